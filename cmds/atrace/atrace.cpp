@@ -16,10 +16,12 @@
 
 #define LOG_TAG "atrace"
 
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <inttypes.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdbool.h>
@@ -27,12 +29,21 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/sendfile.h>
+#include <sys/sysinfo.h>
 #include <time.h>
 #include <unistd.h>
 #include <zlib.h>
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <fstream>
 #include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
 
 #include <binder/IBinder.h>
 #include <binder/IServiceManager.h>
@@ -192,6 +203,42 @@ static const TracingCategory k_categories[] = {
     } },
 };
 
+struct TracingPreset {
+    // The name given to --preset.
+    const char* name;
+
+    // What the preset is meant for.
+    const char* description;
+
+    // The space separated categories the preset enables.  Those the
+    // device doesn't support are left out rather than failing the trace.
+    const char* categories;
+
+    // A rough number of kernel events per second that these categories
+    // produce on each CPU of a busy device, used to size the trace buffer.
+    int eventsPerSecond;
+};
+
+/* Tracing presets */
+static const TracingPreset k_presets[] = {
+    { "jank",       "Dropped frames and input latency",
+      "gfx input view wm am hal res dalvik binder_driver sched freq idle", 4000 },
+    { "startup",    "App startup",
+      "am wm view res dalvik pm ss binder_driver sched freq idle disk", 3000 },
+    { "power",      "CPU frequency, idle states and wakeups",
+      "power sched freq idle irq regulators", 1500 },
+    { "io",         "Storage and memory pressure",
+      "disk mmc memreclaim pagecache sched", 2000 },
+};
+
+/* Trace buffer autosizing */
+// sched_switch, by far the most frequent event, takes 64 bytes in the ring
+// buffer; most of the others are smaller.
+static const int k_bytesPerEvent = 64;
+static const int k_defaultEventsPerSecond = 2000;
+static const int k_minAutoBufferSizeKB = 1024;
+static const int k_maxAutoBufferSizeKB = 64 * 1024;
+
 /* Command line options */
 static int g_traceDurationSeconds = 5;
 static bool g_traceOverwrite = false;
@@ -203,9 +250,10 @@ static const char* g_categoriesFile = NULL;
 static const char* g_kernelTraceFuncs = NULL;
 static const char* g_debugAppCmdLine = "";
 static const char* g_outputFile = nullptr;
+static const TracingPreset* g_preset = nullptr;
 
 /* Global state */
-static bool g_traceAborted = false;
+static std::atomic<bool> g_traceAborted(false);
 static bool g_categoryEnables[NELEM(k_categories)] = {};
 static std::string g_traceFolder;
 
@@ -246,6 +294,9 @@ static const char* k_funcgraphDurationPath =
 static const char* k_ftraceFilterPath =
     "set_ftrace_filter";
 
+static const char* k_setEventPath =
+    "set_event";
+
 static const char* k_tracingOnPath =
     "tracing_on";
 
@@ -258,6 +309,15 @@ static const char* k_traceStreamPath =
 static const char* k_traceMarkerPath =
     "trace_marker";
 
+static const char* k_perCpuRawPathFormat =
+    "per_cpu/cpu%d/trace_pipe_raw";
+
+static const char* k_savedCmdlinesPath =
+    "saved_cmdlines";
+
+static const char* k_savedTgidsPath =
+    "saved_tgids";
+
 // Check whether a file exists.
 static bool fileExists(const char* filename) {
     return access((g_traceFolder + filename).c_str(), F_OK) != -1;
@@ -441,6 +501,24 @@ static bool setTraceBufferSizeKB(int size)
     return writeStr(k_traceBufferSizePath, str);
 }
 
+// Pick a per-CPU trace buffer size that holds |seconds| worth of events at
+// the expected rate, without letting the buffers of all the CPUs together
+// take more than an eighth of the RAM.
+static int autosizeTraceBufferKB(int eventsPerSecond, int seconds)
+{
+    int64_t sizeKB = (int64_t) eventsPerSecond * k_bytesPerEvent * std::max(seconds, 1) / 1024;
+    sizeKB = std::max<int64_t>(sizeKB, k_minAutoBufferSizeKB);
+    sizeKB = std::min<int64_t>(sizeKB, k_maxAutoBufferSizeKB);
+
+    long numCpus = sysconf(_SC_NPROCESSORS_CONF);
+    struct sysinfo info;
+    if (numCpus > 0 && sysinfo(&info) == 0) {
+        int64_t budgetKB = (int64_t) info.totalram * info.mem_unit / 8 / 1024 / numCpus;
+        sizeKB = std::max<int64_t>(std::min(sizeKB, budgetKB), 1);
+    }
+    return sizeKB;
+}
+
 // Set the default size of cmdline hashtable
 static bool setCmdlineSize()
 {
@@ -625,19 +703,103 @@ static bool setAppCmdlineProperty(char* cmdline)
     return true;
 }
 
+// Get the name set_event knows the event of an enable file by:
+// "events/sched/sched_switch/enable" is "sched:sched_switch", and
+// "events/irq/enable" is "irq:*".
+static bool getSetEventName(const std::string& path, std::string* name)
+{
+    static const std::string prefix = "events/";
+    static const std::string suffix = "/enable";
+    if (path.size() <= prefix.size() + suffix.size() ||
+            path.compare(0, prefix.size(), prefix) != 0 ||
+            path.compare(path.size() - suffix.size(), suffix.size(), suffix) != 0) {
+        return false;
+    }
+    *name = path.substr(prefix.size(), path.size() - prefix.size() - suffix.size());
+    size_t slash = name->find('/');
+    if (slash == std::string::npos) {
+        *name += ":*";
+    } else if (name->find('/', slash + 1) == std::string::npos) {
+        (*name)[slash] = ':';
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Apply the enables through set_event: the kernel still takes one event per
+// write, but they all go through a single file descriptor instead of
+// opening every event's enable file, which is what makes starting a trace
+// slow.  Only root can write set_event; returns false if it couldn't be used.
+static bool setKernelTraceEventsBatched(const std::set<std::string>& disables,
+                                        const std::set<std::string>& enables)
+{
+    if (!fileIsWritable(k_setEventPath)) {
+        return false;
+    }
+    std::vector<std::string> commands;
+    std::string name;
+    for (const std::string& path : disables) {
+        if (!getSetEventName(path, &name)) {
+            return false;
+        }
+        commands.push_back("!" + name + "\n");
+    }
+    for (const std::string& path : enables) {
+        if (!getSetEventName(path, &name)) {
+            return false;
+        }
+        commands.push_back(name + "\n");
+    }
+
+    int fd = open((g_traceFolder + k_setEventPath).c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    bool ok = true;
+    for (const std::string& command : commands) {
+        if (!android::base::WriteFully(fd, command.data(), command.size())) {
+            fprintf(stderr, "error writing %s to %s: %s (%d)\n", command.c_str(),
+                    k_setEventPath, strerror(errno), errno);
+            ok = false;
+            break;
+        }
+    }
+    close(fd);
+    return ok;
+}
+
+// Disable the /sys/ enable files in |disables| and then enable those in
+// |enables|, writing each file only once.
+static bool setKernelTraceEvents(const std::set<std::string>& disables,
+                                 const std::set<std::string>& enables)
+{
+    if (setKernelTraceEventsBatched(disables, enables)) {
+        return true;
+    }
+    bool ok = true;
+    for (const std::string& path : disables) {
+        ok &= setKernelOptionEnable(path.c_str(), false);
+    }
+    for (const std::string& path : enables) {
+        ok &= setKernelOptionEnable(path.c_str(), true);
+    }
+    return ok;
+}
+
 // Disable all /sys/ enable files.
 static bool disableKernelTraceEvents() {
-    bool ok = true;
+    std::set<std::string> disables;
     for (int i = 0; i < NELEM(k_categories); i++) {
         const TracingCategory &c = k_categories[i];
         for (int j = 0; j < MAX_SYS_FILES; j++) {
             const char* path = c.sysfiles[j].path;
             if (path != NULL && fileIsWritable(path)) {
-                ok &= setKernelOptionEnable(path, false);
+                disables.insert(path);
             }
         }
     }
-    return ok;
+    return setKernelTraceEvents(disables, {});
 }
 
 // Verify that the comma separated list of functions are being traced by the
@@ -738,6 +900,33 @@ static bool setCategoryEnable(const char* name, bool enable)
     return false;
 }
 
+// Enable the categories of a preset that the device supports.
+static bool setPresetEnable(const char* name)
+{
+    for (int i = 0; i < NELEM(k_presets); i++) {
+        const TracingPreset& p = k_presets[i];
+        if (strcmp(name, p.name) != 0) {
+            continue;
+        }
+        g_preset = &p;
+        char* categories = strdup(p.categories);
+        char* category = strtok(categories, " ");
+        while (category) {
+            for (int j = 0; j < NELEM(k_categories); j++) {
+                if (strcmp(category, k_categories[j].name) == 0 &&
+                        isCategorySupported(k_categories[j])) {
+                    g_categoryEnables[j] = true;
+                }
+            }
+            category = strtok(NULL, " ");
+        }
+        free(categories);
+        return true;
+    }
+    fprintf(stderr, "error: unknown tracing preset \"%s\"\n", name);
+    return false;
+}
+
 static bool setCategoriesEnableFromFile(const char* categories_file)
 {
     if (!categories_file) {
@@ -806,11 +995,10 @@ static bool setUpTrace()
     ok &= pokeBinderServices();
     pokeHalServices();
 
-    // Disable all the sysfs enables.  This is done as a separate loop from
-    // the enables to allow the same enable to exist in multiple categories.
-    ok &= disableKernelTraceEvents();
-
-    // Enable all the sysfs enables that are in an enabled category.
+    // Enable all the sysfs enables that are in an enabled category, and
+    // disable all the others.  The same enable may exist in multiple
+    // categories, so the enables win.
+    std::set<std::string> enables;
     for (int i = 0; i < NELEM(k_categories); i++) {
         if (g_categoryEnables[i]) {
             const TracingCategory &c = k_categories[i];
@@ -819,7 +1007,7 @@ static bool setUpTrace()
                 bool required = c.sysfiles[j].required == REQ;
                 if (path != NULL) {
                     if (fileIsWritable(path)) {
-                        ok &= setKernelOptionEnable(path, true);
+                        enables.insert(path);
                     } else if (required) {
                         fprintf(stderr, "error writing file %s\n", path);
                         ok = false;
@@ -828,6 +1016,17 @@ static bool setUpTrace()
             }
         }
     }
+    std::set<std::string> disables;
+    for (int i = 0; i < NELEM(k_categories); i++) {
+        const TracingCategory &c = k_categories[i];
+        for (int j = 0; j < MAX_SYS_FILES; j++) {
+            const char* path = c.sysfiles[j].path;
+            if (path != NULL && enables.count(path) == 0 && fileIsWritable(path)) {
+                disables.insert(path);
+            }
+        }
+    }
+    ok &= setKernelTraceEvents(disables, enables);
 
     return ok;
 }
@@ -888,6 +1087,364 @@ static void streamTrace()
     }
 }
 
+/*
+ * --stream_raw saves the kernel's binary ring buffer pages rather than the text trace, so the
+ * kernel doesn't have to format every event while tracing. The output is a sequence of records
+ * meant to be converted offline (for example into a trace-cmd .dat file):
+ *
+ *   "ATRACE_RAW 1\n"
+ *   then records of: uint32_t type, uint32_t cpu, uint32_t size, and size bytes of payload.
+ *
+ * RAW_RECORD_FILE payloads are a NUL-terminated path relative to the tracing folder followed by
+ * the contents of that file: the page and event headers and the event formats come first, the
+ * saved cmdlines and tgids last. RAW_RECORD_PAGES payloads are ring buffer pages of one CPU, in
+ * the order they were read. With -z, the whole output is a single zlib stream.
+ */
+static const char k_rawTraceMagic[] = "ATRACE_RAW 1\n";
+
+enum : uint32_t {
+    RAW_RECORD_FILE = 1,
+    RAW_RECORD_PAGES = 2,
+};
+
+struct RawRecordHeader {
+    uint32_t type;
+    uint32_t cpu;
+    uint32_t size;
+};
+
+// Writes the records of a raw trace, either spliced straight into the output or compressed by a
+// thread of its own so that the per-CPU readers never wait on zlib.
+class RawTraceWriter {
+public:
+    RawTraceWriter(int fd, bool compress) : mFd(fd), mCompress(compress) {}
+
+    ~RawTraceWriter() {
+        finish();
+    }
+
+    bool start() {
+        if (mCompress) {
+            memset(&mStream, 0, sizeof(mStream));
+            // Keeping up with the trace matters more than the size of the output.
+            int result = deflateInit(&mStream, Z_BEST_SPEED);
+            if (result != Z_OK) {
+                fprintf(stderr, "error initializing zlib: %d\n", result);
+                return false;
+            }
+            mThread = std::thread(&RawTraceWriter::compressLoop, this);
+        }
+        append(nullptr, k_rawTraceMagic, strlen(k_rawTraceMagic));
+        return !mFailed;
+    }
+
+    void writeRecord(uint32_t type, uint32_t cpu, const void* data, size_t size) {
+        RawRecordHeader header = { type, cpu, static_cast<uint32_t>(size) };
+        append(&header, data, size);
+    }
+
+    // Moves a record of |size| bytes from |pipeFd| into the output.
+    bool spliceRecord(uint32_t cpu, int pipeFd, size_t size) {
+        RawRecordHeader header = { RAW_RECORD_PAGES, cpu, static_cast<uint32_t>(size) };
+        if (mCompress) {
+            std::vector<uint8_t> data(size);
+            size_t done = 0;
+            while (done < size) {
+                ssize_t n = TEMP_FAILURE_RETRY(read(pipeFd, data.data() + done, size - done));
+                if (n <= 0) {
+                    fprintf(stderr, "error reading trace pages: %s (%d)\n", strerror(errno), errno);
+                    return false;
+                }
+                done += n;
+            }
+            append(&header, data.data(), size);
+            return !mFailed;
+        }
+
+        std::lock_guard<std::mutex> lock(mLock);
+        if (!writeFully(&header, sizeof(header))) {
+            return false;
+        }
+        size_t done = 0;
+        while (done < size) {
+            ssize_t n = TEMP_FAILURE_RETRY(splice(pipeFd, NULL, mFd, NULL, size - done,
+                                                  SPLICE_F_MOVE));
+            if (n <= 0) {
+                fprintf(stderr, "error writing trace pages: %s (%d)\n", strerror(errno), errno);
+                mFailed = true;
+                return false;
+            }
+            done += n;
+        }
+        mBytesWritten += sizeof(header) + size;
+        return true;
+    }
+
+    bool finish() {
+        if (mThread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(mLock);
+                mFinishing = true;
+            }
+            mQueued.notify_one();
+            mThread.join();
+            deflateEnd(&mStream);
+        }
+        return !mFailed;
+    }
+
+    uint64_t getBytesWritten() const { return mBytesWritten; }
+
+private:
+    // How much may wait for compression before the readers are held back.
+    static constexpr size_t kMaxQueuedBytes = 32 * 1024 * 1024;
+    static constexpr size_t kOutBufSize = 64 * 1024;
+
+    // Writes a record; |header| may be null for data that isn't one.
+    void append(const RawRecordHeader* header, const void* data, size_t size) {
+        if (!mCompress) {
+            std::lock_guard<std::mutex> lock(mLock);
+            if (header == nullptr || writeFully(header, sizeof(*header))) {
+                if (writeFully(data, size)) {
+                    mBytesWritten += (header != nullptr ? sizeof(*header) : 0) + size;
+                }
+            }
+            return;
+        }
+
+        std::vector<uint8_t> chunk;
+        chunk.reserve((header != nullptr ? sizeof(*header) : 0) + size);
+        if (header != nullptr) {
+            const uint8_t* h = reinterpret_cast<const uint8_t*>(header);
+            chunk.insert(chunk.end(), h, h + sizeof(*header));
+        }
+        const uint8_t* d = reinterpret_cast<const uint8_t*>(data);
+        chunk.insert(chunk.end(), d, d + size);
+
+        std::unique_lock<std::mutex> lock(mLock);
+        const size_t chunkSize = chunk.size();
+        mDrained.wait(lock, [this, chunkSize] {
+            return mQueuedBytes == 0 || mQueuedBytes + chunkSize <= kMaxQueuedBytes;
+        });
+        mQueuedBytes += chunkSize;
+        mQueue.push_back(std::move(chunk));
+        mQueued.notify_one();
+    }
+
+    // Must be called with mLock held.
+    bool writeFully(const void* data, size_t size) {
+        if (mFailed) {
+            return false;
+        }
+        if (!android::base::WriteFully(mFd, data, size)) {
+            fprintf(stderr, "error writing raw trace: %s (%d)\n", strerror(errno), errno);
+            mFailed = true;
+            return false;
+        }
+        return true;
+    }
+
+    void compressLoop() {
+        std::unique_ptr<uint8_t[]> out(new uint8_t[kOutBufSize]);
+        std::unique_lock<std::mutex> lock(mLock);
+        while (true) {
+            mQueued.wait(lock, [this] { return mFinishing || !mQueue.empty(); });
+            bool last = mQueue.empty();
+            std::vector<uint8_t> chunk;
+            if (!last) {
+                chunk = std::move(mQueue.front());
+                mQueue.pop_front();
+            }
+            lock.unlock();
+
+            mStream.next_in = chunk.data();
+            mStream.avail_in = chunk.size();
+            int result;
+            do {
+                mStream.next_out = out.get();
+                mStream.avail_out = kOutBufSize;
+                result = deflate(&mStream, last ? Z_FINISH : Z_NO_FLUSH);
+                size_t bytes = kOutBufSize - mStream.avail_out;
+                if (bytes > 0 && !mFailed) {
+                    if (!android::base::WriteFully(mFd, out.get(), bytes)) {
+                        fprintf(stderr, "error writing deflated trace: %s (%d)\n",
+                                strerror(errno), errno);
+                        mFailed = true;
+                    }
+                    mBytesWritten += bytes;
+                }
+            } while (mStream.avail_out == 0 && result != Z_STREAM_END);
+
+            lock.lock();
+            if (last) {
+                return;
+            }
+            mQueuedBytes -= chunk.size();
+            mDrained.notify_all();
+        }
+    }
+
+    const int mFd;
+    const bool mCompress;
+    std::atomic<bool> mFailed { false };
+    std::atomic<uint64_t> mBytesWritten { 0 };
+
+    std::mutex mLock;
+    std::condition_variable mQueued;
+    std::condition_variable mDrained;
+    // Guarded by mLock.
+    std::deque<std::vector<uint8_t>> mQueue;
+    size_t mQueuedBytes = 0;
+    bool mFinishing = false;
+
+    z_stream mStream;
+    std::thread mThread;
+};
+
+// Adds a file of the tracing folder to the raw trace, if it exists.
+static void writeRawTraceFile(RawTraceWriter* writer, const std::string& path)
+{
+    std::string content;
+    if (!android::base::ReadFileToString(g_traceFolder + path, &content)) {
+        return;
+    }
+    std::string payload = path;
+    payload.push_back('\0');
+    payload.append(content);
+    writer->writeRecord(RAW_RECORD_FILE, 0, payload.data(), payload.size());
+}
+
+// Adds what's needed to parse the ring buffer pages: their layout and every event's format.
+static void writeRawTraceFormats(RawTraceWriter* writer)
+{
+    writeRawTraceFile(writer, "events/header_page");
+    writeRawTraceFile(writer, "events/header_event");
+
+    DIR* events = opendir((g_traceFolder + "events").c_str());
+    if (events == nullptr) {
+        fprintf(stderr, "error opening events: %s (%d)\n", strerror(errno), errno);
+        return;
+    }
+    struct dirent* system;
+    while ((system = readdir(events)) != nullptr) {
+        if (system->d_type != DT_DIR || system->d_name[0] == '.') continue;
+        std::string systemPath = std::string("events/") + system->d_name;
+        DIR* systemDir = opendir((g_traceFolder + systemPath).c_str());
+        if (systemDir == nullptr) continue;
+        struct dirent* event;
+        while ((event = readdir(systemDir)) != nullptr) {
+            if (event->d_type != DT_DIR || event->d_name[0] == '.') continue;
+            writeRawTraceFile(writer, systemPath + "/" + event->d_name + "/format");
+        }
+        closedir(systemDir);
+    }
+    closedir(events);
+}
+
+// Moves one CPU's ring buffer pages into the raw trace until |stop| is set, and then whatever
+// is left in its buffer.
+static void streamRawTraceCpu(int cpu, RawTraceWriter* writer, const std::atomic<bool>* stop)
+{
+    char path[64];
+    snprintf(path, sizeof(path), k_perCpuRawPathFormat, cpu);
+    int traceFD = open((g_traceFolder + path).c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (traceFD == -1) {
+        // CPUs that aren't present don't have a buffer.
+        if (errno != ENOENT) {
+            fprintf(stderr, "error opening %s: %s (%d)\n", path, strerror(errno), errno);
+        }
+        return;
+    }
+    int pipeFDs[2];
+    if (pipe2(pipeFDs, O_CLOEXEC) != 0) {
+        fprintf(stderr, "error creating pipe for cpu %d: %s (%d)\n", cpu, strerror(errno), errno);
+        close(traceFD);
+        return;
+    }
+
+    // splice() only moves whole pages, and at most what fits in the pipe.
+    const size_t pageSize = sysconf(_SC_PAGESIZE);
+    const size_t chunkSize = pageSize * 16;
+    bool draining = false;
+    while (true) {
+        ssize_t n = splice(traceFD, NULL, pipeFDs[1], NULL, chunkSize,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n > 0) {
+            if (!writer->spliceRecord(cpu, pipeFDs[0], n)) {
+                break;
+            }
+            continue;
+        }
+        if (n < 0 && errno != EAGAIN && errno != EINTR) {
+            fprintf(stderr, "error reading %s: %s (%d)\n", path, strerror(errno), errno);
+            break;
+        }
+        if (draining) {
+            break;
+        }
+        if (*stop) {
+            // Tracing is off; empty the buffer and be done.
+            draining = true;
+            continue;
+        }
+        struct pollfd pfd = { traceFD, POLLIN, 0 };
+        poll(&pfd, 1, 100);
+    }
+
+    // The last, partially filled, page can only be read.
+    std::vector<uint8_t> page(pageSize);
+    ssize_t n;
+    while ((n = TEMP_FAILURE_RETRY(read(traceFD, page.data(), page.size()))) > 0) {
+        writer->writeRecord(RAW_RECORD_PAGES, cpu, page.data(), n);
+    }
+
+    close(pipeFDs[0]);
+    close(pipeFDs[1]);
+    close(traceFD);
+}
+
+// Stream the binary per-CPU buffers to the output file until interrupted.
+static void streamRawTrace()
+{
+    int outFd = open(g_outputFile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (outFd == -1) {
+        fprintf(stderr, "error opening %s: %s (%d)\n", g_outputFile, strerror(errno), errno);
+        return;
+    }
+
+    nsecs_t start = systemTime();
+    {
+        RawTraceWriter writer(outFd, g_compress);
+        if (writer.start()) {
+            writeRawTraceFormats(&writer);
+
+            std::atomic<bool> stop(false);
+            std::vector<std::thread> readers;
+            int numCpus = sysconf(_SC_NPROCESSORS_CONF);
+            for (int cpu = 0; cpu < numCpus; cpu++) {
+                readers.emplace_back(streamRawTraceCpu, cpu, &writer, &stop);
+            }
+            while (!g_traceAborted) {
+                usleep(100 * 1000);
+            }
+            // Nothing gets added to the buffers while the readers empty them.
+            setTracingEnabled(false);
+            stop = true;
+            for (auto& reader : readers) {
+                reader.join();
+            }
+
+            writeRawTraceFile(&writer, k_savedCmdlinesPath);
+            writeRawTraceFile(&writer, k_savedTgidsPath);
+        }
+        if (writer.finish()) {
+            fprintf(stderr, "wrote %" PRIu64 " bytes of raw trace in %.3fs\n",
+                    writer.getBytesWritten(), (systemTime() - start) / 1e9);
+        }
+    }
+    close(outFd);
+}
+
 // Read the current kernel trace and write it to stdout.
 static void dumpTrace(int outFd)
 {
@@ -1023,7 +1580,9 @@ static void showHelp(const char *cmd)
     fprintf(stderr, "options include:\n"
                     "  -a appname      enable app-level tracing for a comma "
                         "separated list of cmdlines\n"
-                    "  -b N            use a trace buffer size of N KB\n"
+                    "  -b N            use a trace buffer size of N KB per CPU, or 'auto' to\n"
+                    "                    size it from the duration and the expected event\n"
+                    "                    rate [default 2048, auto with --preset]\n"
                     "  -c              trace into a circular buffer\n"
                     "  -f filename     use the categories written in a file as space-separated\n"
                     "                    values in a line\n"
@@ -1040,11 +1599,20 @@ static void showHelp(const char *cmd)
                     "                    Note: this can take significant CPU time, and is best\n"
                     "                    used for measuring things that are not affected by\n"
                     "                    CPU performance, like pagecache usage.\n"
+                    "  --stream_raw    stream the binary per-CPU trace buffers to the file\n"
+                    "                    given with -o until interrupted, to be converted\n"
+                    "                    offline; much cheaper than --stream. Compressed\n"
+                    "                    with -z.\n"
+                    "  --preset name   enable the categories of a preset (see below)\n"
                     "  --list_categories\n"
                     "                  list the available tracing categories\n"
                     " -o filename      write the trace to the specified file instead\n"
                     "                    of stdout.\n"
             );
+    fprintf(stderr, "presets:\n");
+    for (int i = 0; i < NELEM(k_presets); i++) {
+        fprintf(stderr, "  %10s - %s\n", k_presets[i].name, k_presets[i].description);
+    }
 }
 
 bool findTraceFiles()
@@ -1077,6 +1645,9 @@ int main(int argc, char **argv)
     bool traceStop = true;
     bool traceDump = true;
     bool traceStream = false;
+    bool traceStreamRaw = false;
+    bool autoBufferSize = false;
+    bool bufferSizeGiven = false;
 
     if (argc == 2 && 0 == strcmp(argv[1], "--help")) {
         showHelp(argv[0]);
@@ -1097,6 +1668,8 @@ int main(int argc, char **argv)
             {"async_dump",      no_argument, 0,  0 },
             {"list_categories", no_argument, 0,  0 },
             {"stream",          no_argument, 0,  0 },
+            {"stream_raw",      no_argument, 0,  0 },
+            {"preset",    required_argument, 0,  0 },
             {           0,                0, 0,  0 }
         };
 
@@ -1119,7 +1692,12 @@ int main(int argc, char **argv)
             break;
 
             case 'b':
-                g_traceBufferSizeKB = atoi(optarg);
+                bufferSizeGiven = true;
+                if (!strcmp(optarg, "auto")) {
+                    autoBufferSize = true;
+                } else {
+                    g_traceBufferSizeKB = atoi(optarg);
+                }
             break;
 
             case 'c':
@@ -1170,6 +1748,13 @@ int main(int argc, char **argv)
                 } else if (!strcmp(long_options[option_index].name, "stream")) {
                     traceStream = true;
                     traceDump = false;
+                } else if (!strcmp(long_options[option_index].name, "stream_raw")) {
+                    traceStreamRaw = true;
+                    traceDump = false;
+                } else if (!strcmp(long_options[option_index].name, "preset")) {
+                    if (!setPresetEnable(optarg)) {
+                        exit(1);
+                    }
                 } else if (!strcmp(long_options[option_index].name, "list_categories")) {
                     listSupportedCategories();
                     exit(0);
@@ -1184,6 +1769,20 @@ int main(int argc, char **argv)
         }
     }
 
+    if (traceStreamRaw && g_outputFile == nullptr) {
+        fprintf(stderr, "--stream_raw needs an output file (-o)\n");
+        exit(-1);
+    }
+
+    if (autoBufferSize || (g_preset != nullptr && !bufferSizeGiven)) {
+        int eventsPerSecond = g_preset != nullptr ? g_preset->eventsPerSecond
+                                                  : k_defaultEventsPerSecond;
+        // When streaming, the buffer only has to hold what the reader hasn't
+        // caught up with yet.
+        int seconds = (traceStream || traceStreamRaw) ? 1 : g_traceDurationSeconds;
+        g_traceBufferSizeKB = autosizeTraceBufferKB(eventsPerSecond, seconds);
+    }
+
     registerSigHandler();
 
     if (g_initialSleepSecs > 0) {
@@ -1208,7 +1807,7 @@ int main(int argc, char **argv)
         ok = clearTrace();
 
         writeClockSyncMarker();
-        if (ok && !async && !traceStream) {
+        if (ok && !async && !traceStream && !traceStreamRaw) {
             // Sleep to allow the trace to be captured.
             struct timespec timeLeft;
             timeLeft.tv_sec = g_traceDurationSeconds;
@@ -1222,6 +1821,8 @@ int main(int argc, char **argv)
 
         if (traceStream) {
             streamTrace();
+        } else if (traceStreamRaw) {
+            streamRawTrace();
         }
     }
 
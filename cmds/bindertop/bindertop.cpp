@@ -0,0 +1,542 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * bindertop: which processes make binder calls to which, how often, with how
+ * much data and how long the calls take.
+ *
+ * The calls are seen through the binder_transaction and
+ * binder_transaction_alloc_buf tracepoints, in a tracing instance of its own
+ * so that a concurrent atrace or systrace isn't disturbed. A call's latency
+ * is the time until the reply to the calling thread; oneway calls have none.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/stringprintf.h>
+#include <android-base/strings.h>
+#include <binder/IBinder.h>
+#include <binder/IServiceManager.h>
+#include <binder/Parcel.h>
+#include <binder/ProcessState.h>
+#include <utils/String16.h>
+
+using namespace android;
+using android::base::StringPrintf;
+
+static const char* k_tracingRoots[] = {
+    "/sys/kernel/tracing/",
+    "/sys/kernel/debug/tracing/",
+};
+static const char* k_instancePath = "instances/bindertop";
+static const char* k_printTgidPath = "options/print-tgid";
+static const char* k_events[] = {
+    "events/binder/binder_transaction/enable",
+    "events/binder/binder_transaction_alloc_buf/enable",
+};
+
+// From the binder UAPI; the tracepoint reports the raw flags.
+static const uint32_t k_oneWayFlag = 0x01;
+
+// Limits on the bookkeeping of calls whose reply or buffer was never seen,
+// e.g. because the trace buffer overflowed.
+static const size_t k_maxPendingCalls = 64;
+static const size_t k_maxPendingTransactions = 16 * 1024;
+
+static volatile sig_atomic_t g_stop = 0;
+
+static void handleSignal(int /*signo*/) {
+    g_stop = 1;
+}
+
+// Client and server process.
+typedef std::pair<pid_t, pid_t> PairKey;
+
+struct PairStats {
+    uint64_t calls = 0;
+    uint64_t oneWayCalls = 0;
+    uint64_t bytes = 0;
+    // Latency of the calls whose reply was seen.
+    uint64_t replies = 0;
+    uint64_t totalLatencyNs = 0;
+    uint64_t maxLatencyNs = 0;
+};
+
+typedef std::map<PairKey, PairStats> Matrix;
+
+class Collector {
+  public:
+    // Accounts for one line of the text trace.
+    void processLine(const std::string& line);
+
+    // Returns what was counted since the last call, and starts over.
+    Matrix takeStats() {
+        Matrix stats;
+        std::swap(stats, mStats);
+        return stats;
+    }
+
+  private:
+    struct PendingCall {
+        uint64_t timestampNs;
+        PairKey key;
+    };
+
+    void processTransaction(pid_t tid, pid_t tgid, uint64_t timestampNs, const char* args);
+    void processAllocBuf(const char* args);
+    pid_t getTgid(pid_t tid);
+
+    Matrix mStats;
+    // The calls each thread is waiting for a reply to, innermost last.
+    std::unordered_map<pid_t, std::vector<PendingCall>> mPendingCalls;
+    // Transactions whose buffer size hasn't been reported yet.
+    std::unordered_map<int, PairKey> mPendingTransactions;
+    std::unordered_map<pid_t, pid_t> mTgids;
+};
+
+pid_t Collector::getTgid(pid_t tid) {
+    auto it = mTgids.find(tid);
+    if (it != mTgids.end()) {
+        return it->second;
+    }
+    pid_t tgid = tid;
+    std::string status;
+    if (android::base::ReadFileToString(StringPrintf("/proc/%d/status", tid), &status)) {
+        size_t pos = status.find("\nTgid:");
+        if (pos != std::string::npos) {
+            tgid = atoi(status.c_str() + pos + strlen("\nTgid:"));
+        }
+    }
+    mTgids[tid] = tgid;
+    return tgid;
+}
+
+void Collector::processLine(const std::string& line) {
+    // "  <comm>-<tid> [(<tgid>)] [<cpu>] <flags> <secs>.<usecs>: <event>: <args>"
+    size_t event = line.find(": binder_transaction");
+    if (event == std::string::npos) {
+        return;
+    }
+    size_t timestamp = event;
+    while (timestamp > 0 && (isdigit(line[timestamp - 1]) || line[timestamp - 1] == '.')) {
+        timestamp--;
+    }
+    uint64_t secs, usecs;
+    if (sscanf(line.c_str() + timestamp, "%" SCNu64 ".%" SCNu64, &secs, &usecs) != 2) {
+        return;
+    }
+    const uint64_t timestampNs = secs * 1000000000 + usecs * 1000;
+
+    const char* name = line.c_str() + event + 2;
+    const char* args = strchr(name, ':');
+    if (args == nullptr) {
+        return;
+    }
+    args += 2;
+    if (!strncmp(name, "binder_transaction_alloc_buf:", strlen("binder_transaction_alloc_buf:"))) {
+        processAllocBuf(args);
+        return;
+    }
+    if (strncmp(name, "binder_transaction:", strlen("binder_transaction:"))) {
+        return;
+    }
+
+    // The tid ends the task name, which is followed by the tgid when
+    // options/print-tgid is set, and then the cpu.
+    size_t cpu = line.rfind('[', timestamp);
+    if (cpu == std::string::npos || cpu == 0) {
+        return;
+    }
+    pid_t tgid = 0;
+    size_t end = line.find_last_not_of(' ', cpu - 1);
+    if (end != std::string::npos && line[end] == ')') {
+        size_t open = line.rfind('(', end);
+        if (open == std::string::npos || open == 0) {
+            return;
+        }
+        tgid = atoi(line.c_str() + open + 1);
+        end = line.find_last_not_of(' ', open - 1);
+    }
+    if (end == std::string::npos) {
+        return;
+    }
+    size_t start = end + 1;
+    while (start > 0 && isdigit(line[start - 1])) {
+        start--;
+    }
+    if (start == 0 || start > end || line[start - 1] != '-') {
+        return;
+    }
+    processTransaction(atoi(line.c_str() + start), tgid, timestampNs, args);
+}
+
+void Collector::processTransaction(pid_t tid, pid_t tgid, uint64_t timestampNs,
+                                   const char* args) {
+    int transaction;
+    int destNode, destProc, destThread, reply;
+    uint32_t flags;
+    if (sscanf(args, "transaction=%d dest_node=%d dest_proc=%d dest_thread=%d reply=%d flags=%x",
+               &transaction, &destNode, &destProc, &destThread, &reply, &flags) != 6) {
+        return;
+    }
+    if (mPendingTransactions.size() >= k_maxPendingTransactions) {
+        mPendingTransactions.clear();
+    }
+
+    const pid_t sender = tgid > 0 ? tgid : getTgid(tid);
+    if (!reply) {
+        const PairKey key(sender, destProc);
+        PairStats& stats = mStats[key];
+        stats.calls++;
+        if (flags & k_oneWayFlag) {
+            stats.oneWayCalls++;
+        } else {
+            std::vector<PendingCall>& calls = mPendingCalls[tid];
+            if (calls.size() >= k_maxPendingCalls) {
+                calls.clear();
+            }
+            calls.push_back({timestampNs, key});
+        }
+        mPendingTransactions[transaction] = key;
+        return;
+    }
+
+    // A reply goes back to the thread that made the call.
+    auto it = mPendingCalls.find(destThread);
+    if (it == mPendingCalls.end() || it->second.empty()) {
+        mPendingTransactions[transaction] = PairKey(destProc, sender);
+        return;
+    }
+    const PendingCall call = it->second.back();
+    it->second.pop_back();
+    if (it->second.empty()) {
+        mPendingCalls.erase(it);
+    }
+    mPendingTransactions[transaction] = call.key;
+    if (timestampNs < call.timestampNs) {
+        return;
+    }
+    const uint64_t latencyNs = timestampNs - call.timestampNs;
+    PairStats& stats = mStats[call.key];
+    stats.replies++;
+    stats.totalLatencyNs += latencyNs;
+    stats.maxLatencyNs = std::max(stats.maxLatencyNs, latencyNs);
+}
+
+void Collector::processAllocBuf(const char* args) {
+    int transaction;
+    uint64_t dataSize, offsetsSize;
+    if (sscanf(args, "transaction=%d data_size=%" SCNu64 " offsets_size=%" SCNu64,
+               &transaction, &dataSize, &offsetsSize) != 3) {
+        return;
+    }
+    auto it = mPendingTransactions.find(transaction);
+    if (it == mPendingTransactions.end()) {
+        return;
+    }
+    // Replies count towards the pair of the call they answer.
+    mStats[it->second].bytes += dataSize + offsetsSize;
+    mPendingTransactions.erase(it);
+}
+
+// Returns the name a process was started with, cached, or its pid once it's
+// gone.
+static const std::string& getProcessName(pid_t pid) {
+    static std::unordered_map<pid_t, std::string> names;
+    auto it = names.find(pid);
+    if (it != names.end()) {
+        return it->second;
+    }
+    std::string cmdline;
+    android::base::ReadFileToString(StringPrintf("/proc/%d/cmdline", pid), &cmdline);
+    cmdline = cmdline.c_str();  // Just argv[0].
+    if (cmdline.empty()) {
+        android::base::ReadFileToString(StringPrintf("/proc/%d/comm", pid), &cmdline);
+        cmdline = android::base::Trim(cmdline);
+    }
+    if (cmdline.empty()) {
+        cmdline = StringPrintf("<%d>", pid);
+    } else {
+        cmdline = StringPrintf("%s/%d", cmdline.c_str(), pid);
+    }
+    return names[pid] = cmdline;
+}
+
+static void printReport(FILE* out, const Matrix& stats, double seconds, size_t topCount) {
+    seconds = std::max(seconds, 0.001);
+    std::vector<Matrix::const_iterator> sorted;
+    PairStats total;
+    for (auto it = stats.begin(); it != stats.end(); ++it) {
+        sorted.push_back(it);
+        total.calls += it->second.calls;
+        total.bytes += it->second.bytes;
+    }
+    std::stable_sort(sorted.begin(), sorted.end(),
+                     [](Matrix::const_iterator lhs, Matrix::const_iterator rhs) {
+                         return lhs->second.calls > rhs->second.calls;
+                     });
+
+    fprintf(out, "%.1fs: %.1f calls/s, %.1f KB/s between %zu client/server pairs\n", seconds,
+            total.calls / seconds, total.bytes / seconds / 1024, stats.size());
+    fprintf(out, "%9s %9s %7s %10s %10s  %s\n", "CALLS/S", "KB/S", "ONEWAY", "AVG LAT", "MAX LAT",
+            "CLIENT -> SERVER");
+    for (size_t i = 0; i < sorted.size() && i < topCount; i++) {
+        const PairKey& key = sorted[i]->first;
+        const PairStats& pair = sorted[i]->second;
+        std::string avgLatency = "-";
+        std::string maxLatency = "-";
+        if (pair.replies > 0) {
+            avgLatency = StringPrintf("%.0fus", pair.totalLatencyNs / 1000.0 / pair.replies);
+            maxLatency = StringPrintf("%.0fus", pair.maxLatencyNs / 1000.0);
+        }
+        // Pairs seen only through replies to calls made before the period.
+        const uint64_t oneWayPercent = pair.calls ? pair.oneWayCalls * 100 / pair.calls : 0;
+        fprintf(out, "%9.1f %9.1f %6" PRIu64 "%% %10s %10s  %s -> %s\n", pair.calls / seconds,
+                pair.bytes / seconds / 1024, oneWayPercent,
+                avgLatency.c_str(), maxLatency.c_str(), getProcessName(key.first).c_str(),
+                getProcessName(key.second).c_str());
+    }
+}
+
+// Appends the per-interface counters kept by the process hosting |name|
+// (see binder/TransactionStats.h), if it's recording them.
+static void printServiceStats(FILE* out, const char* name) {
+    sp<IBinder> service = defaultServiceManager()->checkService(String16(name));
+    if (service == nullptr) {
+        fprintf(out, "Can't find service: %s\n", name);
+        return;
+    }
+    fprintf(out, "Interfaces of the process hosting %s:\n", name);
+    fflush(out);
+    Parcel data, reply;
+    data.writeFileDescriptor(fileno(out));
+    data.writeInt32(0 /* reset */);
+    status_t err = service->transact(IBinder::TRANSACTION_STATS_TRANSACTION, data, &reply);
+    if (err != NO_ERROR) {
+        fprintf(out, "Can't get the stats of %s: %s\n", name, strerror(-err));
+    }
+}
+
+static bool writeTraceFile(const std::string& path, const char* value) {
+    if (!android::base::WriteStringToFile(value, path)) {
+        fprintf(stderr, "error writing %s: %s (%d)\n", path.c_str(), strerror(errno), errno);
+        return false;
+    }
+    return true;
+}
+
+static std::string setUpInstance(int bufferSizeKB) {
+    std::string root;
+    for (const char* path : k_tracingRoots) {
+        if (access((std::string(path) + "instances").c_str(), F_OK) == 0) {
+            root = path;
+            break;
+        }
+    }
+    if (root.empty()) {
+        fprintf(stderr, "No tracing instances found; is tracefs mounted?\n");
+        return "";
+    }
+    std::string instance = root + k_instancePath + "/";
+    if (mkdir(instance.c_str(), 0700) != 0 && errno != EEXIST) {
+        fprintf(stderr, "error creating %s: %s (%d)\n", instance.c_str(), strerror(errno),
+                errno);
+        return "";
+    }
+    bool ok = writeTraceFile(instance + "buffer_size_kb", std::to_string(bufferSizeKB).c_str());
+    for (const char* event : k_events) {
+        ok &= writeTraceFile(instance + event, "1");
+    }
+    // Saves looking the process of every thread up, where the kernel can
+    // print it.
+    if (access((instance + k_printTgidPath).c_str(), W_OK) == 0) {
+        writeTraceFile(instance + k_printTgidPath, "1");
+    }
+    ok &= writeTraceFile(instance + "tracing_on", "1");
+    return ok ? instance : "";
+}
+
+static void cleanUpInstance(const std::string& instance) {
+    writeTraceFile(instance + "tracing_on", "0");
+    for (const char* event : k_events) {
+        writeTraceFile(instance + event, "0");
+    }
+    rmdir(instance.c_str());
+}
+
+static uint64_t uptimeNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void usage() {
+    fprintf(stderr,
+            "usage: bindertop [-i SECONDS | -t SECONDS] [-n COUNT] [-o FILE] [-b KB]\n"
+            "                 [--stats SERVICE]...\n"
+            "  Shows which processes make binder calls to which: calls per second, KB\n"
+            "  per second, the share of oneway calls and the latency of the others.\n"
+            "  -i SECONDS: refresh the live view this often [default 2]\n"
+            "  -t SECONDS: capture for this long, then print a single report\n"
+            "  -n COUNT: show the busiest COUNT pairs [default 20]\n"
+            "  -o FILE: write the reports to FILE instead of stdout\n"
+            "  -b KB: per-CPU trace buffer size [default 4096]\n"
+            "  --stats SERVICE: also print the per-interface counters of the process\n"
+            "      hosting SERVICE; it must record them (binder.transaction_stats=1)\n");
+}
+
+int main(int argc, char* const argv[]) {
+    double interval = 2;
+    double captureSeconds = 0;
+    size_t topCount = 20;
+    int bufferSizeKB = 4096;
+    const char* outputPath = nullptr;
+    std::vector<const char*> statsServices;
+
+    static struct option longOptions[] = {
+        {"stats", required_argument, 0, 's'},
+        {0, 0, 0, 0},
+    };
+    int c;
+    while ((c = getopt_long(argc, argv, "i:t:n:o:b:h", longOptions, nullptr)) != -1) {
+        switch (c) {
+            case 'i':
+                interval = atof(optarg);
+                break;
+            case 't':
+                captureSeconds = atof(optarg);
+                break;
+            case 'n':
+                topCount = atoi(optarg);
+                break;
+            case 'o':
+                outputPath = optarg;
+                break;
+            case 'b':
+                bufferSizeKB = atoi(optarg);
+                break;
+            case 's':
+                statsServices.push_back(optarg);
+                break;
+            default:
+                usage();
+                return c == 'h' ? 0 : 1;
+        }
+    }
+    if (optind < argc || interval <= 0 || captureSeconds < 0 || bufferSizeKB <= 0) {
+        usage();
+        return 1;
+    }
+
+    FILE* out = stdout;
+    if (outputPath != nullptr) {
+        out = fopen(outputPath, "we");
+        if (out == nullptr) {
+            fprintf(stderr, "error opening %s: %s (%d)\n", outputPath, strerror(errno), errno);
+            return 1;
+        }
+    }
+    if (!statsServices.empty()) {
+        ProcessState::self()->startThreadPool();
+    }
+
+    std::string instance = setUpInstance(bufferSizeKB);
+    if (instance.empty()) {
+        return 1;
+    }
+    int traceFd = open((instance + "trace_pipe").c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (traceFd == -1) {
+        fprintf(stderr, "error opening %strace_pipe: %s (%d)\n", instance.c_str(),
+                strerror(errno), errno);
+        cleanUpInstance(instance);
+        return 1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handleSignal;
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+    sigaction(SIGHUP, &sa, nullptr);
+
+    const bool capture = captureSeconds > 0;
+    const uint64_t periodNs = (capture ? captureSeconds : interval) * 1e9;
+    Collector collector;
+    std::string pending;
+    char buffer[64 * 1024];
+    uint64_t periodStart = uptimeNs();
+    while (true) {
+        const uint64_t now = uptimeNs();
+        if (g_stop || now - periodStart >= periodNs) {
+            printReport(out, collector.takeStats(), (now - periodStart) / 1e9, topCount);
+            for (const char* service : statsServices) {
+                printServiceStats(out, service);
+            }
+            fprintf(out, "\n");
+            fflush(out);
+            if (g_stop || capture) {
+                break;
+            }
+            periodStart = now;
+            continue;
+        }
+
+        struct pollfd pfd = {traceFd, POLLIN, 0};
+        int timeoutMs = (periodStart + periodNs - now) / 1000000 + 1;
+        if (poll(&pfd, 1, timeoutMs) <= 0) {
+            continue;
+        }
+        // One read at a time, so a busy trace can't hold back the reports.
+        ssize_t n = read(traceFd, buffer, sizeof(buffer));
+        if (n <= 0) {
+            continue;
+        }
+        pending.append(buffer, n);
+        size_t start = 0;
+        size_t newline;
+        while ((newline = pending.find('\n', start)) != std::string::npos) {
+            collector.processLine(pending.substr(start, newline - start));
+            start = newline + 1;
+        }
+        pending.erase(0, start);
+    }
+
+    close(traceFd);
+    cleanUpInstance(instance);
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
@@ -12,7 +12,9 @@ COMMON_ZIP_LIBRARIES := libziparchive libz libcrypto
 COMMON_LOCAL_CFLAGS := \
        -Wall -Werror -Wno-missing-field-initializers -Wno-unused-variable -Wunused-parameter
 COMMON_SRC_FILES := \
+        DumpPool.cpp \
         DumpstateInternal.cpp \
+        ZipWriterQueue.cpp \
         utils.cpp
 COMMON_SHARED_LIBRARIES := \
         android.hardware.dumpstate@1.0 \
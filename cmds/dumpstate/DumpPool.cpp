@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "dumpstate"
+
+#include "DumpPool.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include <android-base/file.h>
+#include <cutils/log.h>
+
+#include "DumpstateInternal.h"
+
+namespace android {
+namespace os {
+namespace dumpstate {
+
+DumpPool::DumpPool(const std::string& tmp_dir, size_t num_threads) : tmp_dir_(tmp_dir) {
+    if (tmp_dir_.empty()) {
+        return;
+    }
+    for (size_t i = 0; i < num_threads; i++) {
+        threads_.emplace_back(&DumpPool::ThreadMain, this);
+    }
+}
+
+DumpPool::~DumpPool() {
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        exiting_ = true;
+        pending_.clear();
+        for (const auto& it : tasks_) {
+            MYLOGE("Discarding section '%s', which was never waited for\n", it.first.c_str());
+        }
+    }
+    work_.notify_all();
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+}
+
+int DumpPool::CreateTempFile() const {
+    std::string path = tmp_dir_ + "/dumpstate-section-XXXXXX";
+    int fd = TEMP_FAILURE_RETRY(mkostemp(&path[0], O_CLOEXEC));
+    if (fd < 0) {
+        MYLOGE("Could not create a temporary file in %s: %s\n", tmp_dir_.c_str(), strerror(errno));
+        return -1;
+    }
+    unlink(path.c_str());
+    return fd;
+}
+
+void DumpPool::EnqueueTask(const std::string& name, std::function<void(int)> task) {
+    auto entry = std::make_shared<Task>();
+    entry->run = std::move(task);
+    if (!threads_.empty()) {
+        entry->output.reset(CreateTempFile());
+    }
+
+    std::lock_guard<std::mutex> lock(lock_);
+    if (tasks_.count(name) != 0) {
+        MYLOGE("Section '%s' was already enqueued\n", name.c_str());
+        return;
+    }
+    tasks_[name] = entry;
+    // Without a file to write to, the section is run by whoever waits for it.
+    if (entry->output.get() >= 0) {
+        pending_.push_back(entry);
+        work_.notify_one();
+    }
+}
+
+bool DumpPool::WaitForTask(const std::string& name, int out_fd) {
+    std::shared_ptr<Task> task;
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        auto it = tasks_.find(name);
+        if (it == tasks_.end()) {
+            MYLOGE("No section '%s' to wait for\n", name.c_str());
+            return false;
+        }
+        task = it->second;
+        tasks_.erase(it);
+        if (task->started) {
+            done_.wait(lock, [&task] { return task->done; });
+        } else {
+            // Nobody got to it yet; it's quicker to run it here than to wait for a thread.
+            task->started = true;
+            pending_.erase(std::remove(pending_.begin(), pending_.end(), task), pending_.end());
+        }
+    }
+
+    if (!task->done) {
+        task->run(out_fd);
+        return true;
+    }
+
+    int fd = task->output.get();
+    if (lseek(fd, 0, SEEK_SET) != 0) {
+        MYLOGE("Could not rewind output of section '%s': %s\n", name.c_str(), strerror(errno));
+        return true;
+    }
+    char buffer[65536];
+    ssize_t bytes_read;
+    while ((bytes_read = TEMP_FAILURE_RETRY(read(fd, buffer, sizeof(buffer)))) > 0) {
+        if (!android::base::WriteFully(out_fd, buffer, bytes_read)) {
+            MYLOGE("Could not copy output of section '%s': %s\n", name.c_str(), strerror(errno));
+            break;
+        }
+    }
+    if (bytes_read < 0) {
+        MYLOGE("Could not read output of section '%s': %s\n", name.c_str(), strerror(errno));
+    }
+    return true;
+}
+
+void DumpPool::ThreadMain() {
+    std::unique_lock<std::mutex> lock(lock_);
+    while (true) {
+        work_.wait(lock, [this] { return exiting_ || !pending_.empty(); });
+        if (exiting_) {
+            return;
+        }
+        std::shared_ptr<Task> task = pending_.front();
+        pending_.pop_front();
+        task->started = true;
+        lock.unlock();
+        task->run(task->output.get());
+        lock.lock();
+        task->done = true;
+        done_.notify_all();
+    }
+}
+
+}  // namespace dumpstate
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef ANDROID_OS_DUMPSTATE_DUMP_POOL_H_
+#define ANDROID_OS_DUMPSTATE_DUMP_POOL_H_
+
+#include <unistd.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android-base/macros.h>
+#include <android-base/unique_fd.h>
+
+namespace android {
+namespace os {
+namespace dumpstate {
+
+/*
+ * Runs independent bugreport sections on a bounded pool of threads.
+ *
+ * Each section writes to its own temporary file instead of the bugreport, and its output is only
+ * copied to the bugreport when the main thread reaches the point where the section used to run,
+ * so the final text is in the same order no matter how the sections were scheduled.
+ *
+ * Typical usage:
+ *
+ *    pool.EnqueueTask("DUMPSYS", [](int out_fd) { ... write to out_fd ... });
+ *    ... other sections ...
+ *    pool.WaitForTask("DUMPSYS");
+ *
+ * A section that can't be given a temporary file, or that hasn't started by the time it's waited
+ * for, simply runs on the calling thread, writing directly to the output.
+ */
+class DumpPool {
+  public:
+    /*
+     * |tmp_dir| directory where the sections' temporary files are created (they are unlinked
+     * right away).
+     * |num_threads| how many sections may run at once; 0 runs every section on the thread that
+     * waits for it.
+     */
+    DumpPool(const std::string& tmp_dir, size_t num_threads);
+
+    // Waits for the sections already running; those never waited for are discarded.
+    ~DumpPool();
+
+    /*
+     * Queues a section; |task| is called with the fd it should write its output to.
+     * |name| must be unique, and is what the section is waited for by.
+     */
+    void EnqueueTask(const std::string& name, std::function<void(int)> task);
+
+    /*
+     * Waits for the section enqueued as |name| to finish and copies its output to |out_fd|.
+     * Returns false if there's no such section.
+     */
+    bool WaitForTask(const std::string& name, int out_fd = STDOUT_FILENO);
+
+  private:
+    struct Task {
+        std::function<void(int)> run;
+        android::base::unique_fd output;
+        bool started = false;
+        bool done = false;
+    };
+
+    void ThreadMain();
+    int CreateTempFile() const;
+
+    const std::string tmp_dir_;
+
+    std::mutex lock_;
+    std::condition_variable work_;
+    std::condition_variable done_;
+    // Guarded by lock_.
+    std::map<std::string, std::shared_ptr<Task>> tasks_;
+    std::deque<std::shared_ptr<Task>> pending_;
+    bool exiting_ = false;
+
+    std::vector<std::thread> threads_;
+
+    DISALLOW_COPY_AND_ASSIGN(DumpPool);
+};
+
+}  // namespace dumpstate
+}  // namespace os
+}  // namespace android
+
+#endif  // ANDROID_OS_DUMPSTATE_DUMP_POOL_H_
@@ -21,9 +21,11 @@
 #include <dirent.h>
 #include <fcntl.h>
 #include <sys/prctl.h>
+#include <sys/resource.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <vector>
 
 #include <android-base/file.h>
@@ -42,7 +44,11 @@ namespace {
 
 static constexpr const char* kSuPath = "/system/xbin/su";
 
-static bool waitpid_with_timeout(pid_t pid, int timeout_seconds, int* status) {
+// Longest a command's parent sleeps between checks on whether it exited.
+static constexpr uint64_t kChildPollSliceNs = 50 * 1000 * 1000;
+
+static bool waitpid_with_timeout(pid_t pid, int timeout_seconds, int* status,
+                                 struct rusage* usage = nullptr) {
     sigset_t child_mask, old_mask;
     sigemptyset(&child_mask);
     sigaddset(&child_mask, SIGCHLD);
@@ -52,38 +58,46 @@ static bool waitpid_with_timeout(pid_t pid, int timeout_seconds, int* status) {
         return false;
     }
 
-    timespec ts;
-    ts.tv_sec = timeout_seconds;
-    ts.tv_nsec = 0;
-    int ret = TEMP_FAILURE_RETRY(sigtimedwait(&child_mask, NULL, &ts));
-    int saved_errno = errno;
+    // Sections can run commands from several threads at once, and any of them may be the one
+    // to consume a SIGCHLD, so it only means "check again": the child is always polled, and
+    // never waited on for more than a short slice at a time.
+    uint64_t deadline = Nanotime() + static_cast<uint64_t>(timeout_seconds) * NANOS_PER_SEC;
+    bool ret = false;
+    int saved_errno = 0;
+    while (true) {
+        pid_t child_pid = wait4(pid, status, WNOHANG, usage);
+        if (child_pid == pid) {
+            ret = true;
+            break;
+        }
+        if (child_pid != 0) {
+            saved_errno = errno;
+            printf("*** waitpid failed: %s\n", strerror(errno));
+            break;
+        }
+        uint64_t now = Nanotime();
+        if (now >= deadline) {
+            saved_errno = ETIMEDOUT;
+            break;
+        }
+        uint64_t slice = std::min(deadline - now, kChildPollSliceNs);
+        timespec ts;
+        ts.tv_sec = slice / NANOS_PER_SEC;
+        ts.tv_nsec = slice % NANOS_PER_SEC;
+        if (sigtimedwait(&child_mask, NULL, &ts) == -1 && errno != EAGAIN && errno != EINTR) {
+            saved_errno = errno;
+            printf("*** sigtimedwait failed: %s\n", strerror(errno));
+            break;
+        }
+    }
     // Set the signals back the way they were.
     if (sigprocmask(SIG_SETMASK, &old_mask, NULL) == -1) {
         printf("*** sigprocmask failed: %s\n", strerror(errno));
-        if (ret == 0) {
-            return false;
-        }
     }
-    if (ret == -1) {
+    if (!ret) {
         errno = saved_errno;
-        if (errno == EAGAIN) {
-            errno = ETIMEDOUT;
-        } else {
-            printf("*** sigtimedwait failed: %s\n", strerror(errno));
-        }
-        return false;
     }
-
-    pid_t child_pid = waitpid(pid, status, WNOHANG);
-    if (child_pid != pid) {
-        if (child_pid != -1) {
-            printf("*** Waiting for pid %d, got pid %d instead\n", pid, child_pid);
-        } else {
-            printf("*** waitpid failed: %s\n", strerror(errno));
-        }
-        return false;
-    }
-    return true;
+    return ret;
 }
 }  // unnamed namespace
 
@@ -191,8 +205,17 @@ int DumpFileToFd(int out_fd, const std::string& title, const std::string& path)
     return DumpFileFromFdToFd(title, path, fd, out_fd, PropertiesHelper::IsDryRun());
 }
 
+static uint64_t timeval_to_ns(const struct timeval& tv) {
+    return static_cast<uint64_t>(tv.tv_sec) * NANOS_PER_SEC + tv.tv_usec * 1000;
+}
+
 int RunCommandToFd(int fd, const std::string& title, const std::vector<std::string>& full_command,
                    const CommandOptions& options) {
+    return RunCommandToFd(fd, title, full_command, options, nullptr);
+}
+
+int RunCommandToFd(int fd, const std::string& title, const std::vector<std::string>& full_command,
+                   const CommandOptions& options, CommandStats* stats) {
     if (full_command.empty()) {
         MYLOGE("No arguments on RunCommandToFd(%s)\n", title.c_str());
         return -1;
@@ -307,12 +330,14 @@ int RunCommandToFd(int fd, const std::string& title, const std::vector<std::stri
 
     /* handle parent case */
     int status;
-    bool ret = waitpid_with_timeout(pid, options.Timeout(), &status);
+    struct rusage usage = {};
+    bool ret = waitpid_with_timeout(pid, options.Timeout(), &status, &usage);
     fsync(fd);
 
     uint64_t elapsed = Nanotime() - start;
     if (!ret) {
-        if (errno == ETIMEDOUT) {
+        bool timed_out = errno == ETIMEDOUT;
+        if (timed_out) {
             if (!silent)
                 dprintf(fd, "*** command '%s' timed out after %.3fs (killing pid %d)\n", command,
                         static_cast<float>(elapsed) / NANOS_PER_SEC, pid);
@@ -325,19 +350,29 @@ int RunCommandToFd(int fd, const std::string& title, const std::vector<std::stri
             MYLOGE("command '%s': Error after %.4fs (killing pid %d)\n", command,
                    static_cast<float>(elapsed) / NANOS_PER_SEC, pid);
         }
+        if (stats != nullptr) {
+            stats->timed_out = timed_out;
+        }
         kill(pid, SIGTERM);
-        if (!waitpid_with_timeout(pid, 5, nullptr)) {
+        if (!waitpid_with_timeout(pid, 5, nullptr, &usage)) {
             kill(pid, SIGKILL);
-            if (!waitpid_with_timeout(pid, 5, nullptr)) {
+            if (!waitpid_with_timeout(pid, 5, nullptr, &usage)) {
                 if (!silent)
                     dprintf(fd, "could not kill command '%s' (pid %d) even with SIGKILL.\n",
                             command, pid);
                 MYLOGE("could not kill command '%s' (pid %d) even with SIGKILL.\n", command, pid);
             }
         }
+        if (stats != nullptr) {
+            stats->cpu_time_ns = timeval_to_ns(usage.ru_utime) + timeval_to_ns(usage.ru_stime);
+        }
         return -1;
     }
 
+    if (stats != nullptr) {
+        stats->cpu_time_ns = timeval_to_ns(usage.ru_utime) + timeval_to_ns(usage.ru_stime);
+    }
+
     if (WIFSIGNALED(status)) {
         if (!silent)
             dprintf(fd, "*** command '%s' failed: killed by signal %d\n", command, WTERMSIG(status));
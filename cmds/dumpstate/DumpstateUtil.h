@@ -163,6 +163,22 @@ class PropertiesHelper {
 int RunCommandToFd(int fd, const std::string& title, const std::vector<std::string>& full_command,
                    const CommandOptions& options = CommandOptions::DEFAULT);
 
+/*
+ * Resources used by a command ran by RunCommandToFd().
+ */
+struct CommandStats {
+    /* CPU time (user and system) used by the command, in nanoseconds. */
+    uint64_t cpu_time_ns = 0;
+    /* Whether the command had to be killed for not finishing before its timeout. */
+    bool timed_out = false;
+};
+
+/*
+ * Same as above, but also reports the command's resource usage on |stats|, when not null.
+ */
+int RunCommandToFd(int fd, const std::string& title, const std::vector<std::string>& full_command,
+                   const CommandOptions& options, CommandStats* stats);
+
 /*
  * Dumps the contents of a file into a file descriptor.
  *
@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "dumpstate"
+
+#include "ZipWriterQueue.h"
+
+#include <cutils/log.h>
+
+#include "DumpstateInternal.h"
+
+namespace android {
+namespace os {
+namespace dumpstate {
+
+ZipWriterQueue::ZipWriterQueue(ZipWriter* writer, size_t max_buffered_bytes)
+    : writer_(writer), max_buffered_bytes_(max_buffered_bytes) {
+    thread_ = std::thread(&ZipWriterQueue::ThreadMain, this);
+}
+
+ZipWriterQueue::~ZipWriterQueue() {
+    Finish();
+}
+
+void ZipWriterQueue::StartEntry(const std::string& name, size_t flags, time_t time) {
+    Push(Op{Op::START, name, flags, time, {}});
+}
+
+void ZipWriterQueue::WriteBytes(std::vector<uint8_t> data) {
+    Push(Op{Op::DATA, "", 0, 0, std::move(data)});
+}
+
+void ZipWriterQueue::FinishEntry() {
+    Push(Op{Op::FINISH, "", 0, 0, {}});
+}
+
+bool ZipWriterQueue::Finish() {
+    if (thread_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            finishing_ = true;
+        }
+        queued_.notify_one();
+        thread_.join();
+    }
+    return !any_failed_;
+}
+
+void ZipWriterQueue::Push(Op op) {
+    if (!thread_.joinable()) {
+        // Already finished; nothing else is using the writer anymore.
+        Execute(op);
+        return;
+    }
+    std::unique_lock<std::mutex> lock(lock_);
+    // A chunk larger than the limit still goes through, just on its own.
+    const size_t size = op.data.size();
+    drained_.wait(lock, [this, size] {
+        return buffered_bytes_ == 0 || buffered_bytes_ + size <= max_buffered_bytes_;
+    });
+    buffered_bytes_ += size;
+    ops_.push_back(std::move(op));
+    queued_.notify_one();
+}
+
+void ZipWriterQueue::ThreadMain() {
+    std::unique_lock<std::mutex> lock(lock_);
+    while (true) {
+        queued_.wait(lock, [this] { return finishing_ || !ops_.empty(); });
+        if (ops_.empty()) {
+            return;
+        }
+        Op op = std::move(ops_.front());
+        ops_.pop_front();
+        lock.unlock();
+        Execute(op);
+        lock.lock();
+        buffered_bytes_ -= op.data.size();
+        drained_.notify_one();
+    }
+}
+
+void ZipWriterQueue::Execute(const Op& op) {
+    int32_t err;
+    switch (op.type) {
+        case Op::START:
+            err = writer_->StartEntryWithTime(op.name.c_str(), op.flags, op.time);
+            entry_failed_ = err != 0;
+            if (entry_failed_) {
+                MYLOGE("zip_writer_->StartEntryWithTime(%s): %s\n", op.name.c_str(),
+                       ZipWriter::ErrorCodeString(err));
+            }
+            break;
+        case Op::DATA:
+            if (entry_failed_) break;
+            err = writer_->WriteBytes(op.data.data(), op.data.size());
+            entry_failed_ = err != 0;
+            if (entry_failed_) {
+                MYLOGE("zip_writer_->WriteBytes(): %s\n", ZipWriter::ErrorCodeString(err));
+            }
+            break;
+        case Op::FINISH:
+            if (entry_failed_) break;
+            err = writer_->FinishEntry();
+            entry_failed_ = err != 0;
+            if (entry_failed_) {
+                MYLOGE("zip_writer_->FinishEntry(): %s\n", ZipWriter::ErrorCodeString(err));
+            }
+            break;
+    }
+    any_failed_ |= entry_failed_;
+}
+
+}  // namespace dumpstate
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef ANDROID_OS_DUMPSTATE_ZIP_WRITER_QUEUE_H_
+#define ANDROID_OS_DUMPSTATE_ZIP_WRITER_QUEUE_H_
+
+#include <time.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android-base/macros.h>
+#include <ziparchive/zip_writer.h>
+
+namespace android {
+namespace os {
+namespace dumpstate {
+
+/*
+ * Feeds a ZipWriter from a dedicated thread, so the time spent deflating entries overlaps with
+ * the time spent collecting them.
+ *
+ * Entries are written in the order they're queued, exactly as if the calls had been made on the
+ * ZipWriter directly. Queued data is bounded by |max_buffered_bytes|: once it's reached, the
+ * producer blocks until the writer thread catches up, so large files are streamed rather than
+ * read into memory.
+ *
+ * Only one thread may queue entries at a time, and the ZipWriter must not be used by anyone else
+ * until Finish() returns.
+ */
+class ZipWriterQueue {
+  public:
+    static constexpr size_t kDefaultMaxBufferedBytes = 8 * 1024 * 1024;
+
+    ZipWriterQueue(ZipWriter* writer, size_t max_buffered_bytes = kDefaultMaxBufferedBytes);
+
+    // Calls Finish().
+    ~ZipWriterQueue();
+
+    /* Queues the start of a new entry; |flags| are ZipWriter's, like ZipWriter::kCompress. */
+    void StartEntry(const std::string& name, size_t flags, time_t time);
+
+    /* Queues data for the current entry. */
+    void WriteBytes(std::vector<uint8_t> data);
+
+    /* Queues the end of the current entry. */
+    void FinishEntry();
+
+    /*
+     * Writes everything queued so far and stops the writer thread, after which the ZipWriter can
+     * be used directly again. Returns false if writing any of the entries failed.
+     */
+    bool Finish();
+
+  private:
+    struct Op {
+        enum Type { START, DATA, FINISH } type;
+        std::string name;
+        size_t flags;
+        time_t time;
+        std::vector<uint8_t> data;
+    };
+
+    void Push(Op op);
+    void ThreadMain();
+    void Execute(const Op& op);
+
+    ZipWriter* writer_;
+    const size_t max_buffered_bytes_;
+
+    std::mutex lock_;
+    std::condition_variable queued_;
+    std::condition_variable drained_;
+    // Guarded by lock_.
+    std::deque<Op> ops_;
+    size_t buffered_bytes_ = 0;
+    bool finishing_ = false;
+
+    // Only used by the writer thread, and by Finish() once it's joined.
+    bool entry_failed_ = false;
+    bool any_failed_ = false;
+
+    std::thread thread_;
+
+    DISALLOW_COPY_AND_ASSIGN(ZipWriterQueue);
+};
+
+}  // namespace dumpstate
+}  // namespace os
+}  // namespace android
+
+#endif  // ANDROID_OS_DUMPSTATE_ZIP_WRITER_QUEUE_H_
@@ -56,8 +56,10 @@ using ::android::hardware::dumpstate::V1_0::IDumpstateDevice;
 
 // TODO: remove once moved to namespace
 using android::os::dumpstate::CommandOptions;
+using android::os::dumpstate::DumpPool;
 using android::os::dumpstate::DumpFileToFd;
 using android::os::dumpstate::PropertiesHelper;
+using android::os::dumpstate::ZipWriterQueue;
 using android::os::dumpstate::GetPidByName;
 
 /* read before root is shed */
@@ -107,6 +109,21 @@ static int DumpFile(const std::string& title, const std::string& path) {
     return ds.DumpFile(title, path);
 }
 
+/*
+ * Starts a dumpsys section on the dump pool; its output is only added to the bugreport when
+ * WaitForSection() is called with the same title, at the point where the section belongs.
+ */
+static void EnqueueDumpsys(const std::string& title, const std::vector<std::string>& dumpsysArgs,
+                           const CommandOptions& options = Dumpstate::DEFAULT_DUMPSYS,
+                           long dumpsysTimeout = 0) {
+    ds.dump_pool_->EnqueueTask(title, [title, dumpsysArgs, options, dumpsysTimeout](int out_fd) {
+        ds.RunDumpsys(out_fd, title, dumpsysArgs, options, dumpsysTimeout);
+    });
+}
+static void WaitForSection(const std::string& title) {
+    ds.dump_pool_->WaitForTask(title);
+}
+
 // Relative directory (inside the zip) for all files copied as-is into the bugreport.
 static const std::string ZIP_ROOT_DIR = "FS";
 
@@ -122,6 +139,11 @@ static constexpr char PROPERTY_EXTRA_DESCRIPTION[] = "dumpstate.options.descript
 
 static const CommandOptions AS_ROOT_20 = CommandOptions::WithTimeout(20).AsRoot().Build();
 
+// How many sections may run in parallel with the main one. The framework sections mostly wait on
+// system_server while the rest mostly wait on the kernel, so a couple of threads is enough to
+// overlap them without making each dumpsys slower.
+static constexpr size_t kDumpPoolThreads = 2;
+
 /* gets the tombstone data, according to the bugreport type: if zipped, gets all tombstones;
  * otherwise, gets just those modified in the last half an hour. */
 static void get_tombstone_fds(tombstone_data_t data[NUM_TOMBSTONES]) {
@@ -689,6 +711,13 @@ static const std::set<std::string> PROBLEMATIC_FILE_EXTENSIONS = {
       ".shb", ".sys", ".vb",  ".vbe", ".vbs", ".vxd", ".wsc", ".wsf", ".wsh"
 };
 
+// List of file extensions whose contents are already compressed, and are stored as they are since
+// deflating them again would take time without saving space.
+static const std::set<std::string> COMPRESSED_FILE_EXTENSIONS = {
+      ".7z", ".apk", ".br", ".bz2", ".gz", ".jpeg", ".jpg", ".lz4", ".mp3", ".mp4", ".png",
+      ".webp", ".xz", ".zip", ".zst"
+};
+
 bool Dumpstate::AddZipEntryFromFd(const std::string& entry_name, int fd) {
     if (!IsZipping()) {
         MYLOGD("Not adding zip entry %s from fd because it's not a zipped bugreport\n",
@@ -696,6 +725,7 @@ bool Dumpstate::AddZipEntryFromFd(const std::string& entry_name, int fd) {
         return false;
     }
     std::string valid_name = entry_name;
+    size_t flags = ZipWriter::kCompress;
 
     // Rename extension if necessary.
     size_t idx = entry_name.rfind(".");
@@ -706,41 +736,35 @@ bool Dumpstate::AddZipEntryFromFd(const std::string& entry_name, int fd) {
             valid_name = entry_name + ".renamed";
             MYLOGI("Renaming entry %s to %s\n", entry_name.c_str(), valid_name.c_str());
         }
+        if (COMPRESSED_FILE_EXTENSIONS.count(extension) != 0) {
+            flags = 0;
+        }
     }
 
     // Logging statement  below is useful to time how long each entry takes, but it's too verbose.
     // MYLOGD("Adding zip entry %s\n", entry_name.c_str());
-    int32_t err = zip_writer_->StartEntryWithTime(valid_name.c_str(), ZipWriter::kCompress,
-                                                  get_mtime(fd, ds.now_));
-    if (err != 0) {
-        MYLOGE("zip_writer_->StartEntryWithTime(%s): %s\n", valid_name.c_str(),
-               ZipWriter::ErrorCodeString(err));
-        return false;
-    }
+    // The entries are compressed and written by zip_queue_'s thread; errors doing so are reported
+    // by FinishZipFile().
+    zip_queue_->StartEntry(valid_name, flags, get_mtime(fd, ds.now_));
 
-    std::vector<uint8_t> buffer(65536);
+    bool ok = true;
     while (1) {
+        std::vector<uint8_t> buffer(65536);
         ssize_t bytes_read = TEMP_FAILURE_RETRY(read(fd, buffer.data(), buffer.size()));
         if (bytes_read == 0) {
             break;
         } else if (bytes_read == -1) {
             MYLOGE("read(%s): %s\n", entry_name.c_str(), strerror(errno));
-            return false;
-        }
-        err = zip_writer_->WriteBytes(buffer.data(), bytes_read);
-        if (err) {
-            MYLOGE("zip_writer_->WriteBytes(): %s\n", ZipWriter::ErrorCodeString(err));
-            return false;
+            // Still finish the entry, so the ones after it can be written.
+            ok = false;
+            break;
         }
+        buffer.resize(bytes_read);
+        zip_queue_->WriteBytes(std::move(buffer));
     }
 
-    err = zip_writer_->FinishEntry();
-    if (err != 0) {
-        MYLOGE("zip_writer_->FinishEntry(): %s\n", ZipWriter::ErrorCodeString(err));
-        return false;
-    }
-
-    return true;
+    zip_queue_->FinishEntry();
+    return ok;
 }
 
 bool Dumpstate::AddZipEntry(const std::string& entry_name, const std::string& entry_path) {
@@ -776,25 +800,9 @@ bool Dumpstate::AddTextZipEntry(const std::string& entry_name, const std::string
         return false;
     }
     MYLOGD("Adding zip text entry %s\n", entry_name.c_str());
-    int32_t err = zip_writer_->StartEntryWithTime(entry_name.c_str(), ZipWriter::kCompress, ds.now_);
-    if (err != 0) {
-        MYLOGE("zip_writer_->StartEntryWithTime(%s): %s\n", entry_name.c_str(),
-               ZipWriter::ErrorCodeString(err));
-        return false;
-    }
-
-    err = zip_writer_->WriteBytes(content.c_str(), content.length());
-    if (err != 0) {
-        MYLOGE("zip_writer_->WriteBytes(%s): %s\n", entry_name.c_str(),
-               ZipWriter::ErrorCodeString(err));
-        return false;
-    }
-
-    err = zip_writer_->FinishEntry();
-    if (err != 0) {
-        MYLOGE("zip_writer_->FinishEntry(): %s\n", ZipWriter::ErrorCodeString(err));
-        return false;
-    }
+    zip_queue_->StartEntry(entry_name, ZipWriter::kCompress, ds.now_);
+    zip_queue_->WriteBytes(std::vector<uint8_t>(content.begin(), content.end()));
+    zip_queue_->FinishEntry();
 
     return true;
 }
@@ -944,6 +952,24 @@ static void AddAnrTraceFiles() {
 static void dumpstate() {
     DurationReporter duration_reporter("DUMPSTATE");
 
+    // The framework sections are the slowest ones and don't depend on anything dumped before
+    // them, so they're started right away and collected where they used to run. Longest first,
+    // since the pool runs them in order.
+    ds.dump_pool_.reset(new DumpPool(ds.bugreport_dir_, kDumpPoolThreads));
+    EnqueueDumpsys("DUMPSYS", {"--skip", "meminfo", "cpuinfo"},
+                   CommandOptions::WithTimeout(90).Build(), 10);
+    EnqueueDumpsys("CHECKIN BATTERYSTATS", {"batterystats", "-c"});
+    EnqueueDumpsys("CHECKIN MEMINFO", {"meminfo", "--checkin"});
+    EnqueueDumpsys("CHECKIN NETSTATS", {"netstats", "--checkin"});
+    EnqueueDumpsys("CHECKIN PROCSTATS", {"procstats", "-c"});
+    EnqueueDumpsys("CHECKIN USAGESTATS", {"usagestats", "-c"});
+    EnqueueDumpsys("CHECKIN PACKAGE", {"package", "--checkin"});
+    EnqueueDumpsys("APP ACTIVITIES", {"activity", "-v", "all"});
+    EnqueueDumpsys("APP SERVICES", {"activity", "service", "all"});
+    EnqueueDumpsys("APP PROVIDERS", {"activity", "provider", "all"});
+    EnqueueDumpsys("DROPBOX SYSTEM SERVER CRASHES", {"dropbox", "-p", "system_server_crash"});
+    EnqueueDumpsys("DROPBOX SYSTEM APP CRASHES", {"dropbox", "-p", "system_app_crash"});
+
     dump_dev_files("TRUSTY VERSION", "/sys/bus/platform/drivers/trusty", "trusty_version");
     RunCommand("UPTIME", {"uptime"});
     dump_files("UPTIME MMC PERF", mmcblk0, skip_not_stat, dump_stat_from_fd);
@@ -1111,50 +1137,51 @@ static void dumpstate() {
     printf("== Android Framework Services\n");
     printf("========================================================\n");
 
-    RunDumpsys("DUMPSYS", {"--skip", "meminfo", "cpuinfo"}, CommandOptions::WithTimeout(90).Build(),
-               10);
+    WaitForSection("DUMPSYS");
 
     printf("========================================================\n");
     printf("== Checkins\n");
     printf("========================================================\n");
 
-    RunDumpsys("CHECKIN BATTERYSTATS", {"batterystats", "-c"});
-    RunDumpsys("CHECKIN MEMINFO", {"meminfo", "--checkin"});
-    RunDumpsys("CHECKIN NETSTATS", {"netstats", "--checkin"});
-    RunDumpsys("CHECKIN PROCSTATS", {"procstats", "-c"});
-    RunDumpsys("CHECKIN USAGESTATS", {"usagestats", "-c"});
-    RunDumpsys("CHECKIN PACKAGE", {"package", "--checkin"});
+    WaitForSection("CHECKIN BATTERYSTATS");
+    WaitForSection("CHECKIN MEMINFO");
+    WaitForSection("CHECKIN NETSTATS");
+    WaitForSection("CHECKIN PROCSTATS");
+    WaitForSection("CHECKIN USAGESTATS");
+    WaitForSection("CHECKIN PACKAGE");
 
     printf("========================================================\n");
     printf("== Running Application Activities\n");
     printf("========================================================\n");
 
-    RunDumpsys("APP ACTIVITIES", {"activity", "-v", "all"});
+    WaitForSection("APP ACTIVITIES");
 
     printf("========================================================\n");
     printf("== Running Application Services\n");
     printf("========================================================\n");
 
-    RunDumpsys("APP SERVICES", {"activity", "service", "all"});
+    WaitForSection("APP SERVICES");
 
     printf("========================================================\n");
     printf("== Running Application Providers\n");
     printf("========================================================\n");
 
-    RunDumpsys("APP PROVIDERS", {"activity", "provider", "all"});
+    WaitForSection("APP PROVIDERS");
 
     printf("========================================================\n");
     printf("== Dropbox crashes\n");
     printf("========================================================\n");
 
-    RunDumpsys("DROPBOX SYSTEM SERVER CRASHES", {"dropbox", "-p", "system_server_crash"});
-    RunDumpsys("DROPBOX SYSTEM APP CRASHES", {"dropbox", "-p", "system_app_crash"});
+    WaitForSection("DROPBOX SYSTEM SERVER CRASHES");
+    WaitForSection("DROPBOX SYSTEM APP CRASHES");
 
     // DumpModemLogs adds the modem logs if available to the bugreport.
     // Do this at the end to allow for sufficient time for the modem logs to be
     // collected.
     DumpModemLogs();
 
+    ds.dump_pool_.reset();
+
     printf("========================================================\n");
     printf("== Final progress (pid %d): %d/%d (estimated %d)\n", ds.pid_, ds.progress_->Get(),
            ds.progress_->GetMax(), ds.progress_->GetInitialMax());
@@ -1277,6 +1304,10 @@ bool Dumpstate::FinishZipFile() {
         MYLOGE("Failed to add text entry to .zip file\n");
         return false;
     }
+    if (!AddTextZipEntry("sections.json", GetSectionStatsJson())) {
+        MYLOGE("Failed to add sections.json to .zip file\n");
+        return false;
+    }
     if (!AddTextZipEntry("main_entry.txt", entry_name)) {
         MYLOGE("Failed to add main_entry.txt to .zip file\n");
         return false;
@@ -1292,6 +1323,11 @@ bool Dumpstate::FinishZipFile() {
     redirect_to_existing_file(stderr, const_cast<char*>(ds.log_path_.c_str()));
     fprintf(stderr, "\n");
 
+    if (!zip_queue_->Finish()) {
+        MYLOGE("Failed to write all entries to .zip file\n");
+        return false;
+    }
+
     int32_t err = zip_writer_->Finish();
     if (err != 0) {
         MYLOGE("zip_writer_->Finish(): %s\n", ZipWriter::ErrorCodeString(err));
@@ -1599,6 +1635,7 @@ int main(int argc, char *argv[]) {
                 do_zip_file = 0;
             } else {
                 ds.zip_writer_.reset(new ZipWriter(ds.zip_file.get()));
+                ds.zip_queue_.reset(new ZipWriterQueue(ds.zip_writer_.get()));
             }
             ds.AddTextZipEntry("version.txt", ds.version_);
         }
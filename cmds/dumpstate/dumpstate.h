@@ -22,13 +22,17 @@
 #include <stdbool.h>
 #include <stdio.h>
 
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
 #include <android-base/macros.h>
 #include <ziparchive/zip_writer.h>
 
+#include "DumpPool.h"
 #include "DumpstateUtil.h"
+#include "ZipWriterQueue.h"
 #include "android/os/BnDumpstate.h"
 
 // Workaround for const char *args[MAX_ARGS_ARRAY_SIZE] variables until they're converted to
@@ -61,17 +65,28 @@ extern "C" {
  *
  *    DurationReporter duration_reporter(title);
  *
+ * The duration is printed on `stdout`, or on |out_fd| for sections writing somewhere else. The
+ * section's costs are also recorded for the `sections.json` entry of the zipped bugreport.
  */
 class DurationReporter {
   public:
-    DurationReporter(const std::string& title, bool log_only = false);
+    DurationReporter(const std::string& title, bool log_only = false,
+                     int out_fd = STDOUT_FILENO);
 
     ~DurationReporter();
 
+    /* Accounts a command ran by the section as part of its cost. */
+    void AddCommandStats(const android::os::dumpstate::CommandStats& stats);
+
   private:
     std::string title_;
     bool log_only_;
+    int out_fd_;
     uint64_t started_;
+    uint64_t started_cpu_;
+    off_t started_offset_;
+    uint64_t commands_cpu_ns_ = 0;
+    bool timed_out_ = false;
 
     DISALLOW_COPY_AND_ASSIGN(DurationReporter);
 };
@@ -155,6 +170,19 @@ static std::string VERSION_SPLIT_ANR = "2.0-dev-1";
  */
 static std::string VERSION_DEFAULT = "default";
 
+/*
+ * What a section of the bugreport cost, as measured by its DurationReporter.
+ */
+struct SectionStats {
+    std::string title;
+    uint64_t wall_time_ns;
+    // CPU used by dumpstate on the section's thread, plus by the commands it ran.
+    uint64_t cpu_time_ns;
+    // Bytes written to the section's output, or -1 if it isn't a regular file.
+    int64_t bytes_written;
+    bool timed_out;
+};
+
 /*
  * Main class driving a bugreport generation.
  *
@@ -185,6 +213,15 @@ class Dumpstate {
                    const android::os::dumpstate::CommandOptions& options =
                        android::os::dumpstate::CommandOptions::DEFAULT);
 
+    /*
+     * Same as above, but writes the output (including the title and duration) to |out_fd|
+     * instead of `stdout`; used by sections running in parallel.
+     */
+    int RunCommand(int out_fd, const std::string& title,
+                   const std::vector<std::string>& fullCommand,
+                   const android::os::dumpstate::CommandOptions& options =
+                       android::os::dumpstate::CommandOptions::DEFAULT);
+
     /*
      * Runs `dumpsys` with the given arguments, automatically setting its timeout
      * (`-t` argument)
@@ -201,6 +238,12 @@ class Dumpstate {
                     const android::os::dumpstate::CommandOptions& options = DEFAULT_DUMPSYS,
                     long dumpsys_timeout = 0);
 
+    /* Same as above, but writes the output to |out_fd| instead of `stdout`. */
+    void RunDumpsys(int out_fd, const std::string& title,
+                    const std::vector<std::string>& dumpsys_args,
+                    const android::os::dumpstate::CommandOptions& options = DEFAULT_DUMPSYS,
+                    long dumpsys_timeout = 0);
+
     /*
      * Prints the contents of a file.
      *
@@ -248,6 +291,8 @@ class Dumpstate {
 
     /*
      * Updates the overall progress of the bugreport generation by the given weight increment.
+     *
+     * Can be called from sections running in parallel.
      */
     void UpdateProgress(int32_t delta);
 
@@ -263,6 +308,12 @@ class Dumpstate {
     /* Gets the path of a bugreport file with the given suffix. */
     std::string GetPath(const std::string& suffix) const;
 
+    /* Records the cost of a finished section; can be called from sections running in parallel. */
+    void AddSectionStats(const SectionStats& stats);
+
+    /* Gets the recorded section costs as a JSON document, slowest section first. */
+    std::string GetSectionStatsJson();
+
     // TODO: initialize fields on constructor
 
     // dumpstate id - unique after each device reboot.
@@ -286,6 +337,16 @@ class Dumpstate {
 
     std::unique_ptr<Progress> progress_;
 
+    // Serializes UpdateProgress() calls made by sections running in parallel.
+    std::mutex progress_lock_;
+
+    // Costs of the sections finished so far, guarded by section_stats_lock_.
+    std::vector<SectionStats> section_stats_;
+    std::mutex section_stats_lock_;
+
+    // Runs sections in parallel while the bugreport is generated; null when they run in order.
+    std::unique_ptr<android::os::dumpstate::DumpPool> dump_pool_;
+
     // When set, defines a socket file-descriptor use to report progress to bugreportz.
     int control_socket_fd_ = -1;
 
@@ -329,6 +390,9 @@ class Dumpstate {
     // Pointer to the zip structure.
     std::unique_ptr<ZipWriter> zip_writer_;
 
+    // Writes entries to zip_writer_ from its own thread until FinishZipFile() is called.
+    std::unique_ptr<android::os::dumpstate::ZipWriterQueue> zip_queue_;
+
     // Binder object listing to progress.
     android::sp<android::os::IDumpstateListener> listener_;
     std::string listener_name_;
@@ -30,12 +30,16 @@
 #include <signal.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <atomic>
+#include <chrono>
 #include <thread>
 
 #include <android-base/file.h>
 #include <android-base/properties.h>
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
+#include <ziparchive/zip_archive.h>
+#include <ziparchive/zip_writer.h>
 
 namespace android {
 namespace os {
@@ -301,6 +305,30 @@ TEST_F(DumpstateTest, RunCommandTimesout) {
                                 " --sleep 2' timed out after 1"));
 }
 
+TEST_F(DumpstateTest, RunCommandRecordsSectionStats) {
+    ds.section_stats_.clear();
+    EXPECT_EQ(0, RunCommand("I AM GROOT", {kSimpleCommand}));
+    EXPECT_EQ(-1, RunCommand("I AM SLOW", {kSimpleCommand, "--sleep", "2"},
+                             CommandOptions::WithTimeout(1).Build()));
+
+    ASSERT_EQ(2U, ds.section_stats_.size());
+    EXPECT_THAT(ds.section_stats_[0].title, StrEq("I AM GROOT"));
+    // Everything but the duration, which is printed once the section is done.
+    EXPECT_GT(ds.section_stats_[1].bytes_written, 0) << out;
+    EXPECT_LT(ds.section_stats_[1].bytes_written, (int64_t)out.size()) << out;
+    EXPECT_FALSE(ds.section_stats_[0].timed_out);
+    EXPECT_TRUE(ds.section_stats_[1].timed_out);
+
+    // Slowest first.
+    std::string json = ds.GetSectionStatsJson();
+    size_t slow = json.find("\"title\": \"I AM SLOW\"");
+    size_t groot = json.find("\"title\": \"I AM GROOT\"");
+    ASSERT_NE(std::string::npos, slow) << json;
+    ASSERT_NE(std::string::npos, groot) << json;
+    EXPECT_LT(slow, groot) << json;
+    EXPECT_THAT(json, HasSubstr("\"timed_out\": true}")) << json;
+}
+
 TEST_F(DumpstateTest, RunCommandIsKilled) {
     CaptureStdout();
     CaptureStderr();
@@ -795,6 +823,189 @@ TEST_F(ProgressTest, ThirdTime) {
     AssertStats(path, 3, 16);
 }
 
+class DumpPoolTest : public DumpstateBaseTest {
+  public:
+    void SetUp() {
+        DumpstateBaseTest::SetUp();
+        path_ = kTestDataPath + "DumpPoolTest.txt";
+        fd_ = TEMP_FAILURE_RETRY(open(path_.c_str(),
+                                      O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW,
+                                      S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH));
+        ASSERT_GE(fd_, 0) << "could not create FD for path " << path_;
+    }
+
+    void TearDown() {
+        close(fd_);
+    }
+
+    // Gets what was written to `fd_` so far.
+    std::string GetOutput() {
+        std::string out;
+        ReadFileToString(path_, &out);
+        return out;
+    }
+
+    int fd_;
+
+  private:
+    std::string path_;
+};
+
+TEST_F(DumpPoolTest, OutputInWaitOrder) {
+    DumpPool pool(kTestDataPath, 2);
+    pool.EnqueueTask("slow", [](int fd) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        dprintf(fd, "slow\n");
+    });
+    pool.EnqueueTask("fast", [](int fd) { dprintf(fd, "fast\n"); });
+
+    EXPECT_TRUE(pool.WaitForTask("slow", fd_));
+    EXPECT_TRUE(pool.WaitForTask("fast", fd_));
+    EXPECT_THAT(GetOutput(), StrEq("slow\nfast\n"));
+}
+
+TEST_F(DumpPoolTest, RunsInParallel) {
+    DumpPool pool(kTestDataPath, 2);
+    std::atomic<int> running(0);
+    std::atomic<int> max_running(0);
+    auto task = [&running, &max_running](int fd) {
+        int now = ++running;
+        int max = max_running;
+        while (now > max && !max_running.compare_exchange_weak(max, now)) {
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        --running;
+        dprintf(fd, "done\n");
+    };
+    pool.EnqueueTask("first", task);
+    pool.EnqueueTask("second", task);
+    // Give both threads a chance to pick up their task before waiting.
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    EXPECT_TRUE(pool.WaitForTask("first", fd_));
+    EXPECT_TRUE(pool.WaitForTask("second", fd_));
+    EXPECT_EQ(2, max_running);
+    EXPECT_THAT(GetOutput(), StrEq("done\ndone\n"));
+}
+
+TEST_F(DumpPoolTest, NoThreadsRunsOnWaitingThread) {
+    DumpPool pool(kTestDataPath, 0);
+    std::thread::id ran_on;
+    pool.EnqueueTask("task", [&ran_on](int fd) {
+        ran_on = std::this_thread::get_id();
+        dprintf(fd, "task\n");
+    });
+
+    EXPECT_TRUE(pool.WaitForTask("task", fd_));
+    EXPECT_EQ(std::this_thread::get_id(), ran_on);
+    EXPECT_THAT(GetOutput(), StrEq("task\n"));
+}
+
+TEST_F(DumpPoolTest, NoTmpDirRunsOnWaitingThread) {
+    DumpPool pool("", 2);
+    std::thread::id ran_on;
+    pool.EnqueueTask("task", [&ran_on](int) { ran_on = std::this_thread::get_id(); });
+
+    EXPECT_TRUE(pool.WaitForTask("task", fd_));
+    EXPECT_EQ(std::this_thread::get_id(), ran_on);
+}
+
+TEST_F(DumpPoolTest, WaitForUnknownTask) {
+    DumpPool pool(kTestDataPath, 1);
+    CaptureStderr();
+    EXPECT_FALSE(pool.WaitForTask("nope", fd_));
+    EXPECT_THAT(GetCapturedStderr(), StrEq("No section 'nope' to wait for\n"));
+}
+
+TEST_F(DumpPoolTest, WaitTwice) {
+    DumpPool pool(kTestDataPath, 1);
+    pool.EnqueueTask("task", [](int fd) { dprintf(fd, "task\n"); });
+
+    EXPECT_TRUE(pool.WaitForTask("task", fd_));
+    CaptureStderr();
+    EXPECT_FALSE(pool.WaitForTask("task", fd_));
+    GetCapturedStderr();
+    EXPECT_THAT(GetOutput(), StrEq("task\n"));
+}
+
+class ZipWriterQueueTest : public DumpstateBaseTest {
+  public:
+    void SetUp() {
+        DumpstateBaseTest::SetUp();
+        path_ = kTestDataPath + "ZipWriterQueueTest.zip";
+        file_ = fopen(path_.c_str(), "wb");
+        ASSERT_THAT(file_, NotNull()) << "could not create " << path_;
+        writer_.reset(new ZipWriter(file_));
+    }
+
+    void TearDown() {
+        if (file_ != nullptr) {
+            fclose(file_);
+        }
+    }
+
+    // Finishes the zip file and opens it for reading.
+    void OpenZip() {
+        ASSERT_EQ(0, writer_->Finish());
+        fclose(file_);
+        file_ = nullptr;
+        ASSERT_EQ(0, OpenArchive(path_.c_str(), &handle_));
+    }
+
+    // Gets the contents of an entry, checking how it was stored.
+    void ReadEntry(const std::string& name, uint16_t method, std::string* content) {
+        ZipEntry entry;
+        ASSERT_EQ(0, FindEntry(handle_, ZipString(name.c_str()), &entry)) << name;
+        EXPECT_EQ(method, entry.method) << name;
+        content->resize(entry.uncompressed_length);
+        ASSERT_EQ(0, ExtractToMemory(handle_, &entry, reinterpret_cast<uint8_t*>(&(*content)[0]),
+                                     entry.uncompressed_length));
+    }
+
+    static std::vector<uint8_t> Bytes(const std::string& s) {
+        return std::vector<uint8_t>(s.begin(), s.end());
+    }
+
+    std::unique_ptr<ZipWriter> writer_;
+    ZipArchiveHandle handle_ = nullptr;
+
+  private:
+    std::string path_;
+    FILE* file_ = nullptr;
+};
+
+TEST_F(ZipWriterQueueTest, WritesEntriesInOrder) {
+    // A tiny buffer, so the producer has to keep waiting for the writer thread.
+    ZipWriterQueue queue(writer_.get(), 4);
+    queue.StartEntry("first.txt", ZipWriter::kCompress, 0);
+    queue.WriteBytes(Bytes("Hello, "));
+    queue.WriteBytes(Bytes("World!"));
+    queue.FinishEntry();
+    queue.StartEntry("second.png", 0, 0);
+    queue.WriteBytes(Bytes("not really a png"));
+    queue.FinishEntry();
+    EXPECT_TRUE(queue.Finish());
+
+    OpenZip();
+    std::string content;
+    ReadEntry("first.txt", kCompressDeflated, &content);
+    EXPECT_THAT(content, StrEq("Hello, World!"));
+    ReadEntry("second.png", kCompressStored, &content);
+    EXPECT_THAT(content, StrEq("not really a png"));
+    CloseArchive(handle_);
+}
+
+TEST_F(ZipWriterQueueTest, ReportsFailedEntries) {
+    ZipWriterQueue queue(writer_.get());
+    CaptureStderr();
+    queue.StartEntry("entry.txt", ZipWriter::kCompress, 0);
+    queue.FinishEntry();
+    // There's no entry left to finish.
+    queue.FinishEntry();
+    EXPECT_FALSE(queue.Finish());
+    EXPECT_THAT(GetCapturedStderr(), StartsWith("zip_writer_->FinishEntry()"));
+}
+
 class DumpstateUtilTest : public DumpstateBaseTest {
   public:
     void SetUp() {
@@ -38,6 +38,7 @@
 #include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <set>
 #include <string>
 #include <vector>
@@ -57,6 +58,7 @@
 
 // TODO: remove once moved to namespace
 using android::os::dumpstate::CommandOptions;
+using android::os::dumpstate::CommandStats;
 using android::os::dumpstate::DumpFileToFd;
 using android::os::dumpstate::PropertiesHelper;
 
@@ -116,22 +118,51 @@ Dumpstate& Dumpstate::GetInstance() {
     return singleton_;
 }
 
-DurationReporter::DurationReporter(const std::string& title, bool log_only)
-    : title_(title), log_only_(log_only) {
+static uint64_t ThreadCpuTime() {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) {
+        return 0;
+    }
+    return static_cast<uint64_t>(ts.tv_sec) * NANOS_PER_SEC + ts.tv_nsec;
+}
+
+DurationReporter::DurationReporter(const std::string& title, bool log_only, int out_fd)
+    : title_(title), log_only_(log_only), out_fd_(out_fd) {
     if (!title_.empty()) {
         started_ = Nanotime();
+        started_cpu_ = ThreadCpuTime();
+        // Fails (and the size isn't reported) unless the output is a regular file.
+        started_offset_ = log_only_ ? -1 : lseek(out_fd_, 0, SEEK_CUR);
     }
 }
 
+void DurationReporter::AddCommandStats(const CommandStats& stats) {
+    commands_cpu_ns_ += stats.cpu_time_ns;
+    timed_out_ |= stats.timed_out;
+}
+
 DurationReporter::~DurationReporter() {
     if (!title_.empty()) {
         uint64_t elapsed = Nanotime() - started_;
+        int64_t bytes_written = -1;
+        if (started_offset_ >= 0) {
+            off_t offset = lseek(out_fd_, 0, SEEK_CUR);
+            if (offset >= started_offset_) {
+                bytes_written = offset - started_offset_;
+            }
+        }
+        Dumpstate::GetInstance().AddSectionStats(
+            {title_, elapsed, ThreadCpuTime() - started_cpu_ + commands_cpu_ns_, bytes_written,
+             timed_out_});
         if (log_only_) {
             MYLOGD("Duration of '%s': %.3fs\n", title_.c_str(), (float)elapsed / NANOS_PER_SEC);
-        } else {
+        } else if (out_fd_ == STDOUT_FILENO) {
             // Use "Yoda grammar" to make it easier to grep|sort sections.
             printf("------ %.3fs was the duration of '%s' ------\n", (float)elapsed / NANOS_PER_SEC,
                    title_.c_str());
+        } else {
+            dprintf(out_fd_, "------ %.3fs was the duration of '%s' ------\n",
+                    (float)elapsed / NANOS_PER_SEC, title_.c_str());
         }
     }
 }
@@ -254,6 +285,52 @@ std::string Dumpstate::GetPath(const std::string& suffix) const {
                                        name_.c_str(), suffix.c_str());
 }
 
+void Dumpstate::AddSectionStats(const SectionStats& stats) {
+    std::lock_guard<std::mutex> lock(section_stats_lock_);
+    section_stats_.push_back(stats);
+}
+
+static std::string JsonEscape(const std::string& s) {
+    std::string escaped;
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            escaped += android::base::StringPrintf("\\u%04x", c);
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+std::string Dumpstate::GetSectionStatsJson() {
+    std::vector<SectionStats> sections;
+    {
+        std::lock_guard<std::mutex> lock(section_stats_lock_);
+        sections = section_stats_;
+    }
+    std::stable_sort(sections.begin(), sections.end(),
+                     [](const SectionStats& a, const SectionStats& b) {
+                         return a.wall_time_ns > b.wall_time_ns;
+                     });
+
+    std::string json = "{\n  \"sections\": [";
+    for (size_t i = 0; i < sections.size(); i++) {
+        const SectionStats& s = sections[i];
+        json += android::base::StringPrintf(
+            "%s\n    {\"title\": \"%s\", \"wall_time_ms\": %.3f, \"cpu_time_ms\": %.3f, "
+            "\"bytes_written\": %s, \"timed_out\": %s}",
+            i == 0 ? "" : ",", JsonEscape(s.title).c_str(), s.wall_time_ns / 1e6,
+            s.cpu_time_ns / 1e6,
+            s.bytes_written < 0 ? "null" : std::to_string(s.bytes_written).c_str(),
+            s.timed_out ? "true" : "false");
+    }
+    json += "\n  ]\n}\n";
+    return json;
+}
+
 void Dumpstate::SetProgress(std::unique_ptr<Progress> progress) {
     progress_ = std::move(progress);
 }
@@ -704,9 +781,17 @@ int dump_file_from_fd(const char *title, const char *path, int fd) {
 
 int Dumpstate::RunCommand(const std::string& title, const std::vector<std::string>& full_command,
                           const CommandOptions& options) {
-    DurationReporter duration_reporter(title);
+    return RunCommand(STDOUT_FILENO, title, full_command, options);
+}
+
+int Dumpstate::RunCommand(int out_fd, const std::string& title,
+                          const std::vector<std::string>& full_command,
+                          const CommandOptions& options) {
+    DurationReporter duration_reporter(title, false, out_fd);
 
-    int status = RunCommandToFd(STDOUT_FILENO, title, full_command, options);
+    CommandStats stats;
+    int status = RunCommandToFd(out_fd, title, full_command, options, &stats);
+    duration_reporter.AddCommandStats(stats);
 
     /* TODO: for now we're simplifying the progress calculation by using the
      * timeout as the weight. It's a good approximation for most cases, except when calling dumpsys,
@@ -719,10 +804,16 @@ int Dumpstate::RunCommand(const std::string& title, const std::vector<std::strin
 
 void Dumpstate::RunDumpsys(const std::string& title, const std::vector<std::string>& dumpsys_args,
                            const CommandOptions& options, long dumpsysTimeout) {
+    RunDumpsys(STDOUT_FILENO, title, dumpsys_args, options, dumpsysTimeout);
+}
+
+void Dumpstate::RunDumpsys(int out_fd, const std::string& title,
+                           const std::vector<std::string>& dumpsys_args,
+                           const CommandOptions& options, long dumpsysTimeout) {
     long timeout = dumpsysTimeout > 0 ? dumpsysTimeout : options.Timeout();
     std::vector<std::string> dumpsys = {"/system/bin/dumpsys", "-t", std::to_string(timeout)};
     dumpsys.insert(dumpsys.end(), dumpsys_args.begin(), dumpsys_args.end());
-    RunCommand(title, dumpsys, options);
+    RunCommand(out_fd, title, dumpsys, options);
 }
 
 int open_socket(const char *service) {
@@ -1030,8 +1121,8 @@ void dump_route_tables() {
     fclose(fp);
 }
 
-// TODO: make this function thread safe if sections are generated in parallel.
 void Dumpstate::UpdateProgress(int32_t delta) {
+    std::lock_guard<std::mutex> lock(progress_lock_);
     if (progress_ == nullptr) {
         MYLOGE("UpdateProgress: progress_ not set\n");
         return;
@@ -15,8 +15,14 @@
  */
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
 #include <thread>
+#include <vector>
 
 #include <android-base/file.h>
 #include <android-base/stringprintf.h>
@@ -25,6 +31,7 @@
 #include <binder/ProcessState.h>
 #include <binder/TextOutput.h>
 #include <utils/Log.h>
+#include <utils/String8.h>
 #include <utils/Vector.h>
 
 #include <fcntl.h>
@@ -55,12 +62,19 @@ static void usage() {
         "usage: dumpsys\n"
             "         To dump all services.\n"
             "or:\n"
-            "       dumpsys [-t TIMEOUT] [--help | -l | --skip SERVICES | SERVICE [ARGS]]\n"
+            "       dumpsys [-t TIMEOUT] [--parallel N] [--stats]\n"
+            "               [--help | -l | --skip SERVICES | SERVICE [ARGS]]\n"
             "         --help: shows this help\n"
             "         -l: only list services, do not dump them\n"
             "         -t TIMEOUT: TIMEOUT to use in seconds instead of default 10 seconds\n"
+            "         --parallel N: dumps up to N services at once (output is still in order)\n"
+            "         --stats: prints how many bytes each service dumped and how long it took\n"
             "         --skip SERVICES: dumps all services but SERVICES (comma-separated list)\n"
-            "         SERVICE [ARGS]: dumps only service SERVICE, optionally passing ARGS to it\n");
+            "         SERVICE [ARGS]: dumps only service SERVICE, optionally passing ARGS to it\n"
+            "or:\n"
+            "       dumpsys [-t TIMEOUT] --binder-stats SERVICE [--reset]\n"
+            "         dumps the binder transaction stats of the process hosting SERVICE,\n"
+            "         and clears them with --reset\n");
 }
 
 static bool IsSkipped(const Vector<String16>& skipped, const String16& service) {
@@ -72,16 +86,182 @@ static bool IsSkipped(const Vector<String16>& skipped, const String16& service)
     return false;
 }
 
+// Receives the output of a service dump; returns false if it couldn't be written.
+typedef std::function<bool(const char* data, size_t size)> DumpWriter;
+
+struct DumpResult {
+    // Whether the service was skipped or couldn't be found, rather than dumped.
+    bool skipped = false;
+    size_t bytes = 0;
+    double elapsed_seconds = 0;
+    bool timed_out = false;
+};
+
+static bool WriteString(const DumpWriter& write, const std::string& s) {
+    return write(s.data(), s.size());
+}
+
+/*
+ * Dumps |service| to |write|, waiting at most |timeoutArg| seconds for it. When |asSection| is
+ * set, the dump is surrounded by the header and the duration printed when dumping many services.
+ */
+static void DumpService(const String16& service_name, const sp<IBinder>& service,
+                        const Vector<String16>& args, bool binderStats, int timeoutArg,
+                        bool asSection, const DumpWriter& write, DumpResult* result) {
+    const std::string name = String8(service_name).string();
+    int sfd[2];
+
+    if (pipe(sfd) != 0) {
+        aerr << "Failed to create pipe to dump service info for " << service_name
+             << ": " << strerror(errno) << endl;
+        result->skipped = true;
+        return;
+    }
+
+    unique_fd local_end(sfd[0]);
+    unique_fd remote_end(sfd[1]);
+    sfd[0] = sfd[1] = -1;
+
+    if (asSection) {
+        WriteString(write, "------------------------------------------------------------"
+                           "-------------------\n"
+                           "DUMP OF SERVICE " + name + ":\n");
+    }
+
+    // dump blocks until completion, so spawn a thread..
+    std::thread dump_thread([=, remote_end { std::move(remote_end) }]() mutable {
+        int err;
+        if (binderStats) {
+            Parcel data, reply;
+            data.writeFileDescriptor(remote_end.get());
+            data.writeInt32(!args.empty() && args[0] == String16("--reset"));
+            err = service->transact(IBinder::TRANSACTION_STATS_TRANSACTION, data, &reply);
+        } else {
+            err = service->dump(remote_end.get(), args);
+        }
+
+        // It'd be nice to be able to close the remote end of the socketpair before the dump
+        // call returns, to terminate our reads if the other end closes their copy of the
+        // file descriptor, but then hangs for some reason. There doesn't seem to be a good
+        // way to do this, though.
+        remote_end.reset();
+
+        if (err != 0) {
+            aerr << "Error dumping service info: (" << strerror(err) << ") " << service_name
+                 << endl;
+        }
+    });
+
+    auto timeout = std::chrono::seconds(timeoutArg);
+    auto start = std::chrono::steady_clock::now();
+    auto end = start + timeout;
+
+    struct pollfd pfd = {
+        .fd = local_end.get(),
+        .events = POLLIN
+    };
+
+    bool timed_out = false;
+    bool error = false;
+    while (true) {
+        // Wrap this in a lambda so that TEMP_FAILURE_RETRY recalculates the timeout.
+        auto time_left_ms = [end]() {
+            auto now = std::chrono::steady_clock::now();
+            auto diff = std::chrono::duration_cast<std::chrono::milliseconds>(end - now);
+            return std::max(diff.count(), 0ll);
+        };
+
+        int rc = TEMP_FAILURE_RETRY(poll(&pfd, 1, time_left_ms()));
+        if (rc < 0) {
+            aerr << "Error in poll while dumping service " << service_name << " : "
+                 << strerror(errno) << endl;
+            error = true;
+            break;
+        } else if (rc == 0) {
+            timed_out = true;
+            break;
+        }
+
+        char buf[4096];
+        rc = TEMP_FAILURE_RETRY(read(local_end.get(), buf, sizeof(buf)));
+        if (rc < 0) {
+            aerr << "Failed to read while dumping service " << service_name << ": "
+                 << strerror(errno) << endl;
+            error = true;
+            break;
+        } else if (rc == 0) {
+            // EOF.
+            break;
+        }
+
+        if (!write(buf, rc)) {
+            aerr << "Failed to write while dumping service " << service_name << ": "
+                 << strerror(errno) << endl;
+            error = true;
+            break;
+        }
+        result->bytes += rc;
+    }
+
+    if (timed_out) {
+        WriteString(write, StringPrintf("\n*** SERVICE '%s' DUMP TIMEOUT (%ds) EXPIRED ***\n\n",
+                                        name.c_str(), timeoutArg));
+    }
+
+    if (timed_out || error) {
+        dump_thread.detach();
+    } else {
+        dump_thread.join();
+    }
+
+    std::chrono::duration<double> elapsed_seconds = std::chrono::steady_clock::now() - start;
+    result->elapsed_seconds = elapsed_seconds.count();
+    result->timed_out = timed_out;
+    if (asSection) {
+        WriteString(write, StringPrintf("--------- %.3fs was the duration of dumpsys %s\n",
+                                        result->elapsed_seconds, name.c_str()));
+    }
+}
+
+static void PrintStats(const Vector<String16>& services, const std::vector<DumpResult>& results,
+                       double elapsed_seconds) {
+    size_t dumped = 0;
+    size_t total_bytes = 0;
+    double total_seconds = 0;
+    aout << "------------------------------------------------------------"
+            "-------------------" << endl;
+    aout << "DUMPSYS STATS:" << endl;
+    aout << StringPrintf("  %-40s %12s %10s", "SERVICE", "BYTES", "DURATION").c_str() << endl;
+    for (size_t i = 0; i < results.size(); i++) {
+        const DumpResult& result = results[i];
+        if (result.skipped) continue;
+        aout << StringPrintf("  %-40s %12zu %9.3fs%s", String8(services[i]).string(),
+                             result.bytes, result.elapsed_seconds,
+                             result.timed_out ? " (timed out)" : "").c_str() << endl;
+        dumped++;
+        total_bytes += result.bytes;
+        total_seconds += result.elapsed_seconds;
+    }
+    aout << StringPrintf("  %zu services, %zu bytes, %.3fs of dumps in %.3fs", dumped, total_bytes,
+                         total_seconds, elapsed_seconds).c_str() << endl;
+}
+
 int Dumpsys::main(int argc, char* const argv[]) {
     Vector<String16> services;
     Vector<String16> args;
     Vector<String16> skippedServices;
     bool showListOnly = false;
     bool skipServices = false;
+    bool binderStats = false;
+    bool showStats = false;
     int timeoutArg = 10;
+    int parallelism = 1;
     static struct option longOptions[] = {
         {"skip", no_argument, 0,  0 },
         {"help", no_argument, 0,  0 },
+        {"binder-stats", no_argument, 0,  0 },
+        {"parallel", required_argument, 0,  0 },
+        {"stats", no_argument, 0,  0 },
         {     0,           0, 0,  0 }
     };
 
@@ -105,6 +285,17 @@ int Dumpsys::main(int argc, char* const argv[]) {
             } else if (!strcmp(longOptions[optionIndex].name, "help")) {
                 usage();
                 return 0;
+            } else if (!strcmp(longOptions[optionIndex].name, "binder-stats")) {
+                binderStats = true;
+            } else if (!strcmp(longOptions[optionIndex].name, "parallel")) {
+                char *endptr;
+                parallelism = strtol(optarg, &endptr, 10);
+                if (*endptr != '\0' || parallelism <= 0) {
+                    fprintf(stderr, "Error: invalid number of parallel dumps: '%s'\n", optarg);
+                    return -1;
+                }
+            } else if (!strcmp(longOptions[optionIndex].name, "stats")) {
+                showStats = true;
             }
             break;
 
@@ -143,7 +334,8 @@ int Dumpsys::main(int argc, char* const argv[]) {
     }
 
     if ((skipServices && skippedServices.empty()) ||
-            (showListOnly && (!services.empty() || !skippedServices.empty()))) {
+            (showListOnly && (!services.empty() || !skippedServices.empty())) ||
+            (binderStats && (services.empty() || showListOnly || skipServices))) {
         usage();
         return -1;
     }
@@ -175,118 +367,75 @@ int Dumpsys::main(int argc, char* const argv[]) {
         return 0;
     }
 
-    for (size_t i = 0; i < N; i++) {
-        String16 service_name = std::move(services[i]);
-        if (IsSkipped(skippedServices, service_name)) continue;
-
+    std::vector<DumpResult> results(N);
+    auto dumpOne = [&](size_t i, const DumpWriter& write) {
+        const String16& service_name = services[i];
+        DumpResult* result = &results[i];
+        if (IsSkipped(skippedServices, service_name)) {
+            result->skipped = true;
+            return;
+        }
         sp<IBinder> service = sm_->checkService(service_name);
-        if (service != nullptr) {
-            int sfd[2];
-
-            if (pipe(sfd) != 0) {
-                aerr << "Failed to create pipe to dump service info for " << service_name
-                     << ": " << strerror(errno) << endl;
-                continue;
-            }
-
-            unique_fd local_end(sfd[0]);
-            unique_fd remote_end(sfd[1]);
-            sfd[0] = sfd[1] = -1;
-
-            if (N > 1) {
-                aout << "------------------------------------------------------------"
-                        "-------------------" << endl;
-                aout << "DUMP OF SERVICE " << service_name << ":" << endl;
-            }
-
-            // dump blocks until completion, so spawn a thread..
-            std::thread dump_thread([=, remote_end { std::move(remote_end) }]() mutable {
-                int err = service->dump(remote_end.get(), args);
-
-                // It'd be nice to be able to close the remote end of the socketpair before the dump
-                // call returns, to terminate our reads if the other end closes their copy of the
-                // file descriptor, but then hangs for some reason. There doesn't seem to be a good
-                // way to do this, though.
-                remote_end.reset();
-
-                if (err != 0) {
-                    aerr << "Error dumping service info: (" << strerror(err) << ") " << service_name
-                         << endl;
-                }
-            });
-
-            auto timeout = std::chrono::seconds(timeoutArg);
-            auto start = std::chrono::steady_clock::now();
-            auto end = start + timeout;
-
-            struct pollfd pfd = {
-                .fd = local_end.get(),
-                .events = POLLIN
-            };
-
-            bool timed_out = false;
-            bool error = false;
-            while (true) {
-                // Wrap this in a lambda so that TEMP_FAILURE_RETRY recalculates the timeout.
-                auto time_left_ms = [end]() {
-                    auto now = std::chrono::steady_clock::now();
-                    auto diff = std::chrono::duration_cast<std::chrono::milliseconds>(end - now);
-                    return std::max(diff.count(), 0ll);
-                };
-
-                int rc = TEMP_FAILURE_RETRY(poll(&pfd, 1, time_left_ms()));
-                if (rc < 0) {
-                    aerr << "Error in poll while dumping service " << service_name << " : "
-                         << strerror(errno) << endl;
-                    error = true;
-                    break;
-                } else if (rc == 0) {
-                    timed_out = true;
-                    break;
-                }
-
-                char buf[4096];
-                rc = TEMP_FAILURE_RETRY(read(local_end.get(), buf, sizeof(buf)));
-                if (rc < 0) {
-                    aerr << "Failed to read while dumping service " << service_name << ": "
-                         << strerror(errno) << endl;
-                    error = true;
-                    break;
-                } else if (rc == 0) {
-                    // EOF.
-                    break;
-                }
-
-                if (!WriteFully(STDOUT_FILENO, buf, rc)) {
-                    aerr << "Failed to write while dumping service " << service_name << ": "
-                         << strerror(errno) << endl;
-                    error = true;
-                    break;
-                }
-            }
+        if (service == nullptr) {
+            aerr << "Can't find service: " << service_name << endl;
+            result->skipped = true;
+            return;
+        }
+        DumpService(service_name, service, args, binderStats, timeoutArg, N > 1, write, result);
+    };
 
-            if (timed_out) {
-                aout << endl
-                     << "*** SERVICE '" << service_name << "' DUMP TIMEOUT (" << timeoutArg
-                     << "s) EXPIRED ***" << endl
-                     << endl;
+    auto start = std::chrono::steady_clock::now();
+    if (parallelism > 1 && N > 1) {
+        // Each service is dumped into its own buffer by one of the workers, and the buffers are
+        // printed in order as soon as all of the services before them are done.
+        std::vector<std::string> buffers(N);
+        std::vector<bool> done(N, false);
+        std::mutex lock;
+        std::condition_variable changed;
+        std::atomic<size_t> next(0);
+        auto work = [&]() {
+            size_t i;
+            while ((i = next++) < N) {
+                std::string* buffer = &buffers[i];
+                dumpOne(i, [buffer](const char* data, size_t size) {
+                    buffer->append(data, size);
+                    return true;
+                });
+                std::lock_guard<std::mutex> guard(lock);
+                done[i] = true;
+                changed.notify_all();
             }
-
-            if (timed_out || error) {
-                dump_thread.detach();
-            } else {
-                dump_thread.join();
+        };
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < std::min(static_cast<size_t>(parallelism), N); i++) {
+            workers.emplace_back(work);
+        }
+        for (size_t i = 0; i < N; i++) {
+            std::string buffer;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                changed.wait(guard, [&done, i] { return done[i]; });
+                buffer.swap(buffers[i]);
             }
-
-            if (N > 1) {
-              std::chrono::duration<double> elapsed_seconds =
-                  std::chrono::steady_clock::now() - start;
-              aout << StringPrintf("--------- %.3fs ", elapsed_seconds.count()).c_str()
-                   << "was the duration of dumpsys " << service_name << endl;
+            if (!WriteFully(STDOUT_FILENO, buffer.data(), buffer.size())) {
+                aerr << "Failed to write dump of service " << services[i] << ": "
+                     << strerror(errno) << endl;
             }
-        } else {
-            aerr << "Can't find service: " << service_name << endl;
         }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    } else {
+        for (size_t i = 0; i < N; i++) {
+            dumpOne(i, [](const char* data, size_t size) {
+                return WriteFully(STDOUT_FILENO, data, size);
+            });
+        }
+    }
+
+    if (showStats) {
+        std::chrono::duration<double> elapsed_seconds = std::chrono::steady_clock::now() - start;
+        PrintStats(services, results, elapsed_seconds.count());
     }
 
     return 0;
@@ -31,6 +31,7 @@ using namespace android;
 using ::testing::_;
 using ::testing::Action;
 using ::testing::ActionInterface;
+using ::testing::ContainsRegex;
 using ::testing::DoAll;
 using ::testing::Eq;
 using ::testing::HasSubstr;
@@ -192,6 +193,19 @@ class DumpsysTest : public Test {
         EXPECT_THAT(stdout_, HasSubstr(expected));
     }
 
+    void AssertOutputMatches(const std::string& regex) {
+        EXPECT_THAT(stdout_, ContainsRegex(regex));
+    }
+
+    void AssertOutputInOrder(const std::vector<std::string>& dumps) {
+        size_t last = 0;
+        for (const std::string& dump : dumps) {
+            size_t pos = stdout_.find(dump, last);
+            EXPECT_NE(std::string::npos, pos) << dump << " missing or out of order";
+            last = pos;
+        }
+    }
+
     void AssertDumped(const std::string& service, const std::string& dump) {
         EXPECT_THAT(stdout_, HasSubstr("DUMP OF SERVICE " + service + ":\n" + dump));
     }
@@ -298,3 +312,35 @@ TEST_F(DumpsysTest, DumpWithSkip) {
     AssertNotDumped("dump3");
     AssertNotDumped("dump5");
 }
+
+// Tests 'dumpsys --parallel 2', which should still print the services in order
+TEST_F(DumpsysTest, DumpMultipleServicesInParallel) {
+    ExpectListServices({"running1", "stopped2", "running3", "running4"});
+    ExpectDumpAndHang("running1", 1, "dump1");
+    ExpectCheckService("stopped2", false);
+    ExpectDump("running3", "dump3");
+    ExpectDump("running4", "dump4");
+
+    CallMain({"--parallel", "2"});
+
+    AssertRunningServices({"running1", "running3", "running4"});
+    AssertDumped("running1", "dump1");
+    AssertStopped("stopped2");
+    AssertDumped("running3", "dump3");
+    AssertDumped("running4", "dump4");
+    AssertOutputInOrder({"dump1", "dump3", "dump4"});
+}
+
+// Tests 'dumpsys --stats', which should print how much each service dumped
+TEST_F(DumpsysTest, DumpWithStats) {
+    ExpectListServices({"running1", "skipped2"});
+    ExpectDump("running1", "dump1");
+    ExpectDump("skipped2", "dump2");
+
+    CallMain({"--stats", "--skip", "skipped2"});
+
+    AssertDumped("running1", "dump1");
+    AssertNotDumped("dump2");
+    AssertOutputContains("DUMPSYS STATS:\n");
+    AssertOutputMatches("\n  running1 +5 +[0-9.]+s\n  1 services, 5 bytes, ");
+}
@@ -282,4 +282,227 @@ Composer* blendShrink() {
     return new BlendShrinkComp();
 }
 
+Composer* hwcOverlay() {
+    // The layer is scanned out by the hardware composer: GLES only has to
+    // clear the hole through which the overlay is seen.
+    class HwcOverlayComp : public ComposerBase {
+        virtual bool compose(GLuint /*texName*/, const sp<GLConsumer>& /*glc*/) {
+            GLint vp[4];
+            glGetIntegerv(GL_VIEWPORT, vp);
+
+            int32_t x = mLayerDesc.x;
+            int32_t y = mLayerDesc.y;
+            int32_t w = mLayerDesc.width;
+            int32_t h = mLayerDesc.height;
+
+            glEnable(GL_SCISSOR_TEST);
+            glScissor(x, vp[3] - y - h, w, h);
+            glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+            glClear(GL_COLOR_BUFFER_BIT);
+            glDisable(GL_SCISSOR_TEST);
+
+            return true;
+        }
+    };
+    return new HwcOverlayComp();
+}
+
+Composer* blurBehind() {
+    // A translucent layer over a blurred copy of what is behind it.  The
+    // blur is done with separable passes in a downscaled buffer, the way
+    // frosted glass effects are usually implemented.
+    class BlurBehindComp : public ComposerBase {
+        virtual bool setUp(GLHelper* helper) {
+            bool result;
+
+            result = mBlitter.setUp(helper);
+            if (!result) {
+                return false;
+            }
+
+            result = helper->getShaderProgram("Blur", &mBlurPgm);
+            if (!result) {
+                return false;
+            }
+
+            mPosAttribLoc = glGetAttribLocation(mBlurPgm, "position");
+            mUVAttribLoc = glGetAttribLocation(mBlurPgm, "uv");
+            mObjToNdcUniformLoc = glGetUniformLocation(mBlurPgm, "objToNdc");
+            mBlurSrcSamplerLoc = glGetUniformLocation(mBlurPgm, "blurSrc");
+            mBlurStepUniformLoc = glGetUniformLocation(mBlurPgm, "blurStep");
+
+            mSmallWidth = mLayerDesc.width / DOWNSCALE_FACTOR;
+            mSmallHeight = mLayerDesc.height / DOWNSCALE_FACTOR;
+            if (mSmallWidth == 0 || mSmallHeight == 0) {
+                mSmallWidth = mSmallHeight = 1;
+            }
+
+            glGenTextures(NUM_TEXTURES, mTexNames);
+            setUpTexture(mTexNames[0], mLayerDesc.width, mLayerDesc.height);
+            setUpTexture(mTexNames[1], mSmallWidth, mSmallHeight);
+            setUpTexture(mTexNames[2], mSmallWidth, mSmallHeight);
+            glGenFramebuffers(1, &mFbo);
+
+            if (glGetError() != GL_NO_ERROR) {
+                fprintf(stderr, "GL error!\n");
+                return false;
+            }
+
+            return true;
+        }
+
+        virtual void tearDown() {
+            glDeleteFramebuffers(1, &mFbo);
+            glDeleteTextures(NUM_TEXTURES, mTexNames);
+        }
+
+        virtual bool compose(GLuint texName, const sp<GLConsumer>& glc) {
+            bool result;
+
+            float texMatrix[16];
+            glc->getTransformMatrix(texMatrix);
+
+            float modColor[4] = { .5f, .5f, .5f, .5f };
+
+            int32_t x = mLayerDesc.x;
+            int32_t y = mLayerDesc.y;
+            int32_t w = mLayerDesc.width;
+            int32_t h = mLayerDesc.height;
+
+            GLint vp[4];
+            glGetIntegerv(GL_VIEWPORT, vp);
+
+            // Copy what has been composed so far behind the layer.
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, mTexNames[0]);
+            glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, x, vp[3] - y - h, w, h);
+
+            // Downscale and blur it horizontally, then vertically.
+            float identity[16] = {
+                1.0f,   0.0f,   0.0f,   0.0f,
+                0.0f,   1.0f,   0.0f,   0.0f,
+                0.0f,   0.0f,   1.0f,   0.0f,
+                0.0f,   0.0f,   0.0f,   1.0f,
+            };
+            const float ndcPos[] = {
+                -1.0f,  -1.0f,
+                1.0f,   -1.0f,
+                -1.0f,  1.0f,
+                1.0f,   1.0f,
+            };
+            const float uv[] = {
+                0.0f, 0.0f,
+                1.0f, 0.0f,
+                0.0f, 1.0f,
+                1.0f, 1.0f,
+            };
+
+            glBindFramebuffer(GL_FRAMEBUFFER, mFbo);
+            glViewport(0, 0, mSmallWidth, mSmallHeight);
+
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                    GL_TEXTURE_2D, mTexNames[1], 0);
+            drawBlur(mTexNames[0], identity, ndcPos, uv, 1.0f / float(w), 0.0f);
+
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                    GL_TEXTURE_2D, mTexNames[2], 0);
+            drawBlur(mTexNames[1], identity, ndcPos, uv,
+                    0.0f, 1.0f / float(mSmallHeight));
+
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            glViewport(vp[0], vp[1], vp[2], vp[3]);
+
+            // Upscale the blurred background back in place, smoothing it
+            // once more, and blend the layer on top of it.
+            float screenToNdc[16] = {
+                2.0f/float(vp[2]),  0.0f,               0.0f,   0.0f,
+                0.0f,               -2.0f/float(vp[3]), 0.0f,   0.0f,
+                0.0f,               0.0f,               1.0f,   0.0f,
+                -1.0f,              1.0f,               0.0f,   1.0f,
+            };
+            const float screenPos[] = {
+                float(x),   float(y),
+                float(x+w), float(y),
+                float(x),   float(y+h),
+                float(x+w), float(y+h),
+            };
+            const float flippedUv[] = {
+                0.0f, 1.0f,
+                1.0f, 1.0f,
+                0.0f, 0.0f,
+                1.0f, 0.0f,
+            };
+            drawBlur(mTexNames[2], screenToNdc, screenPos, flippedUv,
+                    1.0f / float(mSmallWidth), 0.0f);
+
+            glEnable(GL_BLEND);
+            glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+            result = mBlitter.modBlit(texName, texMatrix, modColor,
+                    x, y, w, h);
+            if (!result) {
+                return false;
+            }
+
+            glDisable(GL_BLEND);
+
+            return true;
+        }
+
+        void drawBlur(GLuint srcTexName, const float* objToNdc,
+                const float* pos, const float* uv, float stepX, float stepY) {
+            glUseProgram(mBlurPgm);
+
+            glVertexAttribPointer(mPosAttribLoc, 2, GL_FLOAT, GL_FALSE, 0, pos);
+            glVertexAttribPointer(mUVAttribLoc, 2, GL_FLOAT, GL_FALSE, 0, uv);
+            glEnableVertexAttribArray(mPosAttribLoc);
+            glEnableVertexAttribArray(mUVAttribLoc);
+
+            glUniformMatrix4fv(mObjToNdcUniformLoc, 1, GL_FALSE, objToNdc);
+            glUniform2f(mBlurStepUniformLoc, stepX, stepY);
+
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, srcTexName);
+            glUniform1i(mBlurSrcSamplerLoc, 0);
+
+            glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+            glDisableVertexAttribArray(mPosAttribLoc);
+            glDisableVertexAttribArray(mUVAttribLoc);
+
+            if (glGetError() != GL_NO_ERROR) {
+                fprintf(stderr, "GL error!\n");
+            }
+        }
+
+        static void setUpTexture(GLuint texName, uint32_t w, uint32_t h) {
+            glBindTexture(GL_TEXTURE_2D, texName);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA,
+                    GL_UNSIGNED_BYTE, NULL);
+        }
+
+        enum { DOWNSCALE_FACTOR = 4 };
+        enum { NUM_TEXTURES = 3 };
+
+        Blitter mBlitter;
+        GLuint mBlurPgm;
+        GLint mPosAttribLoc;
+        GLint mUVAttribLoc;
+        GLint mObjToNdcUniformLoc;
+        GLint mBlurSrcSamplerLoc;
+        GLint mBlurStepUniformLoc;
+
+        // The copy of the background, then the two blur passes
+        GLuint mTexNames[NUM_TEXTURES];
+        GLuint mFbo;
+        uint32_t mSmallWidth;
+        uint32_t mSmallHeight;
+    };
+    return new BlurBehindComp();
+}
+
 } // namespace android
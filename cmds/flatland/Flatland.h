@@ -20,6 +20,7 @@
 #include <GLES2/gl2.h>
 
 #include <gui/GLConsumer.h>
+#include <gui/Surface.h>
 
 namespace android {
 
@@ -32,6 +33,16 @@ class Composer;
 class Renderer;
 class GLHelper;
 
+// LayerDesc flags
+enum {
+    // The layer's buffers are RGBA_FP16, as used for wide color content.
+    LAYER_FP16 = 0x1,
+
+    // The layer's buffers are YV12 and are filled by the CPU, like decoded
+    // video frames.  Its renderer must implement renderCpu().
+    LAYER_YUV = 0x2,
+};
+
 struct LayerDesc {
     uint32_t flags;
     Renderer* (*rendererFactory)();
@@ -57,6 +68,8 @@ Composer* opaque();
 Composer* opaqueShrink();
 Composer* blend();
 Composer* blendShrink();
+Composer* hwcOverlay();
+Composer* blurBehind();
 
 class Renderer {
 public:
@@ -64,8 +77,12 @@ public:
     virtual bool setUp(GLHelper* helper) = 0;
     virtual void tearDown() = 0;
     virtual bool render(EGLSurface surface) = 0;
+
+    // Used instead of render() for LAYER_YUV layers.
+    virtual bool renderCpu(const sp<Surface>& /*surface*/) { return false; }
 };
 
 Renderer* staticGradient();
+Renderer* yuvVideo();
 
 } // namespace android
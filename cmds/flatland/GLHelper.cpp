@@ -16,6 +16,7 @@
 
 #include <GLES2/gl2.h>
 #include <GLES2/gl2ext.h>
+#include <EGL/eglext.h>
 
 #include <ui/DisplayInfo.h>
 #include <gui/SurfaceComposerClient.h>
@@ -29,6 +30,7 @@ GLHelper::GLHelper() :
     mContext(EGL_NO_CONTEXT),
     mDummySurface(EGL_NO_SURFACE),
     mConfig(0),
+    mFp16Config(0),
     mShaderPrograms(NULL),
     mDitherTexture(0) {
 }
@@ -81,8 +83,8 @@ bool GLHelper::setUp(const ShaderDesc* shaderDescs, size_t numShaders) {
         return false;
     }
 
-    bool resultb = createNamedSurfaceTexture(0, 1, 1, &mDummyGLConsumer,
-            &mDummySurface);
+    bool resultb = createNamedSurfaceTexture(0, 1, 1, mConfig,
+            &mDummyGLConsumer, &mDummySurface);
     if (!resultb) {
         return false;
     }
@@ -97,9 +99,51 @@ bool GLHelper::setUp(const ShaderDesc* shaderDescs, size_t numShaders) {
         return false;
     }
 
+    chooseFp16Config();
+
     return true;
 }
 
+void GLHelper::chooseFp16Config() {
+    EGLint numConfigs = 0;
+    EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+        EGL_COLOR_COMPONENT_TYPE_EXT, EGL_COLOR_COMPONENT_TYPE_FLOAT_EXT,
+        EGL_RED_SIZE, 16,
+        EGL_GREEN_SIZE, 16,
+        EGL_BLUE_SIZE, 16,
+        EGL_ALPHA_SIZE, 16,
+        EGL_NONE
+    };
+    EGLConfig config = 0;
+    EGLBoolean result = eglChooseConfig(mDisplay, configAttribs, &config, 1,
+            &numConfigs);
+    if (result != EGL_TRUE || numConfigs < 1) {
+        // Not an error, the scenarios using FP16 layers are skipped.
+        eglGetError();
+        return;
+    }
+
+    // Layers are all rendered with the same context, make sure it can be
+    // used with FP16 surfaces.
+    sp<GLConsumer> glc;
+    EGLSurface surface;
+    if (!createNamedSurfaceTexture(0, 1, 1, config, &glc, &surface)) {
+        return;
+    }
+    result = eglMakeCurrent(mDisplay, surface, surface, mContext);
+    eglMakeCurrent(mDisplay, mDummySurface, mDummySurface, mContext);
+    eglDestroySurface(mDisplay, surface);
+    glc->abandon();
+    if (result != EGL_TRUE) {
+        eglGetError();
+        return;
+    }
+
+    mFp16Config = config;
+}
+
 void GLHelper::tearDown() {
     if (mShaderPrograms != NULL) {
         delete[] mShaderPrograms;
@@ -129,6 +173,7 @@ void GLHelper::tearDown() {
     mDummySurface = EGL_NO_SURFACE;
     mDummyGLConsumer.clear();
     mConfig = 0;
+    mFp16Config = 0;
 }
 
 bool GLHelper::makeCurrent(EGLSurface surface) {
@@ -150,6 +195,29 @@ bool GLHelper::makeCurrent(EGLSurface surface) {
 
 bool GLHelper::createSurfaceTexture(uint32_t w, uint32_t h,
         sp<GLConsumer>* glConsumer, EGLSurface* surface,
+        GLuint* name, bool fp16) {
+    if (fp16 && mFp16Config == 0) {
+        fprintf(stderr, "FP16 surfaces are not supported\n");
+        return false;
+    }
+
+    if (!makeCurrent(mDummySurface)) {
+        return false;
+    }
+
+    *name = 0;
+    glGenTextures(1, name);
+    if (*name == 0) {
+        fprintf(stderr, "glGenTextures error: %#x\n", glGetError());
+        return false;
+    }
+
+    return createNamedSurfaceTexture(*name, w, h,
+            fp16 ? mFp16Config : mConfig, glConsumer, surface);
+}
+
+bool GLHelper::createCpuSurfaceTexture(uint32_t w, uint32_t h,
+        PixelFormat format, sp<GLConsumer>* glConsumer, sp<Surface>* surface,
         GLuint* name) {
     if (!makeCurrent(mDummySurface)) {
         return false;
@@ -162,7 +230,13 @@ bool GLHelper::createSurfaceTexture(uint32_t w, uint32_t h,
         return false;
     }
 
-    return createNamedSurfaceTexture(*name, w, h, glConsumer, surface);
+    sp<IGraphicBufferProducer> producer;
+    sp<GLConsumer> glc = createNamedGLConsumer(*name, w, h, &producer);
+    glc->setDefaultBufferFormat(format);
+
+    *glConsumer = glc;
+    *surface = new Surface(producer);
+    return true;
 }
 
 void GLHelper::destroySurface(EGLSurface* surface) {
@@ -198,19 +272,25 @@ bool GLHelper::getShaderProgram(const char* name, GLuint* outPgm) {
     return false;
 }
 
-bool GLHelper::createNamedSurfaceTexture(GLuint name, uint32_t w, uint32_t h,
-        sp<GLConsumer>* glConsumer, EGLSurface* surface) {
-    sp<IGraphicBufferProducer> producer;
+sp<GLConsumer> GLHelper::createNamedGLConsumer(GLuint name, uint32_t w,
+        uint32_t h, sp<IGraphicBufferProducer>* producer) {
     sp<IGraphicBufferConsumer> consumer;
-    BufferQueue::createBufferQueue(&producer, &consumer);
+    BufferQueue::createBufferQueue(producer, &consumer);
     sp<GLConsumer> glc = new GLConsumer(consumer, name,
             GL_TEXTURE_EXTERNAL_OES, false, true);
     glc->setDefaultBufferSize(w, h);
-    producer->setMaxDequeuedBufferCount(2);
+    (*producer)->setMaxDequeuedBufferCount(2);
     glc->setConsumerUsageBits(GRALLOC_USAGE_HW_COMPOSER);
+    return glc;
+}
+
+bool GLHelper::createNamedSurfaceTexture(GLuint name, uint32_t w, uint32_t h,
+        EGLConfig config, sp<GLConsumer>* glConsumer, EGLSurface* surface) {
+    sp<IGraphicBufferProducer> producer;
+    sp<GLConsumer> glc = createNamedGLConsumer(name, w, h, &producer);
 
     sp<ANativeWindow> anw = new Surface(producer);
-    EGLSurface s = eglCreateWindowSurface(mDisplay, mConfig, anw.get(), NULL);
+    EGLSurface s = eglCreateWindowSurface(mDisplay, config, anw.get(), NULL);
     if (s == EGL_NO_SURFACE) {
         fprintf(stderr, "eglCreateWindowSurface error: %#x\n", eglGetError());
         return false;
@@ -52,8 +52,17 @@ public:
 
     bool createSurfaceTexture(uint32_t w, uint32_t h,
             sp<GLConsumer>* surfaceTexture, EGLSurface* surface,
+            GLuint* name, bool fp16 = false);
+
+    // Creates a surface texture whose buffers are filled by the CPU rather
+    // than rendered to with GLES.
+    bool createCpuSurfaceTexture(uint32_t w, uint32_t h, PixelFormat format,
+            sp<GLConsumer>* surfaceTexture, sp<Surface>* surface,
             GLuint* name);
 
+    // Whether the device can render to RGBA_FP16 surfaces.
+    bool hasFp16Config() const { return mFp16Config != 0; }
+
     bool createWindowSurface(uint32_t w, uint32_t h,
             sp<SurfaceControl>* surfaceControl, EGLSurface* surface);
 
@@ -68,7 +77,13 @@ public:
 private:
 
     bool createNamedSurfaceTexture(GLuint name, uint32_t w, uint32_t h,
-            sp<GLConsumer>* surfaceTexture, EGLSurface* surface);
+            EGLConfig config, sp<GLConsumer>* surfaceTexture,
+            EGLSurface* surface);
+
+    sp<GLConsumer> createNamedGLConsumer(GLuint name, uint32_t w, uint32_t h,
+            sp<IGraphicBufferProducer>* producer);
+
+    void chooseFp16Config();
 
     bool computeWindowScale(uint32_t w, uint32_t h, float* scale);
 
@@ -79,6 +94,7 @@ private:
     EGLSurface mDummySurface;
     sp<GLConsumer> mDummyGLConsumer;
     EGLConfig mConfig;
+    EGLConfig mFp16Config;
 
     sp<SurfaceComposerClient> mSurfaceComposerClient;
 
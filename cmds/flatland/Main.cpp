@@ -21,6 +21,7 @@
 #include <gui/GLConsumer.h>
 #include <gui/Surface.h>
 #include <ui/Fence.h>
+#include <ui/PixelFormat.h>
 #include <utils/Trace.h>
 
 #include <EGL/egl.h>
@@ -201,6 +202,97 @@ static const BenchmarkDesc benchmarks[] = {
             },
         },
     },
+
+    { "16:10 Wide Color Window",
+        2560, 1600, { 800, 1200, 1600, 2400 },
+        {
+            {   // Window
+                LAYER_FP16, staticGradient, opaque,
+                0,    50,     2560,   1454,
+            },
+            {   // Status bar
+                0, staticGradient, opaque,
+                0,    0,      2560,   50,
+            },
+            {   // Navigation bar
+                0, staticGradient, opaque,
+                0,    1504,   2560,   96,
+            },
+        },
+    },
+
+    // The next two scenarios play the same video with the same controls on
+    // top of it, the difference between them is the cost of composing the
+    // video with GLES rather than with a hardware overlay.
+    { "16:10 Video, GLES Composition",
+        2560, 1600, { 800, 1200, 1600, 2400 },
+        {
+            {   // Video
+                LAYER_YUV, yuvVideo, opaque,
+                0,    0,      2560,   1600,
+            },
+            {   // Player controls
+                0, staticGradient, blend,
+                0,    1300,   2560,   200,
+            },
+            {   // Status bar
+                0, staticGradient, blend,
+                0,    0,      2560,   50,
+            },
+            {   // Navigation bar
+                0, staticGradient, blend,
+                0,    1504,   2560,   96,
+            },
+        },
+    },
+
+    { "16:10 Video, HWC Overlay",
+        2560, 1600, { 800, 1200, 1600, 2400 },
+        {
+            {   // Video
+                LAYER_YUV, yuvVideo, hwcOverlay,
+                0,    0,      2560,   1600,
+            },
+            {   // Player controls
+                0, staticGradient, blend,
+                0,    1300,   2560,   200,
+            },
+            {   // Status bar
+                0, staticGradient, blend,
+                0,    0,      2560,   50,
+            },
+            {   // Navigation bar
+                0, staticGradient, blend,
+                0,    1504,   2560,   96,
+            },
+        },
+    },
+
+    { "16:10 Blurred Dialog",
+        2560, 1600, { 800, 1200, 1600, 2400 },
+        {
+            {   // Wallpaper
+                0, staticGradient, opaque,
+                0,    50,     2560,   1454,
+            },
+            {   // Launcher
+                0, staticGradient, blend,
+                0,    50,     2560,   1454,
+            },
+            {   // Dialog
+                0, staticGradient, blurBehind,
+                640,  400,    1280,   800,
+            },
+            {   // Status bar
+                0, staticGradient, opaque,
+                0,    0,      2560,   50,
+            },
+            {   // Navigation bar
+                0, staticGradient, opaque,
+                0,    1504,   2560,   96,
+            },
+        },
+    },
 };
 
 static const ShaderDesc shaders[] = {
@@ -277,6 +369,46 @@ static const ShaderDesc shaders[] = {
             "}",
         },
     },
+
+    {
+        .name="Blur",
+        .vertexShader={
+            "precision mediump float;",
+            "",
+            "attribute vec4 position;",
+            "attribute vec4 uv;",
+            "",
+            "varying vec2 texCoords;",
+            "",
+            "uniform mat4 objToNdc;",
+            "",
+            "void main() {",
+            "    gl_Position = objToNdc * position;",
+            "    texCoords = uv.xy;",
+            "}",
+        },
+        .fragmentShader={
+            "precision mediump float;",
+            "",
+            "varying vec2 texCoords;",
+            "",
+            "uniform sampler2D blurSrc;",
+            "uniform vec2 blurStep;",
+            "",
+            "// A 9-tap gaussian, using bilinear filtering to get two taps",
+            "// per texture fetch.",
+            "void main() {",
+            "    vec2 offset0 = blurStep * 1.3846153846;",
+            "    vec2 offset1 = blurStep * 3.2307692308;",
+            "    vec4 color = texture2D(blurSrc, texCoords) * 0.2270270270;",
+            "    color += texture2D(blurSrc, texCoords + offset0) * 0.3162162162;",
+            "    color += texture2D(blurSrc, texCoords - offset0) * 0.3162162162;",
+            "    color += texture2D(blurSrc, texCoords + offset1) * 0.0702702703;",
+            "    color += texture2D(blurSrc, texCoords - offset1) * 0.0702702703;",
+            "    gl_FragColor = color;",
+            "}",
+        },
+    },
 };
 
 class Layer {
@@ -286,7 +418,9 @@ public:
     Layer() :
         mFirstFrame(true),
         mGLHelper(NULL),
-        mSurface(EGL_NO_SURFACE) {
+        mSurface(EGL_NO_SURFACE),
+        mRenderer(NULL),
+        mComposer(NULL) {
     }
 
     bool setUp(const LayerDesc& desc, GLHelper* helper) {
@@ -295,8 +429,15 @@ public:
         mDesc = desc;
         mGLHelper = helper;
 
-        result = mGLHelper->createSurfaceTexture(mDesc.width, mDesc.height,
-                &mGLConsumer, &mSurface, &mTexName);
+        if (mDesc.flags & LAYER_YUV) {
+            result = mGLHelper->createCpuSurfaceTexture(mDesc.width,
+                    mDesc.height, HAL_PIXEL_FORMAT_YV12, &mGLConsumer,
+                    &mCpuSurface, &mTexName);
+        } else {
+            result = mGLHelper->createSurfaceTexture(mDesc.width, mDesc.height,
+                    &mGLConsumer, &mSurface, &mTexName,
+                    (mDesc.flags & LAYER_FP16) != 0);
+        }
         if (!result) {
             return false;
         }
@@ -333,11 +474,18 @@ public:
             mGLHelper->destroySurface(&mSurface);
             mGLConsumer->abandon();
         }
+        if (mCpuSurface != NULL) {
+            mCpuSurface.clear();
+            mGLConsumer->abandon();
+        }
         mGLHelper = NULL;
         mGLConsumer.clear();
     }
 
     bool render() {
+        if (mCpuSurface != NULL) {
+            return mRenderer->renderCpu(mCpuSurface);
+        }
         return mRenderer->render(mSurface);
     }
 
@@ -368,6 +516,9 @@ private:
     sp<GLConsumer> mGLConsumer;
     EGLSurface mSurface;
 
+    // Used instead of mSurface by LAYER_YUV layers
+    sp<Surface> mCpuSurface;
+
     Renderer* mRenderer;
     Composer* mComposer;
 };
@@ -380,6 +531,7 @@ public:
         mDesc(desc),
         mInstance(instance),
         mNumLayers(countLayers(desc)),
+        mSupported(true),
         mGLHelper(NULL),
         mSurface(EGL_NO_SURFACE),
         mWindowSurface(EGL_NO_SURFACE) {
@@ -409,6 +561,14 @@ public:
             return false;
         }
 
+        for (size_t i = 0; i < mNumLayers; i++) {
+            if ((mDesc.layers[i].flags & LAYER_FP16) &&
+                    !mGLHelper->hasFp16Config()) {
+                mSupported = false;
+                return true;
+            }
+        }
+
         for (size_t i = 0; i < mNumLayers; i++) {
             // Scale the layer to match the current screen size.
             LayerDesc ld = mDesc.layers[i];
@@ -461,7 +621,16 @@ public:
         }
     }
 
-    nsecs_t run(uint32_t warmUpFrames, uint32_t totalFrames) {
+    // Whether the device has what the benchmark needs.  Only valid after a
+    // successful setUp(), the benchmark can't be run if this is false.
+    bool isSupported() const {
+        return mSupported;
+    }
+
+    // If frameTimes isn't NULL, the time each of the timed frames took to
+    // complete is appended to it.
+    nsecs_t run(uint32_t warmUpFrames, uint32_t totalFrames,
+            Vector<double>* frameTimes = NULL) {
         ATRACE_CALL();
 
         bool result;
@@ -481,11 +650,15 @@ public:
         sp<Fence> startFence = mGLConsumer->getCurrentFence();
 
         //  the timed frames.
+        Vector<sp<Fence> > frameFences;
         for (uint32_t i = warmUpFrames; i < totalFrames; i++) {
             result = doFrame(mSurface);
             if (!result) {
                 return -1;
             }
+            if (frameTimes != NULL) {
+                frameFences.add(mGLConsumer->getCurrentFence());
+            }
         }
 
         // Grab the fence for the end timestamp.
@@ -503,6 +676,17 @@ public:
         nsecs_t startTime = startFence->getSignalTime();
         nsecs_t endTime = endFence->getSignalTime();
 
+        // Frames complete in order, so each one took from the completion of
+        // the previous one to its own.
+        if (frameTimes != NULL) {
+            nsecs_t prevTime = startTime;
+            for (size_t i = 0; i < frameFences.size(); i++) {
+                nsecs_t time = frameFences[i]->getSignalTime();
+                frameTimes->add(double(time - prevTime));
+                prevTime = time;
+            }
+        }
+
         return endTime - startTime;
     }
 
@@ -568,6 +752,7 @@ private:
     const BenchmarkDesc& mDesc;
     const size_t mInstance;
     const size_t mNumLayers;
+    bool mSupported;
 
     GLHelper* mGLHelper;
 
@@ -591,11 +776,21 @@ static int cmpDouble(const double* lhs, const double* rhs) {
     return 0;
 }
 
+// Returns the p-th percentile of sorted samples.
+static double percentile(const Vector<double>& samples, size_t p) {
+    size_t i = samples.size() * p / 100;
+    if (i >= samples.size()) {
+        i = samples.size() - 1;
+    }
+    return samples[i];
+}
+
 // Run a single benchmark and print the result.
 static bool runTest(const BenchmarkDesc b, size_t run) {
     bool success = true;
     double prevResult = 0.0, result = 0.0;
     Vector<double> samples;
+    Vector<double> frameTimes;
 
     uint32_t runHeight = b.runHeights[run];
     uint32_t runWidth = b.width * runHeight / b.height;
@@ -619,6 +814,10 @@ static bool runTest(const BenchmarkDesc b, size_t run) {
 
     // Find the number of frames needed to run for over 100ms.
     double runTime = 0.0;
+    if (!r.isSupported()) {
+        printf("unsupported");
+        goto done;
+    }
     while (true) {
         runTime = double(r.run(warmUpFrames, totalFrames));
         if (runTime < 50e6) {
@@ -652,7 +851,8 @@ static bool runTest(const BenchmarkDesc b, size_t run) {
         }
 
         for (size_t i = 0; i < newSamples; i++) {
-            double sample = double(r.run(warmUpFrames, totalFrames));
+            double sample = double(r.run(warmUpFrames, totalFrames,
+                    &frameTimes));
 
             if (g_SleepBetweenSamplesMs > 0) {
                 usleep(g_SleepBetweenSamplesMs  * 1000);
@@ -675,6 +875,10 @@ static bool runTest(const BenchmarkDesc b, size_t run) {
 
     printf("%6.3f", result / double(totalFrames - warmUpFrames) / 1e6);
 
+    frameTimes.sort(cmpDouble);
+    printf(" | %6.3f %6.3f %6.3f", percentile(frameTimes, 50) / 1e6,
+            percentile(frameTimes, 90) / 1e6, percentile(frameTimes, 99) / 1e6);
+
 done:
 
     printf("\n");
@@ -689,7 +893,7 @@ static void printResultsTableHeader() {
     size_t len = strlen(scenario);
     size_t leftPad = (g_BenchmarkNameLen - len) / 2;
     size_t rightPad = g_BenchmarkNameLen - len - leftPad;
-    printf(" %*s%s%*s | Resolution  | Time (ms)\n",
+    printf(" %*s%s%*s | Resolution  | Time (ms) | p50    p90    p99 (ms)\n",
             static_cast<int>(leftPad), "",
             "Scenario", static_cast<int>(rightPad), "");
 }
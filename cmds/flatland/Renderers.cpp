@@ -193,5 +193,76 @@ Renderer* staticGradient() {
     return new NoRenderer;
 }
 
+Renderer* yuvVideo() {
+    class YuvRenderer : public Renderer {
+        virtual bool setUp(GLHelper* /*helper*/) {
+            mNumFilled = 0;
+            return true;
+        }
+
+        virtual void tearDown() {
+        }
+
+        virtual bool render(EGLSurface /*surface*/) {
+            return false;
+        }
+
+        // Queues a new frame every time, as a video decoder would.  Only the
+        // first buffers are actually filled, so that the CPU doesn't become
+        // the bottleneck of the benchmark.
+        virtual bool renderCpu(const sp<Surface>& surface) {
+            ANativeWindow_Buffer buffer;
+            status_t err = surface->lock(&buffer, NULL);
+            if (err != NO_ERROR) {
+                fprintf(stderr, "Surface::lock error: %d\n", err);
+                return false;
+            }
+
+            if (mNumFilled < NUM_FILLED_BUFFERS) {
+                mNumFilled++;
+                fillYV12(buffer, genColor());
+            }
+
+            err = surface->unlockAndPost();
+            if (err != NO_ERROR) {
+                fprintf(stderr, "Surface::unlockAndPost error: %d\n", err);
+                return false;
+            }
+            return true;
+        }
+
+        // A horizontal luma ramp over a chroma taken from color.
+        static void fillYV12(const ANativeWindow_Buffer& buffer,
+                const float* color) {
+            const uint32_t w = buffer.width;
+            const uint32_t h = buffer.height;
+            const uint32_t yStride = buffer.stride;
+            const uint32_t cStride = ((yStride / 2) + 15) & ~15;
+            uint8_t* yPlane = static_cast<uint8_t*>(buffer.bits);
+            uint8_t* vPlane = yPlane + yStride * h;
+            uint8_t* uPlane = vPlane + cStride * (h / 2);
+
+            const float r = color[0], g = color[1], b = color[2];
+            const uint8_t u = uint8_t(128.0f + 112.0f * (-.15f*r - .29f*g + .44f*b));
+            const uint8_t v = uint8_t(128.0f + 112.0f * (.44f*r - .37f*g - .07f*b));
+
+            for (uint32_t y = 0; y < h; y++) {
+                for (uint32_t x = 0; x < w; x++) {
+                    yPlane[y * yStride + x] = uint8_t(16 + (219 * x) / w);
+                }
+            }
+            for (uint32_t y = 0; y < h / 2; y++) {
+                memset(uPlane + y * cStride, u, w / 2);
+                memset(vPlane + y * cStride, v, w / 2);
+            }
+        }
+
+        enum { NUM_FILLED_BUFFERS = 4 };
+
+        uint32_t mNumFilled;
+    };
+    return new YuvRenderer;
+}
+
 
 } // namespace android
@@ -50,10 +50,11 @@ void CacheTracker::addDataPath(const std::string& dataPath) {
     mDataPaths.push_back(dataPath);
 }
 
-void CacheTracker::loadStats() {
+void CacheTracker::loadStats(TreeSizeCalculator* calculator) {
     ATRACE_BEGIN("loadStats quota");
     cacheUsed = 0;
     if (loadQuotaStats()) {
+        ATRACE_END();
         return;
     }
     ATRACE_END();
@@ -63,8 +64,8 @@ void CacheTracker::loadStats() {
     for (auto path : mDataPaths) {
         auto cachePath = read_path_inode(path, "cache", kXattrInodeCache);
         auto codeCachePath = read_path_inode(path, "code_cache", kXattrInodeCodeCache);
-        calculate_tree_size(cachePath, &cacheUsed);
-        calculate_tree_size(codeCachePath, &cacheUsed);
+        calculator->measure(cachePath, &cacheUsed);
+        calculator->measure(codeCachePath, &cacheUsed);
     }
     ATRACE_END();
 }
@@ -28,6 +28,7 @@
 #include <cutils/multiuser.h>
 
 #include "CacheItem.h"
+#include "TreeSizeCalculator.h"
 
 namespace android {
 namespace installd {
@@ -46,7 +47,12 @@ public:
 
     void addDataPath(const std::string& dataPath);
 
-    void loadStats();
+    /**
+     * Loads stats from quota when available, or else queues the cache trees
+     * on the calculator; cacheUsed is then only complete once the calculator
+     * has been waited for. Lets the stats of many trackers load at once.
+     */
+    void loadStats(TreeSizeCalculator* calculator);
     void loadItems();
 
     void ensureItems();
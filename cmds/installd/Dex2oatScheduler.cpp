@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Dex2oatScheduler.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <android-base/logging.h>
+
+#include "installd_deps.h"
+
+namespace android {
+namespace installd {
+
+// Heap assumed for a dex2oat without dalvik.vm.dex2oat-Xmx.
+static constexpr int64_t kDefaultDex2oatHeapBytes = 512 * 1024 * 1024;
+
+// Parses a heap size like -Xmx takes, such as "512m".
+static int64_t parse_heap_size(const char* value) {
+    char* end;
+    int64_t size = strtoll(value, &end, 10);
+    switch (*end) {
+        case 'k': case 'K': size *= 1024; break;
+        case 'm': case 'M': size *= 1024 * 1024; break;
+        case 'g': case 'G': size *= 1024 * 1024 * 1024; break;
+    }
+    return size > 0 ? size : kDefaultDex2oatHeapBytes;
+}
+
+// Returns MemAvailable, or -1 if it can't be read.
+static int64_t read_mem_available() {
+    FILE* fp = fopen("/proc/meminfo", "re");
+    if (fp == nullptr) {
+        return -1;
+    }
+    char line[128];
+    int64_t kb = -1;
+    while (fgets(line, sizeof(line), fp) != nullptr) {
+        if (sscanf(line, "MemAvailable: %" SCNd64 " kB", &kb) == 1) {
+            break;
+        }
+    }
+    fclose(fp);
+    return kb >= 0 ? kb * 1024 : -1;
+}
+
+Dex2oatScheduler::Job::Job(Priority priority, const char* dexPath) :
+        mPriority(priority), mDexPath(dexPath), mQueued(std::chrono::steady_clock::now()) {
+    Dex2oatScheduler::getInstance().start(priority);
+    mStarted = std::chrono::steady_clock::now();
+}
+
+Dex2oatScheduler::Job::~Job() {
+    auto now = std::chrono::steady_clock::now();
+    int64_t waitMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+            mStarted - mQueued).count();
+    int64_t runMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+            now - mStarted).count();
+    LOG(INFO) << "dex2oat of " << mDexPath << " (priority " << mPriority << ") waited "
+            << waitMs << "ms, ran " << runMs << "ms";
+    Dex2oatScheduler::getInstance().finish(mPriority, waitMs, runMs);
+}
+
+Dex2oatScheduler& Dex2oatScheduler::getInstance() {
+    static Dex2oatScheduler* instance = new Dex2oatScheduler();
+    return *instance;
+}
+
+Dex2oatScheduler::Dex2oatScheduler() : mRunning(0) {
+    std::fill(mWaiting, mWaiting + kNumPriorities, 0);
+    std::fill(mCompleted, mCompleted + kNumPriorities, 0);
+    std::fill(mTotalWaitMs, mTotalWaitMs + kNumPriorities, 0);
+    std::fill(mTotalRunMs, mTotalRunMs + kNumPriorities, 0);
+    std::fill(mMaxWaitMs, mMaxWaitMs + kNumPriorities, 0);
+}
+
+size_t Dex2oatScheduler::computeBudget(Priority priority) const {
+    char buf[kPropertyValueMax];
+    if (get_property("ro.config.low_ram", buf, "false") > 0 && !strcmp(buf, "true")) {
+        return 1;
+    }
+
+    // run_dex2oat() passes the same property as -j; without it, each dex2oat
+    // uses every core and there's no point in running more than one.
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    long threads = cpus;
+    const char* threads_key = priority == PRIORITY_BOOT
+            ? "dalvik.vm.boot-dex2oat-threads" : "dalvik.vm.dex2oat-threads";
+    if (get_property(threads_key, buf, nullptr) > 0 && atol(buf) > 0) {
+        threads = atol(buf);
+    }
+    size_t budget = std::max(cpus / std::max(threads, 1L), 1L);
+
+    // Jobs already running are part of what's no longer available.
+    int64_t heap = kDefaultDex2oatHeapBytes;
+    if (get_property("dalvik.vm.dex2oat-Xmx", buf, nullptr) > 0) {
+        heap = parse_heap_size(buf);
+    }
+    int64_t available = read_mem_available();
+    if (available >= 0) {
+        budget = std::min(budget, mRunning + static_cast<size_t>(available / heap));
+    }
+    return std::max(budget, static_cast<size_t>(1));
+}
+
+bool Dex2oatScheduler::canStartLocked(Priority priority) {
+    for (int i = 0; i < priority; i++) {
+        if (mWaiting[i] > 0) {
+            return false;
+        }
+    }
+    if (priority == PRIORITY_IDLE) {
+        return mRunning == 0;
+    }
+    return mRunning < computeBudget(priority);
+}
+
+void Dex2oatScheduler::start(Priority priority) {
+    std::unique_lock<std::mutex> lock(mLock);
+    mWaiting[priority]++;
+    mChanged.wait(lock, [this, priority] { return canStartLocked(priority); });
+    mWaiting[priority]--;
+    mRunning++;
+    // Others of the same priority may fit in the budget too
+    mChanged.notify_all();
+}
+
+void Dex2oatScheduler::finish(Priority priority, int64_t waitMs, int64_t runMs) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mRunning--;
+    mCompleted[priority]++;
+    mTotalWaitMs[priority] += waitMs;
+    mTotalRunMs[priority] += runMs;
+    mMaxWaitMs[priority] = std::max(mMaxWaitMs[priority], waitMs);
+    mChanged.notify_all();
+}
+
+void Dex2oatScheduler::dump(std::ostream& out) {
+    std::lock_guard<std::mutex> lock(mLock);
+    static const char* kPriorityNames[kNumPriorities] = { "boot", "foreground", "idle" };
+    out << "dex2oat jobs: " << mRunning << " running" << std::endl;
+    for (int i = 0; i < kNumPriorities; i++) {
+        out << "    " << kPriorityNames[i] << ": " << mWaiting[i] << " waiting, "
+                << mCompleted[i] << " completed";
+        if (mCompleted[i] > 0) {
+            out << ", avg wait " << mTotalWaitMs[i] / static_cast<int64_t>(mCompleted[i])
+                    << "ms, max wait " << mMaxWaitMs[i] << "ms, avg run "
+                    << mTotalRunMs[i] / static_cast<int64_t>(mCompleted[i]) << "ms";
+        }
+        out << std::endl;
+    }
+}
+
+}  // namespace installd
+}  // namespace android
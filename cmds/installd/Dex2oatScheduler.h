@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_INSTALLD_DEX2OAT_SCHEDULER_H
+#define ANDROID_INSTALLD_DEX2OAT_SCHEDULER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+#include <android-base/macros.h>
+
+namespace android {
+namespace installd {
+
+/**
+ * Decides how many dex2oat processes may run at once, and in what order the
+ * dexopt calls waiting for one get to start.
+ *
+ * The budget is the number of CPUs divided by the threads each dex2oat is
+ * given, further limited by how many dex2oat heaps fit in available memory.
+ * Idle maintenance jobs only ever run one at a time, and only when nothing
+ * more important is waiting.
+ */
+class Dex2oatScheduler {
+public:
+    enum Priority {
+        // Compilation blocking boot, such as the first boot after an OTA
+        PRIORITY_BOOT = 0,
+        // Installs and other compilation on behalf of the user
+        PRIORITY_FOREGROUND = 1,
+        // The idle background dexopt job
+        PRIORITY_IDLE = 2,
+    };
+
+    /**
+     * The right to run one dex2oat, held for the lifetime of the object. The
+     * constructor blocks until the scheduler admits the job; the destructor
+     * logs how long it waited and ran.
+     */
+    class Job {
+    public:
+        Job(Priority priority, const char* dexPath);
+        ~Job();
+
+    private:
+        const Priority mPriority;
+        const std::string mDexPath;
+        const std::chrono::steady_clock::time_point mQueued;
+        std::chrono::steady_clock::time_point mStarted;
+
+        DISALLOW_COPY_AND_ASSIGN(Job);
+    };
+
+    static Dex2oatScheduler& getInstance();
+
+    void dump(std::ostream& out);
+
+private:
+    static constexpr int kNumPriorities = PRIORITY_IDLE + 1;
+
+    Dex2oatScheduler();
+
+    // Reads the current state of the device; mLock must be held for mRunning.
+    size_t computeBudget(Priority priority) const;
+    bool canStartLocked(Priority priority);
+
+    void start(Priority priority);
+    void finish(Priority priority, int64_t waitMs, int64_t runMs);
+
+    std::mutex mLock;
+    std::condition_variable mChanged;
+    // Guarded by mLock.
+    size_t mRunning;
+    size_t mWaiting[kNumPriorities];
+    size_t mCompleted[kNumPriorities];
+    int64_t mTotalWaitMs[kNumPriorities];
+    int64_t mTotalRunMs[kNumPriorities];
+    int64_t mMaxWaitMs[kNumPriorities];
+
+    DISALLOW_COPY_AND_ASSIGN(Dex2oatScheduler);
+};
+
+}  // namespace installd
+}  // namespace android
+
+#endif  // ANDROID_INSTALLD_DEX2OAT_SCHEDULER_H
@@ -18,6 +18,9 @@
 
 #define ATRACE_TAG ATRACE_TAG_PACKAGE_MANAGER
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <errno.h>
 #include <inttypes.h>
 #include <fstream>
@@ -34,6 +37,7 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/xattr.h>
+#include <thread>
 #include <unistd.h>
 
 #include <android-base/logging.h>
@@ -44,7 +48,6 @@
 #include <cutils/properties.h>
 #include <cutils/sched_policy.h>
 #include <log/log.h>               // TODO: Move everything to base/logging.
-#include <logwrap/logwrap.h>
 #include <private/android_filesystem_config.h>
 #include <selinux/android.h>
 #include <system/thread_defs.h>
@@ -57,7 +60,10 @@
 #include "utils.h"
 
 #include "CacheTracker.h"
+#include "Dex2oatScheduler.h"
 #include "MatchExtensionGen.h"
+#include "TreeCopier.h"
+#include "TreeSizeCalculator.h"
 
 #ifndef LOG_TAG
 #define LOG_TAG "installd"
@@ -69,7 +75,6 @@ using std::endl;
 namespace android {
 namespace installd {
 
-static constexpr const char* kCpPath = "/system/bin/cp";
 static constexpr const char* kXattrDefault = "user.default";
 
 static constexpr const int MIN_RESTRICTED_HOME_SDK_VERSION = 24; // > M
@@ -82,6 +87,12 @@ static constexpr const char *kIdMapPath = "/system/bin/idmap";
 static constexpr const char* IDMAP_PREFIX = "/data/resource-cache/";
 static constexpr const char* IDMAP_SUFFIX = "@idmap";
 
+// Cache items deleted by freeCache() per hold of the global lock
+static constexpr size_t kFreeCacheBatchSize = 64;
+
+// Threads preparing packages in createAppDataBatch()
+static constexpr size_t kAppDataThreads = 4;
+
 // NOTE: keep in sync with Installer
 static constexpr int FLAG_CLEAR_CACHE_ONLY = 1 << 8;
 static constexpr int FLAG_CLEAR_CODE_CACHE_ONLY = 1 << 9;
@@ -226,6 +237,9 @@ status_t InstalldNativeService::dump(int fd, const Vector<String16> & /* args */
         }
     }
 
+    out << endl;
+    Dex2oatScheduler::getInstance().dump(out);
+
     out << endl;
     out.flush();
 
@@ -238,7 +252,7 @@ status_t InstalldNativeService::dump(int fd, const Vector<String16> & /* args */
  * significant time by avoiding no-op traversals of large filesystem trees.
  */
 static int restorecon_app_data_lazy(const std::string& path, const std::string& seInfo, uid_t uid,
-        bool existing) {
+        bool existing, bool* recursed = nullptr) {
     int res = 0;
     char* before = nullptr;
     char* after = nullptr;
@@ -271,6 +285,7 @@ static int restorecon_app_data_lazy(const std::string& path, const std::string&
             PLOG(ERROR) << "Failed recursive restorecon for " << path;
             goto fail;
         }
+        if (recursed != nullptr) *recursed = true;
     }
 
     goto done;
@@ -288,6 +303,27 @@ static int restorecon_app_data_lazy(const std::string& parent, const char* name,
             existing);
 }
 
+/**
+ * Restorecon an app data directory along with its cache directories, which
+ * are already covered when the top-level label change forced a recursive pass.
+ * That is always the case for freshly created directories.
+ */
+static int restorecon_app_data_dirs_lazy(const std::string& path, const std::string& seInfo,
+        uid_t uid, bool existing) {
+    bool recursed = false;
+    if (restorecon_app_data_lazy(path, seInfo, uid, existing, &recursed)) {
+        return -1;
+    }
+    if (recursed) {
+        return 0;
+    }
+    if (restorecon_app_data_lazy(path, "cache", seInfo, uid, existing) ||
+            restorecon_app_data_lazy(path, "code_cache", seInfo, uid, existing)) {
+        return -1;
+    }
+    return 0;
+}
+
 static int prepare_app_dir(const std::string& path, mode_t target_mode, uid_t uid) {
     if (fs_prepare_dir_strict(path.c_str(), target_mode, uid, uid) != 0) {
         PLOG(ERROR) << "Failed to prepare " << path;
@@ -343,7 +379,70 @@ binder::Status InstalldNativeService::createAppData(const std::unique_ptr<std::s
     CHECK_ARGUMENT_UUID(uuid);
     CHECK_ARGUMENT_PACKAGE_NAME(packageName);
     std::lock_guard<std::recursive_mutex> lock(mLock);
+    return createAppDataLocked(uuid, packageName, userId, flags, appId, seInfo, targetSdkVersion,
+            _aidl_return);
+}
+
+binder::Status InstalldNativeService::createAppDataBatch(
+        const std::unique_ptr<std::vector<std::unique_ptr<std::string>>>& uuids,
+        const std::vector<std::string>& packageNames, int32_t userId, int32_t flags,
+        const std::vector<int32_t>& appIds, const std::vector<std::string>& seInfos,
+        const std::vector<int32_t>& targetSdkVersions, std::vector<int64_t>* _aidl_return) {
+    ENFORCE_UID(AID_SYSTEM);
+    const size_t count = packageNames.size();
+    if ((uuids && uuids->size() != count) || appIds.size() != count
+            || seInfos.size() != count || targetSdkVersions.size() != count) {
+        return exception(binder::Status::EX_ILLEGAL_ARGUMENT, "Mismatched batch lengths");
+    }
+    static const std::unique_ptr<std::string> kNullUuid;
+    auto uuidAt = [&uuids](size_t i) -> const std::unique_ptr<std::string>& {
+        return uuids ? uuids->at(i) : kNullUuid;
+    };
+    for (size_t i = 0; i < count; i++) {
+        CHECK_ARGUMENT_UUID(uuidAt(i));
+        CHECK_ARGUMENT_PACKAGE_NAME(packageNames[i]);
+    }
+    std::lock_guard<std::recursive_mutex> lock(mLock);
+    ATRACE_BEGIN("createAppDataBatch");
+
+    // Packages share nothing on disk, so they're prepared on a few threads at
+    // once; most of the time goes to restorecon, which is I/O bound. Workers
+    // don't take mLock, held here on their behalf.
+    std::vector<int64_t> inodes(count, -1);
+    std::vector<binder::Status> results(count);
+    std::atomic<size_t> next(0);
+    auto work = [&]() {
+        size_t i;
+        while ((i = next++) < count) {
+            results[i] = createAppDataLocked(uuidAt(i), packageNames[i], userId, flags,
+                    appIds[i], seInfos[i], targetSdkVersions[i], &inodes[i]);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < std::min(count, kAppDataThreads); i++) {
+        threads.emplace_back(work);
+    }
+    work();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    ATRACE_END();
+
+    // Every package was attempted; report the first failure, if any, so the
+    // caller can retry those packages on their own.
+    for (const auto& result : results) {
+        if (!result.isOk()) {
+            return result;
+        }
+    }
+    *_aidl_return = std::move(inodes);
+    return ok();
+}
 
+binder::Status InstalldNativeService::createAppDataLocked(
+        const std::unique_ptr<std::string>& uuid, const std::string& packageName,
+        int32_t userId, int32_t flags, int32_t appId, const std::string& seInfo,
+        int32_t targetSdkVersion, int64_t* _aidl_return) {
     const char* uuid_ = uuid ? uuid->c_str() : nullptr;
     const char* pkgname = packageName.c_str();
 
@@ -370,9 +469,7 @@ binder::Status InstalldNativeService::createAppData(const std::unique_ptr<std::s
         }
 
         // Consider restorecon over contents if label changed
-        if (restorecon_app_data_lazy(path, seInfo, uid, existing) ||
-                restorecon_app_data_lazy(path, "cache", seInfo, uid, existing) ||
-                restorecon_app_data_lazy(path, "code_cache", seInfo, uid, existing)) {
+        if (restorecon_app_data_dirs_lazy(path, seInfo, uid, existing)) {
             return error("Failed to restorecon " + path);
         }
 
@@ -401,9 +498,7 @@ binder::Status InstalldNativeService::createAppData(const std::unique_ptr<std::s
         }
 
         // Consider restorecon over contents if label changed
-        if (restorecon_app_data_lazy(path, seInfo, uid, existing) ||
-                restorecon_app_data_lazy(path, "cache", seInfo, uid, existing) ||
-                restorecon_app_data_lazy(path, "code_cache", seInfo, uid, existing)) {
+        if (restorecon_app_data_dirs_lazy(path, seInfo, uid, existing)) {
             return error("Failed to restorecon " + path);
         }
 
@@ -614,6 +709,19 @@ static gid_t get_cache_gid(uid_t uid) {
     return (gid != -1) ? gid : uid;
 }
 
+/**
+ * What fixupAppData() last brought a package directory in line with. Bump
+ * the version whenever the rules below change, so every package is walked
+ * again.
+ */
+struct FixupDigest {
+    uint32_t version;
+    uint32_t uid;
+    uint64_t inode_cache;
+    uint64_t inode_code_cache;
+};
+static constexpr uint32_t kFixupDigestVersion = 1;
+
 binder::Status InstalldNativeService::fixupAppData(const std::unique_ptr<std::string>& uuid,
         int32_t flags) {
     ENFORCE_UID(AID_SYSTEM);
@@ -631,6 +739,9 @@ binder::Status InstalldNativeService::fixupAppData(const std::unique_ptr<std::st
         if (!(fts = fts_open(argv, FTS_PHYSICAL | FTS_NOCHDIR | FTS_XDEV, NULL))) {
             return error("Failed to fts_open");
         }
+        // Digest of the package being walked, and whether all of it was seen
+        FixupDigest digest;
+        bool package_walked = false;
         while ((p = fts_read(fts)) != nullptr) {
             if (p->fts_info == FTS_D && p->fts_level == 1) {
                 // Track down inodes of cache directories
@@ -644,6 +755,27 @@ binder::Status InstalldNativeService::fixupAppData(const std::unique_ptr<std::st
                     inode_code_cache = raw;
                 }
 
+                // Skip packages already fixed up against the same owner and
+                // cache directories; anything the app has created since then
+                // got its GID from those already.
+                memset(&digest, 0, sizeof(digest));
+                digest.version = kFixupDigestVersion;
+                digest.uid = p->fts_statp->st_uid;
+                digest.inode_cache = inode_cache;
+                digest.inode_code_cache = inode_code_cache;
+                FixupDigest existing;
+                if (!(flags & FLAG_FORCE)
+                        && getxattr(p->fts_path, kXattrFixupDigest, &existing, sizeof(existing))
+                                == sizeof(existing)
+                        && !memcmp(&existing, &digest, sizeof(digest))) {
+#if FIXUP_DEBUG
+                    LOG(DEBUG) << "Skipping " << p->fts_path << " with matching fixup digest";
+#endif
+                    fts_set(fts, p, FTS_SKIP);
+                    continue;
+                }
+                package_walked = true;
+
                 // Figure out expected GID of each child
                 FTSENT* child = fts_children(fts, 0);
                 while (child != nullptr) {
@@ -657,7 +789,17 @@ binder::Status InstalldNativeService::fixupAppData(const std::unique_ptr<std::st
                     }
                     child = child->fts_link;
                 }
+            } else if (p->fts_info == FTS_DP && p->fts_level == 1) {
+                if (package_walked && setxattr(p->fts_path, kXattrFixupDigest, &digest,
+                        sizeof(digest), 0) != 0 && errno != EOPNOTSUPP) {
+                    PLOG(WARNING) << "Failed to write fixup digest for " << p->fts_path;
+                }
+                package_walked = false;
             } else if (p->fts_level >= 2) {
+                if (p->fts_info == FTS_DNR || p->fts_info == FTS_ERR || p->fts_info == FTS_NS) {
+                    // Not fully seen, so look again next time
+                    package_walked = false;
+                }
                 if (p->fts_level > 2) {
                     // Inherit GID from parent once we're deeper into tree
                     p->fts_number = p->fts_parent->fts_number;
@@ -714,6 +856,24 @@ binder::Status InstalldNativeService::fixupAppData(const std::unique_ptr<std::st
     return ok();
 }
 
+/**
+ * Copy the tree at from into to_parent as "cp -F -p -R -P -d" would, logging
+ * how much was moved. Returns 0 or -1 with errno set.
+ */
+static int copy_app_tree(const std::string& from, const std::string& to_parent) {
+    LOG(DEBUG) << "Copying " << from << " to " << to_parent;
+    ATRACE_BEGIN("copy");
+    auto start = std::chrono::steady_clock::now();
+    TreeCopier copier;
+    int res = copier.copy(from, to_parent);
+    LOG(INFO) << "Copied " << copier.getFilesCopied() << " files, " << copier.getBytesCopied()
+            << " bytes from " << from << " in "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - start).count() << "ms";
+    ATRACE_END();
+    return res;
+}
+
 binder::Status InstalldNativeService::moveCompleteApp(const std::unique_ptr<std::string>& fromUuid,
         const std::unique_ptr<std::string>& toUuid, const std::string& packageName,
         const std::string& dataAppName, int32_t appId, const std::string& seInfo,
@@ -738,21 +898,8 @@ binder::Status InstalldNativeService::moveCompleteApp(const std::unique_ptr<std:
         auto to = create_data_app_package_path(to_uuid, data_app_name);
         auto to_parent = create_data_app_path(to_uuid);
 
-        char *argv[] = {
-            (char*) kCpPath,
-            (char*) "-F", /* delete any existing destination file first (--remove-destination) */
-            (char*) "-p", /* preserve timestamps, ownership, and permissions */
-            (char*) "-R", /* recurse into subdirectories (DEST must be a directory) */
-            (char*) "-P", /* Do not follow symlinks [default] */
-            (char*) "-d", /* don't dereference symlinks */
-            (char*) from.c_str(),
-            (char*) to_parent.c_str()
-        };
-
-        LOG(DEBUG) << "Copying " << from << " to " << to;
-        int rc = android_fork_execvp(ARRAY_SIZE(argv), argv, NULL, false, true);
-        if (rc != 0) {
-            res = error(rc, "Failed copying " + from + " to " + to);
+        if (copy_app_tree(from, to_parent) != 0) {
+            res = error("Failed copying " + from + " to " + to);
             goto fail;
         }
 
@@ -778,40 +925,19 @@ binder::Status InstalldNativeService::moveCompleteApp(const std::unique_ptr<std:
             goto fail;
         }
 
-        char *argv[] = {
-            (char*) kCpPath,
-            (char*) "-F", /* delete any existing destination file first (--remove-destination) */
-            (char*) "-p", /* preserve timestamps, ownership, and permissions */
-            (char*) "-R", /* recurse into subdirectories (DEST must be a directory) */
-            (char*) "-P", /* Do not follow symlinks [default] */
-            (char*) "-d", /* don't dereference symlinks */
-            nullptr,
-            nullptr
-        };
-
         {
             auto from = create_data_user_de_package_path(from_uuid, user, package_name);
             auto to = create_data_user_de_path(to_uuid, user);
-            argv[6] = (char*) from.c_str();
-            argv[7] = (char*) to.c_str();
-
-            LOG(DEBUG) << "Copying " << from << " to " << to;
-            int rc = android_fork_execvp(ARRAY_SIZE(argv), argv, NULL, false, true);
-            if (rc != 0) {
-                res = error(rc, "Failed copying " + from + " to " + to);
+            if (copy_app_tree(from, to) != 0) {
+                res = error("Failed copying " + from + " to " + to);
                 goto fail;
             }
         }
         {
             auto from = create_data_user_ce_package_path(from_uuid, user, package_name);
             auto to = create_data_user_ce_path(to_uuid, user);
-            argv[6] = (char*) from.c_str();
-            argv[7] = (char*) to.c_str();
-
-            LOG(DEBUG) << "Copying " << from << " to " << to;
-            int rc = android_fork_execvp(ARRAY_SIZE(argv), argv, NULL, false, true);
-            if (rc != 0) {
-                res = error(rc, "Failed copying " + from + " to " + to);
+            if (copy_app_tree(from, to) != 0) {
+                res = error("Failed copying " + from + " to " + to);
                 goto fail;
             }
         }
@@ -919,7 +1045,11 @@ binder::Status InstalldNativeService::freeCache(const std::unique_ptr<std::strin
         int64_t targetFreeBytes, int64_t cacheReservedBytes, int32_t flags) {
     ENFORCE_UID(AID_SYSTEM);
     CHECK_ARGUMENT_UUID(uuid);
-    std::lock_guard<std::recursive_mutex> lock(mLock);
+    // Finding and measuring cache only reads app data, so the global lock is
+    // only held around batches of deletions below; other operations don't
+    // wait for a whole scan of every user.
+    std::lock_guard<std::mutex> freeCacheLock(mFreeCacheLock);
+    std::unique_lock<std::recursive_mutex> lock(mLock, std::defer_lock);
 
     const char* uuid_ = uuid ? uuid->c_str() : nullptr;
     auto data_path = create_data_path(uuid_);
@@ -999,8 +1129,15 @@ binder::Status InstalldNativeService::freeCache(const std::unique_ptr<std::strin
         };
         std::priority_queue<std::shared_ptr<CacheTracker>,
                 std::vector<std::shared_ptr<CacheTracker>>, decltype(cmp)> queue(cmp);
+        {
+            // Without quota, this walks the cache of every app; do them all at once
+            TreeSizeCalculator calculator;
+            for (const auto& it : trackers) {
+                it.second->loadStats(&calculator);
+            }
+            calculator.wait();
+        }
         for (const auto& it : trackers) {
-            it.second->loadStats();
             queue.push(it.second);
             cacheTotal += it.second->cacheUsed;
         }
@@ -1010,6 +1147,7 @@ binder::Status InstalldNativeService::freeCache(const std::unique_ptr<std::strin
         // the most over their assigned quota
         ATRACE_BEGIN("bounce");
         std::shared_ptr<CacheTracker> active;
+        size_t batch = 0;
         while (active || !queue.empty()) {
             // Only look at apps under quota when explicitly requested
             if (active && (active->getCacheRatio() < 10000)
@@ -1050,7 +1188,15 @@ binder::Status InstalldNativeService::freeCache(const std::unique_ptr<std::strin
 
                 LOG(DEBUG) << "Purging " << item->toString() << " from " << active->toString();
                 if (!noop) {
+                    // Let other operations in between batches
+                    if (!lock.owns_lock()) {
+                        lock.lock();
+                    }
                     item->purge();
+                    if (++batch >= kFreeCacheBatchSize) {
+                        lock.unlock();
+                        batch = 0;
+                    }
                 }
                 active->cacheUsed -= item->size;
                 needed -= item->size;
@@ -1219,7 +1365,8 @@ static void collectQuotaStats(const std::string& device, int32_t userId,
     }
 }
 
-static void collectManualStats(const std::string& path, struct stats* stats) {
+static void collectManualStats(const std::string& path, struct stats* stats,
+        TreeSizeCalculator* calculator) {
     DIR *d;
     int dfd;
     struct dirent *de;
@@ -1248,13 +1395,14 @@ static void collectManualStats(const std::string& path, struct stats* stats) {
                 // Don't recurse or count node size
                 continue;
             } else {
-                // Measure all children nodes
-                size = 0;
-                calculate_tree_size(StringPrintf("%s/%s", path.c_str(), name), &size);
-            }
-
-            if (!strcmp(name, "cache") || !strcmp(name, "code_cache")) {
-                stats->cacheSize += size;
+                // Measure all children nodes; everything found inside is considered data
+                auto childPath = StringPrintf("%s/%s", path.c_str(), name);
+                if (!strcmp(name, "cache") || !strcmp(name, "code_cache")) {
+                    calculator->measure(childPath, &stats->dataSize, &stats->cacheSize);
+                } else {
+                    calculator->measure(childPath, &stats->dataSize);
+                }
+                continue;
             }
         }
 
@@ -1270,7 +1418,7 @@ static void collectManualStats(const std::string& path, struct stats* stats) {
 }
 
 static void collectManualStatsForUser(const std::string& path, struct stats* stats,
-        bool exclude_apps = false) {
+        TreeSizeCalculator* calculator, bool exclude_apps = false) {
     DIR *d;
     int dfd;
     struct dirent *de;
@@ -1296,45 +1444,63 @@ static void collectManualStatsForUser(const std::string& path, struct stats* sta
             } else if (exclude_apps && (user_uid >= AID_APP_START && user_uid <= AID_APP_END)) {
                 continue;
             } else {
-                collectManualStats(StringPrintf("%s/%s", path.c_str(), name), stats);
+                collectManualStats(StringPrintf("%s/%s", path.c_str(), name), stats, calculator);
             }
         }
     }
     closedir(d);
 }
 
-static void collectManualExternalStatsForUser(const std::string& path, struct stats* stats) {
-    FTS *fts;
-    FTSENT *p;
-    char *argv[] = { (char*) path.c_str(), nullptr };
-    if (!(fts = fts_open(argv, FTS_PHYSICAL | FTS_NOCHDIR | FTS_XDEV, NULL))) {
-        PLOG(ERROR) << "Failed to fts_open " << path;
+// Walks down to Android/data/<package>/cache in an external storage tree,
+// handing everything to the calculator as data and the cache directories as
+// cache too. level is the depth of path below the root of the tree.
+static void collectManualExternalStats(const std::string& path, int level, struct stats* stats,
+        TreeSizeCalculator* calculator) {
+    DIR *d = opendir(path.c_str());
+    if (d == nullptr) {
+        if (errno != ENOENT) {
+            PLOG(WARNING) << "Failed to open " << path;
+        }
         return;
     }
-    while ((p = fts_read(fts)) != NULL) {
-        p->fts_number = p->fts_parent->fts_number;
-        switch (p->fts_info) {
-        case FTS_D:
-            if (p->fts_level == 4
-                    && !strcmp(p->fts_name, "cache")
-                    && !strcmp(p->fts_parent->fts_parent->fts_name, "data")
-                    && !strcmp(p->fts_parent->fts_parent->fts_parent->fts_name, "Android")) {
-                p->fts_number = 1;
-            }
-            // Fall through to count the directory
-        case FTS_DEFAULT:
-        case FTS_F:
-        case FTS_SL:
-        case FTS_SLNONE:
-            int64_t size = (p->fts_statp->st_blocks * 512);
-            if (p->fts_number == 1) {
-                stats->cacheSize += size;
+    int dfd = dirfd(d);
+    struct dirent *de;
+    struct stat s;
+    while ((de = readdir(d))) {
+        const char *name = de->d_name;
+        if (!strcmp(name, ".") || !strcmp(name, "..")) {
+            continue;
+        }
+        auto childPath = StringPrintf("%s/%s", path.c_str(), name);
+        if (de->d_type != DT_DIR) {
+            calculator->measure(childPath, &stats->dataSize);
+        } else if ((level == 0 && !strcmp(name, "Android"))
+                || (level == 1 && !strcmp(name, "data"))
+                || level == 2) {
+            if (fstatat(dfd, name, &s, AT_SYMLINK_NOFOLLOW) == 0) {
+                stats->dataSize += s.st_blocks * 512;
             }
-            stats->dataSize += size;
-            break;
+            collectManualExternalStats(childPath, level + 1, stats, calculator);
+        } else if (level == 3 && !strcmp(name, "cache")) {
+            calculator->measure(childPath, &stats->dataSize, &stats->cacheSize);
+        } else {
+            calculator->measure(childPath, &stats->dataSize);
+        }
+    }
+    closedir(d);
+}
+
+static void collectManualExternalStatsForUser(const std::string& path, struct stats* stats,
+        TreeSizeCalculator* calculator) {
+    struct stat s;
+    if (lstat(path.c_str(), &s) != 0) {
+        if (errno != ENOENT) {
+            PLOG(ERROR) << "Failed to stat " << path;
         }
+        return;
     }
-    fts_close(fts);
+    stats->dataSize += s.st_blocks * 512;
+    collectManualExternalStats(path, 0, stats, calculator);
 }
 
 binder::Status InstalldNativeService::getAppSize(const std::unique_ptr<std::string>& uuid,
@@ -1373,6 +1539,9 @@ binder::Status InstalldNativeService::getAppSize(const std::unique_ptr<std::stri
     struct stats extStats;
     memset(&stats, 0, sizeof(stats));
     memset(&extStats, 0, sizeof(extStats));
+    // Trees are measured in the background; sizes land in stats and
+    // extStats once calculator.wait() returns.
+    TreeSizeCalculator calculator;
 
     const char* uuid_ = uuid ? uuid->c_str() : nullptr;
 
@@ -1384,14 +1553,14 @@ binder::Status InstalldNativeService::getAppSize(const std::unique_ptr<std::stri
     ATRACE_BEGIN("obb");
     for (auto packageName : packageNames) {
         auto obbCodePath = create_data_media_obb_path(uuid_, packageName.c_str());
-        calculate_tree_size(obbCodePath, &extStats.codeSize);
+        calculator.measure(obbCodePath, &extStats.codeSize);
     }
     ATRACE_END();
 
     if (flags & FLAG_USE_QUOTA && appId >= AID_APP_START) {
         ATRACE_BEGIN("code");
         for (auto codePath : codePaths) {
-            calculate_tree_size(codePath, &stats.codeSize, -1,
+            calculator.measure(codePath, &stats.codeSize, -1,
                     multiuser_get_shared_gid(0, appId));
         }
         ATRACE_END();
@@ -1402,7 +1571,7 @@ binder::Status InstalldNativeService::getAppSize(const std::unique_ptr<std::stri
     } else {
         ATRACE_BEGIN("code");
         for (auto codePath : codePaths) {
-            calculate_tree_size(codePath, &stats.codeSize);
+            calculator.measure(codePath, &stats.codeSize);
         }
         ATRACE_END();
 
@@ -1411,17 +1580,17 @@ binder::Status InstalldNativeService::getAppSize(const std::unique_ptr<std::stri
 
             ATRACE_BEGIN("data");
             auto cePath = create_data_user_ce_package_path(uuid_, userId, pkgname, ceDataInodes[i]);
-            collectManualStats(cePath, &stats);
+            collectManualStats(cePath, &stats, &calculator);
             auto dePath = create_data_user_de_package_path(uuid_, userId, pkgname);
-            collectManualStats(dePath, &stats);
+            collectManualStats(dePath, &stats, &calculator);
             ATRACE_END();
 
             if (!uuid) {
                 ATRACE_BEGIN("profiles");
-                calculate_tree_size(
+                calculator.measure(
                         create_primary_current_profile_package_dir_path(userId, pkgname),
                         &stats.dataSize);
-                calculate_tree_size(
+                calculator.measure(
                         create_primary_reference_profile_package_dir_path(pkgname),
                         &stats.codeSize);
                 ATRACE_END();
@@ -1429,9 +1598,9 @@ binder::Status InstalldNativeService::getAppSize(const std::unique_ptr<std::stri
 
             ATRACE_BEGIN("external");
             auto extPath = create_data_media_package_path(uuid_, userId, "data", pkgname);
-            collectManualStats(extPath, &extStats);
+            collectManualStats(extPath, &extStats, &calculator);
             auto mediaPath = create_data_media_package_path(uuid_, userId, "media", pkgname);
-            calculate_tree_size(mediaPath, &extStats.dataSize);
+            calculator.measure(mediaPath, &extStats.dataSize);
             ATRACE_END();
         }
 
@@ -1439,13 +1608,17 @@ binder::Status InstalldNativeService::getAppSize(const std::unique_ptr<std::stri
             ATRACE_BEGIN("dalvik");
             int32_t sharedGid = multiuser_get_shared_gid(0, appId);
             if (sharedGid != -1) {
-                calculate_tree_size(create_data_dalvik_cache_path(), &stats.codeSize,
+                calculator.measure(create_data_dalvik_cache_path(), &stats.codeSize,
                         sharedGid, -1);
             }
             ATRACE_END();
         }
     }
 
+    ATRACE_BEGIN("wait");
+    calculator.wait();
+    ATRACE_END();
+
     std::vector<int64_t> ret;
     ret.push_back(stats.codeSize);
     ret.push_back(stats.dataSize);
@@ -1479,6 +1652,9 @@ binder::Status InstalldNativeService::getUserSize(const std::unique_ptr<std::str
     struct stats extStats;
     memset(&stats, 0, sizeof(stats));
     memset(&extStats, 0, sizeof(extStats));
+    // Trees are measured in the background; sizes land in stats and
+    // extStats once calculator.wait() returns.
+    TreeSizeCalculator calculator;
 
     const char* uuid_ = uuid ? uuid->c_str() : nullptr;
 
@@ -1505,22 +1681,22 @@ binder::Status InstalldNativeService::getUserSize(const std::unique_ptr<std::str
         ATRACE_END();
 
         ATRACE_BEGIN("code");
-        calculate_tree_size(create_data_app_path(uuid_), &stats.codeSize, -1, -1, true);
+        calculator.measure(create_data_app_path(uuid_), &stats.codeSize, -1, -1, true);
         ATRACE_END();
 
         ATRACE_BEGIN("data");
         auto cePath = create_data_user_ce_path(uuid_, userId);
-        collectManualStatsForUser(cePath, &stats, true);
+        collectManualStatsForUser(cePath, &stats, &calculator, true);
         auto dePath = create_data_user_de_path(uuid_, userId);
-        collectManualStatsForUser(dePath, &stats, true);
+        collectManualStatsForUser(dePath, &stats, &calculator, true);
         ATRACE_END();
 
         if (!uuid) {
             ATRACE_BEGIN("profile");
             auto userProfilePath = create_primary_cur_profile_dir_path(userId);
-            calculate_tree_size(userProfilePath, &stats.dataSize, -1, -1, true);
+            calculator.measure(userProfilePath, &stats.dataSize, -1, -1, true);
             auto refProfilePath = create_primary_ref_profile_dir_path();
-            calculate_tree_size(refProfilePath, &stats.codeSize, -1, -1, true);
+            calculator.measure(refProfilePath, &stats.codeSize, -1, -1, true);
             ATRACE_END();
         }
 
@@ -1541,9 +1717,9 @@ binder::Status InstalldNativeService::getUserSize(const std::unique_ptr<std::str
 
         if (!uuid) {
             ATRACE_BEGIN("dalvik");
-            calculate_tree_size(create_data_dalvik_cache_path(), &stats.codeSize,
+            calculator.measure(create_data_dalvik_cache_path(), &stats.codeSize,
                     -1, -1, true);
-            calculate_tree_size(create_primary_cur_profile_dir_path(userId), &stats.dataSize,
+            calculator.measure(create_primary_cur_profile_dir_path(userId), &stats.dataSize,
                     -1, -1, true);
             ATRACE_END();
         }
@@ -1565,32 +1741,32 @@ binder::Status InstalldNativeService::getUserSize(const std::unique_ptr<std::str
     } else {
         ATRACE_BEGIN("obb");
         auto obbPath = create_data_path(uuid_) + "/media/obb";
-        calculate_tree_size(obbPath, &extStats.codeSize);
+        calculator.measure(obbPath, &extStats.codeSize);
         ATRACE_END();
 
         ATRACE_BEGIN("code");
-        calculate_tree_size(create_data_app_path(uuid_), &stats.codeSize);
+        calculator.measure(create_data_app_path(uuid_), &stats.codeSize);
         ATRACE_END();
 
         ATRACE_BEGIN("data");
         auto cePath = create_data_user_ce_path(uuid_, userId);
-        collectManualStatsForUser(cePath, &stats);
+        collectManualStatsForUser(cePath, &stats, &calculator);
         auto dePath = create_data_user_de_path(uuid_, userId);
-        collectManualStatsForUser(dePath, &stats);
+        collectManualStatsForUser(dePath, &stats, &calculator);
         ATRACE_END();
 
         if (!uuid) {
             ATRACE_BEGIN("profile");
             auto userProfilePath = create_primary_cur_profile_dir_path(userId);
-            calculate_tree_size(userProfilePath, &stats.dataSize);
+            calculator.measure(userProfilePath, &stats.dataSize);
             auto refProfilePath = create_primary_ref_profile_dir_path();
-            calculate_tree_size(refProfilePath, &stats.codeSize);
+            calculator.measure(refProfilePath, &stats.codeSize);
             ATRACE_END();
         }
 
         ATRACE_BEGIN("external");
         auto dataMediaPath = create_data_media_path(uuid_, userId);
-        collectManualExternalStatsForUser(dataMediaPath, &extStats);
+        collectManualExternalStatsForUser(dataMediaPath, &extStats, &calculator);
 #if MEASURE_DEBUG
         LOG(DEBUG) << "Measured external data " << extStats.dataSize << " cache "
                 << extStats.cacheSize;
@@ -1599,12 +1775,16 @@ binder::Status InstalldNativeService::getUserSize(const std::unique_ptr<std::str
 
         if (!uuid) {
             ATRACE_BEGIN("dalvik");
-            calculate_tree_size(create_data_dalvik_cache_path(), &stats.codeSize);
-            calculate_tree_size(create_primary_cur_profile_dir_path(userId), &stats.dataSize);
+            calculator.measure(create_data_dalvik_cache_path(), &stats.codeSize);
+            calculator.measure(create_primary_cur_profile_dir_path(userId), &stats.dataSize);
             ATRACE_END();
         }
     }
 
+    ATRACE_BEGIN("wait");
+    calculator.wait();
+    ATRACE_END();
+
     std::vector<int64_t> ret;
     ret.push_back(stats.codeSize);
     ret.push_back(stats.dataSize);
@@ -1808,7 +1988,7 @@ binder::Status InstalldNativeService::dexopt(const std::string& apkPath, int32_t
     if (packageName && *packageName != "*") {
         CHECK_ARGUMENT_PACKAGE_NAME(*packageName);
     }
-    std::lock_guard<std::recursive_mutex> lock(mLock);
+    std::unique_lock<std::recursive_mutex> lock(mLock);
 
     const char* apk_path = apkPath.c_str();
     const char* pkgname = packageName ? packageName->c_str() : "*";
@@ -1819,7 +1999,7 @@ binder::Status InstalldNativeService::dexopt(const std::string& apkPath, int32_t
     const char* shared_libraries = sharedLibraries ? sharedLibraries->c_str() : nullptr;
     const char* se_info = seInfo ? seInfo->c_str() : nullptr;
     int res = android::installd::dexopt(apk_path, uid, pkgname, instruction_set, dexoptNeeded,
-            oat_dir, dexFlags, compiler_filter, volume_uuid, shared_libraries, se_info);
+            oat_dir, dexFlags, compiler_filter, volume_uuid, shared_libraries, se_info, &lock);
     return res ? error(res, "Failed to dexopt") : ok();
 }
 
@@ -2275,6 +2455,26 @@ binder::Status InstalldNativeService::reconcileSecondaryDexFile(
     return result ? ok() : error();
 }
 
+binder::Status InstalldNativeService::reconcileSecondaryDexFiles(
+        const std::vector<std::string>& dexPaths, const std::vector<std::string>& packageNames,
+        const std::vector<int32_t>& uids, const std::vector<std::string>& isas,
+        const std::unique_ptr<std::string>& volumeUuid, int32_t storage_flag,
+        std::vector<bool>* _aidl_return) {
+    ENFORCE_UID(AID_SYSTEM);
+    CHECK_ARGUMENT_UUID(volumeUuid);
+    if (packageNames.size() != dexPaths.size() || uids.size() != dexPaths.size()) {
+        return exception(binder::Status::EX_ILLEGAL_ARGUMENT, "Mismatched batch lengths");
+    }
+    for (const std::string& packageName : packageNames) {
+        CHECK_ARGUMENT_PACKAGE_NAME(packageName);
+    }
+
+    std::lock_guard<std::recursive_mutex> lock(mLock);
+    bool result = android::installd::reconcile_secondary_dex_files(
+            dexPaths, packageNames, uids, isas, volumeUuid, storage_flag, _aidl_return);
+    return result ? ok() : error();
+}
+
 binder::Status InstalldNativeService::invalidateMounts() {
     ENFORCE_UID(AID_SYSTEM);
     std::lock_guard<std::recursive_mutex> lock(mMountsLock);
@@ -48,6 +48,11 @@ public:
     binder::Status createAppData(const std::unique_ptr<std::string>& uuid,
             const std::string& packageName, int32_t userId, int32_t flags, int32_t appId,
             const std::string& seInfo, int32_t targetSdkVersion, int64_t* _aidl_return);
+    binder::Status createAppDataBatch(
+            const std::unique_ptr<std::vector<std::unique_ptr<std::string>>>& uuids,
+            const std::vector<std::string>& packageNames, int32_t userId, int32_t flags,
+            const std::vector<int32_t>& appIds, const std::vector<std::string>& seInfos,
+            const std::vector<int32_t>& targetSdkVersions, std::vector<int64_t>* _aidl_return);
     binder::Status restoreconAppData(const std::unique_ptr<std::string>& uuid,
             const std::string& packageName, int32_t userId, int32_t flags, int32_t appId,
             const std::string& seInfo);
@@ -113,6 +118,10 @@ public:
     binder::Status reconcileSecondaryDexFile(const std::string& dexPath,
         const std::string& packageName, int32_t uid, const std::vector<std::string>& isa,
         const std::unique_ptr<std::string>& volumeUuid, int32_t storage_flag, bool* _aidl_return);
+    binder::Status reconcileSecondaryDexFiles(const std::vector<std::string>& dexPaths,
+        const std::vector<std::string>& packageNames, const std::vector<int32_t>& uids,
+        const std::vector<std::string>& isas, const std::unique_ptr<std::string>& volumeUuid,
+        int32_t storage_flag, std::vector<bool>* _aidl_return);
 
     binder::Status invalidateMounts();
     binder::Status isQuotaSupported(const std::unique_ptr<std::string>& volumeUuid,
@@ -120,6 +129,8 @@ public:
 
 private:
     std::recursive_mutex mLock;
+    /* Serializes freeCache(), which only holds mLock while deleting */
+    std::mutex mFreeCacheLock;
 
     std::recursive_mutex mMountsLock;
     std::recursive_mutex mQuotasLock;
@@ -132,6 +143,11 @@ private:
     /* Map from UID to cache quota size */
     std::unordered_map<uid_t, int64_t> mCacheQuotas;
 
+    /* Body of createAppData(), with mLock held by the caller */
+    binder::Status createAppDataLocked(const std::unique_ptr<std::string>& uuid,
+            const std::string& packageName, int32_t userId, int32_t flags, int32_t appId,
+            const std::string& seInfo, int32_t targetSdkVersion, int64_t* _aidl_return);
+
     std::string findDataMediaPath(const std::unique_ptr<std::string>& uuid, userid_t userid);
     std::string findQuotaDeviceForUuid(const std::unique_ptr<std::string>& uuid);
 };
@@ -0,0 +1,292 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "TreeCopier.h"
+
+#include <algorithm>
+#include <thread>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <fts.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <android-base/logging.h>
+#include <android-base/unique_fd.h>
+
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+
+using android::base::unique_fd;
+
+namespace android {
+namespace installd {
+
+static constexpr size_t kCopyBufferSize = 64 * 1024;
+
+// Creates dest as a directory unless it already is one; the metadata is set
+// once its contents are in place, since adding them changes the timestamps.
+static int make_directory(const std::string& to) {
+    if (mkdir(to.c_str(), 0700) == 0) {
+        return 0;
+    }
+    struct stat st;
+    if (errno != EEXIST || lstat(to.c_str(), &st) != 0) {
+        return -1;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        return 0;
+    }
+    if (unlink(to.c_str()) != 0) {
+        return -1;
+    }
+    return mkdir(to.c_str(), 0700);
+}
+
+static int set_metadata(const std::string& to, const struct stat& st) {
+    const struct timespec times[2] = { st.st_atim, st.st_mtim };
+    if (lchown(to.c_str(), st.st_uid, st.st_gid) != 0) {
+        return -1;
+    }
+    if (!S_ISLNK(st.st_mode) && chmod(to.c_str(), st.st_mode & 07777) != 0) {
+        return -1;
+    }
+    return utimensat(AT_FDCWD, to.c_str(), times, AT_SYMLINK_NOFOLLOW);
+}
+
+static int copy_link(const std::string& from, const std::string& to, const struct stat& st) {
+    std::vector<char> target(st.st_size + 1);
+    ssize_t len = readlink(from.c_str(), target.data(), target.size());
+    if (len < 0) {
+        return -1;
+    }
+    if (static_cast<size_t>(len) >= target.size()) {
+        // Changed under us; the recorded size no longer matches.
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    target[len] = '\0';
+    if (unlink(to.c_str()) != 0 && errno != ENOENT) {
+        return -1;
+    }
+    if (symlink(target.data(), to.c_str()) != 0) {
+        return -1;
+    }
+    return set_metadata(to, st);
+}
+
+static int copy_special(const std::string& to, const struct stat& st) {
+    if (unlink(to.c_str()) != 0 && errno != ENOENT) {
+        return -1;
+    }
+    if (mknod(to.c_str(), st.st_mode, st.st_rdev) != 0) {
+        return -1;
+    }
+    return set_metadata(to, st);
+}
+
+TreeCopier::TreeCopier(size_t numThreads) :
+        mNumThreads(std::max(numThreads, static_cast<size_t>(1))), mBytesCopied(0),
+        mFilesCopied(0) {
+}
+
+int TreeCopier::copy(const std::string& from, const std::string& to_parent) {
+    // Where the name of the tree starts in from; 0 when it has no slash.
+    const size_t name_start = from.find_last_of('/') + 1;
+
+    FTS *fts;
+    FTSENT *p;
+    char *argv[] = { (char*) from.c_str(), nullptr };
+    if (!(fts = fts_open(argv, FTS_PHYSICAL | FTS_NOCHDIR | FTS_XDEV, NULL))) {
+        PLOG(ERROR) << "Failed to fts_open " << from;
+        return -1;
+    }
+
+    // Directories, links and special files are created during the walk, in
+    // order; file contents are only copied once every directory exists.
+    std::vector<Node> dirs;
+    std::vector<Node> files;
+    int res = 0;
+    while (res == 0 && (p = fts_read(fts)) != NULL) {
+        std::string path(p->fts_path);
+        std::string to = to_parent + "/" + path.substr(name_start);
+        switch (p->fts_info) {
+        case FTS_D:
+            if (make_directory(to) != 0) {
+                PLOG(ERROR) << "Failed to create " << to;
+                res = -1;
+                break;
+            }
+            dirs.push_back(Node { path, to, *p->fts_statp });
+            break;
+        case FTS_F:
+            files.push_back(Node { path, to, *p->fts_statp });
+            break;
+        case FTS_SL:
+        case FTS_SLNONE:
+            if (copy_link(path, to, *p->fts_statp) != 0) {
+                PLOG(ERROR) << "Failed to copy link " << path;
+                res = -1;
+            }
+            break;
+        case FTS_DEFAULT:
+            if (S_ISSOCK(p->fts_statp->st_mode)) {
+                // Sockets can't be copied; whoever owns them creates them again.
+                LOG(WARNING) << "Skipping socket " << path;
+            } else if (copy_special(to, *p->fts_statp) != 0) {
+                PLOG(ERROR) << "Failed to copy " << path;
+                res = -1;
+            }
+            break;
+        case FTS_DNR:
+        case FTS_ERR:
+        case FTS_NS:
+            errno = p->fts_errno;
+            PLOG(ERROR) << "Failed to read " << path;
+            res = -1;
+            break;
+        }
+    }
+    fts_close(fts);
+    if (res != 0) {
+        return res;
+    }
+
+    std::atomic<size_t> next(0);
+    std::atomic<int> firstError(0);
+    auto work = [&]() {
+        size_t i;
+        while (firstError == 0 && (i = next++) < files.size()) {
+            if (copyFile(files[i]) != 0) {
+                PLOG(ERROR) << "Failed to copy " << files[i].from;
+                int expected = 0;
+                firstError.compare_exchange_strong(expected, errno != 0 ? errno : EIO);
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < std::min(files.size(), mNumThreads); i++) {
+        threads.emplace_back(work);
+    }
+    work();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    if (firstError != 0) {
+        errno = firstError;
+        return -1;
+    }
+
+    // Deepest first, so that setting a directory's timestamps is the last
+    // change made inside its parent.
+    for (auto it = dirs.rbegin(); it != dirs.rend(); ++it) {
+        if (set_metadata(it->to, it->st) != 0) {
+            PLOG(ERROR) << "Failed to set attributes of " << it->to;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int TreeCopier::copyFile(const Node& node) {
+    unique_fd from_fd(TEMP_FAILURE_RETRY(
+            open(node.from.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC)));
+    if (from_fd.get() < 0) {
+        return -1;
+    }
+    // Like "cp -F", replace rather than write through whatever is there.
+    if (unlink(node.to.c_str()) != 0 && errno != ENOENT) {
+        return -1;
+    }
+    unique_fd to_fd(TEMP_FAILURE_RETRY(open(node.to.c_str(),
+            O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600)));
+    if (to_fd.get() < 0) {
+        return -1;
+    }
+    if (copyContents(from_fd.get(), to_fd.get(), node.st.st_size) != 0) {
+        return -1;
+    }
+
+    const struct timespec times[2] = { node.st.st_atim, node.st.st_mtim };
+    if (fchown(to_fd.get(), node.st.st_uid, node.st.st_gid) != 0
+            || fchmod(to_fd.get(), node.st.st_mode & 07777) != 0
+            || futimens(to_fd.get(), times) != 0) {
+        return -1;
+    }
+    mFilesCopied++;
+    return 0;
+}
+
+int TreeCopier::copyContents(int from_fd, int to_fd, off_t size) {
+    // A reflink shares the blocks outright, when both ends are on a
+    // filesystem that can.
+    if (size > 0 && ioctl(to_fd, FICLONE, from_fd) == 0) {
+        mBytesCopied += size;
+        return 0;
+    }
+
+#ifdef __NR_copy_file_range
+    // Copied in the kernel without passing through our buffers; older
+    // kernels refuse this between filesystems, or don't have it at all.
+    off_t copied = 0;
+    while (true) {
+        ssize_t n = syscall(__NR_copy_file_range, from_fd, nullptr, to_fd, nullptr,
+                kCopyBufferSize * 16, 0);
+        if (n > 0) {
+            copied += n;
+            mBytesCopied += n;
+            continue;
+        }
+        if (n == 0) {
+            return 0;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (copied == 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL
+                || errno == EOPNOTSUPP)) {
+            break;
+        }
+        return -1;
+    }
+#endif
+
+    char buf[kCopyBufferSize];
+    while (true) {
+        ssize_t n = TEMP_FAILURE_RETRY(read(from_fd, buf, sizeof(buf)));
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
+            return 0;
+        }
+        for (ssize_t written = 0; written < n; ) {
+            ssize_t w = TEMP_FAILURE_RETRY(write(to_fd, buf + written, n - written));
+            if (w < 0) {
+                return -1;
+            }
+            written += w;
+        }
+        mBytesCopied += n;
+    }
+}
+
+}  // namespace installd
+}  // namespace android
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_INSTALLD_TREE_COPIER_H
+#define ANDROID_INSTALLD_TREE_COPIER_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <android-base/macros.h>
+
+namespace android {
+namespace installd {
+
+/**
+ * Copies directory trees in-process the way "cp -F -p -R -P -d" does, with
+ * a pool of worker threads copying file contents. Each file is cloned when
+ * the filesystem supports reflinks, copied in the kernel with
+ * copy_file_range() when it doesn't, and read and written as a last resort.
+ */
+class TreeCopier {
+public:
+    explicit TreeCopier(size_t numThreads = kDefaultThreads);
+
+    /**
+     * Copies the tree at from into the directory to_parent, under the same
+     * name. Existing directories are merged into; existing files and links
+     * are replaced. Ownership, permissions and timestamps are preserved and
+     * symlinks are copied as links. Returns 0 on success, or -1 with errno
+     * set by the first failure.
+     */
+    int copy(const std::string& from, const std::string& to_parent);
+
+    /** Bytes of file contents copied so far, readable while copy() runs. */
+    int64_t getBytesCopied() const { return mBytesCopied; }
+    /** Files copied so far. */
+    int64_t getFilesCopied() const { return mFilesCopied; }
+
+private:
+    static constexpr size_t kDefaultThreads = 4;
+
+    struct Node {
+        std::string from;
+        std::string to;
+        struct stat st;
+    };
+
+    int copyFile(const Node& node);
+    int copyContents(int from_fd, int to_fd, off_t size);
+
+    const size_t mNumThreads;
+    std::atomic<int64_t> mBytesCopied;
+    std::atomic<int64_t> mFilesCopied;
+
+    DISALLOW_COPY_AND_ASSIGN(TreeCopier);
+};
+
+}  // namespace installd
+}  // namespace android
+
+#endif  // ANDROID_INSTALLD_TREE_COPIER_H
@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "TreeSizeCalculator.h"
+
+#include <algorithm>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <android-base/logging.h>
+#include <cutils/multiuser.h>
+#include <private/android_filesystem_config.h>
+
+namespace android {
+namespace installd {
+
+TreeSizeCalculator::TreeSizeCalculator(size_t numThreads) : mBusy(0), mExiting(false) {
+    for (size_t i = 0; i < std::max(numThreads, (size_t) 1); i++) {
+        mThreads.emplace_back(&TreeSizeCalculator::threadMain, this);
+    }
+}
+
+TreeSizeCalculator::~TreeSizeCalculator() {
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mExiting = true;
+    }
+    mWork.notify_all();
+    for (auto& thread : mThreads) {
+        thread.join();
+    }
+}
+
+void TreeSizeCalculator::measure(const std::string& path, int64_t* size,
+        int32_t include_gid, int32_t exclude_gid, bool exclude_apps) {
+    queue(path, size, nullptr, include_gid, exclude_gid, exclude_apps);
+}
+
+void TreeSizeCalculator::measure(const std::string& path, int64_t* size, int64_t* alsoSize) {
+    queue(path, size, alsoSize, -1, -1, false);
+}
+
+void TreeSizeCalculator::queue(const std::string& path, int64_t* size, int64_t* alsoSize,
+        int32_t include_gid, int32_t exclude_gid, bool exclude_apps) {
+    // Like fts with FTS_PHYSICAL, the root itself isn't followed if it's a symlink.
+    struct stat s;
+    if (lstat(path.c_str(), &s) != 0) {
+        if (errno != ENOENT) {
+            PLOG(ERROR) << "Failed to stat " << path;
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mLock);
+    mTrees.emplace_back();
+    Tree* tree = &mTrees.back();
+    tree->size = size;
+    tree->alsoSize = alsoSize;
+    tree->includeGid = include_gid;
+    tree->excludeGid = exclude_gid;
+    tree->excludeApps = exclude_apps;
+    int64_t measured = 0;
+    const bool traverse = countNode(*tree, s, &measured);
+    tree->measured = measured;
+
+    if (traverse && S_ISDIR(s.st_mode)) {
+        mPending.push_back(Directory { tree, s.st_dev, path });
+        mWork.notify_one();
+    }
+}
+
+void TreeSizeCalculator::wait() {
+    std::unique_lock<std::mutex> lock(mLock);
+    mIdle.wait(lock, [this] { return mPending.empty() && mBusy == 0; });
+    for (auto& tree : mTrees) {
+        const int64_t measured = tree.measured;
+        *tree.size += measured;
+        if (tree.alsoSize != nullptr) {
+            *tree.alsoSize += measured;
+        }
+    }
+    mTrees.clear();
+}
+
+void TreeSizeCalculator::threadMain() {
+    std::unique_lock<std::mutex> lock(mLock);
+    while (true) {
+        mWork.wait(lock, [this] { return mExiting || !mPending.empty(); });
+        if (mPending.empty()) {
+            return;
+        }
+        Directory dir = std::move(mPending.front());
+        mPending.pop_front();
+        mBusy++;
+        lock.unlock();
+        measureDirectory(dir);
+        lock.lock();
+        mBusy--;
+        if (mPending.empty() && mBusy == 0) {
+            mIdle.notify_all();
+        }
+    }
+}
+
+void TreeSizeCalculator::measureDirectory(const Directory& dir) {
+    DIR* d = opendir(dir.path.c_str());
+    if (d == nullptr) {
+        // The directory itself was already counted, as fts does for FTS_DNR.
+        if (errno != ENOENT) {
+            PLOG(WARNING) << "Failed to open " << dir.path;
+        }
+        return;
+    }
+
+    std::vector<Directory> children;
+    int64_t measured = 0;
+    int dfd = dirfd(d);
+    struct dirent* de;
+    struct stat s;
+    while ((de = readdir(d))) {
+        const char* name = de->d_name;
+        if (!strcmp(name, ".") || !strcmp(name, "..")) {
+            continue;
+        }
+        if (fstatat(dfd, name, &s, AT_SYMLINK_NOFOLLOW) != 0) {
+            continue;
+        }
+        if (!countNode(*dir.tree, s, &measured)) {
+            continue;
+        }
+        // Like FTS_XDEV, mount points are counted but not traversed.
+        if (S_ISDIR(s.st_mode) && s.st_dev == dir.dev) {
+            children.push_back(Directory { dir.tree, dir.dev, dir.path + "/" + name });
+        }
+    }
+    closedir(d);
+    dir.tree->measured += measured;
+
+    if (!children.empty()) {
+        std::lock_guard<std::mutex> lock(mLock);
+        for (auto& child : children) {
+            mPending.push_back(std::move(child));
+        }
+        mWork.notify_all();
+    }
+}
+
+bool TreeSizeCalculator::countNode(const Tree& tree, const struct stat& s, int64_t* size) {
+    int32_t user_uid = multiuser_get_app_id(s.st_uid);
+    int32_t user_gid = multiuser_get_app_id(s.st_gid);
+    if (tree.excludeApps && ((user_uid >= AID_APP_START && user_uid <= AID_APP_END)
+            || (user_gid >= AID_CACHE_GID_START && user_gid <= AID_CACHE_GID_END)
+            || (user_gid >= AID_SHARED_GID_START && user_gid <= AID_SHARED_GID_END))) {
+        // Don't traverse inside or measure
+        return false;
+    }
+    if (tree.includeGid != -1 && (int32_t) s.st_gid != tree.includeGid) {
+        return true;
+    }
+    if (tree.excludeGid != -1 && (int32_t) s.st_gid == tree.excludeGid) {
+        return true;
+    }
+    *size += s.st_blocks * 512;
+    return true;
+}
+
+}  // namespace installd
+}  // namespace android
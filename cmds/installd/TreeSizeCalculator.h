@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_INSTALLD_TREE_SIZE_CALCULATOR_H
+#define ANDROID_INSTALLD_TREE_SIZE_CALCULATOR_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <android-base/macros.h>
+
+namespace android {
+namespace installd {
+
+/**
+ * Measures directory trees the way calculate_tree_size() does, with a pool
+ * of worker threads sharing the directories of all the trees queued so far.
+ * Used when quota stats aren't available, where a whole user can take
+ * seconds to walk serially on flash.
+ *
+ * Sizes are only written to their targets by wait(), from the calling
+ * thread, so targets need no locking.
+ */
+class TreeSizeCalculator {
+public:
+    explicit TreeSizeCalculator(size_t numThreads = kDefaultThreads);
+    ~TreeSizeCalculator();
+
+    /**
+     * Queues the tree at path, whose size is added to *size by wait(). The
+     * filters are those of calculate_tree_size().
+     */
+    void measure(const std::string& path, int64_t* size,
+            int32_t include_gid = -1, int32_t exclude_gid = -1, bool exclude_apps = false);
+
+    /**
+     * Like measure(), adding the size of the tree to both targets.
+     */
+    void measure(const std::string& path, int64_t* size, int64_t* alsoSize);
+
+    /**
+     * Waits for all the queued trees and adds their sizes to their targets.
+     */
+    void wait();
+
+private:
+    static constexpr size_t kDefaultThreads = 4;
+
+    struct Tree {
+        int64_t* size;
+        int64_t* alsoSize;
+        int32_t includeGid;
+        int32_t excludeGid;
+        bool excludeApps;
+        std::atomic<int64_t> measured;
+    };
+
+    struct Directory {
+        Tree* tree;
+        dev_t dev;
+        std::string path;
+    };
+
+    void queue(const std::string& path, int64_t* size, int64_t* alsoSize,
+            int32_t include_gid, int32_t exclude_gid, bool exclude_apps);
+    void threadMain();
+    void measureDirectory(const Directory& dir);
+    // Returns whether the node should be traversed, and adds its size to *size if it matches
+    // the filters of tree.
+    static bool countNode(const Tree& tree, const struct stat& s, int64_t* size);
+
+    std::mutex mLock;
+    std::condition_variable mWork;
+    std::condition_variable mIdle;
+    // Guarded by mLock.
+    std::deque<Tree> mTrees;
+    std::deque<Directory> mPending;
+    size_t mBusy;
+    bool mExiting;
+
+    std::vector<std::thread> mThreads;
+
+    DISALLOW_COPY_AND_ASSIGN(TreeSizeCalculator);
+};
+
+}  // namespace installd
+}  // namespace android
+
+#endif  // ANDROID_INSTALLD_TREE_SIZE_CALCULATOR_H
@@ -15,6 +15,7 @@
  */
 #define LOG_TAG "installed"
 
+#include <dirent.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
@@ -27,6 +28,9 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <mutex>
+#include <unordered_map>
+
 #include <android-base/logging.h>
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
@@ -39,6 +43,7 @@
 #include <selinux/android.h>
 #include <system/thread_defs.h>
 
+#include "Dex2oatScheduler.h"
 #include "dexopt.h"
 #include "installd_deps.h"
 #include "otapreopt_utils.h"
@@ -666,6 +671,83 @@ static void run_profman_merge(const std::vector<unique_fd>& profiles_fd,
     exit(68);   /* only get here on exec failure */
 }
 
+// Forget the profiles of the oldest half of the locations past this many.
+static constexpr size_t kMaxProfileHashes = 1024;
+
+// Content hash of the profiles for which profman last said compilation could be skipped,
+// keyed by location. Merging the same profiles again gives the same answer, so the idle
+// maintenance passes that keep asking about unchanged packages needn't fork profman.
+static std::mutex profile_hashes_lock;
+static std::unordered_map<std::string, uint64_t> skipped_profile_hashes;
+
+static std::string profile_hash_key(const std::string& location, bool is_secondary_dex) {
+    return (is_secondary_dex ? "secondary:" : "primary:") + location;
+}
+
+// Returns an FNV-1a hash of the contents of all the given profiles, or 0 if one can't be read.
+// The fds are read with pread() so that profman still gets them at their current offsets.
+static uint64_t hash_profile_files(const std::vector<unique_fd>& profiles_fd,
+        const unique_fd& reference_profile_fd, /*out*/ bool* all_current_empty) {
+    uint64_t hash = 14695981039346656037ULL;
+    auto mix = [&hash](const uint8_t* data, size_t size) {
+        for (size_t i = 0; i < size; i++) {
+            hash = (hash ^ data[i]) * 1099511628211ULL;
+        }
+    };
+    auto mix_file = [&mix](int fd, /*out*/ off_t* file_size) {
+        uint8_t buf[64 * 1024];
+        off_t offset = 0;
+        ssize_t n;
+        while ((n = TEMP_FAILURE_RETRY(pread(fd, buf, sizeof(buf), offset))) > 0) {
+            mix(buf, n);
+            offset += n;
+        }
+        // Keep the boundaries between files in the hash.
+        mix(reinterpret_cast<const uint8_t*>(&offset), sizeof(offset));
+        *file_size = offset;
+        return n == 0;
+    };
+
+    off_t size;
+    if (!mix_file(reference_profile_fd.get(), &size)) {
+        return 0;
+    }
+    *all_current_empty = true;
+    for (const unique_fd& fd : profiles_fd) {
+        if (!mix_file(fd.get(), &size)) {
+            return 0;
+        }
+        if (size != 0) {
+            *all_current_empty = false;
+        }
+    }
+    return hash;
+}
+
+static bool profiles_skipped_before(const std::string& key, uint64_t hash) {
+    std::lock_guard<std::mutex> lock(profile_hashes_lock);
+    auto it = skipped_profile_hashes.find(key);
+    return it != skipped_profile_hashes.end() && it->second == hash;
+}
+
+static void set_profiles_skipped(const std::string& key, uint64_t hash) {
+    std::lock_guard<std::mutex> lock(profile_hashes_lock);
+    if (hash == 0) {
+        skipped_profile_hashes.erase(key);
+        return;
+    }
+    if (skipped_profile_hashes.size() >= kMaxProfileHashes
+            && skipped_profile_hashes.find(key) == skipped_profile_hashes.end()) {
+        // Entries of removed packages are never looked up again; drop an arbitrary half
+        // rather than tracking age for what is only a cache.
+        auto it = skipped_profile_hashes.begin();
+        for (size_t i = 0; i < kMaxProfileHashes / 2; i++) {
+            it = skipped_profile_hashes.erase(it);
+        }
+    }
+    skipped_profile_hashes[key] = hash;
+}
+
 // Decides if profile guided compilation is needed or not based on existing profiles.
 // The location is the package name for primary apks or the dex path for secondary dex files.
 // Returns true if there is enough information in the current profiles that makes it
@@ -682,6 +764,17 @@ static bool analyze_profiles(uid_t uid, const std::string& location, bool is_sec
         return false;
     }
 
+    // With nothing new in the current profiles, or the same profiles profman already judged
+    // not worth compiling, the merge would come back with SKIP_COMPILATION.
+    const std::string hash_key = profile_hash_key(location, is_secondary_dex);
+    bool all_current_empty = false;
+    const uint64_t profiles_hash = hash_profile_files(profiles_fd, reference_profile_fd,
+            &all_current_empty);
+    if (profiles_hash != 0 && (all_current_empty
+            || profiles_skipped_before(hash_key, profiles_hash))) {
+        return false;
+    }
+
     pid_t pid = fork();
     if (pid == 0) {
         /* child -- drop privileges before continuing */
@@ -708,6 +801,8 @@ static bool analyze_profiles(uid_t uid, const std::string& location, bool is_sec
                 need_to_compile = false;
                 should_clear_current_profiles = false;
                 should_clear_reference_profile = false;
+                // profman doesn't save the merge in this case, so the files are unchanged.
+                set_profiles_skipped(hash_key, profiles_hash);
                 break;
             case PROFMAN_BIN_RETURN_CODE_BAD_PROFILES:
                 LOG(WARNING) << "Bad profiles for location " << location;
@@ -1487,9 +1582,53 @@ static bool process_secondary_dex_dexopt(const char* original_dex_path, const ch
     return success;
 }
 
+// Forks and waits for dex2oat, returning the status of the child.
+static int run_dex2oat_child(uid_t uid, bool boot_complete, int input_fd, int out_oat_fd,
+        int in_vdex_fd, int out_vdex_fd, int image_fd, const char* dex_path,
+        const char* out_oat_path, int swap_fd, const char* instruction_set,
+        const char* compiler_filter, bool debuggable, int reference_profile_fd,
+        const char* shared_libraries) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        /* child -- drop privileges before continuing */
+        drop_capabilities(uid);
+
+        SetDex2OatScheduling(boot_complete);
+        if (flock(out_oat_fd, LOCK_EX | LOCK_NB) != 0) {
+            ALOGE("flock(%s) failed: %s\n", out_oat_path, strerror(errno));
+            _exit(67);
+        }
+
+        run_dex2oat(input_fd,
+                    out_oat_fd,
+                    in_vdex_fd,
+                    out_vdex_fd,
+                    image_fd,
+                    dex_path,
+                    out_oat_path,
+                    swap_fd,
+                    instruction_set,
+                    compiler_filter,
+                    debuggable,
+                    boot_complete,
+                    reference_profile_fd,
+                    shared_libraries);
+        _exit(68);   /* only get here on exec failure */
+    } else {
+        int res = wait_child(pid);
+        if (res == 0) {
+            ALOGV("DexInv: --- END '%s' (success) ---\n", dex_path);
+        } else {
+            ALOGE("DexInv: --- END '%s' --- status=0x%04x, process failed\n", dex_path, res);
+        }
+        return res;
+    }
+}
+
 int dexopt(const char* dex_path, uid_t uid, const char* pkgname, const char* instruction_set,
         int dexopt_needed, const char* oat_dir, int dexopt_flags, const char* compiler_filter,
-        const char* volume_uuid, const char* shared_libraries, const char* se_info) {
+        const char* volume_uuid, const char* shared_libraries, const char* se_info,
+        std::unique_lock<std::recursive_mutex>* service_lock) {
     CHECK(pkgname != nullptr);
     CHECK(pkgname[0] != 0);
     if ((dexopt_flags & ~DEXOPT_MASK) != 0) {
@@ -1501,6 +1640,7 @@ int dexopt(const char* dex_path, uid_t uid, const char* pkgname, const char* ins
     bool boot_complete = (dexopt_flags & DEXOPT_BOOTCOMPLETE) != 0;
     bool profile_guided = (dexopt_flags & DEXOPT_PROFILE_GUIDED) != 0;
     bool is_secondary_dex = (dexopt_flags & DEXOPT_SECONDARY_DEX) != 0;
+    bool idle_job = (dexopt_flags & DEXOPT_IDLE_BACKGROUND_JOB) != 0;
 
     // Check if we're dealing with a secondary dex file and if we need to compile it.
     std::string oat_dir_str;
@@ -1573,40 +1713,26 @@ int dexopt(const char* dex_path, uid_t uid, const char* pkgname, const char* ins
 
     ALOGV("DexInv: --- BEGIN '%s' ---\n", dex_path);
 
-    pid_t pid = fork();
-    if (pid == 0) {
-        /* child -- drop privileges before continuing */
-        drop_capabilities(uid);
-
-        SetDex2OatScheduling(boot_complete);
-        if (flock(out_oat_fd.get(), LOCK_EX | LOCK_NB) != 0) {
-            ALOGE("flock(%s) failed: %s\n", out_oat_path, strerror(errno));
-            _exit(67);
-        }
-
-        run_dex2oat(input_fd.get(),
-                    out_oat_fd.get(),
-                    in_vdex_fd.get(),
-                    out_vdex_fd.get(),
-                    image_fd.get(),
-                    dex_path,
-                    out_oat_path,
-                    swap_fd.get(),
-                    instruction_set,
-                    compiler_filter,
-                    debuggable,
-                    boot_complete,
-                    reference_profile_fd.get(),
-                    shared_libraries);
-        _exit(68);   /* only get here on exec failure */
-    } else {
-        int res = wait_child(pid);
-        if (res == 0) {
-            ALOGV("DexInv: --- END '%s' (success) ---\n", dex_path);
-        } else {
-            ALOGE("DexInv: --- END '%s' --- status=0x%04x, process failed\n", dex_path, res);
-            return res;
-        }
+    // Everything dex2oat needs is open, and the output is flock()ed by the child, so other
+    // calls don't have to wait for the compilation.
+    if (service_lock != nullptr) {
+        service_lock->unlock();
+    }
+    int res;
+    {
+        Dex2oatScheduler::Job job(idle_job ? Dex2oatScheduler::PRIORITY_IDLE
+                : boot_complete ? Dex2oatScheduler::PRIORITY_FOREGROUND
+                : Dex2oatScheduler::PRIORITY_BOOT, dex_path);
+        res = run_dex2oat_child(uid, boot_complete, input_fd.get(), out_oat_fd.get(),
+                in_vdex_fd.get(), out_vdex_fd.get(), image_fd.get(), dex_path, out_oat_path,
+                swap_fd.get(), instruction_set, compiler_filter, debuggable,
+                reference_profile_fd.get(), shared_libraries);
+    }
+    if (service_lock != nullptr) {
+        service_lock->lock();
+    }
+    if (res != 0) {
+        return res;
     }
 
     update_out_oat_access_times(dex_path, out_oat_path);
@@ -1671,6 +1797,84 @@ static bool create_secondary_dex_oat_layout(const std::string& dex_path, const s
     return true;
 }
 
+// Check whether the secondary dex 'dex_path' exists, the same way access(F_OK) does.
+// 'dir_entries' is the listing of the parent directory of 'dex_path', mapping names to their
+// d_type, or null if there is none: symbolic links and entries of an unknown type are always
+// checked with access(), since whether they exist depends on their target.
+// Return 1 if the file exists, 0 if it doesn't, or -1 with errno set on errors.
+typedef std::unordered_map<std::string, unsigned char> DirEntries;
+static int secondary_dex_exists(const std::string& dex_path, const DirEntries* dir_entries) {
+    if (dir_entries != nullptr) {
+        std::string name = dex_path.substr(dex_path.rfind('/') + 1);
+        if (!name.empty()) {
+            auto it = dir_entries->find(name);
+            if (it == dir_entries->end()) {
+                return 0;
+            }
+            if (it->second != DT_LNK && it->second != DT_UNKNOWN) {
+                return 1;
+            }
+        }
+    }
+    if (access(dex_path.c_str(), F_OK) == 0) {
+        return 1;
+    }
+    return errno == ENOENT ? 0 : -1;
+}
+
+// List the directory 'dir' for secondary_dex_exists(). A directory that doesn't exist gives an
+// empty listing. Return null if the directory couldn't be read.
+static std::unique_ptr<DirEntries> list_secondary_dex_dir(const std::string& dir) {
+    std::unique_ptr<DirEntries> entries(new DirEntries());
+    std::unique_ptr<DIR, decltype(&closedir)> d(opendir(dir.c_str()), closedir);
+    if (d == nullptr) {
+        if (errno != ENOENT) {
+            PLOG(WARNING) << "Failed to list secondary dex dir " << dir;
+            return nullptr;
+        }
+        return entries;
+    }
+    struct dirent* de;
+    while ((de = readdir(d.get())) != nullptr) {
+        entries->emplace(de->d_name, de->d_type);
+    }
+    return entries;
+}
+
+// Delete the oat/vdex/art files and the profiles generated for the secondary dex 'dex_path'.
+static bool clear_secondary_dex_artifacts(const std::string& dex_path, int uid,
+        const std::vector<std::string>& isas) {
+    char oat_path[PKG_PATH_MAX];
+    char oat_dir[PKG_PATH_MAX];
+    char oat_isa_dir[PKG_PATH_MAX];
+    bool result = true;
+    for (size_t i = 0; i < isas.size(); i++) {
+        if (!create_secondary_dex_oat_layout(dex_path, isas[i], oat_dir, oat_isa_dir, oat_path)) {
+            LOG(ERROR) << "Could not create secondary odex layout: " << dex_path;
+            result = false;
+            continue;
+        }
+
+        // Delete oat/vdex/art files.
+        result = unlink_if_exists(oat_path) && result;
+        result = unlink_if_exists(create_vdex_filename(oat_path)) && result;
+        result = unlink_if_exists(create_image_filename(oat_path)) && result;
+
+        // Delete profiles.
+        std::string current_profile = create_current_profile_path(
+                multiuser_get_user_id(uid), dex_path, /*is_secondary*/true);
+        std::string reference_profile = create_reference_profile_path(
+                dex_path, /*is_secondary*/true);
+        result = unlink_if_exists(current_profile) && result;
+        result = unlink_if_exists(reference_profile) && result;
+
+        // Try removing the directories as well, they might be empty.
+        result = rmdir_if_empty(oat_isa_dir) && result;
+        result = rmdir_if_empty(oat_dir) && result;
+    }
+    return result;
+}
+
 // Reconcile the secondary dex 'dex_path' and its generated oat files.
 // Return true if all the parameters are valid and the secondary dex file was
 //   processed successfully (i.e. the dex_path either exists, or if not, its corresponding
@@ -1697,45 +1901,61 @@ bool reconcile_secondary_dex_file(const std::string& dex_path,
         return false;
     }
 
-    if (access(dex_path.c_str(), F_OK) == 0) {
+    int exists = secondary_dex_exists(dex_path, /*dir_entries*/nullptr);
+    if (exists == 1) {
         // The path exists, nothing to do. The odex files (if any) will be left untouched.
         *out_secondary_dex_exists = true;
         return true;
-    } else if (errno != ENOENT) {
+    } else if (exists < 0) {
         PLOG(ERROR) << "Failed to check access to secondary dex " << dex_path;
         return false;
     }
 
     // The secondary dex does not exist anymore. Clear any generated files.
-    char oat_path[PKG_PATH_MAX];
-    char oat_dir[PKG_PATH_MAX];
-    char oat_isa_dir[PKG_PATH_MAX];
+    return clear_secondary_dex_artifacts(dex_path, uid, isas);
+}
+
+bool reconcile_secondary_dex_files(const std::vector<std::string>& dex_paths,
+        const std::vector<std::string>& pkgnames, const std::vector<int32_t>& uids,
+        const std::vector<std::string>& isas, const std::unique_ptr<std::string>& volume_uuid,
+        int storage_flag, /*out*/std::vector<bool>* out_secondary_dex_exists) {
+    out_secondary_dex_exists->assign(dex_paths.size(), false);
+    if (isas.size() == 0) {
+        LOG(ERROR) << "reconcile_secondary_dex_files called with empty isas vector";
+        return false;
+    }
+
+    // The secondary dex files of an app usually share a few directories. Each of them is
+    // listed once, instead of checking every file with its own access().
+    std::unordered_map<std::string, std::unique_ptr<DirEntries>> dir_listings;
+
+    const char* volume_uuid_cstr = volume_uuid == nullptr ? nullptr : volume_uuid->c_str();
     bool result = true;
-    for (size_t i = 0; i < isas.size(); i++) {
-        if (!create_secondary_dex_oat_layout(dex_path, isas[i], oat_dir, oat_isa_dir, oat_path)) {
-            LOG(ERROR) << "Could not create secondary odex layout: " << dex_path;
+    for (size_t i = 0; i < dex_paths.size(); i++) {
+        const std::string& dex_path = dex_paths[i];
+        if (!validate_secondary_dex_path(pkgnames[i].c_str(), dex_path.c_str(), volume_uuid_cstr,
+                uids[i], storage_flag)) {
+            LOG(ERROR) << "Could not validate secondary dex path " << dex_path;
             result = false;
             continue;
         }
 
-        // Delete oat/vdex/art files.
-        result = unlink_if_exists(oat_path) && result;
-        result = unlink_if_exists(create_vdex_filename(oat_path)) && result;
-        result = unlink_if_exists(create_image_filename(oat_path)) && result;
-
-        // Delete profiles.
-        std::string current_profile = create_current_profile_path(
-                multiuser_get_user_id(uid), dex_path, /*is_secondary*/true);
-        std::string reference_profile = create_reference_profile_path(
-                dex_path, /*is_secondary*/true);
-        result = unlink_if_exists(current_profile) && result;
-        result = unlink_if_exists(reference_profile) && result;
+        std::string dir = dex_path.substr(0, dex_path.rfind('/'));
+        auto listing = dir_listings.find(dir);
+        if (listing == dir_listings.end()) {
+            listing = dir_listings.emplace(dir, list_secondary_dex_dir(dir)).first;
+        }
 
-        // Try removing the directories as well, they might be empty.
-        result = rmdir_if_empty(oat_isa_dir) && result;
-        result = rmdir_if_empty(oat_dir) && result;
+        int exists = secondary_dex_exists(dex_path, listing->second.get());
+        if (exists == 1) {
+            (*out_secondary_dex_exists)[i] = true;
+        } else if (exists < 0) {
+            PLOG(ERROR) << "Failed to check access to secondary dex " << dex_path;
+            result = false;
+        } else {
+            result = clear_secondary_dex_artifacts(dex_path, uids[i], isas) && result;
+        }
     }
-
     return result;
 }
 
@@ -19,6 +19,8 @@
 
 #include <sys/types.h>
 
+#include <mutex>
+
 #include <cutils/multiuser.h>
 
 namespace android {
@@ -58,9 +60,20 @@ bool reconcile_secondary_dex_file(const std::string& dex_path,
         const std::unique_ptr<std::string>& volumeUuid, int storage_flag,
         /*out*/bool* out_secondary_dex_exists);
 
+// Batched reconcile_secondary_dex_file(). The i-th dex path belongs to the i-th package and uid.
+// Every dex path is processed, even after an error; the return value is false if any of them
+// failed. out_secondary_dex_exists[i] is true if the i-th secondary dex file still exists.
+bool reconcile_secondary_dex_files(const std::vector<std::string>& dex_paths,
+        const std::vector<std::string>& pkgnames, const std::vector<int32_t>& uids,
+        const std::vector<std::string>& isas, const std::unique_ptr<std::string>& volume_uuid,
+        int storage_flag, /*out*/std::vector<bool>* out_secondary_dex_exists);
+
+// If service_lock is given, it is released while dex2oat runs, so that other calls can go
+// ahead, including other dexopt calls up to the budget of Dex2oatScheduler.
 int dexopt(const char *apk_path, uid_t uid, const char *pkgName, const char *instruction_set,
         int dexopt_needed, const char* oat_dir, int dexopt_flags, const char* compiler_filter,
-        const char* volume_uuid, const char* shared_libraries, const char* se_info);
+        const char* volume_uuid, const char* shared_libraries, const char* se_info,
+        std::unique_lock<std::recursive_mutex>* service_lock = nullptr);
 
 }  // namespace installd
 }  // namespace android
@@ -15,6 +15,8 @@
  */
 
 #include <algorithm>
+#include <chrono>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <limits>
 #include <random>
@@ -24,6 +26,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/capability.h>
+#include <sys/file.h>
 #include <sys/prctl.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
@@ -78,8 +81,9 @@ static_assert(DEXOPT_SECONDARY_DEX  == 1 << 5, "DEXOPT_SECONDARY_DEX unexpected.
 static_assert(DEXOPT_FORCE          == 1 << 6, "DEXOPT_FORCE unexpected.");
 static_assert(DEXOPT_STORAGE_CE     == 1 << 7, "DEXOPT_STORAGE_CE unexpected.");
 static_assert(DEXOPT_STORAGE_DE     == 1 << 8, "DEXOPT_STORAGE_DE unexpected.");
+static_assert(DEXOPT_IDLE_BACKGROUND_JOB == 1 << 9, "DEXOPT_IDLE_BACKGROUND_JOB unexpected.");
 
-static_assert(DEXOPT_MASK           == 0x1fe, "DEXOPT_MASK unexpected.");
+static_assert(DEXOPT_MASK           == 0x3fe, "DEXOPT_MASK unexpected.");
 
 
 
@@ -106,12 +110,20 @@ class OTAPreoptService {
     // 4) Prepare(compile) boot image, if necessary.
     //
     // 5) Run update.
+    //
+    // Several instances may run at once (see otapreopt_script.sh). They share the boot image
+    // under a file lock, held exclusively only to create it.
     int Main(int argc, char** argv) {
         if (!ReadArguments(argc, argv)) {
             LOG(ERROR) << "Failed reading command line.";
             return 1;
         }
 
+        // Have the APK read in while the B partition properties and the boot image are looked
+        // at, or while waiting for another instance to finish the boot image.
+        const auto start = std::chrono::steady_clock::now();
+        PrefetchApk();
+
         if (!ReadSystemProperties()) {
             LOG(ERROR)<< "Failed reading system properties.";
             return 2;
@@ -129,13 +141,20 @@ class OTAPreoptService {
 
         PrepareEnvironment();
 
+        OpenBootImageLock();
+        LockBootImage(LOCK_EX);
         if (!PrepareBootImage(/* force */ false)) {
             LOG(ERROR) << "Failed preparing boot image.";
             return 5;
         }
+        LockBootImage(LOCK_SH);
 
         int dexopt_retcode = RunPreopt();
 
+        LOG(INFO) << "Preopt of " << package_parameters_.apk_path << " took "
+                << std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::steady_clock::now() - start).count()
+                << "ms, result " << dexopt_retcode;
         return dexopt_retcode;
     }
 
@@ -602,6 +621,66 @@ private:
         }
     }
 
+    // Starts readahead of the whole APK, so that it is in the page cache once dex2oat gets to
+    // it rather than read on demand during compilation.
+    void PrefetchApk() const {
+        int fd = TEMP_FAILURE_RETRY(open(package_parameters_.apk_path, O_RDONLY | O_CLOEXEC));
+        if (fd < 0) {
+            // ShouldSkipPreopt() takes care of missing packages.
+            return;
+        }
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        close(fd);
+    }
+
+    // Opens the lock serializing creation of the boot image against its use by concurrent
+    // instances. Without it, otapreopt still works, but only safely if run one at a time.
+    void OpenBootImageLock() {
+        std::string ota_dir = GetOTADataDirectory();
+        if (access(ota_dir.c_str(), F_OK) != 0 && !CreatePath(ota_dir)
+                && access(ota_dir.c_str(), F_OK) != 0) {
+            return;
+        }
+        std::string lock_path = ota_dir + "/boot-image.lock";
+        boot_image_lock_fd_ = TEMP_FAILURE_RETRY(
+                open(lock_path.c_str(), O_RDONLY | O_CREAT | O_CLOEXEC, 0600));
+        if (boot_image_lock_fd_ < 0) {
+            PLOG(WARNING) << "Could not open " << lock_path;
+        }
+    }
+
+    void LockBootImage(int operation) const {
+        if (boot_image_lock_fd_ >= 0 && TEMP_FAILURE_RETRY(flock(boot_image_lock_fd_,
+                operation)) != 0) {
+            PLOG(WARNING) << "Could not lock the boot image";
+        }
+    }
+
+    bool StatBootImage(struct stat* st) const {
+        std::string art_path = StringPrintf("%s/%s/%s/system@framework@boot.art",
+                GetOTADataDirectory().c_str(), DALVIK_CACHE, package_parameters_.instruction_set);
+        return stat(art_path.c_str(), st) == 0;
+    }
+
+    // Recreates the boot image after dex2oat failed to use it, unless a concurrent instance
+    // already did so while this one was compiling. Must be called with the shared lock held.
+    bool RegenerateBootImage() {
+        struct stat before;
+        const bool had_image = StatBootImage(&before);
+        LockBootImage(LOCK_EX);
+        struct stat after;
+        const bool replaced = had_image && StatBootImage(&after)
+                && (before.st_ino != after.st_ino
+                        || before.st_mtim.tv_sec != after.st_mtim.tv_sec
+                        || before.st_mtim.tv_nsec != after.st_mtim.tv_nsec);
+        bool result = true;
+        if (!replaced) {
+            result = PrepareBootImage(/* force */ true);
+        }
+        LockBootImage(LOCK_SH);
+        return result;
+    }
+
     static bool CreatePath(const std::string& path) {
         // Create the given path. Use string processing instead of dirname, as dirname's need for
         // a writable char buffer is painful.
@@ -840,7 +919,7 @@ private:
         // Then regenerate and retry.
         if (WEXITSTATUS(dexopt_result) ==
                 static_cast<int>(art::dex2oat::ReturnCode::kCreateRuntime)) {
-            if (!PrepareBootImage(/* force */ true)) {
+            if (!RegenerateBootImage()) {
                 LOG(ERROR) << "Forced boot image creating failed. Original error return was "
                         << dexopt_result;
                 return dexopt_result;
@@ -992,6 +1071,9 @@ private:
 
     Parameters package_parameters_;
 
+    // Lock file shared with concurrent instances, see Main().
+    int boot_image_lock_fd_ = -1;
+
     // Store environment values we need to set.
     std::vector<std::string> environ_;
 };
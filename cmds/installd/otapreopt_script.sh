@@ -24,6 +24,13 @@ STATUS_FD="$2"
 # Maximum number of packages/steps.
 MAXIMUM_PACKAGES=1000
 
+# Number of packages compiled at once. Each compilation also reads its APK before dex2oat
+# needs it, so with more than one, I/O of some packages overlaps compilation of others.
+JOBS=$(getprop dalvik.vm.otapreopt-jobs)
+if [ -z "$JOBS" ] || [ "$JOBS" -lt 1 ] ; then
+  JOBS=1
+fi
+
 # First ensure the system is booted. This is to work around issues when cmd would
 # infinitely loop trying to get a service manager (which will never come up in that
 # mode). b/30797145
@@ -58,23 +65,40 @@ PREPARE=$(cmd otadexopt prepare)
 PROGRESS=$(cmd otadexopt progress)
 print -u${STATUS_FD} "global_progress $PROGRESS"
 
-i=0
-while ((i<MAXIMUM_PACKAGES)) ; do
-  DEXOPT_PARAMS=$(cmd otadexopt next)
-
-  /system/bin/otapreopt_chroot $STATUS_FD $TARGET_SLOT_SUFFIX $DEXOPT_PARAMS >&- 2>&-
-
-  PROGRESS=$(cmd otadexopt progress)
-  print -u${STATUS_FD} "global_progress $PROGRESS"
-
-  DONE=$(cmd otadexopt done)
-  if [ "$DONE" = "OTA incomplete." ] ; then
-    sleep 1
-    i=$((i+1))
-    continue
-  fi
-  break
+START_TIME=$(date +%s)
+
+# Compiles packages until the service has handed them all out. Each call to next returns a
+# different package, so workers can share the queue.
+run_worker() {
+  i=0
+  while ((i<MAXIMUM_PACKAGES)) ; do
+    DEXOPT_PARAMS=$(cmd otadexopt next)
+
+    /system/bin/otapreopt_chroot $STATUS_FD $TARGET_SLOT_SUFFIX $DEXOPT_PARAMS >&- 2>&-
+
+    PROGRESS=$(cmd otadexopt progress)
+    print -u${STATUS_FD} "global_progress $PROGRESS"
+
+    DONE=$(cmd otadexopt done)
+    if [ "$DONE" = "OTA incomplete." ] ; then
+      sleep 1
+      i=$((i+1))
+      continue
+    fi
+    break
+  done
+}
+
+j=1
+while ((j<JOBS)) ; do
+  run_worker &
+  j=$((j+1))
 done
+run_worker
+wait
+
+END_TIME=$(date +%s)
+echo "Preopt with $JOBS jobs took $((END_TIME-START_TIME))s."
 
 DONE=$(cmd otadexopt done)
 if [ "$DONE" = "OTA incomplete." ] ; then
@@ -26,6 +26,7 @@
 
 #include "InstalldNativeService.h"
 #include "globals.h"
+#include "installd_constants.h"
 #include "utils.h"
 
 using android::base::StringPrintf;
@@ -161,5 +162,38 @@ TEST_F(ServiceTest, RmDexNoDalvikCache) {
     EXPECT_TRUE(service->rmdex("com.example", "arm").isOk());
 }
 
+TEST_F(ServiceTest, ReconcileSecondaryDexFiles) {
+    LOG(INFO) << "ReconcileSecondaryDexFiles";
+
+    mkdir("com.example", 10000, 10000, 0700);
+    mkdir("com.example/foo", 10000, 10000, 0700);
+    touch("com.example/foo/present.dex", 10000, 10000, 0600);
+
+    const std::string dir = "/data/local/tmp/user/0/com.example/";
+    std::vector<std::string> dexPaths = {
+            dir + "foo/present.dex",
+            dir + "foo/missing.dex",
+            dir + "bar/missing.dex",
+    };
+    std::vector<std::string> packageNames(dexPaths.size(), "com.example");
+    std::vector<int32_t> uids(dexPaths.size(), 10000);
+    std::vector<std::string> isas = {"arm"};
+    std::vector<bool> exists;
+
+    EXPECT_TRUE(service->reconcileSecondaryDexFiles(dexPaths, packageNames, uids, isas,
+            testUuid, FLAG_STORAGE_CE, &exists).isOk());
+    EXPECT_EQ(std::vector<bool>({true, false, false}), exists);
+
+    // A path outside of the app directory fails, without stopping the rest of the batch
+    dexPaths[1] = "/data/local/tmp/other.dex";
+    EXPECT_FALSE(service->reconcileSecondaryDexFiles(dexPaths, packageNames, uids, isas,
+            testUuid, FLAG_STORAGE_CE, &exists).isOk());
+    EXPECT_EQ(std::vector<bool>({true, false, false}), exists);
+
+    uids.pop_back();
+    EXPECT_FALSE(service->reconcileSecondaryDexFiles(dexPaths, packageNames, uids, isas,
+            testUuid, FLAG_STORAGE_CE, &exists).isOk());
+}
+
 }  // namespace installd
 }  // namespace android
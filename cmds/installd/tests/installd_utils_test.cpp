@@ -14,12 +14,17 @@
  * limitations under the License.
  */
 
+#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <gtest/gtest.h>
 
 #include "InstalldNativeService.h"
+#include "TreeCopier.h"
+#include "TreeSizeCalculator.h"
 #include "globals.h"
 #include "utils.h"
 
@@ -38,6 +43,8 @@
 
 #define TEST_PROFILE_DIR "/data/misc/profiles"
 
+#define TEST_TREE_DIR "/data/local/tmp/installd_tree_test"
+
 #define REALLY_LONG_APP_NAME "com.example." \
         "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa." \
         "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa." \
@@ -571,5 +578,117 @@ TEST_F(UtilsTest, CreateSecondaryReferenceProfile) {
                     "/data/user/0/com.example/secondary.dex", /*is_secondary*/true));
 }
 
+static void make_tree(const std::string& path, int depth) {
+    ::mkdir(path.c_str(), 0755);
+    for (int i = 0; i < 3; i++) {
+        std::string file = path + "/file" + std::to_string(i);
+        int fd = ::open(file.c_str(), O_RDWR | O_CREAT, 0644);
+        ::fallocate(fd, 0, 0, 4096 * (i + 1));
+        ::close(fd);
+        if (depth > 0) {
+            make_tree(path + "/dir" + std::to_string(i), depth - 1);
+        }
+    }
+    ::symlink("file0", (path + "/link").c_str());
+}
+
+TEST_F(UtilsTest, TreeSizeCalculator_MatchesCalculateTreeSize) {
+    system("rm -rf " TEST_TREE_DIR);
+    make_tree(TEST_TREE_DIR, 3);
+
+    int64_t expected = 0;
+    EXPECT_EQ(0, calculate_tree_size(TEST_TREE_DIR, &expected));
+    EXPECT_GT(expected, 0);
+
+    int64_t size = 0;
+    int64_t dirSize = 0;
+    int64_t alsoSize = 0;
+    {
+        TreeSizeCalculator calculator;
+        calculator.measure(TEST_TREE_DIR, &size);
+        calculator.measure(TEST_TREE_DIR "/dir1", &dirSize, &alsoSize);
+        calculator.measure(TEST_TREE_DIR "/missing", &size);
+        calculator.wait();
+    }
+    EXPECT_EQ(expected, size);
+
+    int64_t expectedDir = 0;
+    calculate_tree_size(TEST_TREE_DIR "/dir1", &expectedDir);
+    EXPECT_EQ(expectedDir, dirSize);
+    EXPECT_EQ(expectedDir, alsoSize);
+
+    system("rm -rf " TEST_TREE_DIR);
+}
+
+TEST_F(UtilsTest, TreeSizeCalculator_Filters) {
+    system("rm -rf " TEST_TREE_DIR);
+    make_tree(TEST_TREE_DIR, 2);
+    const int32_t gid = getegid();
+
+    int64_t expectedIncluded = 0;
+    int64_t expectedExcluded = 0;
+    calculate_tree_size(TEST_TREE_DIR, &expectedIncluded, gid, -1);
+    calculate_tree_size(TEST_TREE_DIR, &expectedExcluded, -1, gid);
+
+    int64_t included = 0;
+    int64_t excluded = 0;
+    TreeSizeCalculator calculator(1);
+    calculator.measure(TEST_TREE_DIR, &included, gid, -1);
+    calculator.measure(TEST_TREE_DIR, &excluded, -1, gid);
+    calculator.wait();
+    EXPECT_EQ(expectedIncluded, included);
+    EXPECT_EQ(expectedExcluded, excluded);
+    EXPECT_EQ(0, excluded);
+
+    system("rm -rf " TEST_TREE_DIR);
+}
+
+static void expect_same_node(const std::string& from, const std::string& to) {
+    struct stat from_st;
+    struct stat to_st;
+    ASSERT_EQ(0, lstat(from.c_str(), &from_st)) << from;
+    ASSERT_EQ(0, lstat(to.c_str(), &to_st)) << to;
+    EXPECT_EQ(from_st.st_mode, to_st.st_mode) << to;
+    EXPECT_EQ(from_st.st_uid, to_st.st_uid) << to;
+    EXPECT_EQ(from_st.st_gid, to_st.st_gid) << to;
+    EXPECT_EQ(from_st.st_mtim.tv_sec, to_st.st_mtim.tv_sec) << to;
+    EXPECT_EQ(from_st.st_mtim.tv_nsec, to_st.st_mtim.tv_nsec) << to;
+    if (!S_ISDIR(from_st.st_mode)) {
+        EXPECT_EQ(from_st.st_size, to_st.st_size) << to;
+    }
+}
+
+TEST_F(UtilsTest, TreeCopier_CopiesLikeCp) {
+    system("rm -rf " TEST_TREE_DIR " " TEST_TREE_DIR "_to");
+    make_tree(TEST_TREE_DIR, 2);
+    ::chmod(TEST_TREE_DIR "/dir1", 02771);
+
+    // Existing directories are merged into, existing files replaced.
+    ::mkdir(TEST_TREE_DIR "_to", 0755);
+    ::mkdir(TEST_TREE_DIR "_to/installd_tree_test", 0700);
+    int fd = ::open(TEST_TREE_DIR "_to/installd_tree_test/file1", O_RDWR | O_CREAT, 0600);
+    EXPECT_EQ(5, ::write(fd, "stale", 5));
+    ::close(fd);
+
+    TreeCopier copier;
+    EXPECT_EQ(0, copier.copy(TEST_TREE_DIR, TEST_TREE_DIR "_to"));
+    EXPECT_EQ(39, copier.getFilesCopied());
+    EXPECT_EQ(39 / 3 * (4096 + 8192 + 12288), copier.getBytesCopied());
+
+    const std::string to = TEST_TREE_DIR "_to/installd_tree_test";
+    expect_same_node(TEST_TREE_DIR, to);
+    expect_same_node(TEST_TREE_DIR "/dir1", to + "/dir1");
+    expect_same_node(TEST_TREE_DIR "/file1", to + "/file1");
+    expect_same_node(TEST_TREE_DIR "/link", to + "/link");
+    expect_same_node(TEST_TREE_DIR "/dir2/dir0/file2", to + "/dir2/dir0/file2");
+    char target[PATH_MAX];
+    ssize_t len = readlink((to + "/dir1/link").c_str(), target, sizeof(target));
+    EXPECT_EQ("file0", std::string(target, std::max(len, (ssize_t) 0)));
+
+    EXPECT_EQ(-1, copier.copy(TEST_TREE_DIR "/missing", TEST_TREE_DIR "_to"));
+
+    system("rm -rf " TEST_TREE_DIR " " TEST_TREE_DIR "_to");
+}
+
 }  // namespace installd
 }  // namespace android
@@ -45,6 +45,7 @@ constexpr const char* kXattrInodeCache = "user.inode_cache";
 constexpr const char* kXattrInodeCodeCache = "user.inode_code_cache";
 constexpr const char* kXattrCacheGroup = "user.cache_group";
 constexpr const char* kXattrCacheTombstone = "user.cache_tombstone";
+constexpr const char* kXattrFixupDigest = "user.fixup_digest";
 
 int create_pkg_path(char path[PKG_PATH_MAX],
                     const char *pkgname,
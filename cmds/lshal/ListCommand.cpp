@@ -18,12 +18,14 @@
 
 #include <getopt.h>
 
+#include <atomic>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <map>
 #include <sstream>
 #include <regex>
+#include <thread>
 
 #include <android-base/parseint.h>
 #include <android/hidl/manager/1.0/IServiceManager.h>
@@ -57,6 +59,26 @@ std::string getCmdline(pid_t pid) {
     return cmdline;
 }
 
+// Calls func(0) to func(count - 1) from up to MAX_CONCURRENT_QUERIES threads,
+// so one slow HAL doesn't hold up all the others. Returns once they are done.
+static void forEachConcurrently(size_t count, const std::function<void(size_t)> &func) {
+    std::atomic<size_t> next{0};
+    auto worker = [&] {
+        size_t i;
+        while ((i = next++) < count) {
+            func(i);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < std::min(count, MAX_CONCURRENT_QUERIES); ++i) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
 const std::string &ListCommand::getCmdline(pid_t pid) {
     auto pair = mCmdlines.find(pid);
     if (pair != mCmdlines.end()) {
@@ -343,12 +365,21 @@ void ListCommand::dumpTable() {
             "the library and successfully fetched the passthrough implementation.";
     mImplementationsTable.description =
             "All available passthrough implementations (all -impl.so files)";
-    forEachTable([this] (const Table &table) {
+    // We're only interested in dumping debug info for already
+    // instantiated services. There's little value in dumping the
+    // debug info for a service we create on the fly, so we only operate
+    // on the "mServicesTable".
+    std::vector<std::string> debugInfos;
+    if (mEmitDebugInfo) {
+        debugInfos = fetchDebugInfos();
+    }
+    forEachTable([this, &debugInfos] (const Table &table) {
         mOut << table.description << std::endl;
         mOut << std::left;
         printLine("Interface", "Transport", "Arch", "Server", "Server CMD",
                   "PTR", "Clients", "Clients CMD");
 
+        size_t index = 0;
         for (const auto &entry : table) {
             printLine(entry.interfaceName,
                     entry.transport,
@@ -359,21 +390,43 @@ void ListCommand::dumpTable() {
                     join(entry.clientPids, " "),
                     join(entry.clientCmdlines, ";"));
 
-            // We're only interested in dumping debug info for already
-            // instantiated services. There's little value in dumping the
-            // debug info for a service we create on the fly, so we only operate
-            // on the "mServicesTable".
             if (mEmitDebugInfo && &table == &mServicesTable) {
-                auto pair = splitFirst(entry.interfaceName, '/');
-                mLshal.emitDebugInfo(pair.first, pair.second, {}, mOut.buf(),
-                        NullableOStream<std::ostream>(nullptr));
+                mOut << debugInfos[index];
             }
+            ++index;
         }
         mOut << std::endl;
     });
 
 }
 
+std::vector<std::string> ListCommand::fetchDebugInfos() {
+    const Table::Entries &entries = mServicesTable.entries;
+    std::vector<std::string> debugInfos(entries.size());
+    std::vector<char> skipped(entries.size(), false);
+    const auto deadline = std::chrono::system_clock::now() + DEBUG_DEADLINE;
+    forEachConcurrently(entries.size(), [&] (size_t i) {
+        // debug() calls have no timeout of their own, so the deadline only
+        // stops new ones from being made.
+        if (std::chrono::system_clock::now() >= deadline) {
+            skipped[i] = true;
+            return;
+        }
+        auto pair = splitFirst(entries[i].interfaceName, '/');
+        std::stringstream out;
+        mLshal.emitDebugInfo(pair.first, pair.second, {}, out,
+                NullableOStream<std::ostream>(nullptr));
+        debugInfos[i] = out.str();
+    });
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (skipped[i]) {
+            mErr << "Warning: Skipping debug info of \"" << entries[i].interfaceName << "\": "
+                 << "out of time." << std::endl;
+        }
+    }
+    return debugInfos;
+}
+
 void ListCommand::dump() {
     if (mVintf) {
         dumpVintf();
@@ -484,41 +537,66 @@ Status ListCommand::fetchBinderized(const sp<IServiceManager> &manager) {
     }
 
     Status status = OK;
-    // server pid, .ptr value of binder object, child pids
-    std::map<std::string, DebugInfo> allDebugInfos;
-    std::map<pid_t, std::map<uint64_t, Pids>> allPids;
-    for (const auto &fqInstanceName : fqInstanceNames) {
+    // Fetched concurrently; each instance only touches its own slot, and the
+    // results are merged in listing order so the output doesn't depend on
+    // which HAL answered first.
+    struct FetchResult {
+        bool hasDebugInfo = false;
+        DebugInfo debugInfo;
+        std::string error;
+    };
+    std::vector<FetchResult> results(fqInstanceNames.size());
+    const auto deadline = std::chrono::system_clock::now() + FETCH_DEADLINE;
+    forEachConcurrently(fqInstanceNames.size(), [&] (size_t i) {
+        const std::string fqInstanceName{fqInstanceNames[i].c_str()};
+        FetchResult &result = results[i];
+        if (std::chrono::system_clock::now() >= deadline) {
+            result.error = "Warning: Skipping \"" + fqInstanceName + "\": "
+                    + "out of time.";
+            return;
+        }
         const auto pair = splitFirst(fqInstanceName, '/');
         const auto &serviceName = pair.first;
         const auto &instanceName = pair.second;
         auto getRet = timeoutIPC(manager, &IServiceManager::get, serviceName, instanceName);
         if (!getRet.isOk()) {
-            mErr << "Warning: Skipping \"" << fqInstanceName << "\": "
-                 << "cannot be fetched from service manager:"
-                 << getRet.description() << std::endl;
-            status |= DUMP_BINDERIZED_ERROR;
-            continue;
+            result.error = "Warning: Skipping \"" + fqInstanceName + "\": "
+                    + "cannot be fetched from service manager:"
+                    + getRet.description();
+            return;
         }
         sp<IBase> service = getRet;
         if (service == nullptr) {
-            mErr << "Warning: Skipping \"" << fqInstanceName << "\": "
-                 << "cannot be fetched from service manager (null)"
-                 << std::endl;
-            status |= DUMP_BINDERIZED_ERROR;
-            continue;
+            result.error = "Warning: Skipping \"" + fqInstanceName + "\": "
+                    + "cannot be fetched from service manager (null)";
+            return;
         }
         auto debugRet = timeoutIPC(service, &IBase::getDebugInfo, [&] (const auto &debugInfo) {
-            allDebugInfos[fqInstanceName] = debugInfo;
-            if (debugInfo.pid >= 0) {
-                allPids[static_cast<pid_t>(debugInfo.pid)].clear();
-            }
+            result.debugInfo = debugInfo;
+            result.hasDebugInfo = true;
         });
         if (!debugRet.isOk()) {
-            mErr << "Warning: Skipping \"" << fqInstanceName << "\": "
-                 << "debugging information cannot be retrieved:"
-                 << debugRet.description() << std::endl;
+            result.error = "Warning: Skipping \"" + fqInstanceName + "\": "
+                    + "debugging information cannot be retrieved:"
+                    + debugRet.description();
+        }
+    });
+
+    // server pid, .ptr value of binder object, child pids
+    std::map<std::string, DebugInfo> allDebugInfos;
+    std::map<pid_t, std::map<uint64_t, Pids>> allPids;
+    for (size_t i = 0; i < fqInstanceNames.size(); ++i) {
+        const FetchResult &result = results[i];
+        if (!result.error.empty()) {
+            mErr << result.error << std::endl;
             status |= DUMP_BINDERIZED_ERROR;
         }
+        if (result.hasDebugInfo) {
+            allDebugInfos[fqInstanceNames[i]] = result.debugInfo;
+            if (result.debugInfo.pid >= 0) {
+                allPids[static_cast<pid_t>(result.debugInfo.pid)].clear();
+            }
+        }
     }
     for (auto &pair : allPids) {
         pid_t serverPid = pair.first;
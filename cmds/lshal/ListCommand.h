@@ -48,6 +48,9 @@ private:
     Status fetchPassthrough(const sp<::android::hidl::manager::V1_0::IServiceManager> &manager);
     Status fetchBinderized(const sp<::android::hidl::manager::V1_0::IServiceManager> &manager);
     Status fetchAllLibraries(const sp<::android::hidl::manager::V1_0::IServiceManager> &manager);
+    // Calls IBase::debug on every service in mServicesTable, concurrently, and
+    // returns their output in the same order.
+    std::vector<std::string> fetchDebugInfos();
     bool getReferencedPids(
         pid_t serverPid, std::map<uint64_t, Pids> *objects) const;
     void dumpTable();
@@ -27,6 +27,16 @@ namespace lshal {
 
 static constexpr std::chrono::milliseconds IPC_CALL_WAIT{500};
 
+// How many HALs are queried at once while listing.
+static constexpr size_t MAX_CONCURRENT_QUERIES = 8;
+// How long fetching the binderized services may take in total; services not
+// queried by then are skipped. Calls already made are still bounded by
+// IPC_CALL_WAIT.
+static constexpr std::chrono::milliseconds FETCH_DEADLINE{3000};
+// Same for collecting IBase::debug output with --debug; together with
+// FETCH_DEADLINE this stays within the time bugreports give lshal.
+static constexpr std::chrono::milliseconds DEBUG_DEADLINE{6000};
+
 class BackgroundTaskState {
 public:
     BackgroundTaskState(std::function<void(void)> &&func)
@@ -159,6 +159,34 @@ TEST_F(LshalTest, Debug3) {
     EXPECT_THAT(err.str(), HasSubstr("does not exist"));
 }
 
+TEST_F(LshalTest, ListKeepsServiceOrder) {
+    using ::android::hardware::tests::baz::V1_0::IQuux;
+    // Services are fetched concurrently, but must be listed, and complained
+    // about, in the order hwservicemanager returns them.
+    const std::string first = "android.hardware.tests.doesnotexist@1.0::IFoo/first";
+    const std::string quux = std::string{IQuux::descriptor} + "/default";
+    const std::string last = "android.hardware.tests.doesnotexist@1.0::IFoo/last";
+    ON_CALL(*serviceManager, list(_)).WillByDefault(Invoke(
+        [&](IServiceManager::list_cb cb) {
+            cb({first, quux, last});
+            return ::android::hardware::Void();
+        }));
+    const char *args[] = {
+        "lshal", "list", "-i"
+    };
+    Lshal(out, err, serviceManager, serviceManager)
+            .main({NELEMS(args), const_cast<char **>(args)});
+
+    std::string output = out.str();
+    ASSERT_NE(std::string::npos, output.find(first));
+    EXPECT_LT(output.find(first), output.find(quux));
+    EXPECT_LT(output.find(quux), output.find(last));
+
+    std::string errors = err.str();
+    ASSERT_NE(std::string::npos, errors.find("\"" + first + "\""));
+    EXPECT_LT(errors.find("\"" + first + "\""), errors.find("\"" + last + "\""));
+}
+
 } // namespace lshal
 } // namespace android
 
@@ -7,6 +7,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <cutils/multiuser.h>
 
@@ -136,6 +137,8 @@ static int svc_can_find(const uint16_t *name, size_t name_len, pid_t spid, uid_t
 struct svcinfo
 {
     struct svcinfo *next;
+    struct svcinfo *hash_next;
+    uint32_t hash;
     uint32_t handle;
     struct binder_death death;
     int allow_isolated;
@@ -143,14 +146,85 @@ struct svcinfo
     uint16_t name[0];
 };
 
+// svclist keeps the registration order that list_service() hands out;
+// lookups go through svchash, whose size is a power of two.
 struct svcinfo *svclist = NULL;
+static struct svcinfo **svchash = NULL;
+static size_t svchash_size = 0;
+static size_t svc_count = 0;
+
+#define SVCHASH_INITIAL_SIZE 256
+
+struct lookup_stats {
+    uint64_t lookups;
+    uint64_t misses;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t next_report;
+};
 
-struct svcinfo *find_svc(const uint16_t *s16, size_t len)
+// Reported at 1024 lookups, then each time the count doubles, which
+// covers boot with a few lines and stays quiet afterwards.
+static struct lookup_stats lookup_stats = { 0, 0, 0, 0, 1024 };
+
+static uint32_t svc_hash(const uint16_t *s16, size_t len)
 {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hash = (hash ^ s16[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static int svchash_grow(void)
+{
+    size_t new_size = svchash_size ? svchash_size * 2 : SVCHASH_INITIAL_SIZE;
+    struct svcinfo **new_hash = calloc(new_size, sizeof(*new_hash));
     struct svcinfo *si;
 
+    if (!new_hash) {
+        return -1;
+    }
     for (si = svclist; si; si = si->next) {
-        if ((len == si->len) &&
+        size_t bucket = si->hash & (new_size - 1);
+        si->hash_next = new_hash[bucket];
+        new_hash[bucket] = si;
+    }
+    free(svchash);
+    svchash = new_hash;
+    svchash_size = new_size;
+    return 0;
+}
+
+static int svchash_insert(struct svcinfo *si)
+{
+    size_t bucket;
+
+    // at most 3/4 full
+    if ((svc_count + 1) * 4 > svchash_size * 3 && svchash_grow()) {
+        return -1;
+    }
+    bucket = si->hash & (svchash_size - 1);
+    si->hash_next = svchash[bucket];
+    svchash[bucket] = si;
+    svc_count++;
+    return 0;
+}
+
+struct svcinfo *find_svc(const uint16_t *s16, size_t len)
+{
+    struct svcinfo *si;
+    uint32_t hash;
+
+    if (!svchash_size) {
+        return NULL;
+    }
+    hash = svc_hash(s16, len);
+    for (si = svchash[hash & (svchash_size - 1)]; si; si = si->hash_next) {
+        if ((hash == si->hash) && (len == si->len) &&
             !memcmp(s16, si->name, len * sizeof(uint16_t))) {
             return si;
         }
@@ -158,6 +232,35 @@ struct svcinfo *find_svc(const uint16_t *s16, size_t len)
     return NULL;
 }
 
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static void record_lookup(uint64_t elapsed_ns, int found)
+{
+    struct lookup_stats *st = &lookup_stats;
+
+    st->lookups++;
+    if (!found) {
+        st->misses++;
+    }
+    st->total_ns += elapsed_ns;
+    if (elapsed_ns > st->max_ns) {
+        st->max_ns = elapsed_ns;
+    }
+    if (st->lookups == st->next_report) {
+        ALOGI("%" PRIu64 " lookups (%" PRIu64 " misses) of %zu services, "
+              "%" PRIu64 " ns avg, %" PRIu64 " ns max\n",
+              st->lookups, st->misses, svc_count,
+              st->total_ns / st->lookups, st->max_ns);
+        st->next_report *= 2;
+    }
+}
+
 void svcinfo_death(struct binder_state *bs, void *ptr)
 {
     struct svcinfo *si = (struct svcinfo* ) ptr;
@@ -240,6 +343,13 @@ int do_add_service(struct binder_state *bs,
         si->death.func = (void*) svcinfo_death;
         si->death.ptr = si;
         si->allow_isolated = allow_isolated;
+        si->hash = svc_hash(s, len);
+        if (svchash_insert(si)) {
+            ALOGE("add_service('%s',%x) uid=%d - OUT OF MEMORY\n",
+                 str8(s, len), handle, uid);
+            free(si);
+            return -1;
+        }
         si->next = svclist;
         svclist = si;
     }
@@ -260,6 +370,7 @@ int svcmgr_handler(struct binder_state *bs,
     uint32_t handle;
     uint32_t strict_policy;
     int allow_isolated;
+    uint64_t start_ns;
 
     //ALOGI("target=%p code=%d pid=%d uid=%d\n",
     //      (void*) txn->target.ptr, txn->code, txn->sender_pid, txn->sender_euid);
@@ -301,7 +412,9 @@ int svcmgr_handler(struct binder_state *bs,
         if (s == NULL) {
             return -1;
         }
+        start_ns = now_ns();
         handle = do_find_service(s, len, txn->sender_euid, txn->sender_pid);
+        record_lookup(now_ns() - start_ns, handle != 0);
         if (!handle)
             break;
         bio_put_ref(reply, handle);
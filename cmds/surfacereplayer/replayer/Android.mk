@@ -30,6 +30,7 @@ LOCAL_SRC_FILES := \
     BufferQueueScheduler.cpp \
     Event.cpp \
     Replayer.cpp \
+    ReplayStats.cpp \
 
 LOCAL_SHARED_LIBRARIES := \
     libEGL \
@@ -23,8 +23,12 @@
 using namespace android;
 
 BufferQueueScheduler::BufferQueueScheduler(
-        const sp<SurfaceControl>& surfaceControl, const HSV& color, int id)
-      : mSurfaceControl(surfaceControl), mColor(color), mSurfaceId(id), mContinueScheduling(true) {}
+        const sp<SurfaceControl>& surfaceControl, const HSV& color, int id, ReplayStats* stats)
+      : mSurfaceControl(surfaceControl),
+        mColor(color),
+        mSurfaceId(id),
+        mStats(stats),
+        mContinueScheduling(true) {}
 
 void BufferQueueScheduler::startScheduling() {
     ALOGV("Starting Scheduler for %d Layer", mSurfaceId);
@@ -102,8 +106,13 @@ void BufferQueueScheduler::fillSurface(const std::shared_ptr<Event>& event) {
     }
 
     event->readyToExecute();
+    const nsecs_t startTime = systemTime();
 
     status = s->unlockAndPost();
 
     ALOGE_IF(status != NO_ERROR, "fillSurface: failed to unlock and post buffer, (%d)", status);
+
+    if (mStats != nullptr && status == NO_ERROR) {
+        mStats->addSample("buffers", systemTime() - startTime);
+    }
 }
@@ -19,6 +19,7 @@
 
 #include "Color.h"
 #include "Event.h"
+#include "ReplayStats.h"
 
 #include <gui/SurfaceControl.h>
 
@@ -52,7 +53,9 @@ struct BufferEvent {
 
 class BufferQueueScheduler {
   public:
-    BufferQueueScheduler(const sp<SurfaceControl>& surfaceControl, const HSV& color, int id);
+    // Buffer latencies are added to stats unless it is null
+    BufferQueueScheduler(const sp<SurfaceControl>& surfaceControl, const HSV& color, int id,
+            ReplayStats* stats = nullptr);
 
     void startScheduling();
     void addEvent(const BufferEvent&);
@@ -70,6 +73,7 @@ class BufferQueueScheduler {
     sp<SurfaceControl> mSurfaceControl;
     HSV mColor;
     const int mSurfaceId;
+    ReplayStats* const mStats;
 
     bool mContinueScheduling;
 
@@ -51,6 +51,12 @@ void printHelpMenu() {
 
     std::cout << "  -l  Indefinitely loop the replayer\n";
 
+    std::cout << "  -b  Replay as fast as SurfaceFlinger accepts the trace and report throughput "
+                 "and latencies\n";
+
+    std::cout << "  -f  Start every increment at its absolute time from the start of the replay "
+                 "and report how late they were\n";
+
     std::cout << "  -h  Display help menu\n";
 
     std::cout << std::endl;
@@ -63,9 +69,10 @@ int main(int argc, char** argv) {
     bool pauseBeginning = false;
     int numThreads = DEFAULT_THREADS;
     long stopHere = -1;
+    ReplayMode mode = ReplayMode::Default;
 
     int opt = 0;
-    while ((opt = getopt(argc, argv, "mt:s:nlh?")) != -1) {
+    while ((opt = getopt(argc, argv, "mt:s:nlbfh?")) != -1) {
         switch (opt) {
             case 'm':
                 pauseBeginning = true;
@@ -82,6 +89,12 @@ int main(int argc, char** argv) {
             case 'l':
                 loop = true;
                 break;
+            case 'b':
+                mode = ReplayMode::MaxThroughput;
+                break;
+            case 'f':
+                mode = ReplayMode::Faithful;
+                break;
             case 'h':
             case '?':
                 printHelpMenu();
@@ -102,7 +115,7 @@ int main(int argc, char** argv) {
 
     status_t status = NO_ERROR;
     do {
-        android::Replayer r(filename, pauseBeginning, numThreads, wait, stopHere);
+        android::Replayer r(filename, pauseBeginning, numThreads, wait, stopHere, mode);
         status = r.replay();
     } while(loop);
 
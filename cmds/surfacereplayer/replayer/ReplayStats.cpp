@@ -0,0 +1,67 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ReplayStats.h"
+
+#include <algorithm>
+#include <iomanip>
+
+using namespace android;
+
+void ReplayStats::start() {
+    std::lock_guard<std::mutex> lock(mLock);
+    mSamples.clear();
+    mStartTime = systemTime();
+    mStopTime = 0;
+}
+
+void ReplayStats::stop() {
+    std::lock_guard<std::mutex> lock(mLock);
+    mStopTime = systemTime();
+}
+
+void ReplayStats::addSample(const std::string& name, nsecs_t latency) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mSamples[name].push_back(latency);
+}
+
+static double toMs(nsecs_t time) {
+    return time / 1000000.0;
+}
+
+void ReplayStats::dump(std::ostream& out) {
+    std::lock_guard<std::mutex> lock(mLock);
+    const nsecs_t stopTime = mStopTime != 0 ? mStopTime : systemTime();
+    const double seconds = (stopTime - mStartTime) / 1e9;
+    out << "Replayed in " << std::fixed << std::setprecision(3) << seconds << " s\n";
+
+    for (auto& entry : mSamples) {
+        std::vector<nsecs_t>& samples = entry.second;
+        if (samples.empty()) {
+            continue;
+        }
+        std::sort(samples.begin(), samples.end());
+        auto percentile = [&samples](size_t p) {
+            return samples[std::min(samples.size() - 1, samples.size() * p / 100)];
+        };
+        out << "  " << entry.first << ": " << samples.size() << " (" << std::setprecision(1)
+            << (seconds > 0 ? samples.size() / seconds : 0.0) << "/s), latency ms"
+            << std::setprecision(3) << " p50 " << toMs(percentile(50)) << " p90 "
+            << toMs(percentile(90)) << " p99 " << toMs(percentile(99)) << " max "
+            << toMs(samples.back()) << "\n";
+    }
+    out << std::flush;
+}
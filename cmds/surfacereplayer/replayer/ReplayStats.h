@@ -0,0 +1,53 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SURFACEREPLAYER_REPLAYSTATS_H
+#define ANDROID_SURFACEREPLAYER_REPLAYSTATS_H
+
+#include <utils/Timers.h>
+
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace android {
+
+// Collects how long SurfaceFlinger took to accept each replayed action, and
+// how late the actions were started, to report them as a benchmark.
+// Thread safe.
+class ReplayStats {
+  public:
+    void start();
+    void stop();
+
+    // latency is how long the action took, from the moment it was allowed
+    // to execute
+    void addSample(const std::string& name, nsecs_t latency);
+
+    // Prints the rate and latency percentiles of every kind of action
+    void dump(std::ostream& out);
+
+  private:
+    std::mutex mLock;
+    nsecs_t mStartTime = 0;
+    nsecs_t mStopTime = 0;
+    std::map<std::string, std::vector<nsecs_t>> mSamples;
+};
+
+}  // namespace android
+#endif
@@ -51,14 +51,16 @@ using namespace android;
 std::atomic_bool Replayer::sReplayingManually(false);
 
 Replayer::Replayer(const std::string& filename, bool replayManually, int numThreads, bool wait,
-        nsecs_t stopHere)
+        nsecs_t stopHere, ReplayMode mode)
       : mTrace(),
         mLoaded(false),
         mIncrementIndex(0),
         mCurrentTime(0),
         mNumThreads(numThreads),
-        mWaitForTimeStamps(wait),
-        mStopTimeStamp(stopHere) {
+        mWaitForTimeStamps(wait && mode != ReplayMode::MaxThroughput),
+        mStopTimeStamp(stopHere),
+        mMode(mode),
+        mStatsOrNull(mode != ReplayMode::Default ? &mStats : nullptr) {
     srand(RAND_COLOR_SEED);
 
     std::string input;
@@ -82,14 +84,17 @@ Replayer::Replayer(const std::string& filename, bool replayManually, int numThre
     }
 }
 
-Replayer::Replayer(const Trace& t, bool replayManually, int numThreads, bool wait, nsecs_t stopHere)
+Replayer::Replayer(const Trace& t, bool replayManually, int numThreads, bool wait, nsecs_t stopHere,
+        ReplayMode mode)
       : mTrace(t),
         mLoaded(true),
         mIncrementIndex(0),
         mCurrentTime(0),
         mNumThreads(numThreads),
-        mWaitForTimeStamps(wait),
-        mStopTimeStamp(stopHere) {
+        mWaitForTimeStamps(wait && mode != ReplayMode::MaxThroughput),
+        mStopTimeStamp(stopHere),
+        mMode(mode),
+        mStatsOrNull(mode != ReplayMode::Default ? &mStats : nullptr) {
     srand(RAND_COLOR_SEED);
     mCurrentTime = mTrace.increment(0).time_stamp();
 
@@ -117,6 +122,9 @@ status_t Replayer::replay() {
     initReplay();
 
     ALOGV("Starting actual Replay!");
+    mStats.start();
+    mFirstTimeStamp = mCurrentTime;
+    mReplayStart = std::chrono::steady_clock::now();
     while (!mPendingIncrements.empty()) {
         mCurrentIncrement = mTrace.increment(mIncrementIndex);
 
@@ -125,8 +133,15 @@ status_t Replayer::replay() {
             sReplayingManually.store(true);
         }
 
+        const bool paused = sReplayingManually && !mWaitingForNextVSync;
         waitForConsoleCommmand();
 
+        if (paused) {
+            // Deadlines resume from where the replay was paused
+            mReplayStart = std::chrono::steady_clock::now() -
+                    std::chrono::nanoseconds(mCurrentIncrement.time_stamp() - mFirstTimeStamp);
+        }
+
         if (mWaitForTimeStamps) {
             waitUntilTimestamp(mCurrentIncrement.time_stamp());
         }
@@ -155,6 +170,11 @@ status_t Replayer::replay() {
 
     SurfaceComposerClient::enableVSyncInjections(false);
 
+    if (mStatsOrNull != nullptr) {
+        mStats.stop();
+        mStats.dump(std::cout);
+    }
+
     return status;
 }
 
@@ -300,7 +320,7 @@ status_t Replayer::dispatchEvent(int index) {
             auto layerId = increment.buffer_update().id();
             if (mBufferQueueSchedulers.count(layerId) == 0) {
                 mBufferQueueSchedulers[layerId] = std::make_shared<BufferQueueScheduler>(
-                        mLayers[layerId], mColors[layerId], layerId);
+                        mLayers[layerId], mColors[layerId], layerId, mStatsOrNull);
                 mBufferQueueSchedulers[layerId]->addEvent(bufferEvent);
 
                 std::thread(&BufferQueueScheduler::startScheduling,
@@ -350,9 +370,14 @@ status_t Replayer::doTransaction(const Transaction& t, const std::shared_ptr<Eve
     }
 
     event->readyToExecute();
+    const nsecs_t startTime = systemTime();
 
     SurfaceComposerClient::closeGlobalTransaction(t.synchronous());
 
+    if (mStatsOrNull != nullptr) {
+        mStatsOrNull->addSample("transactions", systemTime() - startTime);
+    }
+
     ALOGV("Ended Transaction");
 
     return status;
@@ -649,9 +674,14 @@ status_t Replayer::injectVSyncEvent(
     doDeleteSurfaceControls();
 
     event->readyToExecute();
+    const nsecs_t startTime = systemTime();
 
     SurfaceComposerClient::injectVSync(vSyncEvent.when());
 
+    if (mStatsOrNull != nullptr) {
+        mStatsOrNull->addSample("vsyncs", systemTime() - startTime);
+    }
+
     return NO_ERROR;
 }
 
@@ -685,6 +715,15 @@ void Replayer::updatePowerMode(const PowerModeUpdate& pmu, const std::shared_ptr
 }
 
 void Replayer::waitUntilTimestamp(int64_t timestamp) {
+    if (mMode == ReplayMode::Faithful) {
+        const auto deadline =
+                mReplayStart + std::chrono::nanoseconds(timestamp - mFirstTimeStamp);
+        std::this_thread::sleep_until(deadline);
+        const auto lateness = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - deadline);
+        mStats.addSample("late starts", lateness.count());
+        return;
+    }
     ALOGV("Waiting for %lld nanoseconds...", static_cast<int64_t>(timestamp - mCurrentTime));
     std::this_thread::sleep_for(std::chrono::nanoseconds(timestamp - mCurrentTime));
 }
@@ -20,6 +20,7 @@
 #include "BufferQueueScheduler.h"
 #include "Color.h"
 #include "Event.h"
+#include "ReplayStats.h"
 
 #include <frameworks/native/cmds/surfacereplayer/proto/src/trace.pb.h>
 
@@ -30,6 +31,7 @@
 #include <utils/StrongPointer.h>
 
 #include <stdatomic.h>
+#include <chrono>
 #include <condition_variable>
 #include <memory>
 #include <mutex>
@@ -50,12 +52,23 @@ typedef int32_t display_id;
 typedef google::protobuf::RepeatedPtrField<SurfaceChange> SurfaceChanges;
 typedef google::protobuf::RepeatedPtrField<DisplayChange> DisplayChanges;
 
+enum class ReplayMode {
+    // Sleeps between increments for as long as the trace says
+    Default,
+    // Ignores timestamps and reports how fast SurfaceFlinger accepted the increments
+    MaxThroughput,
+    // Starts every increment at its absolute deadline from the start of the replay, so that
+    // the time spent replaying doesn't accumulate as drift, and reports how late they were
+    Faithful,
+};
+
 class Replayer {
   public:
     Replayer(const std::string& filename, bool replayManually = false,
-            int numThreads = DEFAULT_THREADS, bool wait = true, nsecs_t stopHere = -1);
+            int numThreads = DEFAULT_THREADS, bool wait = true, nsecs_t stopHere = -1,
+            ReplayMode mode = ReplayMode::Default);
     Replayer(const Trace& trace, bool replayManually = false, int numThreads = DEFAULT_THREADS,
-            bool wait = true, nsecs_t stopHere = -1);
+            bool wait = true, nsecs_t stopHere = -1, ReplayMode mode = ReplayMode::Default);
 
     status_t replay();
 
@@ -122,6 +135,13 @@ class Replayer {
     nsecs_t mStopTimeStamp;
     bool mHasStopped;
 
+    ReplayMode mMode;
+    ReplayStats mStats;
+    ReplayStats* mStatsOrNull;
+    // Faithful mode, when the increment with mFirstTimeStamp is due
+    std::chrono::steady_clock::time_point mReplayStart;
+    int64_t mFirstTimeStamp = 0;
+
     std::mutex mLayerLock;
     std::condition_variable mLayerCond;
     std::unordered_map<layer_id, sp<SurfaceControl>> mLayers;
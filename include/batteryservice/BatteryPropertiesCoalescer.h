@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_BATTERYPROPERTIESCOALESCER_H
+#define ANDROID_BATTERYPROPERTIESCOALESCER_H
+
+#include <batteryservice/BatteryService.h>
+#include <utils/Timers.h>
+
+namespace android {
+
+/*
+ * Decides which BatteryProperties updates are sent to the
+ * IBatteryPropertiesListeners. Noisy fuel gauges report a new current,
+ * voltage or charge counter on almost every update, which would wake up every
+ * listener each time. Changes to the charger, status, health, presence, level
+ * or technology are always sent right away; changes limited to the measured
+ * values are sent at most once per window, and are dropped if they flip back
+ * to what was last sent before the window ends.
+ *
+ * The registrar calls update() for each update and flush() once the deadline
+ * returned by getDeadline() has passed. Not thread safe.
+ */
+class BatteryPropertiesCoalescer {
+public:
+    static constexpr nsecs_t DEFAULT_WINDOW = 1000000000; // 1s
+
+    // A window of 0 sends every update that changes anything
+    explicit BatteryPropertiesCoalescer(nsecs_t window = DEFAULT_WINDOW);
+
+    void setWindow(nsecs_t window) { mWindow = window; }
+    nsecs_t getWindow() const { return mWindow; }
+
+    // Accounts for props, reported at now. Returns true if props should be
+    // sent to the listeners now.
+    bool update(const BatteryProperties& props, nsecs_t now);
+
+    // Returns when the update held back by update() is due, or -1 if there is
+    // none.
+    nsecs_t getDeadline() const;
+
+    // Returns true and copies the held back update to outProps if it is due
+    // at now.
+    bool flush(nsecs_t now, BatteryProperties* outProps);
+
+private:
+    void markSent(const BatteryProperties& props, nsecs_t now);
+
+    nsecs_t mWindow;
+
+    bool mHasSent;
+    BatteryProperties mSent;
+    nsecs_t mSentTime;
+
+    bool mHasPending;
+    BatteryProperties mPending;
+};
+
+}; // namespace android
+
+#endif // ANDROID_BATTERYPROPERTIESCOALESCER_H
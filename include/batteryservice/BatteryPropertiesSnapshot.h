@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_BATTERYPROPERTIESSNAPSHOT_H
+#define ANDROID_BATTERYPROPERTIESSNAPSHOT_H
+
+#include <batteryservice/BatteryService.h>
+#include <utils/Errors.h>
+
+#include <atomic>
+#include <stdint.h>
+
+namespace android {
+
+/*
+ * The latest BatteryProperties in shared memory, for clients that poll the
+ * battery state instead of registering an IBatteryPropertiesListener. The
+ * registrar is the only writer; readers map the region returned by
+ * IBatteryPropertiesRegistrar::getPropertiesSnapshot() read-only and never
+ * take any lock. The record is protected by a sequence counter so that a
+ * reader racing with the writer can detect a torn copy and retry.
+ */
+class BatteryPropertiesSnapshot {
+public:
+    static constexpr uint32_t MAGIC = 0x42415453; // 'BATS'
+    static constexpr uint32_t VERSION = 1;
+    static constexpr size_t MAX_TECHNOLOGY_LENGTH = 32;
+
+    // BatteryProperties without the String8, so it can live in shared memory
+    struct Record {
+        int32_t chargerAcOnline;
+        int32_t chargerUsbOnline;
+        int32_t chargerWirelessOnline;
+        int32_t maxChargingCurrent;
+        int32_t maxChargingVoltage;
+        int32_t batteryStatus;
+        int32_t batteryHealth;
+        int32_t batteryPresent;
+        int32_t batteryLevel;
+        int32_t batteryVoltage;
+        int32_t batteryTemperature;
+        int32_t batteryCurrent;
+        int32_t batteryCycleCount;
+        int32_t batteryFullCharge;
+        int32_t batteryChargeCounter;
+        // NUL terminated
+        char batteryTechnology[MAX_TECHNOLOGY_LENGTH];
+    };
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t recordSize;
+        // odd while the record is being written, 0 until the first write
+        std::atomic<uint32_t> sequence;
+        Record record;
+    };
+};
+
+// Writer side, used by the registrar. Not thread safe: all calls to write()
+// must come from the same thread.
+class BatteryPropertiesSnapshotWriter {
+public:
+    BatteryPropertiesSnapshotWriter();
+    ~BatteryPropertiesSnapshotWriter();
+
+    BatteryPropertiesSnapshotWriter(const BatteryPropertiesSnapshotWriter&) = delete;
+    BatteryPropertiesSnapshotWriter& operator=(const BatteryPropertiesSnapshotWriter&) = delete;
+
+    status_t initCheck() const { return mHeader != nullptr ? NO_ERROR : NO_INIT; }
+
+    // The ashmem region is read-only for anyone mapping it through this fd.
+    // The caller doesn't own the returned fd.
+    int getFd() const { return mFd; }
+
+    void write(const BatteryProperties& props);
+
+private:
+    int mFd;
+    BatteryPropertiesSnapshot::Header* mHeader;
+};
+
+// Reader side. Takes ownership of fd.
+class BatteryPropertiesSnapshotReader {
+public:
+    explicit BatteryPropertiesSnapshotReader(int fd);
+    ~BatteryPropertiesSnapshotReader();
+
+    BatteryPropertiesSnapshotReader(const BatteryPropertiesSnapshotReader&) = delete;
+    BatteryPropertiesSnapshotReader& operator=(const BatteryPropertiesSnapshotReader&) = delete;
+
+    status_t initCheck() const { return mHeader != nullptr ? NO_ERROR : NO_INIT; }
+
+    // Changes every time the registrar writes new properties. Comparing it to
+    // the generation returned by an earlier read() tells whether there is
+    // anything new to read without copying the record.
+    uint32_t getGeneration() const;
+
+    // Copies the latest properties to outProps. Returns NOT_ENOUGH_DATA if
+    // nothing was written yet, or WOULD_BLOCK if the record kept changing
+    // while it was being copied.
+    status_t read(BatteryProperties* outProps, uint32_t* outGeneration = nullptr) const;
+
+private:
+    int mFd;
+    const BatteryPropertiesSnapshot::Header* mHeader;
+};
+
+}; // namespace android
+
+#endif // ANDROID_BATTERYPROPERTIESSNAPSHOT_H
@@ -28,6 +28,8 @@ enum {
     UNREGISTER_LISTENER,
     GET_PROPERTY,
     SCHEDULE_UPDATE,
+    // native only, not part of IBatteryPropertiesRegistrar.aidl
+    GET_PROPERTIES_SNAPSHOT,
 };
 
 class IBatteryPropertiesRegistrar : public IInterface {
@@ -38,6 +40,11 @@ public:
     virtual void unregisterListener(const sp<IBatteryPropertiesListener>& listener) = 0;
     virtual status_t getProperty(int id, struct BatteryProperty *val) = 0;
     virtual void scheduleUpdate() = 0;
+
+    // Returns a BatteryPropertiesSnapshot region in outFd, owned by the
+    // caller, which always holds the latest properties. Registrars that don't
+    // publish one return INVALID_OPERATION.
+    virtual status_t getPropertiesSnapshot(int* outFd);
 };
 
 class BnBatteryPropertiesRegistrar : public BnInterface<IBatteryPropertiesRegistrar> {
@@ -22,9 +22,22 @@
 
 __BEGIN_DECLS
 
+/* Upper bound on num_threads of calculate_dir_size_parallel() */
+#define DIRSIZE_MAX_THREADS 16
+
+/* Count a file with several hard links inside the tree only once */
+#define DIRSIZE_COUNT_HARDLINKS_ONCE 1
+
 int64_t stat_size(struct stat *s);
 int64_t calculate_dir_size(int dfd);
 
+/*
+ * Like calculate_dir_size(), walking the tree under dfd on up to num_threads
+ * threads. flags is a combination of the DIRSIZE_ flags above. Takes
+ * ownership of dfd.
+ */
+int64_t calculate_dir_size_parallel(int dfd, int num_threads, int flags);
+
 __END_DECLS
 
 #endif /* __LIBDISKUSAGE_DIRSIZE_H */
@@ -20,6 +20,7 @@
 #include <gui/BufferItem.h>
 #include <gui/BufferQueueDefs.h>
 #include <gui/BufferSlot.h>
+#include <gui/LatencyHistogram.h>
 #include <gui/OccupancyTracker.h>
 
 #include <utils/Condition.h>
@@ -119,8 +120,14 @@ private:
     // given slot.
     void clearBufferSlotLocked(int slot);
 
+    // recycleBufferLocked hands the idle buffer of the given slot over to the
+    // GraphicBufferPool, so that the connected producer can get it back
+    // without reallocating it. The slot still has to be cleared.
+    void recycleBufferLocked(int slot);
+
     // freeAllBuffersLocked frees the GraphicBuffer and sync resources for
     // all slots, even if they're currently dequeued, queued, or acquired.
+    // The free buffers are recycled.
     void freeAllBuffersLocked();
 
     // discardFreeBuffersLocked releases all currently-free buffers held by the
@@ -129,9 +136,32 @@ private:
     void discardFreeBuffersLocked();
 
     // If delta is positive, makes more slots available. If negative, takes
-    // away slots. Returns false if the request can't be met.
+    // away slots. Returns false if the request can't be met. delta is
+    // relative to getMaxBufferCountLocked(): slots taken away by the adaptive
+    // buffer count are given back first.
     bool adjustAvailableSlotsLocked(int delta);
 
+    // When the adaptive buffer count is enabled, takes a slot away from a
+    // producer that hasn't needed it for ADAPTIVE_SHRINK_SEGMENTS occupancy
+    // segments, going from triple to double buffering. Returns true if a
+    // buffer was freed, in which case the consumer must be told with
+    // onBuffersReleased().
+    bool shrinkBufferCountLocked();
+
+    // Gives back the slot taken by shrinkBufferCountLocked(). Called when the
+    // producer would otherwise have to wait for a free slot. Returns false if
+    // no slot was taken away.
+    bool growBufferCountLocked();
+
+    // Records a sample in one of the latency histograms below and, while
+    // tracing, publishes it in microseconds as the "<consumer name>
+    // <counterName>" atrace counter.
+    void recordLatencyLocked(LatencyHistogram* histogram,
+            const char* counterName, nsecs_t latency);
+
+    // Makes delta more slots available, or takes -delta slots away.
+    bool resizeAvailableSlotsLocked(int delta);
+
     // waitWhileAllocatingLocked blocks until mIsAllocating is false.
     void waitWhileAllocatingLocked() const;
 
@@ -182,6 +212,9 @@ private:
     int mConnectedApi;
     // PID of the process which last successfully called connect(...)
     pid_t mConnectedPid;
+    // UID of the same process, owner of the buffers recycled while it is
+    // connected
+    uid_t mConnectedUid;
 
     // mLinkedToDeath is used to set a binder death notification on
     // the producer.
@@ -334,6 +367,30 @@ private:
 
     OccupancyTracker mOccupancyTracker;
 
+    // Number of shallow occupancy segments after which the adaptive buffer
+    // count takes a slot away. Doubled each time the slot had to be given
+    // back, up to ADAPTIVE_MAX_BACKOFF times.
+    static constexpr size_t ADAPTIVE_SHRINK_SEGMENTS = 3;
+    static constexpr uint32_t ADAPTIVE_MAX_BACKOFF = 4;
+
+    // mAdaptiveBufferCount is set by the debug.bq.adaptive_buffer_count
+    // property and lets shrinkBufferCountLocked() act on mOccupancyTracker.
+    const bool mAdaptiveBufferCount;
+
+    // Number of slots currently taken away from getMaxBufferCountLocked() by
+    // the adaptive buffer count, 0 or 1.
+    int mAdaptiveSlotReduction;
+
+    // Number of times the producer stalled after a shrink
+    uint32_t mAdaptiveGrowCount;
+
+    // Time the producer spent in dequeueBuffer waiting for a free slot, the
+    // time buffers spent queued before being acquired and the time the
+    // consumer held them. Shown by dumpState.
+    LatencyHistogram mDequeueWaitHistogram;
+    LatencyHistogram mQueueToAcquireHistogram;
+    LatencyHistogram mAcquireToReleaseHistogram;
+
     const uint64_t mUniqueId;
 
 }; // class BufferQueueCore
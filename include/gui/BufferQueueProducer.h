@@ -112,6 +112,13 @@ public:
     virtual status_t queueBuffer(int slot,
             const QueueBufferInput& input, QueueBufferOutput* output);
 
+    // See IGraphicBufferProducer::queueAndDequeueBuffer
+    virtual status_t queueAndDequeueBuffer(int slot,
+            const QueueBufferInput& input, QueueBufferOutput* output,
+            int* outSlot, sp<Fence>* outFence, status_t* outDequeueResult,
+            uint32_t width, uint32_t height, PixelFormat format,
+            uint32_t usage);
+
     // cancelBuffer returns a dequeued buffer to the BufferQueue, but doesn't
     // queue it for use by the consumer.
     //
@@ -179,6 +186,9 @@ public:
     // See IGraphicBufferProducer::getFrameTimestamps
     virtual void getFrameTimestamps(FrameEventHistoryDelta* outDelta) override;
 
+    // See IGraphicBufferProducer::getFrameEventBlock
+    virtual status_t getFrameEventBlock(int* outFd) override;
+
     // See IGraphicBufferProducer::getUniqueId
     virtual status_t getUniqueId(uint64_t* outId) const override;
 
@@ -201,13 +211,22 @@ private:
     // block if there are no available slots and we are not in non-blocking
     // mode (producer and consumer controlled by the application). If it blocks,
     // it will release mCore->mMutex while blocked so that other operations on
-    // the BufferQueue may succeed.
+    // the BufferQueue may succeed. It never blocks for Prefetch, and returns
+    // WOULD_BLOCK instead.
     enum class FreeSlotCaller {
         Dequeue,
         Attach,
+        Prefetch,
     };
     status_t waitForFreeSlotThenRelock(FreeSlotCaller caller, int* found) const;
 
+    // dequeueBufferImpl implements dequeueBuffer, and the non-blocking
+    // dequeue of queueAndDequeueBuffer when caller is Prefetch.
+    status_t dequeueBufferImpl(FreeSlotCaller caller, int* outSlot,
+            sp<Fence>* outFence, uint32_t width, uint32_t height,
+            PixelFormat format, uint32_t usage,
+            FrameEventHistoryDelta* outTimestamps);
+
     sp<BufferQueueCore> mCore;
 
     // This references mCore->mSlots. Lock mCore->mMutex while accessing.
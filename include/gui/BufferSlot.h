@@ -182,7 +182,9 @@ struct BufferSlot {
       mEglFence(EGL_NO_SYNC_KHR),
       mFence(Fence::NO_FENCE),
       mAcquireCalled(false),
-      mNeedsReallocation(false) {
+      mNeedsReallocation(false),
+      mQueueTime(0),
+      mAcquireTime(0) {
     }
 
     // mGraphicBuffer points to the buffer allocated for this slot or is NULL
@@ -230,6 +232,14 @@ struct BufferSlot {
     // producer. If so, it needs to set the BUFFER_NEEDS_REALLOCATION flag when
     // dequeued to prevent the producer from using a stale cached buffer.
     bool mNeedsReallocation;
+
+    // systemTime() when the buffer was last queued, or 0 once it has been
+    // acquired. Used for the queue-to-acquire latency histogram.
+    nsecs_t mQueueTime;
+
+    // systemTime() when the buffer was acquired, or 0 once it has been
+    // released. Used for the acquire-to-release latency histogram.
+    nsecs_t mAcquireTime;
 };
 
 } // namespace android
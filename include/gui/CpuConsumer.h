@@ -111,6 +111,13 @@ class CpuConsumer : public ConsumerBase
     // by calling unlockBuffer before more buffers can be acquired.
     status_t lockNextBuffer(LockedBuffer *nativeBuffer);
 
+    // Locks up to count of the next buffers at once, for consumers that
+    // process frames in groups. outLockedCount is set to the number of
+    // buffers filled in, in queue order. Returns OK if at least one buffer
+    // was locked, otherwise the error lockNextBuffer would have returned.
+    status_t lockNextBuffers(LockedBuffer *nativeBuffers, size_t count,
+            size_t *outLockedCount);
+
     // Returns a locked buffer to the queue, allowing it to be reused. Since
     // only a fixed number of buffers may be locked at a time, old buffers must
     // be released by calling unlockBuffer to ensure new buffers can be acquired by
@@ -121,10 +128,23 @@ class CpuConsumer : public ConsumerBase
     // Maximum number of buffers that can be locked at a time
     size_t mMaxLockedBuffers;
 
+    status_t lockNextBufferLocked(LockedBuffer *nativeBuffer);
+
     status_t releaseAcquiredBufferLocked(size_t lockedIdx);
 
     virtual void freeBufferLocked(int slotIndex);
 
+    // How the buffer of each slot was locked the first time. Buffers of a
+    // format that may be YUV but can't be locked as flexible YUV are then
+    // locked directly, instead of failing a lockYCbCr on every frame. Reset
+    // when the slot is freed.
+    enum LockMode {
+        LOCK_MODE_UNKNOWN,
+        LOCK_MODE_YCBCR,
+        LOCK_MODE_PLAIN,
+    };
+    LockMode mSlotLockModes[BufferQueue::NUM_BUFFER_SLOTS];
+
     // Tracking for buffers acquired by the user
     struct AcquiredBuffer {
         // Need to track the original mSlot index and the buffer itself because
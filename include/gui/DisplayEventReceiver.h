@@ -37,6 +37,7 @@ class IDisplayEventConnection;
 
 namespace gui {
 class BitTube;
+class LatestVsyncSlot;
 } // namespace gui
 
 static inline constexpr uint32_t fourcc(char c1, char c2, char c3, char c4) {
@@ -77,6 +78,17 @@ public:
         };
     };
 
+    /*
+     * The most recent vsync, as delivered in latest-only mode. Timestamps
+     * that are not known are set to -1.
+     */
+    struct LatestVsync {
+        nsecs_t timestamp{-1};
+        uint32_t count{0};
+        // when SurfaceFlinger expects the vsync after this one
+        nsecs_t expectedNextTimestamp{-1};
+    };
+
 public:
     /*
      * DisplayEventReceiver creates and registers an event connection with
@@ -115,9 +127,20 @@ public:
     ssize_t getEvents(Event* events, size_t count);
     static ssize_t getEvents(gui::BitTube* dataChannel, Event* events, size_t count);
 
+    /*
+     * getLatestEvents works like getEvents, except that it drains all the
+     * queued Event::VSync and only returns the most recent one. Other events
+     * are all returned, in order. Use this to catch up after waking up late
+     * instead of processing stale vsyncs one by one. Draining stops early
+     * only if events fills up with events other than Event::VSync.
+     */
+    ssize_t getLatestEvents(Event* events, size_t count);
+    static ssize_t getLatestEvents(gui::BitTube* dataChannel, Event* events, size_t count);
+
     /*
      * sendEvents write events to the queue and returns how many events were
-     * written.
+     * written. Each event is sent as a message of its own, which lets
+     * getEvents receive several of them with a single system call.
      */
     static ssize_t sendEvents(gui::BitTube* dataChannel, Event const* events, size_t count);
 
@@ -135,9 +158,33 @@ public:
      */
     status_t requestNextVsync();
 
+    /*
+     * enableLatestVsync() switches Event::VSync to latest-only delivery.
+     * SurfaceFlinger stops queueing them on getFd() and overwrites a single
+     * LatestVsync instead, which getLatestVsync() reads. Other events are
+     * still delivered through getFd(). The vsync rate and requestNextVsync()
+     * keep working as before.
+     */
+    status_t enableLatestVsync();
+
+    /*
+     * getLatestVsyncFd returns the file descriptor that becomes readable when
+     * a new LatestVsync is available, or NO_INIT if enableLatestVsync() didn't
+     * succeed. OWNERSHIP IS RETAINED by DisplayEventReceiver.
+     */
+    int getLatestVsyncFd() const;
+
+    /*
+     * getLatestVsync copies the most recent vsync to vsync and clears
+     * getLatestVsyncFd(). Returns false if there was no new vsync since the
+     * previous call.
+     */
+    bool getLatestVsync(LatestVsync* vsync);
+
 private:
     sp<IDisplayEventConnection> mEventConnection;
     std::unique_ptr<gui::BitTube> mDataChannel;
+    std::unique_ptr<gui::LatestVsyncSlot> mLatestVsync;
 };
 
 // ----------------------------------------------------------------------------
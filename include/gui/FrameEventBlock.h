@@ -0,0 +1,140 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_GUI_FRAMEEVENTBLOCK_H
+#define ANDROID_GUI_FRAMEEVENTBLOCK_H
+
+#include <gui/FrameTimestamps.h>
+
+#include <utils/Errors.h>
+#include <utils/Timers.h>
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace android {
+
+// The part of a FrameEvents that the consumer publishes through a frame event
+// block. Fences are replaced by the signal times the consumer knows of:
+// Fence::SIGNAL_TIME_PENDING if it hasn't seen them signal yet and
+// Fence::SIGNAL_TIME_INVALID if there is no fence.
+struct FrameEventBlockEntry {
+    enum {
+        eAddPostCompositeCalled = 0x1,
+        eAddReleaseCalled       = 0x2,
+    };
+
+    uint64_t frameNumber{0};
+    uint32_t valid{0};
+    uint32_t flags{0};
+
+    nsecs_t postedTime{FrameEvents::TIMESTAMP_PENDING};
+    nsecs_t requestedPresentTime{FrameEvents::TIMESTAMP_PENDING};
+    nsecs_t latchTime{FrameEvents::TIMESTAMP_PENDING};
+    nsecs_t firstRefreshStartTime{FrameEvents::TIMESTAMP_PENDING};
+    nsecs_t lastRefreshStartTime{FrameEvents::TIMESTAMP_PENDING};
+    nsecs_t dequeueReadyTime{FrameEvents::TIMESTAMP_PENDING};
+
+    nsecs_t gpuCompositionDoneTime{Fence::SIGNAL_TIME_INVALID};
+    nsecs_t displayPresentTime{Fence::SIGNAL_TIME_INVALID};
+    nsecs_t releaseTime{Fence::SIGNAL_TIME_INVALID};
+};
+
+// Everything published through a frame event block. Entry i mirrors
+// FrameEventHistory::mFrames[i].
+struct FrameEventBlockSnapshot {
+    CompositorTiming compositorTiming;
+    FrameEventBlockEntry frames[FrameEventHistory::MAX_FRAME_HISTORY];
+};
+
+/*
+ * A frame event block is a small shared memory region through which the
+ * consumer of a BufferQueue publishes the frame events of its producer, so
+ * that the producer can look them up without a getFrameTimestamps()
+ * transaction and without the events being added to every queueBuffer()
+ * reply. The consumer creates the region and is the only writer; the
+ * producer gets it through IGraphicBufferProducer::getFrameEventBlock() and
+ * maps it read-only. The snapshot is protected by a sequence counter so that
+ * the producer can detect a torn read and retry.
+ *
+ * Fences can't go through shared memory: the producer still has to ask for
+ * them over Binder when it needs a fence the consumer hasn't seen signal.
+ */
+class FrameEventBlock {
+public:
+    static constexpr uint32_t MAGIC = 0x46455642; // 'FEVB'
+    static constexpr uint32_t VERSION = 1;
+
+    struct Shared {
+        uint32_t magic;
+        uint32_t version;
+        // odd while the snapshot is being written
+        std::atomic<uint32_t> sequence;
+        uint32_t reserved;
+        FrameEventBlockSnapshot snapshot;
+    };
+
+    static size_t getRegionSize() { return sizeof(Shared); }
+};
+
+// Consumer side, owns the region. Not thread safe.
+class FrameEventBlockWriter {
+public:
+    FrameEventBlockWriter();
+    ~FrameEventBlockWriter();
+
+    FrameEventBlockWriter(const FrameEventBlockWriter&) = delete;
+    FrameEventBlockWriter& operator=(const FrameEventBlockWriter&) = delete;
+
+    status_t initCheck() const { return mShared != nullptr ? NO_ERROR : NO_INIT; }
+
+    // The ashmem region is read-only for anyone mapping it through this fd.
+    // The caller doesn't own the returned fd.
+    int getFd() const { return mFd; }
+
+    // Publishes snapshot, unless it is identical to the last one.
+    void write(const FrameEventBlockSnapshot& snapshot);
+
+private:
+    int mFd;
+    FrameEventBlock::Shared* mShared;
+    FrameEventBlockSnapshot mLastSnapshot;
+};
+
+// Producer side. Not thread safe. Takes ownership of fd.
+class FrameEventBlockReader {
+public:
+    explicit FrameEventBlockReader(int fd);
+    ~FrameEventBlockReader();
+
+    FrameEventBlockReader(const FrameEventBlockReader&) = delete;
+    FrameEventBlockReader& operator=(const FrameEventBlockReader&) = delete;
+
+    status_t initCheck() const { return mShared != nullptr ? NO_ERROR : NO_INIT; }
+
+    // Returns true and the latest snapshot if it changed since the last call.
+    bool read(FrameEventBlockSnapshot* outSnapshot);
+
+private:
+    int mFd;
+    const FrameEventBlock::Shared* mShared;
+    uint32_t mLastSequence;
+};
+
+}; // namespace android
+
+#endif // ANDROID_GUI_FRAMEEVENTBLOCK_H
@@ -0,0 +1,134 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_GUI_FRAMETIMELINE_H
+#define ANDROID_GUI_FRAMETIMELINE_H
+
+#include <utils/Errors.h>
+#include <utils/Timers.h>
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace android {
+
+// One latched buffer, as recorded by SurfaceFlinger. Timestamps that are not
+// known (e.g. the HWC doesn't provide present fences) are set to -1.
+struct FrameTimelineEntry {
+    // Layer::sequence of the layer the buffer was latched on
+    int32_t layerId{-1};
+    uint64_t frameNumber{0};
+    nsecs_t queueTime{-1};
+    nsecs_t latchTime{-1};
+    nsecs_t compositionStartTime{-1};
+    nsecs_t presentTime{-1};
+    nsecs_t releaseTime{-1};
+};
+
+/*
+ * The frame timeline is a fixed-size ring of FrameTimelineEntry living in
+ * shared memory. SurfaceFlinger is the only writer; readers map the region
+ * returned by ISurfaceComposer::getFrameTimeline() read-only and never take
+ * any lock. Each record is protected by a sequence counter so that a reader
+ * racing with the writer can detect a torn record and retry.
+ */
+class FrameTimeline {
+public:
+    static constexpr uint32_t MAGIC = 0x46544c4e; // 'FTLN'
+    static constexpr uint32_t VERSION = 1;
+    static constexpr uint32_t DEFAULT_CAPACITY = 4096;
+
+    struct Record {
+        // odd while the record is being written
+        std::atomic<uint32_t> sequence;
+        uint32_t reserved;
+        // position of this record in the timeline
+        uint64_t index;
+        FrameTimelineEntry entry;
+    };
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t capacity;
+        uint32_t recordSize;
+        // Number of records ever written, record n is stored at
+        // n % capacity.
+        std::atomic<uint64_t> writeCount;
+    };
+
+    static size_t getRegionSize(uint32_t capacity) {
+        return sizeof(Header) + capacity * sizeof(Record);
+    }
+};
+
+// Writer side, used by SurfaceFlinger. Not thread safe: all calls to write()
+// must come from the same thread.
+class FrameTimelineWriter {
+public:
+    explicit FrameTimelineWriter(uint32_t capacity = FrameTimeline::DEFAULT_CAPACITY);
+    ~FrameTimelineWriter();
+
+    FrameTimelineWriter(const FrameTimelineWriter&) = delete;
+    FrameTimelineWriter& operator=(const FrameTimelineWriter&) = delete;
+
+    status_t initCheck() const { return mHeader != nullptr ? NO_ERROR : NO_INIT; }
+
+    // The ashmem region is read-only for anyone mapping it through this fd.
+    // The caller doesn't own the returned fd.
+    int getFd() const { return mFd; }
+
+    void write(const FrameTimelineEntry& entry);
+
+private:
+    int mFd;
+    size_t mSize;
+    FrameTimeline::Header* mHeader;
+    FrameTimeline::Record* mRecords;
+};
+
+// Reader side. Takes ownership of fd.
+class FrameTimelineReader {
+public:
+    explicit FrameTimelineReader(int fd);
+    ~FrameTimelineReader();
+
+    FrameTimelineReader(const FrameTimelineReader&) = delete;
+    FrameTimelineReader& operator=(const FrameTimelineReader&) = delete;
+
+    status_t initCheck() const { return mHeader != nullptr ? NO_ERROR : NO_INIT; }
+
+    // Index of the next record SurfaceFlinger will write
+    uint64_t getWriteCount() const;
+
+    // Copies up to maxEntries records starting at *inOutCursor and advances
+    // the cursor past the records returned. If the reader fell behind by more
+    // than the ring capacity, the records that were overwritten are skipped
+    // and their number is reported through outDropped.
+    size_t read(uint64_t* inOutCursor, FrameTimelineEntry* outEntries,
+            size_t maxEntries, uint64_t* outDropped = nullptr) const;
+
+private:
+    int mFd;
+    size_t mSize;
+    const FrameTimeline::Header* mHeader;
+    const FrameTimeline::Record* mRecords;
+};
+
+}; // namespace android
+
+#endif // ANDROID_GUI_FRAMETIMELINE_H
@@ -24,11 +24,14 @@
 
 #include <array>
 #include <bitset>
+#include <memory>
 #include <vector>
 
 namespace android {
 
 struct FrameEvents;
+struct FrameEventBlockSnapshot;
+class FrameEventBlockWriter;
 class FrameEventHistoryDelta;
 class String8;
 
@@ -143,12 +146,21 @@ public:
             uint64_t frameNumber, std::shared_ptr<FenceTime>&& acquire);
     void applyDelta(const FrameEventHistoryDelta& delta);
 
+    // Applies what the consumer published through its frame event block.
+    // The post composition and release info of a frame are only considered
+    // complete once the consumer knows the signal times of their fences, so
+    // that the fences are still requested with a delta while they are
+    // pending.
+    void applySnapshot(const FrameEventBlockSnapshot& snapshot);
+
     void updateSignalTimes();
 
 protected:
     void applyFenceDelta(FenceTimeline* timeline,
             std::shared_ptr<FenceTime>* dst,
             const FenceTime::Snapshot& src) const;
+    void applySignalTime(std::shared_ptr<FenceTime>* dst,
+            nsecs_t signalTime) const;
 
     // virtual for testing.
     virtual std::shared_ptr<FenceTime> createFenceTime(
@@ -223,6 +235,15 @@ public:
 
     void getAndResetDelta(FrameEventHistoryDelta* delta);
 
+    // Creates the frame event block of this history if needed and returns
+    // its fd, or -1 on failure. The caller doesn't own the returned fd.
+    int getFrameEventBlockFd();
+
+    // Publishes the current state of the history, including the signal times
+    // of fences that signaled since the last update, through the frame event
+    // block. Does nothing until getFrameEventBlockFd() is called.
+    void updateFrameEventBlock();
+
 private:
     void getFrameDelta(FrameEventHistoryDelta* delta,
             const std::array<FrameEvents, MAX_FRAME_HISTORY>::iterator& frame);
@@ -235,6 +256,8 @@ private:
 
     int mCurrentConnectId{0};
     bool mProducerWantsEvents{false};
+
+    std::unique_ptr<FrameEventBlockWriter> mFrameEventBlock;
 };
 
 
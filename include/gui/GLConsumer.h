@@ -302,6 +302,35 @@ protected:
     // properly set; when set to false, the check is not performed.
     status_t checkAndUpdateEglStateLocked(bool contextCheck = false);
 
+    // setEglImageCacheSize sets how many EGLImages are kept around after the
+    // buffer slot they belong to is freed, so that they can be reused if the
+    // same buffer comes back in another slot. A size of 0, the default,
+    // disables the cache and prepareEglImage.
+    void setEglImageCacheSize(size_t size);
+
+    // prepareEglImage creates the EGLImage of a queued buffer ahead of the
+    // updateTexImage call that will latch it. It may be called from any
+    // thread, typically from onFrameAvailable, and does nothing until the
+    // EGLDisplay is known or if the EGLImage cache is disabled.
+    void prepareEglImage(const BufferItem& item);
+
+    // setPerSlotTexturesEnabled switches to giving every buffer slot its own
+    // texture, to which the slot's EGLImage is bound once instead of being
+    // rebound to a single texture every frame. The texture name passed at
+    // construction or to attachToContext is then only used while there is no
+    // current buffer, and the texture to sample from after each
+    // updateTexImage call must be queried with getCurrentTextureName. The
+    // EGLImages are created without a crop in this mode so that crop changes
+    // don't recreate them; the crop is applied by the transform matrix
+    // instead. Disabled by default, and meant to be set before the first
+    // updateTexImage call.
+    void setPerSlotTexturesEnabled(bool enabled);
+
+    // getCurrentTextureName returns the name of the texture that the current
+    // buffer is bound to. Unless per-slot textures are enabled, this is the
+    // texture name passed at construction or to attachToContext.
+    uint32_t getCurrentTextureName() const;
+
 private:
     // EglImage is a utility class for tracking and creating EGLImageKHRs. There
     // is primarily just one image per slot, but there is also special cases:
@@ -323,6 +352,11 @@ private:
         // texture in the specified texture target.
         void bindToTextureTarget(uint32_t texTarget);
 
+        // imageId returns a process-wide unique id of the EGLImageKHR that
+        // was last created, or 0 if there is none. Unlike the EGLImageKHR
+        // handle, it is never reused after the image is destroyed.
+        uint64_t imageId() const { return mImageId; }
+
         const sp<GraphicBuffer>& graphicBuffer() { return mGraphicBuffer; }
         const native_handle* graphicBufferHandle() {
             return mGraphicBuffer == NULL ? NULL : mGraphicBuffer->handle;
@@ -353,11 +387,31 @@ private:
         // mCropRect is the crop rectangle passed to EGL when mEglImage
         // was created.
         Rect mCropRect;
+
+        // mImageId identifies mEglImage, see imageId().
+        uint64_t mImageId;
     };
 
+    // findEglImageLocked returns the EglImage of the given buffer if there is
+    // one in a slot or in the EGLImage cache, or NULL.
+    sp<EglImage> findEglImageLocked(const sp<GraphicBuffer>& graphicBuffer) const;
+
+    // takeEglImageLocked removes the EglImage of the given buffer from the
+    // EGLImage cache and returns it, or returns a new EglImage if it isn't
+    // cached.
+    sp<EglImage> takeEglImageLocked(const sp<GraphicBuffer>& graphicBuffer);
+
+    // cacheEglImageLocked inserts image as the most recently used entry of
+    // the EGLImage cache, evicting the least recently used entries past
+    // mEglImageCacheSize. Entries whose buffer doesn't have the geometry and
+    // format of image's buffer are dropped too, as buffers are reallocated
+    // when these change and the old ones won't be queued again.
+    void cacheEglImageLocked(const sp<EglImage>& image);
+
     // freeBufferLocked frees up the given buffer slot. If the slot has been
     // initialized this will release the reference to the GraphicBuffer in that
-    // slot and destroy the EGLImage in that slot.  Otherwise it has no effect.
+    // slot and destroy the EGLImage in that slot, unless it can be moved to the
+    // EGLImage cache.  Otherwise it has no effect.
     //
     // This method must be called with mMutex locked.
     virtual void freeBufferLocked(int slotIndex);
@@ -368,6 +422,27 @@ private:
     // mCurrentTextureImage must not be NULL.
     void computeCurrentTransformMatrixLocked();
 
+    // getImageCropLocked returns the crop rectangle that the EGLImage of a
+    // buffer with the given crop should be created with.
+    Rect getImageCropLocked(const Rect& crop) const;
+
+    // bindSlotTextureLocked binds the per-slot texture of mCurrentTexture to
+    // mTexTarget, creating it and binding the current EGLImage to it if
+    // needed. forceCreate recreates the EGLImage and rebinds it even if it
+    // is already bound.
+    status_t bindSlotTextureLocked(bool forceCreate);
+
+    // getCurrentTextureNameLocked is getCurrentTextureName with mMutex
+    // already held.
+    uint32_t getCurrentTextureNameLocked() const;
+
+    // deletePendingTexturesLocked deletes the per-slot textures that were
+    // released since the last call. The GL context must be current.
+    void deletePendingTexturesLocked();
+
+    // releaseSlotTexturesLocked queues the deletion of all per-slot textures.
+    void releaseSlotTexturesLocked();
+
     // doGLFenceWaitLocked inserts a wait command into the OpenGL ES command
     // stream to ensure that it is safe for future OpenGL ES commands to
     // access the current texture buffer.
@@ -458,11 +533,18 @@ private:
     // EGLSlot contains the information and object references that
     // GLConsumer maintains about a BufferQueue buffer slot.
     struct EglSlot {
-        EglSlot() : mEglFence(EGL_NO_SYNC_KHR) {}
+        EglSlot() : mEglFence(EGL_NO_SYNC_KHR), mTexName(0), mBoundImageId(0) {}
 
         // mEglImage is the EGLImage created from mGraphicBuffer.
         sp<EglImage> mEglImage;
 
+        // mTexName is the per-slot texture, or 0 if it hasn't been created
+        // in the current context. Only used with per-slot textures.
+        uint32_t mTexName;
+
+        // mBoundImageId is the imageId() of the EGLImage bound to mTexName.
+        uint64_t mBoundImageId;
+
         // mFence is the EGL sync object that must signal before the buffer
         // associated with this buffer slot may be dequeued. It is initialized
         // to EGL_NO_SYNC_KHR when the buffer is created and (optionally, based
@@ -491,6 +573,21 @@ private:
     // of the buffer allocated to a slot.
     EglSlot mEglSlots[BufferQueueDefs::NUM_BUFFER_SLOTS];
 
+    // mEglImageCache holds the EGLImages of buffers that are no longer in a
+    // slot, or that have been prepared by prepareEglImage before being
+    // acquired, most recently used first. It pins at most
+    // mEglImageCacheSize buffers.
+    Vector<sp<EglImage>> mEglImageCache;
+    size_t mEglImageCacheSize;
+
+    // mPerSlotTextures is set by setPerSlotTexturesEnabled.
+    bool mPerSlotTextures;
+
+    // mPendingTextureDeletes holds the per-slot textures of freed slots. They
+    // can only be deleted while the context is current, which isn't the case
+    // when slots are freed on behalf of the producer.
+    Vector<uint32_t> mPendingTextureDeletes;
+
     // mCurrentTexture is the buffer slot index of the buffer that is currently
     // bound to the OpenGL texture. It is initialized to INVALID_BUFFER_SLOT,
     // indicating that no buffer slot is currently bound to the texture. Note,
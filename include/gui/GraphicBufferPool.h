@@ -0,0 +1,104 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_GUI_GRAPHICBUFFERPOOL_H
+#define ANDROID_GUI_GRAPHICBUFFERPOOL_H
+
+#include <ui/Fence.h>
+#include <ui/GraphicBuffer.h>
+#include <ui/PixelFormat.h>
+
+#include <utils/Mutex.h>
+#include <utils/Singleton.h>
+#include <utils/String8.h>
+#include <utils/Timers.h>
+
+#include <list>
+
+#include <sys/types.h>
+
+namespace android {
+
+/*
+ * A process-wide pool of GraphicBuffers that BufferQueues dropped while they
+ * were idle, so that a BufferQueue being reconnected or resized (rotation,
+ * video resolution switches) can get its buffers back without going through
+ * gralloc again.
+ *
+ * Buffers only go back to the uid of the producer they were allocated for,
+ * since they still hold its content. The pool is bounded by a byte budget,
+ * oldest buffers are evicted first, and buffers that haven't been reused
+ * within MAX_IDLE_TIME are dropped the next time the pool is used.
+ *
+ * The pool is a leaf lock: it can be called with a BufferQueueCore mutex
+ * held.
+ */
+class GraphicBufferPool : public Singleton<GraphicBufferPool> {
+public:
+    // Default budget, can be overridden with the debug.bq.buffer_pool_kb
+    // property. A budget of 0 disables the pool.
+    static constexpr size_t DEFAULT_BUDGET_BYTES = 32 * 1024 * 1024;
+    static constexpr nsecs_t MAX_IDLE_TIME = s2ns(2);
+
+    // Hands an idle buffer over to the pool. fence must signal once the
+    // buffer isn't read anymore, it is returned with the buffer.
+    void recycle(uid_t owner, const sp<GraphicBuffer>& buffer,
+            const sp<Fence>& fence);
+
+    // Returns a buffer previously recycled by owner that can be used for the
+    // given attributes without reallocation, or NULL. outFence receives the
+    // fence to wait on before writing to it.
+    sp<GraphicBuffer> take(uid_t owner, uint32_t width, uint32_t height,
+            PixelFormat format, uint32_t layerCount, uint32_t usage,
+            sp<Fence>* outFence);
+
+    // Drops every pooled buffer.
+    void clear();
+
+    void setBudget(size_t bytes);
+
+    void dump(String8& result) const;
+
+private:
+    friend class Singleton<GraphicBufferPool>;
+    GraphicBufferPool();
+
+    struct Entry {
+        uid_t owner;
+        sp<GraphicBuffer> buffer;
+        sp<Fence> fence;
+        size_t size;
+        nsecs_t recycleTime;
+    };
+
+    static size_t getBufferSize(const sp<GraphicBuffer>& buffer);
+
+    // Moves the buffers that are idle for too long or exceed the budget to
+    // outEvicted, so that they can be freed without holding mMutex.
+    void trimLocked(nsecs_t now, std::list<Entry>* outEvicted);
+
+    mutable Mutex mMutex;
+    // Most recently recycled first
+    std::list<Entry> mEntries;
+    size_t mBudget;
+    size_t mSize;
+    uint64_t mHits;
+    uint64_t mMisses;
+};
+
+}; // namespace android
+
+#endif // ANDROID_GUI_GRAPHICBUFFERPOOL_H
@@ -79,6 +79,12 @@ public:
     // WARNING: This method can only be called when the BufferQueue is in the consumer's process.
     virtual void addAndGetFrameTimestamps(const NewFrameEventsEntry* /*newTimestamps*/,
                                           FrameEventHistoryDelta* /*outDelta*/) {}
+
+    // Returns a new fd for the FrameEventBlock through which the consumer publishes the frame
+    // events of the producer. The caller owns the returned fd.
+    //
+    // WARNING: This method can only be called when the BufferQueue is in the consumer's process.
+    virtual status_t getFrameEventBlock(int* /*outFd*/) { return INVALID_OPERATION; }
 };
 
 class IConsumerListener : public ConsumerListener, public IInterface {
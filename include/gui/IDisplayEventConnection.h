@@ -27,6 +27,7 @@ namespace android {
 
 namespace gui {
 class BitTube;
+class LatestVsyncSlot;
 } // namespace gui
 
 class IDisplayEventConnection : public IInterface {
@@ -51,6 +52,13 @@ public:
      * requestNextVsync() schedules the next vsync event. It has no effect if the vsync rate is > 0.
      */
     virtual void requestNextVsync() = 0; // Asynchronous
+
+    /*
+     * enableLatestVsync() stops sending vsync events through the receive channel. Instead, the
+     * connection overwrites the shared slot returned in outSlot with each vsync and signals its
+     * eventfd. Other events are still sent through the receive channel.
+     */
+    virtual status_t enableLatestVsync(gui::LatestVsyncSlot* outSlot) = 0;
 };
 
 class BnDisplayEventConnection : public SafeBnInterface<IDisplayEventConnection> {
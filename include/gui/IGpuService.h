@@ -0,0 +1,83 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_GUI_IGPUSERVICE_H
+#define ANDROID_GUI_IGPUSERVICE_H
+
+#include <binder/IInterface.h>
+#include <ui/GraphicsEnv.h>
+
+#include <sys/types.h>
+
+#include <vector>
+
+namespace android {
+
+// GPU startup costs of the processes of a uid, as collected by the gpu
+// service
+struct GpuUidStats {
+    uid_t uid = 0;
+    // number of processes that reported their stats
+    uint32_t processCount = 0;
+    // driver loads, and the total and worst time they took
+    uint32_t glDriverLoadCount = 0;
+    int64_t glDriverLoadTimeTotalNs = 0;
+    int64_t glDriverLoadTimeMaxNs = 0;
+    uint32_t vkDriverLoadCount = 0;
+    int64_t vkDriverLoadTimeTotalNs = 0;
+    int64_t vkDriverLoadTimeMaxNs = 0;
+    // EGL blob cache lookups up to the first frame of each process
+    uint64_t shaderCacheHits = 0;
+    uint64_t shaderCacheMisses = 0;
+    // graphic buffer memory currently allocated for the uid by the service's
+    // process, i.e. SurfaceFlinger
+    uint64_t gpuMemoryBytes = 0;
+};
+
+/*
+ * This class defines the Binder IPC interface for GPU-related queries and
+ * control.
+ */
+class IGpuService : public IInterface {
+public:
+    DECLARE_META_INTERFACE(GpuService);
+
+    // Reports the GPU stats of the calling process. Asynchronous, the service
+    // attributes them to the calling uid.
+    virtual void setGpuStats(const GraphicsEnv::GpuStats& stats) = 0;
+
+    // Returns the stats of every uid that reported any
+    virtual status_t getGpuStats(std::vector<GpuUidStats>* outStats) = 0;
+
+    // Reports the stats of this process to the gpu service, once a graphics
+    // driver has been loaded. Only the first call that finds a driver sends
+    // anything, later calls return right away. libgui calls this when a
+    // Surface queues its first buffer.
+    static void reportGpuStats();
+};
+
+class BnGpuService: public BnInterface<IGpuService> {
+protected:
+    virtual status_t shellCommand(int in, int out, int err,
+        Vector<String16>& args) = 0;
+
+    virtual status_t onTransact(uint32_t code, const Parcel& data,
+            Parcel* reply, uint32_t flags = 0) override;
+};
+
+} // namespace android
+
+#endif // ANDROID_GUI_IGPUSERVICE_H
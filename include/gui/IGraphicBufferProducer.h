@@ -20,6 +20,8 @@
 #include <stdint.h>
 #include <sys/types.h>
 
+#include <memory>
+
 #include <utils/Errors.h>
 #include <utils/RefBase.h>
 
@@ -41,6 +43,9 @@ namespace android {
 class IProducerListener;
 class NativeHandle;
 class Surface;
+namespace gui {
+class GraphicBufferCache;
+}
 typedef ::android::hardware::graphics::bufferqueue::V1_0::IGraphicBufferProducer
         HGraphicBufferProducer;
 
@@ -396,6 +401,28 @@ public:
     virtual status_t queueBuffer(int slot, const QueueBufferInput& input,
             QueueBufferOutput* output) = 0;
 
+    // queueAndDequeueBuffer queues the buffer in slot exactly like
+    // queueBuffer, then immediately tries to dequeue the next buffer with the
+    // given attributes, so that a producer can prefetch its next buffer in
+    // the same round trip.
+    //
+    // The queue part returns the same values as queueBuffer. The dequeue part
+    // is only attempted if the queue succeeded, and never blocks: its result
+    // is returned in outDequeueResult, with the same values as dequeueBuffer
+    // or one of:
+    // * WOULD_BLOCK - no buffer could be dequeued without waiting, the
+    //                 producer must call dequeueBuffer when it needs a buffer.
+    // * INVALID_OPERATION - the producer doesn't support prefetching, only
+    //                       the queue part was performed.
+    //
+    // outSlot and outFence are only valid if outDequeueResult is
+    // non-negative. The dequeued buffer doesn't come with frame timestamps,
+    // they are returned in output instead.
+    virtual status_t queueAndDequeueBuffer(int slot,
+            const QueueBufferInput& input, QueueBufferOutput* output,
+            int* outSlot, sp<Fence>* outFence, status_t* outDequeueResult,
+            uint32_t w, uint32_t h, PixelFormat format, uint32_t usage);
+
     // cancelBuffer indicates that the client does not wish to fill in the
     // buffer associated with slot and transfers ownership of the slot back to
     // the server.
@@ -591,6 +618,18 @@ public:
     // Gets the frame events that haven't already been retrieved.
     virtual void getFrameTimestamps(FrameEventHistoryDelta* /*outDelta*/) {}
 
+    // Returns the fd of a FrameEventBlock through which the consumer
+    // publishes the frame events of this producer, so that they can be read
+    // without calling getFrameTimestamps(). The caller owns the returned fd.
+    //
+    // Return of a value other than NO_ERROR means an error has occurred:
+    // * NO_INIT - the buffer queue has been abandoned or the block couldn't
+    //             be created.
+    // * INVALID_OPERATION - the consumer doesn't publish frame events.
+    virtual status_t getFrameEventBlock(int* /*outFd*/) {
+        return INVALID_OPERATION;
+    }
+
     // Returns a unique id for this BufferQueue
     virtual status_t getUniqueId(uint64_t* outId) const = 0;
 };
@@ -600,10 +639,18 @@ public:
 class BnGraphicBufferProducer : public BnInterface<IGraphicBufferProducer>
 {
 public:
+    BnGraphicBufferProducer();
+    virtual ~BnGraphicBufferProducer();
+
     virtual status_t    onTransact( uint32_t code,
                                     const Parcel& data,
                                     Parcel* reply,
                                     uint32_t flags = 0);
+
+private:
+    // the buffers exchanged with the remote producer, which can attach them
+    // again by reference
+    std::unique_ptr<gui::GraphicBufferCache> mBufferCache;
 };
 
 // ----------------------------------------------------------------------------
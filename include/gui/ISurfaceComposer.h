@@ -39,6 +39,8 @@ struct ComposerState;
 struct DisplayState;
 struct DisplayInfo;
 struct DisplayStatInfo;
+class Fence;
+class GraphicBuffer;
 class HdrCapabilities;
 class IDisplayEventConnection;
 class IGraphicBufferProducer;
@@ -74,7 +76,12 @@ public:
 
     enum VsyncSource {
         eVsyncSourceApp = 0,
-        eVsyncSourceSurfaceFlinger = 1
+        eVsyncSourceSurfaceFlinger = 1,
+        // app vsync aligned with SurfaceFlinger's, for latency sensitive
+        // clients like games
+        eVsyncSourceLowLatency = 2,
+        // app vsync late in the period, for background animations
+        eVsyncSourceLate = 3
     };
 
     /* create connection with surface flinger, requires
@@ -173,6 +180,27 @@ public:
             bool useIdentityTransform,
             Rotation rotation = eRotateNone) = 0;
 
+    /* Capture the specified screen into a buffer owned by SurfaceFlinger.
+     * Returns as soon as the rendering has been queued, outFence signals
+     * once the content of outBuffer is ready. reqWidth and reqHeight can be
+     * smaller than the display to get a downscaled capture. Same permission
+     * and secure window restrictions as captureScreen.
+     *
+     * The buffer should be handed back with releaseCaptureBuffer() once the
+     * caller is done with it so that it can be recycled.
+     */
+    virtual status_t captureScreenToBuffer(const sp<IBinder>& display,
+            Rect sourceCrop, uint32_t reqWidth, uint32_t reqHeight,
+            int32_t minLayerZ, int32_t maxLayerZ,
+            bool useIdentityTransform, Rotation rotation,
+            sp<GraphicBuffer>* outBuffer, sp<Fence>* outFence) = 0;
+
+    /* Returns a buffer obtained from captureScreenToBuffer() to
+     * SurfaceFlinger. It won't be reused before releaseFence signals.
+     */
+    virtual void releaseCaptureBuffer(uint64_t bufferId,
+            const sp<Fence>& releaseFence) = 0;
+
     /* Clears the frame statistics for animations.
      *
      * Requires the ACCESS_SURFACE_FLINGER permission.
@@ -195,6 +223,27 @@ public:
     virtual status_t enableVSyncInjections(bool enable) = 0;
 
     virtual status_t injectVSync(nsecs_t when) = 0;
+
+    /* Returns in outFd a read-only shared memory fd holding SurfaceFlinger's
+     * frame timeline, see gui/FrameTimeline.h. The caller owns the fd.
+     *
+     * Requires the ACCESS_SURFACE_FLINGER permission.
+     */
+    virtual status_t getFrameTimeline(int* outFd) = 0;
+
+    /* Returns in outFd a shared memory fd through which the client can
+     * stream the position, alpha and matrix of the layer identified by
+     * handle without transactions, see gui/LayerPropertyBlock.h. The layer
+     * must belong to client. The caller owns the fd.
+     */
+    virtual status_t getLayerPropertyBlock(
+            const sp<ISurfaceComposerClient>& client,
+            const sp<IBinder>& handle, int* outFd) = 0;
+
+    /* Wakes SurfaceFlinger up after a write to a layer property block it
+     * stopped polling.
+     */
+    virtual void signalLayerPropertyBlocks() = 0;
 };
 
 // ----------------------------------------------------------------------------
@@ -229,7 +278,12 @@ public:
         SET_ACTIVE_COLOR_MODE,
         ENABLE_VSYNC_INJECTIONS,
         INJECT_VSYNC,
-        CREATE_SCOPED_CONNECTION
+        CREATE_SCOPED_CONNECTION,
+        GET_FRAME_TIMELINE,
+        CAPTURE_SCREEN_TO_BUFFER,
+        RELEASE_CAPTURE_BUFFER,
+        GET_LAYER_PROPERTY_BLOCK,
+        SIGNAL_LAYER_PROPERTY_BLOCKS,
     };
 
     virtual status_t onTransact(uint32_t code, const Parcel& data,
@@ -0,0 +1,63 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_GUI_LATENCYHISTOGRAM_H
+#define ANDROID_GUI_LATENCYHISTOGRAM_H
+
+#include <utils/Timers.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace android {
+
+class String8;
+
+// A fixed size histogram of latencies with power of two buckets: bucket 0
+// holds latencies under 1us, bucket i those in [2^(i-1), 2^i)us and the last
+// one everything longer. Recording a sample is a few instructions and never
+// allocates, so it can be used on every frame. Not thread safe.
+class LatencyHistogram
+{
+public:
+    static constexpr size_t NUM_BUCKETS = 20;
+
+    LatencyHistogram() { clear(); }
+
+    void add(nsecs_t latency);
+    void clear();
+
+    size_t getCount() const { return mCount; }
+    nsecs_t getMax() const { return mMax; }
+
+    // Returns the upper bound of the bucket holding the given percentile
+    // of the samples, or 0 if there are none.
+    nsecs_t getPercentile(uint32_t percentile) const;
+
+    // Appends a one line summary, prefixed by name.
+    void dump(const char* name, String8* outResult) const;
+
+private:
+    static size_t getBucket(nsecs_t latency);
+
+    uint32_t mBuckets[NUM_BUCKETS];
+    size_t mCount;
+    nsecs_t mMax;
+}; // class LatencyHistogram
+
+} // namespace android
+
+#endif
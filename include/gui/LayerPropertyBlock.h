@@ -0,0 +1,128 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_GUI_LAYERPROPERTYBLOCK_H
+#define ANDROID_GUI_LAYERPROPERTYBLOCK_H
+
+#include <utils/Errors.h>
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace android {
+
+// The layer properties that can be streamed through a property block
+struct LayerProperties {
+    enum {
+        ePositionChanged = 0x1,
+        eAlphaChanged    = 0x2,
+        eMatrixChanged   = 0x4,
+    };
+
+    // Which of the properties below were ever set by the client
+    uint32_t what{0};
+    float x{0};
+    float y{0};
+    float alpha{1.0f};
+    float dsdx{1.0f};
+    float dtdx{0};
+    float dtdy{0};
+    float dsdy{1.0f};
+};
+
+/*
+ * A layer property block is a small shared memory region through which a
+ * client streams the position, alpha and matrix of one of its layers without
+ * going through ISurfaceComposer::setTransactionState(). SurfaceFlinger
+ * creates the region (see ISurfaceComposer::getLayerPropertyBlock()), the
+ * client is the only writer and SurfaceFlinger reads it when latching. The
+ * properties are protected by a sequence counter so that SurfaceFlinger can
+ * detect a torn read and retry.
+ *
+ * SurfaceFlinger keeps polling the block every frame while it changes. Once
+ * it finds it unchanged it clears the armed flag, and the next write has to
+ * wake it up with ISurfaceComposer::signalLayerPropertyBlocks().
+ */
+class LayerPropertyBlock {
+public:
+    static constexpr uint32_t MAGIC = 0x4c50424b; // 'LPBK'
+    static constexpr uint32_t VERSION = 1;
+
+    struct Shared {
+        uint32_t magic;
+        uint32_t version;
+        // odd while the properties are being written
+        std::atomic<uint32_t> sequence;
+        // set while SurfaceFlinger polls the block every frame
+        std::atomic<uint32_t> armed;
+        LayerProperties properties;
+    };
+
+    static size_t getRegionSize() { return sizeof(Shared); }
+};
+
+// Client side. Not thread safe: all calls to write() must come from the same
+// thread. Takes ownership of fd.
+class LayerPropertyWriter {
+public:
+    explicit LayerPropertyWriter(int fd);
+    ~LayerPropertyWriter();
+
+    LayerPropertyWriter(const LayerPropertyWriter&) = delete;
+    LayerPropertyWriter& operator=(const LayerPropertyWriter&) = delete;
+
+    status_t initCheck() const { return mShared != nullptr ? NO_ERROR : NO_INIT; }
+
+    // Returns true if SurfaceFlinger isn't polling the block anymore and
+    // must be signaled to pick the new properties up.
+    bool write(const LayerProperties& properties);
+
+private:
+    int mFd;
+    LayerPropertyBlock::Shared* mShared;
+};
+
+// SurfaceFlinger side, owns the region. Not thread safe.
+class LayerPropertyReader {
+public:
+    LayerPropertyReader();
+    ~LayerPropertyReader();
+
+    LayerPropertyReader(const LayerPropertyReader&) = delete;
+    LayerPropertyReader& operator=(const LayerPropertyReader&) = delete;
+
+    status_t initCheck() const { return mShared != nullptr ? NO_ERROR : NO_INIT; }
+
+    // The caller doesn't own the returned fd.
+    int getFd() const { return mFd; }
+
+    // Returns true and the latest properties if they changed since the last
+    // call. Otherwise stops polling and returns false, unless the client
+    // raced with us in which case the new properties are returned.
+    bool read(LayerProperties* outProperties);
+
+private:
+    bool readSequenced(LayerProperties* outProperties);
+
+    int mFd;
+    LayerPropertyBlock::Shared* mShared;
+    uint32_t mLastSequence;
+};
+
+}; // namespace android
+
+#endif // ANDROID_GUI_LAYERPROPERTYBLOCK_H
@@ -36,7 +36,8 @@ public:
       : mPendingSegment(),
         mSegmentHistory(),
         mLastOccupancy(0),
-        mLastOccupancyChangeTime(0) {}
+        mLastOccupancyChangeTime(0),
+        mShallowSegmentCount(0) {}
 
     struct Segment : public Parcelable {
         Segment()
@@ -72,6 +73,12 @@ public:
     void registerOccupancyChange(size_t occupancy);
     std::vector<Segment> getSegmentHistory(bool forceFlush);
 
+    // Number of consecutive segments recorded without using a third buffer,
+    // most recent first. Unlike the segment history, it isn't cleared when
+    // the history is read, only by resetShallowSegmentCount().
+    size_t getShallowSegmentCount() const { return mShallowSegmentCount; }
+    void resetShallowSegmentCount() { mShallowSegmentCount = 0; }
+
 private:
     static constexpr size_t MAX_HISTORY_SIZE = 10;
     static constexpr nsecs_t NEW_SEGMENT_DELAY = ms2ns(100);
@@ -97,6 +104,8 @@ private:
     size_t mLastOccupancy;
     nsecs_t mLastOccupancyChangeTime;
 
+    size_t mShallowSegmentCount;
+
 }; // class OccupancyTracker
 
 } // namespace android
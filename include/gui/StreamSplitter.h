@@ -55,12 +55,12 @@ public:
     // to the input will be queued to each output. It is assumed that all of the
     // outputs are added before any buffers are queued on the input. If any
     // output is abandoned by its consumer, the splitter will abandon its input
-    // queue (see onAbandoned).
+    // queue (see onAbandoned). At most MAX_OUTPUTS outputs can be added.
     //
     // A return value other than NO_ERROR means that an error has occurred and
     // outputQueue has not been added to the splitter. BAD_VALUE is returned if
-    // outputQueue is NULL. See IGraphicBufferProducer::connect for explanations
-    // of other error codes.
+    // outputQueue is NULL or if there are too many outputs. See
+    // IGraphicBufferProducer::connect for explanations of other error codes.
     status_t addOutput(const sp<IGraphicBufferProducer>& outputQueue);
 
     // setName sets the consumer name of the input queue
@@ -70,10 +70,12 @@ private:
     // From IConsumerListener
     //
     // During this callback, we store some tracking information, detach the
-    // buffer from the input, and attach it to each of the outputs. This call
-    // can block if there are too many outstanding buffers. If it blocks, it
-    // will resume when onBufferReleasedByOutput releases a buffer back to the
-    // input.
+    // buffer from the input, and attach it to each of the outputs that isn't
+    // lagging (see MAX_OUTPUT_LAG). The outputs are called without mMutex
+    // held, so that they can release buffers meanwhile. This call can block
+    // if too many buffers are still held by outputs that aren't lagging. If
+    // it blocks, it will resume when onBufferReleasedByOutput releases a
+    // buffer.
     virtual void onFrameAvailable(const BufferItem& item);
 
     // From IConsumerListener
@@ -93,10 +95,18 @@ private:
     // During this callback, we detach the buffer from the output queue that
     // generated the callback, update our state tracking to see if this is the
     // last output releasing the buffer, and if so, release it to the input.
-    // If we release the buffer to the input, we allow a blocked
-    // onFrameAvailable call to proceed.
+    // Either way a blocked onFrameAvailable call may be allowed to proceed.
     void onBufferReleasedByOutput(const sp<IGraphicBufferProducer>& from);
 
+    // Records that the output at outputIndex doesn't hold the buffer anymore,
+    // and releases the buffer to the input if no output holds it.
+    void releaseFromOutputLocked(size_t outputIndex, uint64_t bufferId,
+            const sp<Fence>& fence);
+
+    // Number of buffers still held by at least one output that isn't lagging.
+    // These are the buffers that apply back pressure to the input.
+    size_t getBlockingBufferCountLocked() const;
+
     // When this is called, the splitter disconnects from (i.e., abandons) its
     // input queue and signals any waiting onFrameAvailable calls to wake up.
     // It still processes callbacks from other outputs, but only detaches their
@@ -131,13 +141,22 @@ private:
         BufferTracker(const sp<GraphicBuffer>& buffer);
 
         const sp<GraphicBuffer>& getBuffer() const { return mBuffer; }
-        const sp<Fence>& getMergedFence() const { return mMergedFence; }
 
-        void mergeFence(const sp<Fence>& with);
+        // Keeps the release fence of one output. Fences that already
+        // signaled are dropped.
+        void addFence(const sp<Fence>& fence);
 
-        // Returns the new value
+        // Merges the fences of all the outputs pairwise, so that the merges
+        // form a tree rather than a chain that copies the same fences over
+        // and over.
+        sp<Fence> getMergedFence() const;
+
+        // Bitmask of the indices of the outputs holding the buffer
         // Only called while mMutex is held
-        size_t incrementReleaseCountLocked() { return ++mReleaseCount; }
+        uint32_t getHoldersLocked() const { return mHolders; }
+        void addHolderLocked(size_t outputIndex) { mHolders |= 1u << outputIndex; }
+        // Returns true if the output held the buffer
+        bool removeHolderLocked(size_t outputIndex);
 
     private:
         // Only destroy through LightRefBase
@@ -149,8 +168,14 @@ private:
         BufferTracker& operator=(const BufferTracker& other);
 
         sp<GraphicBuffer> mBuffer; // One instance that holds this native handle
-        sp<Fence> mMergedFence;
-        size_t mReleaseCount;
+        Vector<sp<Fence> > mFences;
+        uint32_t mHolders;
+    };
+
+    struct Output {
+        sp<IGraphicBufferProducer> producer;
+        // Number of buffers queued to this output that it hasn't released
+        size_t lag;
     };
 
     // Only called from createSplitter
@@ -159,7 +184,15 @@ private:
     // Must be accessed through RefBase
     virtual ~StreamSplitter();
 
-    static const int MAX_OUTSTANDING_BUFFERS = 2;
+    static const size_t MAX_OUTSTANDING_BUFFERS = 2;
+
+    // Once an output holds this many buffers, it stops getting new ones until
+    // it releases one, i.e. it drops frames, and the buffers it holds stop
+    // counting towards MAX_OUTSTANDING_BUFFERS. This way a slow output (e.g.
+    // an encoder) doesn't hold up the others (e.g. preview).
+    static const size_t MAX_OUTPUT_LAG = 2;
+
+    static const size_t MAX_OUTPUTS = 32;
 
     // mIsAbandoned is set to true when an output dies. Once the StreamSplitter
     // has been abandoned, it will continue to detach buffers from other
@@ -169,9 +202,8 @@ private:
 
     Mutex mMutex;
     Condition mReleaseCondition;
-    int mOutstandingBuffers;
     sp<IGraphicBufferConsumer> mInput;
-    Vector<sp<IGraphicBufferProducer> > mOutputs;
+    Vector<Output> mOutputs;
 
     // Map of GraphicBuffer IDs (GraphicBuffer::getId()) to buffer tracking
     // objects (which are mostly for counting how many outputs have released the
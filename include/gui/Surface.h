@@ -31,6 +31,7 @@ struct ANativeWindow_Buffer;
 
 namespace android {
 
+class FrameEventBlockReader;
 class ISurfaceComposer;
 
 /*
@@ -223,6 +224,7 @@ private:
     int dispatchGetFrameTimestamps(va_list args);
     int dispatchGetWideColorSupport(va_list args);
     int dispatchGetHdrSupport(va_list args);
+    int dispatchSetFrameMetadata(va_list args);
 
 protected:
     virtual int dequeueBuffer(ANativeWindowBuffer** buffer, int* fenceFd);
@@ -244,6 +246,7 @@ protected:
     virtual int setCrop(Rect const* rect);
     virtual int setUsage(uint32_t reqUsage);
     virtual void setSurfaceDamage(android_native_rect_t* rects, size_t numRects);
+    virtual int setFrameMetadata(const android_native_frame_metadata_t& metadata);
 
 public:
     virtual int disconnect(int api,
@@ -285,9 +288,20 @@ protected:
 
     void querySupportedTimestampsLocked() const;
 
+    // Applies the frame events published by the consumer since the last call,
+    // if it publishes them through a FrameEventBlock.
+    void readFrameEventBlockLocked();
+
     void freeAllBuffers();
     int getSlotFromBufferLocked(android_native_buffer_t* buffer) const;
 
+    // Returns the buffer prefetched by queueBuffer, if any, to the producer.
+    // Must be called before anything that changes how many buffers may be
+    // dequeued, since the producer counts it as dequeued.
+    void cancelPrefetchedBufferLocked();
+
+    void setSurfaceDamageLocked(const android_native_rect_t* rects, size_t numRects);
+
     struct BufferSlot {
         sp<GraphicBuffer> buffer;
         Region dirtyRegion;
@@ -420,6 +434,20 @@ protected:
     // used to prevent a mismatch between the number of queue/dequeue calls.
     bool mSharedBufferHasBeenQueued;
 
+    // queueBuffer dequeues the next buffer in the same transaction (see
+    // IGraphicBufferProducer::queueAndDequeueBuffer) and keeps it here along
+    // with the attributes it was dequeued with. The next dequeueBuffer hands
+    // it out without going over Binder if the attributes still match.
+    // mPrefetchBuffers is cleared if the producer doesn't support it.
+    bool mPrefetchBuffers = true;
+    int mPrefetchedSlot;
+    sp<Fence> mPrefetchedFence;
+    status_t mPrefetchedResult = NO_ERROR;
+    uint32_t mPrefetchedWidth = 0;
+    uint32_t mPrefetchedHeight = 0;
+    PixelFormat mPrefetchedFormat = 0;
+    uint32_t mPrefetchedUsage = 0;
+
     // These are used to satisfy the NATIVE_WINDOW_LAST_*_DURATION queries
     nsecs_t mLastDequeueDuration = 0;
     nsecs_t mLastQueueDuration = 0;
@@ -440,6 +468,11 @@ protected:
     bool mEnableFrameTimestamps = false;
     std::unique_ptr<ProducerFrameEventHistory> mFrameEventHistory;
 
+    // Set when frame timestamps are first enabled if the consumer supports
+    // it. The frame events are then read from it instead of being returned
+    // by queueBuffer and dequeueBuffer.
+    std::unique_ptr<FrameEventBlockReader> mFrameEventBlock;
+
     bool mReportRemovedBuffers = false;
     std::vector<sp<GraphicBuffer>> mRemovedBuffers;
 };
@@ -171,6 +171,9 @@ public:
     status_t clearLayerFrameStats(const sp<IBinder>& token) const;
     status_t getLayerFrameStats(const sp<IBinder>& token, FrameStats* outStats) const;
 
+    // See ISurfaceComposer::getLayerPropertyBlock()
+    status_t getLayerPropertyBlock(const sp<IBinder>& token, int* outFd) const;
+
     static status_t clearAnimationFrameStats();
     static status_t getAnimationFrameStats(FrameStats* outStats);
 
@@ -29,6 +29,9 @@
 #include <ui/Region.h>
 
 #include <gui/ISurfaceComposerClient.h>
+#include <gui/LayerPropertyBlock.h>
+
+#include <memory>
 
 namespace android {
 
@@ -141,6 +144,13 @@ public:
     status_t clearLayerFrameStats() const;
     status_t getLayerFrameStats(FrameStats* outStats) const;
 
+    // From now on, setPosition(), setAlpha() and setMatrix() are streamed to
+    // SurfaceFlinger through shared memory instead of transactions. They
+    // take effect on the next frame SurfaceFlinger composes and are no
+    // longer applied atomically with the rest of a global transaction, which
+    // suits continuously animated surfaces.
+    status_t enablePropertyBlock();
+
 private:
     // can't be copied
     SurfaceControl& operator = (SurfaceControl& rhs);
@@ -158,6 +168,7 @@ private:
 
     sp<Surface> generateSurfaceLocked() const;
     status_t validate() const;
+    status_t writePropertiesLocked();
     void destroy();
 
     sp<SurfaceComposerClient>   mClient;
@@ -165,6 +176,9 @@ private:
     sp<IGraphicBufferProducer>  mGraphicBufferProducer;
     mutable Mutex               mLock;
     mutable sp<Surface>         mSurfaceData;
+    // Protected by mLock
+    std::unique_ptr<LayerPropertyWriter> mPropertyWriter;
+    LayerProperties             mProperties;
 };
 
 }; // namespace android
@@ -0,0 +1,745 @@
+/*
+ * Copyright 2017, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_GRAPHICS_BUFFERQUEUE_V1_0_CONVERSION_H
+#define ANDROID_HARDWARE_GRAPHICS_BUFFERQUEUE_V1_0_CONVERSION_H
+
+#include <gui/bufferqueue/1.0/H2BGraphicBufferProducer.h>
+
+#include <cutils/native_handle.h>
+#include <ui/Fence.h>
+#include <ui/GraphicBuffer.h>
+#include <ui/Region.h>
+#include <utils/Flattenable.h>
+
+#include <limits>
+#include <memory>
+#include <new>
+
+#include <unistd.h>
+
+namespace android {
+namespace hardware {
+namespace graphics {
+namespace bufferqueue {
+namespace V1_0 {
+namespace utils {
+
+/*
+ * Conversions between the HIDL and binder types of
+ * `IGraphicBufferProducer`, used by `H2BGraphicBufferProducer` on every call.
+ *
+ * Whenever the binder type exposes its fields, the conversion copies them
+ * directly. `GraphicBuffer` and `FrameEventHistoryDelta` can only be
+ * initialized by unflattening; they are flattened into stack storage, with
+ * the file descriptors duplicated straight into the fd array instead of
+ * going through cloned native handles.
+ */
+
+using ::android::hardware::graphics::common::V1_0::Dataspace;
+typedef ::android::hardware::media::V1_0::Rect HRect;
+typedef ::android::hardware::media::V1_0::Region HRegion;
+
+// Scratch storage.
+
+/**
+ * \brief Array of `size` elements that lives on the stack if `size <= N`, and
+ * on the heap otherwise.
+ *
+ * `get()` returns `nullptr` if the heap allocation failed.
+ */
+template <typename T, size_t N>
+class ScratchArray {
+public:
+    explicit ScratchArray(size_t size)
+          : mHeap(size > N ? new (std::nothrow) T[size] : nullptr),
+            mData(size > N ? mHeap.get() : mStack) {}
+
+    T* get() const { return mData; }
+
+private:
+    ScratchArray(const ScratchArray&) = delete;
+    ScratchArray& operator=(const ScratchArray&) = delete;
+
+    alignas(alignof(int64_t)) T mStack[N];
+    std::unique_ptr<T[]> mHeap;
+    T* mData;
+};
+
+/**
+ * \brief Close the file descriptors in `[begin, end)`.
+ */
+inline void closeFds(int const* begin, int const* end) {
+    for (int const* fd = begin; fd < end; ++fd) {
+        close(*fd);
+    }
+}
+
+// native_handle_t helper functions.
+
+/**
+ * \brief Take an fd and create a native handle containing only the given fd.
+ * The created handle will need to be deleted manually with
+ * `native_handle_delete()`.
+ *
+ * \param[in] fd The source file descriptor (of type `int`).
+ * \return The create `native_handle_t*` that contains the given \p fd. If the
+ * supplied \p fd is negative, the created native handle will contain no file
+ * descriptors.
+ *
+ * If the native handle cannot be created, the return value will be
+ * `nullptr`.
+ *
+ * This function does not duplicate the file descriptor.
+ */
+inline native_handle_t* native_handle_create_from_fd(int fd) {
+    if (fd < 0) {
+        return native_handle_create(0, 0);
+    }
+    native_handle_t* nh = native_handle_create(1, 0);
+    if (nh == nullptr) {
+        return nullptr;
+    }
+    nh->data[0] = fd;
+    return nh;
+}
+
+/**
+ * \brief Extract a file descriptor from a native handle.
+ *
+ * \param[in] nh The source `native_handle_t*`.
+ * \param[in] index The index of the file descriptor in \p nh to read from. This
+ * input has the default value of `0`.
+ * \return The `index`-th file descriptor in \p nh. If \p nh does not have
+ * enough file descriptors, the returned value will be `-1`.
+ *
+ * This function does not duplicate the file descriptor.
+ */
+inline int native_handle_read_fd(native_handle_t const* nh, int index = 0) {
+    return ((nh == nullptr) || (nh->numFds == 0) ||
+            (nh->numFds <= index) || (index < 0)) ?
+            -1 : nh->data[index];
+}
+
+/**
+ * \brief Convert `Return<Status>` to `status_t`. This is for legacy binder
+ * calls.
+ *
+ * \param[in] t The source `Return<Status>`.
+ * \return The corresponding `status_t`.
+ *
+ * This function first check if \p t has a transport error. If it does, then the
+ * return value is the transport error code. Otherwise, the return value is
+ * converted from `Status` contained inside \p t.
+ *
+ * Note:
+ * - This `Status` is omx-specific. It is defined in `types.hal`.
+ * - The name of this function is not `convert`.
+ */
+// convert: Return<Status> -> status_t
+inline status_t toStatusT(Return<HGraphicBufferProducer::Status> const& t) {
+    return t.isOk() ? static_cast<status_t>(
+            static_cast<HGraphicBufferProducer::Status>(t)) : UNKNOWN_ERROR;
+}
+
+/**
+ * \brief Convert `Return<void>` to `status_t`. This is for legacy binder calls.
+ *
+ * \param[in] t The source `Return<void>`.
+ * \return The corresponding `status_t`.
+ */
+// convert: Return<void> -> status_t
+inline status_t toStatusT(Return<void> const& t) {
+    return t.isOk() ? OK : UNKNOWN_ERROR;
+}
+
+/**
+ * \brief Wrap `GraphicBuffer` in `AnwBuffer`.
+ *
+ * \param[out] t The wrapper of type `AnwBuffer`.
+ * \param[in] l The source `GraphicBuffer`.
+ */
+// wrap: GraphicBuffer -> AnwBuffer
+inline void wrapAs(AnwBuffer* t, GraphicBuffer const& l) {
+    t->attr.width = l.getWidth();
+    t->attr.height = l.getHeight();
+    t->attr.stride = l.getStride();
+    t->attr.format = static_cast<PixelFormat>(l.getPixelFormat());
+    t->attr.layerCount = l.getLayerCount();
+    t->attr.usage = l.getUsage();
+    t->attr.id = l.getId();
+    t->attr.generationNumber = l.getGenerationNumber();
+    t->nativeHandle = hidl_handle(l.handle);
+}
+
+/**
+ * \brief Convert `AnwBuffer` to `GraphicBuffer`.
+ *
+ * \param[out] l The destination `GraphicBuffer`.
+ * \param[in] t The source `AnwBuffer`.
+ *
+ * This function will duplicate all file descriptors in \p t.
+ *
+ * `GraphicBuffer` can only get its id from `unflatten`, so \p t is laid out
+ * in the flattened format, in stack storage for handles of a usual size.
+ */
+// convert: AnwBuffer -> GraphicBuffer
+// Ref: frameworks/native/libs/ui/GraphicBuffer.cpp: GraphicBuffer::flatten
+inline bool convertTo(GraphicBuffer* l, AnwBuffer const& t) {
+    native_handle_t const* handle = t.nativeHandle;
+
+    size_t const numFds = static_cast<size_t>(handle ? handle->numFds : 0);
+    size_t const numInts = 12 +
+            static_cast<size_t>(handle ? handle->numInts : 0);
+    ScratchArray<int32_t, 64> ints(numInts);
+    ScratchArray<int, 8> fds(numFds);
+    if (ints.get() == nullptr || fds.get() == nullptr) {
+        return false;
+    }
+
+    int32_t* flatInts = ints.get();
+    flatInts[0] = 'GBFR';
+    flatInts[1] = static_cast<int32_t>(t.attr.width);
+    flatInts[2] = static_cast<int32_t>(t.attr.height);
+    flatInts[3] = static_cast<int32_t>(t.attr.stride);
+    flatInts[4] = static_cast<int32_t>(t.attr.format);
+    flatInts[5] = static_cast<int32_t>(t.attr.layerCount);
+    flatInts[6] = static_cast<int32_t>(t.attr.usage);
+    flatInts[7] = static_cast<int32_t>(t.attr.id >> 32);
+    flatInts[8] = static_cast<int32_t>(t.attr.id & 0xFFFFFFFF);
+    flatInts[9] = static_cast<int32_t>(t.attr.generationNumber);
+    flatInts[10] = static_cast<int32_t>(numFds);
+    flatInts[11] = static_cast<int32_t>(numInts - 12);
+    if (handle) {
+        std::copy(handle->data + numFds, handle->data + numFds + numInts - 12,
+                &flatInts[12]);
+    }
+
+    // GraphicBuffer::unflatten takes ownership of the fds
+    int* flatFds = fds.get();
+    for (size_t i = 0; i < numFds; ++i) {
+        flatFds[i] = dup(handle->data[i]);
+        if (flatFds[i] < 0) {
+            closeFds(flatFds, flatFds + i);
+            return false;
+        }
+    }
+
+    void const* constBuffer = static_cast<void const*>(flatInts);
+    size_t size = numInts * sizeof(int32_t);
+    int const* constFds = static_cast<int const*>(flatFds);
+    size_t count = numFds;
+    if (l->unflatten(constBuffer, size, constFds, count) != NO_ERROR) {
+        closeFds(flatFds, flatFds + numFds);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * \brief Wrap `Fence` in `hidl_handle`.
+ *
+ * \param[out] t The wrapper of type `hidl_handle`.
+ * \param[out] nh The native handle pointed to by \p t.
+ * \param[in] l The source `Fence`.
+ *
+ * On success, \p nh will hold a newly created native handle, or `nullptr` if
+ * \p l is invalid. The native handle must be deleted manually with
+ * `native_handle_delete()` afterwards. It doesn't own the file descriptor of
+ * \p l.
+ */
+// wrap: Fence -> hidl_handle
+inline bool wrapAs(hidl_handle* t, native_handle_t** nh, Fence const& l) {
+    int const fd = l.get();
+    if (fd == -1) {
+        *nh = nullptr;
+        *t = hidl_handle();
+        return true;
+    }
+    *nh = native_handle_create_from_fd(fd);
+    if (*nh == nullptr) {
+        return false;
+    }
+    *t = *nh;
+    return true;
+}
+
+/**
+ * \brief Convert `hidl_handle` to `Fence`.
+ *
+ * \param[out] l The destination `Fence`.
+ * \param[in] t The source `hidl_handle`.
+ *
+ * If \p t contains a valid file descriptor, it will be duplicated. Otherwise
+ * \p l is set to `Fence::NO_FENCE`.
+ */
+// convert: hidl_handle -> Fence
+inline bool convertTo(sp<Fence>* l, hidl_handle const& t) {
+    int fd = native_handle_read_fd(t);
+    if (fd == -1) {
+        *l = Fence::NO_FENCE;
+        return true;
+    }
+    fd = dup(fd);
+    if (fd == -1) {
+        *l = Fence::NO_FENCE;
+        return false;
+    }
+    *l = new Fence(fd);
+    return true;
+}
+
+// Ref: frameworks/native/libs/gui/IGraphicBufferProducer.cpp:
+//      IGraphicBufferProducer::QueueBufferInput
+
+/**
+ * \brief Wrap `IGraphicBufferProducer::QueueBufferInput` in
+ * `HGraphicBufferProducer::QueueBufferInput`.
+ *
+ * \param[out] t The wrapper of type
+ * `HGraphicBufferProducer::QueueBufferInput`.
+ * \param[out] nh The underlying native handle for `t->fence`.
+ * \param[in] l The source `IGraphicBufferProducer::QueueBufferInput`.
+ *
+ * If the return value is `true` and `t->fence` contains a valid file
+ * descriptor, \p nh will be a newly created native handle holding that file
+ * descriptor. \p nh needs to be deleted with `native_handle_delete()`
+ * afterwards.
+ */
+inline bool wrapAs(
+        HGraphicBufferProducer::QueueBufferInput* t,
+        native_handle_t** nh,
+        BGraphicBufferProducer::QueueBufferInput const& l) {
+    int64_t timestamp;
+    bool isAutoTimestamp;
+    android_dataspace dataSpace;
+    ::android::Rect crop;
+    int scalingMode;
+    uint32_t transform;
+    sp<Fence> fence;
+    uint32_t stickyTransform;
+    bool getFrameTimestamps;
+    l.deflate(&timestamp, &isAutoTimestamp, &dataSpace, &crop, &scalingMode,
+            &transform, &fence, &stickyTransform, &getFrameTimestamps);
+
+    t->timestamp = timestamp;
+    t->isAutoTimestamp = static_cast<int32_t>(isAutoTimestamp);
+    t->dataSpace = static_cast<Dataspace>(dataSpace);
+    t->crop = HRect{
+            static_cast<int32_t>(crop.left),
+            static_cast<int32_t>(crop.top),
+            static_cast<int32_t>(crop.right),
+            static_cast<int32_t>(crop.bottom)};
+    t->scalingMode = static_cast<int32_t>(scalingMode);
+    t->transform = transform;
+    t->stickyTransform = stickyTransform;
+    t->getFrameTimestamps = getFrameTimestamps;
+
+    ::android::Region const& damage = l.getSurfaceDamage();
+    size_t const numRects = static_cast<size_t>(damage.end() - damage.begin());
+    t->surfaceDamage.resize(numRects);
+    size_t r = 0;
+    for (::android::Rect const* rect = damage.begin(); rect != damage.end();
+            ++rect, ++r) {
+        t->surfaceDamage[r] = HRect{
+                static_cast<int32_t>(rect->left),
+                static_cast<int32_t>(rect->top),
+                static_cast<int32_t>(rect->right),
+                static_cast<int32_t>(rect->bottom)};
+    }
+
+    if (fence == nullptr) {
+        *nh = nullptr;
+        t->fence = hidl_handle();
+        return true;
+    }
+    return wrapAs(&(t->fence), nh, *fence);
+}
+
+// Ref: frameworks/native/libs/ui/FenceTime.cpp: FenceTime::Snapshot
+
+/**
+ * \brief Return the size of the non-fd buffer required to flatten
+ * `FenceTimeSnapshot`.
+ *
+ * \param[in] t The input `FenceTimeSnapshot`.
+ * \return The required size of the flat buffer.
+ */
+inline size_t getFlattenedSize(
+        HGraphicBufferProducer::FenceTimeSnapshot const& t) {
+    constexpr size_t min = sizeof(::android::FenceTime::Snapshot::State);
+    switch (t.state) {
+        case HGraphicBufferProducer::FenceTimeSnapshot::State::EMPTY:
+            return min;
+        case HGraphicBufferProducer::FenceTimeSnapshot::State::FENCE:
+            return min + sizeof(uint32_t); // Fence: number of fds
+        case HGraphicBufferProducer::FenceTimeSnapshot::State::SIGNAL_TIME:
+            return min + sizeof(
+                    ::android::FenceTime::Snapshot::signalTime);
+    }
+    return 0;
+}
+
+/**
+ * \brief Return the number of file descriptors contained in
+ * `FenceTimeSnapshot`.
+ *
+ * \param[in] t The input `FenceTimeSnapshot`.
+ * \return The number of file descriptors contained in \p snapshot.
+ */
+inline size_t getFdCount(
+        HGraphicBufferProducer::FenceTimeSnapshot const& t) {
+    return t.state ==
+            HGraphicBufferProducer::FenceTimeSnapshot::State::FENCE &&
+            native_handle_read_fd(t.fence) != -1 ? 1 : 0;
+}
+
+/**
+ * \brief Flatten `FenceTimeSnapshot` in the format of
+ * `FenceTime::Snapshot::flatten`.
+ *
+ * \param[in] t The source `FenceTimeSnapshot`.
+ * \param[in,out] buffer The pointer to the flat non-fd buffer.
+ * \param[in,out] size The size of the flat non-fd buffer.
+ * \param[in,out] fds The pointer to the flat fd buffer.
+ * \param[in,out] numFds The size of the flat fd buffer.
+ * \return `NO_ERROR` on success; other value on failure.
+ *
+ * The file descriptor in `t.fence` is duplicated into \p fds. On failure, no
+ * file descriptor is left open.
+ */
+inline status_t flatten(HGraphicBufferProducer::FenceTimeSnapshot const& t,
+        void*& buffer, size_t& size, int*& fds, size_t& numFds) {
+    if (size < getFlattenedSize(t) || numFds < getFdCount(t)) {
+        return NO_MEMORY;
+    }
+
+    switch (t.state) {
+        case HGraphicBufferProducer::FenceTimeSnapshot::State::EMPTY:
+            FlattenableUtils::write(buffer, size,
+                    ::android::FenceTime::Snapshot::State::EMPTY);
+            return NO_ERROR;
+        case HGraphicBufferProducer::FenceTimeSnapshot::State::FENCE: {
+            FlattenableUtils::write(buffer, size,
+                    ::android::FenceTime::Snapshot::State::FENCE);
+            int const fd = native_handle_read_fd(t.fence);
+            // Cast to uint32_t since the size of a size_t can vary between
+            // 32- and 64-bit processes
+            FlattenableUtils::write(buffer, size,
+                    static_cast<uint32_t>(fd == -1 ? 0 : 1));
+            if (fd != -1) {
+                *fds = dup(fd);
+                if (*fds < 0) {
+                    return NO_MEMORY;
+                }
+                ++fds;
+                --numFds;
+            }
+            return NO_ERROR;
+        }
+        case HGraphicBufferProducer::FenceTimeSnapshot::State::SIGNAL_TIME:
+            FlattenableUtils::write(buffer, size,
+                    ::android::FenceTime::Snapshot::State::SIGNAL_TIME);
+            FlattenableUtils::write(buffer, size, t.signalTimeNs);
+            return NO_ERROR;
+    }
+    return NO_ERROR;
+}
+
+// Ref: frameworks/native/libs/gui/FrameTimestamps.cpp: FrameEventsDelta
+
+/**
+ * \brief Return the size of the non-fd buffer required to flatten
+ * `FrameEventsDelta`, without its fences.
+ *
+ * \param[in] t The input `FrameEventsDelta`.
+ * \return The size of the flat buffer without fences.
+ */
+constexpr size_t minFlattenedSize(
+        HGraphicBufferProducer::FrameEventsDelta const& /* t */) {
+    return sizeof(uint64_t) + // mFrameNumber
+            sizeof(uint16_t) + // mIndex
+            sizeof(uint8_t) + // mAddPostCompositeCalled
+            sizeof(uint8_t) + // mAddReleaseCalled
+            sizeof(nsecs_t) + // mPostedTime
+            sizeof(nsecs_t) + // mRequestedPresentTime
+            sizeof(nsecs_t) + // mLatchTime
+            sizeof(nsecs_t) + // mFirstRefreshStartTime
+            sizeof(nsecs_t) + // mLastRefreshStartTime
+            sizeof(nsecs_t); // mDequeueReadyTime
+}
+
+/**
+ * \brief Return the size of the non-fd buffer required to flatten
+ * `FrameEventsDelta`.
+ *
+ * \param[in] t The input `FrameEventsDelta`.
+ * \return The required size of the flat buffer.
+ *
+ * The display retire fence isn't part of `::android::FrameEventsDelta`
+ * anymore and is dropped.
+ */
+inline size_t getFlattenedSize(
+        HGraphicBufferProducer::FrameEventsDelta const& t) {
+    return minFlattenedSize(t) +
+            getFlattenedSize(t.gpuCompositionDoneFence) +
+            getFlattenedSize(t.displayPresentFence) +
+            getFlattenedSize(t.releaseFence);
+}
+
+/**
+ * \brief Return the number of file descriptors contained in
+ * `FrameEventsDelta`.
+ *
+ * \param[in] t The input `FrameEventsDelta`.
+ * \return The number of file descriptors contained in \p t.
+ */
+inline size_t getFdCount(
+        HGraphicBufferProducer::FrameEventsDelta const& t) {
+    return getFdCount(t.gpuCompositionDoneFence) +
+            getFdCount(t.displayPresentFence) +
+            getFdCount(t.releaseFence);
+}
+
+/**
+ * \brief Flatten `FrameEventsDelta` in the format of
+ * `::android::FrameEventsDelta::flatten`.
+ *
+ * \param[in] t The source `FrameEventsDelta`.
+ * \param[in,out] buffer The pointer to the flat non-fd buffer.
+ * \param[in,out] size The size of the flat non-fd buffer.
+ * \param[in,out] fds The pointer to the flat fd buffer.
+ * \param[in,out] numFds The size of the flat fd buffer.
+ * \return `NO_ERROR` on success; other value on failure.
+ *
+ * The file descriptors contained in \p t are duplicated into \p fds. On
+ * failure, the caller must close the ones written so far.
+ */
+inline status_t flatten(HGraphicBufferProducer::FrameEventsDelta const& t,
+        void*& buffer, size_t& size, int*& fds, size_t& numFds) {
+    // Check that t.index is within a valid range.
+    if (t.index >= static_cast<uint32_t>(FrameEventHistory::MAX_FRAME_HISTORY)
+            || t.index > std::numeric_limits<uint16_t>::max()) {
+        return BAD_VALUE;
+    }
+    if (size < getFlattenedSize(t) || numFds < getFdCount(t)) {
+        return NO_MEMORY;
+    }
+
+    FlattenableUtils::write(buffer, size, t.frameNumber);
+
+    // These are static_cast to uint16_t/uint8_t for alignment.
+    FlattenableUtils::write(buffer, size, static_cast<uint16_t>(t.index));
+    FlattenableUtils::write(
+            buffer, size, static_cast<uint8_t>(t.addPostCompositeCalled));
+    FlattenableUtils::write(
+            buffer, size, static_cast<uint8_t>(t.addReleaseCalled));
+
+    FlattenableUtils::write(buffer, size, t.postedTimeNs);
+    FlattenableUtils::write(buffer, size, t.requestedPresentTimeNs);
+    FlattenableUtils::write(buffer, size, t.latchTimeNs);
+    FlattenableUtils::write(buffer, size, t.firstRefreshStartTimeNs);
+    FlattenableUtils::write(buffer, size, t.lastRefreshStartTimeNs);
+    FlattenableUtils::write(buffer, size, t.dequeueReadyTime);
+
+    // Fences, in the order of FrameEventsDelta::allFences
+    status_t status = flatten(t.gpuCompositionDoneFence,
+            buffer, size, fds, numFds);
+    if (status == NO_ERROR) {
+        status = flatten(t.displayPresentFence, buffer, size, fds, numFds);
+    }
+    if (status == NO_ERROR) {
+        status = flatten(t.releaseFence, buffer, size, fds, numFds);
+    }
+    return status;
+}
+
+// Ref: frameworks/native/libs/gui/FrameTimestamps.cpp: FrameEventHistoryDelta
+
+/**
+ * \brief Return the size of the non-fd buffer required to flatten
+ * `HGraphicBufferProducer::FrameEventHistoryDelta`.
+ *
+ * \param[in] t The input `HGraphicBufferProducer::FrameEventHistoryDelta`.
+ * \return The required size of the flat buffer.
+ */
+inline size_t getFlattenedSize(
+        HGraphicBufferProducer::FrameEventHistoryDelta const& t) {
+    size_t size = 4 + // mDeltas.size()
+            sizeof(t.compositorTiming);
+    for (size_t i = 0; i < t.deltas.size(); ++i) {
+        size += getFlattenedSize(t.deltas[i]);
+    }
+    return size;
+}
+
+/**
+ * \brief Return the number of file descriptors contained in
+ * `HGraphicBufferProducer::FrameEventHistoryDelta`.
+ *
+ * \param[in] t The input `HGraphicBufferProducer::FrameEventHistoryDelta`.
+ * \return The number of file descriptors contained in \p t.
+ */
+inline size_t getFdCount(
+        HGraphicBufferProducer::FrameEventHistoryDelta const& t) {
+    size_t numFds = 0;
+    for (size_t i = 0; i < t.deltas.size(); ++i) {
+        numFds += getFdCount(t.deltas[i]);
+    }
+    return numFds;
+}
+
+/**
+ * \brief Flatten `FrameEventHistoryDelta` in the format of
+ * `::android::FrameEventHistoryDelta::flatten`.
+ *
+ * \param[in] t The source `FrameEventHistoryDelta`.
+ * \param[in,out] buffer The pointer to the flat non-fd buffer.
+ * \param[in,out] size The size of the flat non-fd buffer.
+ * \param[in,out] fds The pointer to the flat fd buffer.
+ * \param[in,out] numFds The size of the flat fd buffer.
+ * \return `NO_ERROR` on success; other value on failure.
+ *
+ * The file descriptors contained in \p t are duplicated into \p fds. On
+ * failure, the caller must close the ones written so far.
+ */
+inline status_t flatten(
+        HGraphicBufferProducer::FrameEventHistoryDelta const& t,
+        void*& buffer, size_t& size, int*& fds, size_t& numFds) {
+    if (t.deltas.size() > ::android::FrameEventHistory::MAX_FRAME_HISTORY) {
+        return BAD_VALUE;
+    }
+    if (size < getFlattenedSize(t)) {
+        return NO_MEMORY;
+    }
+
+    FlattenableUtils::write(buffer, size, t.compositorTiming);
+
+    FlattenableUtils::write(buffer, size, static_cast<uint32_t>(t.deltas.size()));
+    for (size_t deltaIndex = 0; deltaIndex < t.deltas.size(); ++deltaIndex) {
+        status_t status = flatten(t.deltas[deltaIndex],
+                buffer, size, fds, numFds);
+        if (status != NO_ERROR) {
+            return status;
+        }
+    }
+    return NO_ERROR;
+}
+
+/**
+ * \brief Convert `HGraphicBufferProducer::FrameEventHistoryDelta` to
+ * `::android::FrameEventHistoryDelta`.
+ *
+ * \param[out] l The destination `::android::FrameEventHistoryDelta`.
+ * \param[in] t The source `HGraphicBufferProducer::FrameEventHistoryDelta`.
+ *
+ * This function will duplicate all file descriptors contained in \p t.
+ *
+ * `::android::FrameEventHistoryDelta` can only be filled by `unflatten`. A
+ * full history fits in the stack storage used for the flattened form.
+ */
+inline bool convertTo(
+        ::android::FrameEventHistoryDelta* l,
+        HGraphicBufferProducer::FrameEventHistoryDelta const& t) {
+    size_t const baseSize = getFlattenedSize(t);
+    ScratchArray<uint8_t, 1024> baseBuffer(baseSize);
+    if (baseBuffer.get() == nullptr) {
+        return false;
+    }
+
+    size_t const baseNumFds = getFdCount(t);
+    ScratchArray<int, 3 * FrameEventHistory::MAX_FRAME_HISTORY> baseFds(
+            baseNumFds);
+    if (baseFds.get() == nullptr) {
+        return false;
+    }
+
+    void* buffer = static_cast<void*>(baseBuffer.get());
+    size_t size = baseSize;
+    int* fds = baseFds.get();
+    size_t numFds = baseNumFds;
+    if (flatten(t, buffer, size, fds, numFds) != NO_ERROR) {
+        closeFds(baseFds.get(), fds);
+        return false;
+    }
+
+    void const* constBuffer = static_cast<void const*>(baseBuffer.get());
+    size = baseSize;
+    int const* constFds = static_cast<int const*>(baseFds.get());
+    numFds = baseNumFds;
+    if (l->unflatten(constBuffer, size, constFds, numFds) != NO_ERROR) {
+        // The fences that were unflattened own their fds
+        closeFds(constFds, baseFds.get() + baseNumFds);
+        return false;
+    }
+    return true;
+}
+
+// Ref: frameworks/native/libs/gui/IGraphicBufferProducer.cpp:
+//      IGraphicBufferProducer::QueueBufferOutput
+
+/**
+ * \brief Convert `HGraphicBufferProducer::QueueBufferOutput` to
+ * `IGraphicBufferProducer::QueueBufferOutput`.
+ *
+ * \param[out] l The destination `IGraphicBufferProducer::QueueBufferOutput`.
+ * \param[in] t The source `HGraphicBufferProducer::QueueBufferOutput`.
+ *
+ * This function will duplicate all file descriptors contained in \p t.
+ */
+// convert: HGraphicBufferProducer::QueueBufferOutput ->
+// IGraphicBufferProducer::QueueBufferOutput
+inline bool convertTo(
+        BGraphicBufferProducer::QueueBufferOutput* l,
+        HGraphicBufferProducer::QueueBufferOutput const& t) {
+    if (!convertTo(&(l->frameTimestamps), t.frameTimestamps)) {
+        return false;
+    }
+    l->width = t.width;
+    l->height = t.height;
+    l->transformHint = t.transformHint;
+    l->numPendingBuffers = t.numPendingBuffers;
+    l->nextFrameNumber = t.nextFrameNumber;
+    l->bufferReplaced = t.bufferReplaced;
+    return true;
+}
+
+/**
+ * \brief Convert `IGraphicBufferProducer::DisconnectMode` to
+ * `HGraphicBufferProducer::DisconnectMode`.
+ *
+ * \param[in] l The source `IGraphicBufferProducer::DisconnectMode`.
+ * \return The corresponding `HGraphicBufferProducer::DisconnectMode`.
+ */
+inline HGraphicBufferProducer::DisconnectMode toHDisconnectMode(
+        BGraphicBufferProducer::DisconnectMode l) {
+    switch (l) {
+        case BGraphicBufferProducer::DisconnectMode::Api:
+            return HGraphicBufferProducer::DisconnectMode::API;
+        case BGraphicBufferProducer::DisconnectMode::AllLocal:
+            return HGraphicBufferProducer::DisconnectMode::ALL_LOCAL;
+    }
+    return HGraphicBufferProducer::DisconnectMode::API;
+}
+
+}  // namespace utils
+}  // namespace V1_0
+}  // namespace bufferqueue
+}  // namespace graphics
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_GRAPHICS_BUFFERQUEUE_V1_0_CONVERSION_H
@@ -30,6 +30,8 @@
 #include <utils/Vector.h>
 #include <stdint.h>
 
+#include <vector>
+
 /*
  * Additional private constants not defined in ndk/ui/input.h.
  */
@@ -58,6 +60,9 @@ enum {
      */
     AMOTION_EVENT_FLAG_WINDOW_IS_PARTIALLY_OBSCURED = 0x2,
 
+    /* Motion event samples are predicted positions, not ones reported by the device. */
+    AMOTION_EVENT_FLAG_PREDICTED = 0x20000000,
+
     /* Motion event is inconsistent with previously sent motion events. */
     AMOTION_EVENT_FLAG_TAINTED = 0x80000000,
 };
@@ -578,6 +583,11 @@ public:
             nsecs_t eventTime,
             const PointerCoords* pointerCoords);
 
+    // Reserves storage for sampleCount samples of pointerCount pointers.  Storage is kept
+    // when the event is initialized again, so an event that is reused only allocates when
+    // it holds more samples than it ever did before.
+    void reserveSamples(size_t sampleCount, size_t pointerCount);
+
     void offsetLocation(float xOffset, float yOffset);
 
     void scale(float scaleFactor);
@@ -598,11 +608,11 @@ public:
 
     // Low-level accessors.
     inline const PointerProperties* getPointerProperties() const {
-        return mPointerProperties.array();
+        return mPointerProperties.data();
     }
-    inline const nsecs_t* getSampleEventTimes() const { return mSampleEventTimes.array(); }
+    inline const nsecs_t* getSampleEventTimes() const { return mSampleEventTimes.data(); }
     inline const PointerCoords* getSamplePointerCoords() const {
-            return mSamplePointerCoords.array();
+            return mSamplePointerCoords.data();
     }
 
     static const char* getLabel(int32_t axis);
@@ -620,9 +630,10 @@ protected:
     float mXPrecision;
     float mYPrecision;
     nsecs_t mDownTime;
-    Vector<PointerProperties> mPointerProperties;
-    Vector<nsecs_t> mSampleEventTimes;
-    Vector<PointerCoords> mSamplePointerCoords;
+    // Not Vectors, which give up their storage when cleared.
+    std::vector<PointerProperties> mPointerProperties;
+    std::vector<nsecs_t> mSampleEventTimes;
+    std::vector<PointerCoords> mSamplePointerCoords;
 };
 
 /*
@@ -637,6 +648,12 @@ public:
 
     virtual KeyEvent* createKeyEvent() = 0;
     virtual MotionEvent* createMotionEvent() = 0;
+
+protected:
+    // Sample storage the factories below reserve in their motion events: a frame's worth
+    // of batched samples from a high rate touch screen or stylus, plus a resampled one.
+    static const size_t RESERVED_MOTION_SAMPLES = 16;
+    static const size_t RESERVED_MOTION_POINTERS = 2;
 };
 
 /*
@@ -645,7 +662,9 @@ public:
  */
 class PreallocatedInputEventFactory : public InputEventFactoryInterface {
 public:
-    PreallocatedInputEventFactory() { }
+    PreallocatedInputEventFactory() {
+        mMotionEvent.reserveSamples(RESERVED_MOTION_SAMPLES, RESERVED_MOTION_POINTERS);
+    }
     virtual ~PreallocatedInputEventFactory() { }
 
     virtual KeyEvent* createKeyEvent() { return & mKeyEvent; }
@@ -658,6 +677,8 @@ private:
 
 /*
  * An input event factory implementation that maintains a pool of input events.
+ * Recycled motion events keep their sample storage, so once the pool is warm consuming
+ * batched motion events does not allocate.
  */
 class PooledInputEventFactory : public InputEventFactoryInterface {
 public:
@@ -28,6 +28,7 @@
  */
 
 #include <input/Input.h>
+#include <input/TouchPredictor.h>
 #include <utils/Errors.h>
 #include <utils/Timers.h>
 #include <utils/RefBase.h>
@@ -35,6 +36,8 @@
 #include <utils/Vector.h>
 #include <utils/BitSet.h>
 
+#include <vector>
+
 namespace android {
 
 /*
@@ -48,6 +51,10 @@ struct InputMessage {
         TYPE_KEY = 1,
         TYPE_MOTION = 2,
         TYPE_FINISHED = 3,
+        // Used by InputChannel itself when it has a shared memory ring, never returned
+        // by receiveMessage().
+        TYPE_DOORBELL = 4,
+        TYPE_RING_SETUP = 5,
     };
 
     struct Header {
@@ -121,6 +128,15 @@ struct InputMessage {
                 return sizeof(Finished);
             }
         } finished;
+
+        // Sent along with the shared memory fd.
+        struct RingSetup {
+            uint32_t slotCount;
+
+            inline size_t size() const {
+                return sizeof(RingSetup);
+            }
+        } ringSetup;
     } __attribute__((aligned(8))) body;
 
     bool isValid(size_t actualSize) const;
@@ -133,6 +149,13 @@ struct InputMessage {
  *
  * Each endpoint has its own InputChannel object that specifies its file descriptor.
  *
+ * Optionally, messages go through a pair of single producer, single consumer rings in
+ * shared memory instead, and the socket only carries doorbells: a sender only rings when
+ * the receiver found its ring empty and is about to wait, so a receiver that is behind
+ * costs no system calls.  The server end sets the memory up and sends it over the socket
+ * ahead of any message, so the client end attaches to it on its first receiveMessage(),
+ * wherever the fd was passed to.
+ *
  * The input channel is closed when all references to it are released.
  */
 class InputChannel : public RefBase {
@@ -149,9 +172,19 @@ public:
     static status_t openInputChannelPair(const String8& name,
             sp<InputChannel>& outServerChannel, sp<InputChannel>& outClientChannel);
 
+    /* Same as above, with or without the shared memory rings; the variant above uses them
+     * when the property input.channel.shared_memory is set.
+     */
+    static status_t openInputChannelPair(const String8& name,
+            sp<InputChannel>& outServerChannel, sp<InputChannel>& outClientChannel,
+            bool useSharedMemory);
+
     inline String8 getName() const { return mName; }
     inline int getFd() const { return mFd; }
 
+    /* Returns true once this end uses the shared memory rings. */
+    inline bool isUsingSharedMemory() const { return mRing != NULL; }
+
     /* Sends a message to the other endpoint.
      *
      * If the channel is full then the message is guaranteed not to have been sent at all.
@@ -181,8 +214,19 @@ public:
     sp<InputChannel> dup() const;
 
 private:
+    class SharedRing;
+
     String8 mName;
     int mFd;
+
+    // The rings, shared with dup()s of this channel, and whether this is the server end,
+    // which writes ring 0 and reads ring 1.
+    sp<SharedRing> mRing;
+    bool mIsServer;
+
+    status_t sendSocketMessage(const InputMessage* msg, int fdToSend);
+    status_t receiveSocketMessage(InputMessage* msg, int* outFd);
+    status_t attachRing(const InputMessage* msg, int fd);
 };
 
 /*
@@ -340,10 +384,30 @@ public:
      */
     bool hasPendingBatch() const;
 
+    /* Predicts where the pointers of a motion event just returned by consume() are going
+     * next, up to the prediction horizon set by the property
+     * debug.input.prediction.horizon_ms, using the velocity tracker strategy named by
+     * debug.input.prediction.strategy.  The samples of outPrediction are flagged with
+     * AMOTION_EVENT_FLAG_PREDICTED and are never delivered by consume().
+     *
+     * Returns false if prediction is disabled, the event is not a move of a pointer, or
+     * there is not enough movement to predict from yet.
+     */
+    bool predictMotion(const MotionEvent* event, MotionEvent* outPrediction);
+
+    /* Returns how far off the predictions made for the gestures that ended so far were. */
+    inline const TouchPredictor::Accuracy& getPredictionAccuracy() const {
+        return mPredictionAccuracy;
+    }
+
 private:
     // True if touch resampling is enabled.
     const bool mResampleTouch;
 
+    // How far ahead predictMotion() predicts, or 0 if prediction is disabled.
+    const nsecs_t mPredictionHorizon;
+    const String8 mPredictionStrategy;
+
     // The input channel.
     sp<InputChannel> mChannel;
 
@@ -354,11 +418,15 @@ private:
     // call to consume and that still needs to be handled.
     bool mMsgDeferred;
 
-    // Batched motion events per device and source.
+    // Batched motion events per device and source.  These and the sequence chains below
+    // are std::vectors, which keep their storage when elements are removed, and the
+    // samples of removed batches are kept for the next batch, so that batching input at
+    // a steady rate does not allocate.
     struct Batch {
-        Vector<InputMessage> samples;
+        std::vector<InputMessage> samples;
     };
-    Vector<Batch> mBatches;
+    std::vector<Batch> mBatches;
+    std::vector<std::vector<InputMessage> > mSpareBatchSamples;
 
     // Touch state per device and source, only for sources of class pointer.
     struct History {
@@ -413,6 +481,16 @@ private:
     };
     Vector<TouchState> mTouchStates;
 
+    // Touch predictor per device and source while pointers are down, only for sources
+    // of class pointer and only if prediction is enabled.
+    struct Prediction {
+        int32_t deviceId;
+        int32_t source;
+        TouchPredictor* predictor;
+    };
+    Vector<Prediction> mPredictions;
+    TouchPredictor::Accuracy mPredictionAccuracy;
+
     // Chain of batched sequence numbers.  When multiple input messages are combined into
     // a batch, we append a record here that associates the last sequence number in the
     // batch with the previous one.  When the finished signal is sent, we traverse the
@@ -421,7 +499,7 @@ private:
         uint32_t seq;   // sequence number of batched input message
         uint32_t chain; // sequence number of previous batched input message
     };
-    Vector<SeqChain> mSeqChains;
+    std::vector<SeqChain> mSeqChains;
 
     status_t consumeBatch(InputEventFactoryInterface* factory,
             nsecs_t frameTime, uint32_t* outSeq, InputEvent** outEvent);
@@ -432,9 +510,13 @@ private:
     void rewriteMessage(const TouchState& state, InputMessage* msg);
     void resampleTouchState(nsecs_t frameTime, MotionEvent* event,
             const InputMessage *next);
+    void updatePrediction(const MotionEvent* event);
 
+    Batch& addBatch();
+    void removeBatch(size_t index);
     ssize_t findBatch(int32_t deviceId, int32_t source) const;
     ssize_t findTouchState(int32_t deviceId, int32_t source) const;
+    ssize_t findPrediction(int32_t deviceId, int32_t source) const;
 
     status_t sendUnchainedFinishedSignal(uint32_t seq, bool handled);
 
@@ -444,8 +526,11 @@ private:
     static bool canAddSample(const Batch& batch, const InputMessage* msg);
     static ssize_t findSampleNoLaterThan(const Batch& batch, nsecs_t time);
     static bool shouldResampleTool(int32_t toolType);
+    static void traceConsumeLatency(const InputEvent* event);
 
     static bool isTouchResamplingEnabled();
+    static nsecs_t getTouchPredictionHorizon();
+    static String8 getTouchPredictionStrategy();
 };
 
 } // namespace android
@@ -21,11 +21,13 @@
 
 #ifdef __ANDROID__
 #include <binder/IBinder.h>
+#include <input/KeyMapCache.h>
 #endif
 
 #include <input/Input.h>
 #include <utils/Errors.h>
 #include <utils/KeyedVector.h>
+#include <utils/Mutex.h>
 #include <utils/Tokenizer.h>
 #include <utils/String8.h>
 #include <utils/Unicode.h>
@@ -230,6 +232,18 @@ private:
     KeyedVector<int32_t, int32_t> mKeysByScanCode;
     KeyedVector<int32_t, int32_t> mKeysByUsageCode;
 
+    /* The key and meta state that findKey() returns for a character. */
+    struct CharacterKey {
+        int32_t keyCode;
+        int32_t metaState;
+    };
+
+    /* Reverse mapping from characters to keys, built the first time findKey() is called
+     * because most maps are never asked to generate key events. */
+    mutable Mutex mCharacterIndexLock;
+    mutable bool mCharacterIndexBuilt;
+    mutable KeyedVector<char16_t, CharacterKey> mCharacterIndex;
+
     KeyCharacterMap();
     KeyCharacterMap(const KeyCharacterMap& other);
 
@@ -239,9 +253,15 @@ private:
     static bool matchesMetaState(int32_t eventMetaState, int32_t behaviorMetaState);
 
     bool findKey(char16_t ch, int32_t* outKeyCode, int32_t* outMetaState) const;
+    const KeyedVector<char16_t, CharacterKey>& getCharacterIndex() const;
 
     static status_t load(Tokenizer* tokenizer, Format format, sp<KeyCharacterMap>* outMap);
 
+#ifdef __ANDROID__
+    status_t readCompiled(KeyMapCache::Reader* reader);
+    void writeCompiled(KeyMapCache::Writer* writer) const;
+#endif
+
     static void addKey(Vector<KeyEvent>& outEvents,
             int32_t deviceId, int32_t keyCode, int32_t metaState, bool down, nsecs_t time);
     static void addMetaKeys(Vector<KeyEvent>& outEvents,
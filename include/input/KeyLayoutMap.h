@@ -23,6 +23,10 @@
 #include <utils/Tokenizer.h>
 #include <utils/RefBase.h>
 
+#ifdef __ANDROID__
+#include <input/KeyMapCache.h>
+#endif
+
 namespace android {
 
 struct AxisInfo {
@@ -96,6 +100,11 @@ private:
 
     const Key* getKey(int32_t scanCode, int32_t usageCode) const;
 
+#ifdef __ANDROID__
+    status_t readCompiled(KeyMapCache::Reader* reader);
+    void writeCompiled(KeyMapCache::Writer* writer) const;
+#endif
+
     class Parser {
         KeyLayoutMap* mMap;
         Tokenizer* mTokenizer;
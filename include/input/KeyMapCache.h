@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LIBINPUT_KEY_MAP_CACHE_H
+#define _LIBINPUT_KEY_MAP_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/Errors.h>
+#include <utils/String8.h>
+#include <utils/Vector.h>
+
+namespace android {
+
+/*
+ * On disk cache of compiled key layout and key character maps, so that opening an input
+ * device does not parse its key map files again.
+ *
+ * A compiled map is a flat array of int32 values written by the map itself, after a
+ * header naming the source file with its size and modification time. A compiled map
+ * is only used while these still match the source; otherwise the source is parsed
+ * again and the compiled map replaced.
+ *
+ * The cache lives in the directory named by the property input.keymap_cache.dir,
+ * /data/system/keymap_cache by default. It is disabled if the property is empty.
+ */
+class KeyMapCache {
+public:
+    enum Kind {
+        KIND_KEY_LAYOUT = 1,
+        KIND_KEY_CHARACTER_MAP = 2,
+    };
+
+    /* Reads a compiled map, mapped from the cache file. */
+    class Reader {
+    public:
+        ~Reader();
+
+        /* Reads the next value. Returns false past the end of the map. */
+        bool readInt32(int32_t* outValue);
+
+        /* Reads a count of upcoming records of recordSize values each. Returns false
+         * if there are not that many values left. */
+        bool readCount(size_t recordSize, size_t* outCount);
+
+        inline bool isAtEnd() const { return mPosition == mCount; }
+
+    private:
+        friend class KeyMapCache;
+
+        Reader(void* mapping, size_t mappingSize, const int32_t* values, size_t count);
+
+        void* mMapping;
+        size_t mMappingSize;
+        const int32_t* mValues;
+        size_t mCount;
+        size_t mPosition;
+    };
+
+    /* Collects a compiled map to store in the cache. */
+    class Writer {
+    public:
+        inline void writeInt32(int32_t value) { mValues.push(value); }
+
+    private:
+        friend class KeyMapCache;
+
+        Vector<int32_t> mValues;
+    };
+
+    /* Opens the compiled map of a source file, if the cache has a current one.
+     * variant tells apart compiled maps of the same file parsed differently.
+     * Returns NAME_NOT_FOUND if there is none. */
+    static status_t open(const String8& sourcePath, Kind kind, int32_t variant,
+            Reader** outReader);
+
+    /* Stores the compiled map of a source file. Failures only cost the next load
+     * of the file a parse, so they are logged and otherwise ignored. */
+    static void store(const String8& sourcePath, Kind kind, int32_t variant,
+            const Writer& writer);
+
+private:
+    KeyMapCache();
+
+    static String8 getCacheDir();
+    static String8 getCachePath(const String8& cacheDir, const String8& sourcePath,
+            Kind kind, int32_t variant);
+};
+
+} // namespace android
+
+#endif // _LIBINPUT_KEY_MAP_CACHE_H
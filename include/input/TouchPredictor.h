@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LIBINPUT_TOUCH_PREDICTOR_H
+#define _LIBINPUT_TOUCH_PREDICTOR_H
+
+#include <input/Input.h>
+#include <input/VelocityTracker.h>
+#include <utils/BitSet.h>
+#include <utils/Timers.h>
+
+namespace android {
+
+/*
+ * Predicts where pointers are going a short time past their most recent movement, by
+ * extrapolating the estimator of a velocity tracker strategy, and keeps track of how far
+ * off the predictions turned out to be once the pointers got there.
+ */
+class TouchPredictor {
+public:
+    struct Accuracy {
+        // Number of predicted positions checked against the movement that followed.
+        uint32_t count;
+
+        // Sum and maximum of the distances between predicted and actual positions,
+        // in pixels.
+        float totalError;
+        float maxError;
+
+        inline void clear() {
+            count = 0;
+            totalError = 0;
+            maxError = 0;
+        }
+
+        void add(const Accuracy& other);
+
+        inline float getMeanError() const { return count ? totalError / count : 0; }
+    };
+
+    // Maximum number of samples in a prediction.
+    static const size_t MAX_PREDICTED_SAMPLES = 8;
+
+    // Creates a predictor using the specified velocity tracker strategy.
+    // If strategy is NULL, uses the default strategy, "lsq2".
+    explicit TouchPredictor(const char* strategy = NULL);
+
+    ~TouchPredictor();
+
+    // Resets the movement history and pending predictions, but not the accuracy.
+    void clear();
+
+    // Adds movement information for all pointers in a MotionEvent, including historical
+    // samples, and checks the predictions made so far against it.
+    void addMovement(const MotionEvent* event);
+
+    // Gets the predicted position of the specified pointer id at the specified time.
+    // Returns false if there is no movement information for the pointer.
+    bool getPosition(uint32_t id, nsecs_t time, VelocityTracker::Position* outPosition) const;
+
+    // Initializes outPrediction with the predicted positions of all pointers of the event,
+    // which must be the event last passed to addMovement(), at intervals of the device's
+    // sample rate up to horizon past the event time.  The prediction is a move event
+    // flagged with AMOTION_EVENT_FLAG_PREDICTED.
+    // Returns false if the event is not a move or some pointer has no estimate yet.
+    bool predict(const MotionEvent* event, nsecs_t horizon, MotionEvent* outPrediction);
+
+    inline const Accuracy& getAccuracy() const { return mAccuracy; }
+
+    inline void resetAccuracy() { mAccuracy.clear(); }
+
+private:
+    static const char* DEFAULT_STRATEGY;
+
+    struct Movement {
+        nsecs_t eventTime;
+        BitSet32 idBits;
+        VelocityTracker::Position positions[MAX_POINTERS];
+
+        inline const VelocityTracker::Position& getPosition(uint32_t id) const {
+            return positions[idBits.getIndexOfBit(id)];
+        }
+    };
+
+    VelocityTracker mVelocityTracker;
+    Movement mLastMovement;
+    nsecs_t mSampleInterval;
+
+    // Predictions made since mLastMovement, in order by time.
+    size_t mPredictionCount;
+    Movement mPredictions[MAX_PREDICTED_SAMPLES];
+
+    Accuracy mAccuracy;
+
+    void addMovement(const Movement& movement);
+    void checkPredictions(const Movement& movement);
+
+    static void initializeMovement(const MotionEvent* event, ssize_t historicalIndex,
+            Movement* outMovement);
+};
+
+} // namespace android
+
+#endif // _LIBINPUT_TOUCH_PREDICTOR_H
@@ -154,7 +154,10 @@ public:
     };
 
     // Degree must be no greater than Estimator::MAX_DEGREE.
-    LeastSquaresVelocityTrackerStrategy(uint32_t degree, Weighting weighting = WEIGHTING_NONE);
+    // Unweighted 2nd degree fits keep running sums of their normal equations as movements
+    // are added, so that estimates take constant time, unless incremental is false.
+    LeastSquaresVelocityTrackerStrategy(uint32_t degree, Weighting weighting = WEIGHTING_NONE,
+            bool incremental = true);
     virtual ~LeastSquaresVelocityTrackerStrategy();
 
     virtual void clear();
@@ -182,12 +185,36 @@ private:
         }
     };
 
+    // Sums over the movements of one pointer that the fit includes, with time in seconds
+    // relative to the newest movement: of t^k for k = 0..4, of t^k * x and t^k * y for
+    // k = 0..2, and of x^2 and y^2.
+    struct Sums {
+        uint32_t count; // number of movements, 0 if the pointer is not in the newest one
+        uint32_t updateCount; // since the sums were last computed from scratch
+        double t[5];
+        double tx[3], ty[3];
+        double xx, yy;
+
+        void add(double time, const VelocityTracker::Position& position, double sign);
+        void shift(double delta);
+    };
+
     float chooseWeight(uint32_t index) const;
 
+    bool getEstimatorFromSums(uint32_t id, VelocityTracker::Estimator* outEstimator) const;
+    void updateSums(BitSet32 idBits);
+    void computeSums(uint32_t id);
+    uint32_t oldestIndex(uint32_t count) const;
+
     const uint32_t mDegree;
     const Weighting mWeighting;
+    const bool mIncremental;
     uint32_t mIndex;
     Movement mMovements[HISTORY_SIZE];
+
+    // Only kept if mIncremental.
+    nsecs_t mSumsTime;
+    Sums mSums[MAX_POINTER_ID + 1];
 };
 
 
@@ -264,6 +291,42 @@ private:
     Movement mMovements[HISTORY_SIZE];
 };
 
+
+/*
+ * Velocity tracker algorithm based on a Kalman filter with a constant velocity model,
+ * one per axis.  Changes in velocity are modeled as noise.
+ */
+class KalmanVelocityTrackerStrategy : public VelocityTrackerStrategy {
+public:
+    KalmanVelocityTrackerStrategy();
+    virtual ~KalmanVelocityTrackerStrategy();
+
+    virtual void clear();
+    virtual void clearPointers(BitSet32 idBits);
+    virtual void addMovement(nsecs_t eventTime, BitSet32 idBits,
+            const VelocityTracker::Position* positions);
+    virtual bool getEstimator(uint32_t id, VelocityTracker::Estimator* outEstimator) const;
+
+private:
+    // Position and velocity along one axis, and their covariance.
+    struct Axis {
+        float pos, vel;
+        float p00, p01, p11;
+
+        void init(float z);
+        void update(float dt, float z);
+    };
+
+    // Current state estimate for a particular pointer.
+    struct State {
+        nsecs_t updateTime;
+        Axis x, y;
+    };
+
+    BitSet32 mPointerIdBits;
+    State mPointerState[MAX_POINTER_ID + 1];
+};
+
 } // namespace android
 
 #endif // _LIBINPUT_VELOCITY_TRACKER_H
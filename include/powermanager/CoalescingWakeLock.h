@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_COALESCINGWAKELOCK_H
+#define ANDROID_COALESCINGWAKELOCK_H
+
+#include <binder/IBinder.h>
+#include <powermanager/IPowerManager.h>
+#include <utils/String16.h>
+#include <utils/Timers.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace android {
+
+// ----------------------------------------------------------------------------
+
+/*
+ * A partial wake lock held through IPowerManager, for native services that
+ * acquire and release it at a high rate. Each acquire or release is otherwise
+ * a transaction to the system server.
+ *
+ * release() doesn't let go of the wake lock right away: it is held for
+ * releaseDelay longer, and an acquire() within that window cancels the release
+ * so that neither is sent. Transactions that are sent are oneway. The cost is
+ * that the device stays awake for up to releaseDelay after the last release().
+ *
+ * acquire() and release() don't nest, and may be called from any thread.
+ */
+class CoalescingWakeLock {
+public:
+    static constexpr nsecs_t DEFAULT_RELEASE_DELAY = 100000000; // 100ms
+
+    CoalescingWakeLock(const sp<IPowerManager>& powerManager, const String16& tag,
+            const String16& packageName, nsecs_t releaseDelay = DEFAULT_RELEASE_DELAY);
+
+    // Releases the wake lock right away if it is held
+    ~CoalescingWakeLock();
+
+    CoalescingWakeLock(const CoalescingWakeLock&) = delete;
+    CoalescingWakeLock& operator=(const CoalescingWakeLock&) = delete;
+
+    void acquire();
+    void release();
+
+    // true between acquire() and the moment the release is sent
+    bool isHeld() const;
+
+private:
+    void releaseLoop();
+
+    const sp<IPowerManager> mPowerManager;
+    const sp<IBinder> mToken;
+    const String16 mTag;
+    const String16 mPackageName;
+    const nsecs_t mReleaseDelay;
+
+    mutable std::mutex mMutex;
+    std::condition_variable mCondition;
+    // protected by mMutex
+    bool mHeld;
+    // when the pending release is due, or -1
+    nsecs_t mReleaseTime;
+    bool mExit;
+
+    // created on the first release()
+    std::thread mReleaseThread;
+};
+
+// ----------------------------------------------------------------------------
+
+}; // namespace android
+
+#endif // ANDROID_COALESCINGWAKELOCK_H
@@ -0,0 +1,178 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_UI_PRIVATE_REGION_SIMD_H
+#define ANDROID_UI_PRIVATE_REGION_SIMD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+
+#include <ui/Rect.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define REGION_SIMD_SSE2 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define REGION_SIMD_NEON 1
+#endif
+
+namespace android {
+namespace region_simd {
+// ----------------------------------------------------------------------------
+
+/*
+ * Helpers working on the sorted rect list of a Region. A Rect is four
+ * int32_t (left, top, right, bottom), so one rect fits one 128-bit vector.
+ *
+ * Every helper has a scalar version, which is also what is used when neither
+ * SSE2 nor NEON is available; they are kept side by side so that
+ * libui_region_benchmark can compare them.
+ */
+
+// Returns the first rect of the band that spans y, or end. Bands don't
+// overlap and are sorted, so bottoms never decrease along the list.
+inline const Rect* findBand(const Rect* begin, const Rect* end, int32_t y) {
+    return std::upper_bound(begin, end, y,
+            [](int32_t value, const Rect& rect) { return value < rect.bottom; });
+}
+
+inline bool containsScalar(const Rect* begin, const Rect* end, int32_t x, int32_t y) {
+    for (const Rect* cur = begin; cur != end; cur++) {
+        if (y >= cur->top && y < cur->bottom && x >= cur->left && x < cur->right) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Same as containsScalar, over the band spanning y only, testing each rect
+// with a single vector compare.
+inline bool contains(const Rect* begin, const Rect* end, int32_t x, int32_t y) {
+    const Rect* cur = findBand(begin, end, y);
+    if (cur == end || cur->top > y) {
+        return false;
+    }
+    const int32_t top = cur->top;
+#if REGION_SIMD_SSE2
+    // (left, top, right, bottom) > (x, y, x, y) must be (no, no, yes, yes)
+    const __m128i point = _mm_setr_epi32(x, y, x, y);
+    for (; cur != end && cur->top == top; cur++) {
+        const __m128i rect = _mm_loadu_si128(
+                static_cast<const __m128i*>(static_cast<const void*>(cur)));
+        if (_mm_movemask_epi8(_mm_cmpgt_epi32(rect, point)) == 0xFF00) {
+            return true;
+        }
+    }
+    return false;
+#elif REGION_SIMD_NEON
+    const int32_t lanes[4] = { x, y, x, y };
+    const int32x4_t point = vld1q_s32(lanes);
+    const uint32_t expectedLanes[4] = { 0, 0, UINT32_MAX, UINT32_MAX };
+    const uint32x4_t expected = vld1q_u32(expectedLanes);
+    for (; cur != end && cur->top == top; cur++) {
+        const uint32x4_t inside = vceqq_u32(vcgtq_s32(vld1q_s32(&cur->left), point),
+                expected);
+        if (vget_lane_u64(vreinterpret_u64_u16(vmovn_u32(inside)), 0) == UINT64_MAX) {
+            return true;
+        }
+    }
+    return false;
+#else
+    const Rect* bandEnd = cur;
+    while (bandEnd != end && bandEnd->top == top) {
+        bandEnd++;
+    }
+    return containsScalar(cur, bandEnd, x, y);
+#endif
+}
+
+// Returns whether lhs[i] and rhs[i] have the same left and right edges for
+// every i < count. This is the rasterizer's test for coalescing a band with
+// the one above it.
+inline bool sameHorizontalEdgesScalar(const Rect* lhs, const Rect* rhs, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (lhs[i].left != rhs[i].left || lhs[i].right != rhs[i].right) {
+            return false;
+        }
+    }
+    return true;
+}
+
+inline bool sameHorizontalEdges(const Rect* lhs, const Rect* rhs, size_t count) {
+#if REGION_SIMD_SSE2
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        const __m128i* l = static_cast<const __m128i*>(static_cast<const void*>(lhs + i));
+        const __m128i* r = static_cast<const __m128i*>(static_cast<const void*>(rhs + i));
+        const __m128i eq0 = _mm_cmpeq_epi32(_mm_loadu_si128(l), _mm_loadu_si128(r));
+        const __m128i eq1 = _mm_cmpeq_epi32(_mm_loadu_si128(l + 1), _mm_loadu_si128(r + 1));
+        // lanes 0 and 2 of each rect are left and right
+        const int mask = _mm_movemask_epi8(_mm_packs_epi32(eq0, eq1));
+        if ((mask & 0x3333) != 0x3333) {
+            return false;
+        }
+    }
+    return sameHorizontalEdgesScalar(lhs + i, rhs + i, count - i);
+#elif REGION_SIMD_NEON
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        // deinterleave so that val[0] holds the lefts and val[2] the rights
+        const int32x2x4_t l = vld4_s32(&lhs[i].left);
+        const int32x2x4_t r = vld4_s32(&rhs[i].left);
+        const uint32x2_t eq = vand_u32(vceq_s32(l.val[0], r.val[0]),
+                vceq_s32(l.val[2], r.val[2]));
+        if (vget_lane_u64(vreinterpret_u64_u32(eq), 0) != UINT64_MAX) {
+            return false;
+        }
+    }
+    return sameHorizontalEdgesScalar(lhs + i, rhs + i, count - i);
+#else
+    return sameHorizontalEdgesScalar(lhs, rhs, count);
+#endif
+}
+
+inline void offsetScalar(Rect* rects, size_t count, int32_t dx, int32_t dy) {
+    for (size_t i = 0; i < count; i++) {
+        rects[i].offsetBy(dx, dy);
+    }
+}
+
+inline void offset(Rect* rects, size_t count, int32_t dx, int32_t dy) {
+#if REGION_SIMD_SSE2
+    const __m128i delta = _mm_setr_epi32(dx, dy, dx, dy);
+    for (size_t i = 0; i < count; i++) {
+        __m128i* rect = static_cast<__m128i*>(static_cast<void*>(rects + i));
+        _mm_storeu_si128(rect, _mm_add_epi32(_mm_loadu_si128(rect), delta));
+    }
+#elif REGION_SIMD_NEON
+    const int32_t lanes[4] = { dx, dy, dx, dy };
+    const int32x4_t delta = vld1q_s32(lanes);
+    for (size_t i = 0; i < count; i++) {
+        vst1q_s32(&rects[i].left, vaddq_s32(vld1q_s32(&rects[i].left), delta));
+    }
+#else
+    offsetScalar(rects, count, dx, dy);
+#endif
+}
+
+// ----------------------------------------------------------------------------
+}; // namespace region_simd
+}; // namespace android
+
+#endif // ANDROID_UI_PRIVATE_REGION_SIMD_H
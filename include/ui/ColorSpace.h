@@ -22,6 +22,7 @@
 #include <functional>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <math/mat3.h>
 #include <math/scalar.h>
@@ -275,8 +276,52 @@ private:
     float2 mWhitePoint;
 };
 
+/**
+ * A transfer function sampled over the domain [0..1], evaluated by linear
+ * interpolation between the samples. The samples are spaced quadratically
+ * (sample i is at (i / (size - 1))^2) so that the steep start of the
+ * encoding curves gets more of them. Values outside of the domain are
+ * passed to the function itself.
+ */
+class TransferLUT {
+public:
+    static constexpr uint32_t DEFAULT_SIZE = 4096;
+
+    // size is clamped to [2..65536]
+    explicit TransferLUT(ColorSpace::transfer_function function,
+            uint32_t size = DEFAULT_SIZE) noexcept;
+
+    float operator()(float x) const noexcept {
+        // written so that NaNs take the slow path too
+        if (!(x >= 0.0f && x <= 1.0f)) {
+            return mFunction(x);
+        }
+        const float t = std::sqrt(x) * mScale;
+        const uint32_t i = static_cast<uint32_t>(t);
+        if (i >= mLast) {
+            return mTable[mLast];
+        }
+        const float a = mTable[i];
+        return a + (t - static_cast<float>(i)) * (mTable[i + 1] - a);
+    }
+
+    float3 operator()(const float3& v) const noexcept {
+        return float3{(*this)(v.r), (*this)(v.g), (*this)(v.b)};
+    }
+
+    uint32_t getSize() const noexcept { return mLast + 1; }
+
+private:
+    ColorSpace::transfer_function mFunction;
+    std::vector<float> mTable;
+    uint32_t mLast;
+    float mScale;
+};
+
 class ColorSpaceConnector {
 public:
+    // Also samples the source's EOTF and the destination's OETF, for the
+    // batched transform()
     ColorSpaceConnector(const ColorSpace& src, const ColorSpace& dst) noexcept;
 
     constexpr const ColorSpace& getSource() const noexcept { return mSource; }
@@ -294,10 +339,20 @@ public:
         return apply(mTransform * linear, mDestination.getClamper());
     }
 
+    /**
+     * Converts count colors, like transform() does for each of them, but
+     * looks the transfer functions up in TransferLUTs. The results differ
+     * from transform() by less than 1e-4 for the color spaces defined here.
+     * in and out may point to the same array.
+     */
+    void transform(const float3* in, float3* out, size_t count) const noexcept;
+
 private:
     ColorSpace mSource;
     ColorSpace mDestination;
     mat3 mTransform;
+    TransferLUT mSourceEOTF;
+    TransferLUT mDestinationOETF;
 };
 
 }; // namespace android
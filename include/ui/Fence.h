@@ -97,6 +97,10 @@ public:
     // be returned and errno will indicate the problem.
     int dup() const;
 
+    // Return the fence file descriptor without duplicating it. It remains
+    // owned by this Fence and is only valid for as long as the Fence is.
+    int get() const { return mFenceFd; }
+
     // getSignalTime returns the system monotonic clock time at which the
     // fence transitioned to the signaled state.  If the fence is not signaled
     // then SIGNAL_TIME_PENDING is returned.  If the fence is invalid or if an
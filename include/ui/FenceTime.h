@@ -21,10 +21,13 @@
 #include <utils/Flattenable.h>
 #include <utils/Timers.h>
 
+#include <poll.h>
+
 #include <atomic>
+#include <deque>
 #include <mutex>
-#include <queue>
 #include <unordered_map>
+#include <vector>
 
 namespace android {
 
@@ -159,12 +162,46 @@ class FenceTimeline {
 public:
     static constexpr size_t MAX_ENTRIES = 64;
 
+    // Updates the signal times of several timelines together. All of their
+    // pending fences are checked with a single poll(), and only the ones
+    // that signaled, with no pending fence before them on their timeline,
+    // are queried for their timestamp. Without it, every timeline costs a
+    // sync_fence_info() call for its oldest pending fence.
+    //
+    // Keep one around to reuse its memory. Not thread safe.
+    class Batch {
+    public:
+        void add(FenceTimeline* timeline);
+
+        // Updates and then removes every timeline added since the last call
+        void updateSignalTimes();
+
+    private:
+        struct Entry {
+            std::shared_ptr<FenceTime> fenceTime;
+            sp<Fence> fence;
+            // index in mPollFds, or -1 if the fence has no file descriptor
+            ssize_t pollIndex;
+        };
+
+        std::vector<FenceTimeline*> mTimelines;
+        // the pending fences of mTimelines, oldest first, one timeline
+        // after the other
+        std::vector<Entry> mEntries;
+        std::vector<size_t> mEntryCounts;
+        std::vector<struct pollfd> mPollFds;
+    };
+
     void push(const std::shared_ptr<FenceTime>& fence);
     void updateSignalTimes();
 
 private:
+    // Pops the fences nobody references anymore or whose signal time is
+    // already known, without querying any fence.
+    void popResolvedLocked();
+
     mutable std::mutex mMutex;
-    std::queue<std::weak_ptr<FenceTime>> mQueue;
+    std::deque<std::weak_ptr<FenceTime>> mQueue;
 };
 
 // Used by test code to create or get FenceTimes for a given Fence.
@@ -19,9 +19,20 @@
 #define ANDROID_BUFFER_ALLOCATOR_H
 
 #include <stdint.h>
-
+#include <sys/types.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <list>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include <cutils/native_handle.h>
 
@@ -33,6 +44,7 @@
 #include <utils/KeyedVector.h>
 #include <utils/Mutex.h>
 #include <utils/Singleton.h>
+#include <utils/Timers.h>
 
 namespace android {
 
@@ -48,14 +60,72 @@ class GraphicBufferAllocator : public Singleton<GraphicBufferAllocator>
 public:
     static inline GraphicBufferAllocator& get() { return getInstance(); }
 
+    struct AllocationRequest {
+        uint32_t width;
+        uint32_t height;
+        PixelFormat format;
+        uint32_t layerCount;
+        uint64_t usage;
+        std::string requestorName;
+    };
+
+    struct AllocationResult {
+        status_t status = NO_INIT;
+        buffer_handle_t handle = nullptr;
+        uint32_t stride = 0;
+    };
+
+    // Prefetched buffers that are not claimed within this delay are freed
+    static constexpr nsecs_t PREFETCH_TIMEOUT = ms2ns(1000);
+    // Upper bound on the number of prefetched buffers waiting to be claimed
+    static constexpr size_t MAX_PREFETCHED = 8;
+
+    // If buffers matching the request were prefetched, hands out one of
+    // them, waiting for it if it is still being allocated. Otherwise
+    // allocates from the HAL.
     status_t allocate(uint32_t w, uint32_t h, PixelFormat format,
             uint32_t layerCount, uint64_t usage,
             buffer_handle_t* handle, uint32_t* stride, uint64_t graphicBufferId,
             std::string requestorName);
 
+    // Allocates on one of the allocator's worker threads instead of
+    // blocking the caller. The handle of a successful result must be freed
+    // with free(), like the ones from allocate().
+    std::future<AllocationResult> allocateAsync(AllocationRequest request);
+
+    // Hints that count buffers matching request are about to be allocated.
+    // They are allocated in parallel in the background, for the next
+    // matching allocate() calls to claim.
+    void prefetch(const AllocationRequest& request, size_t count);
+
     status_t free(buffer_handle_t handle);
 
+    // Allocations made by the current thread while an instance is alive are
+    // charged to uid instead of the calling process, e.g. the buffers
+    // SurfaceFlinger allocates on behalf of an app. Asynchronous and
+    // prefetched allocations are charged to the uid current when they were
+    // requested.
+    class ScopedUidAttribution {
+    public:
+        explicit ScopedUidAttribution(uid_t uid);
+        ~ScopedUidAttribution();
+    private:
+        ScopedUidAttribution(const ScopedUidAttribution&) = delete;
+        ScopedUidAttribution& operator=(const ScopedUidAttribution&) = delete;
+        const uid_t mPreviousUid;
+    };
+
+    // Caps the bytes that can be allocated for uid, allocations that would
+    // go over it fail with NO_MEMORY. A budget of 0 means no limit.
+    void setUidBudget(uid_t uid, size_t bytes);
+    // Budget of the app uids that have none of their own, 0 (the default)
+    // means no limit. System uids are never capped by it.
+    void setDefaultUidBudget(size_t bytes);
+    // Returns the bytes currently allocated for uid
+    size_t getUidUsage(uid_t uid) const;
+
     void dump(String8& res) const;
+    void dumpUidUsage(String8& res) const;
     static void dumpToSystemLog();
 
 private:
@@ -67,18 +137,82 @@ private:
         uint32_t layerCount;
         uint64_t usage;
         size_t size;
+        uid_t uid;
         std::string requestorName;
     };
 
-    static Mutex sLock;
-    static KeyedVector<buffer_handle_t, alloc_rec_t> sAllocList;
+    struct Prefetched {
+        AllocationRequest request;
+        uid_t uid;
+        std::shared_future<AllocationResult> result;
+        nsecs_t time;
+    };
+
+    // The records of the live allocations are spread over shards, each with
+    // its own lock, so that threads allocating and freeing concurrently
+    // rarely contend.
+    struct Shard {
+        mutable std::mutex lock;
+        std::unordered_map<buffer_handle_t, alloc_rec_t> records;
+    };
+
+    struct UidUsage {
+        size_t bytes = 0;
+        size_t count = 0;
+        size_t budget = 0;
+        bool hasBudget = false;
+    };
+
+    static const size_t NUM_WORKERS = 2;
+    static const size_t NUM_SHARDS = 16;
+    static const uid_t NO_UID = static_cast<uid_t>(-1);
+
+    static Shard sShards[NUM_SHARDS];
+    static std::atomic<size_t> sTotalBytes;
+    static std::atomic<size_t> sTotalCount;
+    static thread_local uid_t sAttributedUid;
+
+    static Shard& shardFor(buffer_handle_t handle);
+    static uid_t currentUid();
 
     friend class Singleton<GraphicBufferAllocator>;
     GraphicBufferAllocator();
     ~GraphicBufferAllocator();
 
+    // Allocates from the HAL and charges uid, request must be normalized
+    AllocationResult allocateFromHal(const AllocationRequest& request, uid_t uid);
+    // Charges size bytes to uid, fails if that goes over its budget
+    bool chargeUid(uid_t uid, size_t size);
+    void unchargeUid(uid_t uid, size_t size);
+    static void normalize(AllocationRequest* request);
+    static bool matches(const AllocationRequest& lhs, const AllocationRequest& rhs);
+
+    // Takes a prefetched buffer matching request, if there is one
+    bool claimPrefetched(const AllocationRequest& request, uid_t uid,
+            AllocationResult* outResult);
+    // Removes the expired prefetched buffers, which the caller must free
+    void takeExpiredPrefetchedLocked(nsecs_t now,
+            std::vector<std::shared_future<AllocationResult>>* outExpired);
+    void freePrefetched(const std::vector<std::shared_future<AllocationResult>>& results);
+
+    void enqueueWork(std::function<void()> work);
+    void workerLoop();
+
     GraphicBufferMapper& mMapper;
     const std::unique_ptr<const Gralloc2::Allocator> mAllocator;
+
+    mutable std::mutex mPrefetchLock;
+    std::list<Prefetched> mPrefetched;
+
+    std::mutex mWorkLock;
+    std::condition_variable mWorkCondition;
+    std::deque<std::function<void()>> mWork;
+    std::vector<std::thread> mWorkers;
+    bool mStopping = false;
+
+    mutable std::mutex mUidLock;
+    std::unordered_map<uid_t, UidUsage> mUidUsage;
+    size_t mDefaultUidBudget = 0;
 };
 
 // ---------------------------------------------------------------------------
@@ -21,6 +21,10 @@
 #include <sys/types.h>
 
 #include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <utils/Singleton.h>
 
@@ -50,6 +54,22 @@ public:
     status_t importBuffer(buffer_handle_t rawHandle,
             buffer_handle_t* outHandle);
 
+    // Same as above, for a buffer known by its GraphicBuffer id. Importing
+    // a buffer that is still imported under the same id, with the same
+    // handle ints and file descriptors referring to the same files, returns
+    // the existing handle instead of importing it again. Each successful import must
+    // still be matched by a freeBuffer, the handle is released when the
+    // last one is. An id of 0 disables the caching.
+    //
+    // Users of a shared handle must not lock it concurrently.
+    status_t importBuffer(uint64_t bufferId, buffer_handle_t rawHandle,
+            buffer_handle_t* outHandle);
+
+    // Imports count buffers as above, taking the cache lock once for all of
+    // them. On error, none of the buffers are imported.
+    status_t importBuffers(size_t count, const uint64_t* bufferIds,
+            const buffer_handle_t* rawHandles, buffer_handle_t* outHandles);
+
     status_t freeBuffer(buffer_handle_t handle);
 
     status_t lock(buffer_handle_t handle,
@@ -83,7 +103,41 @@ private:
 
     GraphicBufferMapper();
 
+    // What a raw handle is compared on: the files behind its fds and its
+    // ints, to tell a different buffer reusing a stale id apart
+    struct Identity {
+        std::vector<std::pair<dev_t, ino_t>> files;
+        std::vector<int> ints;
+
+        bool operator==(const Identity& rhs) const {
+            return files == rhs.files && ints == rhs.ints;
+        }
+        bool operator!=(const Identity& rhs) const { return !(*this == rhs); }
+    };
+
+    struct ImportedBuffer {
+        buffer_handle_t handle;
+        uint32_t refCount;
+        Identity identity;
+    };
+
+    static bool getIdentity(buffer_handle_t rawHandle, Identity* outIdentity);
+
+    // Returns the handle imported for bufferId with one more reference, or
+    // nullptr if there is none for that identity.
+    buffer_handle_t acquireCachedLocked(uint64_t bufferId,
+            const Identity& identity);
+
+    // Imports rawHandle from the HAL and caches it. If another thread
+    // imported the same buffer meanwhile, its handle is used instead.
+    status_t importAndCache(uint64_t bufferId, buffer_handle_t rawHandle,
+            Identity&& identity, buffer_handle_t* outHandle);
+
     const std::unique_ptr<const Gralloc2::Mapper> mMapper;
+
+    std::mutex mImportLock;
+    std::unordered_map<uint64_t, ImportedBuffer> mImportsById;
+    std::unordered_map<buffer_handle_t, uint64_t> mIdsByHandle;
 };
 
 // ---------------------------------------------------------------------------
@@ -17,8 +17,11 @@
 #ifndef ANDROID_UI_GRAPHICS_ENV_H
 #define ANDROID_UI_GRAPHICS_ENV_H 1
 
+#include <atomic>
 #include <string>
 
+#include <stdint.h>
+
 struct android_namespace_t;
 
 namespace android {
@@ -35,10 +38,36 @@ public:
     void setDriverPath(const std::string path);
     android_namespace_t* getDriverNamespace();
 
+    // GPU startup stats of this process, which libgui reports to the gpu
+    // service. The drivers are loaded by libEGL and libvulkan, which can't
+    // talk to the service themselves.
+    enum class Api {
+        GL,
+        Vulkan,
+    };
+
+    struct GpuStats {
+        // time spent loading the driver, or -1 if it wasn't loaded
+        int64_t glDriverLoadTimeNs = -1;
+        int64_t vkDriverLoadTimeNs = -1;
+        // lookups in the EGL blob cache, i.e. shaders found and not found
+        uint64_t shaderCacheHits = 0;
+        uint64_t shaderCacheMisses = 0;
+    };
+
+    void setDriverLoadTime(Api api, int64_t loadTimeNs);
+    void recordShaderCacheLookup(bool hit);
+    GpuStats getGpuStats() const;
+
 private:
     GraphicsEnv() = default;
     std::string mDriverPath;
     android_namespace_t* mDriverNamespace = nullptr;
+
+    std::atomic<int64_t> mGlDriverLoadTime{-1};
+    std::atomic<int64_t> mVkDriverLoadTime{-1};
+    std::atomic<uint64_t> mShaderCacheHits{0};
+    std::atomic<uint64_t> mShaderCacheMisses{0};
 };
 
 } // namespace android
@@ -20,6 +20,8 @@
 #include <stdint.h>
 #include <sys/types.h>
 
+#include <type_traits>
+
 #include <utils/Vector.h>
 
 #include <ui/Rect.h>
@@ -36,14 +38,18 @@ class Region : public LightFlattenable<Region>
 public:
     static const Region INVALID_REGION;
 
+    class Scratch;
+
                         Region();
                         Region(const Region& rhs);
+                        Region(Region&& rhs);
     explicit            Region(const Rect& rhs);
                         ~Region();
 
     static  Region      createTJunctionFreeRegion(const Region& r);
 
         Region& operator = (const Region& rhs);
+        Region& operator = (Region&& rhs);
 
     inline  bool        isEmpty() const     { return getBounds().isEmpty(); }
     inline  bool        isRect() const      { return mStorage.size() == 1; }
@@ -73,6 +79,13 @@ public:
             Region&     andSelf(const Region& rhs);
             Region&     subtractSelf(const Region& rhs);
 
+            // same as above, but the intermediate results live in scratch
+            // instead of temporaries: once scratch and this region have
+            // grown to the working set, these never allocate.
+            Region&     orSelf(const Region& rhs, Scratch& scratch);
+            Region&     andSelf(const Region& rhs, Scratch& scratch);
+            Region&     subtractSelf(const Region& rhs, Scratch& scratch);
+
             // boolean operators
     const   Region      merge(const Rect& rhs) const;
     const   Region      mergeExclusive(const Rect& rhs) const;
@@ -113,7 +126,9 @@ public:
     inline  Region&     operator += (const Point& pt);
 
 
-    // returns true if the regions share the same underlying storage
+    // returns true if the regions are stored as the same list of
+    // rectangles. Equal regions with a different decomposition are not
+    // detected.
     bool isTriviallyEqual(const Region& region) const;
 
 
@@ -147,15 +162,72 @@ private:
     class rasterizer;
     friend class rasterizer;
 
+    // Array of Rects that keeps up to INLINE_CAPACITY of them inside the
+    // object and only goes to the heap beyond that. Unlike Vector, clearing
+    // or assigning keeps the capacity, so a Region that is reused never
+    // allocates once it is large enough.
+    class Storage {
+    public:
+        static const size_t INLINE_CAPACITY = 5;
+
+        inline Storage() : mArray(inlineArray()), mSize(0), mCapacity(INLINE_CAPACITY) { }
+        Storage(const Storage& rhs);
+        Storage(Storage&& rhs);
+        ~Storage();
+
+        Storage& operator = (const Storage& rhs);
+        Storage& operator = (Storage&& rhs);
+
+        inline size_t size() const { return mSize; }
+        inline bool isInline() const { return mArray == inlineArray(); }
+        inline const Rect* array() const { return mArray; }
+        inline Rect* editArray() { return mArray; }
+        inline const Rect* begin() const { return mArray; }
+        inline const Rect* end() const { return mArray + mSize; }
+        inline const Rect& operator[](size_t index) const { return mArray[index]; }
+        inline Rect& operator[](size_t index) { return mArray[index]; }
+        inline const Rect& itemAt(size_t index) const { return mArray[index]; }
+        inline const Rect& top() const { return mArray[mSize - 1]; }
+
+        // keeps the capacity
+        inline void clear() { mSize = 0; }
+
+        inline void add(const Rect& rect) {
+            if (mSize == mCapacity) {
+                grow(mSize + 1);
+            }
+            mArray[mSize++] = rect;
+        }
+        inline void push_back(const Rect& rect) { add(rect); }
+
+        void append(const Storage& rhs);
+        void insertAt(const Rect& rect, size_t index);
+
+    private:
+        inline Rect* inlineArray() { return reinterpret_cast<Rect*>(&mInline); }
+        inline const Rect* inlineArray() const {
+            return reinterpret_cast<const Rect*>(&mInline);
+        }
+        void grow(size_t minCapacity);
+
+        Rect* mArray;
+        size_t mSize;
+        size_t mCapacity;
+        std::aligned_storage<sizeof(Rect) * INLINE_CAPACITY, alignof(Rect)>::type mInline;
+    };
+
     Region& operationSelf(const Rect& r, uint32_t op);
     Region& operationSelf(const Region& r, uint32_t op);
     Region& operationSelf(const Region& r, int dx, int dy, uint32_t op);
+    Region& operationSelf(const Region& r, uint32_t op, Scratch& scratch);
     const Region operation(const Rect& rhs, uint32_t op) const;
     const Region operation(const Region& rhs, uint32_t op) const;
     const Region operation(const Region& rhs, int dx, int dy, uint32_t op) const;
 
+    // span is where the rasterizer builds each band, or null to use its own
     static void boolean_operation(uint32_t op, Region& dst,
-            const Region& lhs, const Region& rhs, int dx, int dy);
+            const Region& lhs, const Region& rhs, int dx, int dy,
+            Storage* span = nullptr);
     static void boolean_operation(uint32_t op, Region& dst,
             const Region& lhs, const Rect& rhs, int dx, int dy);
 
@@ -174,7 +246,24 @@ private:
     // with an extra Rect as the last element which is set to the
     // bounds of the region. However, if the region is
     // a simple Rect then mStorage contains only that rect.
-    Vector<Rect> mStorage;
+    Storage mStorage;
+};
+
+// Working memory for the Scratch variants of the in-place operations. Keep
+// one around (it is not thread safe) and pass it to every operation of a
+// pass: it retains the memory of the largest operand it has seen.
+class Region::Scratch {
+public:
+    Scratch() = default;
+    Scratch(const Scratch&) = delete;
+    Scratch& operator = (const Scratch&) = delete;
+
+private:
+    friend class Region;
+
+    // copy of the destination, since the rasterizer writes into it
+    Region lhs;
+    Region::Storage span;
 };
 
 
@@ -20,11 +20,15 @@
 #include <utils/misc.h>
 #include <binder/BpBinder.h>
 #include <binder/IInterface.h>
+#include <binder/IPCThreadState.h>
 #include <binder/IResultReceiver.h>
 #include <binder/IShellCallback.h>
 #include <binder/Parcel.h>
+#include <binder/TransactionStats.h>
+#include <private/android_filesystem_config.h>
 
 #include <stdio.h>
+#include <unistd.h>
 
 namespace android {
 
@@ -125,6 +129,24 @@ status_t BBinder::transact(
         case PING_TRANSACTION:
             reply->writeInt32(pingBinder());
             break;
+        case TRANSACTION_STATS_TRANSACTION: {
+            // Handled here rather than in onTransact, so that it works for
+            // every service, whatever its onTransact does with unknown codes
+            IPCThreadState* ipc = IPCThreadState::self();
+            const uid_t uid = ipc->getCallingUid();
+            if (ipc->getCallingPid() != getpid() &&
+                    uid != AID_ROOT && uid != AID_SHELL && uid != AID_SYSTEM) {
+                err = PERMISSION_DENIED;
+                break;
+            }
+            const int fd = data.readFileDescriptor();
+            const bool reset = data.readInt32() != 0;
+            err = fd >= 0 ? TransactionStats::dump(fd) : BAD_VALUE;
+            if (err == NO_ERROR && reset) {
+                TransactionStats::reset();
+            }
+            break;
+        }
         default:
             err = onTransact(code, data, reply, flags);
             break;
@@ -132,6 +132,9 @@ public:
     virtual ~BpMemory();
     virtual sp<IMemoryHeap> getMemory(ssize_t* offset=0, size_t* size=0) const;
 
+    // Takes the heap, offset and size sent along with the memory.
+    void setMemory(const sp<IBinder>& heap, ssize_t offset, size_t size) const;
+
 private:
     mutable sp<IMemoryHeap> mHeap;
     mutable ssize_t mOffset;
@@ -170,6 +173,40 @@ ssize_t IMemory::offset() const {
     return offset;
 }
 
+// static
+status_t IMemory::writeToParcel(Parcel* parcel, const sp<IMemory>& memory)
+{
+    status_t err = parcel->writeStrongBinder(IInterface::asBinder(memory));
+    if (err != NO_ERROR || memory == 0) {
+        return err;
+    }
+    ssize_t offset = 0;
+    size_t size = 0;
+    sp<IMemoryHeap> heap = memory->getMemory(&offset, &size);
+    err = parcel->writeStrongBinder(IInterface::asBinder(heap));
+    if (err == NO_ERROR) err = parcel->writeInt32(offset);
+    if (err == NO_ERROR) err = parcel->writeInt32(size);
+    return err;
+}
+
+// static
+sp<IMemory> IMemory::readFromParcel(const Parcel& parcel)
+{
+    sp<IBinder> binder = parcel.readStrongBinder();
+    if (binder == 0) {
+        return 0;
+    }
+    sp<IBinder> heap = parcel.readStrongBinder();
+    ssize_t offset = parcel.readInt32();
+    size_t size = parcel.readInt32();
+    if (binder->localBinder() != 0 || heap == 0) {
+        return interface_cast<IMemory>(binder);
+    }
+    sp<BpMemory> memory = new BpMemory(binder);
+    memory->setMemory(heap, offset, size);
+    return memory;
+}
+
 /******************************************************************************/
 
 BpMemory::BpMemory(const sp<IBinder>& impl)
@@ -181,6 +218,29 @@ BpMemory::~BpMemory()
 {
 }
 
+void BpMemory::setMemory(const sp<IBinder>& heap, ssize_t o, size_t s) const
+{
+    if (heap != 0) {
+        // the heap is mapped once per process, whichever BpMemoryHeap asks
+        mHeap = interface_cast<IMemoryHeap>(heap);
+        if (mHeap != 0) {
+            size_t heapSize = mHeap->getSize();
+            if (s <= heapSize
+                    && o >= 0
+                    && (static_cast<size_t>(o) <= heapSize - s)) {
+                mOffset = o;
+                mSize = s;
+            } else {
+                // Hm.
+                android_errorWriteWithInfoLog(0x534e4554,
+                    "26877992", -1, NULL, 0);
+                mOffset = 0;
+                mSize = 0;
+            }
+        }
+    }
+}
+
 sp<IMemoryHeap> BpMemory::getMemory(ssize_t* offset, size_t* size) const
 {
     if (mHeap == 0) {
@@ -190,24 +250,7 @@ sp<IMemoryHeap> BpMemory::getMemory(ssize_t* offset, size_t* size) const
             sp<IBinder> heap = reply.readStrongBinder();
             ssize_t o = reply.readInt32();
             size_t s = reply.readInt32();
-            if (heap != 0) {
-                mHeap = interface_cast<IMemoryHeap>(heap);
-                if (mHeap != 0) {
-                    size_t heapSize = mHeap->getSize();
-                    if (s <= heapSize
-                            && o >= 0
-                            && (static_cast<size_t>(o) <= heapSize - s)) {
-                        mOffset = o;
-                        mSize = s;
-                    } else {
-                        // Hm.
-                        android_errorWriteWithInfoLog(0x534e4554,
-                            "26877992", -1, NULL, 0);
-                        mOffset = 0;
-                        mSize = 0;
-                    }
-                }
-            }
+            setMemory(heap, o, s);
         }
     }
     if (offset) *offset = mOffset;
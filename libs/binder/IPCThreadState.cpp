@@ -21,6 +21,7 @@
 #include <binder/Binder.h>
 #include <binder/BpBinder.h>
 #include <binder/TextOutput.h>
+#include <binder/TransactionStats.h>
 
 #include <cutils/sched_policy.h>
 #include <utils/Log.h>
@@ -32,14 +33,20 @@
 
 #include <errno.h>
 #include <inttypes.h>
+#include <limits.h>
+#include <poll.h>
 #include <pthread.h>
 #include <sched.h>
 #include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/ioctl.h>
 #include <sys/resource.h>
 #include <unistd.h>
 
+#include <algorithm>
+
 #if LOG_NDEBUG
 
 #define IF_LOG_TRANSACTIONS() if (false)
@@ -105,7 +112,9 @@ static const char *kCommandStrings[] = {
     "BC_EXIT_LOOPER",
     "BC_REQUEST_DEATH_NOTIFICATION",
     "BC_CLEAR_DEATH_NOTIFICATION",
-    "BC_DEAD_BINDER_DONE"
+    "BC_DEAD_BINDER_DONE",
+    "BC_TRANSACTION_SG",
+    "BC_REPLY_SG"
 };
 
 static const char* getReturnString(uint32_t cmd)
@@ -218,6 +227,16 @@ static const void* printCommand(TextOutput& out, const void* _cmd)
             out << dedent;
         } break;
 
+        case BC_TRANSACTION_SG:
+        case BC_REPLY_SG: {
+            out << ": " << indent;
+            cmd = (const int32_t *)printBinderTransactionData(out, cmd);
+            const binder_size_t* buffersSize = (const binder_size_t*)cmd;
+            out << endl << "buffers size: " << (uint64_t)*buffersSize;
+            cmd = (const int32_t *)(buffersSize + 1);
+            out << dedent;
+        } break;
+
         case BC_ACQUIRE_RESULT: {
             const int32_t res = *cmd++;
             out << ": " << res << (res ? " (SUCCESS)" : " (FAILURE)");
@@ -408,16 +427,104 @@ void IPCThreadState::flushCommands()
 {
     if (mProcess->mDriverFD <= 0)
         return;
+    if (!mOnewayBatch.isEmpty()) {
+        flushOnewayBatch();
+    }
     talkWithDriver(false);
 }
 
+void IPCThreadState::beginOnewayBatch()
+{
+    mOnewayBatchDepth++;
+}
+
+status_t IPCThreadState::endOnewayBatch()
+{
+    LOG_ALWAYS_FATAL_IF(mOnewayBatchDepth <= 0, "endOnewayBatch() without beginOnewayBatch()");
+    if (--mOnewayBatchDepth > 0) {
+        return NO_ERROR;
+    }
+    return flushOnewayBatch();
+}
+
+bool IPCThreadState::queueOneway(int32_t handle, uint32_t code, const Parcel& data,
+        uint32_t flags)
+{
+    Parcel* copy = new Parcel;
+    // fails for Parcels that can't be copied, e.g. those referencing
+    // buffers of the caller
+    if (copy->appendFrom(&data, 0, data.dataSize()) != NO_ERROR) {
+        delete copy;
+        return false;
+    }
+    QueuedOneway queued;
+    queued.handle = handle;
+    queued.code = code;
+    queued.flags = flags;
+    queued.data = copy;
+    mOnewayBatch.push(queued);
+    mOnewayBatchSize += copy->dataSize();
+    return true;
+}
+
+status_t IPCThreadState::flushOnewayBatch()
+{
+    const size_t count = mOnewayBatch.size();
+    if (count == 0) {
+        return NO_ERROR;
+    }
+
+    status_t result = NO_ERROR;
+    size_t written = 0;
+    for (size_t i = 0; i < count; i++) {
+        const QueuedOneway& queued = mOnewayBatch[i];
+        status_t err = writeTransactionData(BC_TRANSACTION, queued.flags, queued.handle,
+                queued.code, *queued.data, NULL);
+        if (err != NO_ERROR) {
+            if (result == NO_ERROR) result = err;
+            continue;
+        }
+        written++;
+    }
+    // The first wait writes all of them; each then completes in turn.
+    for (size_t i = 0; i < written; i++) {
+        status_t err = waitForResponse(NULL, NULL);
+        if (err != NO_ERROR && result == NO_ERROR) {
+            result = err;
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        delete mOnewayBatch[i].data;
+    }
+    mOnewayBatch.clear();
+    mOnewayBatchSize = 0;
+
+    if (result != NO_ERROR) {
+        mLastError = result;
+    }
+    return result;
+}
+
 void IPCThreadState::blockUntilThreadAvailable()
 {
     pthread_mutex_lock(&mProcess->mThreadCountLock);
-    while (mProcess->mExecutingThreadsCount >= mProcess->mMaxThreads) {
+    bool waited = false;
+    while (mProcess->mExecutingThreadsCount >= mProcess->threadPoolCapacityLocked()) {
+        if (!waited) {
+            mProcess->mBlockedCallers++;
+            waited = true;
+        }
+        // A caller having to wait is saturation enough, whatever its length.
+        if (mProcess->growThreadPoolLocked(uptimeMillis(), true)) {
+            pthread_mutex_unlock(&mProcess->mThreadCountLock);
+            mProcess->spawnAddedThread();
+            pthread_mutex_lock(&mProcess->mThreadCountLock);
+            continue;
+        }
         ALOGW("Waiting for thread to be free. mExecutingThreadsCount=%lu mMaxThreads=%lu\n",
                 static_cast<unsigned long>(mProcess->mExecutingThreadsCount),
-                static_cast<unsigned long>(mProcess->mMaxThreads));
+                static_cast<unsigned long>(mProcess->threadPoolCapacityLocked()));
         pthread_cond_wait(&mProcess->mThreadCountDecrement, &mProcess->mThreadCountLock);
     }
     pthread_mutex_unlock(&mProcess->mThreadCountLock);
@@ -438,29 +545,36 @@ status_t IPCThreadState::getAndExecuteCommand()
                  << getReturnString(cmd) << endl;
         }
 
+        bool grow = false;
         pthread_mutex_lock(&mProcess->mThreadCountLock);
         mProcess->mExecutingThreadsCount++;
-        if (mProcess->mExecutingThreadsCount >= mProcess->mMaxThreads &&
-                mProcess->mStarvationStartTimeMs == 0) {
-            mProcess->mStarvationStartTimeMs = uptimeMillis();
+        if (mProcess->mExecutingThreadsCount >= mProcess->threadPoolCapacityLocked()) {
+            const int64_t nowMs = uptimeMillis();
+            mProcess->threadPoolSaturatedLocked(nowMs);
+            grow = mProcess->growThreadPoolLocked(nowMs, false);
         }
         pthread_mutex_unlock(&mProcess->mThreadCountLock);
+        if (grow) {
+            mProcess->spawnAddedThread();
+        }
 
         result = executeCommand(cmd);
 
+        grow = false;
         pthread_mutex_lock(&mProcess->mThreadCountLock);
         mProcess->mExecutingThreadsCount--;
-        if (mProcess->mExecutingThreadsCount < mProcess->mMaxThreads &&
+        if (mProcess->mExecutingThreadsCount < mProcess->threadPoolCapacityLocked() &&
                 mProcess->mStarvationStartTimeMs != 0) {
-            int64_t starvationTimeMs = uptimeMillis() - mProcess->mStarvationStartTimeMs;
-            if (starvationTimeMs > 100) {
-                ALOGE("binder thread pool (%zu threads) starved for %" PRId64 " ms",
-                      mProcess->mMaxThreads, starvationTimeMs);
-            }
-            mProcess->mStarvationStartTimeMs = 0;
+            const int64_t nowMs = uptimeMillis();
+            // The pool was full all along, so work was likely queueing up.
+            grow = mProcess->growThreadPoolLocked(nowMs, false);
+            mProcess->threadPoolUnsaturatedLocked(nowMs);
         }
         pthread_cond_broadcast(&mProcess->mThreadCountDecrement);
         pthread_mutex_unlock(&mProcess->mThreadCountLock);
+        if (grow) {
+            mProcess->spawnAddedThread();
+        }
     }
 
     return result;
@@ -491,14 +605,64 @@ void IPCThreadState::processPendingDerefs()
 }
 
 void IPCThreadState::joinThreadPool(bool isMain)
+{
+    threadPoolLoop(isMain, false);
+}
+
+void IPCThreadState::joinAddedThreadPool()
+{
+    threadPoolLoop(false, true);
+}
+
+bool IPCThreadState::waitForWork()
+{
+    if (mIn.dataPosition() < mIn.dataSize()) {
+        return true;
+    }
+    pthread_mutex_lock(&mProcess->mThreadCountLock);
+    const int64_t timeoutMs = mProcess->mThreadPoolPolicy.idleTimeoutMs;
+    pthread_mutex_unlock(&mProcess->mThreadCountLock);
+    if (timeoutMs == 0) {
+        return true;
+    }
+
+    if (mOut.dataSize() > 0) {
+        talkWithDriver(false);
+    }
+    struct pollfd pfd;
+    pfd.fd = mProcess->mDriverFD;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    const int ret = TEMP_FAILURE_RETRY(
+            poll(&pfd, 1, static_cast<int>(std::min<int64_t>(timeoutMs, INT_MAX))));
+    // on errors, let the read report them
+    return ret != 0;
+}
+
+void IPCThreadState::threadPoolLoop(bool isMain, bool isAdded)
 {
     LOG_THREADPOOL("**** THREAD %p (PID %d) IS JOINING THE THREAD POOL\n", (void*)pthread_self(), getpid());
 
-    mOut.writeInt32(isMain ? BC_ENTER_LOOPER : BC_REGISTER_LOOPER);
+    // Added threads aren't spawned at the request of the driver, so they
+    // must not register as if they were.
+    mOut.writeInt32((isMain || isAdded) ? BC_ENTER_LOOPER : BC_REGISTER_LOOPER);
 
-    status_t result;
+    status_t result = NO_ERROR;
+    bool retired = false;
     do {
         processPendingDerefs();
+
+        if (isAdded && !waitForWork()) {
+            pthread_mutex_lock(&mProcess->mThreadCountLock);
+            retired = mProcess->retireAddedThreadLocked();
+            pthread_mutex_unlock(&mProcess->mThreadCountLock);
+            if (retired) {
+                result = TIMED_OUT;
+                break;
+            }
+            continue;
+        }
+
         // now get the next command to be processed, waiting if necessary
         result = getAndExecuteCommand();
 
@@ -515,6 +679,12 @@ void IPCThreadState::joinThreadPool(bool isMain)
         }
     } while (result != -ECONNREFUSED && result != -EBADF);
 
+    if (isAdded && !retired) {
+        pthread_mutex_lock(&mProcess->mThreadCountLock);
+        mProcess->retireAddedThreadLocked();
+        pthread_mutex_unlock(&mProcess->mThreadCountLock);
+    }
+
     LOG_THREADPOOL("**** THREAD %p (PID %d) IS LEAVING THE THREAD POOL err=%d\n",
         (void*)pthread_self(), getpid(), result);
 
@@ -564,6 +734,9 @@ status_t IPCThreadState::transact(int32_t handle,
 
     flags |= TF_ACCEPT_FDS;
 
+    const bool recordStats = TransactionStats::isEnabled();
+    const nsecs_t startTime = recordStats ? systemTime(SYSTEM_TIME_MONOTONIC) : 0;
+
     IF_LOG_TRANSACTIONS() {
         TextOutput::Bundle _b(alog);
         alog << "BC_TRANSACTION thr " << (void*)pthread_self() << " / hand "
@@ -571,7 +744,18 @@ status_t IPCThreadState::transact(int32_t handle,
             << indent << data << dedent << endl;
     }
 
+    bool queued = false;
     if (err == NO_ERROR) {
+        if ((flags & TF_ONE_WAY) != 0 && mOnewayBatchDepth > 0) {
+            queued = queueOneway(handle, code, data, flags);
+        }
+        if (!queued && !mOnewayBatch.isEmpty()) {
+            // whatever comes next must not overtake the batch
+            flushOnewayBatch();
+        }
+    }
+
+    if (err == NO_ERROR && !queued) {
         LOG_ONEWAY(">>>> SEND from pid %d uid %d %s", getpid(), getuid(),
             (flags & TF_ONE_WAY) == 0 ? "READ REPLY" : "ONE WAY");
         err = writeTransactionData(BC_TRANSACTION, flags, handle, code, data, NULL);
@@ -582,7 +766,12 @@ status_t IPCThreadState::transact(int32_t handle,
         return (mLastError = err);
     }
 
-    if ((flags & TF_ONE_WAY) == 0) {
+    if (queued) {
+        if (mOnewayBatch.size() >= MAX_ONEWAY_BATCH_COUNT ||
+                mOnewayBatchSize >= MAX_ONEWAY_BATCH_SIZE) {
+            flushOnewayBatch();
+        }
+    } else if ((flags & TF_ONE_WAY) == 0) {
         #if 0
         if (code == 4) { // relayout
             ALOGI(">>>>>> CALLING transaction 4");
@@ -615,21 +804,57 @@ status_t IPCThreadState::transact(int32_t handle,
         err = waitForResponse(NULL, NULL);
     }
 
+    if (recordStats) {
+        if (mTransactionStats == NULL) {
+            mTransactionStats = TransactionStats::createThreadStats();
+        }
+        TransactionStats::recordOutgoing(mTransactionStats, handle, code,
+                systemTime(SYSTEM_TIME_MONOTONIC) - startTime, data.ipcDataSize(),
+                reply ? reply->ipcDataSize() : 0);
+    }
+
     return err;
 }
 
 void IPCThreadState::incStrongHandle(int32_t handle)
 {
     LOG_REMOTEREFS("IPCThreadState::incStrongHandle(%d)\n", handle);
+    // The driver never saw the release, so the reference is still held
+    for (size_t i = 0; i < mPendingStrongReleases.size(); i++) {
+        if (mPendingStrongReleases[i] == handle) {
+            mPendingStrongReleases.removeAt(i);
+            return;
+        }
+    }
     mOut.writeInt32(BC_ACQUIRE);
     mOut.writeInt32(handle);
+    mLastAcquireEnd = mOut.dataSize();
+    mLastAcquireHandle = handle;
 }
 
 void IPCThreadState::decStrongHandle(int32_t handle)
 {
     LOG_REMOTEREFS("IPCThreadState::decStrongHandle(%d)\n", handle);
-    mOut.writeInt32(BC_RELEASE);
-    mOut.writeInt32(handle);
+    if (mLastAcquireEnd != 0 && mLastAcquireEnd == mOut.dataSize() &&
+            mLastAcquireHandle == handle) {
+        // Nothing was written since the matching BC_ACQUIRE, drop both
+        mOut.setDataSize(mLastAcquireEnd - 2 * sizeof(int32_t));
+        mLastAcquireEnd = 0;
+        return;
+    }
+    mPendingStrongReleases.push(handle);
+    if (mPendingStrongReleases.size() >= MAX_PENDING_STRONG_RELEASES) {
+        writePendingStrongReleases();
+    }
+}
+
+void IPCThreadState::writePendingStrongReleases()
+{
+    for (size_t i = 0; i < mPendingStrongReleases.size(); i++) {
+        mOut.writeInt32(BC_RELEASE);
+        mOut.writeInt32(mPendingStrongReleases[i]);
+    }
+    mPendingStrongReleases.clear();
 }
 
 void IPCThreadState::incWeakHandle(int32_t handle)
@@ -696,8 +921,15 @@ status_t IPCThreadState::clearDeathNotification(int32_t handle, BpBinder* proxy)
 
 IPCThreadState::IPCThreadState()
     : mProcess(ProcessState::self()),
+      mParcelPoolCount(0),
+      mParcelPoolClosed(false),
       mStrictModePolicy(0),
-      mLastTransactionBinderFlags(0)
+      mLastTransactionBinderFlags(0),
+      mTransactionStats(NULL),
+      mOnewayBatchSize(0),
+      mOnewayBatchDepth(0),
+      mLastAcquireEnd(0),
+      mLastAcquireHandle(0)
 {
     pthread_setspecific(gTLS, this);
     clearCaller();
@@ -707,6 +939,63 @@ IPCThreadState::IPCThreadState()
 
 IPCThreadState::~IPCThreadState()
 {
+    // normally flushed by threadDestructor; anything left can't be sent
+    for (size_t i = 0; i < mOnewayBatch.size(); i++) {
+        delete mOnewayBatch[i].data;
+    }
+    TransactionStats::retireThreadStats(mTransactionStats);
+    trimParcelBuffers();
+    // mIn and mOut are destroyed after this, and must not refill the pool
+    mParcelPoolClosed = true;
+}
+
+uint8_t* IPCThreadState::takeParcelBuffer(size_t desired, size_t* outCapacity)
+{
+    // Best fit, so that small Parcels leave the larger buffers to larger
+    // ones, and the most recently used of equal fits since it's likely in cache
+    size_t best = mParcelPoolCount;
+    for (size_t i = 0; i < mParcelPoolCount; i++) {
+        if (mParcelPool[i].capacity >= desired &&
+                (best == mParcelPoolCount ||
+                 mParcelPool[i].capacity <= mParcelPool[best].capacity)) {
+            best = i;
+        }
+    }
+    if (best == mParcelPoolCount) {
+        return NULL;
+    }
+    uint8_t* data = mParcelPool[best].data;
+    *outCapacity = mParcelPool[best].capacity;
+    mParcelPoolCount--;
+    memmove(&mParcelPool[best], &mParcelPool[best + 1],
+            (mParcelPoolCount - best) * sizeof(PooledParcelBuffer));
+    return data;
+}
+
+bool IPCThreadState::recycleParcelBuffer(uint8_t* data, size_t capacity)
+{
+    if (mParcelPoolClosed || capacity > MAX_POOLED_PARCEL_CAPACITY) {
+        return false;
+    }
+    if (mParcelPoolCount == PARCEL_POOL_SIZE) {
+        // Drop the buffer that has gone unused the longest
+        free(mParcelPool[0].data);
+        mParcelPoolCount--;
+        memmove(&mParcelPool[0], &mParcelPool[1],
+                mParcelPoolCount * sizeof(PooledParcelBuffer));
+    }
+    mParcelPool[mParcelPoolCount].data = data;
+    mParcelPool[mParcelPoolCount].capacity = capacity;
+    mParcelPoolCount++;
+    return true;
+}
+
+void IPCThreadState::trimParcelBuffers()
+{
+    for (size_t i = 0; i < mParcelPoolCount; i++) {
+        free(mParcelPool[i].data);
+    }
+    mParcelPoolCount = 0;
 }
 
 status_t IPCThreadState::sendReply(const Parcel& reply, uint32_t flags)
@@ -816,6 +1105,10 @@ status_t IPCThreadState::talkWithDriver(bool doReceive)
         return -EBADF;
     }
 
+    if (!mPendingStrongReleases.isEmpty()) {
+        writePendingStrongReleases();
+    }
+
     binder_write_read bwr;
 
     // Is the read buffer empty?
@@ -890,6 +1183,8 @@ status_t IPCThreadState::talkWithDriver(bool doReceive)
                 mOut.remove(0, bwr.write_consumed);
             else
                 mOut.setDataSize(0);
+            // the BC_ACQUIRE is sent or moved, it can't be cancelled anymore
+            mLastAcquireEnd = 0;
         }
         if (bwr.read_consumed > 0) {
             mIn.setDataSize(bwr.read_consumed);
@@ -925,11 +1220,13 @@ status_t IPCThreadState::writeTransactionData(int32_t cmd, uint32_t binderFlags,
     tr.sender_euid = 0;
 
     const status_t err = data.errorCheck();
+    size_t buffersSize = 0;
     if (err == NO_ERROR) {
         tr.data_size = data.ipcDataSize();
         tr.data.ptr.buffer = data.ipcData();
         tr.offsets_size = data.ipcObjectsCount()*sizeof(binder_size_t);
         tr.data.ptr.offsets = data.ipcObjects();
+        buffersSize = data.ipcBuffersSize();
     } else if (statusBuffer) {
         tr.flags |= TF_STATUS_CODE;
         *statusBuffer = err;
@@ -941,6 +1238,16 @@ status_t IPCThreadState::writeTransactionData(int32_t cmd, uint32_t binderFlags,
         return (mLastError = err);
     }
 
+    if (buffersSize > 0) {
+        // Referenced buffers are gathered by the driver from our memory
+        binder_transaction_data_sg trSg;
+        trSg.transaction_data = tr;
+        trSg.buffers_size = buffersSize;
+        mOut.writeInt32(cmd == BC_REPLY ? BC_REPLY_SG : BC_TRANSACTION_SG);
+        mOut.write(&trSg, sizeof(trSg));
+        return NO_ERROR;
+    }
+
     mOut.writeInt32(cmd);
     mOut.write(&tr, sizeof(tr));
 
@@ -1072,20 +1379,32 @@ status_t IPCThreadState::executeCommand(int32_t cmd)
                     << ", offsets addr="
                     << reinterpret_cast<const size_t*>(tr.data.ptr.offsets) << endl;
             }
+            const bool recordStats = TransactionStats::isEnabled();
+            const nsecs_t startTime = recordStats ? systemTime(SYSTEM_TIME_MONOTONIC) : 0;
             if (tr.target.ptr) {
                 // We only have a weak reference on the target object, so we must first try to
                 // safely acquire a strong reference before doing anything else with it.
                 if (reinterpret_cast<RefBase::weakref_type*>(
                         tr.target.ptr)->attemptIncStrong(this)) {
-                    error = reinterpret_cast<BBinder*>(tr.cookie)->transact(tr.code, buffer,
-                            &reply, tr.flags);
-                    reinterpret_cast<BBinder*>(tr.cookie)->decStrong(this);
+                    BBinder* target = reinterpret_cast<BBinder*>(tr.cookie);
+                    error = target->transact(tr.code, buffer, &reply, tr.flags);
+                    if (recordStats) {
+                        recordIncomingStats(target, tr.code,
+                                systemTime(SYSTEM_TIME_MONOTONIC) - startTime,
+                                tr.data_size, reply.ipcDataSize());
+                    }
+                    target->decStrong(this);
                 } else {
                     error = UNKNOWN_TRANSACTION;
                 }
 
             } else {
                 error = the_context_object->transact(tr.code, buffer, &reply, tr.flags);
+                if (recordStats) {
+                    recordIncomingStats(the_context_object.get(), tr.code,
+                            systemTime(SYSTEM_TIME_MONOTONIC) - startTime,
+                            tr.data_size, reply.ipcDataSize());
+                }
             }
 
             //ALOGI("<<<< TRANSACT from pid %d restore pid %d uid %d\n",
@@ -1151,6 +1470,16 @@ status_t IPCThreadState::executeCommand(int32_t cmd)
     return result;
 }
 
+void IPCThreadState::recordIncomingStats(BBinder* target, uint32_t code, nsecs_t latency,
+        size_t dataSize, size_t replySize)
+{
+    if (mTransactionStats == NULL) {
+        mTransactionStats = TransactionStats::createThreadStats();
+    }
+    TransactionStats::recordIncoming(mTransactionStats, target, code, latency, dataSize,
+            replySize);
+}
+
 void IPCThreadState::threadDestructor(void *st)
 {
         IPCThreadState* const self = static_cast<IPCThreadState*>(st);
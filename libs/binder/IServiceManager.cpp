@@ -21,6 +21,7 @@
 #include <utils/Log.h>
 #include <binder/IPCThreadState.h>
 #include <binder/Parcel.h>
+#include <utils/KeyedVector.h>
 #include <utils/String8.h>
 #include <utils/SystemClock.h>
 #include <utils/CallStack.h>
@@ -124,12 +125,89 @@ bool checkPermission(const String16& permission, pid_t pid, uid_t uid)
 
 // ----------------------------------------------------------------------
 
+// The services checkService() resolved, so that looking one up again
+// doesn't cost a round trip to the service manager. Only remote services
+// are kept, each until it dies.
+class ServiceCache : public IBinder::DeathRecipient
+{
+public:
+    sp<IBinder> get(const String16& name)
+    {
+        AutoMutex _l(mLock);
+        ssize_t i = mServices.indexOfKey(name);
+        if (i < 0 || !mServices.valueAt(i)->isBinderAlive()) {
+            return NULL;
+        }
+        return mServices.valueAt(i);
+    }
+
+    void put(const String16& name, const sp<IBinder>& service)
+    {
+        if (service->remoteBinder() == NULL) {
+            return;
+        }
+        AutoMutex _l(mLock);
+        ssize_t i = mServices.indexOfKey(name);
+        if (i >= 0) {
+            if (mServices.valueAt(i) == service) {
+                return;
+            }
+            mServices.valueAt(i)->unlinkToDeath(this);
+            mServices.removeItemsAt(i);
+        }
+        if (service->linkToDeath(this) == NO_ERROR) {
+            mServices.add(name, service);
+        }
+    }
+
+    void remove(const String16& name)
+    {
+        AutoMutex _l(mLock);
+        ssize_t i = mServices.indexOfKey(name);
+        if (i >= 0) {
+            mServices.valueAt(i)->unlinkToDeath(this);
+            mServices.removeItemsAt(i);
+        }
+    }
+
+    void clear()
+    {
+        AutoMutex _l(mLock);
+        for (size_t i = 0; i < mServices.size(); i++) {
+            mServices.valueAt(i)->unlinkToDeath(this);
+        }
+        mServices.clear();
+    }
+
+    virtual void binderDied(const wp<IBinder>& who)
+    {
+        AutoMutex _l(mLock);
+        // a service may be registered under several names
+        for (size_t i = mServices.size(); i > 0; i--) {
+            if (mServices.valueAt(i - 1).get() == who.unsafe_get()) {
+                mServices.removeItemsAt(i - 1);
+            }
+        }
+    }
+
+private:
+    Mutex mLock;
+    KeyedVector<String16, sp<IBinder> > mServices;
+};
+
 class BpServiceManager : public BpInterface<IServiceManager>
 {
 public:
     explicit BpServiceManager(const sp<IBinder>& impl)
         : BpInterface<IServiceManager>(impl)
+        , mCache(new ServiceCache)
+    {
+    }
+
+    virtual ~BpServiceManager()
     {
+        // the services hold a reference to the cache until unlinked
+        mCache->clear();
     }
 
     virtual sp<IBinder> getService(const String16& name) const
@@ -153,16 +231,24 @@ public:
 
     virtual sp<IBinder> checkService( const String16& name) const
     {
+        sp<IBinder> svc = mCache->get(name);
+        if (svc != NULL) return svc;
+
         Parcel data, reply;
         data.writeInterfaceToken(IServiceManager::getInterfaceDescriptor());
         data.writeString16(name);
         remote()->transact(CHECK_SERVICE_TRANSACTION, data, &reply);
-        return reply.readStrongBinder();
+        svc = reply.readStrongBinder();
+        if (svc != NULL) mCache->put(name, svc);
+        return svc;
     }
 
     virtual status_t addService(const String16& name, const sp<IBinder>& service,
             bool allowIsolated)
     {
+        // the name is going to name another service
+        mCache->remove(name);
+
         Parcel data, reply;
         data.writeInterfaceToken(IServiceManager::getInterfaceDescriptor());
         data.writeString16(name);
@@ -188,6 +274,9 @@ public:
         }
         return res;
     }
+
+private:
+    const sp<ServiceCache> mCache;
 };
 
 IMPLEMENT_META_INTERFACE(ServiceManager, "android.os.IServiceManager");
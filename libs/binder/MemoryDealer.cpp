@@ -38,6 +38,8 @@
 #include <sys/mman.h>
 #include <sys/file.h>
 
+#include <unordered_map>
+
 namespace android {
 // ----------------------------------------------------------------------------
 
@@ -120,6 +122,13 @@ private:
 
 // ----------------------------------------------------------------------------
 
+/*
+ * A good-fit allocator over the heap, in kMemoryAlign units. Chunks, both
+ * free and allocated, are kept in address order so that a freed chunk can
+ * be merged with its neighbors right away; free chunks are also sorted by
+ * size into bins, and allocated ones indexed by offset, so that allocating
+ * and freeing take about the same time however many chunks there are.
+ */
 class SimpleBestFitAllocator
 {
     enum {
@@ -141,23 +150,43 @@ private:
 
     struct chunk_t {
         chunk_t(size_t start, size_t size)
-        : start(start), size(size), free(1), prev(0), next(0) {
+        : start(start), size(size), free(1), prev(0), next(0),
+          freePrev(0), freeNext(0) {
         }
         size_t              start;
-        size_t              size : 28;
-        int                 free : 4;
+        size_t              size;
+        int                 free;
         mutable chunk_t*    prev;
         mutable chunk_t*    next;
+        // links in the bin of the chunk, while it is free
+        chunk_t*            freePrev;
+        chunk_t*            freeNext;
     };
 
+    // Bin i holds the free chunks whose size is in [2^i, 2^(i+1)).
+    static const size_t kNumBins = sizeof(size_t) * 8;
+    // Chunks looked at in the bins where not every chunk fits, before
+    // settling for one of a larger bin, where any fits.
+    static const size_t kMaxBinScan = 8;
+
     ssize_t  alloc(size_t size, uint32_t flags);
     chunk_t* dealloc(size_t start);
+    chunk_t* findFree(size_t size, uint32_t flags) const;
+    size_t   padding(const chunk_t* chunk, uint32_t flags) const;
+    void     insertFree(chunk_t* chunk);
+    void     removeFree(chunk_t* chunk);
     void     dump_l(const char* what) const;
     void     dump_l(String8& res, const char* what) const;
 
+    static size_t binOf(size_t size);
+
     static const int    kMemoryAlign;
     mutable Mutex       mLock;
+    // no two free chunks are ever next to each other
     LinkedList<chunk_t> mList;
+    chunk_t*            mBins[kNumBins];
+    size_t              mNonEmptyBins;  // bit i is set if mBins[i] isn't empty
+    std::unordered_map<size_t, chunk_t*> mAllocated;  // by start
     size_t              mHeapSize;
 };
 
@@ -278,12 +307,19 @@ size_t MemoryDealer::getAllocationAlignment()
 const int SimpleBestFitAllocator::kMemoryAlign = 32;
 
 SimpleBestFitAllocator::SimpleBestFitAllocator(size_t size)
+    : mNonEmptyBins(0)
 {
     size_t pagesize = getpagesize();
     mHeapSize = ((size + pagesize-1) & ~(pagesize-1));
 
+    for (size_t i = 0; i < kNumBins; i++) {
+        mBins[i] = 0;
+    }
     chunk_t* node = new chunk_t(0, mHeapSize / kMemoryAlign);
     mList.insertHead(node);
+    if (node->size) {
+        insertFree(node);
+    }
 }
 
 SimpleBestFitAllocator::~SimpleBestFitAllocator()
@@ -315,102 +351,155 @@ status_t SimpleBestFitAllocator::deallocate(size_t offset)
     return NAME_NOT_FOUND;
 }
 
-ssize_t SimpleBestFitAllocator::alloc(size_t size, uint32_t flags)
+// static
+size_t SimpleBestFitAllocator::binOf(size_t size)
 {
-    if (size == 0) {
+    return sizeof(unsigned long long) * 8 - 1 -
+            __builtin_clzll(static_cast<unsigned long long>(size));
+}
+
+size_t SimpleBestFitAllocator::padding(const chunk_t* chunk, uint32_t flags) const
+{
+    if (!(flags & PAGE_ALIGNED)) {
         return 0;
     }
-    size = (size + kMemoryAlign-1) / kMemoryAlign;
-    chunk_t* free_chunk = 0;
-    chunk_t* cur = mList.head();
+    const size_t pagesize = getpagesize();
+    return -chunk->start & ((pagesize/kMemoryAlign)-1);
+}
 
-    size_t pagesize = getpagesize();
-    while (cur) {
-        int extra = 0;
-        if (flags & PAGE_ALIGNED)
-            extra = ( -cur->start & ((pagesize/kMemoryAlign)-1) ) ;
-
-        // best fit
-        if (cur->free && (cur->size >= (size+extra))) {
-            if ((!free_chunk) || (cur->size < free_chunk->size)) {
-                free_chunk = cur;
-            }
-            if (cur->size == size) {
-                break;
-            }
+void SimpleBestFitAllocator::insertFree(chunk_t* chunk)
+{
+    const size_t bin = binOf(chunk->size);
+    chunk->freePrev = 0;
+    chunk->freeNext = mBins[bin];
+    if (mBins[bin]) {
+        mBins[bin]->freePrev = chunk;
+    }
+    mBins[bin] = chunk;
+    mNonEmptyBins |= size_t(1) << bin;
+}
+
+void SimpleBestFitAllocator::removeFree(chunk_t* chunk)
+{
+    const size_t bin = binOf(chunk->size);
+    if (chunk->freePrev) {
+        chunk->freePrev->freeNext = chunk->freeNext;
+    } else {
+        mBins[bin] = chunk->freeNext;
+        if (!mBins[bin]) {
+            mNonEmptyBins &= ~(size_t(1) << bin);
         }
-        cur = cur->next;
     }
+    if (chunk->freeNext) {
+        chunk->freeNext->freePrev = chunk->freePrev;
+    }
+    chunk->freePrev = chunk->freeNext = 0;
+}
 
-    if (free_chunk) {
-        const size_t free_size = free_chunk->size;
-        free_chunk->free = 0;
-        free_chunk->size = size;
-        if (free_size > size) {
-            int extra = 0;
-            if (flags & PAGE_ALIGNED)
-                extra = ( -free_chunk->start & ((pagesize/kMemoryAlign)-1) ) ;
-            if (extra) {
-                chunk_t* split = new chunk_t(free_chunk->start, extra);
-                free_chunk->start += extra;
-                mList.insertBefore(free_chunk, split);
+SimpleBestFitAllocator::chunk_t* SimpleBestFitAllocator::findFree(
+        size_t size, uint32_t flags) const
+{
+    const size_t pagesize = getpagesize();
+    const size_t maxPadding = (flags & PAGE_ALIGNED) ? (pagesize/kMemoryAlign)-1 : 0;
+    const size_t last = binOf(size + maxPadding);
+
+    // best fit among the first few chunks of the bins that may be too small
+    chunk_t* best = 0;
+    for (size_t bin = binOf(size); bin <= last && !best; bin++) {
+        size_t scanned = 0;
+        for (chunk_t* cur = mBins[bin]; cur && scanned < kMaxBinScan;
+                cur = cur->freeNext, scanned++) {
+            const size_t needed = size + padding(cur, flags);
+            if (cur->size >= needed && (!best || cur->size < best->size)) {
+                best = cur;
+                if (cur->size == needed) {
+                    return best;
+                }
             }
+        }
+    }
+    if (best || last + 1 >= kNumBins) {
+        return best;
+    }
 
-            ALOGE_IF((flags&PAGE_ALIGNED) && 
-                    ((free_chunk->start*kMemoryAlign)&(pagesize-1)),
-                    "PAGE_ALIGNED requested, but page is not aligned!!!");
+    // otherwise the smallest bin where any chunk fits
+    const size_t larger = mNonEmptyBins & ~((size_t(2) << last) - 1);
+    if (!larger) {
+        return 0;
+    }
+    return mBins[__builtin_ctzll(static_cast<unsigned long long>(larger))];
+}
 
-            const ssize_t tail_free = free_size - (size+extra);
-            if (tail_free > 0) {
-                chunk_t* split = new chunk_t(
-                        free_chunk->start + free_chunk->size, tail_free);
-                mList.insertAfter(free_chunk, split);
-            }
-        }
-        return (free_chunk->start)*kMemoryAlign;
+ssize_t SimpleBestFitAllocator::alloc(size_t size, uint32_t flags)
+{
+    if (size == 0) {
+        return 0;
     }
-    return NO_MEMORY;
+    size = (size + kMemoryAlign-1) / kMemoryAlign;
+    chunk_t* free_chunk = findFree(size, flags);
+    if (!free_chunk) {
+        return NO_MEMORY;
+    }
+
+    removeFree(free_chunk);
+    const size_t free_size = free_chunk->size;
+    const size_t extra = padding(free_chunk, flags);
+    free_chunk->free = 0;
+    free_chunk->size = size;
+    // The neighbors of a free chunk are allocated, so what is left on
+    // either side doesn't need merging.
+    if (extra) {
+        chunk_t* split = new chunk_t(free_chunk->start, extra);
+        free_chunk->start += extra;
+        mList.insertBefore(free_chunk, split);
+        insertFree(split);
+    }
+
+    ALOGE_IF((flags&PAGE_ALIGNED) &&
+            ((free_chunk->start*kMemoryAlign)&(getpagesize()-1)),
+            "PAGE_ALIGNED requested, but page is not aligned!!!");
+
+    const size_t tail_free = free_size - (size+extra);
+    if (tail_free > 0) {
+        chunk_t* split = new chunk_t(
+                free_chunk->start + free_chunk->size, tail_free);
+        mList.insertAfter(free_chunk, split);
+        insertFree(split);
+    }
+
+    mAllocated[free_chunk->start] = free_chunk;
+    return (free_chunk->start)*kMemoryAlign;
 }
 
 SimpleBestFitAllocator::chunk_t* SimpleBestFitAllocator::dealloc(size_t start)
 {
     start = start / kMemoryAlign;
-    chunk_t* cur = mList.head();
-    while (cur) {
-        if (cur->start == start) {
-            LOG_FATAL_IF(cur->free,
-                "block at offset 0x%08lX of size 0x%08lX already freed",
-                cur->start*kMemoryAlign, cur->size*kMemoryAlign);
-
-            // merge freed blocks together
-            chunk_t* freed = cur;
-            cur->free = 1;
-            do {
-                chunk_t* const p = cur->prev;
-                chunk_t* const n = cur->next;
-                if (p && (p->free || !cur->size)) {
-                    freed = p;
-                    p->size += cur->size;
-                    mList.remove(cur);
-                    delete cur;
-                }
-                cur = n;
-            } while (cur && cur->free);
-
-            #ifndef NDEBUG
-                if (!freed->free) {
-                    dump_l("dealloc (!freed->free)");
-                }
-            #endif
-            LOG_FATAL_IF(!freed->free,
-                "freed block at offset 0x%08lX of size 0x%08lX is not free!",
-                freed->start * kMemoryAlign, freed->size * kMemoryAlign);
-
-            return freed;
-        }
-        cur = cur->next;
+    auto it = mAllocated.find(start);
+    if (it == mAllocated.end()) {
+        return 0;
     }
-    return 0;
+    chunk_t* freed = it->second;
+    mAllocated.erase(it);
+
+    // merge freed blocks together
+    freed->free = 1;
+    chunk_t* const p = freed->prev;
+    if (p && p->free) {
+        removeFree(p);
+        p->size += freed->size;
+        mList.remove(freed);
+        delete freed;
+        freed = p;
+    }
+    chunk_t* const n = freed->next;
+    if (n && n->free) {
+        removeFree(n);
+        freed->size += n->size;
+        mList.remove(n);
+        delete n;
+    }
+    insertFree(freed);
+    return freed;
 }
 
 void SimpleBestFitAllocator::dump(const char* what) const
@@ -470,6 +559,26 @@ void SimpleBestFitAllocator::dump_l(String8& result,
     snprintf(buffer, SIZE,
             "  size allocated: %u (%u KB)\n", int(size), int(size/1024));
     result.append(buffer);
+
+    // Fragmentation: how much of the free space can't be had in one piece.
+    size_t freeChunks = 0;
+    size_t freeSize = 0;
+    size_t largestFree = 0;
+    for (size_t bin = 0; bin < kNumBins; bin++) {
+        for (chunk_t const* c = mBins[bin]; c; c = c->freeNext) {
+            freeChunks++;
+            freeSize += c->size*kMemoryAlign;
+            if (c->size*kMemoryAlign > largestFree) {
+                largestFree = c->size*kMemoryAlign;
+            }
+        }
+    }
+    snprintf(buffer, SIZE,
+            "  %zu allocated chunks, %zu free chunks of %zu bytes, largest %zu bytes, "
+            "fragmentation %d%%\n",
+            mAllocated.size(), freeChunks, freeSize, largestFree,
+            freeSize ? int(100 - (largestFree * 100) / freeSize) : 0);
+    result.append(buffer);
 }
 
 
@@ -24,6 +24,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -92,6 +93,27 @@ static size_t gParcelGlobalAllocCount = 0;
 
 static size_t gMaxFds = 0;
 
+// Allocates the data of a Parcel, from the buffers recycled on this thread
+// if possible. The capacity may be larger than desired.
+static uint8_t* allocParcelData(size_t desired, size_t* outCapacity)
+{
+    IPCThreadState* ipc = IPCThreadState::selfOrNull();
+    uint8_t* data = ipc ? ipc->takeParcelBuffer(desired, outCapacity) : NULL;
+    if (!data) {
+        data = (uint8_t*)malloc(desired);
+        *outCapacity = desired;
+    }
+    return data;
+}
+
+static void freeParcelData(uint8_t* data, size_t capacity)
+{
+    IPCThreadState* ipc = IPCThreadState::selfOrNull();
+    if (!ipc || !ipc->recycleParcelBuffer(data, capacity)) {
+        free(data);
+    }
+}
+
 // Maximum size of a blob to transfer in-place.
 static const size_t BLOB_INPLACE_LIMIT = 16 * 1024;
 
@@ -138,6 +160,9 @@ void acquire_object(const sp<ProcessState>& proc,
             }
             return;
         }
+        case BINDER_TYPE_PTR:
+            // the buffer belongs to the writer, or to the transaction
+            return;
     }
 
     ALOGD("Invalid object type 0x%08x", obj.type);
@@ -189,6 +214,8 @@ static void release_object(const sp<ProcessState>& proc,
             }
             return;
         }
+        case BINDER_TYPE_PTR:
+            return;
     }
 
     ALOGE("Invalid object type 0x%08x", obj.type);
@@ -495,6 +522,12 @@ status_t Parcel::appendFrom(const Parcel *parcel, size_t offset, size_t len)
     for (int i = 0; i < (int) size; i++) {
         size_t off = objects[i];
         if ((off >= offset) && (off + sizeof(flat_binder_object) <= offset + len)) {
+            if (reinterpret_cast<const flat_binder_object*>(data + off)->type
+                    == BINDER_TYPE_PTR) {
+                // the reference may not outlive the source parcel
+                ALOGE("appendFrom: can't append buffer references");
+                return INVALID_OPERATION;
+            }
             if (firstIndex == -1) {
                 firstIndex = i;
             }
@@ -626,12 +659,17 @@ bool Parcel::enforceInterface(const String16& interface,
     } else {
       threadState->setStrictModePolicy(strictPolicy);
     }
-    const String16 str(readString16());
-    if (str == interface) {
+    // Compare in place, this runs for every incoming transaction and the
+    // descriptor doesn't need to outlive the check.
+    size_t len;
+    const char16_t* str = readString16Inplace(&len);
+    if (str != NULL && len == interface.size() &&
+            memcmp(str, interface.string(), len * sizeof(char16_t)) == 0) {
         return true;
     } else {
         ALOGW("**** enforceInterface() expected '%s' but read '%s'",
-                String8(interface).string(), String8(str).string());
+                String8(interface).string(),
+                str != NULL ? String8(str, len).string() : "");
         return false;
     }
 }
@@ -1344,6 +1382,36 @@ restart_write:
     goto restart_write;
 }
 
+status_t Parcel::writeBufferReference(const void* buffer, size_t length)
+{
+    if (length > INT32_MAX || (buffer == NULL && length != 0)) {
+        return BAD_VALUE;
+    }
+
+    binder_buffer_object obj;
+    memset(&obj, 0, sizeof(obj));
+    obj.hdr.type = BINDER_TYPE_PTR;
+    obj.buffer = reinterpret_cast<binder_uintptr_t>(buffer);
+    obj.length = length;
+
+    if (mDataPos + sizeof(obj) > mDataCapacity) {
+        const status_t err = growData(sizeof(obj));
+        if (err != NO_ERROR) return err;
+    }
+    if (mObjectsSize >= mObjectsCapacity) {
+        size_t newSize = ((mObjectsSize+2)*3)/2;
+        if (newSize*sizeof(binder_size_t) < mObjectsSize) return NO_MEMORY;   // overflow
+        binder_size_t* objects = (binder_size_t*)realloc(mObjects, newSize*sizeof(binder_size_t));
+        if (objects == NULL) return NO_MEMORY;
+        mObjects = objects;
+        mObjectsCapacity = newSize;
+    }
+
+    memcpy(mData + mDataPos, &obj, sizeof(obj));
+    mObjects[mObjectsSize++] = mDataPos;
+    return finishWrite(sizeof(obj));
+}
+
 status_t Parcel::writeNoException()
 {
     binder::Status status;
@@ -2254,6 +2322,37 @@ status_t Parcel::read(FlattenableHelperInterface& val) const
 
     return err;
 }
+status_t Parcel::readBufferReference(const void** outBuffer, size_t* outLength) const
+{
+    const size_t DPOS = mDataPos;
+    if (DPOS + sizeof(binder_buffer_object) > mDataSize) {
+        return NOT_ENOUGH_DATA;
+    }
+
+    // Only trust objects in the object list: the driver validated those and
+    // pointed them at the receiver's copy, while anything else is plain data
+    // the sender could have forged.
+    size_t opos = 0;
+    while (opos < mObjectsSize && mObjects[opos] < DPOS) {
+        opos++;
+    }
+    if (opos == mObjectsSize || mObjects[opos] != DPOS) {
+        ALOGE("readBufferReference: no object at %zu", DPOS);
+        return BAD_TYPE;
+    }
+
+    binder_buffer_object obj;
+    memcpy(&obj, mData + DPOS, sizeof(obj));
+    if (obj.hdr.type != BINDER_TYPE_PTR) {
+        return BAD_TYPE;
+    }
+
+    *outBuffer = reinterpret_cast<const void*>(static_cast<uintptr_t>(obj.buffer));
+    *outLength = static_cast<size_t>(obj.length);
+    mDataPos = DPOS + sizeof(obj);
+    return NO_ERROR;
+}
+
 const flat_binder_object* Parcel::readObject(bool nullMetaData) const
 {
     const size_t DPOS = mDataPos;
@@ -2352,6 +2451,22 @@ size_t Parcel::ipcObjectsCount() const
     return mObjectsSize;
 }
 
+size_t Parcel::ipcBuffersSize() const
+{
+    size_t size = 0;
+    for (size_t i = 0; i < mObjectsSize; i++) {
+        const flat_binder_object* flat =
+                reinterpret_cast<const flat_binder_object*>(mData + mObjects[i]);
+        if (flat->type == BINDER_TYPE_PTR) {
+            const binder_buffer_object* obj =
+                    reinterpret_cast<const binder_buffer_object*>(flat);
+            // the driver keeps each buffer 8-byte aligned
+            size += (static_cast<size_t>(obj->length) + 7) & ~static_cast<size_t>(7);
+        }
+    }
+    return size;
+}
+
 void Parcel::ipcSetDataReference(const uint8_t* data, size_t dataSize,
     const binder_size_t* objects, size_t objectsCount, release_func relFunc, void* relCookie)
 {
@@ -2462,7 +2577,7 @@ void Parcel::freeDataNoInit()
               gParcelGlobalAllocCount--;
             }
             pthread_mutex_unlock(&gParcelGlobalAllocSizeLock);
-            free(mData);
+            freeParcelData(mData, mDataCapacity);
         }
         if (mObjects) free(mObjects);
     }
@@ -2563,7 +2678,8 @@ status_t Parcel::continueWrite(size_t desired)
 
         // If there is a different owner, we need to take
         // posession.
-        uint8_t* data = (uint8_t*)malloc(desired);
+        size_t capacity;
+        uint8_t* data = allocParcelData(desired, &capacity);
         if (!data) {
             mError = NO_MEMORY;
             return NO_MEMORY;
@@ -2573,7 +2689,7 @@ status_t Parcel::continueWrite(size_t desired)
         if (objectsSize) {
             objects = (binder_size_t*)calloc(objectsSize, sizeof(binder_size_t));
             if (!objects) {
-                free(data);
+                freeParcelData(data, capacity);
 
                 mError = NO_MEMORY;
                 return NO_MEMORY;
@@ -2597,9 +2713,9 @@ status_t Parcel::continueWrite(size_t desired)
         mOwner(this, mData, mDataSize, mObjects, mObjectsSize, mOwnerCookie);
         mOwner = NULL;
 
-        LOG_ALLOC("Parcel %p: taking ownership of %zu capacity", this, desired);
+        LOG_ALLOC("Parcel %p: taking ownership of %zu capacity", this, capacity);
         pthread_mutex_lock(&gParcelGlobalAllocSizeLock);
-        gParcelGlobalAllocSize += desired;
+        gParcelGlobalAllocSize += capacity;
         gParcelGlobalAllocCount++;
         pthread_mutex_unlock(&gParcelGlobalAllocSizeLock);
 
@@ -2607,7 +2723,7 @@ status_t Parcel::continueWrite(size_t desired)
         mObjects = objects;
         mDataSize = (mDataSize < desired) ? mDataSize : desired;
         ALOGV("continueWrite Setting data size of %p to %zu", this, mDataSize);
-        mDataCapacity = desired;
+        mDataCapacity = capacity;
         mObjectsSize = mObjectsCapacity = objectsSize;
         mNextObjectHint = 0;
 
@@ -2662,7 +2778,8 @@ status_t Parcel::continueWrite(size_t desired)
 
     } else {
         // This is the first data.  Easy!
-        uint8_t* data = (uint8_t*)malloc(desired);
+        size_t capacity;
+        uint8_t* data = allocParcelData(desired, &capacity);
         if (!data) {
             mError = NO_MEMORY;
             return NO_MEMORY;
@@ -2673,9 +2790,9 @@ status_t Parcel::continueWrite(size_t desired)
             ALOGE("continueWrite: %zu/%p/%zu/%zu", mDataCapacity, mObjects, mObjectsCapacity, desired);
         }
 
-        LOG_ALLOC("Parcel %p: allocating with %zu capacity", this, desired);
+        LOG_ALLOC("Parcel %p: allocating with %zu capacity", this, capacity);
         pthread_mutex_lock(&gParcelGlobalAllocSizeLock);
-        gParcelGlobalAllocSize += desired;
+        gParcelGlobalAllocSize += capacity;
         gParcelGlobalAllocCount++;
         pthread_mutex_unlock(&gParcelGlobalAllocSizeLock);
 
@@ -2683,7 +2800,7 @@ status_t Parcel::continueWrite(size_t desired)
         mDataSize = mDataPos = 0;
         ALOGV("continueWrite Setting data size of %p to %zu", this, mDataSize);
         ALOGV("continueWrite Setting data pos of %p to %zu", this, mDataPos);
-        mDataCapacity = desired;
+        mDataCapacity = capacity;
     }
 
     return NO_ERROR;
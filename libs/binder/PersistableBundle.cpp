@@ -20,6 +20,9 @@
 #include <private/binder/ParcelValTypes.h>
 
 #include <limits>
+#include <mutex>
+
+#include <string.h>
 
 #include <binder/IBinder.h>
 #include <binder/Parcel.h>
@@ -29,6 +32,7 @@
 using android::BAD_TYPE;
 using android::BAD_VALUE;
 using android::NO_ERROR;
+using android::NOT_ENOUGH_DATA;
 using android::Parcel;
 using android::sp;
 using android::status_t;
@@ -61,12 +65,94 @@ set<android::String16> getKeys(const map<android::String16, T>& map) {
     }
     return keys;
 }
+
+status_t skipBytes(const Parcel* parcel, int32_t count, size_t elementSize) {
+    if (count < 0) return UNEXPECTED_NULL;
+    if (static_cast<size_t>(count) > parcel->dataAvail() / elementSize) return NOT_ENOUGH_DATA;
+    parcel->setDataPosition(parcel->dataPosition() + count * elementSize);
+    return NO_ERROR;
+}
+
+status_t skipString16(const Parcel* parcel) {
+    size_t length;
+    return parcel->readString16Inplace(&length) != nullptr ? NO_ERROR : UNEXPECTED_NULL;
+}
+
+// Moves past a value written by PersistableBundle::writeToParcelInner(), checking only what is
+// needed to find the next one.
+status_t skipValue(const Parcel* parcel, int32_t value_type) {
+    int32_t count;
+    switch (value_type) {
+        case VAL_STRING:
+            return skipString16(parcel);
+        case VAL_INTEGER:
+        case VAL_BOOLEAN:
+            return skipBytes(parcel, 1, sizeof(int32_t));
+        case VAL_LONG:
+        case VAL_DOUBLE:
+            return skipBytes(parcel, 1, sizeof(int64_t));
+        case VAL_STRINGARRAY: {
+            status_t status = parcel->readInt32(&count);
+            if (status != NO_ERROR) return status;
+            if (count < 0) return UNEXPECTED_NULL;
+            for (; count > 0; --count) {
+                status = skipString16(parcel);
+                if (status != NO_ERROR) return status;
+            }
+            return NO_ERROR;
+        }
+        case VAL_INTARRAY:
+        case VAL_BOOLEANARRAY: {
+            status_t status = parcel->readInt32(&count);
+            return status != NO_ERROR ? status : skipBytes(parcel, count, sizeof(int32_t));
+        }
+        case VAL_LONGARRAY:
+        case VAL_DOUBLEARRAY: {
+            status_t status = parcel->readInt32(&count);
+            return status != NO_ERROR ? status : skipBytes(parcel, count, sizeof(int64_t));
+        }
+        case VAL_PERSISTABLEBUNDLE: {
+            // The length of a nested bundle doesn't include its magic
+            status_t status = parcel->readInt32(&count);
+            if (status != NO_ERROR) return status;
+            if (count == 0) return NO_ERROR;
+            status = skipBytes(parcel, 1, sizeof(int32_t));
+            return status != NO_ERROR ? status : skipBytes(parcel, count, 1);
+        }
+        default:
+            ALOGE("Unrecognized type: %d", value_type);
+            return BAD_TYPE;
+    }
+}
 }  // namespace
 
 namespace android {
 
 namespace os {
 
+constexpr size_t PersistableBundle::LAZY_READ_THRESHOLD;
+
+struct PersistableBundle::LazyState {
+    struct Entry {
+        // points into parcel
+        const char16_t* key;
+        size_t keyLength;
+        int32_t type;
+        size_t valuePosition;
+
+        bool matches(const String16& other) const {
+            return keyLength == other.size() &&
+                    memcmp(key, other.string(), keyLength * sizeof(char16_t)) == 0;
+        }
+    };
+
+    // The entries as written by writeToParcelInner(), starting at their count
+    Parcel parcel;
+    std::vector<Entry> entries;
+    // Decoding moves the data position of parcel
+    mutable std::mutex lock;
+};
+
 #define RETURN_IF_FAILED(calledOnce)                                     \
     {                                                                    \
         status_t returnStatus = calledOnce;                              \
@@ -97,6 +183,14 @@ status_t PersistableBundle::writeToParcel(Parcel* parcel) const {
         return NO_ERROR;
     }
 
+    // An unmodified lazy bundle still has the bytes it was read from
+    if (mLazy) {
+        const size_t length = mLazy->parcel.dataSize();
+        RETURN_IF_FAILED(parcel->writeInt32(static_cast<int32_t>(length)));
+        RETURN_IF_FAILED(parcel->writeInt32(BUNDLE_MAGIC));
+        return parcel->appendFrom(&mLazy->parcel, 0, length);
+    }
+
     size_t length_pos = parcel->dataPosition();
     RETURN_IF_FAILED(parcel->writeInt32(1));  // dummy, will hold length
     RETURN_IF_FAILED(parcel->writeInt32(BUNDLE_MAGIC));
@@ -136,6 +230,8 @@ bool PersistableBundle::empty() const {
 }
 
 size_t PersistableBundle::size() const {
+    // The maps stay empty until a lazy bundle is decoded
+    if (mLazy) return mLazy->entries.size();
     return (mBoolMap.size() +
             mIntMap.size() +
             mLongMap.size() +
@@ -150,6 +246,7 @@ size_t PersistableBundle::size() const {
 }
 
 size_t PersistableBundle::erase(const String16& key) {
+    if (mLazy) unparcel();
     RETURN_IF_ENTRY_ERASED(mBoolMap, key);
     RETURN_IF_ENTRY_ERASED(mIntMap, key);
     RETURN_IF_ENTRY_ERASED(mLongMap, key);
@@ -219,93 +316,207 @@ void PersistableBundle::putPersistableBundle(const String16& key, const Persista
 }
 
 bool PersistableBundle::getBoolean(const String16& key, bool* out) const {
+    if (mLazy) {
+        return getLazyValue(key, VAL_BOOLEAN, out,
+                [](const Parcel* p, bool* v) { return p->readBool(v); });
+    }
     return getValue(key, out, mBoolMap);
 }
 
 bool PersistableBundle::getInt(const String16& key, int32_t* out) const {
+    if (mLazy) {
+        return getLazyValue(key, VAL_INTEGER, out,
+                [](const Parcel* p, int32_t* v) { return p->readInt32(v); });
+    }
     return getValue(key, out, mIntMap);
 }
 
 bool PersistableBundle::getLong(const String16& key, int64_t* out) const {
+    if (mLazy) {
+        return getLazyValue(key, VAL_LONG, out,
+                [](const Parcel* p, int64_t* v) { return p->readInt64(v); });
+    }
     return getValue(key, out, mLongMap);
 }
 
 bool PersistableBundle::getDouble(const String16& key, double* out) const {
+    if (mLazy) {
+        return getLazyValue(key, VAL_DOUBLE, out,
+                [](const Parcel* p, double* v) { return p->readDouble(v); });
+    }
     return getValue(key, out, mDoubleMap);
 }
 
 bool PersistableBundle::getString(const String16& key, String16* out) const {
+    if (mLazy) {
+        return getLazyValue(key, VAL_STRING, out,
+                [](const Parcel* p, String16* v) { return p->readString16(v); });
+    }
     return getValue(key, out, mStringMap);
 }
 
 bool PersistableBundle::getBooleanVector(const String16& key, vector<bool>* out) const {
+    if (mLazy) {
+        return getLazyValue(key, VAL_BOOLEANARRAY, out,
+                [](const Parcel* p, vector<bool>* v) { return p->readBoolVector(v); });
+    }
     return getValue(key, out, mBoolVectorMap);
 }
 
 bool PersistableBundle::getIntVector(const String16& key, vector<int32_t>* out) const {
+    if (mLazy) {
+        return getLazyValue(key, VAL_INTARRAY, out,
+                [](const Parcel* p, vector<int32_t>* v) { return p->readInt32Vector(v); });
+    }
     return getValue(key, out, mIntVectorMap);
 }
 
 bool PersistableBundle::getLongVector(const String16& key, vector<int64_t>* out) const {
+    if (mLazy) {
+        return getLazyValue(key, VAL_LONGARRAY, out,
+                [](const Parcel* p, vector<int64_t>* v) { return p->readInt64Vector(v); });
+    }
     return getValue(key, out, mLongVectorMap);
 }
 
 bool PersistableBundle::getDoubleVector(const String16& key, vector<double>* out) const {
+    if (mLazy) {
+        return getLazyValue(key, VAL_DOUBLEARRAY, out,
+                [](const Parcel* p, vector<double>* v) { return p->readDoubleVector(v); });
+    }
     return getValue(key, out, mDoubleVectorMap);
 }
 
 bool PersistableBundle::getStringVector(const String16& key, vector<String16>* out) const {
+    if (mLazy) {
+        return getLazyValue(key, VAL_STRINGARRAY, out,
+                [](const Parcel* p, vector<String16>* v) { return p->readString16Vector(v); });
+    }
     return getValue(key, out, mStringVectorMap);
 }
 
 bool PersistableBundle::getPersistableBundle(const String16& key, PersistableBundle* out) const {
+    if (mLazy) {
+        return getLazyValue(key, VAL_PERSISTABLEBUNDLE, out,
+                [](const Parcel* p, PersistableBundle* v) { return v->readFromParcel(p); });
+    }
     return getValue(key, out, mPersistableBundleMap);
 }
 
 set<String16> PersistableBundle::getBooleanKeys() const {
+    if (mLazy) return getLazyKeys(VAL_BOOLEAN);
     return getKeys(mBoolMap);
 }
 
 set<String16> PersistableBundle::getIntKeys() const {
+    if (mLazy) return getLazyKeys(VAL_INTEGER);
     return getKeys(mIntMap);
 }
 
 set<String16> PersistableBundle::getLongKeys() const {
+    if (mLazy) return getLazyKeys(VAL_LONG);
     return getKeys(mLongMap);
 }
 
 set<String16> PersistableBundle::getDoubleKeys() const {
+    if (mLazy) return getLazyKeys(VAL_DOUBLE);
     return getKeys(mDoubleMap);
 }
 
 set<String16> PersistableBundle::getStringKeys() const {
+    if (mLazy) return getLazyKeys(VAL_STRING);
     return getKeys(mStringMap);
 }
 
 set<String16> PersistableBundle::getBooleanVectorKeys() const {
+    if (mLazy) return getLazyKeys(VAL_BOOLEANARRAY);
     return getKeys(mBoolVectorMap);
 }
 
 set<String16> PersistableBundle::getIntVectorKeys() const {
+    if (mLazy) return getLazyKeys(VAL_INTARRAY);
     return getKeys(mIntVectorMap);
 }
 
 set<String16> PersistableBundle::getLongVectorKeys() const {
+    if (mLazy) return getLazyKeys(VAL_LONGARRAY);
     return getKeys(mLongVectorMap);
 }
 
 set<String16> PersistableBundle::getDoubleVectorKeys() const {
+    if (mLazy) return getLazyKeys(VAL_DOUBLEARRAY);
     return getKeys(mDoubleVectorMap);
 }
 
 set<String16> PersistableBundle::getStringVectorKeys() const {
+    if (mLazy) return getLazyKeys(VAL_STRINGARRAY);
     return getKeys(mStringVectorMap);
 }
 
 set<String16> PersistableBundle::getPersistableBundleKeys() const {
+    if (mLazy) return getLazyKeys(VAL_PERSISTABLEBUNDLE);
     return getKeys(mPersistableBundleMap);
 }
 
+bool operator==(const PersistableBundle& lhs, const PersistableBundle& rhs) {
+    if (lhs.mLazy || rhs.mLazy) {
+        PersistableBundle lhsCopy(lhs);
+        PersistableBundle rhsCopy(rhs);
+        if (lhsCopy.mLazy) lhsCopy.unparcel();
+        if (rhsCopy.mLazy) rhsCopy.unparcel();
+        return lhsCopy == rhsCopy;
+    }
+    return (lhs.mBoolMap == rhs.mBoolMap && lhs.mIntMap == rhs.mIntMap &&
+            lhs.mLongMap == rhs.mLongMap && lhs.mDoubleMap == rhs.mDoubleMap &&
+            lhs.mStringMap == rhs.mStringMap && lhs.mBoolVectorMap == rhs.mBoolVectorMap &&
+            lhs.mIntVectorMap == rhs.mIntVectorMap &&
+            lhs.mLongVectorMap == rhs.mLongVectorMap &&
+            lhs.mDoubleVectorMap == rhs.mDoubleVectorMap &&
+            lhs.mStringVectorMap == rhs.mStringVectorMap &&
+            lhs.mPersistableBundleMap == rhs.mPersistableBundleMap);
+}
+
+template <typename T, typename Reader>
+bool PersistableBundle::getLazyValue(const String16& key, int32_t type, T* out,
+                                     Reader read) const {
+    for (const auto& entry : mLazy->entries) {
+        if (!entry.matches(key)) continue;
+        if (entry.type != type) return false;
+
+        T value;
+        {
+            std::lock_guard<std::mutex> lock(mLazy->lock);
+            mLazy->parcel.setDataPosition(entry.valuePosition);
+            if (read(&mLazy->parcel, &value) != NO_ERROR) {
+                ALOGE("Failed to decode value of type %d", type);
+                return false;
+            }
+        }
+        *out = value;
+        return true;
+    }
+    return false;
+}
+
+set<String16> PersistableBundle::getLazyKeys(int32_t type) const {
+    set<String16> keys;
+    for (const auto& entry : mLazy->entries) {
+        if (entry.type == type) {
+            keys.emplace(entry.key, entry.keyLength);
+        }
+    }
+    return keys;
+}
+
+void PersistableBundle::unparcel() {
+    std::shared_ptr<const LazyState> lazy = std::move(mLazy);
+    std::lock_guard<std::mutex> lock(lazy->lock);
+    lazy->parcel.setDataPosition(0);
+    if (readEntries(&lazy->parcel) != NO_ERROR) {
+        ALOGE("Failed to decode lazily read PersistableBundle");
+    }
+}
+
 status_t PersistableBundle::writeToParcelInner(Parcel* parcel) const {
     /*
      * To keep this implementation in sync with writeArrayMapInternal() in
@@ -381,9 +592,8 @@ status_t PersistableBundle::writeToParcelInner(Parcel* parcel) const {
 
 status_t PersistableBundle::readFromParcelInner(const Parcel* parcel, size_t length) {
     /*
-     * Note: we don't actually use length for anything other than an empty PersistableBundle
-     * check, since we do not actually need to copy in an entire Parcel, unlike in the Java
-     * implementation.
+     * Note: besides the empty PersistableBundle check, length is only used to decide whether
+     * to read lazily, in which case the entries are copied like in the Java implementation.
      */
     if (length == 0) {
         // Empty PersistableBundle or end of data.
@@ -397,6 +607,47 @@ status_t PersistableBundle::readFromParcelInner(const Parcel* parcel, size_t len
         return BAD_VALUE;
     }
 
+    // Reading into a bundle that has entries already merges them, which needs the maps
+    if (mLazy) unparcel();
+    if (length >= LAZY_READ_THRESHOLD && empty()) {
+        return readLazily(parcel, length);
+    }
+    return readEntries(parcel);
+}
+
+status_t PersistableBundle::readLazily(const Parcel* parcel, size_t length) {
+    if (length > parcel->dataAvail()) {
+        ALOGE("Bad length in parcel: %zu", length);
+        return BAD_VALUE;
+    }
+
+    std::shared_ptr<LazyState> lazy = std::make_shared<LazyState>();
+    const size_t start = parcel->dataPosition();
+    RETURN_IF_FAILED(lazy->parcel.appendFrom(parcel, start, length));
+    parcel->setDataPosition(start + length);
+
+    const Parcel* p = &lazy->parcel;
+    p->setDataPosition(0);
+    int32_t num_entries;
+    RETURN_IF_FAILED(p->readInt32(&num_entries));
+    for (; num_entries > 0; --num_entries) {
+        LazyState::Entry entry;
+        entry.key = p->readString16Inplace(&entry.keyLength);
+        if (entry.key == nullptr) {
+            ALOGE("Failed at %s:%d (%s)", __FILE__, __LINE__, __func__);
+            return UNEXPECTED_NULL;
+        }
+        RETURN_IF_FAILED(p->readInt32(&entry.type));
+        entry.valuePosition = p->dataPosition();
+        RETURN_IF_FAILED(skipValue(p, entry.type));
+        lazy->entries.push_back(entry);
+    }
+
+    mLazy = std::move(lazy);
+    return NO_ERROR;
+}
+
+status_t PersistableBundle::readEntries(const Parcel* parcel) {
     /*
      * To keep this implementation in sync with unparcel() in
      * frameworks/base/core/java/android/os/BaseBundle.java, the number of
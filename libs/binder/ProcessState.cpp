@@ -25,6 +25,7 @@
 #include <utils/String8.h>
 #include <binder/IServiceManager.h>
 #include <utils/String8.h>
+#include <utils/SystemClock.h>
 #include <utils/threads.h>
 
 #include <private/binder/binder_module.h>
@@ -32,6 +33,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -40,6 +42,8 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <algorithm>
+
 #define BINDER_VM_SIZE ((1 * 1024 * 1024) - sysconf(_SC_PAGE_SIZE) * 2)
 #define DEFAULT_MAX_BINDER_THREADS 15
 
@@ -50,19 +54,25 @@ namespace android {
 class PoolThread : public Thread
 {
 public:
-    explicit PoolThread(bool isMain)
+    explicit PoolThread(bool isMain, bool isAdded = false)
         : mIsMain(isMain)
+        , mIsAdded(isAdded)
     {
     }
     
 protected:
     virtual bool threadLoop()
     {
-        IPCThreadState::self()->joinThreadPool(mIsMain);
+        if (mIsAdded) {
+            IPCThreadState::self()->joinAddedThreadPool();
+        } else {
+            IPCThreadState::self()->joinThreadPool(mIsMain);
+        }
         return false;
     }
     
     const bool mIsMain;
+    const bool mIsAdded;
 };
 
 sp<ProcessState> ProcessState::self()
@@ -318,6 +328,89 @@ status_t ProcessState::setThreadPoolMaxThreadCount(size_t maxThreads) {
     return result;
 }
 
+status_t ProcessState::setThreadPoolPolicy(const ThreadPoolPolicy& policy) {
+    if (policy.growAfterMs < 0 || policy.idleTimeoutMs < 0) {
+        return BAD_VALUE;
+    }
+    pthread_mutex_lock(&mThreadCountLock);
+    mThreadPoolPolicy = policy;
+    pthread_mutex_unlock(&mThreadCountLock);
+    return NO_ERROR;
+}
+
+ProcessState::ThreadPoolStats ProcessState::getThreadPoolStats() {
+    ThreadPoolStats stats;
+    pthread_mutex_lock(&mThreadCountLock);
+    stats.maxThreads = threadPoolCapacityLocked();
+    stats.executingThreads = mExecutingThreadsCount;
+    stats.addedThreads = mAddedThreads;
+    stats.saturationEvents = mSaturationEvents;
+    stats.blockedCallers = mBlockedCallers;
+    stats.saturatedTimeMs = mSaturatedTimeMs;
+    if (mStarvationStartTimeMs != 0) {
+        stats.saturatedTimeMs += uptimeMillis() - mStarvationStartTimeMs;
+    }
+    pthread_mutex_unlock(&mThreadCountLock);
+    return stats;
+}
+
+size_t ProcessState::threadPoolCapacityLocked() const {
+    return mMaxThreads + mAddedThreads;
+}
+
+void ProcessState::threadPoolSaturatedLocked(int64_t nowMs) {
+    if (mStarvationStartTimeMs == 0) {
+        mStarvationStartTimeMs = nowMs;
+        mSaturationEvents++;
+    }
+}
+
+void ProcessState::threadPoolUnsaturatedLocked(int64_t nowMs) {
+    if (mStarvationStartTimeMs != 0) {
+        int64_t starvationTimeMs = nowMs - mStarvationStartTimeMs;
+        if (starvationTimeMs > 100) {
+            ALOGE("binder thread pool (%zu threads) starved for %" PRId64 " ms",
+                  threadPoolCapacityLocked(), starvationTimeMs);
+        }
+        mSaturatedTimeMs += starvationTimeMs;
+        mStarvationStartTimeMs = 0;
+    }
+}
+
+bool ProcessState::growThreadPoolLocked(int64_t nowMs, bool force) {
+    if (!mThreadPoolStarted || threadPoolCapacityLocked() >= mThreadPoolPolicy.maxThreads) {
+        return false;
+    }
+    if (!force) {
+        // Only sustained queueing counts, not every burst that happens
+        // to keep all threads busy for a moment.
+        const int64_t sinceMs = std::max(mStarvationStartTimeMs, mLastGrowthTimeMs);
+        if (mStarvationStartTimeMs == 0 || nowMs - sinceMs < mThreadPoolPolicy.growAfterMs) {
+            return false;
+        }
+    }
+    mAddedThreads++;
+    mLastGrowthTimeMs = nowMs;
+    ALOGI("binder thread pool saturated, growing it to %zu threads",
+          threadPoolCapacityLocked());
+    return true;
+}
+
+bool ProcessState::retireAddedThreadLocked() {
+    if (mAddedThreads == 0) {
+        return false;
+    }
+    mAddedThreads--;
+    return true;
+}
+
+void ProcessState::spawnAddedThread() {
+    String8 name = makeBinderThreadName();
+    ALOGV("Spawning added pooled thread, name=%s\n", name.string());
+    sp<Thread> t = new PoolThread(false, true);
+    t->run(name.string());
+}
+
 void ProcessState::giveThreadPoolName() {
     androidSetThreadName( makeBinderThreadName().string() );
 }
@@ -363,6 +456,12 @@ ProcessState::ProcessState(const char *driver)
     , mExecutingThreadsCount(0)
     , mMaxThreads(DEFAULT_MAX_BINDER_THREADS)
     , mStarvationStartTimeMs(0)
+    , mAddedThreads(0)
+    , mThreadPoolPolicy{0, 0, 0}
+    , mLastGrowthTimeMs(0)
+    , mSaturationEvents(0)
+    , mBlockedCallers(0)
+    , mSaturatedTimeMs(0)
     , mManagesContexts(false)
     , mBinderContextCheckFunc(NULL)
     , mBinderContextUserData(NULL)
@@ -0,0 +1,344 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "TransactionStats"
+
+#include <binder/TransactionStats.h>
+
+#include <binder/Binder.h>
+#include <cutils/properties.h>
+#include <utils/Log.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace android {
+
+// ---------------------------------------------------------------------------
+
+namespace {
+
+typedef std::pair<uintptr_t, uint32_t> Key;
+
+struct KeyHash {
+    size_t operator()(const Key& key) const {
+        return std::hash<uintptr_t>()(key.first) * 31 + key.second;
+    }
+};
+
+inline size_t bucketOf(uint64_t value) {
+    if (value == 0) {
+        return 0;
+    }
+    const size_t bucket = 64 - static_cast<size_t>(__builtin_clzll(value));
+    return std::min(bucket, TransactionStats::NUM_BUCKETS - 1);
+}
+
+// Written only by the thread owning them, so plain loads and stores are
+// enough; they are atomic so that dump can read them at any time.
+struct Histograms {
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> totalLatencyUs;
+    std::atomic<uint64_t> latency[TransactionStats::NUM_BUCKETS];
+    std::atomic<uint64_t> dataSize[TransactionStats::NUM_BUCKETS];
+    std::atomic<uint64_t> replySize[TransactionStats::NUM_BUCKETS];
+
+    Histograms() { clear(); }
+
+    static void increment(std::atomic<uint64_t>& counter, uint64_t value) {
+        counter.store(counter.load(std::memory_order_relaxed) + value,
+                std::memory_order_relaxed);
+    }
+
+    void record(nsecs_t latencyNs, size_t data, size_t reply) {
+        const uint64_t latencyUs = latencyNs > 0 ? static_cast<uint64_t>(latencyNs) / 1000 : 0;
+        increment(count, 1);
+        increment(totalLatencyUs, latencyUs);
+        increment(latency[bucketOf(latencyUs)], 1);
+        increment(dataSize[bucketOf(data)], 1);
+        increment(replySize[bucketOf(reply)], 1);
+    }
+
+    void clear() {
+        count.store(0, std::memory_order_relaxed);
+        totalLatencyUs.store(0, std::memory_order_relaxed);
+        for (size_t i = 0; i < TransactionStats::NUM_BUCKETS; i++) {
+            latency[i].store(0, std::memory_order_relaxed);
+            dataSize[i].store(0, std::memory_order_relaxed);
+            replySize[i].store(0, std::memory_order_relaxed);
+        }
+    }
+};
+
+// A snapshot of Histograms, summed over objects and threads
+struct Totals {
+    uint64_t count = 0;
+    uint64_t totalLatencyUs = 0;
+    uint64_t latency[TransactionStats::NUM_BUCKETS] = {};
+    uint64_t dataSize[TransactionStats::NUM_BUCKETS] = {};
+    uint64_t replySize[TransactionStats::NUM_BUCKETS] = {};
+
+    void add(const Histograms& h) {
+        count += h.count.load(std::memory_order_relaxed);
+        totalLatencyUs += h.totalLatencyUs.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < TransactionStats::NUM_BUCKETS; i++) {
+            latency[i] += h.latency[i].load(std::memory_order_relaxed);
+            dataSize[i] += h.dataSize[i].load(std::memory_order_relaxed);
+            replySize[i] += h.replySize[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    void add(const Totals& t) {
+        count += t.count;
+        totalLatencyUs += t.totalLatencyUs;
+        for (size_t i = 0; i < TransactionStats::NUM_BUCKETS; i++) {
+            latency[i] += t.latency[i];
+            dataSize[i] += t.dataSize[i];
+            replySize[i] += t.replySize[i];
+        }
+    }
+};
+
+struct IncomingEntry {
+    // Named when the object is first seen, since asking for the descriptor
+    // on every transaction would cost more than recording it
+    String16 descriptor;
+    Histograms histograms;
+};
+
+typedef std::map<std::pair<String16, uint32_t>, Totals> IncomingTotals;
+typedef std::map<std::pair<int32_t, uint32_t>, Totals> OutgoingTotals;
+
+} // namespace
+
+struct ThreadTransactionStats {
+    // Taken by the owning thread only to add entries, and by dump and reset
+    // to go through them; lookups and updates by the owner don't need it.
+    std::mutex lock;
+    std::unordered_map<Key, std::unique_ptr<IncomingEntry>, KeyHash> incoming;
+    std::unordered_map<Key, std::unique_ptr<Histograms>, KeyHash> outgoing;
+
+    void addTo(IncomingTotals* incomingTotals, OutgoingTotals* outgoingTotals) {
+        for (const auto& entry : incoming) {
+            (*incomingTotals)[std::make_pair(entry.second->descriptor, entry.first.second)]
+                    .add(entry.second->histograms);
+        }
+        for (const auto& entry : outgoing) {
+            (*outgoingTotals)[std::make_pair(static_cast<int32_t>(entry.first.first),
+                    entry.first.second)].add(*entry.second);
+        }
+    }
+};
+
+namespace {
+
+struct Registry {
+    std::mutex lock;
+    std::vector<ThreadTransactionStats*> threads;
+    // what the threads that exited had recorded
+    IncomingTotals retiredIncoming;
+    OutgoingTotals retiredOutgoing;
+};
+
+// Never destroyed, since binder threads may still be exiting at exit()
+Registry& registry() {
+    static Registry* sRegistry = new Registry;
+    return *sRegistry;
+}
+
+std::atomic<bool>& enabledFlag() {
+    static std::atomic<bool> sEnabled(property_get_bool("binder.transaction_stats", false));
+    return sEnabled;
+}
+
+void appendHistogram(String8& result, const char* name, const uint64_t* buckets) {
+    result.appendFormat("      %s:", name);
+    for (size_t i = 0; i < TransactionStats::NUM_BUCKETS; i++) {
+        if (buckets[i] == 0) {
+            continue;
+        }
+        if (i == 0) {
+            result.appendFormat(" 0:%" PRIu64, buckets[i]);
+        } else if (i == TransactionStats::NUM_BUCKETS - 1) {
+            result.appendFormat(" %" PRIu64 "+:%" PRIu64, uint64_t(1) << (i - 1), buckets[i]);
+        } else {
+            result.appendFormat(" %" PRIu64 "-%" PRIu64 ":%" PRIu64,
+                    uint64_t(1) << (i - 1), uint64_t(1) << i, buckets[i]);
+        }
+    }
+    result.append("\n");
+}
+
+void appendTotals(String8& result, const Totals& totals) {
+    result.appendFormat(" %" PRIu64 " calls, %" PRIu64 " us avg\n", totals.count,
+            totals.count ? totals.totalLatencyUs / totals.count : 0);
+    appendHistogram(result, "latency (us)", totals.latency);
+    appendHistogram(result, "data (bytes)", totals.dataSize);
+    appendHistogram(result, "reply (bytes)", totals.replySize);
+}
+
+// Busiest first
+template <typename Map>
+std::vector<typename Map::const_iterator> sortedByCount(const Map& map) {
+    std::vector<typename Map::const_iterator> sorted;
+    for (auto it = map.begin(); it != map.end(); ++it) {
+        sorted.push_back(it);
+    }
+    std::stable_sort(sorted.begin(), sorted.end(),
+            [](typename Map::const_iterator lhs, typename Map::const_iterator rhs) {
+                return lhs->second.count > rhs->second.count;
+            });
+    return sorted;
+}
+
+} // namespace
+
+// ---------------------------------------------------------------------------
+
+bool TransactionStats::isEnabled()
+{
+    return enabledFlag().load(std::memory_order_relaxed);
+}
+
+void TransactionStats::setEnabled(bool enabled)
+{
+    enabledFlag().store(enabled, std::memory_order_relaxed);
+}
+
+void TransactionStats::reset()
+{
+    Registry& r = registry();
+    std::lock_guard<std::mutex> _l(r.lock);
+    r.retiredIncoming.clear();
+    r.retiredOutgoing.clear();
+    for (ThreadTransactionStats* stats : r.threads) {
+        std::lock_guard<std::mutex> _t(stats->lock);
+        for (auto& entry : stats->incoming) {
+            entry.second->histograms.clear();
+        }
+        for (auto& entry : stats->outgoing) {
+            entry.second->clear();
+        }
+    }
+}
+
+void TransactionStats::dump(String8& result)
+{
+    IncomingTotals incoming;
+    OutgoingTotals outgoing;
+    {
+        Registry& r = registry();
+        std::lock_guard<std::mutex> _l(r.lock);
+        incoming = r.retiredIncoming;
+        outgoing = r.retiredOutgoing;
+        for (ThreadTransactionStats* stats : r.threads) {
+            std::lock_guard<std::mutex> _t(stats->lock);
+            stats->addTo(&incoming, &outgoing);
+        }
+    }
+
+    result.appendFormat("Binder transaction stats of pid %d (%s):\n", getpid(),
+            isEnabled() ? "enabled" : "disabled");
+    result.append("  Incoming:\n");
+    for (const auto& it : sortedByCount(incoming)) {
+        result.appendFormat("    %s code %u:", String8(it->first.first).string(),
+                it->first.second);
+        appendTotals(result, it->second);
+    }
+    result.append("  Outgoing:\n");
+    for (const auto& it : sortedByCount(outgoing)) {
+        result.appendFormat("    handle %d code %u:", it->first.first, it->first.second);
+        appendTotals(result, it->second);
+    }
+}
+
+status_t TransactionStats::dump(int fd)
+{
+    String8 result;
+    dump(result);
+    const char* data = result.string();
+    size_t size = result.size();
+    while (size > 0) {
+        const ssize_t written = TEMP_FAILURE_RETRY(write(fd, data, size));
+        if (written < 0) {
+            return -errno;
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+    return NO_ERROR;
+}
+
+ThreadTransactionStats* TransactionStats::createThreadStats()
+{
+    ThreadTransactionStats* stats = new ThreadTransactionStats;
+    Registry& r = registry();
+    std::lock_guard<std::mutex> _l(r.lock);
+    r.threads.push_back(stats);
+    return stats;
+}
+
+void TransactionStats::retireThreadStats(ThreadTransactionStats* stats)
+{
+    if (stats == NULL) {
+        return;
+    }
+    Registry& r = registry();
+    {
+        std::lock_guard<std::mutex> _l(r.lock);
+        r.threads.erase(std::remove(r.threads.begin(), r.threads.end(), stats), r.threads.end());
+        stats->addTo(&r.retiredIncoming, &r.retiredOutgoing);
+    }
+    delete stats;
+}
+
+void TransactionStats::recordOutgoing(ThreadTransactionStats* stats, int32_t handle,
+        uint32_t code, nsecs_t latency, size_t dataSize, size_t replySize)
+{
+    const Key key(static_cast<uintptr_t>(handle), code);
+    auto it = stats->outgoing.find(key);
+    if (it == stats->outgoing.end()) {
+        std::lock_guard<std::mutex> _l(stats->lock);
+        it = stats->outgoing.emplace(key, std::unique_ptr<Histograms>(new Histograms)).first;
+    }
+    it->second->record(latency, dataSize, replySize);
+}
+
+void TransactionStats::recordIncoming(ThreadTransactionStats* stats, BBinder* target,
+        uint32_t code, nsecs_t latency, size_t dataSize, size_t replySize)
+{
+    const Key key(reinterpret_cast<uintptr_t>(target), code);
+    auto it = stats->incoming.find(key);
+    if (it == stats->incoming.end()) {
+        std::unique_ptr<IncomingEntry> entry(new IncomingEntry);
+        entry->descriptor = target->getInterfaceDescriptor();
+        std::lock_guard<std::mutex> _l(stats->lock);
+        it = stats->incoming.emplace(key, std::move(entry)).first;
+    }
+    it->second->histograms.record(latency, dataSize, replySize);
+}
+
+}; // namespace android
@@ -79,6 +79,14 @@ public:
     void* pointer() const;
     size_t size() const;
     ssize_t offset() const;
+
+    // Write memory along with its heap, offset and size, so that the
+    // IMemory read back in another process doesn't have to ask for them
+    // with a transaction; its heap is only mapped once per process. Both
+    // ends must use these instead of writeStrongBinder() and
+    // interface_cast.
+    static status_t writeToParcel(Parcel* parcel, const sp<IMemory>& memory);
+    static sp<IMemory> readFromParcel(const Parcel& parcel);
 };
 
 class BnMemory : public BnInterface<IMemory>
@@ -29,6 +29,8 @@ typedef  int  uid_t;
 // ---------------------------------------------------------------------------
 namespace android {
 
+struct ThreadTransactionStats;
+
 class IPCThreadState
 {
 public:
@@ -64,6 +66,21 @@ public:
                                          uint32_t code, const Parcel& data,
                                          Parcel* reply, uint32_t flags);
 
+            // Oneway transactions made on this thread between beginOnewayBatch()
+            // and endOnewayBatch() are held back, then handed to the driver
+            // together in one BINDER_WRITE_READ: when the batch ends, when it
+            // fills up, on flushCommands(), or before any other transaction
+            // from the thread, so that they stay in order. Their transact()
+            // returns NO_ERROR; errors are reported by the flush instead.
+            // Batches nest, and the outermost end flushes.
+            void                beginOnewayBatch();
+            status_t            endOnewayBatch();
+            status_t            flushOnewayBatch();
+
+            // BC_RELEASE is held back until this thread next talks to the
+            // driver, and an incStrongHandle() of the same handle before then
+            // cancels it. A decStrongHandle() right after the
+            // incStrongHandle() of the same handle cancels the BC_ACQUIRE.
             void                incStrongHandle(int32_t handle);
             void                decStrongHandle(int32_t handle);
             void                incWeakHandle(int32_t handle);
@@ -89,7 +106,19 @@ public:
             // the maximum number of binder threads threads allowed for this process.
             void                blockUntilThreadAvailable();
 
+            // Parcel data buffers freed on this thread are kept here for the next
+            // Parcel allocated on it, so that the Parcels of back-to-back
+            // transactions reuse capacity instead of going to malloc every time.
+            // takeParcelBuffer returns NULL, and recycleParcelBuffer false, when
+            // the pool can't help; the caller then uses malloc and free.
+            uint8_t*            takeParcelBuffer(size_t desired, size_t* outCapacity);
+            bool                recycleParcelBuffer(uint8_t* data, size_t capacity);
+            // Frees the pooled buffers, e.g. before the thread goes idle for long.
+            void                trimParcelBuffers();
+
 private:
+    friend class PoolThread;
+
                                 IPCThreadState();
                                 ~IPCThreadState();
 
@@ -97,6 +126,7 @@ private:
             status_t            waitForResponse(Parcel *reply,
                                                 status_t *acquireResult=NULL);
             status_t            talkWithDriver(bool doReceive=true);
+            void                writePendingStrongReleases();
             status_t            writeTransactionData(int32_t cmd,
                                                      uint32_t binderFlags,
                                                      int32_t handle,
@@ -105,9 +135,22 @@ private:
                                                      status_t* statusBuffer);
             status_t            getAndExecuteCommand();
             status_t            executeCommand(int32_t command);
+            // Returns false if the transaction must be sent right away.
+            bool                queueOneway(int32_t handle, uint32_t code,
+                                            const Parcel& data, uint32_t flags);
             void                processPendingDerefs();
 
+            // Threads added by the adaptive pool policy of ProcessState.
+            void                joinAddedThreadPool();
+            void                threadPoolLoop(bool isMain, bool isAdded);
+            // Returns false if no work came in for the idle timeout of the
+            // policy.
+            bool                waitForWork();
+
             void                clearCaller();
+            void                recordIncomingStats(BBinder* target, uint32_t code,
+                                                    nsecs_t latency, size_t dataSize,
+                                                    size_t replySize);
 
     static  void                threadDestructor(void *st);
     static  void                freeBuffer(Parcel* parcel,
@@ -115,10 +158,42 @@ private:
                                            const binder_size_t* objects, size_t objectsSize,
                                            void* cookie);
     
+    // Buffers larger than this are freed rather than pooled, so that one
+    // large transaction doesn't keep its memory around on every thread.
+    static  const size_t        MAX_POOLED_PARCEL_CAPACITY = 8 * 1024;
+    static  const size_t        PARCEL_POOL_SIZE = 4;
+
+    struct PooledParcelBuffer {
+        uint8_t* data;
+        size_t capacity;
+    };
+
+    // A batch is flushed once it holds this many transactions or bytes,
+    // which keeps it well within the async space of the receivers.
+    static  const size_t        MAX_ONEWAY_BATCH_COUNT = 32;
+    static  const size_t        MAX_ONEWAY_BATCH_SIZE = 64 * 1024;
+
+    // Held back BC_RELEASEs are written out once there are this many, which
+    // bounds the search done by incStrongHandle().
+    static  const size_t        MAX_PENDING_STRONG_RELEASES = 64;
+
+    struct QueuedOneway {
+        int32_t handle;
+        uint32_t code;
+        uint32_t flags;
+        Parcel* data;
+    };
+
     const   sp<ProcessState>    mProcess;
             Vector<BBinder*>    mPendingStrongDerefs;
             Vector<RefBase::weakref_type*> mPendingWeakDerefs;
 
+            // least recently recycled first; declared before mIn and mOut
+            // since their destructors may recycle into it
+            PooledParcelBuffer  mParcelPool[PARCEL_POOL_SIZE];
+            size_t              mParcelPoolCount;
+            bool                mParcelPoolClosed;
+
             Parcel              mIn;
             Parcel              mOut;
             status_t            mLastError;
@@ -126,6 +201,18 @@ private:
             uid_t               mCallingUid;
             int32_t             mStrictModePolicy;
             int32_t             mLastTransactionBinderFlags;
+            ThreadTransactionStats* mTransactionStats;
+            // copies of the queued Parcels, since the callers' ones are gone by
+            // the time the batch is flushed
+            Vector<QueuedOneway> mOnewayBatch;
+            size_t              mOnewayBatchSize;
+            int32_t             mOnewayBatchDepth;
+            // handles for which decStrongHandle() is yet to write BC_RELEASE
+            Vector<int32_t>     mPendingStrongReleases;
+            // where the last BC_ACQUIRE written to mOut ends, if it is still
+            // the last command, and its handle
+            size_t              mLastAcquireEnd;
+            int32_t             mLastAcquireHandle;
 };
 
 }; // namespace android
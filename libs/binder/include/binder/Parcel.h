@@ -233,6 +233,13 @@ public:
 
     status_t            writeObject(const flat_binder_object& val, bool nullMetaData);
 
+    // Writes a reference to a buffer instead of its contents: the binder
+    // driver copies it straight into the receiver's transaction buffer, so
+    // large payloads are copied once rather than into the parcel first. The
+    // buffer must stay valid and unchanged until the transaction is sent.
+    // Parcels holding buffer references can't be appended to other Parcels.
+    status_t            writeBufferReference(const void* buffer, size_t length);
+
     // Like Parcel.java's writeNoException().  Just writes a zero int32.
     // Currently the native implementation doesn't do any of the StrictMode
     // stack gathering and serialization that the Java implementation does.
@@ -377,6 +384,10 @@ public:
 
     const flat_binder_object* readObject(bool nullMetaData) const;
 
+    // Reads a buffer written with writeBufferReference(). The data stays valid
+    // as long as this Parcel.
+    status_t            readBufferReference(const void** outBuffer, size_t* outLength) const;
+
     // Explicitly close all file descriptors in the parcel.
     void                closeFileDescriptors();
 
@@ -394,6 +405,8 @@ private:
     size_t              ipcDataSize() const;
     uintptr_t           ipcObjects() const;
     size_t              ipcObjectsCount() const;
+    // size of the buffers referenced by the parcel, as the driver counts it
+    size_t              ipcBuffersSize() const;
     void                ipcSetDataReference(const uint8_t* data, size_t dataSize,
                                             const binder_size_t* objects, size_t objectsCount,
                                             release_func relFunc, void* relCookie);
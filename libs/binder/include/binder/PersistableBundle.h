@@ -18,6 +18,7 @@
 #define ANDROID_PERSISTABLE_BUNDLE_H
 
 #include <map>
+#include <memory>
 #include <set>
 #include <vector>
 
@@ -32,6 +33,12 @@ namespace os {
 /*
  * C++ implementation of PersistableBundle, a mapping from String values to
  * various types that can be saved to persistent and later restored.
+ *
+ * Large bundles are read from a Parcel lazily: readFromParcel() keeps a copy of
+ * the raw bytes and an index of the keys, and the getters only decode the value
+ * they are asked for. Writing an unmodified lazy bundle copies the raw bytes
+ * back. The first change to the bundle decodes all of it. Errors within nested
+ * bundles are only reported when they are accessed.
  */
 class PersistableBundle : public Parcelable {
 public:
@@ -93,24 +100,33 @@ public:
     std::set<String16> getStringVectorKeys() const;
     std::set<String16> getPersistableBundleKeys() const;
 
-    friend bool operator==(const PersistableBundle& lhs, const PersistableBundle& rhs) {
-        return (lhs.mBoolMap == rhs.mBoolMap && lhs.mIntMap == rhs.mIntMap &&
-                lhs.mLongMap == rhs.mLongMap && lhs.mDoubleMap == rhs.mDoubleMap &&
-                lhs.mStringMap == rhs.mStringMap && lhs.mBoolVectorMap == rhs.mBoolVectorMap &&
-                lhs.mIntVectorMap == rhs.mIntVectorMap &&
-                lhs.mLongVectorMap == rhs.mLongVectorMap &&
-                lhs.mDoubleVectorMap == rhs.mDoubleVectorMap &&
-                lhs.mStringVectorMap == rhs.mStringVectorMap &&
-                lhs.mPersistableBundleMap == rhs.mPersistableBundleMap);
-    }
+    friend bool operator==(const PersistableBundle& lhs, const PersistableBundle& rhs);
 
     friend bool operator!=(const PersistableBundle& lhs, const PersistableBundle& rhs) {
         return !(lhs == rhs);
     }
 
 private:
+    // Bundles whose parcelled size is at least this many bytes are read lazily
+    static constexpr size_t LAZY_READ_THRESHOLD = 1024;
+
+    // The raw bytes of a lazily read bundle and the index of its keys. Shared
+    // by the copies of the bundle, and never modified once built.
+    struct LazyState;
+
     status_t writeToParcelInner(Parcel* parcel) const;
     status_t readFromParcelInner(const Parcel* parcel, size_t length);
+    status_t readEntries(const Parcel* parcel);
+    status_t readLazily(const Parcel* parcel, size_t length);
+
+    // Decodes all of a lazily read bundle into the maps
+    void unparcel();
+
+    template <typename T, typename Reader>
+    bool getLazyValue(const String16& key, int32_t type, T* out, Reader read) const;
+    std::set<String16> getLazyKeys(int32_t type) const;
+
+    std::shared_ptr<const LazyState> mLazy;
 
     std::map<String16, bool> mBoolMap;
     std::map<String16, int32_t> mIntMap;
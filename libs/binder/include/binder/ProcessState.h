@@ -69,6 +69,30 @@ public:
             status_t            setThreadPoolMaxThreadCount(size_t maxThreads);
             void                giveThreadPoolName();
 
+            // Lets the pool grow past the threads the driver spawns (see
+            // setThreadPoolMaxThreadCount) under load: once every thread has been
+            // busy for growAfterMs, or a caller waits in
+            // IPCThreadState::blockUntilThreadAvailable, a thread is added, up to
+            // maxThreads in total. Added threads exit after idling for
+            // idleTimeoutMs, or never if it is 0. A maxThreads of 0, the default,
+            // keeps the pool fixed.
+            struct ThreadPoolPolicy {
+                size_t  maxThreads;
+                int64_t growAfterMs;
+                int64_t idleTimeoutMs;
+            };
+            status_t            setThreadPoolPolicy(const ThreadPoolPolicy& policy);
+
+            struct ThreadPoolStats {
+                size_t   maxThreads;        // driver spawned plus added
+                size_t   executingThreads;
+                size_t   addedThreads;
+                uint64_t saturationEvents;  // times every thread became busy
+                uint64_t blockedCallers;    // blockUntilThreadAvailable calls that waited
+                int64_t  saturatedTimeMs;   // total time every thread was busy
+            };
+            ThreadPoolStats     getThreadPoolStats();
+
             String8             getDriverName();
 
 private:
@@ -88,6 +112,17 @@ private:
 
             handle_entry*       lookupHandleLocked(int32_t handle);
 
+            // All called with mThreadCountLock held.
+            size_t              threadPoolCapacityLocked() const;
+            void                threadPoolSaturatedLocked(int64_t nowMs);
+            void                threadPoolUnsaturatedLocked(int64_t nowMs);
+            // Returns true if the caller should spawnAddedThread() once it has
+            // released the lock.
+            bool                growThreadPoolLocked(int64_t nowMs, bool force);
+            bool                retireAddedThreadLocked();
+
+            void                spawnAddedThread();
+
             String8             mDriverName;
             int                 mDriverFD;
             void*               mVMStart;
@@ -101,6 +136,14 @@ private:
             size_t              mMaxThreads;
             // Time when thread pool was emptied
             int64_t             mStarvationStartTimeMs;
+            // Threads added by the policy on top of mMaxThreads.
+            size_t              mAddedThreads;
+            ThreadPoolPolicy    mThreadPoolPolicy;
+            // Time of the last growth, so that each one takes growAfterMs
+            int64_t             mLastGrowthTimeMs;
+            uint64_t            mSaturationEvents;
+            uint64_t            mBlockedCallers;
+            int64_t             mSaturatedTimeMs;
 
     mutable Mutex               mLock;  // protects everything below.
 
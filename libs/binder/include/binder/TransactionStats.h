@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_BINDER_TRANSACTION_STATS_H
+#define ANDROID_BINDER_TRANSACTION_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <utils/String16.h>
+#include <utils/String8.h>
+#include <utils/Timers.h>
+
+// ---------------------------------------------------------------------------
+namespace android {
+
+class BBinder;
+struct ThreadTransactionStats;
+
+/*
+ * Call counts, latency and size histograms of the binder transactions of
+ * this process: incoming ones by interface descriptor and code, outgoing ones
+ * by handle and code.
+ *
+ * Off by default, in which case a transaction only pays for one load. Turned
+ * on with setEnabled(), or for the whole process by setting the property
+ * binder.transaction_stats to 1 before it starts.
+ *
+ * Each thread records in its own buckets, so recording threads never wait on
+ * each other. The stats of a process are dumped by
+ *   dumpsys --binder-stats SERVICE [--reset]
+ * for any service it hosts (IBinder::TRANSACTION_STATS_TRANSACTION).
+ */
+class TransactionStats
+{
+public:
+    // Histogram bucket i counts values in [2^(i-1), 2^i), bucket 0 counts 0;
+    // latencies are in microseconds and sizes in bytes.
+    static const size_t         NUM_BUCKETS = 24;
+
+    static  bool                isEnabled();
+    static  void                setEnabled(bool enabled);
+
+    // Clears what was recorded so far.
+    static  void                reset();
+
+    static  void                dump(String8& result);
+    static  status_t            dump(int fd);
+
+private:
+    friend class IPCThreadState;
+
+    static  ThreadTransactionStats* createThreadStats();
+    // Folds the stats of an exiting thread into the process totals.
+    static  void                retireThreadStats(ThreadTransactionStats* stats);
+
+    static  void                recordOutgoing(ThreadTransactionStats* stats, int32_t handle,
+                                               uint32_t code, nsecs_t latency,
+                                               size_t dataSize, size_t replySize);
+    static  void                recordIncoming(ThreadTransactionStats* stats, BBinder* target,
+                                               uint32_t code, nsecs_t latency,
+                                               size_t dataSize, size_t replySize);
+};
+
+}; // namespace android
+
+// ---------------------------------------------------------------------------
+
+#endif // ANDROID_BINDER_TRANSACTION_STATS_H
@@ -20,6 +20,9 @@
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include <vector>
 
 #include <gtest/gtest.h>
 
@@ -58,6 +61,7 @@ enum BinderLibTestTranscationCode {
     BINDER_LIB_TEST_DELAYED_EXIT_TRANSACTION,
     BINDER_LIB_TEST_GET_PTR_SIZE_TRANSACTION,
     BINDER_LIB_TEST_CREATE_BINDER_TRANSACTION,
+    BINDER_LIB_TEST_ECHO_BUFFER_REFERENCE_TRANSACTION,
 };
 
 pid_t start_server_process(int arg2)
@@ -326,6 +330,51 @@ TEST_F(BinderLibTest, NopTransaction) {
     EXPECT_EQ(NO_ERROR, ret);
 }
 
+TEST_F(BinderLibTest, ParcelBuffersAreReused) {
+    const void* firstData;
+    {
+        Parcel data, reply;
+        data.writeInt32(1);
+        firstData = data.data();
+        EXPECT_EQ(NO_ERROR, m_server->transact(BINDER_LIB_TEST_NOP_TRANSACTION, data, &reply));
+    }
+    // The buffer of the previous transaction's Parcel is handed to the next one
+    Parcel data;
+    data.writeInt32(2);
+    EXPECT_EQ(firstData, data.data());
+
+    // Large buffers aren't kept
+    {
+        Parcel large;
+        large.setDataCapacity(1024 * 1024);
+    }
+    Parcel other;
+    other.setDataCapacity(512 * 1024);
+    EXPECT_GE(other.dataCapacity(), 512u * 1024);
+    EXPECT_LT(other.dataCapacity(), 1024u * 1024);
+}
+
+TEST_F(BinderLibTest, ThreadPoolPolicy) {
+    sp<ProcessState> process = ProcessState::self();
+    ProcessState::ThreadPoolStats before = process->getThreadPoolStats();
+
+    ProcessState::ThreadPoolPolicy policy = { before.maxThreads + 4, -1, 0 };
+    EXPECT_EQ(BAD_VALUE, process->setThreadPoolPolicy(policy));
+    policy.growAfterMs = 10;
+    policy.idleTimeoutMs = 100;
+    EXPECT_EQ(NO_ERROR, process->setThreadPoolPolicy(policy));
+
+    // The pool isn't saturated, so a caller isn't blocked and nothing is added
+    IPCThreadState::self()->blockUntilThreadAvailable();
+    ProcessState::ThreadPoolStats after = process->getThreadPoolStats();
+    EXPECT_EQ(before.maxThreads, after.maxThreads);
+    EXPECT_EQ(before.blockedCallers, after.blockedCallers);
+    EXPECT_EQ(0u, after.addedThreads);
+
+    policy = { 0, 0, 0 };
+    EXPECT_EQ(NO_ERROR, process->setThreadPoolPolicy(policy));
+}
+
 TEST_F(BinderLibTest, SetError) {
     int32_t testValue[] = { 0, -123, 123 };
     for (size_t i = 0; i < ARRAY_SIZE(testValue); i++) {
@@ -362,6 +411,46 @@ TEST_F(BinderLibTest, PtrSize) {
     RecordProperty("ServerPtrSize", sizeof(void *));
 }
 
+TEST_F(BinderLibTest, BufferReference) {
+    std::vector<uint8_t> payload(256 * 1024);
+    for (size_t i = 0; i < payload.size(); i++) {
+        payload[i] = static_cast<uint8_t>(i * 7);
+    }
+
+    Parcel data, reply;
+    ASSERT_EQ(NO_ERROR, data.writeBufferReference(payload.data(), payload.size()));
+    // the payload isn't copied into the parcel
+    EXPECT_LT(data.dataSize(), payload.size());
+    ASSERT_EQ(NO_ERROR, m_server->transact(BINDER_LIB_TEST_ECHO_BUFFER_REFERENCE_TRANSACTION,
+            data, &reply));
+
+    const void* buffer;
+    size_t length;
+    ASSERT_EQ(NO_ERROR, reply.readBufferReference(&buffer, &length));
+    ASSERT_EQ(payload.size(), length);
+    EXPECT_NE(static_cast<const void*>(payload.data()), buffer);
+    EXPECT_EQ(0, memcmp(payload.data(), buffer, length));
+
+    Parcel other;
+    EXPECT_EQ(INVALID_OPERATION, other.appendFrom(&data, 0, data.dataSize()));
+}
+
+TEST_F(BinderLibTest, BufferReferenceMustBeAnObject) {
+    // A buffer object written as plain data isn't trusted
+    binder_buffer_object obj;
+    memset(&obj, 0, sizeof(obj));
+    obj.hdr.type = BINDER_TYPE_PTR;
+    obj.buffer = reinterpret_cast<binder_uintptr_t>(&obj);
+    obj.length = sizeof(obj);
+    Parcel data;
+    data.write(&obj, sizeof(obj));
+    data.setDataPosition(0);
+
+    const void* buffer;
+    size_t length;
+    EXPECT_EQ(BAD_TYPE, data.readBufferReference(&buffer, &length));
+}
+
 TEST_F(BinderLibTest, IndirectGetId2)
 {
     status_t ret;
@@ -483,6 +572,23 @@ TEST_F(BinderLibTest, CallBack)
     EXPECT_EQ(NO_ERROR, ret);
 }
 
+TEST_F(BinderLibTest, BatchedCallBack)
+{
+    sp<BinderLibTestCallBack> callBack = new BinderLibTestCallBack();
+    IPCThreadState::self()->beginOnewayBatch();
+    {
+        Parcel data, reply;
+        data.writeStrongBinder(callBack);
+        EXPECT_EQ(NO_ERROR,
+                m_server->transact(BINDER_LIB_TEST_NOP_CALL_BACK, data, &reply, TF_ONE_WAY));
+    }
+    // held back until the batch ends, though the Parcel is gone
+    EXPECT_NE(NO_ERROR, callBack->waitEvent(1));
+    EXPECT_EQ(NO_ERROR, IPCThreadState::self()->endOnewayBatch());
+    EXPECT_EQ(NO_ERROR, callBack->waitEvent(5));
+    EXPECT_EQ(NO_ERROR, callBack->getResult());
+}
+
 TEST_F(BinderLibTest, AddServer)
 {
     sp<IBinder> server = addServer();
@@ -865,6 +971,16 @@ class BinderLibTestService : public BBinder
             case BINDER_LIB_TEST_GET_PTR_SIZE_TRANSACTION:
                 reply->writeInt32(sizeof(void *));
                 return NO_ERROR;
+            case BINDER_LIB_TEST_ECHO_BUFFER_REFERENCE_TRANSACTION: {
+                const void* buffer;
+                size_t length;
+                status_t ret = data.readBufferReference(&buffer, &length);
+                if (ret != NO_ERROR) {
+                    return ret;
+                }
+                // data outlives the reply, so its buffer can be sent back
+                return reply->writeBufferReference(buffer, length);
+            }
             case BINDER_LIB_TEST_GET_STATUS_TRANSACTION:
                 return NO_ERROR;
             case BINDER_LIB_TEST_ADD_STRONG_REF_TRANSACTION:
@@ -17,6 +17,7 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <limits>
 #include <cstddef>
 #include <vector>
@@ -28,6 +29,7 @@
 #include <binder/Parcel.h>
 #include <binder/Value.h>
 #include <binder/Debug.h>
+#include <utils/String8.h>
 
 using ::android::binder::Value;
 using ::android::os::PersistableBundle;
@@ -109,3 +111,74 @@ TEST(ValueType, HandlesSwap) {
     ASSERT_TRUE(value_b.getInt(&int_x));
     ASSERT_EQ(31337, int_x);
 }
+
+static PersistableBundle makeLargeBundle() {
+    PersistableBundle bundle;
+    for (int32_t i = 0; i < 100; i++) {
+        bundle.putInt(String16(android::String8::format("key%d", i)), i);
+    }
+    bundle.putString(String16("string"), String16("Lovely"));
+    bundle.putStringVector(String16("strings"), {String16("a"), String16("bc")});
+    bundle.putDoubleVector(String16("doubles"), {3.14159265358979323846});
+    PersistableBundle nested;
+    nested.putLong(String16("long"), 13370133701337l);
+    bundle.putPersistableBundle(String16("nested"), nested);
+    return bundle;
+}
+
+TEST(PersistableBundle, ReadsLargeBundleLazily) {
+    const PersistableBundle bundle = makeLargeBundle();
+    android::Parcel parcel;
+    ASSERT_EQ(android::NO_ERROR, bundle.writeToParcel(&parcel));
+    const size_t end = parcel.dataPosition();
+    parcel.setDataPosition(0);
+
+    PersistableBundle read;
+    ASSERT_EQ(android::NO_ERROR, read.readFromParcel(&parcel));
+    ASSERT_EQ(end, parcel.dataPosition());
+    ASSERT_EQ(bundle.size(), read.size());
+    ASSERT_EQ(bundle, read);
+
+    int32_t int_x;
+    ASSERT_TRUE(read.getInt(String16("key42"), &int_x));
+    ASSERT_EQ(42, int_x);
+    int64_t long_x;
+    ASSERT_FALSE(read.getLong(String16("key42"), &long_x));
+    String16 string_x;
+    ASSERT_TRUE(read.getString(String16("string"), &string_x));
+    ASSERT_EQ(String16("Lovely"), string_x);
+    PersistableBundle nested;
+    ASSERT_TRUE(read.getPersistableBundle(String16("nested"), &nested));
+    ASSERT_TRUE(nested.getLong(String16("long"), &long_x));
+    ASSERT_EQ(13370133701337l, long_x);
+    ASSERT_EQ(100u, read.getIntKeys().size());
+
+    // Written back as it was read
+    android::Parcel copy;
+    ASSERT_EQ(android::NO_ERROR, read.writeToParcel(&copy));
+    ASSERT_EQ(end, copy.dataSize());
+    ASSERT_EQ(0, memcmp(parcel.data(), copy.data(), end));
+}
+
+TEST(PersistableBundle, ModifiesLazyBundle) {
+    const PersistableBundle bundle = makeLargeBundle();
+    android::Parcel parcel;
+    ASSERT_EQ(android::NO_ERROR, bundle.writeToParcel(&parcel));
+    parcel.setDataPosition(0);
+    PersistableBundle read;
+    ASSERT_EQ(android::NO_ERROR, read.readFromParcel(&parcel));
+
+    PersistableBundle modified(read);
+    modified.putInt(String16("key1"), 31337);
+    ASSERT_EQ(1u, modified.erase(String16("key2")));
+    ASSERT_EQ(bundle.size() - 1, modified.size());
+
+    int32_t int_x;
+    ASSERT_TRUE(modified.getInt(String16("key1"), &int_x));
+    ASSERT_EQ(31337, int_x);
+    ASSERT_FALSE(modified.getInt(String16("key2"), &int_x));
+    // The copy it was made from is unchanged
+    ASSERT_TRUE(read.getInt(String16("key1"), &int_x));
+    ASSERT_EQ(1, int_x);
+    ASSERT_NE(read, modified);
+}
@@ -0,0 +1,288 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Microbenchmarks of the costs that make up a binder call: flattening and
+ * unflattening a Parcel, and transactions to a service in another process
+ * (round trip by payload size, fd passing, oneway throughput, and several
+ * client threads at once). For machine-readable results, to compare
+ * releases, run with
+ *   binder_benchmark --benchmark_format=json
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <binder/Binder.h>
+#include <binder/IBinder.h>
+#include <binder/IPCThreadState.h>
+#include <binder/IServiceManager.h>
+#include <binder/Parcel.h>
+#include <binder/ProcessState.h>
+#include <utils/String16.h>
+#include <utils/String8.h>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+namespace android {
+
+enum BenchmarkServiceCode {
+    BENCHMARK_NOP = IBinder::FIRST_CALL_TRANSACTION,
+    BENCHMARK_ECHO,
+    BENCHMARK_READ_FD,
+    BENCHMARK_EXIT,
+};
+
+class BenchmarkService : public BBinder
+{
+public:
+    virtual status_t onTransact(uint32_t code, const Parcel& data, Parcel* reply,
+            uint32_t flags = 0) {
+        switch (code) {
+        case BENCHMARK_NOP:
+            return NO_ERROR;
+        case BENCHMARK_ECHO:
+            return reply->appendFrom(&data, 0, data.dataSize());
+        case BENCHMARK_READ_FD:
+            return data.readFileDescriptor() >= 0 ? NO_ERROR : BAD_VALUE;
+        case BENCHMARK_EXIT:
+            exit(EXIT_SUCCESS);
+        default:
+            return BBinder::onTransact(code, data, reply, flags);
+        }
+    }
+};
+
+static sp<IBinder> gService;
+
+static String16 serviceName(pid_t pid) {
+    return String16(String8::format("binder_benchmark.%d", pid));
+}
+
+// ---------------------------------------------------------------------------
+// Parcel
+
+static void BM_ParcelWriteInt32(benchmark::State& state) {
+    Parcel parcel;
+    while (state.KeepRunning()) {
+        parcel.setDataPosition(0);
+        for (int32_t i = 0; i < 64; i++) {
+            parcel.writeInt32(i);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * 64);
+}
+
+static void BM_ParcelReadInt32(benchmark::State& state) {
+    Parcel parcel;
+    for (int32_t i = 0; i < 64; i++) {
+        parcel.writeInt32(i);
+    }
+    while (state.KeepRunning()) {
+        parcel.setDataPosition(0);
+        for (int32_t i = 0; i < 64; i++) {
+            benchmark::DoNotOptimize(parcel.readInt32());
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * 64);
+}
+
+static void BM_ParcelWriteString16(benchmark::State& state) {
+    const String16 string(String8(std::string(state.range(0), 'x').c_str()));
+    Parcel parcel;
+    while (state.KeepRunning()) {
+        parcel.setDataPosition(0);
+        parcel.writeString16(string);
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0) * sizeof(char16_t));
+}
+
+static void BM_ParcelReadString16(benchmark::State& state) {
+    Parcel parcel;
+    parcel.writeString16(String16(String8(std::string(state.range(0), 'x').c_str())));
+    while (state.KeepRunning()) {
+        parcel.setDataPosition(0);
+        benchmark::DoNotOptimize(parcel.readString16());
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0) * sizeof(char16_t));
+}
+
+static void BM_ParcelWriteInt32Vector(benchmark::State& state) {
+    const std::vector<int32_t> values(state.range(0), 42);
+    Parcel parcel;
+    while (state.KeepRunning()) {
+        parcel.setDataPosition(0);
+        parcel.writeInt32Vector(values);
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0) * sizeof(int32_t));
+}
+
+static void BM_ParcelReadInt32Vector(benchmark::State& state) {
+    Parcel parcel;
+    parcel.writeInt32Vector(std::vector<int32_t>(state.range(0), 42));
+    std::vector<int32_t> values;
+    while (state.KeepRunning()) {
+        parcel.setDataPosition(0);
+        parcel.readInt32Vector(&values);
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0) * sizeof(int32_t));
+}
+
+// Flattening a binder takes references on it, so the Parcel is new each
+// time, as it would be for a transaction.
+static void BM_ParcelWriteStrongBinder(benchmark::State& state) {
+    sp<IBinder> binder = new BBinder;
+    while (state.KeepRunning()) {
+        Parcel parcel;
+        parcel.writeStrongBinder(binder);
+    }
+}
+
+static void BM_ParcelReadStrongBinder(benchmark::State& state) {
+    Parcel parcel;
+    parcel.writeStrongBinder(new BBinder);
+    while (state.KeepRunning()) {
+        parcel.setDataPosition(0);
+        benchmark::DoNotOptimize(parcel.readStrongBinder());
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Transactions
+
+static void BM_TransactNop(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        Parcel data, reply;
+        gService->transact(BENCHMARK_NOP, data, &reply);
+    }
+}
+
+// The payload is echoed back, so it crosses twice.
+static void BM_TransactEcho(benchmark::State& state) {
+    const std::vector<uint8_t> payload(state.range(0), 0x5a);
+    while (state.KeepRunning()) {
+        Parcel data, reply;
+        data.write(payload.data(), payload.size());
+        if (gService->transact(BENCHMARK_ECHO, data, &reply) != NO_ERROR) {
+            state.SkipWithError("transaction failed");
+            break;
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0) * 2);
+}
+
+static void BM_TransactFd(benchmark::State& state) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+        state.SkipWithError("pipe failed");
+        return;
+    }
+    while (state.KeepRunning()) {
+        Parcel data, reply;
+        data.writeFileDescriptor(fds[0]);
+        if (gService->transact(BENCHMARK_READ_FD, data, &reply) != NO_ERROR) {
+            state.SkipWithError("transaction failed");
+            break;
+        }
+    }
+    close(fds[0]);
+    close(fds[1]);
+}
+
+// Ends with a regular call, so that the time includes handling all of
+// the oneway transactions, not just queueing them.
+static void BM_TransactOneway(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        Parcel data;
+        gService->transact(BENCHMARK_NOP, data, NULL, IBinder::FLAG_ONEWAY);
+    }
+    Parcel data, reply;
+    gService->transact(BENCHMARK_NOP, data, &reply);
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_ParcelWriteInt32);
+BENCHMARK(BM_ParcelReadInt32);
+BENCHMARK(BM_ParcelWriteString16)->Arg(16)->Arg(256)->Arg(4096);
+BENCHMARK(BM_ParcelReadString16)->Arg(16)->Arg(256)->Arg(4096);
+BENCHMARK(BM_ParcelWriteInt32Vector)->Arg(16)->Arg(256)->Arg(4096);
+BENCHMARK(BM_ParcelReadInt32Vector)->Arg(16)->Arg(256)->Arg(4096);
+BENCHMARK(BM_ParcelWriteStrongBinder);
+BENCHMARK(BM_ParcelReadStrongBinder);
+BENCHMARK(BM_TransactNop);
+BENCHMARK(BM_TransactEcho)->Arg(0)->Arg(64)->Arg(1024)->Arg(16 * 1024)->Arg(256 * 1024);
+BENCHMARK(BM_TransactFd);
+BENCHMARK(BM_TransactOneway);
+// contention between client threads, and for the threads of the service
+BENCHMARK(BM_TransactNop)->ThreadRange(2, 8)->UseRealTime();
+BENCHMARK(BM_TransactEcho)->Arg(1024)->ThreadRange(2, 8)->UseRealTime();
+
+// ---------------------------------------------------------------------------
+
+static void runService(pid_t parent) {
+    sp<ProcessState> process = ProcessState::self();
+    process->setThreadPoolMaxThreadCount(8);
+    if (defaultServiceManager()->addService(serviceName(parent),
+            new BenchmarkService) != NO_ERROR) {
+        fprintf(stderr, "binder_benchmark: cannot register the service\n");
+        exit(EXIT_FAILURE);
+    }
+    process->startThreadPool();
+    IPCThreadState::self()->joinThreadPool();
+    exit(EXIT_FAILURE);
+}
+
+} // namespace android
+
+using namespace android;
+
+int main(int argc, char** argv) {
+    // The service forks off before this process touches binder.
+    const pid_t parent = getpid();
+    const pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return EXIT_FAILURE;
+    }
+    if (pid == 0) {
+        runService(parent);
+    }
+
+    gService = defaultServiceManager()->getService(serviceName(parent));
+    if (gService == NULL) {
+        fprintf(stderr, "binder_benchmark: the service didn't start\n");
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        return EXIT_FAILURE;
+    }
+    ProcessState::self()->startThreadPool();
+
+    ::benchmark::Initialize(&argc, argv);
+    ::benchmark::RunSpecifiedBenchmarks();
+
+    Parcel data;
+    gService->transact(BENCHMARK_EXIT, data, NULL, IBinder::FLAG_ONEWAY);
+    IPCThreadState::self()->flushCommands();
+    waitpid(pid, NULL, 0);
+    return EXIT_SUCCESS;
+}
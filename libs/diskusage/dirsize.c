@@ -17,7 +17,11 @@
 
 #include <dirent.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
 #include <diskusage/dirsize.h>
@@ -69,3 +73,255 @@ int64_t calculate_dir_size(int dfd)
     closedir(d);
     return size;
 }
+
+/*
+ * Parallel walk. Workers share a queue of open directories; each one reads
+ * whole getdents64() batches at a time and stats entries relative to the
+ * directory fd, asking statx() only for what the size needs. When the queue
+ * is deep enough to keep every worker busy, subdirectories are walked in
+ * place instead, which bounds the number of open directories.
+ */
+
+#define DIRSIZE_QUEUE_MAX 256
+#define DIRSIZE_DENTS_BUF 32768
+#define DIRSIZE_INODES_INITIAL 1024
+
+/* Only a hint to network filesystems; the value is fixed by the kernel ABI. */
+#ifdef AT_STATX_DONT_SYNC
+#define DIRSIZE_AT_STATX_DONT_SYNC AT_STATX_DONT_SYNC
+#else
+#define DIRSIZE_AT_STATX_DONT_SYNC 0x4000
+#endif
+
+struct linux_dirent64_entry {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+struct inode_key {
+    uint64_t dev;
+    uint64_t ino;
+};
+
+struct dir_walk {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int queue[DIRSIZE_QUEUE_MAX];
+    size_t queued;
+    size_t busy;
+    int flags;
+    int64_t size;
+
+    /* Open-addressed set of inodes with more than one link seen so far */
+    pthread_mutex_t inodes_lock;
+    struct inode_key *inodes;
+    size_t inodes_capacity;
+    size_t inodes_count;
+};
+
+/* Returns whether the inode hadn't been seen before. */
+static int first_sighting(struct dir_walk *walk, uint64_t dev, uint64_t ino)
+{
+    size_t i, mask;
+    int res = 1;
+
+    pthread_mutex_lock(&walk->inodes_lock);
+    if ((walk->inodes_count + 1) * 2 > walk->inodes_capacity) {
+        size_t capacity = walk->inodes_capacity ? walk->inodes_capacity * 2
+                : DIRSIZE_INODES_INITIAL;
+        struct inode_key *inodes = calloc(capacity, sizeof(*inodes));
+        if (inodes == NULL) {
+            /* Rather count a link twice than lose it. */
+            pthread_mutex_unlock(&walk->inodes_lock);
+            return 1;
+        }
+        for (i = 0; i < walk->inodes_capacity; i++) {
+            struct inode_key *key = &walk->inodes[i];
+            size_t j;
+            if (key->ino == 0) {
+                continue;
+            }
+            for (j = (key->ino ^ key->dev) & (capacity - 1); inodes[j].ino != 0;
+                    j = (j + 1) & (capacity - 1)) {
+            }
+            inodes[j] = *key;
+        }
+        free(walk->inodes);
+        walk->inodes = inodes;
+        walk->inodes_capacity = capacity;
+    }
+    mask = walk->inodes_capacity - 1;
+    for (i = (ino ^ dev) & mask; walk->inodes[i].ino != 0; i = (i + 1) & mask) {
+        if (walk->inodes[i].ino == ino && walk->inodes[i].dev == dev) {
+            res = 0;
+            break;
+        }
+    }
+    if (res) {
+        walk->inodes[i].dev = dev;
+        walk->inodes[i].ino = ino;
+        walk->inodes_count++;
+    }
+    pthread_mutex_unlock(&walk->inodes_lock);
+    return res;
+}
+
+/*
+ * Returns the size of the entry, or -1 if it can't be stat()ed. Sets
+ * *is_dir to whether it is a directory.
+ */
+static int64_t entry_size(struct dir_walk *walk, int dfd, const char *name, int *is_dir)
+{
+    uint64_t blocks, dev, ino, nlink;
+#if defined(__NR_statx) && defined(STATX_BLOCKS)
+    struct statx sx;
+    if (syscall(__NR_statx, dfd, name, AT_SYMLINK_NOFOLLOW | DIRSIZE_AT_STATX_DONT_SYNC,
+            STATX_TYPE | STATX_NLINK | STATX_INO | STATX_BLOCKS, &sx) == 0) {
+        blocks = sx.stx_blocks;
+        nlink = sx.stx_nlink;
+        ino = sx.stx_ino;
+        dev = ((uint64_t) sx.stx_dev_major << 32) | sx.stx_dev_minor;
+        *is_dir = S_ISDIR(sx.stx_mode);
+    } else
+#endif
+    {
+        struct stat s;
+        if (fstatat(dfd, name, &s, AT_SYMLINK_NOFOLLOW) != 0) {
+            return -1;
+        }
+        blocks = s.st_blocks;
+        nlink = s.st_nlink;
+        ino = s.st_ino;
+        dev = s.st_dev;
+        *is_dir = S_ISDIR(s.st_mode);
+    }
+
+    if ((walk->flags & DIRSIZE_COUNT_HARDLINKS_ONCE) && !*is_dir && nlink > 1
+            && !first_sighting(walk, dev, ino)) {
+        return 0;
+    }
+    return blocks * 512;
+}
+
+static void walk_push_locked(struct dir_walk *walk, int fd)
+{
+    walk->queue[walk->queued++] = fd;
+    pthread_cond_signal(&walk->cond);
+}
+
+/* Sizes the contents of the directory, closing dfd. */
+static int64_t walk_dir(struct dir_walk *walk, int dfd)
+{
+    char buf[DIRSIZE_DENTS_BUF];
+    int64_t size = 0;
+    long n;
+
+    while ((n = syscall(__NR_getdents64, dfd, buf, sizeof(buf))) > 0) {
+        long pos = 0;
+        while (pos < n) {
+            struct linux_dirent64_entry *de = (struct linux_dirent64_entry *) (buf + pos);
+            const char *name = de->d_name;
+            int64_t entry;
+            int is_dir;
+            pos += de->d_reclen;
+
+            /* always skip "." and ".." */
+            if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0))) {
+                continue;
+            }
+            entry = entry_size(walk, dfd, name, &is_dir);
+            if (entry < 0) {
+                continue;
+            }
+            size += entry;
+
+            if (is_dir) {
+                int subfd = openat(dfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                if (subfd < 0) {
+                    continue;
+                }
+                pthread_mutex_lock(&walk->lock);
+                if (walk->queued < DIRSIZE_QUEUE_MAX) {
+                    walk_push_locked(walk, subfd);
+                    subfd = -1;
+                }
+                pthread_mutex_unlock(&walk->lock);
+                if (subfd >= 0) {
+                    size += walk_dir(walk, subfd);
+                }
+            }
+        }
+    }
+    close(dfd);
+    return size;
+}
+
+static void *walk_thread(void *arg)
+{
+    struct dir_walk *walk = arg;
+    int64_t size = 0;
+
+    pthread_mutex_lock(&walk->lock);
+    for (;;) {
+        int fd;
+        while (walk->queued == 0 && walk->busy > 0) {
+            pthread_cond_wait(&walk->cond, &walk->lock);
+        }
+        if (walk->queued == 0) {
+            /* Nothing queued and nobody left to queue more. */
+            break;
+        }
+        fd = walk->queue[--walk->queued];
+        walk->busy++;
+        pthread_mutex_unlock(&walk->lock);
+        size += walk_dir(walk, fd);
+        pthread_mutex_lock(&walk->lock);
+        walk->busy--;
+        if (walk->busy == 0 && walk->queued == 0) {
+            pthread_cond_broadcast(&walk->cond);
+        }
+    }
+    walk->size += size;
+    pthread_mutex_unlock(&walk->lock);
+    return NULL;
+}
+
+int64_t calculate_dir_size_parallel(int dfd, int num_threads, int flags)
+{
+    struct dir_walk walk;
+    pthread_t threads[DIRSIZE_MAX_THREADS];
+    int started = 0;
+    int i;
+
+    if (num_threads < 1) {
+        num_threads = 1;
+    } else if (num_threads > DIRSIZE_MAX_THREADS) {
+        num_threads = DIRSIZE_MAX_THREADS;
+    }
+
+    memset(&walk, 0, sizeof(walk));
+    pthread_mutex_init(&walk.lock, NULL);
+    pthread_cond_init(&walk.cond, NULL);
+    pthread_mutex_init(&walk.inodes_lock, NULL);
+    walk.flags = flags;
+    walk.queue[walk.queued++] = dfd;
+
+    for (i = 1; i < num_threads; i++) {
+        if (pthread_create(&threads[started], NULL, walk_thread, &walk) == 0) {
+            started++;
+        }
+    }
+    walk_thread(&walk);
+    for (i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&walk.cond);
+    pthread_mutex_destroy(&walk.lock);
+    pthread_mutex_destroy(&walk.inodes_lock);
+    free(walk.inodes);
+    return walk.size;
+}
@@ -21,8 +21,11 @@
 #include <sys/types.h>
 
 #include <fcntl.h>
+#include <string.h>
 #include <unistd.h>
 
+#include <algorithm>
+
 #include <utils/Errors.h>
 
 #include <binder/Parcel.h>
@@ -34,6 +37,10 @@ namespace gui {
 // need. So we make it smaller.
 static const size_t DEFAULT_SOCKET_BUFFER_SIZE = 4 * 1024;
 
+// Maximum number of messages moved by a single sendmmsg()/recvmmsg() call. The default socket
+// buffer holds about this many display events.
+static const size_t MAX_BATCH_MESSAGES = 16;
+
 BitTube::BitTube(size_t bufsize) {
     init(bufsize, bufsize);
 }
@@ -157,5 +164,84 @@ ssize_t BitTube::recvObjects(BitTube* tube, void* events, size_t count, size_t o
     return size < 0 ? size : size / static_cast<ssize_t>(objSize);
 }
 
+ssize_t BitTube::sendObjectsBatch(BitTube* tube, void const* events, size_t count,
+                                  size_t objSize) {
+    const char* vaddr = reinterpret_cast<const char*>(events);
+    iovec iov[MAX_BATCH_MESSAGES];
+    mmsghdr messages[MAX_BATCH_MESSAGES];
+
+    size_t sent = 0;
+    while (sent < count) {
+        const size_t batch = std::min(count - sent, MAX_BATCH_MESSAGES);
+        memset(messages, 0, batch * sizeof(messages[0]));
+        for (size_t i = 0; i < batch; i++) {
+            iov[i].iov_base = const_cast<char*>(vaddr + (sent + i) * objSize);
+            iov[i].iov_len = objSize;
+            messages[i].msg_hdr.msg_iov = &iov[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int len;
+        do {
+            len = ::sendmmsg(tube->mSendFd, messages, batch, MSG_DONTWAIT | MSG_NOSIGNAL);
+        } while (len < 0 && errno == EINTR);
+        if (len < 0) {
+            return sent > 0 ? static_cast<ssize_t>(sent) : -errno;
+        }
+
+        sent += static_cast<size_t>(len);
+        if (static_cast<size_t>(len) < batch) {
+            // The socket buffer is full.
+            break;
+        }
+    }
+    return static_cast<ssize_t>(sent);
+}
+
+ssize_t BitTube::recvObjectsBatch(BitTube* tube, void* events, size_t count, size_t objSize) {
+    char* vaddr = reinterpret_cast<char*>(events);
+    iovec iov[MAX_BATCH_MESSAGES];
+    mmsghdr messages[MAX_BATCH_MESSAGES];
+
+    size_t received = 0;
+    while (received < count) {
+        const size_t batch = std::min(count - received, MAX_BATCH_MESSAGES);
+        memset(messages, 0, batch * sizeof(messages[0]));
+        for (size_t i = 0; i < batch; i++) {
+            iov[i].iov_base = vaddr + (received + i) * objSize;
+            iov[i].iov_len = objSize;
+            messages[i].msg_hdr.msg_iov = &iov[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int len;
+        do {
+            len = ::recvmmsg(tube->mReceiveFd, messages, batch, MSG_DONTWAIT, nullptr);
+        } while (len < 0 && errno == EINTR);
+        if (len < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // Nothing more to read, as with read().
+                break;
+            }
+            return received > 0 ? static_cast<ssize_t>(received) : -errno;
+        }
+
+        for (int i = 0; i < len; i++) {
+            // should never happen as long as the sender uses one message per object
+            LOG_ALWAYS_FATAL_IF(messages[i].msg_len != objSize ||
+                                        (messages[i].msg_hdr.msg_flags & MSG_TRUNC),
+                                "BitTube::recvObjectsBatch(count=%zu, size=%zu), len=%u (partial "
+                                "events were received!)",
+                                count, objSize, messages[i].msg_len);
+        }
+
+        received += static_cast<size_t>(len);
+        if (static_cast<size_t>(len) < batch) {
+            break;
+        }
+    }
+    return static_cast<ssize_t>(received);
+}
+
 } // namespace gui
 } // namespace android
@@ -51,6 +51,8 @@ status_t BufferQueueConsumer::acquireBuffer(BufferItem* outBuffer,
 
     int numDroppedBuffers = 0;
     sp<IProducerListener> listener;
+    int32_t queueDepth = 0;
+    String8 consumerName;
     {
         Mutex::Autolock lock(mCore->mMutex);
 
@@ -244,6 +246,18 @@ status_t BufferQueueConsumer::acquireBuffer(BufferItem* outBuffer,
                 mSlots[slot].mBufferState.acquire();
             }
             mSlots[slot].mFence = Fence::NO_FENCE;
+
+            // In shared buffer mode the buffer can be acquired again without
+            // having been queued, only count the first acquire.
+            const nsecs_t now = systemTime();
+            if (mSlots[slot].mQueueTime != 0) {
+                mCore->recordLatencyLocked(&mCore->mQueueToAcquireHistogram,
+                        "queueToAcquire", now - mSlots[slot].mQueueTime);
+                mSlots[slot].mQueueTime = 0;
+            }
+            if (mSlots[slot].mAcquireTime == 0) {
+                mSlots[slot].mAcquireTime = now;
+            }
         }
 
         // If the buffer has previously been acquired by the consumer, set
@@ -255,18 +269,20 @@ status_t BufferQueueConsumer::acquireBuffer(BufferItem* outBuffer,
 
         mCore->mQueue.erase(front);
 
-        // We might have freed a slot while dropping old buffers, or the producer
-        // may be blocked waiting for the number of buffers in the queue to
-        // decrease.
-        mCore->mDequeueCondition.broadcast();
-
-        ATRACE_INT(mCore->mConsumerName.string(),
-                static_cast<int32_t>(mCore->mQueue.size()));
+        queueDepth = static_cast<int32_t>(mCore->mQueue.size());
+        consumerName = mCore->mConsumerName;
         mCore->mOccupancyTracker.registerOccupancyChange(mCore->mQueue.size());
 
         VALIDATE_CONSISTENCY();
     }
 
+    // We might have freed a slot while dropping old buffers, or the producer
+    // may be blocked waiting for the number of buffers in the queue to
+    // decrease. Wake it up without the lock held so that it doesn't
+    // immediately block on it.
+    mCore->mDequeueCondition.broadcast();
+    ATRACE_INT(consumerName.string(), queueDepth);
+
     if (listener != NULL) {
         for (int i = 0; i < numDroppedBuffers; ++i) {
             listener->onBufferReleased();
@@ -440,6 +456,13 @@ status_t BufferQueueConsumer::releaseBuffer(int slot, uint64_t frameNumber,
         mSlots[slot].mFence = releaseFence;
         mSlots[slot].mBufferState.release();
 
+        if (mSlots[slot].mAcquireTime != 0 &&
+                !mSlots[slot].mBufferState.isAcquired()) {
+            mCore->recordLatencyLocked(&mCore->mAcquireToReleaseHistogram,
+                    "acquireToRelease", systemTime() - mSlots[slot].mAcquireTime);
+            mSlots[slot].mAcquireTime = 0;
+        }
+
         // After leaving shared buffer mode, the shared buffer will
         // still be around. Mark it as no longer shared if this
         // operation causes it to be free.
@@ -455,10 +478,12 @@ status_t BufferQueueConsumer::releaseBuffer(int slot, uint64_t frameNumber,
         listener = mCore->mConnectedProducerListener;
         BQ_LOGV("releaseBuffer: releasing slot %d", slot);
 
-        mCore->mDequeueCondition.broadcast();
         VALIDATE_CONSISTENCY();
     } // Autolock scope
 
+    // Wake up a producer waiting for a free slot once the lock is released
+    mCore->mDequeueCondition.broadcast();
+
     // Call back without lock held
     if (listener != NULL) {
         listener->onBufferReleased();
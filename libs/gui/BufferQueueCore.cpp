@@ -27,12 +27,14 @@
 #endif
 
 #include <inttypes.h>
+#include <stdlib.h>
 
 #include <cutils/properties.h>
 #include <cutils/atomic.h>
 
 #include <gui/BufferItem.h>
 #include <gui/BufferQueueCore.h>
+#include <gui/GraphicBufferPool.h>
 #include <gui/IConsumerListener.h>
 #include <gui/IProducerListener.h>
 #include <gui/ISurfaceComposer.h>
@@ -46,6 +48,12 @@ static String8 getUniqueName() {
             android_atomic_inc(&counter));
 }
 
+static bool isAdaptiveBufferCountEnabled() {
+    char value[PROPERTY_VALUE_MAX];
+    property_get("debug.bq.adaptive_buffer_count", value, "0");
+    return atoi(value) != 0;
+}
+
 static uint64_t getUniqueId() {
     static std::atomic<uint32_t> counter{0};
     static uint64_t id = static_cast<uint64_t>(getpid()) << 32;
@@ -61,6 +69,7 @@ BufferQueueCore::BufferQueueCore() :
     mConsumerUsageBits(0),
     mConsumerIsProtected(false),
     mConnectedApi(NO_CONNECTED_API),
+    mConnectedUid(0),
     mLinkedToDeath(),
     mConnectedProducerListener(),
     mSlots(),
@@ -93,6 +102,9 @@ BufferQueueCore::BufferQueueCore() :
     mSharedBufferCache(Rect::INVALID_RECT, 0, NATIVE_WINDOW_SCALING_MODE_FREEZE,
             HAL_DATASPACE_UNKNOWN),
     mLastQueuedSlot(INVALID_BUFFER_SLOT),
+    mAdaptiveBufferCount(isAdaptiveBufferCountEnabled()),
+    mAdaptiveSlotReduction(0),
+    mAdaptiveGrowCount(0),
     mUniqueId(getUniqueId())
 {
     int numStartingBuffers = getMaxBufferCountLocked();
@@ -125,11 +137,18 @@ void BufferQueueCore::dumpState(const String8& prefix, String8* outResult) const
     outResult->appendFormat("%s-BufferQueue mMaxAcquiredBufferCount=%d, "
             "mMaxDequeuedBufferCount=%d, mDequeueBufferCannotBlock=%d "
             "mAsyncMode=%d, default-size=[%dx%d], default-format=%d, "
-            "transform-hint=%02x, FIFO(%zu)={%s}\n", prefix.string(),
+            "transform-hint=%02x, adaptive-slot-reduction=%d, "
+            "FIFO(%zu)={%s}\n", prefix.string(),
             mMaxAcquiredBufferCount, mMaxDequeuedBufferCount,
             mDequeueBufferCannotBlock, mAsyncMode, mDefaultWidth,
-            mDefaultHeight, mDefaultBufferFormat, mTransformHint, mQueue.size(),
-            fifo.string());
+            mDefaultHeight, mDefaultBufferFormat, mTransformHint,
+            mAdaptiveSlotReduction, mQueue.size(), fifo.string());
+
+    mDequeueWaitHistogram.dump((prefix + "-dequeue-wait").string(), outResult);
+    mQueueToAcquireHistogram.dump((prefix + "-queue-to-acquire").string(),
+            outResult);
+    mAcquireToReleaseHistogram.dump((prefix + "-acquire-to-release").string(),
+            outResult);
 
     for (int s : mActiveBuffers) {
         const sp<GraphicBuffer>& buffer(mSlots[s].mGraphicBuffer);
@@ -202,6 +221,8 @@ void BufferQueueCore::clearBufferSlotLocked(int slot) {
     mSlots[slot].mFrameNumber = 0;
     mSlots[slot].mAcquireCalled = false;
     mSlots[slot].mNeedsReallocation = true;
+    mSlots[slot].mQueueTime = 0;
+    mSlots[slot].mAcquireTime = 0;
 
     // Destroy fence as BufferQueue now takes ownership
     if (mSlots[slot].mEglFence != EGL_NO_SYNC_KHR) {
@@ -216,6 +237,18 @@ void BufferQueueCore::clearBufferSlotLocked(int slot) {
     }
 }
 
+void BufferQueueCore::recycleBufferLocked(int slot) {
+    // Only buffers nobody is using anymore, whose owner is known
+    if (mConnectedApi == NO_CONNECTED_API ||
+            mSlots[slot].mGraphicBuffer == NULL ||
+            mSlots[slot].mEglFence != EGL_NO_SYNC_KHR ||
+            slot == mSharedBufferSlot) {
+        return;
+    }
+    GraphicBufferPool::getInstance().recycle(mConnectedUid,
+            mSlots[slot].mGraphicBuffer, mSlots[slot].mFence);
+}
+
 void BufferQueueCore::freeAllBuffersLocked() {
     for (int s : mFreeSlots) {
         clearBufferSlotLocked(s);
@@ -223,6 +256,7 @@ void BufferQueueCore::freeAllBuffersLocked() {
 
     for (int s : mFreeBuffers) {
         mFreeSlots.insert(s);
+        recycleBufferLocked(s);
         clearBufferSlotLocked(s);
     }
     mFreeBuffers.clear();
@@ -258,6 +292,77 @@ void BufferQueueCore::discardFreeBuffersLocked() {
 }
 
 bool BufferQueueCore::adjustAvailableSlotsLocked(int delta) {
+    const int reduction = mAdaptiveSlotReduction;
+    mAdaptiveSlotReduction = 0;
+    if (!resizeAvailableSlotsLocked(delta + reduction)) {
+        mAdaptiveSlotReduction = reduction;
+        return false;
+    }
+    return true;
+}
+
+bool BufferQueueCore::shrinkBufferCountLocked() {
+    if (!mAdaptiveBufferCount || mAdaptiveSlotReduction > 0) {
+        return false;
+    }
+
+    // The extra buffer of the async and non-blocking modes is what lets
+    // them not block, leave them alone. Same for shared buffers.
+    if (mAsyncMode || mDequeueBufferCannotBlock || mSharedBufferMode) {
+        return false;
+    }
+
+    // Only ever go from triple to double buffering
+    if (getMaxBufferCountLocked() <= mMaxAcquiredBufferCount + 1) {
+        return false;
+    }
+
+    const uint32_t backoff = mAdaptiveGrowCount < ADAPTIVE_MAX_BACKOFF ?
+            mAdaptiveGrowCount : ADAPTIVE_MAX_BACKOFF;
+    if (mOccupancyTracker.getShallowSegmentCount() <
+            (ADAPTIVE_SHRINK_SEGMENTS << backoff)) {
+        return false;
+    }
+
+    const bool hadFreeSlot = !mFreeSlots.empty();
+    if (!resizeAvailableSlotsLocked(-1)) {
+        // Every slot is in use, try again after the next segment
+        return false;
+    }
+    mAdaptiveSlotReduction = 1;
+    BQ_LOGV("shrinkBufferCountLocked: %d slots",
+            getMaxBufferCountLocked() - mAdaptiveSlotReduction);
+    VALIDATE_CONSISTENCY();
+    // Taking an empty slot away frees no buffer
+    return !hadFreeSlot;
+}
+
+bool BufferQueueCore::growBufferCountLocked() {
+    if (mAdaptiveSlotReduction == 0) {
+        return false;
+    }
+    if (!resizeAvailableSlotsLocked(mAdaptiveSlotReduction)) {
+        return false;
+    }
+    mAdaptiveSlotReduction = 0;
+    mAdaptiveGrowCount++;
+    mOccupancyTracker.resetShallowSegmentCount();
+    BQ_LOGV("growBufferCountLocked: %d slots", getMaxBufferCountLocked());
+    VALIDATE_CONSISTENCY();
+    return true;
+}
+
+void BufferQueueCore::recordLatencyLocked(LatencyHistogram* histogram,
+        const char* counterName, nsecs_t latency) {
+    histogram->add(latency);
+    if (ATRACE_ENABLED()) {
+        String8 counter;
+        counter.appendFormat("%s %s", mConsumerName.string(), counterName);
+        ATRACE_INT64(counter.string(), ns2us(latency));
+    }
+}
+
+bool BufferQueueCore::resizeAvailableSlotsLocked(int delta) {
     if (delta >= 0) {
         // If we're going to fail, do so before modifying anything
         if (delta > static_cast<int>(mUnusedSlots.size())) {
@@ -421,11 +526,12 @@ void BufferQueueCore::validateConsistencyLocked() const {
         }
     }
 
-    if (allocatedSlots != getMaxBufferCountLocked()) {
+    const int expectedSlots = getMaxBufferCountLocked() - mAdaptiveSlotReduction;
+    if (allocatedSlots != expectedSlots) {
         BQ_LOGE("Number of allocated slots is incorrect. Allocated = %d, "
                 "Should be %d (%zu free slots, %zu free buffers, "
                 "%zu activeBuffers, %zu unusedSlots)", allocatedSlots,
-                getMaxBufferCountLocked(), mFreeSlots.size(),
+                expectedSlots, mFreeSlots.size(),
                 mFreeBuffers.size(), mActiveBuffers.size(),
                 mUnusedSlots.size());
     }
@@ -33,9 +33,12 @@
 #include <gui/BufferQueueCore.h>
 #include <gui/BufferQueueProducer.h>
 #include <gui/GLConsumer.h>
+#include <gui/GraphicBufferPool.h>
 #include <gui/IConsumerListener.h>
 #include <gui/IProducerListener.h>
 
+#include <ui/GraphicBufferAllocator.h>
+
 #include <utils/Log.h>
 #include <utils/Trace.h>
 
@@ -246,7 +249,8 @@ int BufferQueueProducer::getFreeSlotLocked() const {
 status_t BufferQueueProducer::waitForFreeSlotThenRelock(FreeSlotCaller caller,
         int* found) const {
     auto callerString = (caller == FreeSlotCaller::Dequeue) ?
-            "dequeueBuffer" : "attachBuffer";
+            "dequeueBuffer" : (caller == FreeSlotCaller::Prefetch) ?
+            "queueAndDequeueBuffer" : "attachBuffer";
     bool tryAgain = true;
     while (tryAgain) {
         if (mCore->mIsAbandoned) {
@@ -270,6 +274,11 @@ status_t BufferQueueProducer::waitForFreeSlotThenRelock(FreeSlotCaller caller,
         // This check is only done if a buffer has already been queued
         if (mCore->mBufferHasBeenQueued &&
                 dequeuedCount >= mCore->mMaxDequeuedBufferCount) {
+            // Not an error for a prefetch, the producer still holds on to
+            // all the buffers it may dequeue.
+            if (caller == FreeSlotCaller::Prefetch) {
+                return WOULD_BLOCK;
+            }
             BQ_LOGE("%s: attempting to exceed the max dequeued buffer count "
                     "(%d)", callerString, mCore->mMaxDequeuedBufferCount);
             return INVALID_OPERATION;
@@ -294,7 +303,7 @@ status_t BufferQueueProducer::waitForFreeSlotThenRelock(FreeSlotCaller caller,
                     BufferQueueCore::INVALID_BUFFER_SLOT) {
                 *found = mCore->mSharedBufferSlot;
             } else {
-                if (caller == FreeSlotCaller::Dequeue) {
+                if (caller != FreeSlotCaller::Attach) {
                     // If we're calling this from dequeue, prefer free buffers
                     int slot = getFreeBufferLocked();
                     if (slot != BufferQueueCore::INVALID_BUFFER_SLOT) {
@@ -320,6 +329,14 @@ status_t BufferQueueProducer::waitForFreeSlotThenRelock(FreeSlotCaller caller,
         tryAgain = (*found == BufferQueueCore::INVALID_BUFFER_SLOT) ||
                    tooManyBuffers;
         if (tryAgain) {
+            if (caller == FreeSlotCaller::Prefetch) {
+                return WOULD_BLOCK;
+            }
+            // The producer needs the slot the adaptive buffer count took
+            // away, give it back rather than stalling
+            if (!tooManyBuffers && mCore->growBufferCountLocked()) {
+                continue;
+            }
             // Return an error if we're in non-blocking mode (producer and
             // consumer are controlled by the application).
             // However, the consumer is allowed to briefly acquire an extra
@@ -350,6 +367,14 @@ status_t BufferQueueProducer::dequeueBuffer(int *outSlot,
         PixelFormat format, uint32_t usage,
         FrameEventHistoryDelta* outTimestamps) {
     ATRACE_CALL();
+    return dequeueBufferImpl(FreeSlotCaller::Dequeue, outSlot, outFence,
+            width, height, format, usage, outTimestamps);
+}
+
+status_t BufferQueueProducer::dequeueBufferImpl(FreeSlotCaller caller,
+        int *outSlot, sp<android::Fence> *outFence, uint32_t width,
+        uint32_t height, PixelFormat format, uint32_t usage,
+        FrameEventHistoryDelta* outTimestamps) {
     { // Autolock scope
         Mutex::Autolock lock(mCore->mMutex);
         mConsumerName = mCore->mConsumerName;
@@ -377,10 +402,12 @@ status_t BufferQueueProducer::dequeueBuffer(int *outSlot,
     EGLDisplay eglDisplay = EGL_NO_DISPLAY;
     EGLSyncKHR eglFence = EGL_NO_SYNC_KHR;
     bool attachedByConsumer = false;
+    uid_t owner = 0;
 
     { // Autolock scope
         Mutex::Autolock lock(mCore->mMutex);
         mCore->waitWhileAllocatingLocked();
+        owner = mCore->mConnectedUid;
 
         if (format == 0) {
             format = mCore->mDefaultBufferFormat;
@@ -395,10 +422,10 @@ status_t BufferQueueProducer::dequeueBuffer(int *outSlot,
             height = mCore->mDefaultHeight;
         }
 
+        const nsecs_t waitStartTime = systemTime();
         int found = BufferItem::INVALID_BUFFER_SLOT;
         while (found == BufferItem::INVALID_BUFFER_SLOT) {
-            status_t status = waitForFreeSlotThenRelock(FreeSlotCaller::Dequeue,
-                    &found);
+            status_t status = waitForFreeSlotThenRelock(caller, &found);
             if (status != NO_ERROR) {
                 return status;
             }
@@ -430,6 +457,8 @@ status_t BufferQueueProducer::dequeueBuffer(int *outSlot,
                 }
             }
         }
+        mCore->recordLatencyLocked(&mCore->mDequeueWaitHistogram,
+                "dequeueWait", systemTime() - waitStartTime);
 
         const sp<GraphicBuffer>& buffer(mSlots[found].mGraphicBuffer);
         if (mCore->mSharedBufferSlot == found &&
@@ -455,6 +484,9 @@ status_t BufferQueueProducer::dequeueBuffer(int *outSlot,
         if ((buffer == NULL) ||
                 buffer->needsReallocation(width, height, format, BQ_LAYER_COUNT, usage))
         {
+            // The old buffer may fit an other slot, or this one again once
+            // the size switches back
+            mCore->recycleBufferLocked(found);
             mSlots[found].mAcquireCalled = false;
             mSlots[found].mGraphicBuffer = NULL;
             mSlots[found].mRequestBufferCalled = false;
@@ -501,10 +533,22 @@ status_t BufferQueueProducer::dequeueBuffer(int *outSlot,
     } // Autolock scope
 
     if (returnFlags & BUFFER_NEEDS_REALLOCATION) {
-        BQ_LOGV("dequeueBuffer: allocating a new buffer for slot %d", *outSlot);
-        sp<GraphicBuffer> graphicBuffer = new GraphicBuffer(
-                width, height, format, BQ_LAYER_COUNT, usage,
-                {mConsumerName.string(), mConsumerName.size()});
+        sp<Fence> pooledFence;
+        sp<GraphicBuffer> graphicBuffer =
+                GraphicBufferPool::getInstance().take(owner, width, height,
+                        format, BQ_LAYER_COUNT, usage, &pooledFence);
+        if (graphicBuffer != NULL) {
+            BQ_LOGV("dequeueBuffer: reusing a pooled buffer for slot %d",
+                    *outSlot);
+            *outFence = pooledFence;
+        } else {
+            BQ_LOGV("dequeueBuffer: allocating a new buffer for slot %d",
+                    *outSlot);
+            GraphicBufferAllocator::ScopedUidAttribution attribution(owner);
+            graphicBuffer = new GraphicBuffer(
+                    width, height, format, BQ_LAYER_COUNT, usage,
+                    {mConsumerName.string(), mConsumerName.size()});
+        }
 
         status_t error = graphicBuffer->initCheck();
 
@@ -786,9 +830,15 @@ status_t BufferQueueProducer::queueBuffer(int slot,
 
     sp<IConsumerListener> frameAvailableListener;
     sp<IConsumerListener> frameReplacedListener;
+    sp<IConsumerListener> buffersReleasedListener;
     int callbackTicket = 0;
     uint64_t currentFrameNumber = 0;
     BufferItem item;
+    // Holds the references of a replaced droppable buffer until after the
+    // lock is released, so that the last one isn't dropped with it held
+    BufferItem droppedItem;
+    int32_t queueDepth = 0;
+    String8 consumerName;
     { // Autolock scope
         Mutex::Autolock lock(mCore->mMutex);
 
@@ -854,6 +904,7 @@ status_t BufferQueueProducer::queueBuffer(int slot,
         ++mCore->mFrameCounter;
         currentFrameNumber = mCore->mFrameCounter;
         mSlots[slot].mFrameNumber = currentFrameNumber;
+        mSlots[slot].mQueueTime = systemTime();
 
         item.mAcquireCalled = mSlots[slot].mAcquireCalled;
         item.mGraphicBuffer = mSlots[slot].mGraphicBuffer;
@@ -920,6 +971,7 @@ status_t BufferQueueProducer::queueBuffer(int slot,
                 }
 
                 // Overwrite the droppable buffer with the incoming one
+                droppedItem = last;
                 mCore->mQueue.editItemAt(mCore->mQueue.size() - 1) = item;
                 frameReplacedListener = mCore->mConsumerListener;
             } else {
@@ -929,7 +981,6 @@ status_t BufferQueueProducer::queueBuffer(int slot,
         }
 
         mCore->mBufferHasBeenQueued = true;
-        mCore->mDequeueCondition.broadcast();
         mCore->mLastQueuedSlot = slot;
 
         output->width = mCore->mDefaultWidth;
@@ -938,9 +989,12 @@ status_t BufferQueueProducer::queueBuffer(int slot,
         output->numPendingBuffers = static_cast<uint32_t>(mCore->mQueue.size());
         output->nextFrameNumber = mCore->mFrameCounter + 1;
 
-        ATRACE_INT(mCore->mConsumerName.string(),
-                static_cast<int32_t>(mCore->mQueue.size()));
+        queueDepth = static_cast<int32_t>(mCore->mQueue.size());
+        consumerName = mCore->mConsumerName;
         mCore->mOccupancyTracker.registerOccupancyChange(mCore->mQueue.size());
+        if (mCore->shrinkBufferCountLocked()) {
+            buffersReleasedListener = mCore->mConsumerListener;
+        }
 
         // Take a ticket for the callback functions
         callbackTicket = mNextCallbackTicket++;
@@ -948,6 +1002,11 @@ status_t BufferQueueProducer::queueBuffer(int slot,
         VALIDATE_CONSISTENCY();
     } // Autolock scope
 
+    // Wake up the waiters once the lock is released, so that they don't
+    // wake up only to block on it. They recheck their condition anyway.
+    mCore->mDequeueCondition.broadcast();
+    ATRACE_INT(consumerName.string(), queueDepth);
+
     // It is okay not to clear the GraphicBuffer when the consumer is SurfaceFlinger because
     // it is guaranteed that the BufferQueue is inside SurfaceFlinger's process and
     // there will be no Binder call
@@ -975,6 +1034,9 @@ status_t BufferQueueProducer::queueBuffer(int slot,
         } else if (frameReplacedListener != NULL) {
             frameReplacedListener->onFrameReplaced(item);
         }
+        if (buffersReleasedListener != NULL) {
+            buffersReleasedListener->onBuffersReleased();
+        }
 
         connectedApi = mCore->mConnectedApi;
         lastQueuedFence = std::move(mLastQueueBufferFence);
@@ -1009,6 +1071,27 @@ status_t BufferQueueProducer::queueBuffer(int slot,
     return NO_ERROR;
 }
 
+status_t BufferQueueProducer::queueAndDequeueBuffer(int slot,
+        const QueueBufferInput& input, QueueBufferOutput* output,
+        int* outSlot, sp<Fence>* outFence, status_t* outDequeueResult,
+        uint32_t width, uint32_t height, PixelFormat format,
+        uint32_t usage) {
+    ATRACE_CALL();
+    *outSlot = BufferQueueCore::INVALID_BUFFER_SLOT;
+    *outFence = Fence::NO_FENCE;
+    *outDequeueResult = WOULD_BLOCK;
+
+    status_t result = queueBuffer(slot, input, output);
+    if (result != NO_ERROR) {
+        return result;
+    }
+
+    // The frame timestamps were already returned in output
+    *outDequeueResult = dequeueBufferImpl(FreeSlotCaller::Prefetch, outSlot,
+            outFence, width, height, format, usage, nullptr);
+    return NO_ERROR;
+}
+
 status_t BufferQueueProducer::cancelBuffer(int slot, const sp<Fence>& fence) {
     ATRACE_CALL();
     BQ_LOGV("cancelBuffer: slot %d", slot);
@@ -1205,6 +1288,7 @@ status_t BufferQueueProducer::connect(const sp<IProducerListener>& listener,
             break;
     }
     mCore->mConnectedPid = IPCThreadState::self()->getCallingPid();
+    mCore->mConnectedUid = IPCThreadState::self()->getCallingUid();
     mCore->mBufferHasBeenQueued = false;
     mCore->mDequeueBufferCannotBlock = false;
     if (mDequeueTimeout < 0) {
@@ -1327,6 +1411,7 @@ void BufferQueueProducer::allocateBuffers(uint32_t width, uint32_t height,
         uint32_t allocHeight = 0;
         PixelFormat allocFormat = PIXEL_FORMAT_UNKNOWN;
         uint32_t allocUsage = 0;
+        uid_t owner = 0;
         { // Autolock scope
             Mutex::Autolock lock(mCore->mMutex);
             mCore->waitWhileAllocatingLocked();
@@ -1346,15 +1431,43 @@ void BufferQueueProducer::allocateBuffers(uint32_t width, uint32_t height,
             allocHeight = height > 0 ? height : mCore->mDefaultHeight;
             allocFormat = format != 0 ? format : mCore->mDefaultBufferFormat;
             allocUsage = usage | mCore->mConsumerUsageBits;
+            owner = mCore->mConnectedUid;
 
             mCore->mIsAllocating = true;
         } // Autolock scope
 
+        GraphicBufferAllocator::ScopedUidAttribution attribution(owner);
         Vector<sp<GraphicBuffer>> buffers;
-        for (size_t i = 0; i <  newBufferCount; ++i) {
-            sp<GraphicBuffer> graphicBuffer = new GraphicBuffer(
-                    allocWidth, allocHeight, allocFormat, BQ_LAYER_COUNT,
-                    allocUsage, {mConsumerName.string(), mConsumerName.size()});
+        Vector<sp<Fence>> fences;
+        size_t missingCount = 0;
+        for (size_t i = 0; i < newBufferCount; ++i) {
+            sp<Fence> fence = Fence::NO_FENCE;
+            sp<GraphicBuffer> graphicBuffer =
+                    GraphicBufferPool::getInstance().take(owner, allocWidth,
+                            allocHeight, allocFormat, BQ_LAYER_COUNT,
+                            allocUsage, &fence);
+            if (graphicBuffer == NULL) {
+                missingCount++;
+            }
+            buffers.push_back(graphicBuffer);
+            fences.push_back(fence);
+        }
+
+        // Let the allocator allocate the buffers the pool couldn't provide
+        // in parallel, the GraphicBuffers below claim them one at a time.
+        if (missingCount > 1) {
+            GraphicBufferAllocator::get().prefetch({allocWidth, allocHeight,
+                    allocFormat, BQ_LAYER_COUNT, allocUsage,
+                    {mConsumerName.string(), mConsumerName.size()}}, missingCount);
+        }
+
+        for (size_t i = 0; i < newBufferCount; ++i) {
+            sp<GraphicBuffer>& graphicBuffer(buffers.editItemAt(i));
+            if (graphicBuffer == NULL) {
+                graphicBuffer = new GraphicBuffer(
+                        allocWidth, allocHeight, allocFormat, BQ_LAYER_COUNT,
+                        allocUsage, {mConsumerName.string(), mConsumerName.size()});
+            }
 
             status_t result = graphicBuffer->initCheck();
 
@@ -1366,7 +1479,6 @@ void BufferQueueProducer::allocateBuffers(uint32_t width, uint32_t height,
                 mCore->mIsAllocatingCondition.broadcast();
                 return;
             }
-            buffers.push_back(graphicBuffer);
         }
 
         { // Autolock scope
@@ -1393,8 +1505,9 @@ void BufferQueueProducer::allocateBuffers(uint32_t width, uint32_t height,
                 }
                 auto slot = mCore->mFreeSlots.begin();
                 mCore->clearBufferSlotLocked(*slot); // Clean up the slot first
+                buffers[i]->setGenerationNumber(mCore->mGenerationNumber);
                 mSlots[*slot].mGraphicBuffer = buffers[i];
-                mSlots[*slot].mFence = Fence::NO_FENCE;
+                mSlots[*slot].mFence = fences[i];
 
                 // freeBufferLocked puts this slot on the free slots list. Since
                 // we then attached a buffer, move the slot to free buffer list.
@@ -1512,6 +1625,24 @@ void BufferQueueProducer::getFrameTimestamps(FrameEventHistoryDelta* outDelta) {
     addAndGetFrameTimestamps(nullptr, outDelta);
 }
 
+status_t BufferQueueProducer::getFrameEventBlock(int* outFd) {
+    ATRACE_CALL();
+    BQ_LOGV("getFrameEventBlock");
+    sp<IConsumerListener> listener;
+    {
+        Mutex::Autolock lock(mCore->mMutex);
+        if (mCore->mIsAbandoned) {
+            BQ_LOGE("getFrameEventBlock: BufferQueue has been abandoned");
+            return NO_INIT;
+        }
+        listener = mCore->mConsumerListener;
+    }
+    if (listener == NULL) {
+        return NO_INIT;
+    }
+    return listener->getFrameEventBlock(outFd);
+}
+
 void BufferQueueProducer::addAndGetFrameTimestamps(
         const NewFrameEventsEntry* newTimestamps,
         FrameEventHistoryDelta* outDelta) {
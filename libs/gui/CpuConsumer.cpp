@@ -40,6 +40,10 @@ CpuConsumer::CpuConsumer(const sp<IGraphicBufferConsumer>& bq,
     // Create tracking entries for locked buffers
     mAcquiredBuffers.insertAt(0, maxLockedBuffers);
 
+    for (size_t i = 0; i < BufferQueue::NUM_BUFFER_SLOTS; i++) {
+        mSlotLockModes[i] = LOCK_MODE_UNKNOWN;
+    }
+
     mConsumer->setConsumerUsageBits(GRALLOC_USAGE_SW_READ_OFTEN);
     mConsumer->setMaxAcquiredBufferCount(static_cast<int32_t>(maxLockedBuffers));
 }
@@ -89,9 +93,32 @@ static bool isPossiblyYUV(PixelFormat format) {
 }
 
 status_t CpuConsumer::lockNextBuffer(LockedBuffer *nativeBuffer) {
+    if (!nativeBuffer) return BAD_VALUE;
+
+    Mutex::Autolock _l(mMutex);
+    return lockNextBufferLocked(nativeBuffer);
+}
+
+status_t CpuConsumer::lockNextBuffers(LockedBuffer *nativeBuffers,
+        size_t count, size_t *outLockedCount) {
+    if (!nativeBuffers || !outLockedCount || count == 0) return BAD_VALUE;
+    *outLockedCount = 0;
+
+    Mutex::Autolock _l(mMutex);
+    status_t err = OK;
+    while (*outLockedCount < count) {
+        err = lockNextBufferLocked(&nativeBuffers[*outLockedCount]);
+        if (err != OK) {
+            break;
+        }
+        (*outLockedCount)++;
+    }
+    return *outLockedCount > 0 ? OK : err;
+}
+
+status_t CpuConsumer::lockNextBufferLocked(LockedBuffer *nativeBuffer) {
     status_t err;
 
-    if (!nativeBuffer) return BAD_VALUE;
     if (mCurrentLockedBuffers == mMaxLockedBuffers) {
         CC_LOGW("Max buffers have been locked (%zd), cannot lock anymore.",
                 mMaxLockedBuffers);
@@ -100,8 +127,6 @@ status_t CpuConsumer::lockNextBuffer(LockedBuffer *nativeBuffer) {
 
     BufferItem b;
 
-    Mutex::Autolock _l(mMutex);
-
     err = acquireBufferLocked(&b, 0);
     if (err != OK) {
         if (err == BufferQueue::NO_BUFFER_AVAILABLE) {
@@ -119,7 +144,7 @@ status_t CpuConsumer::lockNextBuffer(LockedBuffer *nativeBuffer) {
 
     PixelFormat format = mSlots[slot].mGraphicBuffer->getPixelFormat();
     PixelFormat flexFormat = format;
-    if (isPossiblyYUV(format)) {
+    if (isPossiblyYUV(format) && mSlotLockModes[slot] != LOCK_MODE_PLAIN) {
         if (b.mFence.get()) {
             err = mSlots[slot].mGraphicBuffer->lockAsyncYCbCr(
                 GraphicBuffer::USAGE_SW_READ_OFTEN,
@@ -133,6 +158,7 @@ status_t CpuConsumer::lockNextBuffer(LockedBuffer *nativeBuffer) {
                 &ycbcr);
         }
         if (err == OK) {
+            mSlotLockModes[slot] = LOCK_MODE_YCBCR;
             bufferPointer = ycbcr.y;
             flexFormat = HAL_PIXEL_FORMAT_YCbCr_420_888;
             if (format != HAL_PIXEL_FORMAT_YCbCr_420_888) {
@@ -142,6 +168,8 @@ status_t CpuConsumer::lockNextBuffer(LockedBuffer *nativeBuffer) {
             CC_LOGE("Unable to lock YCbCr buffer for CPU reading: %s (%d)",
                     strerror(-err), err);
             return err;
+        } else if (mSlotLockModes[slot] == LOCK_MODE_UNKNOWN) {
+            mSlotLockModes[slot] = LOCK_MODE_PLAIN;
         }
     }
 
@@ -261,6 +289,7 @@ status_t CpuConsumer::releaseAcquiredBufferLocked(size_t lockedIdx) {
 }
 
 void CpuConsumer::freeBufferLocked(int slotIndex) {
+    mSlotLockModes[slotIndex] = LOCK_MODE_UNKNOWN;
     ConsumerBase::freeBufferLocked(slotIndex);
 }
 
@@ -25,6 +25,7 @@
 #include <private/gui/ComposerService.h>
 
 #include <private/gui/BitTube.h>
+#include <private/gui/LatestVsyncSlot.h>
 
 // ---------------------------------------------------------------------------
 
@@ -78,6 +79,37 @@ status_t DisplayEventReceiver::requestNextVsync() {
     return NO_INIT;
 }
 
+status_t DisplayEventReceiver::enableLatestVsync() {
+    if (mEventConnection == NULL)
+        return NO_INIT;
+    if (mLatestVsync != NULL)
+        return NO_ERROR;
+
+    auto slot = std::make_unique<gui::LatestVsyncSlot>();
+    status_t err = mEventConnection->enableLatestVsync(slot.get());
+    if (err != NO_ERROR)
+        return err;
+    err = slot->initCheck();
+    if (err != NO_ERROR)
+        return err;
+    mLatestVsync = std::move(slot);
+    return NO_ERROR;
+}
+
+int DisplayEventReceiver::getLatestVsyncFd() const {
+    if (mLatestVsync == NULL)
+        return NO_INIT;
+
+    return mLatestVsync->getFd();
+}
+
+bool DisplayEventReceiver::getLatestVsync(LatestVsync* vsync) {
+    if (mLatestVsync == NULL)
+        return false;
+
+    return mLatestVsync->read(vsync);
+}
+
 
 ssize_t DisplayEventReceiver::getEvents(DisplayEventReceiver::Event* events,
         size_t count) {
@@ -87,13 +119,56 @@ ssize_t DisplayEventReceiver::getEvents(DisplayEventReceiver::Event* events,
 ssize_t DisplayEventReceiver::getEvents(gui::BitTube* dataChannel,
         Event* events, size_t count)
 {
-    return gui::BitTube::recvObjects(dataChannel, events, count);
+    return gui::BitTube::recvObjectsBatch(dataChannel, events, count);
+}
+
+ssize_t DisplayEventReceiver::getLatestEvents(DisplayEventReceiver::Event* events,
+        size_t count) {
+    return DisplayEventReceiver::getLatestEvents(mDataChannel.get(), events, count);
+}
+
+// Removes all but the last vsync event from events, keeping the order of the others. Returns the
+// number of events left.
+static size_t dropStaleVsyncs(DisplayEventReceiver::Event* events, size_t count) {
+    size_t last = count;
+    for (size_t i = 0; i < count; i++) {
+        if (events[i].header.type == DisplayEventReceiver::DISPLAY_EVENT_VSYNC) {
+            last = i;
+        }
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (events[i].header.type != DisplayEventReceiver::DISPLAY_EVENT_VSYNC || i == last) {
+            events[kept++] = events[i];
+        }
+    }
+    return kept;
+}
+
+ssize_t DisplayEventReceiver::getLatestEvents(gui::BitTube* dataChannel,
+        Event* events, size_t count)
+{
+    // Read into the free part of the buffer and drop stale vsyncs after each read, until the
+    // queue is empty or the buffer is full of events that have to be kept.
+    size_t kept = 0;
+    while (kept < count) {
+        ssize_t n = getEvents(dataChannel, events + kept, count - kept);
+        if (n < 0) {
+            return kept > 0 ? static_cast<ssize_t>(kept) : n;
+        }
+        if (n == 0) {
+            break;
+        }
+        kept = dropStaleVsyncs(events, kept + static_cast<size_t>(n));
+    }
+    return static_cast<ssize_t>(kept);
 }
 
 ssize_t DisplayEventReceiver::sendEvents(gui::BitTube* dataChannel,
         Event const* events, size_t count)
 {
-    return gui::BitTube::sendObjects(dataChannel, events, count);
+    return gui::BitTube::sendObjectsBatch(dataChannel, events, count);
 }
 
 // ---------------------------------------------------------------------------
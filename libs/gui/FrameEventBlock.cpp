@@ -0,0 +1,188 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "FrameEventBlock"
+
+#include <gui/FrameEventBlock.h>
+
+#include <cutils/ashmem.h>
+#include <log/log.h>
+
+#include <new>
+#include <type_traits>
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace android {
+
+static constexpr uint32_t MAX_READ_RETRIES = 64;
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2,
+        "FrameEventBlock requires lock-free atomics to be shared across processes");
+static_assert(std::is_trivially_copyable<FrameEventBlockSnapshot>::value,
+        "FrameEventBlockSnapshot must be trivially copyable");
+// FrameEventBlockWriter compares snapshots with memcmp
+static_assert(sizeof(FrameEventBlockEntry) == 2 * sizeof(uint64_t) + 9 * sizeof(nsecs_t),
+        "FrameEventBlockEntry must not have padding");
+
+// ----------------------------------------------------------------------------
+// FrameEventBlockWriter
+// ----------------------------------------------------------------------------
+
+FrameEventBlockWriter::FrameEventBlockWriter()
+  : mFd(-1),
+    mShared(nullptr)
+{
+    const size_t size = FrameEventBlock::getRegionSize();
+    mFd = ashmem_create_region("SurfaceFlinger frame events", size);
+    if (mFd < 0) {
+        ALOGE("FrameEventBlockWriter: ashmem_create_region failed: %s",
+                strerror(errno));
+        return;
+    }
+
+    void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, 0);
+    if (base == MAP_FAILED) {
+        ALOGE("FrameEventBlockWriter: mmap failed: %s", strerror(errno));
+        close(mFd);
+        mFd = -1;
+        return;
+    }
+
+    // Any mapping created from now on (i.e. by the producer) is read-only
+    if (ashmem_set_prot_region(mFd, PROT_READ) < 0) {
+        ALOGE("FrameEventBlockWriter: ashmem_set_prot_region failed: %s",
+                strerror(errno));
+        munmap(base, size);
+        close(mFd);
+        mFd = -1;
+        return;
+    }
+
+    FrameEventBlock::Shared* shared = new (base) FrameEventBlock::Shared;
+    shared->magic = FrameEventBlock::MAGIC;
+    shared->version = FrameEventBlock::VERSION;
+    shared->sequence.store(0, std::memory_order_relaxed);
+    shared->reserved = 0;
+    shared->snapshot = mLastSnapshot;
+    std::atomic_thread_fence(std::memory_order_release);
+
+    mShared = shared;
+}
+
+FrameEventBlockWriter::~FrameEventBlockWriter() {
+    if (mShared != nullptr) {
+        munmap(mShared, FrameEventBlock::getRegionSize());
+    }
+    if (mFd >= 0) {
+        close(mFd);
+    }
+}
+
+void FrameEventBlockWriter::write(const FrameEventBlockSnapshot& snapshot) {
+    if (mShared == nullptr ||
+            memcmp(&snapshot, &mLastSnapshot, sizeof(snapshot)) == 0) {
+        return;
+    }
+
+    const uint32_t sequence = mShared->sequence.load(std::memory_order_relaxed);
+    mShared->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    mShared->snapshot = snapshot;
+    mShared->sequence.store(sequence + 2, std::memory_order_release);
+
+    mLastSnapshot = snapshot;
+}
+
+// ----------------------------------------------------------------------------
+// FrameEventBlockReader
+// ----------------------------------------------------------------------------
+
+FrameEventBlockReader::FrameEventBlockReader(int fd)
+  : mFd(fd),
+    mShared(nullptr),
+    mLastSequence(0)
+{
+    if (mFd < 0) {
+        return;
+    }
+
+    const size_t size = FrameEventBlock::getRegionSize();
+    if (ashmem_get_size_region(mFd) < static_cast<int>(size)) {
+        ALOGE("FrameEventBlockReader: invalid region size");
+        return;
+    }
+
+    void* base = mmap(nullptr, size, PROT_READ, MAP_SHARED, mFd, 0);
+    if (base == MAP_FAILED) {
+        ALOGE("FrameEventBlockReader: mmap failed: %s", strerror(errno));
+        return;
+    }
+
+    const FrameEventBlock::Shared* shared =
+            static_cast<const FrameEventBlock::Shared*>(base);
+    if (shared->magic != FrameEventBlock::MAGIC ||
+            shared->version != FrameEventBlock::VERSION) {
+        ALOGE("FrameEventBlockReader: unsupported block layout");
+        munmap(base, size);
+        return;
+    }
+
+    mShared = shared;
+}
+
+FrameEventBlockReader::~FrameEventBlockReader() {
+    if (mShared != nullptr) {
+        munmap(const_cast<FrameEventBlock::Shared*>(mShared),
+                FrameEventBlock::getRegionSize());
+    }
+    if (mFd >= 0) {
+        close(mFd);
+    }
+}
+
+bool FrameEventBlockReader::read(FrameEventBlockSnapshot* outSnapshot) {
+    if (mShared == nullptr || outSnapshot == nullptr) {
+        return false;
+    }
+
+    // Bounds the number of times we look at a block that is being written,
+    // so that a consumer dying mid-write can't make us spin forever.
+    for (uint32_t retries = 0; retries < MAX_READ_RETRIES; retries++) {
+        const uint32_t before = mShared->sequence.load(std::memory_order_acquire);
+        if (before == mLastSequence) {
+            return false;
+        }
+        if (before & 1) {
+            continue;
+        }
+        const FrameEventBlockSnapshot snapshot = mShared->snapshot;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        const uint32_t after = mShared->sequence.load(std::memory_order_relaxed);
+        if (before != after) {
+            continue;
+        }
+        mLastSequence = before;
+        *outSnapshot = snapshot;
+        return true;
+    }
+    return false;
+}
+
+}; // namespace android
@@ -0,0 +1,243 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "FrameTimeline"
+
+#include <gui/FrameTimeline.h>
+
+#include <cutils/ashmem.h>
+#include <log/log.h>
+
+#include <new>
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace android {
+
+static constexpr uint32_t MAX_READ_RETRIES = 64;
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2,
+        "FrameTimeline requires lock-free atomics to be shared across processes");
+
+// ----------------------------------------------------------------------------
+// FrameTimelineWriter
+// ----------------------------------------------------------------------------
+
+FrameTimelineWriter::FrameTimelineWriter(uint32_t capacity)
+  : mFd(-1),
+    mSize(FrameTimeline::getRegionSize(capacity)),
+    mHeader(nullptr),
+    mRecords(nullptr)
+{
+    if (capacity == 0) {
+        ALOGE("FrameTimelineWriter: invalid capacity");
+        return;
+    }
+
+    mFd = ashmem_create_region("SurfaceFlinger frame timeline", mSize);
+    if (mFd < 0) {
+        ALOGE("FrameTimelineWriter: ashmem_create_region failed: %s",
+                strerror(errno));
+        return;
+    }
+
+    void* base = mmap(nullptr, mSize, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, 0);
+    if (base == MAP_FAILED) {
+        ALOGE("FrameTimelineWriter: mmap failed: %s", strerror(errno));
+        close(mFd);
+        mFd = -1;
+        return;
+    }
+
+    // Any mapping created from now on (i.e. by the readers) is read-only
+    if (ashmem_set_prot_region(mFd, PROT_READ) < 0) {
+        ALOGE("FrameTimelineWriter: ashmem_set_prot_region failed: %s",
+                strerror(errno));
+        munmap(base, mSize);
+        close(mFd);
+        mFd = -1;
+        return;
+    }
+
+    FrameTimeline::Header* header = new (base) FrameTimeline::Header;
+    header->magic = FrameTimeline::MAGIC;
+    header->version = FrameTimeline::VERSION;
+    header->capacity = capacity;
+    header->recordSize = sizeof(FrameTimeline::Record);
+    header->writeCount.store(0, std::memory_order_relaxed);
+
+    FrameTimeline::Record* records = reinterpret_cast<FrameTimeline::Record*>(header + 1);
+    for (uint32_t i = 0; i < capacity; i++) {
+        new (&records[i]) FrameTimeline::Record;
+        records[i].sequence.store(0, std::memory_order_relaxed);
+        records[i].index = UINT64_MAX;
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+
+    mHeader = header;
+    mRecords = records;
+}
+
+FrameTimelineWriter::~FrameTimelineWriter() {
+    if (mHeader != nullptr) {
+        munmap(mHeader, mSize);
+    }
+    if (mFd >= 0) {
+        close(mFd);
+    }
+}
+
+void FrameTimelineWriter::write(const FrameTimelineEntry& entry) {
+    if (mHeader == nullptr) {
+        return;
+    }
+
+    const uint64_t index = mHeader->writeCount.load(std::memory_order_relaxed);
+    FrameTimeline::Record& record(mRecords[index % mHeader->capacity]);
+
+    const uint32_t sequence = record.sequence.load(std::memory_order_relaxed);
+    record.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    record.index = index;
+    record.entry = entry;
+    record.sequence.store(sequence + 2, std::memory_order_release);
+
+    mHeader->writeCount.store(index + 1, std::memory_order_release);
+}
+
+// ----------------------------------------------------------------------------
+// FrameTimelineReader
+// ----------------------------------------------------------------------------
+
+FrameTimelineReader::FrameTimelineReader(int fd)
+  : mFd(fd),
+    mSize(0),
+    mHeader(nullptr),
+    mRecords(nullptr)
+{
+    if (mFd < 0) {
+        return;
+    }
+
+    const int size = ashmem_get_size_region(mFd);
+    if (size < static_cast<int>(sizeof(FrameTimeline::Header))) {
+        ALOGE("FrameTimelineReader: invalid region size %d", size);
+        return;
+    }
+
+    void* base = mmap(nullptr, static_cast<size_t>(size), PROT_READ, MAP_SHARED,
+            mFd, 0);
+    if (base == MAP_FAILED) {
+        ALOGE("FrameTimelineReader: mmap failed: %s", strerror(errno));
+        return;
+    }
+
+    const FrameTimeline::Header* header =
+            static_cast<const FrameTimeline::Header*>(base);
+    if (header->magic != FrameTimeline::MAGIC ||
+            header->version != FrameTimeline::VERSION ||
+            header->recordSize != sizeof(FrameTimeline::Record) ||
+            header->capacity == 0 ||
+            FrameTimeline::getRegionSize(header->capacity) >
+                    static_cast<size_t>(size)) {
+        ALOGE("FrameTimelineReader: unsupported timeline layout");
+        munmap(base, static_cast<size_t>(size));
+        return;
+    }
+
+    mSize = static_cast<size_t>(size);
+    mHeader = header;
+    mRecords = reinterpret_cast<const FrameTimeline::Record*>(header + 1);
+}
+
+FrameTimelineReader::~FrameTimelineReader() {
+    if (mHeader != nullptr) {
+        munmap(const_cast<FrameTimeline::Header*>(mHeader), mSize);
+    }
+    if (mFd >= 0) {
+        close(mFd);
+    }
+}
+
+uint64_t FrameTimelineReader::getWriteCount() const {
+    if (mHeader == nullptr) {
+        return 0;
+    }
+    return mHeader->writeCount.load(std::memory_order_acquire);
+}
+
+size_t FrameTimelineReader::read(uint64_t* inOutCursor,
+        FrameTimelineEntry* outEntries, size_t maxEntries,
+        uint64_t* outDropped) const {
+    if (outDropped != nullptr) {
+        *outDropped = 0;
+    }
+    if (mHeader == nullptr || inOutCursor == nullptr || outEntries == nullptr) {
+        return 0;
+    }
+
+    const uint64_t capacity = mHeader->capacity;
+    uint64_t cursor = *inOutCursor;
+    size_t count = 0;
+    uint64_t dropped = 0;
+    // Bounds the number of times we look at a record that is being written,
+    // so that a writer dying mid-write can't make readers spin forever.
+    uint32_t retries = 0;
+
+    while (count < maxEntries && retries < MAX_READ_RETRIES) {
+        const uint64_t writeCount = mHeader->writeCount.load(std::memory_order_acquire);
+        if (cursor >= writeCount) {
+            break;
+        }
+        if (writeCount - cursor > capacity) {
+            dropped += writeCount - capacity - cursor;
+            cursor = writeCount - capacity;
+        }
+
+        const FrameTimeline::Record& record(mRecords[cursor % capacity]);
+        const uint32_t before = record.sequence.load(std::memory_order_acquire);
+        if (before & 1) {
+            // The writer is lapping us on this very record, look again at
+            // writeCount to skip ahead.
+            retries++;
+            continue;
+        }
+        const uint64_t index = record.index;
+        const FrameTimelineEntry entry = record.entry;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        const uint32_t after = record.sequence.load(std::memory_order_relaxed);
+        if (before != after || index != cursor) {
+            // Overwritten while we were reading it
+            retries++;
+            continue;
+        }
+
+        outEntries[count++] = entry;
+        cursor++;
+        retries = 0;
+    }
+
+    *inOutCursor = cursor;
+    if (outDropped != nullptr) {
+        *outDropped = dropped;
+    }
+    return count;
+}
+
+}; // namespace android
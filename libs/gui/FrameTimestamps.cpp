@@ -18,6 +18,8 @@
 
 #define LOG_TAG "FrameEvents"
 
+#include <gui/FrameEventBlock.h>
+
 #include <cutils/compiler.h>  // For CC_[UN]LIKELY
 #include <inttypes.h>
 #include <utils/Log.h>
@@ -306,6 +308,56 @@ void ProducerFrameEventHistory::applyDelta(
     }
 }
 
+void ProducerFrameEventHistory::applySnapshot(
+        const FrameEventBlockSnapshot& snapshot) {
+    mCompositorTiming = snapshot.compositorTiming;
+
+    for (size_t i = 0; i < mFrames.size(); i++) {
+        const FrameEventBlockEntry& entry = snapshot.frames[i];
+        if (!entry.valid) {
+            continue;
+        }
+
+        FrameEvents& frame = mFrames[i];
+        if (!frame.valid || frame.frameNumber != entry.frameNumber) {
+            // We got a new frame. Initialize some of the fields.
+            frame.frameNumber = entry.frameNumber;
+            frame.addPostCompositeCalled = false;
+            frame.addReleaseCalled = false;
+            frame.acquireFence = FenceTime::NO_FENCE;
+            frame.gpuCompositionDoneFence = FenceTime::NO_FENCE;
+            frame.displayPresentFence = FenceTime::NO_FENCE;
+            frame.releaseFence = FenceTime::NO_FENCE;
+            frame.valid = true;
+        }
+
+        frame.postedTime = entry.postedTime;
+        frame.requestedPresentTime = entry.requestedPresentTime;
+        frame.latchTime = entry.latchTime;
+        frame.firstRefreshStartTime = entry.firstRefreshStartTime;
+        frame.lastRefreshStartTime = entry.lastRefreshStartTime;
+        frame.dequeueReadyTime = entry.dequeueReadyTime;
+
+        // Once set, either here or by a delta, the info is never reverted.
+        if (!frame.addPostCompositeCalled &&
+                (entry.flags & FrameEventBlockEntry::eAddPostCompositeCalled) &&
+                entry.gpuCompositionDoneTime != Fence::SIGNAL_TIME_PENDING &&
+                entry.displayPresentTime != Fence::SIGNAL_TIME_PENDING) {
+            frame.addPostCompositeCalled = true;
+            applySignalTime(&frame.gpuCompositionDoneFence,
+                    entry.gpuCompositionDoneTime);
+            applySignalTime(&frame.displayPresentFence,
+                    entry.displayPresentTime);
+        }
+        if (!frame.addReleaseCalled &&
+                (entry.flags & FrameEventBlockEntry::eAddReleaseCalled) &&
+                entry.releaseTime != Fence::SIGNAL_TIME_PENDING) {
+            frame.addReleaseCalled = true;
+            applySignalTime(&frame.releaseFence, entry.releaseTime);
+        }
+    }
+}
+
 void ProducerFrameEventHistory::updateSignalTimes() {
     mAcquireTimeline.updateSignalTimes();
     mGpuCompositionDoneTimeline.updateSignalTimes();
@@ -338,6 +390,18 @@ void ProducerFrameEventHistory::applyFenceDelta(FenceTimeline* timeline,
     }
 }
 
+void ProducerFrameEventHistory::applySignalTime(
+        std::shared_ptr<FenceTime>* dst, nsecs_t signalTime) const {
+    if (signalTime == Fence::SIGNAL_TIME_INVALID) {
+        return;
+    }
+    if ((*dst)->isValid()) {
+        (*dst)->applyTrustedSnapshot(FenceTime::Snapshot(signalTime));
+    } else {
+        *dst = std::make_shared<FenceTime>(signalTime);
+    }
+}
+
 std::shared_ptr<FenceTime> ProducerFrameEventHistory::createFenceTime(
         const sp<Fence>& fence) const {
     return std::make_shared<FenceTime>(fence);
@@ -353,6 +417,7 @@ ConsumerFrameEventHistory::~ConsumerFrameEventHistory() = default;
 void ConsumerFrameEventHistory::onDisconnect() {
     mCurrentConnectId++;
     mProducerWantsEvents = false;
+    updateFrameEventBlock();
 }
 
 void ConsumerFrameEventHistory::initializeCompositorTiming(
@@ -377,6 +442,7 @@ void ConsumerFrameEventHistory::addQueue(const NewFrameEventsEntry& newEntry) {
     mFramesDirty[mQueueOffset].setDirty<FrameEvent::POSTED>();
 
     mQueueOffset = (mQueueOffset + 1) % mFrames.size();
+    updateFrameEventBlock();
 }
 
 void ConsumerFrameEventHistory::addLatch(
@@ -388,6 +454,7 @@ void ConsumerFrameEventHistory::addLatch(
     }
     frame->latchTime = latchTime;
     mFramesDirty[mCompositionOffset].setDirty<FrameEvent::LATCH>();
+    updateFrameEventBlock();
 }
 
 void ConsumerFrameEventHistory::addPreComposition(
@@ -404,6 +471,7 @@ void ConsumerFrameEventHistory::addPreComposition(
         frame->firstRefreshStartTime = refreshStartTime;
         mFramesDirty[mCompositionOffset].setDirty<FrameEvent::FIRST_REFRESH_START>();
     }
+    updateFrameEventBlock();
 }
 
 void ConsumerFrameEventHistory::addPostComposition(uint64_t frameNumber,
@@ -428,6 +496,7 @@ void ConsumerFrameEventHistory::addPostComposition(uint64_t frameNumber,
             mFramesDirty[mCompositionOffset].setDirty<FrameEvent::DISPLAY_PRESENT>();
         }
     }
+    updateFrameEventBlock();
 }
 
 void ConsumerFrameEventHistory::addRelease(uint64_t frameNumber,
@@ -441,6 +510,7 @@ void ConsumerFrameEventHistory::addRelease(uint64_t frameNumber,
     frame->dequeueReadyTime = dequeueReadyTime;
     frame->releaseFence = std::move(release);
     mFramesDirty[mReleaseOffset].setDirty<FrameEvent::RELEASE>();
+    updateFrameEventBlock();
 }
 
 void ConsumerFrameEventHistory::getFrameDelta(
@@ -478,6 +548,57 @@ void ConsumerFrameEventHistory::getAndResetDelta(
 }
 
 
+int ConsumerFrameEventHistory::getFrameEventBlockFd() {
+    if (mFrameEventBlock == nullptr) {
+        auto block = std::make_unique<FrameEventBlockWriter>();
+        if (block->initCheck() != NO_ERROR) {
+            return -1;
+        }
+        mFrameEventBlock = std::move(block);
+        updateFrameEventBlock();
+    }
+    return mFrameEventBlock->getFd();
+}
+
+void ConsumerFrameEventHistory::updateFrameEventBlock() {
+    if (mFrameEventBlock == nullptr) {
+        return;
+    }
+
+    FrameEventBlockSnapshot snapshot;
+    snapshot.compositorTiming = mCompositorTiming;
+    for (size_t i = 0; i < mFrames.size(); i++) {
+        const FrameEvents& frame = mFrames[i];
+        // Same as the deltas, the producer only gets the frames of the
+        // current connection.
+        if (!frame.valid || frame.connectId != mCurrentConnectId) {
+            continue;
+        }
+
+        FrameEventBlockEntry& entry = snapshot.frames[i];
+        entry.frameNumber = frame.frameNumber;
+        entry.valid = 1;
+        entry.flags =
+                (frame.addPostCompositeCalled ?
+                        FrameEventBlockEntry::eAddPostCompositeCalled : 0) |
+                (frame.addReleaseCalled ?
+                        FrameEventBlockEntry::eAddReleaseCalled : 0);
+        entry.postedTime = frame.postedTime;
+        entry.requestedPresentTime = frame.requestedPresentTime;
+        entry.latchTime = frame.latchTime;
+        entry.firstRefreshStartTime = frame.firstRefreshStartTime;
+        entry.lastRefreshStartTime = frame.lastRefreshStartTime;
+        entry.dequeueReadyTime = frame.dequeueReadyTime;
+        entry.gpuCompositionDoneTime =
+                frame.gpuCompositionDoneFence->getCachedSignalTime();
+        entry.displayPresentTime =
+                frame.displayPresentFence->getCachedSignalTime();
+        entry.releaseTime = frame.releaseFence->getCachedSignalTime();
+    }
+    mFrameEventBlock->write(snapshot);
+}
+
+
 // ============================================================================
 // FrameEventsDelta
 // ============================================================================
@@ -41,6 +41,8 @@
 #include <utils/String8.h>
 #include <utils/Trace.h>
 
+#include <atomic>
+
 EGLAPI const char* eglQueryStringImplementationANDROID(EGLDisplay dpy, EGLint name);
 #define CROP_EXT_STR "EGL_ANDROID_image_crop"
 #define PROT_CONTENT_EXT_STR "EGL_EXT_protected_content"
@@ -148,6 +150,8 @@ static bool isEglImageCroppable(const Rect& crop) {
     return hasEglAndroidImageCrop() && (crop.left == 0 && crop.top == 0);
 }
 
+static std::atomic<uint64_t> sNextEglImageId(1);
+
 GLConsumer::GLConsumer(const sp<IGraphicBufferConsumer>& bq, uint32_t tex,
         uint32_t texTarget, bool useFenceSync, bool isControlledByApp) :
     ConsumerBase(bq, isControlledByApp),
@@ -166,6 +170,8 @@ GLConsumer::GLConsumer(const sp<IGraphicBufferConsumer>& bq, uint32_t tex,
     mTexTarget(texTarget),
     mEglDisplay(EGL_NO_DISPLAY),
     mEglContext(EGL_NO_CONTEXT),
+    mEglImageCacheSize(0),
+    mPerSlotTextures(false),
     mCurrentTexture(BufferQueue::INVALID_BUFFER_SLOT),
     mAttached(true)
 {
@@ -195,6 +201,8 @@ GLConsumer::GLConsumer(const sp<IGraphicBufferConsumer>& bq, uint32_t texTarget,
     mTexTarget(texTarget),
     mEglDisplay(EGL_NO_DISPLAY),
     mEglContext(EGL_NO_CONTEXT),
+    mEglImageCacheSize(0),
+    mPerSlotTextures(false),
     mCurrentTexture(BufferQueue::INVALID_BUFFER_SLOT),
     mAttached(false)
 {
@@ -244,7 +252,7 @@ status_t GLConsumer::updateTexImage() {
         if (err == BufferQueue::NO_BUFFER_AVAILABLE) {
             // We always bind the texture even if we don't update its contents.
             GLC_LOGV("updateTexImage: no buffers were available");
-            glBindTexture(mTexTarget, mTexName);
+            glBindTexture(mTexTarget, getCurrentTextureNameLocked());
             err = NO_ERROR;
         } else {
             GLC_LOGE("updateTexImage: acquire failed: %s (%d)",
@@ -257,7 +265,7 @@ status_t GLConsumer::updateTexImage() {
     err = updateAndReleaseLocked(item);
     if (err != NO_ERROR) {
         // We always bind the texture.
-        glBindTexture(mTexTarget, mTexName);
+        glBindTexture(mTexTarget, getCurrentTextureNameLocked());
         return err;
     }
 
@@ -381,12 +389,129 @@ status_t GLConsumer::acquireBufferLocked(BufferItem *item,
     // replaces any old EglImage with a new one (using the new buffer).
     if (item->mGraphicBuffer != NULL) {
         int slot = item->mSlot;
-        mEglSlots[slot].mEglImage = new EglImage(item->mGraphicBuffer);
+        mEglSlots[slot].mEglImage = takeEglImageLocked(item->mGraphicBuffer);
     }
 
     return NO_ERROR;
 }
 
+void GLConsumer::setEglImageCacheSize(size_t size) {
+    Mutex::Autolock lock(mMutex);
+    mEglImageCacheSize = size;
+    while (mEglImageCache.size() > mEglImageCacheSize) {
+        mEglImageCache.removeAt(mEglImageCache.size() - 1);
+    }
+}
+
+void GLConsumer::setPerSlotTexturesEnabled(bool enabled) {
+    Mutex::Autolock lock(mMutex);
+    if (mPerSlotTextures == enabled) {
+        return;
+    }
+    mPerSlotTextures = enabled;
+    if (!enabled) {
+        releaseSlotTexturesLocked();
+    }
+    if (mCurrentTextureImage != NULL) {
+        computeCurrentTransformMatrixLocked();
+    }
+}
+
+uint32_t GLConsumer::getCurrentTextureName() const {
+    Mutex::Autolock lock(mMutex);
+    return getCurrentTextureNameLocked();
+}
+
+Rect GLConsumer::getImageCropLocked(const Rect& crop) const {
+    return mPerSlotTextures ? Rect::INVALID_RECT : crop;
+}
+
+void GLConsumer::prepareEglImage(const BufferItem& item) {
+    ATRACE_CALL();
+    const sp<GraphicBuffer>& buffer = item.mGraphicBuffer;
+    EGLDisplay display;
+    Rect imageCrop;
+    {
+        Mutex::Autolock lock(mMutex);
+        if (mAbandoned || mEglImageCacheSize == 0 ||
+                mEglDisplay == EGL_NO_DISPLAY || buffer == NULL) {
+            return;
+        }
+        sp<EglImage> image = findEglImageLocked(buffer);
+        if (image != NULL) {
+            // Usually a no-op, unless the crop changed. Never touch the
+            // image that is bound to the texture.
+            if (image != mCurrentTextureImage) {
+                image->createIfNeeded(mEglDisplay, getImageCropLocked(item.mCrop));
+            }
+            return;
+        }
+        display = mEglDisplay;
+        imageCrop = getImageCropLocked(item.mCrop);
+    }
+
+    // This buffer has never been seen. Creating its EGLImage doesn't need a
+    // context and nobody else can reach it yet, so don't hold the lock while
+    // doing so.
+    sp<EglImage> image = new EglImage(buffer);
+    if (image->createIfNeeded(display, imageCrop) != NO_ERROR) {
+        return;
+    }
+
+    Mutex::Autolock lock(mMutex);
+    if (mAbandoned || mEglDisplay != display || findEglImageLocked(buffer) != NULL) {
+        return;
+    }
+    cacheEglImageLocked(image);
+}
+
+sp<GLConsumer::EglImage> GLConsumer::findEglImageLocked(
+        const sp<GraphicBuffer>& graphicBuffer) const {
+    const uint64_t id = graphicBuffer->getId();
+    for (int i = 0; i < BufferQueueDefs::NUM_BUFFER_SLOTS; i++) {
+        const sp<EglImage>& image = mEglSlots[i].mEglImage;
+        if (image != NULL && image->graphicBuffer() != NULL &&
+                image->graphicBuffer()->getId() == id) {
+            return image;
+        }
+    }
+    for (size_t i = 0; i < mEglImageCache.size(); i++) {
+        if (mEglImageCache[i]->graphicBuffer()->getId() == id) {
+            return mEglImageCache[i];
+        }
+    }
+    return NULL;
+}
+
+sp<GLConsumer::EglImage> GLConsumer::takeEglImageLocked(
+        const sp<GraphicBuffer>& graphicBuffer) {
+    const uint64_t id = graphicBuffer->getId();
+    for (size_t i = 0; i < mEglImageCache.size(); i++) {
+        if (mEglImageCache[i]->graphicBuffer()->getId() == id) {
+            sp<EglImage> image = mEglImageCache[i];
+            mEglImageCache.removeAt(i);
+            return image;
+        }
+    }
+    return new EglImage(graphicBuffer);
+}
+
+void GLConsumer::cacheEglImageLocked(const sp<EglImage>& image) {
+    const sp<GraphicBuffer>& buffer = image->graphicBuffer();
+    for (size_t i = mEglImageCache.size(); i > 0; i--) {
+        const sp<GraphicBuffer>& cached = mEglImageCache[i - 1]->graphicBuffer();
+        if (cached->getWidth() != buffer->getWidth() ||
+                cached->getHeight() != buffer->getHeight() ||
+                cached->getPixelFormat() != buffer->getPixelFormat()) {
+            mEglImageCache.removeAt(i - 1);
+        }
+    }
+    mEglImageCache.insertAt(image, 0);
+    while (mEglImageCache.size() > mEglImageCacheSize) {
+        mEglImageCache.removeAt(mEglImageCache.size() - 1);
+    }
+}
+
 status_t GLConsumer::releaseBufferLocked(int buf,
         sp<GraphicBuffer> graphicBuffer,
         EGLDisplay display, EGLSyncKHR eglFence) {
@@ -428,7 +553,8 @@ status_t GLConsumer::updateAndReleaseLocked(const BufferItem& item,
     // ConsumerBase.
     // We may have to do this even when item.mGraphicBuffer == NULL (which
     // means the buffer was previously acquired).
-    err = mEglSlots[slot].mEglImage->createIfNeeded(mEglDisplay, item.mCrop);
+    err = mEglSlots[slot].mEglImage->createIfNeeded(mEglDisplay,
+            getImageCropLocked(item.mCrop));
     if (err != NO_ERROR) {
         GLC_LOGW("updateAndRelease: unable to createImage on display=%p slot=%d",
                 mEglDisplay, slot);
@@ -518,6 +644,24 @@ status_t GLConsumer::bindTextureImageLocked() {
         return NO_INIT;
     }
 
+    deletePendingTexturesLocked();
+    if (mPerSlotTextures && mCurrentTexture != BufferQueue::INVALID_BUFFER_SLOT) {
+        status_t err = bindSlotTextureLocked(false);
+        // Same as below, a failed bind may mean that the display was
+        // terminated and initialized again.
+        if (err == NO_ERROR && (error = glGetError()) != GL_NO_ERROR) {
+            err = bindSlotTextureLocked(true);
+            if (err == NO_ERROR && (error = glGetError()) != GL_NO_ERROR) {
+                GLC_LOGE("bindTextureImage: error binding external image: %#04x", error);
+                err = UNKNOWN_ERROR;
+            }
+        }
+        if (err != NO_ERROR) {
+            return err;
+        }
+        return doGLFenceWaitLocked();
+    }
+
     status_t err = mCurrentTextureImage->createIfNeeded(mEglDisplay,
                                                         mCurrentCrop);
     if (err != NO_ERROR) {
@@ -552,6 +696,63 @@ status_t GLConsumer::bindTextureImageLocked() {
     return doGLFenceWaitLocked();
 }
 
+status_t GLConsumer::bindSlotTextureLocked(bool forceCreate) {
+    EglSlot& eglSlot = mEglSlots[mCurrentTexture];
+    if (eglSlot.mTexName == 0) {
+        glGenTextures(1, &eglSlot.mTexName);
+        glBindTexture(mTexTarget, eglSlot.mTexName);
+        glTexParameteri(mTexTarget, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(mTexTarget, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(mTexTarget, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(mTexTarget, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        eglSlot.mBoundImageId = 0;
+    } else {
+        glBindTexture(mTexTarget, eglSlot.mTexName);
+    }
+
+    status_t err = mCurrentTextureImage->createIfNeeded(mEglDisplay,
+            getImageCropLocked(mCurrentCrop), forceCreate);
+    if (err != NO_ERROR) {
+        GLC_LOGW("bindTextureImage: can't create image on display=%p slot=%d",
+                mEglDisplay, mCurrentTexture);
+        return UNKNOWN_ERROR;
+    }
+
+    // The image only changes when the buffer in the slot is reallocated or
+    // the display changes, the rest of the time the texture already samples
+    // from the right buffer.
+    if (forceCreate || eglSlot.mBoundImageId != mCurrentTextureImage->imageId()) {
+        mCurrentTextureImage->bindToTextureTarget(mTexTarget);
+        eglSlot.mBoundImageId = mCurrentTextureImage->imageId();
+    }
+    return NO_ERROR;
+}
+
+uint32_t GLConsumer::getCurrentTextureNameLocked() const {
+    if (mPerSlotTextures && mCurrentTexture != BufferQueue::INVALID_BUFFER_SLOT &&
+            mEglSlots[mCurrentTexture].mTexName != 0) {
+        return mEglSlots[mCurrentTexture].mTexName;
+    }
+    return mTexName;
+}
+
+void GLConsumer::deletePendingTexturesLocked() {
+    if (!mPendingTextureDeletes.isEmpty()) {
+        glDeleteTextures(mPendingTextureDeletes.size(), mPendingTextureDeletes.array());
+        mPendingTextureDeletes.clear();
+    }
+}
+
+void GLConsumer::releaseSlotTexturesLocked() {
+    for (int i = 0; i < BufferQueueDefs::NUM_BUFFER_SLOTS; i++) {
+        if (mEglSlots[i].mTexName != 0) {
+            mPendingTextureDeletes.push_back(mEglSlots[i].mTexName);
+            mEglSlots[i].mTexName = 0;
+            mEglSlots[i].mBoundImageId = 0;
+        }
+    }
+}
+
 status_t GLConsumer::checkAndUpdateEglStateLocked(bool contextCheck) {
     EGLDisplay dpy = eglGetCurrentDisplay();
     EGLContext ctx = eglGetCurrentContext();
@@ -632,6 +833,14 @@ status_t GLConsumer::detachFromContext() {
         glDeleteTextures(1, &mTexName);
     }
 
+    // The per-slot textures belong to this context, they are created again in
+    // the next one.
+    releaseSlotTexturesLocked();
+    if (dpy != EGL_NO_DISPLAY && ctx != EGL_NO_CONTEXT) {
+        deletePendingTexturesLocked();
+    }
+    mPendingTextureDeletes.clear();
+
     mEglDisplay = EGL_NO_DISPLAY;
     mEglContext = EGL_NO_CONTEXT;
     mAttached = false;
@@ -810,8 +1019,10 @@ void GLConsumer::computeCurrentTransformMatrixLocked() {
         GLC_LOGD("computeCurrentTransformMatrixLocked: "
                 "mCurrentTextureImage is NULL");
     }
+    // The EGLImages of per-slot textures are never cropped.
+    const bool imageCropped = !mPerSlotTextures && isEglImageCroppable(mCurrentCrop);
     computeTransformMatrix(mCurrentTransformMatrix, buf,
-        isEglImageCroppable(mCurrentCrop) ? Rect::EMPTY_RECT : mCurrentCrop,
+        imageCropped ? Rect::EMPTY_RECT : mCurrentCrop,
         mCurrentTransform, mFilteringEnabled);
 }
 
@@ -1074,7 +1285,17 @@ void GLConsumer::freeBufferLocked(int slotIndex) {
     if (slotIndex == mCurrentTexture) {
         mCurrentTexture = BufferQueue::INVALID_BUFFER_SLOT;
     }
+    const sp<EglImage>& image = mEglSlots[slotIndex].mEglImage;
+    if (image != NULL && image->graphicBuffer() != NULL &&
+            mEglImageCacheSize > 0) {
+        cacheEglImageLocked(image);
+    }
     mEglSlots[slotIndex].mEglImage.clear();
+    if (mEglSlots[slotIndex].mTexName != 0) {
+        mPendingTextureDeletes.push_back(mEglSlots[slotIndex].mTexName);
+        mEglSlots[slotIndex].mTexName = 0;
+        mEglSlots[slotIndex].mBoundImageId = 0;
+    }
     ConsumerBase::freeBufferLocked(slotIndex);
 }
 
@@ -1082,6 +1303,8 @@ void GLConsumer::abandonLocked() {
     GLC_LOGV("abandonLocked");
     mCurrentTextureImage.clear();
     ConsumerBase::abandonLocked();
+    // freeBufferLocked moved the slot images to the cache
+    mEglImageCache.clear();
 }
 
 void GLConsumer::setName(const String8& name) {
@@ -1145,10 +1368,11 @@ void GLConsumer::dumpLocked(String8& result, const char* prefix) const
 {
     result.appendFormat(
        "%smTexName=%d mCurrentTexture=%d\n"
-       "%smCurrentCrop=[%d,%d,%d,%d] mCurrentTransform=%#x\n",
+       "%smCurrentCrop=[%d,%d,%d,%d] mCurrentTransform=%#x\n"
+       "%smEglImageCache=%zu/%zu\n",
        prefix, mTexName, mCurrentTexture, prefix, mCurrentCrop.left,
        mCurrentCrop.top, mCurrentCrop.right, mCurrentCrop.bottom,
-       mCurrentTransform);
+       mCurrentTransform, prefix, mEglImageCache.size(), mEglImageCacheSize);
 
     ConsumerBase::dumpLocked(result, prefix);
 }
@@ -1179,7 +1403,8 @@ GLConsumer::EglImage::EglImage(sp<GraphicBuffer> graphicBuffer) :
     mGraphicBuffer(graphicBuffer),
     mEglImage(EGL_NO_IMAGE_KHR),
     mEglDisplay(EGL_NO_DISPLAY),
-    mCropRect(Rect::EMPTY_RECT) {
+    mCropRect(Rect::EMPTY_RECT),
+    mImageId(0) {
 }
 
 GLConsumer::EglImage::~EglImage() {
@@ -1205,6 +1430,7 @@ status_t GLConsumer::EglImage::createIfNeeded(EGLDisplay eglDisplay,
         eglTerminate(mEglDisplay);
         mEglImage = EGL_NO_IMAGE_KHR;
         mEglDisplay = EGL_NO_DISPLAY;
+        mImageId = 0;
     }
 
     // If there's no image, create one.
@@ -1212,6 +1438,9 @@ status_t GLConsumer::EglImage::createIfNeeded(EGLDisplay eglDisplay,
         mEglDisplay = eglDisplay;
         mCropRect = cropRect;
         mEglImage = createImage(mEglDisplay, mGraphicBuffer, mCropRect);
+        if (mEglImage != EGL_NO_IMAGE_KHR) {
+            mImageId = sNextEglImageId.fetch_add(1, std::memory_order_relaxed);
+        }
     }
 
     // Fail if we can't create a valid image.
@@ -0,0 +1,131 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <private/gui/GraphicBufferCache.h>
+
+#include <binder/Parcel.h>
+
+namespace android {
+namespace gui {
+
+GraphicBufferCache::Reference GraphicBufferCache::Reference::from(const GraphicBuffer& buffer) {
+    Reference reference;
+    reference.id = buffer.getId();
+    reference.generationNumber = buffer.getGenerationNumber();
+    reference.width = buffer.getWidth();
+    reference.height = buffer.getHeight();
+    reference.stride = buffer.getStride();
+    reference.format = buffer.getPixelFormat();
+    reference.layerCount = buffer.getLayerCount();
+    reference.usage = buffer.getUsage();
+    return reference;
+}
+
+bool GraphicBufferCache::Reference::matches(const GraphicBuffer& buffer) const {
+    return id == buffer.getId() && generationNumber == buffer.getGenerationNumber() &&
+            width == buffer.getWidth() && height == buffer.getHeight() &&
+            stride == buffer.getStride() && format == buffer.getPixelFormat() &&
+            layerCount == buffer.getLayerCount() && usage == buffer.getUsage();
+}
+
+status_t GraphicBufferCache::Reference::writeToParcel(Parcel* parcel) const {
+    status_t result = parcel->writeUint64(id);
+    if (result != NO_ERROR) return result;
+    result = parcel->writeUint32(generationNumber);
+    if (result != NO_ERROR) return result;
+    result = parcel->writeUint32(width);
+    if (result != NO_ERROR) return result;
+    result = parcel->writeUint32(height);
+    if (result != NO_ERROR) return result;
+    result = parcel->writeUint32(stride);
+    if (result != NO_ERROR) return result;
+    result = parcel->writeInt32(format);
+    if (result != NO_ERROR) return result;
+    result = parcel->writeUint32(layerCount);
+    if (result != NO_ERROR) return result;
+    return parcel->writeUint32(usage);
+}
+
+status_t GraphicBufferCache::Reference::readFromParcel(const Parcel* parcel) {
+    status_t result = parcel->readUint64(&id);
+    if (result != NO_ERROR) return result;
+    result = parcel->readUint32(&generationNumber);
+    if (result != NO_ERROR) return result;
+    result = parcel->readUint32(&width);
+    if (result != NO_ERROR) return result;
+    result = parcel->readUint32(&height);
+    if (result != NO_ERROR) return result;
+    result = parcel->readUint32(&stride);
+    if (result != NO_ERROR) return result;
+    result = parcel->readInt32(&format);
+    if (result != NO_ERROR) return result;
+    result = parcel->readUint32(&layerCount);
+    if (result != NO_ERROR) return result;
+    return parcel->readUint32(&usage);
+}
+
+void GraphicBufferCache::add(const sp<GraphicBuffer>& buffer) {
+    if (buffer == nullptr) {
+        return;
+    }
+
+    Mutex::Autolock lock(mMutex);
+    if (mBuffers.size() >= PRUNE_THRESHOLD) {
+        for (auto it = mBuffers.begin(); it != mBuffers.end();) {
+            if (it->second.promote() == nullptr) {
+                it = mBuffers.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    mBuffers[buffer->getId()] = buffer;
+}
+
+bool GraphicBufferCache::contains(const sp<GraphicBuffer>& buffer) const {
+    if (buffer == nullptr) {
+        return false;
+    }
+
+    Mutex::Autolock lock(mMutex);
+    auto it = mBuffers.find(buffer->getId());
+    return it != mBuffers.end() && it->second.promote() == buffer;
+}
+
+sp<GraphicBuffer> GraphicBufferCache::find(const Reference& reference) const {
+    sp<GraphicBuffer> buffer;
+    {
+        Mutex::Autolock lock(mMutex);
+        auto it = mBuffers.find(reference.id);
+        if (it == mBuffers.end()) {
+            return nullptr;
+        }
+        buffer = it->second.promote();
+    }
+    if (buffer == nullptr || !reference.matches(*buffer)) {
+        return nullptr;
+    }
+    return buffer;
+}
+
+void GraphicBufferCache::remove(uint64_t id) {
+    Mutex::Autolock lock(mMutex);
+    mBuffers.erase(id);
+}
+
+} // namespace gui
+} // namespace android
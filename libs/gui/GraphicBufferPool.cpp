@@ -0,0 +1,148 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "GraphicBufferPool"
+#define ATRACE_TAG ATRACE_TAG_GRAPHICS
+//#define LOG_NDEBUG 0
+
+#include <gui/GraphicBufferPool.h>
+
+#include <cutils/properties.h>
+#include <log/log.h>
+#include <utils/Trace.h>
+
+#include <iterator>
+
+#include <inttypes.h>
+#include <stdlib.h>
+
+namespace android {
+
+ANDROID_SINGLETON_STATIC_INSTANCE(GraphicBufferPool);
+
+GraphicBufferPool::GraphicBufferPool() : Singleton<GraphicBufferPool>(),
+        mBudget(DEFAULT_BUDGET_BYTES),
+        mSize(0),
+        mHits(0),
+        mMisses(0) {
+    char value[PROPERTY_VALUE_MAX];
+    if (property_get("debug.bq.buffer_pool_kb", value, nullptr) > 0) {
+        mBudget = static_cast<size_t>(strtoul(value, nullptr, 10)) * 1024;
+    }
+}
+
+size_t GraphicBufferPool::getBufferSize(const sp<GraphicBuffer>& buffer) {
+    // YUV formats report 0 bytes per pixel, count them as 32 bits to err on
+    // the side of holding less memory.
+    ssize_t bpp = bytesPerPixel(buffer->getPixelFormat());
+    if (bpp <= 0) {
+        bpp = 4;
+    }
+    return static_cast<size_t>(buffer->getStride()) * buffer->getHeight() *
+            buffer->getLayerCount() * static_cast<size_t>(bpp);
+}
+
+void GraphicBufferPool::recycle(uid_t owner, const sp<GraphicBuffer>& buffer,
+        const sp<Fence>& fence) {
+    if (buffer == NULL) {
+        return;
+    }
+
+    // Evicted buffers are freed once the lock is released
+    std::list<Entry> evicted;
+    {
+        Mutex::Autolock lock(mMutex);
+        const size_t size = getBufferSize(buffer);
+        if (size > mBudget) {
+            return;
+        }
+        const nsecs_t now = systemTime();
+        mEntries.push_front({owner, buffer,
+                fence != NULL ? fence : Fence::NO_FENCE, size, now});
+        mSize += size;
+        trimLocked(now, &evicted);
+        ALOGV("recycle: %ux%u format %d (%zu bytes), pool now %zu bytes",
+                buffer->getWidth(), buffer->getHeight(),
+                buffer->getPixelFormat(), size, mSize);
+    }
+}
+
+sp<GraphicBuffer> GraphicBufferPool::take(uid_t owner, uint32_t width,
+        uint32_t height, PixelFormat format, uint32_t layerCount,
+        uint32_t usage, sp<Fence>* outFence) {
+    std::list<Entry> evicted;
+    Mutex::Autolock lock(mMutex);
+    trimLocked(systemTime(), &evicted);
+    if (mEntries.empty()) {
+        return NULL;
+    }
+
+    for (auto entry = mEntries.begin(); entry != mEntries.end(); ++entry) {
+        if (entry->owner != owner || entry->buffer->needsReallocation(
+                width, height, format, layerCount, usage)) {
+            continue;
+        }
+        ATRACE_NAME("GraphicBufferPool::take");
+        sp<GraphicBuffer> buffer = entry->buffer;
+        *outFence = entry->fence;
+        mSize -= entry->size;
+        mEntries.erase(entry);
+        mHits++;
+        return buffer;
+    }
+    mMisses++;
+    return NULL;
+}
+
+void GraphicBufferPool::clear() {
+    std::list<Entry> evicted;
+    Mutex::Autolock lock(mMutex);
+    evicted.swap(mEntries);
+    mSize = 0;
+}
+
+void GraphicBufferPool::setBudget(size_t bytes) {
+    std::list<Entry> evicted;
+    Mutex::Autolock lock(mMutex);
+    mBudget = bytes;
+    trimLocked(systemTime(), &evicted);
+}
+
+void GraphicBufferPool::trimLocked(nsecs_t now, std::list<Entry>* outEvicted) {
+    while (!mEntries.empty() && (mSize > mBudget ||
+            now - mEntries.back().recycleTime > MAX_IDLE_TIME)) {
+        mSize -= mEntries.back().size;
+        outEvicted->splice(outEvicted->end(), mEntries,
+                std::prev(mEntries.end()));
+    }
+}
+
+void GraphicBufferPool::dump(String8& result) const {
+    Mutex::Autolock lock(mMutex);
+    result.appendFormat("GraphicBufferPool: %zu buffers, %zu/%zu KiB, "
+            "%" PRIu64 " hits, %" PRIu64 " misses\n", mEntries.size(),
+            mSize / 1024, mBudget / 1024, mHits, mMisses);
+    const nsecs_t now = systemTime();
+    for (const Entry& entry : mEntries) {
+        result.appendFormat("  uid %u: %ux%u format %d usage %#x, "
+                "%zu KiB, idle %.1f ms\n", entry.owner,
+                entry.buffer->getWidth(), entry.buffer->getHeight(),
+                entry.buffer->getPixelFormat(), entry.buffer->getUsage(),
+                entry.size / 1024, (now - entry.recycleTime) / 1e6);
+    }
+}
+
+}; // namespace android
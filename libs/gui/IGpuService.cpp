@@ -0,0 +1,179 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "IGpuService"
+
+#include <gui/IGpuService.h>
+
+#include <binder/IResultReceiver.h>
+#include <binder/IServiceManager.h>
+#include <binder/Parcel.h>
+
+#include <atomic>
+
+namespace android {
+
+enum {
+    SET_GPU_STATS = IBinder::FIRST_CALL_TRANSACTION,
+    GET_GPU_STATS,
+};
+
+// ----------------------------------------------------------------------------
+
+class BpGpuService : public BpInterface<IGpuService>
+{
+public:
+    explicit BpGpuService(const sp<IBinder>& impl) : BpInterface<IGpuService>(impl) {}
+
+    virtual void setGpuStats(const GraphicsEnv::GpuStats& stats) {
+        Parcel data, reply;
+        data.writeInterfaceToken(IGpuService::getInterfaceDescriptor());
+        data.writeInt64(stats.glDriverLoadTimeNs);
+        data.writeInt64(stats.vkDriverLoadTimeNs);
+        data.writeUint64(stats.shaderCacheHits);
+        data.writeUint64(stats.shaderCacheMisses);
+        remote()->transact(SET_GPU_STATS, data, &reply, IBinder::FLAG_ONEWAY);
+    }
+
+    virtual status_t getGpuStats(std::vector<GpuUidStats>* outStats) {
+        Parcel data, reply;
+        data.writeInterfaceToken(IGpuService::getInterfaceDescriptor());
+        status_t result = remote()->transact(GET_GPU_STATS, data, &reply);
+        if (result != NO_ERROR) {
+            ALOGE("getGpuStats failed to transact: %d", result);
+            return result;
+        }
+        result = reply.readInt32();
+        if (result != NO_ERROR) {
+            return result;
+        }
+        uint32_t count = reply.readUint32();
+        if (count > reply.dataAvail() / sizeof(int32_t)) {
+            return BAD_VALUE;
+        }
+        outStats->resize(count);
+        for (GpuUidStats& stats : *outStats) {
+            stats.uid = static_cast<uid_t>(reply.readInt32());
+            stats.processCount = reply.readUint32();
+            stats.glDriverLoadCount = reply.readUint32();
+            stats.glDriverLoadTimeTotalNs = reply.readInt64();
+            stats.glDriverLoadTimeMaxNs = reply.readInt64();
+            stats.vkDriverLoadCount = reply.readUint32();
+            stats.vkDriverLoadTimeTotalNs = reply.readInt64();
+            stats.vkDriverLoadTimeMaxNs = reply.readInt64();
+            stats.shaderCacheHits = reply.readUint64();
+            stats.shaderCacheMisses = reply.readUint64();
+            stats.gpuMemoryBytes = reply.readUint64();
+        }
+        return NO_ERROR;
+    }
+};
+
+IMPLEMENT_META_INTERFACE(GpuService, "android.ui.IGpuService");
+
+void IGpuService::reportGpuStats() {
+    static std::atomic<bool> sReported{false};
+    if (sReported.load(std::memory_order_relaxed)) {
+        return;
+    }
+    // Processes that only draw with the CPU have nothing to report, and may
+    // still load a driver later.
+    GraphicsEnv::GpuStats stats = GraphicsEnv::getInstance().getGpuStats();
+    if (stats.glDriverLoadTimeNs < 0 && stats.vkDriverLoadTimeNs < 0) {
+        return;
+    }
+    if (sReported.exchange(true)) {
+        return;
+    }
+
+    // Not worth waiting for, e.g. in the processes started before the gpu
+    // service
+    sp<IBinder> binder = defaultServiceManager()->checkService(String16("gpu"));
+    if (binder == nullptr) {
+        ALOGV("reportGpuStats: gpu service isn't running");
+        return;
+    }
+    interface_cast<IGpuService>(binder)->setGpuStats(stats);
+}
+
+status_t BnGpuService::onTransact(uint32_t code, const Parcel& data,
+        Parcel* reply, uint32_t flags)
+{
+    status_t status;
+    switch (code) {
+    case SET_GPU_STATS: {
+        CHECK_INTERFACE(IGpuService, data, reply);
+        GraphicsEnv::GpuStats stats;
+        stats.glDriverLoadTimeNs = data.readInt64();
+        stats.vkDriverLoadTimeNs = data.readInt64();
+        stats.shaderCacheHits = data.readUint64();
+        stats.shaderCacheMisses = data.readUint64();
+        setGpuStats(stats);
+        return NO_ERROR;
+    }
+
+    case GET_GPU_STATS: {
+        CHECK_INTERFACE(IGpuService, data, reply);
+        std::vector<GpuUidStats> stats;
+        status_t result = getGpuStats(&stats);
+        reply->writeInt32(result);
+        if (result != NO_ERROR) {
+            return NO_ERROR;
+        }
+        reply->writeUint32(static_cast<uint32_t>(stats.size()));
+        for (const GpuUidStats& s : stats) {
+            reply->writeInt32(static_cast<int32_t>(s.uid));
+            reply->writeUint32(s.processCount);
+            reply->writeUint32(s.glDriverLoadCount);
+            reply->writeInt64(s.glDriverLoadTimeTotalNs);
+            reply->writeInt64(s.glDriverLoadTimeMaxNs);
+            reply->writeUint32(s.vkDriverLoadCount);
+            reply->writeInt64(s.vkDriverLoadTimeTotalNs);
+            reply->writeInt64(s.vkDriverLoadTimeMaxNs);
+            reply->writeUint64(s.shaderCacheHits);
+            reply->writeUint64(s.shaderCacheMisses);
+            reply->writeUint64(s.gpuMemoryBytes);
+        }
+        return NO_ERROR;
+    }
+
+    case SHELL_COMMAND_TRANSACTION: {
+        int in = data.readFileDescriptor();
+        int out = data.readFileDescriptor();
+        int err = data.readFileDescriptor();
+        int argc = data.readInt32();
+        Vector<String16> args;
+        for (int i = 0; i < argc && data.dataAvail() > 0; i++) {
+           args.add(data.readString16());
+        }
+        sp<IBinder> unusedCallback;
+        sp<IResultReceiver> resultReceiver;
+        if ((status = data.readNullableStrongBinder(&unusedCallback)) != OK)
+            return status;
+        if ((status = data.readNullableStrongBinder(&resultReceiver)) != OK)
+            return status;
+        status = shellCommand(in, out, err, args);
+        if (resultReceiver != nullptr)
+            resultReceiver->send(status);
+        return OK;
+    }
+
+    default:
+        return BBinder::onTransact(code, data, reply, flags);
+    }
+}
+
+} // namespace android
@@ -14,7 +14,10 @@
  * limitations under the License.
  */
 
+#include <errno.h>
+#include <fcntl.h>
 #include <stdint.h>
+#include <string.h>
 #include <sys/types.h>
 
 #include <utils/Errors.h>
@@ -33,6 +36,8 @@
 
 #include <gui/bufferqueue/1.0/H2BGraphicBufferProducer.h>
 
+#include <private/gui/GraphicBufferCache.h>
+
 namespace android {
 // ----------------------------------------------------------------------------
 
@@ -62,7 +67,18 @@ enum {
     SET_DEQUEUE_TIMEOUT,
     GET_LAST_QUEUED_BUFFER,
     GET_FRAME_TIMESTAMPS,
-    GET_UNIQUE_ID
+    GET_UNIQUE_ID,
+    QUEUE_AND_DEQUEUE_BUFFER,
+    GET_FRAME_EVENT_BLOCK
+};
+
+// How ATTACH_BUFFER sends the buffer
+enum {
+    // flattened, i.e. the native handle is sent and imported again
+    ATTACH_BY_VALUE = 0,
+    // a GraphicBufferCache::Reference, if the remote side exchanged the
+    // buffer with us before
+    ATTACH_BY_REFERENCE = 1,
 };
 
 class BpGraphicBufferProducer : public BpInterface<IGraphicBufferProducer>
@@ -91,6 +107,7 @@ public:
                 (*buf).clear();
                 return result;
             }
+            mBufferCache.add(*buf);
         }
         result = reply.readInt32();
         return result;
@@ -198,6 +215,7 @@ public:
                     outBuffer->clear();
                     return result;
                 }
+                mBufferCache.add(*outBuffer);
             }
             nonNull = reply.readInt32();
             if (nonNull) {
@@ -214,23 +232,21 @@ public:
     }
 
     virtual status_t attachBuffer(int* slot, const sp<GraphicBuffer>& buffer) {
-        Parcel data, reply;
-        data.writeInterfaceToken(IGraphicBufferProducer::getInterfaceDescriptor());
-        data.write(*buffer.get());
-        status_t result = remote()->transact(ATTACH_BUFFER, data, &reply);
-        if (result != NO_ERROR) {
-            return result;
+        if (mBufferCache.contains(buffer)) {
+            bool found = false;
+            status_t result = transactAttachBuffer(slot, buffer, ATTACH_BY_REFERENCE, &found);
+            if (found) {
+                return result;
+            }
+            // The remote side destroyed its copy of the buffer in the meantime
+            mBufferCache.remove(buffer->getId());
         }
 
-        *slot = reply.readInt32();
-        result = reply.readInt32();
-        if (result == NO_ERROR &&
-                (*slot < 0 || *slot >= BufferQueueDefs::NUM_BUFFER_SLOTS)) {
-            ALOGE("attachBuffer returned invalid slot %d", *slot);
-            android_errorWriteLog(0x534e4554, "37478824");
-            return UNKNOWN_ERROR;
+        bool found = false;
+        status_t result = transactAttachBuffer(slot, buffer, ATTACH_BY_VALUE, &found);
+        if (result == NO_ERROR) {
+            mBufferCache.add(buffer);
         }
-
         return result;
     }
 
@@ -256,6 +272,50 @@ public:
         return result;
     }
 
+    virtual status_t queueAndDequeueBuffer(int buf,
+            const QueueBufferInput& input, QueueBufferOutput* output,
+            int* outSlot, sp<Fence>* outFence, status_t* outDequeueResult,
+            uint32_t width, uint32_t height, PixelFormat format,
+            uint32_t usage) {
+        Parcel data, reply;
+        *outDequeueResult = INVALID_OPERATION;
+
+        data.writeInterfaceToken(IGraphicBufferProducer::getInterfaceDescriptor());
+        data.writeInt32(buf);
+        data.write(input);
+        data.writeUint32(width);
+        data.writeUint32(height);
+        data.writeInt32(static_cast<int32_t>(format));
+        data.writeUint32(usage);
+
+        status_t result = remote()->transact(QUEUE_AND_DEQUEUE_BUFFER, data,
+                &reply);
+        if (result != NO_ERROR) {
+            return result;
+        }
+
+        result = reply.read(*output);
+        if (result != NO_ERROR) {
+            return result;
+        }
+        status_t queueResult = reply.readInt32();
+
+        *outSlot = reply.readInt32();
+        *outFence = new Fence();
+        result = reply.read(**outFence);
+        if (result != NO_ERROR) {
+            outFence->clear();
+            return queueResult;
+        }
+        *outDequeueResult = reply.readInt32();
+        if (*outDequeueResult >= 0 &&
+                (*outSlot < 0 || *outSlot >= BufferQueueDefs::NUM_BUFFER_SLOTS)) {
+            ALOGE("queueAndDequeueBuffer returned invalid slot %d", *outSlot);
+            *outDequeueResult = UNKNOWN_ERROR;
+        }
+        return queueResult;
+    }
+
     virtual status_t cancelBuffer(int buf, const sp<Fence>& fence) {
         Parcel data, reply;
         data.writeInterfaceToken(IGraphicBufferProducer::getInterfaceDescriptor());
@@ -475,6 +535,30 @@ public:
         }
     }
 
+    virtual status_t getFrameEventBlock(int* outFd) {
+        if (outFd == nullptr) {
+            return BAD_VALUE;
+        }
+        Parcel data, reply;
+        data.writeInterfaceToken(IGraphicBufferProducer::getInterfaceDescriptor());
+        status_t result = remote()->transact(GET_FRAME_EVENT_BLOCK, data,
+                &reply);
+        if (result != NO_ERROR) {
+            ALOGE("getFrameEventBlock failed to transact: %d", result);
+            return result;
+        }
+        result = reply.readInt32();
+        if (result != NO_ERROR) {
+            return result;
+        }
+        *outFd = fcntl(reply.readFileDescriptor(), F_DUPFD_CLOEXEC, 0);
+        if (*outFd < 0) {
+            ALOGE("getFrameEventBlock failed to dup fd: %s", strerror(errno));
+            return -errno;
+        }
+        return NO_ERROR;
+    }
+
     virtual status_t getUniqueId(uint64_t* outId) const {
         Parcel data, reply;
         data.writeInterfaceToken(IGraphicBufferProducer::getInterfaceDescriptor());
@@ -493,12 +577,53 @@ public:
         }
         return actualResult;
     }
+
+private:
+    status_t transactAttachBuffer(int* slot, const sp<GraphicBuffer>& buffer, int32_t method,
+            bool* outFound) {
+        Parcel data, reply;
+        data.writeInterfaceToken(IGraphicBufferProducer::getInterfaceDescriptor());
+        data.writeInt32(method);
+        if (method == ATTACH_BY_REFERENCE) {
+            gui::GraphicBufferCache::Reference::from(*buffer).writeToParcel(&data);
+        } else {
+            data.write(*buffer.get());
+        }
+        status_t result = remote()->transact(ATTACH_BUFFER, data, &reply);
+        if (result != NO_ERROR) {
+            return result;
+        }
+
+        *outFound = reply.readInt32();
+        if (!*outFound) {
+            return NAME_NOT_FOUND;
+        }
+        *slot = reply.readInt32();
+        result = reply.readInt32();
+        if (result == NO_ERROR &&
+                (*slot < 0 || *slot >= BufferQueueDefs::NUM_BUFFER_SLOTS)) {
+            ALOGE("attachBuffer returned invalid slot %d", *slot);
+            android_errorWriteLog(0x534e4554, "37478824");
+            return UNKNOWN_ERROR;
+        }
+
+        return result;
+    }
+
+    // the buffers exchanged with the consumer side, see attachBuffer()
+    gui::GraphicBufferCache mBufferCache;
 };
 
 // Out-of-line virtual method definition to trigger vtable emission in this
 // translation unit (see clang warning -Wweak-vtables)
 BpGraphicBufferProducer::~BpGraphicBufferProducer() {}
 
+BnGraphicBufferProducer::BnGraphicBufferProducer()
+    : mBufferCache(new gui::GraphicBufferCache) {
+}
+
+BnGraphicBufferProducer::~BnGraphicBufferProducer() {}
+
 class HpGraphicBufferProducer : public HpInterface<
         BpGraphicBufferProducer, H2BGraphicBufferProducer> {
 public:
@@ -544,6 +669,17 @@ public:
         return mBase->queueBuffer(slot, input, output);
     }
 
+    status_t queueAndDequeueBuffer(
+            int slot,
+            const QueueBufferInput& input,
+            QueueBufferOutput* output,
+            int* outSlot, sp<Fence>* outFence, status_t* outDequeueResult,
+            uint32_t w, uint32_t h,
+            PixelFormat format, uint32_t usage) override {
+        return mBase->queueAndDequeueBuffer(slot, input, output, outSlot,
+                outFence, outDequeueResult, w, h, format, usage);
+    }
+
     status_t cancelBuffer(int slot, const sp<Fence>& fence) override {
         return mBase->cancelBuffer(slot, fence);
     }
@@ -609,6 +745,10 @@ public:
         return mBase->getFrameTimestamps(outDelta);
     }
 
+    status_t getFrameEventBlock(int* outFd) override {
+        return mBase->getFrameEventBlock(outFd);
+    }
+
     status_t getUniqueId(uint64_t* outId) const override {
         return mBase->getUniqueId(outId);
     }
@@ -619,6 +759,21 @@ IMPLEMENT_HYBRID_META_INTERFACE(GraphicBufferProducer, HGraphicBufferProducer,
 
 // ----------------------------------------------------------------------
 
+status_t IGraphicBufferProducer::queueAndDequeueBuffer(int slot,
+        const QueueBufferInput& input, QueueBufferOutput* output,
+        int* outSlot, sp<Fence>* outFence, status_t* outDequeueResult,
+        uint32_t /*w*/, uint32_t /*h*/, PixelFormat /*format*/,
+        uint32_t /*usage*/) {
+    // Producers that can't dequeue without blocking only queue here, the
+    // caller falls back to dequeueBuffer.
+    *outSlot = -1;
+    *outFence = Fence::NO_FENCE;
+    *outDequeueResult = INVALID_OPERATION;
+    return queueBuffer(slot, input, output);
+}
+
+// ----------------------------------------------------------------------
+
 status_t BnGraphicBufferProducer::onTransact(
     uint32_t code, const Parcel& data, Parcel* reply, uint32_t flags)
 {
@@ -631,6 +786,7 @@ status_t BnGraphicBufferProducer::onTransact(
             reply->writeInt32(buffer != 0);
             if (buffer != 0) {
                 reply->write(*buffer);
+                mBufferCache->add(buffer);
             }
             reply->writeInt32(result);
             return NO_ERROR;
@@ -688,6 +844,7 @@ status_t BnGraphicBufferProducer::onTransact(
                 reply->writeInt32(buffer != NULL);
                 if (buffer != NULL) {
                     reply->write(*buffer);
+                    mBufferCache->add(buffer);
                 }
                 reply->writeInt32(fence != NULL);
                 if (fence != NULL) {
@@ -698,8 +855,27 @@ status_t BnGraphicBufferProducer::onTransact(
         }
         case ATTACH_BUFFER: {
             CHECK_INTERFACE(IGraphicBufferProducer, data, reply);
-            sp<GraphicBuffer> buffer = new GraphicBuffer();
-            status_t result = data.read(*buffer.get());
+            sp<GraphicBuffer> buffer;
+            status_t result;
+            if (data.readInt32() == ATTACH_BY_REFERENCE) {
+                gui::GraphicBufferCache::Reference reference;
+                result = reference.readFromParcel(&data);
+                if (result == NO_ERROR) {
+                    buffer = mBufferCache->find(reference);
+                }
+                if (buffer == nullptr) {
+                    // Tells the caller to send the whole buffer
+                    reply->writeInt32(false);
+                    return NO_ERROR;
+                }
+            } else {
+                buffer = new GraphicBuffer();
+                result = data.read(*buffer.get());
+                if (result == NO_ERROR) {
+                    mBufferCache->add(buffer);
+                }
+            }
+            reply->writeInt32(true);
             int slot = 0;
             if (result == NO_ERROR) {
                 result = attachBuffer(&slot, buffer);
@@ -720,6 +896,31 @@ status_t BnGraphicBufferProducer::onTransact(
 
             return NO_ERROR;
         }
+        case QUEUE_AND_DEQUEUE_BUFFER: {
+            CHECK_INTERFACE(IGraphicBufferProducer, data, reply);
+
+            int buf = data.readInt32();
+            QueueBufferInput input(data);
+            uint32_t width = data.readUint32();
+            uint32_t height = data.readUint32();
+            PixelFormat format = static_cast<PixelFormat>(data.readInt32());
+            uint32_t usage = data.readUint32();
+
+            QueueBufferOutput output;
+            int slot = -1;
+            sp<Fence> fence = Fence::NO_FENCE;
+            status_t dequeueResult = INVALID_OPERATION;
+            status_t result = queueAndDequeueBuffer(buf, input, &output,
+                    &slot, &fence, &dequeueResult, width, height, format,
+                    usage);
+            reply->write(output);
+            reply->writeInt32(result);
+            reply->writeInt32(slot);
+            reply->write(fence != NULL ? *fence : *Fence::NO_FENCE);
+            reply->writeInt32(dequeueResult);
+
+            return NO_ERROR;
+        }
         case CANCEL_BUFFER: {
             CHECK_INTERFACE(IGraphicBufferProducer, data, reply);
             int buf = data.readInt32();
@@ -863,6 +1064,16 @@ status_t BnGraphicBufferProducer::onTransact(
             }
             return NO_ERROR;
         }
+        case GET_FRAME_EVENT_BLOCK: {
+            CHECK_INTERFACE(IGraphicBufferProducer, data, reply);
+            int fd = -1;
+            status_t result = getFrameEventBlock(&fd);
+            reply->writeInt32(result);
+            if (result == NO_ERROR) {
+                reply->writeFileDescriptor(fd, true /* takeOwnership */);
+            }
+            return NO_ERROR;
+        }
         case GET_UNIQUE_ID: {
             CHECK_INTERFACE(IGraphicBufferProducer, data, reply);
             uint64_t outId = 0;
@@ -17,7 +17,10 @@
 // tag as surfaceflinger
 #define LOG_TAG "SurfaceFlinger"
 
+#include <errno.h>
+#include <fcntl.h>
 #include <stdint.h>
+#include <string.h>
 #include <sys/types.h>
 
 #include <binder/Parcel.h>
@@ -35,6 +38,8 @@
 
 #include <ui/DisplayInfo.h>
 #include <ui/DisplayStatInfo.h>
+#include <ui/Fence.h>
+#include <ui/GraphicBuffer.h>
 #include <ui/HdrCapabilities.h>
 
 #include <utils/Log.h>
@@ -122,6 +127,64 @@ public:
         return reply.readInt32();
     }
 
+    virtual status_t captureScreenToBuffer(const sp<IBinder>& display,
+            Rect sourceCrop, uint32_t reqWidth, uint32_t reqHeight,
+            int32_t minLayerZ, int32_t maxLayerZ,
+            bool useIdentityTransform,
+            ISurfaceComposer::Rotation rotation,
+            sp<GraphicBuffer>* outBuffer, sp<Fence>* outFence)
+    {
+        if (outBuffer == nullptr || outFence == nullptr) {
+            return BAD_VALUE;
+        }
+        Parcel data, reply;
+        data.writeInterfaceToken(ISurfaceComposer::getInterfaceDescriptor());
+        data.writeStrongBinder(display);
+        data.write(sourceCrop);
+        data.writeUint32(reqWidth);
+        data.writeUint32(reqHeight);
+        data.writeInt32(minLayerZ);
+        data.writeInt32(maxLayerZ);
+        data.writeInt32(static_cast<int32_t>(useIdentityTransform));
+        data.writeInt32(static_cast<int32_t>(rotation));
+        status_t result = remote()->transact(
+                BnSurfaceComposer::CAPTURE_SCREEN_TO_BUFFER, data, &reply);
+        if (result != NO_ERROR) {
+            ALOGE("captureScreenToBuffer failed to transact: %d", result);
+            return result;
+        }
+        result = reply.readInt32();
+        if (result != NO_ERROR) {
+            return result;
+        }
+        sp<GraphicBuffer> buffer = new GraphicBuffer();
+        result = reply.read(*buffer);
+        if (result != NO_ERROR) {
+            ALOGE("captureScreenToBuffer failed to read buffer: %d", result);
+            return result;
+        }
+        sp<Fence> fence = new Fence();
+        result = reply.read(*fence);
+        if (result != NO_ERROR) {
+            ALOGE("captureScreenToBuffer failed to read fence: %d", result);
+            return result;
+        }
+        *outBuffer = buffer;
+        *outFence = fence;
+        return NO_ERROR;
+    }
+
+    virtual void releaseCaptureBuffer(uint64_t bufferId,
+            const sp<Fence>& releaseFence)
+    {
+        Parcel data, reply;
+        data.writeInterfaceToken(ISurfaceComposer::getInterfaceDescriptor());
+        data.writeUint64(bufferId);
+        data.write(releaseFence != nullptr ? *releaseFence : *Fence::NO_FENCE);
+        remote()->transact(BnSurfaceComposer::RELEASE_CAPTURE_BUFFER, data,
+                &reply, IBinder::FLAG_ONEWAY);
+    }
+
     virtual bool authenticateSurfaceTexture(
             const sp<IGraphicBufferProducer>& bufferProducer) const
     {
@@ -469,6 +532,80 @@ public:
         return result;
     }
 
+    virtual status_t getFrameTimeline(int* outFd) {
+        if (outFd == nullptr) {
+            return BAD_VALUE;
+        }
+        Parcel data, reply;
+        status_t result = data.writeInterfaceToken(ISurfaceComposer::getInterfaceDescriptor());
+        if (result != NO_ERROR) {
+            ALOGE("getFrameTimeline failed to writeInterfaceToken: %d", result);
+            return result;
+        }
+        result = remote()->transact(BnSurfaceComposer::GET_FRAME_TIMELINE, data, &reply);
+        if (result != NO_ERROR) {
+            ALOGE("getFrameTimeline failed to transact: %d", result);
+            return result;
+        }
+        result = reply.readInt32();
+        if (result != NO_ERROR) {
+            return result;
+        }
+        *outFd = fcntl(reply.readFileDescriptor(), F_DUPFD_CLOEXEC, 0);
+        if (*outFd < 0) {
+            ALOGE("getFrameTimeline failed to dup fd: %s", strerror(errno));
+            return -errno;
+        }
+        return NO_ERROR;
+    }
+
+    virtual status_t getLayerPropertyBlock(
+            const sp<ISurfaceComposerClient>& client,
+            const sp<IBinder>& handle, int* outFd) {
+        if (outFd == nullptr) {
+            return BAD_VALUE;
+        }
+        Parcel data, reply;
+        status_t result = data.writeInterfaceToken(ISurfaceComposer::getInterfaceDescriptor());
+        if (result != NO_ERROR) {
+            ALOGE("getLayerPropertyBlock failed to writeInterfaceToken: %d", result);
+            return result;
+        }
+        result = data.writeStrongBinder(IInterface::asBinder(client));
+        if (result != NO_ERROR) {
+            ALOGE("getLayerPropertyBlock failed to write client: %d", result);
+            return result;
+        }
+        result = data.writeStrongBinder(handle);
+        if (result != NO_ERROR) {
+            ALOGE("getLayerPropertyBlock failed to write handle: %d", result);
+            return result;
+        }
+        result = remote()->transact(BnSurfaceComposer::GET_LAYER_PROPERTY_BLOCK,
+                data, &reply);
+        if (result != NO_ERROR) {
+            ALOGE("getLayerPropertyBlock failed to transact: %d", result);
+            return result;
+        }
+        result = reply.readInt32();
+        if (result != NO_ERROR) {
+            return result;
+        }
+        *outFd = fcntl(reply.readFileDescriptor(), F_DUPFD_CLOEXEC, 0);
+        if (*outFd < 0) {
+            ALOGE("getLayerPropertyBlock failed to dup fd: %s", strerror(errno));
+            return -errno;
+        }
+        return NO_ERROR;
+    }
+
+    virtual void signalLayerPropertyBlocks() {
+        Parcel data, reply;
+        data.writeInterfaceToken(ISurfaceComposer::getInterfaceDescriptor());
+        remote()->transact(BnSurfaceComposer::SIGNAL_LAYER_PROPERTY_BLOCKS,
+                data, &reply, IBinder::FLAG_ONEWAY);
+    }
+
 };
 
 // Out-of-line virtual method definition to trigger vtable emission in this
@@ -558,6 +695,44 @@ status_t BnSurfaceComposer::onTransact(
             reply->writeInt32(res);
             return NO_ERROR;
         }
+        case CAPTURE_SCREEN_TO_BUFFER: {
+            CHECK_INTERFACE(ISurfaceComposer, data, reply);
+            sp<IBinder> display = data.readStrongBinder();
+            Rect sourceCrop(Rect::EMPTY_RECT);
+            data.read(sourceCrop);
+            uint32_t reqWidth = data.readUint32();
+            uint32_t reqHeight = data.readUint32();
+            int32_t minLayerZ = data.readInt32();
+            int32_t maxLayerZ = data.readInt32();
+            bool useIdentityTransform = static_cast<bool>(data.readInt32());
+            int32_t rotation = data.readInt32();
+
+            sp<GraphicBuffer> buffer;
+            sp<Fence> fence;
+            status_t res = captureScreenToBuffer(display,
+                    sourceCrop, reqWidth, reqHeight, minLayerZ, maxLayerZ,
+                    useIdentityTransform,
+                    static_cast<ISurfaceComposer::Rotation>(rotation),
+                    &buffer, &fence);
+            reply->writeInt32(res);
+            if (res == NO_ERROR) {
+                reply->write(*buffer);
+                reply->write(*fence);
+            }
+            return NO_ERROR;
+        }
+        case RELEASE_CAPTURE_BUFFER: {
+            CHECK_INTERFACE(ISurfaceComposer, data, reply);
+            uint64_t bufferId = data.readUint64();
+            sp<Fence> releaseFence = new Fence();
+            status_t res = data.read(*releaseFence);
+            if (res != NO_ERROR) {
+                ALOGE("releaseCaptureBuffer: failed to read fence: %d", res);
+                return res;
+            }
+            releaseCaptureBuffer(bufferId, releaseFence);
+            return NO_ERROR;
+        }
         case AUTHENTICATE_SURFACE: {
             CHECK_INTERFACE(ISurfaceComposer, data, reply);
             sp<IGraphicBufferProducer> bufferProducer =
@@ -763,6 +938,34 @@ status_t BnSurfaceComposer::onTransact(
             }
             return injectVSync(when);
         }
+        case GET_FRAME_TIMELINE: {
+            CHECK_INTERFACE(ISurfaceComposer, data, reply);
+            int fd = -1;
+            status_t result = getFrameTimeline(&fd);
+            reply->writeInt32(result);
+            if (result == NO_ERROR) {
+                reply->writeFileDescriptor(fd, true /* takeOwnership */);
+            }
+            return NO_ERROR;
+        }
+        case GET_LAYER_PROPERTY_BLOCK: {
+            CHECK_INTERFACE(ISurfaceComposer, data, reply);
+            sp<ISurfaceComposerClient> client =
+                    interface_cast<ISurfaceComposerClient>(data.readStrongBinder());
+            sp<IBinder> handle = data.readStrongBinder();
+            int fd = -1;
+            status_t result = getLayerPropertyBlock(client, handle, &fd);
+            reply->writeInt32(result);
+            if (result == NO_ERROR) {
+                reply->writeFileDescriptor(fd, true /* takeOwnership */);
+            }
+            return NO_ERROR;
+        }
+        case SIGNAL_LAYER_PROPERTY_BLOCKS: {
+            CHECK_INTERFACE(ISurfaceComposer, data, reply);
+            signalLayerPropertyBlocks();
+            return NO_ERROR;
+        }
         default: {
             return BBinder::onTransact(code, data, reply, flags);
         }
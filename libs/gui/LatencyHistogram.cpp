@@ -0,0 +1,69 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gui/LatencyHistogram.h>
+#include <utils/String8.h>
+
+#include <string.h>
+
+namespace android {
+
+size_t LatencyHistogram::getBucket(nsecs_t latency) {
+    uint64_t us = latency > 0 ? static_cast<uint64_t>(ns2us(latency)) : 0;
+    if (us == 0) {
+        return 0;
+    }
+    const size_t bucket = 64 - __builtin_clzll(us);
+    return bucket < NUM_BUCKETS ? bucket : NUM_BUCKETS - 1;
+}
+
+void LatencyHistogram::add(nsecs_t latency) {
+    mBuckets[getBucket(latency)]++;
+    mCount++;
+    if (latency > mMax) {
+        mMax = latency;
+    }
+}
+
+void LatencyHistogram::clear() {
+    memset(mBuckets, 0, sizeof(mBuckets));
+    mCount = 0;
+    mMax = 0;
+}
+
+nsecs_t LatencyHistogram::getPercentile(uint32_t percentile) const {
+    if (mCount == 0) {
+        return 0;
+    }
+    // Rank of the sample, rounded up so that p100 is the last one
+    const size_t rank = (mCount * percentile + 99) / 100;
+    size_t seen = 0;
+    for (size_t bucket = 0; bucket < NUM_BUCKETS - 1; bucket++) {
+        seen += mBuckets[bucket];
+        if (seen >= rank) {
+            return us2ns(static_cast<nsecs_t>(1) << bucket);
+        }
+    }
+    return mMax;
+}
+
+void LatencyHistogram::dump(const char* name, String8* outResult) const {
+    outResult->appendFormat("%s: count=%zu p50<%.3fms p90<%.3fms p99<%.3fms "
+            "max=%.3fms\n", name, mCount, getPercentile(50) / 1e6,
+            getPercentile(90) / 1e6, getPercentile(99) / 1e6, mMax / 1e6);
+}
+
+} // namespace android
@@ -0,0 +1,199 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "LatestVsyncSlot"
+
+#include <private/gui/LatestVsyncSlot.h>
+
+#include <binder/Parcel.h>
+#include <cutils/ashmem.h>
+#include <log/log.h>
+
+#include <new>
+
+#include <errno.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace android {
+namespace gui {
+
+static constexpr uint32_t MAX_READ_RETRIES = 64;
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2,
+        "LatestVsyncSlot requires lock-free atomics to be shared across processes");
+
+LatestVsyncSlot::~LatestVsyncSlot() {
+    if (mShared != nullptr) {
+        munmap(mShared, sizeof(Shared));
+    }
+}
+
+status_t LatestVsyncSlot::create() {
+    if (mShared != nullptr) {
+        return INVALID_OPERATION;
+    }
+
+    mMemoryFd.reset(ashmem_create_region("DisplayEventReceiver latest vsync", sizeof(Shared)));
+    mEventFd.reset(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+    if (mMemoryFd < 0 || mEventFd < 0) {
+        int error = errno;
+        ALOGE("LatestVsyncSlot::create: can't allocate the slot (%s)", strerror(error));
+        mMemoryFd.reset();
+        mEventFd.reset();
+        return -error;
+    }
+
+    status_t err = map(PROT_READ | PROT_WRITE);
+    if (err != NO_ERROR) {
+        return err;
+    }
+
+    // Any mapping created from now on (i.e. by the readers) is read-only
+    if (ashmem_set_prot_region(mMemoryFd, PROT_READ) < 0) {
+        int error = errno;
+        ALOGE("LatestVsyncSlot::create: ashmem_set_prot_region failed (%s)", strerror(error));
+        munmap(mShared, sizeof(Shared));
+        mShared = nullptr;
+        return -error;
+    }
+
+    Shared* shared = new (mShared) Shared;
+    shared->magic = MAGIC;
+    shared->version = VERSION;
+    shared->sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    return NO_ERROR;
+}
+
+status_t LatestVsyncSlot::map(int prot) {
+    void* base = mmap(nullptr, sizeof(Shared), prot, MAP_SHARED, mMemoryFd, 0);
+    if (base == MAP_FAILED) {
+        int error = errno;
+        ALOGE("LatestVsyncSlot: mmap failed (%s)", strerror(error));
+        return -error;
+    }
+    mShared = static_cast<Shared*>(base);
+    return NO_ERROR;
+}
+
+void LatestVsyncSlot::write(const DisplayEventReceiver::LatestVsync& vsync) {
+    if (mShared == nullptr) {
+        return;
+    }
+
+    const uint32_t sequence = mShared->sequence.load(std::memory_order_relaxed);
+    mShared->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    mShared->vsync = vsync;
+    mShared->sequence.store(sequence + 2, std::memory_order_release);
+
+    // Only the count changes if a reader is behind, the eventfd stays readable until it catches up
+    const uint64_t one = 1;
+    if (::write(mEventFd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        ALOGE("LatestVsyncSlot::write: can't signal the eventfd (%s)", strerror(errno));
+    }
+}
+
+bool LatestVsyncSlot::read(DisplayEventReceiver::LatestVsync* outVsync) {
+    if (mShared == nullptr || outVsync == nullptr) {
+        return false;
+    }
+
+    // Clear the eventfd first: a vsync written after this point signals it again, so it is never
+    // lost even if the copy below already sees it
+    uint64_t signaled;
+    (void)::read(mEventFd, &signaled, sizeof(signaled));
+
+    // Bounds the number of times we look at a slot that is being written, so that a writer dying
+    // mid-write can't make readers spin forever.
+    for (uint32_t retries = 0; retries < MAX_READ_RETRIES; retries++) {
+        const uint32_t before = mShared->sequence.load(std::memory_order_acquire);
+        if (before & 1) {
+            continue;
+        }
+        if (before == mLastSequence) {
+            return false;
+        }
+        const DisplayEventReceiver::LatestVsync vsync = mShared->vsync;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (mShared->sequence.load(std::memory_order_relaxed) != before) {
+            continue;
+        }
+        *outVsync = vsync;
+        mLastSequence = before;
+        return true;
+    }
+    return false;
+}
+
+status_t LatestVsyncSlot::duplicate(LatestVsyncSlot* outSlot) const {
+    if (mShared == nullptr) {
+        return NO_INIT;
+    }
+    outSlot->mMemoryFd.reset(dup(mMemoryFd));
+    outSlot->mEventFd.reset(dup(mEventFd));
+    if (outSlot->mMemoryFd < 0 || outSlot->mEventFd < 0) {
+        int error = errno;
+        outSlot->mMemoryFd.reset();
+        outSlot->mEventFd.reset();
+        return -error;
+    }
+    return NO_ERROR;
+}
+
+status_t LatestVsyncSlot::writeToParcel(Parcel* parcel) const {
+    if (mMemoryFd < 0 || mEventFd < 0) return -EINVAL;
+
+    status_t result = parcel->writeDupFileDescriptor(mMemoryFd);
+    if (result != NO_ERROR) return result;
+    return parcel->writeDupFileDescriptor(mEventFd);
+}
+
+status_t LatestVsyncSlot::readFromParcel(const Parcel* parcel) {
+    mMemoryFd.reset(dup(parcel->readFileDescriptor()));
+    mEventFd.reset(dup(parcel->readFileDescriptor()));
+    if (mMemoryFd < 0 || mEventFd < 0) {
+        int error = errno;
+        ALOGE("LatestVsyncSlot::readFromParcel: can't dup file descriptors (%s)",
+                strerror(error));
+        mMemoryFd.reset();
+        mEventFd.reset();
+        return -error;
+    }
+
+    if (ashmem_get_size_region(mMemoryFd) < static_cast<int>(sizeof(Shared))) {
+        ALOGE("LatestVsyncSlot::readFromParcel: invalid region size");
+        return BAD_VALUE;
+    }
+    status_t err = map(PROT_READ);
+    if (err != NO_ERROR) {
+        return err;
+    }
+    if (mShared->magic != MAGIC || mShared->version != VERSION) {
+        ALOGE("LatestVsyncSlot::readFromParcel: unsupported slot layout");
+        munmap(mShared, sizeof(Shared));
+        mShared = nullptr;
+        return BAD_VALUE;
+    }
+    mLastSequence = 0;
+    return NO_ERROR;
+}
+
+} // namespace gui
+} // namespace android
@@ -0,0 +1,193 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "LayerPropertyBlock"
+
+#include <gui/LayerPropertyBlock.h>
+
+#include <cutils/ashmem.h>
+#include <log/log.h>
+
+#include <new>
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace android {
+
+static constexpr uint32_t MAX_READ_RETRIES = 64;
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2,
+        "LayerPropertyBlock requires lock-free atomics to be shared across processes");
+
+// ----------------------------------------------------------------------------
+// LayerPropertyWriter
+// ----------------------------------------------------------------------------
+
+LayerPropertyWriter::LayerPropertyWriter(int fd)
+  : mFd(fd),
+    mShared(nullptr)
+{
+    if (mFd < 0) {
+        return;
+    }
+
+    const size_t size = LayerPropertyBlock::getRegionSize();
+    if (ashmem_get_size_region(mFd) < static_cast<int>(size)) {
+        ALOGE("LayerPropertyWriter: invalid region size");
+        return;
+    }
+
+    void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, 0);
+    if (base == MAP_FAILED) {
+        ALOGE("LayerPropertyWriter: mmap failed: %s", strerror(errno));
+        return;
+    }
+
+    LayerPropertyBlock::Shared* shared = static_cast<LayerPropertyBlock::Shared*>(base);
+    if (shared->magic != LayerPropertyBlock::MAGIC ||
+            shared->version != LayerPropertyBlock::VERSION) {
+        ALOGE("LayerPropertyWriter: unsupported block layout");
+        munmap(base, size);
+        return;
+    }
+
+    mShared = shared;
+}
+
+LayerPropertyWriter::~LayerPropertyWriter() {
+    if (mShared != nullptr) {
+        munmap(mShared, LayerPropertyBlock::getRegionSize());
+    }
+    if (mFd >= 0) {
+        close(mFd);
+    }
+}
+
+bool LayerPropertyWriter::write(const LayerProperties& properties) {
+    if (mShared == nullptr) {
+        return false;
+    }
+
+    const uint32_t sequence = mShared->sequence.load(std::memory_order_relaxed) & ~1u;
+    mShared->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    mShared->properties = properties;
+    mShared->sequence.store(sequence + 2, std::memory_order_release);
+
+    // Pairs with the fence in LayerPropertyReader::read(): either the reader
+    // sees the new sequence after disarming, or we see it disarmed.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return mShared->armed.load(std::memory_order_relaxed) == 0;
+}
+
+// ----------------------------------------------------------------------------
+// LayerPropertyReader
+// ----------------------------------------------------------------------------
+
+LayerPropertyReader::LayerPropertyReader()
+  : mFd(-1),
+    mShared(nullptr),
+    mLastSequence(0)
+{
+    const size_t size = LayerPropertyBlock::getRegionSize();
+    mFd = ashmem_create_region("SurfaceFlinger layer properties", size);
+    if (mFd < 0) {
+        ALOGE("LayerPropertyReader: ashmem_create_region failed: %s",
+                strerror(errno));
+        return;
+    }
+
+    void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, 0);
+    if (base == MAP_FAILED) {
+        ALOGE("LayerPropertyReader: mmap failed: %s", strerror(errno));
+        close(mFd);
+        mFd = -1;
+        return;
+    }
+
+    LayerPropertyBlock::Shared* shared = new (base) LayerPropertyBlock::Shared;
+    shared->magic = LayerPropertyBlock::MAGIC;
+    shared->version = LayerPropertyBlock::VERSION;
+    shared->sequence.store(0, std::memory_order_relaxed);
+    shared->armed.store(0, std::memory_order_relaxed);
+    shared->properties = LayerProperties();
+    std::atomic_thread_fence(std::memory_order_release);
+
+    mShared = shared;
+}
+
+LayerPropertyReader::~LayerPropertyReader() {
+    if (mShared != nullptr) {
+        munmap(mShared, LayerPropertyBlock::getRegionSize());
+    }
+    if (mFd >= 0) {
+        close(mFd);
+    }
+}
+
+bool LayerPropertyReader::read(LayerProperties* outProperties) {
+    if (mShared == nullptr || outProperties == nullptr) {
+        return false;
+    }
+
+    if (readSequenced(outProperties)) {
+        mShared->armed.store(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    if (mShared->armed.load(std::memory_order_relaxed) == 0) {
+        return false;
+    }
+
+    // Nothing new this frame, stop polling. The client may have written
+    // right before seeing the flag cleared, look one last time.
+    mShared->armed.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (readSequenced(outProperties)) {
+        mShared->armed.store(1, std::memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+bool LayerPropertyReader::readSequenced(LayerProperties* outProperties) {
+    // Bounds the number of times we look at a block that is being written,
+    // so that a client dying mid-write can't make us spin forever.
+    for (uint32_t retries = 0; retries < MAX_READ_RETRIES; retries++) {
+        const uint32_t before = mShared->sequence.load(std::memory_order_acquire);
+        if (before == mLastSequence) {
+            return false;
+        }
+        if (before & 1) {
+            continue;
+        }
+        const LayerProperties properties = mShared->properties;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        const uint32_t after = mShared->sequence.load(std::memory_order_relaxed);
+        if (before != after) {
+            continue;
+        }
+        mLastSequence = before;
+        *outProperties = properties;
+        return true;
+    }
+    return false;
+}
+
+}; // namespace android
@@ -107,6 +107,7 @@ void OccupancyTracker::recordPendingSegment() {
         }
         mSegmentHistory.push_front({mPendingSegment.totalTime,
                 mPendingSegment.numFrames, occupancyAverage, usedThirdBuffer});
+        mShallowSegmentCount = usedThirdBuffer ? 0 : mShallowSegmentCount + 1;
         if (mSegmentHistory.size() > MAX_HISTORY_SIZE) {
             mSegmentHistory.pop_back();
         }
@@ -56,13 +56,13 @@ status_t StreamSplitter::createSplitter(
 
 StreamSplitter::StreamSplitter(const sp<IGraphicBufferConsumer>& inputQueue)
       : mIsAbandoned(false), mMutex(), mReleaseCondition(),
-        mOutstandingBuffers(0), mInput(inputQueue), mOutputs(), mBuffers() {}
+        mInput(inputQueue), mOutputs(), mBuffers() {}
 
 StreamSplitter::~StreamSplitter() {
     mInput->consumerDisconnect();
-    Vector<sp<IGraphicBufferProducer> >::iterator output = mOutputs.begin();
+    Vector<Output>::iterator output = mOutputs.begin();
     for (; output != mOutputs.end(); ++output) {
-        (*output)->disconnect(NATIVE_WINDOW_API_CPU);
+        output->producer->disconnect(NATIVE_WINDOW_API_CPU);
     }
 
     if (mBuffers.size() > 0) {
@@ -79,6 +79,11 @@ status_t StreamSplitter::addOutput(
 
     Mutex::Autolock lock(mMutex);
 
+    if (mOutputs.size() >= MAX_OUTPUTS) {
+        ALOGE("addOutput: too many outputs (max %zu)", MAX_OUTPUTS);
+        return BAD_VALUE;
+    }
+
     IGraphicBufferProducer::QueueBufferOutput queueBufferOutput;
     sp<OutputListener> listener(new OutputListener(this, outputQueue));
     IInterface::asBinder(outputQueue)->linkToDeath(listener);
@@ -89,7 +94,7 @@ status_t StreamSplitter::addOutput(
         return status;
     }
 
-    mOutputs.push_back(outputQueue);
+    mOutputs.push_back({outputQueue, 0});
 
     return NO_ERROR;
 }
@@ -101,44 +106,73 @@ void StreamSplitter::setName(const String8 &name) {
 
 void StreamSplitter::onFrameAvailable(const BufferItem& /* item */) {
     ATRACE_CALL();
-    Mutex::Autolock lock(mMutex);
 
-    // The current policy is that if any one consumer is consuming buffers too
-    // slowly, the splitter will stall the rest of the outputs by not acquiring
-    // any more buffers from the input. This will cause back pressure on the
-    // input queue, slowing down its producer.
-
-    // If there are too many outstanding buffers, we block until a buffer is
-    // released back to the input in onBufferReleased
-    while (mOutstandingBuffers >= MAX_OUTSTANDING_BUFFERS) {
-        mReleaseCondition.wait(mMutex);
-
-        // If the splitter is abandoned while we are waiting, the release
-        // condition variable will be broadcast, and we should just return
-        // without attempting to do anything more (since the input queue will
-        // also be abandoned).
-        if (mIsAbandoned) {
-            return;
-        }
-    }
-    ++mOutstandingBuffers;
-
-    // Acquire and detach the buffer from the input
     BufferItem bufferItem;
-    status_t status = mInput->acquireBuffer(&bufferItem, /* presentWhen */ 0);
-    LOG_ALWAYS_FATAL_IF(status != NO_ERROR,
-            "acquiring buffer from input failed (%d)", status);
+    Vector<size_t> targets;
+    Vector<sp<IGraphicBufferProducer> > producers;
+    { // Autolock scope
+        Mutex::Autolock lock(mMutex);
+
+        // The current policy is that if the outputs are consuming buffers too
+        // slowly, the splitter will stall them by not acquiring any more
+        // buffers from the input. This will cause back pressure on the input
+        // queue, slowing down its producer. Outputs lagging behind the others
+        // don't count, they skip frames instead.
+
+        // If there are too many outstanding buffers, we block until a buffer
+        // is released in onBufferReleasedByOutput
+        while (getBlockingBufferCountLocked() >= MAX_OUTSTANDING_BUFFERS) {
+            mReleaseCondition.wait(mMutex);
+
+            // If the splitter is abandoned while we are waiting, the release
+            // condition variable will be broadcast, and we should just return
+            // without attempting to do anything more (since the input queue
+            // will also be abandoned).
+            if (mIsAbandoned) {
+                return;
+            }
+        }
 
-    ALOGV("acquired buffer %#" PRIx64 " from input",
-            bufferItem.mGraphicBuffer->getId());
+        // Acquire and detach the buffer from the input
+        status_t status = mInput->acquireBuffer(&bufferItem,
+                /* presentWhen */ 0);
+        LOG_ALWAYS_FATAL_IF(status != NO_ERROR,
+                "acquiring buffer from input failed (%d)", status);
 
-    status = mInput->detachBuffer(bufferItem.mSlot);
-    LOG_ALWAYS_FATAL_IF(status != NO_ERROR,
-            "detaching buffer from input failed (%d)", status);
+        ALOGV("acquired buffer %#" PRIx64 " from input",
+                bufferItem.mGraphicBuffer->getId());
 
-    // Initialize our reference count for this buffer
-    mBuffers.add(bufferItem.mGraphicBuffer->getId(),
-            new BufferTracker(bufferItem.mGraphicBuffer));
+        status = mInput->detachBuffer(bufferItem.mSlot);
+        LOG_ALWAYS_FATAL_IF(status != NO_ERROR,
+                "detaching buffer from input failed (%d)", status);
+
+        // Initialize our tracking for this buffer, with every output that
+        // will get it as a holder
+        sp<BufferTracker> tracker(new BufferTracker(bufferItem.mGraphicBuffer));
+        for (size_t i = 0; i < mOutputs.size(); i++) {
+            Output& output = mOutputs.editItemAt(i);
+            if (output.lag >= MAX_OUTPUT_LAG) {
+                ALOGV("output %p is lagging, skipping buffer %#" PRIx64,
+                        output.producer.get(),
+                        bufferItem.mGraphicBuffer->getId());
+                continue;
+            }
+            tracker->addHolderLocked(i);
+            output.lag++;
+            targets.push_back(i);
+            producers.push_back(output.producer);
+        }
+        mBuffers.add(bufferItem.mGraphicBuffer->getId(), tracker);
+
+        if (targets.isEmpty()) {
+            // Every output is lagging, this frame is dropped. The producer
+            // still has to wait for its own rendering to complete.
+            tracker->addFence(bufferItem.mFence);
+            releaseFromOutputLocked(MAX_OUTPUTS,
+                    bufferItem.mGraphicBuffer->getId(), Fence::NO_FENCE);
+            return;
+        }
+    } // Autolock scope
 
     IGraphicBufferProducer::QueueBufferInput queueInput(
             bufferItem.mTimestamp, bufferItem.mIsAutoTimestamp,
@@ -146,52 +180,48 @@ void StreamSplitter::onFrameAvailable(const BufferItem& /* item */) {
             static_cast<int32_t>(bufferItem.mScalingMode),
             bufferItem.mTransform, bufferItem.mFence);
 
-    // Attach and queue the buffer to each of the outputs
-    Vector<sp<IGraphicBufferProducer> >::iterator output = mOutputs.begin();
-    for (; output != mOutputs.end(); ++output) {
+    // Attach and queue the buffer to each of the outputs. This is done
+    // without mMutex held: the outputs can release buffers, to the input or
+    // to each other, while a slow output is attaching or queueing.
+    for (size_t i = 0; i < targets.size(); i++) {
+        const sp<IGraphicBufferProducer>& output = producers[i];
         int slot;
-        status = (*output)->attachBuffer(&slot, bufferItem.mGraphicBuffer);
-        if (status == NO_INIT) {
-            // If we just discovered that this output has been abandoned, note
-            // that, increment the release count so that we still release this
-            // buffer eventually, and move on to the next output
-            onAbandonedLocked();
-            mBuffers.editValueFor(bufferItem.mGraphicBuffer->getId())->
-                    incrementReleaseCountLocked();
-            continue;
-        } else {
-            LOG_ALWAYS_FATAL_IF(status != NO_ERROR,
-                    "attaching buffer to output failed (%d)", status);
+        status_t status = output->attachBuffer(&slot,
+                bufferItem.mGraphicBuffer);
+        if (status == NO_ERROR) {
+            IGraphicBufferProducer::QueueBufferOutput queueOutput;
+            status = output->queueBuffer(slot, queueInput, &queueOutput);
         }
-
-        IGraphicBufferProducer::QueueBufferOutput queueOutput;
-        status = (*output)->queueBuffer(slot, queueInput, &queueOutput);
         if (status == NO_INIT) {
             // If we just discovered that this output has been abandoned, note
-            // that, increment the release count so that we still release this
-            // buffer eventually, and move on to the next output
+            // that, release the buffer on its behalf so that we still release
+            // this buffer eventually, and move on to the next output
+            Mutex::Autolock lock(mMutex);
             onAbandonedLocked();
-            mBuffers.editValueFor(bufferItem.mGraphicBuffer->getId())->
-                    incrementReleaseCountLocked();
+            releaseFromOutputLocked(targets[i],
+                    bufferItem.mGraphicBuffer->getId(), Fence::NO_FENCE);
             continue;
         } else {
             LOG_ALWAYS_FATAL_IF(status != NO_ERROR,
-                    "queueing buffer to output failed (%d)", status);
+                    "attaching or queueing buffer to output failed (%d)",
+                    status);
         }
 
         ALOGV("queued buffer %#" PRIx64 " to output %p",
-                bufferItem.mGraphicBuffer->getId(), output->get());
+                bufferItem.mGraphicBuffer->getId(), output.get());
     }
 }
 
 void StreamSplitter::onBufferReleasedByOutput(
         const sp<IGraphicBufferProducer>& from) {
     ATRACE_CALL();
-    Mutex::Autolock lock(mMutex);
 
+    // Detach without mMutex held, the other outputs keep going meanwhile
     sp<GraphicBuffer> buffer;
     sp<Fence> fence;
     status_t status = from->detachNextBuffer(&buffer, &fence);
+
+    Mutex::Autolock lock(mMutex);
     if (status == NO_INIT) {
         // If we just discovered that this output has been abandoned, note that,
         // but we can't do anything else, since buffer is invalid
@@ -205,30 +235,54 @@ void StreamSplitter::onBufferReleasedByOutput(
     ALOGV("detached buffer %#" PRIx64 " from output %p",
           buffer->getId(), from.get());
 
-    const sp<BufferTracker>& tracker = mBuffers.editValueFor(buffer->getId());
+    size_t outputIndex = 0;
+    for (; outputIndex < mOutputs.size(); outputIndex++) {
+        if (IInterface::asBinder(mOutputs[outputIndex].producer) ==
+                IInterface::asBinder(from)) {
+            break;
+        }
+    }
+    LOG_ALWAYS_FATAL_IF(outputIndex == mOutputs.size(),
+            "buffer released by an unknown output");
 
-    // Merge the release fence of the incoming buffer so that the fence we send
-    // back to the input includes all of the outputs' fences
-    tracker->mergeFence(fence);
+    releaseFromOutputLocked(outputIndex, buffer->getId(), fence);
+}
+
+void StreamSplitter::releaseFromOutputLocked(size_t outputIndex,
+        uint64_t bufferId, const sp<Fence>& fence) {
+    const ssize_t index = mBuffers.indexOfKey(bufferId);
+    LOG_ALWAYS_FATAL_IF(index < 0, "releasing an untracked buffer %#" PRIx64,
+            bufferId);
+    const sp<BufferTracker> tracker = mBuffers.valueAt(index);
+
+    if (outputIndex < mOutputs.size() &&
+            tracker->removeHolderLocked(outputIndex)) {
+        mOutputs.editItemAt(outputIndex).lag--;
+        // Keep the release fence of the incoming buffer so that the fence we
+        // send back to the input includes all of the outputs' fences
+        tracker->addFence(fence);
+    }
+
+    // Lags changed, a blocked onFrameAvailable may proceed now
+    mReleaseCondition.broadcast();
 
     // Check to see if this is the last outstanding reference to this buffer
-    size_t releaseCount = tracker->incrementReleaseCountLocked();
-    ALOGV("buffer %#" PRIx64 " reference count %zu (of %zu)", buffer->getId(),
-            releaseCount, mOutputs.size());
-    if (releaseCount < mOutputs.size()) {
+    ALOGV("buffer %#" PRIx64 " holders %#x", bufferId,
+            tracker->getHoldersLocked());
+    if (tracker->getHoldersLocked() != 0) {
         return;
     }
 
     // If we've been abandoned, we can't return the buffer to the input, so just
     // stop tracking it and move on
     if (mIsAbandoned) {
-        mBuffers.removeItem(buffer->getId());
+        mBuffers.removeItem(bufferId);
         return;
     }
 
     // Attach and release the buffer back to the input
     int consumerSlot;
-    status = mInput->attachBuffer(&consumerSlot, tracker->getBuffer());
+    status_t status = mInput->attachBuffer(&consumerSlot, tracker->getBuffer());
     LOG_ALWAYS_FATAL_IF(status != NO_ERROR,
             "attaching buffer to input failed (%d)", status);
 
@@ -237,15 +291,28 @@ void StreamSplitter::onBufferReleasedByOutput(
     LOG_ALWAYS_FATAL_IF(status != NO_ERROR,
             "releasing buffer to input failed (%d)", status);
 
-    ALOGV("released buffer %#" PRIx64 " to input", buffer->getId());
+    ALOGV("released buffer %#" PRIx64 " to input", bufferId);
 
     // We no longer need to track the buffer once it has been returned to the
     // input
-    mBuffers.removeItem(buffer->getId());
+    mBuffers.removeItem(bufferId);
+}
+
+size_t StreamSplitter::getBlockingBufferCountLocked() const {
+    uint32_t laggingOutputs = 0;
+    for (size_t i = 0; i < mOutputs.size(); i++) {
+        if (mOutputs[i].lag >= MAX_OUTPUT_LAG) {
+            laggingOutputs |= 1u << i;
+        }
+    }
 
-    // Notify any waiting onFrameAvailable calls
-    --mOutstandingBuffers;
-    mReleaseCondition.signal();
+    size_t count = 0;
+    for (size_t i = 0; i < mBuffers.size(); i++) {
+        if ((mBuffers.valueAt(i)->getHoldersLocked() & ~laggingOutputs) != 0) {
+            count++;
+        }
+    }
+    return count;
 }
 
 void StreamSplitter::onAbandonedLocked() {
@@ -274,12 +341,46 @@ void StreamSplitter::OutputListener::binderDied(const wp<IBinder>& /* who */) {
 }
 
 StreamSplitter::BufferTracker::BufferTracker(const sp<GraphicBuffer>& buffer)
-      : mBuffer(buffer), mMergedFence(Fence::NO_FENCE), mReleaseCount(0) {}
+      : mBuffer(buffer), mFences(), mHolders(0) {}
 
 StreamSplitter::BufferTracker::~BufferTracker() {}
 
-void StreamSplitter::BufferTracker::mergeFence(const sp<Fence>& with) {
-    mMergedFence = Fence::merge(String8("StreamSplitter"), mMergedFence, with);
+bool StreamSplitter::BufferTracker::removeHolderLocked(size_t outputIndex) {
+    const uint32_t bit = 1u << outputIndex;
+    const bool held = (mHolders & bit) != 0;
+    mHolders &= ~bit;
+    return held;
+}
+
+void StreamSplitter::BufferTracker::addFence(const sp<Fence>& fence) {
+    if (fence == NULL || !fence->isValid()) {
+        return;
+    }
+    const nsecs_t signalTime = fence->getSignalTime();
+    if (signalTime != Fence::SIGNAL_TIME_PENDING &&
+            signalTime != Fence::SIGNAL_TIME_INVALID) {
+        return;
+    }
+    mFences.push_back(fence);
+}
+
+sp<Fence> StreamSplitter::BufferTracker::getMergedFence() const {
+    if (mFences.isEmpty()) {
+        return Fence::NO_FENCE;
+    }
+    Vector<sp<Fence> > level(mFences);
+    while (level.size() > 1) {
+        Vector<sp<Fence> > next;
+        for (size_t i = 0; i + 1 < level.size(); i += 2) {
+            next.push_back(Fence::merge("StreamSplitter", level[i],
+                    level[i + 1]));
+        }
+        if (level.size() % 2 != 0) {
+            next.push_back(level[level.size() - 1]);
+        }
+        level = next;
+    }
+    return level[0];
 }
 
 } // namespace android
@@ -32,6 +32,8 @@
 #include <ui/Region.h>
 
 #include <gui/BufferItem.h>
+#include <gui/FrameEventBlock.h>
+#include <gui/IGpuService.h>
 #include <gui/IProducerListener.h>
 
 #include <gui/ISurfaceComposer.h>
@@ -52,6 +54,7 @@ Surface::Surface(
       mAutoRefresh(false),
       mSharedBufferSlot(BufferItem::INVALID_BUFFER_SLOT),
       mSharedBufferHasBeenQueued(false),
+      mPrefetchedSlot(BufferItem::INVALID_BUFFER_SLOT),
       mQueriedSupportedTimestamps(false),
       mFrameTimestampsSupportsPresent(false),
       mEnableFrameTimestamps(false),
@@ -94,6 +97,10 @@ Surface::Surface(
 }
 
 Surface::~Surface() {
+    {
+        Mutex::Autolock lock(mMutex);
+        cancelPrefetchedBufferLocked();
+    }
     if (mConnectedToCpu) {
         Surface::disconnect(NATIVE_WINDOW_API_CPU);
     }
@@ -165,13 +172,36 @@ void Surface::enableFrameTimestamps(bool enable) {
     // If going from disabled to enabled, get the initial values for
     // compositor and display timing.
     if (!mEnableFrameTimestamps && enable) {
-        FrameEventHistoryDelta delta;
-        mGraphicBufferProducer->getFrameTimestamps(&delta);
-        mFrameEventHistory->applyDelta(delta);
+        if (mFrameEventBlock == nullptr) {
+            int fd = -1;
+            if (mGraphicBufferProducer->getFrameEventBlock(&fd) == NO_ERROR) {
+                auto block = std::make_unique<FrameEventBlockReader>(fd);
+                if (block->initCheck() == NO_ERROR) {
+                    mFrameEventBlock = std::move(block);
+                }
+            }
+        }
+        if (mFrameEventBlock != nullptr) {
+            readFrameEventBlockLocked();
+        } else {
+            FrameEventHistoryDelta delta;
+            mGraphicBufferProducer->getFrameTimestamps(&delta);
+            mFrameEventHistory->applyDelta(delta);
+        }
     }
     mEnableFrameTimestamps = enable;
 }
 
+void Surface::readFrameEventBlockLocked() {
+    if (mFrameEventBlock == nullptr) {
+        return;
+    }
+    FrameEventBlockSnapshot snapshot;
+    if (mFrameEventBlock->read(&snapshot)) {
+        mFrameEventHistory->applySnapshot(snapshot);
+    }
+}
+
 status_t Surface::getCompositorTiming(
         nsecs_t* compositeDeadline, nsecs_t* compositeInterval,
         nsecs_t* compositeToPresentLatency) {
@@ -180,6 +210,8 @@ status_t Surface::getCompositorTiming(
         return INVALID_OPERATION;
     }
 
+    readFrameEventBlockLocked();
+
     if (compositeDeadline != nullptr) {
         *compositeDeadline =
                 mFrameEventHistory->getNextCompositeDeadline(now());
@@ -280,6 +312,18 @@ status_t Surface::getFrameTimestamps(uint64_t frameNumber,
     }
 
     // Update our cache of events if the requested events are not available.
+    // Look at the frame event block first, and only ask the consumer for
+    // what it couldn't tell, i.e. fences it hasn't seen signal yet.
+    if (mFrameEventBlock != nullptr && checkConsumerForUpdates(events,
+            mLastFrameNumber, outLatchTime, outFirstRefreshStartTime,
+            outLastRefreshStartTime, outGpuCompositionDoneTime,
+            outDisplayPresentTime, outDequeueReadyTime, outReleaseTime)) {
+        readFrameEventBlockLocked();
+        events = mFrameEventHistory->getFrame(frameNumber);
+        if (events == nullptr) {
+            return NAME_NOT_FOUND;
+        }
+    }
     if (checkConsumerForUpdates(events, mLastFrameNumber,
             outLatchTime, outFirstRefreshStartTime, outLastRefreshStartTime,
             outGpuCompositionDoneTime, outDisplayPresentTime,
@@ -389,7 +433,9 @@ int Surface::hook_cancelBuffer(ANativeWindow* window,
 int Surface::hook_queueBuffer(ANativeWindow* window,
         ANativeWindowBuffer* buffer, int fenceFd) {
     Surface* c = getSelf(window);
-    return c->queueBuffer(buffer, fenceFd);
+    int result = c->queueBuffer(buffer, fenceFd);
+    IGpuService::reportGpuStats();
+    return result;
 }
 
 int Surface::hook_dequeueBuffer_DEPRECATED(ANativeWindow* window,
@@ -428,7 +474,9 @@ int Surface::hook_lockBuffer_DEPRECATED(ANativeWindow* window,
 int Surface::hook_queueBuffer_DEPRECATED(ANativeWindow* window,
         ANativeWindowBuffer* buffer) {
     Surface* c = getSelf(window);
-    return c->queueBuffer(buffer, -1);
+    int result = c->queueBuffer(buffer, -1);
+    IGpuService::reportGpuStats();
+    return result;
 }
 
 int Surface::hook_query(const ANativeWindow* window,
@@ -459,6 +507,10 @@ int Surface::setSwapInterval(int interval) {
         interval = maxSwapInterval;
 
     mSwapIntervalZero = (interval == 0);
+    {
+        Mutex::Autolock lock(mMutex);
+        cancelPrefetchedBufferLocked();
+    }
     mGraphicBufferProducer->setAsyncMode(mSwapIntervalZero);
 
     return NO_ERROR;
@@ -473,6 +525,9 @@ int Surface::dequeueBuffer(android_native_buffer_t** buffer, int* fenceFd) {
     PixelFormat reqFormat;
     uint32_t reqUsage;
     bool enableFrameTimestamps;
+    int prefetchedSlot = BufferItem::INVALID_BUFFER_SLOT;
+    sp<Fence> prefetchedFence;
+    status_t prefetchedResult = NO_ERROR;
 
     {
         Mutex::Autolock lock(mMutex);
@@ -486,7 +541,9 @@ int Surface::dequeueBuffer(android_native_buffer_t** buffer, int* fenceFd) {
         reqFormat = mReqFormat;
         reqUsage = mReqUsage;
 
-        enableFrameTimestamps = mEnableFrameTimestamps;
+        // With a frame event block the timestamps are read from it instead
+        enableFrameTimestamps = mEnableFrameTimestamps &&
+                mFrameEventBlock == nullptr;
 
         if (mSharedBufferMode && mAutoRefresh && mSharedBufferSlot !=
                 BufferItem::INVALID_BUFFER_SLOT) {
@@ -497,6 +554,21 @@ int Surface::dequeueBuffer(android_native_buffer_t** buffer, int* fenceFd) {
                 return OK;
             }
         }
+
+        if (mPrefetchedSlot != BufferItem::INVALID_BUFFER_SLOT) {
+            if (mPrefetchedWidth == reqWidth &&
+                    mPrefetchedHeight == reqHeight &&
+                    mPrefetchedFormat == reqFormat &&
+                    mPrefetchedUsage == reqUsage) {
+                prefetchedSlot = mPrefetchedSlot;
+                prefetchedFence = mPrefetchedFence;
+                prefetchedResult = mPrefetchedResult;
+                mPrefetchedSlot = BufferItem::INVALID_BUFFER_SLOT;
+                mPrefetchedFence.clear();
+            } else {
+                cancelPrefetchedBufferLocked();
+            }
+        }
     } // Drop the lock so that we can still touch the Surface while blocking in IGBP::dequeueBuffer
 
     int buf = -1;
@@ -504,9 +576,18 @@ int Surface::dequeueBuffer(android_native_buffer_t** buffer, int* fenceFd) {
     nsecs_t startTime = systemTime();
 
     FrameEventHistoryDelta frameTimestamps;
-    status_t result = mGraphicBufferProducer->dequeueBuffer(&buf, &fence,
-            reqWidth, reqHeight, reqFormat, reqUsage,
-            enableFrameTimestamps ? &frameTimestamps : nullptr);
+    status_t result;
+    if (prefetchedSlot != BufferItem::INVALID_BUFFER_SLOT) {
+        buf = prefetchedSlot;
+        fence = prefetchedFence;
+        result = prefetchedResult;
+        // The timestamps came back with the queueBuffer that prefetched it
+        enableFrameTimestamps = false;
+    } else {
+        result = mGraphicBufferProducer->dequeueBuffer(&buf, &fence,
+                reqWidth, reqHeight, reqFormat, reqUsage,
+                enableFrameTimestamps ? &frameTimestamps : nullptr);
+    }
     mLastDequeueDuration = systemTime() - startTime;
 
     if (result < 0) {
@@ -605,6 +686,29 @@ int Surface::cancelBuffer(android_native_buffer_t* buffer,
     return OK;
 }
 
+void Surface::cancelPrefetchedBufferLocked() {
+    if (mPrefetchedSlot == BufferItem::INVALID_BUFFER_SLOT) {
+        return;
+    }
+
+    // The flags of the dequeue are only returned once, apply them now so that
+    // the next dequeue of this slot requests the new buffer.
+    if (mPrefetchedResult & IGraphicBufferProducer::RELEASE_ALL_BUFFERS) {
+        freeAllBuffers();
+    }
+    if (mPrefetchedResult & IGraphicBufferProducer::BUFFER_NEEDS_REALLOCATION) {
+        sp<GraphicBuffer>& gbuf(mSlots[mPrefetchedSlot].buffer);
+        if (mReportRemovedBuffers && (gbuf != nullptr)) {
+            mRemovedBuffers.push_back(gbuf);
+        }
+        gbuf = nullptr;
+    }
+
+    mGraphicBufferProducer->cancelBuffer(mPrefetchedSlot, mPrefetchedFence);
+    mPrefetchedSlot = BufferItem::INVALID_BUFFER_SLOT;
+    mPrefetchedFence.clear();
+}
+
 int Surface::getSlotFromBufferLocked(
         android_native_buffer_t* buffer) const {
     for (int i = 0; i < NUM_BUFFER_SLOTS; i++) {
@@ -661,7 +765,8 @@ int Surface::queueBuffer(android_native_buffer_t* buffer, int fenceFd) {
     IGraphicBufferProducer::QueueBufferOutput output;
     IGraphicBufferProducer::QueueBufferInput input(timestamp, isAutoTimestamp,
             mDataSpace, crop, mScalingMode, mTransform ^ mStickyTransform,
-            fence, mStickyTransform, mEnableFrameTimestamps);
+            fence, mStickyTransform,
+            mEnableFrameTimestamps && mFrameEventBlock == nullptr);
 
     if (mConnectedToCpu || mDirtyRegion.bounds() == Rect::INVALID_RECT) {
         input.setSurfaceDamage(Region::INVALID_REGION);
@@ -726,15 +831,48 @@ int Surface::queueBuffer(android_native_buffer_t* buffer, int fenceFd) {
         input.setSurfaceDamage(flippedRegion);
     }
 
+    // Prefetch the next buffer in the same transaction, unless the shared
+    // buffer is handed out without going over Binder anyway.
+    const bool prefetch = mPrefetchBuffers && !mSharedBufferMode &&
+            mPrefetchedSlot == BufferItem::INVALID_BUFFER_SLOT;
+
     nsecs_t now = systemTime();
-    status_t err = mGraphicBufferProducer->queueBuffer(i, input, &output);
+    status_t err;
+    if (prefetch) {
+        const uint32_t reqWidth = mReqWidth ? mReqWidth : mUserWidth;
+        const uint32_t reqHeight = mReqHeight ? mReqHeight : mUserHeight;
+        int prefetchedSlot = BufferItem::INVALID_BUFFER_SLOT;
+        sp<Fence> prefetchedFence;
+        status_t dequeueResult = INVALID_OPERATION;
+        err = mGraphicBufferProducer->queueAndDequeueBuffer(i, input, &output,
+                &prefetchedSlot, &prefetchedFence, &dequeueResult,
+                reqWidth, reqHeight, mReqFormat, mReqUsage);
+        if (dequeueResult >= 0) {
+            mPrefetchedSlot = prefetchedSlot;
+            mPrefetchedFence = prefetchedFence;
+            mPrefetchedResult = dequeueResult;
+            mPrefetchedWidth = reqWidth;
+            mPrefetchedHeight = reqHeight;
+            mPrefetchedFormat = mReqFormat;
+            mPrefetchedUsage = mReqUsage;
+        } else if (dequeueResult == INVALID_OPERATION) {
+            mPrefetchBuffers = false;
+        }
+    } else {
+        err = mGraphicBufferProducer->queueBuffer(i, input, &output);
+    }
     mLastQueueDuration = systemTime() - now;
     if (err != OK)  {
         ALOGE("queueBuffer: error queuing buffer to SurfaceTexture, %d", err);
     }
 
     if (mEnableFrameTimestamps) {
-        mFrameEventHistory->applyDelta(output.frameTimestamps);
+        if (mFrameEventBlock != nullptr) {
+            // The consumer published the new frame before returning
+            readFrameEventBlockLocked();
+        } else {
+            mFrameEventHistory->applyDelta(output.frameTimestamps);
+        }
         // Update timestamps with the local acquire fence.
         // The consumer doesn't send it back to prevent us from having two
         // file descriptors of the same fence.
@@ -962,6 +1100,9 @@ int Surface::perform(int operation, va_list args)
     case NATIVE_WINDOW_GET_HDR_SUPPORT:
         res = dispatchGetHdrSupport(args);
         break;
+    case NATIVE_WINDOW_SET_FRAME_METADATA:
+        res = dispatchSetFrameMetadata(args);
+        break;
     default:
         res = NAME_NOT_FOUND;
         break;
@@ -1135,6 +1276,15 @@ int Surface::dispatchGetHdrSupport(va_list args) {
     return getHdrSupport(outSupport);
 }
 
+int Surface::dispatchSetFrameMetadata(va_list args) {
+    const android_native_frame_metadata_t* metadata =
+            va_arg(args, const android_native_frame_metadata_t*);
+    if (metadata == NULL) {
+        return BAD_VALUE;
+    }
+    return setFrameMetadata(*metadata);
+}
+
 int Surface::connect(int api) {
     static sp<IProducerListener> listener = new DummyProducerListener();
     return connect(api, listener);
@@ -1181,6 +1331,7 @@ int Surface::disconnect(int api, IGraphicBufferProducer::DisconnectMode mode) {
     ATRACE_CALL();
     ALOGV("Surface::disconnect");
     Mutex::Autolock lock(mMutex);
+    cancelPrefetchedBufferLocked();
     mRemovedBuffers.clear();
     mSharedBufferSlot = BufferItem::INVALID_BUFFER_SLOT;
     mSharedBufferHasBeenQueued = false;
@@ -1216,6 +1367,7 @@ int Surface::detachNextBuffer(sp<GraphicBuffer>* outBuffer,
     if (mReportRemovedBuffers) {
         mRemovedBuffers.clear();
     }
+    cancelPrefetchedBufferLocked();
 
     sp<GraphicBuffer> buffer(NULL);
     sp<Fence> fence(NULL);
@@ -1254,6 +1406,7 @@ int Surface::attachBuffer(ANativeWindowBuffer* buffer)
     if (mReportRemovedBuffers) {
         mRemovedBuffers.clear();
     }
+    cancelPrefetchedBufferLocked();
 
     sp<GraphicBuffer> graphicBuffer(static_cast<GraphicBuffer*>(buffer));
     uint32_t priorGeneration = graphicBuffer->mGenerationNumber;
@@ -1309,6 +1462,7 @@ int Surface::setBufferCount(int bufferCount)
     ATRACE_CALL();
     ALOGV("Surface::setBufferCount");
     Mutex::Autolock lock(mMutex);
+    cancelPrefetchedBufferLocked();
 
     status_t err = NO_ERROR;
     if (bufferCount == 0) {
@@ -1333,6 +1487,7 @@ int Surface::setMaxDequeuedBufferCount(int maxDequeuedBuffers) {
     ATRACE_CALL();
     ALOGV("Surface::setMaxDequeuedBufferCount");
     Mutex::Autolock lock(mMutex);
+    cancelPrefetchedBufferLocked();
 
     status_t err = mGraphicBufferProducer->setMaxDequeuedBufferCount(
             maxDequeuedBuffers);
@@ -1346,6 +1501,7 @@ int Surface::setAsyncMode(bool async) {
     ATRACE_CALL();
     ALOGV("Surface::setAsyncMode");
     Mutex::Autolock lock(mMutex);
+    cancelPrefetchedBufferLocked();
 
     status_t err = mGraphicBufferProducer->setAsyncMode(async);
     ALOGE_IF(err, "IGraphicBufferProducer::setAsyncMode(%d) returned %s",
@@ -1358,6 +1514,7 @@ int Surface::setSharedBufferMode(bool sharedBufferMode) {
     ATRACE_CALL();
     ALOGV("Surface::setSharedBufferMode (%d)", sharedBufferMode);
     Mutex::Autolock lock(mMutex);
+    cancelPrefetchedBufferLocked();
 
     status_t err = mGraphicBufferProducer->setSharedBufferMode(
             sharedBufferMode);
@@ -1374,6 +1531,7 @@ int Surface::setAutoRefresh(bool autoRefresh) {
     ATRACE_CALL();
     ALOGV("Surface::setAutoRefresh (%d)", autoRefresh);
     Mutex::Autolock lock(mMutex);
+    cancelPrefetchedBufferLocked();
 
     status_t err = mGraphicBufferProducer->setAutoRefresh(autoRefresh);
     if (err == NO_ERROR) {
@@ -1495,7 +1653,10 @@ void Surface::setSurfaceDamage(android_native_rect_t* rects, size_t numRects) {
     ATRACE_CALL();
     ALOGV("Surface::setSurfaceDamage");
     Mutex::Autolock lock(mMutex);
+    setSurfaceDamageLocked(rects, numRects);
+}
 
+void Surface::setSurfaceDamageLocked(const android_native_rect_t* rects, size_t numRects) {
     if (mConnectedToCpu || numRects == 0) {
         mDirtyRegion = Region::INVALID_REGION;
         return;
@@ -1512,6 +1673,70 @@ void Surface::setSurfaceDamage(android_native_rect_t* rects, size_t numRects) {
     }
 }
 
+int Surface::setFrameMetadata(const android_native_frame_metadata_t& metadata)
+{
+    ATRACE_CALL();
+    ALOGV("Surface::setFrameMetadata(%#x)", metadata.fields);
+
+    // Validate everything first, so that an invalid field leaves the state
+    // of the next frame as it was
+    const uint32_t fields = metadata.fields;
+    if (fields & NATIVE_WINDOW_FRAME_METADATA_DIMENSIONS) {
+        if ((metadata.width && !metadata.height) || (!metadata.width && metadata.height)) {
+            return BAD_VALUE;
+        }
+    }
+    if (fields & NATIVE_WINDOW_FRAME_METADATA_SCALING_MODE) {
+        switch (metadata.scalingMode) {
+            case NATIVE_WINDOW_SCALING_MODE_FREEZE:
+            case NATIVE_WINDOW_SCALING_MODE_SCALE_TO_WINDOW:
+            case NATIVE_WINDOW_SCALING_MODE_SCALE_CROP:
+            case NATIVE_WINDOW_SCALING_MODE_NO_SCALE_CROP:
+                break;
+            default:
+                ALOGE("unknown scaling mode: %d", metadata.scalingMode);
+                return BAD_VALUE;
+        }
+    }
+    if ((fields & NATIVE_WINDOW_FRAME_METADATA_SURFACE_DAMAGE) &&
+            metadata.numDamageRects != 0 && metadata.damageRects == NULL) {
+        return BAD_VALUE;
+    }
+
+    Mutex::Autolock lock(mMutex);
+    if (fields & NATIVE_WINDOW_FRAME_METADATA_DIMENSIONS) {
+        if (metadata.width != mReqWidth || metadata.height != mReqHeight) {
+            mSharedBufferSlot = BufferItem::INVALID_BUFFER_SLOT;
+        }
+        mReqWidth = metadata.width;
+        mReqHeight = metadata.height;
+    }
+    if (fields & NATIVE_WINDOW_FRAME_METADATA_CROP) {
+        const Rect& crop = reinterpret_cast<const Rect&>(metadata.crop);
+        if (crop.isEmpty()) {
+            mCrop.clear();
+        } else {
+            mCrop = crop;
+        }
+    }
+    if (fields & NATIVE_WINDOW_FRAME_METADATA_TRANSFORM) {
+        mTransform = metadata.transform;
+    }
+    if (fields & NATIVE_WINDOW_FRAME_METADATA_SCALING_MODE) {
+        mScalingMode = metadata.scalingMode;
+    }
+    if (fields & NATIVE_WINDOW_FRAME_METADATA_TIMESTAMP) {
+        mTimestamp = metadata.timestamp;
+    }
+    if (fields & NATIVE_WINDOW_FRAME_METADATA_DATASPACE) {
+        mDataSpace = metadata.dataSpace;
+    }
+    if (fields & NATIVE_WINDOW_FRAME_METADATA_SURFACE_DAMAGE) {
+        setSurfaceDamageLocked(metadata.damageRects, metadata.numDamageRects);
+    }
+    return NO_ERROR;
+}
+
 // ----------------------------------------------------------------------
 // the lock/unlock APIs must be used from the same thread
 
@@ -727,6 +727,15 @@ status_t SurfaceComposerClient::getLayerFrameStats(const sp<IBinder>& token,
     return mClient->getLayerFrameStats(token, outStats);
 }
 
+status_t SurfaceComposerClient::getLayerPropertyBlock(const sp<IBinder>& token,
+        int* outFd) const {
+    if (mStatus != NO_ERROR) {
+        return mStatus;
+    }
+    return ComposerService::getComposerService()->getLayerPropertyBlock(
+            mClient, token, outFd);
+}
+
 inline Composer& SurfaceComposerClient::getComposer() {
     return mComposer;
 }
@@ -35,10 +35,13 @@
 
 #include <gui/BufferQueueCore.h>
 #include <gui/ISurfaceComposer.h>
+#include <gui/LayerPropertyBlock.h>
 #include <gui/Surface.h>
 #include <gui/SurfaceComposerClient.h>
 #include <gui/SurfaceControl.h>
 
+#include <private/gui/ComposerService.h>
+
 namespace android {
 
 // ============================================================================
@@ -118,6 +121,15 @@ status_t SurfaceControl::setRelativeLayer(const sp<IBinder>& relativeTo, int32_t
 status_t SurfaceControl::setPosition(float x, float y) {
     status_t err = validate();
     if (err < 0) return err;
+    {
+        Mutex::Autolock _l(mLock);
+        if (mPropertyWriter != nullptr) {
+            mProperties.what |= LayerProperties::ePositionChanged;
+            mProperties.x = x;
+            mProperties.y = y;
+            return writePropertiesLocked();
+        }
+    }
     return mClient->setPosition(mHandle, x, y);
 }
 status_t SurfaceControl::setGeometryAppliesWithResize() {
@@ -153,11 +165,30 @@ status_t SurfaceControl::setTransparentRegionHint(const Region& transparent) {
 status_t SurfaceControl::setAlpha(float alpha) {
     status_t err = validate();
     if (err < 0) return err;
+    {
+        Mutex::Autolock _l(mLock);
+        if (mPropertyWriter != nullptr) {
+            mProperties.what |= LayerProperties::eAlphaChanged;
+            mProperties.alpha = alpha;
+            return writePropertiesLocked();
+        }
+    }
     return mClient->setAlpha(mHandle, alpha);
 }
 status_t SurfaceControl::setMatrix(float dsdx, float dtdx, float dtdy, float dsdy) {
     status_t err = validate();
     if (err < 0) return err;
+    {
+        Mutex::Autolock _l(mLock);
+        if (mPropertyWriter != nullptr) {
+            mProperties.what |= LayerProperties::eMatrixChanged;
+            mProperties.dsdx = dsdx;
+            mProperties.dtdx = dtdx;
+            mProperties.dtdy = dtdy;
+            mProperties.dsdy = dsdy;
+            return writePropertiesLocked();
+        }
+    }
     return mClient->setMatrix(mHandle, dsdx, dtdx, dtdy, dsdy);
 }
 status_t SurfaceControl::setCrop(const Rect& crop) {
@@ -217,6 +248,34 @@ status_t SurfaceControl::getLayerFrameStats(FrameStats* outStats) const {
     return client->getLayerFrameStats(mHandle, outStats);
 }
 
+status_t SurfaceControl::enablePropertyBlock() {
+    status_t err = validate();
+    if (err < 0) return err;
+    Mutex::Autolock _l(mLock);
+    if (mPropertyWriter != nullptr) {
+        return NO_ERROR;
+    }
+    int fd = -1;
+    err = mClient->getLayerPropertyBlock(mHandle, &fd);
+    if (err != NO_ERROR) {
+        return err;
+    }
+    std::unique_ptr<LayerPropertyWriter> writer(new LayerPropertyWriter(fd));
+    err = writer->initCheck();
+    if (err != NO_ERROR) {
+        return err;
+    }
+    mPropertyWriter = std::move(writer);
+    return NO_ERROR;
+}
+
+status_t SurfaceControl::writePropertiesLocked() {
+    if (mPropertyWriter->write(mProperties)) {
+        ComposerService::getComposerService()->signalLayerPropertyBlocks();
+    }
+    return NO_ERROR;
+}
+
 status_t SurfaceControl::validate() const
 {
     if (mHandle==0 || mClient==0) {
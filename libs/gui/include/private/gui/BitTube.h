@@ -71,6 +71,20 @@ public:
         return recvObjects(tube, events, count, sizeof(T));
     }
 
+    // send objects as one message each, batched into as few system calls as possible. Returns the
+    // number of objects sent, which is less than count if the socket buffer filled up.
+    template <typename T>
+    static ssize_t sendObjectsBatch(BitTube* tube, T const* events, size_t count) {
+        return sendObjectsBatch(tube, events, count, sizeof(T));
+    }
+
+    // receive up to count objects that were sent one per message, such as by sendObjectsBatch(),
+    // batched into as few system calls as possible. Each object takes one message.
+    template <typename T>
+    static ssize_t recvObjectsBatch(BitTube* tube, T* events, size_t count) {
+        return recvObjectsBatch(tube, events, count, sizeof(T));
+    }
+
     // implement the Parcelable protocol. Only parcels the receive file descriptor
     status_t writeToParcel(Parcel* reply) const;
     status_t readFromParcel(const Parcel* parcel);
@@ -91,6 +105,11 @@ private:
     static ssize_t sendObjects(BitTube* tube, void const* events, size_t count, size_t objSize);
 
     static ssize_t recvObjects(BitTube* tube, void* events, size_t count, size_t objSize);
+
+    static ssize_t sendObjectsBatch(BitTube* tube, void const* events, size_t count,
+                                    size_t objSize);
+
+    static ssize_t recvObjectsBatch(BitTube* tube, void* events, size_t count, size_t objSize);
 };
 
 } // namespace gui
@@ -0,0 +1,84 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <gui/BufferQueueDefs.h>
+#include <ui/GraphicBuffer.h>
+#include <utils/Mutex.h>
+#include <utils/RefBase.h>
+
+#include <unordered_map>
+
+namespace android {
+
+class Parcel;
+
+namespace gui {
+
+/*
+ * GraphicBufferCache remembers the GraphicBuffers that went through one IGraphicBufferProducer
+ * connection, by id, so that a buffer the other side already has can be sent as a Reference
+ * instead of being flattened, and then imported again by the receiver.
+ *
+ * It only keeps weak references: a reference to a buffer that was destroyed in the meantime can't
+ * be resolved, and the sender must fall back to sending the whole buffer. Thread safe.
+ */
+class GraphicBufferCache {
+public:
+    // Identifies a buffer, along with the properties that may change while its id stays the same
+    struct Reference {
+        uint64_t id = 0;
+        uint32_t generationNumber = 0;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t stride = 0;
+        int32_t format = 0;
+        uint32_t layerCount = 0;
+        uint32_t usage = 0;
+
+        static Reference from(const GraphicBuffer& buffer);
+        bool matches(const GraphicBuffer& buffer) const;
+
+        status_t writeToParcel(Parcel* parcel) const;
+        status_t readFromParcel(const Parcel* parcel);
+    };
+
+    GraphicBufferCache() = default;
+    GraphicBufferCache(const GraphicBufferCache&) = delete;
+    GraphicBufferCache& operator=(const GraphicBufferCache&) = delete;
+
+    void add(const sp<GraphicBuffer>& buffer);
+
+    // true if buffer itself was added and the other side may still have it
+    bool contains(const sp<GraphicBuffer>& buffer) const;
+
+    // the added buffer that matches the reference, or nullptr if there is none or it was destroyed
+    sp<GraphicBuffer> find(const Reference& reference) const;
+
+    void remove(uint64_t id);
+
+private:
+    // Expired entries are dropped once the cache holds more than this many entries
+    static constexpr size_t PRUNE_THRESHOLD = 2 * BufferQueueDefs::NUM_BUFFER_SLOTS;
+
+    mutable Mutex mMutex;
+    std::unordered_map<uint64_t, wp<GraphicBuffer>> mBuffers;
+};
+
+} // namespace gui
+} // namespace android
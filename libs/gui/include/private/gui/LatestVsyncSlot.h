@@ -0,0 +1,95 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <android-base/unique_fd.h>
+#include <binder/Parcelable.h>
+#include <gui/DisplayEventReceiver.h>
+#include <utils/Errors.h>
+
+#include <atomic>
+
+namespace android {
+
+class Parcel;
+
+namespace gui {
+
+/*
+ * LatestVsyncSlot holds the most recent vsync of a display event connection in shared memory.
+ * SurfaceFlinger overwrites the slot on every vsync and signals an eventfd, so that a client that
+ * wakes up late reads one current record instead of a backlog of stale events. The slot is
+ * protected by a sequence counter, readers never take any lock.
+ *
+ * Only the side that called create() can write. The parceled copy maps the slot read-only.
+ */
+class LatestVsyncSlot : public Parcelable {
+public:
+    static constexpr uint32_t MAGIC = 0x4c565359; // 'LVSY'
+    static constexpr uint32_t VERSION = 1;
+
+    struct Shared {
+        uint32_t magic;
+        uint32_t version;
+        // odd while the slot is being written, 0 until the first vsync
+        std::atomic<uint32_t> sequence;
+        uint32_t reserved;
+        DisplayEventReceiver::LatestVsync vsync;
+    };
+
+    // creates an uninitialized slot (to unparcel into)
+    LatestVsyncSlot() = default;
+    virtual ~LatestVsyncSlot();
+
+    LatestVsyncSlot(const LatestVsyncSlot&) = delete;
+    LatestVsyncSlot& operator=(const LatestVsyncSlot&) = delete;
+
+    // allocates the shared memory and the eventfd, for the writer side
+    status_t create();
+
+    status_t initCheck() const { return mShared != nullptr ? NO_ERROR : NO_INIT; }
+
+    // the eventfd that becomes readable when the slot is written. The caller doesn't own the
+    // returned fd.
+    int getFd() const { return mEventFd; }
+
+    // overwrites the slot and signals the eventfd. Not thread safe, all calls to write() must come
+    // from the same thread.
+    void write(const DisplayEventReceiver::LatestVsync& vsync);
+
+    // clears the eventfd and copies the slot to outVsync. Returns false if nothing was written
+    // since the previous call to read().
+    bool read(DisplayEventReceiver::LatestVsync* outVsync);
+
+    // gives outSlot its own copies of the file descriptors, so that it can be written to a parcel
+    status_t duplicate(LatestVsyncSlot* outSlot) const;
+
+    // implement the Parcelable protocol. Only parcels the file descriptors
+    status_t writeToParcel(Parcel* parcel) const override;
+    status_t readFromParcel(const Parcel* parcel) override;
+
+private:
+    status_t map(int prot);
+
+    base::unique_fd mMemoryFd;
+    base::unique_fd mEventFd;
+    Shared* mShared = nullptr;
+    uint32_t mLastSequence = 0;
+};
+
+} // namespace gui
+} // namespace android
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "BitTube_test"
+//#define LOG_NDEBUG 0
+
+#include <gtest/gtest.h>
+#include <gui/DisplayEventReceiver.h>
+#include <private/gui/BitTube.h>
+
+#include <string.h>
+
+namespace android {
+
+using Event = DisplayEventReceiver::Event;
+
+static Event makeVsync(uint32_t count) {
+    Event event;
+    memset(&event, 0, sizeof(event));
+    event.header.type = DisplayEventReceiver::DISPLAY_EVENT_VSYNC;
+    event.header.timestamp = count * 1000;
+    event.vsync.count = count;
+    return event;
+}
+
+static Event makeHotplug(bool connected) {
+    Event event;
+    memset(&event, 0, sizeof(event));
+    event.header.type = DisplayEventReceiver::DISPLAY_EVENT_HOTPLUG;
+    event.hotplug.connected = connected;
+    return event;
+}
+
+TEST(BitTubeTest, BatchedObjects) {
+    gui::BitTube tube(gui::BitTube::DefaultSize);
+    ASSERT_EQ(NO_ERROR, tube.initCheck());
+
+    const uint64_t sent[] = {1, 2, 3, 4, 5};
+    EXPECT_EQ(5, gui::BitTube::sendObjectsBatch(&tube, sent, 5));
+
+    // Every object is a message of its own, so they can be received in any grouping.
+    uint64_t received[8] = {};
+    EXPECT_EQ(2, gui::BitTube::recvObjectsBatch(&tube, received, 2));
+    EXPECT_EQ(3, gui::BitTube::recvObjectsBatch(&tube, received + 2, 8));
+    for (size_t i = 0; i < 5; i++) {
+        EXPECT_EQ(sent[i], received[i]);
+    }
+    EXPECT_EQ(0, gui::BitTube::recvObjectsBatch(&tube, received, 8));
+}
+
+TEST(BitTubeTest, GetEvents) {
+    gui::BitTube tube(gui::BitTube::DefaultSize);
+    ASSERT_EQ(NO_ERROR, tube.initCheck());
+
+    const Event sent[] = {makeVsync(1), makeHotplug(true), makeVsync(2)};
+    EXPECT_EQ(3, DisplayEventReceiver::sendEvents(&tube, sent, 3));
+
+    Event received[8];
+    EXPECT_EQ(3, DisplayEventReceiver::getEvents(&tube, received, 8));
+    EXPECT_EQ(1u, received[0].vsync.count);
+    EXPECT_EQ(uint32_t(DisplayEventReceiver::DISPLAY_EVENT_HOTPLUG), received[1].header.type);
+    EXPECT_EQ(2u, received[2].vsync.count);
+}
+
+TEST(BitTubeTest, GetLatestEvents) {
+    gui::BitTube tube(gui::BitTube::DefaultSize);
+    ASSERT_EQ(NO_ERROR, tube.initCheck());
+
+    const Event sent[] = {makeVsync(1), makeVsync(2), makeHotplug(true), makeVsync(3),
+                          makeVsync(4)};
+    EXPECT_EQ(5, DisplayEventReceiver::sendEvents(&tube, sent, 5));
+
+    // A buffer smaller than the number of queued events still drains all the vsyncs, as long as
+    // the other events leave room for one.
+    Event received[3];
+    ASSERT_EQ(2, DisplayEventReceiver::getLatestEvents(&tube, received, 3));
+    EXPECT_EQ(uint32_t(DisplayEventReceiver::DISPLAY_EVENT_HOTPLUG), received[0].header.type);
+    EXPECT_EQ(uint32_t(DisplayEventReceiver::DISPLAY_EVENT_VSYNC), received[1].header.type);
+    EXPECT_EQ(4u, received[1].vsync.count);
+    EXPECT_EQ(0, DisplayEventReceiver::getLatestEvents(&tube, received, 3));
+}
+
+} // namespace android
@@ -1198,4 +1198,115 @@ TEST_F(BufferQueueTest, TestProducerConnectDisconnect) {
     ASSERT_EQ(NO_INIT, mProducer->disconnect(NATIVE_WINDOW_API_CPU));
 }
 
+TEST_F(BufferQueueTest, TestQueueAndDequeueBuffer) {
+    createBufferQueue();
+    sp<DummyConsumer> dc(new DummyConsumer);
+    ASSERT_EQ(OK, mConsumer->consumerConnect(dc, false));
+    IGraphicBufferProducer::QueueBufferOutput output;
+    ASSERT_EQ(OK, mProducer->connect(new DummyProducerListener,
+            NATIVE_WINDOW_API_CPU, false, &output));
+
+    int firstSlot = BufferQueue::INVALID_BUFFER_SLOT;
+    sp<Fence> fence;
+    sp<GraphicBuffer> buffer;
+    ASSERT_EQ(IGraphicBufferProducer::BUFFER_NEEDS_REALLOCATION,
+            mProducer->dequeueBuffer(&firstSlot, &fence, 0, 0, 0, 0, nullptr));
+    ASSERT_EQ(OK, mProducer->requestBuffer(firstSlot, &buffer));
+
+    IGraphicBufferProducer::QueueBufferInput input(0ull, true,
+            HAL_DATASPACE_UNKNOWN, Rect::INVALID_RECT,
+            NATIVE_WINDOW_SCALING_MODE_FREEZE, 0, Fence::NO_FENCE);
+
+    // Queueing the first buffer prefetches the second one
+    int secondSlot = BufferQueue::INVALID_BUFFER_SLOT;
+    status_t dequeueResult = NO_ERROR;
+    ASSERT_EQ(OK, mProducer->queueAndDequeueBuffer(firstSlot, input, &output,
+            &secondSlot, &fence, &dequeueResult, 0, 0, 0, 0));
+    ASSERT_EQ(IGraphicBufferProducer::BUFFER_NEEDS_REALLOCATION, dequeueResult);
+    ASSERT_NE(firstSlot, secondSlot);
+    ASSERT_EQ(OK, mProducer->requestBuffer(secondSlot, &buffer));
+
+    // Both buffers are queued, the prefetch must not block
+    int slot = BufferQueue::INVALID_BUFFER_SLOT;
+    ASSERT_EQ(OK, mProducer->queueAndDequeueBuffer(secondSlot, input, &output,
+            &slot, &fence, &dequeueResult, 0, 0, 0, 0));
+    ASSERT_EQ(WOULD_BLOCK, dequeueResult);
+
+    // Once the consumer releases the first buffer it can be dequeued again
+    BufferItem item;
+    ASSERT_EQ(OK, mConsumer->acquireBuffer(&item, 0));
+    ASSERT_EQ(firstSlot, item.mSlot);
+    ASSERT_EQ(OK, mConsumer->releaseBuffer(item.mSlot, item.mFrameNumber,
+            EGL_NO_DISPLAY, EGL_NO_SYNC_KHR, Fence::NO_FENCE));
+    ASSERT_EQ(OK, mProducer->dequeueBuffer(&slot, &fence, 0, 0, 0, 0, nullptr));
+    ASSERT_EQ(firstSlot, slot);
+}
+
+TEST_F(BufferQueueTest, TestBuffersRecycledAcrossReconnects) {
+    createBufferQueue();
+    sp<DummyConsumer> dc(new DummyConsumer);
+    ASSERT_EQ(OK, mConsumer->consumerConnect(dc, false));
+    IGraphicBufferProducer::QueueBufferOutput output;
+    ASSERT_EQ(OK, mProducer->connect(new DummyProducerListener,
+            NATIVE_WINDOW_API_CPU, false, &output));
+
+    // An unusual size, so that no other test can take it from the pool
+    const uint32_t width = 37;
+    const uint32_t height = 41;
+    int slot = BufferQueue::INVALID_BUFFER_SLOT;
+    sp<Fence> fence;
+    sp<GraphicBuffer> buffer;
+    ASSERT_EQ(IGraphicBufferProducer::BUFFER_NEEDS_REALLOCATION,
+            mProducer->dequeueBuffer(&slot, &fence, width, height, 0,
+                    GRALLOC_USAGE_SW_WRITE_OFTEN, nullptr));
+    ASSERT_EQ(OK, mProducer->requestBuffer(slot, &buffer));
+    const uint64_t id = buffer->getId();
+    ASSERT_EQ(OK, mProducer->cancelBuffer(slot, Fence::NO_FENCE));
+    ASSERT_EQ(OK, mProducer->disconnect(NATIVE_WINDOW_API_CPU));
+
+    // The buffer freed by the disconnect comes back after reconnecting
+    ASSERT_EQ(OK, mProducer->connect(new DummyProducerListener,
+            NATIVE_WINDOW_API_CPU, false, &output));
+    ASSERT_EQ(IGraphicBufferProducer::BUFFER_NEEDS_REALLOCATION,
+            mProducer->dequeueBuffer(&slot, &fence, width, height, 0,
+                    GRALLOC_USAGE_SW_WRITE_OFTEN, nullptr));
+    ASSERT_EQ(OK, mProducer->requestBuffer(slot, &buffer));
+    EXPECT_EQ(id, buffer->getId());
+}
+
+TEST_F(BufferQueueTest, TestLatencyHistogramsInDump) {
+    createBufferQueue();
+    sp<DummyConsumer> dc(new DummyConsumer);
+    ASSERT_EQ(OK, mConsumer->consumerConnect(dc, false));
+    IGraphicBufferProducer::QueueBufferOutput output;
+    ASSERT_EQ(OK, mProducer->connect(new DummyProducerListener,
+            NATIVE_WINDOW_API_CPU, false, &output));
+
+    int slot = BufferQueue::INVALID_BUFFER_SLOT;
+    sp<Fence> fence;
+    sp<GraphicBuffer> buffer;
+    IGraphicBufferProducer::QueueBufferInput input(0, false,
+            HAL_DATASPACE_UNKNOWN, Rect(0, 0, 1, 1),
+            NATIVE_WINDOW_SCALING_MODE_FREEZE, 0, Fence::NO_FENCE);
+    for (int i = 0; i < 2; i++) {
+        ASSERT_LE(OK, mProducer->dequeueBuffer(&slot, &fence, 0, 0, 0, 0,
+                nullptr));
+        ASSERT_EQ(OK, mProducer->requestBuffer(slot, &buffer));
+        ASSERT_EQ(OK, mProducer->queueBuffer(slot, input, &output));
+    }
+
+    // Both buffers were acquired, only one was released
+    BufferItem item;
+    ASSERT_EQ(OK, mConsumer->acquireBuffer(&item, 0));
+    ASSERT_EQ(OK, mConsumer->releaseBuffer(item.mSlot, item.mFrameNumber,
+            EGL_NO_DISPLAY, EGL_NO_SYNC_KHR, Fence::NO_FENCE));
+    ASSERT_EQ(OK, mConsumer->acquireBuffer(&item, 0));
+
+    String8 dumpString;
+    mConsumer->dumpState(String8{}, &dumpString);
+    EXPECT_NE(-1, dumpString.find("-dequeue-wait: count=2 "));
+    EXPECT_NE(-1, dumpString.find("-queue-to-acquire: count=2 "));
+    EXPECT_NE(-1, dumpString.find("-acquire-to-release: count=1 "));
+}
+
 } // namespace android
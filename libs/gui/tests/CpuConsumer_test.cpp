@@ -689,6 +689,62 @@ TEST_P(CpuConsumerTest, FromCpuLockMax) {
 
 }
 
+TEST_P(CpuConsumerTest, FromCpuLockBatch) {
+    status_t err;
+    CpuConsumerTestParams params = GetParam();
+
+    // Set up
+
+    ASSERT_NO_FATAL_FAILURE(configureANW(mANW, params, params.maxLockedBuffers + 1));
+
+    // Produce
+
+    const int64_t time = 1234L;
+    uint32_t stride;
+
+    for (int i = 0; i < params.maxLockedBuffers; i++) {
+        ALOGV("Producing frame %d", i);
+        ASSERT_NO_FATAL_FAILURE(produceOneFrame(mANW, params, time,
+                        &stride));
+    }
+
+    // Consume, asking for more buffers than were produced
+
+    const size_t count = static_cast<size_t>(params.maxLockedBuffers) + 1;
+    CpuConsumer::LockedBuffer *b = new CpuConsumer::LockedBuffer[count];
+    size_t lockedCount = 0;
+    err = mCC->lockNextBuffers(b, count, &lockedCount);
+    ASSERT_NO_ERROR(err, "lockNextBuffers error: ");
+    ASSERT_EQ(static_cast<size_t>(params.maxLockedBuffers), lockedCount);
+
+    for (size_t i = 0; i < lockedCount; i++) {
+        ASSERT_TRUE(b[i].data != NULL);
+        EXPECT_EQ(params.width,  b[i].width);
+        EXPECT_EQ(params.height, b[i].height);
+        EXPECT_EQ(params.format, b[i].format);
+        EXPECT_EQ(stride, b[i].stride);
+        EXPECT_EQ(time, b[i].timestamp);
+
+        checkAnyBuffer(b[i], GetParam().format);
+    }
+
+    ALOGV("Locking a batch (too many)");
+    err = mCC->lockNextBuffers(&b[lockedCount], 1, &lockedCount);
+    ASSERT_TRUE(err == NOT_ENOUGH_DATA) << "Allowing too many locks";
+    EXPECT_EQ(0u, lockedCount);
+
+    for (int i = 0; i < params.maxLockedBuffers; i++) {
+        err = mCC->unlockBuffer(b[i]);
+        ASSERT_NO_ERROR(err, "Could not unlock buffer: ");
+    }
+
+    ALOGV("Locking a batch (no more available)");
+    err = mCC->lockNextBuffers(b, count, &lockedCount);
+    ASSERT_EQ(BAD_VALUE, err) << "Not out of buffers somehow";
+
+    delete[] b;
+}
+
 CpuConsumerTestParams y8TestSets[] = {
     { 512,   512, 1, HAL_PIXEL_FORMAT_Y8},
     { 512,   512, 3, HAL_PIXEL_FORMAT_Y8},
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "FrameEventBlock_test"
+//#define LOG_NDEBUG 0
+
+#include <gtest/gtest.h>
+#include <gui/FrameEventBlock.h>
+
+#include <memory>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace android {
+
+class FrameEventBlockTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        mWriter = std::make_unique<FrameEventBlockWriter>();
+        ASSERT_EQ(NO_ERROR, mWriter->initCheck());
+        mReader = std::make_unique<FrameEventBlockReader>(dup(mWriter->getFd()));
+        ASSERT_EQ(NO_ERROR, mReader->initCheck());
+    }
+
+    std::unique_ptr<FrameEventBlockWriter> mWriter;
+    std::unique_ptr<FrameEventBlockReader> mReader;
+};
+
+TEST_F(FrameEventBlockTest, ReadsWhatWasWritten) {
+    FrameEventBlockSnapshot snapshot;
+    snapshot.compositorTiming.deadline = 100;
+    snapshot.frames[2].valid = 1;
+    snapshot.frames[2].frameNumber = 7;
+    snapshot.frames[2].latchTime = 42;
+    snapshot.frames[2].flags = FrameEventBlockEntry::eAddPostCompositeCalled;
+    snapshot.frames[2].displayPresentTime = 43;
+    mWriter->write(snapshot);
+
+    FrameEventBlockSnapshot read;
+    ASSERT_TRUE(mReader->read(&read));
+    EXPECT_EQ(100, read.compositorTiming.deadline);
+    EXPECT_EQ(1u, read.frames[2].valid);
+    EXPECT_EQ(7u, read.frames[2].frameNumber);
+    EXPECT_EQ(42, read.frames[2].latchTime);
+    EXPECT_EQ(43, read.frames[2].displayPresentTime);
+    EXPECT_EQ(0u, read.frames[0].valid);
+
+    // Nothing new to read
+    EXPECT_FALSE(mReader->read(&read));
+
+    // Identical snapshots aren't published again
+    mWriter->write(snapshot);
+    EXPECT_FALSE(mReader->read(&read));
+}
+
+TEST_F(FrameEventBlockTest, ProducerHistoryAppliesSnapshot) {
+    ProducerFrameEventHistory history;
+    FrameEventBlockSnapshot snapshot;
+    snapshot.frames[0].valid = 1;
+    snapshot.frames[0].frameNumber = 3;
+    snapshot.frames[0].latchTime = 10;
+    snapshot.frames[0].flags = FrameEventBlockEntry::eAddPostCompositeCalled;
+    snapshot.frames[0].gpuCompositionDoneTime = Fence::SIGNAL_TIME_INVALID;
+    snapshot.frames[0].displayPresentTime = Fence::SIGNAL_TIME_PENDING;
+    history.applySnapshot(snapshot);
+
+    FrameEvents* events = history.getFrame(3);
+    ASSERT_NE(nullptr, events);
+    EXPECT_EQ(10, events->latchTime);
+    // The present fence hasn't signaled, the producer has to ask for it
+    EXPECT_FALSE(events->addPostCompositeCalled);
+
+    snapshot.frames[0].displayPresentTime = 12;
+    history.applySnapshot(snapshot);
+    EXPECT_TRUE(events->addPostCompositeCalled);
+    EXPECT_EQ(12, events->displayPresentFence->getSignalTime());
+}
+
+TEST_F(FrameEventBlockTest, RegionIsReadOnlyForReaders) {
+    const size_t size = FrameEventBlock::getRegionSize();
+    void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+            mWriter->getFd(), 0);
+    EXPECT_EQ(MAP_FAILED, base);
+    if (base != MAP_FAILED) {
+        munmap(base, size);
+    }
+}
+
+TEST_F(FrameEventBlockTest, RejectsInvalidFd) {
+    FrameEventBlockReader reader(-1);
+    EXPECT_EQ(NO_INIT, reader.initCheck());
+    FrameEventBlockSnapshot snapshot;
+    EXPECT_FALSE(reader.read(&snapshot));
+}
+
+} // namespace android
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "FrameTimeline_test"
+//#define LOG_NDEBUG 0
+
+#include <gtest/gtest.h>
+#include <gui/FrameTimeline.h>
+
+#include <memory>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace android {
+
+static constexpr uint32_t kCapacity = 8;
+
+class FrameTimelineTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        mWriter = std::make_unique<FrameTimelineWriter>(kCapacity);
+        ASSERT_EQ(NO_ERROR, mWriter->initCheck());
+        mReader = std::make_unique<FrameTimelineReader>(dup(mWriter->getFd()));
+        ASSERT_EQ(NO_ERROR, mReader->initCheck());
+    }
+
+    static FrameTimelineEntry makeEntry(uint64_t frameNumber) {
+        FrameTimelineEntry entry;
+        entry.layerId = 42;
+        entry.frameNumber = frameNumber;
+        entry.queueTime = static_cast<nsecs_t>(frameNumber * 10);
+        entry.latchTime = entry.queueTime + 1;
+        entry.compositionStartTime = entry.queueTime + 2;
+        entry.presentTime = entry.queueTime + 3;
+        entry.releaseTime = entry.queueTime + 4;
+        return entry;
+    }
+
+    std::unique_ptr<FrameTimelineWriter> mWriter;
+    std::unique_ptr<FrameTimelineReader> mReader;
+};
+
+TEST_F(FrameTimelineTest, ReadsWhatWasWritten) {
+    for (uint64_t i = 1; i <= 3; i++) {
+        mWriter->write(makeEntry(i));
+    }
+    EXPECT_EQ(3u, mReader->getWriteCount());
+
+    uint64_t cursor = 0;
+    uint64_t dropped = 0;
+    FrameTimelineEntry entries[kCapacity];
+    ASSERT_EQ(3u, mReader->read(&cursor, entries, kCapacity, &dropped));
+    EXPECT_EQ(3u, cursor);
+    EXPECT_EQ(0u, dropped);
+    for (uint64_t i = 0; i < 3; i++) {
+        const FrameTimelineEntry expected = makeEntry(i + 1);
+        EXPECT_EQ(expected.layerId, entries[i].layerId);
+        EXPECT_EQ(expected.frameNumber, entries[i].frameNumber);
+        EXPECT_EQ(expected.queueTime, entries[i].queueTime);
+        EXPECT_EQ(expected.latchTime, entries[i].latchTime);
+        EXPECT_EQ(expected.compositionStartTime, entries[i].compositionStartTime);
+        EXPECT_EQ(expected.presentTime, entries[i].presentTime);
+        EXPECT_EQ(expected.releaseTime, entries[i].releaseTime);
+    }
+
+    // Nothing new to read
+    EXPECT_EQ(0u, mReader->read(&cursor, entries, kCapacity, &dropped));
+    EXPECT_EQ(3u, cursor);
+}
+
+TEST_F(FrameTimelineTest, HonorsMaxEntries) {
+    for (uint64_t i = 1; i <= 5; i++) {
+        mWriter->write(makeEntry(i));
+    }
+    uint64_t cursor = 0;
+    FrameTimelineEntry entries[2];
+    ASSERT_EQ(2u, mReader->read(&cursor, entries, 2));
+    EXPECT_EQ(2u, entries[1].frameNumber);
+    ASSERT_EQ(2u, mReader->read(&cursor, entries, 2));
+    EXPECT_EQ(4u, entries[1].frameNumber);
+    ASSERT_EQ(1u, mReader->read(&cursor, entries, 2));
+    EXPECT_EQ(5u, entries[0].frameNumber);
+}
+
+TEST_F(FrameTimelineTest, SkipsOverwrittenEntries) {
+    for (uint64_t i = 1; i <= kCapacity + 3; i++) {
+        mWriter->write(makeEntry(i));
+    }
+    uint64_t cursor = 0;
+    uint64_t dropped = 0;
+    FrameTimelineEntry entries[kCapacity];
+    ASSERT_EQ(kCapacity, mReader->read(&cursor, entries, kCapacity, &dropped));
+    EXPECT_EQ(3u, dropped);
+    EXPECT_EQ(4u, entries[0].frameNumber);
+    EXPECT_EQ(kCapacity + 3u, entries[kCapacity - 1].frameNumber);
+}
+
+TEST_F(FrameTimelineTest, RegionIsReadOnlyForReaders) {
+    const size_t size = FrameTimeline::getRegionSize(kCapacity);
+    void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+            mWriter->getFd(), 0);
+    EXPECT_EQ(MAP_FAILED, base);
+    if (base != MAP_FAILED) {
+        munmap(base, size);
+    }
+}
+
+TEST_F(FrameTimelineTest, RejectsInvalidFd) {
+    FrameTimelineReader reader(-1);
+    EXPECT_EQ(NO_INIT, reader.initCheck());
+    uint64_t cursor = 0;
+    FrameTimelineEntry entry;
+    EXPECT_EQ(0u, reader.read(&cursor, &entry, 1));
+}
+
+} // namespace android
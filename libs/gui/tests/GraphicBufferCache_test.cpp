@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#define LOG_TAG "GraphicBufferCache_test"
+//#define LOG_NDEBUG 0
+
+#include <gtest/gtest.h>
+
+#include <binder/Parcel.h>
+#include <private/gui/GraphicBufferCache.h>
+
+namespace android {
+
+using Reference = gui::GraphicBufferCache::Reference;
+
+class GraphicBufferCacheTest : public ::testing::Test {
+protected:
+    // No need to allocate anything, the cache only looks at the metadata
+    static sp<GraphicBuffer> makeBuffer() {
+        return new GraphicBuffer();
+    }
+
+    gui::GraphicBufferCache mCache;
+};
+
+TEST_F(GraphicBufferCacheTest, FindsAddedBuffer) {
+    sp<GraphicBuffer> buffer = makeBuffer();
+    EXPECT_FALSE(mCache.contains(buffer));
+    EXPECT_EQ(nullptr, mCache.find(Reference::from(*buffer)).get());
+
+    mCache.add(buffer);
+    EXPECT_TRUE(mCache.contains(buffer));
+    EXPECT_EQ(buffer.get(), mCache.find(Reference::from(*buffer)).get());
+
+    // Another buffer isn't mistaken for it
+    sp<GraphicBuffer> other = makeBuffer();
+    EXPECT_FALSE(mCache.contains(other));
+    EXPECT_EQ(nullptr, mCache.find(Reference::from(*other)).get());
+
+    mCache.remove(buffer->getId());
+    EXPECT_FALSE(mCache.contains(buffer));
+    EXPECT_EQ(nullptr, mCache.find(Reference::from(*buffer)).get());
+}
+
+TEST_F(GraphicBufferCacheTest, RejectsStaleReference) {
+    sp<GraphicBuffer> buffer = makeBuffer();
+    mCache.add(buffer);
+
+    Reference reference = Reference::from(*buffer);
+    buffer->setGenerationNumber(buffer->getGenerationNumber() + 1);
+    EXPECT_EQ(nullptr, mCache.find(reference).get());
+    EXPECT_EQ(buffer.get(), mCache.find(Reference::from(*buffer)).get());
+}
+
+TEST_F(GraphicBufferCacheTest, DoesNotKeepBuffersAlive) {
+    sp<GraphicBuffer> buffer = makeBuffer();
+    wp<GraphicBuffer> weak = buffer;
+    const Reference reference = Reference::from(*buffer);
+    mCache.add(buffer);
+
+    buffer.clear();
+    EXPECT_EQ(nullptr, weak.promote().get());
+    EXPECT_EQ(nullptr, mCache.find(reference).get());
+}
+
+TEST_F(GraphicBufferCacheTest, ReferenceParcelRoundTrip) {
+    sp<GraphicBuffer> buffer = makeBuffer();
+    buffer->setGenerationNumber(7);
+    mCache.add(buffer);
+
+    Parcel parcel;
+    ASSERT_EQ(NO_ERROR, Reference::from(*buffer).writeToParcel(&parcel));
+    parcel.setDataPosition(0);
+    Reference reference;
+    ASSERT_EQ(NO_ERROR, reference.readFromParcel(&parcel));
+    EXPECT_EQ(buffer->getId(), reference.id);
+    EXPECT_EQ(7u, reference.generationNumber);
+    EXPECT_EQ(buffer.get(), mCache.find(reference).get());
+}
+
+} // namespace android
@@ -0,0 +1,129 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Microbenchmarks for the per-call conversions H2BGraphicBufferProducer does
+ * between the HIDL and binder types of IGraphicBufferProducer. For
+ * machine-readable results, run with
+ *   libgui_conversion_benchmark --benchmark_format=json
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <gui/bufferqueue/1.0/Conversion.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace android {
+
+using namespace ::android::hardware::graphics::bufferqueue::V1_0::utils;
+
+// A file descriptor standing in for a fence fd, conversions only dup it
+static int openFenceFd() {
+    return open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+static void BM_ConvertFence(benchmark::State& state) {
+    const int fd = openFenceFd();
+    native_handle_t* nh = native_handle_create_from_fd(fd);
+    hidl_handle tFence(nh);
+    while (state.KeepRunning()) {
+        sp<Fence> fence;
+        benchmark::DoNotOptimize(convertTo(&fence, tFence));
+    }
+    native_handle_close(nh);
+    native_handle_delete(nh);
+}
+
+static void BM_WrapQueueBufferInput(benchmark::State& state) {
+    BGraphicBufferProducer::QueueBufferInput input(0, false,
+            HAL_DATASPACE_UNKNOWN, ::android::Rect(0, 0, 1920, 1080),
+            NATIVE_WINDOW_SCALING_MODE_FREEZE, 0, new Fence(openFenceFd()));
+    ::android::Region damage;
+    for (int i = 0; i < state.range(0); i++) {
+        damage.orSelf(::android::Rect(i * 20, i * 20, i * 20 + 10, i * 20 + 10));
+    }
+    input.setSurfaceDamage(damage);
+    while (state.KeepRunning()) {
+        HGraphicBufferProducer::QueueBufferInput tInput;
+        native_handle_t* nh = nullptr;
+        benchmark::DoNotOptimize(wrapAs(&tInput, &nh, input));
+        native_handle_delete(nh);
+    }
+}
+
+// {number of frame event deltas, whether the snapshots hold fences}
+static void BM_ConvertQueueBufferOutput(benchmark::State& state) {
+    const int fd = openFenceFd();
+    native_handle_t* nh = native_handle_create_from_fd(fd);
+
+    HGraphicBufferProducer::QueueBufferOutput tOutput;
+    tOutput.frameTimestamps.deltas.resize(state.range(0));
+    for (int i = 0; i < state.range(0); i++) {
+        HGraphicBufferProducer::FrameEventsDelta& delta =
+                tOutput.frameTimestamps.deltas[i];
+        delta.index = i;
+        delta.frameNumber = i + 1;
+        HGraphicBufferProducer::FenceTimeSnapshot* snapshots[] = {
+            &delta.gpuCompositionDoneFence, &delta.displayPresentFence,
+            &delta.displayRetireFence, &delta.releaseFence,
+        };
+        for (auto snapshot : snapshots) {
+            if (state.range(1)) {
+                snapshot->state =
+                        HGraphicBufferProducer::FenceTimeSnapshot::State::FENCE;
+                snapshot->fence = nh;
+            } else {
+                snapshot->state = HGraphicBufferProducer::FenceTimeSnapshot::
+                        State::SIGNAL_TIME;
+                snapshot->signalTimeNs = i;
+            }
+        }
+    }
+
+    while (state.KeepRunning()) {
+        BGraphicBufferProducer::QueueBufferOutput output;
+        benchmark::DoNotOptimize(convertTo(&output, tOutput));
+    }
+    native_handle_close(nh);
+    native_handle_delete(nh);
+}
+
+static void BM_ConvertAnwBuffer(benchmark::State& state) {
+    sp<GraphicBuffer> buffer = new GraphicBuffer(64, 64, PIXEL_FORMAT_RGBA_8888,
+            1, GRALLOC_USAGE_SW_READ_OFTEN, "BM_ConvertAnwBuffer");
+    if (buffer->initCheck() != NO_ERROR) {
+        state.SkipWithError("can't allocate a buffer");
+        return;
+    }
+    AnwBuffer tBuffer;
+    wrapAs(&tBuffer, *buffer);
+    while (state.KeepRunning()) {
+        sp<GraphicBuffer> converted = new GraphicBuffer();
+        benchmark::DoNotOptimize(convertTo(converted.get(), tBuffer));
+    }
+}
+
+BENCHMARK(BM_ConvertFence);
+BENCHMARK(BM_WrapQueueBufferInput)->Arg(1)->Arg(8);
+BENCHMARK(BM_ConvertQueueBufferOutput)->ArgPair(0, 0)->ArgPair(1, 0)
+        ->ArgPair(8, 0)->ArgPair(8, 1);
+BENCHMARK(BM_ConvertAnwBuffer);
+
+} // namespace android
+
+BENCHMARK_MAIN();
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "LatestVsyncSlot_test"
+//#define LOG_NDEBUG 0
+
+#include <gtest/gtest.h>
+
+#include <binder/Parcel.h>
+#include <private/gui/LatestVsyncSlot.h>
+
+#include <poll.h>
+
+namespace android {
+
+using LatestVsync = DisplayEventReceiver::LatestVsync;
+
+class LatestVsyncSlotTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        ASSERT_EQ(NO_ERROR, mWriter.create());
+
+        // Goes through a parcel like the slot returned by enableLatestVsync()
+        gui::LatestVsyncSlot copy;
+        ASSERT_EQ(NO_ERROR, mWriter.duplicate(&copy));
+        Parcel parcel;
+        ASSERT_EQ(NO_ERROR, copy.writeToParcel(&parcel));
+        parcel.setDataPosition(0);
+        ASSERT_EQ(NO_ERROR, mReader.readFromParcel(&parcel));
+        ASSERT_EQ(NO_ERROR, mReader.initCheck());
+    }
+
+    static LatestVsync makeVsync(uint32_t count) {
+        LatestVsync vsync;
+        vsync.timestamp = static_cast<nsecs_t>(count) * 16;
+        vsync.count = count;
+        vsync.expectedNextTimestamp = vsync.timestamp + 16;
+        return vsync;
+    }
+
+    bool isSignaled() const {
+        struct pollfd pfd = {mReader.getFd(), POLLIN, 0};
+        return poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN);
+    }
+
+    gui::LatestVsyncSlot mWriter;
+    gui::LatestVsyncSlot mReader;
+};
+
+TEST_F(LatestVsyncSlotTest, EmptyUntilWritten) {
+    LatestVsync vsync;
+    EXPECT_FALSE(isSignaled());
+    EXPECT_FALSE(mReader.read(&vsync));
+}
+
+TEST_F(LatestVsyncSlotTest, ReadsWhatWasWritten) {
+    mWriter.write(makeVsync(1));
+    EXPECT_TRUE(isSignaled());
+
+    LatestVsync vsync;
+    ASSERT_TRUE(mReader.read(&vsync));
+    EXPECT_EQ(1u, vsync.count);
+    EXPECT_EQ(16, vsync.timestamp);
+    EXPECT_EQ(32, vsync.expectedNextTimestamp);
+
+    // Reading clears the eventfd and the same vsync isn't returned twice
+    EXPECT_FALSE(isSignaled());
+    EXPECT_FALSE(mReader.read(&vsync));
+}
+
+TEST_F(LatestVsyncSlotTest, OnlyKeepsLatest) {
+    for (uint32_t i = 1; i <= 5; i++) {
+        mWriter.write(makeVsync(i));
+    }
+
+    LatestVsync vsync;
+    ASSERT_TRUE(mReader.read(&vsync));
+    EXPECT_EQ(5u, vsync.count);
+    EXPECT_FALSE(mReader.read(&vsync));
+
+    mWriter.write(makeVsync(6));
+    ASSERT_TRUE(mReader.read(&vsync));
+    EXPECT_EQ(6u, vsync.count);
+}
+
+TEST_F(LatestVsyncSlotTest, UninitializedSlot) {
+    gui::LatestVsyncSlot slot;
+    gui::LatestVsyncSlot copy;
+    LatestVsync vsync;
+    EXPECT_EQ(NO_INIT, slot.initCheck());
+    EXPECT_FALSE(slot.read(&vsync));
+    EXPECT_EQ(NO_INIT, slot.duplicate(&copy));
+}
+
+} // namespace android
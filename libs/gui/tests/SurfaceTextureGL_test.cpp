@@ -22,6 +22,8 @@
 #include "DisconnectWaiter.h"
 #include "FillBuffer.h"
 
+#include <set>
+
 namespace android {
 
 TEST_F(SurfaceTextureGLTest, TexturingFromCpuFilledYV12BufferNpot) {
@@ -533,6 +535,40 @@ TEST_F(SurfaceTextureGLTest, DisconnectClearsCurrentTexture) {
             NATIVE_WINDOW_API_CPU));
 }
 
+TEST_F(SurfaceTextureGLTest, PerSlotTexturesAreReused) {
+    mST->setPerSlotTexturesEnabled(true);
+    ASSERT_EQ(OK, native_window_api_connect(mANW.get(),
+            NATIVE_WINDOW_API_CPU));
+
+    const int numFrames = 10;
+    std::set<uint32_t> names;
+    for (int i = 0; i < numFrames; i++) {
+        ANativeWindowBuffer* anb;
+        ASSERT_EQ(OK, native_window_dequeue_buffer_and_wait(mANW.get(), &anb));
+        ASSERT_EQ(OK, mANW->queueBuffer(mANW.get(), anb, -1));
+        ASSERT_EQ(OK, mST->updateTexImage());
+
+        GLint boundName = 0;
+        glGetIntegerv(GL_TEXTURE_BINDING_EXTERNAL_OES, &boundName);
+        const uint32_t name = mST->getCurrentTextureName();
+        EXPECT_NE(uint32_t(TEX_ID), name);
+        EXPECT_EQ(name, uint32_t(boundName));
+        names.insert(name);
+    }
+    // One texture per slot, not per frame
+    EXPECT_LT(names.size(), size_t(numFrames));
+
+    mST->setPerSlotTexturesEnabled(false);
+    ANativeWindowBuffer* anb;
+    ASSERT_EQ(OK, native_window_dequeue_buffer_and_wait(mANW.get(), &anb));
+    ASSERT_EQ(OK, mANW->queueBuffer(mANW.get(), anb, -1));
+    ASSERT_EQ(OK, mST->updateTexImage());
+    EXPECT_EQ(uint32_t(TEX_ID), mST->getCurrentTextureName());
+
+    ASSERT_EQ(OK, native_window_api_disconnect(mANW.get(),
+            NATIVE_WINDOW_API_CPU));
+}
+
 TEST_F(SurfaceTextureGLTest, ScaleToWindowMode) {
     ASSERT_EQ(OK, native_window_set_scaling_mode(mANW.get(),
         NATIVE_WINDOW_SCALING_MODE_SCALE_TO_WINDOW));
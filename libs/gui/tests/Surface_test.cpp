@@ -409,6 +409,56 @@ TEST_F(SurfaceTest, TestGetLastDequeueStartTime) {
     ASSERT_GE(after, lastDequeueTime);
 }
 
+TEST_F(SurfaceTest, SetFrameMetadata) {
+    sp<IGraphicBufferProducer> producer;
+    sp<IGraphicBufferConsumer> consumer;
+    BufferQueue::createBufferQueue(&producer, &consumer);
+    sp<BufferItemConsumer> itemConsumer = new BufferItemConsumer(consumer,
+            GRALLOC_USAGE_SW_READ_OFTEN);
+    sp<Surface> surface = new Surface(producer);
+    sp<ANativeWindow> anw(surface);
+    ASSERT_EQ(NO_ERROR, native_window_api_connect(anw.get(), NATIVE_WINDOW_API_CPU));
+
+    android_native_frame_metadata_t metadata;
+    memset(&metadata, 0, sizeof(metadata));
+    metadata.fields = NATIVE_WINDOW_FRAME_METADATA_DIMENSIONS |
+            NATIVE_WINDOW_FRAME_METADATA_CROP |
+            NATIVE_WINDOW_FRAME_METADATA_TRANSFORM |
+            NATIVE_WINDOW_FRAME_METADATA_SCALING_MODE |
+            NATIVE_WINDOW_FRAME_METADATA_TIMESTAMP |
+            NATIVE_WINDOW_FRAME_METADATA_DATASPACE;
+    metadata.width = 64;
+    metadata.height = 32;
+    metadata.crop = {1, 2, 33, 18};
+    metadata.transform = NATIVE_WINDOW_TRANSFORM_ROT_90;
+    metadata.scalingMode = NATIVE_WINDOW_SCALING_MODE_SCALE_CROP;
+    metadata.timestamp = 1234;
+    metadata.dataSpace = HAL_DATASPACE_SRGB;
+
+    // An invalid field rejects the whole call
+    android_native_frame_metadata_t invalid = metadata;
+    invalid.scalingMode = -1;
+    ASSERT_EQ(BAD_VALUE, native_window_set_frame_metadata(anw.get(), &invalid));
+
+    ASSERT_EQ(NO_ERROR, native_window_set_frame_metadata(anw.get(), &metadata));
+
+    ANativeWindowBuffer* buffer = nullptr;
+    int fenceFd = -1;
+    ASSERT_EQ(NO_ERROR, anw->dequeueBuffer(anw.get(), &buffer, &fenceFd));
+    EXPECT_EQ(64, buffer->width);
+    EXPECT_EQ(32, buffer->height);
+    ASSERT_EQ(NO_ERROR, anw->queueBuffer(anw.get(), buffer, fenceFd));
+
+    BufferItem item;
+    ASSERT_EQ(NO_ERROR, itemConsumer->acquireBuffer(&item, 0));
+    EXPECT_EQ(Rect(1, 2, 33, 18), item.mCrop);
+    EXPECT_EQ(static_cast<uint32_t>(NATIVE_WINDOW_TRANSFORM_ROT_90), item.mTransform);
+    EXPECT_EQ(NATIVE_WINDOW_SCALING_MODE_SCALE_CROP, static_cast<int>(item.mScalingMode));
+    EXPECT_EQ(1234, item.mTimestamp);
+    EXPECT_EQ(HAL_DATASPACE_SRGB, item.mDataSpace);
+    ASSERT_EQ(NO_ERROR, itemConsumer->releaseBuffer(item));
+}
+
 class FakeConsumer : public BnConsumerListener {
 public:
     void onFrameAvailable(const BufferItem& /*item*/) override {}
@@ -539,6 +589,21 @@ public:
         return NO_ERROR;
     }
     status_t injectVSync(nsecs_t /*when*/) override { return NO_ERROR; }
+    status_t getFrameTimeline(int* /*outFd*/) override { return NO_ERROR; }
+    status_t getLayerPropertyBlock(const sp<ISurfaceComposerClient>& /*client*/,
+            const sp<IBinder>& /*handle*/, int* /*outFd*/) override {
+        return NO_ERROR;
+    }
+    void signalLayerPropertyBlocks() override {}
+    status_t captureScreenToBuffer(const sp<IBinder>& /*display*/,
+            Rect /*sourceCrop*/, uint32_t /*reqWidth*/, uint32_t /*reqHeight*/,
+            int32_t /*minLayerZ*/, int32_t /*maxLayerZ*/,
+            bool /*useIdentityTransform*/, Rotation /*rotation*/,
+            sp<GraphicBuffer>* /*outBuffer*/, sp<Fence>* /*outFence*/) override {
+        return NO_ERROR;
+    }
+    void releaseCaptureBuffer(uint64_t /*bufferId*/,
+            const sp<Fence>& /*releaseFence*/) override {}
 
 protected:
     IBinder* onAsBinder() override { return nullptr; }
@@ -522,7 +522,9 @@ HWC2On1Adapter::Display::Display(HWC2On1Adapter& device, HWC2::DisplayType type)
     mHwc1LayerMap(),
     mNumAvailableRects(0),
     mNextAvailableRect(nullptr),
-    mGeometryChanged(false)
+    mGeometryChanged(false),
+    mLayersChanged(true),
+    mAlreadyPresented(false)
     {}
 
 Error HWC2On1Adapter::Display::acceptChanges() {
@@ -561,6 +563,7 @@ Error HWC2On1Adapter::Display::createLayer(hwc2_layer_t* outLayerId) {
     *outLayerId = layer->getId();
     ALOGV("[%" PRIu64 "] created layer %" PRIu64, mId, *outLayerId);
     markGeometryChanged();
+    mLayersChanged = true;
     return Error::None;
 }
 
@@ -584,6 +587,7 @@ Error HWC2On1Adapter::Display::destroyLayer(hwc2_layer_t layerId) {
     }
     ALOGV("[%" PRIu64 "] destroyed layer %" PRIu64, mId, layerId);
     markGeometryChanged();
+    mLayersChanged = true;
     return Error::None;
 }
 
@@ -788,7 +792,15 @@ Error HWC2On1Adapter::Display::present(int32_t* outRetireFence) {
                     to_string(error).c_str());
             return error;
         }
+    } else if (!mAlreadyPresented) {
+        Error error = mDevice.presentWithoutValidate();
+        if (error != Error::None) {
+            ALOGV("[%" PRIu64 "] present: can't skip validate (%s)", mId,
+                    to_string(error).c_str());
+            return error;
+        }
     }
+    mAlreadyPresented = false;
 
     *outRetireFence = mRetireFence.get()->dup();
     ALOGV("[%" PRIu64 "] present returning retire fence %d", mId,
@@ -875,7 +887,12 @@ Error HWC2On1Adapter::Display::setColorTransform(android_color_transform_t hint)
 
     ALOGV("%" PRIu64 "] setColorTransform(%d)", mId,
             static_cast<int32_t>(hint));
-    mHasColorTransform = (hint != HAL_COLOR_TRANSFORM_IDENTITY);
+    bool hasColorTransform = (hint != HAL_COLOR_TRANSFORM_IDENTITY);
+    if (hasColorTransform != mHasColorTransform) {
+        // Changes which layers HWC1 may compose, it has to be prepared again
+        mHasColorTransform = hasColorTransform;
+        markGeometryChanged();
+    }
     return Error::None;
 }
 
@@ -1016,6 +1033,7 @@ Error HWC2On1Adapter::Display::updateLayerZ(hwc2_layer_t layerId, uint32_t z) {
     layer->setZ(z);
     mLayers.emplace(std::move(layer));
     markGeometryChanged();
+    mLayersChanged = true;
 
     return Error::None;
 }
@@ -1206,8 +1224,18 @@ bool HWC2On1Adapter::Display::prepare() {
         return false;
     }
 
-    allocateRequestedContents();
-    assignHwc1LayerIds();
+    mAlreadyPresented = false;
+
+    // Most frames only change buffers, so instead of rebuilding the HWC1
+    // contents we only rewrite the layers whose state changed
+    if (!canUpdateContentsInPlace()) {
+        allocateRequestedContents();
+        assignHwc1LayerIds();
+        for (auto& layer : mLayers) {
+            layer->markStateDirty();
+        }
+        mLayersChanged = false;
+    }
 
     mHwc1RequestedContents->retireFenceFd = -1;
     mHwc1RequestedContents->flags = 0;
@@ -1293,10 +1321,51 @@ Error HWC2On1Adapter::Display::set(hwc_display_contents_1& hwcContents) {
     }
 
     mChanges.reset();
+    mAlreadyPresented = true;
 
     return Error::None;
 }
 
+bool HWC2On1Adapter::Display::canSkipValidate() const {
+    std::unique_lock<std::recursive_mutex> lock(mStateMutex);
+
+    if (mChanges || mGeometryChanged || !canUpdateContentsInPlace()) {
+        return false;
+    }
+
+    // Client composition needs a client target rendered for the current
+    // frame, which SurfaceFlinger only does after validating
+    size_t numLayers = mHwc1RequestedContents->numHwLayers;
+    for (size_t hwc1Id = 0; hwc1Id < numLayers - 1; ++hwc1Id) {
+        const auto& hwc1Layer = mHwc1RequestedContents->hwLayers[hwc1Id];
+        if (hwc1Layer.compositionType == HWC_FRAMEBUFFER) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void HWC2On1Adapter::Display::refreshBuffers() {
+    std::unique_lock<std::recursive_mutex> lock(mStateMutex);
+
+    mHwc1RequestedContents->retireFenceFd = -1;
+    mHwc1RequestedContents->flags = 0;
+    mHwc1RequestedContents->outbuf = mOutputBuffer.getBuffer();
+    mHwc1RequestedContents->outbufAcquireFenceFd = mOutputBuffer.getFence();
+
+    for (auto& layer : mLayers) {
+        auto& hwc1Layer = mHwc1RequestedContents->hwLayers[layer->getHwc1Id()];
+        layer->applyBufferUpdate(hwc1Layer);
+    }
+
+    auto& clientTargetLayer = mHwc1RequestedContents->hwLayers[mLayers.size()];
+    clientTargetLayer.releaseFenceFd = -1;
+    clientTargetLayer.handle = mClientTarget.getBuffer();
+    clientTargetLayer.acquireFenceFd = mClientTarget.getFence();
+
+    mAlreadyPresented = true;
+}
+
 void HWC2On1Adapter::Display::addRetireFence(int fenceFd) {
     std::unique_lock<std::recursive_mutex> lock(mStateMutex);
     mRetireFence.add(fenceFd);
@@ -1805,6 +1874,27 @@ void HWC2On1Adapter::Display::allocateRequestedContents() {
     mNumAvailableRects = numRects;
 }
 
+bool HWC2On1Adapter::Display::canUpdateContentsInPlace() const {
+    if (!mHwc1RequestedContents || mLayersChanged) {
+        return false;
+    }
+    if (mHwc1RequestedContents->numHwLayers != mLayers.size() + 1) {
+        return false;
+    }
+    for (const auto& layer : mLayers) {
+        if (!layer->isStateDirty()) {
+            continue;
+        }
+        const auto& hwc1Layer =
+                mHwc1RequestedContents->hwLayers[layer->getHwc1Id()];
+        if (hwc1Layer.visibleRegionScreen.numRects !=
+                layer->getNumVisibleRegions()) {
+            return false;
+        }
+    }
+    return true;
+}
+
 void HWC2On1Adapter::Display::assignHwc1LayerIds() {
     mHwc1LayerMap.clear();
     size_t nextHwc1Id = 0;
@@ -1878,8 +1968,11 @@ void HWC2On1Adapter::Display::prepareFramebufferTarget() {
     hwc1Target.displayFrame = {0, 0, width, height};
     hwc1Target.planeAlpha = 255;
 
+    // The rect is kept when the contents are updated in place
+    hwc_rect_t* rects = hwc1Target.visibleRegionScreen.rects != nullptr ?
+            const_cast<hwc_rect_t*>(hwc1Target.visibleRegionScreen.rects) :
+            GetRects(1);
     hwc1Target.visibleRegionScreen.numRects = 1;
-    hwc_rect_t* rects = GetRects(1);
     rects[0].left = 0;
     rects[0].top = 0;
     rects[0].right = width;
@@ -1911,7 +2004,8 @@ HWC2On1Adapter::Layer::Layer(Display& display)
     mZ(0),
     mReleaseFence(),
     mHwc1Id(0),
-    mHasUnsupportedPlaneAlpha(false) {}
+    mHasUnsupportedPlaneAlpha(false),
+    mStateDirty(true) {}
 
 bool HWC2On1Adapter::SortLayersByZ::operator()(
         const std::shared_ptr<Layer>& lhs, const std::shared_ptr<Layer>& rhs) {
@@ -1955,18 +2049,21 @@ Error HWC2On1Adapter::Layer::setSurfaceDamage(hwc_region_t damage) {
 
 Error HWC2On1Adapter::Layer::setBlendMode(BlendMode mode) {
     mBlendMode = mode;
+    mStateDirty = true;
     mDisplay.markGeometryChanged();
     return Error::None;
 }
 
 Error HWC2On1Adapter::Layer::setColor(hwc_color_t color) {
     mColor = color;
+    mStateDirty = true;
     mDisplay.markGeometryChanged();
     return Error::None;
 }
 
 Error HWC2On1Adapter::Layer::setCompositionType(Composition type) {
     mCompositionType = type;
+    mStateDirty = true;
     mDisplay.markGeometryChanged();
     return Error::None;
 }
@@ -1977,30 +2074,35 @@ Error HWC2On1Adapter::Layer::setDataspace(android_dataspace_t) {
 
 Error HWC2On1Adapter::Layer::setDisplayFrame(hwc_rect_t frame) {
     mDisplayFrame = frame;
+    mStateDirty = true;
     mDisplay.markGeometryChanged();
     return Error::None;
 }
 
 Error HWC2On1Adapter::Layer::setPlaneAlpha(float alpha) {
     mPlaneAlpha = alpha;
+    mStateDirty = true;
     mDisplay.markGeometryChanged();
     return Error::None;
 }
 
 Error HWC2On1Adapter::Layer::setSidebandStream(const native_handle_t* stream) {
     mSidebandStream = stream;
+    mStateDirty = true;
     mDisplay.markGeometryChanged();
     return Error::None;
 }
 
 Error HWC2On1Adapter::Layer::setSourceCrop(hwc_frect_t crop) {
     mSourceCrop = crop;
+    mStateDirty = true;
     mDisplay.markGeometryChanged();
     return Error::None;
 }
 
 Error HWC2On1Adapter::Layer::setTransform(Transform transform) {
     mTransform = transform;
+    mStateDirty = true;
     mDisplay.markGeometryChanged();
     return Error::None;
 }
@@ -2008,6 +2110,7 @@ Error HWC2On1Adapter::Layer::setTransform(Transform transform) {
 Error HWC2On1Adapter::Layer::setVisibleRegion(hwc_region_t visible) {
     mVisibleRegion.resize(visible.numRects);
     std::copy_n(visible.rects, visible.numRects, mVisibleRegion.begin());
+    mStateDirty = true;
     mDisplay.markGeometryChanged();
     return Error::None;
 }
@@ -2027,7 +2130,12 @@ const sp<MiniFence>& HWC2On1Adapter::Layer::getReleaseFence() const {
 }
 
 void HWC2On1Adapter::Layer::applyState(hwc_layer_1_t& hwc1Layer) {
-    applyCommonState(hwc1Layer);
+    if (mStateDirty) {
+        applyCommonState(hwc1Layer);
+        mStateDirty = false;
+    }
+    // HWC1 writes its hints back to the contents during prepare
+    hwc1Layer.hints = 0;
     applyCompositionType(hwc1Layer);
     switch (mCompositionType) {
         case Composition::SolidColor : applySolidColorState(hwc1Layer); break;
@@ -2036,6 +2144,16 @@ void HWC2On1Adapter::Layer::applyState(hwc_layer_1_t& hwc1Layer) {
     }
 }
 
+void HWC2On1Adapter::Layer::applyBufferUpdate(hwc_layer_1_t& hwc1Layer) {
+    hwc1Layer.releaseFenceFd = -1;
+    hwc1Layer.acquireFenceFd = -1;
+    switch (mCompositionType) {
+        case Composition::SolidColor: break;
+        case Composition::Sideband: applySidebandState(hwc1Layer); break;
+        default: applyBufferState(hwc1Layer); break;
+    }
+}
+
 static std::string regionStrings(const std::vector<hwc_rect_t>& visibleRegion,
         const std::vector<hwc_rect_t>& surfaceDamage) {
     std::string regions;
@@ -2133,9 +2251,14 @@ void HWC2On1Adapter::Layer::applyCommonState(hwc_layer_1_t& hwc1Layer) {
 
     hwc1Layer.transform = static_cast<uint32_t>(mTransform);
 
+    // When the contents are updated in place the display made sure the rect
+    // count didn't change, so the rects from the previous frame are reused
     auto& hwc1VisibleRegion = hwc1Layer.visibleRegionScreen;
+    hwc_rect_t* rects = const_cast<hwc_rect_t*>(hwc1VisibleRegion.rects);
+    if (rects == nullptr) {
+        rects = mDisplay.GetRects(mVisibleRegion.size());
+    }
     hwc1VisibleRegion.numRects = mVisibleRegion.size();
-    hwc_rect_t* rects = mDisplay.GetRects(hwc1VisibleRegion.numRects);
     hwc1VisibleRegion.rects = rects;
     for (size_t i = 0; i < mVisibleRegion.size(); i++) {
         rects[i] = mVisibleRegion[i];
@@ -2251,6 +2374,9 @@ void HWC2On1Adapter::populateCapabilities() {
     // HWC2 present fences when they are deferred, but it's not very reliable.
     // To be safe, we indicate PresentFenceIsNotReliable for all HWC1 devices.
     mCapabilities.insert(Capability::PresentFenceIsNotReliable);
+
+    // present() falls back to NotValidated whenever HWC1 needs a prepare.
+    mCapabilities.insert(Capability::SkipValidate);
 }
 
 HWC2On1Adapter::Display* HWC2On1Adapter::getDisplay(hwc2_display_t id) {
@@ -2482,6 +2608,50 @@ Error HWC2On1Adapter::setAllDisplays() {
         }
     }
 
+    commitHwc1Contents();
+
+    return Error::None;
+}
+
+Error HWC2On1Adapter::presentWithoutValidate() {
+    ATRACE_CALL();
+
+    std::unique_lock<std::recursive_timed_mutex> lock(mStateMutex);
+
+    if (mHwc1Contents.empty()) {
+        return Error::NotValidated;
+    }
+
+    // HWC1 sets all displays at once, so every one of them has to be able to
+    // reuse its last prepare result
+    std::vector<Display*> displays;
+    for (size_t hwc1Id = 0; hwc1Id < mHwc1Contents.size(); ++hwc1Id) {
+        if (mHwc1DisplayMap.count(hwc1Id) == 0) {
+            if (mHwc1Contents[hwc1Id] != nullptr) {
+                return Error::NotValidated;
+            }
+            continue;
+        }
+
+        auto display = mDisplays.find(mHwc1DisplayMap[hwc1Id]);
+        if (display == mDisplays.end() ||
+                display->second->getDisplayContents() != mHwc1Contents[hwc1Id] ||
+                !display->second->canSkipValidate()) {
+            return Error::NotValidated;
+        }
+        displays.push_back(display->second.get());
+    }
+
+    for (auto display : displays) {
+        display->refreshBuffers();
+    }
+
+    commitHwc1Contents();
+
+    return Error::None;
+}
+
+void HWC2On1Adapter::commitHwc1Contents() {
     ALOGV("Calling HWC1 set");
     {
         ATRACE_NAME("HWC1 set");
@@ -2504,8 +2674,6 @@ Error HWC2On1Adapter::setAllDisplays() {
         display->addRetireFence(mHwc1Contents[hwc1Id]->retireFenceFd);
         display->addReleaseFences(*mHwc1Contents[hwc1Id]);
     }
-
-    return Error::None;
 }
 
 void HWC2On1Adapter::hwc1Invalidate() {
@@ -224,9 +224,14 @@ private:
 
             // Since HWC1 "presents" (called "set" in HWC1) all Displays
             // at once, the first call to any Display::present will trigger
-            // present() on all Displays in the Device. Subsequent calls without
-            // first calling validate() are noop (except for duping/returning
-            // the retire fence).
+            // present() on all Displays in the Device. Subsequent calls on
+            // the other Displays are noop (except for duping/returning the
+            // retire fence).
+            //
+            // If present() is called without validate(), the new buffers are
+            // presented with the composition HWC1 chose during the last
+            // prepare, provided nothing else changed on any Display.
+            // Otherwise it returns NotValidated.
             HWC2::Error present(int32_t* outRetireFence);
 
             HWC2::Error setActiveConfig(hwc2_config_t configId);
@@ -264,6 +269,14 @@ private:
 
             bool hasChanges() const;
             HWC2::Error set(hwc_display_contents_1& hwcContents);
+
+            // True if the contents HWC1 prepared last can be set again with
+            // new buffers, without calling prepare.
+            bool canSkipValidate() const;
+
+            // Write the new buffers and fences to the contents HWC1 prepared
+            // last, keeping the composition types it chose.
+            void refreshBuffers();
             void addRetireFence(int fenceFd);
             void addReleaseFences(const hwc_display_contents_1& hwcContents);
 
@@ -413,6 +426,11 @@ private:
             // mHwc1RequestedContents.
             void allocateRequestedContents();
 
+            // True if the contents sent to HWC1 last frame can be updated in
+            // place: same layers in the same order, and no layer needs more
+            // or fewer rects than it was given.
+            bool canUpdateContentsInPlace() const;
+
             // Array of structs exchanged between client and hwc1 device.
             // Sent to device upon calling prepare().
             std::unique_ptr<hwc_display_contents_1> mHwc1RequestedContents;
@@ -458,6 +476,15 @@ private:
             // updated with anything other than a buffer since last call to
             // Display::set()
             bool mGeometryChanged;
+
+            // True if layers were added, removed or reordered since the HWC1
+            // contents were last allocated, in which case they are rebuilt
+            bool mLayersChanged;
+
+            // True once HWC1 set was called with this display's contents on
+            // behalf of another display, until present() is called on this
+            // one
+            bool mAlreadyPresented;
     };
 
     // Utility template calling a Display object method directly based on the
@@ -560,9 +587,19 @@ private:
             void setHwc1Id(size_t id) { mHwc1Id = id; }
             size_t getHwc1Id() const { return mHwc1Id; }
 
-            // Write state to HWC1 communication struct.
+            // Write state to HWC1 communication struct. Only the per-frame
+            // state is written unless the layer was marked dirty.
             void applyState(struct hwc_layer_1& hwc1Layer);
 
+            // Write the buffer and fences only, leaving the composition type
+            // HWC1 wrote back during prepare untouched.
+            void applyBufferUpdate(struct hwc_layer_1& hwc1Layer);
+
+            // Must be called when the HWC1 communication struct of this
+            // layer was reallocated.
+            void markStateDirty() { mStateDirty = true; }
+            bool isStateDirty() const { return mStateDirty; }
+
             std::string dump() const;
 
             std::size_t getNumVisibleRegions() { return mVisibleRegion.size(); }
@@ -605,6 +642,10 @@ private:
 
             size_t mHwc1Id;
             bool mHasUnsupportedPlaneAlpha;
+
+            // True if any state other than the buffer changed since it was
+            // last applied to the HWC1 communication struct
+            bool mStateDirty;
     };
 
     // Utility tempate calling a Layer object method based on ID parameters:
@@ -679,6 +720,15 @@ private:
     std::vector<struct hwc_display_contents_1*> mHwc1Contents;
     HWC2::Error setAllDisplays();
 
+    // Calls HWC1 set again with the contents of the last prepare, updated
+    // with new buffers. Returns NotValidated if any display needs to be
+    // prepared first.
+    HWC2::Error presentWithoutValidate();
+
+    // Calls HWC1 set with mHwc1Contents and hands the resulting fences out
+    // to the displays.
+    void commitHwc1Contents();
+
     // Callbacks
     void hwc1Invalidate();
     void hwc1Vsync(int hwc1DisplayId, int64_t timestamp);
@@ -242,8 +242,7 @@ void MotionEvent::initialize(
     mXPrecision = xPrecision;
     mYPrecision = yPrecision;
     mDownTime = downTime;
-    mPointerProperties.clear();
-    mPointerProperties.appendArray(pointerProperties, pointerCount);
+    mPointerProperties.assign(pointerProperties, pointerProperties + pointerCount);
     mSampleEventTimes.clear();
     mSamplePointerCoords.clear();
     addSample(eventTime, pointerCoords);
@@ -268,21 +267,27 @@ void MotionEvent::copyFrom(const MotionEvent* other, bool keepHistory) {
         mSampleEventTimes = other->mSampleEventTimes;
         mSamplePointerCoords = other->mSamplePointerCoords;
     } else {
-        mSampleEventTimes.clear();
-        mSampleEventTimes.push(other->getEventTime());
-        mSamplePointerCoords.clear();
+        mSampleEventTimes.assign(1, other->getEventTime());
         size_t pointerCount = other->getPointerCount();
         size_t historySize = other->getHistorySize();
-        mSamplePointerCoords.appendArray(other->mSamplePointerCoords.array()
-                + (historySize * pointerCount), pointerCount);
+        const PointerCoords* pointerCoords = other->mSamplePointerCoords.data()
+                + (historySize * pointerCount);
+        mSamplePointerCoords.assign(pointerCoords, pointerCoords + pointerCount);
     }
 }
 
 void MotionEvent::addSample(
         int64_t eventTime,
         const PointerCoords* pointerCoords) {
-    mSampleEventTimes.push(eventTime);
-    mSamplePointerCoords.appendArray(pointerCoords, getPointerCount());
+    mSampleEventTimes.push_back(eventTime);
+    mSamplePointerCoords.insert(mSamplePointerCoords.end(),
+            pointerCoords, pointerCoords + getPointerCount());
+}
+
+void MotionEvent::reserveSamples(size_t sampleCount, size_t pointerCount) {
+    mPointerProperties.reserve(pointerCount);
+    mSampleEventTimes.reserve(sampleCount);
+    mSamplePointerCoords.reserve(sampleCount * pointerCount);
 }
 
 const PointerCoords* MotionEvent::getRawPointerCoords(size_t pointerIndex) const {
@@ -329,7 +334,7 @@ float MotionEvent::getHistoricalAxisValue(int32_t axis, size_t pointerIndex,
 ssize_t MotionEvent::findPointerIndex(int32_t pointerId) const {
     size_t pointerCount = mPointerProperties.size();
     for (size_t i = 0; i < pointerCount; i++) {
-        if (mPointerProperties.itemAt(i).id == pointerId) {
+        if (mPointerProperties[i].id == pointerId) {
             return i;
         }
     }
@@ -349,7 +354,7 @@ void MotionEvent::scale(float scaleFactor) {
 
     size_t numSamples = mSamplePointerCoords.size();
     for (size_t i = 0; i < numSamples; i++) {
-        mSamplePointerCoords.editItemAt(i).scale(scaleFactor);
+        mSamplePointerCoords[i].scale(scaleFactor);
     }
 }
 
@@ -407,7 +412,7 @@ void MotionEvent::transform(const float matrix[9]) {
     // Apply the transformation to all samples.
     size_t numSamples = mSamplePointerCoords.size();
     for (size_t i = 0; i < numSamples; i++) {
-        PointerCoords& c = mSamplePointerCoords.editItemAt(i);
+        PointerCoords& c = mSamplePointerCoords[i];
         float x = c.getAxisValue(AMOTION_EVENT_AXIS_X) + oldXOffset;
         float y = c.getAxisValue(AMOTION_EVENT_AXIS_Y) + oldYOffset;
         transformPoint(matrix, x, y, &x, &y);
@@ -444,25 +449,25 @@ status_t MotionEvent::readFromParcel(Parcel* parcel) {
     mDownTime = parcel->readInt64();
 
     mPointerProperties.clear();
-    mPointerProperties.setCapacity(pointerCount);
+    mPointerProperties.reserve(pointerCount);
     mSampleEventTimes.clear();
-    mSampleEventTimes.setCapacity(sampleCount);
+    mSampleEventTimes.reserve(sampleCount);
     mSamplePointerCoords.clear();
-    mSamplePointerCoords.setCapacity(sampleCount * pointerCount);
+    mSamplePointerCoords.reserve(sampleCount * pointerCount);
 
     for (size_t i = 0; i < pointerCount; i++) {
-        mPointerProperties.push();
-        PointerProperties& properties = mPointerProperties.editTop();
+        mPointerProperties.push_back(PointerProperties());
+        PointerProperties& properties = mPointerProperties.back();
         properties.id = parcel->readInt32();
         properties.toolType = parcel->readInt32();
     }
 
     while (sampleCount > 0) {
         sampleCount--;
-        mSampleEventTimes.push(parcel->readInt64());
+        mSampleEventTimes.push_back(parcel->readInt64());
         for (size_t i = 0; i < pointerCount; i++) {
-            mSamplePointerCoords.push();
-            status_t status = mSamplePointerCoords.editTop().readFromParcel(parcel);
+            mSamplePointerCoords.push_back(PointerCoords());
+            status_t status = mSamplePointerCoords.back().readFromParcel(parcel);
             if (status) {
                 return status;
             }
@@ -493,14 +498,14 @@ status_t MotionEvent::writeToParcel(Parcel* parcel) const {
     parcel->writeInt64(mDownTime);
 
     for (size_t i = 0; i < pointerCount; i++) {
-        const PointerProperties& properties = mPointerProperties.itemAt(i);
+        const PointerProperties& properties = mPointerProperties[i];
         parcel->writeInt32(properties.id);
         parcel->writeInt32(properties.toolType);
     }
 
-    const PointerCoords* pc = mSamplePointerCoords.array();
+    const PointerCoords* pc = mSamplePointerCoords.data();
     for (size_t h = 0; h < sampleCount; h++) {
-        parcel->writeInt64(mSampleEventTimes.itemAt(h));
+        parcel->writeInt64(mSampleEventTimes[h]);
         for (size_t i = 0; i < pointerCount; i++) {
             status_t status = (pc++)->writeToParcel(parcel);
             if (status) {
@@ -568,7 +573,9 @@ MotionEvent* PooledInputEventFactory::createMotionEvent() {
         mMotionEventPool.pop();
         return event;
     }
-    return new MotionEvent();
+    MotionEvent* event = new MotionEvent();
+    event->reserveSamples(RESERVED_MOTION_SAMPLES, RESERVED_MOTION_POINTERS);
+    return event;
 }
 
 void PooledInputEventFactory::recycle(InputEvent* event) {
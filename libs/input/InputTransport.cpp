@@ -4,6 +4,7 @@
 // Provides a shared memory transport for input events.
 //
 #define LOG_TAG "InputTransport"
+#define ATRACE_TAG ATRACE_TAG_INPUT
 
 //#define LOG_NDEBUG 0
 
@@ -19,16 +20,25 @@
 // Log debug messages about touch event resampling
 #define DEBUG_RESAMPLING 0
 
+// Log debug messages about touch prediction accuracy
+#define DEBUG_PREDICTION 0
+
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
 #include <math.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <atomic>
+
+#include <cutils/ashmem.h>
 #include <cutils/properties.h>
 #include <log/log.h>
+#include <utils/Trace.h>
 
 #include <input/InputTransport.h>
 
@@ -40,6 +50,13 @@ namespace android {
 // behind processing touches.
 static const size_t SOCKET_BUFFER_SIZE = 32 * 1024;
 
+// Number of messages each of the shared memory rings of a channel holds.  Matches what
+// the socket buffer holds of two finger motion events, give or take.
+static const uint32_t RING_SLOT_COUNT = 32;
+
+// Upper bound on the slot count a client accepts from the server end.
+static const uint32_t MAX_RING_SLOT_COUNT = 1024;
+
 // Nanoseconds per milliseconds.
 static const nsecs_t NANOS_PER_MS = 1000000;
 
@@ -58,6 +75,9 @@ static const nsecs_t RESAMPLE_MAX_DELTA = 20 * NANOS_PER_MS;
 // far into the future.  This time is further bounded by 50% of the last time delta.
 static const nsecs_t RESAMPLE_MAX_PREDICTION = 8 * NANOS_PER_MS;
 
+// Upper bound on the horizon of predictMotion(), about two frames.
+static const nsecs_t PREDICTION_MAX_HORIZON = 32 * NANOS_PER_MS;
+
 template<typename T>
 inline static T min(const T& a, const T& b) {
     return a < b ? a : b;
@@ -79,6 +99,11 @@ bool InputMessage::isValid(size_t actualSize) const {
                     && body.motion.pointerCount <= MAX_POINTERS;
         case TYPE_FINISHED:
             return true;
+        case TYPE_DOORBELL:
+            return true;
+        case TYPE_RING_SETUP:
+            return body.ringSetup.slotCount > 0
+                    && body.ringSetup.slotCount <= MAX_RING_SLOT_COUNT;
         }
     }
     return false;
@@ -92,15 +117,162 @@ size_t InputMessage::size() const {
         return sizeof(Header) + body.motion.size();
     case TYPE_FINISHED:
         return sizeof(Header) + body.finished.size();
+    case TYPE_RING_SETUP:
+        return sizeof(Header) + body.ringSetup.size();
     }
     return sizeof(Header);
 }
 
 
+// --- InputChannel::SharedRing ---
+
+/*
+ * Two rings of InputMessages in one ashmem region: ring 0 from the server end to the client,
+ * ring 1 back.  The peer can write anything to the region, so indices are checked and
+ * messages are validated after they are copied out.
+ */
+class InputChannel::SharedRing : public RefBase {
+public:
+    static sp<SharedRing> create(const String8& name, uint32_t slotCount, int* outFd) {
+        size_t size = regionSize(slotCount);
+        int fd = ashmem_create_region(name.string(), size);
+        if (fd < 0) {
+            return NULL;
+        }
+        sp<SharedRing> ring = map(fd, slotCount);
+        if (ring == NULL) {
+            ::close(fd);
+            return NULL;
+        }
+        // Nobody has looked at either ring yet, so the first message rings the doorbell.
+        ring->indices(0).consumerWaiting.store(1);
+        ring->indices(1).consumerWaiting.store(1);
+        *outFd = fd;
+        return ring;
+    }
+
+    static sp<SharedRing> map(int fd, uint32_t slotCount) {
+        size_t size = regionSize(slotCount);
+        int actualSize = ashmem_get_size_region(fd);
+        if (actualSize < 0 || size_t(actualSize) < size) {
+            return NULL;
+        }
+        void* base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED) {
+            return NULL;
+        }
+        return new SharedRing(base, size, slotCount);
+    }
+
+    status_t push(int ring, const InputMessage* msg, bool* outWakeConsumer) {
+        Indices& r = indices(ring);
+        uint32_t tail = r.tail.load(std::memory_order_relaxed);
+        uint32_t used = tail - r.head.load(std::memory_order_acquire);
+        if (used > mSlotCount) {
+            return UNKNOWN_ERROR;
+        }
+        if (used == mSlotCount) {
+            return WOULD_BLOCK;
+        }
+        Slot& slot = slots(ring)[tail % mSlotCount];
+        slot.size = uint32_t(msg->size());
+        memcpy(&slot.message, msg, slot.size);
+        r.tail.store(tail + 1);
+        // Paired with the store of consumerWaiting and reload of tail in armDoorbell.
+        *outWakeConsumer = r.consumerWaiting.exchange(0) != 0;
+        return OK;
+    }
+
+    status_t pop(int ring, InputMessage* msg) {
+        Indices& r = indices(ring);
+        uint32_t head = r.head.load(std::memory_order_relaxed);
+        uint32_t available = r.tail.load(std::memory_order_acquire) - head;
+        if (available == 0) {
+            return WOULD_BLOCK;
+        }
+        if (available > mSlotCount) {
+            return BAD_VALUE;
+        }
+        const Slot& slot = slots(ring)[head % mSlotCount];
+        size_t size = slot.size;
+        if (size > sizeof(InputMessage)) {
+            return BAD_VALUE;
+        }
+        memcpy(msg, &slot.message, size);
+        r.head.store(head + 1, std::memory_order_release);
+        if (!msg->isValid(size) || msg->header.type == InputMessage::TYPE_DOORBELL
+                || msg->header.type == InputMessage::TYPE_RING_SETUP) {
+            return BAD_VALUE;
+        }
+        return OK;
+    }
+
+    // Asks the producer for a doorbell with the next message.  Returns true if a message
+    // got in ahead of that, in which case the caller should look again rather than wait.
+    bool armDoorbell(int ring) {
+        Indices& r = indices(ring);
+        r.consumerWaiting.store(1);
+        return r.tail.load() != r.head.load(std::memory_order_relaxed);
+    }
+
+    void disarmDoorbell(int ring) {
+        indices(ring).consumerWaiting.store(0, std::memory_order_relaxed);
+    }
+
+protected:
+    virtual ~SharedRing() {
+        munmap(mBase, mSize);
+    }
+
+private:
+    // On a cache line of its own, ahead of the slots.
+    struct Indices {
+        std::atomic<uint32_t> head; // next slot the consumer reads
+        std::atomic<uint32_t> tail; // next slot the producer writes
+        std::atomic<uint32_t> consumerWaiting; // the consumer wants a doorbell
+        uint32_t padding[13];
+    };
+
+    struct Slot {
+        uint32_t size;
+        uint32_t padding;
+        InputMessage message;
+    };
+
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t)
+            && sizeof(Indices) == 64, "ring indices must be shareable across processes");
+
+    void* mBase;
+    size_t mSize;
+    uint32_t mSlotCount;
+
+    SharedRing(void* base, size_t size, uint32_t slotCount) :
+            mBase(base), mSize(size), mSlotCount(slotCount) {
+    }
+
+    static size_t ringSize(uint32_t slotCount) {
+        return sizeof(Indices) + sizeof(Slot) * slotCount;
+    }
+
+    static size_t regionSize(uint32_t slotCount) {
+        return ringSize(slotCount) * 2;
+    }
+
+    Indices& indices(int ring) {
+        uint8_t* base = static_cast<uint8_t*>(mBase) + ringSize(mSlotCount) * ring;
+        return *reinterpret_cast<Indices*>(base);
+    }
+
+    Slot* slots(int ring) {
+        return reinterpret_cast<Slot*>(&indices(ring) + 1);
+    }
+};
+
+
 // --- InputChannel ---
 
 InputChannel::InputChannel(const String8& name, int fd) :
-        mName(name), mFd(fd) {
+        mName(name), mFd(fd), mIsServer(false) {
 #if DEBUG_CHANNEL_LIFECYCLE
     ALOGD("Input channel constructed: name='%s', fd=%d",
             mName.string(), fd);
@@ -122,6 +294,13 @@ InputChannel::~InputChannel() {
 
 status_t InputChannel::openInputChannelPair(const String8& name,
         sp<InputChannel>& outServerChannel, sp<InputChannel>& outClientChannel) {
+    return openInputChannelPair(name, outServerChannel, outClientChannel,
+            property_get_bool("input.channel.shared_memory", false));
+}
+
+status_t InputChannel::openInputChannelPair(const String8& name,
+        sp<InputChannel>& outServerChannel, sp<InputChannel>& outClientChannel,
+        bool useSharedMemory) {
     int sockets[2];
     if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sockets)) {
         status_t result = -errno;
@@ -145,14 +324,92 @@ status_t InputChannel::openInputChannelPair(const String8& name,
     String8 clientChannelName = name;
     clientChannelName.append(" (client)");
     outClientChannel = new InputChannel(clientChannelName, sockets[1]);
+    outServerChannel->mIsServer = true;
+
+    if (useSharedMemory) {
+        // Falls back to the socket alone if the rings can't be set up.
+        int ringFd;
+        sp<SharedRing> ring = SharedRing::create(name, RING_SLOT_COUNT, &ringFd);
+        if (ring == NULL) {
+            ALOGW("channel '%s' ~ Could not create shared memory rings, using the socket.",
+                    name.string());
+            return OK;
+        }
+        InputMessage setup;
+        setup.header.type = InputMessage::TYPE_RING_SETUP;
+        setup.body.ringSetup.slotCount = RING_SLOT_COUNT;
+        status_t result = outServerChannel->sendSocketMessage(&setup, ringFd);
+        ::close(ringFd);
+        if (result) {
+            ALOGW("channel '%s' ~ Could not send shared memory rings, using the socket.  "
+                    "status=%d", name.string(), result);
+            return OK;
+        }
+        outServerChannel->mRing = ring;
+    }
     return OK;
 }
 
 status_t InputChannel::sendMessage(const InputMessage* msg) {
+    if (mRing == NULL) {
+        return sendSocketMessage(msg, -1);
+    }
+
+    bool wakeConsumer;
+    status_t result = mRing->push(mIsServer ? 0 : 1, msg, &wakeConsumer);
+    if (result) {
+#if DEBUG_CHANNEL_MESSAGES
+        ALOGD("channel '%s' ~ error sending message of type %d to the ring, status=%d",
+                mName.string(), msg->header.type, result);
+#endif
+        return result;
+    }
+
+    if (wakeConsumer) {
+        // A doorbell that doesn't fit is already waiting in the socket, and one is enough.
+        InputMessage doorbell;
+        doorbell.header.type = InputMessage::TYPE_DOORBELL;
+        result = sendSocketMessage(&doorbell, -1);
+        if (result && result != WOULD_BLOCK) {
+            return result;
+        }
+    }
+
+#if DEBUG_CHANNEL_MESSAGES
+    ALOGD("channel '%s' ~ sent message of type %d to the ring", mName.string(),
+            msg->header.type);
+#endif
+    return OK;
+}
+
+status_t InputChannel::sendSocketMessage(const InputMessage* msg, int fdToSend) {
     size_t msgLength = msg->size();
+    struct iovec iov;
+    iov.iov_base = const_cast<InputMessage*>(msg);
+    iov.iov_len = msgLength;
+
+    union {
+        struct cmsghdr header;
+        char buffer[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr msgHeader;
+    memset(&msgHeader, 0, sizeof(msgHeader));
+    msgHeader.msg_iov = &iov;
+    msgHeader.msg_iovlen = 1;
+    if (fdToSend >= 0) {
+        memset(&control, 0, sizeof(control));
+        msgHeader.msg_control = control.buffer;
+        msgHeader.msg_controllen = sizeof(control.buffer);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msgHeader);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fdToSend, sizeof(int));
+    }
+
     ssize_t nWrite;
     do {
-        nWrite = ::send(mFd, msg, msgLength, MSG_DONTWAIT | MSG_NOSIGNAL);
+        nWrite = ::sendmsg(mFd, &msgHeader, MSG_DONTWAIT | MSG_NOSIGNAL);
     } while (nWrite == -1 && errno == EINTR);
 
     if (nWrite < 0) {
@@ -185,11 +442,103 @@ status_t InputChannel::sendMessage(const InputMessage* msg) {
 }
 
 status_t InputChannel::receiveMessage(InputMessage* msg) {
+    const int ring = mIsServer ? 1 : 0;
+    for (;;) {
+        if (mRing != NULL) {
+            status_t result = mRing->pop(ring, msg);
+            if (result != WOULD_BLOCK) {
+#if DEBUG_CHANNEL_MESSAGES
+                ALOGD("channel '%s' ~ received message of type %d from the ring, status=%d",
+                        mName.string(), msg->header.type, result);
+#endif
+                return result;
+            }
+        }
+
+        int fd = -1;
+        status_t result = receiveSocketMessage(msg, &fd);
+        if (result == OK && msg->header.type == InputMessage::TYPE_RING_SETUP) {
+            result = attachRing(msg, fd);
+            if (result) {
+                return result;
+            }
+            continue;
+        }
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        if (result == OK && msg->header.type == InputMessage::TYPE_DOORBELL) {
+            continue;
+        }
+        if (result == WOULD_BLOCK && mRing != NULL && mRing->armDoorbell(ring)) {
+            // A message got in before the doorbell was armed; the producer may not ring
+            // for it.
+            mRing->disarmDoorbell(ring);
+            continue;
+        }
+        return result;
+    }
+}
+
+status_t InputChannel::attachRing(const InputMessage* msg, int fd) {
+    if (mIsServer || mRing != NULL || fd < 0) {
+        ALOGE("channel '%s' ~ received an unexpected shared memory setup", mName.string());
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        return BAD_VALUE;
+    }
+    mRing = SharedRing::map(fd, msg->body.ringSetup.slotCount);
+    ::close(fd);
+    if (mRing == NULL) {
+        ALOGE("channel '%s' ~ could not map the shared memory rings", mName.string());
+        return BAD_VALUE;
+    }
+#if DEBUG_CHANNEL_LIFECYCLE
+    ALOGD("channel '%s' ~ attached to shared memory rings", mName.string());
+#endif
+    return OK;
+}
+
+status_t InputChannel::receiveSocketMessage(InputMessage* msg, int* outFd) {
+    struct iovec iov;
+    iov.iov_base = msg;
+    iov.iov_len = sizeof(InputMessage);
+
+    union {
+        struct cmsghdr header;
+        char buffer[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr msgHeader;
+    memset(&msgHeader, 0, sizeof(msgHeader));
+    msgHeader.msg_iov = &iov;
+    msgHeader.msg_iovlen = 1;
+    msgHeader.msg_control = control.buffer;
+    msgHeader.msg_controllen = sizeof(control.buffer);
+
     ssize_t nRead;
     do {
-        nRead = ::recv(mFd, msg, sizeof(InputMessage), MSG_DONTWAIT);
+        nRead = ::recvmsg(mFd, &msgHeader, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
     } while (nRead == -1 && errno == EINTR);
 
+    if (nRead >= 0) {
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msgHeader); cmsg != NULL;
+                cmsg = CMSG_NXTHDR(&msgHeader, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+                size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                for (size_t i = 0; i < count; i++) {
+                    int fd;
+                    memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+                    if (*outFd < 0) {
+                        *outFd = fd;
+                    } else {
+                        ::close(fd);
+                    }
+                }
+            }
+        }
+    }
+
     if (nRead < 0) {
         int error = errno;
 #if DEBUG_CHANNEL_MESSAGES
@@ -226,7 +575,13 @@ status_t InputChannel::receiveMessage(InputMessage* msg) {
 
 sp<InputChannel> InputChannel::dup() const {
     int fd = ::dup(getFd());
-    return fd >= 0 ? new InputChannel(getName(), fd) : NULL;
+    if (fd < 0) {
+        return NULL;
+    }
+    sp<InputChannel> channel = new InputChannel(getName(), fd);
+    channel->mRing = mRing;
+    channel->mIsServer = mIsServer;
+    return channel;
 }
 
 
@@ -374,10 +729,16 @@ status_t InputPublisher::receiveFinishedSignal(uint32_t* outSeq, bool* outHandle
 
 InputConsumer::InputConsumer(const sp<InputChannel>& channel) :
         mResampleTouch(isTouchResamplingEnabled()),
+        mPredictionHorizon(getTouchPredictionHorizon()),
+        mPredictionStrategy(getTouchPredictionStrategy()),
         mChannel(channel), mMsgDeferred(false) {
+    mPredictionAccuracy.clear();
 }
 
 InputConsumer::~InputConsumer() {
+    for (size_t i = 0; i < mPredictions.size(); i++) {
+        delete mPredictions.itemAt(i).predictor;
+    }
 }
 
 bool InputConsumer::isTouchResamplingEnabled() {
@@ -395,6 +756,20 @@ bool InputConsumer::isTouchResamplingEnabled() {
     return true;
 }
 
+nsecs_t InputConsumer::getTouchPredictionHorizon() {
+    nsecs_t horizon = property_get_int32("debug.input.prediction.horizon_ms", 0) * NANOS_PER_MS;
+    if (horizon <= 0) {
+        return 0;
+    }
+    return horizon < PREDICTION_MAX_HORIZON ? horizon : PREDICTION_MAX_HORIZON;
+}
+
+String8 InputConsumer::getTouchPredictionStrategy() {
+    char value[PROPERTY_VALUE_MAX];
+    property_get("debug.input.prediction.strategy", value, "lsq2");
+    return String8(value);
+}
+
 status_t InputConsumer::consume(InputEventFactoryInterface* factory,
         bool consumeBatches, nsecs_t frameTime, uint32_t* outSeq, InputEvent** outEvent) {
 #if DEBUG_TRANSPORT_ACTIONS
@@ -449,9 +824,9 @@ status_t InputConsumer::consume(InputEventFactoryInterface* factory,
         case AINPUT_EVENT_TYPE_MOTION: {
             ssize_t batchIndex = findBatch(mMsg.body.motion.deviceId, mMsg.body.motion.source);
             if (batchIndex >= 0) {
-                Batch& batch = mBatches.editItemAt(batchIndex);
+                Batch& batch = mBatches[batchIndex];
                 if (canAddSample(batch, &mMsg)) {
-                    batch.samples.push(mMsg);
+                    batch.samples.push_back(mMsg);
 #if DEBUG_TRANSPORT_ACTIONS
                     ALOGD("channel '%s' consumer ~ appended to batch event",
                             mChannel->getName().string());
@@ -463,7 +838,7 @@ status_t InputConsumer::consume(InputEventFactoryInterface* factory,
                     mMsgDeferred = true;
                     status_t result = consumeSamples(factory,
                             batch, batch.samples.size(), outSeq, outEvent);
-                    mBatches.removeAt(batchIndex);
+                    removeBatch(batchIndex);
                     if (result) {
                         return result;
                     }
@@ -479,9 +854,8 @@ status_t InputConsumer::consume(InputEventFactoryInterface* factory,
             // Start a new batch if needed.
             if (mMsg.body.motion.action == AMOTION_EVENT_ACTION_MOVE
                     || mMsg.body.motion.action == AMOTION_EVENT_ACTION_HOVER_MOVE) {
-                mBatches.push();
-                Batch& batch = mBatches.editTop();
-                batch.samples.push(mMsg);
+                Batch& batch = addBatch();
+                batch.samples.push_back(mMsg);
 #if DEBUG_TRANSPORT_ACTIONS
                 ALOGD("channel '%s' consumer ~ started batch event",
                         mChannel->getName().string());
@@ -494,6 +868,7 @@ status_t InputConsumer::consume(InputEventFactoryInterface* factory,
 
             updateTouchState(&mMsg);
             initializeMotionEvent(motionEvent, &mMsg);
+            updatePrediction(motionEvent);
             *outSeq = mMsg.body.motion.seq;
             *outEvent = motionEvent;
 #if DEBUG_TRANSPORT_ACTIONS
@@ -509,19 +884,36 @@ status_t InputConsumer::consume(InputEventFactoryInterface* factory,
             return UNKNOWN_ERROR;
         }
     }
+    traceConsumeLatency(*outEvent);
     return OK;
 }
 
+void InputConsumer::traceConsumeLatency(const InputEvent* event) {
+    if (!ATRACE_ENABLED()) {
+        return;
+    }
+    // From the evdev timestamp of the oldest sample the app is handed, which is
+    // where the dispatcher's latency stats in dumpsys input also start from.
+    nsecs_t eventTime;
+    if (event->getType() == AINPUT_EVENT_TYPE_KEY) {
+        eventTime = static_cast<const KeyEvent*>(event)->getEventTime();
+    } else {
+        eventTime = static_cast<const MotionEvent*>(event)->getHistoricalEventTime(0);
+    }
+    nsecs_t latency = systemTime(SYSTEM_TIME_MONOTONIC) - eventTime;
+    ATRACE_INT("input_consume_us", latency > 0 ? int32_t(latency / 1000) : 0);
+}
+
 status_t InputConsumer::consumeBatch(InputEventFactoryInterface* factory,
         nsecs_t frameTime, uint32_t* outSeq, InputEvent** outEvent) {
     status_t result;
     for (size_t i = mBatches.size(); i > 0; ) {
         i--;
-        Batch& batch = mBatches.editItemAt(i);
+        Batch& batch = mBatches[i];
         if (frameTime < 0) {
             result = consumeSamples(factory, batch, batch.samples.size(),
                     outSeq, outEvent);
-            mBatches.removeAt(i);
+            removeBatch(i);
             return result;
         }
 
@@ -536,11 +928,11 @@ status_t InputConsumer::consumeBatch(InputEventFactoryInterface* factory,
 
         result = consumeSamples(factory, batch, split + 1, outSeq, outEvent);
         const InputMessage* next;
-        if (batch.samples.isEmpty()) {
-            mBatches.removeAt(i);
+        if (batch.samples.empty()) {
+            removeBatch(i);
             next = NULL;
         } else {
-            next = &batch.samples.itemAt(0);
+            next = &batch.samples[0];
         }
         if (!result && mResampleTouch) {
             resampleTouchState(sampleTime, static_cast<MotionEvent*>(*outEvent), next);
@@ -558,20 +950,21 @@ status_t InputConsumer::consumeSamples(InputEventFactoryInterface* factory,
 
     uint32_t chain = 0;
     for (size_t i = 0; i < count; i++) {
-        InputMessage& msg = batch.samples.editItemAt(i);
+        InputMessage& msg = batch.samples[i];
         updateTouchState(&msg);
         if (i) {
             SeqChain seqChain;
             seqChain.seq = msg.body.motion.seq;
             seqChain.chain = chain;
-            mSeqChains.push(seqChain);
+            mSeqChains.push_back(seqChain);
             addSample(motionEvent, &msg);
         } else {
             initializeMotionEvent(motionEvent, &msg);
         }
         chain = msg.body.motion.seq;
     }
-    batch.samples.removeItemsAt(0, count);
+    batch.samples.erase(batch.samples.begin(), batch.samples.begin() + count);
+    updatePrediction(motionEvent);
 
     *outSeq = chain;
     *outEvent = motionEvent;
@@ -804,6 +1197,56 @@ void InputConsumer::resampleTouchState(nsecs_t sampleTime, MotionEvent* event,
     event->addSample(sampleTime, touchState.lastResample.pointers);
 }
 
+void InputConsumer::updatePrediction(const MotionEvent* event) {
+    if (!mPredictionHorizon || !(event->getSource() & AINPUT_SOURCE_CLASS_POINTER)) {
+        return;
+    }
+
+    // Fed before resampling, so that predictions only build on reported samples.
+    int32_t actionMasked = event->getActionMasked();
+    ssize_t index = findPrediction(event->getDeviceId(), event->getSource());
+    if (index < 0) {
+        if (actionMasked != AMOTION_EVENT_ACTION_DOWN) {
+            return;
+        }
+        Prediction prediction;
+        prediction.deviceId = event->getDeviceId();
+        prediction.source = event->getSource();
+        prediction.predictor = new TouchPredictor(mPredictionStrategy.string());
+        index = mPredictions.add(prediction);
+    }
+
+    TouchPredictor* predictor = mPredictions.itemAt(index).predictor;
+    predictor->addMovement(event);
+
+    if (actionMasked == AMOTION_EVENT_ACTION_UP
+            || actionMasked == AMOTION_EVENT_ACTION_CANCEL) {
+        const TouchPredictor::Accuracy& accuracy = predictor->getAccuracy();
+        mPredictionAccuracy.add(accuracy);
+        ATRACE_INT("input_prediction_error_px", int32_t(accuracy.getMeanError() + 0.5f));
+#if DEBUG_PREDICTION
+        ALOGD("channel '%s' consumer ~ gesture predictions: count=%u, mean error=%0.3f, "
+                "max error=%0.3f; overall mean error=%0.3f",
+                mChannel->getName().string(), accuracy.count, accuracy.getMeanError(),
+                accuracy.maxError, mPredictionAccuracy.getMeanError());
+#endif
+        delete predictor;
+        mPredictions.removeAt(index);
+    }
+}
+
+bool InputConsumer::predictMotion(const MotionEvent* event, MotionEvent* outPrediction) {
+    if (!mPredictionHorizon) {
+        return false;
+    }
+    ssize_t index = findPrediction(event->getDeviceId(), event->getSource());
+    if (index < 0) {
+        return false;
+    }
+    return mPredictions.itemAt(index).predictor->predict(event, mPredictionHorizon,
+            outPrediction);
+}
+
 bool InputConsumer::shouldResampleTool(int32_t toolType) {
     return toolType == AMOTION_EVENT_TOOL_TYPE_FINGER
             || toolType == AMOTION_EVENT_TOOL_TYPE_UNKNOWN;
@@ -828,11 +1271,11 @@ status_t InputConsumer::sendFinishedSignal(uint32_t seq, bool handled) {
         size_t chainIndex = 0;
         for (size_t i = seqChainCount; i > 0; ) {
              i--;
-             const SeqChain& seqChain = mSeqChains.itemAt(i);
+             const SeqChain& seqChain = mSeqChains[i];
              if (seqChain.seq == currentSeq) {
                  currentSeq = seqChain.chain;
                  chainSeqs[chainIndex++] = currentSeq;
-                 mSeqChains.removeAt(i);
+                 mSeqChains.erase(mSeqChains.begin() + i);
              }
         }
         status_t status = OK;
@@ -846,7 +1289,7 @@ status_t InputConsumer::sendFinishedSignal(uint32_t seq, bool handled) {
                 SeqChain seqChain;
                 seqChain.seq = chainIndex != 0 ? chainSeqs[chainIndex - 1] : seq;
                 seqChain.chain = chainSeqs[chainIndex];
-                mSeqChains.push(seqChain);
+                mSeqChains.push_back(seqChain);
                 if (chainIndex != 0) {
                     chainIndex--;
                 }
@@ -872,13 +1315,31 @@ bool InputConsumer::hasDeferredEvent() const {
 }
 
 bool InputConsumer::hasPendingBatch() const {
-    return !mBatches.isEmpty();
+    return !mBatches.empty();
+}
+
+InputConsumer::Batch& InputConsumer::addBatch() {
+    mBatches.push_back(Batch());
+    Batch& batch = mBatches.back();
+    if (!mSpareBatchSamples.empty()) {
+        batch.samples.swap(mSpareBatchSamples.back());
+        mSpareBatchSamples.pop_back();
+    }
+    return batch;
+}
+
+void InputConsumer::removeBatch(size_t index) {
+    std::vector<InputMessage>& samples = mBatches[index].samples;
+    samples.clear();
+    mSpareBatchSamples.push_back(std::vector<InputMessage>());
+    mSpareBatchSamples.back().swap(samples);
+    mBatches.erase(mBatches.begin() + index);
 }
 
 ssize_t InputConsumer::findBatch(int32_t deviceId, int32_t source) const {
     for (size_t i = 0; i < mBatches.size(); i++) {
-        const Batch& batch = mBatches.itemAt(i);
-        const InputMessage& head = batch.samples.itemAt(0);
+        const Batch& batch = mBatches[i];
+        const InputMessage& head = batch.samples[0];
         if (head.body.motion.deviceId == deviceId && head.body.motion.source == source) {
             return i;
         }
@@ -896,6 +1357,16 @@ ssize_t InputConsumer::findTouchState(int32_t deviceId, int32_t source) const {
     return -1;
 }
 
+ssize_t InputConsumer::findPrediction(int32_t deviceId, int32_t source) const {
+    for (size_t i = 0; i < mPredictions.size(); i++) {
+        const Prediction& prediction = mPredictions.itemAt(i);
+        if (prediction.deviceId == deviceId && prediction.source == source) {
+            return i;
+        }
+    }
+    return -1;
+}
+
 void InputConsumer::initializeKeyEvent(KeyEvent* event, const InputMessage* msg) {
     event->initialize(
             msg->body.key.deviceId,
@@ -951,7 +1422,7 @@ void InputConsumer::addSample(MotionEvent* event, const InputMessage* msg) {
 }
 
 bool InputConsumer::canAddSample(const Batch& batch, const InputMessage *msg) {
-    const InputMessage& head = batch.samples.itemAt(0);
+    const InputMessage& head = batch.samples[0];
     uint32_t pointerCount = msg->body.motion.pointerCount;
     if (head.body.motion.pointerCount != pointerCount
             || head.body.motion.action != msg->body.motion.action) {
@@ -970,7 +1441,7 @@ ssize_t InputConsumer::findSampleNoLaterThan(const Batch& batch, nsecs_t time) {
     size_t numSamples = batch.samples.size();
     size_t index = 0;
     while (index < numSamples
-            && batch.samples.itemAt(index).body.motion.eventTime <= time) {
+            && batch.samples[index].body.motion.eventTime <= time) {
         index += 1;
     }
     return ssize_t(index) - 1;
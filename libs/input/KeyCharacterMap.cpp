@@ -88,12 +88,12 @@ static String8 toString(const char16_t* chars, size_t numChars) {
 sp<KeyCharacterMap> KeyCharacterMap::sEmpty = new KeyCharacterMap();
 
 KeyCharacterMap::KeyCharacterMap() :
-    mType(KEYBOARD_TYPE_UNKNOWN) {
+    mType(KEYBOARD_TYPE_UNKNOWN), mCharacterIndexBuilt(false) {
 }
 
 KeyCharacterMap::KeyCharacterMap(const KeyCharacterMap& other) :
     RefBase(), mType(other.mType), mKeysByScanCode(other.mKeysByScanCode),
-    mKeysByUsageCode(other.mKeysByUsageCode) {
+    mKeysByUsageCode(other.mKeysByUsageCode), mCharacterIndexBuilt(false) {
     for (size_t i = 0; i < other.mKeys.size(); i++) {
         mKeys.add(other.mKeys.keyAt(i), new Key(*other.mKeys.valueAt(i)));
     }
@@ -110,6 +110,20 @@ status_t KeyCharacterMap::load(const String8& filename,
         Format format, sp<KeyCharacterMap>* outMap) {
     outMap->clear();
 
+#ifdef __ANDROID__
+    KeyMapCache::Reader* reader;
+    if (!KeyMapCache::open(filename, KeyMapCache::KIND_KEY_CHARACTER_MAP, format, &reader)) {
+        sp<KeyCharacterMap> map = new KeyCharacterMap();
+        status_t status = map->readCompiled(reader);
+        delete reader;
+        if (!status) {
+            *outMap = map;
+            return OK;
+        }
+        ALOGW("Ignoring invalid compiled key character map of %s.", filename.string());
+    }
+#endif
+
     Tokenizer* tokenizer;
     status_t status = Tokenizer::open(filename, &tokenizer);
     if (status) {
@@ -117,6 +131,13 @@ status_t KeyCharacterMap::load(const String8& filename,
     } else {
         status = load(tokenizer, format, outMap);
         delete tokenizer;
+#ifdef __ANDROID__
+        if (!status) {
+            KeyMapCache::Writer writer;
+            (*outMap)->writeCompiled(&writer);
+            KeyMapCache::store(filename, KeyMapCache::KIND_KEY_CHARACTER_MAP, format, writer);
+        }
+#endif
     }
     return status;
 }
@@ -463,24 +484,46 @@ bool KeyCharacterMap::findKey(char16_t ch, int32_t* outKeyCode, int32_t* outMeta
         return false;
     }
 
+    const KeyedVector<char16_t, CharacterKey>& characterIndex = getCharacterIndex();
+    ssize_t index = characterIndex.indexOfKey(ch);
+    if (index < 0) {
+        return false;
+    }
+    *outKeyCode = characterIndex.valueAt(index).keyCode;
+    *outMetaState = characterIndex.valueAt(index).metaState;
+    return true;
+}
+
+const KeyedVector<char16_t, KeyCharacterMap::CharacterKey>&
+        KeyCharacterMap::getCharacterIndex() const {
+    AutoMutex _l(mCharacterIndexLock);
+    if (mCharacterIndexBuilt) {
+        // The map is immutable once loaded so the index never changes after this point.
+        return mCharacterIndex;
+    }
+
+    // A character maps to the lowest key code that generates it and, for that key, to the
+    // most general behavior. For example, the base key behavior will usually be last in the list.
     for (size_t i = 0; i < mKeys.size(); i++) {
+        const int32_t keyCode = mKeys.keyAt(i);
         const Key* key = mKeys.valueAt(i);
-
-        // Try to find the most general behavior that maps to this character.
-        // For example, the base key behavior will usually be last in the list.
-        const Behavior* found = NULL;
         for (const Behavior* behavior = key->firstBehavior; behavior; behavior = behavior->next) {
-            if (behavior->character == ch) {
-                found = behavior;
+            if (!behavior->character) {
+                continue;
+            }
+            ssize_t index = mCharacterIndex.indexOfKey(behavior->character);
+            if (index < 0) {
+                CharacterKey characterKey;
+                characterKey.keyCode = keyCode;
+                characterKey.metaState = behavior->metaState;
+                mCharacterIndex.add(behavior->character, characterKey);
+            } else if (mCharacterIndex.valueAt(index).keyCode == keyCode) {
+                mCharacterIndex.editValueAt(index).metaState = behavior->metaState;
             }
-        }
-        if (found) {
-            *outKeyCode = mKeys.keyAt(i);
-            *outMetaState = found->metaState;
-            return true;
         }
     }
-    return false;
+    mCharacterIndexBuilt = true;
+    return mCharacterIndex;
 }
 
 void KeyCharacterMap::addKey(Vector<KeyEvent>& outEvents,
@@ -677,6 +720,92 @@ void KeyCharacterMap::writeToParcel(Parcel* parcel) const {
         parcel->writeInt32(0);
     }
 }
+
+status_t KeyCharacterMap::readCompiled(KeyMapCache::Reader* reader) {
+    size_t numKeys;
+    if (!reader->readInt32(&mType) || !reader->readCount(4, &numKeys) || numKeys > MAX_KEYS) {
+        return BAD_VALUE;
+    }
+    mKeys.setCapacity(numKeys);
+    for (size_t i = 0; i < numKeys; i++) {
+        int32_t keyCode, label, number;
+        size_t numBehaviors;
+        reader->readInt32(&keyCode);
+        reader->readInt32(&label);
+        reader->readInt32(&number);
+        if (!reader->readCount(4, &numBehaviors)) {
+            return BAD_VALUE;
+        }
+
+        Key* key = new Key();
+        key->label = label;
+        key->number = number;
+        mKeys.add(keyCode, key);
+
+        Behavior** nextBehavior = &key->firstBehavior;
+        for (size_t j = 0; j < numBehaviors; j++) {
+            int32_t character;
+            Behavior* behavior = new Behavior();
+            reader->readInt32(&behavior->metaState);
+            reader->readInt32(&character);
+            reader->readInt32(&behavior->fallbackKeyCode);
+            reader->readInt32(&behavior->replacementKeyCode);
+            behavior->character = character;
+            *nextBehavior = behavior;
+            nextBehavior = &behavior->next;
+        }
+    }
+
+    KeyedVector<int32_t, int32_t>* keyMaps[] = { &mKeysByScanCode, &mKeysByUsageCode };
+    for (KeyedVector<int32_t, int32_t>* keys : keyMaps) {
+        size_t count;
+        if (!reader->readCount(2, &count)) {
+            return BAD_VALUE;
+        }
+        keys->setCapacity(count);
+        for (size_t i = 0; i < count; i++) {
+            int32_t code, keyCode;
+            reader->readInt32(&code);
+            reader->readInt32(&keyCode);
+            keys->add(code, keyCode);
+        }
+    }
+    return reader->isAtEnd() ? OK : BAD_VALUE;
+}
+
+void KeyCharacterMap::writeCompiled(KeyMapCache::Writer* writer) const {
+    writer->writeInt32(mType);
+
+    writer->writeInt32(mKeys.size());
+    for (size_t i = 0; i < mKeys.size(); i++) {
+        const Key* key = mKeys.valueAt(i);
+        writer->writeInt32(mKeys.keyAt(i));
+        writer->writeInt32(key->label);
+        writer->writeInt32(key->number);
+        size_t numBehaviors = 0;
+        for (const Behavior* behavior = key->firstBehavior; behavior != NULL;
+                behavior = behavior->next) {
+            numBehaviors += 1;
+        }
+        writer->writeInt32(numBehaviors);
+        for (const Behavior* behavior = key->firstBehavior; behavior != NULL;
+                behavior = behavior->next) {
+            writer->writeInt32(behavior->metaState);
+            writer->writeInt32(behavior->character);
+            writer->writeInt32(behavior->fallbackKeyCode);
+            writer->writeInt32(behavior->replacementKeyCode);
+        }
+    }
+
+    const KeyedVector<int32_t, int32_t>* keyMaps[] = { &mKeysByScanCode, &mKeysByUsageCode };
+    for (const KeyedVector<int32_t, int32_t>* keys : keyMaps) {
+        writer->writeInt32(keys->size());
+        for (size_t i = 0; i < keys->size(); i++) {
+            writer->writeInt32(keys->keyAt(i));
+            writer->writeInt32(keys->valueAt(i));
+        }
+    }
+}
 #endif
 
 
@@ -52,6 +52,20 @@ KeyLayoutMap::~KeyLayoutMap() {
 status_t KeyLayoutMap::load(const String8& filename, sp<KeyLayoutMap>* outMap) {
     outMap->clear();
 
+#ifdef __ANDROID__
+    KeyMapCache::Reader* reader;
+    if (!KeyMapCache::open(filename, KeyMapCache::KIND_KEY_LAYOUT, 0, &reader)) {
+        sp<KeyLayoutMap> map = new KeyLayoutMap();
+        status_t status = map->readCompiled(reader);
+        delete reader;
+        if (!status) {
+            *outMap = map;
+            return OK;
+        }
+        ALOGW("Ignoring invalid compiled key layout map of %s.", filename.string());
+    }
+#endif
+
     Tokenizer* tokenizer;
     status_t status = Tokenizer::open(filename, &tokenizer);
     if (status) {
@@ -75,6 +89,11 @@ status_t KeyLayoutMap::load(const String8& filename, sp<KeyLayoutMap>* outMap) {
 #endif
             if (!status) {
                 *outMap = map;
+#ifdef __ANDROID__
+                KeyMapCache::Writer writer;
+                map->writeCompiled(&writer);
+                KeyMapCache::store(filename, KeyMapCache::KIND_KEY_LAYOUT, 0, writer);
+#endif
             }
         }
         delete tokenizer;
@@ -185,6 +204,96 @@ status_t KeyLayoutMap::findUsageCodeForLed(int32_t ledCode, int32_t* outUsageCod
     return NAME_NOT_FOUND;
 }
 
+#ifdef __ANDROID__
+status_t KeyLayoutMap::readCompiled(KeyMapCache::Reader* reader) {
+    size_t count;
+    KeyedVector<int32_t, Key>* keyMaps[] = { &mKeysByScanCode, &mKeysByUsageCode };
+    for (KeyedVector<int32_t, Key>* keys : keyMaps) {
+        if (!reader->readCount(3, &count)) {
+            return BAD_VALUE;
+        }
+        keys->setCapacity(count);
+        for (size_t i = 0; i < count; i++) {
+            int32_t code, flags;
+            Key key;
+            reader->readInt32(&code);
+            reader->readInt32(&key.keyCode);
+            reader->readInt32(&flags);
+            key.flags = uint32_t(flags);
+            keys->add(code, key);
+        }
+    }
+
+    if (!reader->readCount(6, &count)) {
+        return BAD_VALUE;
+    }
+    mAxes.setCapacity(count);
+    for (size_t i = 0; i < count; i++) {
+        int32_t code, mode;
+        AxisInfo axisInfo;
+        reader->readInt32(&code);
+        reader->readInt32(&mode);
+        reader->readInt32(&axisInfo.axis);
+        reader->readInt32(&axisInfo.highAxis);
+        reader->readInt32(&axisInfo.splitValue);
+        reader->readInt32(&axisInfo.flatOverride);
+        if (mode < AxisInfo::MODE_NORMAL || mode > AxisInfo::MODE_SPLIT) {
+            return BAD_VALUE;
+        }
+        axisInfo.mode = AxisInfo::Mode(mode);
+        mAxes.add(code, axisInfo);
+    }
+
+    KeyedVector<int32_t, Led>* ledMaps[] = { &mLedsByScanCode, &mLedsByUsageCode };
+    for (KeyedVector<int32_t, Led>* leds : ledMaps) {
+        if (!reader->readCount(2, &count)) {
+            return BAD_VALUE;
+        }
+        leds->setCapacity(count);
+        for (size_t i = 0; i < count; i++) {
+            int32_t code;
+            Led led;
+            reader->readInt32(&code);
+            reader->readInt32(&led.ledCode);
+            leds->add(code, led);
+        }
+    }
+    return reader->isAtEnd() ? OK : BAD_VALUE;
+}
+
+void KeyLayoutMap::writeCompiled(KeyMapCache::Writer* writer) const {
+    const KeyedVector<int32_t, Key>* keyMaps[] = { &mKeysByScanCode, &mKeysByUsageCode };
+    for (const KeyedVector<int32_t, Key>* keys : keyMaps) {
+        writer->writeInt32(keys->size());
+        for (size_t i = 0; i < keys->size(); i++) {
+            writer->writeInt32(keys->keyAt(i));
+            writer->writeInt32(keys->valueAt(i).keyCode);
+            writer->writeInt32(keys->valueAt(i).flags);
+        }
+    }
+
+    writer->writeInt32(mAxes.size());
+    for (size_t i = 0; i < mAxes.size(); i++) {
+        const AxisInfo& axisInfo = mAxes.valueAt(i);
+        writer->writeInt32(mAxes.keyAt(i));
+        writer->writeInt32(axisInfo.mode);
+        writer->writeInt32(axisInfo.axis);
+        writer->writeInt32(axisInfo.highAxis);
+        writer->writeInt32(axisInfo.splitValue);
+        writer->writeInt32(axisInfo.flatOverride);
+    }
+
+    const KeyedVector<int32_t, Led>* ledMaps[] = { &mLedsByScanCode, &mLedsByUsageCode };
+    for (const KeyedVector<int32_t, Led>* leds : ledMaps) {
+        writer->writeInt32(leds->size());
+        for (size_t i = 0; i < leds->size(); i++) {
+            writer->writeInt32(leds->keyAt(i));
+            writer->writeInt32(leds->valueAt(i).ledCode);
+        }
+    }
+}
+#endif
+
 
 // --- KeyLayoutMap::Parser ---
 
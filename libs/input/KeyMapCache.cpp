@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "KeyMapCache"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cutils/properties.h>
+#include <input/KeyMapCache.h>
+#include <utils/Log.h>
+
+namespace android {
+
+static const char* DEFAULT_CACHE_DIR = "/data/system/keymap_cache";
+
+static const uint32_t CACHE_MAGIC = 0x314d434b; // 'KCM1'
+// Bump when the layout of a compiled map changes.
+static const uint32_t CACHE_VERSION = 1;
+
+struct CacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    int32_t kind;
+    int32_t variant;
+    int64_t sourceSize;
+    int64_t sourceMtimeSec;
+    int64_t sourceMtimeNsec;
+    uint32_t pathLength; // followed by the path, padded to 4 bytes
+    uint32_t valueCount; // followed by the values, after the path
+};
+
+static inline size_t padPathLength(size_t length) {
+    return (length + 3) & ~size_t(3);
+}
+
+static bool statSource(const String8& sourcePath, struct stat* outStat) {
+    if (stat(sourcePath.string(), outStat)) {
+        return false;
+    }
+    return S_ISREG(outStat->st_mode);
+}
+
+static bool writeFully(int fd, const void* data, size_t size) {
+    const char* p = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t n = TEMP_FAILURE_RETRY(write(fd, p, size));
+        if (n < 0) {
+            return false;
+        }
+        p += n;
+        size -= size_t(n);
+    }
+    return true;
+}
+
+
+// --- KeyMapCache ---
+
+String8 KeyMapCache::getCacheDir() {
+    char value[PROPERTY_VALUE_MAX];
+    property_get("input.keymap_cache.dir", value, DEFAULT_CACHE_DIR);
+    return String8(value);
+}
+
+String8 KeyMapCache::getCachePath(const String8& cacheDir, const String8& sourcePath,
+        Kind kind, int32_t variant) {
+    // FNV-1a. Files whose paths collide just keep replacing each other's compiled map,
+    // since the header holds the whole source path.
+    uint32_t hash = 2166136261u;
+    for (const char* p = sourcePath.string(); *p; p++) {
+        hash = (hash ^ uint8_t(*p)) * 16777619u;
+    }
+    String8 path(cacheDir);
+    path.appendFormat("/%08x.%s%d", hash, kind == KIND_KEY_LAYOUT ? "kl" : "kcm", variant);
+    return path;
+}
+
+status_t KeyMapCache::open(const String8& sourcePath, Kind kind, int32_t variant,
+        Reader** outReader) {
+    *outReader = NULL;
+
+    String8 cacheDir(getCacheDir());
+    struct stat sourceStat;
+    if (cacheDir.isEmpty() || !statSource(sourcePath, &sourceStat)) {
+        return NAME_NOT_FOUND;
+    }
+
+    String8 cachePath(getCachePath(cacheDir, sourcePath, kind, variant));
+    int fd = ::open(cachePath.string(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NAME_NOT_FOUND;
+    }
+    struct stat cacheStat;
+    void* mapping = MAP_FAILED;
+    size_t mappingSize = 0;
+    if (!fstat(fd, &cacheStat) && cacheStat.st_size >= off_t(sizeof(CacheHeader))) {
+        mappingSize = size_t(cacheStat.st_size);
+        mapping = mmap(NULL, mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return NAME_NOT_FOUND;
+    }
+
+    const CacheHeader* header = static_cast<const CacheHeader*>(mapping);
+    const char* path = static_cast<const char*>(mapping) + sizeof(CacheHeader);
+    const size_t valuesOffset = sizeof(CacheHeader) + padPathLength(header->pathLength);
+    if (header->magic != CACHE_MAGIC
+            || header->version != CACHE_VERSION
+            || header->kind != kind
+            || header->variant != variant
+            || header->sourceSize != int64_t(sourceStat.st_size)
+            || header->sourceMtimeSec != int64_t(sourceStat.st_mtim.tv_sec)
+            || header->sourceMtimeNsec != int64_t(sourceStat.st_mtim.tv_nsec)
+            || header->pathLength != sourcePath.length()
+            || valuesOffset > mappingSize
+            || (mappingSize - valuesOffset) / sizeof(int32_t) != header->valueCount
+            || (mappingSize - valuesOffset) % sizeof(int32_t)
+            || memcmp(path, sourcePath.string(), header->pathLength)) {
+        munmap(mapping, mappingSize);
+        return NAME_NOT_FOUND;
+    }
+
+    *outReader = new Reader(mapping, mappingSize,
+            reinterpret_cast<const int32_t*>(static_cast<const char*>(mapping) + valuesOffset),
+            header->valueCount);
+    return OK;
+}
+
+void KeyMapCache::store(const String8& sourcePath, Kind kind, int32_t variant,
+        const Writer& writer) {
+    String8 cacheDir(getCacheDir());
+    struct stat sourceStat;
+    if (cacheDir.isEmpty() || !statSource(sourcePath, &sourceStat)) {
+        return;
+    }
+    if (mkdir(cacheDir.string(), 0700) && errno != EEXIST) {
+        ALOGW("Could not create key map cache directory %s: %s", cacheDir.string(),
+                strerror(errno));
+        return;
+    }
+
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = CACHE_MAGIC;
+    header.version = CACHE_VERSION;
+    header.kind = kind;
+    header.variant = variant;
+    header.sourceSize = sourceStat.st_size;
+    header.sourceMtimeSec = sourceStat.st_mtim.tv_sec;
+    header.sourceMtimeNsec = sourceStat.st_mtim.tv_nsec;
+    header.pathLength = sourcePath.length();
+    header.valueCount = writer.mValues.size();
+    static const char padding[3] = { 0, 0, 0 };
+
+    // Written aside and renamed, so a reader never maps a partial file.
+    String8 cachePath(getCachePath(cacheDir, sourcePath, kind, variant));
+    String8 tempPath(cachePath);
+    tempPath.appendFormat(".%d.tmp", gettid());
+    int fd = ::open(tempPath.string(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        ALOGW("Could not create compiled key map %s: %s", tempPath.string(), strerror(errno));
+        return;
+    }
+    bool ok = writeFully(fd, &header, sizeof(header))
+            && writeFully(fd, sourcePath.string(), sourcePath.length())
+            && writeFully(fd, padding, padPathLength(sourcePath.length()) - sourcePath.length())
+            && writeFully(fd, writer.mValues.array(), writer.mValues.size() * sizeof(int32_t));
+    if (close(fd)) {
+        ok = false;
+    }
+    if (!ok || rename(tempPath.string(), cachePath.string())) {
+        ALOGW("Could not write compiled key map %s: %s", cachePath.string(), strerror(errno));
+        unlink(tempPath.string());
+    }
+}
+
+
+// --- KeyMapCache::Reader ---
+
+KeyMapCache::Reader::Reader(void* mapping, size_t mappingSize,
+        const int32_t* values, size_t count) :
+        mMapping(mapping), mMappingSize(mappingSize),
+        mValues(values), mCount(count), mPosition(0) {
+}
+
+KeyMapCache::Reader::~Reader() {
+    munmap(mMapping, mMappingSize);
+}
+
+bool KeyMapCache::Reader::readInt32(int32_t* outValue) {
+    if (mPosition >= mCount) {
+        return false;
+    }
+    *outValue = mValues[mPosition++];
+    return true;
+}
+
+bool KeyMapCache::Reader::readCount(size_t recordSize, size_t* outCount) {
+    int32_t count;
+    if (!readInt32(&count) || count < 0
+            || size_t(count) > (mCount - mPosition) / recordSize) {
+        return false;
+    }
+    *outCount = size_t(count);
+    return true;
+}
+
+} // namespace android
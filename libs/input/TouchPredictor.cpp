@@ -0,0 +1,252 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "TouchPredictor"
+//#define LOG_NDEBUG 0
+
+// Log debug messages about predictions and how they turned out.
+#define DEBUG_PREDICTION 0
+
+#include <math.h>
+
+#include <input/TouchPredictor.h>
+#include <log/log.h>
+
+namespace android {
+
+// Nanoseconds per milliseconds.
+static const nsecs_t NANOS_PER_MS = 1000000;
+
+// Range of time differences between consecutive samples taken as the sample interval
+// of the device, which is also the interval of predicted samples.  Anything outside it
+// is a pause or a duplicate rather than the sample rate.
+static const nsecs_t MIN_SAMPLE_INTERVAL = 2 * NANOS_PER_MS;
+static const nsecs_t MAX_SAMPLE_INTERVAL = 20 * NANOS_PER_MS;
+
+
+// --- TouchPredictor::Accuracy ---
+
+void TouchPredictor::Accuracy::add(const Accuracy& other) {
+    count += other.count;
+    totalError += other.totalError;
+    if (other.maxError > maxError) {
+        maxError = other.maxError;
+    }
+}
+
+
+// --- TouchPredictor ---
+
+const size_t TouchPredictor::MAX_PREDICTED_SAMPLES;
+
+const char* TouchPredictor::DEFAULT_STRATEGY = "lsq2";
+
+TouchPredictor::TouchPredictor(const char* strategy) :
+        mVelocityTracker(strategy ? strategy : DEFAULT_STRATEGY) {
+    clear();
+    mAccuracy.clear();
+}
+
+TouchPredictor::~TouchPredictor() {
+}
+
+void TouchPredictor::clear() {
+    mVelocityTracker.clear();
+    mLastMovement.eventTime = 0;
+    mLastMovement.idBits.clear();
+    mSampleInterval = 0;
+    mPredictionCount = 0;
+}
+
+void TouchPredictor::addMovement(const MotionEvent* event) {
+    mVelocityTracker.addMovement(event);
+
+    int32_t actionMasked = event->getActionMasked();
+    if (actionMasked != AMOTION_EVENT_ACTION_MOVE
+            && actionMasked != AMOTION_EVENT_ACTION_HOVER_MOVE) {
+        // Pointers went down or up, so there is nothing to check the pending
+        // predictions against.
+        if (actionMasked == AMOTION_EVENT_ACTION_DOWN
+                || actionMasked == AMOTION_EVENT_ACTION_HOVER_ENTER) {
+            mSampleInterval = 0;
+        }
+        mPredictionCount = 0;
+        initializeMovement(event, -1, &mLastMovement);
+        return;
+    }
+
+    Movement movement;
+    size_t historySize = event->getHistorySize();
+    for (size_t h = 0; h < historySize; h++) {
+        initializeMovement(event, h, &movement);
+        addMovement(movement);
+    }
+    initializeMovement(event, -1, &movement);
+    addMovement(movement);
+}
+
+void TouchPredictor::addMovement(const Movement& movement) {
+    if (!mLastMovement.idBits.isEmpty()) {
+        nsecs_t interval = movement.eventTime - mLastMovement.eventTime;
+        if (interval >= MIN_SAMPLE_INTERVAL && interval <= MAX_SAMPLE_INTERVAL) {
+            mSampleInterval = interval;
+        }
+        checkPredictions(movement);
+    }
+    mLastMovement = movement;
+}
+
+void TouchPredictor::checkPredictions(const Movement& movement) {
+    nsecs_t delta = movement.eventTime - mLastMovement.eventTime;
+    size_t checked = 0;
+    while (checked < mPredictionCount
+            && mPredictions[checked].eventTime <= movement.eventTime) {
+        const Movement& prediction = mPredictions[checked++];
+        if (delta <= 0 || prediction.eventTime <= mLastMovement.eventTime) {
+            continue;
+        }
+
+        // Where the pointers were at the predicted time, going by the samples around it.
+        float alpha = float(prediction.eventTime - mLastMovement.eventTime) / delta;
+        BitSet32 idBits(prediction.idBits.value & movement.idBits.value
+                & mLastMovement.idBits.value);
+        while (!idBits.isEmpty()) {
+            uint32_t id = idBits.clearFirstMarkedBit();
+            const VelocityTracker::Position& last = mLastMovement.getPosition(id);
+            const VelocityTracker::Position& current = movement.getPosition(id);
+            const VelocityTracker::Position& predicted = prediction.getPosition(id);
+            float error = hypotf(predicted.x - (last.x + (current.x - last.x) * alpha),
+                    predicted.y - (last.y + (current.y - last.y) * alpha));
+            mAccuracy.count += 1;
+            mAccuracy.totalError += error;
+            if (error > mAccuracy.maxError) {
+                mAccuracy.maxError = error;
+            }
+#if DEBUG_PREDICTION
+            ALOGD("[%d] - predicted (%0.3f, %0.3f) %0.3f ms ahead, error %0.3f",
+                    id, predicted.x, predicted.y,
+                    (prediction.eventTime - mLastMovement.eventTime) * 0.000001f, error);
+#endif
+        }
+    }
+
+    mPredictionCount -= checked;
+    for (size_t i = 0; i < mPredictionCount; i++) {
+        mPredictions[i] = mPredictions[i + checked];
+    }
+}
+
+bool TouchPredictor::getPosition(uint32_t id, nsecs_t time,
+        VelocityTracker::Position* outPosition) const {
+    VelocityTracker::Estimator estimator;
+    if (!mVelocityTracker.getEstimator(id, &estimator)) {
+        return false;
+    }
+
+    float t = (time - estimator.time) * 0.000000001f;
+    float tn = 1;
+    outPosition->x = 0;
+    outPosition->y = 0;
+    for (size_t i = 0; i <= estimator.degree; i++) {
+        outPosition->x += estimator.xCoeff[i] * tn;
+        outPosition->y += estimator.yCoeff[i] * tn;
+        tn *= t;
+    }
+    return true;
+}
+
+bool TouchPredictor::predict(const MotionEvent* event, nsecs_t horizon,
+        MotionEvent* outPrediction) {
+    int32_t actionMasked = event->getActionMasked();
+    size_t pointerCount = event->getPointerCount();
+    if ((actionMasked != AMOTION_EVENT_ACTION_MOVE
+                    && actionMasked != AMOTION_EVENT_ACTION_HOVER_MOVE)
+            || pointerCount > MAX_POINTERS || horizon <= 0 || mSampleInterval == 0) {
+        return false;
+    }
+
+    size_t sampleCount = size_t((horizon + mSampleInterval - 1) / mSampleInterval);
+    if (sampleCount > MAX_PREDICTED_SAMPLES) {
+        sampleCount = MAX_PREDICTED_SAMPLES;
+    }
+
+    mPredictionCount = 0;
+    PointerCoords coords[MAX_POINTERS];
+    for (size_t s = 0; s < sampleCount; s++) {
+        nsecs_t predictionTime = event->getEventTime()
+                + (s + 1 < sampleCount ? nsecs_t(s + 1) * mSampleInterval : horizon);
+        Movement& prediction = mPredictions[s];
+        prediction.eventTime = predictionTime;
+        prediction.idBits.clear();
+        for (size_t i = 0; i < pointerCount; i++) {
+            prediction.idBits.markBit(event->getPointerId(i));
+        }
+        for (size_t i = 0; i < pointerCount; i++) {
+            uint32_t id = event->getPointerId(i);
+            VelocityTracker::Position& position =
+                    prediction.positions[prediction.idBits.getIndexOfBit(id)];
+            if (!getPosition(id, predictionTime, &position)) {
+                return false;
+            }
+            coords[i].copyFrom(*event->getRawPointerCoords(i));
+            coords[i].setAxisValue(AMOTION_EVENT_AXIS_X, position.x - event->getXOffset());
+            coords[i].setAxisValue(AMOTION_EVENT_AXIS_Y, position.y - event->getYOffset());
+        }
+
+        if (s == 0) {
+            outPrediction->initialize(event->getDeviceId(), event->getSource(),
+                    actionMasked, 0, event->getFlags() | AMOTION_EVENT_FLAG_PREDICTED,
+                    event->getEdgeFlags(), event->getMetaState(), event->getButtonState(),
+                    event->getXOffset(), event->getYOffset(),
+                    event->getXPrecision(), event->getYPrecision(),
+                    event->getDownTime(), predictionTime,
+                    pointerCount, event->getPointerProperties(0), coords);
+        } else {
+            outPrediction->addSample(predictionTime, coords);
+        }
+    }
+
+    mPredictionCount = sampleCount;
+    return true;
+}
+
+void TouchPredictor::initializeMovement(const MotionEvent* event, ssize_t historicalIndex,
+        Movement* outMovement) {
+    size_t pointerCount = event->getPointerCount();
+    if (pointerCount > MAX_POINTERS) {
+        pointerCount = MAX_POINTERS;
+    }
+
+    outMovement->eventTime = historicalIndex < 0 ? event->getEventTime()
+            : event->getHistoricalEventTime(historicalIndex);
+    outMovement->idBits.clear();
+    for (size_t i = 0; i < pointerCount; i++) {
+        outMovement->idBits.markBit(event->getPointerId(i));
+    }
+    for (size_t i = 0; i < pointerCount; i++) {
+        VelocityTracker::Position& position =
+                outMovement->positions[outMovement->idBits.getIndexOfBit(event->getPointerId(i))];
+        if (historicalIndex < 0) {
+            position.x = event->getX(i);
+            position.y = event->getY(i);
+        } else {
+            position.x = event->getHistoricalX(i, historicalIndex);
+            position.y = event->getHistoricalY(i, historicalIndex);
+        }
+    }
+}
+
+} // namespace android
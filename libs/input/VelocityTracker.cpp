@@ -25,6 +25,7 @@
 
 #include <math.h>
 #include <limits.h>
+#include <string.h>
 
 #include <cutils/properties.h>
 #include <input/VelocityTracker.h>
@@ -156,6 +157,12 @@ VelocityTrackerStrategy* VelocityTracker::createStrategy(const char* strategy) {
         // duplicate or jittery touch coordinates when the finger is released.
         return new LeastSquaresVelocityTrackerStrategy(2);
     }
+    if (!strcmp("lsq2-qr", strategy)) {
+        // 2nd order least squares, decomposed on every estimate.  Quality: VERY GOOD.
+        // The same fit as 'lsq2' without its running sums, for comparison purposes only.
+        return new LeastSquaresVelocityTrackerStrategy(2,
+                LeastSquaresVelocityTrackerStrategy::WEIGHTING_NONE, false /*incremental*/);
+    }
     if (!strcmp("lsq3", strategy)) {
         // 3rd order least squares.  Quality: UNUSABLE.
         // Frequently overfits the touch data yielding wildly divergent estimates
@@ -198,6 +205,12 @@ VelocityTrackerStrategy* VelocityTracker::createStrategy(const char* strategy) {
         // time to adjust to changes in direction.
         return new LegacyVelocityTrackerStrategy();
     }
+    if (!strcmp("kalman", strategy)) {
+        // Kalman filter, constant velocity.  Quality: EXPERIMENTAL.
+        // Meant for predicting touch positions a frame ahead: it smooths over jitter
+        // without lagging behind as much as the least squares fits do.
+        return new KalmanVelocityTrackerStrategy();
+    }
     return NULL;
 }
 
@@ -356,9 +369,14 @@ bool VelocityTracker::getEstimator(uint32_t id, Estimator* outEstimator) const {
 const nsecs_t LeastSquaresVelocityTrackerStrategy::HORIZON;
 const uint32_t LeastSquaresVelocityTrackerStrategy::HISTORY_SIZE;
 
+// Number of updates after which the running sums of a pointer are computed from scratch
+// again, so that rounding errors from adding and removing movements do not build up.
+static const uint32_t LSQ_SUMS_RECOMPUTE_INTERVAL = 64;
+
 LeastSquaresVelocityTrackerStrategy::LeastSquaresVelocityTrackerStrategy(
-        uint32_t degree, Weighting weighting) :
-        mDegree(degree), mWeighting(weighting) {
+        uint32_t degree, Weighting weighting, bool incremental) :
+        mDegree(degree), mWeighting(weighting),
+        mIncremental(incremental && degree == 2 && weighting == WEIGHTING_NONE) {
     clear();
 }
 
@@ -368,11 +386,22 @@ LeastSquaresVelocityTrackerStrategy::~LeastSquaresVelocityTrackerStrategy() {
 void LeastSquaresVelocityTrackerStrategy::clear() {
     mIndex = 0;
     mMovements[0].idBits.clear();
+    if (mIncremental) {
+        mSumsTime = 0;
+        for (uint32_t id = 0; id <= MAX_POINTER_ID; id++) {
+            mSums[id].count = 0;
+        }
+    }
 }
 
 void LeastSquaresVelocityTrackerStrategy::clearPointers(BitSet32 idBits) {
     BitSet32 remainingIdBits(mMovements[mIndex].idBits.value & ~idBits.value);
     mMovements[mIndex].idBits = remainingIdBits;
+    if (mIncremental) {
+        for (BitSet32 iterIdBits(idBits); !iterIdBits.isEmpty(); ) {
+            mSums[iterIdBits.clearFirstMarkedBit()].count = 0;
+        }
+    }
 }
 
 void LeastSquaresVelocityTrackerStrategy::addMovement(nsecs_t eventTime, BitSet32 idBits,
@@ -382,12 +411,121 @@ void LeastSquaresVelocityTrackerStrategy::addMovement(nsecs_t eventTime, BitSet3
     }
 
     Movement& movement = mMovements[mIndex];
+    if (mIncremental) {
+        // This overwrites the oldest movement, which drops out of the sums that have
+        // a full history.
+        BitSet32 oldIdBits(movement.idBits);
+        while (!oldIdBits.isEmpty()) {
+            uint32_t id = oldIdBits.clearFirstMarkedBit();
+            Sums& sums = mSums[id];
+            if (sums.count == HISTORY_SIZE) {
+                sums.add(-(mSumsTime - movement.eventTime) * 0.000000001,
+                        movement.getPosition(id), -1);
+                sums.count -= 1;
+            }
+        }
+    }
+
     movement.eventTime = eventTime;
     movement.idBits = idBits;
     uint32_t count = idBits.count();
     for (uint32_t i = 0; i < count; i++) {
         movement.positions[i] = positions[i];
     }
+
+    if (mIncremental) {
+        updateSums(idBits);
+    }
+}
+
+void LeastSquaresVelocityTrackerStrategy::updateSums(BitSet32 idBits) {
+    const Movement& newestMovement = mMovements[mIndex];
+    double delta = (newestMovement.eventTime - mSumsTime) * 0.000000001;
+    mSumsTime = newestMovement.eventTime;
+
+    for (uint32_t id = 0; id <= MAX_POINTER_ID; id++) {
+        Sums& sums = mSums[id];
+        if (!idBits.hasBit(id)) {
+            sums.count = 0;
+            continue;
+        }
+        if (sums.count == 0 || ++sums.updateCount >= LSQ_SUMS_RECOMPUTE_INTERVAL
+                || delta > HORIZON * 0.000000001) {
+            computeSums(id);
+            continue;
+        }
+
+        sums.shift(delta);
+        sums.add(0, newestMovement.getPosition(id), 1);
+        sums.count += 1;
+
+        // Drop the movements that are now older than the horizon.
+        while (sums.count > 1) {
+            const Movement& oldestMovement = mMovements[oldestIndex(sums.count)];
+            nsecs_t age = newestMovement.eventTime - oldestMovement.eventTime;
+            if (age <= HORIZON) {
+                break;
+            }
+            sums.add(-age * 0.000000001, oldestMovement.getPosition(id), -1);
+            sums.count -= 1;
+        }
+    }
+}
+
+void LeastSquaresVelocityTrackerStrategy::computeSums(uint32_t id) {
+    Sums& sums = mSums[id];
+    memset(&sums, 0, sizeof(Sums));
+
+    // The same movements as getEstimator() collects.
+    uint32_t index = mIndex;
+    const Movement& newestMovement = mMovements[mIndex];
+    do {
+        const Movement& movement = mMovements[index];
+        if (!movement.idBits.hasBit(id)) {
+            break;
+        }
+        nsecs_t age = newestMovement.eventTime - movement.eventTime;
+        if (age > HORIZON) {
+            break;
+        }
+        sums.add(-age * 0.000000001, movement.getPosition(id), 1);
+        index = (index == 0 ? HISTORY_SIZE : index) - 1;
+    } while (++sums.count < HISTORY_SIZE);
+}
+
+uint32_t LeastSquaresVelocityTrackerStrategy::oldestIndex(uint32_t count) const {
+    return (mIndex + HISTORY_SIZE - (count - 1)) % HISTORY_SIZE;
+}
+
+void LeastSquaresVelocityTrackerStrategy::Sums::add(double time,
+        const VelocityTracker::Position& position, double sign) {
+    double tn = sign;
+    for (uint32_t k = 0; k < 5; k++) {
+        if (k < 3) {
+            tx[k] += tn * position.x;
+            ty[k] += tn * position.y;
+        }
+        t[k] += tn;
+        tn *= time;
+    }
+    xx += sign * position.x * position.x;
+    yy += sign * position.y * position.y;
+}
+
+void LeastSquaresVelocityTrackerStrategy::Sums::shift(double delta) {
+    // Sums of (t - delta)^k, expanded binomially.
+    const double d = delta, d2 = d * d, d3 = d2 * d, d4 = d3 * d;
+    const double t0 = t[0], t1 = t[1], t2 = t[2], t3 = t[3], t4 = t[4];
+    t[1] = t1 - d * t0;
+    t[2] = t2 - 2 * d * t1 + d2 * t0;
+    t[3] = t3 - 3 * d * t2 + 3 * d2 * t1 - d3 * t0;
+    t[4] = t4 - 4 * d * t3 + 6 * d2 * t2 - 4 * d3 * t1 + d4 * t0;
+    const double x0 = tx[0], x1 = tx[1], x2 = tx[2];
+    tx[1] = x1 - d * x0;
+    tx[2] = x2 - 2 * d * x1 + d2 * x0;
+    const double y0 = ty[0], y1 = ty[1], y2 = ty[2];
+    ty[1] = y1 - d * y0;
+    ty[2] = y2 - 2 * d * y1 + d2 * y0;
 }
 
 /**
@@ -557,10 +695,107 @@ static bool solveLeastSquares(const float* x, const float* y,
     return true;
 }
 
+/*
+ * Solves the normal equations of a least squares fit of a polynomial of n coefficients,
+ * given as the sums s[k] of t^k for k = 0..2n-2 and the sums sy[k] of t^k * y for
+ * k = 0..n-1, by Gaussian elimination.  Also returns the coefficient of determination,
+ * from the sum of y^2.
+ *
+ * Does the same job as solveLeastSquares() for unweighted data, in time independent of
+ * the number of data points, but with doubles: the normal equations square the condition
+ * number of the problem.  The matrix is the Gram matrix of the columns of A, so it needs
+ * no pivoting, and the pivots are the squared norms of the columns of Q before they are
+ * normalized.  Returns false if the system is singular or close to it, in which case the
+ * caller should fall back to solveLeastSquares().
+ */
+static bool solveNormalEquations(const double* s, const double* sy, double syy,
+        uint32_t n, float* outB, float* outDet) {
+    double a[3][4];
+    for (uint32_t i = 0; i < n; i++) {
+        for (uint32_t j = 0; j < n; j++) {
+            a[i][j] = s[i + j];
+        }
+        a[i][n] = sy[i];
+    }
+
+    for (uint32_t j = 0; j < n; j++) {
+        // The same threshold as the norm in solveLeastSquares(), and one for pivots that
+        // are lost in the rounding errors of the sums.
+        if (a[j][j] < 0.000000000001 || a[j][j] <= 1e-9 * s[2 * j]) {
+            return false;
+        }
+        for (uint32_t i = j + 1; i < n; i++) {
+            double factor = a[i][j] / a[j][j];
+            for (uint32_t k = j; k <= n; k++) {
+                a[i][k] -= factor * a[j][k];
+            }
+        }
+    }
+
+    double b[3];
+    for (uint32_t i = n; i != 0; ) {
+        i--;
+        b[i] = a[i][n];
+        for (uint32_t j = i + 1; j < n; j++) {
+            b[i] -= a[i][j] * b[j];
+        }
+        b[i] /= a[i][i];
+    }
+
+    // SSerr = sum (y - A b)^2 = syy - 2 b' A'y + b' A'A b, and SStot = syy - m ymean^2.
+    double sserr = syy;
+    for (uint32_t i = 0; i < n; i++) {
+        sserr -= 2 * b[i] * sy[i];
+        for (uint32_t j = 0; j < n; j++) {
+            sserr += b[i] * b[j] * s[i + j];
+        }
+    }
+    if (sserr < 0) {
+        sserr = 0;
+    }
+    double sstot = syy - sy[0] * sy[0] / s[0];
+    *outDet = sstot > 0.000001 ? float(1.0 - (sserr / sstot)) : 1;
+    for (uint32_t i = 0; i < n; i++) {
+        outB[i] = float(b[i]);
+    }
+    return true;
+}
+
+bool LeastSquaresVelocityTrackerStrategy::getEstimatorFromSums(uint32_t id,
+        VelocityTracker::Estimator* outEstimator) const {
+    const Sums& sums = mSums[id];
+    uint32_t degree = sums.count - 1 < mDegree ? sums.count - 1 : mDegree;
+    uint32_t n = degree + 1;
+    float xdet, ydet;
+    if (degree < 1
+            || !solveNormalEquations(sums.t, sums.tx, sums.xx, n, outEstimator->xCoeff, &xdet)
+            || !solveNormalEquations(sums.t, sums.ty, sums.yy, n, outEstimator->yCoeff, &ydet)) {
+        return false;
+    }
+    outEstimator->time = mMovements[mIndex].eventTime;
+    outEstimator->degree = degree;
+    outEstimator->confidence = xdet * ydet;
+    return true;
+}
+
 bool LeastSquaresVelocityTrackerStrategy::getEstimator(uint32_t id,
         VelocityTracker::Estimator* outEstimator) const {
     outEstimator->clear();
 
+    if (mIncremental && mSums[id].count > 0) {
+        if (getEstimatorFromSums(id, outEstimator)) {
+#if DEBUG_STRATEGY
+            ALOGD("estimate from sums: degree=%d, xCoeff=%s, yCoeff=%s, confidence=%f",
+                    int(outEstimator->degree),
+                    vectorToString(outEstimator->xCoeff, outEstimator->degree + 1).string(),
+                    vectorToString(outEstimator->yCoeff, outEstimator->degree + 1).string(),
+                    outEstimator->confidence);
+#endif
+            return true;
+        }
+        outEstimator->clear();
+    }
+
     // Iterate over movement samples in reverse time order and collect samples.
     float x[HISTORY_SIZE];
     float y[HISTORY_SIZE];
@@ -927,4 +1162,99 @@ bool LegacyVelocityTrackerStrategy::getEstimator(uint32_t id,
     return true;
 }
 
+
+// --- KalmanVelocityTrackerStrategy ---
+
+// Variance of the touch position reported by the device, in pixels squared.
+static const float KALMAN_MEASUREMENT_VARIANCE = 1.0f;
+
+// Variance of the velocity when a pointer goes down, in (pixels per second) squared.
+static const float KALMAN_INITIAL_VELOCITY_VARIANCE = 1.0e6f;
+
+// Power of the acceleration the model treats as noise, in pixels squared per second
+// to the fourth over a second.
+static const float KALMAN_ACCELERATION_NOISE = 1.0e7f;
+
+KalmanVelocityTrackerStrategy::KalmanVelocityTrackerStrategy() {
+}
+
+KalmanVelocityTrackerStrategy::~KalmanVelocityTrackerStrategy() {
+}
+
+void KalmanVelocityTrackerStrategy::clear() {
+    mPointerIdBits.clear();
+}
+
+void KalmanVelocityTrackerStrategy::clearPointers(BitSet32 idBits) {
+    mPointerIdBits.value &= ~idBits.value;
+}
+
+void KalmanVelocityTrackerStrategy::addMovement(nsecs_t eventTime, BitSet32 idBits,
+        const VelocityTracker::Position* positions) {
+    uint32_t index = 0;
+    for (BitSet32 iterIdBits(idBits); !iterIdBits.isEmpty();) {
+        uint32_t id = iterIdBits.clearFirstMarkedBit();
+        State& state = mPointerState[id];
+        const VelocityTracker::Position& position = positions[index++];
+        if (mPointerIdBits.hasBit(id) && eventTime > state.updateTime) {
+            float dt = (eventTime - state.updateTime) * 0.000000001f;
+            state.x.update(dt, position.x);
+            state.y.update(dt, position.y);
+        } else {
+            state.x.init(position.x);
+            state.y.init(position.y);
+        }
+        state.updateTime = eventTime;
+    }
+
+    mPointerIdBits = idBits;
+}
+
+bool KalmanVelocityTrackerStrategy::getEstimator(uint32_t id,
+        VelocityTracker::Estimator* outEstimator) const {
+    outEstimator->clear();
+
+    if (!mPointerIdBits.hasBit(id)) {
+        return false;
+    }
+
+    const State& state = mPointerState[id];
+    outEstimator->time = state.updateTime;
+    outEstimator->confidence = 1.0f;
+    outEstimator->degree = 1;
+    outEstimator->xCoeff[0] = state.x.pos;
+    outEstimator->xCoeff[1] = state.x.vel;
+    outEstimator->yCoeff[0] = state.y.pos;
+    outEstimator->yCoeff[1] = state.y.vel;
+    return true;
+}
+
+void KalmanVelocityTrackerStrategy::Axis::init(float z) {
+    pos = z;
+    vel = 0;
+    p00 = KALMAN_MEASUREMENT_VARIANCE;
+    p01 = 0;
+    p11 = KALMAN_INITIAL_VELOCITY_VARIANCE;
+}
+
+void KalmanVelocityTrackerStrategy::Axis::update(float dt, float z) {
+    // Predict: x = F x, P = F P F' + Q, with F = [1 dt; 0 1].
+    const float dt2 = dt * dt;
+    pos += vel * dt;
+    p00 += dt * (2 * p01 + dt * p11) + KALMAN_ACCELERATION_NOISE * dt2 * dt2 / 4;
+    p01 += dt * p11 + KALMAN_ACCELERATION_NOISE * dt2 * dt / 2;
+    p11 += KALMAN_ACCELERATION_NOISE * dt2;
+
+    // Correct with the measured position: H = [1 0].
+    const float s = p00 + KALMAN_MEASUREMENT_VARIANCE;
+    const float k0 = p00 / s;
+    const float k1 = p01 / s;
+    const float residual = z - pos;
+    pos += k0 * residual;
+    vel += k1 * residual;
+    p11 -= k1 * p01;
+    p01 -= k0 * p01;
+    p00 -= k0 * p00;
+}
+
 } // namespace android
@@ -19,6 +19,7 @@
 #include <unistd.h>
 #include <time.h>
 #include <errno.h>
+#include <poll.h>
 
 #include <gtest/gtest.h>
 #include <input/InputTransport.h>
@@ -155,5 +156,101 @@ TEST_F(InputChannelTest, SendSignal_WhenPeerClosed_ReturnsAnError) {
             << "sendMessage should have returned DEAD_OBJECT";
 }
 
+TEST_F(InputChannelTest, OpenInputChannelPair_WithSharedMemory_ExchangesMessagesThroughTheRings) {
+    sp<InputChannel> serverChannel, clientChannel;
+
+    status_t result = InputChannel::openInputChannelPair(String8("channel name"),
+            serverChannel, clientChannel, true);
+
+    ASSERT_EQ(OK, result)
+            << "should have successfully opened a channel pair";
+    ASSERT_TRUE(serverChannel->isUsingSharedMemory())
+            << "server channel should have set up the shared memory";
+    EXPECT_FALSE(clientChannel->isUsingSharedMemory())
+            << "client channel should attach to the shared memory on its first receive";
+
+    // Server -> Client communication
+    InputMessage serverMsg;
+    memset(&serverMsg, 0, sizeof(InputMessage));
+    serverMsg.header.type = InputMessage::TYPE_KEY;
+    serverMsg.body.key.action = AKEY_EVENT_ACTION_DOWN;
+    EXPECT_EQ(OK, serverChannel->sendMessage(&serverMsg))
+            << "server channel should be able to send message to client channel";
+
+    InputMessage clientMsg;
+    EXPECT_EQ(OK, clientChannel->receiveMessage(&clientMsg))
+            << "client channel should be able to receive message from server channel";
+    EXPECT_TRUE(clientChannel->isUsingSharedMemory())
+            << "client channel should have attached to the shared memory";
+    EXPECT_EQ(serverMsg.header.type, clientMsg.header.type)
+            << "client channel should receive the correct message from server channel";
+    EXPECT_EQ(serverMsg.body.key.action, clientMsg.body.key.action)
+            << "client channel should receive the correct message from server channel";
+
+    // Client -> Server reply
+    InputMessage clientReply;
+    memset(&clientReply, 0, sizeof(InputMessage));
+    clientReply.header.type = InputMessage::TYPE_FINISHED;
+    clientReply.body.finished.seq = 0x11223344;
+    clientReply.body.finished.handled = true;
+    EXPECT_EQ(OK, clientChannel->sendMessage(&clientReply))
+            << "client channel should be able to send message to server channel";
+
+    InputMessage serverReply;
+    EXPECT_EQ(OK, serverChannel->receiveMessage(&serverReply))
+            << "server channel should be able to receive message from client channel";
+    EXPECT_EQ(clientReply.header.type, serverReply.header.type)
+            << "server channel should receive the correct message from client channel";
+    EXPECT_EQ(clientReply.body.finished.seq, serverReply.body.finished.seq)
+            << "server channel should receive the correct message from client channel";
+    EXPECT_EQ(clientReply.body.finished.handled, serverReply.body.finished.handled)
+            << "server channel should receive the correct message from client channel";
+
+    EXPECT_EQ(WOULD_BLOCK, serverChannel->receiveMessage(&serverReply))
+            << "server channel should have no more messages";
+}
+
+TEST_F(InputChannelTest, SendMessage_WithSharedMemory_WakesAWaitingReceiverOnce) {
+    sp<InputChannel> serverChannel, clientChannel;
+
+    status_t result = InputChannel::openInputChannelPair(String8("channel name"),
+            serverChannel, clientChannel, true);
+
+    ASSERT_EQ(OK, result)
+            << "should have successfully opened a channel pair";
+
+    InputMessage msg;
+    EXPECT_EQ(WOULD_BLOCK, clientChannel->receiveMessage(&msg))
+            << "client channel should attach and then find no message";
+    ASSERT_TRUE(clientChannel->isUsingSharedMemory())
+            << "client channel should have attached to the shared memory";
+
+    struct pollfd pfd = { clientChannel->getFd(), POLLIN, 0 };
+    EXPECT_EQ(0, poll(&pfd, 1, 0))
+            << "client channel fd should not be readable without messages";
+
+    memset(&msg, 0, sizeof(InputMessage));
+    msg.header.type = InputMessage::TYPE_KEY;
+    for (int i = 0; i < 3; i++) {
+        msg.body.key.seq = i + 1;
+        EXPECT_EQ(OK, serverChannel->sendMessage(&msg))
+                << "server channel should be able to send message " << i;
+    }
+
+    EXPECT_EQ(1, poll(&pfd, 1, 0))
+            << "the first message should have woken the client channel";
+
+    for (int i = 0; i < 3; i++) {
+        EXPECT_EQ(OK, clientChannel->receiveMessage(&msg))
+                << "client channel should receive message " << i;
+        EXPECT_EQ(uint32_t(i + 1), msg.body.key.seq)
+                << "client channel should receive the messages in order";
+    }
+    EXPECT_EQ(WOULD_BLOCK, clientChannel->receiveMessage(&msg))
+            << "client channel should have consumed the doorbell along with the messages";
+    EXPECT_EQ(0, poll(&pfd, 1, 0))
+            << "client channel fd should not be readable once the rings are drained";
+}
+
 
 } // namespace android
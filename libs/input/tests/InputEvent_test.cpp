@@ -471,6 +471,27 @@ TEST_F(MotionEventTest, CopyFrom_DoNotKeepHistory) {
     ASSERT_EQ(event.getX(0), copy.getX(0));
 }
 
+TEST_F(MotionEventTest, Initialize_AfterReserveSamples_KeepsSampleStorage) {
+    MotionEvent event;
+    event.reserveSamples(3, 2);
+    const nsecs_t* sampleEventTimes = event.getSampleEventTimes();
+    const PointerCoords* samplePointerCoords = event.getSamplePointerCoords();
+
+    initializeEventWithHistory(&event);
+    ASSERT_EQ(sampleEventTimes, event.getSampleEventTimes())
+            << "samples should fit in the reserved storage";
+    ASSERT_EQ(samplePointerCoords, event.getSamplePointerCoords())
+            << "samples should fit in the reserved storage";
+
+    // Initializing the event again, as the event factories do, should reuse the storage.
+    initializeEventWithHistory(&event);
+    ASSERT_EQ(sampleEventTimes, event.getSampleEventTimes())
+            << "reinitialized event should reuse its sample storage";
+    ASSERT_EQ(samplePointerCoords, event.getSamplePointerCoords())
+            << "reinitialized event should reuse its sample storage";
+    ASSERT_NO_FATAL_FAILURE(assertEqualsEventWithHistory(&event));
+}
+
 TEST_F(MotionEventTest, OffsetLocation) {
     MotionEvent event;
     initializeEventWithHistory(&event);
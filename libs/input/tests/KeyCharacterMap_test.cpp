@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <android/keycodes.h>
+#include <gtest/gtest.h>
+#include <input/KeyCharacterMap.h>
+
+namespace android {
+
+static const char* BASE_CONTENTS =
+        "type FULL\n"
+        "\n"
+        "key A {\n"
+        "    label: 'A'\n"
+        "    base: 'a'\n"
+        "    shift: 'A'\n"
+        "}\n"
+        "\n"
+        "key B {\n"
+        "    label: 'B'\n"
+        "    base: 'b'\n"
+        "    shift: 'B'\n"
+        "}\n"
+        "\n"
+        "key 1 {\n"
+        "    label: '1'\n"
+        "    base: '1'\n"
+        "}\n"
+        "\n"
+        "key NUMPAD_1 {\n"
+        "    label: '1'\n"
+        "    base: '1'\n"
+        "}\n";
+
+static const char* OVERLAY_CONTENTS =
+        "key A {\n"
+        "    label: 'Q'\n"
+        "    base: 'q'\n"
+        "    shift: 'Q'\n"
+        "}\n";
+
+class KeyCharacterMapTest : public testing::Test {
+protected:
+    virtual void SetUp() {
+        ASSERT_EQ(OK, KeyCharacterMap::loadContents(String8("base.kcm"), BASE_CONTENTS,
+                KeyCharacterMap::FORMAT_BASE, &mBase));
+        ASSERT_EQ(OK, KeyCharacterMap::loadContents(String8("overlay.kcm"), OVERLAY_CONTENTS,
+                KeyCharacterMap::FORMAT_OVERLAY, &mOverlay));
+    }
+
+    sp<KeyCharacterMap> mBase;
+    sp<KeyCharacterMap> mOverlay;
+};
+
+TEST_F(KeyCharacterMapTest, GetEventsMapsCharactersToKeys) {
+    const char16_t chars[] = { 'a', 'b' };
+    Vector<KeyEvent> events;
+    ASSERT_TRUE(mBase->getEvents(1, chars, 2, events));
+
+    ASSERT_EQ(4U, events.size());
+    EXPECT_EQ(AKEYCODE_A, events[0].getKeyCode());
+    EXPECT_EQ(AKEY_EVENT_ACTION_DOWN, events[0].getAction());
+    EXPECT_EQ(0, events[0].getMetaState());
+    EXPECT_EQ(AKEYCODE_A, events[1].getKeyCode());
+    EXPECT_EQ(AKEY_EVENT_ACTION_UP, events[1].getAction());
+    EXPECT_EQ(AKEYCODE_B, events[2].getKeyCode());
+    EXPECT_EQ(AKEYCODE_B, events[3].getKeyCode());
+}
+
+TEST_F(KeyCharacterMapTest, GetEventsAddsMetaKeys) {
+    const char16_t chars[] = { 'B' };
+    Vector<KeyEvent> events;
+    ASSERT_TRUE(mBase->getEvents(1, chars, 1, events));
+
+    // shift down, B down, B up, shift up
+    ASSERT_EQ(4U, events.size());
+    EXPECT_EQ(AKEYCODE_SHIFT_LEFT, events[0].getKeyCode());
+    EXPECT_EQ(AKEYCODE_B, events[1].getKeyCode());
+    EXPECT_TRUE(events[1].getMetaState() & AMETA_SHIFT_ON);
+    EXPECT_EQ(AKEYCODE_SHIFT_LEFT, events[3].getKeyCode());
+}
+
+TEST_F(KeyCharacterMapTest, GetEventsPrefersLowestKeyCode) {
+    const char16_t chars[] = { '1' };
+    Vector<KeyEvent> events;
+    ASSERT_TRUE(mBase->getEvents(1, chars, 1, events));
+
+    ASSERT_EQ(2U, events.size());
+    EXPECT_EQ(AKEYCODE_1, events[0].getKeyCode());
+}
+
+TEST_F(KeyCharacterMapTest, GetEventsFailsOnUnmappedCharacter) {
+    const char16_t chars[] = { 'a', 'z' };
+    Vector<KeyEvent> events;
+    EXPECT_FALSE(mBase->getEvents(1, chars, 2, events));
+}
+
+TEST_F(KeyCharacterMapTest, CombinedMapHasItsOwnIndex) {
+    const char16_t a[] = { 'a' };
+    const char16_t q[] = { 'q' };
+    Vector<KeyEvent> events;
+
+    // Make sure the base index is built before combining
+    ASSERT_TRUE(mBase->getEvents(1, a, 1, events));
+
+    sp<KeyCharacterMap> combined = KeyCharacterMap::combine(mBase, mOverlay);
+    events.clear();
+    EXPECT_FALSE(combined->getEvents(1, a, 1, events));
+
+    events.clear();
+    ASSERT_TRUE(combined->getEvents(1, q, 1, events));
+    ASSERT_EQ(2U, events.size());
+    EXPECT_EQ(AKEYCODE_A, events[0].getKeyCode());
+
+    // The base map is unchanged
+    events.clear();
+    EXPECT_TRUE(mBase->getEvents(1, a, 1, events));
+}
+
+} // namespace android
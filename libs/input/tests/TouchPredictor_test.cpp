@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+
+#include <gtest/gtest.h>
+#include <input/Input.h>
+#include <input/TouchPredictor.h>
+
+namespace android {
+
+// Nanoseconds per milliseconds.
+static const nsecs_t NANOS_PER_MS = 1000000;
+
+// A finger moving right at one pixel per millisecond, sampled every 8 ms.
+static const nsecs_t SAMPLE_INTERVAL = 8 * NANOS_PER_MS;
+static const float VELOCITY = 1.0f / NANOS_PER_MS;
+
+class TouchPredictorTest : public testing::Test {
+protected:
+    MotionEvent mEvent;
+
+    void initializeEvent(int32_t action, nsecs_t eventTime) {
+        initializeEvent(action, eventTime, eventTime * VELOCITY);
+    }
+
+    void initializeEvent(int32_t action, nsecs_t eventTime, float x) {
+        PointerProperties properties;
+        properties.clear();
+        properties.id = 0;
+        properties.toolType = AMOTION_EVENT_TOOL_TYPE_FINGER;
+
+        PointerCoords coords;
+        coords.clear();
+        coords.setAxisValue(AMOTION_EVENT_AXIS_X, x);
+        coords.setAxisValue(AMOTION_EVENT_AXIS_Y, 100);
+
+        mEvent.initialize(1, AINPUT_SOURCE_TOUCHSCREEN, action, 0, 0, 0, AMETA_NONE, 0,
+                0, 0, 1, 1, 0, eventTime, 1, &properties, &coords);
+    }
+
+    // Moves the finger for count samples after a down at time 0.
+    void move(TouchPredictor& predictor, size_t count) {
+        initializeEvent(AMOTION_EVENT_ACTION_DOWN, 0);
+        predictor.addMovement(&mEvent);
+        for (size_t i = 1; i <= count; i++) {
+            initializeEvent(AMOTION_EVENT_ACTION_MOVE, nsecs_t(i) * SAMPLE_INTERVAL);
+            predictor.addMovement(&mEvent);
+        }
+    }
+
+    void checkPrediction(TouchPredictor& predictor, float tolerance) {
+        MotionEvent prediction;
+        ASSERT_TRUE(predictor.predict(&mEvent, 16 * NANOS_PER_MS, &prediction))
+                << "predict should succeed after a few moves";
+        EXPECT_TRUE(prediction.getFlags() & AMOTION_EVENT_FLAG_PREDICTED)
+                << "prediction should be flagged as predicted";
+        ASSERT_EQ(1U, prediction.getHistorySize())
+                << "prediction should have a sample per sample interval";
+        EXPECT_EQ(mEvent.getEventTime() + SAMPLE_INTERVAL, prediction.getHistoricalEventTime(0));
+        EXPECT_EQ(mEvent.getEventTime() + 2 * SAMPLE_INTERVAL, prediction.getEventTime());
+        EXPECT_NEAR(prediction.getEventTime() * VELOCITY, prediction.getX(0), tolerance)
+                << "prediction should continue the movement";
+        EXPECT_NEAR(100, prediction.getY(0), tolerance)
+                << "prediction should continue the movement";
+    }
+};
+
+TEST_F(TouchPredictorTest, Predict_WithLeastSquares_ContinuesLinearMovement) {
+    TouchPredictor predictor("lsq2");
+    move(predictor, 10);
+    checkPrediction(predictor, 0.1f);
+}
+
+TEST_F(TouchPredictorTest, Predict_WithKalmanFilter_ContinuesLinearMovement) {
+    TouchPredictor predictor("kalman");
+    move(predictor, 20);
+    checkPrediction(predictor, 0.5f);
+}
+
+TEST_F(TouchPredictorTest, Predict_WithoutMovement_Fails) {
+    TouchPredictor predictor;
+    initializeEvent(AMOTION_EVENT_ACTION_DOWN, 0);
+    predictor.addMovement(&mEvent);
+
+    MotionEvent prediction;
+    EXPECT_FALSE(predictor.predict(&mEvent, 16 * NANOS_PER_MS, &prediction))
+            << "predict should fail for a down";
+}
+
+TEST_F(TouchPredictorTest, AddMovement_AfterPredict_RecordsAccuracy) {
+    TouchPredictor predictor("lsq2");
+    move(predictor, 10);
+
+    MotionEvent prediction;
+    ASSERT_TRUE(predictor.predict(&mEvent, 16 * NANOS_PER_MS, &prediction));
+    EXPECT_EQ(0U, predictor.getAccuracy().count)
+            << "nothing should be checked before the pointer moves on";
+
+    // The finger keeps going for one sample, then stops dead for the next.
+    initializeEvent(AMOTION_EVENT_ACTION_MOVE, 11 * SAMPLE_INTERVAL);
+    predictor.addMovement(&mEvent);
+    EXPECT_EQ(1U, predictor.getAccuracy().count)
+            << "the first predicted sample should have been checked";
+    EXPECT_NEAR(0, predictor.getAccuracy().maxError, 0.1f);
+
+    initializeEvent(AMOTION_EVENT_ACTION_MOVE, 12 * SAMPLE_INTERVAL, mEvent.getX(0));
+    predictor.addMovement(&mEvent);
+    EXPECT_EQ(2U, predictor.getAccuracy().count)
+            << "the second predicted sample should have been checked";
+    EXPECT_NEAR(SAMPLE_INTERVAL * VELOCITY, predictor.getAccuracy().maxError, 0.1f)
+            << "the prediction should have overshot where the finger stopped";
+}
+
+} // namespace android
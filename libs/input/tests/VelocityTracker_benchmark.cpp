@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Microbenchmarks of a velocity estimate as the input pipeline asks for it:
+ * one movement added and the velocity of every pointer read, for the running
+ * sums of "lsq2" and the QR decomposition of "lsq2-qr", by pointer count.
+ */
+
+#include <math.h>
+
+#include <benchmark/benchmark.h>
+#include <input/VelocityTracker.h>
+
+namespace android {
+
+// Nanoseconds per milliseconds.
+static const nsecs_t NANOS_PER_MS = 1000000;
+
+static void benchmarkStrategy(benchmark::State& state, const char* strategy) {
+    const uint32_t pointerCount = state.range(0);
+    VelocityTracker tracker(strategy);
+    BitSet32 idBits;
+    for (uint32_t id = 0; id < pointerCount; id++) {
+        idBits.markBit(id);
+    }
+    VelocityTracker::Position positions[MAX_POINTERS];
+    nsecs_t eventTime = 0;
+    while (state.KeepRunning()) {
+        eventTime += 8 * NANOS_PER_MS;
+        const float t = eventTime * 1e-9f;
+        for (uint32_t i = 0; i < pointerCount; i++) {
+            positions[i].x = 500 + 300 * sinf(t * 5 + i);
+            positions[i].y = 800 + 200 * cosf(t * 3 + i);
+        }
+        tracker.addMovement(eventTime, idBits, positions);
+        for (uint32_t id = 0; id < pointerCount; id++) {
+            float vx, vy;
+            benchmark::DoNotOptimize(tracker.getVelocity(id, &vx, &vy));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * pointerCount);
+}
+
+static void BM_Lsq2(benchmark::State& state) {
+    benchmarkStrategy(state, "lsq2");
+}
+
+static void BM_Lsq2Qr(benchmark::State& state) {
+    benchmarkStrategy(state, "lsq2-qr");
+}
+
+BENCHMARK(BM_Lsq2)->Arg(1)->Arg(2)->Arg(5)->Arg(10);
+BENCHMARK(BM_Lsq2Qr)->Arg(1)->Arg(2)->Arg(5)->Arg(10);
+
+} // namespace android
+
+BENCHMARK_MAIN();
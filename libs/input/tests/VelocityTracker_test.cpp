@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+
+#include <gtest/gtest.h>
+#include <input/VelocityTracker.h>
+
+namespace android {
+
+// Nanoseconds per milliseconds.
+static const nsecs_t NANOS_PER_MS = 1000000;
+
+class VelocityTrackerTest : public testing::Test {
+protected:
+    // Feeds the same curved movements of pointers 0 and 3 to both trackers, with uneven
+    // sampling, a pause longer than the fit horizon and pointer 3 going up now and then,
+    // and checks that they agree after each movement.
+    void expectSameEstimates(VelocityTracker& tracker, VelocityTracker& reference) {
+        nsecs_t eventTime = 0;
+        for (int i = 0; i < 1000; i++) {
+            eventTime += (i % 3 == 0 ? 4 : 8) * NANOS_PER_MS + (i % 7) * 100000;
+            if (i == 500) {
+                eventTime += 300 * NANOS_PER_MS;
+            }
+            const float t = eventTime * 1e-9f;
+
+            BitSet32 idBits;
+            idBits.markBit(0);
+            if ((i / 37) % 2) {
+                idBits.markBit(3);
+            }
+            VelocityTracker::Position positions[2];
+            positions[0].x = 500 + 300 * sinf(t * 5);
+            positions[0].y = 800 + 200 * cosf(t * 3);
+            positions[1].x = 100 + 50 * t;
+            positions[1].y = 1900 - 40 * t * t;
+            tracker.addMovement(eventTime, idBits, positions);
+            reference.addMovement(eventTime, idBits, positions);
+
+            for (uint32_t id = 0; id <= 3; id += 3) {
+                float vx, vy, referenceVx, referenceVy;
+                bool valid = tracker.getVelocity(id, &vx, &vy);
+                ASSERT_EQ(reference.getVelocity(id, &referenceVx, &referenceVy), valid)
+                        << "movement " << i << " pointer " << id;
+                if (valid) {
+                    // The reference solves in single precision.
+                    EXPECT_NEAR(referenceVx, vx, 2 + fabsf(referenceVx) * 0.02f)
+                            << "movement " << i << " pointer " << id;
+                    EXPECT_NEAR(referenceVy, vy, 2 + fabsf(referenceVy) * 0.02f)
+                            << "movement " << i << " pointer " << id;
+                }
+            }
+        }
+    }
+};
+
+TEST_F(VelocityTrackerTest, Lsq2_MatchesQrSolution) {
+    VelocityTracker tracker("lsq2");
+    VelocityTracker reference("lsq2-qr");
+    expectSameEstimates(tracker, reference);
+}
+
+TEST_F(VelocityTrackerTest, Lsq2_RecoversQuadraticExactly) {
+    VelocityTracker tracker("lsq2");
+    BitSet32 idBits;
+    idBits.markBit(0);
+    for (int i = 0; i < 20; i++) {
+        const nsecs_t eventTime = 1000 * NANOS_PER_MS + i * 8 * NANOS_PER_MS;
+        const float t = i * 0.008f;
+        VelocityTracker::Position position;
+        position.x = 100 + 1000 * t;
+        position.y = 100 + 500 * t * t;
+        tracker.addMovement(eventTime, idBits, &position);
+    }
+
+    VelocityTracker::Estimator estimator;
+    ASSERT_TRUE(tracker.getEstimator(0, &estimator));
+    EXPECT_EQ(2U, estimator.degree);
+    EXPECT_NEAR(1000, estimator.xCoeff[1], 0.5);
+    EXPECT_NEAR(0, estimator.xCoeff[2], 0.5);
+    EXPECT_NEAR(500 * 2 * 0.152, estimator.yCoeff[1], 0.5);
+    EXPECT_NEAR(500, estimator.yCoeff[2], 0.5);
+    EXPECT_NEAR(1, estimator.confidence, 1e-4);
+}
+
+TEST_F(VelocityTrackerTest, Lsq2_ClearForgetsMovements) {
+    VelocityTracker tracker("lsq2");
+    BitSet32 idBits;
+    idBits.markBit(0);
+    VelocityTracker::Position position;
+    position.x = 0;
+    position.y = 0;
+    for (int i = 0; i < 5; i++) {
+        position.x += 10;
+        tracker.addMovement(i * 8 * NANOS_PER_MS, idBits, &position);
+    }
+    tracker.clear();
+
+    tracker.addMovement(100 * NANOS_PER_MS, idBits, &position);
+    VelocityTracker::Estimator estimator;
+    ASSERT_TRUE(tracker.getEstimator(0, &estimator));
+    EXPECT_EQ(0U, estimator.degree);
+    EXPECT_EQ(position.x, estimator.xCoeff[0]);
+}
+
+} // namespace android
@@ -16,11 +16,20 @@
 
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 #include <iosfwd>
 #include <limits>
 #include <type_traits>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define HALF_SIMD_SSE2 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HALF_SIMD_NEON 1
+#endif
+
 #ifndef LIKELY
 #define LIKELY_DEFINED_LOCAL
 #ifdef __cplusplus
@@ -89,6 +98,11 @@ public:
     unsigned int getExponent() const noexcept { return mBits.getE(); }
     unsigned int getMantissa() const noexcept { return mBits.getM(); }
 
+    // Convert count values, 4 at a time with SSE2 or NEON when available.
+    // The results are the same as half(float) and operator float().
+    static void convert(half* out, const float* in, size_t count) noexcept;
+    static void convert(float* out, const half* in, size_t count) noexcept;
+
 private:
     friend class std::numeric_limits<half>;
     friend CONSTEXPR half operator"" _hf(long double v);
@@ -150,6 +164,147 @@ inline CONSTEXPR float half::htof(half::fp16 in) noexcept {
     return out.fp;
 }
 
+#if defined(HALF_SIMD_SSE2)
+
+inline void half::convert(half* out, const float* in, size_t count) noexcept {
+    static_assert(sizeof(half) == sizeof(uint16_t), "half must be 16 bits");
+    // ftoh() on 4 lanes of 32 bits
+    const __m128i exponentBias = _mm_set1_epi32(127 - 15);
+    const __m128i halfInfinity = _mm_set1_epi32(0x7C00);
+    // same bits as ftoh()'s overflow case
+    const __m128i overflow = _mm_set1_epi32((0x31 << 10) & 0x7FFF);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m128i v = _mm_castps_si128(_mm_loadu_ps(in + i));
+        const __m128i s = _mm_srli_epi32(_mm_and_si128(v, _mm_set1_epi32(INT32_MIN)), 16);
+        const __m128i e = _mm_and_si128(_mm_srli_epi32(v, 23), _mm_set1_epi32(0xFF));
+        const __m128i m = _mm_and_si128(v, _mm_set1_epi32(0x7FFFFF));
+        const __m128i he = _mm_sub_epi32(e, exponentBias);
+
+        __m128i h = _mm_or_si128(_mm_slli_epi32(he, 10), _mm_srli_epi32(m, 13));
+        h = _mm_add_epi32(h, _mm_srli_epi32(_mm_and_si128(m, _mm_set1_epi32(0x1000)), 12));
+        const __m128i overflows = _mm_cmpgt_epi32(he, _mm_set1_epi32(0x1E));
+        h = _mm_or_si128(_mm_and_si128(overflows, overflow), _mm_andnot_si128(overflows, h));
+        h = _mm_andnot_si128(_mm_cmplt_epi32(he, _mm_set1_epi32(1)), h);
+        const __m128i infOrNan = _mm_cmpeq_epi32(e, _mm_set1_epi32(0xFF));
+        const __m128i nan = _mm_andnot_si128(_mm_cmpeq_epi32(m, _mm_setzero_si128()),
+                _mm_set1_epi32(0x200));
+        h = _mm_or_si128(_mm_and_si128(infOrNan, _mm_or_si128(halfInfinity, nan)),
+                _mm_andnot_si128(infOrNan, h));
+        h = _mm_or_si128(s, h);
+
+        // sign extend so that the signed saturation keeps the 16 low bits
+        h = _mm_srai_epi32(_mm_slli_epi32(h, 16), 16);
+        _mm_storel_epi64(static_cast<__m128i*>(static_cast<void*>(out + i)),
+                _mm_packs_epi32(h, h));
+    }
+    for (; i < count; i++) {
+        out[i] = half(in[i]);
+    }
+}
+
+inline void half::convert(float* out, const half* in, size_t count) noexcept {
+    // htof() on 4 lanes of 32 bits
+    const __m128i exponentBias = _mm_set1_epi32(127 - 15);
+    const __m128i floatInfinity = _mm_set1_epi32(0x7F800000);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m128i v = _mm_unpacklo_epi16(_mm_loadl_epi64(
+                static_cast<const __m128i*>(static_cast<const void*>(in + i))),
+                _mm_setzero_si128());
+        const __m128i s = _mm_slli_epi32(_mm_and_si128(v, _mm_set1_epi32(0x8000)), 16);
+        const __m128i e = _mm_and_si128(_mm_srli_epi32(v, 10), _mm_set1_epi32(0x1F));
+        const __m128i m = _mm_and_si128(v, _mm_set1_epi32(0x3FF));
+
+        __m128i f = _mm_or_si128(_mm_slli_epi32(_mm_add_epi32(e, exponentBias), 23),
+                _mm_slli_epi32(m, 13));
+        // denormals are flushed to zero
+        f = _mm_andnot_si128(_mm_cmpeq_epi32(e, _mm_setzero_si128()), f);
+        const __m128i infOrNan = _mm_cmpeq_epi32(e, _mm_set1_epi32(0x1F));
+        const __m128i nan = _mm_andnot_si128(_mm_cmpeq_epi32(m, _mm_setzero_si128()),
+                _mm_set1_epi32(0x400000));
+        f = _mm_or_si128(_mm_and_si128(infOrNan, _mm_or_si128(floatInfinity, nan)),
+                _mm_andnot_si128(infOrNan, f));
+        _mm_storeu_ps(out + i, _mm_castsi128_ps(_mm_or_si128(s, f)));
+    }
+    for (; i < count; i++) {
+        out[i] = float(in[i]);
+    }
+}
+
+#elif defined(HALF_SIMD_NEON)
+
+inline void half::convert(half* out, const float* in, size_t count) noexcept {
+    static_assert(sizeof(half) == sizeof(uint16_t), "half must be 16 bits");
+    // ftoh() on 4 lanes of 32 bits
+    const int32x4_t exponentBias = vdupq_n_s32(127 - 15);
+    const uint32x4_t halfInfinity = vdupq_n_u32(0x7C00);
+    // same bits as ftoh()'s overflow case
+    const uint32x4_t overflow = vdupq_n_u32((0x31 << 10) & 0x7FFF);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const uint32x4_t v = vreinterpretq_u32_f32(vld1q_f32(in + i));
+        const uint32x4_t s = vshrq_n_u32(vandq_u32(v, vdupq_n_u32(0x80000000)), 16);
+        const uint32x4_t e = vandq_u32(vshrq_n_u32(v, 23), vdupq_n_u32(0xFF));
+        const uint32x4_t m = vandq_u32(v, vdupq_n_u32(0x7FFFFF));
+        const int32x4_t he = vsubq_s32(vreinterpretq_s32_u32(e), exponentBias);
+
+        uint32x4_t h = vorrq_u32(vshlq_n_u32(vreinterpretq_u32_s32(he), 10), vshrq_n_u32(m, 13));
+        h = vaddq_u32(h, vshrq_n_u32(vandq_u32(m, vdupq_n_u32(0x1000)), 12));
+        h = vbslq_u32(vcgtq_s32(he, vdupq_n_s32(0x1E)), overflow, h);
+        h = vbicq_u32(h, vcltq_s32(he, vdupq_n_s32(1)));
+        const uint32x4_t nan = vbicq_u32(vdupq_n_u32(0x200), vceqq_u32(m, vdupq_n_u32(0)));
+        h = vbslq_u32(vceqq_u32(e, vdupq_n_u32(0xFF)), vorrq_u32(halfInfinity, nan), h);
+        h = vorrq_u32(s, h);
+
+        vst1_u16(static_cast<uint16_t*>(static_cast<void*>(out + i)), vmovn_u32(h));
+    }
+    for (; i < count; i++) {
+        out[i] = half(in[i]);
+    }
+}
+
+inline void half::convert(float* out, const half* in, size_t count) noexcept {
+    // htof() on 4 lanes of 32 bits
+    const uint32x4_t exponentBias = vdupq_n_u32(127 - 15);
+    const uint32x4_t floatInfinity = vdupq_n_u32(0x7F800000);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const uint32x4_t v = vmovl_u16(vld1_u16(
+                static_cast<const uint16_t*>(static_cast<const void*>(in + i))));
+        const uint32x4_t s = vshlq_n_u32(vandq_u32(v, vdupq_n_u32(0x8000)), 16);
+        const uint32x4_t e = vandq_u32(vshrq_n_u32(v, 10), vdupq_n_u32(0x1F));
+        const uint32x4_t m = vandq_u32(v, vdupq_n_u32(0x3FF));
+
+        uint32x4_t f = vorrq_u32(vshlq_n_u32(vaddq_u32(e, exponentBias), 23),
+                vshlq_n_u32(m, 13));
+        // denormals are flushed to zero
+        f = vbicq_u32(f, vceqq_u32(e, vdupq_n_u32(0)));
+        const uint32x4_t nan = vbicq_u32(vdupq_n_u32(0x400000), vceqq_u32(m, vdupq_n_u32(0)));
+        f = vbslq_u32(vceqq_u32(e, vdupq_n_u32(0x1F)), vorrq_u32(floatInfinity, nan), f);
+        vst1q_f32(out + i, vreinterpretq_f32_u32(vorrq_u32(s, f)));
+    }
+    for (; i < count; i++) {
+        out[i] = float(in[i]);
+    }
+}
+
+#else
+
+inline void half::convert(half* out, const float* in, size_t count) noexcept {
+    for (size_t i = 0; i < count; i++) {
+        out[i] = half(in[i]);
+    }
+}
+
+inline void half::convert(float* out, const half* in, size_t count) noexcept {
+    for (size_t i = 0; i < count; i++) {
+        out[i] = float(in[i]);
+    }
+}
+
+#endif
+
 inline CONSTEXPR android::half operator"" _hf(long double v) {
     return android::half(android::half::binary, android::half::ftoh(static_cast<float>(v)).bits);
 }
@@ -210,3 +365,5 @@ public:
 #endif // LIKELY_DEFINED_LOCAL
 
 #undef CONSTEXPR
+#undef HALF_SIMD_SSE2
+#undef HALF_SIMD_NEON
@@ -26,6 +26,14 @@
 #include <sys/types.h>
 #include <limits>
 
+#if defined(__SSE2__)
+#include <xmmintrin.h>
+#define MATH_SIMD_SSE 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define MATH_SIMD_NEON 1
+#endif
+
 #define PURE __attribute__((pure))
 
 #if __cplusplus >= 201402L
@@ -561,6 +569,164 @@ operator *(U lhs, const TMat44<T>& rhs) {
     return rhs * lhs;
 }
 
+// ----------------------------------------------------------------------------------------
+// SIMD specializations for float
+// ----------------------------------------------------------------------------------------
+
+/*
+ * mat4 is 4 contiguous float4 columns, so each column fits one SSE or NEON
+ * register. The specializations below replace the generic loops of
+ * TMatHelpers.h for mat4 * mat4, mat4 * float4, transpose() and inverse().
+ * They are not constexpr; use mat4d (or build without SIMD) for compile time
+ * evaluation.
+ */
+
+#if defined(MATH_SIMD_SSE) || defined(MATH_SIMD_NEON)
+
+namespace simd {
+
+#if defined(MATH_SIMD_SSE)
+typedef __m128 float32x4;
+inline float32x4 load(const float* p) { return _mm_loadu_ps(p); }
+inline void store(float* p, float32x4 v) { _mm_storeu_ps(p, v); }
+inline float32x4 set(float a, float b, float c, float d) { return _mm_setr_ps(a, b, c, d); }
+inline float32x4 splat(float v) { return _mm_set1_ps(v); }
+inline float32x4 add(float32x4 a, float32x4 b) { return _mm_add_ps(a, b); }
+inline float32x4 sub(float32x4 a, float32x4 b) { return _mm_sub_ps(a, b); }
+inline float32x4 mul(float32x4 a, float32x4 b) { return _mm_mul_ps(a, b); }
+#else
+typedef float32x4_t float32x4;
+inline float32x4 load(const float* p) { return vld1q_f32(p); }
+inline void store(float* p, float32x4 v) { vst1q_f32(p, v); }
+inline float32x4 set(float a, float b, float c, float d) {
+    const float lanes[4] = { a, b, c, d };
+    return vld1q_f32(lanes);
+}
+inline float32x4 splat(float v) { return vdupq_n_f32(v); }
+inline float32x4 add(float32x4 a, float32x4 b) { return vaddq_f32(a, b); }
+inline float32x4 sub(float32x4 a, float32x4 b) { return vsubq_f32(a, b); }
+inline float32x4 mul(float32x4 a, float32x4 b) { return vmulq_f32(a, b); }
+#endif
+
+// m * v, accumulated in the same order as the generic operator *
+inline float32x4 transform(const float* m, const float* v) {
+    float32x4 r = mul(load(m), splat(v[0]));
+    r = add(r, mul(load(m + 4), splat(v[1])));
+    r = add(r, mul(load(m + 8), splat(v[2])));
+    return add(r, mul(load(m + 12), splat(v[3])));
+}
+
+} // namespace simd
+
+namespace matrix {
+
+template <>
+inline TMat44<float> PURE multiply<TMat44<float>, TMat44<float>, TMat44<float>>(
+        const TMat44<float>& lhs, const TMat44<float>& rhs) {
+    TMat44<float> res(TMat44<float>::NO_INIT);
+    for (size_t col = 0; col < TMat44<float>::NUM_COLS; ++col) {
+        simd::store(&res[col][0], simd::transform(&lhs[0][0], &rhs[col][0]));
+    }
+    return res;
+}
+
+template <>
+inline TMat44<float> PURE transpose<TMat44<float>>(const TMat44<float>& m) {
+    TMat44<float> result(TMat44<float>::NO_INIT);
+#if defined(MATH_SIMD_SSE)
+    __m128 c0 = _mm_loadu_ps(&m[0][0]);
+    __m128 c1 = _mm_loadu_ps(&m[1][0]);
+    __m128 c2 = _mm_loadu_ps(&m[2][0]);
+    __m128 c3 = _mm_loadu_ps(&m[3][0]);
+    _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+    _mm_storeu_ps(&result[0][0], c0);
+    _mm_storeu_ps(&result[1][0], c1);
+    _mm_storeu_ps(&result[2][0], c2);
+    _mm_storeu_ps(&result[3][0], c3);
+#else
+    // de-interleaving the 16 floats by 4 gathers the rows
+    const float32x4x4_t rows = vld4q_f32(&m[0][0]);
+    vst1q_f32(&result[0][0], rows.val[0]);
+    vst1q_f32(&result[1][0], rows.val[1]);
+    vst1q_f32(&result[2][0], rows.val[2]);
+    vst1q_f32(&result[3][0], rows.val[3]);
+#endif
+    return result;
+}
+
+/*
+ * Analytic inverse from the cofactors, computed 4 at a time instead of
+ * gaussJordanInverse()'s row operations. Like the generic version, the
+ * result is undefined if the matrix isn't invertible.
+ */
+template <>
+inline TMat44<float> PURE inverse<TMat44<float>>(const TMat44<float>& m) {
+    using namespace simd;
+    // 2x2 sub-determinants of the last three columns, four at a time
+    const float32x4 fac0 = sub(
+            mul(set(m[2][2], m[2][2], m[1][2], m[1][2]), set(m[3][3], m[3][3], m[3][3], m[2][3])),
+            mul(set(m[3][2], m[3][2], m[3][2], m[2][2]), set(m[2][3], m[2][3], m[1][3], m[1][3])));
+    const float32x4 fac1 = sub(
+            mul(set(m[2][1], m[2][1], m[1][1], m[1][1]), set(m[3][3], m[3][3], m[3][3], m[2][3])),
+            mul(set(m[3][1], m[3][1], m[3][1], m[2][1]), set(m[2][3], m[2][3], m[1][3], m[1][3])));
+    const float32x4 fac2 = sub(
+            mul(set(m[2][1], m[2][1], m[1][1], m[1][1]), set(m[3][2], m[3][2], m[3][2], m[2][2])),
+            mul(set(m[3][1], m[3][1], m[3][1], m[2][1]), set(m[2][2], m[2][2], m[1][2], m[1][2])));
+    const float32x4 fac3 = sub(
+            mul(set(m[2][0], m[2][0], m[1][0], m[1][0]), set(m[3][3], m[3][3], m[3][3], m[2][3])),
+            mul(set(m[3][0], m[3][0], m[3][0], m[2][0]), set(m[2][3], m[2][3], m[1][3], m[1][3])));
+    const float32x4 fac4 = sub(
+            mul(set(m[2][0], m[2][0], m[1][0], m[1][0]), set(m[3][2], m[3][2], m[3][2], m[2][2])),
+            mul(set(m[3][0], m[3][0], m[3][0], m[2][0]), set(m[2][2], m[2][2], m[1][2], m[1][2])));
+    const float32x4 fac5 = sub(
+            mul(set(m[2][0], m[2][0], m[1][0], m[1][0]), set(m[3][1], m[3][1], m[3][1], m[2][1])),
+            mul(set(m[3][0], m[3][0], m[3][0], m[2][0]), set(m[2][1], m[2][1], m[1][1], m[1][1])));
+
+    const float32x4 vec0 = set(m[1][0], m[0][0], m[0][0], m[0][0]);
+    const float32x4 vec1 = set(m[1][1], m[0][1], m[0][1], m[0][1]);
+    const float32x4 vec2 = set(m[1][2], m[0][2], m[0][2], m[0][2]);
+    const float32x4 vec3 = set(m[1][3], m[0][3], m[0][3], m[0][3]);
+
+    const float32x4 signA = set( 1, -1,  1, -1);
+    const float32x4 signB = set(-1,  1, -1,  1);
+    const float32x4 inv0 = mul(signA,
+            add(sub(mul(vec1, fac0), mul(vec2, fac1)), mul(vec3, fac2)));
+    const float32x4 inv1 = mul(signB,
+            add(sub(mul(vec0, fac0), mul(vec2, fac3)), mul(vec3, fac4)));
+    const float32x4 inv2 = mul(signA,
+            add(sub(mul(vec0, fac1), mul(vec1, fac3)), mul(vec3, fac5)));
+    const float32x4 inv3 = mul(signB,
+            add(sub(mul(vec0, fac2), mul(vec1, fac4)), mul(vec2, fac5)));
+
+    TMat44<float> inverted(TMat44<float>::NO_INIT);
+    store(&inverted[0][0], inv0);
+    store(&inverted[1][0], inv1);
+    store(&inverted[2][0], inv2);
+    store(&inverted[3][0], inv3);
+
+    // the determinant is the dot product of the first column with the first
+    // row of the adjugate
+    const float det = m[0][0] * inverted[0][0] + m[0][1] * inverted[1][0] +
+            m[0][2] * inverted[2][0] + m[0][3] * inverted[3][0];
+    const float32x4 oneOverDet = splat(1.0f / det);
+    for (size_t col = 0; col < TMat44<float>::NUM_COLS; ++col) {
+        store(&inverted[col][0], mul(load(&inverted[col][0]), oneOverDet));
+    }
+    return inverted;
+}
+
+} // namespace matrix
+
+// matrix * column-vector
+template <>
+inline TVec4<float> PURE operator *<float, float>(const TMat44<float>& lhs, const TVec4<float>& rhs) {
+    TVec4<float> result(TVec4<float>::NO_INIT);
+    simd::store(&result[0], simd::transform(&lhs[0][0], &rhs[0]));
+    return result;
+}
+
+#endif // MATH_SIMD_SSE || MATH_SIMD_NEON
+
 // ----------------------------------------------------------------------------------------
 
 /* FIXME: this should go into TMatSquareFunctions<> but for some reason
@@ -584,3 +750,5 @@ typedef details::TMat44<float> mat4f;
 
 #undef PURE
 #undef CONSTEXPR
+#undef MATH_SIMD_SSE
+#undef MATH_SIMD_NEON
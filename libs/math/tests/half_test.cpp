@@ -18,6 +18,9 @@
 
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include <vector>
 
 #include <math/half.h>
 #include <math/vec4.h>
@@ -82,6 +85,32 @@ TEST_F(HalfTest, Literals) {
 }
 
 
+// half::convert() has SSE2/NEON versions, which must give the same bits as
+// the scalar conversions
+TEST_F(HalfTest, Convert) {
+    std::vector<float> floats = {
+        0.0f, -0.0f, 1.0f, -2.0f, 1.0f/3, 1.0009765625f, 6.10352e-5f, 6.09756e-5f,
+        -5.96046e-8f, 65504.0f, 1e6f, -1e6f, NAN,
+        std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(),
+    };
+    for (int i = -2048; i <= 2048; i += 3) {
+        floats.push_back(i * 1.25f);
+    }
+
+    std::vector<half> halves(floats.size(), half(0.0f));
+    half::convert(halves.data(), floats.data(), floats.size());
+    for (size_t i = 0; i < floats.size(); i++) {
+        EXPECT_EQ(half(floats[i]).getBits(), halves[i].getBits()) << floats[i];
+    }
+
+    std::vector<float> converted(halves.size());
+    half::convert(converted.data(), halves.data(), halves.size());
+    for (size_t i = 0; i < halves.size(); i++) {
+        const float expected = halves[i];
+        EXPECT_EQ(0, memcmp(&expected, &converted[i], sizeof(float))) << expected;
+    }
+}
+
 TEST_F(HalfTest, Vec) {
     float4 f4(1,2,3,4);
     half4 h4(f4);
@@ -0,0 +1,173 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Microbenchmarks of the SIMD specializations of mat4 and half, each next to
+ * the generic loop it replaces. For machine-readable results, run with
+ *   libmath_benchmark --benchmark_format=json
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <math/half.h>
+#include <math/mat4.h>
+
+#include <vector>
+
+namespace android {
+
+static const size_t NUM_VALUES = 1024;
+
+static mat4 makeMatrix() {
+    return mat4::translate(vec4(1, 2, 3, 1)) * mat4::rotate(0.5f, vec3(0, 0, 1)) *
+            mat4::scale(vec4(2, 3, 4, 1));
+}
+
+// The generic versions from TMatHelpers.h and mat4.h, which mat4 doesn't
+// use anymore
+static mat4 genericMultiply(const mat4& lhs, const mat4& rhs) {
+    mat4 res(mat4::NO_INIT);
+    for (size_t col = 0; col < mat4::NUM_COLS; ++col) {
+        vec4 result;
+        for (size_t k = 0; k < mat4::NUM_COLS; ++k) {
+            result += lhs[k] * rhs[col][k];
+        }
+        res[col] = result;
+    }
+    return res;
+}
+
+static vec4 genericTransform(const mat4& lhs, const vec4& rhs) {
+    vec4 result;
+    for (size_t col = 0; col < mat4::NUM_COLS; ++col) {
+        result += lhs[col] * rhs[col];
+    }
+    return result;
+}
+
+static mat4 genericTranspose(const mat4& m) {
+    mat4 result(mat4::NO_INIT);
+    for (size_t col = 0; col < mat4::NUM_COLS; ++col) {
+        for (size_t row = 0; row < mat4::NUM_ROWS; ++row) {
+            result[col][row] = m[row][col];
+        }
+    }
+    return result;
+}
+
+static void BM_MultiplyGeneric(benchmark::State& state) {
+    mat4 m(makeMatrix());
+    const mat4 n(inverse(m));
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(m = genericMultiply(m, n));
+    }
+}
+BENCHMARK(BM_MultiplyGeneric);
+
+static void BM_Multiply(benchmark::State& state) {
+    mat4 m(makeMatrix());
+    const mat4 n(inverse(m));
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(m = m * n);
+    }
+}
+BENCHMARK(BM_Multiply);
+
+static void BM_TransformGeneric(benchmark::State& state) {
+    const mat4 m(makeMatrix());
+    vec4 v(1, 2, 3, 1);
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(v = genericTransform(m, v));
+    }
+}
+BENCHMARK(BM_TransformGeneric);
+
+static void BM_Transform(benchmark::State& state) {
+    const mat4 m(makeMatrix());
+    vec4 v(1, 2, 3, 1);
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(v = m * v);
+    }
+}
+BENCHMARK(BM_Transform);
+
+static void BM_TransposeGeneric(benchmark::State& state) {
+    mat4 m(makeMatrix());
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(m = genericTranspose(m));
+    }
+}
+BENCHMARK(BM_TransposeGeneric);
+
+static void BM_Transpose(benchmark::State& state) {
+    mat4 m(makeMatrix());
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(m = transpose(m));
+    }
+}
+BENCHMARK(BM_Transpose);
+
+static void BM_InverseGeneric(benchmark::State& state) {
+    mat4 m(makeMatrix());
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(m = details::matrix::gaussJordanInverse(m));
+    }
+}
+BENCHMARK(BM_InverseGeneric);
+
+static void BM_Inverse(benchmark::State& state) {
+    mat4 m(makeMatrix());
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(m = inverse(m));
+    }
+}
+BENCHMARK(BM_Inverse);
+
+static void BM_HalfConvertScalar(benchmark::State& state) {
+    std::vector<float> floats(NUM_VALUES);
+    for (size_t i = 0; i < NUM_VALUES; i++) {
+        floats[i] = i * 0.25f;
+    }
+    std::vector<half> halves(NUM_VALUES, half(0.0f));
+    while (state.KeepRunning()) {
+        for (size_t i = 0; i < NUM_VALUES; i++) {
+            halves[i] = half(floats[i]);
+        }
+        for (size_t i = 0; i < NUM_VALUES; i++) {
+            floats[i] = halves[i];
+        }
+        benchmark::ClobberMemory();
+    }
+}
+BENCHMARK(BM_HalfConvertScalar);
+
+static void BM_HalfConvert(benchmark::State& state) {
+    std::vector<float> floats(NUM_VALUES);
+    for (size_t i = 0; i < NUM_VALUES; i++) {
+        floats[i] = i * 0.25f;
+    }
+    std::vector<half> halves(NUM_VALUES, half(0.0f));
+    while (state.KeepRunning()) {
+        half::convert(halves.data(), floats.data(), NUM_VALUES);
+        half::convert(floats.data(), halves.data(), NUM_VALUES);
+        benchmark::ClobberMemory();
+    }
+}
+BENCHMARK(BM_HalfConvert);
+
+} // namespace android
+
+BENCHMARK_MAIN();
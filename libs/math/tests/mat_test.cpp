@@ -162,6 +162,44 @@ TEST_F(MatTest, ElementAccess) {
     EXPECT_FLOAT_EQ(m(3, 2), 100);
 }
 
+// mat4 has SSE/NEON specializations, check them against the generic double
+// versions on random matrices
+TEST_F(MatTest, MatchesDouble) {
+    std::default_random_engine generator(171717);
+    std::uniform_real_distribution<float> distribution(-10.0f, 10.0f);
+    auto next = std::bind(distribution, generator);
+
+    for (size_t i = 0; i < 100; i++) {
+        mat4 a, b;
+        vec4 v(next(), next(), next(), next());
+        for (size_t c = 0; c < 4; c++) {
+            for (size_t r = 0; r < 4; r++) {
+                a[c][r] = next();
+                b[c][r] = next();
+            }
+        }
+        const mat4d ad(a);
+        const mat4d bd(b);
+
+        const mat4 product(a * b);
+        const mat4d productd(ad * bd);
+        const vec4 transformed(a * v);
+        const double4 transformedd(ad * double4(v));
+        const mat4 transposed(transpose(a));
+        const mat4 inverted(inverse(a));
+        const mat4d invertedd(inverse(ad));
+        for (size_t c = 0; c < 4; c++) {
+            for (size_t r = 0; r < 4; r++) {
+                EXPECT_NEAR(productd[c][r], product[c][r], 1e-3);
+                EXPECT_EQ(a[r][c], transposed[c][r]);
+                EXPECT_NEAR(invertedd[c][r], inverted[c][r],
+                        1e-3 * std::max(1.0, std::abs(invertedd[c][r])));
+            }
+            EXPECT_NEAR(transformedd[c], transformed[c], 1e-3);
+        }
+    }
+}
+
 //------------------------------------------------------------------------------
 // MAT 3
 //------------------------------------------------------------------------------
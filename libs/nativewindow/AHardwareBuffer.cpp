@@ -26,6 +26,7 @@
 #include <log/log.h>
 #include <utils/StrongPointer.h>
 #include <ui/GraphicBuffer.h>
+#include <ui/PixelFormat.h>
 #include <system/graphics.h>
 
 #include <private/android/AHardwareBufferHelpers.h>
@@ -130,6 +131,78 @@ int AHardwareBuffer_lock(AHardwareBuffer* buffer, uint64_t usage,
     return gBuffer->lockAsync(usage, usage, bounds, outVirtualAddress, fence);
 }
 
+int AHardwareBuffer_lockPlanes(AHardwareBuffer* buffer, uint64_t usage,
+        int32_t fence, const ARect* rect, AHardwareBuffer_Planes* outPlanes) {
+    if (!buffer || !outPlanes) return BAD_VALUE;
+
+    if (usage & ~(AHARDWAREBUFFER_USAGE_CPU_READ_MASK |
+                  AHARDWAREBUFFER_USAGE_CPU_WRITE_MASK)) {
+        ALOGE("Invalid usage flags passed to AHardwareBuffer_lockPlanes; only "
+                " AHARDWAREBUFFER_USAGE_CPU_* flags are allowed");
+        return BAD_VALUE;
+    }
+
+    usage = AHardwareBuffer_convertToGrallocUsageBits(usage);
+    GraphicBuffer* gBuffer = AHardwareBuffer_to_GraphicBuffer(buffer);
+    Rect bounds;
+    if (!rect) {
+        bounds.set(Rect(gBuffer->getWidth(), gBuffer->getHeight()));
+    } else {
+        bounds.set(Rect(rect->left, rect->top, rect->right, rect->bottom));
+    }
+
+    memset(outPlanes, 0, sizeof(*outPlanes));
+    const uint32_t format = uint32_t(gBuffer->getPixelFormat());
+    if (AHardwareBuffer_isYuvPixelFormat(format)) {
+        android_ycbcr ycbcr;
+        status_t err = gBuffer->lockAsyncYCbCr(uint32_t(usage), bounds, &ycbcr, fence);
+        if (err != NO_ERROR) {
+            return err;
+        }
+        outPlanes->planeCount = 3;
+        outPlanes->planes[0].data = ycbcr.y;
+        outPlanes->planes[0].pixelStride = 1;
+        outPlanes->planes[0].rowStride = uint32_t(ycbcr.ystride);
+        outPlanes->planes[1].data = ycbcr.cb;
+        outPlanes->planes[1].pixelStride = uint32_t(ycbcr.chroma_step);
+        outPlanes->planes[1].rowStride = uint32_t(ycbcr.cstride);
+        outPlanes->planes[2].data = ycbcr.cr;
+        outPlanes->planes[2].pixelStride = uint32_t(ycbcr.chroma_step);
+        outPlanes->planes[2].rowStride = uint32_t(ycbcr.cstride);
+        return NO_ERROR;
+    }
+
+    void* data = nullptr;
+    status_t err = gBuffer->lockAsync(usage, usage, bounds, &data, fence);
+    if (err != NO_ERROR) {
+        return err;
+    }
+    // The stride of the buffer is in pixels; packed formats (RAW10, ...) have
+    // none we can express in bytes, and report 0.
+    const uint32_t pixelStride = AHardwareBuffer_bytesPerPixel(format);
+    outPlanes->planeCount = 1;
+    outPlanes->planes[0].data = data;
+    outPlanes->planes[0].pixelStride = pixelStride;
+    outPlanes->planes[0].rowStride = pixelStride * gBuffer->getStride();
+    return NO_ERROR;
+}
+
+int AHardwareBuffer_relockPlanes(AHardwareBuffer* buffer, uint64_t usage,
+        int32_t fence, const ARect* rect, AHardwareBuffer_Planes* outPlanes) {
+    if (!buffer || !outPlanes) return BAD_VALUE;
+
+    // gralloc has no cache maintenance call of its own: unlocking is what
+    // flushes the CPU writes, and locking is what invalidates the CPU view.
+    // The lock doesn't wait for any fence from the unlock, since the caller
+    // was the only one using the buffer.
+    GraphicBuffer* gBuffer = AHardwareBuffer_to_GraphicBuffer(buffer);
+    status_t err = gBuffer->unlock();
+    if (err != NO_ERROR) {
+        return err;
+    }
+    return AHardwareBuffer_lockPlanes(buffer, usage, fence, rect, outPlanes);
+}
+
 int AHardwareBuffer_unlock(AHardwareBuffer* buffer, int32_t* fence) {
     if (!buffer) return BAD_VALUE;
 
@@ -379,6 +452,34 @@ bool AHardwareBuffer_isValidPixelFormat(uint32_t format) {
     }
 }
 
+bool AHardwareBuffer_isYuvPixelFormat(uint32_t format) {
+    switch (format) {
+        case AHARDWAREBUFFER_FORMAT_YV12:
+        case AHARDWAREBUFFER_FORMAT_Y8Cb8Cr8_420:
+        case AHARDWAREBUFFER_FORMAT_Y8Cb8Cr8_422:
+        case AHARDWAREBUFFER_FORMAT_Y8Cb8Cr8_444:
+        case AHARDWAREBUFFER_FORMAT_YCbCr_422_SP:
+        case AHARDWAREBUFFER_FORMAT_YCrCb_420_SP:
+        case AHARDWAREBUFFER_FORMAT_YCbCr_422_I:
+            return true;
+        default:
+            return false;
+    }
+}
+
+uint32_t AHardwareBuffer_bytesPerPixel(uint32_t format) {
+    switch (format) {
+        case AHARDWAREBUFFER_FORMAT_BLOB:
+        case AHARDWAREBUFFER_FORMAT_Y8:
+            return 1;
+        case AHARDWAREBUFFER_FORMAT_Y16:
+        case AHARDWAREBUFFER_FORMAT_RAW16:
+            return 2;
+        default:
+            return bytesPerPixel(PixelFormat(format));
+    }
+}
+
 uint32_t AHardwareBuffer_convertFromPixelFormat(uint32_t hal_format) {
     return hal_format;
 }
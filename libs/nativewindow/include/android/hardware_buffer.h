@@ -147,6 +147,24 @@ typedef struct AHardwareBuffer_Desc {
     uint64_t    rfu1;       // Initialize to zero, reserved for future use
 } AHardwareBuffer_Desc;
 
+/**
+ * One plane of a locked buffer, see AHardwareBuffer_lockPlanes().
+ */
+typedef struct AHardwareBuffer_Plane {
+    void*       data;           // first byte of the plane in the locked area
+    uint32_t    pixelStride;    // bytes from one pixel to the next, 0 if unknown
+    uint32_t    rowStride;      // bytes from one row to the next, 0 if unknown
+} AHardwareBuffer_Plane;
+
+/**
+ * The planes of a locked buffer: one for RGB and raw formats, three (Y, Cb
+ * and Cr, in that order) for YUV formats.
+ */
+typedef struct AHardwareBuffer_Planes {
+    uint32_t                planeCount;
+    AHardwareBuffer_Plane   planes[4];
+} AHardwareBuffer_Planes;
+
 typedef struct AHardwareBuffer AHardwareBuffer;
 
 /**
@@ -213,6 +231,43 @@ void AHardwareBuffer_describe(const AHardwareBuffer* buffer,
 int AHardwareBuffer_lock(AHardwareBuffer* buffer, uint64_t usage,
         int32_t fence, const ARect* rect, void** outVirtualAddress);
 
+/*
+ * Lock the AHardwareBuffer like AHardwareBuffer_lock(), and return the
+ * address, pixel stride and row stride of each of its planes. This is the
+ * only way to lock YUV formats, whose plane layout is up to the gralloc
+ * implementation: the Cb and Cr planes may be separate or interleaved
+ * (pixelStride 2), the buffer may be padded, etc.
+ *
+ * The buffer is unlocked with AHardwareBuffer_unlock().
+ *
+ * Returns NO_ERROR on success, BAD_VALUE if the buffer or outPlanes is NULL
+ * or if the usage flags are not a combination of AHARDWAREBUFFER_USAGE_CPU_*,
+ * or an error number if the lock fails for any reason.
+ */
+int AHardwareBuffer_lockPlanes(AHardwareBuffer* buffer, uint64_t usage,
+        int32_t fence, const ARect* rect, AHardwareBuffer_Planes* outPlanes);
+
+/*
+ * For a buffer that stays locked across frames: make the CPU writes done
+ * since it was locked visible to the other users of the buffer, and their
+ * writes visible to the CPU, i.e. flush and invalidate the CPU caches. The
+ * buffer is locked again with usage and rect, and since the mapping may
+ * change, outPlanes is updated; no pointer from the previous lock may be used
+ * after this call. If fence is not negative, the relock waits for it, e.g.
+ * the fence of the next frame written by the producer of the buffer.
+ *
+ * This is equivalent to AHardwareBuffer_unlock() followed by
+ * AHardwareBuffer_lockPlanes(), without a window where the buffer is
+ * unlocked for the caller.
+ *
+ * Returns NO_ERROR on success, BAD_VALUE if the buffer or outPlanes is NULL
+ * or if the usage flags are not a combination of AHARDWAREBUFFER_USAGE_CPU_*,
+ * or an error number if the unlock or the lock fails for any reason (e.g. if
+ * the buffer wasn't locked). The buffer is left unlocked if the lock fails.
+ */
+int AHardwareBuffer_relockPlanes(AHardwareBuffer* buffer, uint64_t usage,
+        int32_t fence, const ARect* rect, AHardwareBuffer_Planes* outPlanes);
+
 /*
  * Unlock the AHardwareBuffer; must be called after all changes to the buffer
  * are completed by the caller. If fence is not NULL then it will be set to a
@@ -35,6 +35,12 @@ namespace android {
 // whether this AHardwareBuffer format is valid
 bool AHardwareBuffer_isValidPixelFormat(uint32_t ahardwarebuffer_format);
 
+// whether this AHardwareBuffer format has separate Y, Cb and Cr planes
+bool AHardwareBuffer_isYuvPixelFormat(uint32_t ahardwarebuffer_format);
+
+// bytes per pixel of a single plane AHardwareBuffer format, 0 if packed
+uint32_t AHardwareBuffer_bytesPerPixel(uint32_t ahardwarebuffer_format);
+
 // convert AHardwareBuffer format to HAL format (note: this is a no-op)
 uint32_t AHardwareBuffer_convertFromPixelFormat(uint32_t format);
 
@@ -242,9 +242,39 @@ enum {
     NATIVE_WINDOW_GET_FRAME_TIMESTAMPS      = 27,
     NATIVE_WINDOW_GET_WIDE_COLOR_SUPPORT    = 28,
     NATIVE_WINDOW_GET_HDR_SUPPORT           = 29,
+    NATIVE_WINDOW_SET_FRAME_METADATA        = 30,
 // clang-format on
 };
 
+/* bits of android_native_frame_metadata_t::fields */
+enum {
+    NATIVE_WINDOW_FRAME_METADATA_DIMENSIONS     = 0x01,
+    NATIVE_WINDOW_FRAME_METADATA_CROP           = 0x02,
+    NATIVE_WINDOW_FRAME_METADATA_TRANSFORM      = 0x04,
+    NATIVE_WINDOW_FRAME_METADATA_SCALING_MODE   = 0x08,
+    NATIVE_WINDOW_FRAME_METADATA_TIMESTAMP      = 0x10,
+    NATIVE_WINDOW_FRAME_METADATA_DATASPACE      = 0x20,
+    NATIVE_WINDOW_FRAME_METADATA_SURFACE_DAMAGE = 0x40,
+};
+
+/*
+ * parameter for NATIVE_WINDOW_SET_FRAME_METADATA: the values of the separate
+ * per-frame setters, of which only the ones in fields are applied.
+ */
+typedef struct android_native_frame_metadata_t
+{
+    uint32_t fields;                /* NATIVE_WINDOW_FRAME_METADATA_* */
+    uint32_t width;                 /* native_window_set_buffers_dimensions */
+    uint32_t height;
+    android_native_rect_t crop;     /* native_window_set_crop */
+    uint32_t transform;             /* native_window_set_buffers_transform */
+    int scalingMode;                /* native_window_set_scaling_mode */
+    int64_t timestamp;              /* native_window_set_buffers_timestamp */
+    android_dataspace_t dataSpace;  /* native_window_set_buffers_data_space */
+    const android_native_rect_t* damageRects;   /* native_window_set_surface_damage */
+    size_t numDamageRects;
+} android_native_frame_metadata_t;
+
 /* parameter for NATIVE_WINDOW_[API_][DIS]CONNECT */
 enum {
     /* Buffers will be queued by EGL via eglSwapBuffers after being filled using
@@ -969,4 +999,59 @@ static inline int native_window_get_hdr_support(struct ANativeWindow* window,
   return window->perform(window, NATIVE_WINDOW_GET_HDR_SUPPORT, outSupport);
 }
 
+/*
+ * native_window_set_frame_metadata(..., const android_native_frame_metadata_t*)
+ * Sets all the per-frame state of the next queued buffer in one call, with the
+ * same meaning and validation as the separate setters, but taking the lock of
+ * the window once. Surface applies either all the fields or, if one of them is
+ * invalid, none.
+ *
+ * Windows that don't implement NATIVE_WINDOW_SET_FRAME_METADATA get the
+ * separate setters instead, so this can be used with any window; there, the
+ * fields before an invalid one are applied.
+ */
+static inline int native_window_set_frame_metadata(
+        struct ANativeWindow* window,
+        const android_native_frame_metadata_t* metadata)
+{
+    int err = window->perform(window, NATIVE_WINDOW_SET_FRAME_METADATA, metadata);
+    if (err != -ENOENT) {
+        return err;
+    }
+    if (metadata->fields & NATIVE_WINDOW_FRAME_METADATA_DIMENSIONS) {
+        err = window->perform(window, NATIVE_WINDOW_SET_BUFFERS_DIMENSIONS,
+                metadata->width, metadata->height);
+        if (err != 0) return err;
+    }
+    if (metadata->fields & NATIVE_WINDOW_FRAME_METADATA_CROP) {
+        err = window->perform(window, NATIVE_WINDOW_SET_CROP, &metadata->crop);
+        if (err != 0) return err;
+    }
+    if (metadata->fields & NATIVE_WINDOW_FRAME_METADATA_TRANSFORM) {
+        err = window->perform(window, NATIVE_WINDOW_SET_BUFFERS_TRANSFORM,
+                metadata->transform);
+        if (err != 0) return err;
+    }
+    if (metadata->fields & NATIVE_WINDOW_FRAME_METADATA_SCALING_MODE) {
+        err = window->perform(window, NATIVE_WINDOW_SET_SCALING_MODE,
+                metadata->scalingMode);
+        if (err != 0) return err;
+    }
+    if (metadata->fields & NATIVE_WINDOW_FRAME_METADATA_TIMESTAMP) {
+        err = window->perform(window, NATIVE_WINDOW_SET_BUFFERS_TIMESTAMP,
+                metadata->timestamp);
+        if (err != 0) return err;
+    }
+    if (metadata->fields & NATIVE_WINDOW_FRAME_METADATA_DATASPACE) {
+        err = window->perform(window, NATIVE_WINDOW_SET_BUFFERS_DATASPACE,
+                metadata->dataSpace);
+        if (err != 0) return err;
+    }
+    if (metadata->fields & NATIVE_WINDOW_FRAME_METADATA_SURFACE_DAMAGE) {
+        err = window->perform(window, NATIVE_WINDOW_SET_SURFACE_DAMAGE,
+                metadata->damageRects, metadata->numDamageRects);
+    }
+    return err;
+}
+
 __END_DECLS
@@ -18,8 +18,10 @@
 //#define LOG_NDEBUG 0
 
 #include <android/hardware_buffer.h>
+#include <vndk/hardware_buffer.h>
 #include <private/android/AHardwareBufferHelpers.h>
 #include <android/hardware/graphics/common/1.0/types.h>
+#include <utils/Errors.h>
 
 #include <gtest/gtest.h>
 
@@ -106,3 +108,29 @@ EXPECT_TRUE(TestUsageConversion(
         AHARDWAREBUFFER_USAGE_GPU_COLOR_OUTPUT | AHARDWAREBUFFER_USAGE_GPU_SAMPLED_IMAGE |
         AHARDWAREBUFFER_USAGE_VENDOR_1 | AHARDWAREBUFFER_USAGE_VENDOR_13));
 }
+
+TEST(AHardwareBufferTest, PlaneLayout) {
+    EXPECT_TRUE(AHardwareBuffer_isYuvPixelFormat(AHARDWAREBUFFER_FORMAT_Y8Cb8Cr8_420));
+    EXPECT_TRUE(AHardwareBuffer_isYuvPixelFormat(AHARDWAREBUFFER_FORMAT_YV12));
+    EXPECT_TRUE(AHardwareBuffer_isYuvPixelFormat(AHARDWAREBUFFER_FORMAT_YCrCb_420_SP));
+    EXPECT_FALSE(AHardwareBuffer_isYuvPixelFormat(AHARDWAREBUFFER_FORMAT_R8G8B8A8_UNORM));
+    EXPECT_FALSE(AHardwareBuffer_isYuvPixelFormat(AHARDWAREBUFFER_FORMAT_Y8));
+    EXPECT_FALSE(AHardwareBuffer_isYuvPixelFormat(AHARDWAREBUFFER_FORMAT_BLOB));
+
+    EXPECT_EQ(4U, AHardwareBuffer_bytesPerPixel(AHARDWAREBUFFER_FORMAT_R8G8B8A8_UNORM));
+    EXPECT_EQ(8U, AHardwareBuffer_bytesPerPixel(AHARDWAREBUFFER_FORMAT_R16G16B16A16_FLOAT));
+    EXPECT_EQ(3U, AHardwareBuffer_bytesPerPixel(AHARDWAREBUFFER_FORMAT_R8G8B8_UNORM));
+    EXPECT_EQ(2U, AHardwareBuffer_bytesPerPixel(AHARDWAREBUFFER_FORMAT_R5G6B5_UNORM));
+    EXPECT_EQ(1U, AHardwareBuffer_bytesPerPixel(AHARDWAREBUFFER_FORMAT_BLOB));
+    EXPECT_EQ(1U, AHardwareBuffer_bytesPerPixel(AHARDWAREBUFFER_FORMAT_Y8));
+    EXPECT_EQ(2U, AHardwareBuffer_bytesPerPixel(AHARDWAREBUFFER_FORMAT_Y16));
+    EXPECT_EQ(0U, AHardwareBuffer_bytesPerPixel(AHARDWAREBUFFER_FORMAT_RAW10));
+}
+
+TEST(AHardwareBufferTest, LockPlanesInvalidArguments) {
+    AHardwareBuffer_Planes planes;
+    EXPECT_EQ(BAD_VALUE, AHardwareBuffer_lockPlanes(nullptr,
+            AHARDWAREBUFFER_USAGE_CPU_READ_OFTEN, -1, nullptr, &planes));
+    EXPECT_EQ(BAD_VALUE, AHardwareBuffer_relockPlanes(nullptr,
+            AHARDWAREBUFFER_USAGE_CPU_READ_OFTEN, -1, nullptr, &planes));
+}
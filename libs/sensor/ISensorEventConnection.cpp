@@ -36,7 +36,9 @@ enum {
     ENABLE_DISABLE,
     SET_EVENT_RATE,
     FLUSH_SENSOR,
-    CONFIGURE_CHANNEL
+    CONFIGURE_CHANNEL,
+    SET_EVENT_RING,
+    CONFIGURE_CHANNELS
 };
 
 class BpSensorEventConnection : public BpInterface<ISensorEventConnection>
@@ -96,6 +98,39 @@ public:
         remote()->transact(CONFIGURE_CHANNEL, data, &reply);
         return reply.readInt32();
     }
+
+    virtual status_t configureChannels(const Vector<int32_t>& handles,
+                                       const Vector<int32_t>& rateLevels,
+                                       Vector<int32_t>* outResults) {
+        if (handles.size() != rateLevels.size()) {
+            return BAD_VALUE;
+        }
+        Parcel data, reply;
+        data.writeInterfaceToken(ISensorEventConnection::getInterfaceDescriptor());
+        data.writeUint32(static_cast<uint32_t>(handles.size()));
+        for (size_t i = 0; i < handles.size(); ++i) {
+            data.writeInt32(handles[i]);
+            data.writeInt32(rateLevels[i]);
+        }
+        remote()->transact(CONFIGURE_CHANNELS, data, &reply);
+        status_t result = reply.readInt32();
+        if (result == NO_ERROR) {
+            outResults->resize(handles.size());
+            for (auto &i : *outResults) {
+                i = reply.readInt32();
+            }
+        }
+        return result;
+    }
+
+    virtual status_t setEventRing(const native_handle_t* resource, uint32_t size) {
+        Parcel data, reply;
+        data.writeInterfaceToken(ISensorEventConnection::getInterfaceDescriptor());
+        data.writeNativeHandle(resource);
+        data.writeUint32(size);
+        remote()->transact(SET_EVENT_RING, data, &reply);
+        return reply.readInt32();
+    }
 };
 
 // Out-of-line virtual method definition to trigger vtable emission in this
@@ -150,6 +185,44 @@ status_t BnSensorEventConnection::onTransact(
             reply->writeInt32(result);
             return NO_ERROR;
         }
+        case SET_EVENT_RING: {
+            CHECK_INTERFACE(ISensorEventConnection, data, reply);
+            native_handle_t* resource = data.readNativeHandle();
+            uint32_t size = data.readUint32();
+            status_t result = resource != NULL ? setEventRing(resource, size) : BAD_VALUE;
+            if (resource != NULL) {
+                native_handle_close(resource);
+                native_handle_delete(resource);
+            }
+            reply->writeInt32(result);
+            return NO_ERROR;
+        }
+        case CONFIGURE_CHANNELS: {
+            CHECK_INTERFACE(ISensorEventConnection, data, reply);
+            const uint32_t count = data.readUint32();
+            if (count > data.dataAvail() / (2 * sizeof(int32_t))) {
+                reply->writeInt32(BAD_VALUE);
+                return NO_ERROR;
+            }
+            Vector<int32_t> handles, rateLevels, results;
+            handles.resize(count);
+            rateLevels.resize(count);
+            for (uint32_t i = 0; i < count; ++i) {
+                handles.editItemAt(i) = data.readInt32();
+                rateLevels.editItemAt(i) = data.readInt32();
+            }
+            status_t result = configureChannels(handles, rateLevels, &results);
+            if (result == NO_ERROR && results.size() != count) {
+                result = UNKNOWN_ERROR;
+            }
+            reply->writeInt32(result);
+            if (result == NO_ERROR) {
+                for (auto i : results) {
+                    reply->writeInt32(i);
+                }
+            }
+            return NO_ERROR;
+        }
 
     }
     return BBinder::onTransact(code, data, reply, flags);
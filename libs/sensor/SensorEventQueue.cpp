@@ -19,14 +19,20 @@
 #include <sensor/SensorEventQueue.h>
 
 #include <algorithm>
+#include <inttypes.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <unistd.h>
 
+#include <cutils/ashmem.h>
+#include <cutils/native_handle.h>
 #include <utils/RefBase.h>
 #include <utils/Looper.h>
 
 #include <sensor/Sensor.h>
 #include <sensor/BitTube.h>
 #include <sensor/ISensorEventConnection.h>
+#include <sensor/SensorEventRing.h>
 
 #include <android/sensor.h>
 
@@ -38,12 +44,16 @@ namespace android {
 
 SensorEventQueue::SensorEventQueue(const sp<ISensorEventConnection>& connection)
     : mSensorEventConnection(connection), mRecBuffer(NULL), mAvailable(0), mConsumed(0),
-      mNumAcksToSend(0) {
+      mBorrowed(0), mNumAcksToSend(0), mEventRing(NULL), mEventRingFd(-1) {
     mRecBuffer = new ASensorEvent[MAX_RECEIVE_BUFFER_EVENT_COUNT];
 }
 
 SensorEventQueue::~SensorEventQueue() {
     delete [] mRecBuffer;
+    delete mEventRing;
+    if (mEventRingFd >= 0) {
+        close(mEventRingFd);
+    }
 }
 
 void SensorEventQueue::onFirstRef()
@@ -53,7 +63,7 @@ void SensorEventQueue::onFirstRef()
 
 int SensorEventQueue::getFd() const
 {
-    return mSensorChannel->getFd();
+    return mEventRing != NULL ? mEventRingFd : mSensorChannel->getFd();
 }
 
 
@@ -63,6 +73,25 @@ ssize_t SensorEventQueue::write(const sp<BitTube>& tube,
 }
 
 ssize_t SensorEventQueue::read(ASensorEvent* events, size_t numEvents) {
+    if (mEventRing != NULL) {
+        // Events are read straight out of the ring. The doorbell is only cleared once the ring
+        // has been emptied, and the ring is read again after that, so no batch goes unsignalled.
+        uint64_t numLost = 0;
+        size_t count = mEventRing->read(events, numEvents, &numLost);
+        if (count < numEvents) {
+            uint64_t signals;
+            if (::read(mEventRingFd, &signals, sizeof(signals)) < 0 && errno != EAGAIN) {
+                ALOGE("SensorEventQueue::read doorbell error (errno=%d)", errno);
+            }
+            count += mEventRing->read(events + count, numEvents - count, &numLost);
+        }
+        ALOGW_IF(numLost, "SensorEventQueue::read lost %" PRIu64 " events", numLost);
+        return count > 0 ? static_cast<ssize_t>(count) : -EAGAIN;
+    }
+    if (mBorrowed != 0) {
+        // Refilling the receive buffer would overwrite the borrowed events.
+        return INVALID_OPERATION;
+    }
     if (mAvailable == 0) {
         ssize_t err = BitTube::recvObjects(mSensorChannel,
                 mRecBuffer, MAX_RECEIVE_BUFFER_EVENT_COUNT);
@@ -79,6 +108,73 @@ ssize_t SensorEventQueue::read(ASensorEvent* events, size_t numEvents) {
     return static_cast<ssize_t>(count);
 }
 
+ssize_t SensorEventQueue::borrowEvents(ASensorEvent const** events, size_t numEvents) {
+    if (mEventRing != NULL || mBorrowed != 0) {
+        return INVALID_OPERATION;
+    }
+    if (mAvailable == 0) {
+        ssize_t err = BitTube::recvObjects(mSensorChannel,
+                mRecBuffer, MAX_RECEIVE_BUFFER_EVENT_COUNT);
+        if (err < 0) {
+            return err;
+        }
+        mAvailable = static_cast<size_t>(err);
+        mConsumed = 0;
+    }
+    size_t count = min(numEvents, mAvailable);
+    *events = mRecBuffer + mConsumed;
+    mAvailable -= count;
+    mConsumed += count;
+    mBorrowed = count;
+    return static_cast<ssize_t>(count);
+}
+
+void SensorEventQueue::releaseEvents() {
+    if (mBorrowed == 0) {
+        return;
+    }
+    sendAck(mRecBuffer + mConsumed - mBorrowed, static_cast<int>(mBorrowed));
+    mBorrowed = 0;
+}
+
+status_t SensorEventQueue::enableEventRing(size_t numEvents) {
+    Mutex::Autolock _l(mLock);
+    if (mEventRing != NULL || mLooper != 0) {
+        return INVALID_OPERATION;
+    }
+    if (numEvents == 0 || numEvents > UINT32_MAX / sizeof(ASensorEvent)) {
+        return BAD_VALUE;
+    }
+
+    const size_t size = numEvents * sizeof(ASensorEvent);
+    int ashmemFd = ashmem_create_region("SensorEventRing", size);
+    if (ashmemFd < 0) {
+        return NO_MEMORY;
+    }
+    int eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    SensorEventRing* ring = eventFd >= 0 ? SensorEventRing::map(ashmemFd, size, false) : NULL;
+    status_t err = NO_MEMORY;
+    if (ring != NULL) {
+        native_handle_t* resource = native_handle_create(2, 0);
+        resource->data[0] = ashmemFd;
+        resource->data[1] = eventFd;
+        err = mSensorEventConnection->setEventRing(resource, static_cast<uint32_t>(size));
+        native_handle_delete(resource);
+    }
+    close(ashmemFd);
+    if (err != NO_ERROR) {
+        delete ring;
+        if (eventFd >= 0) {
+            close(eventFd);
+        }
+        return err;
+    }
+
+    mEventRing = ring;
+    mEventRingFd = eventFd;
+    return NO_ERROR;
+}
+
 sp<Looper> SensorEventQueue::getLooper() const
 {
     Mutex::Autolock _l(mLock);
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "Sensors"
+
+#include <sensor/SensorEventRing.h>
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <cutils/ashmem.h>
+#include <utils/Log.h>
+
+#include <android/sensor.h>
+
+// ----------------------------------------------------------------------------
+namespace android {
+// ----------------------------------------------------------------------------
+
+SensorEventRing* SensorEventRing::map(int fd, size_t size, bool writable) {
+    const size_t capacity = size / sizeof(ASensorEvent);
+    const int regionSize = ashmem_get_size_region(fd);
+    if (capacity == 0 || regionSize < 0 || static_cast<size_t>(regionSize) < size) {
+        ALOGE("Sensor event ring of %zu bytes does not fit its region (%d bytes)",
+                size, regionSize);
+        return NULL;
+    }
+
+    const size_t mappingSize = capacity * sizeof(ASensorEvent);
+    void* mapping = mmap(NULL, mappingSize, PROT_READ | (writable ? PROT_WRITE : 0),
+            MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        ALOGE("Could not map sensor event ring: %s", strerror(errno));
+        return NULL;
+    }
+    return new SensorEventRing(mapping, mappingSize, capacity);
+}
+
+SensorEventRing::SensorEventRing(void* mapping, size_t mappingSize, size_t capacity)
+    : mMapping(mapping), mMappingSize(mappingSize),
+      mEvents(static_cast<ASensorEvent*>(mapping)), mCapacity(capacity), mPosition(0) {
+}
+
+SensorEventRing::~SensorEventRing() {
+    munmap(mMapping, mMappingSize);
+}
+
+void SensorEventRing::write(ASensorEvent const* events, size_t numEvents) {
+    for (size_t i = 0; i < numEvents; ++i) {
+        ASensorEvent* slot = &mEvents[static_cast<size_t>(mPosition % mCapacity)];
+        const uint32_t counter = getCounter(mPosition);
+        // While the event is written, its counter reads as two laps behind, so that a reader
+        // neither takes it for the new event nor for the one it replaces.
+        const int32_t writing = static_cast<int32_t>(counter - 2 * mCapacity);
+        __atomic_store_n(&slot->reserved0, writing, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+
+        ASensorEvent event = events[i];
+        event.reserved0 = writing;
+        memcpy(slot, &event, sizeof(ASensorEvent));
+        __atomic_store_n(&slot->reserved0, static_cast<int32_t>(counter), __ATOMIC_RELEASE);
+        mPosition++;
+    }
+}
+
+size_t SensorEventRing::read(ASensorEvent* events, size_t numEvents, uint64_t* outNumLost) {
+    size_t count = 0;
+    while (count < numEvents) {
+        const ASensorEvent* slot = &mEvents[static_cast<size_t>(mPosition % mCapacity)];
+        const uint32_t expected = getCounter(mPosition);
+        const uint32_t counter = static_cast<uint32_t>(
+                __atomic_load_n(&slot->reserved0, __ATOMIC_ACQUIRE));
+        int32_t ahead = static_cast<int32_t>(counter - expected);
+        if (ahead < 0) {
+            // Not written yet.
+            break;
+        }
+        if (ahead == 0) {
+            memcpy(&events[count], slot, sizeof(ASensorEvent));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (static_cast<uint32_t>(__atomic_load_n(&slot->reserved0, __ATOMIC_RELAXED))
+                    == expected) {
+                count++;
+                mPosition++;
+                continue;
+            }
+            // Overwritten while it was copied.
+            ahead = static_cast<int32_t>(mCapacity);
+        }
+
+        // The writer has been around the ring since this event was written. Skip to the oldest
+        // event which may still be there.
+        const uint64_t lost = static_cast<size_t>(ahead) >= mCapacity
+                ? static_cast<uint64_t>(ahead) - (mCapacity - 1) : 1;
+        mPosition += lost;
+        *outNumLost += lost;
+    }
+    return count;
+}
+
+// ----------------------------------------------------------------------------
+}; // namespace android
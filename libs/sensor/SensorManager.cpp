@@ -304,6 +304,26 @@ int SensorManager::configureDirectChannel(int channelNativeHandle, int sensorHan
     return ret;
 }
 
+int SensorManager::configureDirectChannels(int channelNativeHandle,
+        const Vector<int32_t> &sensorHandles, const Vector<int32_t> &rateLevels,
+        Vector<int32_t> *outResults) {
+    Mutex::Autolock _l(mLock);
+    if (assertStateLocked() != NO_ERROR) {
+        return NO_INIT;
+    }
+
+    auto i = mDirectConnection.find(channelNativeHandle);
+    if (i == mDirectConnection.end()) {
+        ALOGE("Cannot find the handle in client direct connection table");
+        return BAD_VALUE;
+    }
+
+    int ret = i->second->configureChannels(sensorHandles, rateLevels, outResults);
+    ALOGE_IF(ret < 0, "SensorManager::configureChannels (%zu sensors) returns %d",
+            sensorHandles.size(), static_cast<int>(ret));
+    return ret;
+}
+
 int SensorManager::setOperationParameter(
         int type, const Vector<float> &floats, const Vector<int32_t> &ints) {
     Mutex::Autolock _l(mLock);
@@ -22,9 +22,12 @@
 #include <utils/Errors.h>
 #include <utils/StrongPointer.h>
 #include <utils/Timers.h>
+#include <utils/Vector.h>
 
 #include <binder/IInterface.h>
 
+#include <cutils/native_handle.h>
+
 namespace android {
 // ----------------------------------------------------------------------------
 
@@ -42,6 +45,15 @@ public:
     virtual status_t setEventRate(int handle, nsecs_t ns) = 0;
     virtual status_t flush() = 0;
     virtual int32_t configureChannel(int32_t handle, int32_t rateLevel) = 0;
+    // Like configureChannel() for each of handles with the rate level at the same index, in one
+    // call. outResults receives what configureChannel() would have returned for each sensor.
+    virtual status_t configureChannels(const Vector<int32_t>& handles,
+                                       const Vector<int32_t>& rateLevels,
+                                       Vector<int32_t>* outResults) = 0;
+    // Delivers the events of this connection through a SensorEventRing of size bytes instead of
+    // the sensor channel. resource holds the ashmem region of the ring and an eventfd signalled
+    // after each batch.
+    virtual status_t setEventRing(const native_handle_t* resource, uint32_t size) = 0;
 };
 
 // ----------------------------------------------------------------------------
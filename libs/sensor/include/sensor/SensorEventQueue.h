@@ -42,6 +42,7 @@ namespace android {
 
 class ISensorEventConnection;
 class Sensor;
+class SensorEventRing;
 class Looper;
 
 // ----------------------------------------------------------------------------
@@ -75,6 +76,20 @@ public:
 
     ssize_t read(ASensorEvent* events, size_t numEvents);
 
+    // Borrows up to numEvents events straight out of the receive buffer of the queue instead of
+    // copying them like read(). *events stays valid until releaseEvents(), which must be called
+    // before the queue is read again, and which acknowledges the wake-up sensor events among the
+    // borrowed ones with a single write. Not available on queues using an event ring.
+    ssize_t borrowEvents(ASensorEvent const** events, size_t numEvents);
+    void releaseEvents();
+
+    // Has the service deliver the events of this queue through a SensorEventRing of numEvents
+    // events in shared memory rather than through the sensor channel. getFd() then returns the
+    // eventfd signalled after each batch. Must be called before the queue is first polled and
+    // before any sensor is enabled. Wake-up sensors cannot be enabled on such a queue, as the
+    // ring cannot hold their events until they are acknowledged.
+    status_t enableEventRing(size_t numEvents);
+
     status_t waitForEvent() const;
     status_t wake() const;
 
@@ -101,7 +116,10 @@ private:
     ASensorEvent* mRecBuffer;
     size_t mAvailable;
     size_t mConsumed;
+    size_t mBorrowed;
     uint32_t mNumAcksToSend;
+    SensorEventRing* mEventRing;
+    int mEventRingFd;
 };
 
 // ----------------------------------------------------------------------------
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct ASensorEvent;
+
+// ----------------------------------------------------------------------------
+namespace android {
+// ----------------------------------------------------------------------------
+
+/*
+ * A ring of sensor events in shared memory, which a SensorEventConnection can deliver its
+ * events through instead of its BitTube.
+ *
+ * The memory is laid out like a direct channel in the SENSOR_DIRECT_FMT_SENSORS_EVENT format:
+ * an array of events whose reserved0 field is an atomic counter. The n-th event written, from
+ * n = 1, goes in slot (n - 1) % capacity with counter n, modulo 2^32. The writer never waits for
+ * the reader. A reader which falls a whole ring behind loses events and carries on from the
+ * oldest event still in the ring.
+ *
+ * There is one writer and one reader. The ring does not wake the reader up; the connection
+ * signals an eventfd after each batch.
+ */
+class SensorEventRing {
+public:
+    // Maps size bytes of fd, an ashmem region, rounded down to whole events. The fd is not
+    // kept. Returns NULL if the region cannot be mapped or holds less than one event.
+    static SensorEventRing* map(int fd, size_t size, bool writable);
+    ~SensorEventRing();
+
+    size_t getCapacity() const { return mCapacity; }
+
+    // Appends events to the ring, overwriting the oldest ones.
+    void write(ASensorEvent const* events, size_t numEvents);
+
+    // Reads at most numEvents of the events written since the last read. Adds the number of
+    // events lost to the writer to *outNumLost.
+    size_t read(ASensorEvent* events, size_t numEvents, uint64_t* outNumLost);
+
+private:
+    SensorEventRing(void* mapping, size_t mappingSize, size_t capacity);
+
+    static uint32_t getCounter(uint64_t position) {
+        return static_cast<uint32_t>(position + 1);
+    }
+
+    void* mMapping;
+    size_t mMappingSize;
+    ASensorEvent* mEvents;
+    size_t mCapacity;
+    // Number of events written, for the writer, or read, for the reader.
+    uint64_t mPosition;
+};
+
+// ----------------------------------------------------------------------------
+}; // namespace android
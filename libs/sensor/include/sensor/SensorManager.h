@@ -64,6 +64,10 @@ public:
     int createDirectChannel(size_t size, int channelType, const native_handle_t *channelData);
     void destroyDirectChannel(int channelNativeHandle);
     int configureDirectChannel(int channelNativeHandle, int sensorHandle, int rateLevel);
+    // Configures several sensors of a direct channel in one call to sensorservice. On success,
+    // outResults holds what configureDirectChannel() would have returned for each sensor.
+    int configureDirectChannels(int channelNativeHandle, const Vector<int32_t> &sensorHandles,
+            const Vector<int32_t> &rateLevels, Vector<int32_t> *outResults);
     int setOperationParameter(int type, const Vector<float> &floats, const Vector<int32_t> &ints);
 
 private:
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "SensorEventRing_test"
+
+#include <sensor/SensorEventRing.h>
+
+#include <unistd.h>
+
+#include <android/sensor.h>
+#include <cutils/ashmem.h>
+
+#include <gtest/gtest.h>
+
+#include <memory>
+
+namespace android {
+
+static const size_t RING_CAPACITY = 8;
+
+class SensorEventRingTest : public testing::Test {
+protected:
+    virtual void SetUp() {
+        mFd = ashmem_create_region("SensorEventRingTest", RING_CAPACITY * sizeof(ASensorEvent));
+        ASSERT_GE(mFd, 0);
+        mWriter.reset(SensorEventRing::map(mFd, RING_CAPACITY * sizeof(ASensorEvent), true));
+        mReader.reset(SensorEventRing::map(mFd, RING_CAPACITY * sizeof(ASensorEvent), false));
+        ASSERT_TRUE(mWriter != nullptr);
+        ASSERT_TRUE(mReader != nullptr);
+    }
+
+    virtual void TearDown() {
+        mWriter.reset();
+        mReader.reset();
+        if (mFd >= 0) {
+            close(mFd);
+        }
+    }
+
+    void writeEvents(int64_t firstTimestamp, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            ASensorEvent event = {};
+            event.sensor = 1;
+            event.type = ASENSOR_TYPE_ACCELEROMETER;
+            event.timestamp = firstTimestamp + int64_t(i);
+            mWriter->write(&event, 1);
+        }
+    }
+
+    int mFd;
+    std::unique_ptr<SensorEventRing> mWriter;
+    std::unique_ptr<SensorEventRing> mReader;
+};
+
+TEST_F(SensorEventRingTest, Map_RejectsRegionSmallerThanRing) {
+    EXPECT_TRUE(SensorEventRing::map(mFd, (RING_CAPACITY + 1) * sizeof(ASensorEvent), false)
+            == nullptr);
+    EXPECT_TRUE(SensorEventRing::map(mFd, sizeof(ASensorEvent) - 1, false) == nullptr);
+}
+
+TEST_F(SensorEventRingTest, Read_ReturnsEventsInOrderWithCounters) {
+    writeEvents(100, 3);
+
+    ASensorEvent events[RING_CAPACITY];
+    uint64_t numLost = 0;
+    ASSERT_EQ(3U, mReader->read(events, RING_CAPACITY, &numLost));
+    EXPECT_EQ(0U, numLost);
+    for (size_t i = 0; i < 3; i++) {
+        EXPECT_EQ(100 + int64_t(i), events[i].timestamp);
+        EXPECT_EQ(int32_t(i + 1), events[i].reserved0);
+    }
+    EXPECT_EQ(0U, mReader->read(events, RING_CAPACITY, &numLost));
+}
+
+TEST_F(SensorEventRingTest, Read_StopsAtRequestedCount) {
+    writeEvents(0, 5);
+
+    ASensorEvent events[RING_CAPACITY];
+    uint64_t numLost = 0;
+    ASSERT_EQ(2U, mReader->read(events, 2, &numLost));
+    ASSERT_EQ(3U, mReader->read(events, RING_CAPACITY, &numLost));
+    EXPECT_EQ(2, events[0].timestamp);
+    EXPECT_EQ(0U, numLost);
+}
+
+TEST_F(SensorEventRingTest, Read_AfterOverrun_SkipsToOldestEventInRing) {
+    writeEvents(0, RING_CAPACITY * 2 + 3);
+
+    ASensorEvent events[RING_CAPACITY];
+    uint64_t numLost = 0;
+    ASSERT_EQ(RING_CAPACITY, mReader->read(events, RING_CAPACITY, &numLost));
+    EXPECT_EQ(RING_CAPACITY + 3, numLost);
+    EXPECT_EQ(int64_t(RING_CAPACITY + 3), events[0].timestamp);
+    EXPECT_EQ(int64_t(RING_CAPACITY * 2 + 2), events[RING_CAPACITY - 1].timestamp);
+}
+
+} // namespace android
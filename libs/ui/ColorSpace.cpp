@@ -357,7 +357,8 @@ std::unique_ptr<float3> ColorSpace::createLUT(uint32_t size,
     size = clamp(size, 2u, 256u);
     float m = 1.0f / float(size - 1);
 
-    std::unique_ptr<float3> lut(new float3[size * size * size]);
+    const size_t count = size_t(size) * size * size;
+    std::unique_ptr<float3> lut(new float3[count]);
     float3* data = lut.get();
 
     ColorSpaceConnector connector(src, dst);
@@ -365,14 +366,26 @@ std::unique_ptr<float3> ColorSpace::createLUT(uint32_t size,
     for (uint32_t z = 0; z < size; z++) {
         for (int32_t y = int32_t(size - 1); y >= 0; y--) {
             for (uint32_t x = 0; x < size; x++) {
-                *data++ = connector.transform({x * m, y * m, z * m});
+                *data++ = {x * m, y * m, z * m};
             }
         }
     }
+    connector.transform(lut.get(), lut.get(), count);
 
     return lut;
 }
 
+TransferLUT::TransferLUT(ColorSpace::transfer_function function, uint32_t size) noexcept
+        : mFunction(std::move(function))
+        , mLast(clamp(size, 2u, 65536u) - 1)
+        , mScale(float(mLast)) {
+    mTable.resize(mLast + 1);
+    for (uint32_t i = 0; i <= mLast; i++) {
+        const float t = float(i) / mScale;
+        mTable[i] = mFunction(t * t);
+    }
+}
+
 static const float2 ILLUMINANT_D50_XY = {0.34567f, 0.35850f};
 static const float3 ILLUMINANT_D50_XYZ = {0.964212f, 1.0f, 0.825188f};
 static const mat3 BRADFORD = mat3{
@@ -391,7 +404,9 @@ ColorSpaceConnector::ColorSpaceConnector(
         const ColorSpace& src,
         const ColorSpace& dst) noexcept
         : mSource(src)
-        , mDestination(dst) {
+        , mDestination(dst)
+        , mSourceEOTF(src.getEOTF())
+        , mDestinationOETF(dst.getOETF()) {
 
     if (all(lessThan(abs(src.getWhitePoint() - dst.getWhitePoint()), float2{1e-3f}))) {
         mTransform = dst.getXYZtoRGB() * src.getRGBtoXYZ();
@@ -414,4 +429,13 @@ ColorSpaceConnector::ColorSpaceConnector(
     }
 }
 
+void ColorSpaceConnector::transform(const float3* in, float3* out, size_t count) const noexcept {
+    const ColorSpace::clamping_function& srcClamper = mSource.getClamper();
+    const ColorSpace::clamping_function& dstClamper = mDestination.getClamper();
+    for (size_t i = 0; i < count; i++) {
+        const float3 linear = mSourceEOTF(apply(in[i], srcClamper));
+        out[i] = apply(mDestinationOETF(mTransform * linear), dstClamper);
+    }
+}
+
 }; // namespace android
@@ -20,8 +20,10 @@
 
 #include <cutils/compiler.h>  // For CC_[UN]LIKELY
 #include <utils/Log.h>
+#include <errno.h>
 #include <inttypes.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <memory>
 
@@ -285,9 +287,9 @@ void FenceTimeline::push(const std::shared_ptr<FenceTime>& fence) {
             // we are removing it from the timeline.
             front->getSignalTime();
         }
-        mQueue.pop();
+        mQueue.pop_front();
     }
-    mQueue.push(fence);
+    mQueue.push_back(fence);
 }
 
 void FenceTimeline::updateSignalTimes() {
@@ -297,11 +299,11 @@ void FenceTimeline::updateSignalTimes() {
         if (!fence) {
             // The shared_ptr no longer exists and no one cares about the
             // timestamp anymore.
-            mQueue.pop();
+            mQueue.pop_front();
             continue;
         } else if (fence->getSignalTime() != Fence::SIGNAL_TIME_PENDING) {
             // The fence has signaled and we've removed the sp<Fence> ref.
-            mQueue.pop();
+            mQueue.pop_front();
             continue;
         } else {
             // The fence didn't signal yet. Break since the later ones
@@ -311,6 +313,97 @@ void FenceTimeline::updateSignalTimes() {
     }
 }
 
+void FenceTimeline::popResolvedLocked() {
+    while (!mQueue.empty()) {
+        std::shared_ptr<FenceTime> fence = mQueue.front().lock();
+        if (fence && fence->getCachedSignalTime() == Fence::SIGNAL_TIME_PENDING) {
+            break;
+        }
+        mQueue.pop_front();
+    }
+}
+
+// ============================================================================
+// FenceTimeline::Batch
+// ============================================================================
+
+void FenceTimeline::Batch::add(FenceTimeline* timeline) {
+    mTimelines.push_back(timeline);
+}
+
+void FenceTimeline::Batch::updateSignalTimes() {
+    mEntries.clear();
+    mEntryCounts.clear();
+    mPollFds.clear();
+
+    // Take references to the pending fences, so that they stay open while
+    // we poll them without the timeline locks held.
+    for (FenceTimeline* timeline : mTimelines) {
+        std::lock_guard<std::mutex> lock(timeline->mMutex);
+        timeline->popResolvedLocked();
+        size_t count = 0;
+        for (const auto& weakFence : timeline->mQueue) {
+            std::shared_ptr<FenceTime> fenceTime = weakFence.lock();
+            if (!fenceTime) {
+                continue;
+            }
+            FenceTime::Snapshot snapshot = fenceTime->getSnapshot();
+            if (snapshot.state != FenceTime::Snapshot::State::FENCE) {
+                continue;
+            }
+            ssize_t pollIndex = -1;
+            const int fd = snapshot.fence->get();
+            if (fd >= 0) {
+                struct pollfd pollFd;
+                pollFd.fd = fd;
+                pollFd.events = POLLIN;
+                pollFd.revents = 0;
+                pollIndex = static_cast<ssize_t>(mPollFds.size());
+                mPollFds.push_back(pollFd);
+            }
+            mEntries.push_back({std::move(fenceTime), std::move(snapshot.fence), pollIndex});
+            count++;
+        }
+        mEntryCounts.push_back(count);
+    }
+
+    bool polled = false;
+    if (!mPollFds.empty()) {
+        int result;
+        do {
+            result = poll(mPollFds.data(), mPollFds.size(), 0);
+        } while (result < 0 && errno == EINTR);
+        polled = result >= 0;
+        ALOGE_IF(!polled, "FenceTimeline::Batch: poll failed: %s (%d)",
+                strerror(errno), errno);
+    }
+
+    size_t first = 0;
+    for (size_t t = 0; t < mTimelines.size(); t++) {
+        const size_t end = first + mEntryCounts[t];
+        for (size_t i = first; i < end; i++) {
+            const Entry& entry = mEntries[i];
+            if (polled && entry.pollIndex >= 0 &&
+                    mPollFds[static_cast<size_t>(entry.pollIndex)].revents == 0) {
+                // Still pending, so are the ones after it on this timeline
+                break;
+            }
+            if (entry.fenceTime->getSignalTime() == Fence::SIGNAL_TIME_PENDING) {
+                break;
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(mTimelines[t]->mMutex);
+            mTimelines[t]->popResolvedLocked();
+        }
+        first = end;
+    }
+
+    // Don't hold on to the fences until the next update
+    mEntries.clear();
+    mTimelines.clear();
+}
+
 // ============================================================================
 // FenceToFenceTimeMap
 // ============================================================================
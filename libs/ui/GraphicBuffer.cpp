@@ -437,7 +437,9 @@ status_t GraphicBuffer::unflatten(
 
     if (handle != 0) {
         buffer_handle_t importedHandle;
-        status_t err = mBufferMapper.importBuffer(handle, &importedHandle);
+        // The same buffer is often received again and again, e.g. by
+        // consumers after reconnects: let the mapper share the import.
+        status_t err = mBufferMapper.importBuffer(mId, handle, &importedHandle);
         if (err != NO_ERROR) {
             width = height = stride = format = layerCount = usage = 0;
             handle = NULL;
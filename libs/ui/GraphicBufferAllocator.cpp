@@ -21,10 +21,12 @@
 #include <ui/GraphicBufferAllocator.h>
 
 #include <stdio.h>
+#include <unistd.h>
 
 #include <grallocusage/GrallocUsageConversion.h>
 
 #include <log/log.h>
+#include <private/android_filesystem_config.h>
 #include <utils/Singleton.h>
 #include <utils/String8.h>
 #include <utils/Trace.h>
@@ -37,9 +39,21 @@ namespace android {
 
 ANDROID_SINGLETON_STATIC_INSTANCE( GraphicBufferAllocator )
 
-Mutex GraphicBufferAllocator::sLock;
-KeyedVector<buffer_handle_t,
-    GraphicBufferAllocator::alloc_rec_t> GraphicBufferAllocator::sAllocList;
+GraphicBufferAllocator::Shard GraphicBufferAllocator::sShards[NUM_SHARDS];
+std::atomic<size_t> GraphicBufferAllocator::sTotalBytes(0);
+std::atomic<size_t> GraphicBufferAllocator::sTotalCount(0);
+thread_local uid_t GraphicBufferAllocator::sAttributedUid = NO_UID;
+
+GraphicBufferAllocator::ScopedUidAttribution::ScopedUidAttribution(uid_t uid)
+  : mPreviousUid(sAttributedUid)
+{
+    sAttributedUid = uid;
+}
+
+GraphicBufferAllocator::ScopedUidAttribution::~ScopedUidAttribution()
+{
+    sAttributedUid = mPreviousUid;
+}
 
 GraphicBufferAllocator::GraphicBufferAllocator()
   : mMapper(GraphicBufferMapper::getInstance()),
@@ -48,43 +62,145 @@ GraphicBufferAllocator::GraphicBufferAllocator()
 {
 }
 
-GraphicBufferAllocator::~GraphicBufferAllocator() {}
+GraphicBufferAllocator::~GraphicBufferAllocator()
+{
+    {
+        std::lock_guard<std::mutex> lock(mWorkLock);
+        mStopping = true;
+    }
+    mWorkCondition.notify_all();
+    for (std::thread& worker : mWorkers) {
+        worker.join();
+    }
+}
+
+GraphicBufferAllocator::Shard& GraphicBufferAllocator::shardFor(buffer_handle_t handle)
+{
+    // native handles are heap allocated, skip the alignment bits
+    return sShards[(reinterpret_cast<uintptr_t>(handle) >> 4) % NUM_SHARDS];
+}
+
+uid_t GraphicBufferAllocator::currentUid()
+{
+    return sAttributedUid != NO_UID ? sAttributedUid : getuid();
+}
 
 void GraphicBufferAllocator::dump(String8& result) const
 {
-    Mutex::Autolock _l(sLock);
-    KeyedVector<buffer_handle_t, alloc_rec_t>& list(sAllocList);
     size_t total = 0;
     const size_t SIZE = 4096;
     char buffer[SIZE];
     snprintf(buffer, SIZE, "Allocated buffers:\n");
     result.append(buffer);
-    const size_t c = list.size();
-    for (size_t i=0 ; i<c ; i++) {
-        const alloc_rec_t& rec(list.valueAt(i));
-        if (rec.size) {
-            snprintf(buffer, SIZE, "%10p: %7.2f KiB | %4u (%4u) x %4u | %4u | %8X | 0x%" PRIx64
-                    " | %s\n",
-                    list.keyAt(i), rec.size/1024.0,
-                    rec.width, rec.stride, rec.height, rec.layerCount, rec.format,
-                    rec.usage, rec.requestorName.c_str());
-        } else {
-            snprintf(buffer, SIZE, "%10p: unknown     | %4u (%4u) x %4u | %4u | %8X | 0x%" PRIx64
-                    " | %s\n",
-                    list.keyAt(i),
-                    rec.width, rec.stride, rec.height, rec.layerCount, rec.format,
-                    rec.usage, rec.requestorName.c_str());
+    for (const Shard& shard : sShards) {
+        std::lock_guard<std::mutex> lock(shard.lock);
+        for (const auto& entry : shard.records) {
+            const alloc_rec_t& rec(entry.second);
+            if (rec.size) {
+                snprintf(buffer, SIZE, "%10p: %7.2f KiB | %4u (%4u) x %4u | %4u | %8X | 0x%" PRIx64
+                        " | %5u | %s\n",
+                        entry.first, rec.size/1024.0,
+                        rec.width, rec.stride, rec.height, rec.layerCount, rec.format,
+                        rec.usage, rec.uid, rec.requestorName.c_str());
+            } else {
+                snprintf(buffer, SIZE, "%10p: unknown     | %4u (%4u) x %4u | %4u | %8X | 0x%" PRIx64
+                        " | %5u | %s\n",
+                        entry.first,
+                        rec.width, rec.stride, rec.height, rec.layerCount, rec.format,
+                        rec.usage, rec.uid, rec.requestorName.c_str());
+            }
+            result.append(buffer);
+            total += rec.size;
         }
-        result.append(buffer);
-        total += rec.size;
     }
     snprintf(buffer, SIZE, "Total allocated (estimate): %.2f KB\n", total/1024.0);
     result.append(buffer);
 
+    size_t prefetched;
+    {
+        std::lock_guard<std::mutex> lock(mPrefetchLock);
+        prefetched = mPrefetched.size();
+    }
+    snprintf(buffer, SIZE, "Prefetched buffers waiting to be claimed: %zu\n", prefetched);
+    result.append(buffer);
+
     std::string deviceDump = mAllocator->dumpDebugInfo();
     result.append(deviceDump.c_str(), deviceDump.size());
 }
 
+void GraphicBufferAllocator::dumpUidUsage(String8& result) const
+{
+    std::lock_guard<std::mutex> lock(mUidLock);
+    result.appendFormat("Graphics memory per uid (%zu buffers, %.2f KiB in total):\n",
+            sTotalCount.load(), sTotalBytes.load() / 1024.0);
+    if (mDefaultUidBudget > 0) {
+        result.appendFormat("  default budget: %.2f KiB\n", mDefaultUidBudget / 1024.0);
+    }
+    for (const auto& entry : mUidUsage) {
+        const UidUsage& usage(entry.second);
+        if (usage.count == 0 && !usage.hasBudget) {
+            continue;
+        }
+        result.appendFormat("  uid %5u: %4zu buffers, %10.2f KiB", entry.first,
+                usage.count, usage.bytes / 1024.0);
+        if (usage.hasBudget && usage.budget > 0) {
+            result.appendFormat(" (budget %.2f KiB)", usage.budget / 1024.0);
+        }
+        result.append("\n");
+    }
+}
+
+void GraphicBufferAllocator::setUidBudget(uid_t uid, size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mUidLock);
+    UidUsage& usage(mUidUsage[uid]);
+    usage.budget = bytes;
+    usage.hasBudget = true;
+}
+
+void GraphicBufferAllocator::setDefaultUidBudget(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mUidLock);
+    mDefaultUidBudget = bytes;
+}
+
+size_t GraphicBufferAllocator::getUidUsage(uid_t uid) const
+{
+    std::lock_guard<std::mutex> lock(mUidLock);
+    auto it = mUidUsage.find(uid);
+    return it != mUidUsage.end() ? it->second.bytes : 0;
+}
+
+bool GraphicBufferAllocator::chargeUid(uid_t uid, size_t size)
+{
+    std::lock_guard<std::mutex> lock(mUidLock);
+    UidUsage& usage(mUidUsage[uid]);
+    const bool isApp = (uid % AID_USER) >= AID_APP;
+    size_t budget = usage.hasBudget ? usage.budget : (isApp ? mDefaultUidBudget : 0);
+    if (budget > 0 && usage.bytes + size > budget) {
+        ALOGW("uid %u is over its graphics memory budget: %zu + %zu > %zu bytes",
+                uid, usage.bytes, size, budget);
+        return false;
+    }
+    usage.bytes += size;
+    usage.count++;
+    return true;
+}
+
+void GraphicBufferAllocator::unchargeUid(uid_t uid, size_t size)
+{
+    std::lock_guard<std::mutex> lock(mUidLock);
+    auto it = mUidUsage.find(uid);
+    if (it == mUidUsage.end()) {
+        return;
+    }
+    it->second.bytes -= size;
+    it->second.count--;
+    if (it->second.count == 0 && !it->second.hasBudget) {
+        mUidUsage.erase(it);
+    }
+}
+
 void GraphicBufferAllocator::dumpToSystemLog()
 {
     String8 s;
@@ -92,52 +208,246 @@ void GraphicBufferAllocator::dumpToSystemLog()
     ALOGD("%s", s.string());
 }
 
-status_t GraphicBufferAllocator::allocate(uint32_t width, uint32_t height,
-        PixelFormat format, uint32_t layerCount, uint64_t usage,
-        buffer_handle_t* handle, uint32_t* stride,
-        uint64_t /*graphicBufferId*/, std::string requestorName)
+void GraphicBufferAllocator::normalize(AllocationRequest* request)
 {
-    ATRACE_CALL();
-
     // make sure to not allocate a N x 0 or 0 x N buffer, since this is
     // allowed from an API stand-point allocate a 1x1 buffer instead.
-    if (!width || !height)
-        width = height = 1;
+    if (!request->width || !request->height)
+        request->width = request->height = 1;
 
     // Ensure that layerCount is valid.
-    if (layerCount < 1)
-        layerCount = 1;
+    if (request->layerCount < 1)
+        request->layerCount = 1;
+}
+
+bool GraphicBufferAllocator::matches(const AllocationRequest& lhs,
+        const AllocationRequest& rhs)
+{
+    return lhs.width == rhs.width && lhs.height == rhs.height &&
+            lhs.format == rhs.format && lhs.layerCount == rhs.layerCount &&
+            lhs.usage == rhs.usage;
+}
+
+GraphicBufferAllocator::AllocationResult GraphicBufferAllocator::allocateFromHal(
+        const AllocationRequest& request, uid_t uid)
+{
+    ATRACE_CALL();
 
     Gralloc2::IMapper::BufferDescriptorInfo info = {};
-    info.width = width;
-    info.height = height;
-    info.layerCount = layerCount;
-    info.format = static_cast<Gralloc2::PixelFormat>(format);
-    info.usage = usage;
+    info.width = request.width;
+    info.height = request.height;
+    info.layerCount = request.layerCount;
+    info.format = static_cast<Gralloc2::PixelFormat>(request.format);
+    info.usage = request.usage;
 
-    Gralloc2::Error error = mAllocator->allocate(info, stride, handle);
+    AllocationResult result;
+    Gralloc2::Error error = mAllocator->allocate(info, &result.stride, &result.handle);
     if (error == Gralloc2::Error::NONE) {
-        Mutex::Autolock _l(sLock);
-        KeyedVector<buffer_handle_t, alloc_rec_t>& list(sAllocList);
-        uint32_t bpp = bytesPerPixel(format);
+        uint32_t bpp = bytesPerPixel(request.format);
         alloc_rec_t rec;
-        rec.width = width;
-        rec.height = height;
-        rec.stride = *stride;
-        rec.format = format;
-        rec.layerCount = layerCount;
-        rec.usage = usage;
-        rec.size = static_cast<size_t>(height * (*stride) * bpp);
-        rec.requestorName = std::move(requestorName);
-        list.add(*handle, rec);
-
-        return NO_ERROR;
+        rec.width = request.width;
+        rec.height = request.height;
+        rec.stride = result.stride;
+        rec.format = request.format;
+        rec.layerCount = request.layerCount;
+        rec.usage = request.usage;
+        rec.size = static_cast<size_t>(request.height * result.stride * bpp);
+        rec.uid = uid;
+        rec.requestorName = request.requestorName;
+
+        // The size is only known once the buffer is allocated
+        if (!chargeUid(uid, rec.size)) {
+            mMapper.freeBuffer(result.handle);
+            result.handle = nullptr;
+            result.status = NO_MEMORY;
+            return result;
+        }
+        sTotalBytes += rec.size;
+        sTotalCount++;
+
+        Shard& shard(shardFor(result.handle));
+        std::lock_guard<std::mutex> lock(shard.lock);
+        shard.records.emplace(result.handle, std::move(rec));
+
+        result.status = NO_ERROR;
     } else {
         ALOGE("Failed to allocate (%u x %u) layerCount %u format %d "
                 "usage %" PRIx64 ": %d",
-                width, height, layerCount, format, usage,
-                error);
-        return NO_MEMORY;
+                request.width, request.height, request.layerCount, request.format,
+                request.usage, error);
+        result.handle = nullptr;
+        result.status = NO_MEMORY;
+    }
+    return result;
+}
+
+status_t GraphicBufferAllocator::allocate(uint32_t width, uint32_t height,
+        PixelFormat format, uint32_t layerCount, uint64_t usage,
+        buffer_handle_t* handle, uint32_t* stride,
+        uint64_t /*graphicBufferId*/, std::string requestorName)
+{
+    ATRACE_CALL();
+
+    AllocationRequest request = {
+        width, height, format, layerCount, usage, std::move(requestorName)
+    };
+    normalize(&request);
+    const uid_t uid = currentUid();
+
+    AllocationResult result;
+    if (claimPrefetched(request, uid, &result)) {
+        // The record was added under the name of whoever asked for the
+        // prefetch, make it point to the actual owner.
+        Shard& shard(shardFor(result.handle));
+        std::lock_guard<std::mutex> lock(shard.lock);
+        auto it = shard.records.find(result.handle);
+        if (it != shard.records.end()) {
+            it->second.requestorName = std::move(request.requestorName);
+        }
+    } else {
+        result = allocateFromHal(request, uid);
+    }
+
+    if (result.status != NO_ERROR) {
+        return result.status;
+    }
+    *handle = result.handle;
+    *stride = result.stride;
+    return NO_ERROR;
+}
+
+std::future<GraphicBufferAllocator::AllocationResult> GraphicBufferAllocator::allocateAsync(
+        AllocationRequest request)
+{
+    normalize(&request);
+    const uid_t uid = currentUid();
+    auto task = std::make_shared<std::packaged_task<AllocationResult()>>(
+            [this, request, uid]() { return allocateFromHal(request, uid); });
+    std::future<AllocationResult> result = task->get_future();
+    enqueueWork([task]() { (*task)(); });
+    return result;
+}
+
+void GraphicBufferAllocator::prefetch(const AllocationRequest& request, size_t count)
+{
+    ATRACE_CALL();
+
+    AllocationRequest normalized(request);
+    normalize(&normalized);
+    const uid_t uid = currentUid();
+
+    std::vector<std::shared_future<AllocationResult>> expired;
+    std::vector<std::shared_ptr<std::packaged_task<AllocationResult()>>> tasks;
+    {
+        std::lock_guard<std::mutex> lock(mPrefetchLock);
+        const nsecs_t now = systemTime();
+        takeExpiredPrefetchedLocked(now, &expired);
+        while (count > 0 && mPrefetched.size() < MAX_PREFETCHED) {
+            auto task = std::make_shared<std::packaged_task<AllocationResult()>>(
+                    [this, normalized, uid]() { return allocateFromHal(normalized, uid); });
+            mPrefetched.push_back({ normalized, uid, task->get_future().share(), now });
+            tasks.push_back(std::move(task));
+            count--;
+        }
+    }
+
+    freePrefetched(expired);
+    for (auto& task : tasks) {
+        enqueueWork([task]() { (*task)(); });
+    }
+}
+
+bool GraphicBufferAllocator::claimPrefetched(const AllocationRequest& request,
+        uid_t uid, AllocationResult* outResult)
+{
+    std::vector<std::shared_future<AllocationResult>> expired;
+    std::shared_future<AllocationResult> claimed;
+    {
+        std::lock_guard<std::mutex> lock(mPrefetchLock);
+        if (mPrefetched.empty()) {
+            return false;
+        }
+        takeExpiredPrefetchedLocked(systemTime(), &expired);
+        for (auto it = mPrefetched.begin(); it != mPrefetched.end(); ++it) {
+            if (it->uid == uid && matches(it->request, request)) {
+                claimed = it->result;
+                mPrefetched.erase(it);
+                break;
+            }
+        }
+    }
+
+    freePrefetched(expired);
+    if (!claimed.valid()) {
+        return false;
+    }
+
+    ATRACE_NAME("wait for prefetched buffer");
+    *outResult = claimed.get();
+    // A failed prefetch doesn't mean the synchronous allocation fails as
+    // well, e.g. if other buffers were freed since; let the caller retry.
+    return outResult->status == NO_ERROR;
+}
+
+void GraphicBufferAllocator::takeExpiredPrefetchedLocked(nsecs_t now,
+        std::vector<std::shared_future<AllocationResult>>* outExpired)
+{
+    for (auto it = mPrefetched.begin(); it != mPrefetched.end();) {
+        if (now - it->time > PREFETCH_TIMEOUT) {
+            outExpired->push_back(std::move(it->result));
+            it = mPrefetched.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void GraphicBufferAllocator::freePrefetched(
+        const std::vector<std::shared_future<AllocationResult>>& results)
+{
+    if (results.empty()) {
+        return;
+    }
+    // Some of them may still be in flight, don't wait for them here.
+    enqueueWork([this, results]() {
+        for (const auto& result : results) {
+            const AllocationResult& r(result.get());
+            if (r.status == NO_ERROR) {
+                this->free(r.handle);
+            }
+        }
+    });
+}
+
+void GraphicBufferAllocator::enqueueWork(std::function<void()> work)
+{
+    {
+        std::lock_guard<std::mutex> lock(mWorkLock);
+        mWork.push_back(std::move(work));
+        // The workers are started the first time they are needed, most
+        // processes never allocate asynchronously.
+        if (mWorkers.empty()) {
+            for (size_t i = 0; i < NUM_WORKERS; i++) {
+                mWorkers.emplace_back(&GraphicBufferAllocator::workerLoop, this);
+            }
+        }
+    }
+    mWorkCondition.notify_one();
+}
+
+void GraphicBufferAllocator::workerLoop()
+{
+    std::unique_lock<std::mutex> lock(mWorkLock);
+    while (true) {
+        mWorkCondition.wait(lock, [this]() { return mStopping || !mWork.empty(); });
+        if (mStopping) {
+            return;
+        }
+        std::function<void()> work(std::move(mWork.front()));
+        mWork.pop_front();
+        lock.unlock();
+        work();
+        lock.lock();
     }
 }
 
@@ -145,13 +455,30 @@ status_t GraphicBufferAllocator::free(buffer_handle_t handle)
 {
     ATRACE_CALL();
 
+    // Drop the record first: once freed, the handle value may be handed out
+    // again by a concurrent allocation.
+    uid_t uid = NO_UID;
+    size_t size = 0;
+    {
+        Shard& shard(shardFor(handle));
+        std::lock_guard<std::mutex> lock(shard.lock);
+        auto it = shard.records.find(handle);
+        if (it != shard.records.end()) {
+            uid = it->second.uid;
+            size = it->second.size;
+            shard.records.erase(it);
+        }
+    }
+
     // We allocated a buffer from the allocator and imported it into the
     // mapper to get the handle.  We just need to free the handle now.
     mMapper.freeBuffer(handle);
 
-    Mutex::Autolock _l(sLock);
-    KeyedVector<buffer_handle_t, alloc_rec_t>& list(sAllocList);
-    list.removeItem(handle);
+    if (uid != NO_UID) {
+        sTotalBytes -= size;
+        sTotalCount--;
+        unchargeUid(uid, size);
+    }
 
     return NO_ERROR;
 }
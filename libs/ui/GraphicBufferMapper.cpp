@@ -29,6 +29,8 @@
 #include <sync/sync.h>
 #pragma clang diagnostic pop
 
+#include <sys/stat.h>
+
 #include <utils/Log.h>
 #include <utils/Trace.h>
 
@@ -61,10 +63,138 @@ status_t GraphicBufferMapper::importBuffer(buffer_handle_t rawHandle,
     return static_cast<status_t>(error);
 }
 
+bool GraphicBufferMapper::getIdentity(buffer_handle_t rawHandle,
+        Identity* outIdentity)
+{
+    outIdentity->files.clear();
+    outIdentity->ints.clear();
+    if (rawHandle == nullptr || rawHandle->numFds <= 0 || rawHandle->numInts < 0) {
+        return false;
+    }
+    for (int i = 0; i < rawHandle->numFds; i++) {
+        struct stat st;
+        if (fstat(rawHandle->data[i], &st) != 0) {
+            return false;
+        }
+        outIdentity->files.emplace_back(st.st_dev, st.st_ino);
+    }
+    const int* ints = rawHandle->data + rawHandle->numFds;
+    outIdentity->ints.assign(ints, ints + rawHandle->numInts);
+    return true;
+}
+
+buffer_handle_t GraphicBufferMapper::acquireCachedLocked(uint64_t bufferId,
+        const Identity& identity)
+{
+    auto it = mImportsById.find(bufferId);
+    if (it == mImportsById.end() || it->second.identity != identity) {
+        return nullptr;
+    }
+    it->second.refCount++;
+    return it->second.handle;
+}
+
+status_t GraphicBufferMapper::importAndCache(uint64_t bufferId,
+        buffer_handle_t rawHandle, Identity&& identity,
+        buffer_handle_t* outHandle)
+{
+    buffer_handle_t handle;
+    status_t err = importBuffer(rawHandle, &handle);
+    if (err != NO_ERROR) {
+        return err;
+    }
+
+    buffer_handle_t duplicate = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mImportLock);
+        buffer_handle_t cached = acquireCachedLocked(bufferId, identity);
+        if (cached != nullptr) {
+            duplicate = handle;
+            handle = cached;
+        } else if (mImportsById.count(bufferId) == 0) {
+            mImportsById[bufferId] = {handle, 1, std::move(identity)};
+            mIdsByHandle[handle] = bufferId;
+        }
+        // else a different buffer holds this id, leave ours uncached
+    }
+    if (duplicate != nullptr) {
+        mMapper->freeBuffer(duplicate);
+    }
+
+    *outHandle = handle;
+    return NO_ERROR;
+}
+
+status_t GraphicBufferMapper::importBuffer(uint64_t bufferId,
+        buffer_handle_t rawHandle, buffer_handle_t* outHandle)
+{
+    return importBuffers(1, &bufferId, &rawHandle, outHandle);
+}
+
+status_t GraphicBufferMapper::importBuffers(size_t count,
+        const uint64_t* bufferIds, const buffer_handle_t* rawHandles,
+        buffer_handle_t* outHandles)
+{
+    ATRACE_CALL();
+
+    std::vector<Identity> identities(count);
+    std::vector<bool> cacheable(count);
+    for (size_t i = 0; i < count; i++) {
+        cacheable[i] = bufferIds[i] != 0 &&
+                getIdentity(rawHandles[i], &identities[i]);
+        outHandles[i] = nullptr;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mImportLock);
+        for (size_t i = 0; i < count; i++) {
+            if (cacheable[i]) {
+                outHandles[i] = acquireCachedLocked(bufferIds[i], identities[i]);
+            }
+        }
+    }
+
+    status_t err = NO_ERROR;
+    for (size_t i = 0; i < count && err == NO_ERROR; i++) {
+        if (outHandles[i] != nullptr) {
+            continue;
+        }
+        if (cacheable[i]) {
+            err = importAndCache(bufferIds[i], rawHandles[i],
+                    std::move(identities[i]), &outHandles[i]);
+        } else {
+            err = importBuffer(rawHandles[i], &outHandles[i]);
+        }
+    }
+
+    if (err != NO_ERROR) {
+        for (size_t i = 0; i < count; i++) {
+            if (outHandles[i] != nullptr) {
+                freeBuffer(outHandles[i]);
+                outHandles[i] = nullptr;
+            }
+        }
+    }
+    return err;
+}
+
 status_t GraphicBufferMapper::freeBuffer(buffer_handle_t handle)
 {
     ATRACE_CALL();
 
+    {
+        std::lock_guard<std::mutex> lock(mImportLock);
+        auto idIt = mIdsByHandle.find(handle);
+        if (idIt != mIdsByHandle.end()) {
+            auto it = mImportsById.find(idIt->second);
+            if (--it->second.refCount > 0) {
+                return NO_ERROR;
+            }
+            mImportsById.erase(it);
+            mIdsByHandle.erase(idIt);
+        }
+    }
+
     mMapper->freeBuffer(handle);
 
     return NO_ERROR;
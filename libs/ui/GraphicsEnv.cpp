@@ -18,6 +18,7 @@
 #define LOG_TAG "GraphicsEnv"
 #include <ui/GraphicsEnv.h>
 
+#include <inttypes.h>
 #include <mutex>
 
 #include <log/log.h>
@@ -65,6 +66,27 @@ android_namespace_t* GraphicsEnv::getDriverNamespace() {
     return mDriverNamespace;
 }
 
+void GraphicsEnv::setDriverLoadTime(Api api, int64_t loadTimeNs) {
+    ALOGV("%s driver loaded in %" PRId64 "ns", api == Api::GL ? "GL" : "Vulkan", loadTimeNs);
+    (api == Api::GL ? mGlDriverLoadTime : mVkDriverLoadTime).store(loadTimeNs,
+            std::memory_order_relaxed);
+}
+
+void GraphicsEnv::recordShaderCacheLookup(bool hit) {
+    // Called by the GL threads on every blob cache lookup, only needs to be
+    // a counter
+    (hit ? mShaderCacheHits : mShaderCacheMisses).fetch_add(1, std::memory_order_relaxed);
+}
+
+GraphicsEnv::GpuStats GraphicsEnv::getGpuStats() const {
+    GpuStats stats;
+    stats.glDriverLoadTimeNs = mGlDriverLoadTime.load(std::memory_order_relaxed);
+    stats.vkDriverLoadTimeNs = mVkDriverLoadTime.load(std::memory_order_relaxed);
+    stats.shaderCacheHits = mShaderCacheHits.load(std::memory_order_relaxed);
+    stats.shaderCacheMisses = mShaderCacheMisses.load(std::memory_order_relaxed);
+    return stats;
+}
+
 } // namespace android
 
 extern "C" android_namespace_t* android_getDriverNamespace() {
@@ -18,6 +18,10 @@
 
 #include <inttypes.h>
 #include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <utility>
 
 #include <utils/Log.h>
 #include <utils/String8.h>
@@ -28,6 +32,7 @@
 #include <ui/Point.h>
 
 #include <private/ui/RegionHelper.h>
+#include <private/ui/RegionSimd.h>
 
 // ----------------------------------------------------------------------------
 #define VALIDATE_REGIONS        (false)
@@ -69,6 +74,14 @@ Region::Region(const Region& rhs)
 #endif
 }
 
+Region::Region(Region&& rhs)
+    : mStorage(std::move(rhs.mStorage))
+{
+    // leave rhs a valid, empty region
+    rhs.mStorage.clear();
+    rhs.mStorage.add(Rect(0,0));
+}
+
 Region::Region(const Rect& rhs) {
     mStorage.add(rhs);
 }
@@ -77,6 +90,95 @@ Region::~Region()
 {
 }
 
+// ----------------------------------------------------------------------------
+
+static_assert(std::is_trivially_copyable<Rect>::value,
+        "Region::Storage moves Rects with memcpy");
+
+Region::Storage::Storage(const Storage& rhs)
+    : mArray(inlineArray()), mSize(0), mCapacity(INLINE_CAPACITY)
+{
+    *this = rhs;
+}
+
+Region::Storage::Storage(Storage&& rhs)
+    : mArray(inlineArray()), mSize(0), mCapacity(INLINE_CAPACITY)
+{
+    *this = std::move(rhs);
+}
+
+Region::Storage::~Storage() {
+    if (!isInline()) {
+        free(mArray);
+    }
+}
+
+Region::Storage& Region::Storage::operator = (const Storage& rhs) {
+    if (this != &rhs) {
+        if (rhs.mSize > mCapacity) {
+            mSize = 0;
+            grow(rhs.mSize);
+        }
+        memcpy(mArray, rhs.mArray, rhs.mSize * sizeof(Rect));
+        mSize = rhs.mSize;
+    }
+    return *this;
+}
+
+Region::Storage& Region::Storage::operator = (Storage&& rhs) {
+    if (this == &rhs) {
+        return *this;
+    }
+    if (rhs.isInline()) {
+        return *this = rhs;
+    }
+    if (!isInline()) {
+        free(mArray);
+    }
+    mArray = rhs.mArray;
+    mSize = rhs.mSize;
+    mCapacity = rhs.mCapacity;
+    rhs.mArray = rhs.inlineArray();
+    rhs.mSize = 0;
+    rhs.mCapacity = INLINE_CAPACITY;
+    return *this;
+}
+
+void Region::Storage::append(const Storage& rhs) {
+    if (mSize + rhs.mSize > mCapacity) {
+        grow(mSize + rhs.mSize);
+    }
+    memcpy(mArray + mSize, rhs.mArray, rhs.mSize * sizeof(Rect));
+    mSize += rhs.mSize;
+}
+
+void Region::Storage::insertAt(const Rect& rect, size_t index) {
+    if (mSize == mCapacity) {
+        grow(mSize + 1);
+    }
+    memmove(mArray + index + 1, mArray + index, (mSize - index) * sizeof(Rect));
+    mArray[index] = rect;
+    mSize++;
+}
+
+void Region::Storage::grow(size_t minCapacity) {
+    size_t capacity = mCapacity * 2;
+    if (capacity < minCapacity) {
+        capacity = minCapacity;
+    }
+    Rect* array = static_cast<Rect*>(malloc(capacity * sizeof(Rect)));
+    LOG_ALWAYS_FATAL_IF(array == nullptr,
+            "Region: out of memory growing to %zu rects", capacity);
+    memcpy(array, mArray, mSize * sizeof(Rect));
+    if (!isInline()) {
+        free(mArray);
+    }
+    mArray = array;
+    mCapacity = capacity;
+}
+
+// ----------------------------------------------------------------------------
+
 /**
  * Copy rects from the src vector into the dst vector, resolving vertical T-Junctions along the way
  *
@@ -91,8 +193,9 @@ Region::~Region()
  * final, correctly ordered region buffer. Each rectangle will be compared with the span directly
  * above it, and subdivided to resolve any remaining T-junctions.
  */
+template <typename STORAGE>
 static void reverseRectsResolvingJunctions(const Rect* begin, const Rect* end,
-        Vector<Rect>& dst, int spanDirection) {
+        STORAGE& dst, int spanDirection) {
     dst.clear();
 
     const Rect* current = end - 1;
@@ -192,11 +295,11 @@ Region Region::createTJunctionFreeRegion(const Region& r) {
     if (r.isEmpty()) return r;
     if (r.isRect()) return r;
 
-    Vector<Rect> reversed;
-    reverseRectsResolvingJunctions(r.begin(), r.end(), reversed, direction_RTL);
+    Region reversed;
+    reverseRectsResolvingJunctions(r.begin(), r.end(), reversed.mStorage, direction_RTL);
 
     Region outputRegion;
-    reverseRectsResolvingJunctions(reversed.begin(), reversed.end(),
+    reverseRectsResolvingJunctions(reversed.mStorage.begin(), reversed.mStorage.end(),
             outputRegion.mStorage, direction_LTR);
     outputRegion.mStorage.add(r.getBounds()); // to make region valid, mStorage must end with bounds
 
@@ -217,6 +320,16 @@ Region& Region::operator = (const Region& rhs)
     return *this;
 }
 
+Region& Region::operator = (Region&& rhs)
+{
+    if (this != &rhs) {
+        mStorage = std::move(rhs.mStorage);
+        rhs.mStorage.clear();
+        rhs.mStorage.add(Rect(0,0));
+    }
+    return *this;
+}
+
 Region& Region::makeBoundsSelf()
 {
     if (mStorage.size() >= 2) {
@@ -232,15 +345,7 @@ bool Region::contains(const Point& point) const {
 }
 
 bool Region::contains(int x, int y) const {
-    const_iterator cur = begin();
-    const_iterator const tail = end();
-    while (cur != tail) {
-        if (y >= cur->top && y < cur->bottom && x >= cur->left && x < cur->right) {
-            return true;
-        }
-        cur++;
-    }
-    return false;
+    return region_simd::contains(begin(), end(), x, y);
 }
 
 void Region::clear()
@@ -268,7 +373,12 @@ void Region::set(uint32_t w, uint32_t h)
 }
 
 bool Region::isTriviallyEqual(const Region& region) const {
-    return begin() == region.begin();
+    if (begin() == region.begin()) {
+        return true;
+    }
+    const size_t count = mStorage.size();
+    return count == region.mStorage.size() &&
+            memcmp(mStorage.array(), region.mStorage.array(), count * sizeof(Rect)) == 0;
 }
 
 // ----------------------------------------------------------------------------
@@ -277,7 +387,7 @@ void Region::addRectUnchecked(int l, int t, int r, int b)
 {
     Rect rect(l,t,r,b);
     size_t where = mStorage.size() - 1;
-    mStorage.insertAt(rect, where, 1);
+    mStorage.insertAt(rect, where);
 }
 
 // ----------------------------------------------------------------------------
@@ -316,7 +426,24 @@ Region& Region::subtractSelf(const Region& rhs) {
 }
 Region& Region::operationSelf(const Region& rhs, uint32_t op) {
     Region lhs(*this);
-    boolean_operation(op, *this, lhs, rhs);
+    // the rasterizer overwrites our storage, which rhs may be
+    boolean_operation(op, *this, lhs, &rhs == this ? lhs : rhs);
+    return *this;
+}
+
+Region& Region::orSelf(const Region& rhs, Scratch& scratch) {
+    return operationSelf(rhs, op_or, scratch);
+}
+Region& Region::andSelf(const Region& rhs, Scratch& scratch) {
+    return operationSelf(rhs, op_and, scratch);
+}
+Region& Region::subtractSelf(const Region& rhs, Scratch& scratch) {
+    return operationSelf(rhs, op_nand, scratch);
+}
+Region& Region::operationSelf(const Region& rhs, uint32_t op, Scratch& scratch) {
+    scratch.lhs.mStorage = mStorage;
+    boolean_operation(op, *this, scratch.lhs, &rhs == this ? scratch.lhs : rhs,
+            0, 0, &scratch.span);
     return *this;
 }
 
@@ -387,7 +514,7 @@ Region& Region::subtractSelf(const Region& rhs, int dx, int dy) {
 }
 Region& Region::operationSelf(const Region& rhs, int dx, int dy, uint32_t op) {
     Region lhs(*this);
-    boolean_operation(op, *this, lhs, rhs, dx, dy);
+    boolean_operation(op, *this, lhs, &rhs == this ? lhs : rhs, dx, dy);
     return *this;
 }
 
@@ -418,15 +545,18 @@ const Region Region::operation(const Region& rhs, int dx, int dy, uint32_t op) c
 class Region::rasterizer : public region_operator<Rect>::region_rasterizer
 {
     Rect bounds;
-    Vector<Rect>& storage;
+    Storage& storage;
     Rect* head;
     Rect* tail;
-    Vector<Rect> span;
+    Storage ownSpan;
+    Storage& span;
     Rect* cur;
 public:
-    explicit rasterizer(Region& reg)
-        : bounds(INT_MAX, 0, INT_MIN, 0), storage(reg.mStorage), head(), tail(), cur() {
+    rasterizer(Region& reg, Storage* spanStorage)
+        : bounds(INT_MAX, 0, INT_MIN, 0), storage(reg.mStorage), head(), tail(),
+          span(spanStorage ? *spanStorage : ownSpan), cur() {
         storage.clear();
+        span.clear();
     }
 
     virtual ~rasterizer();
@@ -483,15 +613,7 @@ void Region::rasterizer::flushSpan()
         Rect const* p = span.editArray();
         Rect const* q = head;
         if (p->top == q->bottom) {
-            merge = true;
-            while (q != tail) {
-                if ((p->left != q->left) || (p->right != q->right)) {
-                    merge = false;
-                    break;
-                }
-                p++;
-                q++;
-            }
+            merge = region_simd::sameHorizontalEdges(p, q, span.size());
         }
     }
     if (merge) {
@@ -504,7 +626,7 @@ void Region::rasterizer::flushSpan()
     } else {
         bounds.left = min(span.itemAt(0).left, bounds.left);
         bounds.right = max(span.top().right, bounds.right);
-        storage.appendVector(span);
+        storage.append(span);
         tail = storage.editArray() + storage.size();
         head = tail - span.size();
     }
@@ -585,7 +707,7 @@ bool Region::validate(const Region& reg, const char* name, bool silent)
 
 void Region::boolean_operation(uint32_t op, Region& dst,
         const Region& lhs,
-        const Region& rhs, int dx, int dy)
+        const Region& rhs, int dx, int dy, Storage* span)
 {
 #if VALIDATE_REGIONS
     validate(lhs, "boolean_operation (before): lhs");
@@ -603,7 +725,7 @@ void Region::boolean_operation(uint32_t op, Region& dst,
     region_operator<Rect>::region rhs_region(rhs_rects, rhs_count, dx, dy);
     region_operator<Rect> operation(op, lhs_region, rhs_region);
     { // scope for rasterizer (dtor has side effects)
-        rasterizer r(dst);
+        rasterizer r(dst, span);
         operation(r);
     }
 
@@ -715,7 +837,7 @@ void Region::boolean_operation(uint32_t op, Region& dst,
     region_operator<Rect>::region rhs_region(&rhs, 1, dx, dy);
     region_operator<Rect> operation(op, lhs_region, rhs_region);
     { // scope for rasterizer (dtor has side effects)
-        rasterizer r(dst);
+        rasterizer r(dst, nullptr);
         operation(r);
     }
 
@@ -740,13 +862,7 @@ void Region::translate(Region& reg, int dx, int dy)
 #if VALIDATE_REGIONS
         validate(reg, "translate (before)");
 #endif
-        size_t count = reg.mStorage.size();
-        Rect* rects = reg.mStorage.editArray();
-        while (count) {
-            rects->offsetBy(dx, dy);
-            rects++;
-            count--;
-        }
+        region_simd::offset(reg.mStorage.editArray(), reg.mStorage.size(), dx, dy);
 #if VALIDATE_REGIONS
         validate(reg, "translate (after)");
 #endif
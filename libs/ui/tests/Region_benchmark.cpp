@@ -0,0 +1,178 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Microbenchmarks comparing the vectorized Region helpers with their scalar
+ * versions, on the kinds of regions SurfaceFlinger deals with:
+ *   0: a screen partly covered by a window (a few rects)
+ *   1: a screen with rounded corners (one band per corner scanline)
+ *   2: scattered damage (many small rects, several per band)
+ * The argument of each benchmark is the shape. For machine-readable results,
+ * run with
+ *   libui_region_benchmark --benchmark_format=json
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <ui/Rect.h>
+#include <ui/Region.h>
+
+#include <private/ui/RegionSimd.h>
+
+#include <stdlib.h>
+
+#include <vector>
+
+namespace android {
+
+static const int32_t WIDTH = 1080;
+static const int32_t HEIGHT = 1920;
+static const size_t NUM_PROBES = 256;
+
+static Region makeShape(int64_t shape) {
+    Region region(Rect(WIDTH, HEIGHT));
+    switch (shape) {
+        case 0:
+            region.subtractSelf(Rect(100, 400, 980, 1500));
+            break;
+        case 1: {
+            const int32_t radius = 96;
+            for (int32_t y = 0; y < radius; y++) {
+                const int32_t dy = radius - y;
+                int32_t inset = 0;
+                while ((radius - inset) * (radius - inset) + dy * dy > radius * radius) {
+                    inset++;
+                }
+                region.subtractSelf(Rect(0, y, inset, y + 1));
+                region.subtractSelf(Rect(WIDTH - inset, y, WIDTH, y + 1));
+                region.subtractSelf(Rect(0, HEIGHT - y - 1, inset, HEIGHT - y));
+                region.subtractSelf(Rect(WIDTH - inset, HEIGHT - y - 1, WIDTH, HEIGHT - y));
+            }
+            break;
+        }
+        case 2: {
+            region.clear();
+            srandom(2017);
+            for (int32_t row = 0; row < 16; row++) {
+                for (int32_t col = 0; col < 12; col++) {
+                    const int32_t x = col * 90 + static_cast<int32_t>(random() % 40);
+                    const int32_t y = row * 120 + static_cast<int32_t>(random() % 60);
+                    region.orSelf(Rect(x, y, x + 24, y + 24));
+                }
+            }
+            break;
+        }
+    }
+    return region;
+}
+
+static std::vector<Point> makeProbes() {
+    std::vector<Point> probes;
+    srandom(1);
+    for (size_t i = 0; i < NUM_PROBES; i++) {
+        probes.push_back(Point(static_cast<int32_t>(random() % WIDTH),
+                static_cast<int32_t>(random() % HEIGHT)));
+    }
+    return probes;
+}
+
+static void BM_ContainsScalar(benchmark::State& state) {
+    const Region region(makeShape(state.range(0)));
+    const std::vector<Point> probes(makeProbes());
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        const Point& p = probes[i++ % NUM_PROBES];
+        benchmark::DoNotOptimize(
+                region_simd::containsScalar(region.begin(), region.end(), p.x, p.y));
+    }
+}
+
+static void BM_Contains(benchmark::State& state) {
+    const Region region(makeShape(state.range(0)));
+    const std::vector<Point> probes(makeProbes());
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        const Point& p = probes[i++ % NUM_PROBES];
+        benchmark::DoNotOptimize(
+                region_simd::contains(region.begin(), region.end(), p.x, p.y));
+    }
+}
+
+// Comparing a region with an identical copy is the worst case: every rect
+// has to be looked at.
+static void BM_SameHorizontalEdgesScalar(benchmark::State& state) {
+    const Region region(makeShape(state.range(0)));
+    const std::vector<Rect> copy(region.begin(), region.end());
+    const size_t count = copy.size();
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(region_simd::sameHorizontalEdgesScalar(
+                region.begin(), copy.data(), count));
+    }
+}
+
+static void BM_SameHorizontalEdges(benchmark::State& state) {
+    const Region region(makeShape(state.range(0)));
+    const std::vector<Rect> copy(region.begin(), region.end());
+    const size_t count = copy.size();
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(region_simd::sameHorizontalEdges(
+                region.begin(), copy.data(), count));
+    }
+}
+
+static void BM_OffsetScalar(benchmark::State& state) {
+    const Region region(makeShape(state.range(0)));
+    std::vector<Rect> rects(region.begin(), region.end());
+    while (state.KeepRunning()) {
+        region_simd::offsetScalar(rects.data(), rects.size(), 1, -1);
+        benchmark::ClobberMemory();
+    }
+}
+
+static void BM_Offset(benchmark::State& state) {
+    const Region region(makeShape(state.range(0)));
+    std::vector<Rect> rects(region.begin(), region.end());
+    while (state.KeepRunning()) {
+        region_simd::offset(rects.data(), rects.size(), 1, -1);
+        benchmark::ClobberMemory();
+    }
+}
+
+// End to end: a boolean operation, whose rasterizer coalesces bands with
+// sameHorizontalEdges
+static void BM_SubtractTranslated(benchmark::State& state) {
+    const Region region(makeShape(state.range(0)));
+    const Region other(region.translate(0, 1));
+    Region::Scratch scratch;
+    Region result;
+    while (state.KeepRunning()) {
+        result = region;
+        result.subtractSelf(other, scratch);
+        benchmark::DoNotOptimize(result.begin());
+    }
+}
+
+BENCHMARK(BM_ContainsScalar)->DenseRange(0, 2);
+BENCHMARK(BM_Contains)->DenseRange(0, 2);
+BENCHMARK(BM_SameHorizontalEdgesScalar)->DenseRange(0, 2);
+BENCHMARK(BM_SameHorizontalEdges)->DenseRange(0, 2);
+BENCHMARK(BM_OffsetScalar)->DenseRange(0, 2);
+BENCHMARK(BM_Offset)->DenseRange(0, 2);
+BENCHMARK(BM_SubtractTranslated)->DenseRange(0, 2);
+
+} // namespace android
+
+BENCHMARK_MAIN();
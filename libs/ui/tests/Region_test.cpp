@@ -17,8 +17,11 @@
 #define LOG_TAG "RegionTest"
 
 #include <stdlib.h>
+#include <utility>
+#include <vector>
 #include <ui/Region.h>
 #include <ui/Rect.h>
+#include <private/ui/RegionSimd.h>
 #include <gtest/gtest.h>
 
 namespace android {
@@ -152,5 +155,130 @@ TEST_F(RegionTest, Random_TJunction) {
     }
 }
 
+static void expectSameRects(const Region& expected, const Region& actual) {
+    size_t expectedCount = 0, actualCount = 0;
+    const Rect* expectedRects = expected.getArray(&expectedCount);
+    const Rect* actualRects = actual.getArray(&actualCount);
+    ASSERT_EQ(expectedCount, actualCount);
+    for (size_t i = 0; i < expectedCount; i++) {
+        EXPECT_EQ(expectedRects[i], actualRects[i]);
+    }
+    EXPECT_EQ(expected.getBounds(), actual.getBounds());
+}
+
+TEST_F(RegionTest, CopyAndMoveAcrossInlineCapacity) {
+    // a staircase of n steps is n rects, more than fit inline for large n
+    for (int steps = 1; steps < 12; steps++) {
+        Region r;
+        for (int i = 0; i < steps; i++) {
+            r.orSelf(Rect(i, i, i + 4, i + 1));
+        }
+        EXPECT_EQ(steps, r.end() - r.begin());
+
+        Region copy(r);
+        expectSameRects(r, copy);
+        EXPECT_TRUE(copy.isTriviallyEqual(r));
+
+        Region moved(std::move(copy));
+        expectSameRects(r, moved);
+        EXPECT_TRUE(copy.isEmpty());
+
+        Region assigned(Rect(0, 0, 1, 1));
+        assigned = std::move(moved);
+        expectSameRects(r, assigned);
+        EXPECT_TRUE(moved.isEmpty());
+
+        // shrinking and regrowing a region reuses its storage
+        assigned.set(Rect(0, 0, 1, 1));
+        EXPECT_TRUE(assigned.isRect());
+        assigned = r;
+        expectSameRects(r, assigned);
+    }
+}
+
+TEST_F(RegionTest, ScratchOperationsMatchPlainOperations) {
+    Region::Scratch scratch;
+    srandom(54321);
+
+    for (int iter = 0; iter < ITER_MAX; iter++) {
+        Region lhs, rhs;
+        for (int i = 0; i < X_MAX; i++) {
+            for (int j = 0; j < Y_MAX; j++) {
+                if (random() % 2) {
+                    lhs.orSelf(Rect(i, j, i + 1, j + 1));
+                }
+                if (random() % 2) {
+                    rhs.orSelf(Rect(i, j, i + 2, j + 1));
+                }
+            }
+        }
+
+        Region result(lhs);
+        expectSameRects(lhs | rhs, result.orSelf(rhs, scratch));
+        result = lhs;
+        expectSameRects(lhs & rhs, result.andSelf(rhs, scratch));
+        result = lhs;
+        expectSameRects(lhs - rhs, result.subtractSelf(rhs, scratch));
+    }
+}
+
+TEST_F(RegionTest, OperationWithItself) {
+    Region::Scratch scratch;
+    Region r;
+    for (int i = 0; i < 8; i++) {
+        r.orSelf(Rect(i, i, i + 4, i + 1));
+    }
+    const Region original(r);
+
+    expectSameRects(original, r.orSelf(r));
+    expectSameRects(original, r.andSelf(r, scratch));
+    EXPECT_TRUE(r.subtractSelf(r, scratch).isEmpty());
+}
+
+TEST_F(RegionTest, SimdHelpersMatchScalar) {
+    srandom(13579);
+
+    for (int iter = 0; iter < ITER_MAX; iter++) {
+        Region r;
+        for (int i = 0; i < X_MAX; i++) {
+            for (int j = 0; j < Y_MAX; j++) {
+                if (random() % 2) {
+                    r.orSelf(Rect(i, j, i + 1 + random() % 2, j + 1));
+                }
+            }
+        }
+
+        for (int x = -1; x <= X_MAX + 1; x++) {
+            for (int y = -1; y <= Y_MAX; y++) {
+                EXPECT_EQ(region_simd::containsScalar(r.begin(), r.end(), x, y),
+                        r.contains(x, y)) << "x=" << x << " y=" << y;
+            }
+        }
+
+        size_t count = 0;
+        const Rect* rects = r.getArray(&count);
+        std::vector<Rect> edited(rects, rects + count);
+        EXPECT_TRUE(region_simd::sameHorizontalEdges(rects, edited.data(), count));
+        if (count > 0) {
+            Rect& victim = edited[static_cast<size_t>(random()) % count];
+            switch (random() % 3) {
+                case 0: victim.left--; break;
+                case 1: victim.right++; break;
+                case 2: victim.bottom++; break;  // not a horizontal edge
+            }
+            EXPECT_EQ(region_simd::sameHorizontalEdgesScalar(rects, edited.data(), count),
+                    region_simd::sameHorizontalEdges(rects, edited.data(), count));
+        }
+
+        Region translated(r);
+        translated.translateSelf(3, -5);
+        for (size_t i = 0; i < count; i++) {
+            Rect expected(rects[i]);
+            expected.offsetBy(3, -5);
+            EXPECT_EQ(expected, translated.begin()[i]);
+        }
+    }
+}
+
 }; // namespace android
 
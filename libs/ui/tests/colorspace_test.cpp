@@ -180,4 +180,46 @@ TEST_F(ColorSpaceTest, LUT) {
 
 }
 
+TEST_F(ColorSpaceTest, TransferLUT) {
+    const ColorSpace spaces[] = {
+        ColorSpace::sRGB(), ColorSpace::AdobeRGB(), ColorSpace::ProPhotoRGB(),
+        ColorSpace::BT2020(), ColorSpace::DCIP3()
+    };
+    for (const ColorSpace& space : spaces) {
+        TransferLUT eotf(space.getEOTF());
+        TransferLUT oetf(space.getOETF());
+        for (uint32_t i = 0; i <= 4096; i++) {
+            float x = i / 4096.0f;
+            EXPECT_NEAR(space.getEOTF()(x), eotf(x), 1e-4f) << space.getName() << " " << x;
+            EXPECT_NEAR(space.getOETF()(x), oetf(x), 1e-4f) << space.getName() << " " << x;
+        }
+    }
+
+    // Out of the sampled domain
+    ColorSpace extendedSRGB(ColorSpace::extendedSRGB());
+    TransferLUT eotf(extendedSRGB.getEOTF());
+    EXPECT_EQ(extendedSRGB.getEOTF()(-0.5f), eotf(-0.5f));
+    EXPECT_EQ(extendedSRGB.getEOTF()(2.0f), eotf(2.0f));
+}
+
+TEST_F(ColorSpaceTest, ConnectBatch) {
+    ColorSpaceConnector connector(ColorSpace::sRGB(), ColorSpace::ProPhotoRGB());
+
+    std::vector<float3> colors;
+    for (uint32_t i = 0; i < 1000; i++) {
+        colors.push_back({(i % 10) / 9.0f, ((i / 10) % 10) / 9.0f, (i / 100) / 9.0f});
+    }
+    std::vector<float3> out(colors.size());
+    connector.transform(colors.data(), out.data(), colors.size());
+
+    for (size_t i = 0; i < colors.size(); i++) {
+        float3 expected = connector.transform(colors[i]);
+        EXPECT_TRUE(all(lessThan(abs(out[i] - expected), float3{1e-4f})));
+    }
+
+    // In place
+    connector.transform(colors.data(), colors.data(), colors.size());
+    EXPECT_TRUE(std::equal(colors.begin(), colors.end(), out.begin()));
+}
+
 }; // namespace android
@@ -1,8 +1,10 @@
 #include "libbroadcastring/broadcast_ring.h"
 
 #include <stdlib.h>
+#include <chrono>
 #include <memory>
 #include <thread>  // NOLINT
+#include <vector>
 #include <sys/mman.h>
 
 #include <gtest/gtest.h>
@@ -286,6 +288,54 @@ TYPED_TEST(BroadcastRingTest, FillTwice) {
   }
 }
 
+TYPED_TEST(BroadcastRingTest, GetRange) {
+  using Record = typename TypeParam::Record;
+  using Ring = typename TypeParam::Ring;
+  Ring ring;
+  auto mmap = CreateRing(&ring, Ring::Traits::MinCount());
+  const uint32_t record_count = ring.record_count();
+  std::vector<Record> records(record_count + 1);
+  {
+    uint32_t sequence = ring.GetOldestSequence();
+    EXPECT_EQ(0U, ring.GetRange(&sequence, record_count, records.data()));
+  }
+
+  // Overfill the ring so that the readable region wraps around its end.
+  const uint32_t put_count = record_count + record_count / 2 + 1;
+  for (uint32_t i = 0; i < put_count; ++i)
+    ring.Put(Record(FillChar(i)));
+  const uint32_t oldest_sequence = ring.GetOldestSequence();
+
+  {
+    uint32_t sequence = oldest_sequence - 1;
+    EXPECT_EQ(record_count,
+              ring.GetRange(&sequence, record_count + 1, records.data()));
+    EXPECT_EQ(oldest_sequence, sequence);
+    for (uint32_t j = 0; j < record_count; ++j)
+      EXPECT_EQ(Record(FillChar(put_count - record_count + j)), records[j]);
+  }
+
+  for (uint32_t first = 0; first < record_count; ++first) {
+    for (uint32_t count = 1; first + count <= record_count; ++count) {
+      uint32_t sequence = oldest_sequence + first;
+      ASSERT_EQ(count, ring.GetRange(&sequence, count, records.data()));
+      EXPECT_EQ(oldest_sequence + first, sequence);
+      for (uint32_t j = 0; j < count; ++j) {
+        uint32_t get_sequence = sequence + j;
+        Record record;
+        EXPECT_TRUE(ring.Get(&get_sequence, &record));
+        EXPECT_EQ(record, records[j]);
+      }
+    }
+  }
+
+  {
+    uint32_t sequence = ring.GetNextSequence();
+    EXPECT_EQ(0U, ring.GetRange(&sequence, record_count, records.data()));
+    EXPECT_EQ(ring.GetNextSequence(), sequence);
+  }
+}
+
 TYPED_TEST(BroadcastRingTest, Import) {
   using Record = typename TypeParam::Record;
   using Ring = typename TypeParam::Ring;
@@ -469,6 +519,17 @@ TEST(BroadcastRingTest, ShouldImportIfDynamicSizeShrinks) {
       EXPECT_EQ(original_sequence_1, sequence);
       EXPECT_EQ(original_record_1.Truncate<ImportedRecord>(), shrunk_record);
     }
+
+    {
+      uint32_t sequence = original_sequence_0;
+      ImportedRecord shrunk_records[2];
+      EXPECT_EQ(2U, imported_ring.GetRange(&sequence, 2, shrunk_records));
+      EXPECT_EQ(original_sequence_0, sequence);
+      EXPECT_EQ(original_record_0.Truncate<ImportedRecord>(),
+                shrunk_records[0]);
+      EXPECT_EQ(original_record_1.Truncate<ImportedRecord>(),
+                shrunk_records[1]);
+    }
   }
 }
 
@@ -862,5 +923,82 @@ TEST(BroadcastRingTest, ThreadedOverwriteTortureLarge) {
   ThreadedOverwriteTorture<Dynamic_256_NxM_1plus0::Ring>();
 }
 
+TEST(BroadcastRingTest, ThreadedGetRangeTorture) {
+  using Ring = Dynamic_32_NxM::Ring;
+  using Record = Ring::Record;
+  constexpr uint32_t kRecordCount = 16;
+  Ring out_ring;
+  auto out_mmap = CreateRing(&out_ring, kRecordCount);
+
+  std::atomic<bool> quit(false);
+  std::thread check_task([&quit, &out_mmap]() {
+    bool import_ok;
+    Ring in_ring;
+    std::tie(in_ring, import_ok) = Ring::Import(out_mmap.mmap(), out_mmap.size);
+    ASSERT_TRUE(import_ok);
+
+    Record records[kRecordCount];
+    uint32_t sequence = in_ring.GetOldestSequence();
+    while (!std::atomic_load_explicit(&quit, std::memory_order_relaxed)) {
+      const uint32_t count =
+          in_ring.GetRange(&sequence, kRecordCount, records);
+      // Each record is filled with a single value, and consecutive records
+      // were written with consecutive values.
+      for (uint32_t i = 0; i < count; ++i) {
+        ASSERT_EQ(Record(records[i].v[0]), records[i]);
+        ASSERT_EQ(FillChar(records[0].v[0] + i), records[i].v[0]);
+      }
+      sequence += count;
+    }
+  });
+
+  constexpr int kIterations = 100000;
+  for (int i = 0; i < kIterations; ++i)
+    out_ring.Put(Record(FillChar(i)));
+
+  std::atomic_store_explicit(&quit, true, std::memory_order_relaxed);
+  check_task.join();
+}
+
+// Compares catching up on a full ring record by record with Get() against a
+// single GetRange(). Only reports the timings; it does not fail on them.
+template <typename Ring>
+void BenchmarkCatchUp(const char* name) {
+  using Record = typename Ring::Record;
+  constexpr uint32_t kRecordCount = 1024;
+  constexpr int kIterations = 2000;
+  Ring ring;
+  auto mmap = CreateRing(&ring, kRecordCount);
+  for (uint32_t i = 0; i < kRecordCount; ++i)
+    ring.Put(Record(FillChar(i)));
+
+  std::vector<Record> records(kRecordCount);
+  const auto get_start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kIterations; ++i) {
+    uint32_t sequence = ring.GetOldestSequence();
+    for (uint32_t j = 0; j < kRecordCount; ++j, ++sequence)
+      ASSERT_TRUE(ring.Get(&sequence, &records[j]));
+  }
+  const auto get_end = std::chrono::steady_clock::now();
+  for (int i = 0; i < kIterations; ++i) {
+    uint32_t sequence = ring.GetOldestSequence();
+    ASSERT_EQ(kRecordCount,
+              ring.GetRange(&sequence, kRecordCount, records.data()));
+  }
+  const auto range_end = std::chrono::steady_clock::now();
+
+  using Nanoseconds = std::chrono::duration<double, std::nano>;
+  const double records_read = static_cast<double>(kIterations) * kRecordCount;
+  printf("%s: Get %.2f ns/record, GetRange %.2f ns/record\n", name,
+         Nanoseconds(get_end - get_start).count() / records_read,
+         Nanoseconds(range_end - get_end).count() / records_read);
+}
+
+TEST(BroadcastRingTest, BenchmarkCatchUp) {
+  BenchmarkCatchUp<Dynamic_16_NxM::Ring>("16 byte records");
+  BenchmarkCatchUp<Dynamic_32_32xM::Ring>("32 byte records");
+  BenchmarkCatchUp<Dynamic_256_NxM_1plus0::Ring>("256 byte records");
+}
+
 } // namespace dvr
 } // namespace android
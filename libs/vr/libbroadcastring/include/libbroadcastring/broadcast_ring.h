@@ -4,6 +4,7 @@
 #include <inttypes.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <algorithm>
 #include <atomic>
 #include <limits>
 #include <tuple>
@@ -123,6 +124,13 @@ struct DefaultRingTraits {
 //         ProcessRecord(sequence, record);
 //         sequence++;
 //       }
+//     } else if (you_want_to_catch_up_in_batches) {
+//       Record records[kBatchSize];
+//       uint32_t count;
+//       while ((count = ring.GetRange(&sequence, kBatchSize, records))) {
+//         ProcessRecords(sequence, records, count);
+//         sequence += count;
+//       }
 //     } else if (you_want_to_skip_to_the_newest_record) {
 //       if (ring.GetNewest(&sequence, &record)) {
 //         ProcessRecord(sequence, record);
@@ -348,6 +356,57 @@ class BroadcastRing {
     return Get(sequence, record);
   }
 
+  // Copies up to |count| consecutive records to |records|, starting with the
+  // oldest available record with sequence at least |*sequence|.
+  //
+  // Returns the number of records copied, which is zero if there is no recent
+  // enough record available.
+  //
+  // Updates |*sequence| with the sequence number of the first record returned.
+  // To get the records that follow, add the returned count to this number.
+  //
+  // The result is the same as calling Get() for each record in turn, but the
+  // sequence numbers are checked once for the whole range rather than once per
+  // record, and records that are contiguous in the ring are copied as one
+  // block. Synchronization is the same as in Get().
+  uint32_t GetRange(uint32_t* sequence /*inout*/, uint32_t count,
+                    Record* records /*out*/) const {
+    for (;;) {
+      uint32_t tail = std::atomic_load_explicit(&header_mmap()->tail,
+                                                std::memory_order_acquire);
+      uint32_t head = std::atomic_load_explicit(&header_mmap()->head,
+                                                std::memory_order_relaxed);
+
+      if (tail - head > record_count())
+        continue;  // Concurrent modification; re-try.
+
+      if (*sequence - head > tail - head)
+        *sequence = head;  // Out of window, skip forward to first available.
+
+      const uint32_t range_count = std::min(count, tail - *sequence);
+      if (range_count == 0) return 0;  // No new records available.
+
+      // The range wraps around the end of the ring at most once.
+      const uint32_t first_index = SequenceToIndex(*sequence, record_count());
+      const uint32_t first_count =
+          std::min(range_count, record_count() - first_index);
+      GetRecordsInternal(first_index, first_count, records);
+      GetRecordsInternal(0, range_count - first_count, records + first_count);
+
+      // NB: It is not sufficient to change this to a load-acquire of |head|.
+      std::atomic_thread_fence(std::memory_order_acquire);
+
+      uint32_t final_head = std::atomic_load_explicit(
+          &header_mmap()->head, std::memory_order_relaxed);
+
+      // Every record in the range is valid if the first one is.
+      if (final_head - head > *sequence - head)
+        continue;  // Concurrent modification; re-try.
+
+      return range_count;
+    }
+  }
+
   uint32_t record_count() const { return record_count_internal(); }
   uint32_t record_size() const { return record_size_internal(); }
   static constexpr uint32_t mmap_alignment() { return alignof(Mmap); }
@@ -506,6 +565,32 @@ class BroadcastRing {
     memcpy(out, &data, sizeof(*out));
   }
 
+  // Copies |count| records stored contiguously from ring index |index| out of
+  // the ring.
+  //
+  // When records are stored at their native size the span is copied as a
+  // single array of words, still with relaxed atomics, which the compiler can
+  // unroll across record boundaries.
+  void GetRecordsInternal(uint32_t index, uint32_t count, Record* out) const {
+    if (record_size() != sizeof(Record)) {
+      for (uint32_t i = 0; i < count; ++i)
+        GetRecordInternal(record_mmap_reader(index + i), out + i);
+      return;
+    }
+
+    const std::atomic<StorageType>* in =
+        reinterpret_cast<const std::atomic<StorageType>*>(
+            record_mmap_reader(index));
+    char* out_bytes = reinterpret_cast<char*>(out);
+    const size_t word_count =
+        static_cast<size_t>(count) * (sizeof(Record) / sizeof(StorageType));
+    for (size_t i = 0; i < word_count; ++i) {
+      const StorageType word =
+          std::atomic_load_explicit(&in[i], std::memory_order_relaxed);
+      memcpy(out_bytes + i * sizeof(word), &word, sizeof(word));
+    }
+  }
+
   // Converts a record's sequence number into a storage index.
   static uint32_t SequenceToIndex(uint32_t sequence, uint32_t record_count) {
     return sequence & (record_count - 1);
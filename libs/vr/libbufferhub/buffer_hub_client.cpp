@@ -2,9 +2,11 @@
 
 #include <log/log.h>
 #include <poll.h>
+#include <string.h>
 #define ATRACE_TAG ATRACE_TAG_GRAPHICS
 #include <utils/Trace.h>
 
+#include <chrono>
 #include <mutex>
 
 #include <pdx/default_transport/client_channel.h>
@@ -14,12 +16,18 @@
 
 using android::pdx::LocalHandle;
 using android::pdx::LocalChannelHandle;
-using android::pdx::rpc::WrapBuffer;
 using android::pdx::Status;
 
 namespace android {
 namespace dvr {
 
+namespace {
+
+constexpr uint32_t kMetadataUsage =
+    GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_SW_WRITE_OFTEN;
+
+}  // anonymous namespace
+
 BufferHubBuffer::BufferHubBuffer(LocalChannelHandle channel_handle)
     : Client{pdx::default_transport::ClientChannel::Create(
           std::move(channel_handle))},
@@ -29,7 +37,10 @@ BufferHubBuffer::BufferHubBuffer(const std::string& endpoint_path)
           endpoint_path)},
       id_(-1) {}
 
-BufferHubBuffer::~BufferHubBuffer() {}
+BufferHubBuffer::~BufferHubBuffer() {
+  if (metadata_header_)
+    metadata_buffer_.Unlock();
+}
 
 Status<LocalChannelHandle> BufferHubBuffer::CreateConsumer() {
   Status<LocalChannelHandle> status =
@@ -43,42 +54,129 @@ Status<LocalChannelHandle> BufferHubBuffer::CreateConsumer() {
 int BufferHubBuffer::ImportBuffer() {
   ATRACE_NAME("BufferHubBuffer::ImportBuffer");
 
-  Status<NativeBufferHandle<LocalHandle>> status =
+  Status<BufferDescription<LocalHandle>> status =
       InvokeRemoteMethod<BufferHubRPC::GetBuffer>();
   if (!status) {
     ALOGE("BufferHubBuffer::ImportBuffer: Failed to get buffer: %s",
           status.GetErrorMessage().c_str());
     return -status.error();
-  } else if (status.get().id() < 0) {
+  }
+
+  return ImportBuffer(status.take());
+}
+
+int BufferHubBuffer::ImportBuffer(LocalBufferDescription buffer_desc) {
+  if (buffer_desc.id() < 0) {
     ALOGE("BufferHubBuffer::ImportBuffer: Received an invalid id!");
     return -EIO;
   }
 
-  auto buffer_handle = status.take();
-
   // Stash the buffer id to replace the value in id_.
-  const int new_id = buffer_handle.id();
+  const int new_id = buffer_desc.id();
 
   // Import the buffer.
   IonBuffer ion_buffer;
-  ALOGD_IF(
-      TRACE, "BufferHubBuffer::ImportBuffer: id=%d FdCount=%zu IntCount=%zu",
-      buffer_handle.id(), buffer_handle.FdCount(), buffer_handle.IntCount());
+  ALOGD_IF(TRACE,
+           "BufferHubBuffer::ImportBuffer: id=%d buffer_state_bit=%" PRIx64,
+           buffer_desc.id(), buffer_desc.buffer_state_bit());
 
-  const int ret = buffer_handle.Import(&ion_buffer);
+  int ret = buffer_desc.ImportBuffer(&ion_buffer);
   if (ret < 0)
     return ret;
 
+  // Import and map the metadata buffer holding the shared buffer state.
+  IonBuffer metadata_buffer;
+  ret = buffer_desc.ImportMetadata(&metadata_buffer);
+  if (ret < 0)
+    return ret;
+
+  const size_t metadata_size = metadata_buffer.width();
+  if (metadata_size < BufferHubDefs::kMetadataHeaderSize) {
+    ALOGE("BufferHubBuffer::ImportBuffer: Metadata buffer too small: %zu",
+          metadata_size);
+    return -EINVAL;
+  }
+
+  void* metadata_ptr = nullptr;
+  ret = metadata_buffer.Lock(kMetadataUsage, 0, 0, metadata_size, 1,
+                             &metadata_ptr);
+  if (ret < 0) {
+    ALOGE("BufferHubBuffer::ImportBuffer: Failed to map metadata: %s",
+          strerror(-ret));
+    return ret;
+  }
+
   // If the import succeeds, replace the previous buffer and id.
+  if (metadata_header_)
+    metadata_buffer_.Unlock();
   buffer_ = std::move(ion_buffer);
+  metadata_buffer_ = std::move(metadata_buffer);
+  metadata_header_ = static_cast<BufferHubDefs::MetadataHeader*>(metadata_ptr);
+  user_metadata_ptr_ =
+      static_cast<uint8_t*>(metadata_ptr) + BufferHubDefs::kMetadataHeaderSize;
+  user_metadata_size_ = metadata_size - BufferHubDefs::kMetadataHeaderSize;
+  buffer_state_bit_ = buffer_desc.buffer_state_bit();
   id_ = new_id;
   return 0;
 }
 
+bool BufferHubBuffer::IsBufferAvailable() const {
+  if (!metadata_header_)
+    return false;
+
+  const uint64_t state =
+      metadata_header_->buffer_state.load(std::memory_order_acquire);
+  if (buffer_state_bit_ == BufferHubDefs::kProducerStateBit) {
+    return BufferHubDefs::IsBufferReleased(state);
+  } else {
+    const uint64_t acquired =
+        metadata_header_->acquired_state.load(std::memory_order_acquire);
+    return BufferHubDefs::IsBufferPosted(state, acquired, buffer_state_bit_);
+  }
+}
+
+int BufferHubBuffer::NotifyBufferStateChanged() {
+  return ReturnStatusOrError(
+      SendImpulse(BufferHubRPC::BufferStateChanged::Opcode));
+}
+
 int BufferHubBuffer::Poll(int timeout_ms) {
   ATRACE_NAME("BufferHubBuffer::Poll");
+  // Clients change the buffer state directly and bufferhubd updates the event
+  // fd shortly after, so the event may lag behind the state in either
+  // direction. Go by the state and only use the event fd to wait.
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
   pollfd p = {event_fd(), POLLIN, 0};
-  return poll(&p, 1, timeout_ms);
+  while (true) {
+    if (IsBufferAvailable())
+      return 1;
+
+    int wait_ms = timeout_ms;
+    if (timeout_ms > 0) {
+      const auto remaining = deadline - std::chrono::steady_clock::now();
+      wait_ms = std::max<int>(
+          0, std::chrono::duration_cast<std::chrono::milliseconds>(remaining)
+                 .count());
+    }
+
+    const int ret = poll(&p, 1, wait_ms);
+    if (ret <= 0)
+      return ret;
+
+    // Report hangups and errors, and any event when the state isn't mapped.
+    auto status = GetEventMask(p.revents);
+    if (!status || (status.get() & ~POLLIN) || !metadata_header_)
+      return ret;
+
+    // The event is stale; keep waiting unless the time is up. The event is
+    // brought in line with the state right after the impulse that follows the
+    // state change, so this does not spin for long.
+    if (IsBufferAvailable())
+      return ret;
+    if (wait_ms == 0)
+      return 0;
+  }
 }
 
 int BufferHubBuffer::Lock(int usage, int x, int y, int width, int height,
@@ -118,6 +216,17 @@ BufferConsumer::BufferConsumer(LocalChannelHandle channel)
   }
 }
 
+BufferConsumer::BufferConsumer(LocalChannelHandle channel,
+                               LocalBufferDescription buffer_desc)
+    : BASE(std::move(channel)) {
+  const int ret = ImportBuffer(std::move(buffer_desc));
+  if (ret < 0) {
+    ALOGE("BufferConsumer::BufferConsumer: Failed to import buffer: %s",
+          strerror(-ret));
+    Close(ret);
+  }
+}
+
 std::unique_ptr<BufferConsumer> BufferConsumer::Import(
     LocalChannelHandle channel) {
   ATRACE_NAME("BufferConsumer::Import");
@@ -131,6 +240,14 @@ std::unique_ptr<BufferConsumer> BufferConsumer::Import(
                        : LocalChannelHandle{nullptr, -status.error()});
 }
 
+std::unique_ptr<BufferConsumer> BufferConsumer::Import(
+    LocalChannelHandle channel, LocalBufferDescription buffer_desc) {
+  ATRACE_NAME("BufferConsumer::Import");
+  ALOGD_IF(TRACE, "BufferConsumer::Import: channel=%d buffer_id=%d",
+           channel.value(), buffer_desc.id());
+  return BufferConsumer::Create(std::move(channel), std::move(buffer_desc));
+}
+
 int BufferConsumer::Acquire(LocalHandle* ready_fence) {
   return Acquire(ready_fence, nullptr, 0);
 }
@@ -138,26 +255,79 @@ int BufferConsumer::Acquire(LocalHandle* ready_fence) {
 int BufferConsumer::Acquire(LocalHandle* ready_fence, void* meta,
                             size_t meta_size_bytes) {
   ATRACE_NAME("BufferConsumer::Acquire");
+  if (meta_size_bytes != 0 && meta_size_bytes != user_metadata_size_) {
+    ALOGD_IF(TRACE,
+             "BufferConsumer::Acquire: Expected meta_size_bytes=%zu got "
+             "size=%zu",
+             user_metadata_size_, meta_size_bytes);
+    return -EINVAL;
+  }
+  if (!metadata_header_)
+    return -EPIPE;
+
+  // Acquire locally unless there is a fence to pick up from bufferhubd. Go
+  // through the service on failure too, it knows why the buffer is busy.
+  int ret = 0;
   LocalFence fence;
-  auto return_value =
-      std::make_pair(std::ref(fence), WrapBuffer(meta, meta_size_bytes));
-  auto status = InvokeRemoteMethodInPlace<BufferHubRPC::ConsumerAcquire>(
-      &return_value, meta_size_bytes);
-  if (status && ready_fence)
+  const bool has_fence =
+      metadata_header_->fence_state.load(std::memory_order_acquire) &
+      BufferHubDefs::kPostFenceBit;
+  if (!has_fence &&
+      BufferHubDefs::ConsumerAcquire(metadata_header_, buffer_state_bit_) ==
+          0) {
+    ret = NotifyBufferStateChanged();
+  } else {
+    auto status = InvokeRemoteMethod<BufferHubRPC::ConsumerAcquire>();
+    if (!status)
+      return -status.error();
+    fence = status.take();
+  }
+
+  if (meta)
+    memcpy(meta, user_metadata_ptr_, meta_size_bytes);
+  if (ready_fence)
     *ready_fence = fence.take();
-  return status ? 0 : -status.error();
+  return ret;
+}
+
+int BufferConsumer::LocalRelease() {
+  const bool acquired =
+      metadata_header_->acquired_state.load(std::memory_order_acquire) &
+      buffer_state_bit_;
+  bool released;
+  const int ret = BufferHubDefs::ConsumerRelease(
+      metadata_header_, buffer_state_bit_, &released);
+  if (ret < 0)
+    return ret;
+
+  // bufferhubd only needs to hear about it when the producer is waiting for
+  // this release, or when the buffer is discarded without being acquired and
+  // the event of this consumer is still set.
+  if (released || !acquired)
+    return NotifyBufferStateChanged();
+  return 0;
 }
 
 int BufferConsumer::Release(const LocalHandle& release_fence) {
   ATRACE_NAME("BufferConsumer::Release");
+  // Release fences are merged by bufferhubd. Go through the service on failure
+  // too, it knows why the buffer cannot be released.
+  if (!release_fence && metadata_header_ && LocalRelease() == 0)
+    return 0;
   return ReturnStatusOrError(InvokeRemoteMethod<BufferHubRPC::ConsumerRelease>(
       BorrowedFence(release_fence.Borrow())));
 }
 
 int BufferConsumer::ReleaseAsync() {
   ATRACE_NAME("BufferConsumer::ReleaseAsync");
-  return ReturnStatusOrError(
-      SendImpulse(BufferHubRPC::ConsumerRelease::Opcode));
+  if (!metadata_header_) {
+    return ReturnStatusOrError(
+        SendImpulse(BufferHubRPC::ConsumerRelease::Opcode));
+  }
+
+  // A buffer in the wrong state is not reported as an error.
+  const int ret = LocalRelease();
+  return ret == -EBUSY ? 0 : ret;
 }
 
 int BufferConsumer::Discard() { return Release(LocalHandle()); }
@@ -360,15 +530,65 @@ BufferProducer::BufferProducer(LocalChannelHandle channel)
   }
 }
 
+BufferProducer::BufferProducer(LocalChannelHandle channel,
+                               LocalBufferDescription buffer_desc)
+    : BASE(std::move(channel)) {
+  const int ret = ImportBuffer(std::move(buffer_desc));
+  if (ret < 0) {
+    ALOGE(
+        "BufferProducer::BufferProducer: Failed to import producer buffer: %s",
+        strerror(-ret));
+    Close(ret);
+  }
+}
+
 int BufferProducer::Post(const LocalHandle& ready_fence, const void* meta,
                          size_t meta_size_bytes) {
   ATRACE_NAME("BufferProducer::Post");
+  if (meta_size_bytes != user_metadata_size_) {
+    ALOGD_IF(TRACE,
+             "BufferProducer::Post: Expected meta_size_bytes=%zu got size=%zu",
+             user_metadata_size_, meta_size_bytes);
+    return -EINVAL;
+  }
+  if (!metadata_header_)
+    return -EPIPE;
+
+  // The metadata must not change under consumers that are still reading it, so
+  // only touch it while the buffer is gained; otherwise let bufferhubd report
+  // the error.
+  const uint64_t state =
+      metadata_header_->buffer_state.load(std::memory_order_acquire);
+  if (BufferHubDefs::IsBufferGained(state)) {
+    if (meta_size_bytes)
+      memcpy(user_metadata_ptr_, meta, meta_size_bytes);
+
+    // Consumers pick the ready fence up from bufferhubd.
+    if (!ready_fence) {
+      metadata_header_->fence_state.fetch_and(~BufferHubDefs::kPostFenceBit,
+                                              std::memory_order_release);
+      if (BufferHubDefs::ProducerPost(metadata_header_) == 0)
+        return NotifyBufferStateChanged();
+    }
+  }
+
   return ReturnStatusOrError(InvokeRemoteMethod<BufferHubRPC::ProducerPost>(
-      BorrowedFence(ready_fence.Borrow()), WrapBuffer(meta, meta_size_bytes)));
+      BorrowedFence(ready_fence.Borrow())));
 }
 
 int BufferProducer::Gain(LocalHandle* release_fence) {
   ATRACE_NAME("BufferProducer::Gain");
+  // Gain locally unless a consumer left a release fence with bufferhubd. Go
+  // through the service on failure too, it knows why the buffer is busy.
+  if (metadata_header_ &&
+      !(metadata_header_->fence_state.load(std::memory_order_acquire) &
+        BufferHubDefs::kReleaseFenceBit) &&
+      BufferHubDefs::ProducerGain(metadata_header_) == 0) {
+    if (release_fence)
+      *release_fence = LocalHandle();
+    return NotifyBufferStateChanged();
+  }
+
   auto status = InvokeRemoteMethod<BufferHubRPC::ProducerGain>();
   if (!status)
     return -status.error();
@@ -379,6 +599,15 @@ int BufferProducer::Gain(LocalHandle* release_fence) {
 
 int BufferProducer::GainAsync() {
   ATRACE_NAME("BufferProducer::GainAsync");
+  // bufferhubd drops the release fence, if there is one.
+  if (metadata_header_ &&
+      !(metadata_header_->fence_state.load(std::memory_order_acquire) &
+        BufferHubDefs::kReleaseFenceBit)) {
+    const int ret = BufferHubDefs::ProducerGain(metadata_header_);
+    if (ret < 0)
+      return 0;  // A buffer in the wrong state is not reported as an error.
+    return NotifyBufferStateChanged();
+  }
   return ReturnStatusOrError(SendImpulse(BufferHubRPC::ProducerGain::Opcode));
 }
 
@@ -394,6 +623,13 @@ std::unique_ptr<BufferProducer> BufferProducer::Import(
                        : LocalChannelHandle{nullptr, -status.error()});
 }
 
+std::unique_ptr<BufferProducer> BufferProducer::Import(
+    LocalChannelHandle channel, LocalBufferDescription buffer_desc) {
+  ALOGD_IF(TRACE, "BufferProducer::Import: channel=%d buffer_id=%d",
+           channel.value(), buffer_desc.id());
+  return BufferProducer::Create(std::move(channel), std::move(buffer_desc));
+}
+
 int BufferProducer::MakePersistent(const std::string& name, int user_id,
                                    int group_id) {
   ATRACE_NAME("BufferProducer::MakePersistent");
@@ -1,8 +1,10 @@
 #include <gtest/gtest.h>
 #include <private/dvr/buffer_hub_client.h>
 
+#include <chrono>
 #include <mutex>
 #include <thread>
+#include <vector>
 
 #define RETRY_EINTR(fnc_call)                 \
   ([&]() -> decltype(fnc_call) {              \
@@ -224,3 +226,81 @@ TEST_F(LibBufferHubTest, TestRemovePersistentBuffer) {
 
   EXPECT_EQ(-EPIPE, c->Release(LocalHandle()));
 }
+
+TEST_F(LibBufferHubTest, TestStateTransitions) {
+  std::unique_ptr<BufferProducer> p =
+      BufferProducer::Create(kWidth, kHeight, kFormat, kUsage);
+  ASSERT_TRUE(p.get() != nullptr);
+  std::unique_ptr<BufferConsumer> c =
+      BufferConsumer::Import(p->CreateConsumer());
+  ASSERT_TRUE(c.get() != nullptr);
+
+  LocalHandle fence;
+  EXPECT_EQ(-EALREADY, p->Gain(&fence));
+  EXPECT_EQ(-EBUSY, c->Acquire(&fence));
+
+  EXPECT_EQ(0, p->Post<void>(LocalHandle()));
+  EXPECT_EQ(-EBUSY, p->Post<void>(LocalHandle()));
+  EXPECT_EQ(-EBUSY, p->Gain(&fence));
+
+  EXPECT_EQ(0, c->Acquire(&fence));
+  EXPECT_FALSE(fence.IsValid());
+  EXPECT_EQ(-EBUSY, c->Acquire(&fence));
+  EXPECT_GE(0, RETRY_EINTR(c->Poll(0)));
+
+  // A consumer created while the buffer is posted receives it as well.
+  std::unique_ptr<BufferConsumer> c2 =
+      BufferConsumer::Import(p->CreateConsumer());
+  ASSERT_TRUE(c2.get() != nullptr);
+  EXPECT_LT(0, RETRY_EINTR(c2->Poll(10)));
+
+  EXPECT_EQ(0, c->Release(LocalHandle()));
+  EXPECT_EQ(-EBUSY, c->Release(LocalHandle()));
+  EXPECT_EQ(-EBUSY, p->Gain(&fence));
+  EXPECT_GE(0, RETRY_EINTR(p->Poll(0)));
+
+  EXPECT_EQ(0, c2->Discard());
+  EXPECT_LT(0, RETRY_EINTR(p->Poll(10)));
+  EXPECT_EQ(0, p->Gain(&fence));
+  EXPECT_FALSE(fence.IsValid());
+}
+
+TEST_F(LibBufferHubTest, TestConsumerCloseReleasesBuffer) {
+  std::unique_ptr<BufferProducer> p =
+      BufferProducer::Create(kWidth, kHeight, kFormat, kUsage);
+  ASSERT_TRUE(p.get() != nullptr);
+  std::unique_ptr<BufferConsumer> c =
+      BufferConsumer::Import(p->CreateConsumer());
+  ASSERT_TRUE(c.get() != nullptr);
+
+  LocalHandle fence;
+  EXPECT_EQ(0, p->Post<void>(LocalHandle()));
+  EXPECT_EQ(0, c->Acquire(&fence));
+
+  // bufferhubd releases the buffer on behalf of a consumer that goes away.
+  c = nullptr;
+  EXPECT_LT(0, RETRY_EINTR(p->Poll(100)));
+  EXPECT_EQ(0, p->Gain(&fence));
+}
+
+TEST_F(LibBufferHubTest, TestMaxConsumers) {
+  std::unique_ptr<BufferProducer> p =
+      BufferProducer::Create(kWidth, kHeight, kFormat, kUsage);
+  ASSERT_TRUE(p.get() != nullptr);
+
+  std::vector<std::unique_ptr<BufferConsumer>> consumers;
+  for (size_t i = 0; i < android::dvr::BufferHubDefs::kMaxConsumerCount; i++) {
+    consumers.push_back(BufferConsumer::Import(p->CreateConsumer()));
+    ASSERT_TRUE(consumers.back().get() != nullptr);
+  }
+  EXPECT_FALSE(p->CreateConsumer());
+
+  // Closing a consumer frees up its slot once bufferhubd sees the hangup.
+  consumers.pop_back();
+  auto status = p->CreateConsumer();
+  for (int i = 0; i < 10 && !status; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    status = p->CreateConsumer();
+  }
+  EXPECT_TRUE(status);
+}
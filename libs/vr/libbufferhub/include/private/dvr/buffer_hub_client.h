@@ -9,6 +9,8 @@
 
 #include <vector>
 
+#include <private/dvr/buffer_hub_defs.h>
+#include <private/dvr/bufferhub_rpc.h>
 #include <private/dvr/ion_buffer.h>
 
 namespace android {
@@ -25,9 +27,16 @@ class BufferHubBuffer : public pdx::Client {
   // a file descriptor for the new channel or a negative error code.
   Status<LocalChannelHandle> CreateConsumer();
 
-  // Polls the fd for |timeout_ms| milliseconds (-1 for infinity).
+  // Waits up to |timeout_ms| milliseconds (-1 for infinity) for the buffer to
+  // become available to this client, that is released for producers and posted
+  // for consumers, or for the channel to hang up. Returns a positive value when
+  // either happened, zero on timeout or a negative error code.
   int Poll(int timeout_ms);
 
+  // Returns true if the shared buffer state says the buffer is available to
+  // this client, without waiting or making any calls to bufferhubd.
+  bool IsBufferAvailable() const;
+
   // Locks the area specified by (x, y, width, height) for a specific usage. If
   // the usage is software then |addr| will be updated to point to the address
   // of the buffer in virtual memory. The caller should only access/modify the
@@ -103,8 +112,23 @@ class BufferHubBuffer : public pdx::Client {
   explicit BufferHubBuffer(const std::string& endpoint_path);
   virtual ~BufferHubBuffer();
 
-  // Initialization helper.
+  // Initialization helpers. The first form fetches the buffer description
+  // from bufferhubd, the second uses one the caller already received, such as
+  // from a buffer queue.
   int ImportBuffer();
+  int ImportBuffer(LocalBufferDescription buffer_desc);
+
+  // Tells bufferhubd that this client changed the shared buffer state, so that
+  // it can signal the other side. Returns zero or a negative error code.
+  int NotifyBufferStateChanged();
+
+  // Shared buffer state and user metadata, mapped from |metadata_buffer_|.
+  BufferHubDefs::MetadataHeader* metadata_header_{nullptr};
+  void* user_metadata_ptr_{nullptr};
+  size_t user_metadata_size_{0};
+
+  // kProducerStateBit for producers, the bit of the consumer for consumers.
+  uint64_t buffer_state_bit_{0};
 
  private:
   BufferHubBuffer(const BufferHubBuffer&) = delete;
@@ -116,6 +140,7 @@ class BufferHubBuffer : public pdx::Client {
   int id_;
 
   IonBuffer buffer_;
+  IonBuffer metadata_buffer_;
 };
 
 // This represents a writable buffer. Calling Post notifies all clients and
@@ -136,6 +161,11 @@ class BufferProducer : public pdx::ClientBase<BufferProducer, BufferHubBuffer> {
   static std::unique_ptr<BufferProducer> Import(
       Status<LocalChannelHandle> status);
 
+  // Imports a bufferhub producer channel along with the description of its
+  // buffer, which saves fetching the description from bufferhubd.
+  static std::unique_ptr<BufferProducer> Import(
+      LocalChannelHandle channel, LocalBufferDescription buffer_desc);
+
   // Post this buffer, passing |ready_fence| to the consumers. The bytes in
   // |meta| are passed unaltered to the consumers. The producer must not modify
   // the buffer until it is re-gained.
@@ -234,6 +264,8 @@ class BufferProducer : public pdx::ClientBase<BufferProducer, BufferHubBuffer> {
 
   // Imports the given file handle to a producer channel, taking ownership.
   explicit BufferProducer(LocalChannelHandle channel);
+  BufferProducer(LocalChannelHandle channel,
+                 LocalBufferDescription buffer_desc);
 };
 
 // This is a connection to a producer buffer, which can be located in another
@@ -249,6 +281,11 @@ class BufferConsumer : public pdx::ClientBase<BufferConsumer, BufferHubBuffer> {
   static std::unique_ptr<BufferConsumer> Import(
       Status<LocalChannelHandle> status);
 
+  // Imports a consumer channel along with the description of its buffer, which
+  // saves fetching the description from bufferhubd.
+  static std::unique_ptr<BufferConsumer> Import(
+      LocalChannelHandle channel, LocalBufferDescription buffer_desc);
+
   // Attempt to retrieve a post event from buffer hub. If successful,
   // |ready_fence| will be set to a fence to wait on until the buffer is ready.
   // This call will only succeed after the fd is signalled. This call may be
@@ -305,6 +342,12 @@ class BufferConsumer : public pdx::ClientBase<BufferConsumer, BufferHubBuffer> {
   friend BASE;
 
   explicit BufferConsumer(LocalChannelHandle channel);
+  BufferConsumer(LocalChannelHandle channel,
+                 LocalBufferDescription buffer_desc);
+
+  // Releases the buffer in the shared buffer state and lets bufferhubd know if
+  // that needs an event to change. Returns zero or a negative error code.
+  int LocalRelease();
 };
 
 }  // namespace dvr
@@ -0,0 +1,203 @@
+#ifndef ANDROID_DVR_BUFFER_HUB_DEFS_H_
+#define ANDROID_DVR_BUFFER_HUB_DEFS_H_
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+namespace android {
+namespace dvr {
+
+// Definitions of the buffer state shared between a producer, its consumers and
+// bufferhubd. The state lives at the start of a small metadata buffer that
+// bufferhubd allocates along with each producer buffer and maps into every
+// client. Clients move the buffer between the gained, posted, acquired and
+// released states with atomic operations on this header, so a transition that
+// does not carry a fence needs no round trip to the service. bufferhubd is
+// told about such transitions with a one-way impulse, after which it brings
+// the event fds of the affected channels up to date.
+namespace BufferHubDefs {
+
+// Set in the buffer state while the producer owns the buffer.
+static constexpr uint64_t kProducerStateBit = 1ULL << 63;
+
+// Each consumer of a buffer is assigned one of the remaining bits.
+static constexpr uint64_t kConsumerStateMask = kProducerStateBit - 1;
+static constexpr size_t kMaxConsumerCount = 63;
+
+// Set in the fence state while bufferhubd holds a fence for the current cycle.
+// Transitions that need a fence go through the service, since file
+// descriptors cannot be passed through shared memory.
+static constexpr uint32_t kPostFenceBit = 1U << 0;
+static constexpr uint32_t kReleaseFenceBit = 1U << 1;
+
+struct MetadataHeader {
+  // kProducerStateBit while the buffer is gained. Otherwise the bits of the
+  // consumers the current post was delivered to and that have not released it
+  // yet; zero means the buffer is released and may be gained.
+  std::atomic<uint64_t> buffer_state;
+
+  // Bits of the consumers that acquired the current post.
+  std::atomic<uint64_t> acquired_state;
+
+  // Bits of the consumers that are not ignoring the buffer; a post is only
+  // delivered to these. Only written by bufferhubd.
+  std::atomic<uint64_t> active_consumers;
+
+  // Number of posts and number of times the buffer became released. bufferhubd
+  // uses these to signal each event fd once per transition even when it learns
+  // about several transitions at once.
+  std::atomic<uint32_t> post_count;
+  std::atomic<uint32_t> release_count;
+
+  // Combination of kPostFenceBit and kReleaseFenceBit.
+  std::atomic<uint32_t> fence_state;
+
+  uint32_t reserved;
+};
+
+static_assert(sizeof(MetadataHeader) == 40,
+              "MetadataHeader is shared across processes and must not change "
+              "size.");
+
+// User metadata, if any, follows the header.
+static constexpr size_t kMetadataHeaderSize = sizeof(MetadataHeader);
+
+inline bool IsBufferGained(uint64_t state) {
+  return state == kProducerStateBit;
+}
+
+inline bool IsBufferReleased(uint64_t state) { return state == 0; }
+
+// Returns true if the current post was delivered to the consumer owning
+// |consumer_bit| and that consumer has not acquired or released it yet.
+inline bool IsBufferPosted(uint64_t state, uint64_t acquired,
+                           uint64_t consumer_bit) {
+  return (state & consumer_bit) && !(acquired & consumer_bit);
+}
+
+// Moves a gained buffer to the posted state, delivering it to every active
+// consumer. Any user metadata must be written before calling this. Returns
+// zero or a negative errno code.
+inline int ProducerPost(MetadataHeader* header) {
+  const uint64_t consumers =
+      header->active_consumers.load(std::memory_order_acquire);
+  header->acquired_state.store(0, std::memory_order_relaxed);
+
+  uint64_t state = kProducerStateBit;
+  if (!header->buffer_state.compare_exchange_strong(
+          state, consumers, std::memory_order_acq_rel,
+          std::memory_order_acquire)) {
+    return -EBUSY;
+  }
+
+  header->post_count.fetch_add(1, std::memory_order_release);
+  if (IsBufferReleased(consumers))
+    header->release_count.fetch_add(1, std::memory_order_release);
+  return 0;
+}
+
+// Moves a released buffer back to the producer. Returns zero, -EALREADY if the
+// producer already owns the buffer or -EBUSY if consumers still hold it.
+inline int ProducerGain(MetadataHeader* header) {
+  uint64_t state = 0;
+  if (!header->buffer_state.compare_exchange_strong(
+          state, kProducerStateBit, std::memory_order_acq_rel,
+          std::memory_order_acquire)) {
+    return IsBufferGained(state) ? -EALREADY : -EBUSY;
+  }
+  return 0;
+}
+
+// Marks the current post as acquired by the consumer owning |consumer_bit|.
+// Returns zero or -EBUSY if the buffer is not posted to that consumer.
+inline int ConsumerAcquire(MetadataHeader* header, uint64_t consumer_bit) {
+  const uint64_t state = header->buffer_state.load(std::memory_order_acquire);
+  if (!(state & consumer_bit))
+    return -EBUSY;
+  if (header->acquired_state.fetch_or(consumer_bit,
+                                      std::memory_order_acq_rel) &
+      consumer_bit) {
+    return -EBUSY;
+  }
+  return 0;
+}
+
+// Returns the current post to the producer on behalf of the consumer owning
+// |consumer_bit|, whether or not it was acquired. Returns zero or -EBUSY if the
+// buffer is not posted to that consumer. |released| is set when this was the
+// last consumer holding the buffer.
+inline int ConsumerRelease(MetadataHeader* header, uint64_t consumer_bit,
+                           bool* released) {
+  const uint64_t state =
+      header->buffer_state.fetch_and(~consumer_bit, std::memory_order_acq_rel);
+  if (!(state & consumer_bit))
+    return -EBUSY;
+
+  *released = state == consumer_bit;
+  if (*released)
+    header->release_count.fetch_add(1, std::memory_order_release);
+  return 0;
+}
+
+// Delivers the current post to a consumer that was not part of it, unless the
+// producer owns the buffer. Used when consumers are created while a buffer is
+// posted or released. Returns true if the buffer was delivered.
+inline bool PostToConsumer(MetadataHeader* header, uint64_t consumer_bit) {
+  // Consumer bits are reused, so drop what a previous owner of the bit left.
+  header->acquired_state.fetch_and(~consumer_bit, std::memory_order_relaxed);
+
+  uint64_t state = header->buffer_state.load(std::memory_order_acquire);
+  do {
+    if (state & kProducerStateBit)
+      return false;
+  } while (!header->buffer_state.compare_exchange_weak(
+      state, state | consumer_bit, std::memory_order_acq_rel,
+      std::memory_order_acquire));
+  return true;
+}
+
+// State shared between bufferhubd and a buffer queue client, see
+// BufferHubRPC::GetQueueState. Instead of having the client poll the event fd
+// of every buffer in the queue, bufferhubd marks the slots whose buffers became
+// ready for the client, or were detached from the queue, and rings a single
+// doorbell eventfd. The client takes all marked slots at once, so one wakeup
+// can move any number of buffers and costs the same no matter how many buffers
+// the queue holds.
+struct QueueState {
+  // One bit per slot whose buffer became ready: released for producer queues,
+  // posted for consumer queues.
+  std::atomic<uint64_t> ready_slots;
+
+  // One bit per slot whose buffer was detached by the producer queue.
+  std::atomic<uint64_t> hangup_slots;
+};
+
+static_assert(sizeof(QueueState) == 16,
+              "QueueState is shared across processes and must not change "
+              "size.");
+
+// Queue slots are tracked with one bit each.
+static constexpr size_t kMaxQueueSlotCount = 64;
+
+// Marks |slot_mask| in |slots|. Returns true if no slot was marked before,
+// which means that the doorbell must be rung: the client drains the doorbell
+// before taking the marked slots, so it only needs to be woken up again once
+// the marks it took are replaced by new ones.
+inline bool MarkQueueSlots(std::atomic<uint64_t>* slots, uint64_t slot_mask) {
+  return slots->fetch_or(slot_mask, std::memory_order_acq_rel) == 0;
+}
+
+// Takes all slots marked in |slots|.
+inline uint64_t TakeQueueSlots(std::atomic<uint64_t>* slots) {
+  return slots->exchange(0, std::memory_order_acq_rel);
+}
+
+}  // namespace BufferHubDefs
+
+}  // namespace dvr
+}  // namespace android
+
+#endif  // ANDROID_DVR_BUFFER_HUB_DEFS_H_
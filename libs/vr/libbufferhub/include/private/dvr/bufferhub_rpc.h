@@ -9,6 +9,7 @@
 #include <pdx/file_handle.h>
 #include <pdx/rpc/remote_method.h>
 #include <pdx/rpc/serializable.h>
+#include <private/dvr/buffer_hub_defs.h>
 #include <private/dvr/ion_buffer.h>
 
 namespace android {
@@ -96,6 +97,46 @@ class NativeBufferHandle {
 using BorrowedNativeBufferHandle = NativeBufferHandle<pdx::BorrowedHandle>;
 using LocalNativeBufferHandle = NativeBufferHandle<pdx::LocalHandle>;
 
+// Everything a client needs to map a buffer: the buffer itself, the metadata
+// buffer holding the shared buffer state (see buffer_hub_defs.h) and the bit
+// that identifies the client in that state.
+template <typename FileHandleType>
+class BufferDescription {
+ public:
+  BufferDescription() = default;
+  BufferDescription(const IonBuffer& buffer, const IonBuffer& metadata, int id,
+                    uint64_t buffer_state_bit)
+      : id_(id),
+        buffer_state_bit_(buffer_state_bit),
+        buffer_(buffer, id),
+        metadata_(metadata, id) {}
+  BufferDescription(BufferDescription&& other) = default;
+  BufferDescription& operator=(BufferDescription&& other) = default;
+
+  // Imports the buffer and the metadata buffer into the given IonBuffer
+  // instances.
+  int ImportBuffer(IonBuffer* buffer) { return buffer_.Import(buffer); }
+  int ImportMetadata(IonBuffer* metadata) { return metadata_.Import(metadata); }
+
+  int id() const { return id_; }
+  uint64_t buffer_state_bit() const { return buffer_state_bit_; }
+
+ private:
+  int id_{-1};
+  uint64_t buffer_state_bit_{0};
+  NativeBufferHandle<FileHandleType> buffer_;
+  NativeBufferHandle<FileHandleType> metadata_;
+
+  PDX_SERIALIZABLE_MEMBERS(BufferDescription<FileHandleType>, id_,
+                           buffer_state_bit_, buffer_, metadata_);
+
+  BufferDescription(const BufferDescription&) = delete;
+  void operator=(const BufferDescription&) = delete;
+};
+
+using BorrowedBufferDescription = BufferDescription<pdx::BorrowedHandle>;
+using LocalBufferDescription = BufferDescription<pdx::LocalHandle>;
+
 template <typename FileHandleType>
 class FenceHandle {
  public:
@@ -137,6 +178,56 @@ struct QueueInfo {
   PDX_SERIALIZABLE_MEMBERS(QueueInfo, meta_size_bytes, id);
 };
 
+// Everything a queue client needs to learn about ready buffers without polling
+// each of them: the buffer holding the queue state (see buffer_hub_defs.h) and
+// the doorbell eventfd that bufferhubd signals when the state changes.
+template <typename FileHandleType>
+class QueueStateDescription {
+ public:
+  QueueStateDescription() = default;
+  QueueStateDescription(const IonBuffer& state_buffer, int id,
+                        FileHandleType doorbell)
+      : state_(state_buffer, id), doorbell_(std::move(doorbell)) {}
+  QueueStateDescription(QueueStateDescription&& other) = default;
+  QueueStateDescription& operator=(QueueStateDescription&& other) = default;
+
+  // Imports the queue state buffer into the given IonBuffer instance.
+  int ImportState(IonBuffer* state_buffer) {
+    return state_.Import(state_buffer);
+  }
+
+  FileHandleType take_doorbell() { return std::move(doorbell_); }
+
+ private:
+  NativeBufferHandle<FileHandleType> state_;
+  FileHandleType doorbell_;
+
+  PDX_SERIALIZABLE_MEMBERS(QueueStateDescription<FileHandleType>, state_,
+                           doorbell_);
+
+  QueueStateDescription(const QueueStateDescription&) = delete;
+  void operator=(const QueueStateDescription&) = delete;
+};
+
+// A buffer allocated for or imported into a queue: the channel of the new
+// producer or consumer, its slot in the queue and the description of the
+// buffer, so that clients do not need a separate GetBuffer call per buffer.
+template <typename ChannelHandleType, typename FileHandleType>
+struct QueueBufferSlot {
+  ChannelHandleType channel_handle;
+  size_t slot;
+  BufferDescription<FileHandleType> buffer_description;
+
+ private:
+  using Self = QueueBufferSlot<ChannelHandleType, FileHandleType>;
+  PDX_SERIALIZABLE_MEMBERS(Self, channel_handle, slot, buffer_description);
+};
+
+using RemoteQueueBufferSlot =
+    QueueBufferSlot<pdx::RemoteChannelHandle, pdx::BorrowedHandle>;
+using LocalQueueBufferSlot =
+    QueueBufferSlot<pdx::LocalChannelHandle, pdx::LocalHandle>;
+
 struct UsagePolicy {
   uint64_t usage_set_mask;
   uint64_t usage_clear_mask;
@@ -162,6 +253,8 @@ struct BufferHubRPC {
   // interface: |android::IGraphicBufferProducer|.
   static constexpr size_t kMaxQueueCapacity =
       android::BufferQueueDefs::NUM_BUFFER_SLOTS;
+  static_assert(kMaxQueueCapacity <= BufferHubDefs::kMaxQueueSlotCount,
+                "Queue slots must fit into the bit masks of QueueState.");
 
   // Op codes.
   enum {
@@ -183,10 +276,11 @@ struct BufferHubRPC {
     kOpProducerQueueAllocateBuffers,
     kOpProducerQueueDetachBuffer,
     kOpConsumerQueueImportBuffers,
+    kOpBufferStateChanged,
+    kOpGetQueueState,
   };
 
   // Aliases.
-  using MetaData = pdx::rpc::BufferWrapper<std::uint8_t*>;
   using LocalChannelHandle = pdx::LocalChannelHandle;
   using LocalHandle = pdx::LocalHandle;
   using Void = pdx::rpc::Void;
@@ -202,21 +296,26 @@ struct BufferHubRPC {
   PDX_REMOTE_METHOD(GetPersistentBuffer, kOpGetPersistentBuffer,
                     void(const std::string& name));
   PDX_REMOTE_METHOD(GetBuffer, kOpGetBuffer,
-                    NativeBufferHandle<LocalHandle>(Void));
+                    BufferDescription<LocalHandle>(Void));
   PDX_REMOTE_METHOD(NewConsumer, kOpNewConsumer, LocalChannelHandle(Void));
   PDX_REMOTE_METHOD(ProducerMakePersistent, kOpProducerMakePersistent,
                     void(const std::string& name, int user_id, int group_id));
   PDX_REMOTE_METHOD(ProducerRemovePersistence, kOpProducerRemovePersistence,
                     void(Void));
+  // The buffer state transitions below are performed by clients directly in
+  // the shared buffer state when no fence is involved, see buffer_hub_defs.h.
+  // The user metadata is always passed through the metadata buffer.
   PDX_REMOTE_METHOD(ProducerPost, kOpProducerPost,
-                    void(LocalFence acquire_fence, MetaData));
+                    void(LocalFence acquire_fence));
   PDX_REMOTE_METHOD(ProducerGain, kOpProducerGain, LocalFence(Void));
-  PDX_REMOTE_METHOD(ConsumerAcquire, kOpConsumerAcquire,
-                    std::pair<LocalFence, MetaData>(std::size_t metadata_size));
+  PDX_REMOTE_METHOD(ConsumerAcquire, kOpConsumerAcquire, LocalFence(Void));
   PDX_REMOTE_METHOD(ConsumerRelease, kOpConsumerRelease,
                     void(LocalFence release_fence));
   PDX_REMOTE_METHOD(ConsumerSetIgnore, kOpConsumerSetIgnore, void(bool ignore));
 
+  // Sent as an impulse by clients after changing the shared buffer state.
+  PDX_REMOTE_METHOD(BufferStateChanged, kOpBufferStateChanged, void(Void));
+
   // Buffer Queue Methods.
   PDX_REMOTE_METHOD(CreateProducerQueue, kOpCreateProducerQueue,
                     QueueInfo(size_t meta_size_bytes,
@@ -224,15 +323,17 @@ struct BufferHubRPC {
   PDX_REMOTE_METHOD(CreateConsumerQueue, kOpCreateConsumerQueue,
                     LocalChannelHandle(Void));
   PDX_REMOTE_METHOD(GetQueueInfo, kOpGetQueueInfo, QueueInfo(Void));
+  PDX_REMOTE_METHOD(GetQueueState, kOpGetQueueState,
+                    QueueStateDescription<LocalHandle>(Void));
   PDX_REMOTE_METHOD(ProducerQueueAllocateBuffers,
                     kOpProducerQueueAllocateBuffers,
-                    std::vector<std::pair<LocalChannelHandle, size_t>>(
+                    std::vector<LocalQueueBufferSlot>(
                         uint32_t width, uint32_t height, uint32_t layer_count,
                         uint32_t format, uint64_t usage, size_t buffer_count));
   PDX_REMOTE_METHOD(ProducerQueueDetachBuffer, kOpProducerQueueDetachBuffer,
                     void(size_t slot));
   PDX_REMOTE_METHOD(ConsumerQueueImportBuffers, kOpConsumerQueueImportBuffers,
-                    std::vector<std::pair<LocalChannelHandle, size_t>>(Void));
+                    std::vector<LocalQueueBufferSlot>(Void));
 };
 
 }  // namespace dvr
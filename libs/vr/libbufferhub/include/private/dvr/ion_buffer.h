@@ -66,6 +66,29 @@ class IonBuffer {
               struct android_ycbcr* yuv);
   int Unlock();
 
+  // Maps the whole buffer into the address space of the process until Unmap()
+  // is called or the buffer is freed. Unlike Lock(), the mapping persists, so
+  // buffers that the CPU accesses every frame don't pay for mapping them each
+  // time. |usage| is a combination of the GRALLOC_USAGE_SW_READ_* and
+  // GRALLOC_USAGE_SW_WRITE_* bits and determines whether the mapping is
+  // writable. Calling Map() again returns the existing mapping, unless it needs
+  // to become writable. Only buffers whose memory is a single linear dma-buf,
+  // like BLOB buffers, can be mapped this way. Returns 0 on success or a
+  // negative errno code otherwise.
+  int Map(uint64_t usage, void** address, size_t* size);
+  int Unmap();
+
+  // Bracket CPU access to a buffer mapped with Map(). BeginCpuAccess()
+  // invalidates the CPU caches for reading and EndCpuAccess() flushes what the
+  // CPU wrote, so that the device and other processes using the buffer see
+  // coherent contents. |usage| is a combination of the GRALLOC_USAGE_SW_READ_*
+  // and GRALLOC_USAGE_SW_WRITE_* bits describing the access. Returns 0 on
+  // success or a negative errno code otherwise.
+  int BeginCpuAccess(uint64_t usage);
+  int EndCpuAccess(uint64_t usage);
+
+  bool IsMapped() const { return mapped_address_ != nullptr; }
+
   const sp<GraphicBuffer>& buffer() const { return buffer_; }
   buffer_handle_t handle() const {
     return buffer_.get() ? buffer_->handle : nullptr;
@@ -84,8 +107,16 @@ class IonBuffer {
   }
 
  private:
+  // Issues a dma-buf sync operation with |flags| for the mapped buffer.
+  int SyncMapping(uint64_t flags);
+
   sp<GraphicBuffer> buffer_;
 
+  // Persistent mapping created by Map().
+  void* mapped_address_;
+  size_t mapped_size_;
+  int mapped_protection_;
+
   IonBuffer(const IonBuffer&) = delete;
   void operator=(const IonBuffer&) = delete;
 };
@@ -1,6 +1,11 @@
 #include <private/dvr/ion_buffer.h>
 
+#include <errno.h>
+#include <linux/dma-buf.h>
 #include <log/log.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #define ATRACE_TAG ATRACE_TAG_GRAPHICS
 #include <utils/Trace.h>
 
@@ -10,6 +15,16 @@ namespace {
 
 constexpr uint32_t kDefaultGraphicBufferLayerCount = 1;
 
+// Translates the software usage bits of a CPU access to dma-buf sync flags.
+uint64_t GetSyncFlags(uint64_t usage) {
+  uint64_t flags = 0;
+  if (usage & GRALLOC_USAGE_SW_READ_MASK)
+    flags |= DMA_BUF_SYNC_READ;
+  if (usage & GRALLOC_USAGE_SW_WRITE_MASK)
+    flags |= DMA_BUF_SYNC_WRITE;
+  return flags;
+}
+
 }  // anonymous namespace
 
 namespace android {
@@ -31,7 +46,10 @@ IonBuffer::IonBuffer(buffer_handle_t handle, uint32_t width, uint32_t height,
 IonBuffer::IonBuffer(buffer_handle_t handle, uint32_t width, uint32_t height,
                      uint32_t layer_count, uint32_t stride, uint32_t format,
                      uint64_t usage)
-    : buffer_(nullptr) {
+    : buffer_(nullptr),
+      mapped_address_(nullptr),
+      mapped_size_(0),
+      mapped_protection_(PROT_NONE) {
   ALOGD_IF(TRACE,
            "IonBuffer::IonBuffer: handle=%p width=%u height=%u layer_count=%u "
            "stride=%u format=%u usage=%" PRIx64,
@@ -58,13 +76,21 @@ IonBuffer& IonBuffer::operator=(IonBuffer&& other) {
            other.handle());
 
   if (this != &other) {
+    FreeHandle();
     buffer_ = other.buffer_;
+    mapped_address_ = other.mapped_address_;
+    mapped_size_ = other.mapped_size_;
+    mapped_protection_ = other.mapped_protection_;
+    other.mapped_address_ = nullptr;
+    other.mapped_size_ = 0;
+    other.mapped_protection_ = PROT_NONE;
     other.FreeHandle();
   }
   return *this;
 }
 
 void IonBuffer::FreeHandle() {
+  Unmap();
   if (buffer_.get()) {
     // GraphicBuffer unregisters and cleans up the handle if needed
     buffer_ = nullptr;
@@ -83,6 +109,7 @@ int IonBuffer::Alloc(uint32_t width, uint32_t height, uint32_t layer_count,
     ALOGE("IonBuffer::Aloc: Failed to allocate buffer");
     return -EINVAL;
   } else {
+    Unmap();
     buffer_ = buffer;
     return 0;
   }
@@ -236,5 +263,92 @@ int IonBuffer::Unlock() {
   else
     return 0;
 }
+
+int IonBuffer::Map(uint64_t usage, void** address, size_t* size) {
+  ATRACE_NAME("IonBuffer::Map");
+  if (!address || !size || !handle() || handle()->numFds < 1)
+    return -EINVAL;
+
+  int protection = PROT_READ;
+  if (usage & GRALLOC_USAGE_SW_WRITE_MASK)
+    protection |= PROT_WRITE;
+  if ((mapped_protection_ & protection) != protection)
+    Unmap();
+
+  if (!mapped_address_) {
+    // Like BufferHubBuffer::GetBlobFd(), this relies on the allocation being
+    // entirely in the first fd of the handle.
+    const int fd = handle()->data[0];
+    const off_t length = lseek(fd, 0, SEEK_END);
+    if (length <= 0) {
+      ALOGE("IonBuffer::Map: Failed to get the size of handle=%p: %s",
+            handle(), length < 0 ? strerror(errno) : "empty buffer");
+      return length < 0 ? -errno : -EINVAL;
+    }
+
+    void* mapping = mmap(nullptr, length, protection, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+      ALOGE("IonBuffer::Map: Failed to map handle=%p: %s", handle(),
+            strerror(errno));
+      return -errno;
+    }
+
+    mapped_address_ = mapping;
+    mapped_size_ = length;
+    mapped_protection_ = protection;
+    ALOGD_IF(TRACE, "IonBuffer::Map: handle=%p address=%p size=%zu", handle(),
+             mapped_address_, mapped_size_);
+  }
+
+  *address = mapped_address_;
+  *size = mapped_size_;
+  return 0;
+}
+
+int IonBuffer::Unmap() {
+  if (!mapped_address_)
+    return 0;
+
+  ALOGD_IF(TRACE, "IonBuffer::Unmap: handle=%p address=%p", handle(),
+           mapped_address_);
+  const int ret = munmap(mapped_address_, mapped_size_);
+  mapped_address_ = nullptr;
+  mapped_size_ = 0;
+  mapped_protection_ = PROT_NONE;
+  return ret < 0 ? -errno : 0;
+}
+
+int IonBuffer::BeginCpuAccess(uint64_t usage) {
+  ATRACE_NAME("IonBuffer::BeginCpuAccess");
+  return SyncMapping(DMA_BUF_SYNC_START | GetSyncFlags(usage));
+}
+
+int IonBuffer::EndCpuAccess(uint64_t usage) {
+  ATRACE_NAME("IonBuffer::EndCpuAccess");
+  return SyncMapping(DMA_BUF_SYNC_END | GetSyncFlags(usage));
+}
+
+int IonBuffer::SyncMapping(uint64_t flags) {
+  if (!mapped_address_)
+    return -EINVAL;
+  if (!(flags & DMA_BUF_SYNC_RW))
+    return 0;
+
+  struct dma_buf_sync sync = {flags};
+  int ret;
+  do {
+    ret = ioctl(handle()->data[0], DMA_BUF_IOCTL_SYNC, &sync);
+  } while (ret < 0 && (errno == EINTR || errno == EAGAIN));
+
+  // Exporters that predate the sync ioctl only hand out coherent mappings, so
+  // there is nothing to do for them.
+  if (ret < 0 && errno != ENOTTY) {
+    ALOGE("IonBuffer::SyncMapping: Failed to sync handle=%p flags=%" PRIx64
+          ": %s",
+          handle(), flags, strerror(errno));
+    return -errno;
+  }
+  return 0;
+}
 }  // namespace dvr
 }  // namespace android
@@ -2,8 +2,8 @@
 
 #include <inttypes.h>
 #include <log/log.h>
-#include <poll.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 
 #include <array>
 
@@ -12,15 +12,6 @@
 #include <pdx/file_handle.h>
 #include <private/dvr/bufferhub_rpc.h>
 
-#define RETRY_EINTR(fnc_call)                 \
-  ([&]() -> decltype(fnc_call) {              \
-    decltype(fnc_call) result;                \
-    do {                                      \
-      result = (fnc_call);                    \
-    } while (result == -1 && errno == EINTR); \
-    return result;                            \
-  })()
-
 using android::pdx::ErrorStatus;
 using android::pdx::LocalChannelHandle;
 using android::pdx::Status;
@@ -28,12 +19,19 @@ using android::pdx::Status;
 namespace android {
 namespace dvr {
 
+namespace {
+
+constexpr uint32_t kQueueStateUsage =
+    GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_SW_WRITE_OFTEN;
+
+}  // anonymous namespace
+
 BufferHubQueue::BufferHubQueue(LocalChannelHandle channel_handle)
     : Client{pdx::default_transport::ClientChannel::Create(
           std::move(channel_handle))},
       meta_size_(0),
       buffers_(BufferHubQueue::kMaxQueueCapacity),
-      epollhup_pending_(BufferHubQueue::kMaxQueueCapacity, false),
+      hangup_pending_(BufferHubQueue::kMaxQueueCapacity, false),
       available_buffers_(BufferHubQueue::kMaxQueueCapacity),
       fences_(BufferHubQueue::kMaxQueueCapacity),
       capacity_(0),
@@ -46,7 +44,7 @@ BufferHubQueue::BufferHubQueue(const std::string& endpoint_path)
           endpoint_path)},
       meta_size_(0),
       buffers_(BufferHubQueue::kMaxQueueCapacity),
-      epollhup_pending_(BufferHubQueue::kMaxQueueCapacity, false),
+      hangup_pending_(BufferHubQueue::kMaxQueueCapacity, false),
       available_buffers_(BufferHubQueue::kMaxQueueCapacity),
       fences_(BufferHubQueue::kMaxQueueCapacity),
       capacity_(0),
@@ -54,6 +52,11 @@ BufferHubQueue::BufferHubQueue(const std::string& endpoint_path)
   Initialize();
 }
 
+BufferHubQueue::~BufferHubQueue() {
+  if (queue_state_)
+    queue_state_buffer_.Unlock();
+}
+
 void BufferHubQueue::Initialize() {
   int ret = epoll_fd_.Create();
   if (ret < 0) {
@@ -80,8 +83,60 @@ Status<void> BufferHubQueue::ImportQueue() {
     return ErrorStatus(status.error());
   } else {
     SetupQueue(status.get().meta_size_bytes, status.get().id);
-    return {};
+    return ImportQueueState();
+  }
+}
+
+Status<void> BufferHubQueue::ImportQueueState() {
+  auto status = InvokeRemoteMethod<BufferHubRPC::GetQueueState>();
+  if (!status) {
+    ALOGE("BufferHubQueue::ImportQueueState: Failed to get queue state: %s",
+          status.GetErrorMessage().c_str());
+    return ErrorStatus(status.error());
+  }
+
+  auto state_desc = status.take();
+  IonBuffer state_buffer;
+  int ret = state_desc.ImportState(&state_buffer);
+  if (ret < 0) {
+    ALOGE("BufferHubQueue::ImportQueueState: Failed to import state: %s",
+          strerror(-ret));
+    return ErrorStatus(-ret);
+  }
+
+  const size_t state_size = state_buffer.width();
+  if (state_size < sizeof(BufferHubDefs::QueueState)) {
+    ALOGE("BufferHubQueue::ImportQueueState: Queue state too small: %zu",
+          state_size);
+    return ErrorStatus(EINVAL);
+  }
+
+  void* state_ptr = nullptr;
+  ret = state_buffer.Lock(kQueueStateUsage, 0, 0, state_size, 1, &state_ptr);
+  if (ret < 0) {
+    ALOGE("BufferHubQueue::ImportQueueState: Failed to map state: %s",
+          strerror(-ret));
+    return ErrorStatus(-ret);
   }
+
+  LocalHandle doorbell = state_desc.take_doorbell();
+  epoll_event event = {.events = EPOLLIN,
+                       .data = {.u64 = static_cast<uint64_t>(
+                                    BufferHubQueue::kEpollDoorbellEventIndex)}};
+  ret = epoll_fd_.Control(EPOLL_CTL_ADD, doorbell.Get(), &event);
+  if (ret < 0) {
+    ALOGE(
+        "BufferHubQueue::ImportQueueState: Failed to add doorbell to epoll "
+        "set: %s",
+        strerror(-ret));
+    state_buffer.Unlock();
+    return ErrorStatus(-ret);
+  }
+
+  queue_state_buffer_ = std::move(state_buffer);
+  queue_state_ = static_cast<BufferHubDefs::QueueState*>(state_ptr);
+  doorbell_ = std::move(doorbell);
+  return {};
 }
 
 void BufferHubQueue::SetupQueue(size_t meta_size_bytes, int id) {
@@ -148,9 +203,9 @@ bool BufferHubQueue::WaitForBuffers(int timeout) {
 
     const int num_events = ret;
 
-    // A BufferQueue's epoll fd tracks N+1 events, where there are N events,
-    // one for each buffer, in the queue and one extra event for the queue
-    // client itself.
+    // A BufferQueue's epoll fd tracks two events no matter how many buffers
+    // are in the queue: the doorbell, which reports ready and detached
+    // buffers, and the queue client itself.
     for (int i = 0; i < num_events; i++) {
       int64_t index = static_cast<int64_t>(events[i].data.u64);
 
@@ -158,8 +213,8 @@ bool BufferHubQueue::WaitForBuffers(int timeout) {
                "BufferHubQueue::WaitForBuffers: event %d: index=%" PRId64, i,
                index);
 
-      if (is_buffer_event_index(index)) {
-        HandleBufferEvent(static_cast<size_t>(index), events[i].events);
+      if (is_doorbell_event_index(index)) {
+        HandleDoorbellEvent();
       } else if (is_queue_event_index(index)) {
         HandleQueueEvent(events[i].events);
       } else {
@@ -172,58 +227,74 @@ bool BufferHubQueue::WaitForBuffers(int timeout) {
   return count() != 0;
 }
 
-void BufferHubQueue::HandleBufferEvent(size_t slot, int poll_events) {
+void BufferHubQueue::HandleDoorbellEvent() {
+  // Drain the doorbell before taking the marked slots: BufferHub rings it again
+  // for any slot it marks from here on.
+  eventfd_t value;
+  eventfd_read(doorbell_.Get(), &value);
+
+  uint64_t hangup_slots =
+      BufferHubDefs::TakeQueueSlots(&queue_state_->hangup_slots);
+  uint64_t ready_slots =
+      BufferHubDefs::TakeQueueSlots(&queue_state_->ready_slots);
+  ALOGD_IF(TRACE,
+           "BufferHubQueue::HandleDoorbellEvent: queue_id=%d ready_slots=%" PRIx64
+           " hangup_slots=%" PRIx64,
+           id(), ready_slots, hangup_slots);
+
+  while (hangup_slots) {
+    const size_t slot = __builtin_ctzll(hangup_slots);
+    hangup_slots &= hangup_slots - 1;
+    HandleBufferHangup(slot);
+  }
+
+  while (ready_slots) {
+    const size_t slot = __builtin_ctzll(ready_slots);
+    ready_slots &= ready_slots - 1;
+    HandleBufferReady(slot);
+  }
+}
+
+void BufferHubQueue::HandleBufferReady(size_t slot) {
   auto buffer = buffers_[slot];
   if (!buffer) {
-    ALOGW("BufferHubQueue::HandleBufferEvent: Invalid buffer slot: %zu", slot);
+    // The buffer was detached after BufferHub reported it.
+    ALOGD_IF(TRACE, "BufferHubQueue::HandleBufferReady: Empty buffer slot: %zu",
+             slot);
     return;
   }
 
-  auto status = buffer->GetEventMask(poll_events);
-  if (!status) {
-    ALOGW("BufferHubQueue::HandleBufferEvent: Failed to get event mask: %s",
-          status.GetErrorMessage().c_str());
-    return;
+  const int ret = OnBufferReady(buffer, &fences_[slot]);
+  if (ret == 0 || ret == -EALREADY || ret == -EBUSY) {
+    // Only enqueue the buffer if it moves to or is already in the state
+    // requested in OnBufferReady(). If the buffer is busy this means that the
+    // buffer moved from released to posted when a new consumer was created
+    // before the ProducerQueue had a chance to regain it, or that it was
+    // reported both on import and through the queue state. These are valid and
+    // we have to handle them because the ready state is latched even if it is
+    // later de-asserted -- don't enqueue or print an error log in this case.
+    if (ret != -EBUSY)
+      Enqueue(buffer, slot);
+  } else {
+    ALOGE(
+        "BufferHubQueue::HandleBufferReady: Failed to set buffer ready, "
+        "queue_id=%d buffer_id=%d: %s",
+        id(), buffer->id(), strerror(-ret));
   }
+}
 
-  const int events = status.get();
-  if (events & EPOLLIN) {
-    const int ret = OnBufferReady(buffer, &fences_[slot]);
-    if (ret == 0 || ret == -EALREADY || ret == -EBUSY) {
-      // Only enqueue the buffer if it moves to or is already in the state
-      // requested in OnBufferReady(). If the buffer is busy this means that the
-      // buffer moved from released to posted when a new consumer was created
-      // before the ProducerQueue had a chance to regain it. This is a valid
-      // transition that we have to handle because edge triggered poll events
-      // latch the ready state even if it is later de-asserted -- don't enqueue
-      // or print an error log in this case.
-      if (ret != -EBUSY)
-        Enqueue(buffer, slot);
-    } else {
-      ALOGE(
-          "BufferHubQueue::HandleBufferEvent: Failed to set buffer ready, "
-          "queue_id=%d buffer_id=%d: %s",
-          id(), buffer->id(), strerror(-ret));
-    }
-  } else if (events & EPOLLHUP) {
-    // This might be caused by producer replacing an existing buffer slot, or
-    // when BufferHubQueue is shutting down. For the first case, currently the
-    // epoll FD is cleaned up when the replacement consumer client is imported,
-    // we shouldn't detach again if |epollhub_pending_[slot]| is set.
-    ALOGW(
-        "BufferHubQueue::HandleBufferEvent: Received EPOLLHUP at slot: %zu, "
-        "buffer event fd: %d, EPOLLHUP pending: %d",
-        slot, buffer->event_fd(), int{epollhup_pending_[slot]});
-    if (epollhup_pending_[slot]) {
-      epollhup_pending_[slot] = false;
-    } else {
-      DetachBuffer(slot);
-    }
-  } else {
-    ALOGW(
-        "BufferHubQueue::HandleBufferEvent: Unknown event, slot=%zu, epoll "
-        "events=%d",
-        slot, events);
+void BufferHubQueue::HandleBufferHangup(size_t slot) {
+  // This is caused by the producer queue detaching or replacing the buffer
+  // slot. For the latter, the slot may already have been cleaned up when the
+  // replacement consumer client was imported; we shouldn't detach again if
+  // |hangup_pending_[slot]| is set.
+  ALOGD_IF(TRACE,
+           "BufferHubQueue::HandleBufferHangup: slot=%zu hangup pending: %d",
+           slot, int{hangup_pending_[slot]});
+  if (hangup_pending_[slot]) {
+    hangup_pending_[slot] = false;
+  } else if (buffers_[slot]) {
+    DetachBuffer(slot);
   }
 }
 
@@ -267,15 +338,7 @@ int BufferHubQueue::AddBuffer(const std::shared_ptr<BufferHubBuffer>& buf,
     // producer side replaced the slot with a newly allocated buffer. Detach the
     // buffer before setting up with the new one.
     DetachBuffer(slot);
-    epollhup_pending_[slot] = true;
-  }
-
-  epoll_event event = {.events = EPOLLIN | EPOLLET, .data = {.u64 = slot}};
-  const int ret = epoll_fd_.Control(EPOLL_CTL_ADD, buf->event_fd(), &event);
-  if (ret < 0) {
-    ALOGE("BufferHubQueue::AddBuffer: Failed to add buffer to epoll set: %s",
-          strerror(-ret));
-    return ret;
+    hangup_pending_[slot] = true;
   }
 
   buffers_[slot] = buf;
@@ -290,16 +353,7 @@ int BufferHubQueue::DetachBuffer(size_t slot) {
     return -EINVAL;
   }
 
-  const int ret = epoll_fd_.Control(EPOLL_CTL_DEL, buf->event_fd(), nullptr);
-  if (ret < 0) {
-    ALOGE(
-        "BufferHubQueue::DetachBuffer: Failed to detach buffer from epoll set: "
-        "%s",
-        strerror(-ret));
-    return ret;
-  }
-
-  buffers_[slot] = nullptr;
+  buf = nullptr;
   capacity_--;
   return 0;
 }
@@ -386,6 +440,13 @@ ProducerQueue::ProducerQueue(size_t meta_size, uint64_t usage_set_mask,
   }
 
   SetupQueue(status.get().meta_size_bytes, status.get().id);
+
+  auto state_status = ImportQueueState();
+  if (!state_status) {
+    ALOGE("ProducerQueue::ProducerQueue: Failed to import queue state: %s",
+          state_status.GetErrorMessage().c_str());
+    Close(-state_status.error());
+  }
 }
 
 int ProducerQueue::AllocateBuffer(uint32_t width, uint32_t height,
@@ -396,37 +457,74 @@ int ProducerQueue::AllocateBuffer(uint32_t width, uint32_t height,
     return -EINVAL;
   }
 
-  if (is_full()) {
-    ALOGE("ProducerQueue::AllocateBuffer queue is at maximum capacity: %zu",
-          capacity());
+  const size_t kBufferCount = 1U;
+  std::vector<size_t> slots;
+  const int ret = AllocateBuffers(width, height, layer_count, format, usage,
+                                  kBufferCount, &slots);
+  if (ret < 0)
+    return ret;
+
+  *out_slot = slots[0];
+  return 0;
+}
+
+int ProducerQueue::AllocateBuffers(uint32_t width, uint32_t height,
+                                   uint32_t layer_count, uint32_t format,
+                                   uint64_t usage, size_t buffer_count,
+                                   std::vector<size_t>* out_slots) {
+  if (out_slots == nullptr) {
+    ALOGE(
+        "ProducerQueue::AllocateBuffers: Parameter out_slots cannot be null.");
+    return -EINVAL;
+  }
+
+  if (buffer_count > kMaxQueueCapacity - capacity()) {
+    ALOGE(
+        "ProducerQueue::AllocateBuffers: allocating %zu buffers would exceed "
+        "the maximum capacity, capacity=%zu",
+        buffer_count, capacity());
     return -E2BIG;
   }
 
-  const size_t kBufferCount = 1U;
-  Status<std::vector<std::pair<LocalChannelHandle, size_t>>> status =
+  Status<std::vector<LocalQueueBufferSlot>> status =
       InvokeRemoteMethod<BufferHubRPC::ProducerQueueAllocateBuffers>(
-          width, height, layer_count, format, usage, kBufferCount);
+          width, height, layer_count, format, usage, buffer_count);
   if (!status) {
-    ALOGE("ProducerQueue::AllocateBuffer failed to create producer buffer: %s",
-          status.GetErrorMessage().c_str());
+    ALOGE(
+        "ProducerQueue::AllocateBuffers failed to create producer buffers: %s",
+        status.GetErrorMessage().c_str());
     return -status.error();
   }
 
-  auto buffer_handle_slots = status.take();
-  LOG_ALWAYS_FATAL_IF(buffer_handle_slots.size() != kBufferCount,
+  auto buffer_slots = status.take();
+  LOG_ALWAYS_FATAL_IF(buffer_slots.size() != buffer_count,
                       "BufferHubRPC::ProducerQueueAllocateBuffers should "
-                      "return one and only one buffer handle.");
+                      "return %zu buffer handles, got %zu.",
+                      buffer_count, buffer_slots.size());
 
-  // We only allocate one buffer at a time.
-  auto& buffer_handle = buffer_handle_slots[0].first;
-  size_t buffer_slot = buffer_handle_slots[0].second;
-  ALOGD_IF(TRACE,
-           "ProducerQueue::AllocateBuffer, new buffer, channel_handle: %d",
-           buffer_handle.value());
+  // The reply carries the buffer descriptions, so importing the buffers does
+  // not take another round trip per buffer.
+  int last_error = 0;
+  for (auto& buffer_slot : buffer_slots) {
+    ALOGD_IF(TRACE,
+             "ProducerQueue::AllocateBuffers, new buffer, channel_handle: %d "
+             "slot: %zu",
+             buffer_slot.channel_handle.value(), buffer_slot.slot);
+    const int ret =
+        AddBuffer(BufferProducer::Import(
+                      std::move(buffer_slot.channel_handle),
+                      std::move(buffer_slot.buffer_description)),
+                  buffer_slot.slot);
+    if (ret < 0) {
+      ALOGE("ProducerQueue::AllocateBuffers: Failed to add buffer: %s",
+            strerror(-ret));
+      last_error = ret;
+      continue;
+    }
+    out_slots->push_back(buffer_slot.slot);
+  }
 
-  *out_slot = buffer_slot;
-  return AddBuffer(BufferProducer::Import(std::move(buffer_handle)),
-                   buffer_slot);
+  return last_error;
 }
 
 int ProducerQueue::AddBuffer(const std::shared_ptr<BufferProducer>& buf,
@@ -510,13 +608,14 @@ Status<size_t> ConsumerQueue::ImportBuffers() {
   int last_error = 0;
   int imported_buffers = 0;
 
-  auto buffer_handle_slots = status.take();
-  for (auto& buffer_handle_slot : buffer_handle_slots) {
+  auto buffer_slots = status.take();
+  for (auto& buffer_slot : buffer_slots) {
     ALOGD_IF(TRACE, "ConsumerQueue::ImportBuffers: buffer_handle=%d",
-             buffer_handle_slot.first.value());
+             buffer_slot.channel_handle.value());
 
     std::unique_ptr<BufferConsumer> buffer_consumer =
-        BufferConsumer::Import(std::move(buffer_handle_slot.first));
+        BufferConsumer::Import(std::move(buffer_slot.channel_handle),
+                               std::move(buffer_slot.buffer_description));
 
     // Setup ignore state before adding buffer to the queue.
     if (ignore_on_import_) {
@@ -534,7 +633,7 @@ Status<size_t> ConsumerQueue::ImportBuffers() {
       }
     }
 
-    ret = AddBuffer(std::move(buffer_consumer), buffer_handle_slot.second);
+    ret = AddBuffer(std::move(buffer_consumer), buffer_slot.slot);
     if (ret < 0) {
       ALOGE("ConsumerQueue::ImportBuffers: Failed to add buffer: %s",
             strerror(-ret));
@@ -559,22 +658,11 @@ int ConsumerQueue::AddBuffer(const std::shared_ptr<BufferConsumer>& buf,
   if (ret < 0)
     return ret;
 
-  // Check to see if the buffer is already signaled. This is necessary to catch
-  // cases where buffers are already available; epoll edge triggered mode does
-  // not fire until and edge transition when adding new buffers to the epoll
-  // set.
-  const int kTimeoutMs = 0;
-  pollfd pfd{buf->event_fd(), POLLIN, 0};
-  const int count = RETRY_EINTR(poll(&pfd, 1, kTimeoutMs));
-  if (count < 0) {
-    const int error = errno;
-    ALOGE("ConsumerQueue::AddBuffer: Failed to poll consumer buffer: %s",
-          strerror(errno));
-    return -error;
-  }
-
-  if (count == 1)
-    HandleBufferEvent(slot, pfd.revents);
+  // Check to see if the buffer is already posted. This is necessary to catch
+  // cases where buffers are already available; BufferHub only reports posts
+  // through the queue state once the buffer belongs to the queue.
+  if (buf->IsBufferAvailable())
+    HandleBufferReady(slot);
 
   return 0;
 }
@@ -26,7 +26,7 @@ class BufferHubQueue : public pdx::Client {
   template <typename T>
   using Status = pdx::Status<T>;
 
-  virtual ~BufferHubQueue() {}
+  virtual ~BufferHubQueue();
   void Initialize();
 
   // Create a new consumer queue that is attached to the producer. Returns
@@ -98,6 +98,10 @@ class BufferHubQueue : public pdx::Client {
   // queue.
   static constexpr int64_t kEpollQueueEventIndex = -1;
 
+  // Special epoll data field indicating that the epoll event refers to the
+  // doorbell of the queue state.
+  static constexpr int64_t kEpollDoorbellEventIndex = -2;
+
   // When pass |kNoTimeout| to |Dequeue|, it will block indefinitely without a
   // timeout.
   static constexpr int kNoTimeOut = -1;
@@ -113,15 +117,19 @@ class BufferHubQueue : public pdx::Client {
   // this channel.
   Status<void> ImportQueue();
 
+  // Maps the state through which BufferHub reports ready and detached buffers
+  // and adds its doorbell to the epoll set.
+  Status<void> ImportQueueState();
+
   // Sets up the queue with the given parameters.
   void SetupQueue(size_t meta_size_bytes_, int id);
 
   // Called by ProducerQueue::AddBuffer and ConsumerQueue::AddBuffer only. to
-  // register a buffer for epoll and internal bookkeeping.
+  // register a buffer for internal bookkeeping.
   int AddBuffer(const std::shared_ptr<BufferHubBuffer>& buf, size_t slot);
 
   // Called by ProducerQueue::DetachBuffer and ConsumerQueue::DetachBuffer only.
-  // to deregister a buffer for epoll and internal bookkeeping.
+  // to deregister a buffer for internal bookkeeping.
   virtual int DetachBuffer(size_t slot);
 
   // Dequeue a buffer from the free queue, blocking until one is available. The
@@ -136,7 +144,9 @@ class BufferHubQueue : public pdx::Client {
 
   // Wait for buffers to be released and re-add them to the queue.
   bool WaitForBuffers(int timeout);
-  void HandleBufferEvent(size_t slot, int poll_events);
+  void HandleDoorbellEvent();
+  void HandleBufferReady(size_t slot);
+  void HandleBufferHangup(size_t slot);
   void HandleQueueEvent(int poll_events);
 
   virtual int OnBufferReady(const std::shared_ptr<BufferHubBuffer>& buf,
@@ -158,21 +168,20 @@ class BufferHubQueue : public pdx::Client {
   std::unique_ptr<uint8_t[]> meta_buffer_tmp_;
 
  private:
-  static constexpr size_t kMaxEvents = 128;
+  // The epoll set only holds the queue channel and the doorbell.
+  static constexpr size_t kMaxEvents = 2;
 
   // The |u64| data field of an epoll event is interpreted as int64_t:
-  // When |index| >= 0 and |index| < kMaxQueueCapacity it refers to a specific
-  // element of |buffers_| as a direct index;
-  static bool is_buffer_event_index(int64_t index) {
-    return index >= 0 &&
-           index < static_cast<int64_t>(BufferHubQueue::kMaxQueueCapacity);
-  }
-
   // When |index| == kEpollQueueEventIndex, it refers to the queue itself.
   static bool is_queue_event_index(int64_t index) {
     return index == BufferHubQueue::kEpollQueueEventIndex;
   }
 
+  // When |index| == kEpollDoorbellEventIndex, it refers to the doorbell.
+  static bool is_doorbell_event_index(int64_t index) {
+    return index == BufferHubQueue::kEpollDoorbellEventIndex;
+  }
+
   struct BufferInfo {
     // A logical slot number that is assigned to a buffer at allocation time.
     // The slot number remains unchanged during the entire life cycle of the
@@ -225,29 +234,30 @@ class BufferHubQueue : public pdx::Client {
   // |buffers_| tracks all |BufferHubBuffer|s created by this |BufferHubQueue|.
   std::vector<std::shared_ptr<BufferHubBuffer>> buffers_;
 
-  // |epollhup_pending_| tracks whether a slot of |buffers_| get detached before
-  // its corresponding EPOLLHUP event got handled. This could happen as the
-  // following sequence:
+  // |hangup_pending_| tracks whether a slot of |buffers_| get detached before
+  // its corresponding hangup got handled. This could happen as the following
+  // sequence:
   // 1. Producer queue's client side allocates a new buffer (at slot 1).
   // 2. Producer queue's client side replaces an existing buffer (at slot 0).
   //    This is implemented by first detaching the buffer and then allocating a
   //    new buffer.
   // 3. During the same epoll_wait, Consumer queue's client side gets EPOLLIN
   //    event on the queue which indicates a new buffer is available and the
-  //    EPOLLHUP event for slot 0. Consumer handles these two events in order.
+  //    doorbell with the hangup of slot 0. Consumer handles the queue event
+  //    first.
   // 4. Consumer client calls BufferHubRPC::ConsumerQueueImportBuffers and both
   //    slot 0 and (the new) slot 1 buffer will be imported. During the import
   //    of the buffer at slot 1, consumer client detaches the old buffer so that
   //    the new buffer can be registered. At the same time
-  //    |epollhup_pending_[slot]| is marked to indicate that buffer at this slot
-  //    was detached prior to EPOLLHUP event.
-  // 5. Consumer client continues to handle the EPOLLHUP. Since
-  //    |epollhup_pending_[slot]| is marked as true, it can safely ignore the
-  //    event without detaching the newly allocated buffer at slot 1.
+  //    |hangup_pending_[slot]| is marked to indicate that buffer at this slot
+  //    was detached prior to the hangup.
+  // 5. Consumer client continues to handle the hangup. Since
+  //    |hangup_pending_[slot]| is marked as true, it can safely ignore the
+  //    hangup without detaching the newly allocated buffer at slot 1.
   //
   // In normal situations where the previously described sequence doesn't
-  // happen, an EPOLLHUP event should trigger a regular buffer detach.
-  std::vector<bool> epollhup_pending_;
+  // happen, a hangup should trigger a regular buffer detach.
+  std::vector<bool> hangup_pending_;
 
   // |available_buffers_| uses |dvr::RingBuffer| to implementation queue
   // sematics. When |Dequeue|, we pop the front element from
@@ -266,6 +276,14 @@ class BufferHubQueue : public pdx::Client {
   // Epoll fd used to wait for BufferHub events.
   EpollFileDescriptor epoll_fd_;
 
+  // State shared with BufferHub, mapped from |queue_state_buffer_|. BufferHub
+  // marks the slots of ready and detached buffers in it and then rings
+  // |doorbell_|, so waiting for buffers does not depend on how many buffers
+  // the queue holds.
+  IonBuffer queue_state_buffer_;
+  BufferHubDefs::QueueState* queue_state_{nullptr};
+  LocalHandle doorbell_;
+
   // Flag indicating that the other side hung up. For ProducerQueues this
   // triggers when BufferHub dies or explicitly closes the queue channel. For
   // ConsumerQueues this can either mean the same or that the ProducerQueue on
@@ -339,6 +357,16 @@ class ProducerQueue : public pdx::ClientBase<ProducerQueue, BufferHubQueue> {
   int AllocateBuffer(uint32_t width, uint32_t height, uint32_t layer_count,
                      uint32_t format, uint64_t usage, size_t* out_slot);
 
+  // Allocate |buffer_count| producer buffers of the same spec with a single
+  // request, which lets bufferhubd run the allocations in parallel. The slots
+  // of the new buffers are appended to |out_slots|. bufferhubd either
+  // allocates all of the buffers or none of them.
+  // Returns Zero on success and negative error code when buffer allocation
+  // fails.
+  int AllocateBuffers(uint32_t width, uint32_t height, uint32_t layer_count,
+                      uint32_t format, uint64_t usage, size_t buffer_count,
+                      std::vector<size_t>* out_slots);
+
   // Add a producer buffer to populate the queue. Once added, a producer buffer
   // is available to use (i.e. in |Gain|'ed mode).
   int AddBuffer(const std::shared_ptr<BufferProducer>& buf, size_t slot);
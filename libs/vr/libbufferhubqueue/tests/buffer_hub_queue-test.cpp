@@ -341,6 +341,86 @@ TEST_F(BufferHubQueueTest, TestAllocateBuffer) {
   ASSERT_EQ(cs2, s2);
 }
 
+TEST_F(BufferHubQueueTest, TestAllocateBuffers) {
+  ASSERT_TRUE(CreateQueues<int64_t>());
+
+  const size_t kBufferCount = 4;
+  std::vector<size_t> slots;
+  int ret = producer_queue_->AllocateBuffers(
+      kBufferWidth, kBufferHeight, kBufferLayerCount, kBufferFormat,
+      kBufferUsage, kBufferCount, &slots);
+  ASSERT_EQ(ret, 0);
+  ASSERT_EQ(slots.size(), kBufferCount);
+  ASSERT_EQ(producer_queue_->capacity(), kBufferCount);
+  ASSERT_EQ(producer_queue_->count(), kBufferCount);
+
+  // Every buffer can be posted to and acquired from the consumer queue, which
+  // imports all of them with a single call.
+  int64_t seq = 1;
+  LocalHandle fence;
+  for (size_t i = 0; i < kBufferCount; i++) {
+    size_t slot;
+    auto p_status = producer_queue_->Dequeue(0, &slot, &fence);
+    ASSERT_TRUE(p_status.ok());
+    auto p = p_status.take();
+    ASSERT_NE(nullptr, p);
+    ASSERT_EQ(p->Post(LocalHandle(), seq), 0);
+  }
+  for (size_t i = 0; i < kBufferCount; i++) {
+    size_t slot;
+    auto c_status = consumer_queue_->Dequeue(0, &slot, &seq, &fence);
+    ASSERT_TRUE(c_status.ok());
+    ASSERT_NE(nullptr, c_status.get());
+  }
+  ASSERT_EQ(consumer_queue_->capacity(), kBufferCount);
+
+  // A batch that does not fit into the queue allocates nothing.
+  slots.clear();
+  ret = producer_queue_->AllocateBuffers(
+      kBufferWidth, kBufferHeight, kBufferLayerCount, kBufferFormat,
+      kBufferUsage, BufferHubQueue::kMaxQueueCapacity, &slots);
+  ASSERT_EQ(ret, -E2BIG);
+  ASSERT_TRUE(slots.empty());
+  ASSERT_EQ(producer_queue_->capacity(), kBufferCount);
+}
+
+TEST_F(BufferHubQueueTest, TestDetachBuffer) {
+  ASSERT_TRUE(CreateQueues<int64_t>());
+
+  const size_t kBufferCount = 2;
+  std::vector<size_t> slots;
+  ASSERT_EQ(0, producer_queue_->AllocateBuffers(
+                   kBufferWidth, kBufferHeight, kBufferLayerCount,
+                   kBufferFormat, kBufferUsage, kBufferCount, &slots));
+
+  // Import both buffers into the consumer queue.
+  consumer_queue_->HandleQueueEvents();
+  ASSERT_EQ(consumer_queue_->capacity(), kBufferCount);
+
+  // Detaching a buffer from the producer queue drops it from the consumer
+  // queue as well, while the other buffer keeps working.
+  size_t slot;
+  LocalHandle fence;
+  auto p_status = producer_queue_->Dequeue(0, &slot, &fence);
+  ASSERT_TRUE(p_status.ok());
+  ASSERT_EQ(slot, slots[0]);
+  ASSERT_EQ(0, producer_queue_->DetachBuffer(slot));
+  ASSERT_EQ(producer_queue_->capacity(), kBufferCount - 1);
+  consumer_queue_->HandleQueueEvents();
+  ASSERT_EQ(consumer_queue_->capacity(), kBufferCount - 1);
+  ASSERT_EQ(nullptr, consumer_queue_->GetBuffer(slots[0]));
+
+  p_status = producer_queue_->Dequeue(0, &slot, &fence);
+  ASSERT_TRUE(p_status.ok());
+  ASSERT_EQ(slot, slots[1]);
+  int64_t seq = 1;
+  ASSERT_EQ(0, p_status.get()->Post(LocalHandle(), seq));
+
+  auto c_status = consumer_queue_->Dequeue(0, &slot, &seq, &fence);
+  ASSERT_TRUE(c_status.ok());
+  ASSERT_EQ(slot, slots[1]);
+}
+
 TEST_F(BufferHubQueueTest, TestUsageSetMask) {
   const uint32_t set_mask = GRALLOC_USAGE_SW_WRITE_OFTEN;
   ASSERT_TRUE(CreateQueues<int64_t>(set_mask, 0, 0, 0));
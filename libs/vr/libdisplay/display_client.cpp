@@ -7,6 +7,7 @@
 #include <pdx/status.h>
 
 #include <mutex>
+#include <vector>
 
 #include <private/dvr/display_protocol.h>
 #include <private/dvr/native_buffer.h>
@@ -136,16 +137,15 @@ Status<std::unique_ptr<ProducerQueue>> Surface::CreateQueue(
   auto producer_queue = status.take();
 
   ALOGD_IF(TRACE, "Surface::CreateQueue: Allocating %zu buffers...", capacity);
-  for (size_t i = 0; i < capacity; i++) {
-    size_t slot;
-    const int ret = producer_queue->AllocateBuffer(width, height, layer_count,
-                                                   format, usage, &slot);
-    if (ret < 0) {
-      ALOGE(
-          "Surface::CreateQueue: Failed to allocate buffer on queue_id=%d: %s",
+  std::vector<size_t> slots;
+  const int ret = producer_queue->AllocateBuffers(
+      width, height, layer_count, format, usage, capacity, &slots);
+  if (ret < 0) {
+    ALOGE("Surface::CreateQueue: Failed to allocate buffers on queue_id=%d: %s",
           producer_queue->id(), strerror(-ret));
-      return ErrorStatus(ENOMEM);
-    }
+    return ErrorStatus(ENOMEM);
+  }
+  for (size_t slot : slots) {
     ALOGD_IF(
         TRACE,
         "Surface::CreateQueue: Allocated buffer at slot=%zu of capacity=%zu",
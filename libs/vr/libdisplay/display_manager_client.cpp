@@ -22,14 +22,45 @@ DisplayManagerClient::~DisplayManagerClient() {}
 
 pdx::Status<std::vector<display::SurfaceState>>
 DisplayManagerClient::GetSurfaceState() {
-  auto status = InvokeRemoteMethod<DisplayManagerProtocol::GetSurfaceState>();
+  auto status =
+      InvokeRemoteMethod<DisplayManagerProtocol::GetSurfaceStateUpdates>();
   if (!status) {
     ALOGE(
         "DisplayManagerClient::GetSurfaceState: Failed to get surface info: %s",
         status.GetErrorMessage().c_str());
+    return status.error_status();
+  }
+
+  auto updates = status.take();
+  for (const int32_t surface_id : updates.removed_surface_ids)
+    surface_states_.erase(surface_id);
+  for (auto& entry : surface_states_)
+    entry.second.update_flags = SurfaceUpdateFlags::None;
+
+  for (auto& update : updates.surfaces) {
+    auto search = surface_states_.find(update.surface_id);
+    if (search == surface_states_.end()) {
+      surface_states_.emplace(update.surface_id, std::move(update));
+      continue;
+    }
+
+    // Merge the changes into the known state of the surface.
+    auto& state = search->second;
+    state.process_id = update.process_id;
+    for (auto& attribute : update.surface_attributes)
+      state.surface_attributes[attribute.first] = std::move(attribute.second);
+    state.update_flags = update.update_flags;
+    if ((update.update_flags & SurfaceUpdateFlags::BuffersChanged) ||
+        !update.queue_ids.empty()) {
+      state.queue_ids = std::move(update.queue_ids);
+    }
   }
 
-  return status;
+  std::vector<SurfaceState> surface_states;
+  surface_states.reserve(surface_states_.size());
+  for (const auto& entry : surface_states_)
+    surface_states.push_back(entry.second);
+  return {std::move(surface_states)};
 }
 
 pdx::Status<std::unique_ptr<IonBuffer>> DisplayManagerClient::SetupNamedBuffer(
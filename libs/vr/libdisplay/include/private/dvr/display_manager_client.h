@@ -1,6 +1,7 @@
 #ifndef ANDROID_DVR_DISPLAY_MANAGER_CLIENT_H_
 #define ANDROID_DVR_DISPLAY_MANAGER_CLIENT_H_
 
+#include <map>
 #include <string>
 #include <vector>
 
@@ -20,6 +21,10 @@ class DisplayManagerClient : public pdx::ClientBase<DisplayManagerClient> {
  public:
   ~DisplayManagerClient() override;
 
+  // Returns the state of all application surfaces. Only the changes since the
+  // previous call are transferred from the display service; they are merged
+  // into a local copy of the state. The update flags of surfaces that did not
+  // change are None.
   pdx::Status<std::vector<SurfaceState>> GetSurfaceState();
   pdx::Status<std::unique_ptr<IonBuffer>> SetupNamedBuffer(
       const std::string& name, size_t size, uint64_t usage);
@@ -40,6 +45,9 @@ class DisplayManagerClient : public pdx::ClientBase<DisplayManagerClient> {
 
   DisplayManagerClient();
 
+  // Surface state as of the last call to GetSurfaceState(), by surface id.
+  std::map<int32_t, SurfaceState> surface_states_;
+
   DisplayManagerClient(const DisplayManagerClient&) = delete;
   void operator=(const DisplayManagerClient&) = delete;
 };
@@ -175,6 +175,18 @@ struct SurfaceState {
                            surface_attributes, update_flags, queue_ids);
 };
 
+// Changes to the application surfaces since the last time the display manager
+// asked for them. Surfaces the display manager has not seen before are sent in
+// full; for the others only the attributes that were set since the last update
+// are sent, and the queue ids only if the queues changed.
+struct SurfaceStateUpdates {
+  std::vector<SurfaceState> surfaces;
+  std::vector<int32_t> removed_surface_ids;
+
+ private:
+  PDX_SERIALIZABLE_MEMBERS(SurfaceStateUpdates, surfaces, removed_surface_ids);
+};
+
 struct SurfaceInfo {
   int surface_id;
   bool visible;
@@ -226,6 +238,7 @@ struct DisplayManagerProtocol {
     kOpGetSurfaceState = 0,
     kOpGetSurfaceQueue,
     kOpSetupNamedBuffer,
+    kOpGetSurfaceStateUpdates,
   };
 
   // Aliases.
@@ -240,6 +253,8 @@ struct DisplayManagerProtocol {
   PDX_REMOTE_METHOD(SetupNamedBuffer, kOpSetupNamedBuffer,
                     LocalNativeBufferHandle(const std::string& name,
                                             size_t size, uint64_t usage));
+  PDX_REMOTE_METHOD(GetSurfaceStateUpdates, kOpGetSurfaceStateUpdates,
+                    SurfaceStateUpdates(Void));
 };
 
 struct VSyncSchedInfo {
@@ -33,6 +33,12 @@ int ConvertToAHardwareBuffer(GraphicBuffer* graphic_buffer,
   return 0;
 }
 
+// CPU access performed through persistent mappings. Write buffers may also
+// read back what they wrote.
+constexpr uint64_t kWriteBufferCpuUsage =
+    GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_SW_WRITE_OFTEN;
+constexpr uint64_t kReadBufferCpuUsage = GRALLOC_USAGE_SW_READ_OFTEN;
+
 }  // anonymous namespace
 
 extern "C" {
@@ -101,6 +107,31 @@ int dvrWriteBufferGainAsync(DvrWriteBuffer* write_buffer) {
   return write_buffer->write_buffer->GainAsync();
 }
 
+int dvrWriteBufferMap(DvrWriteBuffer* write_buffer, void** address_out,
+                      size_t* size_out) {
+  if (!write_buffer || !write_buffer->write_buffer)
+    return -EINVAL;
+
+  return write_buffer->write_buffer->buffer()->Map(kWriteBufferCpuUsage,
+                                                   address_out, size_out);
+}
+
+int dvrWriteBufferBeginCpuAccess(DvrWriteBuffer* write_buffer) {
+  if (!write_buffer || !write_buffer->write_buffer)
+    return -EINVAL;
+
+  return write_buffer->write_buffer->buffer()->BeginCpuAccess(
+      kWriteBufferCpuUsage);
+}
+
+int dvrWriteBufferEndCpuAccess(DvrWriteBuffer* write_buffer) {
+  if (!write_buffer || !write_buffer->write_buffer)
+    return -EINVAL;
+
+  return write_buffer->write_buffer->buffer()->EndCpuAccess(
+      kWriteBufferCpuUsage);
+}
+
 void dvrReadBufferCreateEmpty(DvrReadBuffer** read_buffer) {
   if (read_buffer)
     *read_buffer = new DvrReadBuffer;
@@ -164,6 +195,34 @@ int dvrReadBufferReleaseAsync(DvrReadBuffer* read_buffer) {
   return read_buffer->read_buffer->ReleaseAsync();
 }
 
+int dvrReadBufferMap(DvrReadBuffer* read_buffer, const void** address_out,
+                     size_t* size_out) {
+  if (!read_buffer || !read_buffer->read_buffer || !address_out)
+    return -EINVAL;
+
+  void* address = nullptr;
+  const int ret = read_buffer->read_buffer->buffer()->Map(kReadBufferCpuUsage,
+                                                          &address, size_out);
+  if (ret == 0)
+    *address_out = address;
+  return ret;
+}
+
+int dvrReadBufferBeginCpuAccess(DvrReadBuffer* read_buffer) {
+  if (!read_buffer || !read_buffer->read_buffer)
+    return -EINVAL;
+
+  return read_buffer->read_buffer->buffer()->BeginCpuAccess(
+      kReadBufferCpuUsage);
+}
+
+int dvrReadBufferEndCpuAccess(DvrReadBuffer* read_buffer) {
+  if (!read_buffer || !read_buffer->read_buffer)
+    return -EINVAL;
+
+  return read_buffer->read_buffer->buffer()->EndCpuAccess(kReadBufferCpuUsage);
+}
+
 void dvrBufferDestroy(DvrBuffer* buffer) { delete buffer; }
 
 int dvrBufferGetAHardwareBuffer(DvrBuffer* buffer,
@@ -102,6 +102,10 @@ typedef int (*DvrWriteBufferGainPtr)(DvrWriteBuffer* write_buffer,
 typedef int (*DvrWriteBufferGainAsyncPtr)(DvrWriteBuffer* write_buffer);
 typedef const struct native_handle* (*DvrWriteBufferGetNativeHandlePtr)(
     DvrWriteBuffer* write_buffer);
+typedef int (*DvrWriteBufferMapPtr)(DvrWriteBuffer* write_buffer,
+                                    void** address_out, size_t* size_out);
+typedef int (*DvrWriteBufferBeginCpuAccessPtr)(DvrWriteBuffer* write_buffer);
+typedef int (*DvrWriteBufferEndCpuAccessPtr)(DvrWriteBuffer* write_buffer);
 
 typedef void (*DvrReadBufferCreateEmptyPtr)(DvrReadBuffer** read_buffer_out);
 typedef void (*DvrReadBufferDestroyPtr)(DvrReadBuffer* read_buffer);
@@ -118,6 +122,10 @@ typedef int (*DvrReadBufferReleasePtr)(DvrReadBuffer* read_buffer,
 typedef int (*DvrReadBufferReleaseAsyncPtr)(DvrReadBuffer* read_buffer);
 typedef const struct native_handle* (*DvrReadBufferGetNativeHandlePtr)(
     DvrReadBuffer* read_buffer);
+typedef int (*DvrReadBufferMapPtr)(DvrReadBuffer* read_buffer,
+                                   const void** address_out, size_t* size_out);
+typedef int (*DvrReadBufferBeginCpuAccessPtr)(DvrReadBuffer* read_buffer);
+typedef int (*DvrReadBufferEndCpuAccessPtr)(DvrReadBuffer* read_buffer);
 
 typedef void (*DvrBufferDestroyPtr)(DvrBuffer* buffer);
 typedef int (*DvrBufferGetAHardwareBufferPtr)(
@@ -133,3 +133,12 @@ DVR_V1_API_ENTRY(HwcFrameGetLayerNumVisibleRegions);
 DVR_V1_API_ENTRY(HwcFrameGetLayerVisibleRegion);
 DVR_V1_API_ENTRY(HwcFrameGetLayerNumDamagedRegions);
 DVR_V1_API_ENTRY(HwcFrameGetLayerDamagedRegion);
+
+// Persistent buffer mappings. New entries go at the end so that the layout of
+// DvrApi_v1 stays compatible with existing clients.
+DVR_V1_API_ENTRY(WriteBufferMap);
+DVR_V1_API_ENTRY(WriteBufferBeginCpuAccess);
+DVR_V1_API_ENTRY(WriteBufferEndCpuAccess);
+DVR_V1_API_ENTRY(ReadBufferMap);
+DVR_V1_API_ENTRY(ReadBufferBeginCpuAccess);
+DVR_V1_API_ENTRY(ReadBufferEndCpuAccess);
@@ -2,6 +2,7 @@
 #define ANDROID_DVR_BUFFER_H_
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <sys/cdefs.h>
 #include <memory>
@@ -50,6 +51,22 @@ int dvrWriteBufferGainAsync(DvrWriteBuffer* write_buffer);
 const struct native_handle* dvrWriteBufferGetNativeHandle(
     DvrWriteBuffer* write_buffer);
 
+// Maps the buffer for CPU access and returns its address and size in bytes.
+// The mapping stays valid until the write buffer is destroyed or cleared, so
+// buffers of a write queue can be mapped once and filled in place every frame
+// without copies or per-frame mapping costs. Only linear buffers, like BLOB
+// buffers, can be mapped this way. Calling this again returns the same
+// mapping.
+int dvrWriteBufferMap(DvrWriteBuffer* write_buffer, void** address_out,
+                      size_t* size_out);
+
+// Bracket CPU writes to a buffer mapped with dvrWriteBufferMap(). Call
+// dvrWriteBufferBeginCpuAccess() after gaining the buffer, before touching its
+// contents, and dvrWriteBufferEndCpuAccess() before posting it, so that the
+// CPU caches are coherent with the readers of the buffer.
+int dvrWriteBufferBeginCpuAccess(DvrWriteBuffer* write_buffer);
+int dvrWriteBufferEndCpuAccess(DvrWriteBuffer* write_buffer);
+
 // Creates an empty read buffer that may be filled with and actual buffer by
 // other functions.
 void dvrReadBufferCreateEmpty(DvrReadBuffer** read_buffer);
@@ -87,6 +104,18 @@ int dvrReadBufferReleaseAsync(DvrReadBuffer* read_buffer);
 const struct native_handle* dvrReadBufferGetNativeHandle(
     DvrReadBuffer* read_buffer);
 
+// Maps the buffer for CPU reads and returns its address and size in bytes. The
+// mapping stays valid until the read buffer is destroyed or cleared. See
+// dvrWriteBufferMap().
+int dvrReadBufferMap(DvrReadBuffer* read_buffer, const void** address_out,
+                     size_t* size_out);
+
+// Bracket CPU reads from a buffer mapped with dvrReadBufferMap(). Call
+// dvrReadBufferBeginCpuAccess() after acquiring the buffer and
+// dvrReadBufferEndCpuAccess() before releasing it.
+int dvrReadBufferBeginCpuAccess(DvrReadBuffer* read_buffer);
+int dvrReadBufferEndCpuAccess(DvrReadBuffer* read_buffer);
+
 // Destroys the buffer.
 void dvrBufferDestroy(DvrBuffer* buffer);
 
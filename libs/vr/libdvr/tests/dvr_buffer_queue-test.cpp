@@ -1,4 +1,5 @@
 #include <dvr/dvr_api.h>
+#include <dvr/dvr_buffer.h>
 #include <dvr/dvr_buffer_queue.h>
 #include <gui/Surface.h>
 #include <private/dvr/buffer_hub_queue_client.h>
@@ -186,6 +187,86 @@ TEST_F(DvrBufferQueueTest, TestDequeuePostDequeueRelease) {
   dvrReadBufferQueueDestroy(read_queue);
 }
 
+TEST_F(DvrBufferQueueTest, TestMapWriteAndReadBuffers) {
+  static constexpr int kTimeout = 0;
+  static constexpr uint64_t kMappableUsage =
+      GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_SW_WRITE_OFTEN;
+  DvrReadBufferQueue* read_queue = nullptr;
+  DvrReadBuffer* rb = nullptr;
+  DvrWriteBuffer* wb = nullptr;
+  int fence_fd = -1;
+
+  int ret = dvrWriteBufferQueueCreateReadQueue(write_queue_, &read_queue);
+  ASSERT_EQ(0, ret);
+  ASSERT_NE(nullptr, read_queue);
+
+  size_t slot;
+  ret = GetProducerQueueFromDvrWriteBufferQueue(write_queue_)
+            ->AllocateBuffer(kBufferWidth, kBufferHeight, kLayerCount,
+                             kBufferFormat, kMappableUsage, &slot);
+  ASSERT_EQ(0, ret);
+
+  dvrWriteBufferCreateEmpty(&wb);
+  dvrReadBufferCreateEmpty(&rb);
+
+  ret = dvrWriteBufferQueueDequeue(write_queue_, kTimeout, wb, &fence_fd);
+  ASSERT_EQ(0, ret);
+  pdx::LocalHandle release_fence(fence_fd);
+
+  void* write_address = nullptr;
+  size_t write_size = 0;
+  ret = dvrWriteBufferMap(wb, &write_address, &write_size);
+  ASSERT_EQ(0, ret);
+  ASSERT_NE(nullptr, write_address);
+  ASSERT_GE(write_size, static_cast<size_t>(kBufferWidth));
+
+  // The mapping persists, so mapping again returns the same address.
+  void* address = nullptr;
+  size_t size = 0;
+  ASSERT_EQ(0, dvrWriteBufferMap(wb, &address, &size));
+  EXPECT_EQ(write_address, address);
+  EXPECT_EQ(write_size, size);
+
+  ASSERT_EQ(0, dvrWriteBufferBeginCpuAccess(wb));
+  memset(write_address, 0x5a, kBufferWidth);
+  ASSERT_EQ(0, dvrWriteBufferEndCpuAccess(wb));
+
+  TestMeta seq = 1U;
+  ret = dvrWriteBufferPost(wb, /* fence */ -1, &seq, sizeof(seq));
+  ASSERT_EQ(0, ret);
+
+  TestMeta acquired_seq = 0U;
+  ret = dvrReadBufferQueueDequeue(read_queue, kTimeout, rb, &fence_fd,
+                                  &acquired_seq, sizeof(acquired_seq));
+  ASSERT_EQ(0, ret);
+  ASSERT_EQ(seq, acquired_seq);
+  pdx::LocalHandle acquire_fence(fence_fd);
+
+  const void* read_address = nullptr;
+  size_t read_size = 0;
+  ret = dvrReadBufferMap(rb, &read_address, &read_size);
+  ASSERT_EQ(0, ret);
+  ASSERT_NE(nullptr, read_address);
+  EXPECT_EQ(write_size, read_size);
+
+  ASSERT_EQ(0, dvrReadBufferBeginCpuAccess(rb));
+  const uint8_t* bytes = static_cast<const uint8_t*>(read_address);
+  for (int i = 0; i < kBufferWidth; i++)
+    ASSERT_EQ(0x5a, bytes[i]) << "i=" << i;
+  ASSERT_EQ(0, dvrReadBufferEndCpuAccess(rb));
+
+  ASSERT_EQ(0, dvrReadBufferRelease(rb, -1));
+
+  // Empty buffers cannot be mapped.
+  ASSERT_EQ(0, dvrWriteBufferClear(wb));
+  EXPECT_EQ(-EINVAL, dvrWriteBufferMap(wb, &address, &size));
+  EXPECT_EQ(-EINVAL, dvrWriteBufferBeginCpuAccess(wb));
+
+  dvrReadBufferDestroy(rb);
+  dvrWriteBufferDestroy(wb);
+  dvrReadBufferQueueDestroy(read_queue);
+}
+
 TEST_F(DvrBufferQueueTest, TestGetExternalSurface) {
   ANativeWindow* window = nullptr;
 
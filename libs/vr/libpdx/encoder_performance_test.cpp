@@ -9,8 +9,10 @@
 #include <vector>
 
 #include <pdx/rpc/argument_encoder.h>
+#include <pdx/rpc/message_arena.h>
 #include <pdx/rpc/message_buffer.h>
 #include <pdx/rpc/payload.h>
+#include <pdx/rpc/serializable.h>
 #include <pdx/utility.h>
 
 using namespace android::pdx::rpc;
@@ -26,6 +28,27 @@ namespace {
 
 constexpr size_t kMaxStaticBufferSize = 20480;
 
+// Struct shaped like the vsync and pose RPC payloads. Its members are all
+// fixed-size, so it takes the fixed-layout encoding.
+struct FixedLayoutStruct {
+  int64_t vsync_period_ns;
+  int64_t timestamp_ns;
+  uint32_t vsync_count;
+  std::array<float, 4> orientation;
+  std::array<float, 3> position;
+
+  bool operator!=(const FixedLayoutStruct& other) const {
+    return vsync_period_ns != other.vsync_period_ns ||
+           timestamp_ns != other.timestamp_ns ||
+           vsync_count != other.vsync_count ||
+           orientation != other.orientation || position != other.position;
+  }
+
+ private:
+  PDX_SERIALIZABLE_MEMBERS(FixedLayoutStruct, vsync_period_ns, timestamp_ns,
+                           vsync_count, orientation, position);
+};
+
 // Provide numpunct facet that formats numbers with ',' as thousands separators.
 class CommaNumPunct : public std::numpunct<char> {
  protected:
@@ -150,6 +173,40 @@ std::chrono::nanoseconds DeserializeTestRunner(
   return stop - start;
 }
 
+// Version of DeserializeTestRunner that decodes into ArenaType, the
+// MessageArenaAllocator-backed counterpart of T, with a fresh arena scope per
+// iteration the way DispatchRemoteMethod decodes handler arguments.
+template <typename ArenaType, typename T>
+std::chrono::nanoseconds ArenaDeserializeTestRunner(
+    MessageReader* reader, MessageWriter* writer, size_t iterations,
+    ResetFunc* read_reset, ResetFunc* write_reset, void* reset_data,
+    const T& value) {
+  write_reset(reset_data);
+  Serialize(value, writer);
+  auto start = std::chrono::high_resolution_clock::now();
+  for (size_t i = 0; i < iterations; i++) {
+    read_reset(reset_data);
+    MessageArena::Scope arena_scope;
+    ArenaType output_data;
+    Deserialize(&output_data, reader);
+  }
+  auto stop = std::chrono::high_resolution_clock::now();
+
+  // The arena types don't compare with their standard counterparts; check the
+  // result by round-tripping it back to T.
+  read_reset(reset_data);
+  MessageArena::Scope arena_scope;
+  ArenaType output_data;
+  Deserialize(&output_data, reader);
+  Payload check_buffer;
+  Serialize(output_data, &check_buffer);
+  T check_data;
+  Deserialize(&check_data, &check_buffer);
+  if (check_data != value)
+    return start - stop;  // Return negative value to indicate error.
+  return stop - start;
+}
+
 // Special version of SerializeTestRunner that doesn't perform any serialization
 // but does all the same setup steps and moves data of size |data_size| into
 // the output buffer. Useful to determine the baseline to calculate time used
@@ -246,6 +303,20 @@ class TestRunner {
                         std::move(deserialize_test), data_size);
   }
 
+  template <typename ArenaType, typename T>
+  void AddArenaDeserializationTest(const std::string& name, T&& value) {
+    using ValueType = typename std::decay<T>::type;
+    const size_t data_size = GetSerializedSize(value);
+    auto deserialize_test = std::bind(
+        static_cast<std::chrono::nanoseconds (*)(
+            MessageReader*, MessageWriter*, size_t, ResetFunc*, ResetFunc*,
+            void*, const ValueType&)>(
+            &ArenaDeserializeTestRunner<ArenaType, ValueType>),
+        _1, _2, _3, _4, _5, _6, std::forward<T>(value));
+    tests_.emplace_back(name, std::function<SerializeTestSignature>{},
+                        std::move(deserialize_test), data_size);
+  }
+
   template <typename T>
   void AddTest(const std::string& name, T&& value) {
     const size_t data_size = GetSerializedSize(value);
@@ -459,6 +530,18 @@ int main(int /*argc*/, char** /*argv*/) {
   test_runner.AddTest("tuple<int, bool, string, double>",
                       std::make_tuple(123, true, std::string{"foobar"}, 1.1));
 
+  // The same fields encoded element by element and as a fixed-layout block.
+  test_runner.AddTest(
+      "tuple<int64_t, int64_t, uint32_t, array<float, 4>, array<float, 3>>",
+      std::make_tuple(int64_t{16666666}, int64_t{123456789012345},
+                      uint32_t{4242},
+                      std::array<float, 4>{{0.f, 0.f, 0.f, 1.f}},
+                      std::array<float, 3>{{0.1f, 1.6f, -0.2f}}));
+  test_runner.AddTest(
+      "FixedLayoutStruct",
+      FixedLayoutStruct{16666666, 123456789012345, 4242, {{0.f, 0.f, 0.f, 1.f}},
+                        {{0.1f, 1.6f, -0.2f}}});
+
   for (size_t len : {0, 1, 8, 64}) {
     std::map<int, std::string> test_map;
     for (size_t i = 0; i < len; i++)
@@ -476,6 +559,47 @@ int main(int /*argc*/, char** /*argv*/) {
         std::move(test_map));
   }
 
+  // The same containers decoded into arena-backed types, for comparison with
+  // the deserialization numbers above.
+  for (size_t len : {8, 256, 10240}) {
+    test_runner.AddArenaDeserializationTest<ArenaString>(
+        GenerateContainerName("ArenaString", len), std::string(len, '*'));
+  }
+
+  for (size_t len : {8, 256}) {
+    std::vector<int32_t> int_vector(len);
+    std::iota(int_vector.begin(), int_vector.end(), 0);
+    test_runner.AddArenaDeserializationTest<ArenaVector<int32_t>>(
+        GenerateContainerName("ArenaVector<int32_t>", len),
+        std::move(int_vector));
+  }
+
+  std::vector<std::string> arena_vector_of_strings(
+      5, "012345678901234567890123456789");
+  test_runner.AddArenaDeserializationTest<ArenaVector<ArenaString>>(
+      GenerateContainerName("ArenaVector<ArenaString>",
+                            arena_vector_of_strings.size()),
+      std::move(arena_vector_of_strings));
+
+  for (size_t len : {8, 64}) {
+    std::map<int, std::string> test_map;
+    for (size_t i = 0; i < len; i++)
+      test_map.emplace(i, std::to_string(i));
+    test_runner.AddArenaDeserializationTest<ArenaMap<int, ArenaString>>(
+        GenerateContainerName("ArenaMap<int, ArenaString>", len),
+        std::move(test_map));
+  }
+
+  for (size_t len : {8, 64}) {
+    std::unordered_map<int, std::string> test_map;
+    for (size_t i = 0; i < len; i++)
+      test_map.emplace(i, std::to_string(i));
+    test_runner
+        .AddArenaDeserializationTest<ArenaUnorderedMap<int, ArenaString>>(
+            GenerateContainerName("ArenaUnorderedMap<int, ArenaString>", len),
+            std::move(test_map));
+  }
+
   // BufferWrapper can't be used with deserialization tests right now because
   // it requires external buffer to be filled in, which is not available.
   std::vector<std::vector<uint8_t>> data_buffers;
@@ -112,6 +112,7 @@ typedef std::uint8_t EncodingType;
 enum EncodingExtType : int8_t {
   ENCODING_EXT_TYPE_FILE_DESCRIPTOR,
   ENCODING_EXT_TYPE_CHANNEL_HANDLE,
+  ENCODING_EXT_TYPE_FIXED_LAYOUT,
 };
 
 // Encoding predicates. Determines whether the given encoding is of a specific
@@ -432,6 +433,28 @@ inline constexpr EncodingType EncodeBinType(std::size_t size) {
     return ENCODING_TYPE_BIN32;
 }
 
+inline constexpr EncodingType EncodeExtType(std::size_t size) {
+  switch (size) {
+    case 1:
+      return ENCODING_TYPE_FIXEXT1;
+    case 2:
+      return ENCODING_TYPE_FIXEXT2;
+    case 4:
+      return ENCODING_TYPE_FIXEXT4;
+    case 8:
+      return ENCODING_TYPE_FIXEXT8;
+    case 16:
+      return ENCODING_TYPE_FIXEXT16;
+    default:
+      if (size < (1U << 8))
+        return ENCODING_TYPE_EXT8;
+      else if (size < (1U << 16))
+        return ENCODING_TYPE_EXT16;
+      else
+        return ENCODING_TYPE_EXT32;
+  }
+}
+
 inline EncodingType EncodeType(const EmptyVariant& /*empty*/) {
   return ENCODING_TYPE_NIL;
 }
@@ -451,6 +474,12 @@ inline constexpr EncodingType EncodeType(const std::string& value) {
   return EncodeStringType(value.length());
 }
 
+template <typename Traits, typename Allocator>
+inline constexpr EncodingType EncodeType(
+    const std::basic_string<char, Traits, Allocator>& value) {
+  return EncodeStringType(value.length());
+}
+
 template <typename T, std::size_t Size>
 inline constexpr EncodingType EncodeType(const std::array<T, Size>& /*value*/) {
   return EncodeArrayType(Size);
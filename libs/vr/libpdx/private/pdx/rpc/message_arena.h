@@ -0,0 +1,232 @@
+#ifndef ANDROID_PDX_RPC_MESSAGE_ARENA_H_
+#define ANDROID_PDX_RPC_MESSAGE_ARENA_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace android {
+namespace pdx {
+namespace rpc {
+
+// Linear allocator backing the containers decoded from a single message.
+// Allocation bumps a pointer through a list of blocks; nothing is freed until
+// Reset(), which releases everything at once. When a message needed more than
+// one block, Reset() coalesces them into a single block of the combined size,
+// so a thread that keeps receiving similar messages stops calling into the
+// heap after the first few.
+class MessageArena {
+ public:
+  // Size of the first block allocated by an arena.
+  static constexpr std::size_t kInitialCapacity = 4096;
+
+  MessageArena() = default;
+  ~MessageArena() { FreeBlocks(); }
+
+  // Returns |size| bytes aligned to |alignment|, which must be a power of two
+  // no larger than alignof(std::max_align_t).
+  void* Allocate(std::size_t size, std::size_t alignment) {
+    std::size_t offset = AlignOffset(offset_, alignment);
+    if (!blocks_ || offset + size > blocks_->size) {
+      AddBlock(size);
+      offset = 0;
+    }
+    offset_ = offset + size;
+    return blocks_->data() + offset;
+  }
+
+  // Releases every allocation made since the last reset.
+  void Reset() {
+    if (blocks_ && blocks_->next) {
+      const std::size_t capacity = capacity_;
+      FreeBlocks();
+      AddBlock(capacity);
+    }
+    offset_ = 0;
+  }
+
+  // Total bytes held by the arena, whether in use or not.
+  std::size_t capacity() const { return capacity_; }
+
+  // Returns the arena made current by a Scope on the calling thread, or nullptr
+  // when there is none.
+  static MessageArena* Current() { return GetCurrent(); }
+
+  // Makes the calling thread's arena current for the lifetime of the scope and
+  // resets it on the way out. Scopes nest: inner scopes share the arena of the
+  // outermost one, which is the only one to reset it.
+  class Scope {
+   public:
+    Scope() : arena_(GetCurrent() ? nullptr : &GetThreadArena()) {
+      if (arena_)
+        GetCurrent() = arena_;
+    }
+    ~Scope() {
+      if (arena_) {
+        GetCurrent() = nullptr;
+        arena_->Reset();
+      }
+    }
+
+   private:
+    MessageArena* arena_;
+
+    Scope(const Scope&) = delete;
+    void operator=(const Scope&) = delete;
+  };
+
+ private:
+  struct alignas(std::max_align_t) Block {
+    Block* next;
+    std::size_t size;
+
+    std::uint8_t* data() { return reinterpret_cast<std::uint8_t*>(this + 1); }
+  };
+
+  static std::size_t AlignOffset(std::size_t offset, std::size_t alignment) {
+    return (offset + alignment - 1) & ~(alignment - 1);
+  }
+
+  // Blocks double the capacity of the arena so that a burst of allocations
+  // only takes a logarithmic number of trips to the heap.
+  void AddBlock(std::size_t min_size) {
+    std::size_t size = capacity_ > kInitialCapacity ? capacity_
+                                                    : kInitialCapacity;
+    if (size < min_size)
+      size = min_size;
+    Block* block =
+        static_cast<Block*>(::operator new(sizeof(Block) + size));
+    block->next = blocks_;
+    block->size = size;
+    blocks_ = block;
+    capacity_ += size;
+  }
+
+  void FreeBlocks() {
+    while (blocks_) {
+      Block* next = blocks_->next;
+      ::operator delete(blocks_);
+      blocks_ = next;
+    }
+    capacity_ = 0;
+    offset_ = 0;
+  }
+
+  // See ThreadLocalBuffer for why the arena is reached through a plain pointer
+  // with a separate std::unique_ptr guard.
+  static MessageArena*& GetCurrent() {
+    static thread_local MessageArena* current;
+    return current;
+  }
+
+  static MessageArena& GetThreadArena() {
+    static thread_local MessageArena* arena;
+    if (!arena) {
+      static thread_local std::unique_ptr<MessageArena> arena_guard;
+      arena_guard.reset(arena = new MessageArena);
+    }
+    return *arena;
+  }
+
+  Block* blocks_{nullptr};
+  std::size_t offset_{0};
+  std::size_t capacity_{0};
+
+  MessageArena(const MessageArena&) = delete;
+  void operator=(const MessageArena&) = delete;
+};
+
+// Allocator that takes its storage from the MessageArena current on the thread
+// that constructs it, or from the heap when no arena is active. Arena-backed
+// allocations are never freed individually; they go away in one step when the
+// outermost MessageArena::Scope ends, which for service handlers is right after
+// the handler returns and its reply was sent.
+//
+// Because the allocator is default constructible, containers using it can be
+// used directly as the argument types of service handlers: the argument decoder
+// default-constructs them while DispatchRemoteMethod holds a scope open. Such
+// arguments, and containers move-constructed from them, must not outlive the
+// handler. Copy- or move-assigning into a container created outside of the scope is
+// safe: allocators are not propagated on assignment, so the elements are
+// transferred into that container's own storage.
+template <typename T>
+class MessageArenaAllocator {
+ public:
+  using value_type = T;
+  using propagate_on_container_copy_assignment = std::false_type;
+  using propagate_on_container_move_assignment = std::false_type;
+  using propagate_on_container_swap = std::false_type;
+  using is_always_equal = std::false_type;
+
+  static_assert(alignof(T) <= alignof(std::max_align_t),
+                "Over-aligned types are not supported by MessageArena.");
+
+  MessageArenaAllocator() : arena_(MessageArena::Current()) {}
+  explicit MessageArenaAllocator(MessageArena* arena) : arena_(arena) {}
+  template <typename U>
+  MessageArenaAllocator(const MessageArenaAllocator<U>& other)
+      : arena_(other.arena()) {}
+
+  T* allocate(std::size_t n) {
+    if (arena_)
+      return static_cast<T*>(arena_->Allocate(n * sizeof(T), alignof(T)));
+    else
+      return static_cast<T*>(::operator new(n * sizeof(T)));
+  }
+
+  void deallocate(T* pointer, std::size_t /*n*/) {
+    if (!arena_)
+      ::operator delete(pointer);
+  }
+
+  MessageArena* arena() const { return arena_; }
+
+ private:
+  MessageArena* arena_;
+};
+
+template <typename T, typename U>
+inline bool operator==(const MessageArenaAllocator<T>& a,
+                       const MessageArenaAllocator<U>& b) {
+  return a.arena() == b.arena();
+}
+
+template <typename T, typename U>
+inline bool operator!=(const MessageArenaAllocator<T>& a,
+                       const MessageArenaAllocator<U>& b) {
+  return !(a == b);
+}
+
+// Arena-backed versions of the standard containers supported by the
+// serialization layer. These serialize to the same format as their standard
+// counterparts and are interchangeable with them in remote method signatures.
+template <typename T>
+using ArenaVector = std::vector<T, MessageArenaAllocator<T>>;
+
+using ArenaString = std::basic_string<char, std::char_traits<char>,
+                                      MessageArenaAllocator<char>>;
+
+template <typename Key, typename T, typename Compare = std::less<Key>>
+using ArenaMap =
+    std::map<Key, T, Compare,
+             MessageArenaAllocator<std::pair<const Key, T>>>;
+
+template <typename Key, typename T, typename Hash = std::hash<Key>,
+          typename KeyEqual = std::equal_to<Key>>
+using ArenaUnorderedMap =
+    std::unordered_map<Key, T, Hash, KeyEqual,
+                       MessageArenaAllocator<std::pair<const Key, T>>>;
+
+}  // namespace rpc
+}  // namespace pdx
+}  // namespace android
+
+#endif  // ANDROID_PDX_RPC_MESSAGE_ARENA_H_
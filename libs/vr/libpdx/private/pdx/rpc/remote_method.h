@@ -6,6 +6,7 @@
 
 #include <pdx/client.h>
 #include <pdx/rpc/argument_encoder.h>
+#include <pdx/rpc/message_arena.h>
 #include <pdx/rpc/message_buffer.h>
 #include <pdx/rpc/payload.h>
 #include <pdx/rpc/remote_method_type.h>
@@ -193,6 +194,9 @@ void DispatchRemoteMethod(Class& instance,
 
   payload.Resize(read_status.get());
 
+  // Arguments using MessageArenaAllocator are backed by this scope, which must
+  // outlive them and any return value built from them.
+  MessageArena::Scope arena_scope;
   ErrorType error;
   auto decoder = MakeArgumentDecoder<Signature>(&payload);
   auto arguments = decoder.DecodeArguments(&error);
@@ -229,6 +233,9 @@ void DispatchRemoteMethod(Class& instance,
 
   payload.Resize(read_status.get());
 
+  // Arguments using MessageArenaAllocator are backed by this scope, which must
+  // outlive them and any return value built from them.
+  MessageArena::Scope arena_scope;
   ErrorType error;
   auto decoder = MakeArgumentDecoder<Signature>(&payload);
   auto arguments = decoder.DecodeArguments(&error);
@@ -269,6 +276,9 @@ void DispatchRemoteMethod(Class& instance,
 
   payload.Resize(read_status.get());
 
+  // Arguments using MessageArenaAllocator are backed by this scope, which must
+  // outlive them and any return value built from them.
+  MessageArena::Scope arena_scope;
   ErrorType error;
   auto decoder = MakeArgumentDecoder<Signature>(&payload);
   auto arguments = decoder.DecodeArguments(&error);
@@ -1,9 +1,13 @@
 #ifndef ANDROID_PDX_RPC_SERIALIZABLE_H_
 #define ANDROID_PDX_RPC_SERIALIZABLE_H_
 
+#include <array>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <string>
 #include <tuple>
+#include <type_traits>
 
 #include <pdx/message_reader.h>
 #include <pdx/message_writer.h>
@@ -35,6 +39,9 @@ struct MemberPointer<Type Class::*, Pointer> {
   // Type of the member pointer this type represents.
   using PointerType = Type Class::*;
 
+  // Type of the member this type refers to.
+  using MemberType = Type;
+
   // Resolves a pointer to member with the given instance, yielding a
   // reference to the member in that instance.
   static Type& Resolve(Class& instance) { return (instance.*Pointer); }
@@ -43,6 +50,92 @@ struct MemberPointer<Type Class::*, Pointer> {
   }
 };
 
+// Fixed-layout encoding.
+//
+// When every serializable member of a type is a number, an enum, a bool, a
+// std::array of those, or another serializable type that qualifies, the members
+// are written back to back as raw bytes in a single extension block of type
+// ENCODING_EXT_TYPE_FIXED_LAYOUT instead of as a MessagePack array with one
+// element per member. The size of the block is a compile-time constant, so
+// encoding and decoding such types reduces to a handful of fixed-size copies.
+// This suits the small structs exchanged by hot RPCs, such as vsync info.
+//
+// FixedLayoutTraits<T> evaluates to true if values of type T can be part of a
+// fixed-layout block, and describes how they are laid out in it.
+template <typename T, typename Enabled = void>
+struct FixedLayoutTraits
+    : std::integral_constant<bool, std::is_arithmetic<T>::value ||
+                                       std::is_enum<T>::value> {
+  enum : std::size_t { Size = sizeof(T) };
+
+  static void Write(const T& value, void*& buffer) {
+    WriteRawData(buffer, &value, sizeof(T));
+  }
+  static void Read(T* value, const void*& buffer) {
+    std::memcpy(value, buffer, sizeof(T));
+    buffer = AdvancePointer(buffer, sizeof(T));
+  }
+};
+
+// Booleans are normalized on the way in, so that a peer can't produce a bool
+// with an invalid object representation.
+template <>
+struct FixedLayoutTraits<bool> : std::true_type {
+  enum : std::size_t { Size = 1 };
+
+  static void Write(const bool& value, void*& buffer) {
+    SerializeRaw(static_cast<std::uint8_t>(value), buffer);
+  }
+  static void Read(bool* value, const void*& buffer) {
+    *value = *static_cast<const std::uint8_t*>(buffer) != 0;
+    buffer = AdvancePointer(buffer, 1);
+  }
+};
+
+template <typename T, std::size_t ArraySize>
+struct FixedLayoutTraits<std::array<T, ArraySize>>
+    : std::integral_constant<bool, FixedLayoutTraits<T>::value> {
+  enum : std::size_t { Size = ArraySize * FixedLayoutTraits<T>::Size };
+
+  static void Write(const std::array<T, ArraySize>& value, void*& buffer) {
+    for (const auto& element : value)
+      FixedLayoutTraits<T>::Write(element, buffer);
+  }
+  static void Read(std::array<T, ArraySize>* value, const void*& buffer) {
+    for (auto& element : *value)
+      FixedLayoutTraits<T>::Read(&element, buffer);
+  }
+};
+
+template <typename T>
+struct FixedLayoutTraits<T, EnableIfHasSerializableMembers<T>>
+    : std::integral_constant<bool,
+                             SerializableTraits<T>::IsFixedLayout::value> {
+  enum : std::size_t { Size = SerializableTraits<T>::FixedLayoutSize };
+
+  static void Write(const T& value, void*& buffer) {
+    SerializableTraits<T>::WriteFixedLayout(value, buffer);
+  }
+  static void Read(T* value, const void*& buffer) {
+    SerializableTraits<T>::ReadFixedLayout(value, buffer);
+  }
+};
+
+// Combines FixedLayoutTraits over the member types of a serializable type.
+template <typename... Types>
+struct FixedLayoutMembers : std::true_type {
+  enum : std::size_t { Size = 0 };
+};
+template <typename First, typename... Rest>
+struct FixedLayoutMembers<First, Rest...>
+    : std::integral_constant<bool, FixedLayoutTraits<First>::value &&
+                                       FixedLayoutMembers<Rest...>::value> {
+  enum : std::size_t {
+    Size = static_cast<std::size_t>(FixedLayoutTraits<First>::Size) +
+           FixedLayoutMembers<Rest...>::Size
+  };
+};
+
 // Describes a set of members to be serialized/deserialized by this library. The
 // parameter pack MemberPointers takes a list of MemberPointer types that
 // describe each member to participate in serialization/deserialization.
@@ -56,6 +149,10 @@ struct SerializableMembersType {
   // The member pointers described by this type.
   using Members = std::tuple<MemberPointers...>;
 
+  // Whether and how the members fit the fixed-layout encoding.
+  using FixedLayout =
+      FixedLayoutMembers<typename MemberPointers::MemberType...>;
+
   // Accessor for individual member pointer types.
   template <std::size_t Index>
   using At = typename std::tuple_element<Index, Members>::type;
@@ -89,24 +186,81 @@ struct SerializableMembersType {
 
 template <typename T>
 class SerializableTraits {
+ private:
+  using SerializableMembers = typename T::SerializableMembers;
+
  public:
+  // Whether type T uses the fixed-layout encoding described above.
+  using IsFixedLayout = std::integral_constant<
+      bool, SerializableMembers::MemberCount != 0 &&
+                SerializableMembers::FixedLayout::value>;
+
+  // Size of the raw members of a fixed-layout type T, excluding the extension
+  // header.
+  enum : std::size_t {
+    FixedLayoutSize = SerializableMembers::FixedLayout::Size
+  };
+
   // Gets the serialized size of type T.
   static std::size_t GetSerializedSize(const T& value) {
-    return GetEncodingSize(EncodeArrayType(SerializableMembers::MemberCount)) +
-           GetMembersSize<SerializableMembers>(value);
+    return GetSerializedSize(value, IsFixedLayout{});
   }
 
   // Serializes type T.
   static void SerializeObject(const T& value, MessageWriter* writer,
                               void*& buffer) {
+    SerializeObject(value, writer, buffer, IsFixedLayout{});
+  }
+
+  // Deserializes type T.
+  static ErrorType DeserializeObject(T* value, MessageReader* reader,
+                                     const void*& start, const void* end) {
+    return DeserializeObject(value, reader, start, end, IsFixedLayout{});
+  }
+
+  // Writes and reads the raw members of a fixed-layout type T. The caller is
+  // responsible for the extension header and for bounds checking.
+  static void WriteFixedLayout(const T& value, void*& buffer) {
+    WriteFixedMember(value, buffer, Index<SerializableMembers::MemberCount>());
+  }
+  static void ReadFixedLayout(T* value, const void*& buffer) {
+    ReadFixedMember(value, buffer, Index<SerializableMembers::MemberCount>());
+  }
+
+ private:
+  static constexpr EncodingType FixedLayoutEncoding() {
+    return EncodeExtType(FixedLayoutSize);
+  }
+
+  static std::size_t GetSerializedSize(const T& value, std::false_type) {
+    return GetEncodingSize(EncodeArrayType(SerializableMembers::MemberCount)) +
+           GetMembersSize<SerializableMembers>(value);
+  }
+  static constexpr std::size_t GetSerializedSize(const T& /*value*/,
+                                                 std::true_type) {
+    // Unlike FIXEXT, the EXT encodings have a separate extension type byte.
+    return GetEncodingSize(FixedLayoutEncoding()) +
+           (IsFixextEncoding(FixedLayoutEncoding()) ? 0
+                                                    : sizeof(EncodingExtType)) +
+           FixedLayoutSize;
+  }
+
+  static void SerializeObject(const T& value, MessageWriter* writer,
+                              void*& buffer, std::false_type) {
     SerializeArrayEncoding(EncodeArrayType(SerializableMembers::MemberCount),
                            SerializableMembers::MemberCount, buffer);
     SerializeMembers<SerializableMembers>(value, writer, buffer);
   }
+  static void SerializeObject(const T& value, MessageWriter* /*writer*/,
+                              void*& buffer, std::true_type) {
+    SerializeExtEncoding(FixedLayoutEncoding(), ENCODING_EXT_TYPE_FIXED_LAYOUT,
+                         FixedLayoutSize, buffer);
+    WriteFixedLayout(value, buffer);
+  }
 
-  // Deserializes type T.
   static ErrorType DeserializeObject(T* value, MessageReader* reader,
-                                     const void*& start, const void* end) {
+                                     const void*& start, const void* end,
+                                     std::false_type) {
     EncodingType encoding;
     std::size_t size;
 
@@ -119,9 +273,49 @@ class SerializableTraits {
       return DeserializeMembers<SerializableMembers>(value, reader, start, end);
     }
   }
+  static ErrorType DeserializeObject(T* value, MessageReader* reader,
+                                     const void*& start, const void* end,
+                                     std::true_type) {
+    EncodingType encoding;
+    EncodingExtType type;
+    std::size_t size;
 
- private:
-  using SerializableMembers = typename T::SerializableMembers;
+    if (const auto error =
+            DeserializeExtType(&encoding, &type, &size, reader, start, end)) {
+      return error;
+    } else if (type != ENCODING_EXT_TYPE_FIXED_LAYOUT) {
+      return ErrorType(ErrorCode::UNEXPECTED_ENCODING, ENCODING_CLASS_EXTENSION,
+                       encoding);
+    } else if (size != FixedLayoutSize) {
+      return ErrorType(ErrorCode::UNEXPECTED_TYPE_SIZE,
+                       ENCODING_CLASS_EXTENSION, encoding);
+    } else if (AdvancePointer(start, size) > end) {
+      return ErrorCode::INSUFFICIENT_BUFFER;
+    } else {
+      ReadFixedLayout(value, start);
+      return ErrorCode::NO_ERROR;
+    }
+  }
+
+  static void WriteFixedMember(const T& /*value*/, void*& /*buffer*/,
+                               Index<0>) {}
+  template <std::size_t index>
+  static void WriteFixedMember(const T& value, void*& buffer, Index<index>) {
+    using Member = typename SerializableMembers::template At<index - 1>;
+    WriteFixedMember(value, buffer, Index<index - 1>());
+    FixedLayoutTraits<typename Member::MemberType>::Write(
+        Member::Resolve(value), buffer);
+  }
+
+  static void ReadFixedMember(T* /*value*/, const void*& /*buffer*/,
+                              Index<0>) {}
+  template <std::size_t index>
+  static void ReadFixedMember(T* value, const void*& buffer, Index<index>) {
+    using Member = typename SerializableMembers::template At<index - 1>;
+    ReadFixedMember(value, buffer, Index<index - 1>());
+    FixedLayoutTraits<typename Member::MemberType>::Read(
+        &Member::Resolve(*value), buffer);
+  }
 };
 
 // Utility macro to define a MemberPointer type for a member name.
@@ -48,7 +48,7 @@ namespace rpc {
 //   * char without signed/unsigned qualifiers.
 //   * bool.
 //   * std::vector with value type of any supported type, including nesting.
-//   * std::string.
+//   * std::string, and std::basic_string<char> with any traits and allocator.
 //   * std::tuple with elements of any supported type, including nesting.
 //   * std::pair with elements of any supported type, including nesting.
 //   * std::map with keys and values of any supported type, including nesting.
@@ -252,6 +252,9 @@ inline constexpr std::size_t GetSerializedSize(const T&);
 template <typename T>
 inline constexpr std::size_t GetSerializedSize(const PointerWrapper<T>&);
 inline constexpr std::size_t GetSerializedSize(const std::string&);
+template <typename Traits, typename Allocator>
+inline constexpr std::size_t GetSerializedSize(
+    const std::basic_string<char, Traits, Allocator>&);
 template <typename T>
 inline constexpr std::size_t GetSerializedSize(const StringWrapper<T>&);
 template <typename T>
@@ -310,6 +313,13 @@ inline constexpr std::size_t GetSerializedSize(const std::string& s) {
          s.length() * sizeof(std::string::value_type);
 }
 
+// Overload for std::basic_string with a non-default traits or allocator.
+template <typename Traits, typename Allocator>
+inline constexpr std::size_t GetSerializedSize(
+    const std::basic_string<char, Traits, Allocator>& s) {
+  return GetEncodingSize(EncodeType(s)) + s.length() * sizeof(char);
+}
+
 // Overload for StringWrapper.
 template <typename T>
 inline constexpr std::size_t GetSerializedSize(const StringWrapper<T>& s) {
@@ -540,6 +550,11 @@ inline void SerializeStringType(const StringType& value, void*& buffer) {
 inline void SerializeType(const std::string& value, void*& buffer) {
   SerializeStringType(value, buffer);
 }
+template <typename Traits, typename Allocator>
+inline void SerializeType(
+    const std::basic_string<char, Traits, Allocator>& value, void*& buffer) {
+  SerializeStringType(value, buffer);
+}
 template <typename T>
 inline void SerializeType(const StringWrapper<T>& value, void*& buffer) {
   SerializeStringType(value, buffer);
@@ -849,6 +864,9 @@ inline void SerializeObject(const BufferWrapper<std::vector<T, Allocator>>&, Mes
 template <typename T>
 inline void SerializeObject(const BufferWrapper<T*>&, MessageWriter*, void*&);
 inline void SerializeObject(const std::string&, MessageWriter*, void*&);
+template <typename Traits, typename Allocator>
+inline void SerializeObject(const std::basic_string<char, Traits, Allocator>&,
+                            MessageWriter*, void*&);
 template <typename T>
 inline void SerializeObject(const StringWrapper<T>&, MessageWriter*, void*&);
 template <typename T, typename Allocator>
@@ -953,6 +971,11 @@ inline void SerializeObject(const std::string& s, MessageWriter* /*writer*/,
                             void*& buffer) {
   SerializeString(s, buffer);
 }
+template <typename Traits, typename Allocator>
+inline void SerializeObject(const std::basic_string<char, Traits, Allocator>& s,
+                            MessageWriter* /*writer*/, void*& buffer) {
+  SerializeString(s, buffer);
+}
 template <typename T>
 inline void SerializeObject(const StringWrapper<T>& s,
                             MessageWriter* /*writer*/, void*& buffer) {
@@ -1397,6 +1420,9 @@ inline ErrorType DeserializeObject(BufferWrapper<T*>*, MessageReader*,
                                    const void*&, const void*&);
 inline ErrorType DeserializeObject(std::string*, MessageReader*, const void*&,
                                    const void*&);
+template <typename Traits, typename Allocator>
+inline ErrorType DeserializeObject(std::basic_string<char, Traits, Allocator>*,
+                                   MessageReader*, const void*&, const void*&);
 template <typename T>
 inline ErrorType DeserializeObject(StringWrapper<T>*, MessageReader*,
                                    const void*&, const void*&);
@@ -1628,8 +1654,9 @@ inline ErrorType DeserializeStringType(EncodingType* encoding,
   }
 }
 
-// Overload of DeserializeObject() for std::string types.
-inline ErrorType DeserializeObject(std::string* value, MessageReader* reader,
+// Deserializes the payload of std::basic_string types.
+template <typename StringType>
+inline ErrorType DeserializeString(StringType* value, MessageReader* reader,
                                    const void*& start, const void*& end) {
   EncodingType encoding;
   std::size_t size;
@@ -1646,6 +1673,21 @@ inline ErrorType DeserializeObject(std::string* value, MessageReader* reader,
   }
 }
 
+// Overload of DeserializeObject() for std::string types.
+inline ErrorType DeserializeObject(std::string* value, MessageReader* reader,
+                                   const void*& start, const void*& end) {
+  return DeserializeString(value, reader, start, end);
+}
+
+// Overload of DeserializeObject() for std::basic_string types with a
+// non-default traits or allocator, such as ArenaString.
+template <typename Traits, typename Allocator>
+inline ErrorType DeserializeObject(
+    std::basic_string<char, Traits, Allocator>* value, MessageReader* reader,
+    const void*& start, const void*& end) {
+  return DeserializeString(value, reader, start, end);
+}
+
 // Overload of DeserializeObject() for StringWrapper types.
 template <typename T>
 inline ErrorType DeserializeObject(StringWrapper<T>* value,
@@ -1722,7 +1764,9 @@ inline ErrorType DeserializeObject(std::vector<T, Allocator>* value,
           DeserializeArrayType(&encoding, &size, reader, start, end))
     return error;
 
-  std::vector<T, Allocator> result(size);
+  // Decode into storage from the destination's allocator, so that stateful
+  // allocators such as MessageArenaAllocator keep their arena.
+  std::vector<T, Allocator> result(size, value->get_allocator());
   for (std::size_t i = 0; i < size; i++) {
     if (const auto error = DeserializeObject(&result[i], reader, start, end))
       return error;
@@ -1800,7 +1844,7 @@ inline ErrorType DeserializeMap(MapType* value, MessageReader* reader,
           DeserializeMapType(&encoding, &size, reader, start, end))
     return error;
 
-  MapType result;
+  MapType result(value->get_allocator());
   for (std::size_t i = 0; i < size; i++) {
     std::pair<typename MapType::key_type, typename MapType::mapped_type>
         element;
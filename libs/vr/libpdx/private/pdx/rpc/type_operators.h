@@ -44,7 +44,8 @@ struct And<A, B, Rest...> : And<A, And<B, Rest...>> {};
 //    5. BufferWrapper<T*> is convertible to BufferWrapper<std::vector<T,
 //    Any...>>.
 //    6. BufferWrapper<std::vector<T, ...>> is convertible to BufferWrapper<T*>.
-//    7. The value type T of A and B must match.
+//    7. std::vector<T, Any...> is convertible to std::vector<T, Other...>.
+//    8. The value type T of A and B must match.
 
 // Compares A and B for convertibility. This base type determines convertibility
 // by equivalence of the underlying types of A and B. Specializations of this
@@ -94,6 +95,9 @@ struct IsConvertible<std::tuple<A...>, std::tuple<B...>>
 
 // Compares std::vector, std::array, and ArrayWrapper; these are convertible if
 // the value types are convertible.
+template <typename A, typename B, typename AllocatorA, typename AllocatorB>
+struct IsConvertible<std::vector<A, AllocatorA>, std::vector<B, AllocatorB>>
+    : IsConvertible<Decay<A>, Decay<B>> {};
 template <typename A, typename B, typename... Any>
 struct IsConvertible<std::vector<A, Any...>, ArrayWrapper<B>>
     : IsConvertible<Decay<A>, Decay<B>> {};
@@ -607,6 +607,14 @@ class Service : public std::enable_shared_from_this<Service> {
    */
   Status<void> ReceiveAndDispatch();
 
+  /*
+   * Dispatches a message received on this Service instance's endpoint.
+   * ReceiveAndDispatch() is Endpoint::MessageReceive() followed by this call;
+   * dispatchers that receive on one thread and handle the messages on others
+   * make the two calls separately.
+   */
+  Status<void> DispatchMessage(Message& message);
+
  private:
   friend class Message;
 
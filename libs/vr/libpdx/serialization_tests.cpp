@@ -2,6 +2,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 
+#include <array>
 #include <memory>
 #include <string>
 #include <thread>
@@ -11,6 +12,7 @@
 #include <pdx/rpc/argument_encoder.h>
 #include <pdx/rpc/array_wrapper.h>
 #include <pdx/rpc/default_initialization_allocator.h>
+#include <pdx/rpc/message_arena.h>
 #include <pdx/rpc/payload.h>
 #include <pdx/rpc/serializable.h>
 #include <pdx/rpc/serialization.h>
@@ -80,6 +82,35 @@ struct TestTemplateType {
   PDX_SERIALIZABLE_MEMBERS(TestTemplateType<FileHandleType>, fd);
 };
 
+// Types made only of fixed-size members, which use the fixed-layout encoding.
+struct FixedPoint {
+  std::int16_t x;
+  std::int16_t y;
+
+  bool operator==(const FixedPoint& other) const {
+    return x == other.x && y == other.y;
+  }
+
+ private:
+  PDX_SERIALIZABLE_MEMBERS(FixedPoint, x, y);
+};
+
+struct FixedType {
+  enum class Foo : std::uint8_t { kFoo, kBar, kBaz };
+
+  std::uint32_t a;
+  bool b;
+  Foo c;
+  std::array<FixedPoint, 2> d;
+
+  bool operator==(const FixedType& other) const {
+    return a == other.a && b == other.b && c == other.c && d == other.d;
+  }
+
+ private:
+  PDX_SERIALIZABLE_MEMBERS(FixedType, a, b, c, d);
+};
+
 // Utilities to generate test maps and payloads.
 template <typename MapType>
 MapType MakeMap(std::size_t size) {
@@ -1233,6 +1264,37 @@ TEST(SerializationTest, Serializable) {
   EXPECT_EQ(expected, result);
 }
 
+TEST(SerializationTest, FixedLayout) {
+  Payload result;
+  Payload expected;
+
+  static_assert(SerializableTraits<FixedPoint>::IsFixedLayout::value, "");
+  static_assert(SerializableTraits<FixedType>::IsFixedLayout::value, "");
+  static_assert(!SerializableTraits<TestType>::IsFixedLayout::value, "");
+  static_assert(!SerializableTraits<TestTemplateType<LocalHandle>>::
+                    IsFixedLayout::value,
+                "");
+  static_assert(SerializableTraits<FixedType>::FixedLayoutSize == 14, "");
+
+  // Sizes with a FIXEXT encoding.
+  FixedPoint p{1, -2};
+  Serialize(p, &result);
+  expected = {ENCODING_TYPE_FIXEXT4, ENCODING_EXT_TYPE_FIXED_LAYOUT, 1, 0, 0xfe,
+              0xff};
+  EXPECT_EQ(expected, result);
+  EXPECT_EQ(expected.Size(), GetSerializedSize(p));
+  result.Clear();
+
+  // Other sizes use EXT8/16/32, with nested types flattened into the block.
+  FixedType t{0x12345678, true, FixedType::Foo::kBaz, {{{1, 2}, {3, 4}}}};
+  Serialize(t, &result);
+  expected = decltype(expected)(
+      {ENCODING_TYPE_EXT8, 14, ENCODING_EXT_TYPE_FIXED_LAYOUT, 0x78, 0x56, 0x34,
+       0x12, 1, 2, 1, 0, 2, 0, 3, 0, 4, 0});
+  EXPECT_EQ(expected, result);
+  EXPECT_EQ(expected.Size(), GetSerializedSize(t));
+}
+
 TEST(SerializationTest, Variant) {
   Payload result;
   Payload expected;
@@ -2365,6 +2427,49 @@ TEST(DeserializationTest, Serializable) {
   EXPECT_EQ(TestTemplateType<LocalHandle>(LocalHandle(-1)), tt);
 }
 
+TEST(DeserializationTest, FixedLayout) {
+  Payload buffer;
+  ErrorType error;
+
+  FixedType expected{0x12345678, true, FixedType::Foo::kBar,
+                     {{{1, 2}, {3, 4}}}};
+  FixedType t;
+  Serialize(expected, &buffer);
+  error = Deserialize(&t, &buffer);
+  EXPECT_EQ(ErrorCode::NO_ERROR, error);
+  EXPECT_EQ(expected, t);
+
+  // Booleans are normalized.
+  buffer = {ENCODING_TYPE_EXT8, 14, ENCODING_EXT_TYPE_FIXED_LAYOUT, 0, 0, 0, 0,
+            0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+  error = Deserialize(&t, &buffer);
+  EXPECT_EQ(ErrorCode::NO_ERROR, error);
+  EXPECT_EQ(1, *reinterpret_cast<const std::uint8_t*>(&t.b));
+
+  // Size mismatch.
+  buffer = {ENCODING_TYPE_FIXEXT8, ENCODING_EXT_TYPE_FIXED_LAYOUT, 0, 0, 0, 0,
+            0, 0, 0, 0};
+  error = Deserialize(&t, &buffer);
+  EXPECT_EQ(ErrorCode::UNEXPECTED_TYPE_SIZE, error);
+
+  // Truncated block.
+  buffer = {ENCODING_TYPE_FIXEXT4, ENCODING_EXT_TYPE_FIXED_LAYOUT, 1, 0};
+  FixedPoint p;
+  error = Deserialize(&p, &buffer);
+  EXPECT_EQ(ErrorCode::INSUFFICIENT_BUFFER, error);
+
+  // Wrong extension type.
+  buffer = {ENCODING_TYPE_FIXEXT4, ENCODING_EXT_TYPE_CHANNEL_HANDLE, 0, 0, 0,
+            0};
+  error = Deserialize(&p, &buffer);
+  EXPECT_EQ(ErrorCode::UNEXPECTED_ENCODING, error);
+
+  // The regular encoding isn't accepted for fixed-layout types.
+  buffer = {ENCODING_TYPE_FIXARRAY_MIN + 2, 1, 2};
+  error = Deserialize(&p, &buffer);
+  EXPECT_EQ(ErrorCode::UNEXPECTED_ENCODING, error);
+}
+
 TEST(DeserializationTest, Variant) {
   Payload buffer;
   ErrorType error;
@@ -2503,3 +2608,98 @@ TEST(DeserializationTest, ErrorType) {
   error = Deserialize(&p, &buffer);
   EXPECT_EQ(ErrorCode::UNEXPECTED_TYPE_SIZE, error);
 }
+
+TEST(DeserializationTest, ArenaContainers) {
+  Payload buffer;
+  ErrorType error;
+
+  const std::vector<std::string> strings = {"foo", "bar",
+                                            std::string(1 << 8, 'x')};
+  const std::map<int, std::string> map = {{1, "one"}, {2, "two"}};
+
+  // Arena types serialize exactly like their standard counterparts.
+  Payload expected_buffer;
+  Serialize(strings, &expected_buffer);
+  Serialize(ArenaVector<ArenaString>(strings.begin(), strings.end()), &buffer);
+  EXPECT_EQ(expected_buffer, buffer);
+
+  // Without an active scope the allocator falls back to the heap.
+  EXPECT_EQ(nullptr, MessageArena::Current());
+  ArenaVector<ArenaString> heap_strings;
+  buffer.Rewind();
+  error = Deserialize(&heap_strings, &buffer);
+  EXPECT_EQ(ErrorCode::NO_ERROR, error);
+  EXPECT_EQ(nullptr, heap_strings.get_allocator().arena());
+  ASSERT_EQ(strings.size(), heap_strings.size());
+  for (std::size_t i = 0; i < strings.size(); i++)
+    EXPECT_EQ(strings[i], heap_strings[i].c_str());
+
+  {
+    MessageArena::Scope arena_scope;
+    MessageArena* arena = MessageArena::Current();
+    ASSERT_NE(nullptr, arena);
+
+    {
+      // Nested scopes share the outer arena.
+      MessageArena::Scope nested_scope;
+      EXPECT_EQ(arena, MessageArena::Current());
+    }
+    EXPECT_EQ(arena, MessageArena::Current());
+
+    ArenaVector<ArenaString> arena_strings;
+    buffer.Rewind();
+    error = Deserialize(&arena_strings, &buffer);
+    EXPECT_EQ(ErrorCode::NO_ERROR, error);
+    EXPECT_EQ(arena, arena_strings.get_allocator().arena());
+    ASSERT_EQ(strings.size(), arena_strings.size());
+    for (std::size_t i = 0; i < strings.size(); i++) {
+      EXPECT_EQ(strings[i], arena_strings[i].c_str());
+      EXPECT_EQ(arena, arena_strings[i].get_allocator().arena());
+    }
+
+    ArenaMap<int, ArenaString> arena_map;
+    buffer.Clear();
+    Serialize(map, &buffer);
+    error = Deserialize(&arena_map, &buffer);
+    EXPECT_EQ(ErrorCode::NO_ERROR, error);
+    EXPECT_EQ(arena, arena_map.get_allocator().arena());
+    ASSERT_EQ(map.size(), arena_map.size());
+    EXPECT_EQ("one", arena_map[1]);
+    EXPECT_EQ("two", arena_map[2]);
+
+    // Containers from outside the scope keep using the heap.
+    buffer.Rewind();
+    ArenaMap<int, ArenaString> heap_map{MessageArenaAllocator<int>(nullptr)};
+    error = Deserialize(&heap_map, &buffer);
+    EXPECT_EQ(ErrorCode::NO_ERROR, error);
+    EXPECT_EQ(nullptr, heap_map.get_allocator().arena());
+    EXPECT_EQ(map.size(), heap_map.size());
+
+    EXPECT_LE(MessageArena::kInitialCapacity, arena->capacity());
+  }
+  EXPECT_EQ(nullptr, MessageArena::Current());
+}
+
+TEST(MessageArenaTest, Reset) {
+  MessageArena arena;
+  EXPECT_EQ(0U, arena.capacity());
+
+  // Spill over several blocks.
+  const std::size_t kAllocationSize = MessageArena::kInitialCapacity / 2 + 1;
+  void* first = arena.Allocate(kAllocationSize, alignof(std::max_align_t));
+  for (int i = 0; i < 7; i++) {
+    void* pointer = arena.Allocate(kAllocationSize, alignof(std::max_align_t));
+    EXPECT_NE(first, pointer);
+    EXPECT_EQ(0U, reinterpret_cast<std::uintptr_t>(pointer) %
+                      alignof(std::max_align_t));
+  }
+  const std::size_t capacity = arena.capacity();
+  EXPECT_LE(8 * kAllocationSize, capacity);
+
+  // After a reset the same allocations fit in one block without growing.
+  arena.Reset();
+  EXPECT_EQ(capacity, arena.capacity());
+  for (int i = 0; i < 8; i++)
+    arena.Allocate(kAllocationSize, alignof(std::max_align_t));
+  EXPECT_EQ(capacity, arena.capacity());
+}
@@ -659,10 +659,14 @@ Status<void> Service::ReceiveAndDispatch() {
     return status;
   }
 
+  return DispatchMessage(message);
+}
+
+Status<void> Service::DispatchMessage(Message& message) {
   std::shared_ptr<Service> service = message.GetService();
 
   if (!service) {
-    ALOGE("Service::ReceiveAndDispatch: service context is NULL!!!\n");
+    ALOGE("Service::DispatchMessage: service context is NULL!!!\n");
     // Don't block the sender indefinitely in this error case.
     endpoint_->MessageReply(&message, -EINVAL);
     return ErrorStatus{EINVAL};
@@ -22,12 +22,14 @@ void ChannelManager::CloseHandle(int32_t handle) {
 }
 
 LocalChannelHandle ChannelManager::CreateHandle(LocalHandle data_fd,
-                                                LocalHandle event_fd) {
+                                                LocalHandle event_fd,
+                                                LocalHandle arena_fd) {
   if (data_fd && event_fd) {
     std::lock_guard<std::mutex> autolock(mutex_);
     int32_t handle = data_fd.Get();
-    channels_.emplace(handle,
-                      ChannelData{std::move(data_fd), std::move(event_fd)});
+    channels_.emplace(handle, ChannelData{std::move(data_fd),
+                                          std::move(event_fd),
+                                          PayloadArena{std::move(arena_fd)}});
     return LocalChannelHandle(this, handle);
   }
   return LocalChannelHandle(nullptr, -1);
@@ -33,7 +33,8 @@ struct TransactionState {
     } else if (static_cast<size_t>(index) < response.channels.size()) {
       auto& channel_info = response.channels[index];
       *handle = ChannelManager::Get().CreateHandle(
-          std::move(channel_info.data_fd), std::move(channel_info.event_fd));
+          std::move(channel_info.data_fd), std::move(channel_info.event_fd),
+          std::move(channel_info.arena_fd));
     } else {
       return false;
     }
@@ -56,6 +57,7 @@ struct TransactionState {
       ChannelInfo<BorrowedHandle> channel_info;
       channel_info.data_fd.Reset(handle.value());
       channel_info.event_fd = channel_data->event_receiver.event_fd();
+      channel_info.arena_fd = channel_data->arena.fd().Borrow();
       request.channels.push_back(std::move(channel_info));
       return request.channels.size() - 1;
     } else {
@@ -84,26 +86,75 @@ Status<void> ReadAndDiscardData(const BorrowedHandle& socket_fd, size_t size) {
 }
 
 Status<void> SendRequest(const BorrowedHandle& socket_fd,
-                         TransactionState* transaction_state, int opcode,
+                         TransactionState* transaction_state,
+                         PayloadArena* arena, int opcode,
                          const iovec* send_vector, size_t send_count,
                          size_t max_recv_len) {
   size_t send_len = CountVectorSize(send_vector, send_count);
-  InitRequest(&transaction_state->request, opcode, send_len, max_recv_len,
-              false);
-  auto status = SendData(socket_fd, transaction_state->request);
-  if (status && send_len > 0)
+  auto& request = transaction_state->request;
+  InitRequest(&request, opcode, send_len, max_recv_len, false);
+
+  // Only map the channel's shared region once a transaction could use it.
+  if (arena && (send_len >= PayloadArena::kThreshold ||
+                max_recv_len >= PayloadArena::kThreshold)) {
+    request.accepts_arena_reply = arena->GetRange(0, 0) != nullptr;
+    uint8_t* data = nullptr;
+    if (send_len >= PayloadArena::kThreshold && send_len <= PayloadArena::kSize)
+      data = static_cast<uint8_t*>(arena->GetRange(0, send_len));
+    if (data) {
+      for (size_t i = 0; i < send_count; i++) {
+        memcpy(data, send_vector[i].iov_base, send_vector[i].iov_len);
+        data += send_vector[i].iov_len;
+      }
+      request.arena_len = send_len;
+    }
+  }
+
+  auto status = SendData(socket_fd, request);
+  if (status && send_len > 0 && request.arena_len == 0)
     status = SendDataVector(socket_fd, send_vector, send_count);
   return status;
 }
 
+Status<void> ReceiveArenaResponse(const ResponseHeader<LocalHandle>& response,
+                                  PayloadArena* arena,
+                                  const iovec* receive_vector,
+                                  size_t receive_count) {
+  const uint8_t* data = nullptr;
+  if (arena && response.arena_len == response.recv_len) {
+    data = static_cast<const uint8_t*>(
+        arena->GetRange(response.arena_offset, response.arena_len));
+  }
+  if (!data)
+    return ErrorStatus(EIO);
+
+  size_t size_remaining = response.recv_len;
+  for (size_t i = 0; i < receive_count && size_remaining > 0; i++) {
+    size_t size_to_copy = std::min(size_remaining, receive_vector[i].iov_len);
+    memcpy(receive_vector[i].iov_base, data, size_to_copy);
+    data += size_to_copy;
+    size_remaining -= size_to_copy;
+  }
+  // Like ReadAndDiscardData(), report a reply that didn't fit as an error.
+  if (size_remaining > 0)
+    return ErrorStatus(EIO);
+  return {};
+}
+
 Status<void> ReceiveResponse(const BorrowedHandle& socket_fd,
                              TransactionState* transaction_state,
-                             const iovec* receive_vector, size_t receive_count,
-                             size_t max_recv_len) {
+                             PayloadArena* arena, const iovec* receive_vector,
+                             size_t receive_count, size_t max_recv_len) {
   auto status = ReceiveData(socket_fd, &transaction_state->response);
   if (!status)
     return status;
 
+  if (transaction_state->response.arena_len > 0) {
+    // The reply data was left in the channel's shared region.
+    return ReceiveArenaResponse(transaction_state->response, arena,
+                                receive_vector, receive_count);
+  }
+
   if (transaction_state->response.recv_len > 0) {
     std::vector<iovec> read_buffers;
     size_t size_remaining = 0;
@@ -185,12 +236,15 @@ Status<int> ClientChannel::SendAndReceive(void* transaction_state, int opcode,
 
   auto* state = static_cast<TransactionState*>(transaction_state);
   size_t max_recv_len = CountVectorSize(receive_vector, receive_count);
+  PayloadArena* arena = channel_data_ ? &channel_data_->arena : nullptr;
 
-  auto status = SendRequest(BorrowedHandle{channel_handle_.value()}, state,
-                            opcode, send_vector, send_count, max_recv_len);
+  auto status =
+      SendRequest(BorrowedHandle{channel_handle_.value()}, state, arena,
+                  opcode, send_vector, send_count, max_recv_len);
   if (status) {
     status = ReceiveResponse(BorrowedHandle{channel_handle_.value()}, state,
-                             receive_vector, receive_count, max_recv_len);
+                             arena, receive_vector, receive_count,
+                             max_recv_len);
   }
   if (!result.PropagateError(status)) {
     const int return_code = state->response.ret_code;
@@ -57,6 +57,7 @@ std::unique_ptr<pdx::ClientChannelFactory> ClientChannelFactory::Create(
 Status<std::unique_ptr<pdx::ClientChannel>> ClientChannelFactory::Connect(
     int64_t timeout_ms) const {
   Status<void> status;
+  LocalHandle arena_fd;
 
   bool connected = socket_.IsValid();
   if (!connected) {
@@ -128,6 +129,7 @@ Status<std::unique_ptr<pdx::ClientChannel>> ClientChannelFactory::Connect(
       if (!status)
         return status.error_status();
       socket_ = std::move(connection_info.channel_fd);
+      arena_fd = std::move(connection_info.arena_fd);
       if (!socket_) {
         ALOGE("ClientChannelFactory::Connect: Failed to obtain channel socket");
         return ErrorStatus(EIO);
@@ -152,7 +154,7 @@ Status<std::unique_ptr<pdx::ClientChannel>> ClientChannelFactory::Connect(
 
   LocalHandle event_fd = std::move(response.file_descriptors[ref]);
   return ClientChannel::Create(ChannelManager::Get().CreateHandle(
-      std::move(socket_), std::move(event_fd)));
+      std::move(socket_), std::move(event_fd), std::move(arena_fd)));
 }
 
 }  // namespace uds
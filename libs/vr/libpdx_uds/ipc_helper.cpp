@@ -6,11 +6,13 @@
 #include <poll.h>
 #include <string.h>
 #include <sys/inotify.h>
+#include <sys/mman.h>
 #include <sys/param.h>
 #include <sys/socket.h>
 
 #include <algorithm>
 
+#include <cutils/ashmem.h>
 #include <pdx/service.h>
 #include <pdx/utility.h>
 
@@ -356,6 +358,66 @@ bool ReceivePayload::GetChannelHandle(ChannelReference /*ref*/,
   return false;
 }
 
+PayloadArena::PayloadArena(PayloadArena&& other)
+    : fd_{std::move(other.fd_)},
+      mapping_{other.mapping_},
+      map_failed_{other.map_failed_} {
+  other.mapping_ = nullptr;
+}
+
+PayloadArena& PayloadArena::operator=(PayloadArena&& other) {
+  if (this != &other) {
+    if (mapping_)
+      munmap(mapping_, kSize);
+    fd_ = std::move(other.fd_);
+    mapping_ = other.mapping_;
+    map_failed_ = other.map_failed_;
+    other.mapping_ = nullptr;
+  }
+  return *this;
+}
+
+PayloadArena::~PayloadArena() {
+  if (mapping_)
+    munmap(mapping_, kSize);
+}
+
+LocalHandle PayloadArena::CreateRegion() {
+  LocalHandle fd{ashmem_create_region("pdx_uds_payload", kSize)};
+  if (!fd) {
+    ALOGE("PayloadArena::CreateRegion: Failed to create region: %s",
+          strerror(errno));
+  }
+  return fd;
+}
+
+void* PayloadArena::GetRange(uint32_t offset, uint32_t size) {
+  if (!fd_ || map_failed_ || offset > kSize || size > kSize - offset)
+    return nullptr;
+
+  if (!mapping_) {
+    // The region comes from the other end of the channel; don't map more than
+    // it actually has.
+    int region_size = ashmem_get_size_region(fd_.Get());
+    if (region_size < 0 || static_cast<size_t>(region_size) < kSize) {
+      ALOGE("PayloadArena::GetRange: Region has unexpected size %d",
+            region_size);
+      map_failed_ = true;
+      return nullptr;
+    }
+    void* mapping =
+        mmap(nullptr, kSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd_.Get(), 0);
+    if (mapping == MAP_FAILED) {
+      ALOGE("PayloadArena::GetRange: Failed to map region: %s",
+            strerror(errno));
+      map_failed_ = true;
+      return nullptr;
+    }
+    mapping_ = mapping;
+  }
+  return static_cast<uint8_t*>(mapping_) + offset;
+}
+
 Status<void> SendData(const BorrowedHandle& socket_fd, const void* data,
                       size_t size) {
   return SendAll(&g_socket_sender, socket_fd, data, size);
@@ -398,6 +460,9 @@ void InitRequest(android::pdx::uds::RequestHeader<BorrowedHandle>* request,
   request->send_len = send_len;
   request->max_recv_len = max_recv_len;
   request->is_impulse = is_impulse;
+  request->arena_offset = 0;
+  request->arena_len = 0;
+  request->accepts_arena_reply = false;
 }
 
 Status<void> WaitForEndpoint(const std::string& endpoint_path,
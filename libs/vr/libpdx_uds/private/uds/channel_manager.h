@@ -7,6 +7,7 @@
 #include <pdx/channel_handle.h>
 #include <pdx/file_handle.h>
 #include <uds/channel_event_set.h>
+#include <uds/ipc_helper.h>
 
 namespace android {
 namespace pdx {
@@ -16,10 +17,12 @@ class ChannelManager : public ChannelManagerInterface {
  public:
   static ChannelManager& Get();
 
-  LocalChannelHandle CreateHandle(LocalHandle data_fd, LocalHandle event_fd);
+  LocalChannelHandle CreateHandle(LocalHandle data_fd, LocalHandle event_fd,
+                                  LocalHandle arena_fd);
   struct ChannelData {
     LocalHandle data_fd;
     ChannelEventReceiver event_receiver;
+    PayloadArena arena;
   };
 
   ChannelData* GetChannelData(int32_t handle);
@@ -105,23 +105,66 @@ class ReceivePayload : public MessageReader, public InputResourceMapper {
   size_t read_pos_{0};
 };
 
+// Shared memory region for the large payloads of a channel. The endpoint
+// creates one per channel along with the channel socket pair, and the client
+// receives its fd together with the channel socket. Payloads of at least
+// kThreshold bytes are copied into the region and referenced by offset and
+// size from the request/response header, instead of being streamed through
+// the socket. A channel has at most one transaction in flight (the client
+// holds its socket lock until the reply arrives and the endpoint doesn't
+// re-arm the channel before replying), so both directions use the region
+// from offset 0. The region is only mapped the first time it is needed.
+class PayloadArena {
+ public:
+  enum : size_t {
+    kSize = 1024 * 1024,
+    kThreshold = 16 * 1024,
+  };
+
+  PayloadArena() = default;
+  explicit PayloadArena(LocalHandle fd) : fd_{std::move(fd)} {}
+  PayloadArena(PayloadArena&& other);
+  PayloadArena& operator=(PayloadArena&& other);
+  ~PayloadArena();
+
+  // Returns an empty handle if the region can't be created. Channels without
+  // a region send everything over the socket.
+  static LocalHandle CreateRegion();
+
+  const LocalHandle& fd() const { return fd_; }
+
+  // Returns the [offset, offset + size) range of the region, or nullptr if
+  // the channel has no usable region or the range is out of its bounds.
+  void* GetRange(uint32_t offset, uint32_t size);
+
+ private:
+  PayloadArena(const PayloadArena&) = delete;
+  void operator=(const PayloadArena&) = delete;
+
+  LocalHandle fd_;
+  void* mapping_{nullptr};
+  bool map_failed_{false};
+};
+
 template <typename FileHandleType>
 class ChannelInfo {
  public:
   FileHandleType data_fd;
   FileHandleType event_fd;
+  FileHandleType arena_fd;
 
  private:
-  PDX_SERIALIZABLE_MEMBERS(ChannelInfo, data_fd, event_fd);
+  PDX_SERIALIZABLE_MEMBERS(ChannelInfo, data_fd, event_fd, arena_fd);
 };
 
 template <typename FileHandleType>
 class ChannelConnectionInfo {
  public:
   FileHandleType channel_fd;
+  FileHandleType arena_fd;
 
  private:
-  PDX_SERIALIZABLE_MEMBERS(ChannelConnectionInfo, channel_fd);
+  PDX_SERIALIZABLE_MEMBERS(ChannelConnectionInfo, channel_fd, arena_fd);
 };
 
 template <typename FileHandleType>
@@ -135,11 +178,18 @@ class RequestHeader {
   std::vector<ChannelInfo<FileHandleType>> channels;
   std::array<uint8_t, 32> impulse_payload;
   bool is_impulse{false};
+  // When arena_len is non-zero, the send_len bytes of the request are in the
+  // channel's PayloadArena at arena_offset rather than after the header.
+  uint32_t arena_offset{0};
+  uint32_t arena_len{0};
+  // Set when the client has the arena mapped, so the reply may use it too.
+  bool accepts_arena_reply{false};
 
  private:
   PDX_SERIALIZABLE_MEMBERS(RequestHeader, op, send_len, max_recv_len,
                            file_descriptors, channels, impulse_payload,
-                           is_impulse);
+                           is_impulse, arena_offset, arena_len,
+                           accepts_arena_reply);
 };
 
 template <typename FileHandleType>
@@ -149,10 +199,13 @@ class ResponseHeader {
   uint32_t recv_len{0};
   std::vector<FileHandleType> file_descriptors;
   std::vector<ChannelInfo<FileHandleType>> channels;
+  // Same as in RequestHeader, for the recv_len bytes of the reply.
+  uint32_t arena_offset{0};
+  uint32_t arena_len{0};
 
  private:
   PDX_SERIALIZABLE_MEMBERS(ResponseHeader, ret_code, recv_len, file_descriptors,
-                           channels);
+                           channels, arena_offset, arena_len);
 };
 
 template <typename T>
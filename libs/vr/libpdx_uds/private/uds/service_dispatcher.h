@@ -1,12 +1,17 @@
 #ifndef ANDROID_PDX_UDS_SERVICE_DISPATCHER_H_
 #define ANDROID_PDX_UDS_SERVICE_DISPATCHER_H_
 
+#include <chrono>
+#include <deque>
 #include <list>
 #include <memory>
 #include <mutex>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 #include <pdx/file_handle.h>
+#include <pdx/service.h>
 #include <pdx/service_dispatcher.h>
 
 namespace android {
@@ -18,6 +23,30 @@ class ServiceDispatcher : public pdx::ServiceDispatcher {
   // Get a new instance of ServiceDispatcher, or return nullptr if init failed.
   static std::unique_ptr<pdx::ServiceDispatcher> Create();
 
+  // Get a new instance of ServiceDispatcher that hands the messages it
+  // receives over to |worker_count| worker threads, or return nullptr if init
+  // failed. All the messages of a channel go to the same worker, so as long
+  // as a single thread receives (e.g. in EnterDispatchLoop()) they are handled
+  // in the order they were sent, while other channels are handled in
+  // parallel. The services added to such a dispatcher must be safe to call
+  // from several threads. The workers inherit the scheduling policy of the
+  // calling thread.
+  static std::unique_ptr<ServiceDispatcher> CreateWithWorkers(
+      size_t worker_count);
+
+  // Queueing delay of the messages handed over to a worker, measured from the
+  // time they were received to the time the worker started handling them.
+  struct QueueStats {
+    uint64_t message_count{0};
+    uint64_t total_delay_ns{0};
+    uint64_t max_delay_ns{0};
+    size_t max_depth{0};
+  };
+
+  // Returns the statistics of each worker thread; empty if the dispatcher
+  // handles messages on the receiving threads.
+  std::vector<QueueStats> GetQueueStats() const;
+
   ~ServiceDispatcher() override;
   int AddService(const std::shared_ptr<Service>& service) override;
   int RemoveService(const std::shared_ptr<Service>& service) override;
@@ -30,10 +59,31 @@ class ServiceDispatcher : public pdx::ServiceDispatcher {
  private:
   ServiceDispatcher();
 
+  struct QueuedMessage {
+    std::shared_ptr<Service> service;
+    Message message;
+    std::chrono::steady_clock::time_point receive_time;
+  };
+
+  struct Worker {
+    std::thread thread;
+    std::mutex mutex;
+    // Signaled both when a message is queued and when one is taken.
+    std::condition_variable condition;
+    std::deque<QueuedMessage> queue;
+    QueueStats stats;
+    bool quit{false};
+  };
+
   // Internal thread accounting.
   int ThreadEnter();
   void ThreadExit();
 
+  // Receives one message from |service| and handles it, or queues it to the
+  // worker of its channel.
+  void HandleServiceEvent(Service* service);
+  void WorkerLoop(Worker* worker);
+
   std::mutex mutex_;
   std::condition_variable condition_;
   std::atomic<bool> canceled_{false};
@@ -44,6 +94,10 @@ class ServiceDispatcher : public pdx::ServiceDispatcher {
   LocalHandle event_fd_;
   LocalHandle epoll_fd_;
 
+  std::vector<std::unique_ptr<Worker>> workers_;
+  // Messages queued to or being handled by the workers.
+  std::atomic<size_t> pending_messages_{0};
+
   ServiceDispatcher(const ServiceDispatcher&) = delete;
   void operator=(const ServiceDispatcher&) = delete;
 };
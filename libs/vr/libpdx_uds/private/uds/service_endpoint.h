@@ -12,6 +12,7 @@
 #include <pdx/service.h>
 #include <pdx/service_endpoint.h>
 #include <uds/channel_event_set.h>
+#include <uds/ipc_helper.h>
 #include <uds/service_dispatcher.h>
 
 namespace android {
@@ -112,6 +113,7 @@ class Endpoint : public pdx::Endpoint {
     LocalHandle data_fd;
     ChannelEventSet event_set;
     Channel* channel_state{nullptr};
+    std::shared_ptr<PayloadArena> arena;
   };
 
   // This class must be instantiated using Create() static methods above.
@@ -133,17 +135,19 @@ class Endpoint : public pdx::Endpoint {
   Status<void> AcceptConnection(Message* message);
   Status<void> ReceiveMessageForChannel(const BorrowedHandle& channel_fd,
                                         Message* message);
-  Status<void> OnNewChannel(LocalHandle channel_fd);
+  Status<void> OnNewChannel(LocalHandle channel_fd, LocalHandle arena_fd);
   Status<std::pair<int32_t, ChannelData*>> OnNewChannelLocked(
-      LocalHandle channel_fd, Channel* channel_state);
+      LocalHandle channel_fd, LocalHandle arena_fd, Channel* channel_state);
   Status<void> CloseChannelLocked(int32_t channel_id);
   Status<void> ReenableEpollEvent(const BorrowedHandle& channel_fd);
   Channel* GetChannelState(int32_t channel_id);
   BorrowedHandle GetChannelSocketFd(int32_t channel_id);
   BorrowedHandle GetChannelEventFd(int32_t channel_id);
+  std::shared_ptr<PayloadArena> GetChannelArena(int32_t channel_id);
   int32_t GetChannelId(const BorrowedHandle& channel_fd);
   Status<void> CreateChannelSocketPair(LocalHandle* local_socket,
-                                       LocalHandle* remote_socket);
+                                       LocalHandle* remote_socket,
+                                       LocalHandle* arena_fd);
 
   std::string endpoint_path_;
   bool is_blocking_;
@@ -4,6 +4,7 @@
 
 #include <array>
 #include <cstdint>
+#include <map>
 #include <memory>
 #include <numeric>
 #include <string>
@@ -12,6 +13,7 @@
 #include <gtest/gtest.h>
 #include <pdx/channel_handle.h>
 #include <pdx/client.h>
+#include <pdx/rpc/message_arena.h>
 #include <pdx/rpc/remote_method.h>
 #include <pdx/rpc/serializable.h>
 #include <pdx/service.h>
@@ -150,6 +152,7 @@ struct TestInterface final {
     kOpReadFile,
     kOpPushChannel,
     kOpPositive,
+    kOpCountWords,
   };
 
   // Methods.
@@ -178,10 +181,14 @@ struct TestInterface final {
                         const std::string&, int, std::size_t));
   PDX_REMOTE_METHOD(PushChannel, kOpPushChannel, LocalChannelHandle(Void));
   PDX_REMOTE_METHOD(Positive, kOpPositive, void(int));
+  PDX_REMOTE_METHOD(
+      CountWords, kOpCountWords,
+      std::map<std::string, int>(const std::vector<std::string>&));
 
   PDX_REMOTE_API(API, Add, Foo, Concatenate, SumVector, StringLength,
                  SendTestType, SendVector, Rot13, NoArgs, SendFile, GetFile,
-                 GetTestFdType, OpenFiles, PushChannel, Positive);
+                 GetTestFdType, OpenFiles, PushChannel, Positive,
+                 CountWords);
 };
 
 constexpr char TestInterface::kClientPath[];
@@ -323,6 +330,15 @@ class TestClient : public ClientBase<TestClient> {
     return status.ok();
   }
 
+  std::map<std::string, int> CountWords(const std::vector<std::string>& words) {
+    Status<std::map<std::string, int>> status =
+        InvokeRemoteMethod<TestInterface::CountWords>(words);
+    if (!status)
+      return {};
+    else
+      return status.take();
+  }
+
   int GetFd() const { return event_fd(); }
 
  private:
@@ -424,6 +440,11 @@ class TestService : public ServiceBase<TestService> {
             *this, &TestService::OnPositive, message);
         return {};
 
+      case TestInterface::CountWords::Opcode:
+        DispatchRemoteMethod<TestInterface::CountWords>(
+            *this, &TestService::OnCountWords, message);
+        return {};
+
       default:
         return Service::DefaultHandleMessage(message);
     }
@@ -539,6 +560,18 @@ class TestService : public ServiceBase<TestService> {
       return ErrorStatus(EINVAL);
   }
 
+  // Decodes into and replies from containers backed by the message arena.
+  ArenaMap<ArenaString, int> OnCountWords(
+      Message&, const ArenaVector<ArenaString>& words) {
+    ArenaMap<ArenaString, int> counts;
+    for (const auto& word : words) {
+      if (word.get_allocator().arena() != MessageArena::Current())
+        return {};
+      counts[word]++;
+    }
+    return counts;
+  }
+
   TestService(const TestService&) = delete;
   void operator=(const TestService&) = delete;
 };
@@ -721,6 +754,27 @@ TEST_F(RemoteMethodTest, Positive) {
   ASSERT_FALSE(client->Positive(-1));
 }
 
+TEST_F(RemoteMethodTest, ArenaArguments) {
+  // Create a test service and add it to the dispatcher.
+  auto service = TestService::Create();
+  ASSERT_NE(nullptr, service);
+  ASSERT_EQ(0, dispatcher_->AddService(service));
+
+  // Create a client to service.
+  auto client = TestClient::Create();
+  ASSERT_NE(nullptr, client);
+
+  const std::vector<std::string> words = {"one", "two", "two",
+                                          std::string(1 << 8, 'x')};
+  const std::map<std::string, int> expected = {
+      {"one", 1}, {"two", 2}, {std::string(1 << 8, 'x'), 1}};
+  EXPECT_EQ(expected, client->CountWords(words));
+
+  // The same arena serves the next message.
+  EXPECT_EQ(expected, client->CountWords(words));
+  EXPECT_TRUE(client->CountWords({}).empty());
+}
+
 TEST_F(RemoteMethodTest, AggregateLocalHandle) {
   // Create a test service and add it to the dispatcher.
   auto service = TestService::Create();
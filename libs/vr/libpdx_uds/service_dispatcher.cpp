@@ -5,11 +5,21 @@
 #include <sys/epoll.h>
 #include <sys/eventfd.h>
 
+#include <algorithm>
+
 #include "pdx/service.h"
 #include "uds/service_endpoint.h"
 
 static const int kMaxEventsPerLoop = 128;
 
+// Past this, the receiving thread waits for the worker to catch up instead of
+// queueing more, which is what the dispatcher would do without workers.
+static const size_t kMaxQueuedMessagesPerWorker = 256;
+
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+
 namespace android {
 namespace pdx {
 namespace uds {
@@ -23,6 +33,21 @@ std::unique_ptr<pdx::ServiceDispatcher> ServiceDispatcher::Create() {
   return std::move(dispatcher);
 }
 
+std::unique_ptr<ServiceDispatcher> ServiceDispatcher::CreateWithWorkers(
+    size_t worker_count) {
+  std::unique_ptr<ServiceDispatcher> dispatcher{new ServiceDispatcher()};
+  if (!dispatcher->epoll_fd_ || !dispatcher->event_fd_ || worker_count == 0)
+    return nullptr;
+
+  for (size_t i = 0; i < worker_count; i++) {
+    dispatcher->workers_.emplace_back(new Worker);
+    Worker* worker = dispatcher->workers_.back().get();
+    worker->thread =
+        std::thread(&ServiceDispatcher::WorkerLoop, dispatcher.get(), worker);
+  }
+  return dispatcher;
+}
+
 ServiceDispatcher::ServiceDispatcher() {
   event_fd_.Reset(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
   if (!event_fd_) {
@@ -51,7 +76,18 @@ ServiceDispatcher::ServiceDispatcher() {
   }
 }
 
-ServiceDispatcher::~ServiceDispatcher() { SetCanceled(true); }
+ServiceDispatcher::~ServiceDispatcher() {
+  SetCanceled(true);
+
+  // Let the workers finish what was already handed over to them.
+  for (auto& worker : workers_) {
+    std::lock_guard<std::mutex> autolock(worker->mutex);
+    worker->quit = true;
+    worker->condition.notify_all();
+  }
+  for (auto& worker : workers_)
+    worker->thread.join();
+}
 
 int ServiceDispatcher::ThreadEnter() {
   std::lock_guard<std::mutex> autolock(mutex_);
@@ -97,7 +133,7 @@ int ServiceDispatcher::RemoveService(const std::shared_ptr<Service>& service) {
   std::lock_guard<std::mutex> autolock(mutex_);
 
   // It's dangerous to remove a service while other threads may be using it.
-  if (thread_count_ > 0)
+  if (thread_count_ > 0 || pending_messages_ > 0)
     return -EBUSY;
 
   epoll_event dummy;  // See BUGS in man 2 epoll_ctl.
@@ -136,11 +172,7 @@ int ServiceDispatcher::ReceiveAndDispatch(int timeout) {
       ThreadExit();
       return -EBUSY;
     } else {
-      Service* service = static_cast<Service*>(events[i].data.ptr);
-
-      ALOGI_IF(TRACE, "Dispatching message: fd=%d\n",
-               static_cast<Endpoint*>(service->endpoint())->epoll_fd());
-      service->ReceiveAndDispatch();
+      HandleServiceEvent(static_cast<Service*>(events[i].data.ptr));
     }
   }
 
@@ -168,11 +200,7 @@ int ServiceDispatcher::EnterDispatchLoop() {
         ThreadExit();
         return -EBUSY;
       } else {
-        Service* service = static_cast<Service*>(events[i].data.ptr);
-
-        ALOGI_IF(TRACE, "Dispatching message: fd=%d\n",
-                 static_cast<Endpoint*>(service->endpoint())->epoll_fd());
-        service->ReceiveAndDispatch();
+        HandleServiceEvent(static_cast<Service*>(events[i].data.ptr));
       }
     }
   }
@@ -181,6 +209,78 @@ int ServiceDispatcher::EnterDispatchLoop() {
   return 0;
 }
 
+void ServiceDispatcher::HandleServiceEvent(Service* service) {
+  ALOGI_IF(TRACE, "Dispatching message: fd=%d\n",
+           static_cast<Endpoint*>(service->endpoint())->epoll_fd());
+  if (workers_.empty()) {
+    service->ReceiveAndDispatch();
+    return;
+  }
+
+  Message message;
+  const auto status = service->endpoint()->MessageReceive(&message);
+  if (!status) {
+    ALOGE("Failed to receive message: %s\n", status.GetErrorMessage().c_str());
+    return;
+  }
+
+  // Channel ids are handed out in sequence, which spreads the channels evenly
+  // over the workers.
+  const uint32_t channel_id = static_cast<uint32_t>(message.GetChannelId());
+  Worker* worker = workers_[channel_id % workers_.size()].get();
+
+  std::unique_lock<std::mutex> lock(worker->mutex);
+  worker->condition.wait(lock, [worker] {
+    return worker->queue.size() < kMaxQueuedMessagesPerWorker;
+  });
+  pending_messages_++;
+  worker->queue.push_back(QueuedMessage{service->shared_from_this(),
+                                        std::move(message),
+                                        steady_clock::now()});
+  worker->stats.max_depth =
+      std::max(worker->stats.max_depth, worker->queue.size());
+  worker->condition.notify_all();
+}
+
+void ServiceDispatcher::WorkerLoop(Worker* worker) {
+  std::unique_lock<std::mutex> lock(worker->mutex);
+  for (;;) {
+    worker->condition.wait(
+        lock, [worker] { return worker->quit || !worker->queue.empty(); });
+    if (worker->queue.empty())
+      return;
+
+    QueuedMessage queued = std::move(worker->queue.front());
+    worker->queue.pop_front();
+    const uint64_t delay_ns =
+        duration_cast<nanoseconds>(steady_clock::now() - queued.receive_time)
+            .count();
+    worker->stats.message_count++;
+    worker->stats.total_delay_ns += delay_ns;
+    worker->stats.max_delay_ns = std::max(worker->stats.max_delay_ns, delay_ns);
+    worker->condition.notify_all();
+    lock.unlock();
+
+    queued.service->DispatchMessage(queued.message);
+    // Let the message reply, if the service didn't, before the service can be
+    // removed.
+    queued = QueuedMessage{};
+    pending_messages_--;
+
+    lock.lock();
+  }
+}
+
+std::vector<ServiceDispatcher::QueueStats> ServiceDispatcher::GetQueueStats()
+    const {
+  std::vector<QueueStats> stats;
+  for (const auto& worker : workers_) {
+    std::lock_guard<std::mutex> autolock(worker->mutex);
+    stats.push_back(worker->stats);
+  }
+  return stats;
+}
+
 void ServiceDispatcher::SetCanceled(bool cancel) {
   std::unique_lock<std::mutex> lock(mutex_);
   canceled_ = cancel;
@@ -30,6 +30,7 @@ using android::pdx::LocalHandle;
 using android::pdx::Status;
 using android::pdx::uds::ChannelInfo;
 using android::pdx::uds::ChannelManager;
+using android::pdx::uds::PayloadArena;
 
 struct MessageState {
   bool GetLocalFileHandle(int index, LocalHandle* handle) {
@@ -49,7 +50,8 @@ struct MessageState {
     } else if (static_cast<size_t>(index) < request.channels.size()) {
       auto& channel_info = request.channels[index];
       *handle = ChannelManager::Get().CreateHandle(
-          std::move(channel_info.data_fd), std::move(channel_info.event_fd));
+          std::move(channel_info.data_fd), std::move(channel_info.event_fd),
+          std::move(channel_info.arena_fd));
     } else {
       return false;
     }
@@ -72,6 +74,7 @@ struct MessageState {
       ChannelInfo<BorrowedHandle> channel_info;
       channel_info.data_fd.Reset(handle.value());
       channel_info.event_fd = channel_data->event_receiver.event_fd();
+      channel_info.arena_fd = channel_data->arena.fd().Borrow();
       response.channels.push_back(std::move(channel_info));
       return response.channels.size() - 1;
     } else {
@@ -80,12 +83,14 @@ struct MessageState {
   }
 
   Status<ChannelReference> PushChannelHandle(BorrowedHandle data_fd,
-                                             BorrowedHandle event_fd) {
+                                             BorrowedHandle event_fd,
+                                             BorrowedHandle arena_fd) {
     if (!data_fd || !event_fd)
       return ErrorStatus{EINVAL};
     ChannelInfo<BorrowedHandle> channel_info;
     channel_info.data_fd = std::move(data_fd);
     channel_info.event_fd = std::move(event_fd);
+    channel_info.arena_fd = std::move(arena_fd);
     response.channels.push_back(std::move(channel_info));
     return response.channels.size() - 1;
   }
@@ -226,19 +231,22 @@ Status<void> Endpoint::AcceptConnection(Message* message) {
 
   LocalHandle local_socket;
   LocalHandle remote_socket;
-  auto status = CreateChannelSocketPair(&local_socket, &remote_socket);
+  LocalHandle arena_fd;
+  auto status =
+      CreateChannelSocketPair(&local_socket, &remote_socket, &arena_fd);
   if (!status)
     return status;
 
-  // Borrow the local channel handle before we move it into OnNewChannel().
+  // Send the channel socket fd and the payload arena fd to the client.
+  // Borrow them before they're moved into OnNewChannel().
+  ChannelConnectionInfo<BorrowedHandle> connection_info;
+  connection_info.channel_fd = remote_socket.Borrow();
+  connection_info.arena_fd = arena_fd.Borrow();
   BorrowedHandle channel_handle = local_socket.Borrow();
-  status = OnNewChannel(std::move(local_socket));
+  status = OnNewChannel(std::move(local_socket), std::move(arena_fd));
   if (!status)
     return status;
 
-  // Send the channel socket fd to the client.
-  ChannelConnectionInfo<LocalHandle> connection_info;
-  connection_info.channel_fd = std::move(remote_socket);
   status = SendData(connection_fd.Borrow(), connection_info);
 
   if (status) {
@@ -268,15 +276,17 @@ Status<void> Endpoint::SetChannel(int channel_id, Channel* channel) {
   return {};
 }
 
-Status<void> Endpoint::OnNewChannel(LocalHandle channel_fd) {
+Status<void> Endpoint::OnNewChannel(LocalHandle channel_fd,
+                                    LocalHandle arena_fd) {
   std::lock_guard<std::mutex> autolock(channel_mutex_);
   Status<void> status;
-  status.PropagateError(OnNewChannelLocked(std::move(channel_fd), nullptr));
+  status.PropagateError(
+      OnNewChannelLocked(std::move(channel_fd), std::move(arena_fd), nullptr));
   return status;
 }
 
 Status<std::pair<int32_t, Endpoint::ChannelData*>> Endpoint::OnNewChannelLocked(
-    LocalHandle channel_fd, Channel* channel_state) {
+    LocalHandle channel_fd, LocalHandle arena_fd, Channel* channel_state) {
   epoll_event event;
   event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
   event.data.fd = channel_fd.Get();
@@ -290,6 +300,8 @@ Status<std::pair<int32_t, Endpoint::ChannelData*>> Endpoint::OnNewChannelLocked(
   channel_data.event_set.AddDataFd(channel_fd);
   channel_data.data_fd = std::move(channel_fd);
   channel_data.channel_state = channel_state;
+  if (arena_fd)
+    channel_data.arena = std::make_shared<PayloadArena>(std::move(arena_fd));
   for (;;) {
     // Try new channel IDs until we find one which is not already in the map.
     if (last_channel_id_++ == std::numeric_limits<int32_t>::max())
@@ -363,7 +375,8 @@ Status<void> Endpoint::ModifyChannelEvents(int channel_id, int clear_mask,
 }
 
 Status<void> Endpoint::CreateChannelSocketPair(LocalHandle* local_socket,
-                                               LocalHandle* remote_socket) {
+                                               LocalHandle* remote_socket,
+                                               LocalHandle* arena_fd) {
   Status<void> status;
   char* endpoint_context = nullptr;
   // Make sure the channel socket has the correct SELinux label applied.
@@ -416,7 +429,11 @@ Status<void> Endpoint::CreateChannelSocketPair(LocalHandle* local_socket,
         "the credentials for channel %d: %s",
         local_socket->Get(), strerror(errno));
     status.SetError(errno);
+    return status;
   }
+
+  // Not having a payload arena only means large messages go over the socket.
+  *arena_fd = PayloadArena::CreateRegion();
   return status;
 }
 
@@ -426,12 +443,15 @@ Status<RemoteChannelHandle> Endpoint::PushChannel(Message* message,
                                                   int* channel_id) {
   LocalHandle local_socket;
   LocalHandle remote_socket;
-  auto status = CreateChannelSocketPair(&local_socket, &remote_socket);
+  LocalHandle arena_fd;
+  auto status =
+      CreateChannelSocketPair(&local_socket, &remote_socket, &arena_fd);
   if (!status)
     return status.error_status();
 
   std::lock_guard<std::mutex> autolock(channel_mutex_);
-  auto channel_data = OnNewChannelLocked(std::move(local_socket), channel);
+  auto channel_data = OnNewChannelLocked(std::move(local_socket),
+                                         std::move(arena_fd), channel);
   if (!channel_data)
     return channel_data.error_status();
   *channel_id = channel_data.get().first;
@@ -440,9 +460,11 @@ Status<RemoteChannelHandle> Endpoint::PushChannel(Message* message,
   // TODO(xiaohuit): Implement those.
 
   auto* state = static_cast<MessageState*>(message->GetState());
+  auto& arena = channel_data.get().second->arena;
   Status<ChannelReference> ref = state->PushChannelHandle(
       remote_socket.Borrow(),
-      channel_data.get().second->event_set.event_fd().Borrow());
+      channel_data.get().second->event_set.event_fd().Borrow(),
+      arena ? arena->fd().Borrow() : BorrowedHandle{});
   if (!ref)
     return ref.error_status();
   state->sockets_to_close.push_back(std::move(remote_socket));
@@ -481,6 +503,13 @@ BorrowedHandle Endpoint::GetChannelEventFd(int32_t channel_id) {
   return handle;
 }
 
+std::shared_ptr<PayloadArena> Endpoint::GetChannelArena(int32_t channel_id) {
+  std::lock_guard<std::mutex> autolock(channel_mutex_);
+  auto channel_data = channels_.find(channel_id);
+  return (channel_data != channels_.end()) ? channel_data->second.arena
+                                           : nullptr;
+}
+
 int32_t Endpoint::GetChannelId(const BorrowedHandle& channel_fd) {
   std::lock_guard<std::mutex> autolock(channel_mutex_);
   auto iter = channel_fd_to_id_.find(channel_fd.Get());
@@ -527,8 +556,21 @@ Status<void> Endpoint::ReceiveMessageForChannel(
   state->request = std::move(request);
   if (request.send_len > 0 && !request.is_impulse) {
     state->request_data.resize(request.send_len);
-    status = ReceiveData(channel_fd, state->request_data.data(),
-                         state->request_data.size());
+    if (request.arena_len > 0) {
+      // The client left the payload in the channel's shared region. Take a
+      // copy, so that the client can't change it under the service.
+      auto arena = GetChannelArena(channel_id);
+      const void* data = nullptr;
+      if (arena && request.arena_len == request.send_len)
+        data = arena->GetRange(request.arena_offset, request.arena_len);
+      if (data)
+        memcpy(state->request_data.data(), data, request.arena_len);
+      else
+        status.SetError(EIO);
+    } else {
+      status = ReceiveData(channel_fd, state->request_data.data(),
+                           state->request_data.size());
+    }
   }
 
   if (status && request.is_impulse)
@@ -628,8 +670,23 @@ Status<void> Endpoint::MessageReply(Message* message, int return_code) {
 
   state->response.ret_code = return_code;
   state->response.recv_len = state->response_data.size();
+
+  // The client is blocked waiting for this reply and is done with the arena,
+  // so a large reply can go there.
+  const size_t response_size = state->response_data.size();
+  if (state->request.accepts_arena_reply &&
+      response_size >= PayloadArena::kThreshold &&
+      response_size <= PayloadArena::kSize) {
+    auto arena = GetChannelArena(channel_id);
+    if (void* data = arena ? arena->GetRange(0, response_size) : nullptr) {
+      memcpy(data, state->response_data.data(), response_size);
+      state->response.arena_len = response_size;
+    }
+  }
+
   auto status = SendData(channel_socket, state->response);
-  if (status && !state->response_data.empty()) {
+  if (status && !state->response_data.empty() &&
+      state->response.arena_len == 0) {
     status = SendData(channel_socket, state->response_data.data(),
                       state->response_data.size());
   }
@@ -764,7 +821,7 @@ Status<void> Endpoint::RegisterNewChannelForTests(LocalHandle channel_fd) {
         channel_fd.Get(), strerror(errno));
     return ErrorStatus(errno);
   }
-  return OnNewChannel(std::move(channel_fd));
+  return OnNewChannel(std::move(channel_fd), LocalHandle{});
 }
 
 }  // namespace uds
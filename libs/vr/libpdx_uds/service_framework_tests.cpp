@@ -6,10 +6,12 @@
 
 #include <array>
 #include <atomic>
+#include <condition_variable>
 #include <memory>
 #include <numeric>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include <gtest/gtest.h>
 #include <pdx/channel_handle.h>
@@ -64,6 +66,9 @@ enum test_op_codes {
   TEST_OP_POLLHUP_FROM_SERVICE,
   TEST_OP_POLLIN_FROM_SERVICE,
   TEST_OP_SEND_LARGE_DATA_RETURN_SUM,
+  TEST_OP_ECHO_DATA,
+  TEST_OP_WAIT_FOR_RELEASE,
+  TEST_OP_RELEASE,
 };
 
 using ImpulsePayload = std::array<std::uint8_t, sizeof(MessageInfo::impulse)>;
@@ -221,6 +226,33 @@ class TestService : public ServiceBase<TestService> {
         REPLY_MESSAGE_RETURN(message, sum, {});
       }
 
+      case TEST_OP_ECHO_DATA: {
+        std::vector<uint8_t> data(message.GetSendLength());
+        if (!message.ReadAll(data.data(), data.size()) ||
+            !message.WriteAll(data.data(), data.size())) {
+          REPLY_ERROR_RETURN(message, EIO, {});
+        }
+        REPLY_MESSAGE_RETURN(message, 0, {});
+      }
+
+      case TEST_OP_WAIT_FOR_RELEASE: {
+        std::unique_lock<std::mutex> lock(release_mutex_);
+        if (!release_condition_.wait_for(lock, std::chrono::seconds(5),
+                                         [this] { return released_; })) {
+          REPLY_ERROR_RETURN(message, ETIMEDOUT, {});
+        }
+        REPLY_MESSAGE_RETURN(message, 0, {});
+      }
+
+      case TEST_OP_RELEASE: {
+        {
+          std::lock_guard<std::mutex> lock(release_mutex_);
+          released_ = true;
+        }
+        release_condition_.notify_all();
+        REPLY_MESSAGE_RETURN(message, 0, {});
+      }
+
       default:
         return Service::DefaultHandleMessage(message);
     }
@@ -236,6 +268,10 @@ class TestService : public ServiceBase<TestService> {
   int service_id_;
   ImpulsePayload impulse_payload_;
 
+  std::mutex release_mutex_;
+  std::condition_variable release_condition_;
+  bool released_{false};
+
   static std::atomic<int> service_counter_;
 
   TestService(const std::string& name,
@@ -380,6 +416,23 @@ class TestClient : public ClientBase<TestClient> {
                         data_array.size() * sizeof(int), nullptr, 0));
   }
 
+  int EchoData(const std::vector<uint8_t>& data, std::vector<uint8_t>* echo) {
+    Transaction trans{*this};
+    return ReturnStatusOrError(trans.Send<int>(TEST_OP_ECHO_DATA, data.data(),
+                                               data.size(), echo->data(),
+                                               echo->size()));
+  }
+
+  int WaitForRelease() {
+    Transaction trans{*this};
+    return ReturnStatusOrError(trans.Send<int>(TEST_OP_WAIT_FOR_RELEASE));
+  }
+
+  int Release() {
+    Transaction trans{*this};
+    return ReturnStatusOrError(trans.Send<int>(TEST_OP_RELEASE));
+  }
+
   Status<int> GetEventMask(int events) {
     if (auto* client_channel = GetChannel()) {
       return client_channel->GetEventMask(events);
@@ -665,6 +718,79 @@ TEST_F(ServiceFrameworkTest, LargeDataSum) {
   ASSERT_EQ(expected_sum, sum);
 }
 
+TEST_F(ServiceFrameworkTest, LargeDataEcho) {
+  // Create a test service and add it to the dispatcher.
+  auto service = TestService::Create(kTestService1);
+  ASSERT_NE(nullptr, service);
+  ASSERT_EQ(0, dispatcher_->AddService(service));
+
+  // Create a client to service, and one on a channel pushed by the service.
+  auto client = TestClient::Create(kTestService1);
+  ASSERT_NE(nullptr, client);
+  auto pushed_client = client->GetNewChannel();
+  ASSERT_NE(nullptr, pushed_client);
+
+  // Cover payloads sent over the socket, through the channel's shared payload
+  // arena, and too large for the arena.
+  for (size_t size : {100, 64 * 1024, 512 * 1024, 3 * 1024 * 1024}) {
+    std::vector<uint8_t> data(size);
+    for (size_t i = 0; i < size; i++)
+      data[i] = static_cast<uint8_t>(i * 7 + size);
+
+    std::vector<uint8_t> echo(size);
+    EXPECT_EQ(0, client->EchoData(data, &echo)) << "size=" << size;
+    EXPECT_EQ(data, echo) << "size=" << size;
+
+    std::fill(echo.begin(), echo.end(), 0);
+    EXPECT_EQ(0, pushed_client->EchoData(data, &echo)) << "size=" << size;
+    EXPECT_EQ(data, echo) << "size=" << size;
+  }
+}
+
+TEST_F(ServiceFrameworkTest, WorkerThreads) {
+  // Use a dispatcher with workers instead of the fixture's one.
+  auto dispatcher = android::pdx::uds::ServiceDispatcher::CreateWithWorkers(2);
+  ASSERT_NE(nullptr, dispatcher);
+  std::thread dispatch_thread{
+      std::bind(&ServiceDispatcher::EnterDispatchLoop, dispatcher.get())};
+
+  auto service = TestService::Create(kTestService1);
+  ASSERT_NE(nullptr, service);
+  ASSERT_EQ(0, dispatcher->AddService(service));
+
+  // Consecutive channels are on different workers, so the second client can
+  // release the first one, which a single dispatch thread would deadlock on.
+  auto client1 = TestClient::Create(kTestService1);
+  ASSERT_NE(nullptr, client1);
+  auto client2 = TestClient::Create(kTestService1);
+  ASSERT_NE(nullptr, client2);
+
+  int wait_result = -1;
+  std::thread wait_thread{
+      [&client1, &wait_result] { wait_result = client1->WaitForRelease(); }};
+  EXPECT_EQ(0, client2->Release());
+  wait_thread.join();
+  EXPECT_EQ(0, wait_result);
+
+  // Messages on a channel are still handled one at a time, in order.
+  for (int i = 0; i < 10; i++)
+    EXPECT_EQ(0, client1->SendAsync(&i, sizeof(i)));
+  EXPECT_LE(0, client1->GetThisChannelId());
+  int expected = 9;
+  EXPECT_EQ(0, memcmp(&expected, service->GetImpulsePayload().data(),
+                      sizeof(expected)));
+
+  auto stats = dispatcher->GetQueueStats();
+  ASSERT_EQ(2u, stats.size());
+  EXPECT_LT(0u, stats[0].message_count);
+  EXPECT_LT(0u, stats[1].message_count);
+
+  client1 = nullptr;
+  client2 = nullptr;
+  dispatcher->SetCanceled(true);
+  dispatch_thread.join();
+}
+
 TEST_F(ServiceFrameworkTest, Cancel) {
   // Create a test service and add it to the dispatcher.
   auto service = TestService::Create(kTestService1, nullptr, true);
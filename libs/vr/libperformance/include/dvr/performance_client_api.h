@@ -2,6 +2,7 @@
 #define ANDROID_DVR_PERFORMANCE_CLIENT_API_H_
 
 #include <stddef.h>
+#include <stdint.h>
 #include <unistd.h>
 
 #ifdef __cplusplus
@@ -31,6 +32,12 @@ int dvrSetCpuPartition(pid_t task_id, const char* partition);
 /// background. Additional options following a ':' to be supported in the
 /// future.
 ///
+/// Latency critical threads that produce a frame per display or camera period
+/// may use the render, render:high and camera classes. Besides the priority
+/// these raise the minimum utilization clamp of the thread, on kernels that
+/// support it, so that the cpu frequency keeps up with bursts of work. Any
+/// other class resets the clamp.
+///
 /// @param task_id The task id of task to attach to a partition. When task_id is
 /// 0 the current task id is substituted.
 /// @param scheduler_class NULL-terminated ASCII string containing the desired
@@ -52,6 +59,58 @@ int dvrSetSchedulerClass(pid_t task_id, const char* scheduler_class);
 /// @returns Returns 0 on success or a negative errno error code on error.
 int dvrGetCpuPartition(pid_t task_id, char* partition, size_t size);
 
+/// Sets the CPU partitions for several tasks.
+///
+/// Equivalent to calling dvrSetCpuPartition() for each task, but the tasks are
+/// handled by a single request to the performance service.
+///
+/// @param count The number of tasks.
+/// @param task_ids Array of |count| task ids. Task ids of 0 are replaced by the
+/// current task id.
+/// @param partitions Array of |count| NULL-terminated ASCII strings describing
+/// the CPU partition for the task at the same index.
+/// @param results Optional array of |count| ints that receives the result of
+/// each task, 0 or a negative errno error code. May be NULL.
+/// @returns Returns 0 if every task was attached to its partition, otherwise
+/// the error code of the first task that failed or of the request itself.
+int dvrSetCpuPartitions(size_t count, const pid_t* task_ids,
+                        const char* const* partitions, int* results);
+
+/// Sets the scheduler classes for several tasks.
+///
+/// Equivalent to calling dvrSetSchedulerClass() for each task, but the tasks
+/// are handled by a single request to the performance service.
+///
+/// @param count The number of tasks.
+/// @param task_ids Array of |count| task ids. Task ids of 0 are replaced by the
+/// current task id.
+/// @param scheduler_classes Array of |count| NULL-terminated ASCII strings
+/// containing the scheduler class for the task at the same index.
+/// @param results Optional array of |count| ints that receives the result of
+/// each task, 0 or a negative errno error code. May be NULL.
+/// @returns Returns 0 if every task was set to its scheduler class, otherwise
+/// the error code of the first task that failed or of the request itself.
+int dvrSetSchedulerClasses(size_t count, const pid_t* task_ids,
+                           const char* const* scheduler_classes, int* results);
+
+/// Reports the timing of a frame rendered against the display deadline.
+///
+/// Threads that render frames for the display report each completed frame so
+/// that the performance service can raise their cpu frequency floor or move
+/// them to faster cores when frames get close to the deadline, and relax the
+/// boost again when there is headroom. Long-lived callers should keep a
+/// PerformanceClient instead, since this call connects to the service each
+/// time.
+///
+/// @param task_id The task id of the rendering task. When task_id is 0 the
+/// current task id is substituted.
+/// @param vsync_count The vsync the frame was shown at.
+/// @param work_ns The time it took to produce the frame.
+/// @param budget_ns The time that was available to produce the frame.
+/// @returns Returns 0 on success or a negative errno error code on error.
+int dvrReportFrameTiming(pid_t task_id, uint32_t vsync_count, int64_t work_ns,
+                         int64_t budget_ns);
+
 #ifdef __cplusplus
 }  // extern "C"
 #endif
@@ -1,11 +1,14 @@
 #ifndef ANDROID_DVR_PERFORMANCE_CLIENT_H_
 #define ANDROID_DVR_PERFORMANCE_CLIENT_H_
 
+#include <stdint.h>
 #include <sys/types.h>
 
 #include <cstddef>
 #include <string>
 #include <tuple>
+#include <utility>
+#include <vector>
 
 #include <pdx/client.h>
 
@@ -21,6 +24,22 @@ class PerformanceClient : public pdx::ClientBase<PerformanceClient> {
   int GetCpuPartition(pid_t task_id, std::string* partition_out);
   int GetCpuPartition(pid_t task_id, char* partition_out, std::size_t size);
 
+  // Apply the partition or scheduler class paired with each task id in a single
+  // request. Returns 0 if every request succeeded, otherwise the error of the
+  // first one that failed or of the transport. When |results_out| is not null
+  // it receives the result of each request, unless the transport failed.
+  int SetCpuPartitions(std::vector<std::pair<pid_t, std::string>> requests,
+                       std::vector<int>* results_out);
+  int SetSchedulerClasses(std::vector<std::pair<pid_t, std::string>> requests,
+                          std::vector<int>* results_out);
+
+  // Reports that |task_id| completed a frame for the display of |vsync_count|,
+  // taking |work_ns| of the |budget_ns| it had. The report is asynchronous and
+  // cheap enough to send every frame; performanced uses it to boost the task
+  // when its frames get close to their deadline.
+  int ReportFrameTiming(pid_t task_id, uint32_t vsync_count, int64_t work_ns,
+                        int64_t budget_ns);
+
  private:
   friend BASE;
 
@@ -1,10 +1,14 @@
 #ifndef ANDROID_DVR_PERFORMANCE_RPC_H_
 #define ANDROID_DVR_PERFORMANCE_RPC_H_
 
+#include <stdint.h>
 #include <sys/types.h>
 
 #include <string>
+#include <utility>
+#include <vector>
 
+#include <pdx/rpc/remote_method.h>
 #include <pdx/rpc/remote_method_type.h>
 
 namespace android {
@@ -21,14 +25,46 @@ struct PerformanceRPC {
     kOpSetCpuPartition = 0,
     kOpSetSchedulerClass,
     kOpGetCpuPartition,
+    kOpSetCpuPartitions,
+    kOpSetSchedulerClasses,
+    kOpReportFrameTiming,
   };
 
+  // Task ids paired with the partition or scheduler class to apply to them.
+  using TaskRequests = std::vector<std::pair<pid_t, std::string>>;
+
+  // Payload of the ReportFrameTiming impulse. Describes a frame that |task_id|
+  // completed for the display of |vsync_count|, taking |work_ns| of the
+  // |budget_ns| it had before the frame would have missed that vsync.
+  struct FrameTiming {
+    int32_t task_id;
+    uint32_t vsync_count;
+    int64_t work_ns;
+    int64_t budget_ns;
+    int64_t reserved;
+  };
+  static_assert(sizeof(FrameTiming) <= 32,
+                "FrameTiming must fit the impulse payload.");
+
   // Methods.
   PDX_REMOTE_METHOD(SetCpuPartition, kOpSetCpuPartition,
                     int(pid_t, const std::string&));
   PDX_REMOTE_METHOD(SetSchedulerClass, kOpSetSchedulerClass,
                     int(pid_t, const std::string&));
   PDX_REMOTE_METHOD(GetCpuPartition, kOpGetCpuPartition, std::string(pid_t));
+
+  // Batched versions of SetCpuPartition and SetSchedulerClass. The requests are
+  // applied in order and the result of each is returned at the same index.
+  PDX_REMOTE_METHOD(SetCpuPartitions, kOpSetCpuPartitions,
+                    std::vector<int>(const TaskRequests&));
+  PDX_REMOTE_METHOD(SetSchedulerClasses, kOpSetSchedulerClasses,
+                    std::vector<int>(const TaskRequests&));
+
+  // Sent as an impulse with a FrameTiming payload by threads that render
+  // against the display deadline, so that performanced can boost them when
+  // their frames get close to the deadline.
+  PDX_REMOTE_METHOD(ReportFrameTiming, kOpReportFrameTiming,
+                    void(pdx::rpc::Void));
 };
 
 }  // namespace dvr
@@ -2,6 +2,10 @@
 
 #include <sys/types.h>
 
+#include <algorithm>
+#include <utility>
+#include <vector>
+
 #include <pdx/default_transport/client_channel_factory.h>
 #include <pdx/rpc/remote_method.h>
 #include <pdx/rpc/string_wrapper.h>
@@ -9,6 +13,32 @@
 
 using android::pdx::rpc::WrapString;
 
+namespace {
+
+// Substitutes the current task id for task ids of 0.
+void ResolveTaskIds(android::dvr::PerformanceRPC::TaskRequests* requests) {
+  for (auto& request : *requests) {
+    if (request.first == 0)
+      request.first = gettid();
+  }
+}
+
+int ReturnFirstError(std::vector<int> results,
+                     std::vector<int>* results_out) {
+  int error = 0;
+  for (const int result : results) {
+    if (result < 0) {
+      error = result;
+      break;
+    }
+  }
+  if (results_out)
+    *results_out = std::move(results);
+  return error;
+}
+
+}  // anonymous namespace
+
 namespace android {
 namespace dvr {
 
@@ -90,9 +120,70 @@ int PerformanceClient::GetCpuPartition(pid_t task_id, char* partition_out,
   return 0;
 }
 
+int PerformanceClient::SetCpuPartitions(
+    std::vector<std::pair<pid_t, std::string>> requests,
+    std::vector<int>* results_out) {
+  ResolveTaskIds(&requests);
+  auto status =
+      InvokeRemoteMethod<PerformanceRPC::SetCpuPartitions>(requests);
+  if (!status)
+    return -status.error();
+  return ReturnFirstError(status.take(), results_out);
+}
+
+int PerformanceClient::SetSchedulerClasses(
+    std::vector<std::pair<pid_t, std::string>> requests,
+    std::vector<int>* results_out) {
+  ResolveTaskIds(&requests);
+  auto status =
+      InvokeRemoteMethod<PerformanceRPC::SetSchedulerClasses>(requests);
+  if (!status)
+    return -status.error();
+  return ReturnFirstError(status.take(), results_out);
+}
+
+int PerformanceClient::ReportFrameTiming(pid_t task_id, uint32_t vsync_count,
+                                         int64_t work_ns, int64_t budget_ns) {
+  if (task_id == 0)
+    task_id = gettid();
+
+  const PerformanceRPC::FrameTiming timing = {task_id, vsync_count, work_ns,
+                                              budget_ns, 0};
+  return ReturnStatusOrError(SendImpulse(
+      PerformanceRPC::ReportFrameTiming::Opcode, &timing, sizeof(timing)));
+}
+
 }  // namespace dvr
 }  // namespace android
 
+namespace {
+
+// Common implementation of the batched C API calls.
+template <typename Method>
+int SetTaskValues(Method method, size_t count, const pid_t* task_ids,
+                  const char* const* values, int* results) {
+  if (count > 0 && (task_ids == nullptr || values == nullptr))
+    return -EINVAL;
+
+  int error;
+  auto client = android::dvr::PerformanceClient::Create(&error);
+  if (!client)
+    return error;
+
+  android::dvr::PerformanceRPC::TaskRequests requests;
+  requests.reserve(count);
+  for (size_t i = 0; i < count; i++)
+    requests.emplace_back(task_ids[i], values[i]);
+
+  std::vector<int> task_results;
+  error = (client.get()->*method)(std::move(requests), &task_results);
+  if (results && task_results.size() == count)
+    std::copy(task_results.begin(), task_results.end(), results);
+  return error;
+}
+
+}  // anonymous namespace
+
 extern "C" int dvrSetCpuPartition(pid_t task_id, const char* partition) {
   int error;
   if (auto client = android::dvr::PerformanceClient::Create(&error))
@@ -110,6 +201,29 @@ extern "C" int dvrSetSchedulerClass(pid_t task_id,
     return error;
 }
 
+extern "C" int dvrSetCpuPartitions(size_t count, const pid_t* task_ids,
+                                   const char* const* partitions,
+                                   int* results) {
+  return SetTaskValues(&android::dvr::PerformanceClient::SetCpuPartitions,
+                       count, task_ids, partitions, results);
+}
+
+extern "C" int dvrSetSchedulerClasses(size_t count, const pid_t* task_ids,
+                                      const char* const* scheduler_classes,
+                                      int* results) {
+  return SetTaskValues(&android::dvr::PerformanceClient::SetSchedulerClasses,
+                       count, task_ids, scheduler_classes, results);
+}
+
+extern "C" int dvrReportFrameTiming(pid_t task_id, uint32_t vsync_count,
+                                    int64_t work_ns, int64_t budget_ns) {
+  int error;
+  if (auto client = android::dvr::PerformanceClient::Create(&error))
+    return client->ReportFrameTiming(task_id, vsync_count, work_ns, budget_ns);
+  else
+    return error;
+}
+
 extern "C" int dvrGetCpuPartition(pid_t task_id, char* partition, size_t size) {
   int error;
   if (auto client = android::dvr::PerformanceClient::Create(&error))
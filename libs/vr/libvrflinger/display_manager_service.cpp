@@ -73,6 +73,11 @@ pdx::Status<void> DisplayManagerService::HandleMessage(pdx::Message& message) {
           *this, &DisplayManagerService::OnGetSurfaceState, message);
       return {};
 
+    case DisplayManagerProtocol::GetSurfaceStateUpdates::Opcode:
+      DispatchRemoteMethod<DisplayManagerProtocol::GetSurfaceStateUpdates>(
+          *this, &DisplayManagerService::OnGetSurfaceStateUpdates, message);
+      return {};
+
     case DisplayManagerProtocol::GetSurfaceQueue::Opcode:
       DispatchRemoteMethod<DisplayManagerProtocol::GetSurfaceQueue>(
           *this, &DisplayManagerService::OnGetSurfaceQueue, message);
@@ -101,12 +106,61 @@ DisplayManagerService::OnGetSurfaceState(pdx::Message& /*message*/) {
         surface->ClearUpdate();
       });
 
+  // The pending updates were consumed above, so the next call to
+  // OnGetSurfaceStateUpdates() has to start over with full state.
+  display_manager_->reported_surface_ids().clear();
+
   // The fact that we're in the message handler implies that display_manager_ is
   // not nullptr. No check required, unless this service becomes multi-threaded.
   display_manager_->SetNotificationsPending(false);
   return items;
 }
 
+pdx::Status<display::SurfaceStateUpdates>
+DisplayManagerService::OnGetSurfaceStateUpdates(pdx::Message& /*message*/) {
+  display::SurfaceStateUpdates updates;
+  std::set<int> surface_ids;
+  auto& reported_surface_ids = display_manager_->reported_surface_ids();
+
+  display_service_->ForEachDisplaySurface(
+      SurfaceType::Application,
+      [&](const std::shared_ptr<DisplaySurface>& surface) mutable {
+        const int surface_id = surface->surface_id();
+        surface_ids.insert(surface_id);
+
+        const bool reported = reported_surface_ids.count(surface_id) != 0;
+        if (reported && !surface->IsUpdatePending())
+          return;
+
+        display::SurfaceState state{surface_id,
+                                    surface->process_id(),
+                                    surface->user_id(),
+                                    {},
+                                    surface->update_flags(),
+                                    {}};
+        if (!reported) {
+          state.surface_attributes = surface->attributes();
+          state.queue_ids = surface->GetQueueIds();
+        } else {
+          state.surface_attributes = surface->GetChangedAttributes();
+          if (state.update_flags & display::SurfaceUpdateFlags::BuffersChanged)
+            state.queue_ids = surface->GetQueueIds();
+        }
+        updates.surfaces.push_back(std::move(state));
+        surface->ClearUpdate();
+      });
+
+  for (const int surface_id : reported_surface_ids) {
+    if (surface_ids.count(surface_id) == 0)
+      updates.removed_surface_ids.push_back(surface_id);
+  }
+  reported_surface_ids = std::move(surface_ids);
+
+  // As in OnGetSurfaceState() display_manager_ is known to be valid here.
+  display_manager_->SetNotificationsPending(false);
+  return {std::move(updates)};
+}
+
 pdx::Status<pdx::LocalChannelHandle> DisplayManagerService::OnGetSurfaceQueue(
     pdx::Message& /*message*/, int surface_id, int queue_id) {
   auto surface = display_service_->GetDisplaySurface(surface_id);
@@ -5,6 +5,8 @@
 #include <pdx/status.h>
 #include <private/dvr/display_protocol.h>
 
+#include <set>
+
 #include "display_service.h"
 
 namespace android {
@@ -28,12 +30,17 @@ class DisplayManager : public pdx::Channel {
   // |pending| is false the POLLIN bit is cleared in the event mask.
   void SetNotificationsPending(bool pending);
 
+  // Ids of the surfaces the display manager has received the full state of.
+  // Later updates to these surfaces only carry what changed.
+  std::set<int>& reported_surface_ids() { return reported_surface_ids_; }
+
  private:
   DisplayManager(const DisplayManager&) = delete;
   void operator=(const DisplayManager&) = delete;
 
   DisplayManagerService* service_;
   int channel_id_;
+  std::set<int> reported_surface_ids_;
 };
 
 // The display manager service marshalls state and events from the display
@@ -53,6 +60,8 @@ class DisplayManagerService : public pdx::ServiceBase<DisplayManagerService> {
 
   pdx::Status<std::vector<display::SurfaceState>> OnGetSurfaceState(
       pdx::Message& message);
+  pdx::Status<display::SurfaceStateUpdates> OnGetSurfaceStateUpdates(
+      pdx::Message& message);
   pdx::Status<pdx::LocalChannelHandle> OnGetSurfaceQueue(pdx::Message& message,
                                                          int surface_id,
                                                          int queue_id);
@@ -103,6 +103,7 @@ Status<void> DisplaySurface::OnSetAttributes(
     } else {
       // Only update the attribute map with valid values.
       attributes_[attribute.first] = attribute.second;
+      changed_attribute_keys_.insert(attribute.first);
 
       // All attribute changes generate a notification, even if the value
       // doesn't change. Visibility attributes set a flag only if the value
@@ -129,6 +130,14 @@ void DisplaySurface::SurfaceUpdated(display::SurfaceUpdateFlags update_flags) {
 void DisplaySurface::ClearUpdate() {
   ALOGD_IF(TRACE, "DisplaySurface::ClearUpdate: surface_id=%d", surface_id());
   update_flags_ = display::SurfaceUpdateFlags::None;
+  changed_attribute_keys_.clear();
+}
+
+display::SurfaceAttributes DisplaySurface::GetChangedAttributes() const {
+  display::SurfaceAttributes changed_attributes;
+  for (const auto& key : changed_attribute_keys_)
+    changed_attributes.emplace(key, attributes_.at(key));
+  return changed_attributes;
 }
 
 Status<display::SurfaceInfo> DisplaySurface::OnGetSurfaceInfo(
@@ -10,6 +10,7 @@
 #include <functional>
 #include <iterator>
 #include <memory>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -47,6 +48,9 @@ class DisplaySurface : public pdx::Channel {
 
   virtual std::vector<int32_t> GetQueueIds() const { return {}; }
 
+  // Returns the attributes set since the last call to ClearUpdate().
+  display::SurfaceAttributes GetChangedAttributes() const;
+
   bool IsUpdatePending() const {
     return update_flags_.value() != display::SurfaceUpdateFlags::None;
   }
@@ -107,6 +111,7 @@ class DisplaySurface : public pdx::Channel {
 
   display::SurfaceAttributes attributes_;
   display::SurfaceUpdateFlags update_flags_ = display::SurfaceUpdateFlags::None;
+  std::set<display::SurfaceAttributeKey> changed_attribute_keys_;
 
   // Subset of attributes that may be interpreted by the display service.
   bool visible_ = false;
@@ -9,6 +9,7 @@
 #include <sys/eventfd.h>
 #include <sys/prctl.h>
 #include <sys/resource.h>
+#include <sys/syscall.h>
 #include <sys/system_properties.h>
 #include <sys/timerfd.h>
 #include <time.h>
@@ -45,9 +46,15 @@ namespace {
 // display and the EDS timing coincides with zero pending fences, so this is 0.
 constexpr int kAllowedPendingFenceCount = 0;
 
-// Offset before vsync to submit frames to hardware composer.
+// Offset before vsync to submit frames to hardware composer, used until enough
+// frames have been timed to adapt it.
 constexpr int64_t kFramePostOffsetNs = 4000000;  // 4ms
 
+// The adaptive offset is the slowest recent post time plus this margin, but
+// never less than kMinFramePostOffsetNs nor more than half a frame.
+constexpr int64_t kFramePostMarginNs = 500000;      // 0.5ms
+constexpr int64_t kMinFramePostOffsetNs = 1000000;  // 1ms
+
 const char kBacklightBrightnessSysFile[] =
     "/sys/class/leds/lcd-backlight/brightness";
 
@@ -60,6 +67,28 @@ const char kDvrPerformanceProperty[] = "sys.dvr.performance";
 
 const char kRightEyeOffsetProperty[] = "dvr.right_eye_offset_ns";
 
+const char kFramePostOffsetProperty[] = "dvr.hwc.post_offset_ns";
+
+const char kLateLatchProperty[] = "dvr.hwc.late_latch";
+
+const char kDeadlineSchedulingProperty[] = "dvr.hwc.deadline_scheduling";
+
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE 6
+#endif
+
+// Argument of the sched_setattr syscall, which has no libc wrapper.
+struct SchedAttr {
+  uint32_t size;
+  uint32_t sched_policy;
+  uint64_t sched_flags;
+  int32_t sched_nice;
+  uint32_t sched_priority;
+  uint64_t sched_runtime;
+  uint64_t sched_deadline;
+  uint64_t sched_period;
+};
+
 // Get time offset from a vsync to when the pose for that vsync should be
 // predicted out to. For example, if scanout gets halfway through the frame
 // at the halfway point between vsyncs, then this could be half the period.
@@ -93,6 +122,50 @@ bool SetThreadPolicy(const std::string& scheduler_class,
   return true;
 }
 
+// Attempts to move the current thread to SCHED_DEADLINE, reserving |runtime_ns|
+// of every |period_ns| to be used within |deadline_ns| of each wakeup. Returns
+// true on success or false on failure.
+bool SetThreadDeadlinePolicy(int64_t runtime_ns, int64_t deadline_ns,
+                             int64_t period_ns) {
+#ifdef __NR_sched_setattr
+  SchedAttr attr = {};
+  attr.size = sizeof(attr);
+  attr.sched_policy = SCHED_DEADLINE;
+  attr.sched_runtime = runtime_ns;
+  attr.sched_deadline = deadline_ns;
+  attr.sched_period = period_ns;
+  if (syscall(__NR_sched_setattr, 0, &attr, 0) < 0) {
+    ALOGE(
+        "SetThreadDeadlinePolicy: Failed to set SCHED_DEADLINE for "
+        "thread_id=%d: %s",
+        gettid(), strerror(errno));
+    return false;
+  }
+  return true;
+#else
+  (void)runtime_ns;
+  (void)deadline_ns;
+  (void)period_ns;
+  ALOGE("SetThreadDeadlinePolicy: SCHED_DEADLINE is not supported.");
+  return false;
+#endif
+}
+
+// Sets up the scheduling of the post thread. With |deadline_scheduling| the
+// thread is given a deadline reservation covering the longest post window it
+// allows itself, half a frame, and falls back to the SCHED_FIFO class from
+// performanced if the kernel refuses. The cpu partition is only applied in the
+// latter case, since the kernel does not admit SCHED_DEADLINE threads with a
+// restricted affinity.
+bool SetPostThreadPolicy(bool deadline_scheduling, int64_t ns_per_frame) {
+  if (deadline_scheduling &&
+      SetThreadDeadlinePolicy(ns_per_frame / 2, ns_per_frame / 2,
+                              ns_per_frame)) {
+    return true;
+  }
+  return SetThreadPolicy("graphics:high", "/system/performance");
+}
+
 }  // anonymous namespace
 
 // Layer static data.
@@ -101,6 +174,7 @@ const HWCDisplayMetrics* Layer::display_metrics_;
 
 // HardwareComposer static data;
 constexpr size_t HardwareComposer::kMaxHardwareLayers;
+constexpr size_t HardwareComposer::kFramePostTimingCount;
 
 HardwareComposer::HardwareComposer()
     : HardwareComposer(nullptr, RequestDisplayCallback()) {}
@@ -418,6 +492,17 @@ void HardwareComposer::PostLayers() {
     ATRACE_INT("frame_skip_count", 0);
   }
 
+  // Picking up a buffer that arrived during validation costs a second
+  // validation, which is cheap compared to showing that buffer a frame later.
+  if (late_latch_enabled_ && LatchNewBuffers()) {
+    error = Validate(HWC_DISPLAY_PRIMARY);
+    if (error != HWC::Error::None) {
+      ALOGE("HardwareComposer::PostLayers: Late latch validate failed: %s",
+            error.to_string().c_str());
+      return;
+    }
+  }
+
 #if TRACE
   for (size_t i = 0; i < active_layer_count_; i++)
     ALOGI("HardwareComposer::PostLayers: layer=%zu composition=%s", i,
@@ -450,6 +535,41 @@ void HardwareComposer::PostLayers() {
   }
 }
 
+bool HardwareComposer::LatchNewBuffers() {
+  ATRACE_NAME("HardwareComposer::LatchNewBuffers");
+  bool latched = false;
+  for (size_t i = 0; i < active_layer_count_; i++) {
+    if (layers_[i].IsBufferAvailable()) {
+      layers_[i].Prepare();
+      latched = true;
+    }
+  }
+  return latched;
+}
+
+int64_t HardwareComposer::GetFramePostOffset() const {
+  if (frame_post_offset_override_ns_ > 0)
+    return frame_post_offset_override_ns_;
+  if (frame_post_time_count_ < kFramePostTimingCount)
+    return kFramePostOffsetNs;
+
+  // Follow the slowest recent frame rather than an average: a frame that
+  // misses vsync costs far more than the latency saved by cutting it close.
+  const int64_t max_post_time_ns = *std::max_element(
+      frame_post_times_ns_.begin(), frame_post_times_ns_.end());
+  const int64_t max_offset_ns = display_metrics_.vsync_period_ns / 2;
+  return std::min(
+      std::max(max_post_time_ns + kFramePostMarginNs, kMinFramePostOffsetNs),
+      max_offset_ns);
+}
+
+void HardwareComposer::RecordFramePostTime(int64_t post_time_ns) {
+  ATRACE_INT64("frame_post_time_ns", post_time_ns);
+  frame_post_times_ns_[frame_post_time_count_ % kFramePostTimingCount] =
+      post_time_ns;
+  frame_post_time_count_++;
+}
+
 void HardwareComposer::SetDisplaySurfaces(
     std::vector<std::shared_ptr<DirectDisplaySurface>> surfaces) {
   ALOGI("HardwareComposer::SetDisplaySurfaces: surface count=%zd",
@@ -686,11 +806,20 @@ void HardwareComposer::PostThread() {
   // NOLINTNEXTLINE(runtime/int)
   prctl(PR_SET_NAME, reinterpret_cast<unsigned long>("VrHwcPost"), 0, 0, 0);
 
-  // Set the scheduler to SCHED_FIFO with high priority. If this fails here
-  // there may have been a startup timing issue between this thread and
-  // performanced. Try again later when this thread becomes active.
+  const int64_t ns_per_frame = display_metrics_.vsync_period_ns;
+
+  // Set the scheduler to SCHED_FIFO with high priority, or SCHED_DEADLINE when
+  // requested. If this fails here there may have been a startup timing issue
+  // between this thread and performanced. Try again later when this thread
+  // becomes active.
+  const bool deadline_scheduling =
+      property_get_bool(kDeadlineSchedulingProperty, false);
   bool thread_policy_setup =
-      SetThreadPolicy("graphics:high", "/system/performance");
+      SetPostThreadPolicy(deadline_scheduling, ns_per_frame);
+
+  frame_post_offset_override_ns_ =
+      property_get_int64(kFramePostOffsetProperty, 0);
+  late_latch_enabled_ = property_get_bool(kLateLatchProperty, false);
 
 #if ENABLE_BACKLIGHT_BRIGHTNESS
   // TODO(hendrikw): This isn't required at the moment. It's possible that there
@@ -727,7 +856,6 @@ void HardwareComposer::PostThread() {
       "HardwareComposer: Failed to create vsync sleep timerfd: %s",
       strerror(errno));
 
-  const int64_t ns_per_frame = display_metrics_.vsync_period_ns;
   const int64_t photon_offset_ns = GetPosePredictionTimeOffset(ns_per_frame);
 
   // TODO(jbates) Query vblank time from device, when such an API is available.
@@ -773,13 +901,21 @@ void HardwareComposer::PostThread() {
       OnPostThreadResumed();
       was_running = true;
 
+      // Post times measured before the pause may not apply anymore.
+      frame_post_time_count_ = 0;
+
       // Try to setup the scheduler policy if it failed during startup. Only
       // attempt to do this on transitions from inactive to active to avoid
       // spamming the system with RPCs and log messages.
       if (!thread_policy_setup) {
         thread_policy_setup =
-            SetThreadPolicy("graphics:high", "/system/performance");
+            SetPostThreadPolicy(deadline_scheduling, ns_per_frame);
       }
+
+      // Deadline threads get their reservation no matter the frequency and
+      // cannot be moved between partitions, so only boost the others.
+      if (!performance_client_ && !deadline_scheduling)
+        performance_client_ = PerformanceClient::Create();
     }
 
     int64_t vsync_timestamp = 0;
@@ -817,16 +953,22 @@ void HardwareComposer::PostThread() {
       vsync_callback_(HWC_DISPLAY_PRIMARY, vsync_timestamp,
                       /*frame_time_estimate*/ 0, vsync_count_);
 
+    // The time the post is measured from. Scheduling delays after the wakeup
+    // count towards the post time, so they are covered by the offset as well.
+    int64_t post_start_ns;
     {
       // Sleep until shortly before vsync.
       ATRACE_NAME("sleep");
 
+      const int64_t post_offset_ns = GetFramePostOffset();
       const int64_t display_time_est_ns = vsync_timestamp + ns_per_frame;
       const int64_t now_ns = GetSystemClockNs();
       const int64_t sleep_time_ns =
-          display_time_est_ns - now_ns - kFramePostOffsetNs;
-      const int64_t wakeup_time_ns = display_time_est_ns - kFramePostOffsetNs;
+          display_time_est_ns - now_ns - post_offset_ns;
+      const int64_t wakeup_time_ns = display_time_est_ns - post_offset_ns;
+      post_start_ns = sleep_time_ns > 0 ? wakeup_time_ns : now_ns;
 
+      ATRACE_INT64("post_offset_ns", post_offset_ns);
       ATRACE_INT64("sleep_time_ns", sleep_time_ns);
       if (sleep_time_ns > 0) {
         int error = SleepUntil(wakeup_time_ns);
@@ -845,6 +987,15 @@ void HardwareComposer::PostThread() {
     }
 
     PostLayers();
+    const int64_t post_time_ns = GetSystemClockNs() - post_start_ns;
+    RecordFramePostTime(post_time_ns);
+
+    // The post offset can absorb slow posts up to half a frame; from there on
+    // only a faster post thread helps.
+    if (performance_client_) {
+      performance_client_->ReportFrameTiming(0, vsync_count_, post_time_ns,
+                                             ns_per_frame / 2);
+    }
   }
 }
 
@@ -864,7 +1015,11 @@ bool HardwareComposer::UpdateLayerConfig() {
 
   display_surfaces_.clear();
 
-  Layer* target_layer;
+  // Surfaces that already have a layer keep it, along with the buffer it holds,
+  // and only have their position in the stack updated. Creating a new layer
+  // would drop the acquired buffer and show a solid color until the surface
+  // posts again.
+  std::array<Layer, kMaxHardwareLayers> layers;
   size_t layer_index;
   for (layer_index = 0;
        layer_index < std::min(surfaces.size(), kMaxHardwareLayers);
@@ -872,15 +1027,29 @@ bool HardwareComposer::UpdateLayerConfig() {
     // The bottom layer is opaque, other layers blend.
     HWC::BlendMode blending =
         layer_index == 0 ? HWC::BlendMode::None : HWC::BlendMode::Coverage;
-    layers_[layer_index].Setup(surfaces[layer_index], blending,
-                               display_transform_, HWC::Composition::Device,
-                               layer_index);
+
+    const int surface_id = surfaces[layer_index]->surface_id();
+    auto search = std::find_if(
+        layers_.begin(), layers_.begin() + active_layer_count_,
+        [surface_id](const Layer& layer) {
+          return layer.IsLayerSetup() && layer.GetSurfaceId() == surface_id;
+        });
+    if (search != layers_.begin() + active_layer_count_) {
+      layers[layer_index] = std::move(*search);
+      layers[layer_index].UpdateSetup(blending, display_transform_,
+                                      layer_index);
+    } else {
+      layers[layer_index].Setup(surfaces[layer_index], blending,
+                                display_transform_, HWC::Composition::Device,
+                                layer_index);
+    }
     display_surfaces_.push_back(surfaces[layer_index]);
   }
 
-  // Clear unused layers.
-  for (size_t i = layer_index; i < kMaxHardwareLayers; i++)
-    layers_[i].Reset();
+  // Moving the new configuration in destroys the layers of surfaces that are
+  // no longer displayed.
+  for (size_t i = 0; i < kMaxHardwareLayers; i++)
+    layers_[i] = std::move(layers[i]);
 
   active_layer_count_ = layer_index;
   ALOGD_IF(TRACE, "HardwareComposer::UpdateLayerConfig: %zd active layers",
@@ -938,6 +1107,29 @@ void Layer::InitializeGlobals(Hwc2::Composer* hwc2_hidl,
   display_metrics_ = metrics;
 }
 
+Layer::Layer(Layer&& other) { *this = std::move(other); }
+
+Layer& Layer::operator=(Layer&& other) {
+  if (this != &other) {
+    Reset();
+    hardware_composer_layer_ = other.hardware_composer_layer_;
+    z_order_ = other.z_order_;
+    blending_ = other.blending_;
+    transform_ = other.transform_;
+    composition_type_ = other.composition_type_;
+    target_composition_type_ = other.target_composition_type_;
+    source_ = std::move(other.source_);
+    acquire_fence_ = std::move(other.acquire_fence_);
+    surface_rect_functions_applied_ = other.surface_rect_functions_applied_;
+
+    // The hardware composer layer now belongs to this instance; keep the
+    // moved-from layer from destroying it.
+    other.hardware_composer_layer_ = 0;
+    other.Reset();
+  }
+  return *this;
+}
+
 void Layer::Reset() {
   if (hwc2_hidl_ != nullptr && hardware_composer_layer_) {
     hwc2_hidl_->destroyLayer(HWC_DISPLAY_PRIMARY, hardware_composer_layer_);
@@ -980,6 +1172,31 @@ void Layer::Setup(const std::shared_ptr<IonBuffer>& buffer,
   CommonLayerSetup();
 }
 
+void Layer::UpdateSetup(HWC::BlendMode blending, HWC::Transform transform,
+                        size_t z_order) {
+  HWC::Error error;
+  transform_ = transform;
+
+  if (blending_ != blending) {
+    blending_ = blending;
+    error = hwc2_hidl_->setLayerBlendMode(
+        HWC_DISPLAY_PRIMARY, hardware_composer_layer_,
+        blending_.cast<Hwc2::IComposerClient::BlendMode>());
+    ALOGE_IF(error != HWC::Error::None,
+             "Layer::UpdateSetup: Error setting layer blend mode: %s",
+             error.to_string().c_str());
+  }
+
+  if (z_order_ != z_order) {
+    z_order_ = z_order;
+    error = hwc2_hidl_->setLayerZOrder(HWC_DISPLAY_PRIMARY,
+                                       hardware_composer_layer_, z_order_);
+    ALOGE_IF(error != HWC::Error::None,
+             "Layer::UpdateSetup: Error setting z order: %s",
+             error.to_string().c_str());
+  }
+}
+
 void Layer::UpdateBuffer(const std::shared_ptr<IonBuffer>& buffer) {
   if (source_.is<SourceBuffer>())
     std::get<SourceBuffer>(source_) = {buffer};
@@ -20,6 +20,7 @@
 #include <pdx/file_handle.h>
 #include <pdx/rpc/variant.h>
 #include <private/dvr/buffer_hub_client.h>
+#include <private/dvr/performance_client.h>
 
 #include "acquired_buffer.h"
 #include "display_surface.h"
@@ -51,6 +52,12 @@ class Layer {
  public:
   Layer() {}
 
+  // Layers are movable so that the hardware composer layer of a surface can be
+  // kept across changes to the surface stack. The moved-from layer is left
+  // empty.
+  Layer(Layer&& other);
+  Layer& operator=(Layer&& other);
+
   // Sets up the global state used by all Layer instances. This must be called
   // before using any Layer methods.
   static void InitializeGlobals(Hwc2::Composer* hwc2_hidl,
@@ -84,6 +91,12 @@ class Layer {
              HWC::Transform transform, HWC::Composition composition_type,
              size_t z_order);
 
+  // Updates the blending and z-order of a layer that is already set up, only
+  // calling into the hardware composer for the values that changed. The
+  // source, buffers and fences of the layer are kept.
+  void UpdateSetup(HWC::BlendMode blending, HWC::Transform transform,
+                   size_t z_order);
+
   // Layers that use a direct IonBuffer should call this each frame to update
   // which buffer will be used for the next PostLayers.
   void UpdateBuffer(const std::shared_ptr<IonBuffer>& buffer);
@@ -93,6 +106,17 @@ class Layer {
   // buffer if one is available.
   void Prepare();
 
+  // Returns true if the display surface of this layer has a buffer newer than
+  // the one acquired by the last call to Prepare().
+  bool IsBufferAvailable() {
+    bool available = false;
+    pdx::rpc::IfAnyOf<SourceSurface>::Call(
+        &source_, [&available](SourceSurface& surface_source) {
+          available = surface_source.surface->IsBufferAvailable();
+        });
+    return available;
+  }
+
   // After calling prepare, if this frame is to be dropped instead of passing
   // along to the HWC, call Drop to close the contained fence(s).
   void Drop();
@@ -241,6 +265,9 @@ class HardwareComposer {
   // just set it to 4 for now.
   static constexpr size_t kMaxHardwareLayers = 4;
 
+  // Number of recent frames whose post times determine the post offset.
+  static constexpr size_t kFramePostTimingCount = 30;
+
   HardwareComposer();
   HardwareComposer(Hwc2::Composer* hidl,
                    RequestDisplayCallback request_display_callback);
@@ -322,6 +349,16 @@ class HardwareComposer {
   void PostLayers();
   void PostThread();
 
+  // Re-prepares the layers whose surfaces received a new buffer since the
+  // frame was prepared. Returns true if any layer changed, in which case the
+  // display must be validated again.
+  bool LatchNewBuffers();
+
+  // Returns how long before vsync the post thread should wake up to submit the
+  // next frame, see kFramePostTimingCount.
+  int64_t GetFramePostOffset() const;
+  void RecordFramePostTime(int64_t post_time_ns);
+
   // The post thread has two controlling states:
   // 1. Idle: no work to do (no visible surfaces).
   // 2. Suspended: explicitly halted (system is not in VR mode).
@@ -431,6 +468,20 @@ class HardwareComposer {
   // Counter tracking the number of skipped frames.
   int frame_skip_count_ = 0;
 
+  // Time from the scheduled wakeup of the post thread until hardware composer
+  // accepted the frame, for the last kFramePostTimingCount frames. The post
+  // offset adapts to the slowest of these. Used exclusively by the post thread.
+  std::array<int64_t, kFramePostTimingCount> frame_post_times_ns_;
+  size_t frame_post_time_count_ = 0;
+
+  // Fixed post offset from the dvr.hwc.post_offset_ns property, or zero to
+  // adapt the offset to the measured post times.
+  int64_t frame_post_offset_override_ns_ = 0;
+
+  // Whether buffers posted while a frame is validated are still picked up for
+  // that frame, from the dvr.hwc.late_latch property.
+  bool late_latch_enabled_ = false;
+
   // Fd array for tracking retire fences that are returned by hwc. This allows
   // us to detect when the display driver begins queuing frames.
   std::vector<pdx::LocalHandle> retire_fence_fds_;
@@ -439,6 +490,11 @@ class HardwareComposer {
   // out to display frame boundaries, so we need to tell it about vsyncs.
   DvrPose* pose_client_ = nullptr;
 
+  // Reports the post times to performanced, which boosts the post thread when
+  // posts get close to the longest post offset allowed. Used exclusively by the
+  // post thread.
+  std::unique_ptr<PerformanceClient> performance_client_;
+
   static constexpr int kPostThreadInterrupted = 1;
 
   static void HwcRefresh(hwc2_callback_data_t data, hwc2_display_t display);
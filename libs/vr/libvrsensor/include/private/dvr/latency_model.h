@@ -1,6 +1,9 @@
 #ifndef ANDROID_DVR_LATENCY_MODEL_H_
 #define ANDROID_DVR_LATENCY_MODEL_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include <vector>
 
 namespace android {
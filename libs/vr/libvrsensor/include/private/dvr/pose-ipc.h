@@ -19,6 +19,7 @@ enum {
   DVR_POSE_GET_MODE,
   DVR_POSE_GET_CONTROLLER_RING_BUFFER,
   DVR_POSE_LOG_CONTROLLER,
+  DVR_POSE_GET_PREDICTION_RING_BUFFER,
 };
 
 #ifdef __cplusplus
@@ -0,0 +1,42 @@
+#ifndef ANDROID_DVR_POSE_PREDICTION_RING_H_
+#define ANDROID_DVR_POSE_PREDICTION_RING_H_
+
+#include <stdint.h>
+
+#include <dvr/pose_client.h>
+#include <libbroadcastring/broadcast_ring.h>
+#include <private/dvr/sensor_constants.h>
+
+namespace android {
+namespace dvr {
+
+// Head poses predicted by the pose service for the next few vsyncs, published
+// once per vsync through PosePredictionRing.
+struct PosePredictionRecord {
+  // Vsync count the first pose is predicted for. poses[i] is predicted for
+  // vsync_count + i.
+  uint32_t vsync_count;
+  uint32_t reserved[3];
+
+  DvrPoseAsync poses[kPoseAsyncBufferMinFutureCount];
+};
+
+struct PosePredictionRingTraits : public DefaultRingTraits {
+  // Leaves room for new fields at the end of PosePredictionRecord.
+  static constexpr bool kUseStaticRecordSize = false;
+
+  // A few frames of history, so that a reader running late still finds the
+  // record for the vsync it is rendering.
+  static constexpr uint32_t kStaticRecordCount = 8;
+};
+
+// Shared memory ring the pose service publishes predicted poses through, see
+// DVR_POSE_GET_PREDICTION_RING_BUFFER. The service is the only writer; clients
+// map it read-only and read the newest record without any IPC or locking.
+using PosePredictionRing =
+    BroadcastRing<PosePredictionRecord, PosePredictionRingTraits>;
+
+}  // namespace dvr
+}  // namespace android
+
+#endif  // ANDROID_DVR_POSE_PREDICTION_RING_H_
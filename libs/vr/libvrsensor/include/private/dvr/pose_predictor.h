@@ -0,0 +1,82 @@
+#ifndef ANDROID_DVR_POSE_PREDICTOR_H_
+#define ANDROID_DVR_POSE_PREDICTOR_H_
+
+#include <stdint.h>
+
+#include <dvr/pose_client.h>
+#include <private/dvr/eigen.h>
+#include <private/dvr/latency_model.h>
+#include <private/dvr/pose_prediction_ring.h>
+
+namespace android {
+namespace dvr {
+
+// Extrapolates the head pose from the sensor fusion to the times the frames of
+// the upcoming vsyncs are shown, separately for each eye. The pose service
+// feeds it every fused pose and every vsync, and publishes the predictions
+// through PosePredictionRing.
+//
+// The motion is assumed to continue at the velocities of the latest sample.
+// This class is not thread safe.
+class PosePredictor {
+ public:
+  // A pose from the sensor fusion. Orientation is head-from-start; position,
+  // velocity and angular velocity are in start space.
+  struct Sample {
+    Eigen::Quaterniond orientation;
+    Eigen::Vector3d position;
+    Eigen::Vector3d velocity;
+    Eigen::Vector3d angular_velocity;
+
+    // When the pose was received from the fusion. The latency model accounts
+    // for the time from the motion itself to this point.
+    int64_t timestamp_ns;
+  };
+
+  // Predictions never extrapolate further than this past the latest sample.
+  static constexpr int64_t kMaxPredictionNs = 100000000;  // 100ms
+
+  // |latency_window_size| is the number of latency measurements averaged by
+  // the latency model.
+  explicit PosePredictor(size_t latency_window_size);
+
+  void AddSample(const Sample& sample);
+
+  // Adds a measurement of the time from a motion to the fusion reporting it.
+  void AddLatency(int64_t latency_ns) { latency_model_.AddLatency(latency_ns); }
+
+  // Updates the display timing, with the arguments of
+  // privateDvrPoseNotifyVsync().
+  void NotifyVsync(uint32_t vsync_count, int64_t display_timestamp_ns,
+                   int64_t display_period_ns,
+                   int64_t right_eye_photon_offset_ns);
+
+  // Predicts the pose for the display of |vsync_count|. Returns false if there
+  // is no sample or no vsync timing yet.
+  bool Predict(uint32_t vsync_count, DvrPoseAsync* out_pose) const;
+
+  // Fills |record| with predictions for the current vsync and the ones that
+  // follow it. Returns false if there is no sample or no vsync timing yet.
+  bool Predict(PosePredictionRecord* record) const;
+
+ private:
+  // Extrapolates the latest sample to |timestamp_ns|.
+  void Extrapolate(int64_t timestamp_ns, Eigen::Quaterniond* orientation,
+                   Eigen::Vector3d* position) const;
+
+  LatencyModel latency_model_;
+
+  bool has_sample_ = false;
+  Sample sample_;
+
+  bool has_vsync_ = false;
+  uint32_t vsync_count_ = 0;
+  int64_t display_timestamp_ns_ = 0;
+  int64_t display_period_ns_ = 0;
+  int64_t right_eye_photon_offset_ns_ = 0;
+};
+
+}  // namespace dvr
+}  // namespace android
+
+#endif  // ANDROID_DVR_POSE_PREDICTOR_H_
@@ -10,6 +10,7 @@
 #include <private/dvr/buffer_hub_client.h>
 #include <private/dvr/pose-ipc.h>
 #include <private/dvr/pose_client_internal.h>
+#include <private/dvr/pose_prediction_ring.h>
 #include <private/dvr/sensor_constants.h>
 
 using android::pdx::LocalHandle;
@@ -44,6 +45,9 @@ class PoseClient : public pdx::ClientBase<PoseClient> {
   }
 
   int GetPose(uint32_t vsync_count, DvrPoseAsync* out_pose) {
+    if (GetPredictedPose(vsync_count, out_pose) == 0)
+      return 0;
+
     if (!mapped_pose_buffer_) {
       int ret = GetRingBuffer(nullptr);
       if (ret < 0)
@@ -168,6 +172,66 @@ class PoseClient : public pdx::ClientBase<PoseClient> {
     return 0;
   }
 
+  // Reads the pose for |vsync_count| from the prediction ring, if the pose
+  // service provides one. Returns -ENOENT if it does not, or -EAGAIN if the
+  // ring holds no prediction for |vsync_count|.
+  int GetPredictedPose(uint32_t vsync_count, DvrPoseAsync* out_pose) {
+    if (!prediction_ring_requested_) {
+      prediction_ring_requested_ = true;
+      ImportPredictionRing();
+    }
+    if (!prediction_buffer_)
+      return -ENOENT;
+
+    uint32_t sequence = prediction_ring_.GetNewestSequence();
+    PosePredictionRecord record;
+    if (!prediction_ring_.GetNewest(&sequence, &record))
+      return -EAGAIN;
+
+    const uint32_t offset = vsync_count - record.vsync_count;
+    if (offset >= kPoseAsyncBufferMinFutureCount)
+      return -EAGAIN;
+    *out_pose = record.poses[offset];
+    return 0;
+  }
+
+  // Maps the prediction ring. Pose services that do not publish predictions
+  // fail the request, in which case GetPose() keeps using the pose ring buffer
+  // alone.
+  void ImportPredictionRing() {
+    Transaction trans{*this};
+    Status<LocalChannelHandle> status =
+        trans.Send<LocalChannelHandle>(DVR_POSE_GET_PREDICTION_RING_BUFFER);
+    if (!status) {
+      ALOGI("Pose prediction ring is not available: %s",
+            status.GetErrorMessage().c_str());
+      return;
+    }
+
+    auto buffer = BufferConsumer::Import(status.take());
+    if (!buffer) {
+      ALOGE("Pose failed to import prediction ring");
+      return;
+    }
+    // Map the whole blob rather than PosePredictionRing::MemorySize(), which
+    // is smaller if the service publishes a newer, larger record.
+    const size_t size = buffer->width();
+    void* addr = nullptr;
+    int ret = buffer->GetBlobReadOnlyPointer(size, &addr);
+    if (ret < 0 || !addr) {
+      ALOGE("Pose failed to map prediction ring: ret:%d, addr:%p", ret, addr);
+      return;
+    }
+    bool import_ok;
+    std::tie(prediction_ring_, import_ok) =
+        PosePredictionRing::Import(addr, size);
+    if (!import_ok) {
+      ALOGE("Pose failed to import prediction ring: invalid geometry");
+      return;
+    }
+    prediction_buffer_.swap(buffer);
+  }
+
   int GetControllerRingBuffer(int32_t controller_id) {
     if (controller_id < 0 || controller_id >= arraysize(controllers_)) {
       return -EINVAL;
@@ -261,6 +325,10 @@ class PoseClient : public pdx::ClientBase<PoseClient> {
   std::unique_ptr<BufferConsumer> pose_buffer_;
   const DvrPoseRingBuffer* mapped_pose_buffer_ = nullptr;
 
+  bool prediction_ring_requested_ = false;
+  std::unique_ptr<BufferConsumer> prediction_buffer_;
+  PosePredictionRing prediction_ring_;
+
   struct ControllerClientState {
     std::unique_ptr<BufferConsumer> pose_buffer;
     const DvrPoseAsync* mapped_pose_buffer = nullptr;
@@ -0,0 +1,111 @@
+#include <private/dvr/pose_predictor.h>
+
+#include <algorithm>
+
+namespace android {
+namespace dvr {
+
+namespace {
+
+float32x4_t ToFloat4(const Eigen::Quaterniond& q) {
+  return float32x4_t{static_cast<float>(q.x()), static_cast<float>(q.y()),
+                     static_cast<float>(q.z()), static_cast<float>(q.w())};
+}
+
+float32x4_t ToFloat4(const Eigen::Vector3d& v) {
+  return float32x4_t{static_cast<float>(v.x()), static_cast<float>(v.y()),
+                     static_cast<float>(v.z()), 0.0f};
+}
+
+}  // anonymous namespace
+
+constexpr int64_t PosePredictor::kMaxPredictionNs;
+
+PosePredictor::PosePredictor(size_t latency_window_size)
+    : latency_model_(latency_window_size) {}
+
+void PosePredictor::AddSample(const Sample& sample) {
+  sample_ = sample;
+  has_sample_ = true;
+}
+
+void PosePredictor::NotifyVsync(uint32_t vsync_count,
+                                int64_t display_timestamp_ns,
+                                int64_t display_period_ns,
+                                int64_t right_eye_photon_offset_ns) {
+  vsync_count_ = vsync_count;
+  display_timestamp_ns_ = display_timestamp_ns;
+  display_period_ns_ = display_period_ns;
+  right_eye_photon_offset_ns_ = right_eye_photon_offset_ns;
+  has_vsync_ = true;
+}
+
+void PosePredictor::Extrapolate(int64_t timestamp_ns,
+                                Eigen::Quaterniond* orientation,
+                                Eigen::Vector3d* position) const {
+  // The sample describes the head as it was one fusion latency before it was
+  // received.
+  const int64_t sample_time_ns =
+      sample_.timestamp_ns - latency_model_.CurrentLatencyEstimate();
+  const int64_t delta_ns =
+      std::min(std::max<int64_t>(timestamp_ns - sample_time_ns, 0),
+               kMaxPredictionNs);
+  const double delta_s = delta_ns * 1e-9;
+
+  // The angular velocity is in start space, so the rotation it causes applies
+  // on the start side of the head-from-start orientation.
+  const double angle = sample_.angular_velocity.norm() * delta_s;
+  if (angle > 0.0) {
+    const Eigen::AngleAxisd rotation(
+        angle, sample_.angular_velocity.normalized());
+    *orientation =
+        (sample_.orientation * Eigen::Quaterniond(rotation).inverse())
+            .normalized();
+  } else {
+    *orientation = sample_.orientation;
+  }
+  *position = sample_.position + sample_.velocity * delta_s;
+}
+
+bool PosePredictor::Predict(uint32_t vsync_count,
+                            DvrPoseAsync* out_pose) const {
+  if (!has_sample_ || !has_vsync_)
+    return false;
+
+  // Unsigned arithmetic keeps this correct across vsync count wraparound.
+  const int32_t vsync_offset = static_cast<int32_t>(vsync_count - vsync_count_);
+  const int64_t left_timestamp_ns =
+      display_timestamp_ns_ + vsync_offset * display_period_ns_;
+  const int64_t right_timestamp_ns =
+      left_timestamp_ns + right_eye_photon_offset_ns_;
+
+  Eigen::Quaterniond orientation;
+  Eigen::Vector3d position;
+
+  *out_pose = DvrPoseAsync();
+  Extrapolate(left_timestamp_ns, &orientation, &position);
+  out_pose->orientation = ToFloat4(orientation);
+  out_pose->translation = ToFloat4(position);
+  Extrapolate(right_timestamp_ns, &orientation, &position);
+  out_pose->right_orientation = ToFloat4(orientation);
+  out_pose->right_translation = ToFloat4(position);
+  out_pose->angular_velocity = ToFloat4(sample_.angular_velocity);
+  out_pose->velocity = ToFloat4(sample_.velocity);
+  out_pose->timestamp_ns = left_timestamp_ns;
+  out_pose->flags = DVR_POSE_FLAG_VALID | DVR_POSE_FLAG_HEAD;
+  return true;
+}
+
+bool PosePredictor::Predict(PosePredictionRecord* record) const {
+  if (!has_sample_ || !has_vsync_)
+    return false;
+
+  *record = PosePredictionRecord();
+  record->vsync_count = vsync_count_;
+  for (uint32_t i = 0; i < kPoseAsyncBufferMinFutureCount; i++)
+    Predict(vsync_count_ + i, &record->poses[i]);
+  return true;
+}
+
+}  // namespace dvr
+}  // namespace android
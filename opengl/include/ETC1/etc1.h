@@ -26,6 +26,19 @@ typedef unsigned char etc1_byte;
 typedef int etc1_bool;
 typedef unsigned int etc1_uint32;
 
+// Encoder quality presets.
+//
+// ETC1_QUALITY_FAST only tries the block orientation whose halves are the most uniform.
+// ETC1_QUALITY_MEDIUM tries both orientations; it's what etc1_encode_block and
+// etc1_encode_image use.
+// ETC1_QUALITY_HIGH also tries individual base colors where differential ones would fit,
+// and base colors one quantization step away from the average colors. It's about 36 times
+// slower than ETC1_QUALITY_MEDIUM.
+
+#define ETC1_QUALITY_FAST 0
+#define ETC1_QUALITY_MEDIUM 1
+#define ETC1_QUALITY_HIGH 2
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -43,6 +56,11 @@ extern "C" {
 
 void etc1_encode_block(const etc1_byte* pIn, etc1_uint32 validPixelMask, etc1_byte* pOut);
 
+// Encode a block of pixels, like etc1_encode_block, with one of the ETC1_QUALITY_* presets.
+
+void etc1_encode_block_with_quality(const etc1_byte* pIn, etc1_uint32 validPixelMask,
+        etc1_byte* pOut, etc1_uint32 quality);
+
 // Decode a block of pixels.
 //
 // pIn is an ETC1 compressed version of the data.
@@ -67,6 +85,15 @@ etc1_uint32 etc1_get_encoded_data_size(etc1_uint32 width, etc1_uint32 height);
 int etc1_encode_image(const etc1_byte* pIn, etc1_uint32 width, etc1_uint32 height,
         etc1_uint32 pixelSize, etc1_uint32 stride, etc1_byte* pOut);
 
+// Encode an entire image, like etc1_encode_image, with one of the ETC1_QUALITY_* presets.
+// Rows of blocks are spread over threadCount threads, the calling thread included; 0 uses
+// one thread per CPU. The output doesn't depend on the number of threads.
+// returns non-zero if there is an error.
+
+int etc1_encode_image_with_quality(const etc1_byte* pIn, etc1_uint32 width,
+        etc1_uint32 height, etc1_uint32 pixelSize, etc1_uint32 stride, etc1_byte* pOut,
+        etc1_uint32 quality, etc1_uint32 threadCount);
+
 // Decode an entire image.
 // pIn - pointer to encoded data.
 // pOut - pointer to the image data. Will be written such that
@@ -22,7 +22,8 @@
 
 #include <cutils/properties.h>
 #include <log/log.h>
-#include <chrono>
+#include <algorithm>
+#include <numeric>
 
 namespace android {
 
@@ -39,20 +40,17 @@ BlobCache::BlobCache(size_t maxKeySize, size_t maxValueSize, size_t maxTotalSize
         mMaxKeySize(maxKeySize),
         mMaxValueSize(maxValueSize),
         mMaxTotalSize(maxTotalSize),
-        mTotalSize(0) {
-    int64_t now = std::chrono::steady_clock::now().time_since_epoch().count();
-#ifdef _WIN32
-    srand(now);
-#else
-    mRandState[0] = (now >> 0) & 0xFFFF;
-    mRandState[1] = (now >> 16) & 0xFFFF;
-    mRandState[2] = (now >> 32) & 0xFFFF;
-#endif
-    ALOGV("initializing random seed using %lld", (unsigned long long)now);
+        mTotalSize(0),
+        mAccessClock(0) {
 }
 
 void BlobCache::set(const void* key, size_t keySize, const void* value,
         size_t valueSize) {
+    setEntry(key, keySize, value, valueSize, true);
+}
+
+void BlobCache::setEntry(const void* key, size_t keySize, const void* value,
+        size_t valueSize, bool copyData) {
     if (mMaxKeySize < keySize) {
         ALOGV("set: not caching because the key is too large: %zu (limit: %zu)",
                 keySize, mMaxKeySize);
@@ -84,8 +82,8 @@ void BlobCache::set(const void* key, size_t keySize, const void* value,
         auto index = std::lower_bound(mCacheEntries.begin(), mCacheEntries.end(), dummyEntry);
         if (index == mCacheEntries.end() || dummyEntry < *index) {
             // Create a new cache entry.
-            std::shared_ptr<Blob> keyBlob(new Blob(key, keySize, true));
-            std::shared_ptr<Blob> valueBlob(new Blob(value, valueSize, true));
+            std::shared_ptr<Blob> keyBlob(new Blob(key, keySize, copyData));
+            std::shared_ptr<Blob> valueBlob(new Blob(value, valueSize, copyData));
             size_t newTotalSize = mTotalSize + keySize + valueSize;
             if (mMaxTotalSize < newTotalSize) {
                 if (isCleanable()) {
@@ -100,13 +98,15 @@ void BlobCache::set(const void* key, size_t keySize, const void* value,
                     break;
                 }
             }
-            mCacheEntries.insert(index, CacheEntry(keyBlob, valueBlob));
+            CacheEntry entry(keyBlob, valueBlob);
+            entry.markUsed(tick());
+            mCacheEntries.insert(index, entry);
             mTotalSize = newTotalSize;
             ALOGV("set: created new cache entry with %zu byte key and %zu byte value",
                     keySize, valueSize);
         } else {
             // Update the existing cache entry.
-            std::shared_ptr<Blob> valueBlob(new Blob(value, valueSize, true));
+            std::shared_ptr<Blob> valueBlob(new Blob(value, valueSize, copyData));
             std::shared_ptr<Blob> oldValueBlob(index->getValue());
             size_t newTotalSize = mTotalSize + valueSize - oldValueBlob->getSize();
             if (mMaxTotalSize < newTotalSize) {
@@ -122,6 +122,7 @@ void BlobCache::set(const void* key, size_t keySize, const void* value,
                 }
             }
             index->setValue(valueBlob);
+            index->markUsed(tick());
             mTotalSize = newTotalSize;
             ALOGV("set: updated existing cache entry with %zu byte key and %zu byte "
                     "value", keySize, valueSize);
@@ -147,6 +148,7 @@ size_t BlobCache::get(const void* key, size_t keySize, void* value,
 
     // The key was found. Return the value if the caller's buffer is large
     // enough.
+    index->recordHit(tick());
     std::shared_ptr<Blob> valueBlob(index->getValue());
     size_t valueBlobSize = valueBlob->getSize();
     if (valueBlobSize <= valueSize) {
@@ -188,10 +190,21 @@ int BlobCache::flatten(void* buffer, size_t size) const {
     header->mBuildIdLength = property_get("ro.build.id", buildId, "");
     memcpy(header->mBuildId, buildId, header->mBuildIdLength);
 
-    // Write cache entries
+    // Write cache entries, least recently used first.  unflatten inserts them
+    // in that order, which stamps them with the same relative recency.
+    std::vector<const CacheEntry*> entries;
+    entries.reserve(mCacheEntries.size());
+    for (const CacheEntry& e :  mCacheEntries) {
+        entries.push_back(&e);
+    }
+    std::sort(entries.begin(), entries.end(), [](const CacheEntry* a, const CacheEntry* b) {
+        return a->getLastUse() < b->getLastUse();
+    });
+
     uint8_t* byteBuffer = reinterpret_cast<uint8_t*>(buffer);
     off_t byteOffset = align4(sizeof(Header) + header->mBuildIdLength);
-    for (const CacheEntry& e :  mCacheEntries) {
+    for (const CacheEntry* entry : entries) {
+        const CacheEntry& e = *entry;
         std::shared_ptr<Blob> const& keyBlob = e.getKey();
         std::shared_ptr<Blob> const& valueBlob = e.getValue();
         size_t keySize = keyBlob->getSize();
@@ -223,9 +236,10 @@ int BlobCache::flatten(void* buffer, size_t size) const {
     return 0;
 }
 
-int BlobCache::unflatten(void const* buffer, size_t size) {
+int BlobCache::unflatten(void const* buffer, size_t size, bool copyData) {
     // All errors should result in the BlobCache being in an empty state.
     mCacheEntries.clear();
+    mTotalSize = 0;
 
     // Read the cache header
     if (size < sizeof(Header)) {
@@ -272,7 +286,7 @@ int BlobCache::unflatten(void const* buffer, size_t size) {
         }
 
         const uint8_t* data = eheader->mData;
-        set(data, keySize, data + keySize, valueSize);
+        setEntry(data, keySize, data + keySize, valueSize, copyData);
 
         byteOffset += totalSize;
     }
@@ -280,23 +294,51 @@ int BlobCache::unflatten(void const* buffer, size_t size) {
     return 0;
 }
 
-long int BlobCache::blob_random() {
-#ifdef _WIN32
-    return rand();
-#else
-    return nrand48(mRandState);
-#endif
+uint64_t BlobCache::tick() {
+    return mAccessClock.fetch_add(1, std::memory_order_relaxed) + 1;
 }
 
 void BlobCache::clean() {
-    // Remove a random cache entry until the total cache size gets below half
+    auto entrySize = [](const CacheEntry& e) {
+        return e.getKey()->getSize() + e.getValue()->getSize();
+    };
+
+    // Pick the eviction order without moving anything, so that the entries
+    // that stay are still sorted by key.
+    std::vector<size_t> order(mCacheEntries.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [this, &entrySize](size_t a, size_t b) {
+        const CacheEntry& ea = mCacheEntries[a];
+        const CacheEntry& eb = mCacheEntries[b];
+        if (ea.getLastUse() != eb.getLastUse()) {
+            return ea.getLastUse() < eb.getLastUse();
+        }
+        if (ea.getHits() != eb.getHits()) {
+            return ea.getHits() < eb.getHits();
+        }
+        return entrySize(ea) > entrySize(eb);
+    });
+
+    // Evict entries in that order until the total cache size gets below half
     // the maximum total cache size.
-    while (mTotalSize > mMaxTotalSize / 2) {
-        size_t i = size_t(blob_random() % (mCacheEntries.size()));
-        const CacheEntry& entry(mCacheEntries[i]);
-        mTotalSize -= entry.getKey()->getSize() + entry.getValue()->getSize();
-        mCacheEntries.erase(mCacheEntries.begin() + i);
+    std::vector<bool> evicted(mCacheEntries.size(), false);
+    for (size_t i : order) {
+        if (mTotalSize <= mMaxTotalSize / 2) {
+            break;
+        }
+        mTotalSize -= entrySize(mCacheEntries[i]);
+        evicted[i] = true;
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < mCacheEntries.size(); i++) {
+        if (!evicted[i]) {
+            if (kept != i) {
+                mCacheEntries[kept] = mCacheEntries[i];
+            }
+            kept++;
+        }
     }
+    mCacheEntries.erase(mCacheEntries.begin() + kept, mCacheEntries.end());
 }
 
 bool BlobCache::isCleanable() const {
@@ -334,18 +376,24 @@ size_t BlobCache::Blob::getSize() const {
     return mSize;
 }
 
-BlobCache::CacheEntry::CacheEntry() {
+BlobCache::CacheEntry::CacheEntry():
+        mLastUse(0),
+        mHits(0) {
 }
 
 BlobCache::CacheEntry::CacheEntry(
         const std::shared_ptr<Blob>& key, const std::shared_ptr<Blob>& value):
         mKey(key),
-        mValue(value) {
+        mValue(value),
+        mLastUse(0),
+        mHits(0) {
 }
 
 BlobCache::CacheEntry::CacheEntry(const CacheEntry& ce):
         mKey(ce.mKey),
-        mValue(ce.mValue) {
+        mValue(ce.mValue),
+        mLastUse(ce.getLastUse()),
+        mHits(ce.getHits()) {
 }
 
 bool BlobCache::CacheEntry::operator<(const CacheEntry& rhs) const {
@@ -355,6 +403,8 @@ bool BlobCache::CacheEntry::operator<(const CacheEntry& rhs) const {
 const BlobCache::CacheEntry& BlobCache::CacheEntry::operator=(const CacheEntry& rhs) {
     mKey = rhs.mKey;
     mValue = rhs.mValue;
+    mLastUse.store(rhs.getLastUse(), std::memory_order_relaxed);
+    mHits.store(rhs.getHits(), std::memory_order_relaxed);
     return *this;
 }
 
@@ -370,4 +420,25 @@ void BlobCache::CacheEntry::setValue(const std::shared_ptr<Blob>& value) {
     mValue = value;
 }
 
+void BlobCache::CacheEntry::markUsed(uint64_t now) {
+    // Concurrent gets can race to stamp the entry; keep the most recent use.
+    uint64_t last = mLastUse.load(std::memory_order_relaxed);
+    while (last < now &&
+            !mLastUse.compare_exchange_weak(last, now, std::memory_order_relaxed)) {
+    }
+}
+
+void BlobCache::CacheEntry::recordHit(uint64_t now) {
+    markUsed(now);
+    mHits.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t BlobCache::CacheEntry::getLastUse() const {
+    return mLastUse.load(std::memory_order_relaxed);
+}
+
+uint32_t BlobCache::CacheEntry::getHits() const {
+    return mHits.load(std::memory_order_relaxed);
+}
+
 } // namespace android
@@ -19,13 +19,19 @@
 
 #include <stddef.h>
 
+#include <atomic>
 #include <memory>
 #include <vector>
 
 namespace android {
 
 // A BlobCache is an in-memory cache for binary key/value pairs.  A BlobCache
-// does NOT provide any thread-safety guarantees.
+// does NOT provide any thread-safety guarantees, with one exception: any
+// number of threads may call get concurrently, as long as nothing else is
+// called on the cache at the same time.  That lets the owner guard it with a
+// reader-writer lock.
+//
+// When the cache fills up, the least recently used entries are evicted first.
 //
 // The cache contents can be serialized to an in-memory buffer or mmap'd file
 // and then reloaded in a subsequent execution of the program.  This
@@ -47,7 +53,8 @@ public:
     // put in the cache (based on the maxKeySize, maxValueSize, and maxTotalSize
     // values specified to the BlobCache constructor), then the key/value pair
     // will be in the cache after set returns.  Note, however, that a subsequent
-    // call to set may evict old key/value pairs from the cache.
+    // call to set may evict the least recently used key/value pairs from the
+    // cache.
     //
     // Preconditions:
     //   key != NULL
@@ -63,7 +70,8 @@ public:
     // is non-NULL and the size of the cached value is less than valueSize bytes
     // then the cached value is copied into the buffer pointed to by the value
     // argument.  If the key is not present in the cache then 0 is returned and
-    // the buffer pointed to by the value argument is not modified.
+    // the buffer pointed to by the value argument is not modified.  A
+    // successful lookup marks the entry as recently used.
     //
     // Note that when calling get multiple times with the same key, the later
     // calls may fail, returning 0, even if earlier calls succeeded.  The return
@@ -83,7 +91,8 @@ public:
     // flatten serializes the current contents of the cache into the memory
     // pointed to by 'buffer'.  The serialized cache contents can later be
     // loaded into a BlobCache object using the unflatten method.  The contents
-    // of the BlobCache object will not be modified.
+    // of the BlobCache object will not be modified.  Entries are written from
+    // least to most recently used, so that unflatten restores their order.
     //
     // Preconditions:
     //   size >= this.getFlattenedSize()
@@ -95,20 +104,33 @@ public:
     // unflattening the serialized cache contents then the BlobCache will be
     // left in an empty state.
     //
-    int unflatten(void const* buffer, size_t size);
+    // If copyData is false, the loaded keys and values point into 'buffer'
+    // instead of being copied, e.g. to look entries up in place in an mmap'd
+    // file.  The buffer must then stay valid and unchanged until the BlobCache
+    // is destroyed or unflatten is called again.  Entries set afterwards are
+    // copied as usual.
+    //
+    int unflatten(void const* buffer, size_t size, bool copyData = true);
 
 private:
     // Copying is disallowed.
     BlobCache(const BlobCache&);
     void operator=(const BlobCache&);
 
-    // A random function helper to get around MinGW not having nrand48()
-    long int blob_random();
+    // setEntry implements set.  If copyData is false, the new entry refers to
+    // the key and value memory instead of copying it.
+    void setEntry(const void* key, size_t keySize, const void* value,
+            size_t valueSize, bool copyData);
 
-    // clean evicts a randomly chosen set of entries from the cache such that
+    // clean evicts the least recently used entries from the cache such that
     // the total size of all remaining entries is less than mMaxTotalSize/2.
+    // Entries that were last used at the same time are evicted in order of
+    // fewest hits first, then largest first.
     void clean();
 
+    // tick returns a new value of the access clock, to stamp an entry with.
+    uint64_t tick();
+
     // isCleanable returns true if the cache is full enough for the clean method
     // to have some effect, and false otherwise.
     bool isCleanable() const;
@@ -155,6 +177,15 @@ private:
 
         void setValue(const std::shared_ptr<Blob>& value);
 
+        // markUsed stamps the entry with the given access clock value, and
+        // recordHit does the same while also counting a hit.  Both may be
+        // called concurrently for the same entry.
+        void markUsed(uint64_t now);
+        void recordHit(uint64_t now);
+
+        uint64_t getLastUse() const;
+        uint32_t getHits() const;
+
     private:
 
         // mKey is the key that identifies the cache entry.
@@ -162,6 +193,13 @@ private:
 
         // mValue is the cached data associated with the key.
         std::shared_ptr<Blob> mValue;
+
+        // mLastUse is the access clock value at which the entry was last set
+        // or found by get.  It is atomic because concurrent gets update it.
+        std::atomic<uint64_t> mLastUse;
+
+        // mHits is the number of times the entry was found by get.
+        std::atomic<uint32_t> mHits;
     };
 
     // A Header is the header for the entire BlobCache serialization format. No
@@ -231,9 +269,9 @@ private:
     // the cache.
     size_t mTotalSize;
 
-    // mRandState is the pseudo-random number generator state. It is passed to
-    // nrand48 to generate random numbers when needed.
-    unsigned short mRandState[3];
+    // mAccessClock counts calls that touch an entry, and orders the entries
+    // by recency of use.  It is atomic because concurrent gets advance it.
+    std::atomic<uint64_t> mAccessClock;
 
     // mCacheEntries stores all the cache entries that are resident in memory.
     // Cache entries are added to it by the 'set' method.
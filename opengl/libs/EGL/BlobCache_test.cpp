@@ -267,6 +267,31 @@ TEST_F(BlobCacheTest, ExceedingTotalLimitHalvesCacheSize) {
     ASSERT_EQ(maxEntries/2 + 1, numCached);
 }
 
+TEST_F(BlobCacheTest, ExceedingTotalLimitEvictsLeastRecentlyUsed) {
+    // Fill up the entire cache with 1 char key/value pairs.
+    const int maxEntries = MAX_TOTAL_SIZE / 2;
+    for (int i = 0; i < maxEntries; i++) {
+        uint8_t k = i;
+        mBC->set(&k, 1, "x", 1);
+    }
+    // Use the two oldest entries again.
+    for (int i = 0; i < 2; i++) {
+        uint8_t k = i;
+        ASSERT_EQ(size_t(1), mBC->get(&k, 1, NULL, 0));
+    }
+    // Insert one more entry, causing a cache overflow.
+    {
+        uint8_t k = maxEntries;
+        mBC->set(&k, 1, "x", 1);
+    }
+    // The entries that weren't used since they were set are the ones to go.
+    for (int i = 0; i < maxEntries+1; i++) {
+        uint8_t k = i;
+        bool evicted = i >= 2 && i < maxEntries - 1;
+        ASSERT_EQ(evicted ? size_t(0) : size_t(1), mBC->get(&k, 1, NULL, 0)) << "key " << i;
+    }
+}
+
 class BlobCacheFlattenTest : public BlobCacheTest {
 protected:
     virtual void SetUp() {
@@ -342,6 +367,56 @@ TEST_F(BlobCacheFlattenTest, FlattenDoesntChangeCache) {
     }
 }
 
+TEST_F(BlobCacheFlattenTest, UnflattenWithoutCopyingReadsFromBuffer) {
+    unsigned char buf[4] = { 0xee, 0xee, 0xee, 0xee };
+    mBC->set("abcd", 4, "efgh", 4);
+
+    size_t size = mBC->getFlattenedSize();
+    std::unique_ptr<uint8_t[]> flat(new uint8_t[size]);
+    ASSERT_EQ(OK, mBC->flatten(flat.get(), size));
+    ASSERT_EQ(OK, mBC2->unflatten(flat.get(), size, false));
+
+    ASSERT_EQ(size_t(4), mBC2->get("abcd", 4, buf, 4));
+    ASSERT_EQ('e', buf[0]);
+    ASSERT_EQ('f', buf[1]);
+    ASSERT_EQ('g', buf[2]);
+    ASSERT_EQ('h', buf[3]);
+
+    // Setting a new value replaces the one in the buffer.
+    mBC2->set("abcd", 4, "ijkl", 4);
+    ASSERT_EQ(size_t(4), mBC2->get("abcd", 4, buf, 4));
+    ASSERT_EQ('i', buf[0]);
+    ASSERT_EQ('l', buf[3]);
+}
+
+TEST_F(BlobCacheFlattenTest, UnflattenKeepsRecencyOrder) {
+    // Fill up the entire cache with 1 char key/value pairs, then use the
+    // oldest one again.
+    const int maxEntries = MAX_TOTAL_SIZE / 2;
+    for (int i = 0; i < maxEntries; i++) {
+        uint8_t k = i;
+        mBC->set(&k, 1, "x", 1);
+    }
+    {
+        uint8_t k = 0;
+        ASSERT_EQ(size_t(1), mBC->get(&k, 1, NULL, 0));
+    }
+
+    roundTrip();
+
+    // Overflowing the deserialized cache evicts the least recently used
+    // entries, as it would have in the original one.
+    {
+        uint8_t k = maxEntries;
+        mBC2->set(&k, 1, "x", 1);
+    }
+    for (int i = 0; i < maxEntries+1; i++) {
+        uint8_t k = i;
+        bool evicted = i >= 1 && i < maxEntries / 2 + 1;
+        ASSERT_EQ(evicted ? size_t(0) : size_t(1), mBC2->get(&k, 1, NULL, 0)) << "key " << i;
+    }
+}
+
 TEST_F(BlobCacheFlattenTest, FlattenCatchesBufferTooSmall) {
     // Fill up the entire cache with 1 char key/value pairs.
     const int maxEntries = MAX_TOTAL_SIZE / 2;
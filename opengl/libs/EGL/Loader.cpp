@@ -19,6 +19,7 @@
 
 #include "Loader.h"
 
+#include <chrono>
 #include <string>
 
 #include <dirent.h>
@@ -221,6 +222,8 @@ void* Loader::open(egl_connection_t* cnx)
     void* dso;
     driver_t* hnd = 0;
 
+    const auto loadStart = std::chrono::steady_clock::now();
+
     setEmulatorGlesValue();
 
     dso = load_driver("GLES", cnx, EGL | GLESv1_CM | GLESv2);
@@ -248,6 +251,10 @@ void* Loader::open(egl_connection_t* cnx)
     LOG_ALWAYS_FATAL_IF(!cnx->libGles2 || !cnx->libGles1,
             "couldn't load system OpenGL ES wrapper libraries");
 
+    GraphicsEnv::getInstance().setDriverLoadTime(GraphicsEnv::Api::GL,
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - loadStart).count());
+
     return (void*)hnd;
 }
 
@@ -14,7 +14,11 @@
  ** limitations under the License.
  */
 
+#include <errno.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include <hardware/gralloc.h>
 
@@ -24,6 +28,8 @@
 
 #include <log/log.h>
 
+#include <private/EGL/preload.h>
+
 #include "../egl_impl.h"
 
 #include "egldefs.h"
@@ -205,6 +211,35 @@ EGLBoolean egl_init_drivers() {
     return res;
 }
 
+// Write-protects the pages that hold nothing but resolved GL entry points.
+// Nothing writes them once the driver is loaded (eglGetProcAddress only fills
+// in the ext tables), so in forked apps they stay shared with the zygote; a
+// stray write now faults instead of quietly giving the app a private copy.
+static void freeze_gl_hooks_locked() {
+    const uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+    for (gl_hooks_t& hooks : gHooks) {
+        uintptr_t start = reinterpret_cast<uintptr_t>(&hooks.gl);
+        uintptr_t end = start + sizeof(hooks.gl);
+        start = (start + pageSize - 1) & ~(pageSize - 1);
+        end &= ~(pageSize - 1);
+        if (start < end && mprotect(reinterpret_cast<void*>(start), end - start, PROT_READ)) {
+            ALOGW("couldn't write-protect the GL dispatch table: %s", strerror(errno));
+        }
+    }
+}
+
+bool egl_preload_drivers() {
+    pthread_mutex_lock(&sInitDriverMutex);
+    bool loaded = egl_init_drivers_locked() == EGL_TRUE;
+    static bool frozen = false;
+    if (loaded && !frozen) {
+        freeze_gl_hooks_locked();
+        frozen = true;
+    }
+    pthread_mutex_unlock(&sInitDriverMutex);
+    return loaded;
+}
+
 static pthread_mutex_t sLogPrintMutex = PTHREAD_MUTEX_INITIALIZER;
 static std::chrono::steady_clock::time_point sLogPrintTime;
 static constexpr std::chrono::seconds DURATION(1);
@@ -33,6 +33,7 @@
 #include <cutils/properties.h>
 #include <log/log.h>
 
+#include <chrono>
 #include <condition_variable>
 #include <deque>
 #include <mutex>
@@ -42,6 +43,7 @@
 
 #include "../egl_impl.h"
 
+#include "egl_call_trace.h"
 #include "egl_display.h"
 #include "egl_object.h"
 #include "egl_tls.h"
@@ -261,7 +263,6 @@ static void(*findProcAddress(const char* name,
 extern void setGLHooksThreadSpecific(gl_hooks_t const *value);
 extern EGLBoolean egl_init_drivers();
 extern const __eglMustCastToProperFunctionPointerType gExtensionForwarders[MAX_NUMBER_OF_GL_EXTENSIONS];
-extern gl_hooks_t gHooksTrace;
 
 } // namespace android;
 
@@ -572,6 +573,12 @@ EGLSurface eglCreateWindowSurface(  EGLDisplay dpy, EGLConfig config,
         ANativeWindow* anw = reinterpret_cast<ANativeWindow*>(window);
         anw->setSwapInterval(anw, 1);
 
+        // Frame pacing works off the compositor timing, which is only
+        // reported with frame timestamps enabled.
+        if (dp->paceFrames) {
+            native_window_enable_frame_timestamps(window, true);
+        }
+
         EGLSurface surface = cnx->egl.eglCreateWindowSurface(
                 iDpy, config, window, attrib_list);
         if (surface != EGL_NO_SURFACE) {
@@ -819,7 +826,8 @@ EGLBoolean eglMakeCurrent(  EGLDisplay dpy, EGLSurface draw,
 
     if (result == EGL_TRUE) {
         if (c) {
-            setGLHooksThreadSpecific(c->cnx->hooks[c->version]);
+            setGLHooksThreadSpecific(
+                    egl_call_trace_hooks(c->cnx->hooks[c->version], c->version));
             egl_tls_t::setContext(ctx);
             _c.acquire();
             _r.acquire();
@@ -1050,6 +1058,7 @@ __eglMustCastToProperFunctionPointerType eglGetProcAddress(const char *procname)
                 cnx->hooks[egl_connection_t::GLESv1_INDEX]->ext.extensions[slot] =
                 cnx->hooks[egl_connection_t::GLESv2_INDEX]->ext.extensions[slot] =
                         cnx->egl.eglGetProcAddress(procname);
+                egl_call_trace_set_extension(slot, addr);
                 if (addr) found = true;
             }
 
@@ -1138,6 +1147,9 @@ private:
     std::mutex mMutex;
 };
 
+static EGLBoolean swapBuffersWithDamage(const egl_display_ptr& dp,
+        egl_surface_t const* s, EGLint *rects, EGLint n_rects);
+
 EGLBoolean eglSwapBuffersWithDamageKHR(EGLDisplay dpy, EGLSurface draw,
         EGLint *rects, EGLint n_rects)
 {
@@ -1151,7 +1163,9 @@ EGLBoolean eglSwapBuffersWithDamageKHR(EGLDisplay dpy, EGLSurface draw,
     if (!_s.get())
         return setError(EGL_BAD_SURFACE, (EGLBoolean)EGL_FALSE);
 
-    egl_surface_t const * const s = get_surface(draw);
+    egl_surface_t * const s = get_surface(draw);
+
+    egl_call_trace_poll();
 
     if (CC_UNLIKELY(dp->traceGpuCompletion)) {
         EGLSyncKHR sync = eglCreateSyncKHR(dpy, EGL_SYNC_FENCE_KHR, NULL);
@@ -1170,10 +1184,25 @@ EGLBoolean eglSwapBuffersWithDamageKHR(EGLDisplay dpy, EGLSurface draw,
         }
     }
 
+    int64_t holdOff = CC_UNLIKELY(dp->paceFrames) ? s->paceFrame() : 0;
+
+    EGLBoolean result;
     if (n_rects == 0) {
-        return s->cnx->egl.eglSwapBuffers(dp->disp.dpy, s->surface);
+        result = s->cnx->egl.eglSwapBuffers(dp->disp.dpy, s->surface);
+    } else {
+        result = swapBuffersWithDamage(dp, s, rects, n_rects);
     }
 
+    if (holdOff > 0) {
+        ATRACE_NAME("frame pacing");
+        std::this_thread::sleep_for(std::chrono::nanoseconds(holdOff));
+    }
+    return result;
+}
+
+static EGLBoolean swapBuffersWithDamage(const egl_display_ptr& dp,
+        egl_surface_t const* s, EGLint *rects, EGLint n_rects)
+{
     std::vector<android_native_rect_t> androidRects((size_t)n_rects);
     for (int r = 0; r < n_rects; ++r) {
         int offset = r * 4;
@@ -1367,6 +1396,17 @@ EGLBoolean eglSwapInterval(EGLDisplay dpy, EGLint interval)
         res = cnx->egl.eglSwapInterval(dp->disp.dpy, interval);
     }
 
+    // The interval applies to the current draw surface, and sets how far
+    // apart frame pacing spaces its frames.
+    EGLContext ctx = getContext();
+    if (res == EGL_TRUE && ctx != EGL_NO_CONTEXT) {
+        egl_context_t const * const c = get_context(ctx);
+        SurfaceRef _s(dp.get(), c->draw);
+        if (_s.get()) {
+            _s.get()->setSwapInterval(interval);
+        }
+    }
+
     return res;
 }
 
@@ -1878,8 +1918,9 @@ EGLBoolean eglPresentationTimeANDROID(EGLDisplay dpy, EGLSurface surface,
         return EGL_FALSE;
     }
 
-    egl_surface_t const * const s = get_surface(surface);
+    egl_surface_t * const s = get_surface(surface);
     native_window_set_buffers_timestamp(s->getNativeWindow(), time);
+    s->onPresentationTimeSet();
 
     return EGL_TRUE;
 }
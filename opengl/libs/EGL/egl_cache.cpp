@@ -29,7 +29,9 @@
 
 #include <thread>
 
+#include <cutils/properties.h>
 #include <log/log.h>
+#include <ui/GraphicsEnv.h>
 
 // Cache size limits.
 static const size_t maxKeySize = 12 * 1024;
@@ -40,9 +42,41 @@ static const size_t maxTotalSize = 2 * 1024 * 1024;
 static const char* cacheFileMagic = "EGL$";
 static const size_t cacheFileHeaderSize = 8;
 
+// The optional shared cache is a read-only cache file, in the same format as
+// the per-process ones, holding shaders that most processes compile (e.g. the
+// HWUI ones).  Its path is given by this property.  The shared cache is only
+// looked up when the per-process cache misses.
+static const char* sharedCacheFileProperty = "ro.egl.shared_blob_cache";
+static const size_t maxSharedTotalSize = 8 * 1024 * 1024;
+
 // The time in seconds to wait before saving newly inserted cache entries.
 static const unsigned int deferredSaveDelay = 4;
 
+// New entries are appended to a journal next to the cache file, which gets
+// folded into the cache file once it grows past this size.
+static const char* journalSuffix = ".journal";
+static const size_t maxJournalSize = maxTotalSize / 4;
+
+// The journal starts with a JournalHeader, so that it's discarded along with
+// the cache file after a build update.  Each entry is a JournalRecordHeader
+// followed by the key and then the value.
+static const uint32_t journalMagic = ('E' << 24) + ('G' << 16) + ('L' << 8) + 'j';
+static const uint32_t journalRecordMagic = ('E' << 24) + ('G' << 16) + ('L' << 8) + 'r';
+
+struct JournalHeader {
+    uint32_t mMagicNumber;
+    int32_t mBuildIdLength;
+    char mBuildId[PROPERTY_VALUE_MAX];
+};
+
+struct JournalRecordHeader {
+    uint32_t mMagicNumber;
+    uint32_t mKeySize;
+    uint32_t mValueSize;
+    // mCrc is the crc32c of the key and value data.
+    uint32_t mCrc;
+};
+
 // ----------------------------------------------------------------------------
 namespace android {
 // ----------------------------------------------------------------------------
@@ -71,7 +105,14 @@ static EGLsizeiANDROID getBlob(const void* key, EGLsizeiANDROID keySize,
 // egl_cache_t definition
 //
 egl_cache_t::egl_cache_t() :
-        mInitialized(false) {
+        mInitialized(false),
+        mSavePending(false),
+        mMappedCache(NULL),
+        mMappedCacheSize(0),
+        mMappedSharedCache(NULL),
+        mMappedSharedCacheSize(0),
+        mJournalFd(-1),
+        mJournalSize(0) {
 }
 
 egl_cache_t::~egl_cache_t() {
@@ -84,7 +125,7 @@ egl_cache_t* egl_cache_t::get() {
 }
 
 void egl_cache_t::initialize(egl_display_t *display) {
-    std::lock_guard<std::mutex> lock(mMutex);
+    std::lock_guard<std::shared_timed_mutex> lock(mMutex);
 
     egl_connection_t* const cnx = &gEGLImpl;
     if (cnx->dso && cnx->major >= 0 && cnx->minor >= 0) {
@@ -122,14 +163,18 @@ void egl_cache_t::initialize(egl_display_t *display) {
 }
 
 void egl_cache_t::terminate() {
-    std::lock_guard<std::mutex> lock(mMutex);
-    saveBlobCacheLocked();
-    mBlobCache = NULL;
+    std::lock_guard<std::shared_timed_mutex> lock(mMutex);
+    // With a journal, everything is on disk already; compacting it is left
+    // to the deferred save.
+    if (mJournalFd == -1) {
+        saveBlobCacheLocked();
+    }
+    releaseBlobCacheLocked();
 }
 
 void egl_cache_t::setBlob(const void* key, EGLsizeiANDROID keySize,
         const void* value, EGLsizeiANDROID valueSize) {
-    std::lock_guard<std::mutex> lock(mMutex);
+    std::lock_guard<std::shared_timed_mutex> lock(mMutex);
 
     if (keySize < 0 || valueSize < 0) {
         ALOGW("EGL_ANDROID_blob_cache set: negative sizes are not allowed");
@@ -139,16 +184,13 @@ void egl_cache_t::setBlob(const void* key, EGLsizeiANDROID keySize,
     if (mInitialized) {
         BlobCache* bc = getBlobCacheLocked();
         bc->set(key, keySize, value, valueSize);
+        bool journaled = appendJournalLocked(key, keySize, value, valueSize);
 
-        if (!mSavePending) {
+        if ((!journaled || mJournalSize > maxJournalSize) && !mSavePending) {
             mSavePending = true;
             std::thread deferredSaveThread([this]() {
                 sleep(deferredSaveDelay);
-                std::lock_guard<std::mutex> lock(mMutex);
-                if (mInitialized) {
-                    saveBlobCacheLocked();
-                }
-                mSavePending = false;
+                compactBlobCache();
             });
             deferredSaveThread.detach();
         }
@@ -157,29 +199,61 @@ void egl_cache_t::setBlob(const void* key, EGLsizeiANDROID keySize,
 
 EGLsizeiANDROID egl_cache_t::getBlob(const void* key, EGLsizeiANDROID keySize,
         void* value, EGLsizeiANDROID valueSize) {
-    std::lock_guard<std::mutex> lock(mMutex);
-
     if (keySize < 0 || valueSize < 0) {
         ALOGW("EGL_ANDROID_blob_cache set: negative sizes are not allowed");
         return 0;
     }
 
+    {
+        // Lookups don't change the cache contents, so threads compiling
+        // shaders in parallel can do them at the same time.
+        std::shared_lock<std::shared_timed_mutex> lock(mMutex);
+        if (!mInitialized) {
+            return 0;
+        }
+        if (mBlobCache != nullptr) {
+            return getBlobLocked(key, keySize, value, valueSize);
+        }
+    }
+
+    // The first lookup creates the cache and loads it from disk, which needs
+    // exclusive access.
+    std::lock_guard<std::shared_timed_mutex> lock(mMutex);
     if (mInitialized) {
-        BlobCache* bc = getBlobCacheLocked();
-        return bc->get(key, keySize, value, valueSize);
+        getBlobCacheLocked();
+        return getBlobLocked(key, keySize, value, valueSize);
     }
     return 0;
 }
 
+EGLsizeiANDROID egl_cache_t::getBlobLocked(const void* key, EGLsizeiANDROID keySize,
+        void* value, EGLsizeiANDROID valueSize) {
+    size_t size = mBlobCache->get(key, keySize, value, valueSize);
+    if (size == 0 && mSharedBlobCache != nullptr) {
+        // Entries found in the shared cache aren't copied into mBlobCache:
+        // the shared cache is there on every run, so that would only take
+        // room from the entries it doesn't have.
+        size = mSharedBlobCache->get(key, keySize, value, valueSize);
+    }
+    GraphicsEnv::getInstance().recordShaderCacheLookup(size != 0);
+    return size;
+}
+
 void egl_cache_t::setCacheFilename(const char* filename) {
-    std::lock_guard<std::mutex> lock(mMutex);
+    std::lock_guard<std::shared_timed_mutex> lock(mMutex);
     mFilename = filename;
 }
 
+void egl_cache_t::setSharedCacheFilename(const char* filename) {
+    std::lock_guard<std::shared_timed_mutex> lock(mMutex);
+    mSharedFilename = filename;
+}
+
 BlobCache* egl_cache_t::getBlobCacheLocked() {
     if (mBlobCache == nullptr) {
         mBlobCache.reset(new BlobCache(maxKeySize, maxValueSize, maxTotalSize));
         loadBlobCacheLocked();
+        loadSharedCacheLocked();
     }
     return mBlobCache.get();
 }
@@ -200,138 +274,354 @@ static uint32_t crc32c(const uint8_t* buf, size_t len) {
     return r;
 }
 
-void egl_cache_t::saveBlobCacheLocked() {
-    if (mFilename.length() > 0 && mBlobCache != NULL) {
-        size_t cacheSize = mBlobCache->getFlattenedSize();
-        size_t headerSize = cacheFileHeaderSize;
-        const char* fname = mFilename.c_str();
+bool egl_cache_t::flattenBlobCacheLocked(std::vector<uint8_t>* buf) {
+    size_t cacheSize = mBlobCache->getFlattenedSize();
+    size_t headerSize = cacheFileHeaderSize;
+    buf->resize(headerSize + cacheSize);
 
-        // Try to create the file with no permissions so we can write it
-        // without anyone trying to read it.
-        int fd = open(fname, O_CREAT | O_EXCL | O_RDWR, 0);
-        if (fd == -1) {
-            if (errno == EEXIST) {
-                // The file exists, delete it and try again.
-                if (unlink(fname) == -1) {
-                    // No point in retrying if the unlink failed.
-                    ALOGE("error unlinking cache file %s: %s (%d)", fname,
-                            strerror(errno), errno);
-                    return;
-                }
-                // Retry now that we've unlinked the file.
-                fd = open(fname, O_CREAT | O_EXCL | O_RDWR, 0);
-            }
-            if (fd == -1) {
-                ALOGE("error creating cache file %s: %s (%d)", fname,
+    int err = mBlobCache->flatten(buf->data() + headerSize, cacheSize);
+    if (err < 0) {
+        ALOGE("error writing cache contents: %s (%d)", strerror(-err),
+                -err);
+        return false;
+    }
+
+    // Write the file magic and CRC
+    memcpy(buf->data(), cacheFileMagic, 4);
+    uint32_t* crc = reinterpret_cast<uint32_t*>(buf->data() + 4);
+    *crc = crc32c(buf->data() + headerSize, cacheSize);
+    return true;
+}
+
+// Writes the file under a temporary name and renames it into place, so that
+// the file being replaced, which may be mapped, is never modified.
+static bool writeCacheFile(const std::string& filename, const std::vector<uint8_t>& buf) {
+    std::string tmpName = filename + ".tmp";
+    const char* fname = tmpName.c_str();
+
+    // Try to create the file with no permissions so we can write it
+    // without anyone trying to read it.
+    int fd = open(fname, O_CREAT | O_EXCL | O_RDWR, 0);
+    if (fd == -1) {
+        if (errno == EEXIST) {
+            // A previous save didn't finish; delete it and try again.
+            if (unlink(fname) == -1) {
+                // No point in retrying if the unlink failed.
+                ALOGE("error unlinking cache file %s: %s (%d)", fname,
                         strerror(errno), errno);
-                return;
+                return false;
             }
+            // Retry now that we've unlinked the file.
+            fd = open(fname, O_CREAT | O_EXCL | O_RDWR, 0);
         }
-
-        size_t fileSize = headerSize + cacheSize;
-
-        uint8_t* buf = new uint8_t [fileSize];
-        if (!buf) {
-            ALOGE("error allocating buffer for cache contents: %s (%d)",
+        if (fd == -1) {
+            ALOGE("error creating cache file %s: %s (%d)", fname,
                     strerror(errno), errno);
-            close(fd);
-            unlink(fname);
-            return;
+            return false;
         }
+    }
 
-        int err = mBlobCache->flatten(buf + headerSize, cacheSize);
-        if (err < 0) {
-            ALOGE("error writing cache contents: %s (%d)", strerror(-err),
-                    -err);
-            delete [] buf;
-            close(fd);
-            unlink(fname);
-            return;
-        }
+    if (write(fd, buf.data(), buf.size()) != static_cast<ssize_t>(buf.size())) {
+        ALOGE("error writing cache file: %s (%d)", strerror(errno),
+                errno);
+        close(fd);
+        unlink(fname);
+        return false;
+    }
 
-        // Write the file magic and CRC
-        memcpy(buf, cacheFileMagic, 4);
-        uint32_t* crc = reinterpret_cast<uint32_t*>(buf + 4);
-        *crc = crc32c(buf + headerSize, cacheSize);
+    fchmod(fd, S_IRUSR);
+    close(fd);
+    if (rename(fname, filename.c_str()) == -1) {
+        ALOGE("error renaming cache file %s: %s (%d)", fname,
+                strerror(errno), errno);
+        unlink(fname);
+        return false;
+    }
+    return true;
+}
 
-        if (write(fd, buf, fileSize) == -1) {
-            ALOGE("error writing cache file: %s (%d)", strerror(errno),
-                    errno);
-            delete [] buf;
-            close(fd);
-            unlink(fname);
+void egl_cache_t::saveBlobCacheLocked() {
+    if (mFilename.length() > 0 && mBlobCache != NULL) {
+        std::vector<uint8_t> buf;
+        if (flattenBlobCacheLocked(&buf) && writeCacheFile(mFilename, buf)) {
+            resetJournalLocked();
+        }
+    }
+}
+
+void egl_cache_t::compactBlobCache() {
+    std::vector<uint8_t> buf;
+    std::string filename;
+    size_t journalSize;
+    {
+        std::lock_guard<std::shared_timed_mutex> lock(mMutex);
+        if (!mInitialized || mFilename.empty() || mBlobCache == NULL ||
+                !flattenBlobCacheLocked(&buf)) {
+            mSavePending = false;
             return;
         }
+        filename = mFilename;
+        journalSize = mJournalSize;
+    }
 
-        delete [] buf;
-        fchmod(fd, S_IRUSR);
-        close(fd);
+    // Writing out a cache of several MB takes a while; don't hold up the
+    // GL threads for it.
+    bool saved = writeCacheFile(filename, buf);
+
+    std::lock_guard<std::shared_timed_mutex> lock(mMutex);
+    // Entries journaled while the file was being written aren't in it.  Keep
+    // the journal in that case; replaying it on top of the new file is still
+    // correct, and the next compaction gets rid of it.
+    if (saved && mJournalSize == journalSize && filename == mFilename) {
+        resetJournalLocked();
     }
+    mSavePending = false;
 }
 
 void egl_cache_t::loadBlobCacheLocked() {
     if (mFilename.length() > 0) {
-        size_t headerSize = cacheFileHeaderSize;
+        loadCacheFileLocked();
+        openJournalLocked();
+    }
+}
 
-        int fd = open(mFilename.c_str(), O_RDONLY, 0);
-        if (fd == -1) {
-            if (errno != ENOENT) {
-                ALOGE("error opening cache file %s: %s (%d)", mFilename.c_str(),
-                        strerror(errno), errno);
-            }
-            return;
+// Maps the cache file filename and loads cache from it in place.  On success,
+// the mapping is returned in outMap and outMapSize; it must stay mapped until
+// cache is destroyed.
+static bool mapCacheFile(const std::string& filename, size_t maxFileSize,
+        BlobCache* cache, void** outMap, size_t* outMapSize) {
+    size_t headerSize = cacheFileHeaderSize;
+
+    int fd = open(filename.c_str(), O_RDONLY, 0);
+    if (fd == -1) {
+        if (errno != ENOENT) {
+            ALOGE("error opening cache file %s: %s (%d)", filename.c_str(),
+                    strerror(errno), errno);
         }
+        return false;
+    }
 
-        struct stat statBuf;
-        if (fstat(fd, &statBuf) == -1) {
-            ALOGE("error stat'ing cache file: %s (%d)", strerror(errno), errno);
-            close(fd);
-            return;
-        }
+    struct stat statBuf;
+    if (fstat(fd, &statBuf) == -1) {
+        ALOGE("error stat'ing cache file: %s (%d)", strerror(errno), errno);
+        close(fd);
+        return false;
+    }
 
-        // Sanity check the size before trying to mmap it.
-        size_t fileSize = statBuf.st_size;
-        if (fileSize > maxTotalSize * 2) {
-            ALOGE("cache file is too large: %#" PRIx64,
-                  static_cast<off64_t>(statBuf.st_size));
-            close(fd);
+    // Sanity check the size before trying to mmap it.
+    size_t fileSize = statBuf.st_size;
+    if (fileSize > maxFileSize) {
+        ALOGE("cache file is too large: %#" PRIx64,
+              static_cast<off64_t>(statBuf.st_size));
+        close(fd);
+        return false;
+    }
+    if (fileSize < headerSize) {
+        ALOGE("cache file is too small: %zu", fileSize);
+        close(fd);
+        return false;
+    }
+
+    uint8_t* buf = reinterpret_cast<uint8_t*>(mmap(NULL, fileSize,
+            PROT_READ, MAP_PRIVATE, fd, 0));
+    close(fd);
+    if (buf == MAP_FAILED) {
+        ALOGE("error mmaping cache file: %s (%d)", strerror(errno),
+                errno);
+        return false;
+    }
+
+    // Check the file magic and CRC
+    size_t cacheSize = fileSize - headerSize;
+    if (memcmp(buf, cacheFileMagic, 4) != 0) {
+        ALOGE("cache file has bad mojo");
+        munmap(buf, fileSize);
+        return false;
+    }
+    uint32_t* crc = reinterpret_cast<uint32_t*>(buf + 4);
+    if (crc32c(buf + headerSize, cacheSize) != *crc) {
+        ALOGE("cache file failed CRC check");
+        munmap(buf, fileSize);
+        return false;
+    }
+
+    // Look the entries up in the mapping rather than copying them.  The file
+    // is only ever replaced, never written in place, so the mapping stays
+    // valid until it's unmapped.
+    int err = cache->unflatten(buf + headerSize, cacheSize, false);
+    if (err < 0) {
+        ALOGE("error reading cache contents: %s (%d)", strerror(-err),
+                -err);
+        munmap(buf, fileSize);
+        return false;
+    }
+    *outMap = buf;
+    *outMapSize = fileSize;
+    return true;
+}
+
+void egl_cache_t::loadCacheFileLocked() {
+    mapCacheFile(mFilename, maxTotalSize * 2, mBlobCache.get(), &mMappedCache,
+            &mMappedCacheSize);
+}
+
+void egl_cache_t::loadSharedCacheLocked() {
+    std::string filename = mSharedFilename;
+    if (filename.empty()) {
+        char value[PROPERTY_VALUE_MAX];
+        if (property_get(sharedCacheFileProperty, value, "") <= 0) {
             return;
         }
+        filename = value;
+    }
 
-        uint8_t* buf = reinterpret_cast<uint8_t*>(mmap(NULL, fileSize,
-                PROT_READ, MAP_PRIVATE, fd, 0));
-        if (buf == MAP_FAILED) {
-            ALOGE("error mmaping cache file: %s (%d)", strerror(errno),
-                    errno);
-            close(fd);
-            return;
+    // The shared cache is never written, its entries only come from the file.
+    // A file written by another build loads as an empty cache.
+    std::unique_ptr<BlobCache> cache(new BlobCache(maxKeySize, maxValueSize,
+            maxSharedTotalSize));
+    if (mapCacheFile(filename, maxSharedTotalSize * 2, cache.get(),
+            &mMappedSharedCache, &mMappedSharedCacheSize)) {
+        mSharedBlobCache = std::move(cache);
+    }
+}
+
+void egl_cache_t::releaseBlobCacheLocked() {
+    // The cache entries may point into the mapping, so it has to go last.
+    mBlobCache = NULL;
+    if (mMappedCache != NULL) {
+        munmap(mMappedCache, mMappedCacheSize);
+        mMappedCache = NULL;
+        mMappedCacheSize = 0;
+    }
+    mSharedBlobCache = NULL;
+    if (mMappedSharedCache != NULL) {
+        munmap(mMappedSharedCache, mMappedSharedCacheSize);
+        mMappedSharedCache = NULL;
+        mMappedSharedCacheSize = 0;
+    }
+    if (mJournalFd != -1) {
+        close(mJournalFd);
+        mJournalFd = -1;
+        mJournalSize = 0;
+    }
+}
+
+static void makeJournalHeader(JournalHeader* header) {
+    memset(header, 0, sizeof(*header));
+    header->mMagicNumber = journalMagic;
+    header->mBuildIdLength = property_get("ro.build.id", header->mBuildId, "");
+}
+
+void egl_cache_t::openJournalLocked() {
+    std::string journalName = mFilename + journalSuffix;
+    const char* fname = journalName.c_str();
+
+    int fd = open(fname, O_CREAT | O_RDWR | O_APPEND, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        ALOGE("error opening cache journal %s: %s (%d)", fname,
+                strerror(errno), errno);
+        return;
+    }
+
+    JournalHeader expected;
+    makeJournalHeader(&expected);
+
+    // Replay the entries appended since the cache file was written.  Any
+    // records after a bad one, e.g. from being killed mid-write, are dropped.
+    size_t validSize = 0;
+    std::vector<uint8_t> buf;
+    struct stat statBuf;
+    if (fstat(fd, &statBuf) == 0 && static_cast<size_t>(statBuf.st_size) <= maxTotalSize * 2) {
+        buf.resize(statBuf.st_size);
+        if (pread(fd, buf.data(), buf.size(), 0) != static_cast<ssize_t>(buf.size())) {
+            buf.clear();
+        }
+    }
+    if (buf.size() >= sizeof(JournalHeader) &&
+            memcmp(buf.data(), &expected, sizeof(JournalHeader)) == 0) {
+        validSize = sizeof(JournalHeader);
+        while (validSize + sizeof(JournalRecordHeader) <= buf.size()) {
+            const JournalRecordHeader* record =
+                    reinterpret_cast<const JournalRecordHeader*>(&buf[validSize]);
+            const uint8_t* data = &buf[validSize + sizeof(JournalRecordHeader)];
+            size_t dataSize = size_t(record->mKeySize) + record->mValueSize;
+            if (record->mMagicNumber != journalRecordMagic ||
+                    dataSize > buf.size() - validSize - sizeof(JournalRecordHeader) ||
+                    crc32c(data, dataSize) != record->mCrc) {
+                ALOGW("dropping cache journal records from offset %zu", validSize);
+                break;
+            }
+            mBlobCache->set(data, record->mKeySize, data + record->mKeySize,
+                    record->mValueSize);
+            validSize += sizeof(JournalRecordHeader) + dataSize;
         }
+    }
 
-        // Check the file magic and CRC
-        size_t cacheSize = fileSize - headerSize;
-        if (memcmp(buf, cacheFileMagic, 4) != 0) {
-            ALOGE("cache file has bad mojo");
+    if (validSize != buf.size() || validSize == 0) {
+        // Start over from the last good record, or from an empty journal if it
+        // was written by another build.
+        if (validSize == 0) {
+            validSize = sizeof(JournalHeader);
+            if (ftruncate(fd, 0) == -1 || write(fd, &expected, sizeof(expected)) !=
+                    static_cast<ssize_t>(sizeof(expected))) {
+                ALOGE("error resetting cache journal: %s (%d)", strerror(errno), errno);
+                close(fd);
+                return;
+            }
+        } else if (ftruncate(fd, validSize) == -1) {
+            ALOGE("error truncating cache journal: %s (%d)", strerror(errno), errno);
             close(fd);
             return;
         }
-        uint32_t* crc = reinterpret_cast<uint32_t*>(buf + 4);
-        if (crc32c(buf + headerSize, cacheSize) != *crc) {
-            ALOGE("cache file failed CRC check");
-            close(fd);
-            return;
+    }
+    mJournalFd = fd;
+    mJournalSize = validSize;
+}
+
+bool egl_cache_t::appendJournalLocked(const void* key, size_t keySize,
+        const void* value, size_t valueSize) {
+    if (mJournalFd == -1) {
+        return false;
+    }
+    if (keySize == 0 || valueSize == 0 || keySize > maxKeySize || valueSize > maxValueSize) {
+        // The cache didn't take it either; there's nothing to persist.
+        return true;
+    }
+
+    // Write each record with one call, so that a record is either all there
+    // or gets cut off at the end of the file.
+    std::vector<uint8_t> buf(sizeof(JournalRecordHeader) + keySize + valueSize);
+    JournalRecordHeader* record = reinterpret_cast<JournalRecordHeader*>(buf.data());
+    uint8_t* data = buf.data() + sizeof(JournalRecordHeader);
+    memcpy(data, key, keySize);
+    memcpy(data + keySize, value, valueSize);
+    record->mMagicNumber = journalRecordMagic;
+    record->mKeySize = keySize;
+    record->mValueSize = valueSize;
+    record->mCrc = crc32c(data, keySize + valueSize);
+
+    if (write(mJournalFd, buf.data(), buf.size()) != static_cast<ssize_t>(buf.size())) {
+        ALOGE("error appending to cache journal: %s (%d)", strerror(errno), errno);
+        // Fall back to saving the whole cache; the journal gets rewritten then.
+        if (ftruncate(mJournalFd, mJournalSize) == -1) {
+            close(mJournalFd);
+            mJournalFd = -1;
         }
+        return false;
+    }
+    mJournalSize += buf.size();
+    return true;
+}
 
-        int err = mBlobCache->unflatten(buf + headerSize, cacheSize);
-        if (err < 0) {
-            ALOGE("error reading cache contents: %s (%d)", strerror(-err),
-                    -err);
-            munmap(buf, fileSize);
-            close(fd);
+void egl_cache_t::resetJournalLocked() {
+    if (mJournalFd != -1) {
+        if (ftruncate(mJournalFd, sizeof(JournalHeader)) == -1) {
+            ALOGE("error truncating cache journal: %s (%d)", strerror(errno), errno);
+            close(mJournalFd);
+            mJournalFd = -1;
             return;
         }
-
-        munmap(buf, fileSize);
-        close(fd);
+        mJournalSize = sizeof(JournalHeader);
     }
 }
 
@@ -24,7 +24,9 @@
 
 #include <memory>
 #include <mutex>
+#include <shared_mutex>
 #include <string>
+#include <vector>
 
 // ----------------------------------------------------------------------------
 namespace android {
@@ -67,6 +69,12 @@ public:
     // cache contents from one program invocation to another.
     void setCacheFilename(const char* filename);
 
+    // setSharedCacheFilename sets the name of the read-only shared cache file
+    // that getBlob falls back to, instead of the one given by the
+    // ro.egl.shared_blob_cache property.  It takes effect the next time the
+    // cache is loaded.
+    void setSharedCacheFilename(const char* filename);
+
 private:
     // Creation and (the lack of) destruction is handled internally.
     egl_cache_t();
@@ -82,14 +90,52 @@ private:
     // possible.
     BlobCache* getBlobCacheLocked();
 
+    // getBlobLocked looks the key up in mBlobCache, and then in
+    // mSharedBlobCache if mBlobCache doesn't have it.  mBlobCache must exist.
+    EGLsizeiANDROID getBlobLocked(const void* key, EGLsizeiANDROID keySize,
+        void* value, EGLsizeiANDROID valueSize);
+
     // saveBlobCache attempts to save the current contents of mBlobCache to
-    // disk.
+    // disk, and empties the journal if it succeeds.
     void saveBlobCacheLocked();
 
+    // compactBlobCache is run by the deferred save thread.  It folds the
+    // journal into a new cache file, writing the file without holding mMutex.
+    void compactBlobCache();
+
+    // flattenBlobCacheLocked serializes mBlobCache, including the cache file
+    // header, into buf.
+    bool flattenBlobCacheLocked(std::vector<uint8_t>* buf);
+
     // loadBlobCache attempts to load the saved cache contents from disk into
-    // mBlobCache.
+    // mBlobCache: the cache file, and then the journal on top of it.
     void loadBlobCacheLocked();
 
+    // loadCacheFileLocked maps the cache file and loads mBlobCache from it in
+    // place, without copying the entries.
+    void loadCacheFileLocked();
+
+    // loadSharedCacheLocked maps the shared cache file, if the device has
+    // one, into mSharedBlobCache.
+    void loadSharedCacheLocked();
+
+    // releaseBlobCacheLocked destroys mBlobCache and mSharedBlobCache, then
+    // unmaps the cache files and closes the journal.
+    void releaseBlobCacheLocked();
+
+    // openJournalLocked replays the journal into mBlobCache and opens it for
+    // appending, dropping any records that were only partly written.
+    void openJournalLocked();
+
+    // appendJournalLocked records a new entry in the journal.  It returns false
+    // if the entry could not be journaled, and only a full save would keep it.
+    bool appendJournalLocked(const void* key, size_t keySize, const void* value,
+            size_t valueSize);
+
+    // resetJournalLocked empties the journal once its contents are in the
+    // cache file.
+    void resetJournalLocked();
+
     // mInitialized indicates whether the egl_cache_t is in the initialized
     // state.  It is initialized to false at construction time, and gets set to
     // true when initialize is called.  It is set back to false when terminate
@@ -110,16 +156,43 @@ private:
     // from disk.
     std::string mFilename;
 
+    // mSharedFilename is the name of the shared cache file set with
+    // setSharedCacheFilename.  An empty string means the
+    // ro.egl.shared_blob_cache property names it, if it is set.
+    std::string mSharedFilename;
+
     // mSavePending indicates whether or not a deferred save operation is
-    // pending.  Each time a key/value pair is inserted into the cache via
-    // setBlob, a deferred save is initiated if one is not already pending.
-    // This will wait some amount of time and then trigger a save of the cache
-    // contents to disk.
+    // pending.  When setBlob finds the journal too large, or could not journal
+    // the new entry, a deferred save is initiated if one is not already
+    // pending.  This will wait some amount of time and then trigger a save of
+    // the cache contents to disk.
     bool mSavePending;
 
+    // mMappedCache is the mapping of the cache file that mBlobCache was loaded
+    // from, and mMappedCacheSize its size.  The entries loaded from it point
+    // into the mapping, so it's only unmapped after mBlobCache is destroyed.
+    void* mMappedCache;
+    size_t mMappedCacheSize;
+
+    // mSharedBlobCache holds the entries of the system-wide shared cache file,
+    // which getBlob falls back to when mBlobCache misses.  It is NULL if the
+    // device has no shared cache.  It is loaded along with mBlobCache, from
+    // the read-only mapping mMappedSharedCache of mMappedSharedCacheSize
+    // bytes, and never written.
+    std::unique_ptr<BlobCache> mSharedBlobCache;
+    void* mMappedSharedCache;
+    size_t mMappedSharedCacheSize;
+
+    // mJournalFd is the journal that new entries are appended to, or -1 if it
+    // isn't open.  mJournalSize is its size in bytes, including the header.
+    int mJournalFd;
+    size_t mJournalSize;
+
     // mMutex is the mutex used to prevent concurrent access to the member
     // variables. It must be locked whenever the member variables are accessed.
-    mutable std::mutex mMutex;
+    // getBlob only needs it shared once mBlobCache exists, since concurrent
+    // BlobCache::get calls are safe; everything else locks it exclusively.
+    mutable std::shared_timed_mutex mMutex;
 
     // sCache is the singleton egl_cache_t object.
     static egl_cache_t sCache;
@@ -0,0 +1,335 @@
+/*
+ ** Copyright 2017, The Android Open Source Project
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at
+ **
+ **     http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ ** See the License for the specific language governing permissions and
+ ** limitations under the License.
+ */
+
+#include "egl_call_trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/system_properties.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include <cutils/compiler.h>
+#include <cutils/properties.h>
+#include <log/log.h>
+#include <private/EGL/call_trace.h>
+
+// ----------------------------------------------------------------------------
+namespace android {
+// ----------------------------------------------------------------------------
+
+// Call ids are the indices of the entry points in entries.in, which is also
+// the order of gl_names[].
+#undef GL_ENTRY
+#define GL_ENTRY(_r, _api, ...) CALL_##_api,
+enum {
+    #include "../entries.in"
+    CALL_COUNT
+};
+#undef GL_ENTRY
+
+static const uint32_t kDumpMagic = ('G' << 24) | ('L' << 16) | ('T' << 8) | 'R';
+static const uint32_t kDumpVersion = 1;
+
+// 128KB per thread that makes GL calls.
+static const size_t kRingCapacity = 8192;
+
+struct CallTraceRecord {
+    uint64_t timestamp;     // CLOCK_MONOTONIC, in nanoseconds
+    uint32_t call;
+    uint32_t digest;        // of the raw argument values, not what they point to
+};
+
+struct DumpHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sampleRatio;
+    uint32_t namesSize;     // NUL-separated call names follow the header
+    uint32_t ringCount;
+};
+
+struct DumpRingHeader {
+    uint32_t tid;           // 0 once the thread is gone
+    uint32_t recordCount;   // CallTraceRecords follow, oldest first
+};
+
+// A ring is only ever written by the thread that owns it; the dumper reads
+// it concurrently and throws away whatever may have been overwritten under
+// it.  Rings of threads that exit stay around, and get reused by new ones.
+struct CallTraceRing {
+    std::atomic<pid_t> tid;
+    uint32_t countdown;
+    uint32_t random;
+    std::atomic<uint64_t> head;     // number of records ever written
+    CallTraceRecord records[kRingCapacity];
+};
+
+static uint32_t sSampleRatio = 0;
+static pthread_key_t sRingKey;
+static gl_hooks_t sTraceHooks[2];
+
+static std::mutex sRingsMutex;
+static std::vector<CallTraceRing*> sRings;
+
+// Guard the dump property state, for processes swapping on several threads.
+static std::mutex sDumpMutex;
+static const prop_info* sDumpProperty = nullptr;
+static uint32_t sDumpSerial = 0;
+
+// Spreads the samples around the mean ratio, so that a frame made of exactly
+// N calls doesn't end up sampling the same call over and over.
+static uint32_t nextCountdown(CallTraceRing* ring) {
+    uint32_t x = ring->random;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    ring->random = x;
+    return 1 + x % (2 * sSampleRatio - 1);
+}
+
+static void releaseRing(void* ring) {
+    static_cast<CallTraceRing*>(ring)->tid.store(0, std::memory_order_release);
+}
+
+static CallTraceRing* acquireRing() {
+    const pid_t tid = gettid();
+    CallTraceRing* ring = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(sRingsMutex);
+        for (CallTraceRing* r : sRings) {
+            if (r->tid.load(std::memory_order_relaxed) == 0) {
+                ring = r;
+                break;
+            }
+        }
+        if (!ring) {
+            ring = new CallTraceRing;
+            sRings.push_back(ring);
+        }
+        ring->tid.store(tid, std::memory_order_relaxed);
+        ring->head.store(0, std::memory_order_relaxed);
+    }
+    ring->random = uint32_t(tid) * 2654435761u | 1;
+    ring->countdown = nextCountdown(ring);
+    pthread_setspecific(sRingKey, ring);
+    return ring;
+}
+
+static void record(CallTraceRing* ring, uint32_t call, uint64_t digest) {
+    if (CC_UNLIKELY(!ring)) {
+        acquireRing();
+        return;
+    }
+    ring->countdown = nextCountdown(ring);
+
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    const uint64_t head = ring->head.load(std::memory_order_relaxed);
+    CallTraceRecord& r = ring->records[head % kRingCapacity];
+    r.timestamp = uint64_t(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+    r.call = call;
+    r.digest = uint32_t(digest ^ (digest >> 32));
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+// FNV-1a over the bits of each argument.
+static inline uint64_t digestArgs(uint64_t h) {
+    return h;
+}
+
+template <typename T, typename... Rest>
+static inline uint64_t digestArgs(uint64_t h, T arg, Rest... rest) {
+    static_assert(sizeof(T) <= sizeof(uint64_t), "argument too large to digest");
+    uint64_t bits = 0;
+    memcpy(&bits, &arg, sizeof(arg));
+    return digestArgs((h ^ bits) * 0x100000001b3ull, rest...);
+}
+
+// The tracing version of the entry point Entry, for contexts of client
+// version Version.  It forwards to the driver through gHooks, so the table
+// doesn't need to be rebuilt if the hooks are.
+template <int Version, typename F, F gl_hooks_t::gl_t::*Entry, uint32_t Call>
+struct TracedCall;
+
+template <int Version, typename R, typename... Args,
+        R (*gl_hooks_t::gl_t::*Entry)(Args...), uint32_t Call>
+struct TracedCall<Version, R (*)(Args...), Entry, Call> {
+    static R call(Args... args) {
+        CallTraceRing* ring = static_cast<CallTraceRing*>(pthread_getspecific(sRingKey));
+        if (CC_UNLIKELY(!ring || --ring->countdown == 0)) {
+            record(ring, Call, digestArgs(0xcbf29ce484222325ull, args...));
+        }
+        return (gHooks[Version].gl.*Entry)(args...);
+    }
+};
+
+template <int Version>
+static void initTraceHooks() {
+    gl_hooks_t& hooks = sTraceHooks[Version];
+    hooks.ext = gHooks[Version].ext;
+#define GL_ENTRY(_r, _api, ...)                                             \
+    hooks.gl._api = &TracedCall<Version, decltype(gl_hooks_t::gl_t::_api),  \
+            &gl_hooks_t::gl_t::_api, CALL_##_api>::call;
+    #include "../entries.in"
+#undef GL_ENTRY
+}
+
+static void initCallTrace() {
+    char value[PROPERTY_VALUE_MAX];
+    property_get("debug.egl.trace_sample", value, "0");
+    const int ratio = atoi(value);
+    if (ratio <= 0) {
+        return;
+    }
+    if (pthread_key_create(&sRingKey, releaseRing)) {
+        ALOGE("couldn't create the GL call trace key");
+        return;
+    }
+    initTraceHooks<egl_connection_t::GLESv1_INDEX>();
+    initTraceHooks<egl_connection_t::GLESv2_INDEX>();
+    sDumpProperty = __system_property_find("debug.egl.trace_dump");
+    if (sDumpProperty) {
+        sDumpSerial = __system_property_serial(sDumpProperty);
+    }
+    sSampleRatio = ratio;
+    ALOGI("sampling one GL call in %d", ratio);
+}
+
+static bool callTraceEnabled() {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, initCallTrace);
+    return sSampleRatio != 0;
+}
+
+gl_hooks_t const* egl_call_trace_hooks(gl_hooks_t const* hooks, int version) {
+    return callTraceEnabled() ? &sTraceHooks[version] : hooks;
+}
+
+void egl_call_trace_set_extension(int slot,
+        __eglMustCastToProperFunctionPointerType f) {
+    for (gl_hooks_t& hooks : sTraceHooks) {
+        hooks.ext.extensions[slot] = f;
+    }
+}
+
+static bool writeFully(int fd, const void* data, size_t size) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    while (size) {
+        ssize_t n = TEMP_FAILURE_RETRY(write(fd, p, size));
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool egl_dump_call_trace(int fd) {
+    if (!callTraceEnabled()) {
+        return false;
+    }
+
+    std::vector<char> names;
+    for (size_t i = 0; i < CALL_COUNT; i++) {
+        names.insert(names.end(), gl_names[i], gl_names[i] + strlen(gl_names[i]) + 1);
+    }
+
+    std::lock_guard<std::mutex> lock(sRingsMutex);
+    DumpHeader header = { kDumpMagic, kDumpVersion, sSampleRatio,
+            uint32_t(names.size()), uint32_t(sRings.size()) };
+    if (!writeFully(fd, &header, sizeof(header)) ||
+            !writeFully(fd, names.data(), names.size())) {
+        return false;
+    }
+
+    std::vector<CallTraceRecord> records;
+    for (CallTraceRing* ring : sRings) {
+        const uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t first = head > kRingCapacity ? head - kRingCapacity : 0;
+        records.clear();
+        for (uint64_t i = first; i < head; i++) {
+            records.push_back(ring->records[i % kRingCapacity]);
+        }
+        // The owner kept going while we copied: drop the slots it may have
+        // been writing to.
+        std::atomic_thread_fence(std::memory_order_acquire);
+        const uint64_t now = ring->head.load(std::memory_order_relaxed);
+        if (now + 1 > first + kRingCapacity) {
+            size_t stale = std::min<uint64_t>(now + 1 - kRingCapacity - first, records.size());
+            records.erase(records.begin(), records.begin() + stale);
+        }
+
+        DumpRingHeader ringHeader = { uint32_t(ring->tid.load(std::memory_order_relaxed)),
+                uint32_t(records.size()) };
+        if (!writeFully(fd, &ringHeader, sizeof(ringHeader)) ||
+                !writeFully(fd, records.data(), records.size() * sizeof(CallTraceRecord))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void egl_call_trace_poll() {
+    if (CC_LIKELY(sSampleRatio == 0)) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(sDumpMutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        return;
+    }
+    // Looking the property up is costly; once it exists, checking whether
+    // it changed is a single load.
+    if (!sDumpProperty) {
+        sDumpProperty = __system_property_find("debug.egl.trace_dump");
+        if (!sDumpProperty) {
+            return;
+        }
+    } else if (__system_property_serial(sDumpProperty) == sDumpSerial) {
+        return;
+    }
+    sDumpSerial = __system_property_serial(sDumpProperty);
+
+    char path[PROPERTY_VALUE_MAX];
+    property_get("debug.egl.trace_dump", path, "");
+    if (path[0] != '/') {
+        return;
+    }
+    // Each traced process gets its own file.
+    char filename[PROPERTY_VALUE_MAX + 16];
+    snprintf(filename, sizeof(filename), "%s.%d", path, getpid());
+    int fd = TEMP_FAILURE_RETRY(open(filename,
+            O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+    if (fd < 0) {
+        ALOGW("couldn't open %s for the GL call trace: %s", filename, strerror(errno));
+        return;
+    }
+    if (!egl_dump_call_trace(fd)) {
+        ALOGW("couldn't write the GL call trace to %s: %s", filename, strerror(errno));
+    }
+    close(fd);
+}
+
+// ----------------------------------------------------------------------------
+}; // namespace android
+// ----------------------------------------------------------------------------
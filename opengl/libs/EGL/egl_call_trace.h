@@ -0,0 +1,49 @@
+/*
+ ** Copyright 2017, The Android Open Source Project
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at
+ **
+ **     http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ ** See the License for the specific language governing permissions and
+ ** limitations under the License.
+ */
+
+#ifndef ANDROID_EGL_CALL_TRACE_H
+#define ANDROID_EGL_CALL_TRACE_H
+
+#include "egldefs.h"
+
+// ----------------------------------------------------------------------------
+namespace android {
+// ----------------------------------------------------------------------------
+
+// Sampled tracing of GLES calls, turned on by setting debug.egl.trace_sample
+// to N before the process starts: about one call in N is recorded as
+// (call id, timestamp, argument digest) into a ring owned by the calling
+// thread.  Calls that aren't sampled cost a TLS lookup and a decrement.
+
+// Returns the dispatch table to make current for a context whose driver
+// hooks are |hooks|: the tracing wrappers if sampling is on, |hooks| itself
+// otherwise.
+gl_hooks_t const* egl_call_trace_hooks(gl_hooks_t const* hooks, int version);
+
+// Mirrors an extension entry point resolved by eglGetProcAddress into the
+// tracing tables, so extension calls keep working while tracing.
+void egl_call_trace_set_extension(int slot,
+        __eglMustCastToProperFunctionPointerType f);
+
+// Called once per frame; writes the rings out when debug.egl.trace_dump has
+// been set since the last call.
+void egl_call_trace_poll();
+
+// ----------------------------------------------------------------------------
+}; // namespace android
+// ----------------------------------------------------------------------------
+
+#endif // ANDROID_EGL_CALL_TRACE_H
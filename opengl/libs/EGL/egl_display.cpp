@@ -64,7 +64,7 @@ int egl_get_init_count(EGLDisplay dpy) {
 egl_display_t egl_display_t::sDisplay[NUM_DISPLAYS];
 
 egl_display_t::egl_display_t() :
-    magic('_dpy'), finishOnSwap(false), traceGpuCompletion(false), refs(0), eglIsInitialized(false) {
+    magic('_dpy'), finishOnSwap(false), traceGpuCompletion(false), paceFrames(false), refs(0), eglIsInitialized(false) {
 }
 
 egl_display_t::~egl_display_t() {
@@ -81,17 +81,20 @@ egl_display_t* egl_display_t::get(EGLDisplay dpy) {
 }
 
 void egl_display_t::addObject(egl_object_t* object) {
-    std::lock_guard<std::mutex> _l(lock);
+    std::lock_guard<std::shared_timed_mutex> _l(objectsLock);
     objects.insert(object);
 }
 
 void egl_display_t::removeObject(egl_object_t* object) {
-    std::lock_guard<std::mutex> _l(lock);
+    std::lock_guard<std::shared_timed_mutex> _l(objectsLock);
     objects.erase(object);
 }
 
 bool egl_display_t::getObject(egl_object_t* object) const {
-    std::lock_guard<std::mutex> _l(lock);
+    // The incRef() below is atomic, so lookups can share the lock; removal
+    // takes it exclusively, so an object can't go away between being found
+    // and being referenced.
+    std::shared_lock<std::shared_timed_mutex> _l(objectsLock);
     if (objects.find(object) != objects.end()) {
         if (object->getDisplay() == this) {
             object->incRef();
@@ -221,6 +224,11 @@ EGLBoolean egl_display_t::initialize(EGLint *major, EGLint *minor) {
             traceGpuCompletion = true;
         }
 
+        property_get("debug.egl.pace_frames", value, "0");
+        if (atoi(value)) {
+            paceFrames = true;
+        }
+
         if (major != NULL)
             *major = VERSION_MAJOR;
         if (minor != NULL)
@@ -277,17 +285,21 @@ EGLBoolean egl_display_t::terminate() {
         // reinitialized.
         mExtensionString.clear();
 
+        // this marks all object handles are "terminated"
+        std::unordered_set<egl_object_t*> remaining;
+        {
+            std::lock_guard<std::shared_timed_mutex> _ol(objectsLock);
+            remaining.swap(objects);
+        }
+
         // Mark all objects remaining in the list as terminated, unless
         // there are no reference to them, it which case, we're free to
         // delete them.
-        size_t count = objects.size();
+        size_t count = remaining.size();
         ALOGW_IF(count, "eglTerminate() called w/ %zu objects remaining", count);
-        for (auto o : objects) {
+        for (auto o : remaining) {
             o->destroy();
         }
-
-        // this marks all object handles are "terminated"
-        objects.clear();
     }
 
     { // scope for refLock
@@ -23,6 +23,7 @@
 
 #include <condition_variable>
 #include <mutex>
+#include <shared_mutex>
 #include <string>
 #include <unordered_set>
 
@@ -111,6 +112,7 @@ public:
     DisplayImpl     disp;
     bool    finishOnSwap;       // property: debug.egl.finish
     bool    traceGpuCompletion; // property: debug.egl.traceGpuCompletion
+    bool    paceFrames;         // property: debug.egl.pace_frames
 
 private:
     friend class egl_display_ptr;
@@ -120,6 +122,10 @@ private:
     mutable std::mutex                  lock;
     mutable std::mutex                  refLock;
     mutable std::condition_variable     refCond;
+    // objectsLock guards objects.  It's separate from lock, which is held
+    // across calls into the driver, and handle validation only takes it
+    // shared, so render threads validating handles never wait on each other.
+    mutable std::shared_timed_mutex     objectsLock;
             std::unordered_set<egl_object_t*> objects;
             std::string mVendorString;
             std::string mVersionString;
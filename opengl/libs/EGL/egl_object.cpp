@@ -16,6 +16,7 @@
 
 #include "egl_object.h"
 
+#include <algorithm>
 #include <sstream>
 
 
@@ -59,7 +60,8 @@ egl_surface_t::egl_surface_t(egl_display_t* dpy, EGLConfig config,
         EGLNativeWindowType win, EGLSurface surface,
         egl_connection_t const* cnx) :
     egl_object_t(dpy), surface(surface), config(config), win(win), cnx(cnx),
-    connected(true)
+    connected(true), swapInterval(1), presentationTimeSet(false),
+    lastPacedPresentTime(0)
 {
     if (win) {
         win->incStrong(this);
@@ -88,6 +90,45 @@ void egl_surface_t::terminate() {
     egl_object_t::terminate();
 }
 
+int64_t egl_surface_t::paceFrame() {
+    if (presentationTimeSet) {
+        presentationTimeSet = false;
+        lastPacedPresentTime = 0;
+        return 0;
+    }
+    // Swap interval 0 asks for frames to go out as fast as possible.
+    if (win == NULL || swapInterval <= 0) {
+        return 0;
+    }
+
+    // This needs frame timestamps enabled on the window; if the app turned
+    // them off, there's simply no pacing.
+    int64_t compositeDeadline, compositeInterval, compositeToPresentLatency;
+    if (native_window_get_compositor_timing(win, &compositeDeadline,
+            &compositeInterval, &compositeToPresentLatency) != 0 ||
+            compositeInterval <= 0) {
+        return 0;
+    }
+
+    // The earliest this frame can be shown is right after the next composition.
+    int64_t earliest = compositeDeadline + compositeToPresentLatency;
+    int64_t period = compositeInterval * swapInterval;
+    int64_t target = lastPacedPresentTime + period;
+    if (lastPacedPresentTime == 0 || target < earliest) {
+        // The first frame, or the app fell behind: show it as soon as possible
+        // rather than catching up with a burst of frames.
+        target = earliest;
+    }
+    lastPacedPresentTime = target;
+    native_window_set_buffers_timestamp(win, target);
+
+    // Every frame queued more than a period ahead of being shown only adds
+    // latency.  Holding the app back lets it sample input for the next frame
+    // closer to when that frame is shown.
+    int64_t ahead = target - earliest - period;
+    return ahead > 0 ? std::min(ahead, period) : 0;
+}
+
 // ----------------------------------------------------------------------------
 
 egl_context_t::egl_context_t(EGLDisplay dpy, EGLContext context, EGLConfig config,
@@ -149,6 +149,27 @@ public:
 private:
     bool connected;
     void disconnect();
+
+    // Frame pacing state, see paceFrame().  It comes after the fields above
+    // so that their offsets don't change.
+    EGLint swapInterval;
+    bool presentationTimeSet;
+    int64_t lastPacedPresentTime;
+
+public:
+    void setSwapInterval(EGLint interval) { swapInterval = interval; }
+
+    // Called by eglPresentationTimeANDROID: the app chose the present time of
+    // its next frame itself, so paceFrame() leaves that frame alone.
+    void onPresentationTimeSet() { presentationTimeSet = true; }
+
+    // paceFrame is called before each swap when frame pacing is enabled.  It
+    // spaces the desired present times of successive frames one swap interval
+    // of vsyncs apart, starting from the earliest the compositor can show the
+    // frame.  It returns how long the app should be held back once the frame
+    // is queued, which is non-zero when it's rendering more than a frame ahead
+    // of the display.
+    int64_t paceFrame();
 };
 
 class egl_context_t: public egl_object_t {
@@ -0,0 +1,29 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cutils/compiler.h>
+
+namespace android {
+
+// Writes the GLES calls sampled so far (see debug.egl.trace_sample) to |fd|.
+// The dump starts with the names of the calls, indexed by call id, followed
+// by each thread's ring, oldest record first.  Returns false if tracing is
+// off or the dump couldn't be written.
+ANDROID_API bool egl_dump_call_trace(int fd);
+
+} // namespace android
@@ -16,6 +16,10 @@
 
 #include <string.h>
 
+#include <atomic>
+#include <thread>
+#include <vector>
+
 /* From http://www.khronos.org/registry/gles/extensions/OES/OES_compressed_ETC1_RGB8_texture.txt
 
  The number of bits that represent a 4x4 texel block is 64 bits if
@@ -166,6 +170,13 @@ inline int convertDiff(int base, int diff) {
 static
 void decode_subblock(etc1_byte* pOut, int r, int g, int b, const int* table,
         etc1_uint32 low, bool second, bool flipped) {
+    // All eight pixels pick one of four colors; work those out once.
+    etc1_byte palette[4][3];
+    for (int i = 0; i < 4; i++) {
+        palette[i][0] = clamp(r + table[i]);
+        palette[i][1] = clamp(g + table[i]);
+        palette[i][2] = clamp(b + table[i]);
+    }
     int baseX = 0;
     int baseY = 0;
     if (second) {
@@ -186,11 +197,10 @@ void decode_subblock(etc1_byte* pOut, int r, int g, int b, const int* table,
         }
         int k = y + (x * 4);
         int offset = ((low >> k) & 1) | ((low >> (k + 15)) & 2);
-        int delta = table[offset];
         etc1_byte* q = pOut + 3 * (x + 4 * y);
-        *q++ = clamp(r + delta);
-        *q++ = clamp(g + delta);
-        *q++ = clamp(b + delta);
+        q[0] = palette[offset][0];
+        q[1] = palette[offset][1];
+        q[2] = palette[offset][2];
     }
 }
 
@@ -290,52 +300,22 @@ void etc_average_colors_subblock(const etc1_byte* pIn, etc1_uint32 inMask,
     pColors[2] = (etc1_byte)((b + 4) >> 3);
 }
 
-static
-inline int square(int x) {
-    return x * x;
-}
-
-static etc1_uint32 chooseModifier(const etc1_byte* pBaseColors,
-        const etc1_byte* pIn, etc1_uint32 *pLow, int bitIndex,
-        const int* pModifierTable) {
-    etc1_uint32 bestScore = ~0;
-    int bestIndex = 0;
-    int pixelR = pIn[0];
-    int pixelG = pIn[1];
-    int pixelB = pIn[2];
-    int r = pBaseColors[0];
-    int g = pBaseColors[1];
-    int b = pBaseColors[2];
-    for (int i = 0; i < 4; i++) {
-        int modifier = pModifierTable[i];
-        int decodedG = clamp(g + modifier);
-        etc1_uint32 score = (etc1_uint32) (6 * square(decodedG - pixelG));
-        if (score >= bestScore) {
-            continue;
-        }
-        int decodedR = clamp(r + modifier);
-        score += (etc1_uint32) (3 * square(decodedR - pixelR));
-        if (score >= bestScore) {
-            continue;
-        }
-        int decodedB = clamp(b + modifier);
-        score += (etc1_uint32) square(decodedB - pixelB);
-        if (score < bestScore) {
-            bestScore = score;
-            bestIndex = i;
-        }
-    }
-    etc1_uint32 lowMask = (((bestIndex >> 1) << 16) | (bestIndex & 1))
-            << bitIndex;
-    *pLow |= lowMask;
-    return bestScore;
-}
+// The modifier search scores the eight pixels of a sub-block at once, one
+// per lane.
+typedef int etc_vec __attribute__((vector_size(32)));
+
+typedef struct {
+    etc_vec r;
+    etc_vec g;
+    etc_vec b;
+    etc_vec valid; // ~0 for the pixels set in the mask, 0 for the others
+    int bitIndex[8];
+} etc_subblock;
 
 static
-void etc_encode_subblock_helper(const etc1_byte* pIn, etc1_uint32 inMask,
-        etc_compressed* pCompressed, bool flipped, bool second,
-        const etc1_byte* pBaseColors, const int* pModifierTable) {
-    int score = pCompressed->score;
+void etc_gather_subblock(const etc1_byte* pIn, etc1_uint32 inMask,
+        etc_subblock* pSubblock, bool flipped, bool second) {
+    int n = 0;
     if (flipped) {
         int by = 0;
         if (second) {
@@ -343,12 +323,14 @@ void etc_encode_subblock_helper(const etc1_byte* pIn, etc1_uint32 inMask,
         }
         for (int y = 0; y < 2; y++) {
             int yy = by + y;
-            for (int x = 0; x < 4; x++) {
+            for (int x = 0; x < 4; x++, n++) {
                 int i = x + 4 * yy;
-                if (inMask & (1 << i)) {
-                    score += chooseModifier(pBaseColors, pIn + i * 3,
-                            &pCompressed->low, yy + x * 4, pModifierTable);
-                }
+                const etc1_byte* p = pIn + i * 3;
+                pSubblock->r[n] = p[0];
+                pSubblock->g[n] = p[1];
+                pSubblock->b[n] = p[2];
+                pSubblock->valid[n] = (inMask & (1 << i)) ? ~0 : 0;
+                pSubblock->bitIndex[n] = yy + x * 4;
             }
         }
     } else {
@@ -357,34 +339,82 @@ void etc_encode_subblock_helper(const etc1_byte* pIn, etc1_uint32 inMask,
             bx = 2;
         }
         for (int y = 0; y < 4; y++) {
-            for (int x = 0; x < 2; x++) {
+            for (int x = 0; x < 2; x++, n++) {
                 int xx = bx + x;
                 int i = xx + 4 * y;
-                if (inMask & (1 << i)) {
-                    score += chooseModifier(pBaseColors, pIn + i * 3,
-                            &pCompressed->low, y + xx * 4, pModifierTable);
-                }
+                const etc1_byte* p = pIn + i * 3;
+                pSubblock->r[n] = p[0];
+                pSubblock->g[n] = p[1];
+                pSubblock->b[n] = p[2];
+                pSubblock->valid[n] = (inMask & (1 << i)) ? ~0 : 0;
+                pSubblock->bitIndex[n] = y + xx * 4;
             }
         }
     }
-    pCompressed->score = score;
+}
+
+// Picks the modifier closest to each valid pixel, sets their indices in
+// *pLow and returns the summed error. Ties go to the lowest index.
+static etc1_uint32 etc_encode_subblock_helper(const etc_subblock* pSubblock,
+        const etc1_byte* pBaseColors, const int* pModifierTable,
+        etc1_uint32* pLow) {
+    etc_vec bestScore = {};
+    etc_vec bestIndex = {};
+    for (int i = 0; i < 4; i++) {
+        int modifier = pModifierTable[i];
+        int decodedR = clamp(pBaseColors[0] + modifier);
+        int decodedG = clamp(pBaseColors[1] + modifier);
+        int decodedB = clamp(pBaseColors[2] + modifier);
+        etc_vec dr = decodedR - pSubblock->r;
+        etc_vec dg = decodedG - pSubblock->g;
+        etc_vec db = decodedB - pSubblock->b;
+        etc_vec score = 6 * dg * dg + 3 * dr * dr + db * db;
+        if (i == 0) {
+            bestScore = score;
+            continue;
+        }
+        etc_vec better = score < bestScore;
+        bestScore = (score & better) | (bestScore & ~better);
+        bestIndex = (i & better) | (bestIndex & ~better);
+    }
+    bestScore &= pSubblock->valid;
+    bestIndex &= pSubblock->valid;
+
+    etc1_uint32 score = 0;
+    etc1_uint32 low = 0;
+    for (int n = 0; n < 8; n++) {
+        score += bestScore[n];
+        low |= (((bestIndex[n] >> 1) << 16) | (bestIndex[n] & 1))
+                << pSubblock->bitIndex[n];
+    }
+    *pLow |= low;
+    return score;
 }
 
 static bool inRange4bitSigned(int color) {
     return color >= -4 && color <= 3;
 }
 
+static
+inline int clampQuantized(int x, int max) {
+    return x >= 0 ? (x < max ? x : max) : 0;
+}
+
+// Quantizes the average colors of the two sub-blocks into base colors,
+// differentially when allowed and possible. delta1 and delta2 move each
+// sub-block's base color that many quantization steps from the nearest one.
 static void etc_encodeBaseColors(etc1_byte* pBaseColors,
-        const etc1_byte* pColors, etc_compressed* pCompressed) {
+        const etc1_byte* pColors, etc_compressed* pCompressed,
+        bool allowDifferential, int delta1, int delta2) {
     int r1, g1, b1, r2, g2, b2; // 8 bit base colors for sub-blocks
-    bool differential;
-    {
-        int r51 = convert8To5(pColors[0]);
-        int g51 = convert8To5(pColors[1]);
-        int b51 = convert8To5(pColors[2]);
-        int r52 = convert8To5(pColors[3]);
-        int g52 = convert8To5(pColors[4]);
-        int b52 = convert8To5(pColors[5]);
+    bool differential = false;
+    if (allowDifferential) {
+        int r51 = clampQuantized(convert8To5(pColors[0]) + delta1, 31);
+        int g51 = clampQuantized(convert8To5(pColors[1]) + delta1, 31);
+        int b51 = clampQuantized(convert8To5(pColors[2]) + delta1, 31);
+        int r52 = clampQuantized(convert8To5(pColors[3]) + delta2, 31);
+        int g52 = clampQuantized(convert8To5(pColors[4]) + delta2, 31);
+        int b52 = clampQuantized(convert8To5(pColors[5]) + delta2, 31);
 
         r1 = convert5To8(r51);
         g1 = convert5To8(g51);
@@ -406,12 +436,12 @@ static void etc_encodeBaseColors(etc1_byte* pBaseColors,
     }
 
     if (!differential) {
-        int r41 = convert8To4(pColors[0]);
-        int g41 = convert8To4(pColors[1]);
-        int b41 = convert8To4(pColors[2]);
-        int r42 = convert8To4(pColors[3]);
-        int g42 = convert8To4(pColors[4]);
-        int b42 = convert8To4(pColors[5]);
+        int r41 = clampQuantized(convert8To4(pColors[0]) + delta1, 15);
+        int g41 = clampQuantized(convert8To4(pColors[1]) + delta1, 15);
+        int b41 = clampQuantized(convert8To4(pColors[2]) + delta1, 15);
+        int r42 = clampQuantized(convert8To4(pColors[3]) + delta2, 15);
+        int g42 = clampQuantized(convert8To4(pColors[4]) + delta2, 15);
+        int b42 = clampQuantized(convert8To4(pColors[5]) + delta2, 15);
         r1 = convert4To8(r41);
         g1 = convert4To8(g41);
         b1 = convert4To8(b41);
@@ -430,37 +460,37 @@ static void etc_encodeBaseColors(etc1_byte* pBaseColors,
 }
 
 static
-void etc_encode_block_helper(const etc1_byte* pIn, etc1_uint32 inMask,
-        const etc1_byte* pColors, etc_compressed* pCompressed, bool flipped) {
+void etc_encode_block_helper(const etc_subblock* pSubblocks,
+        const etc1_byte* pColors, etc_compressed* pCompressed, bool flipped,
+        bool allowDifferential, int delta1, int delta2) {
     pCompressed->score = ~0;
     pCompressed->high = (flipped ? 1 : 0);
     pCompressed->low = 0;
 
     etc1_byte pBaseColors[6];
 
-    etc_encodeBaseColors(pBaseColors, pColors, pCompressed);
+    etc_encodeBaseColors(pBaseColors, pColors, pCompressed,
+            allowDifferential, delta1, delta2);
 
     int originalHigh = pCompressed->high;
 
     const int* pModifierTable = kModifierTable;
     for (int i = 0; i < 8; i++, pModifierTable += 4) {
         etc_compressed temp;
-        temp.score = 0;
         temp.high = originalHigh | (i << 5);
         temp.low = 0;
-        etc_encode_subblock_helper(pIn, inMask, &temp, flipped, false,
-                pBaseColors, pModifierTable);
+        temp.score = etc_encode_subblock_helper(&pSubblocks[0],
+                pBaseColors, pModifierTable, &temp.low);
         take_best(pCompressed, &temp);
     }
     pModifierTable = kModifierTable;
     etc_compressed firstHalf = *pCompressed;
     for (int i = 0; i < 8; i++, pModifierTable += 4) {
         etc_compressed temp;
-        temp.score = firstHalf.score;
         temp.high = firstHalf.high | (i << 2);
         temp.low = firstHalf.low;
-        etc_encode_subblock_helper(pIn, inMask, &temp, flipped, true,
-                pBaseColors + 3, pModifierTable);
+        temp.score = firstHalf.score + etc_encode_subblock_helper(&pSubblocks[1],
+                pBaseColors + 3, pModifierTable, &temp.low);
         if (i == 0) {
             *pCompressed = temp;
         } else {
@@ -469,6 +499,25 @@ void etc_encode_block_helper(const etc1_byte* pIn, etc1_uint32 inMask,
     }
 }
 
+// How far the valid pixels of the two sub-blocks are from their averages.
+static etc1_uint32 etc_subblock_variance(const etc_subblock* pSubblocks,
+        const etc1_byte* pColors) {
+    etc_vec error = {};
+    for (int s = 0; s < 2; s++) {
+        const etc_subblock* p = &pSubblocks[s];
+        const etc1_byte* c = pColors + 3 * s;
+        etc_vec dr = c[0] - p->r;
+        etc_vec dg = c[1] - p->g;
+        etc_vec db = c[2] - p->b;
+        error += (6 * dg * dg + 3 * dr * dr + db * db) & p->valid;
+    }
+    etc1_uint32 sum = 0;
+    for (int n = 0; n < 8; n++) {
+        sum += error[n];
+    }
+    return sum;
+}
+
 static void writeBigEndian(etc1_byte* pOut, etc1_uint32 d) {
     pOut[0] = (etc1_byte)(d >> 24);
     pOut[1] = (etc1_byte)(d >> 16);
@@ -481,8 +530,8 @@ static void writeBigEndian(etc1_byte* pOut, etc1_uint32 d) {
 // pixel is valid or not. Invalid pixel color values are ignored when compressing.
 // Output is an ETC1 compressed version of the data.
 
-void etc1_encode_block(const etc1_byte* pIn, etc1_uint32 inMask,
-        etc1_byte* pOut) {
+void etc1_encode_block_with_quality(const etc1_byte* pIn, etc1_uint32 inMask,
+        etc1_byte* pOut, etc1_uint32 quality) {
     etc1_byte colors[6];
     etc1_byte flippedColors[6];
     etc_average_colors_subblock(pIn, inMask, colors, false, false);
@@ -490,30 +539,65 @@ void etc1_encode_block(const etc1_byte* pIn, etc1_uint32 inMask,
     etc_average_colors_subblock(pIn, inMask, flippedColors, true, false);
     etc_average_colors_subblock(pIn, inMask, flippedColors + 3, true, true);
 
+    etc_subblock subblocks[2];
+    etc_subblock flippedSubblocks[2];
+    etc_gather_subblock(pIn, inMask, &subblocks[0], false, false);
+    etc_gather_subblock(pIn, inMask, &subblocks[1], false, true);
+    etc_gather_subblock(pIn, inMask, &flippedSubblocks[0], true, false);
+    etc_gather_subblock(pIn, inMask, &flippedSubblocks[1], true, true);
+
     etc_compressed a, b;
-    etc_encode_block_helper(pIn, inMask, colors, &a, false);
-    etc_encode_block_helper(pIn, inMask, flippedColors, &b, true);
-    take_best(&a, &b);
+    if (quality == ETC1_QUALITY_FAST) {
+        // Only encode the orientation whose halves are the most uniform.
+        if (etc_subblock_variance(subblocks, colors)
+                <= etc_subblock_variance(flippedSubblocks, flippedColors)) {
+            etc_encode_block_helper(subblocks, colors, &a, false, true, 0, 0);
+        } else {
+            etc_encode_block_helper(flippedSubblocks, flippedColors, &a, true,
+                    true, 0, 0);
+        }
+    } else if (quality == ETC1_QUALITY_HIGH) {
+        // Also try individual base colors, and the base colors one
+        // quantization step either side of the averages.
+        a.score = ~0;
+        for (int mode = 0; mode < 2; mode++) {
+            for (int delta1 = -1; delta1 <= 1; delta1++) {
+                for (int delta2 = -1; delta2 <= 1; delta2++) {
+                    etc_encode_block_helper(subblocks, colors, &b, false,
+                            mode == 0, delta1, delta2);
+                    take_best(&a, &b);
+                    etc_encode_block_helper(flippedSubblocks, flippedColors, &b,
+                            true, mode == 0, delta1, delta2);
+                    take_best(&a, &b);
+                }
+            }
+        }
+    } else {
+        etc_encode_block_helper(subblocks, colors, &a, false, true, 0, 0);
+        etc_encode_block_helper(flippedSubblocks, flippedColors, &b, true,
+                true, 0, 0);
+        take_best(&a, &b);
+    }
     writeBigEndian(pOut, a.high);
     writeBigEndian(pOut + 4, a.low);
 }
 
+void etc1_encode_block(const etc1_byte* pIn, etc1_uint32 inMask,
+        etc1_byte* pOut) {
+    etc1_encode_block_with_quality(pIn, inMask, pOut, ETC1_QUALITY_MEDIUM);
+}
+
 // Return the size of the encoded image data (does not include size of PKM header).
 
 etc1_uint32 etc1_get_encoded_data_size(etc1_uint32 width, etc1_uint32 height) {
     return (((width + 3) & ~3) * ((height + 3) & ~3)) >> 1;
 }
 
-// Encode an entire image.
-// pIn - pointer to the image data. Formatted such that the Red component of
-//       pixel (x,y) is at pIn + pixelSize * x + stride * y + redOffset;
-// pOut - pointer to encoded data. Must be large enough to store entire encoded image.
+// Encodes the row of blocks starting at pixel row y.
 
-int etc1_encode_image(const etc1_byte* pIn, etc1_uint32 width, etc1_uint32 height,
-        etc1_uint32 pixelSize, etc1_uint32 stride, etc1_byte* pOut) {
-    if (pixelSize < 2 || pixelSize > 3) {
-        return -1;
-    }
+static void etc_encode_block_row(const etc1_byte* pIn, etc1_uint32 width,
+        etc1_uint32 height, etc1_uint32 pixelSize, etc1_uint32 stride,
+        etc1_uint32 y, etc1_byte* pOut, etc1_uint32 quality) {
     static const unsigned short kYMask[] = { 0x0, 0xf, 0xff, 0xfff, 0xffff };
     static const unsigned short kXMask[] = { 0x0, 0x1111, 0x3333, 0x7777,
             0xffff };
@@ -521,43 +605,94 @@ int etc1_encode_image(const etc1_byte* pIn, etc1_uint32 width, etc1_uint32 heigh
     etc1_byte encoded[ETC1_ENCODED_BLOCK_SIZE];
 
     etc1_uint32 encodedWidth = (width + 3) & ~3;
-    etc1_uint32 encodedHeight = (height + 3) & ~3;
 
-    for (etc1_uint32 y = 0; y < encodedHeight; y += 4) {
-        etc1_uint32 yEnd = height - y;
-        if (yEnd > 4) {
-            yEnd = 4;
+    etc1_uint32 yEnd = height - y;
+    if (yEnd > 4) {
+        yEnd = 4;
+    }
+    int ymask = kYMask[yEnd];
+    for (etc1_uint32 x = 0; x < encodedWidth; x += 4) {
+        etc1_uint32 xEnd = width - x;
+        if (xEnd > 4) {
+            xEnd = 4;
         }
-        int ymask = kYMask[yEnd];
-        for (etc1_uint32 x = 0; x < encodedWidth; x += 4) {
-            etc1_uint32 xEnd = width - x;
-            if (xEnd > 4) {
-                xEnd = 4;
-            }
-            int mask = ymask & kXMask[xEnd];
-            for (etc1_uint32 cy = 0; cy < yEnd; cy++) {
-                etc1_byte* q = block + (cy * 4) * 3;
-                const etc1_byte* p = pIn + pixelSize * x + stride * (y + cy);
-                if (pixelSize == 3) {
-                    memcpy(q, p, xEnd * 3);
-                } else {
-                    for (etc1_uint32 cx = 0; cx < xEnd; cx++) {
-                        int pixel = (p[1] << 8) | p[0];
-                        *q++ = convert5To8(pixel >> 11);
-                        *q++ = convert6To8(pixel >> 5);
-                        *q++ = convert5To8(pixel);
-                        p += pixelSize;
-                    }
+        int mask = ymask & kXMask[xEnd];
+        for (etc1_uint32 cy = 0; cy < yEnd; cy++) {
+            etc1_byte* q = block + (cy * 4) * 3;
+            const etc1_byte* p = pIn + pixelSize * x + stride * (y + cy);
+            if (pixelSize == 3) {
+                memcpy(q, p, xEnd * 3);
+            } else {
+                for (etc1_uint32 cx = 0; cx < xEnd; cx++) {
+                    int pixel = (p[1] << 8) | p[0];
+                    *q++ = convert5To8(pixel >> 11);
+                    *q++ = convert6To8(pixel >> 5);
+                    *q++ = convert5To8(pixel);
+                    p += pixelSize;
                 }
             }
-            etc1_encode_block(block, mask, encoded);
-            memcpy(pOut, encoded, sizeof(encoded));
-            pOut += sizeof(encoded);
         }
+        etc1_encode_block_with_quality(block, mask, encoded, quality);
+        memcpy(pOut, encoded, sizeof(encoded));
+        pOut += sizeof(encoded);
+    }
+}
+
+// Encode an entire image.
+// pIn - pointer to the image data. Formatted such that the Red component of
+//       pixel (x,y) is at pIn + pixelSize * x + stride * y + redOffset;
+// pOut - pointer to encoded data. Must be large enough to store entire encoded image.
+
+int etc1_encode_image_with_quality(const etc1_byte* pIn, etc1_uint32 width,
+        etc1_uint32 height, etc1_uint32 pixelSize, etc1_uint32 stride,
+        etc1_byte* pOut, etc1_uint32 quality, etc1_uint32 threadCount) {
+    if (pixelSize < 2 || pixelSize > 3) {
+        return -1;
+    }
+    if (quality > ETC1_QUALITY_HIGH) {
+        return -1;
+    }
+
+    etc1_uint32 encodedWidth = (width + 3) & ~3;
+    etc1_uint32 encodedHeight = (height + 3) & ~3;
+    etc1_uint32 rowCount = encodedHeight / 4;
+    etc1_uint32 rowSize = (encodedWidth / 4) * ETC1_ENCODED_BLOCK_SIZE;
+
+    if (threadCount == 0) {
+        threadCount = std::thread::hardware_concurrency();
+    }
+    if (threadCount > rowCount) {
+        threadCount = rowCount;
+    }
+
+    // Rows are handed out one at a time, so threads that get easy rows
+    // pick up more of them.
+    std::atomic<etc1_uint32> nextRow(0);
+    auto encodeRows = [&]() {
+        etc1_uint32 row;
+        while ((row = nextRow.fetch_add(1, std::memory_order_relaxed)) < rowCount) {
+            etc_encode_block_row(pIn, width, height, pixelSize, stride, row * 4,
+                    pOut + row * rowSize, quality);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (etc1_uint32 i = 1; i < threadCount; i++) {
+        threads.emplace_back(encodeRows);
+    }
+    encodeRows();
+    for (std::thread& thread : threads) {
+        thread.join();
     }
     return 0;
 }
 
+int etc1_encode_image(const etc1_byte* pIn, etc1_uint32 width, etc1_uint32 height,
+        etc1_uint32 pixelSize, etc1_uint32 stride, etc1_byte* pOut) {
+    return etc1_encode_image_with_quality(pIn, width, height, pixelSize, stride,
+            pOut, ETC1_QUALITY_MEDIUM, 1);
+}
+
 // Decode an entire image.
 // pIn - pointer to encoded data.
 // pOut - pointer to the image data. Will be written such that the Red component of
@@ -26,7 +26,12 @@
 #include "egl_cache.h"
 #include "egl_display.h"
 
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <memory>
+#include <string>
 
 namespace android {
 
@@ -87,10 +92,15 @@ protected:
     }
 
     virtual void TearDown() {
+        unlink(getJournalPath().c_str());
         mTempFile.reset(nullptr);
         EGLCacheTest::TearDown();
     }
 
+    std::string getJournalPath() const {
+        return std::string(mTempFile->path) + ".journal";
+    }
+
     std::unique_ptr<TemporaryFile> mTempFile;
 };
 
@@ -108,4 +118,86 @@ TEST_F(EGLCacheSerializationTest, ReinitializedCacheContainsValues) {
     ASSERT_EQ('h', buf[3]);
 }
 
+TEST_F(EGLCacheSerializationTest, TruncatedJournalKeepsEarlierValues) {
+    uint8_t buf[4] = { 0xee, 0xee, 0xee, 0xee };
+    mCache->setCacheFilename(&mTempFile->path[0]);
+    mCache->initialize(egl_display_t::get(EGL_DEFAULT_DISPLAY));
+    mCache->setBlob("abcd", 4, "efgh", 4);
+    mCache->setBlob("ijkl", 4, "mnop", 4);
+    mCache->terminate();
+
+    // Cut off the last entry, as if the process died while appending it.
+    struct stat st;
+    ASSERT_EQ(0, stat(getJournalPath().c_str(), &st));
+    ASSERT_EQ(0, truncate(getJournalPath().c_str(), st.st_size - 1));
+
+    mCache->initialize(egl_display_t::get(EGL_DEFAULT_DISPLAY));
+    ASSERT_EQ(4, mCache->getBlob("abcd", 4, buf, 4));
+    ASSERT_EQ('e', buf[0]);
+    ASSERT_EQ('f', buf[1]);
+    ASSERT_EQ('g', buf[2]);
+    ASSERT_EQ('h', buf[3]);
+    ASSERT_EQ(0, mCache->getBlob("ijkl", 4, buf, 4));
+}
+
+class EGLSharedCacheTest : public EGLCacheSerializationTest {
+
+protected:
+
+    virtual void SetUp() {
+        EGLCacheSerializationTest::SetUp();
+        mSharedFile.reset(new TemporaryFile());
+    }
+
+    virtual void TearDown() {
+        rmdir(getSharedJournalPath().c_str());
+        mCache->setSharedCacheFilename("");
+        mSharedFile.reset(nullptr);
+        EGLCacheSerializationTest::TearDown();
+    }
+
+    std::string getSharedJournalPath() const {
+        return std::string(mSharedFile->path) + ".journal";
+    }
+
+    // Generates the shared cache file with a per-process cache that can't
+    // journal, so that terminate() writes out the whole cache file.
+    void writeSharedCache(const char* key, const char* value) {
+        ASSERT_EQ(0, mkdir(getSharedJournalPath().c_str(), 0700));
+        mCache->setCacheFilename(&mSharedFile->path[0]);
+        mCache->initialize(egl_display_t::get(EGL_DEFAULT_DISPLAY));
+        mCache->setBlob(key, strlen(key), value, strlen(value));
+        mCache->terminate();
+
+        mCache->setCacheFilename(&mTempFile->path[0]);
+        mCache->setSharedCacheFilename(&mSharedFile->path[0]);
+    }
+
+    std::unique_ptr<TemporaryFile> mSharedFile;
+};
+
+TEST_F(EGLSharedCacheTest, PrivateCacheMissFallsBackToSharedCache) {
+    uint8_t buf[4] = { 0xee, 0xee, 0xee, 0xee };
+    ASSERT_NO_FATAL_FAILURE(writeSharedCache("abcd", "efgh"));
+    mCache->initialize(egl_display_t::get(EGL_DEFAULT_DISPLAY));
+    ASSERT_EQ(4, mCache->getBlob("abcd", 4, buf, 4));
+    ASSERT_EQ('e', buf[0]);
+    ASSERT_EQ('f', buf[1]);
+    ASSERT_EQ('g', buf[2]);
+    ASSERT_EQ('h', buf[3]);
+    ASSERT_EQ(0, mCache->getBlob("ijkl", 4, buf, 4));
+}
+
+TEST_F(EGLSharedCacheTest, PrivateCacheTakesPrecedence) {
+    uint8_t buf[4] = { 0xee, 0xee, 0xee, 0xee };
+    ASSERT_NO_FATAL_FAILURE(writeSharedCache("abcd", "efgh"));
+    mCache->initialize(egl_display_t::get(EGL_DEFAULT_DISPLAY));
+    mCache->setBlob("abcd", 4, "mnop", 4);
+    ASSERT_EQ(4, mCache->getBlob("abcd", 4, buf, 4));
+    ASSERT_EQ('m', buf[0]);
+    ASSERT_EQ('n', buf[1]);
+    ASSERT_EQ('o', buf[2]);
+    ASSERT_EQ('p', buf[3]);
+}
+
 }
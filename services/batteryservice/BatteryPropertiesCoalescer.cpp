@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <batteryservice/BatteryPropertiesCoalescer.h>
+
+namespace android {
+
+constexpr nsecs_t BatteryPropertiesCoalescer::DEFAULT_WINDOW;
+
+// Fields that listeners act on, a change is never held back
+static bool stateEquals(const BatteryProperties& a, const BatteryProperties& b) {
+    return a.chargerAcOnline == b.chargerAcOnline &&
+            a.chargerUsbOnline == b.chargerUsbOnline &&
+            a.chargerWirelessOnline == b.chargerWirelessOnline &&
+            a.batteryStatus == b.batteryStatus &&
+            a.batteryHealth == b.batteryHealth &&
+            a.batteryPresent == b.batteryPresent &&
+            a.batteryLevel == b.batteryLevel &&
+            a.batteryTechnology == b.batteryTechnology;
+}
+
+// Measured values, which jitter from one reading to the next
+static bool measurementsEqual(const BatteryProperties& a, const BatteryProperties& b) {
+    return a.maxChargingCurrent == b.maxChargingCurrent &&
+            a.maxChargingVoltage == b.maxChargingVoltage &&
+            a.batteryVoltage == b.batteryVoltage &&
+            a.batteryTemperature == b.batteryTemperature &&
+            a.batteryCurrent == b.batteryCurrent &&
+            a.batteryCycleCount == b.batteryCycleCount &&
+            a.batteryFullCharge == b.batteryFullCharge &&
+            a.batteryChargeCounter == b.batteryChargeCounter;
+}
+
+BatteryPropertiesCoalescer::BatteryPropertiesCoalescer(nsecs_t window)
+  : mWindow(window),
+    mHasSent(false),
+    mSent(),
+    mSentTime(0),
+    mHasPending(false),
+    mPending()
+{
+}
+
+void BatteryPropertiesCoalescer::markSent(const BatteryProperties& props, nsecs_t now) {
+    mHasSent = true;
+    mSent = props;
+    mSentTime = now;
+    mHasPending = false;
+}
+
+bool BatteryPropertiesCoalescer::update(const BatteryProperties& props, nsecs_t now) {
+    if (!mHasSent || !stateEquals(props, mSent)) {
+        markSent(props, now);
+        return true;
+    }
+
+    if (measurementsEqual(props, mSent)) {
+        // Nothing new, or a flip back to what the listeners already have
+        mHasPending = false;
+        return false;
+    }
+
+    if (now - mSentTime >= mWindow) {
+        markSent(props, now);
+        return true;
+    }
+
+    mPending = props;
+    mHasPending = true;
+    return false;
+}
+
+nsecs_t BatteryPropertiesCoalescer::getDeadline() const {
+    return mHasPending ? mSentTime + mWindow : -1;
+}
+
+bool BatteryPropertiesCoalescer::flush(nsecs_t now, BatteryProperties* outProps) {
+    if (!mHasPending || now < mSentTime + mWindow) {
+        return false;
+    }
+
+    *outProps = mPending;
+    markSent(mPending, now);
+    return true;
+}
+
+}; // namespace android
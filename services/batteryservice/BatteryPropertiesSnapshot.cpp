@@ -0,0 +1,229 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "BatteryPropertiesSnapshot"
+//#define LOG_NDEBUG 0
+#include <utils/Log.h>
+
+#include <batteryservice/BatteryPropertiesSnapshot.h>
+#include <cutils/ashmem.h>
+
+#include <new>
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace android {
+
+static constexpr uint32_t MAX_READ_RETRIES = 64;
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2,
+        "BatteryPropertiesSnapshot requires lock-free atomics to be shared across processes");
+
+static void toRecord(const BatteryProperties& props, BatteryPropertiesSnapshot::Record* record) {
+    record->chargerAcOnline = props.chargerAcOnline ? 1 : 0;
+    record->chargerUsbOnline = props.chargerUsbOnline ? 1 : 0;
+    record->chargerWirelessOnline = props.chargerWirelessOnline ? 1 : 0;
+    record->maxChargingCurrent = props.maxChargingCurrent;
+    record->maxChargingVoltage = props.maxChargingVoltage;
+    record->batteryStatus = props.batteryStatus;
+    record->batteryHealth = props.batteryHealth;
+    record->batteryPresent = props.batteryPresent ? 1 : 0;
+    record->batteryLevel = props.batteryLevel;
+    record->batteryVoltage = props.batteryVoltage;
+    record->batteryTemperature = props.batteryTemperature;
+    record->batteryCurrent = props.batteryCurrent;
+    record->batteryCycleCount = props.batteryCycleCount;
+    record->batteryFullCharge = props.batteryFullCharge;
+    record->batteryChargeCounter = props.batteryChargeCounter;
+    strlcpy(record->batteryTechnology, props.batteryTechnology.string(),
+            sizeof(record->batteryTechnology));
+}
+
+static void fromRecord(const BatteryPropertiesSnapshot::Record& record, BatteryProperties* props) {
+    props->chargerAcOnline = record.chargerAcOnline != 0;
+    props->chargerUsbOnline = record.chargerUsbOnline != 0;
+    props->chargerWirelessOnline = record.chargerWirelessOnline != 0;
+    props->maxChargingCurrent = record.maxChargingCurrent;
+    props->maxChargingVoltage = record.maxChargingVoltage;
+    props->batteryStatus = record.batteryStatus;
+    props->batteryHealth = record.batteryHealth;
+    props->batteryPresent = record.batteryPresent != 0;
+    props->batteryLevel = record.batteryLevel;
+    props->batteryVoltage = record.batteryVoltage;
+    props->batteryTemperature = record.batteryTemperature;
+    props->batteryCurrent = record.batteryCurrent;
+    props->batteryCycleCount = record.batteryCycleCount;
+    props->batteryFullCharge = record.batteryFullCharge;
+    props->batteryChargeCounter = record.batteryChargeCounter;
+    props->batteryTechnology = String8(record.batteryTechnology,
+            strnlen(record.batteryTechnology, sizeof(record.batteryTechnology)));
+}
+
+// ----------------------------------------------------------------------------
+// BatteryPropertiesSnapshotWriter
+// ----------------------------------------------------------------------------
+
+BatteryPropertiesSnapshotWriter::BatteryPropertiesSnapshotWriter()
+  : mFd(-1),
+    mHeader(nullptr)
+{
+    const size_t size = sizeof(BatteryPropertiesSnapshot::Header);
+    mFd = ashmem_create_region("battery properties", size);
+    if (mFd < 0) {
+        ALOGE("BatteryPropertiesSnapshotWriter: ashmem_create_region failed: %s",
+                strerror(errno));
+        return;
+    }
+
+    void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, 0);
+    if (base == MAP_FAILED) {
+        ALOGE("BatteryPropertiesSnapshotWriter: mmap failed: %s", strerror(errno));
+        close(mFd);
+        mFd = -1;
+        return;
+    }
+
+    // Any mapping created from now on (i.e. by the readers) is read-only
+    if (ashmem_set_prot_region(mFd, PROT_READ) < 0) {
+        ALOGE("BatteryPropertiesSnapshotWriter: ashmem_set_prot_region failed: %s",
+                strerror(errno));
+        munmap(base, size);
+        close(mFd);
+        mFd = -1;
+        return;
+    }
+
+    BatteryPropertiesSnapshot::Header* header = new (base) BatteryPropertiesSnapshot::Header;
+    header->magic = BatteryPropertiesSnapshot::MAGIC;
+    header->version = BatteryPropertiesSnapshot::VERSION;
+    header->recordSize = sizeof(BatteryPropertiesSnapshot::Record);
+    header->sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    mHeader = header;
+}
+
+BatteryPropertiesSnapshotWriter::~BatteryPropertiesSnapshotWriter() {
+    if (mHeader != nullptr) {
+        munmap(mHeader, sizeof(BatteryPropertiesSnapshot::Header));
+    }
+    if (mFd >= 0) {
+        close(mFd);
+    }
+}
+
+void BatteryPropertiesSnapshotWriter::write(const BatteryProperties& props) {
+    if (mHeader == nullptr) {
+        return;
+    }
+
+    const uint32_t sequence = mHeader->sequence.load(std::memory_order_relaxed);
+    mHeader->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    toRecord(props, &mHeader->record);
+    mHeader->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+// ----------------------------------------------------------------------------
+// BatteryPropertiesSnapshotReader
+// ----------------------------------------------------------------------------
+
+BatteryPropertiesSnapshotReader::BatteryPropertiesSnapshotReader(int fd)
+  : mFd(fd),
+    mHeader(nullptr)
+{
+    if (mFd < 0) {
+        return;
+    }
+
+    const size_t size = sizeof(BatteryPropertiesSnapshot::Header);
+    if (ashmem_get_size_region(mFd) < static_cast<int>(size)) {
+        ALOGE("BatteryPropertiesSnapshotReader: invalid region size");
+        return;
+    }
+
+    void* base = mmap(nullptr, size, PROT_READ, MAP_SHARED, mFd, 0);
+    if (base == MAP_FAILED) {
+        ALOGE("BatteryPropertiesSnapshotReader: mmap failed: %s", strerror(errno));
+        return;
+    }
+
+    const BatteryPropertiesSnapshot::Header* header =
+            static_cast<const BatteryPropertiesSnapshot::Header*>(base);
+    if (header->magic != BatteryPropertiesSnapshot::MAGIC ||
+            header->version != BatteryPropertiesSnapshot::VERSION ||
+            header->recordSize != sizeof(BatteryPropertiesSnapshot::Record)) {
+        ALOGE("BatteryPropertiesSnapshotReader: unsupported snapshot layout");
+        munmap(base, size);
+        return;
+    }
+
+    mHeader = header;
+}
+
+BatteryPropertiesSnapshotReader::~BatteryPropertiesSnapshotReader() {
+    if (mHeader != nullptr) {
+        munmap(const_cast<BatteryPropertiesSnapshot::Header*>(mHeader),
+                sizeof(BatteryPropertiesSnapshot::Header));
+    }
+    if (mFd >= 0) {
+        close(mFd);
+    }
+}
+
+uint32_t BatteryPropertiesSnapshotReader::getGeneration() const {
+    if (mHeader == nullptr) {
+        return 0;
+    }
+    // A write in progress reports the generation it is about to publish
+    return (mHeader->sequence.load(std::memory_order_acquire) + 1) & ~1u;
+}
+
+status_t BatteryPropertiesSnapshotReader::read(BatteryProperties* outProps,
+        uint32_t* outGeneration) const {
+    if (mHeader == nullptr) {
+        return NO_INIT;
+    }
+
+    // Bounds the number of times we look at a record that is being written,
+    // so that a writer dying mid-write can't make readers spin forever.
+    for (uint32_t retries = 0; retries < MAX_READ_RETRIES; retries++) {
+        const uint32_t before = mHeader->sequence.load(std::memory_order_acquire);
+        if (before == 0) {
+            return NOT_ENOUGH_DATA;
+        }
+        if (before & 1) {
+            continue;
+        }
+        const BatteryPropertiesSnapshot::Record record = mHeader->record;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (mHeader->sequence.load(std::memory_order_relaxed) != before) {
+            continue;
+        }
+
+        fromRecord(record, outProps);
+        if (outGeneration != nullptr) {
+            *outGeneration = before;
+        }
+        return NO_ERROR;
+    }
+    return WOULD_BLOCK;
+}
+
+}; // namespace android
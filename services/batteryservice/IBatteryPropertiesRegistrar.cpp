@@ -20,8 +20,10 @@
 
 #include <batteryservice/IBatteryPropertiesListener.h>
 #include <batteryservice/IBatteryPropertiesRegistrar.h>
+#include <errno.h>
 #include <stdint.h>
 #include <sys/types.h>
+#include <unistd.h>
 #include <binder/Parcel.h>
 
 namespace android {
@@ -66,10 +68,37 @@ public:
             data.writeInterfaceToken(IBatteryPropertiesRegistrar::getInterfaceDescriptor());
             remote()->transact(SCHEDULE_UPDATE, data, NULL);
         }
+
+        status_t getPropertiesSnapshot(int* outFd) {
+            Parcel data, reply;
+            data.writeInterfaceToken(IBatteryPropertiesRegistrar::getInterfaceDescriptor());
+            status_t err = remote()->transact(GET_PROPERTIES_SNAPSHOT, data, &reply);
+            if (err != OK) {
+                return err;
+            }
+            int32_t ret = reply.readExceptionCode();
+            if (ret != 0) {
+                return ret;
+            }
+            ret = reply.readInt32();
+            if (ret != OK) {
+                return ret;
+            }
+            int fd = dup(reply.readFileDescriptor());
+            if (fd < 0) {
+                return -errno;
+            }
+            *outFd = fd;
+            return OK;
+        }
 };
 
 IMPLEMENT_META_INTERFACE(BatteryPropertiesRegistrar, "android.os.IBatteryPropertiesRegistrar");
 
+status_t IBatteryPropertiesRegistrar::getPropertiesSnapshot(int* /*outFd*/) {
+    return INVALID_OPERATION;
+}
+
 status_t BnBatteryPropertiesRegistrar::onTransact(uint32_t code,
                                                   const Parcel& data,
                                                   Parcel* reply,
@@ -109,6 +138,18 @@ status_t BnBatteryPropertiesRegistrar::onTransact(uint32_t code,
             scheduleUpdate();
             return OK;
         }
+
+        case GET_PROPERTIES_SNAPSHOT: {
+            CHECK_INTERFACE(IBatteryPropertiesRegistrar, data, reply);
+            int fd = -1;
+            status_t result = getPropertiesSnapshot(&fd);
+            reply->writeNoException();
+            reply->writeInt32(result);
+            if (result == OK) {
+                reply->writeFileDescriptor(fd, true /* takeOwnership */);
+            }
+            return OK;
+        }
     }
     return BBinder::onTransact(code, data, reply, flags);
 };
@@ -20,8 +20,12 @@
 
 #include <android-base/logging.h>
 #include <android/frameworks/displayservice/1.0/BpHwEventCallback.h>
+#include <gui/DisplayEventReceiver.h>
+#include <utils/Looper.h>
 
+#include <map>
 #include <thread>
+#include <vector>
 
 namespace android {
 namespace frameworks {
@@ -44,55 +48,141 @@ sp<Looper> getLooper() {
     return looper;
 }
 
-DisplayEventReceiver::AttachedEvent::AttachedEvent(const sp<IEventCallback> &callback)
-    : mCallback(callback)
-{
-    mLooperAttached = getLooper()->addFd(mFwkReceiver.getFd(),
-            Looper::POLL_CALLBACK,
-            Looper::EVENT_INPUT,
-            this,
-            nullptr);
-}
+namespace {
+
+using FwkReceiver = ::android::DisplayEventReceiver;
+
+// Connection to SurfaceFlinger shared by all receivers in the process. The
+// events of the connection are fanned out to the subscribed receivers, each
+// with its own vsync rate, so that SurfaceFlinger wakes up a single connection
+// no matter how many HAL clients listen for vsync.
+class SharedReceiver : public LooperCallback {
+public:
+    static sp<SharedReceiver> get() {
+        static sp<SharedReceiver> receiver = []() {
+            sp<SharedReceiver> receiver = new SharedReceiver();
+            receiver->attach();
+            return receiver;
+        }();
+        return receiver;
+    }
 
-DisplayEventReceiver::AttachedEvent::~AttachedEvent() {
-    if (!detach()) {
-        LOG(ERROR) << "Could not remove fd from looper.";
+    bool valid() const {
+        std::unique_lock<std::mutex> lock(mMutex);
+        return mFwkReceiver.initCheck() == OK && mLooperAttached;
     }
-}
 
-bool DisplayEventReceiver::AttachedEvent::detach() {
-    if (!valid()) {
-        return true;
+    void subscribe(const void* key, const sp<IEventCallback>& callback) {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mSubscribers[key] = Subscriber{callback, -1 /* rate */, false /* next */};
     }
 
-    return getLooper()->removeFd(mFwkReceiver.getFd());
-}
+    void unsubscribe(const void* key) {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mSubscribers.erase(key);
+        updateConnectionLocked();
+    }
 
-bool DisplayEventReceiver::AttachedEvent::valid() const {
-    return mFwkReceiver.initCheck() == OK && mLooperAttached;
-}
+    status_t setVsyncRate(const void* key, int32_t count) {
+        std::unique_lock<std::mutex> lock(mMutex);
+        auto search = mSubscribers.find(key);
+        if (search == mSubscribers.end()) {
+            return BAD_VALUE;
+        }
+        search->second.rate = count;
+        return updateConnectionLocked();
+    }
 
-DisplayEventReceiver::FwkReceiver &DisplayEventReceiver::AttachedEvent::receiver() {
-    return mFwkReceiver;
-}
+    status_t requestNextVsync(const void* key) {
+        std::unique_lock<std::mutex> lock(mMutex);
+        auto search = mSubscribers.find(key);
+        if (search == mSubscribers.end()) {
+            return BAD_VALUE;
+        }
+        // As with a SurfaceFlinger connection, the request only has an effect
+        // while the rate is 0.
+        if (search->second.rate <= 0) {
+            search->second.rate = 0;
+            search->second.nextVsync = true;
+        }
+        return updateConnectionLocked();
+    }
+
+    int handleEvent(int fd, int events, void* /* data */) override;
+
+private:
+    struct Subscriber {
+        sp<IEventCallback> callback;
+
+        // Rate as set by setVsyncRate(): n > 0 delivers every nth vsync, 0
+        // delivers a vsync only after requestNextVsync(), and -1, before any
+        // rate is set, delivers none.
+        int32_t rate;
+        bool nextVsync;
+    };
+
+    SharedReceiver() = default;
+
+    void attach() {
+        mLooperAttached = getLooper()->addFd(mFwkReceiver.getFd(),
+                Looper::POLL_CALLBACK,
+                Looper::EVENT_INPUT,
+                this,
+                nullptr);
+    }
+
+    // Makes the SurfaceFlinger connection deliver every vsync while any
+    // subscriber has a rate, and only the requested ones otherwise.
+    status_t updateConnectionLocked() {
+        bool continuous = false;
+        bool requested = false;
+        for (const auto& pair : mSubscribers) {
+            continuous |= pair.second.rate > 0;
+            requested |= pair.second.nextVsync;
+        }
+
+        const int32_t rate = continuous ? 1 : 0;
+        if (rate != mConnectionRate) {
+            status_t status = mFwkReceiver.setVsyncRate(rate);
+            if (status != OK) {
+                return status;
+            }
+            mConnectionRate = rate;
+        }
 
-int DisplayEventReceiver::AttachedEvent::handleEvent(int fd, int events, void* /* data */) {
+        if (!continuous && requested) {
+            return mFwkReceiver.requestNextVsync();
+        }
+        return OK;
+    }
+
+    mutable std::mutex mMutex;
+    FwkReceiver mFwkReceiver;
+    bool mLooperAttached = false;
+    int32_t mConnectionRate = 0;
+    std::map<const void*, Subscriber> mSubscribers;
+};
+
+int SharedReceiver::handleEvent(int fd, int events, void* /* data */) {
     CHECK(fd == mFwkReceiver.getFd());
 
     if (events & (Looper::EVENT_ERROR | Looper::EVENT_HANGUP)) {
-        LOG(ERROR) << "AttachedEvent handleEvent received error or hangup:" << events;
+        LOG(ERROR) << "SharedReceiver handleEvent received error or hangup:" << events;
+        std::unique_lock<std::mutex> lock(mMutex);
+        mLooperAttached = false;
         return 0; // remove the callback
     }
 
     if (!(events & Looper::EVENT_INPUT)) {
-        LOG(ERROR) << "AttachedEvent handleEvent unhandled poll event:" << events;
+        LOG(ERROR) << "SharedReceiver handleEvent unhandled poll event:" << events;
         return 1; // keep the callback
     }
 
-    constexpr size_t SIZE = 1;
+    constexpr size_t SIZE = 8;
 
     ssize_t n;
     FwkReceiver::Event buf[SIZE];
+    std::vector<sp<IEventCallback>> callbacks;
     while ((n = mFwkReceiver.getEvents(buf, SIZE)) > 0) {
         for (size_t i = 0; i < static_cast<size_t>(n); ++i) {
             const FwkReceiver::Event &event = buf[i];
@@ -100,15 +190,38 @@ int DisplayEventReceiver::AttachedEvent::handleEvent(int fd, int events, void* /
             uint32_t type = event.header.type;
             uint64_t timestamp = event.header.timestamp;
 
-            switch(buf[i].header.type) {
+            // The callbacks are invoked without holding the lock, so that
+            // clients may call back into their receiver.
+            callbacks.clear();
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                for (auto& pair : mSubscribers) {
+                    Subscriber& subscriber = pair.second;
+                    if (type != FwkReceiver::DISPLAY_EVENT_VSYNC) {
+                        callbacks.push_back(subscriber.callback);
+                    } else if (subscriber.nextVsync) {
+                        subscriber.nextVsync = false;
+                        callbacks.push_back(subscriber.callback);
+                    } else if (subscriber.rate > 0 &&
+                            event.vsync.count % subscriber.rate == 0) {
+                        callbacks.push_back(subscriber.callback);
+                    }
+                }
+            }
+
+            switch(type) {
                 case FwkReceiver::DISPLAY_EVENT_VSYNC: {
-                    mCallback->onVsync(timestamp, event.vsync.count);
+                    for (const auto& callback : callbacks) {
+                        callback->onVsync(timestamp, event.vsync.count);
+                    }
                 } break;
                 case FwkReceiver::DISPLAY_EVENT_HOTPLUG: {
-                    mCallback->onHotplug(timestamp, event.hotplug.connected);
+                    for (const auto& callback : callbacks) {
+                        callback->onHotplug(timestamp, event.hotplug.connected);
+                    }
                 } break;
                 default: {
-                    LOG(ERROR) << "AttachedEvent handleEvent unknown type: " << type;
+                    LOG(ERROR) << "SharedReceiver handleEvent unknown type: " << type;
                 }
             }
         }
@@ -117,6 +230,42 @@ int DisplayEventReceiver::AttachedEvent::handleEvent(int fd, int events, void* /
     return 1; // keep on going
 }
 
+}  // anonymous namespace
+
+DisplayEventReceiver::AttachedEvent::AttachedEvent(const sp<IEventCallback> &callback)
+{
+    mAttached = SharedReceiver::get()->valid();
+    if (mAttached) {
+        SharedReceiver::get()->subscribe(this, callback);
+    }
+}
+
+DisplayEventReceiver::AttachedEvent::~AttachedEvent() {
+    if (!detach()) {
+        LOG(ERROR) << "Could not unsubscribe from display events.";
+    }
+}
+
+bool DisplayEventReceiver::AttachedEvent::detach() {
+    if (mAttached) {
+        SharedReceiver::get()->unsubscribe(this);
+        mAttached = false;
+    }
+    return true;
+}
+
+bool DisplayEventReceiver::AttachedEvent::valid() const {
+    return mAttached && SharedReceiver::get()->valid();
+}
+
+status_t DisplayEventReceiver::AttachedEvent::setVsyncRate(int32_t count) {
+    return SharedReceiver::get()->setVsyncRate(this, count);
+}
+
+status_t DisplayEventReceiver::AttachedEvent::requestNextVsync() {
+    return SharedReceiver::get()->requestNextVsync(this);
+}
+
 Return<Status> DisplayEventReceiver::init(const sp<IEventCallback>& callback) {
     std::unique_lock<std::mutex> lock(mMutex);
 
@@ -124,7 +273,7 @@ Return<Status> DisplayEventReceiver::init(const sp<IEventCallback>& callback) {
         return Status::BAD_VALUE;
     }
 
-    mAttached = new AttachedEvent(callback);
+    mAttached = std::make_unique<AttachedEvent>(callback);
 
     return mAttached->valid() ? Status::SUCCESS : Status::UNKNOWN;
 }
@@ -136,7 +285,7 @@ Return<Status> DisplayEventReceiver::setVsyncRate(int32_t count) {
         return Status::BAD_VALUE;
     }
 
-    bool success = OK == mAttached->receiver().setVsyncRate(count);
+    bool success = OK == mAttached->setVsyncRate(count);
     return success ? Status::SUCCESS : Status::UNKNOWN;
 }
 
@@ -147,7 +296,7 @@ Return<Status> DisplayEventReceiver::requestNextVsync() {
         return Status::BAD_VALUE;
     }
 
-    bool success = OK == mAttached->receiver().requestNextVsync();
+    bool success = OK == mAttached->requestNextVsync();
     return success ? Status::SUCCESS : Status::UNKNOWN;
 }
 
@@ -18,11 +18,10 @@
 #define ANDROID_FRAMEWORKS_DISPLAYSERVICE_V1_0_DISPLAYEVENTRECEIVER_H
 
 #include <android/frameworks/displayservice/1.0/IDisplayEventReceiver.h>
-#include <gui/DisplayEventReceiver.h>
 #include <hidl/Status.h>
-#include <gui/DisplayEventReceiver.h>
-#include <utils/Looper.h>
+#include <utils/Errors.h>
 
+#include <memory>
 #include <mutex>
 
 namespace android {
@@ -42,24 +41,22 @@ public:
     Return<Status> close() override;
 
 private:
-    using FwkReceiver = ::android::DisplayEventReceiver;
-
-    struct AttachedEvent : LooperCallback {
+    // Subscription of this receiver to the display events of the single
+    // SurfaceFlinger connection that all receivers in the process share.
+    struct AttachedEvent {
         AttachedEvent(const sp<IEventCallback> &callback);
         ~AttachedEvent();
 
         bool detach();
         bool valid() const;
-        FwkReceiver &receiver();
-        virtual int handleEvent(int fd, int events, void* /* data */) override;
+        status_t setVsyncRate(int32_t count);
+        status_t requestNextVsync();
 
     private:
-        FwkReceiver mFwkReceiver;
-        sp<IEventCallback> mCallback;
-        bool mLooperAttached;
+        bool mAttached;
     };
 
-    sp<AttachedEvent> mAttached;
+    std::unique_ptr<AttachedEvent> mAttached;
     std::mutex mMutex;
 };
 
@@ -19,6 +19,7 @@ LOCAL_SRC_FILES:= \
     EventHub.cpp \
     InputApplication.cpp \
     InputDispatcher.cpp \
+    InputLatencyStats.cpp \
     InputListener.cpp \
     InputManager.cpp \
     InputReader.cpp \
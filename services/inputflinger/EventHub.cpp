@@ -174,6 +174,26 @@ void EventHub::Device::close() {
 }
 
 
+// --- EventHub::CachedDevice ---
+
+EventHub::CachedDevice::CachedDevice() :
+        driverVersion(0), configuration(NULL), keyMapLoaded(false),
+        keyMapStatus(NAME_NOT_FOUND), lastUsed(0) {
+    memset(evBitmask, 0, sizeof(evBitmask));
+    memset(keyBitmask, 0, sizeof(keyBitmask));
+    memset(absBitmask, 0, sizeof(absBitmask));
+    memset(relBitmask, 0, sizeof(relBitmask));
+    memset(swBitmask, 0, sizeof(swBitmask));
+    memset(ledBitmask, 0, sizeof(ledBitmask));
+    memset(ffBitmask, 0, sizeof(ffBitmask));
+    memset(propBitmask, 0, sizeof(propBitmask));
+}
+
+EventHub::CachedDevice::~CachedDevice() {
+    delete configuration;
+}
+
+
 // --- EventHub ---
 
 const uint32_t EventHub::EPOLL_ID_INOTIFY;
@@ -184,10 +204,19 @@ const int EventHub::EPOLL_MAX_EVENTS;
 EventHub::EventHub(void) :
         mBuiltInKeyboardId(NO_BUILT_IN_KEYBOARD), mNextDeviceId(1), mControllerNumbers(),
         mOpeningDevices(0), mClosingDevices(0),
+        mDeviceCacheClock(0), mDeviceCacheHits(0), mDeviceCacheMisses(0),
         mNeedToSendFinishedDeviceScan(false),
         mNeedToReopenDevices(false), mNeedToScanDevices(true),
         mPendingEventCount(0), mPendingEventIndex(0), mPendingINotify(false) {
-    acquire_wake_lock(PARTIAL_WAKE_LOCK, WAKE_LOCK_ID);
+    int major, minor;
+    getLinuxRelease(&major, &minor);
+    // EPOLLWAKEUP was introduced in kernel 3.5
+    mUsingEpollWakeup = major > 3 || (major == 3 && minor >= 5);
+    memset(&mIngestStats, 0, sizeof(mIngestStats));
+
+    if (!mUsingEpollWakeup) {
+        acquire_wake_lock(PARTIAL_WAKE_LOCK, WAKE_LOCK_ID);
+    }
 
     mEpollFd = epoll_create(EPOLL_SIZE_HINT);
     LOG_ALWAYS_FATAL_IF(mEpollFd < 0, "Could not create epoll instance.  errno=%d", errno);
@@ -200,6 +229,9 @@ EventHub::EventHub(void) :
     struct epoll_event eventItem;
     memset(&eventItem, 0, sizeof(eventItem));
     eventItem.events = EPOLLIN;
+    if (mUsingEpollWakeup) {
+        eventItem.events |= EPOLLWAKEUP;
+    }
     eventItem.data.u32 = EPOLL_ID_INOTIFY;
     result = epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mINotifyFd, &eventItem);
     LOG_ALWAYS_FATAL_IF(result != 0, "Could not add INotify to epoll instance.  errno=%d", errno);
@@ -223,11 +255,6 @@ EventHub::EventHub(void) :
     result = epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mWakeReadPipeFd, &eventItem);
     LOG_ALWAYS_FATAL_IF(result != 0, "Could not add wake read pipe to epoll instance.  errno=%d",
             errno);
-
-    int major, minor;
-    getLinuxRelease(&major, &minor);
-    // EPOLLWAKEUP was introduced in kernel 3.5
-    mUsingEpollWakeup = major > 3 || (major == 3 && minor >= 5);
 }
 
 EventHub::~EventHub(void) {
@@ -239,12 +266,16 @@ EventHub::~EventHub(void) {
         delete device;
     }
 
+    clearDeviceCacheLocked();
+
     ::close(mEpollFd);
     ::close(mINotifyFd);
     ::close(mWakeReadPipeFd);
     ::close(mWakeWritePipeFd);
 
-    release_wake_lock(WAKE_LOCK_ID);
+    if (!mUsingEpollWakeup) {
+        release_wake_lock(WAKE_LOCK_ID);
+    }
 }
 
 InputDeviceIdentifier EventHub::getDeviceIdentifier(int32_t deviceId) const {
@@ -738,6 +769,8 @@ size_t EventHub::getEvents(int timeoutMillis, RawEvent* buffer, size_t bufferSiz
             ALOGI("Reopening all input devices due to a configuration change.");
 
             closeAllDevicesLocked();
+            // The configuration files may be what changed.
+            clearDeviceCacheLocked();
             mNeedToScanDevices = true;
             break; // return to the caller before we actually rescan
         }
@@ -811,6 +844,7 @@ size_t EventHub::getEvents(int timeoutMillis, RawEvent* buffer, size_t bufferSiz
                     ssize_t nRead;
                     do {
                         nRead = read(mWakeReadPipeFd, buffer, sizeof(buffer));
+                        mIngestStats.reads += 1;
                     } while ((nRead == -1 && errno == EINTR) || nRead == sizeof(buffer));
                 } else {
                     ALOGW("Received unexpected epoll event 0x%08x for wake read pipe.",
@@ -830,6 +864,7 @@ size_t EventHub::getEvents(int timeoutMillis, RawEvent* buffer, size_t bufferSiz
             if (eventItem.events & EPOLLIN) {
                 int32_t readSize = read(device->fd, readBuffer,
                         sizeof(struct input_event) * capacity);
+                mIngestStats.reads += 1;
                 if (readSize == 0 || (readSize < 0 && errno == ENODEV)) {
                     // Device was removed before INotify noticed.
                     ALOGW("could not get event, removed? (fd: %d size: %" PRId32
@@ -982,18 +1017,31 @@ size_t EventHub::getEvents(int timeoutMillis, RawEvent* buffer, size_t bufferSiz
         // is processing events.  Thus the system can only sleep if there are no events
         // pending or currently being processed.
         //
+        // With EPOLLWAKEUP the epoll instance does the same by itself: the wakeup source of
+        // a ready fd stays active until the next epoll_wait(), so we skip the two wake lock
+        // writes per wakeup.
+        //
         // The timeout is advisory only.  If the device is asleep, it will not wake just to
         // service the timeout.
         mPendingEventIndex = 0;
 
         mLock.unlock(); // release lock before poll, must be before release_wake_lock
-        release_wake_lock(WAKE_LOCK_ID);
+        if (!mUsingEpollWakeup) {
+            release_wake_lock(WAKE_LOCK_ID);
+        }
 
         int pollResult = epoll_wait(mEpollFd, mPendingEventItems, EPOLL_MAX_EVENTS, timeoutMillis);
 
-        acquire_wake_lock(PARTIAL_WAKE_LOCK, WAKE_LOCK_ID);
+        if (!mUsingEpollWakeup) {
+            acquire_wake_lock(PARTIAL_WAKE_LOCK, WAKE_LOCK_ID);
+        }
         mLock.lock(); // reacquire lock after poll, must be after acquire_wake_lock
 
+        mIngestStats.epollWaits += 1;
+        if (!mUsingEpollWakeup) {
+            mIngestStats.wakeLockCalls += 2;
+        }
+
         if (pollResult == 0) {
             // Timed out.
             mPendingEventCount = 0;
@@ -1017,7 +1065,15 @@ size_t EventHub::getEvents(int timeoutMillis, RawEvent* buffer, size_t bufferSiz
     }
 
     // All done, return the number of events we read.
-    return event - buffer;
+    size_t count = event - buffer;
+    if (count) {
+        mIngestStats.batches += 1;
+        mIngestStats.events += count;
+        if (count > mIngestStats.maxBatchEvents) {
+            mIngestStats.maxBatchEvents = count;
+        }
+    }
+    return count;
 }
 
 void EventHub::wake() {
@@ -1135,6 +1191,13 @@ status_t EventHub::openDeviceLocked(const char *devicePath) {
     // Fill in the descriptor.
     assignDescriptorLocked(identifier);
 
+    // Get the event types the device reports. This is part of the identity the cached
+    // capabilities are checked against, so that a driver reporting different events under the
+    // same name (e.g. a uinput device created again) is probed from scratch.
+    uint8_t evBitmask[(EV_MAX + 1) / 8];
+    memset(evBitmask, 0, sizeof(evBitmask));
+    ioctl(fd, EVIOCGBIT(0, sizeof(evBitmask)), evBitmask);
+
     // Make file descriptor non-blocking for use with poll().
     if (fcntl(fd, F_SETFL, O_NONBLOCK)) {
         ALOGE("Error %d making device file descriptor non-blocking.", errno);
@@ -1159,17 +1222,35 @@ status_t EventHub::openDeviceLocked(const char *devicePath) {
     ALOGV("  driver:     v%d.%d.%d\n",
         driverVersion >> 16, (driverVersion >> 8) & 0xff, driverVersion & 0xff);
 
-    // Load the configuration file for the device.
-    loadConfigurationLocked(device);
+    const CachedDevice* cached = getCachedDeviceLocked(identifier, driverVersion, evBitmask);
+    if (cached) {
+        ALOGV("  using the capabilities and configuration cached for this descriptor");
 
-    // Figure out the kinds of events the device reports.
-    ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(device->keyBitmask)), device->keyBitmask);
-    ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(device->absBitmask)), device->absBitmask);
-    ioctl(fd, EVIOCGBIT(EV_REL, sizeof(device->relBitmask)), device->relBitmask);
-    ioctl(fd, EVIOCGBIT(EV_SW, sizeof(device->swBitmask)), device->swBitmask);
-    ioctl(fd, EVIOCGBIT(EV_LED, sizeof(device->ledBitmask)), device->ledBitmask);
-    ioctl(fd, EVIOCGBIT(EV_FF, sizeof(device->ffBitmask)), device->ffBitmask);
-    ioctl(fd, EVIOCGPROP(sizeof(device->propBitmask)), device->propBitmask);
+        device->configurationFile = cached->configurationFile;
+        if (cached->configuration) {
+            device->configuration = new PropertyMap(*cached->configuration);
+        }
+
+        memcpy(device->keyBitmask, cached->keyBitmask, sizeof(device->keyBitmask));
+        memcpy(device->absBitmask, cached->absBitmask, sizeof(device->absBitmask));
+        memcpy(device->relBitmask, cached->relBitmask, sizeof(device->relBitmask));
+        memcpy(device->swBitmask, cached->swBitmask, sizeof(device->swBitmask));
+        memcpy(device->ledBitmask, cached->ledBitmask, sizeof(device->ledBitmask));
+        memcpy(device->ffBitmask, cached->ffBitmask, sizeof(device->ffBitmask));
+        memcpy(device->propBitmask, cached->propBitmask, sizeof(device->propBitmask));
+    } else {
+        // Load the configuration file for the device.
+        loadConfigurationLocked(device);
+
+        // Figure out the kinds of events the device reports.
+        ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(device->keyBitmask)), device->keyBitmask);
+        ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(device->absBitmask)), device->absBitmask);
+        ioctl(fd, EVIOCGBIT(EV_REL, sizeof(device->relBitmask)), device->relBitmask);
+        ioctl(fd, EVIOCGBIT(EV_SW, sizeof(device->swBitmask)), device->swBitmask);
+        ioctl(fd, EVIOCGBIT(EV_LED, sizeof(device->ledBitmask)), device->ledBitmask);
+        ioctl(fd, EVIOCGBIT(EV_FF, sizeof(device->ffBitmask)), device->ffBitmask);
+        ioctl(fd, EVIOCGPROP(sizeof(device->propBitmask)), device->propBitmask);
+    }
 
     // See if this is a keyboard.  Ignore everything in the button range except for
     // joystick and gamepad buttons which are handled like keyboards for the most part.
@@ -1267,9 +1348,20 @@ status_t EventHub::openDeviceLocked(const char *devicePath) {
     // Load the key map.
     // We need to do this for joysticks too because the key layout may specify axes.
     status_t keyMapStatus = NAME_NOT_FOUND;
+    bool keyMapLoaded = false;
     if (device->classes & (INPUT_DEVICE_CLASS_KEYBOARD | INPUT_DEVICE_CLASS_JOYSTICK)) {
-        // Load the keymap for the device.
-        keyMapStatus = loadKeyMapLocked(device);
+        if (cached && cached->keyMapLoaded) {
+            device->keyMap = cached->keyMap;
+            keyMapStatus = cached->keyMapStatus;
+        } else {
+            // Load the keymap for the device.
+            keyMapStatus = loadKeyMapLocked(device);
+        }
+        keyMapLoaded = true;
+    }
+
+    if (!cached) {
+        cacheDeviceLocked(device, driverVersion, evBitmask, keyMapLoaded, keyMapStatus);
     }
 
     // Configure the keyboard, gamepad or virtual keyboard.
@@ -1597,6 +1689,86 @@ void EventHub::closeDeviceLocked(Device* device) {
     }
 }
 
+EventHub::CachedDevice* EventHub::getCachedDeviceLocked(const InputDeviceIdentifier& identifier,
+        int driverVersion, const uint8_t* evBitmask) {
+    ssize_t index = mDeviceCache.indexOfKey(identifier.descriptor);
+    if (index < 0) {
+        mDeviceCacheMisses++;
+        return NULL;
+    }
+
+    CachedDevice* cached = mDeviceCache.valueAt(index);
+    if (cached->driverVersion != driverVersion
+            || cached->identifier.bus != identifier.bus
+            || cached->identifier.vendor != identifier.vendor
+            || cached->identifier.product != identifier.product
+            || cached->identifier.version != identifier.version
+            || cached->identifier.name != identifier.name
+            || cached->identifier.location != identifier.location
+            || cached->identifier.uniqueId != identifier.uniqueId
+            || memcmp(cached->evBitmask, evBitmask, sizeof(cached->evBitmask))) {
+        ALOGV("Dropping the cached device '%s', its identity changed.",
+                identifier.descriptor.string());
+        delete cached;
+        mDeviceCache.removeItemsAt(index);
+        mDeviceCacheMisses++;
+        return NULL;
+    }
+
+    cached->lastUsed = ++mDeviceCacheClock;
+    mDeviceCacheHits++;
+    return cached;
+}
+
+void EventHub::cacheDeviceLocked(const Device* device, int driverVersion,
+        const uint8_t* evBitmask, bool keyMapLoaded, status_t keyMapStatus) {
+    if (mDeviceCache.size() >= MAX_CACHED_DEVICES) {
+        size_t oldest = 0;
+        for (size_t i = 1; i < mDeviceCache.size(); i++) {
+            if (mDeviceCache.valueAt(i)->lastUsed < mDeviceCache.valueAt(oldest)->lastUsed) {
+                oldest = i;
+            }
+        }
+        delete mDeviceCache.valueAt(oldest);
+        mDeviceCache.removeItemsAt(oldest);
+    }
+
+    CachedDevice* cached = new CachedDevice();
+    cached->identifier = device->identifier;
+    cached->driverVersion = driverVersion;
+    memcpy(cached->evBitmask, evBitmask, sizeof(cached->evBitmask));
+
+    memcpy(cached->keyBitmask, device->keyBitmask, sizeof(cached->keyBitmask));
+    memcpy(cached->absBitmask, device->absBitmask, sizeof(cached->absBitmask));
+    memcpy(cached->relBitmask, device->relBitmask, sizeof(cached->relBitmask));
+    memcpy(cached->swBitmask, device->swBitmask, sizeof(cached->swBitmask));
+    memcpy(cached->ledBitmask, device->ledBitmask, sizeof(cached->ledBitmask));
+    memcpy(cached->ffBitmask, device->ffBitmask, sizeof(cached->ffBitmask));
+    memcpy(cached->propBitmask, device->propBitmask, sizeof(cached->propBitmask));
+
+    cached->configurationFile = device->configurationFile;
+    if (device->configuration) {
+        cached->configuration = new PropertyMap(*device->configuration);
+    }
+
+    cached->keyMapLoaded = keyMapLoaded;
+    cached->keyMapStatus = keyMapStatus;
+    if (keyMapLoaded) {
+        cached->keyMap = device->keyMap;
+    }
+    cached->lastUsed = ++mDeviceCacheClock;
+
+    // A stale entry for this descriptor was already removed by getCachedDeviceLocked().
+    mDeviceCache.add(device->identifier.descriptor, cached);
+}
+
+void EventHub::clearDeviceCacheLocked() {
+    for (size_t i = 0; i < mDeviceCache.size(); i++) {
+        delete mDeviceCache.valueAt(i);
+    }
+    mDeviceCache.clear();
+}
+
 status_t EventHub::readNotifyLocked() {
     int res;
     char devname[PATH_MAX];
@@ -1678,6 +1850,18 @@ void EventHub::dump(String8& dump) {
 
         dump.appendFormat(INDENT "BuiltInKeyboardId: %d\n", mBuiltInKeyboardId);
 
+        const IngestStats& stats = mIngestStats;
+        const double batches = stats.batches ? double(stats.batches) : 1.0;
+        dump.appendFormat(INDENT "Ingest: batches=%" PRIu64 ", events/batch=%0.1f (max %" PRIu64
+                "), syscalls/batch=%0.2f (epoll_wait=%" PRIu64 ", read=%" PRIu64
+                ", wake lock=%" PRIu64 "), wake mechanism=%s\n",
+                stats.batches, stats.events / batches, stats.maxBatchEvents,
+                (stats.epollWaits + stats.reads + stats.wakeLockCalls) / batches,
+                stats.epollWaits, stats.reads, stats.wakeLockCalls,
+                mUsingEpollWakeup ? "EPOLLWAKEUP" : "wake lock");
+        dump.appendFormat(INDENT "DeviceCache: entries=%zu, hits=%u, misses=%u\n",
+                mDeviceCache.size(), mDeviceCacheHits, mDeviceCacheMisses);
+
         dump.append(INDENT "Devices:\n");
 
         for (size_t i = 0; i < mDevices.size(); i++) {
@@ -381,6 +381,39 @@ private:
         }
     };
 
+    // What openDeviceLocked() learned about a device the last time it was opened: its
+    // capabilities and its configuration and key map files. Reopening the same device (after
+    // resume, a bluetooth reconnection or a driver reload) uses this instead of querying every
+    // event type again and reparsing the files.
+    struct CachedDevice {
+        // Identity of the device the entry was made for. An entry is only used if the device
+        // being opened reports exactly the same identity.
+        InputDeviceIdentifier identifier;
+        int driverVersion;
+        uint8_t evBitmask[(EV_MAX + 1) / 8];
+
+        uint8_t keyBitmask[(KEY_MAX + 1) / 8];
+        uint8_t absBitmask[(ABS_MAX + 1) / 8];
+        uint8_t relBitmask[(REL_MAX + 1) / 8];
+        uint8_t swBitmask[(SW_MAX + 1) / 8];
+        uint8_t ledBitmask[(LED_MAX + 1) / 8];
+        uint8_t ffBitmask[(FF_MAX + 1) / 8];
+        uint8_t propBitmask[(INPUT_PROP_MAX + 1) / 8];
+
+        String8 configurationFile;
+        PropertyMap* configuration;
+
+        // The key map is only loaded for some classes of devices.
+        bool keyMapLoaded;
+        status_t keyMapStatus;
+        KeyMap keyMap;
+
+        uint32_t lastUsed;
+
+        CachedDevice();
+        ~CachedDevice();
+    };
+
     status_t openDeviceLocked(const char *devicePath);
     void createVirtualKeyboardLocked();
     void addDeviceLocked(Device* device);
@@ -390,6 +423,12 @@ private:
     void closeDeviceLocked(Device* device);
     void closeAllDevicesLocked();
 
+    CachedDevice* getCachedDeviceLocked(const InputDeviceIdentifier& identifier,
+            int driverVersion, const uint8_t* evBitmask);
+    void cacheDeviceLocked(const Device* device, int driverVersion, const uint8_t* evBitmask,
+            bool keyMapLoaded, status_t keyMapStatus);
+    void clearDeviceCacheLocked();
+
     status_t scanDirLocked(const char *dirname);
     void scanDevicesLocked();
     status_t readNotifyLocked();
@@ -435,6 +474,13 @@ private:
     Device *mOpeningDevices;
     Device *mClosingDevices;
 
+    // Keyed by descriptor. Bounded, the least recently used entry is evicted first.
+    static const size_t MAX_CACHED_DEVICES = 32;
+    KeyedVector<String8, CachedDevice*> mDeviceCache;
+    uint32_t mDeviceCacheClock;
+    uint32_t mDeviceCacheHits;
+    uint32_t mDeviceCacheMisses;
+
     bool mNeedToSendFinishedDeviceScan;
     bool mNeedToReopenDevices;
     bool mNeedToScanDevices;
@@ -461,7 +507,22 @@ private:
     size_t mPendingEventIndex;
     bool mPendingINotify;
 
+    // With EPOLLWAKEUP, the kernel keeps the system awake from the time a device
+    // has events until the next epoll_wait, so getEvents doesn't need to hold a
+    // wake lock of its own.
     bool mUsingEpollWakeup;
+
+    // Ingest counters for dump(), to see what each batch returned by getEvents
+    // costs the reader thread in system calls.
+    struct IngestStats {
+        uint64_t batches;
+        uint64_t events;
+        uint64_t maxBatchEvents;
+        uint64_t epollWaits;
+        uint64_t reads;
+        uint64_t wakeLockCalls;
+    };
+    IngestStats mIngestStats;
 };
 
 }; // namespace android
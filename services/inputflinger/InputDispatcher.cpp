@@ -46,11 +46,14 @@
 #include "InputDispatcher.h"
 
 #include <errno.h>
+#include <inttypes.h>
 #include <limits.h>
 #include <stddef.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
+
 #include <log/log.h>
 #include <utils/Trace.h>
 #include <powermanager/PowerManager.h>
@@ -88,6 +91,13 @@ const nsecs_t SLOW_EVENT_PROCESSING_WARNING_TIMEOUT = 2000 * 1000000LL; // 2sec
 // Number of recent events to keep for debugging purposes.
 const size_t RECENT_QUEUE_MAX_SIZE = 10;
 
+// Number of freed entries of each type whose memory is kept for reuse. Covers the events
+// in flight for a few windows while a multi-touch gesture streams; a motion entry takes
+// a little over 2 KB.
+const size_t KEY_ENTRY_POOL_SIZE = 16;
+const size_t MOTION_ENTRY_POOL_SIZE = 32;
+const size_t DISPATCH_ENTRY_POOL_SIZE = 64;
+
 static inline nsecs_t now() {
     return systemTime(SYSTEM_TIME_MONOTONIC);
 }
@@ -201,7 +211,12 @@ static void dumpRegion(String8& dump, const Region& region) {
 
 InputDispatcher::InputDispatcher(const sp<InputDispatcherPolicyInterface>& policy) :
     mPolicy(policy),
-    mPendingEvent(NULL), mLastDropReason(DROP_REASON_NOT_DROPPED),
+    mPendingEvent(NULL),
+    mReadLatency("read", "input_read_us"),
+    mDispatchLatency("dispatch", "input_dispatch_us"),
+    mFinishLatency("finish", "input_finish_us"),
+    mTotalLatency("total", "input_total_us"),
+    mLastDropReason(DROP_REASON_NOT_DROPPED),
     mAppSwitchSawKeyDown(false), mAppSwitchDueTime(LONG_LONG_MAX),
     mNextUnblockedEvent(NULL),
     mDispatchEnabled(false), mDispatchFrozen(false), mInputFilterEnabled(false),
@@ -410,6 +425,11 @@ bool InputDispatcher::enqueueInboundEventLocked(EventEntry* entry) {
     mInboundQueue.enqueueAtTail(entry);
     traceInboundQueueLengthLocked();
 
+    entry->enqueueTime = now();
+    if (entry->isFromDevice()) {
+        mReadLatency.record(entry->enqueueTime - entry->eventTime);
+    }
+
     switch (entry->type) {
     case EventEntry::TYPE_KEY: {
         // Optimize app switch latency.
@@ -475,10 +495,14 @@ void InputDispatcher::addRecentEventLocked(EventEntry* entry) {
 
 sp<InputWindowHandle> InputDispatcher::findTouchedWindowAtLocked(int32_t displayId,
         int32_t x, int32_t y) {
+    const Vector<size_t>* candidates = getTouchCandidatesLocked(displayId, x, y);
+    if (candidates == NULL) {
+        return NULL;
+    }
     // Traverse windows from front to back to find touched window.
-    size_t numWindows = mWindowHandles.size();
-    for (size_t i = 0; i < numWindows; i++) {
-        sp<InputWindowHandle> windowHandle = mWindowHandles.itemAt(i);
+    size_t numCandidates = candidates->size();
+    for (size_t i = 0; i < numCandidates; i++) {
+        sp<InputWindowHandle> windowHandle = mWindowHandles.itemAt(candidates->itemAt(i));
         const InputWindowInfo* windowInfo = windowHandle->getInfo();
         if (windowInfo->displayId == displayId) {
             int32_t flags = windowInfo->layoutParamsFlags;
@@ -949,11 +973,12 @@ int32_t InputDispatcher::handleTargetsNotReadyLocked(nsecs_t currentTime,
         const EventEntry* entry,
         const sp<InputApplicationHandle>& applicationHandle,
         const sp<InputWindowHandle>& windowHandle,
-        nsecs_t* nextWakeupTime, const char* reason) {
+        nsecs_t* nextWakeupTime, const TargetWaitReason& reason) {
     if (applicationHandle == NULL && windowHandle == NULL) {
         if (mInputTargetWaitCause != INPUT_TARGET_WAIT_CAUSE_SYSTEM_NOT_READY) {
 #if DEBUG_FOCUS
-            ALOGD("Waiting for system to become ready for input.  Reason: %s", reason);
+            ALOGD("Waiting for system to become ready for input.  Reason: %s",
+                    getTargetWaitReasonLocked(currentTime, windowHandle, reason).string());
 #endif
             mInputTargetWaitCause = INPUT_TARGET_WAIT_CAUSE_SYSTEM_NOT_READY;
             mInputTargetWaitStartTime = currentTime;
@@ -966,7 +991,7 @@ int32_t InputDispatcher::handleTargetsNotReadyLocked(nsecs_t currentTime,
 #if DEBUG_FOCUS
             ALOGD("Waiting for application to become ready for input: %s.  Reason: %s",
                     getApplicationWindowLabelLocked(applicationHandle, windowHandle).string(),
-                    reason);
+                    getTargetWaitReasonLocked(currentTime, windowHandle, reason).string());
 #endif
             nsecs_t timeout;
             if (windowHandle != NULL) {
@@ -998,8 +1023,16 @@ int32_t InputDispatcher::handleTargetsNotReadyLocked(nsecs_t currentTime,
     }
 
     if (currentTime >= mInputTargetWaitTimeoutTime) {
+        if (windowHandle != NULL) {
+            ssize_t connectionIndex = getConnectionIndexLocked(windowHandle->getInputChannel());
+            if (connectionIndex >= 0) {
+                mConnectionsByFd.valueAt(connectionIndex)->counters.timeoutCount.fetch_add(1,
+                        std::memory_order_relaxed);
+            }
+        }
         onANRLocked(currentTime, applicationHandle, windowHandle,
-                entry->eventTime, mInputTargetWaitStartTime, reason);
+                entry->eventTime, mInputTargetWaitStartTime,
+                getTargetWaitReasonLocked(currentTime, windowHandle, reason).string());
 
         // Force poll loop to wake up immediately on next iteration once we get the
         // ANR response back from the policy.
@@ -1072,7 +1105,7 @@ void InputDispatcher::resetANRTimeoutsLocked() {
 int32_t InputDispatcher::findFocusedWindowTargetsLocked(nsecs_t currentTime,
         const EventEntry* entry, Vector<InputTarget>& inputTargets, nsecs_t* nextWakeupTime) {
     int32_t injectionResult;
-    String8 reason;
+    WindowReadiness readiness;
 
     // If there is no currently focused window and no focused application
     // then drop the event.
@@ -1080,9 +1113,9 @@ int32_t InputDispatcher::findFocusedWindowTargetsLocked(nsecs_t currentTime,
         if (mFocusedApplicationHandle != NULL) {
             injectionResult = handleTargetsNotReadyLocked(currentTime, entry,
                     mFocusedApplicationHandle, NULL, nextWakeupTime,
-                    "Waiting because no window has focus but there is a "
-                    "focused application that may eventually add a window "
-                    "when it finishes starting up.");
+                    TargetWaitReason("Waiting because no window has focus but there is a "
+                            "focused application that may eventually add a window "
+                            "when it finishes starting up."));
             goto Unresponsive;
         }
 
@@ -1098,11 +1131,11 @@ int32_t InputDispatcher::findFocusedWindowTargetsLocked(nsecs_t currentTime,
     }
 
     // Check whether the window is ready for more input.
-    reason = checkWindowReadyForMoreInputLocked(currentTime,
-            mFocusedWindowHandle, entry, "focused");
-    if (!reason.isEmpty()) {
+    readiness = checkWindowReadyForMoreInputLocked(currentTime, mFocusedWindowHandle, entry);
+    if (readiness != WINDOW_READY) {
         injectionResult = handleTargetsNotReadyLocked(currentTime, entry,
-                mFocusedApplicationHandle, mFocusedWindowHandle, nextWakeupTime, reason.string());
+                mFocusedApplicationHandle, mFocusedWindowHandle, nextWakeupTime,
+                TargetWaitReason(readiness, "focused"));
         goto Unresponsive;
     }
 
@@ -1211,9 +1244,10 @@ int32_t InputDispatcher::findTouchedWindowTargetsLocked(nsecs_t currentTime,
         bool isTouchModal = false;
 
         // Traverse windows from front to back to find touched window and outside targets.
-        size_t numWindows = mWindowHandles.size();
-        for (size_t i = 0; i < numWindows; i++) {
-            sp<InputWindowHandle> windowHandle = mWindowHandles.itemAt(i);
+        const Vector<size_t>* candidates = getTouchCandidatesLocked(displayId, x, y);
+        size_t numCandidates = candidates != NULL ? candidates->size() : 0;
+        for (size_t i = 0; i < numCandidates; i++) {
+            sp<InputWindowHandle> windowHandle = mWindowHandles.itemAt(candidates->itemAt(i));
             const InputWindowInfo* windowInfo = windowHandle->getInfo();
             if (windowInfo->displayId != displayId) {
                 continue; // wrong display
@@ -1416,11 +1450,12 @@ int32_t InputDispatcher::findTouchedWindowTargetsLocked(nsecs_t currentTime,
         const TouchedWindow& touchedWindow = mTempTouchState.windows[i];
         if (touchedWindow.targetFlags & InputTarget::FLAG_FOREGROUND) {
             // Check whether the window is ready for more input.
-            String8 reason = checkWindowReadyForMoreInputLocked(currentTime,
-                    touchedWindow.windowHandle, entry, "touched");
-            if (!reason.isEmpty()) {
+            WindowReadiness readiness = checkWindowReadyForMoreInputLocked(currentTime,
+                    touchedWindow.windowHandle, entry);
+            if (readiness != WINDOW_READY) {
                 injectionResult = handleTargetsNotReadyLocked(currentTime, entry,
-                        NULL, touchedWindow.windowHandle, nextWakeupTime, reason.string());
+                        NULL, touchedWindow.windowHandle, nextWakeupTime,
+                        TargetWaitReason(readiness, "touched"));
                 goto Unresponsive;
             }
         }
@@ -1622,12 +1657,23 @@ bool InputDispatcher::checkInjectionPermission(const sp<InputWindowHandle>& wind
 bool InputDispatcher::isWindowObscuredAtPointLocked(
         const sp<InputWindowHandle>& windowHandle, int32_t x, int32_t y) const {
     int32_t displayId = windowHandle->getInfo()->displayId;
-    size_t numWindows = mWindowHandles.size();
-    for (size_t i = 0; i < numWindows; i++) {
-        sp<InputWindowHandle> otherHandle = mWindowHandles.itemAt(i);
-        if (otherHandle == windowHandle) {
-            break;
-        }
+    ssize_t gridIndex = mWindowGrids.indexOfKey(displayId);
+    if (gridIndex < 0) {
+        return false;
+    }
+    const WindowGrid& grid = mWindowGrids.valueAt(gridIndex);
+    ssize_t cell = grid.cellAt(x, y);
+    if (cell < 0) {
+        return false; // no frame reaches there
+    }
+
+    // Only the windows in front of this one count.
+    ssize_t windowIndex = mWindowIndices.indexOfKey(windowHandle.get());
+    size_t end = windowIndex >= 0 ? mWindowIndices.valueAt(windowIndex) : mWindowHandles.size();
+    const Vector<size_t>& occluders = grid.occluders.itemAt(cell);
+    size_t numOccluders = occluders.size();
+    for (size_t i = 0; i < numOccluders && occluders.itemAt(i) < end; i++) {
+        sp<InputWindowHandle> otherHandle = mWindowHandles.itemAt(occluders.itemAt(i));
 
         const InputWindowInfo* otherInfo = otherHandle->getInfo();
         if (otherInfo->displayId == displayId
@@ -1660,35 +1706,29 @@ bool InputDispatcher::isWindowObscuredLocked(const sp<InputWindowHandle>& window
     return false;
 }
 
-String8 InputDispatcher::checkWindowReadyForMoreInputLocked(nsecs_t currentTime,
-        const sp<InputWindowHandle>& windowHandle, const EventEntry* eventEntry,
-        const char* targetType) {
+InputDispatcher::WindowReadiness InputDispatcher::checkWindowReadyForMoreInputLocked(
+        nsecs_t currentTime, const sp<InputWindowHandle>& windowHandle,
+        const EventEntry* eventEntry) {
     // If the window is paused then keep waiting.
     if (windowHandle->getInfo()->paused) {
-        return String8::format("Waiting because the %s window is paused.", targetType);
+        return WINDOW_PAUSED;
     }
 
     // If the window's connection is not registered then keep waiting.
     ssize_t connectionIndex = getConnectionIndexLocked(windowHandle->getInputChannel());
     if (connectionIndex < 0) {
-        return String8::format("Waiting because the %s window's input channel is not "
-                "registered with the input dispatcher.  The window may be in the process "
-                "of being removed.", targetType);
+        return WINDOW_NOT_REGISTERED;
     }
 
     // If the connection is dead then keep waiting.
     sp<Connection> connection = mConnectionsByFd.valueAt(connectionIndex);
     if (connection->status != Connection::STATUS_NORMAL) {
-        return String8::format("Waiting because the %s window's input connection is %s."
-                "The window may be in the process of being removed.", targetType,
-                connection->getStatusLabel());
+        return WINDOW_CONNECTION_NOT_NORMAL;
     }
 
     // If the connection is backed up then keep waiting.
     if (connection->inputPublisherBlocked) {
-        return String8::format("Waiting because the %s window's input channel is full.  "
-                "Outbound queue length: %d.  Wait queue length: %d.",
-                targetType, connection->outboundQueue.count(), connection->waitQueue.count());
+        return WINDOW_INPUT_CHANNEL_FULL;
     }
 
     // Ensure that the dispatch queues aren't too far backed up for this event.
@@ -1705,10 +1745,7 @@ String8 InputDispatcher::checkWindowReadyForMoreInputLocked(nsecs_t currentTime,
         // To obtain this behavior, we must serialize key events with respect to all
         // prior input events.
         if (!connection->outboundQueue.isEmpty() || !connection->waitQueue.isEmpty()) {
-            return String8::format("Waiting to send key event because the %s window has not "
-                    "finished processing all of the input events that were previously "
-                    "delivered to it.  Outbound queue length: %d.  Wait queue length: %d.",
-                    targetType, connection->outboundQueue.count(), connection->waitQueue.count());
+            return WINDOW_KEY_WAITING_FOR_PREVIOUS_EVENTS;
         }
     } else {
         // Touch events can always be sent to a window immediately because the user intended
@@ -1729,15 +1766,63 @@ String8 InputDispatcher::checkWindowReadyForMoreInputLocked(nsecs_t currentTime,
         if (!connection->waitQueue.isEmpty()
                 && currentTime >= connection->waitQueue.head->deliveryTime
                         + STREAM_AHEAD_EVENT_TIMEOUT) {
-            return String8::format("Waiting to send non-key event because the %s window has not "
-                    "finished processing certain input events that were delivered to it over "
-                    "%0.1fms ago.  Wait queue length: %d.  Wait queue head age: %0.1fms.",
-                    targetType, STREAM_AHEAD_EVENT_TIMEOUT * 0.000001f,
-                    connection->waitQueue.count(),
-                    (currentTime - connection->waitQueue.head->deliveryTime) * 0.000001f);
+            return WINDOW_WAIT_QUEUE_STALLED;
         }
     }
-    return String8::empty();
+    return WINDOW_READY;
+}
+
+String8 InputDispatcher::getTargetWaitReasonLocked(nsecs_t currentTime,
+        const sp<InputWindowHandle>& windowHandle, const TargetWaitReason& reason) {
+    if (reason.message) {
+        return String8(reason.message);
+    }
+
+    const char* targetType = reason.targetType;
+    sp<Connection> connection;
+    if (windowHandle != NULL) {
+        ssize_t connectionIndex = getConnectionIndexLocked(windowHandle->getInputChannel());
+        if (connectionIndex >= 0) {
+            connection = mConnectionsByFd.valueAt(connectionIndex);
+        }
+    }
+    switch (reason.windowReadiness) {
+    case WINDOW_PAUSED:
+        return String8::format("Waiting because the %s window is paused.", targetType);
+    case WINDOW_NOT_REGISTERED:
+        return String8::format("Waiting because the %s window's input channel is not "
+                "registered with the input dispatcher.  The window may be in the process "
+                "of being removed.", targetType);
+    default:
+        break;
+    }
+    if (connection == NULL) {
+        return String8::format("Waiting for the %s window.", targetType);
+    }
+    switch (reason.windowReadiness) {
+    case WINDOW_CONNECTION_NOT_NORMAL:
+        return String8::format("Waiting because the %s window's input connection is %s."
+                "The window may be in the process of being removed.", targetType,
+                connection->getStatusLabel());
+    case WINDOW_INPUT_CHANNEL_FULL:
+        return String8::format("Waiting because the %s window's input channel is full.  "
+                "Outbound queue length: %d.  Wait queue length: %d.",
+                targetType, connection->outboundQueue.count(), connection->waitQueue.count());
+    case WINDOW_KEY_WAITING_FOR_PREVIOUS_EVENTS:
+        return String8::format("Waiting to send key event because the %s window has not "
+                "finished processing all of the input events that were previously "
+                "delivered to it.  Outbound queue length: %d.  Wait queue length: %d.",
+                targetType, connection->outboundQueue.count(), connection->waitQueue.count());
+    case WINDOW_WAIT_QUEUE_STALLED:
+        return String8::format("Waiting to send non-key event because the %s window has not "
+                "finished processing certain input events that were delivered to it over "
+                "%0.1fms ago.  Wait queue length: %d.  Wait queue head age: %0.1fms.",
+                targetType, STREAM_AHEAD_EVENT_TIMEOUT * 0.000001f,
+                connection->waitQueue.count(), connection->waitQueue.isEmpty() ? 0.0f
+                        : (currentTime - connection->waitQueue.head->deliveryTime) * 0.000001f);
+    default:
+        return String8::format("Waiting for the %s window.", targetType);
+    }
 }
 
 String8 InputDispatcher::getApplicationWindowLabelLocked(
@@ -1865,8 +1950,10 @@ void InputDispatcher::enqueueDispatchEntriesLocked(nsecs_t currentTime,
     enqueueDispatchEntryLocked(connection, eventEntry, inputTarget,
             InputTarget::FLAG_DISPATCH_AS_SLIPPERY_ENTER);
 
-    // If the outbound queue was previously empty, start the dispatch cycle going.
-    if (wasEmpty && !connection->outboundQueue.isEmpty()) {
+    // If the outbound queue was previously empty, start the dispatch cycle going. It also
+    // needs a start if it only held back a move for coalescing, rather than being blocked.
+    if ((wasEmpty || !connection->inputPublisherBlocked)
+            && !connection->outboundQueue.isEmpty()) {
         startDispatchCycleLocked(currentTime, connection);
     }
 }
@@ -1899,6 +1986,7 @@ void InputDispatcher::enqueueDispatchEntryLocked(
             ALOGD("channel '%s' ~ enqueueDispatchEntryLocked: skipping inconsistent key event",
                     connection->getInputChannelName());
 #endif
+            connection->counters.droppedEventCount.fetch_add(1, std::memory_order_relaxed);
             delete dispatchEntry;
             return; // skip the inconsistent event
         }
@@ -1944,6 +2032,7 @@ void InputDispatcher::enqueueDispatchEntryLocked(
             ALOGD("channel '%s' ~ enqueueDispatchEntryLocked: skipping inconsistent motion event",
                     connection->getInputChannelName());
 #endif
+            connection->counters.droppedEventCount.fetch_add(1, std::memory_order_relaxed);
             delete dispatchEntry;
             return; // skip the inconsistent event
         }
@@ -1951,6 +2040,21 @@ void InputDispatcher::enqueueDispatchEntryLocked(
     }
     }
 
+    // A window that is behind only gets the newest of consecutive moves, which replaces
+    // the one still waiting to be published.
+    DispatchEntry* queuedEntry = connection->outboundQueue.tail;
+    if (queuedEntry && isCoalescingMotionLocked(connection)
+            && canCoalesceMotion(queuedEntry, dispatchEntry)) {
+#if DEBUG_DISPATCH_CYCLE
+        ALOGD("channel '%s' ~ enqueueDispatchEntryLocked: coalescing motion event, "
+                "waitQueue length=%u", connection->getInputChannelName(),
+                connection->waitQueue.count());
+#endif
+        connection->outboundQueue.dequeue(queuedEntry);
+        releaseDispatchEntryLocked(queuedEntry);
+        connection->counters.coalescedMotionCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
     // Remember that we are waiting for this dispatch to complete.
     if (dispatchEntry->hasForegroundTarget()) {
         incrementPendingForegroundDispatchesLocked(eventEntry);
@@ -1971,6 +2075,16 @@ void InputDispatcher::startDispatchCycleLocked(nsecs_t currentTime,
     while (connection->status == Connection::STATUS_NORMAL
             && !connection->outboundQueue.isEmpty()) {
         DispatchEntry* dispatchEntry = connection->outboundQueue.head;
+
+        // Hold back the last move for a window that is behind, so that newer moves can still
+        // replace it. It goes out when the window finishes enough events or anything else
+        // is queued behind it.
+        if (dispatchEntry == connection->outboundQueue.tail
+                && isCoalescableMotion(dispatchEntry)
+                && isCoalescingMotionLocked(connection)) {
+            break;
+        }
+
         dispatchEntry->deliveryTime = currentTime;
 
         // Publish the event.
@@ -2069,6 +2183,10 @@ void InputDispatcher::startDispatchCycleLocked(nsecs_t currentTime,
             return;
         }
 
+        if (eventEntry->isFromDevice() && dispatchEntry->hasForegroundTarget()) {
+            mDispatchLatency.record(currentTime - eventEntry->enqueueTime);
+        }
+
         // Re-enqueue the event on the wait queue.
         connection->outboundQueue.dequeue(dispatchEntry);
         traceOutboundQueueLengthLocked(connection);
@@ -2077,6 +2195,47 @@ void InputDispatcher::startDispatchCycleLocked(nsecs_t currentTime,
     }
 }
 
+bool InputDispatcher::isCoalescingMotionLocked(const sp<Connection>& connection) const {
+    return mConfig.motionCoalescingWaitQueueDepth
+            && connection->waitQueue.count() >= mConfig.motionCoalescingWaitQueueDepth;
+}
+
+bool InputDispatcher::isCoalescableMotion(const DispatchEntry* dispatchEntry) {
+    const EventEntry* eventEntry = dispatchEntry->eventEntry;
+    return eventEntry->type == EventEntry::TYPE_MOTION
+            && dispatchEntry->resolvedAction == AMOTION_EVENT_ACTION_MOVE
+            && !eventEntry->isInjected();
+}
+
+bool InputDispatcher::canCoalesceMotion(const DispatchEntry* queuedEntry,
+        const DispatchEntry* entry) {
+    if (!isCoalescableMotion(queuedEntry) || !isCoalescableMotion(entry)
+            || queuedEntry->targetFlags != entry->targetFlags
+            || queuedEntry->resolvedFlags != entry->resolvedFlags
+            || queuedEntry->xOffset != entry->xOffset
+            || queuedEntry->yOffset != entry->yOffset
+            || queuedEntry->scaleFactor != entry->scaleFactor) {
+        return false;
+    }
+
+    const MotionEntry* queuedMotion = static_cast<const MotionEntry*>(queuedEntry->eventEntry);
+    const MotionEntry* motion = static_cast<const MotionEntry*>(entry->eventEntry);
+    if (queuedMotion->deviceId != motion->deviceId
+            || queuedMotion->source != motion->source
+            || queuedMotion->displayId != motion->displayId
+            || queuedMotion->metaState != motion->metaState
+            || queuedMotion->buttonState != motion->buttonState
+            || queuedMotion->pointerCount != motion->pointerCount) {
+        return false;
+    }
+    for (uint32_t i = 0; i < motion->pointerCount; i++) {
+        if (queuedMotion->pointerProperties[i] != motion->pointerProperties[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
 void InputDispatcher::finishDispatchCycleLocked(nsecs_t currentTime,
         const sp<Connection>& connection, uint32_t seq, bool handled) {
 #if DEBUG_DISPATCH_CYCLE
@@ -2103,6 +2262,8 @@ void InputDispatcher::abortBrokenDispatchCycleLocked(nsecs_t currentTime,
 #endif
 
     // Clear the dispatch queues.
+    connection->counters.droppedEventCount.fetch_add(connection->outboundQueue.count(),
+            std::memory_order_relaxed);
     drainDispatchQueueLocked(&connection->outboundQueue);
     traceOutboundQueueLengthLocked(connection);
     drainDispatchQueueLocked(&connection->waitQueue);
@@ -2842,13 +3003,131 @@ sp<InputWindowHandle> InputDispatcher::getWindowHandleLocked(
 
 bool InputDispatcher::hasWindowHandleLocked(
         const sp<InputWindowHandle>& windowHandle) const {
+    return mWindowIndices.indexOfKey(windowHandle.get()) >= 0;
+}
+
+ssize_t InputDispatcher::WindowGrid::cellAt(int32_t x, int32_t y) const {
+    if (cellWidth == 0 || x < left || y < top) {
+        return -1;
+    }
+    int32_t cellX = (x - left) / cellWidth;
+    int32_t cellY = (y - top) / cellHeight;
+    if (cellX >= CELLS_PER_AXIS || cellY >= CELLS_PER_AXIS) {
+        return -1;
+    }
+    return cellY * CELLS_PER_AXIS + cellX;
+}
+
+void InputDispatcher::WindowGrid::addToCells(Vector<Vector<size_t> >& cells,
+        const Rect& rect, size_t index) const {
+    if (rect.isEmpty() || cellWidth == 0) {
+        return;
+    }
+    int32_t firstX = std::max<int32_t>(0, (rect.left - left) / cellWidth);
+    int32_t lastX = std::min<int32_t>(CELLS_PER_AXIS - 1, (rect.right - 1 - left) / cellWidth);
+    int32_t firstY = std::max<int32_t>(0, (rect.top - top) / cellHeight);
+    int32_t lastY = std::min<int32_t>(CELLS_PER_AXIS - 1, (rect.bottom - 1 - top) / cellHeight);
+    for (int32_t cellY = firstY; cellY <= lastY; cellY++) {
+        for (int32_t cellX = firstX; cellX <= lastX; cellX++) {
+            cells.editItemAt(cellY * CELLS_PER_AXIS + cellX).push(index);
+        }
+    }
+}
+
+void InputDispatcher::rebuildWindowGridsLocked() {
+    mWindowGrids.clear();
+    mWindowIndices.clear();
+
+    // The cells of a display cover the frames and touchable regions of its windows.
+    KeyedVector<int32_t, Rect> displayBounds;
     size_t numWindows = mWindowHandles.size();
     for (size_t i = 0; i < numWindows; i++) {
-        if (mWindowHandles.itemAt(i) == windowHandle) {
-            return true;
+        const sp<InputWindowHandle>& windowHandle = mWindowHandles.itemAt(i);
+        mWindowIndices.add(windowHandle.get(), i);
+        const InputWindowInfo* windowInfo = windowHandle->getInfo();
+        if (!windowInfo->visible) {
+            continue;
+        }
+        Rect bounds(windowInfo->frameLeft, windowInfo->frameTop,
+                windowInfo->frameRight, windowInfo->frameBottom);
+        Rect touchableBounds = windowInfo->touchableRegion.getBounds();
+        if (bounds.isEmpty()) {
+            bounds = touchableBounds;
+        } else if (!touchableBounds.isEmpty()) {
+            bounds.left = std::min<int32_t>(bounds.left, touchableBounds.left);
+            bounds.top = std::min<int32_t>(bounds.top, touchableBounds.top);
+            bounds.right = std::max<int32_t>(bounds.right, touchableBounds.right);
+            bounds.bottom = std::max<int32_t>(bounds.bottom, touchableBounds.bottom);
+        }
+
+        ssize_t boundsIndex = displayBounds.indexOfKey(windowInfo->displayId);
+        if (boundsIndex < 0) {
+            displayBounds.add(windowInfo->displayId, bounds);
+        } else if (!bounds.isEmpty()) {
+            Rect& all = displayBounds.editValueAt(boundsIndex);
+            if (all.isEmpty()) {
+                all = bounds;
+            } else {
+                all.left = std::min<int32_t>(all.left, bounds.left);
+                all.top = std::min<int32_t>(all.top, bounds.top);
+                all.right = std::max<int32_t>(all.right, bounds.right);
+                all.bottom = std::max<int32_t>(all.bottom, bounds.bottom);
+            }
         }
     }
-    return false;
+
+    for (size_t d = 0; d < displayBounds.size(); d++) {
+        const Rect& bounds = displayBounds.valueAt(d);
+        WindowGrid grid;
+        if (!bounds.isEmpty()) {
+            grid.left = bounds.left;
+            grid.top = bounds.top;
+            const int32_t cells = WindowGrid::CELLS_PER_AXIS;
+            grid.cellWidth = std::max<int32_t>(1, (bounds.width() + cells - 1) / cells);
+            grid.cellHeight = std::max<int32_t>(1, (bounds.height() + cells - 1) / cells);
+            const size_t numCells = cells * cells;
+            grid.touchCandidates.insertAt(Vector<size_t>(), 0, numCells);
+            grid.occluders.insertAt(Vector<size_t>(), 0, numCells);
+        }
+        mWindowGrids.add(displayBounds.keyAt(d), grid);
+    }
+
+    for (size_t i = 0; i < numWindows; i++) {
+        const InputWindowInfo* windowInfo = mWindowHandles.itemAt(i)->getInfo();
+        if (!windowInfo->visible) {
+            continue;
+        }
+        WindowGrid& grid = mWindowGrids.editValueFor(windowInfo->displayId);
+        Rect frame(windowInfo->frameLeft, windowInfo->frameTop,
+                windowInfo->frameRight, windowInfo->frameBottom);
+
+        int32_t flags = windowInfo->layoutParamsFlags;
+        bool isTouchable = !(flags & InputWindowInfo::FLAG_NOT_TOUCHABLE);
+        bool isTouchModal = (flags & (InputWindowInfo::FLAG_NOT_FOCUSABLE
+                | InputWindowInfo::FLAG_NOT_TOUCH_MODAL)) == 0;
+        if ((isTouchable && isTouchModal) || (flags & InputWindowInfo::FLAG_WATCH_OUTSIDE_TOUCH)) {
+            for (size_t c = 0; c < grid.touchCandidates.size(); c++) {
+                grid.touchCandidates.editItemAt(c).push(i);
+            }
+            grid.outsideTouchCandidates.push(i);
+        } else if (isTouchable) {
+            grid.addToCells(grid.touchCandidates, windowInfo->touchableRegion.getBounds(), i);
+        }
+        if (!windowInfo->isTrustedOverlay()) {
+            grid.addToCells(grid.occluders, frame, i);
+        }
+    }
+}
+
+const Vector<size_t>* InputDispatcher::getTouchCandidatesLocked(int32_t displayId,
+        int32_t x, int32_t y) const {
+    ssize_t gridIndex = mWindowGrids.indexOfKey(displayId);
+    if (gridIndex < 0) {
+        return NULL;
+    }
+    const WindowGrid& grid = mWindowGrids.valueAt(gridIndex);
+    ssize_t cell = grid.cellAt(x, y);
+    return cell >= 0 ? &grid.touchCandidates.itemAt(cell) : &grid.outsideTouchCandidates;
 }
 
 void InputDispatcher::setInputWindows(const Vector<sp<InputWindowHandle> >& inputWindowHandles) {
@@ -2876,6 +3155,7 @@ void InputDispatcher::setInputWindows(const Vector<sp<InputWindowHandle> >& inpu
                 foundHoveredWindow = true;
             }
         }
+        rebuildWindowGridsLocked();
 
         if (!foundHoveredWindow) {
             mLastHoverWindowHandle = NULL;
@@ -3284,11 +3564,20 @@ void InputDispatcher::dumpDispatchStateLocked(String8& dump) {
         dump.append(INDENT "Connections:\n");
         for (size_t i = 0; i < mConnectionsByFd.size(); i++) {
             const sp<Connection>& connection = mConnectionsByFd.valueAt(i);
+            const Connection::Counters& counters = connection->counters;
             dump.appendFormat(INDENT2 "%zu: channelName='%s', windowName='%s', "
                     "status=%s, monitor=%s, inputPublisherBlocked=%s\n",
                     i, connection->getInputChannelName(), connection->getWindowName(),
                     connection->getStatusLabel(), toString(connection->monitor),
                     toString(connection->inputPublisherBlocked));
+            uint64_t finishedEventCount = counters.finishedEventCount.load();
+            dump.appendFormat(INDENT3 "Stats: finishedEvents=%" PRIu64 ", avgWait=%0.1fms, "
+                    "maxWait=%0.1fms, coalescedMotions=%" PRIu64 ", droppedEvents=%" PRIu64
+                    ", timeouts=%u\n",
+                    finishedEventCount, finishedEventCount
+                            ? counters.totalWaitTime.load() * 0.000001f / finishedEventCount : 0.0f,
+                    counters.maxWaitTime.load() * 0.000001f, counters.coalescedMotionCount.load(),
+                    counters.droppedEventCount.load(), counters.timeoutCount.load());
 
             if (!connection->outboundQueue.isEmpty()) {
                 dump.appendFormat(INDENT3 "OutboundQueue: length=%u\n",
@@ -3338,6 +3627,8 @@ void InputDispatcher::dumpDispatchStateLocked(String8& dump) {
             mConfig.keyRepeatDelay * 0.000001f);
     dump.appendFormat(INDENT2 "KeyRepeatTimeout: %0.1fms\n",
             mConfig.keyRepeatTimeout * 0.000001f);
+    dump.appendFormat(INDENT2 "MotionCoalescingWaitQueueDepth: %u\n",
+            mConfig.motionCoalescingWaitQueueDepth);
 }
 
 status_t InputDispatcher::registerInputChannel(const sp<InputChannel>& inputChannel,
@@ -3360,6 +3651,10 @@ status_t InputDispatcher::registerInputChannel(const sp<InputChannel>& inputChan
 
         int fd = inputChannel->getFd();
         mConnectionsByFd.add(fd, connection);
+        {
+            AutoMutex _sl(mConnectionStatsLock);
+            mConnectionStatsConnections.push(connection);
+        }
 
         if (monitor) {
             mMonitoringChannels.push(inputChannel);
@@ -3404,6 +3699,15 @@ status_t InputDispatcher::unregisterInputChannelLocked(const sp<InputChannel>& i
 
     sp<Connection> connection = mConnectionsByFd.valueAt(connectionIndex);
     mConnectionsByFd.removeItemsAt(connectionIndex);
+    {
+        AutoMutex _sl(mConnectionStatsLock);
+        for (size_t i = 0; i < mConnectionStatsConnections.size(); i++) {
+            if (mConnectionStatsConnections[i] == connection) {
+                mConnectionStatsConnections.removeAt(i);
+                break;
+            }
+        }
+    }
 
     if (connection->monitor) {
         removeMonitorChannelLocked(inputChannel);
@@ -3566,6 +3870,16 @@ void InputDispatcher::doDispatchCycleFinishedLockedInterruptible(
     DispatchEntry* dispatchEntry = connection->findWaitQueueEntry(seq);
     if (dispatchEntry) {
         nsecs_t eventDuration = finishTime - dispatchEntry->deliveryTime;
+        Connection::Counters& counters = connection->counters;
+        counters.finishedEventCount.fetch_add(1, std::memory_order_relaxed);
+        counters.totalWaitTime.fetch_add(eventDuration, std::memory_order_relaxed);
+        if (eventDuration > counters.maxWaitTime.load(std::memory_order_relaxed)) {
+            counters.maxWaitTime.store(eventDuration, std::memory_order_relaxed);
+        }
+        if (dispatchEntry->eventEntry->isFromDevice() && dispatchEntry->hasForegroundTarget()) {
+            mFinishLatency.record(eventDuration);
+            mTotalLatency.record(finishTime - dispatchEntry->eventEntry->eventTime);
+        }
         if (eventDuration > SLOW_EVENT_PROCESSING_WARNING_TIMEOUT) {
             String8 msg;
             msg.appendFormat("Window '%s' spent %0.1fms processing the last input event: ",
@@ -3810,6 +4124,8 @@ void InputDispatcher::traceInboundQueueLengthLocked() {
 }
 
 void InputDispatcher::traceOutboundQueueLengthLocked(const sp<Connection>& connection) {
+    connection->counters.outboundQueueLength.store(connection->outboundQueue.count(),
+            std::memory_order_relaxed);
     if (ATRACE_ENABLED()) {
         char counterName[40];
         snprintf(counterName, sizeof(counterName), "oq:%s", connection->getWindowName());
@@ -3818,6 +4134,10 @@ void InputDispatcher::traceOutboundQueueLengthLocked(const sp<Connection>& conne
 }
 
 void InputDispatcher::traceWaitQueueLengthLocked(const sp<Connection>& connection) {
+    connection->counters.waitQueueLength.store(connection->waitQueue.count(),
+            std::memory_order_relaxed);
+    connection->counters.waitQueueHeadDeliveryTime.store(connection->waitQueue.isEmpty()
+            ? 0 : connection->waitQueue.head->deliveryTime, std::memory_order_relaxed);
     if (ATRACE_ENABLED()) {
         char counterName[40];
         snprintf(counterName, sizeof(counterName), "wq:%s", connection->getWindowName());
@@ -3831,12 +4151,31 @@ void InputDispatcher::dump(String8& dump) {
     dump.append("Input Dispatcher State:\n");
     dumpDispatchStateLocked(dump);
 
+    dump.append("\nInput Latency:\n");
+    dumpLatencyStatsLocked(dump);
+
+    dump.append("\nEntry Pools:\n");
+    dumpEntryPools(dump);
+
     if (!mLastANRState.isEmpty()) {
         dump.append("\nInput Dispatcher State at time of last ANR:\n");
         dump.append(mLastANRState);
     }
 }
 
+void InputDispatcher::dumpLatencyStatsLocked(String8& dump) {
+    mReadLatency.dump(dump, INDENT);
+    mDispatchLatency.dump(dump, INDENT);
+    mFinishLatency.dump(dump, INDENT);
+    mTotalLatency.dump(dump, INDENT);
+}
+
+void InputDispatcher::dumpEntryPools(String8& dump) {
+    KeyEntry::pool().dump(dump);
+    MotionEntry::pool().dump(dump);
+    DispatchEntry::pool().dump(dump);
+}
+
 void InputDispatcher::monitor() {
     // Acquire and release the lock to ensure that the dispatcher has not deadlocked.
     mLock.lock();
@@ -3845,6 +4184,76 @@ void InputDispatcher::monitor() {
     mLock.unlock();
 }
 
+void InputDispatcher::getConnectionStats(Vector<InputConnectionStats>& outStats) {
+    nsecs_t currentTime = now();
+    AutoMutex _sl(mConnectionStatsLock);
+
+    outStats.clear();
+    outStats.setCapacity(mConnectionStatsConnections.size());
+    for (size_t i = 0; i < mConnectionStatsConnections.size(); i++) {
+        const sp<Connection>& connection = mConnectionStatsConnections[i];
+        const Connection::Counters& counters = connection->counters;
+        InputConnectionStats stats;
+        stats.inputChannelName = connection->inputChannel->getName();
+        stats.monitor = connection->monitor;
+        stats.outboundQueueLength = counters.outboundQueueLength.load(std::memory_order_relaxed);
+        stats.waitQueueLength = counters.waitQueueLength.load(std::memory_order_relaxed);
+        nsecs_t headDeliveryTime = counters.waitQueueHeadDeliveryTime.load(
+                std::memory_order_relaxed);
+        stats.waitQueueHeadAge = headDeliveryTime && currentTime > headDeliveryTime
+                ? currentTime - headDeliveryTime : 0;
+        stats.finishedEventCount = counters.finishedEventCount.load(std::memory_order_relaxed);
+        stats.totalWaitTime = counters.totalWaitTime.load(std::memory_order_relaxed);
+        stats.maxWaitTime = counters.maxWaitTime.load(std::memory_order_relaxed);
+        stats.coalescedMotionCount = counters.coalescedMotionCount.load(
+                std::memory_order_relaxed);
+        stats.droppedEventCount = counters.droppedEventCount.load(std::memory_order_relaxed);
+        stats.timeoutCount = counters.timeoutCount.load(std::memory_order_relaxed);
+        outStats.push(stats);
+    }
+}
+
+
+// --- InputDispatcher::EntryPool ---
+
+InputDispatcher::EntryPool::EntryPool(const char* name, size_t objectSize, size_t capacity) :
+        mName(name), mObjectSize(objectSize), mCapacity(capacity),
+        mFree(new void*[capacity]), mFreeCount(0), mReuseCount(0), mAllocationCount(0) {
+}
+
+void* InputDispatcher::EntryPool::allocate(size_t size) {
+    if (size == mObjectSize) {
+        AutoMutex _l(mLock);
+        if (mFreeCount) {
+            mReuseCount += 1;
+            return mFree[--mFreeCount];
+        }
+        mAllocationCount += 1;
+    }
+    return ::operator new(size);
+}
+
+void InputDispatcher::EntryPool::free(void* p, size_t size) {
+    if (!p) {
+        return;
+    }
+    if (size == mObjectSize) {
+        AutoMutex _l(mLock);
+        if (mFreeCount < mCapacity) {
+            mFree[mFreeCount++] = p;
+            return;
+        }
+    }
+    ::operator delete(p);
+}
+
+void InputDispatcher::EntryPool::dump(String8& dump) const {
+    AutoMutex _l(mLock);
+    dump.appendFormat(INDENT "%s: %zu cached (capacity %zu), %" PRIu64 " reused, "
+            "%" PRIu64 " allocated\n", mName, mFreeCount, mCapacity,
+            mReuseCount, mAllocationCount);
+}
+
 
 // --- InputDispatcher::InjectionState ---
 
@@ -3871,7 +4280,7 @@ void InputDispatcher::InjectionState::release() {
 // --- InputDispatcher::EventEntry ---
 
 InputDispatcher::EventEntry::EventEntry(int32_t type, nsecs_t eventTime, uint32_t policyFlags) :
-        refCount(1), type(type), eventTime(eventTime), policyFlags(policyFlags),
+        refCount(1), type(type), eventTime(eventTime), enqueueTime(0), policyFlags(policyFlags),
         injectionState(NULL), dispatchInProgress(false) {
 }
 
@@ -3952,6 +4361,20 @@ void InputDispatcher::KeyEntry::appendDescription(String8& msg) const {
             repeatCount, policyFlags);
 }
 
+void* InputDispatcher::KeyEntry::operator new(size_t size) {
+    return pool().allocate(size);
+}
+
+void InputDispatcher::KeyEntry::operator delete(void* p, size_t size) {
+    pool().free(p, size);
+}
+
+// Never destroyed, since entries may still be released at exit.
+InputDispatcher::EntryPool& InputDispatcher::KeyEntry::pool() {
+    static EntryPool* sPool = new EntryPool("KeyEntry", sizeof(KeyEntry), KEY_ENTRY_POOL_SIZE);
+    return *sPool;
+}
+
 void InputDispatcher::KeyEntry::recycle() {
     releaseInjectionState();
 
@@ -4005,6 +4428,20 @@ void InputDispatcher::MotionEntry::appendDescription(String8& msg) const {
     msg.appendFormat("]), policyFlags=0x%08x", policyFlags);
 }
 
+void* InputDispatcher::MotionEntry::operator new(size_t size) {
+    return pool().allocate(size);
+}
+
+void InputDispatcher::MotionEntry::operator delete(void* p, size_t size) {
+    pool().free(p, size);
+}
+
+InputDispatcher::EntryPool& InputDispatcher::MotionEntry::pool() {
+    static EntryPool* sPool = new EntryPool("MotionEntry", sizeof(MotionEntry),
+            MOTION_ENTRY_POOL_SIZE);
+    return *sPool;
+}
+
 
 // --- InputDispatcher::DispatchEntry ---
 
@@ -4023,6 +4460,20 @@ InputDispatcher::DispatchEntry::~DispatchEntry() {
     eventEntry->release();
 }
 
+void* InputDispatcher::DispatchEntry::operator new(size_t size) {
+    return pool().allocate(size);
+}
+
+void InputDispatcher::DispatchEntry::operator delete(void* p, size_t size) {
+    pool().free(p, size);
+}
+
+InputDispatcher::EntryPool& InputDispatcher::DispatchEntry::pool() {
+    static EntryPool* sPool = new EntryPool("DispatchEntry", sizeof(DispatchEntry),
+            DISPATCH_ENTRY_POOL_SIZE);
+    return *sPool;
+}
+
 uint32_t InputDispatcher::DispatchEntry::nextSeq() {
     // Sequence number 0 is reserved and will never be returned.
     uint32_t seq;
@@ -4389,6 +4840,12 @@ bool InputDispatcher::InputState::shouldCancelMotion(const MotionMemento& mement
 
 // --- InputDispatcher::Connection ---
 
+InputDispatcher::Connection::Counters::Counters() :
+        outboundQueueLength(0), waitQueueLength(0), waitQueueHeadDeliveryTime(0),
+        finishedEventCount(0), totalWaitTime(0), maxWaitTime(0),
+        coalescedMotionCount(0), droppedEventCount(0), timeoutCount(0) {
+}
+
 InputDispatcher::Connection::Connection(const sp<InputChannel>& inputChannel,
         const sp<InputWindowHandle>& inputWindowHandle, bool monitor) :
         status(STATUS_NORMAL), inputChannel(inputChannel), inputWindowHandle(inputWindowHandle),
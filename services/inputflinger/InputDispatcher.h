@@ -29,6 +29,7 @@
 #include <utils/BitSet.h>
 #include <cutils/atomic.h>
 
+#include <atomic>
 #include <stddef.h>
 #include <unistd.h>
 #include <limits.h>
@@ -36,6 +37,7 @@
 #include "InputWindow.h"
 #include "InputApplication.h"
 #include "InputListener.h"
+#include "InputLatencyStats.h"
 
 
 namespace android {
@@ -181,9 +183,48 @@ struct InputDispatcherConfiguration {
     // The key repeat inter-key delay.
     nsecs_t keyRepeatDelay;
 
+    // The number of unfinished events past which a window counts as falling behind, or 0
+    // to never coalesce. Moves to such a window are coalesced: only the newest one waiting
+    // to be published is kept, so it gets the latest position once it catches up.
+    uint32_t motionCoalescingWaitQueueDepth;
+
     InputDispatcherConfiguration() :
             keyRepeatTimeout(500 * 1000000LL),
-            keyRepeatDelay(50 * 1000000LL) { }
+            keyRepeatDelay(50 * 1000000LL),
+            motionCoalescingWaitQueueDepth(16) { }
+};
+
+
+/*
+ * Health of the connection to a window or monitor, as reported by
+ * InputDispatcherInterface::getConnectionStats().
+ */
+struct InputConnectionStats {
+    String8 inputChannelName;
+    bool monitor;
+
+    // Events waiting to be published, and published events not yet finished by the
+    // application.
+    uint32_t outboundQueueLength;
+    uint32_t waitQueueLength;
+
+    // How long the oldest unfinished event has been waiting for the application, or 0.
+    nsecs_t waitQueueHeadAge;
+
+    // Events finished by the application, with the total and the longest time they waited.
+    uint64_t finishedEventCount;
+    nsecs_t totalWaitTime;
+    nsecs_t maxWaitTime;
+
+    // Moves replaced by newer ones while the application was behind.
+    uint64_t coalescedMotionCount;
+
+    // Events that were never published, because they were inconsistent with what the
+    // application was sent before or because the connection broke.
+    uint64_t droppedEventCount;
+
+    // Times the application was reported as not responding.
+    uint32_t timeoutCount;
 };
 
 
@@ -286,6 +327,14 @@ public:
     /* Called by the heatbeat to ensures that the dispatcher has not deadlocked. */
     virtual void monitor() = 0;
 
+    /* Gets the health of the connection to each registered input channel.
+     *
+     * The counters are kept up to date by the dispatcher as it goes and read here without
+     * holding the dispatcher lock, so this may be polled often without stalling dispatch.
+     *
+     * This method may be called on any thread. */
+    virtual void getConnectionStats(Vector<InputConnectionStats>& outStats) = 0;
+
     /* Runs a single iteration of the dispatch loop.
      * Nominally processes one queued event, a timeout, or a response from an input consumer.
      *
@@ -375,6 +424,7 @@ public:
 
     virtual void dump(String8& dump);
     virtual void monitor();
+    virtual void getConnectionStats(Vector<InputConnectionStats>& outStats);
 
     virtual void dispatchOnce();
 
@@ -410,6 +460,30 @@ private:
         inline Link() : next(NULL), prev(NULL) { }
     };
 
+    // A bounded cache of the memory of freed entries of one type, so that steady streams of
+    // events don't go to malloc for every entry they allocate. Past the capacity, freed
+    // memory goes back to the heap.
+    class EntryPool {
+    public:
+        EntryPool(const char* name, size_t objectSize, size_t capacity);
+
+        void* allocate(size_t size);
+        void free(void* p, size_t size);
+
+        void dump(String8& dump) const;
+
+    private:
+        const char* const mName;
+        const size_t mObjectSize;
+        const size_t mCapacity;
+
+        mutable Mutex mLock;
+        void** mFree;
+        size_t mFreeCount;
+        uint64_t mReuseCount;
+        uint64_t mAllocationCount;
+    };
+
     struct InjectionState {
         mutable int32_t refCount;
 
@@ -437,6 +511,7 @@ private:
         mutable int32_t refCount;
         int32_t type;
         nsecs_t eventTime;
+        nsecs_t enqueueTime; // time when the event entered the inbound queue
         uint32_t policyFlags;
         InjectionState* injectionState;
 
@@ -444,6 +519,13 @@ private:
 
         inline bool isInjected() const { return injectionState != NULL; }
 
+        // True for key and motion events that came from an input device, whose
+        // event time is the evdev timestamp.
+        inline bool isFromDevice() const {
+            return (type == TYPE_KEY || type == TYPE_MOTION)
+                    && !(policyFlags & POLICY_FLAG_INJECTED);
+        }
+
         void release();
 
         virtual void appendDescription(String8& msg) const = 0;
@@ -501,6 +583,10 @@ private:
         virtual void appendDescription(String8& msg) const;
         void recycle();
 
+        static void* operator new(size_t size);
+        static void operator delete(void* p, size_t size);
+        static EntryPool& pool();
+
     protected:
         virtual ~KeyEntry();
     };
@@ -533,6 +619,10 @@ private:
                 float xOffset, float yOffset);
         virtual void appendDescription(String8& msg) const;
 
+        static void* operator new(size_t size);
+        static void operator delete(void* p, size_t size);
+        static EntryPool& pool();
+
     protected:
         virtual ~MotionEntry();
     };
@@ -564,6 +654,10 @@ private:
             return targetFlags & InputTarget::FLAG_SPLIT;
         }
 
+        static void* operator new(size_t size);
+        static void operator delete(void* p, size_t size);
+        static EntryPool& pool();
+
     private:
         static volatile int32_t sNextSeqAtomic;
 
@@ -829,6 +923,23 @@ private:
         // yet received a "finished" response from the application.
         Queue<DispatchEntry> waitQueue;
 
+        // Health counters, only written by the dispatcher thread and read without the
+        // dispatcher lock by getConnectionStats(). See InputConnectionStats.
+        struct Counters {
+            std::atomic<uint32_t> outboundQueueLength;
+            std::atomic<uint32_t> waitQueueLength;
+            std::atomic<nsecs_t> waitQueueHeadDeliveryTime; // 0 if the wait queue is empty
+            std::atomic<uint64_t> finishedEventCount;
+            std::atomic<nsecs_t> totalWaitTime;
+            std::atomic<nsecs_t> maxWaitTime;
+            std::atomic<uint64_t> coalescedMotionCount;
+            std::atomic<uint64_t> droppedEventCount;
+            std::atomic<uint32_t> timeoutCount;
+
+            Counters();
+        };
+        Counters counters;
+
         explicit Connection(const sp<InputChannel>& inputChannel,
                 const sp<InputWindowHandle>& inputWindowHandle, bool monitor);
 
@@ -863,6 +974,16 @@ private:
     Queue<EventEntry> mRecentQueue;
     Queue<CommandEntry> mCommandQueue;
 
+    // The latency added by each stage of the pipeline, for events from input
+    // devices delivered to foreground windows:
+    // evdev timestamp -> inbound queue (EventHub, InputReader and the policy),
+    // inbound queue -> published to the window, published -> finished by the
+    // window, and evdev timestamp -> finished.
+    LatencyHistogram mReadLatency;
+    LatencyHistogram mDispatchLatency;
+    LatencyHistogram mFinishLatency;
+    LatencyHistogram mTotalLatency;
+
     DropReason mLastDropReason;
 
     void dispatchOnceInnerLocked(nsecs_t* nextWakeupTime);
@@ -897,6 +1018,11 @@ private:
     // All registered connections mapped by channel file descriptor.
     KeyedVector<int, sp<Connection> > mConnectionsByFd;
 
+    // The registered connections again, for getConnectionStats() to read their counters
+    // without taking mLock. Changed together with mConnectionsByFd, under both locks.
+    Mutex mConnectionStatsLock;
+    Vector<sp<Connection> > mConnectionStatsConnections;
+
     ssize_t getConnectionIndexLocked(const sp<InputChannel>& inputChannel);
 
     // Input channels that will receive a copy of all input events.
@@ -958,6 +1084,37 @@ private:
     sp<InputWindowHandle> getWindowHandleLocked(const sp<InputChannel>& inputChannel) const;
     bool hasWindowHandleLocked(const sp<InputWindowHandle>& windowHandle) const;
 
+    // Spatial index of the windows of a display, rebuilt by setInputWindows, so that hit
+    // tests only look at the windows that may be under the point. The windows' bounds are
+    // divided into a grid whose cells list, front to back like mWindowHandles, the indices
+    // in mWindowHandles of the windows to check for points in the cell.
+    struct WindowGrid {
+        enum { CELLS_PER_AXIS = 16 };
+
+        int32_t left;
+        int32_t top;
+        int32_t cellWidth; // 0 if there are no cells
+        int32_t cellHeight;
+        // Visible windows that may get a touch in the cell: touchable ones whose touchable
+        // region meets it, and everywhere, touch modal ones and ones watching outside touches.
+        Vector<Vector<size_t> > touchCandidates;
+        // the touch candidates for points outside of the cells
+        Vector<size_t> outsideTouchCandidates;
+        // Visible windows that may obscure others in the cell, by frame.
+        Vector<Vector<size_t> > occluders;
+
+        WindowGrid() : left(0), top(0), cellWidth(0), cellHeight(0) { }
+
+        // Returns -1 if the point is outside of the cells.
+        ssize_t cellAt(int32_t x, int32_t y) const;
+        void addToCells(Vector<Vector<size_t> >& cells, const Rect& rect, size_t index) const;
+    };
+    KeyedVector<int32_t, WindowGrid> mWindowGrids; // by display id
+    KeyedVector<InputWindowHandle*, size_t> mWindowIndices; // index in mWindowHandles
+
+    void rebuildWindowGridsLocked();
+    const Vector<size_t>* getTouchCandidatesLocked(int32_t displayId, int32_t x, int32_t y) const;
+
     // Focus tracking for keys, trackball, etc.
     sp<InputWindowHandle> mFocusedWindowHandle;
 
@@ -1030,10 +1187,34 @@ private:
     sp<InputWindowHandle> mLastHoverWindowHandle;
 
     // Finding targets for input events.
+    enum WindowReadiness {
+        WINDOW_READY,
+        WINDOW_PAUSED,
+        WINDOW_NOT_REGISTERED,
+        WINDOW_CONNECTION_NOT_NORMAL,
+        WINDOW_INPUT_CHANNEL_FULL,
+        WINDOW_KEY_WAITING_FOR_PREVIOUS_EVENTS,
+        WINDOW_WAIT_QUEUE_STALLED,
+    };
+
+    // Why dispatch is waiting for a target. Dispatch checks the same targets again each
+    // time it wakes up while it waits, so a window's readiness is only turned into a
+    // message when that is logged or reported in an ANR.
+    struct TargetWaitReason {
+        const char* message; // for waits that are not about a window's readiness
+        WindowReadiness windowReadiness;
+        const char* targetType;
+
+        explicit TargetWaitReason(const char* message) :
+                message(message), windowReadiness(WINDOW_READY), targetType(NULL) { }
+        TargetWaitReason(WindowReadiness windowReadiness, const char* targetType) :
+                message(NULL), windowReadiness(windowReadiness), targetType(targetType) { }
+    };
+
     int32_t handleTargetsNotReadyLocked(nsecs_t currentTime, const EventEntry* entry,
             const sp<InputApplicationHandle>& applicationHandle,
             const sp<InputWindowHandle>& windowHandle,
-            nsecs_t* nextWakeupTime, const char* reason);
+            nsecs_t* nextWakeupTime, const TargetWaitReason& reason);
     void resumeAfterTargetsNotReadyTimeoutLocked(nsecs_t newTimeout,
             const sp<InputChannel>& inputChannel);
     nsecs_t getTimeSpentWaitingForApplicationLocked(nsecs_t currentTime);
@@ -1058,9 +1239,10 @@ private:
     String8 getApplicationWindowLabelLocked(const sp<InputApplicationHandle>& applicationHandle,
             const sp<InputWindowHandle>& windowHandle);
 
-    String8 checkWindowReadyForMoreInputLocked(nsecs_t currentTime,
-            const sp<InputWindowHandle>& windowHandle, const EventEntry* eventEntry,
-            const char* targetType);
+    WindowReadiness checkWindowReadyForMoreInputLocked(nsecs_t currentTime,
+            const sp<InputWindowHandle>& windowHandle, const EventEntry* eventEntry);
+    String8 getTargetWaitReasonLocked(nsecs_t currentTime,
+            const sp<InputWindowHandle>& windowHandle, const TargetWaitReason& reason);
 
     // Manage the dispatch cycle for a single connection.
     // These methods are deliberately not Interruptible because doing all of the work
@@ -1073,6 +1255,9 @@ private:
     void enqueueDispatchEntryLocked(const sp<Connection>& connection,
             EventEntry* eventEntry, const InputTarget* inputTarget, int32_t dispatchMode);
     void startDispatchCycleLocked(nsecs_t currentTime, const sp<Connection>& connection);
+    bool isCoalescingMotionLocked(const sp<Connection>& connection) const;
+    static bool isCoalescableMotion(const DispatchEntry* dispatchEntry);
+    static bool canCoalesceMotion(const DispatchEntry* queuedEntry, const DispatchEntry* entry);
     void finishDispatchCycleLocked(nsecs_t currentTime, const sp<Connection>& connection,
             uint32_t seq, bool handled);
     void abortBrokenDispatchCycleLocked(nsecs_t currentTime, const sp<Connection>& connection,
@@ -1097,6 +1282,8 @@ private:
 
     // Dump state.
     void dumpDispatchStateLocked(String8& dump);
+    void dumpLatencyStatsLocked(String8& dump);
+    void dumpEntryPools(String8& dump);
     void logDispatchStateLocked();
 
     // Registration.
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _UI_INPUT_LATENCY_STATS_H
+#define _UI_INPUT_LATENCY_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <utils/String8.h>
+#include <utils/Timers.h>
+
+namespace android {
+
+/*
+ * Histogram of the latency added by one stage of the input pipeline, for
+ * dumpsys input. Each sample is also emitted as an atrace counter, in
+ * microseconds, so the stages can be lined up with the rest of a trace.
+ *
+ * Not thread safe; owned by the reader or the dispatcher and used under its lock.
+ */
+class LatencyHistogram {
+public:
+    // Bucket i counts latencies in [2^(i-1), 2^i) microseconds, bucket 0 counts
+    // those under 1us and the last bucket everything above.
+    static const size_t NUM_BUCKETS = 22;
+
+    // Both strings must outlive the histogram.
+    LatencyHistogram(const char* name, const char* traceCounter);
+
+    void record(nsecs_t latency);
+    void reset();
+    void dump(String8& dump, const char* prefix) const;
+
+private:
+    const char* mName;
+    const char* mTraceCounter;
+    uint64_t mCount;
+    uint64_t mTotalUs;
+    uint64_t mMaxUs;
+    uint64_t mBuckets[NUM_BUCKETS];
+};
+
+} // namespace android
+
+#endif // _UI_INPUT_LATENCY_STATS_H
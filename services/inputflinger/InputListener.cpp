@@ -179,4 +179,56 @@ void QueuedInputListener::flush() {
 }
 
 
+// --- TimestampedArgsQueue ---
+
+TimestampedArgsQueue::TimestampedArgsQueue() {
+}
+
+TimestampedArgsQueue::~TimestampedArgsQueue() {
+    size_t count = mEntries.size();
+    for (size_t i = 0; i < count; i++) {
+        delete mEntries[i].args;
+    }
+}
+
+void TimestampedArgsQueue::notifyConfigurationChanged(
+        const NotifyConfigurationChangedArgs* args) {
+    push(args->eventTime, new NotifyConfigurationChangedArgs(*args));
+}
+
+void TimestampedArgsQueue::notifyKey(const NotifyKeyArgs* args) {
+    push(args->eventTime, new NotifyKeyArgs(*args));
+}
+
+void TimestampedArgsQueue::notifyMotion(const NotifyMotionArgs* args) {
+    push(args->eventTime, new NotifyMotionArgs(*args));
+}
+
+void TimestampedArgsQueue::notifySwitch(const NotifySwitchArgs* args) {
+    push(args->eventTime, new NotifySwitchArgs(*args));
+}
+
+void TimestampedArgsQueue::notifyDeviceReset(const NotifyDeviceResetArgs* args) {
+    push(args->eventTime, new NotifyDeviceResetArgs(*args));
+}
+
+NotifyArgs* TimestampedArgsQueue::popHead() {
+    NotifyArgs* args = mEntries[0].args;
+    mEntries.removeAt(0);
+    return args;
+}
+
+void TimestampedArgsQueue::moveTo(TimestampedArgsQueue* other) {
+    other->mEntries.appendVector(mEntries);
+    mEntries.clear();
+}
+
+void TimestampedArgsQueue::push(nsecs_t eventTime, NotifyArgs* args) {
+    Entry entry;
+    entry.eventTime = eventTime;
+    entry.args = args;
+    mEntries.push(entry);
+}
+
+
 } // namespace android
@@ -193,6 +193,45 @@ private:
     Vector<NotifyArgs*> mArgsQueue;
 };
 
+
+/*
+ * An implementation of the listener interface that queues up decoded events along
+ * with their event times, so that the queues of several producers can be merged
+ * in event time order.  Not thread safe.
+ */
+class TimestampedArgsQueue : public InputListenerInterface {
+protected:
+    virtual ~TimestampedArgsQueue();
+
+public:
+    TimestampedArgsQueue();
+
+    virtual void notifyConfigurationChanged(const NotifyConfigurationChangedArgs* args);
+    virtual void notifyKey(const NotifyKeyArgs* args);
+    virtual void notifyMotion(const NotifyMotionArgs* args);
+    virtual void notifySwitch(const NotifySwitchArgs* args);
+    virtual void notifyDeviceReset(const NotifyDeviceResetArgs* args);
+
+    inline bool isEmpty() const { return mEntries.isEmpty(); }
+    inline nsecs_t getHeadEventTime() const { return mEntries[0].eventTime; }
+
+    // Removes the oldest queued event and returns it; the caller deletes it.
+    NotifyArgs* popHead();
+
+    // Moves all queued events to the tail of another queue.
+    void moveTo(TimestampedArgsQueue* other);
+
+private:
+    struct Entry {
+        nsecs_t eventTime;
+        NotifyArgs* args;
+    };
+
+    Vector<Entry> mEntries;
+
+    void push(nsecs_t eventTime, NotifyArgs* args);
+};
+
 } // namespace android
 
 #endif // _UI_INPUT_LISTENER_H
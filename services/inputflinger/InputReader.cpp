@@ -52,6 +52,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 
+#include <cutils/properties.h>
 #include <log/log.h>
 
 #include <input/Keyboard.h>
@@ -178,6 +179,15 @@ static inline bool sourcesMatchMask(uint32_t sources, uint32_t sourceMask) {
     return (sources & sourceMask & ~ AINPUT_SOURCE_CLASS_MASK) != 0;
 }
 
+// Does what PointerCoords::setAxisValue() does for an axis above all those already set,
+// without searching for its index or moving values out of the way.
+static inline void appendAxisValue(PointerCoords& coords, int32_t axis, float value) {
+    if (value != 0) {
+        coords.values[BitSet64::count(coords.bits)] = value;
+        BitSet64::markBit(coords.bits, axis);
+    }
+}
+
 // Returns true if the pointer should be reported as being down given the specified
 // button states.  This determines whether the event is reported as a touch event.
 static bool isPointerDown(int32_t buttonState) {
@@ -300,16 +310,109 @@ void TouchAffineTransformation::applyTo(float& x, float& y) const {
 }
 
 
+// --- InputReader::DeviceWorker ---
+
+thread_local InputReader::DeviceWorker* InputReader::sCurrentDeviceWorker = NULL;
+
+class InputReader::DeviceWorker : public Thread {
+public:
+    DeviceWorker(InputReader* reader, InputDevice* device) :
+            Thread(/*canCallJava*/ true), device(device),
+            staging(new TimestampedArgsQueue()), output(new TimestampedArgsQueue()),
+            processing(false), busySince(0), exiting(false), mReader(reader) {
+    }
+
+    // Guarded by the reader lock.  Cleared when the device is removed.
+    InputDevice* device;
+    // What the device produces while the worker processes a batch, only touched by the
+    // worker thread; moved to the output queue, which the reader merges, after each batch.
+    sp<TimestampedArgsQueue> staging;
+    sp<TimestampedArgsQueue> output;
+    // Raw events waiting for the worker, guarded by the reader lock.
+    Vector<RawEvent> pendingEvents;
+    bool processing;
+    // The time of the oldest raw event not processed yet, while busy.
+    nsecs_t busySince;
+    bool exiting;
+    Condition workAvailableCondition;
+
+    inline bool isBusy() const { return processing || !pendingEvents.isEmpty(); }
+
+    void enqueueLocked(const RawEvent* rawEvents, size_t count) {
+        if (!isBusy()) {
+            busySince = rawEvents[0].when;
+        }
+        pendingEvents.appendArray(rawEvents, count);
+        workAvailableCondition.signal();
+    }
+
+    void requestExitLocked() {
+        exiting = true;
+        device = NULL;
+        requestExit();
+        workAvailableCondition.signal();
+    }
+
+private:
+    InputReader* mReader;
+    Vector<RawEvent> mBatch;
+
+    virtual status_t readyToRun() {
+        sCurrentDeviceWorker = this;
+        return OK;
+    }
+
+    virtual bool threadLoop() {
+        Mutex& lock = mReader->mLock;
+        lock.lock();
+        while (!exiting && pendingEvents.isEmpty()) {
+            workAvailableCondition.wait(lock);
+        }
+        if (exiting) {
+            lock.unlock();
+            return false;
+        }
+        mBatch.clear();
+        mBatch.appendVector(pendingEvents);
+        pendingEvents.clear();
+        processing = true;
+        InputDevice* batchDevice = device;
+        lock.unlock();
+
+        batchDevice->process(mBatch.array(), mBatch.size());
+
+        lock.lock();
+        staging->moveTo(output.get());
+        processing = false;
+        if (!pendingEvents.isEmpty()) {
+            busySince = pendingEvents[0].when;
+        }
+        mReader->mDeviceWorkersIdleCondition.broadcast();
+        lock.unlock();
+
+        mReader->deliverMergedArgs();
+        return true;
+    }
+};
+
+
 // --- InputReader ---
 
 InputReader::InputReader(const sp<EventHubInterface>& eventHub,
         const sp<InputReaderPolicyInterface>& policy,
         const sp<InputListenerInterface>& listener) :
         mContext(this), mEventHub(eventHub), mPolicy(policy),
+        mEventHubLatency("eventhub", "input_eventhub_us"),
+        mMapperLatency("mapper", "input_mapper_us"),
         mGlobalMetaState(0), mGeneration(1),
         mDisableVirtualKeysTimeout(LLONG_MIN), mNextTimeout(LLONG_MAX),
-        mConfigurationChangesToRefresh(0) {
+        mConfigurationChangesToRefresh(0),
+        mDeviceWorkersEnabled(property_get_bool("input.reader.device_workers", false)),
+        mDeviceWorkerWaiters(0), mSharedGlobalMetaState(0), mFadePointerRequested(false) {
     mQueuedListener = new QueuedInputListener(listener);
+    if (mDeviceWorkersEnabled) {
+        mReaderArgsQueue = new TimestampedArgsQueue();
+    }
 
     { // acquire lock
         AutoMutex _l(mLock);
@@ -320,6 +423,18 @@ InputReader::InputReader(const sp<EventHubInterface>& eventHub,
 }
 
 InputReader::~InputReader() {
+    Vector<sp<DeviceWorker> > workers;
+    { // acquire lock
+        AutoMutex _l(mLock);
+        workers = mDeviceWorkers;
+        for (size_t i = 0; i < workers.size(); i++) {
+            workers[i]->requestExitLocked();
+        }
+    } // release lock
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i]->join();
+    }
+
     for (size_t i = 0; i < mDevices.size(); i++) {
         delete mDevices.valueAt(i);
     }
@@ -348,13 +463,21 @@ void InputReader::loopOnce() {
     } // release lock
 
     size_t count = mEventHub->getEvents(timeoutMillis, mEventBuffer, EVENT_BUFFER_SIZE);
+    nsecs_t readTime = systemTime(SYSTEM_TIME_MONOTONIC);
 
     { // acquire lock
         AutoMutex _l(mLock);
         mReaderIsAliveCondition.broadcast();
 
         if (count) {
+            recordEventHubLatencyLocked(readTime, mEventBuffer, count);
             processEventsLocked(mEventBuffer, count);
+            mMapperLatency.record(systemTime(SYSTEM_TIME_MONOTONIC) - readTime);
+        }
+
+        if (mFadePointerRequested) {
+            mFadePointerRequested = false;
+            fadePointerLocked();
         }
 
         if (mNextTimeout != LLONG_MAX) {
@@ -386,7 +509,21 @@ void InputReader::loopOnce() {
     // resulting in a deadlock.  This situation is actually quite plausible because the
     // listener is actually the input dispatcher, which calls into the window manager,
     // which occasionally calls into the input reader.
-    mQueuedListener->flush();
+    if (mDeviceWorkersEnabled) {
+        deliverMergedArgs();
+    } else {
+        mQueuedListener->flush();
+    }
+}
+
+void InputReader::recordEventHubLatencyLocked(nsecs_t readTime,
+        const RawEvent* rawEvents, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const RawEvent& rawEvent = rawEvents[i];
+        if (rawEvent.type == EV_SYN && rawEvent.code == SYN_REPORT) {
+            mEventHubLatency.record(readTime - rawEvent.when);
+        }
+    }
 }
 
 void InputReader::processEventsLocked(const RawEvent* rawEvents, size_t count) {
@@ -453,6 +590,18 @@ void InputReader::addDeviceLocked(nsecs_t when, int32_t deviceId) {
     mDevices.add(deviceId, device);
     bumpGenerationLocked();
 
+    if (!device->isIgnored() && shouldUseDeviceWorker(classes)) {
+        sp<DeviceWorker> worker = new DeviceWorker(this, device);
+        status_t result = worker->run(String8::format("InputReader:%d", deviceId).string(),
+                PRIORITY_URGENT_DISPLAY);
+        if (result) {
+            ALOGE("Could not start a worker for device %d, processing it on the reader thread.  "
+                    "status=%d", deviceId, result);
+        } else {
+            mDeviceWorkers.push(worker);
+        }
+    }
+
     if (device->getClasses() & INPUT_DEVICE_CLASS_EXTERNAL_STYLUS) {
         notifyExternalStylusPresenceChanged();
     }
@@ -467,6 +616,12 @@ void InputReader::removeDeviceLocked(nsecs_t when, int32_t deviceId) {
     }
 
     device = mDevices.valueAt(deviceIndex);
+    DeviceWorker* worker = getDeviceWorkerLocked(deviceId);
+    if (worker) {
+        // The worker stays in mDeviceWorkers until what it produced has been delivered.
+        waitForDeviceWorkersLocked();
+        worker->requestExitLocked();
+    }
     mDevices.removeItemsAt(deviceIndex, 1);
     bumpGenerationLocked();
 
@@ -575,10 +730,21 @@ void InputReader::processEventsForDeviceLocked(int32_t deviceId,
         return;
     }
 
+    DeviceWorker* worker = getDeviceWorkerLocked(deviceId);
+    if (worker) {
+        // Let a thread waiting for the workers through, rather than keep them busy.
+        if (mDeviceWorkerWaiters) {
+            waitForDeviceWorkersLocked();
+        }
+        worker->enqueueLocked(rawEvents, count);
+        return;
+    }
+
     device->process(rawEvents, count);
 }
 
 void InputReader::timeoutExpiredLocked(nsecs_t when) {
+    waitForDeviceWorkersLocked();
     for (size_t i = 0; i < mDevices.size(); i++) {
         InputDevice* device = mDevices.valueAt(i);
         if (!device->isIgnored()) {
@@ -593,7 +759,7 @@ void InputReader::handleConfigurationChangedLocked(nsecs_t when) {
 
     // Enqueue configuration changed.
     NotifyConfigurationChangedArgs args(when);
-    mQueuedListener->notifyConfigurationChanged(&args);
+    mContext.getListener()->notifyConfigurationChanged(&args);
 }
 
 void InputReader::refreshConfigurationLocked(uint32_t changes) {
@@ -607,6 +773,7 @@ void InputReader::refreshConfigurationLocked(uint32_t changes) {
         if (changes & InputReaderConfiguration::CHANGE_MUST_REOPEN) {
             mEventHub->requestReopenDevices();
         } else {
+            waitForDeviceWorkersLocked();
             for (size_t i = 0; i < mDevices.size(); i++) {
                 InputDevice* device = mDevices.valueAt(i);
                 device->configure(now, &mConfig, changes);
@@ -622,6 +789,7 @@ void InputReader::updateGlobalMetaStateLocked() {
         InputDevice* device = mDevices.valueAt(i);
         mGlobalMetaState |= device->getMetaState();
     }
+    mSharedGlobalMetaState.store(mGlobalMetaState, std::memory_order_relaxed);
 }
 
 int32_t InputReader::getGlobalMetaStateLocked() {
@@ -643,6 +811,7 @@ void InputReader::getExternalStylusDevicesLocked(Vector<InputDeviceInfo>& outDev
 }
 
 void InputReader::dispatchExternalStylusState(const StylusState& state) {
+    waitForDeviceWorkersLocked();
     for (size_t i = 0; i < mDevices.size(); i++) {
         InputDevice* device = mDevices.valueAt(i);
         device->updateExternalStylusState(state);
@@ -668,6 +837,7 @@ bool InputReader::shouldDropVirtualKeyLocked(nsecs_t now,
 }
 
 void InputReader::fadePointerLocked() {
+    waitForDeviceWorkersLocked();
     for (size_t i = 0; i < mDevices.size(); i++) {
         InputDevice* device = mDevices.valueAt(i);
         device->fadePointer();
@@ -691,6 +861,7 @@ void InputReader::getInputDevices(Vector<InputDeviceInfo>& outInputDevices) {
 }
 
 void InputReader::getInputDevicesLocked(Vector<InputDeviceInfo>& outInputDevices) {
+    waitForDeviceWorkersLocked();
     outInputDevices.clear();
 
     size_t numDevices = mDevices.size();
@@ -725,6 +896,7 @@ int32_t InputReader::getSwitchState(int32_t deviceId, uint32_t sourceMask, int32
 
 int32_t InputReader::getStateLocked(int32_t deviceId, uint32_t sourceMask, int32_t code,
         GetStateFunc getStateFunc) {
+    waitForDeviceWorkersLocked();
     int32_t result = AKEY_STATE_UNKNOWN;
     if (deviceId >= 0) {
         ssize_t deviceIndex = mDevices.indexOfKey(deviceId);
@@ -843,6 +1015,7 @@ void InputReader::dump(String8& dump) {
 
     dump.append("Input Reader State:\n");
 
+    waitForDeviceWorkersLocked();
     for (size_t i = 0; i < mDevices.size(); i++) {
         mDevices.valueAt(i)->dump(dump);
     }
@@ -901,6 +1074,116 @@ void InputReader::dump(String8& dump) {
 
     dump.append(INDENT3 "Viewports:\n");
     mConfig.dump(dump);
+
+    dump.append(INDENT "Latency:\n");
+    mEventHubLatency.dump(dump, INDENT2);
+    mMapperLatency.dump(dump, INDENT2);
+
+    dump.appendFormat(INDENT "DeviceWorkers: %s\n", toString(mDeviceWorkersEnabled));
+    for (size_t i = 0; i < mDeviceWorkers.size(); i++) {
+        const DeviceWorker* worker = mDeviceWorkers[i].get();
+        if (worker->device) {
+            dump.appendFormat(INDENT2 "%d: %s\n", worker->device->getId(),
+                    worker->device->getName().string());
+        }
+    }
+}
+
+bool InputReader::shouldUseDeviceWorker(uint32_t classes) const {
+    // Only devices that are nothing but a touch screen or touch pad: their mappers don't
+    // share state with other devices beyond what ContextImpl guards.
+    const uint32_t touchClasses = INPUT_DEVICE_CLASS_TOUCH | INPUT_DEVICE_CLASS_TOUCH_MT;
+    return mDeviceWorkersEnabled && (classes & touchClasses)
+            && !(classes & ~(touchClasses | INPUT_DEVICE_CLASS_EXTERNAL));
+}
+
+InputReader::DeviceWorker* InputReader::getDeviceWorkerLocked(int32_t deviceId) const {
+    for (size_t i = 0; i < mDeviceWorkers.size(); i++) {
+        DeviceWorker* worker = mDeviceWorkers[i].get();
+        if (worker->device && worker->device->getId() == deviceId) {
+            return worker;
+        }
+    }
+    return NULL;
+}
+
+void InputReader::waitForDeviceWorkersLocked() {
+    ALOG_ASSERT(sCurrentDeviceWorker == NULL);
+    mDeviceWorkerWaiters += 1;
+    for (size_t i = 0; i < mDeviceWorkers.size(); ) {
+        if (mDeviceWorkers[i]->isBusy()) {
+            // Releases the lock, so start over once woken.
+            mDeviceWorkersIdleCondition.wait(mLock);
+            i = 0;
+        } else {
+            i++;
+        }
+    }
+    mDeviceWorkerWaiters -= 1;
+}
+
+void InputReader::mergeDeviceWorkerArgsLocked(Vector<NotifyArgs*>& outArgs) {
+    for (;;) {
+        // The queue with the oldest event, favoring the reader thread on ties.
+        TimestampedArgsQueue* queue = NULL;
+        const DeviceWorker* source = NULL;
+        if (!mReaderArgsQueue->isEmpty()) {
+            queue = mReaderArgsQueue.get();
+        }
+        for (size_t i = 0; i < mDeviceWorkers.size(); i++) {
+            const DeviceWorker* worker = mDeviceWorkers[i].get();
+            if (!worker->output->isEmpty() && (!queue
+                    || worker->output->getHeadEventTime() < queue->getHeadEventTime())) {
+                queue = worker->output.get();
+                source = worker;
+            }
+        }
+        if (!queue) {
+            break;
+        }
+
+        // Hold it back while another worker may still produce something older.
+        nsecs_t eventTime = queue->getHeadEventTime();
+        for (size_t i = 0; i < mDeviceWorkers.size(); i++) {
+            const DeviceWorker* worker = mDeviceWorkers[i].get();
+            if (worker != source && worker->isBusy() && worker->busySince <= eventTime) {
+                queue = NULL;
+                break;
+            }
+        }
+        if (!queue) {
+            break;
+        }
+        outArgs.push(queue->popHead());
+    }
+
+    // Forget the workers of removed devices once everything they produced is out.
+    for (size_t i = mDeviceWorkers.size(); i > 0; ) {
+        i--;
+        const DeviceWorker* worker = mDeviceWorkers[i].get();
+        if (worker->exiting && !worker->isBusy() && worker->output->isEmpty()) {
+            mDeviceWorkers.removeAt(i);
+        }
+    }
+}
+
+void InputReader::deliverMergedArgs() {
+    // Called by the reader thread and the workers, so that events are delivered as soon as
+    // nothing older can come from anywhere else.  The delivery lock keeps the batches that
+    // they merged in order.
+    AutoMutex _d(mDeliveryLock);
+
+    Vector<NotifyArgs*> args;
+    { // acquire lock
+        AutoMutex _l(mLock);
+        mergeDeviceWorkerArgsLocked(args);
+    } // release lock
+
+    for (size_t i = 0; i < args.size(); i++) {
+        args[i]->notify(mQueuedListener);
+        delete args[i];
+    }
+    mQueuedListener->flush();
 }
 
 void InputReader::monitor() {
@@ -917,48 +1200,82 @@ void InputReader::monitor() {
 
 // --- InputReader::ContextImpl ---
 
+// Takes the reader lock when called on a device worker, which runs without it.
+class InputReader::DeviceWorkerAutoMutex {
+public:
+    explicit DeviceWorkerAutoMutex(Mutex& lock) : mLock(sCurrentDeviceWorker ? &lock : NULL) {
+        if (mLock) {
+            mLock->lock();
+        }
+    }
+    ~DeviceWorkerAutoMutex() {
+        if (mLock) {
+            mLock->unlock();
+        }
+    }
+
+private:
+    Mutex* mLock;
+};
+
 InputReader::ContextImpl::ContextImpl(InputReader* reader) :
         mReader(reader) {
 }
 
 void InputReader::ContextImpl::updateGlobalMetaState() {
-    // lock is already held by the input loop
+    // lock is already held by the input loop, unless on a device worker
+    DeviceWorkerAutoMutex _l(mReader->mLock);
     mReader->updateGlobalMetaStateLocked();
 }
 
 int32_t InputReader::ContextImpl::getGlobalMetaState() {
+    if (sCurrentDeviceWorker) {
+        return mReader->mSharedGlobalMetaState.load(std::memory_order_relaxed);
+    }
     // lock is already held by the input loop
     return mReader->getGlobalMetaStateLocked();
 }
 
 void InputReader::ContextImpl::disableVirtualKeysUntil(nsecs_t time) {
-    // lock is already held by the input loop
+    // lock is already held by the input loop, unless on a device worker
+    DeviceWorkerAutoMutex _l(mReader->mLock);
     mReader->disableVirtualKeysUntilLocked(time);
 }
 
 bool InputReader::ContextImpl::shouldDropVirtualKey(nsecs_t now,
         InputDevice* device, int32_t keyCode, int32_t scanCode) {
-    // lock is already held by the input loop
+    // lock is already held by the input loop, unless on a device worker
+    DeviceWorkerAutoMutex _l(mReader->mLock);
     return mReader->shouldDropVirtualKeyLocked(now, device, keyCode, scanCode);
 }
 
 void InputReader::ContextImpl::fadePointer() {
+    if (sCurrentDeviceWorker) {
+        // The other devices belong to the reader thread.
+        AutoMutex _l(mReader->mLock);
+        mReader->mFadePointerRequested = true;
+        mReader->mEventHub->wake();
+        return;
+    }
     // lock is already held by the input loop
     mReader->fadePointerLocked();
 }
 
 void InputReader::ContextImpl::requestTimeoutAtTime(nsecs_t when) {
-    // lock is already held by the input loop
+    // lock is already held by the input loop, unless on a device worker
+    DeviceWorkerAutoMutex _l(mReader->mLock);
     mReader->requestTimeoutAtTimeLocked(when);
 }
 
 int32_t InputReader::ContextImpl::bumpGeneration() {
-    // lock is already held by the input loop
+    // lock is already held by the input loop, unless on a device worker
+    DeviceWorkerAutoMutex _l(mReader->mLock);
     return mReader->bumpGenerationLocked();
 }
 
 void InputReader::ContextImpl::getExternalStylusDevices(Vector<InputDeviceInfo>& outDevices) {
     // lock is already held by whatever called refreshConfigurationLocked
+    DeviceWorkerAutoMutex _l(mReader->mLock);
     mReader->getExternalStylusDevicesLocked(outDevices);
 }
 
@@ -971,6 +1288,12 @@ InputReaderPolicyInterface* InputReader::ContextImpl::getPolicy() {
 }
 
 InputListenerInterface* InputReader::ContextImpl::getListener() {
+    if (sCurrentDeviceWorker) {
+        return sCurrentDeviceWorker->staging.get();
+    }
+    if (mReader->mDeviceWorkersEnabled) {
+        return mReader->mReaderArgsQueue.get();
+    }
     return mReader->mQueuedListener.get();
 }
 
@@ -4112,6 +4435,60 @@ void TouchInputMapper::dumpAffineTransformation(String8& dump) {
 void TouchInputMapper::updateAffineTransformation() {
     mAffineTransform = getPolicy()->getTouchAffineTransformation(mDevice->getDescriptor(),
             mSurfaceOrientation);
+    updateCookingTransform();
+}
+
+void TouchInputMapper::updateCookingTransform() {
+    // Each surface coordinate is p * t + q for one coordinate t out of the location
+    // calibration, which is itself affine in the raw coordinates.
+    bool swapAxes;
+    double xp, xq, yp, yq;
+    switch (mSurfaceOrientation) {
+    case DISPLAY_ORIENTATION_90:
+        swapAxes = true;
+        xp = mYScale;
+        xq = mYTranslate - double(mRawPointerAxes.y.minValue) * mYScale;
+        yp = -mXScale;
+        yq = mXTranslate + double(mRawPointerAxes.x.maxValue) * mXScale;
+        mCookingTransform.orientationOffset = -M_PI_2;
+        break;
+    case DISPLAY_ORIENTATION_180:
+        swapAxes = false;
+        xp = -mXScale;
+        xq = mXTranslate + double(mRawPointerAxes.x.maxValue) * mXScale;
+        yp = -mYScale;
+        yq = mYTranslate + double(mRawPointerAxes.y.maxValue) * mYScale;
+        mCookingTransform.orientationOffset = -M_PI;
+        break;
+    case DISPLAY_ORIENTATION_270:
+        swapAxes = true;
+        xp = -mYScale;
+        xq = mYTranslate + double(mRawPointerAxes.y.maxValue) * mYScale;
+        yp = mXScale;
+        yq = mXTranslate - double(mRawPointerAxes.x.minValue) * mXScale;
+        mCookingTransform.orientationOffset = M_PI_2;
+        break;
+    default:
+        swapAxes = false;
+        xp = mXScale;
+        xq = mXTranslate - double(mRawPointerAxes.x.minValue) * mXScale;
+        yp = mYScale;
+        yq = mYTranslate - double(mRawPointerAxes.y.minValue) * mYScale;
+        mCookingTransform.orientationOffset = 0;
+        break;
+    }
+
+    const TouchAffineTransformation& a = mAffineTransform;
+    const double xRow[3] = { a.x_scale, a.x_ymix, a.x_offset };
+    const double yRow[3] = { a.y_xmix, a.y_scale, a.y_offset };
+    const double* xSource = swapAxes ? yRow : xRow;
+    const double* ySource = swapAxes ? xRow : yRow;
+    mCookingTransform.xScale = xp * xSource[0];
+    mCookingTransform.xYMix = xp * xSource[1];
+    mCookingTransform.xOffset = xp * xSource[2] + xq;
+    mCookingTransform.yXMix = yp * ySource[0];
+    mCookingTransform.yScale = yp * ySource[1];
+    mCookingTransform.yOffset = yp * ySource[2] + yq;
 }
 
 void TouchInputMapper::reset(nsecs_t when) {
@@ -4797,6 +5174,11 @@ void TouchInputMapper::cookPointerData() {
         mCurrentCookedState.buttonState = mCurrentRawState.buttonState;
     }
 
+    const uint32_t touchingCount = mCurrentRawState.rawPointerData.touchingIdBits.count();
+    const CookingTransform& transform = mCookingTransform;
+    const bool haveCoverageBox =
+            mCalibration.coverageCalibration == Calibration::COVERAGE_CALIBRATION_BOX;
+
     // Walk through the the active pointers and map device coordinates onto
     // surface coordinates and adjust for display orientation.
     for (uint32_t i = 0; i < currentPointerCount; i++) {
@@ -4839,8 +5221,6 @@ void TouchInputMapper::cookPointerData() {
             }
 
             if (mCalibration.haveSizeIsSummed && mCalibration.sizeIsSummed) {
-                uint32_t touchingCount =
-                        mCurrentRawState.rawPointerData.touchingIdBits.count();
                 if (touchingCount > 1) {
                     touchMajor /= touchingCount;
                     touchMinor /= touchingCount;
@@ -4938,96 +5318,44 @@ void TouchInputMapper::cookPointerData() {
             distance = 0;
         }
 
-        // Coverage
-        int32_t rawLeft, rawTop, rawRight, rawBottom;
-        switch (mCalibration.coverageCalibration) {
-        case Calibration::COVERAGE_CALIBRATION_BOX:
-            rawLeft = (in.toolMinor & 0xffff0000) >> 16;
-            rawRight = in.toolMinor & 0x0000ffff;
-            rawBottom = in.toolMajor & 0x0000ffff;
-            rawTop = (in.toolMajor & 0xffff0000) >> 16;
-            break;
-        default:
-            rawLeft = rawTop = rawRight = rawBottom = 0;
-            break;
-        }
-
-        // Adjust X,Y coords for device calibration
-        // TODO: Adjust coverage coords?
-        float xTransformed = in.x, yTransformed = in.y;
-        mAffineTransform.applyTo(xTransformed, yTransformed);
-
-        // Adjust X, Y, and coverage coords for surface orientation.
-        float x, y;
-        float left, top, right, bottom;
-
-        switch (mSurfaceOrientation) {
-        case DISPLAY_ORIENTATION_90:
-            x = float(yTransformed - mRawPointerAxes.y.minValue) * mYScale + mYTranslate;
-            y = float(mRawPointerAxes.x.maxValue - xTransformed) * mXScale + mXTranslate;
-            left = float(rawTop - mRawPointerAxes.y.minValue) * mYScale + mYTranslate;
-            right = float(rawBottom- mRawPointerAxes.y.minValue) * mYScale + mYTranslate;
-            bottom = float(mRawPointerAxes.x.maxValue - rawLeft) * mXScale + mXTranslate;
-            top = float(mRawPointerAxes.x.maxValue - rawRight) * mXScale + mXTranslate;
-            orientation -= M_PI_2;
-            if (mOrientedRanges.haveOrientation && orientation < mOrientedRanges.orientation.min) {
-                orientation += (mOrientedRanges.orientation.max - mOrientedRanges.orientation.min);
-            }
-            break;
-        case DISPLAY_ORIENTATION_180:
-            x = float(mRawPointerAxes.x.maxValue - xTransformed) * mXScale + mXTranslate;
-            y = float(mRawPointerAxes.y.maxValue - yTransformed) * mYScale + mYTranslate;
-            left = float(mRawPointerAxes.x.maxValue - rawRight) * mXScale + mXTranslate;
-            right = float(mRawPointerAxes.x.maxValue - rawLeft) * mXScale + mXTranslate;
-            bottom = float(mRawPointerAxes.y.maxValue - rawTop) * mYScale + mYTranslate;
-            top = float(mRawPointerAxes.y.maxValue - rawBottom) * mYScale + mYTranslate;
-            orientation -= M_PI;
-            if (mOrientedRanges.haveOrientation && orientation < mOrientedRanges.orientation.min) {
-                orientation += (mOrientedRanges.orientation.max - mOrientedRanges.orientation.min);
-            }
-            break;
-        case DISPLAY_ORIENTATION_270:
-            x = float(mRawPointerAxes.y.maxValue - yTransformed) * mYScale + mYTranslate;
-            y = float(xTransformed - mRawPointerAxes.x.minValue) * mXScale + mXTranslate;
-            left = float(mRawPointerAxes.y.maxValue - rawBottom) * mYScale + mYTranslate;
-            right = float(mRawPointerAxes.y.maxValue - rawTop) * mYScale + mYTranslate;
-            bottom = float(rawRight - mRawPointerAxes.x.minValue) * mXScale + mXTranslate;
-            top = float(rawLeft - mRawPointerAxes.x.minValue) * mXScale + mXTranslate;
-            orientation += M_PI_2;
-            if (mOrientedRanges.haveOrientation && orientation > mOrientedRanges.orientation.max) {
-                orientation -= (mOrientedRanges.orientation.max - mOrientedRanges.orientation.min);
+        // Adjust X and Y for device calibration and surface orientation.
+        float x = transform.xScale * in.x + transform.xYMix * in.y + transform.xOffset;
+        float y = transform.yXMix * in.x + transform.yScale * in.y + transform.yOffset;
+
+        // Adjust orientation for surface orientation.
+        if (transform.orientationOffset) {
+            orientation += transform.orientationOffset;
+            if (mOrientedRanges.haveOrientation) {
+                if (transform.orientationOffset < 0
+                        && orientation < mOrientedRanges.orientation.min) {
+                    orientation += (mOrientedRanges.orientation.max
+                            - mOrientedRanges.orientation.min);
+                } else if (transform.orientationOffset > 0
+                        && orientation > mOrientedRanges.orientation.max) {
+                    orientation -= (mOrientedRanges.orientation.max
+                            - mOrientedRanges.orientation.min);
+                }
             }
-            break;
-        default:
-            x = float(xTransformed - mRawPointerAxes.x.minValue) * mXScale + mXTranslate;
-            y = float(yTransformed - mRawPointerAxes.y.minValue) * mYScale + mYTranslate;
-            left = float(rawLeft - mRawPointerAxes.x.minValue) * mXScale + mXTranslate;
-            right = float(rawRight - mRawPointerAxes.x.minValue) * mXScale + mXTranslate;
-            bottom = float(rawBottom - mRawPointerAxes.y.minValue) * mYScale + mYTranslate;
-            top = float(rawTop - mRawPointerAxes.y.minValue) * mYScale + mYTranslate;
-            break;
         }
 
-        // Write output coords.
+        // Write output coords. The axes go in ascending order, so they can be appended.
         PointerCoords& out = mCurrentCookedState.cookedPointerData.pointerCoords[i];
         out.clear();
-        out.setAxisValue(AMOTION_EVENT_AXIS_X, x);
-        out.setAxisValue(AMOTION_EVENT_AXIS_Y, y);
-        out.setAxisValue(AMOTION_EVENT_AXIS_PRESSURE, pressure);
-        out.setAxisValue(AMOTION_EVENT_AXIS_SIZE, size);
-        out.setAxisValue(AMOTION_EVENT_AXIS_TOUCH_MAJOR, touchMajor);
-        out.setAxisValue(AMOTION_EVENT_AXIS_TOUCH_MINOR, touchMinor);
-        out.setAxisValue(AMOTION_EVENT_AXIS_ORIENTATION, orientation);
-        out.setAxisValue(AMOTION_EVENT_AXIS_TILT, tilt);
-        out.setAxisValue(AMOTION_EVENT_AXIS_DISTANCE, distance);
-        if (mCalibration.coverageCalibration == Calibration::COVERAGE_CALIBRATION_BOX) {
-            out.setAxisValue(AMOTION_EVENT_AXIS_GENERIC_1, left);
-            out.setAxisValue(AMOTION_EVENT_AXIS_GENERIC_2, top);
-            out.setAxisValue(AMOTION_EVENT_AXIS_GENERIC_3, right);
-            out.setAxisValue(AMOTION_EVENT_AXIS_GENERIC_4, bottom);
-        } else {
-            out.setAxisValue(AMOTION_EVENT_AXIS_TOOL_MAJOR, toolMajor);
-            out.setAxisValue(AMOTION_EVENT_AXIS_TOOL_MINOR, toolMinor);
+        appendAxisValue(out, AMOTION_EVENT_AXIS_X, x);
+        appendAxisValue(out, AMOTION_EVENT_AXIS_Y, y);
+        appendAxisValue(out, AMOTION_EVENT_AXIS_PRESSURE, pressure);
+        appendAxisValue(out, AMOTION_EVENT_AXIS_SIZE, size);
+        appendAxisValue(out, AMOTION_EVENT_AXIS_TOUCH_MAJOR, touchMajor);
+        appendAxisValue(out, AMOTION_EVENT_AXIS_TOUCH_MINOR, touchMinor);
+        if (!haveCoverageBox) {
+            appendAxisValue(out, AMOTION_EVENT_AXIS_TOOL_MAJOR, toolMajor);
+            appendAxisValue(out, AMOTION_EVENT_AXIS_TOOL_MINOR, toolMinor);
+        }
+        appendAxisValue(out, AMOTION_EVENT_AXIS_ORIENTATION, orientation);
+        appendAxisValue(out, AMOTION_EVENT_AXIS_DISTANCE, distance);
+        appendAxisValue(out, AMOTION_EVENT_AXIS_TILT, tilt);
+        if (haveCoverageBox) {
+            cookCoverageBox(in, &out);
         }
 
         // Write output properties.
@@ -5043,6 +5371,49 @@ void TouchInputMapper::cookPointerData() {
     }
 }
 
+void TouchInputMapper::cookCoverageBox(const RawPointerData::Pointer& in,
+        PointerCoords* out) const {
+    int32_t rawLeft = (in.toolMinor & 0xffff0000) >> 16;
+    int32_t rawRight = in.toolMinor & 0x0000ffff;
+    int32_t rawBottom = in.toolMajor & 0x0000ffff;
+    int32_t rawTop = (in.toolMajor & 0xffff0000) >> 16;
+
+    // Adjust coverage coords for surface orientation.
+    // TODO: Adjust coverage coords for device calibration?
+    float left, top, right, bottom;
+    switch (mSurfaceOrientation) {
+    case DISPLAY_ORIENTATION_90:
+        left = float(rawTop - mRawPointerAxes.y.minValue) * mYScale + mYTranslate;
+        right = float(rawBottom- mRawPointerAxes.y.minValue) * mYScale + mYTranslate;
+        bottom = float(mRawPointerAxes.x.maxValue - rawLeft) * mXScale + mXTranslate;
+        top = float(mRawPointerAxes.x.maxValue - rawRight) * mXScale + mXTranslate;
+        break;
+    case DISPLAY_ORIENTATION_180:
+        left = float(mRawPointerAxes.x.maxValue - rawRight) * mXScale + mXTranslate;
+        right = float(mRawPointerAxes.x.maxValue - rawLeft) * mXScale + mXTranslate;
+        bottom = float(mRawPointerAxes.y.maxValue - rawTop) * mYScale + mYTranslate;
+        top = float(mRawPointerAxes.y.maxValue - rawBottom) * mYScale + mYTranslate;
+        break;
+    case DISPLAY_ORIENTATION_270:
+        left = float(mRawPointerAxes.y.maxValue - rawBottom) * mYScale + mYTranslate;
+        right = float(mRawPointerAxes.y.maxValue - rawTop) * mYScale + mYTranslate;
+        bottom = float(rawRight - mRawPointerAxes.x.minValue) * mXScale + mXTranslate;
+        top = float(rawLeft - mRawPointerAxes.x.minValue) * mXScale + mXTranslate;
+        break;
+    default:
+        left = float(rawLeft - mRawPointerAxes.x.minValue) * mXScale + mXTranslate;
+        right = float(rawRight - mRawPointerAxes.x.minValue) * mXScale + mXTranslate;
+        bottom = float(rawBottom - mRawPointerAxes.y.minValue) * mYScale + mYTranslate;
+        top = float(rawTop - mRawPointerAxes.y.minValue) * mYScale + mYTranslate;
+        break;
+    }
+
+    appendAxisValue(*out, AMOTION_EVENT_AXIS_GENERIC_1, left);
+    appendAxisValue(*out, AMOTION_EVENT_AXIS_GENERIC_2, top);
+    appendAxisValue(*out, AMOTION_EVENT_AXIS_GENERIC_3, right);
+    appendAxisValue(*out, AMOTION_EVENT_AXIS_GENERIC_4, bottom);
+}
+
 void TouchInputMapper::dispatchPointerUsage(nsecs_t when, uint32_t policyFlags,
         PointerUsage pointerUsage) {
     if (pointerUsage != mPointerUsage) {
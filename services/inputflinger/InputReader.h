@@ -20,6 +20,7 @@
 #include "EventHub.h"
 #include "PointerControllerInterface.h"
 #include "InputListener.h"
+#include "InputLatencyStats.h"
 
 #include <input/DisplayViewport.h>
 #include <input/Input.h>
@@ -36,6 +37,8 @@
 #include <stddef.h>
 #include <unistd.h>
 
+#include <atomic>
+
 // Maximum supported size of a vibration pattern.
 // Must be at least 2.
 #define MAX_VIBRATE_PATTERN_SIZE 100
@@ -470,6 +473,12 @@ private:
 
     KeyedVector<int32_t, InputDevice*> mDevices;
 
+    // evdev timestamp -> returned by getEvents, per SYN_REPORT, and the time the
+    // input mappers then take to process the batch.
+    LatencyHistogram mEventHubLatency;
+    LatencyHistogram mMapperLatency;
+    void recordEventHubLatencyLocked(nsecs_t readTime, const RawEvent* rawEvents, size_t count);
+
     // low-level input event decoding and device management
     void processEventsLocked(const RawEvent* rawEvents, size_t count);
 
@@ -512,6 +521,41 @@ private:
             GetStateFunc getStateFunc);
     bool markSupportedKeyCodesLocked(int32_t deviceId, uint32_t sourceMask, size_t numCodes,
             const int32_t* keyCodes, uint8_t* outFlags);
+
+    // Device workers.
+    // With input.reader.device_workers set, the mappers of each touch-only device run on a
+    // worker thread of their own, so that cooking the touches of one device doesn't hold up
+    // the events of the others.  The workers and the reader thread queue what they produce,
+    // and the queues are merged in event time order on the way to the listener: an event is
+    // only delivered once no worker is still processing raw events older than it.
+    //
+    // A device owned by a worker is only handled by the reader thread (or by the other
+    // methods of the reader) after waitForDeviceWorkersLocked() returns.
+    class DeviceWorker;
+    class DeviceWorkerAutoMutex;
+
+    // The worker whose thread is running, if any.  Lets ContextImpl tell the workers, which
+    // don't hold the reader lock, from the reader thread and the binder threads, which do.
+    static thread_local DeviceWorker* sCurrentDeviceWorker;
+
+    bool mDeviceWorkersEnabled;
+    Vector<sp<DeviceWorker> > mDeviceWorkers;
+    Condition mDeviceWorkersIdleCondition;
+    int32_t mDeviceWorkerWaiters;
+    // What the reader thread produces while device workers are enabled.
+    sp<TimestampedArgsQueue> mReaderArgsQueue;
+    // Serializes delivery to the listener, which happens outside of mLock.
+    Mutex mDeliveryLock;
+    // A copy of mGlobalMetaState for the workers, which read it without mLock.
+    std::atomic<int32_t> mSharedGlobalMetaState;
+    // Set by a worker for the reader thread, which owns the other devices.
+    bool mFadePointerRequested;
+
+    bool shouldUseDeviceWorker(uint32_t classes) const;
+    DeviceWorker* getDeviceWorkerLocked(int32_t deviceId) const;
+    void waitForDeviceWorkersLocked();
+    void mergeDeviceWorkerArgsLocked(Vector<NotifyArgs*>& outArgs);
+    void deliverMergedArgs();
 };
 
 
@@ -1474,6 +1518,7 @@ protected:
     virtual void resolveCalibration();
     virtual void dumpCalibration(String8& dump);
     virtual void updateAffineTransformation();
+    void updateCookingTransform();
     virtual void dumpAffineTransformation(String8& dump);
     virtual void resolveExternalStylusPresence();
     virtual bool hasStylus() const = 0;
@@ -1509,6 +1554,15 @@ private:
     float mYScale;
     float mYPrecision;
 
+    // The location calibration, surface orientation, scale and translation fused into one
+    // transform from raw to surface coordinates, with the offset the surface orientation
+    // adds to pointer orientations. Updated along with mAffineTransform.
+    struct CookingTransform {
+        float xScale, xYMix, xOffset; // x = xScale * rawX + xYMix * rawY + xOffset
+        float yXMix, yScale, yOffset; // y = yXMix * rawX + yScale * rawY + yOffset
+        double orientationOffset;
+    } mCookingTransform;
+
     float mGeometricScale;
 
     float mPressureScale;
@@ -1787,6 +1841,7 @@ private:
     void dispatchButtonPress(nsecs_t when, uint32_t policyFlags);
     const BitSet32& findActiveIdBits(const CookedPointerData& cookedPointerData);
     void cookPointerData();
+    void cookCoverageBox(const RawPointerData::Pointer& in, PointerCoords* out) const;
     void abortTouches(nsecs_t when, uint32_t policyFlags);
 
     void dispatchPointerUsage(nsecs_t when, uint32_t policyFlags, PointerUsage pointerUsage);
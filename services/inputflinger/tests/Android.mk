@@ -36,5 +36,15 @@ $(foreach file,$(test_src_files), \
     $(eval include $(BUILD_NATIVE_TEST)) \
 )
 
+# Build the replay benchmark.
+include $(CLEAR_VARS)
+LOCAL_SHARED_LIBRARIES := $(shared_libraries)
+LOCAL_C_INCLUDES := $(c_includes)
+LOCAL_CFLAGS += -Wno-unused-parameter
+LOCAL_SRC_FILES := InputPipeline_benchmark.cpp
+LOCAL_MODULE := inputflinger_replay_benchmark
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_EXECUTABLE)
+
 # Build the manual test programs.
 include $(call all-makefiles-under, $(LOCAL_PATH))
@@ -253,4 +253,30 @@ TEST_F(InputDispatcherTest, InjectInputEvent_ValidatesMotionEvents) {
             << "Should reject motion events with duplicate pointer ids.";
 }
 
+TEST_F(InputDispatcherTest, GetConnectionStats_FollowsRegisteredChannels) {
+    sp<InputChannel> serverChannel, clientChannel;
+    ASSERT_EQ(OK, InputChannel::openInputChannelPair(String8("channel name"),
+            serverChannel, clientChannel));
+
+    Vector<InputConnectionStats> stats;
+    mDispatcher->getConnectionStats(stats);
+    ASSERT_EQ(0U, stats.size());
+
+    ASSERT_EQ(OK, mDispatcher->registerInputChannel(serverChannel, NULL, /*monitor*/ true));
+    mDispatcher->getConnectionStats(stats);
+    ASSERT_EQ(1U, stats.size());
+    ASSERT_STREQ("channel name", stats[0].inputChannelName.string());
+    ASSERT_TRUE(stats[0].monitor);
+    ASSERT_EQ(0U, stats[0].outboundQueueLength);
+    ASSERT_EQ(0U, stats[0].waitQueueLength);
+    ASSERT_EQ(0, stats[0].waitQueueHeadAge);
+    ASSERT_EQ(0U, stats[0].finishedEventCount);
+    ASSERT_EQ(0U, stats[0].droppedEventCount);
+    ASSERT_EQ(0U, stats[0].timeoutCount);
+
+    ASSERT_EQ(OK, mDispatcher->unregisterInputChannel(serverChannel));
+    mDispatcher->getConnectionStats(stats);
+    ASSERT_EQ(0U, stats.size());
+}
+
 } // namespace android
@@ -0,0 +1,993 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Replays an evdev stream through the input reader and the input dispatcher, into a grid
+ * of fake windows, and reports the throughput and the latency of each stage.
+ *
+ * The stream is either a numeric getevent dump, as written by "getevent -t", or by default
+ * a synthetic ten finger touch screen at 240 Hz. Devices are inferred from the dump: those
+ * with multi-touch or single touch position axes are replayed as touch screens, with the
+ * axis ranges seen in the dump, and the events of any other device are dropped.
+ *
+ * By default frames are replayed as fast as the reader takes them, which measures the
+ * throughput. With -p they are replayed at their recorded times, which measures latency.
+ *
+ * Usage: inputflinger_replay_benchmark [-f getevent.txt] [-p] [-w windows]
+ *         [-n fingers] [-r rate] [-s seconds]
+ */
+
+#define LOG_TAG "InputPipelineBenchmark"
+
+#include "../InputDispatcher.h"
+#include "../InputReader.h"
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <linux/input.h>
+#include <math.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <utils/KeyedVector.h>
+#include <utils/Log.h>
+#include <utils/Thread.h>
+
+namespace android {
+
+// Display properties of the replay.
+static const int32_t DISPLAY_ID = 0;
+static const int32_t DISPLAY_WIDTH = 1080;
+static const int32_t DISPLAY_HEIGHT = 1920;
+
+// Defaults of the synthetic stream.
+static const int32_t DEFAULT_FINGER_COUNT = 10;
+static const int32_t DEFAULT_RATE_HZ = 240;
+static const int32_t DEFAULT_DURATION_SECONDS = 10;
+static const int32_t DEFAULT_WINDOW_COUNT = 16;
+
+// How long deliveries have to stop for after the last frame before the replay ends.
+static const nsecs_t DRAIN_TIMEOUT = 500 * 1000000LL; // 500 ms
+
+// Dispatching timeout of the windows; consumers finish everything at once, so it is never hit.
+static const nsecs_t DISPATCHING_TIMEOUT = 5000 * 1000000LL; // 5 sec
+
+// How long window threads wait for an event before checking whether to exit.
+static const int CONSUMER_POLL_TIMEOUT_MILLIS = 100;
+
+// Nanoseconds per second.
+static const nsecs_t NANOS_PER_SECOND = 1000000000LL;
+
+
+// --- Recording ---
+
+/* An evdev stream to replay, with the devices it came from. */
+struct Recording {
+    struct Device {
+        String8 path;
+        uint32_t classes;
+        KeyedVector<int32_t, RawAbsoluteAxisInfo> absoluteAxes;
+        KeyedVector<int32_t, bool> scanCodes;
+    };
+
+    /* The events of a frame, up to and including its SYN_REPORT. */
+    struct Frame {
+        nsecs_t offset; // recorded time of the frame since the first frame
+        size_t firstEvent;
+        size_t eventCount;
+    };
+
+    Vector<Device> devices;
+    // Device ids are indices into devices; times are offsets since the first event.
+    Vector<RawEvent> events;
+    Vector<Frame> frames;
+
+    bool load(const char* path);
+    void synthesize(int32_t fingerCount, int32_t rateHz, int32_t durationSeconds);
+
+private:
+    size_t getDeviceIndex(const String8& path);
+    void addEvent(nsecs_t offset, int32_t deviceIndex, int32_t type, int32_t code, int32_t value);
+    void inferDevices();
+    void setAxisRange(size_t deviceIndex, int32_t axis, int32_t minValue, int32_t maxValue);
+    void splitFrames();
+};
+
+bool Recording::load(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Could not open %s.\n", path);
+        return false;
+    }
+
+    // Lines look like "[   1234.567890] /dev/input/event2: 0003 0035 000001a4", without the
+    // device when getevent was given one. Anything else, such as the device list getevent
+    // starts with, is skipped.
+    char line[256];
+    char devicePath[128];
+    nsecs_t firstTime = -1;
+    while (fgets(line, sizeof(line), file)) {
+        double seconds;
+        unsigned int type, code, value;
+        if (sscanf(line, " [ %lf] %127[^:]: %x %x %x", &seconds, devicePath,
+                &type, &code, &value) != 5) {
+            if (sscanf(line, " [ %lf] %x %x %x", &seconds, &type, &code, &value) != 4) {
+                continue;
+            }
+            snprintf(devicePath, sizeof(devicePath), "%s", path);
+        }
+        nsecs_t time = nsecs_t(seconds * NANOS_PER_SECOND);
+        if (firstTime < 0) {
+            firstTime = time;
+        }
+        addEvent(time - firstTime, getDeviceIndex(String8(devicePath)),
+                int32_t(type), int32_t(code), int32_t(value));
+    }
+    fclose(file);
+
+    if (events.isEmpty()) {
+        fprintf(stderr, "No events in %s; it should be a \"getevent -t\" dump.\n", path);
+        return false;
+    }
+    inferDevices();
+    splitFrames();
+    return !frames.isEmpty();
+}
+
+void Recording::synthesize(int32_t fingerCount, int32_t rateHz, int32_t durationSeconds) {
+    getDeviceIndex(String8("/dev/input/replay0"));
+
+    // One gesture a second: every finger goes down, circles for the second and lifts.
+    const int32_t framesPerGesture = rateHz;
+    const int32_t frameCount = rateHz * durationSeconds;
+    for (int32_t frame = 0; frame < frameCount; frame++) {
+        const nsecs_t offset = frame * NANOS_PER_SECOND / rateHz;
+        const int32_t gestureFrame = frame % framesPerGesture;
+        const float t = float(gestureFrame) / framesPerGesture;
+        for (int32_t finger = 0; finger < fingerCount; finger++) {
+            const float centerX = DISPLAY_WIDTH * (finger % 2 ? 0.7f : 0.3f);
+            const float centerY = DISPLAY_HEIGHT * (0.1f + 0.8f * (finger / 2) / 5);
+            const float angle = float(2 * M_PI) * (t + float(finger) / fingerCount);
+            addEvent(offset, 0, EV_ABS, ABS_MT_SLOT, finger);
+            if (gestureFrame == 0) {
+                const int32_t gesture = frame / framesPerGesture;
+                addEvent(offset, 0, EV_ABS, ABS_MT_TRACKING_ID,
+                        (gesture * fingerCount + finger) % 65536);
+            } else if (gestureFrame == framesPerGesture - 1) {
+                addEvent(offset, 0, EV_ABS, ABS_MT_TRACKING_ID, -1);
+                continue;
+            }
+            addEvent(offset, 0, EV_ABS, ABS_MT_POSITION_X, int32_t(centerX + 80 * cosf(angle)));
+            addEvent(offset, 0, EV_ABS, ABS_MT_POSITION_Y, int32_t(centerY + 80 * sinf(angle)));
+            addEvent(offset, 0, EV_ABS, ABS_MT_PRESSURE, 64);
+        }
+        if (gestureFrame == 0) {
+            addEvent(offset, 0, EV_KEY, BTN_TOUCH, 1);
+        } else if (gestureFrame == framesPerGesture - 1) {
+            addEvent(offset, 0, EV_KEY, BTN_TOUCH, 0);
+        }
+        addEvent(offset, 0, EV_SYN, SYN_REPORT, 0);
+    }
+
+    inferDevices();
+    // Give the axes the range of the display rather than the range the circles cover.
+    setAxisRange(0, ABS_MT_POSITION_X, 0, DISPLAY_WIDTH - 1);
+    setAxisRange(0, ABS_MT_POSITION_Y, 0, DISPLAY_HEIGHT - 1);
+    setAxisRange(0, ABS_MT_PRESSURE, 0, 255);
+    splitFrames();
+}
+
+size_t Recording::getDeviceIndex(const String8& path) {
+    for (size_t i = 0; i < devices.size(); i++) {
+        if (devices[i].path == path) {
+            return i;
+        }
+    }
+    Device device;
+    device.path = path;
+    device.classes = 0;
+    return devices.add(device);
+}
+
+void Recording::addEvent(nsecs_t offset, int32_t deviceIndex,
+        int32_t type, int32_t code, int32_t value) {
+    RawEvent event;
+    event.when = offset;
+    event.deviceId = deviceIndex;
+    event.type = type;
+    event.code = code;
+    event.value = value;
+    events.push(event);
+
+    Device& device = devices.editItemAt(deviceIndex);
+    if (type == EV_ABS) {
+        ssize_t index = device.absoluteAxes.indexOfKey(code);
+        if (index < 0) {
+            RawAbsoluteAxisInfo info;
+            info.clear();
+            info.valid = true;
+            info.minValue = value;
+            info.maxValue = value;
+            device.absoluteAxes.add(code, info);
+        } else {
+            RawAbsoluteAxisInfo& info = device.absoluteAxes.editValueAt(index);
+            info.minValue = value < info.minValue ? value : info.minValue;
+            info.maxValue = value > info.maxValue ? value : info.maxValue;
+        }
+    } else if (type == EV_KEY) {
+        device.scanCodes.add(code, true);
+    }
+}
+
+void Recording::inferDevices() {
+    for (size_t i = 0; i < devices.size(); i++) {
+        Device& device = devices.editItemAt(i);
+        KeyedVector<int32_t, RawAbsoluteAxisInfo>& axes = device.absoluteAxes;
+        if (axes.indexOfKey(ABS_MT_POSITION_X) >= 0 && axes.indexOfKey(ABS_MT_POSITION_Y) >= 0) {
+            device.classes = INPUT_DEVICE_CLASS_TOUCH | INPUT_DEVICE_CLASS_TOUCH_MT;
+        } else if (axes.indexOfKey(ABS_X) >= 0 && axes.indexOfKey(ABS_Y) >= 0) {
+            device.classes = INPUT_DEVICE_CLASS_TOUCH;
+        } else {
+            fprintf(stderr, "Dropping the events of %s, which is not a touch screen.\n",
+                    device.path.string());
+            continue;
+        }
+
+        // A dump only shows the values that were reached, so widen what cannot be inferred.
+        for (size_t j = 0; j < axes.size(); j++) {
+            RawAbsoluteAxisInfo& info = axes.editValueAt(j);
+            if (axes.keyAt(j) == ABS_MT_TRACKING_ID) {
+                info.minValue = 0;
+                info.maxValue = 65535;
+            } else if (axes.keyAt(j) == ABS_MT_SLOT) {
+                info.minValue = 0;
+            } else if (info.maxValue <= info.minValue) {
+                info.maxValue = info.minValue + 1;
+            }
+        }
+    }
+}
+
+void Recording::setAxisRange(size_t deviceIndex, int32_t axis,
+        int32_t minValue, int32_t maxValue) {
+    RawAbsoluteAxisInfo& info = devices.editItemAt(deviceIndex).absoluteAxes.editValueFor(axis);
+    info.minValue = minValue;
+    info.maxValue = maxValue;
+}
+
+void Recording::splitFrames() {
+    Vector<RawEvent> replayed;
+    Frame frame;
+    frame.firstEvent = 0;
+    frame.eventCount = 0;
+    for (size_t i = 0; i < events.size(); i++) {
+        const RawEvent& event = events[i];
+        if (!devices[event.deviceId].classes) {
+            continue;
+        }
+        if (!frame.eventCount) {
+            frame.offset = event.when;
+            frame.firstEvent = replayed.size();
+        }
+        replayed.push(event);
+        frame.eventCount += 1;
+        if (event.type == EV_SYN && event.code == SYN_REPORT) {
+            frames.push(frame);
+            frame.eventCount = 0;
+        }
+    }
+    events = replayed;
+}
+
+
+// --- ReplayTimeline ---
+
+/* The times at which replayed frames passed through the pipeline, keyed by event time. */
+class ReplayTimeline {
+public:
+    ReplayTimeline() : mDeliveryCount(0), mLastDeliveryTime(0) { }
+
+    /* Called when the reader hands the motion of a frame to the dispatcher. */
+    void recordQueued(nsecs_t eventTime, nsecs_t queueTime) {
+        AutoMutex _l(mLock);
+        // The reader may split a frame into several motions, such as a down and a move.
+        if (mFrames.indexOfKey(eventTime) >= 0) {
+            return;
+        }
+        FrameTimes times;
+        times.queueTime = queueTime;
+        times.deliveryCount = 0;
+        mFrames.add(eventTime, times);
+        mReadLatencies.push(queueTime - eventTime);
+    }
+
+    /* Called when a window receives a sample of a frame. */
+    void recordDelivered(nsecs_t eventTime, nsecs_t deliveryTime) {
+        AutoMutex _l(mLock);
+        ssize_t index = mFrames.indexOfKey(eventTime);
+        if (index < 0) {
+            return;
+        }
+        FrameTimes& times = mFrames.editValueAt(index);
+        times.deliveryCount += 1;
+        mDispatchLatencies.push(deliveryTime - times.queueTime);
+        mTotalLatencies.push(deliveryTime - eventTime);
+        mDeliveryCount += 1;
+        mLastDeliveryTime = deliveryTime;
+    }
+
+    /* Waits until no window received anything for the timeout. */
+    void waitForIdle(nsecs_t timeout) {
+        for (;;) {
+            usleep(useconds_t(timeout / 1000 / 10));
+            AutoMutex _l(mLock);
+            if (systemTime(SYSTEM_TIME_MONOTONIC) - mLastDeliveryTime >= timeout) {
+                return;
+            }
+        }
+    }
+
+    void dump(String8& dump, nsecs_t startTime, size_t frameCount, size_t eventCount);
+
+private:
+    struct FrameTimes {
+        nsecs_t queueTime;
+        uint32_t deliveryCount;
+    };
+
+    Mutex mLock;
+    KeyedVector<nsecs_t, FrameTimes> mFrames;
+    Vector<nsecs_t> mReadLatencies;
+    Vector<nsecs_t> mDispatchLatencies;
+    Vector<nsecs_t> mTotalLatencies;
+    size_t mDeliveryCount;
+    nsecs_t mLastDeliveryTime;
+
+    static int compareLatencies(const nsecs_t* lhs, const nsecs_t* rhs);
+    static void dumpLatencies(String8& dump, const char* stage, Vector<nsecs_t>& latencies);
+};
+
+int ReplayTimeline::compareLatencies(const nsecs_t* lhs, const nsecs_t* rhs) {
+    return *lhs < *rhs ? -1 : *lhs > *rhs;
+}
+
+void ReplayTimeline::dumpLatencies(String8& dump, const char* stage,
+        Vector<nsecs_t>& latencies) {
+    if (latencies.isEmpty()) {
+        dump.appendFormat("  %-10s %10s\n", stage, "-");
+        return;
+    }
+    latencies.sort(compareLatencies);
+    static const double PERCENTILES[] = { 50, 90, 99, 99.9 };
+    dump.appendFormat("  %-10s", stage);
+    for (size_t i = 0; i < sizeof(PERCENTILES) / sizeof(PERCENTILES[0]); i++) {
+        size_t index = size_t(PERCENTILES[i] / 100 * (latencies.size() - 1) + 0.5);
+        dump.appendFormat(" %10.1f", latencies[index] * 0.001);
+    }
+    dump.appendFormat(" %10.1f\n", latencies.top() * 0.001);
+}
+
+void ReplayTimeline::dump(String8& dump, nsecs_t startTime, size_t frameCount,
+        size_t eventCount) {
+    AutoMutex _l(mLock);
+    size_t deliveredFrameCount = 0;
+    for (size_t i = 0; i < mFrames.size(); i++) {
+        if (mFrames.valueAt(i).deliveryCount) {
+            deliveredFrameCount += 1;
+        }
+    }
+
+    const nsecs_t endTime = mLastDeliveryTime > startTime ? mLastDeliveryTime : startTime;
+    const double seconds = double(endTime - startTime) / NANOS_PER_SECOND;
+    dump.appendFormat("Replayed %zu frames of %zu evdev events in %0.3fs: "
+            "%0.0f events/s, %0.0f frames/s\n", frameCount, eventCount, seconds,
+            seconds > 0 ? eventCount / seconds : 0.0, seconds > 0 ? frameCount / seconds : 0.0);
+    dump.appendFormat("Frames queued to the dispatcher: %zu, delivered: %zu, "
+            "samples delivered: %zu\n", mFrames.size(), deliveredFrameCount, mDeliveryCount);
+    dump.appendFormat("Latency (us)     %10s %10s %10s %10s %10s\n",
+            "p50", "p90", "p99", "p99.9", "max");
+    dumpLatencies(dump, "read", mReadLatencies);
+    dumpLatencies(dump, "dispatch", mDispatchLatencies);
+    dumpLatencies(dump, "total", mTotalLatencies);
+}
+
+
+// --- ReplayEventHub ---
+
+/* Hands out the frames of a recording, stamped with the time they are handed out at. */
+class ReplayEventHub : public EventHubInterface {
+public:
+    ReplayEventHub(const Recording& recording, bool paced) :
+            mRecording(recording), mPaced(paced), mDevicesAdded(false),
+            mNextFrame(0), mNextFrameEvent(0), mStartTime(0), mLastEventTime(0) { }
+
+    inline bool isFinished() const { return mNextFrame >= mRecording.frames.size(); }
+    inline nsecs_t getStartTime() const { return mStartTime; }
+
+protected:
+    virtual ~ReplayEventHub() { }
+
+private:
+    const Recording& mRecording;
+    bool mPaced;
+    bool mDevicesAdded;
+    size_t mNextFrame;
+    size_t mNextFrameEvent; // index within the next frame, for frames larger than a buffer
+    nsecs_t mStartTime;
+    nsecs_t mLastEventTime;
+
+    const Recording::Device* getDevice(int32_t deviceId) const {
+        size_t index = size_t(deviceId - 1);
+        return index < mRecording.devices.size() ? &mRecording.devices[index] : NULL;
+    }
+
+    virtual size_t getEvents(int timeoutMillis, RawEvent* buffer, size_t bufferSize) {
+        const nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+        if (!mDevicesAdded) {
+            mDevicesAdded = true;
+            size_t count = 0;
+            for (size_t i = 0; i < mRecording.devices.size() && count + 1 < bufferSize; i++) {
+                if (mRecording.devices[i].classes) {
+                    buffer[count].when = now;
+                    buffer[count].deviceId = int32_t(i + 1);
+                    buffer[count].type = DEVICE_ADDED;
+                    buffer[count].code = 0;
+                    buffer[count].value = 0;
+                    count += 1;
+                }
+            }
+            buffer[count].when = now;
+            buffer[count].deviceId = 0;
+            buffer[count].type = FINISHED_DEVICE_SCAN;
+            buffer[count].code = 0;
+            buffer[count].value = 0;
+            return count + 1;
+        }
+
+        if (isFinished()) {
+            usleep(1000);
+            return 0;
+        }
+
+        const Recording::Frame& frame = mRecording.frames[mNextFrame];
+        if (!mStartTime) {
+            mStartTime = now;
+        }
+        if (mPaced && !mNextFrameEvent) {
+            const nsecs_t delay = mStartTime + frame.offset - now;
+            if (delay > 0) {
+                usleep(useconds_t(delay / 1000));
+            }
+        }
+
+        nsecs_t when = systemTime(SYSTEM_TIME_MONOTONIC);
+        if (when <= mLastEventTime) {
+            // Frames are told apart by their event times.
+            when = mLastEventTime + 1;
+        }
+        mLastEventTime = when;
+
+        size_t count = frame.eventCount - mNextFrameEvent;
+        if (count > bufferSize) {
+            count = bufferSize;
+        }
+        for (size_t i = 0; i < count; i++) {
+            buffer[i] = mRecording.events[frame.firstEvent + mNextFrameEvent + i];
+            buffer[i].when = when;
+            buffer[i].deviceId += 1;
+        }
+        mNextFrameEvent += count;
+        if (mNextFrameEvent == frame.eventCount) {
+            mNextFrameEvent = 0;
+            mNextFrame += 1;
+        }
+        return count;
+    }
+
+    virtual uint32_t getDeviceClasses(int32_t deviceId) const {
+        const Recording::Device* device = getDevice(deviceId);
+        return device ? device->classes : 0;
+    }
+
+    virtual InputDeviceIdentifier getDeviceIdentifier(int32_t deviceId) const {
+        const Recording::Device* device = getDevice(deviceId);
+        InputDeviceIdentifier identifier;
+        if (device) {
+            identifier.name = device->path;
+            identifier.location = device->path;
+            identifier.descriptor = device->path;
+        }
+        return identifier;
+    }
+
+    virtual int32_t getDeviceControllerNumber(int32_t) const {
+        return 0;
+    }
+
+    virtual void getConfiguration(int32_t, PropertyMap* outConfiguration) const {
+        outConfiguration->addProperty(String8("touch.deviceType"), String8("touchScreen"));
+    }
+
+    virtual status_t getAbsoluteAxisInfo(int32_t deviceId, int axis,
+            RawAbsoluteAxisInfo* outAxisInfo) const {
+        const Recording::Device* device = getDevice(deviceId);
+        ssize_t index = device ? device->absoluteAxes.indexOfKey(axis) : -1;
+        if (index < 0) {
+            outAxisInfo->clear();
+            return -1;
+        }
+        *outAxisInfo = device->absoluteAxes.valueAt(index);
+        return OK;
+    }
+
+    virtual bool hasRelativeAxis(int32_t, int) const {
+        return false;
+    }
+
+    virtual bool hasInputProperty(int32_t, int property) const {
+        return property == INPUT_PROP_DIRECT;
+    }
+
+    virtual status_t mapKey(int32_t, int32_t, int32_t, int32_t,
+            int32_t* outKeycode, int32_t* outMetaState, uint32_t* outFlags) const {
+        *outKeycode = 0;
+        *outMetaState = 0;
+        *outFlags = 0;
+        return NAME_NOT_FOUND;
+    }
+
+    virtual status_t mapAxis(int32_t, int32_t, AxisInfo*) const {
+        return NAME_NOT_FOUND;
+    }
+
+    virtual void setExcludedDevices(const Vector<String8>&) {
+    }
+
+    virtual int32_t getScanCodeState(int32_t, int32_t) const {
+        return AKEY_STATE_UP;
+    }
+
+    virtual int32_t getKeyCodeState(int32_t, int32_t) const {
+        return AKEY_STATE_UP;
+    }
+
+    virtual int32_t getSwitchState(int32_t, int32_t) const {
+        return AKEY_STATE_UP;
+    }
+
+    virtual status_t getAbsoluteAxisValue(int32_t, int32_t, int32_t* outValue) const {
+        *outValue = 0;
+        return -1;
+    }
+
+    virtual bool markSupportedKeyCodes(int32_t, size_t, const int32_t*, uint8_t*) const {
+        return false;
+    }
+
+    virtual bool hasScanCode(int32_t deviceId, int32_t scanCode) const {
+        const Recording::Device* device = getDevice(deviceId);
+        return device && device->scanCodes.indexOfKey(scanCode) >= 0;
+    }
+
+    virtual bool hasLed(int32_t, int32_t) const {
+        return false;
+    }
+
+    virtual void setLedState(int32_t, int32_t, bool) {
+    }
+
+    virtual void getVirtualKeyDefinitions(int32_t, Vector<VirtualKeyDefinition>&) const {
+    }
+
+    virtual sp<KeyCharacterMap> getKeyCharacterMap(int32_t) const {
+        return NULL;
+    }
+
+    virtual bool setKeyboardLayoutOverlay(int32_t, const sp<KeyCharacterMap>&) {
+        return false;
+    }
+
+    virtual void vibrate(int32_t, nsecs_t) {
+    }
+
+    virtual void cancelVibrate(int32_t) {
+    }
+
+    virtual void requestReopenDevices() {
+    }
+
+    virtual void wake() {
+    }
+
+    virtual void dump(String8&) {
+    }
+
+    virtual void monitor() {
+    }
+};
+
+
+// --- ReplayReaderPolicy ---
+
+class ReplayReaderPolicy : public InputReaderPolicyInterface {
+    InputReaderConfiguration mConfig;
+
+protected:
+    virtual ~ReplayReaderPolicy() { }
+
+public:
+    ReplayReaderPolicy() {
+        DisplayViewport v;
+        v.displayId = DISPLAY_ID;
+        v.orientation = DISPLAY_ORIENTATION_0;
+        v.logicalLeft = 0;
+        v.logicalTop = 0;
+        v.logicalRight = DISPLAY_WIDTH;
+        v.logicalBottom = DISPLAY_HEIGHT;
+        v.physicalLeft = 0;
+        v.physicalTop = 0;
+        v.physicalRight = DISPLAY_WIDTH;
+        v.physicalBottom = DISPLAY_HEIGHT;
+        v.deviceWidth = DISPLAY_WIDTH;
+        v.deviceHeight = DISPLAY_HEIGHT;
+        mConfig.setPhysicalDisplayViewport(ViewportType::VIEWPORT_INTERNAL, v);
+    }
+
+private:
+    virtual void getReaderConfiguration(InputReaderConfiguration* outConfig) {
+        *outConfig = mConfig;
+    }
+
+    virtual sp<PointerControllerInterface> obtainPointerController(int32_t) {
+        return NULL;
+    }
+
+    virtual void notifyInputDevicesChanged(const Vector<InputDeviceInfo>&) {
+    }
+
+    virtual sp<KeyCharacterMap> getKeyboardLayoutOverlay(const InputDeviceIdentifier&) {
+        return NULL;
+    }
+
+    virtual String8 getDeviceAlias(const InputDeviceIdentifier&) {
+        return String8::empty();
+    }
+
+    virtual TouchAffineTransformation getTouchAffineTransformation(const String8&, int32_t) {
+        return TouchAffineTransformation();
+    }
+};
+
+
+// --- ReplayDispatcherPolicy ---
+
+class ReplayDispatcherPolicy : public InputDispatcherPolicyInterface {
+    InputDispatcherConfiguration mConfig;
+    ReplayTimeline* mTimeline;
+
+protected:
+    virtual ~ReplayDispatcherPolicy() { }
+
+public:
+    explicit ReplayDispatcherPolicy(ReplayTimeline* timeline) : mTimeline(timeline) { }
+
+private:
+    virtual void notifyConfigurationChanged(nsecs_t) {
+    }
+
+    virtual nsecs_t notifyANR(const sp<InputApplicationHandle>&,
+            const sp<InputWindowHandle>& inputWindowHandle, const String8& reason) {
+        fprintf(stderr, "ANR in %s: %s\n", inputWindowHandle != NULL
+                ? inputWindowHandle->getName().string() : "<none>", reason.string());
+        return 0;
+    }
+
+    virtual void notifyInputChannelBroken(const sp<InputWindowHandle>&) {
+    }
+
+    virtual void getDispatcherConfiguration(InputDispatcherConfiguration* outConfig) {
+        *outConfig = mConfig;
+    }
+
+    virtual bool filterInputEvent(const InputEvent*, uint32_t) {
+        return true;
+    }
+
+    virtual void interceptKeyBeforeQueueing(const KeyEvent*, uint32_t& policyFlags) {
+        policyFlags |= POLICY_FLAG_PASS_TO_USER;
+    }
+
+    virtual void interceptMotionBeforeQueueing(nsecs_t when, uint32_t& policyFlags) {
+        mTimeline->recordQueued(when, systemTime(SYSTEM_TIME_MONOTONIC));
+        policyFlags |= POLICY_FLAG_PASS_TO_USER;
+    }
+
+    virtual nsecs_t interceptKeyBeforeDispatching(const sp<InputWindowHandle>&,
+            const KeyEvent*, uint32_t) {
+        return 0;
+    }
+
+    virtual bool dispatchUnhandledKey(const sp<InputWindowHandle>&,
+            const KeyEvent*, uint32_t, KeyEvent*) {
+        return false;
+    }
+
+    virtual void notifySwitch(nsecs_t, uint32_t, uint32_t, uint32_t) {
+    }
+
+    virtual void pokeUserActivity(nsecs_t, int32_t) {
+    }
+
+    virtual bool checkInjectEventsPermissionNonReentrant(int32_t, int32_t) {
+        return false;
+    }
+};
+
+
+// --- ReplayApplicationHandle ---
+
+class ReplayApplicationHandle : public InputApplicationHandle {
+public:
+    ReplayApplicationHandle() { }
+
+    virtual bool updateInfo() {
+        if (!mInfo) {
+            mInfo = new InputApplicationInfo();
+        }
+        mInfo->name = "Replay";
+        mInfo->dispatchingTimeout = DISPATCHING_TIMEOUT;
+        return true;
+    }
+};
+
+
+// --- ReplayWindowHandle ---
+
+class ReplayWindowHandle : public InputWindowHandle {
+public:
+    ReplayWindowHandle(const sp<InputApplicationHandle>& inputApplicationHandle,
+            const sp<InputChannel>& inputChannel, const Rect& frame, int32_t layer) :
+            InputWindowHandle(inputApplicationHandle),
+            mInputChannel(inputChannel), mFrame(frame), mLayer(layer) { }
+
+    virtual bool updateInfo() {
+        if (!mInfo) {
+            mInfo = new InputWindowInfo();
+        }
+        mInfo->inputChannel = mInputChannel;
+        mInfo->name = mInputChannel->getName();
+        mInfo->layoutParamsFlags = InputWindowInfo::FLAG_NOT_TOUCH_MODAL
+                | InputWindowInfo::FLAG_SPLIT_TOUCH;
+        mInfo->layoutParamsType = InputWindowInfo::TYPE_APPLICATION;
+        mInfo->dispatchingTimeout = DISPATCHING_TIMEOUT;
+        mInfo->frameLeft = mFrame.left;
+        mInfo->frameTop = mFrame.top;
+        mInfo->frameRight = mFrame.right;
+        mInfo->frameBottom = mFrame.bottom;
+        mInfo->scaleFactor = 1.0f;
+        mInfo->touchableRegion.clear();
+        mInfo->addTouchableRegion(mFrame);
+        mInfo->visible = true;
+        mInfo->canReceiveKeys = true;
+        mInfo->hasFocus = mLayer == 0;
+        mInfo->hasWallpaper = false;
+        mInfo->paused = false;
+        mInfo->layer = mLayer;
+        mInfo->ownerPid = getpid();
+        mInfo->ownerUid = getuid();
+        mInfo->inputFeatures = 0;
+        mInfo->displayId = DISPLAY_ID;
+        return true;
+    }
+
+private:
+    sp<InputChannel> mInputChannel;
+    Rect mFrame;
+    int32_t mLayer;
+};
+
+
+// --- ReplayConsumerThread ---
+
+/* Plays the application side of a window: consumes what it is sent and finishes it. */
+class ReplayConsumerThread : public Thread {
+public:
+    ReplayConsumerThread(const sp<InputChannel>& inputChannel, ReplayTimeline* timeline) :
+            Thread(/*canCallJava*/ false),
+            mInputChannel(inputChannel), mConsumer(inputChannel), mTimeline(timeline) { }
+
+private:
+    sp<InputChannel> mInputChannel;
+    InputConsumer mConsumer;
+    PreallocatedInputEventFactory mEventFactory;
+    ReplayTimeline* mTimeline;
+
+    virtual bool threadLoop() {
+        struct pollfd pollFd;
+        pollFd.fd = mInputChannel->getFd();
+        pollFd.events = POLLIN;
+        pollFd.revents = 0;
+        if (poll(&pollFd, 1, CONSUMER_POLL_TIMEOUT_MILLIS) <= 0) {
+            return true;
+        }
+
+        for (;;) {
+            uint32_t seq;
+            InputEvent* event;
+            status_t status = mConsumer.consume(&mEventFactory, /*consumeBatches*/ true, -1,
+                    &seq, &event);
+            if (status == WOULD_BLOCK) {
+                return true;
+            }
+            if (status) {
+                ALOGE("Window %s could not consume an event, status=%d",
+                        mInputChannel->getName().string(), status);
+                return false;
+            }
+
+            if (event->getType() == AINPUT_EVENT_TYPE_MOTION) {
+                const nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+                const MotionEvent* motionEvent = static_cast<const MotionEvent*>(event);
+                const size_t historySize = motionEvent->getHistorySize();
+                for (size_t h = 0; h < historySize; h++) {
+                    mTimeline->recordDelivered(motionEvent->getHistoricalEventTime(h), now);
+                }
+                mTimeline->recordDelivered(motionEvent->getEventTime(), now);
+            }
+            mConsumer.sendFinishedSignal(seq, true);
+        }
+    }
+};
+
+
+// --- Replay ---
+
+static void usage(const char* program) {
+    fprintf(stderr, "Usage: %s [-f getevent.txt] [-p] [-w windows] [-n fingers] [-r rate] "
+            "[-s seconds]\n"
+            "  -f  replay a \"getevent -t\" dump instead of a synthetic touch screen\n"
+            "  -p  replay frames at their recorded times rather than as fast as possible\n"
+            "  -w  number of windows the display is split between (default %d)\n"
+            "  -n  fingers of the synthetic touch screen (default %d)\n"
+            "  -r  report rate of the synthetic touch screen in Hz (default %d)\n"
+            "  -s  length of the synthetic stream in seconds (default %d)\n",
+            program, DEFAULT_WINDOW_COUNT, DEFAULT_FINGER_COUNT, DEFAULT_RATE_HZ,
+            DEFAULT_DURATION_SECONDS);
+}
+
+static int replay(int argc, char** argv) {
+    const char* path = NULL;
+    bool paced = false;
+    int32_t windowCount = DEFAULT_WINDOW_COUNT;
+    int32_t fingerCount = DEFAULT_FINGER_COUNT;
+    int32_t rateHz = DEFAULT_RATE_HZ;
+    int32_t durationSeconds = DEFAULT_DURATION_SECONDS;
+    int option;
+    while ((option = getopt(argc, argv, "f:pw:n:r:s:")) != -1) {
+        switch (option) {
+        case 'f':
+            path = optarg;
+            break;
+        case 'p':
+            paced = true;
+            break;
+        case 'w':
+            windowCount = atoi(optarg);
+            break;
+        case 'n':
+            fingerCount = atoi(optarg);
+            break;
+        case 'r':
+            rateHz = atoi(optarg);
+            break;
+        case 's':
+            durationSeconds = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (windowCount < 1 || fingerCount < 1 || fingerCount > MAX_POINTERS
+            || rateHz < 1 || durationSeconds < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Recording recording;
+    if (path) {
+        if (!recording.load(path)) {
+            return 1;
+        }
+    } else {
+        recording.synthesize(fingerCount, rateHz, durationSeconds);
+    }
+
+    ReplayTimeline timeline;
+    sp<InputDispatcher> dispatcher = new InputDispatcher(new ReplayDispatcherPolicy(&timeline));
+    dispatcher->setInputDispatchMode(/*enabled*/ true, /*frozen*/ false);
+
+    // Tile the display with the windows, in as square a grid as the count allows.
+    sp<InputApplicationHandle> application = new ReplayApplicationHandle();
+    Vector<sp<InputWindowHandle> > windows;
+    Vector<sp<ReplayConsumerThread> > consumers;
+    int32_t columns = int32_t(ceilf(sqrtf(float(windowCount))));
+    int32_t rows = (windowCount + columns - 1) / columns;
+    for (int32_t i = 0; i < windowCount; i++) {
+        String8 name = String8::format("Replay window %d", i);
+        sp<InputChannel> serverChannel, clientChannel;
+        status_t status = InputChannel::openInputChannelPair(name, serverChannel, clientChannel);
+        if (status) {
+            fprintf(stderr, "Could not open the input channels of %s, status=%d\n",
+                    name.string(), status);
+            return 1;
+        }
+        const int32_t column = i % columns;
+        const int32_t row = i / columns;
+        Rect frame(column * DISPLAY_WIDTH / columns, row * DISPLAY_HEIGHT / rows,
+                (column + 1) * DISPLAY_WIDTH / columns, (row + 1) * DISPLAY_HEIGHT / rows);
+        sp<InputWindowHandle> window = new ReplayWindowHandle(application, serverChannel,
+                frame, i);
+        dispatcher->registerInputChannel(serverChannel, window, /*monitor*/ false);
+        windows.push(window);
+
+        sp<ReplayConsumerThread> consumer = new ReplayConsumerThread(clientChannel, &timeline);
+        consumer->run(name.string(), PRIORITY_URGENT_DISPLAY);
+        consumers.push(consumer);
+    }
+    dispatcher->setInputWindows(windows);
+    dispatcher->setFocusedApplication(application);
+
+    sp<InputDispatcherThread> dispatcherThread = new InputDispatcherThread(dispatcher);
+    dispatcherThread->run("InputDispatcher", PRIORITY_URGENT_DISPLAY);
+
+    // The reader is driven from this thread, in place of its own, so that the replay ends
+    // as soon as the last frame was read.
+    sp<ReplayEventHub> eventHub = new ReplayEventHub(recording, paced);
+    sp<InputReader> reader = new InputReader(eventHub, new ReplayReaderPolicy(), dispatcher);
+    while (!eventHub->isFinished()) {
+        reader->loopOnce();
+    }
+    timeline.waitForIdle(DRAIN_TIMEOUT);
+
+    dispatcherThread->requestExit();
+    dispatcher->monitor(); // wakes the dispatcher, so that it notices
+    dispatcherThread->requestExitAndWait();
+    for (size_t i = 0; i < consumers.size(); i++) {
+        consumers[i]->requestExitAndWait();
+    }
+
+    String8 dump;
+    dump.appendFormat("%s replay into %d windows, %s\n", path ? path : "Synthetic",
+            windowCount, paced ? "at the recorded rate" : "as fast as possible");
+    timeline.dump(dump, eventHub->getStartTime(), recording.frames.size(),
+            recording.events.size());
+    dump.append("\n");
+    reader->dump(dump);
+    dump.append("\n");
+    dispatcher->dump(dump);
+    fputs(dump.string(), stdout);
+    return 0;
+}
+
+} // namespace android
+
+int main(int argc, char** argv) {
+    return android::replay(argc, argv);
+}
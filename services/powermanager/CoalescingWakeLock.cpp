@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "CoalescingWakeLock"
+//#define LOG_NDEBUG 0
+#include <utils/Log.h>
+
+#include <binder/Binder.h>
+
+#include <powermanager/CoalescingWakeLock.h>
+#include <powermanager/PowerManager.h>
+
+#include <chrono>
+
+namespace android {
+
+constexpr nsecs_t CoalescingWakeLock::DEFAULT_RELEASE_DELAY;
+
+CoalescingWakeLock::CoalescingWakeLock(const sp<IPowerManager>& powerManager,
+        const String16& tag, const String16& packageName, nsecs_t releaseDelay)
+    : mPowerManager(powerManager),
+      mToken(new BBinder()),
+      mTag(tag),
+      mPackageName(packageName),
+      mReleaseDelay(releaseDelay),
+      mHeld(false),
+      mReleaseTime(-1),
+      mExit(false)
+{
+}
+
+CoalescingWakeLock::~CoalescingWakeLock() {
+    bool held;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        held = mHeld;
+        mHeld = false;
+        mReleaseTime = -1;
+        mExit = true;
+    }
+    mCondition.notify_all();
+    if (mReleaseThread.joinable()) {
+        mReleaseThread.join();
+    }
+    if (held && mPowerManager != nullptr) {
+        mPowerManager->releaseWakeLock(mToken, 0, true /* isOneWay */);
+    }
+}
+
+void CoalescingWakeLock::acquire() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mHeld) {
+        // Still held, only the release that was pending goes away
+        mReleaseTime = -1;
+        return;
+    }
+    if (mPowerManager == nullptr) {
+        return;
+    }
+    mPowerManager->acquireWakeLock(POWERMANAGER_PARTIAL_WAKE_LOCK, mToken, mTag,
+            mPackageName, true /* isOneWay */);
+    mHeld = true;
+}
+
+void CoalescingWakeLock::release() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (!mHeld || mReleaseTime >= 0) {
+        return;
+    }
+    mReleaseTime = systemTime(SYSTEM_TIME_MONOTONIC) + mReleaseDelay;
+    if (!mReleaseThread.joinable()) {
+        mReleaseThread = std::thread(&CoalescingWakeLock::releaseLoop, this);
+    } else {
+        mCondition.notify_all();
+    }
+}
+
+bool CoalescingWakeLock::isHeld() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mHeld;
+}
+
+void CoalescingWakeLock::releaseLoop() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (!mExit) {
+        if (mReleaseTime < 0) {
+            mCondition.wait(lock);
+            continue;
+        }
+        const nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+        if (now < mReleaseTime) {
+            mCondition.wait_for(lock, std::chrono::nanoseconds(mReleaseTime - now));
+            continue;
+        }
+
+        // Sent under the lock so that it can't be reordered with a concurrent
+        // acquire(). The transaction is oneway, so this doesn't block.
+        mPowerManager->releaseWakeLock(mToken, 0, true /* isOneWay */);
+        mHeld = false;
+        mReleaseTime = -1;
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+}; // namespace android
@@ -15,6 +15,7 @@ LOCAL_SRC_FILES:= \
     SensorEventConnection.cpp \
     SensorFusion.cpp \
     SensorInterface.cpp \
+    SensorLatencyStats.cpp \
     SensorList.cpp \
     SensorRecord.cpp \
     SensorService.cpp \
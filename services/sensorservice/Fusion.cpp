@@ -487,7 +487,22 @@ void Fusion::predict(const vec3_t& w, float dT) {
     if (x0.w < 0)
         x0 = -x0;
 
-    P = Phi*P*transpose(Phi) + GQGt;
+    // P = Phi*P*transpose(Phi) + GQGt, with the zero and identity blocks of Phi expanded:
+    //
+    // | Phi00 Phi10 | * | P00  P10 | * | Phi00t 0 | = | Phi00*P00*Phi00t + ...  T10 |
+    // |   0     1   |   | P01  P11 |   | Phi10t 1 |   |         T10t             P11 |
+    //
+    // T10 = Phi00*P10 + Phi10*P11
+    // T00 = (Phi00*P00 + Phi10*P01)*Phi00t + T10*Phi10t
+    //
+    // which takes 6 of the 3x3 products the generic form takes 16 of.
+    const mat33_t Phi00t(transpose(Phi[0][0]));
+    const mat33_t T10(Phi[0][0]*P[1][0] + Phi[1][0]*P[1][1]);
+    P[0][0] = (Phi[0][0]*P[0][0] + Phi[1][0]*P[0][1])*Phi00t
+            + T10*transpose(Phi[1][0]) + GQGt[0][0];
+    P[1][0] = T10 + GQGt[1][0];
+    P[0][1] = transpose(P[1][0]);
+    P[1][1] += GQGt[1][1];
 
     checkState();
 }
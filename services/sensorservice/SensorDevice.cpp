@@ -367,6 +367,20 @@ status_t SensorDevice::batch(
     return err;
 }
 
+nsecs_t SensorDevice::getBatchReportLatency(int handle) const {
+    Mutex::Autolock _l(mLock);
+    ssize_t index = mActivationCount.indexOfKey(handle);
+    if (index < 0) {
+        return 0;
+    }
+    const Info& info = mActivationCount.valueAt(index);
+    if (info.batchParams.isEmpty()) {
+        return 0;
+    }
+    // Events come at least once per sampling period, whatever the batch timeout.
+    return std::max(info.bestBatchParams.mTBatch, info.bestBatchParams.mTSample);
+}
+
 status_t SensorDevice::setDelay(void* ident, int handle, int64_t samplingPeriodNs) {
     return batch(ident, handle, 0, samplingPeriodNs, 0);
 }
@@ -659,6 +673,7 @@ void SensorDevice::convertToSensorEvents(
 
     for (size_t i = 0; i < src.size(); ++i) {
         convertToSensorEvent(src[i], &dst[i]);
+        dst[i].flags = 0;
     }
 }
 
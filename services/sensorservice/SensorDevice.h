@@ -86,6 +86,9 @@ public:
     status_t setDelay(void* ident, int handle, int64_t ns);
     status_t flush(void* ident, int handle);
     status_t setMode(uint32_t mode);
+    // The longest the HAL may currently hold events of a sensor before reporting them, or 0 if
+    // the sensor is not batched by the HAL.
+    nsecs_t getBatchReportLatency(int handle) const;
 
     bool isDirectReportSupported() const;
     int32_t registerDirectChannel(const sensors_direct_mem_t *memory);
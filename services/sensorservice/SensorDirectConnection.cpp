@@ -83,6 +83,14 @@ status_t SensorService::SensorDirectConnection::flush() {
     return INVALID_OPERATION;
 }
 
+status_t SensorService::SensorDirectConnection::setEventRing(
+        const native_handle_t* resource, uint32_t size) {
+    // A direct channel is already shared memory, parameters not used
+    UNUSED(resource);
+    UNUSED(size);
+    return INVALID_OPERATION;
+}
+
 int32_t SensorService::SensorDirectConnection::configureChannel(int handle, int rateLevel) {
 
     if (handle == -1 && rateLevel == SENSOR_DIRECT_RATE_STOP) {
@@ -94,6 +102,32 @@ int32_t SensorService::SensorDirectConnection::configureChannel(int handle, int
         return PERMISSION_DENIED;
     }
 
+    Mutex::Autolock _l(mConnectionLock);
+    return configureChannelLocked(handle, rateLevel);
+}
+
+status_t SensorService::SensorDirectConnection::configureChannels(
+        const Vector<int32_t>& handles, const Vector<int32_t>& rateLevels,
+        Vector<int32_t>* outResults) {
+    if (handles.size() != rateLevels.size()) {
+        return BAD_VALUE;
+    }
+
+    if (mService->isOperationRestricted(mOpPackageName)) {
+        return PERMISSION_DENIED;
+    }
+
+    outResults->resize(handles.size());
+    Mutex::Autolock _l(mConnectionLock);
+    for (size_t i = 0; i < handles.size(); ++i) {
+        // Stopping the whole channel is left to configureChannel().
+        outResults->editItemAt(i) = handles[i] == -1
+                ? BAD_VALUE : configureChannelLocked(handles[i], rateLevels[i]);
+    }
+    return NO_ERROR;
+}
+
+int32_t SensorService::SensorDirectConnection::configureChannelLocked(int handle, int rateLevel) {
     sp<SensorInterface> si = mService->getSensorInterfaceFromHandle(handle);
     if (si == nullptr) {
         return NAME_NOT_FOUND;
@@ -114,7 +148,6 @@ int32_t SensorService::SensorDirectConnection::configureChannel(int handle, int
         .rate_level = rateLevel
     };
 
-    Mutex::Autolock _l(mConnectionLock);
     SensorDevice& dev(SensorDevice::getInstance());
     int ret = dev.configureDirectChannel(handle, getHalChannelHandle(), &config);
 
@@ -63,8 +63,16 @@ protected:
     virtual status_t setEventRate(int handle, nsecs_t samplingPeriodNs);
     virtual status_t flush();
     virtual int32_t configureChannel(int handle, int rateLevel);
+    virtual status_t configureChannels(const Vector<int32_t>& handles,
+                                       const Vector<int32_t>& rateLevels,
+                                       Vector<int32_t>* outResults);
+    virtual status_t setEventRing(const native_handle_t* resource, uint32_t size);
 
 private:
+    // Checks and applies the rate level of one sensor, for configureChannel() and
+    // configureChannels(). The caller has checked that the operation is not restricted.
+    int32_t configureChannelLocked(int handle, int rateLevel);
+
     const sp<SensorService> mService;
     const uid_t mUid;
     const sensors_direct_mem_t mMem;
@@ -14,7 +14,9 @@
  * limitations under the License.
  */
 
+#include <inttypes.h>
 #include <sys/socket.h>
+#include <unistd.h>
 #include <utils/threads.h>
 
 #include <sensor/SensorEventQueue.h>
@@ -32,7 +34,12 @@ SensorService::SensorEventConnection::SensorEventConnection(
         const String16& opPackageName)
     : mService(service), mUid(uid), mWakeLockRefCount(0), mHasLooperCallbacks(false),
       mDead(false), mDataInjectionMode(isDataInjectionMode), mEventCache(NULL),
-      mCacheSize(0), mMaxCacheSize(0), mPackageName(packageName), mOpPackageName(opPackageName) {
+      mCacheSize(0), mMaxCacheSize(0), mHeldEventsDeadline(INT64_MAX), mEventRing(NULL),
+      mEventRingFd(-1),
+      mPackageName(packageName), mOpPackageName(opPackageName),
+      mSendLatency(String8("poll to client"),
+              String8::format("SensorSendLatency %s", packageName.string())),
+      mEventsCached(0), mEventsDropped(0) {
     mChannel = new BitTube(mService->mSocketBufferSize);
 #if DEBUG_CONNECTIONS
     mEventsReceived = mEventsSentFromCache = mEventsSent = 0;
@@ -46,6 +53,10 @@ SensorService::SensorEventConnection::~SensorEventConnection() {
     if (mEventCache != NULL) {
         delete mEventCache;
     }
+    delete mEventRing;
+    if (mEventRingFd >= 0) {
+        close(mEventRingFd);
+    }
 }
 
 void SensorService::SensorEventConnection::onFirstRef() {
@@ -68,14 +79,24 @@ void SensorService::SensorEventConnection::dump(String8& result) {
     result.appendFormat("\t %s | WakeLockRefCount %d | uid %d | cache size %d | "
             "max cache size %d\n", mPackageName.string(), mWakeLockRefCount, mUid, mCacheSize,
             mMaxCacheSize);
+    if (mEventRing != NULL) {
+        result.appendFormat("\t event ring of %zu events\n", mEventRing->getCapacity());
+    }
+    result.appendFormat("\t events cached %" PRIu64 " | dropped %" PRIu64 " | held %zu\n",
+            mEventsCached, mEventsDropped, mHeldEvents.size());
+    if (mSendLatency.getCount()) {
+        mSendLatency.dump(result, "\t ");
+    }
     for (size_t i = 0; i < mSensorInfo.size(); ++i) {
         const FlushInfo& flushInfo = mSensorInfo.valueAt(i);
-        result.appendFormat("\t %s 0x%08x | status: %s | pending flush events %d \n",
+        result.appendFormat("\t %s 0x%08x | status: %s | pending flush events %d | "
+                            "max report latency %" PRId64 " ms\n",
                             mService->getSensorName(mSensorInfo.keyAt(i)).string(),
                             mSensorInfo.keyAt(i),
                             flushInfo.mFirstFlushPending ? "First flush pending" :
                                                            "active",
-                            flushInfo.mPendingFlushEventsToSend);
+                            flushInfo.mPendingFlushEventsToSend,
+                            ns2ms(flushInfo.mMaxBatchReportLatencyNs));
     }
 #if DEBUG_CONNECTIONS
     result.appendFormat("\t events recvd: %d | sent %d | cache %d | dropped %d |"
@@ -104,6 +125,7 @@ bool SensorService::SensorEventConnection::addSensor(int32_t handle) {
 bool SensorService::SensorEventConnection::removeSensor(int32_t handle) {
     Mutex::Autolock _l(mConnectionLock);
     if (mSensorInfo.removeItem(handle) >= 0) {
+        removeHeldEventsLocked(handle);
         return true;
     }
     return false;
@@ -145,6 +167,16 @@ void SensorService::SensorEventConnection::setFirstFlushPending(int32_t handle,
     }
 }
 
+void SensorService::SensorEventConnection::setMaxBatchReportLatency(int32_t handle,
+                                nsecs_t maxBatchReportLatencyNs) {
+    Mutex::Autolock _l(mConnectionLock);
+    ssize_t index = mSensorInfo.indexOfKey(handle);
+    if (index >= 0) {
+        FlushInfo& flushInfo = mSensorInfo.editValueAt(index);
+        flushInfo.mMaxBatchReportLatencyNs = maxBatchReportLatencyNs;
+    }
+}
+
 void SensorService::SensorEventConnection::updateLooperRegistration(const sp<Looper>& looper) {
     Mutex::Autolock _l(mConnectionLock);
     updateLooperRegistrationLocked(looper);
@@ -275,6 +307,103 @@ status_t SensorService::SensorEventConnection::sendEvents(
         count = numEvents;
     }
 
+    return sendFilteredEventsLocked(scratch, count, findWakeUpSensorEventLocked(scratch, count),
+            0);
+}
+
+status_t SensorService::SensorEventConnection::sendEventRuns(
+        sensors_event_t const* buffer, SensorEventRun const* runs, size_t numRuns,
+        sensors_event_t* scratch,
+        wp<const SensorEventConnection> const * mapFlushEventsToConnections, nsecs_t pollTime) {
+    // Same filtering as sendEvents(), but the registration of this connection is looked up once
+    // per run rather than once per event, and runs are copied whole.
+    int count = 0;
+    int index_wake_up_event = -1;
+    bool flushed = false;
+    Mutex::Autolock _l(mConnectionLock);
+    for (size_t i = 0; i < numRuns; ++i) {
+        const SensorEventRun& run = runs[i];
+        ssize_t index = mSensorInfo.indexOfKey(run.handle);
+        if (index < 0) {
+            continue;
+        }
+
+        FlushInfo& flushInfo = mSensorInfo.editValueAt(index);
+        if (run.flush) {
+            // A flush_complete event only goes to the connection which called flush.
+            if (mapFlushEventsToConnections[run.first] != this) {
+                continue;
+            }
+            if (flushInfo.mFirstFlushPending) {
+                flushInfo.mFirstFlushPending = false;
+                ALOGD_IF(DEBUG_CONNECTIONS, "First flush event for sensor==%d ", run.handle);
+                continue;
+            }
+            flushed = true;
+        } else if (flushInfo.mFirstFlushPending) {
+            continue;
+        } else if (!run.wakeUp && flushInfo.mMaxBatchReportLatencyNs > run.halLatency) {
+            // The HAL reports this sensor sooner than this connection needs it. Hold the events
+            // until the HAL would otherwise report them too late.
+            mHeldEvents.appendArray(&buffer[run.first], run.count);
+            const nsecs_t deadline = buffer[run.first].timestamp
+                    + (flushInfo.mMaxBatchReportLatencyNs - run.halLatency);
+            if (deadline < mHeldEventsDeadline) {
+                mHeldEventsDeadline = deadline;
+            }
+            continue;
+        }
+
+        if (run.wakeUp && index_wake_up_event < 0) {
+            index_wake_up_event = count;
+        }
+        memcpy(&scratch[count], &buffer[run.first], run.count * sizeof(sensors_event_t));
+        count += run.count;
+    }
+
+    if (!mHeldEvents.isEmpty()) {
+        // A flush_complete_event must come after all the events before it, and the held events
+        // must fit in the socket in one go. If they do not get through, they go to the cache and
+        // the new events queue up behind them.
+        bool release = flushed || pollTime >= mHeldEventsDeadline ||
+                mHeldEvents.size() >= mService->mSocketBufferSize / sizeof(sensors_event_t);
+        for (size_t i = 0; !release && i < mSensorInfo.size(); ++i) {
+            release = mSensorInfo.valueAt(i).mPendingFlushEventsToSend > 0;
+        }
+        if (release) {
+            releaseHeldEventsLocked();
+        }
+    }
+
+    return sendFilteredEventsLocked(scratch, count, index_wake_up_event, pollTime);
+}
+
+status_t SensorService::SensorEventConnection::releaseHeldEventsLocked() {
+    ALOGD_IF(DEBUG_CONNECTIONS, "releasing %zu held events", mHeldEvents.size());
+    // Their send latency would be that of the batching, so it is not recorded.
+    status_t err = sendFilteredEventsLocked(mHeldEvents.editArray(),
+            static_cast<int>(mHeldEvents.size()), -1, 0);
+    mHeldEvents.clear();
+    mHeldEventsDeadline = INT64_MAX;
+    return err;
+}
+
+void SensorService::SensorEventConnection::removeHeldEventsLocked(int32_t handle) {
+    size_t kept = 0;
+    for (size_t i = 0; i < mHeldEvents.size(); ++i) {
+        if (mHeldEvents[i].sensor != handle) {
+            mHeldEvents.editItemAt(kept++) = mHeldEvents[i];
+        }
+    }
+    // The deadline is left as it was, which at worst releases the other events early.
+    mHeldEvents.resize(kept);
+    if (kept == 0) {
+        mHeldEventsDeadline = INT64_MAX;
+    }
+}
+
+status_t SensorService::SensorEventConnection::sendFilteredEventsLocked(
+        sensors_event_t* scratch, int count, int index_wake_up_event, nsecs_t pollTime) {
     sendPendingFlushEventsLocked();
     // Early return if there are no events for this connection.
     if (count == 0) {
@@ -287,6 +416,7 @@ status_t SensorService::SensorEventConnection::sendEvents(
     if (mCacheSize != 0) {
         // There are some events in the cache which need to be sent first. Copy this buffer to
         // the end of cache.
+        mEventsCached += count;
         if (mCacheSize + count <= mMaxCacheSize) {
             memcpy(&mEventCache[mCacheSize], scratch, count * sizeof(sensors_event_t));
             mCacheSize += count;
@@ -304,6 +434,7 @@ status_t SensorService::SensorEventConnection::sendEvents(
                                                 remaningCacheSize * sizeof(sensors_event_t));
             }
             int numEventsDropped = count - remaningCacheSize;
+            mEventsDropped += numEventsDropped;
             countFlushCompleteEventsLocked(mEventCache, numEventsDropped);
             // Drop the first "numEventsDropped" in the cache.
             memmove(mEventCache, &mEventCache[numEventsDropped],
@@ -316,7 +447,6 @@ status_t SensorService::SensorEventConnection::sendEvents(
         return status_t(NO_ERROR);
     }
 
-    int index_wake_up_event = findWakeUpSensorEventLocked(scratch, count);
     if (index_wake_up_event >= 0) {
         scratch[index_wake_up_event].flags |= WAKE_UP_SENSOR_EVENT_NEEDS_ACK;
         ++mWakeLockRefCount;
@@ -325,9 +455,7 @@ status_t SensorService::SensorEventConnection::sendEvents(
 #endif
     }
 
-    // NOTE: ASensorEvent and sensors_event_t are the same type.
-    ssize_t size = SensorEventQueue::write(mChannel,
-                                    reinterpret_cast<ASensorEvent const*>(scratch), count);
+    ssize_t size = writeEventsLocked(scratch, count);
     if (size < 0) {
         // Write error, copy events to local cache.
         if (index_wake_up_event >= 0) {
@@ -347,6 +475,7 @@ status_t SensorService::SensorEventConnection::sendEvents(
         }
         memcpy(&mEventCache[mCacheSize], scratch, count * sizeof(sensors_event_t));
         mCacheSize += count;
+        mEventsCached += count;
 
         // Add this file descriptor to the looper to get a callback when this fd is available for
         // writing.
@@ -354,6 +483,10 @@ status_t SensorService::SensorEventConnection::sendEvents(
         return size;
     }
 
+    if (pollTime) {
+        mSendLatency.record(systemTime(SYSTEM_TIME_BOOTTIME) - pollTime);
+    }
+
 #if DEBUG_CONNECTIONS
     if (size > 0) {
         mEventsSent += count;
@@ -381,6 +514,21 @@ void SensorService::SensorEventConnection::reAllocateCacheLocked(sensors_event_t
     mMaxCacheSize = new_cache_size;
 }
 
+ssize_t SensorService::SensorEventConnection::writeEventsLocked(
+        sensors_event_t const* events, size_t count) {
+    // NOTE: ASensorEvent and sensors_event_t are the same type.
+    if (mEventRing != NULL) {
+        mEventRing->write(reinterpret_cast<ASensorEvent const*>(events), count);
+        uint64_t signal = 1;
+        if (::write(mEventRingFd, &signal, sizeof(signal)) < 0 && errno != EAGAIN) {
+            ALOGE("Could not signal the event ring of %s: %s", mPackageName.string(),
+                    strerror(errno));
+        }
+        return count;
+    }
+    return SensorEventQueue::write(mChannel, reinterpret_cast<ASensorEvent const*>(events), count);
+}
+
 void SensorService::SensorEventConnection::sendPendingFlushEventsLocked() {
     ASensorEvent flushCompleteEvent;
     memset(&flushCompleteEvent, 0, sizeof(flushCompleteEvent));
@@ -402,7 +550,8 @@ void SensorService::SensorEventConnection::sendPendingFlushEventsLocked() {
                ++mWakeLockRefCount;
                flushCompleteEvent.flags |= WAKE_UP_SENSOR_EVENT_NEEDS_ACK;
             }
-            ssize_t size = SensorEventQueue::write(mChannel, &flushCompleteEvent, 1);
+            ssize_t size = writeEventsLocked(
+                    reinterpret_cast<sensors_event_t const*>(&flushCompleteEvent), 1);
             if (size < 0) {
                 if (wakeUpSensor) --mWakeLockRefCount;
                 return;
@@ -507,6 +656,14 @@ status_t SensorService::SensorEventConnection::enableDisable(
 {
     status_t err;
     if (enabled) {
+        if (usesEventRing()) {
+            // Wake up sensor events are held until the app acknowledges them, which a ring that
+            // overwrites unread events cannot promise.
+            sp<SensorInterface> si = mService->getSensorInterfaceFromHandle(handle);
+            if (si != nullptr && si->getSensor().isWakeUpSensor()) {
+                return INVALID_OPERATION;
+            }
+        }
         err = mService->enable(this, handle, samplingPeriodNs, maxBatchReportLatencyNs,
                                reservedFlags, mOpPackageName);
 
@@ -526,6 +683,39 @@ status_t  SensorService::SensorEventConnection::flush() {
     return  mService->flushSensor(this, mOpPackageName);
 }
 
+status_t SensorService::SensorEventConnection::setEventRing(
+        const native_handle_t* resource, uint32_t size) {
+    if (resource->numFds < 2 || mDataInjectionMode) {
+        return BAD_VALUE;
+    }
+    Mutex::Autolock _l(mConnectionLock);
+    // Only before any sensor is enabled, so that no event is left behind in the socket or in
+    // mEventCache.
+    if (mEventRing != NULL || mSensorInfo.size() != 0) {
+        return INVALID_OPERATION;
+    }
+
+    int eventFd = dup(resource->data[1]);
+    if (eventFd < 0) {
+        return -errno;
+    }
+    SensorEventRing* ring = SensorEventRing::map(resource->data[0], size, true);
+    if (ring == NULL) {
+        close(eventFd);
+        return BAD_VALUE;
+    }
+    mEventRing = ring;
+    mEventRingFd = eventFd;
+    ALOGD_IF(DEBUG_CONNECTIONS, "%p uses an event ring of %zu events", this,
+            ring->getCapacity());
+    return NO_ERROR;
+}
+
+bool SensorService::SensorEventConnection::usesEventRing() const {
+    Mutex::Autolock _l(mConnectionLock);
+    return mEventRing != NULL;
+}
+
 int32_t SensorService::SensorEventConnection::configureChannel(int handle, int rateLevel) {
     // SensorEventConnection does not support configureChannel, parameters not used
     UNUSED(handle);
@@ -533,6 +723,16 @@ int32_t SensorService::SensorEventConnection::configureChannel(int handle, int r
     return INVALID_OPERATION;
 }
 
+status_t SensorService::SensorEventConnection::configureChannels(
+        const Vector<int32_t>& handles, const Vector<int32_t>& rateLevels,
+        Vector<int32_t>* outResults) {
+    // SensorEventConnection does not support configureChannels, parameters not used
+    UNUSED(handles);
+    UNUSED(rateLevels);
+    UNUSED(outResults);
+    return INVALID_OPERATION;
+}
+
 int SensorService::SensorEventConnection::handleEvent(int fd, int events, void* /*data*/) {
     if (events & ALOOPER_EVENT_HANGUP || events & ALOOPER_EVENT_ERROR) {
         {
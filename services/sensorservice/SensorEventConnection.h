@@ -35,6 +35,7 @@
 #include <sensor/BitTube.h>
 #include <sensor/ISensorServer.h>
 #include <sensor/ISensorEventConnection.h>
+#include <sensor/SensorEventRing.h>
 
 #include "SensorService.h"
 
@@ -53,12 +54,21 @@ public:
 
     status_t sendEvents(sensors_event_t const* buffer, size_t count, sensors_event_t* scratch,
                         wp<const SensorEventConnection> const * mapFlushEventsToConnections = NULL);
+    // Like sendEvents(), with the buffer already split into runs of events from one sensor by
+    // SensorService::threadLoop().
+    status_t sendEventRuns(sensors_event_t const* buffer, SensorEventRun const* runs,
+                           size_t numRuns, sensors_event_t* scratch,
+                           wp<const SensorEventConnection> const * mapFlushEventsToConnections,
+                           nsecs_t pollTime);
     bool hasSensor(int32_t handle) const;
     bool hasAnySensor() const;
     bool hasOneShotSensors() const;
     bool addSensor(int32_t handle);
     bool removeSensor(int32_t handle);
     void setFirstFlushPending(int32_t handle, bool value);
+    // The maxBatchReportLatencyNs this connection asked for. Events of non wake-up sensors which
+    // the HAL reports sooner than that are held by the connection and delivered in batches.
+    void setMaxBatchReportLatency(int32_t handle, nsecs_t maxBatchReportLatencyNs);
     void dump(String8& result);
     bool needsWakeLock();
     void resetWakeLockRefCount();
@@ -75,6 +85,11 @@ private:
     virtual status_t setEventRate(int handle, nsecs_t samplingPeriodNs);
     virtual status_t flush();
     virtual int32_t configureChannel(int handle, int rateLevel);
+    virtual status_t configureChannels(const Vector<int32_t>& handles,
+                                       const Vector<int32_t>& rateLevels,
+                                       Vector<int32_t>* outResults);
+    virtual status_t setEventRing(const native_handle_t* resource, uint32_t size);
+    bool usesEventRing() const;
 
     // Count the number of flush complete events which are about to be dropped in the buffer.
     // Increment mPendingFlushEventsToSend in mSensorInfo. These flush complete events will be sent
@@ -87,6 +102,23 @@ private:
     // flag set. SOCK_SEQPACKET ensures that either the entire packet is read or dropped.
     int findWakeUpSensorEventLocked(sensors_event_t const* scratch, int count);
 
+    // Writes the events filtered for this connection to the socket, or to mEventCache if the
+    // socket is full. index_wake_up_event is the index of the first wake up sensor event in
+    // scratch, or -1 if there is none. If pollTime is not 0, the time from it to the write is
+    // recorded in mSendLatency.
+    status_t sendFilteredEventsLocked(sensors_event_t* scratch, int count,
+                                      int index_wake_up_event, nsecs_t pollTime);
+
+    // Sends the events held for batching, see setMaxBatchReportLatency().
+    status_t releaseHeldEventsLocked();
+
+    // Forgets the events held for batching from the sensor handle.
+    void removeHeldEventsLocked(int32_t handle);
+
+    // Writes events to the SensorEventRing if the client set one up, or else to the socket, and
+    // returns the number of events written or a negative error like SensorEventQueue::write().
+    ssize_t writeEventsLocked(sensors_event_t const* events, size_t count);
+
     // Send pending flush_complete events. There may have been flush_complete_events that are
     // dropped which need to be sent separately before other events. On older HALs (1_0) this method
     // emulates the behavior of flush().
@@ -150,15 +182,32 @@ private:
         // the events for the sensor are sent on that *connection*.
         bool mFirstFlushPending;
 
-        FlushInfo() : mPendingFlushEventsToSend(0), mFirstFlushPending(false) {}
+        // Set by setMaxBatchReportLatency().
+        nsecs_t mMaxBatchReportLatencyNs;
+
+        FlushInfo() : mPendingFlushEventsToSend(0), mFirstFlushPending(false),
+                mMaxBatchReportLatencyNs(0) {}
     };
     // protected by SensorService::mLock. Key for this vector is the sensor handle.
     KeyedVector<int, FlushInfo> mSensorInfo;
 
     sensors_event_t *mEventCache;
     int mCacheSize, mMaxCacheSize;
+    // Events held until the earliest maxBatchReportLatencyNs of their sensors runs out, at
+    // mHeldEventsDeadline, or until a flush.
+    Vector<sensors_event_t> mHeldEvents;
+    nsecs_t mHeldEventsDeadline;
+    // Set by setEventRing(). Events then go to the ring, which never fills up, so mEventCache is
+    // not used, and mEventRingFd is signalled after each write.
+    SensorEventRing* mEventRing;
+    int mEventRingFd;
     String8 mPackageName;
     const String16 mOpPackageName;
+    // From the return of SensorDevice::poll() to the write of the events to the client.
+    LatencyHistogram mSendLatency;
+    // Events which could not be written straight away and went to mEventCache, and events
+    // dropped because mEventCache was full.
+    uint64_t mEventsCached, mEventsDropped;
 #if DEBUG_CONNECTIONS
     int mEventsReceived, mEventsSent, mEventsSentFromCache;
     int mTotalAcksNeeded, mTotalAcksReceived;
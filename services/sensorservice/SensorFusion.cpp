@@ -36,6 +36,10 @@ SensorFusion::SensorFusion()
     mEnabled[FUSION_NOMAG] = false;
     mEnabled[FUSION_NOGYRO] = false;
 
+    for (int i = 0; i<NUM_FUSION_MODE; ++i) {
+        mRotationValid[i] = false;
+    }
+
     if (count > 0) {
         for (size_t i=0 ; i<size_t(count) ; i++) {
             if (list[i].type == SENSOR_TYPE_ACCELEROMETER) {
@@ -88,6 +92,7 @@ void SensorFusion::process(const sensors_event_t& event) {
                 if (mEnabled[i]) {
                     // fusion in no gyro mode will ignore
                     mFusions[i].handleGyro(gyro, dT);
+                    mRotationValid[i] = false;
                 }
             }
         }
@@ -97,6 +102,7 @@ void SensorFusion::process(const sensors_event_t& event) {
         for (int i = 0; i<NUM_FUSION_MODE; ++i) {
             if (mEnabled[i]) {
                 mFusions[i].handleMag(mag);// fusion in no mag mode will ignore
+                mRotationValid[i] = false;
             }
         }
     } else if (event.type == SENSOR_TYPE_ACCELEROMETER) {
@@ -110,6 +116,7 @@ void SensorFusion::process(const sensors_event_t& event) {
                 if (mEnabled[i]) {
                     mFusions[i].handleAcc(acc, dT);
                     mAttitudes[i] = mFusions[i].getAttitude();
+                    mRotationValid[i] = false;
                 }
             }
         }
@@ -142,6 +149,7 @@ status_t SensorFusion::activate(int mode, void* ident, bool enabled) {
         mEnabled[mode] = newState;
         if (newState) {
             mFusions[mode].init(mode);
+            mRotationValid[mode] = false;
         }
     }
 
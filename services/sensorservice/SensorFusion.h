@@ -50,6 +50,11 @@ class SensorFusion : public Singleton<SensorFusion> {
     vec4_t &mAttitude;
     vec4_t mAttitudes[NUM_FUSION_MODE];
 
+    // The rotation matrix of each fusion, computed the first time a virtual sensor asks for it
+    // after the fusion moved, so that the virtual sensors share it.
+    mutable mat33_t mRotations[NUM_FUSION_MODE];
+    mutable bool mRotationValid[NUM_FUSION_MODE];
+
     SortedVector<void*> mClients[3];
 
     float mEstimatedGyroRate;
@@ -74,7 +79,11 @@ public:
     }
 
     mat33_t getRotationMatrix(int mode = FUSION_9AXIS) const {
-        return mFusions[mode].getRotationMatrix();
+        if (!mRotationValid[mode]) {
+            mRotations[mode] = mFusions[mode].getRotationMatrix();
+            mRotationValid[mode] = true;
+        }
+        return mRotations[mode];
     }
 
     vec4_t getAttitude(int mode = FUSION_9AXIS) const {
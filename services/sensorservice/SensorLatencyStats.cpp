@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#define ATRACE_TAG ATRACE_TAG_SYSTEM_SERVER
+
+#include "SensorLatencyStats.h"
+
+#include <inttypes.h>
+
+#include <utils/Trace.h>
+
+namespace android {
+namespace SensorServiceUtil {
+
+LatencyHistogram::LatencyHistogram(const String8& name, const String8& traceCounter)
+    : mName(name), mTraceCounter(traceCounter), mCount(0), mTotalUs(0), mMaxUs(0) {
+    for (size_t i = 0; i < NUM_BUCKETS; i++) {
+        mBuckets[i] = 0;
+    }
+}
+
+void LatencyHistogram::record(nsecs_t latency) {
+    // HALs which do not stamp events from CLOCK_BOOTTIME can report them slightly in the future.
+    const uint64_t latencyUs = latency > 0 ? uint64_t(latency) / 1000 : 0;
+    size_t bucket = latencyUs ? 64 - size_t(__builtin_clzll(latencyUs)) : 0;
+    if (bucket >= NUM_BUCKETS) {
+        bucket = NUM_BUCKETS - 1;
+    }
+    mCount++;
+    mTotalUs += latencyUs;
+    if (latencyUs > mMaxUs) {
+        mMaxUs = latencyUs;
+    }
+    mBuckets[bucket]++;
+
+    if (ATRACE_ENABLED()) {
+        ATRACE_INT(mTraceCounter.string(),
+                int32_t(latencyUs > INT32_MAX ? INT32_MAX : latencyUs));
+    }
+}
+
+void LatencyHistogram::dump(String8& result, const char* prefix) const {
+    result.appendFormat("%s%s: count=%" PRIu64 ", avg=%0.3fms, max=%0.3fms\n", prefix,
+            mName.string(), mCount, mCount ? mTotalUs * 0.001 / mCount : 0.0, mMaxUs * 0.001);
+    if (!mCount) {
+        return;
+    }
+    result.appendFormat("%s  histogram (us):", prefix);
+    for (size_t i = 0; i < NUM_BUCKETS; i++) {
+        if (!mBuckets[i]) {
+            continue;
+        }
+        if (i == 0) {
+            result.appendFormat(" <1:%" PRIu64, mBuckets[i]);
+        } else if (i == NUM_BUCKETS - 1) {
+            result.appendFormat(" %" PRIu64 "+:%" PRIu64, uint64_t(1) << (i - 1), mBuckets[i]);
+        } else {
+            result.appendFormat(" %" PRIu64 "-%" PRIu64 ":%" PRIu64,
+                    uint64_t(1) << (i - 1), uint64_t(1) << i, mBuckets[i]);
+        }
+    }
+    result.append("\n");
+}
+
+} // namespace SensorServiceUtil
+} // namespace android
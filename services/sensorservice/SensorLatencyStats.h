@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef ANDROID_SENSOR_SERVICE_UTIL_SENSOR_LATENCY_STATS_H
+#define ANDROID_SENSOR_SERVICE_UTIL_SENSOR_LATENCY_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <utils/String8.h>
+#include <utils/Timers.h>
+
+namespace android {
+namespace SensorServiceUtil {
+
+// Histogram of the latency one stage of event delivery adds, for dumpsys sensorservice. While
+// tracing, each sample is also emitted as an atrace counter, in microseconds, so that sensor lag
+// can be lined up with the rest of a trace.
+//
+// Not thread safe; used under the lock of its owner.
+class LatencyHistogram {
+public:
+    // Bucket i counts latencies in [2^(i-1), 2^i) microseconds, bucket 0 counts those under 1us
+    // and the last bucket everything above.
+    static const size_t NUM_BUCKETS = 22;
+
+    LatencyHistogram(const String8& name, const String8& traceCounter);
+
+    void record(nsecs_t latency);
+    void dump(String8& result, const char* prefix) const;
+    uint64_t getCount() const { return mCount; }
+
+private:
+    const String8 mName;
+    const String8 mTraceCounter;
+    uint64_t mCount;
+    uint64_t mTotalUs;
+    uint64_t mMaxUs;
+    uint64_t mBuckets[NUM_BUCKETS];
+};
+
+} // namespace SensorServiceUtil
+} // namespace android;
+
+#endif // ANDROID_SENSOR_SERVICE_UTIL_SENSOR_LATENCY_STATS_H
@@ -78,7 +78,8 @@ static const String16 sLocationHardwarePermission("android.permission.LOCATION_H
 
 SensorService::SensorService()
     : mInitCheck(NO_INIT), mSocketBufferSize(SOCKET_BUFFER_SIZE_NON_BATCHED),
-      mWakeLockAcquired(false) {
+      mWakeLockAcquired(false), mFlushAllConnections(false),
+      mSubscriberIndex(new SubscriberIndex()) {
 }
 
 bool SensorService::initializeHmacKey() {
@@ -260,6 +261,7 @@ void SensorService::onFirstRef() {
             mSensorEventBuffer = new sensors_event_t[minBufferSize];
             mSensorEventScratch = new sensors_event_t[minBufferSize];
             mMapFlushEventsToConnections = new wp<const SensorEventConnection> [minBufferSize];
+            mSensorEventRuns = new SensorEventRun[minBufferSize];
             mCurrentOperatingMode = NORMAL;
 
             mNextSensorRegIndex = 0;
@@ -283,6 +285,8 @@ const Sensor& SensorService::registerSensor(SensorInterface* s, bool isDebug, bo
     int type = s->getSensor().getType();
     if (mSensors.add(handle, s, isDebug, isVirtual)){
         mRecentEvent.emplace(handle, new RecentEventLogger(type));
+        mHalLatency.emplace(handle, new LatencyHistogram(String8("HAL to poll"),
+                String8::format("SensorHalLatency %s", s->getSensor().getName().string())));
         return s->getSensor();
     } else {
         return mSensors.getNonSensor();
@@ -301,6 +305,11 @@ bool SensorService::unregisterDynamicSensorLocked(int handle) {
         delete i->second;
         mRecentEvent.erase(i);
     }
+    const auto latency = mHalLatency.find(handle);
+    if (latency != mHalLatency.end()) {
+        delete latency->second;
+        mHalLatency.erase(latency);
+    }
     return ret;
 }
 
@@ -312,6 +321,9 @@ SensorService::~SensorService() {
     for (auto && entry : mRecentEvent) {
         delete entry.second;
     }
+    for (auto && entry : mHalLatency) {
+        delete entry.second;
+    }
 }
 
 status_t SensorService::dump(int fd, const Vector<String16>& args) {
@@ -421,6 +433,14 @@ status_t SensorService::dump(int fd, const Vector<String16>& args) {
                 }
             }
 
+            result.append("Event latency:\n");
+            for (auto&& i : mHalLatency) {
+                if (i.second->getCount()) {
+                    result.appendFormat("%s:\n", getSensorName(i.first).string());
+                    i.second->dump(result, "  ");
+                }
+            }
+
             result.append("Active sensors:\n");
             for (size_t i=0 ; i<mActiveSensors.size() ; i++) {
                 int handle = mActiveSensors.keyAt(i);
@@ -522,26 +542,31 @@ bool SensorService::threadLoop() {
     SensorDevice& device(SensorDevice::getInstance());
 
     const int halVersion = device.getHalDeviceVersion();
+    // Whether each connection of the subscriber index gets the current batch.
+    Vector<bool> targets;
     do {
         ssize_t count = device.poll(mSensorEventBuffer, numEventMax);
         if (count < 0) {
             ALOGE("sensor poll failed (%s)", strerror(-count));
             break;
         }
-
-        // Reset sensors_event_t.flags to zero for all events in the buffer.
-        for (int i = 0; i < count; i++) {
-             mSensorEventBuffer[i].flags = 0;
-        }
+        // Event timestamps are on the elapsedRealtimeNanos() clock.
+        const nsecs_t pollTime = systemTime(SYSTEM_TIME_BOOTTIME);
 
         // Make a copy of the connection vector as some connections may be removed during the course
         // of this loop (especially when one-shot sensor events are present in the sensor_event
         // buffer). Promote all connections to StrongPointers before the lock is acquired. If the
         // destructor of the sp gets called when the lock is acquired, it may result in a deadlock
         // as ~SensorEventConnection() needs to acquire mLock again for cleanup. So copy all the
-        // strongPointers to a vector before the lock is acquired.
-        SortedVector< sp<SensorEventConnection> > activeConnections;
-        populateActiveConnections(&activeConnections);
+        // strongPointers to a vector before the lock is acquired. The connections come from the
+        // published subscriber index, in its order, so that taking them does not need mLock.
+        sp<const SubscriberIndex> subscriberIndex(getSubscriberIndex());
+        const size_t numConnections = subscriberIndex->connections.size();
+        Vector< sp<SensorEventConnection> > activeConnections;
+        activeConnections.setCapacity(numConnections);
+        for (size_t i = 0; i < numConnections; ++i) {
+            activeConnections.push(subscriberIndex->connections[i].promote());
+        }
 
         Mutex::Autolock _l(mLock);
         // Poll has returned. Hold a wakelock if one of the events is from a wake up sensor. The
@@ -550,141 +575,100 @@ bool SensorService::threadLoop() {
         // not be interleaved with decrementing SensorEventConnection::mWakeLockRefCount and
         // releasing the wakelock.
         bool bufferHasWakeUpEvent = false;
-        for (int i = 0; i < count; i++) {
-            if (isWakeUpSensorEvent(mSensorEventBuffer[i])) {
-                bufferHasWakeUpEvent = true;
-                break;
-            }
-        }
-
-        if (bufferHasWakeUpEvent && !mWakeLockAcquired) {
-            setWakeLockAcquiredLocked(true);
-        }
-        recordLastValueLocked(mSensorEventBuffer, count);
-
-        // handle virtual sensors
-        if (count && vcount) {
-            sensors_event_t const * const event = mSensorEventBuffer;
-            if (!mActiveVirtualSensors.empty()) {
-                size_t k = 0;
-                SensorFusion& fusion(SensorFusion::getInstance());
-                if (fusion.isEnabled()) {
-                    for (size_t i=0 ; i<size_t(count) ; i++) {
-                        fusion.process(event[i]);
-                    }
+        EventSensorInfo sensorInfo;
+        size_t numRuns = 0;
+
+        // Record the last values, run the virtual sensors and split the buffer into runs of events
+        // from one sensor in a single pass. Events synthesized by virtual sensors are written
+        // after the polled ones, which then have to be sorted by time-stamp before they can be
+        // split into runs.
+        const bool runVirtualSensors = vcount && !mActiveVirtualSensors.empty();
+        SensorFusion& fusion(SensorFusion::getInstance());
+        const bool runFusion = runVirtualSensors && fusion.isEnabled();
+        // handle backward compatibility for RotationVector sensor
+        const bool rotationVectorCompat = halVersion < SENSORS_DEVICE_API_VERSION_1_0;
+        size_t k = 0;
+        for (size_t i = 0; i < size_t(count); i++) {
+            sensors_event_t& event = mSensorEventBuffer[i];
+            const EventSensorInfo& info = getEventSensorInfoLocked(event, &sensorInfo);
+            bufferHasWakeUpEvent |= info.wakeUp;
+            recordLastValueLocked(event, info, pollTime);
+
+            if (runVirtualSensors) {
+                if (runFusion) {
+                    fusion.process(event);
                 }
-                for (size_t i=0 ; i<size_t(count) && k<minBufferSize ; i++) {
-                    for (int handle : mActiveVirtualSensors) {
-                        if (count + k >= minBufferSize) {
-                            ALOGE("buffer too small to hold all events: "
-                                    "count=%zd, k=%zu, size=%zu",
-                                    count, k, minBufferSize);
-                            break;
-                        }
-                        sensors_event_t out;
-                        sp<SensorInterface> si = mSensors.getInterface(handle);
-                        if (si == nullptr) {
-                            ALOGE("handle %d is not an valid virtual sensor", handle);
-                            continue;
-                        }
+                for (int handle : mActiveVirtualSensors) {
+                    if (count + k >= minBufferSize) {
+                        ALOGE("buffer too small to hold all events: count=%zd, k=%zu, size=%zu",
+                                count, k, minBufferSize);
+                        break;
+                    }
+                    sp<SensorInterface> si = mSensors.getInterface(handle);
+                    if (si == nullptr) {
+                        ALOGE("handle %d is not an valid virtual sensor", handle);
+                        continue;
+                    }
 
-                        if (si->process(&out, event[i])) {
-                            mSensorEventBuffer[count + k] = out;
-                            k++;
+                    sensors_event_t& out = mSensorEventBuffer[count + k];
+                    if (si->process(&out, event)) {
+                        // Virtual events are stamped with their input, which was timed above.
+                        recordLastValueLocked(out, getEventSensorInfoLocked(out, &sensorInfo), 0);
+                        if (rotationVectorCompat) {
+                            applyRotationVectorCompat(&out);
                         }
+                        k++;
                     }
                 }
-                if (k) {
-                    // record the last synthesized values
-                    recordLastValueLocked(&mSensorEventBuffer[count], k);
-                    count += k;
-                    // sort the buffer by time-stamps
-                    sortEventBuffer(mSensorEventBuffer, count);
-                }
+            } else {
+                routeEventLocked(i, activeConnections, &numRuns, &sensorInfo);
+            }
+            if (rotationVectorCompat) {
+                applyRotationVectorCompat(&event);
             }
         }
 
-        // handle backward compatibility for RotationVector sensor
-        if (halVersion < SENSORS_DEVICE_API_VERSION_1_0) {
-            for (int i = 0; i < count; i++) {
-                if (mSensorEventBuffer[i].type == SENSOR_TYPE_ROTATION_VECTOR) {
-                    // All the 4 components of the quaternion should be available
-                    // No heading accuracy. Set it to -1
-                    mSensorEventBuffer[i].data[4] = -1;
-                }
-            }
+        if (bufferHasWakeUpEvent && !mWakeLockAcquired) {
+            setWakeLockAcquiredLocked(true);
         }
 
-        for (int i = 0; i < count; ++i) {
-            // Map flush_complete_events in the buffer to SensorEventConnections which called flush
-            // on the hardware sensor. mapFlushEventsToConnections[i] will be the
-            // SensorEventConnection mapped to the corresponding flush_complete_event in
-            // mSensorEventBuffer[i] if such a mapping exists (NULL otherwise).
-            mMapFlushEventsToConnections[i] = NULL;
-            if (mSensorEventBuffer[i].type == SENSOR_TYPE_META_DATA) {
-                const int sensor_handle = mSensorEventBuffer[i].meta_data.sensor;
-                SensorRecord* rec = mActiveSensors.valueFor(sensor_handle);
-                if (rec != NULL) {
-                    mMapFlushEventsToConnections[i] = rec->getFirstPendingFlushConnection();
-                    rec->removeFirstPendingFlushConnection();
-                }
+        if (runVirtualSensors) {
+            count += k;
+            if (k) {
+                // sort the buffer by time-stamps
+                sortEventBuffer(mSensorEventBuffer, count);
             }
+            for (size_t i = 0; i < size_t(count); i++) {
+                routeEventLocked(i, activeConnections, &numRuns, &sensorInfo);
+            }
+        }
 
-            // handle dynamic sensor meta events, process registration and unregistration of dynamic
-            // sensor based on content of event.
-            if (mSensorEventBuffer[i].type == SENSOR_TYPE_DYNAMIC_SENSOR_META) {
-                if (mSensorEventBuffer[i].dynamic_sensor_meta.connected) {
-                    int handle = mSensorEventBuffer[i].dynamic_sensor_meta.handle;
-                    const sensor_t& dynamicSensor =
-                            *(mSensorEventBuffer[i].dynamic_sensor_meta.sensor);
-                    ALOGI("Dynamic sensor handle 0x%x connected, type %d, name %s",
-                          handle, dynamicSensor.type, dynamicSensor.name);
-
-                    if (mSensors.isNewHandle(handle)) {
-                        const auto& uuid = mSensorEventBuffer[i].dynamic_sensor_meta.uuid;
-                        sensor_t s = dynamicSensor;
-                        // make sure the dynamic sensor flag is set
-                        s.flags |= DYNAMIC_SENSOR_MASK;
-                        // force the handle to be consistent
-                        s.handle = handle;
-
-                        SensorInterface *si = new HardwareSensor(s, uuid);
-
-                        // This will release hold on dynamic sensor meta, so it should be called
-                        // after Sensor object is created.
-                        device.handleDynamicSensorConnection(handle, true /*connected*/);
-                        registerDynamicSensorLocked(si);
-                    } else {
-                        ALOGE("Handle %d has been used, cannot use again before reboot.", handle);
-                    }
-                } else {
-                    int handle = mSensorEventBuffer[i].dynamic_sensor_meta.handle;
-                    ALOGI("Dynamic sensor handle 0x%x disconnected", handle);
-
-                    device.handleDynamicSensorConnection(handle, false /*connected*/);
-                    if (!unregisterDynamicSensorLocked(handle)) {
-                        ALOGE("Dynamic sensor release error.");
-                    }
-
-                    size_t numConnections = activeConnections.size();
-                    for (size_t i=0 ; i < numConnections; ++i) {
-                        if (activeConnections[i] != NULL) {
-                            activeConnections[i]->removeSensor(handle);
-                        }
-                    }
+        // Only the connections which enabled a sensor of this batch get it. An emulated flush is
+        // delivered by whatever batch comes next, so that one goes to all of them.
+        targets.clear();
+        targets.insertAt(mFlushAllConnections, 0, numConnections);
+        mFlushAllConnections = false;
+        for (size_t r = 0; r < numRuns; ++r) {
+            ssize_t index = subscriberIndex->subscribers.indexOfKey(mSensorEventRuns[r].handle);
+            if (index >= 0) {
+                const Vector<size_t>& subscribers = subscriberIndex->subscribers.valueAt(index);
+                for (size_t s = 0; s < subscribers.size(); ++s) {
+                    targets.editItemAt(subscribers[s]) = true;
                 }
             }
         }
 
-
         // Send our events to clients. Check the state of wake lock for each client and release the
         // lock if none of the clients need it.
         bool needsWakeLock = false;
-        size_t numConnections = activeConnections.size();
         for (size_t i=0 ; i < numConnections; ++i) {
             if (activeConnections[i] != 0) {
-                activeConnections[i]->sendEvents(mSensorEventBuffer, count, mSensorEventScratch,
-                        mMapFlushEventsToConnections);
+                if (!targets[i]) {
+                    needsWakeLock |= activeConnections[i]->needsWakeLock();
+                    continue;
+                }
+                activeConnections[i]->sendEventRuns(mSensorEventBuffer, mSensorEventRuns, numRuns,
+                        mSensorEventScratch, mMapFlushEventsToConnections, pollTime);
                 needsWakeLock |= activeConnections[i]->needsWakeLock();
                 // If the connection has one-shot sensors, it may be cleaned up after first trigger.
                 // Early check for one-shot sensors.
@@ -758,19 +742,137 @@ bool SensorService::SensorEventAckReceiver::threadLoop() {
     return false;
 }
 
+const SensorService::EventSensorInfo& SensorService::getEventSensorInfoLocked(
+        const sensors_event_t& event, EventSensorInfo* cache) {
+    int handle = event.sensor;
+    if (event.type == SENSOR_TYPE_META_DATA) {
+        handle = event.meta_data.sensor;
+    }
+    // Events mostly come in runs from one sensor, so only look the sensor up when that changes.
+    if (!cache->valid || cache->handle != handle) {
+        sp<SensorInterface> sensor = getSensorInterfaceFromHandle(handle);
+        auto logger = mRecentEvent.find(handle);
+        auto halLatency = mHalLatency.find(handle);
+        cache->valid = true;
+        cache->handle = handle;
+        cache->wakeUp = sensor != nullptr && sensor->getSensor().isWakeUpSensor();
+        cache->logger = logger != mRecentEvent.end() ? logger->second : nullptr;
+        cache->halLatency = halLatency != mHalLatency.end() ? halLatency->second : nullptr;
+        cache->batchReportLatency = SensorDevice::getInstance().getBatchReportLatency(handle);
+    }
+    return *cache;
+}
+
 void SensorService::recordLastValueLocked(
-        const sensors_event_t* buffer, size_t count) {
-    for (size_t i = 0; i < count; i++) {
-        if (buffer[i].type == SENSOR_TYPE_META_DATA ||
-            buffer[i].type == SENSOR_TYPE_DYNAMIC_SENSOR_META ||
-            buffer[i].type == SENSOR_TYPE_ADDITIONAL_INFO) {
-            continue;
+        const sensors_event_t& event, const EventSensorInfo& info, nsecs_t pollTime) {
+    if (event.type == SENSOR_TYPE_META_DATA ||
+        event.type == SENSOR_TYPE_DYNAMIC_SENSOR_META ||
+        event.type == SENSOR_TYPE_ADDITIONAL_INFO) {
+        return;
+    }
+
+    if (info.logger != nullptr) {
+        info.logger->addEvent(event);
+    }
+    if (pollTime && info.halLatency != nullptr) {
+        info.halLatency->record(pollTime - event.timestamp);
+    }
+}
+
+void SensorService::applyRotationVectorCompat(sensors_event_t* event) {
+    if (event->type == SENSOR_TYPE_ROTATION_VECTOR) {
+        // All the 4 components of the quaternion should be available
+        // No heading accuracy. Set it to -1
+        event->data[4] = -1;
+    }
+}
+
+void SensorService::routeEventLocked(size_t i,
+        const Vector< sp<SensorEventConnection> >& activeConnections, size_t* numRuns,
+        EventSensorInfo* cache) {
+    const sensors_event_t& event = mSensorEventBuffer[i];
+    const EventSensorInfo& info = getEventSensorInfoLocked(event, cache);
+    const bool flush = event.type == SENSOR_TYPE_META_DATA;
+
+    // Map flush_complete_events in the buffer to SensorEventConnections which called flush on the
+    // hardware sensor. mapFlushEventsToConnections[i] will be the SensorEventConnection mapped to
+    // the corresponding flush_complete_event in mSensorEventBuffer[i] if such a mapping exists
+    // (NULL otherwise).
+    mMapFlushEventsToConnections[i] = NULL;
+    if (flush) {
+        SensorRecord* rec = mActiveSensors.valueFor(info.handle);
+        if (rec != NULL) {
+            mMapFlushEventsToConnections[i] = rec->getFirstPendingFlushConnection();
+            rec->removeFirstPendingFlushConnection();
+        }
+    }
+
+    // Regular events from one sensor extend the current run. A flush_complete_event is a run of
+    // its own, as it goes to at most one connection.
+    SensorEventRun* run = *numRuns ? &mSensorEventRuns[*numRuns - 1] : NULL;
+    if (!flush && run != NULL && !run->flush && run->handle == info.handle) {
+        run->count++;
+    } else {
+        run = &mSensorEventRuns[(*numRuns)++];
+        run->handle = info.handle;
+        run->first = i;
+        run->count = 1;
+        run->wakeUp = info.wakeUp;
+        run->flush = flush;
+        run->halLatency = info.batchReportLatency;
+    }
+
+    if (event.type == SENSOR_TYPE_DYNAMIC_SENSOR_META) {
+        handleDynamicSensorMetaLocked(event, activeConnections);
+        // The sensors may have changed under the cached lookup.
+        cache->valid = false;
+    }
+}
+
+// handle dynamic sensor meta events, process registration and unregistration of dynamic sensor
+// based on content of event.
+void SensorService::handleDynamicSensorMetaLocked(const sensors_event_t& event,
+        const Vector< sp<SensorEventConnection> >& activeConnections) {
+    SensorDevice& device(SensorDevice::getInstance());
+    if (event.dynamic_sensor_meta.connected) {
+        int handle = event.dynamic_sensor_meta.handle;
+        const sensor_t& dynamicSensor = *(event.dynamic_sensor_meta.sensor);
+        ALOGI("Dynamic sensor handle 0x%x connected, type %d, name %s",
+              handle, dynamicSensor.type, dynamicSensor.name);
+
+        if (mSensors.isNewHandle(handle)) {
+            const auto& uuid = event.dynamic_sensor_meta.uuid;
+            sensor_t s = dynamicSensor;
+            // make sure the dynamic sensor flag is set
+            s.flags |= DYNAMIC_SENSOR_MASK;
+            // force the handle to be consistent
+            s.handle = handle;
+
+            SensorInterface *si = new HardwareSensor(s, uuid);
+
+            // This will release hold on dynamic sensor meta, so it should be called
+            // after Sensor object is created.
+            device.handleDynamicSensorConnection(handle, true /*connected*/);
+            registerDynamicSensorLocked(si);
+        } else {
+            ALOGE("Handle %d has been used, cannot use again before reboot.", handle);
         }
+    } else {
+        int handle = event.dynamic_sensor_meta.handle;
+        ALOGI("Dynamic sensor handle 0x%x disconnected", handle);
 
-        auto logger = mRecentEvent.find(buffer[i].sensor);
-        if (logger != mRecentEvent.end()) {
-            logger->second->addEvent(buffer[i]);
+        device.handleDynamicSensorConnection(handle, false /*connected*/);
+        if (!unregisterDynamicSensorLocked(handle)) {
+            ALOGE("Dynamic sensor release error.");
         }
+
+        size_t numConnections = activeConnections.size();
+        for (size_t i=0 ; i < numConnections; ++i) {
+            if (activeConnections[i] != NULL) {
+                activeConnections[i]->removeSensor(handle);
+            }
+        }
+        removeSubscribersLocked(handle);
     }
 }
 
@@ -1140,6 +1242,7 @@ void SensorService::cleanupConnection(SensorEventConnection* c) {
                 ALOGE("sensor interface of handle=0x%08x is null!", handle);
             }
             c->removeSensor(handle);
+            removeSubscriberLocked(handle, connection);
         }
         SensorRecord* rec = mActiveSensors.valueAt(i);
         ALOGE_IF(!rec, "mActiveSensors[%zu] is null (handle=0x%08x)!", i, handle);
@@ -1239,6 +1342,7 @@ status_t SensorService::enable(const sp<SensorEventConnection>& connection,
 
     if (connection->addSensor(handle)) {
         BatteryService::enableSensor(connection->getUid(), handle);
+        addSubscriberLocked(handle, connection);
         // the sensor was added (which means it wasn't already there)
         // so, see if this connection becomes active
         if (mActiveConnections.indexOf(connection) < 0) {
@@ -1266,6 +1370,11 @@ status_t SensorService::enable(const sp<SensorEventConnection>& connection,
 
     status_t err = sensor->batch(connection.get(), handle, 0, samplingPeriodNs,
                                  maxBatchReportLatencyNs);
+    if (err == NO_ERROR) {
+        // The HAL batches for the most demanding connection; the others are batched further
+        // by the connection itself.
+        connection->setMaxBatchReportLatency(handle, maxBatchReportLatencyNs);
+    }
 
     // Call flush() before calling activate() on the sensor. Wait for a first
     // flush complete event before sending events on this connection. Ignore
@@ -1339,6 +1448,7 @@ status_t SensorService::cleanupWithoutDisableLocked(
         // see if this connection becomes inactive
         if (connection->removeSensor(handle)) {
             BatteryService::disableSensor(connection->getUid(), handle);
+            removeSubscriberLocked(handle, connection);
         }
         if (connection->hasAnySensor() == false) {
             connection->updateLooperRegistration(mLooper);
@@ -1400,6 +1510,7 @@ status_t SensorService::flushSensor(const sp<SensorEventConnection>& connection,
             // For older devices just increment pending flush count which will send a trivial
             // flush complete event.
             connection->incrementPendingFlushCount(handle);
+            mFlushAllConnections = true;
         } else {
             if (!canAccessSensor(sensor->getSensor(), "Tried flushing", opPackageName)) {
                 err = INVALID_OPERATION;
@@ -1497,6 +1608,64 @@ void SensorService::populateActiveConnections(
     }
 }
 
+void SensorService::addSubscriberLocked(int handle,
+        const wp<SensorEventConnection>& connection) {
+    ssize_t index = mSubscribers.indexOfKey(handle);
+    if (index < 0) {
+        index = mSubscribers.add(handle, SortedVector< wp<SensorEventConnection> >());
+    }
+    mSubscribers.editValueAt(index).add(connection);
+    publishSubscriberIndexLocked();
+}
+
+void SensorService::removeSubscriberLocked(int handle,
+        const wp<SensorEventConnection>& connection) {
+    ssize_t index = mSubscribers.indexOfKey(handle);
+    if (index < 0 || mSubscribers.editValueAt(index).remove(connection) < 0) {
+        return;
+    }
+    if (mSubscribers.valueAt(index).isEmpty()) {
+        mSubscribers.removeItemsAt(index);
+    }
+    publishSubscriberIndexLocked();
+}
+
+void SensorService::removeSubscribersLocked(int handle) {
+    if (mSubscribers.removeItem(handle) >= 0) {
+        publishSubscriberIndexLocked();
+    }
+}
+
+void SensorService::publishSubscriberIndexLocked() {
+    // Connections only enable or disable sensors now and then, so the index is simply rebuilt.
+    sp<SubscriberIndex> index(new SubscriberIndex());
+    SortedVector< wp<SensorEventConnection> > connections;
+    for (size_t i = 0; i < mSubscribers.size(); ++i) {
+        const SortedVector< wp<SensorEventConnection> >& subscribers = mSubscribers.valueAt(i);
+        for (size_t j = 0; j < subscribers.size(); ++j) {
+            connections.add(subscribers[j]);
+        }
+    }
+    index->connections.appendArray(connections.array(), connections.size());
+    for (size_t i = 0; i < mSubscribers.size(); ++i) {
+        const SortedVector< wp<SensorEventConnection> >& subscribers = mSubscribers.valueAt(i);
+        Vector<size_t> indices;
+        indices.setCapacity(subscribers.size());
+        for (size_t j = 0; j < subscribers.size(); ++j) {
+            indices.push(connections.indexOf(subscribers[j]));
+        }
+        index->subscribers.add(mSubscribers.keyAt(i), indices);
+    }
+
+    Mutex::Autolock _l(mSubscriberIndexLock);
+    mSubscriberIndex = index;
+}
+
+sp<const SensorService::SubscriberIndex> SensorService::getSubscriberIndex() const {
+    Mutex::Autolock _l(mSubscriberIndexLock);
+    return mSubscriberIndex;
+}
+
 bool SensorService::isWhiteListedPackage(const String8& packageName) {
     return (packageName.contains(mWhiteListedPackage.string()));
 }
@@ -19,6 +19,7 @@
 
 #include "SensorList.h"
 #include "RecentEventLogger.h"
+#include "SensorLatencyStats.h"
 
 #include <binder/BinderService.h>
 #include <cutils/compiler.h>
@@ -69,6 +70,29 @@ class SensorService :
     class SensorEventConnection;
     class SensorDirectConnection;
 
+    // Events of mSensorEventBuffer from one sensor, next to each other. Built once per poll so
+    // that each connection filters the buffer per run rather than per event.
+    struct SensorEventRun {
+        int handle;
+        size_t first;
+        size_t count;
+        bool wakeUp;
+        // A single flush_complete_event, delivered to mMapFlushEventsToConnections[first].
+        bool flush;
+        // SensorDevice::getBatchReportLatency() of the sensor.
+        nsecs_t halLatency;
+    };
+
+    // The connections which enabled each sensor. A published index is never modified: updates
+    // build a new one and swap it in, so threadLoop() takes the current one without mLock and
+    // only hands a batch to the connections which enabled one of its sensors.
+    struct SubscriberIndex : public LightRefBase<SubscriberIndex> {
+        // Every connection with at least one sensor enabled.
+        Vector< wp<SensorEventConnection> > connections;
+        // For each sensor handle, indices in connections.
+        KeyedVector<int, Vector<size_t> > subscribers;
+    };
+
 public:
     void cleanupConnection(SensorEventConnection* connection);
     void cleanupConnection(SensorDirectConnection* c);
@@ -166,7 +190,32 @@ private:
     bool isVirtualSensor(int handle) const;
     sp<SensorInterface> getSensorInterfaceFromHandle(int handle) const;
     bool isWakeUpSensor(int type) const;
-    void recordLastValueLocked(sensors_event_t const* buffer, size_t count);
+
+    // What threadLoop() needs to know about the sensor of an event, cached across events from
+    // the same sensor.
+    struct EventSensorInfo {
+        EventSensorInfo() : valid(false), handle(0), wakeUp(false), logger(nullptr),
+                halLatency(nullptr), batchReportLatency(0) { }
+        bool valid;
+        int handle;
+        bool wakeUp;
+        RecentEventLogger* logger;
+        LatencyHistogram* halLatency;
+        nsecs_t batchReportLatency;
+    };
+    const EventSensorInfo& getEventSensorInfoLocked(const sensors_event_t& event,
+            EventSensorInfo* cache);
+    // Also records the latency of event up to pollTime, if not 0.
+    void recordLastValueLocked(const sensors_event_t& event, const EventSensorInfo& info,
+            nsecs_t pollTime);
+    static void applyRotationVectorCompat(sensors_event_t* event);
+    // Maps mSensorEventBuffer[i] to the connection it is flushed to if it is a flush complete
+    // event, handles dynamic sensor meta events and adds the event to mSensorEventRuns.
+    void routeEventLocked(size_t i,
+            const Vector< sp<SensorEventConnection> >& activeConnections,
+            size_t* numRuns, EventSensorInfo* cache);
+    void handleDynamicSensorMetaLocked(const sensors_event_t& event,
+            const Vector< sp<SensorEventConnection> >& activeConnections);
     static void sortEventBuffer(sensors_event_t* buffer, size_t count);
     const Sensor& registerSensor(SensorInterface* sensor,
                                  bool isDebug = false, bool isVirtual = false);
@@ -205,6 +254,14 @@ private:
     // to the output vector.
     void populateActiveConnections( SortedVector< sp<SensorEventConnection> >* activeConnections);
 
+    // Record that a connection enabled or disabled a sensor, or went away, and publish the
+    // updated SubscriberIndex.
+    void addSubscriberLocked(int handle, const wp<SensorEventConnection>& connection);
+    void removeSubscriberLocked(int handle, const wp<SensorEventConnection>& connection);
+    void removeSubscribersLocked(int handle);
+    void publishSubscriberIndexLocked();
+    sp<const SubscriberIndex> getSubscriberIndex() const;
+
     // If SensorService is operating in RESTRICTED mode, only select whitelisted packages are
     // allowed to register for or call flush on sensors. Typically only cts test packages are
     // allowed.
@@ -245,7 +302,15 @@ private:
     bool mWakeLockAcquired;
     sensors_event_t *mSensorEventBuffer, *mSensorEventScratch;
     wp<const SensorEventConnection> * mMapFlushEventsToConnections;
+    SensorEventRun* mSensorEventRuns;
+    // The connections which enabled each sensor, published as mSubscriberIndex.
+    KeyedVector<int, SortedVector< wp<SensorEventConnection> > > mSubscribers;
+    // Set by an emulated flush, which is only delivered by the next batch sent to the
+    // connection.
+    bool mFlushAllConnections;
     std::unordered_map<int, RecentEventLogger*> mRecentEvent;
+    // Per sensor, from the timestamp of an event to the return of the poll which read it.
+    std::unordered_map<int, LatencyHistogram*> mHalLatency;
     SortedVector< wp<SensorDirectConnection> > mDirectConnections;
     Mode mCurrentOperatingMode;
 
@@ -255,6 +320,10 @@ private:
     // sensors.
     String8 mWhiteListedPackage;
 
+    // mSubscriberIndexLock only guards swapping mSubscriberIndex, not the index.
+    mutable Mutex mSubscriberIndexLock;
+    sp<const SubscriberIndex> mSubscriberIndex;
+
     int mNextSensorRegIndex;
     Vector<SensorRegistrationInfo> mLastNSensorRegistrations;
 };
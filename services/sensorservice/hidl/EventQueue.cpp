@@ -34,7 +34,7 @@ public:
 
     int handleEvent(__unused int fd, __unused int events, __unused void* data) {
 
-        ASensorEvent event;
+        ASensorEvent const* events;
         ssize_t actual;
 
         auto internalQueue = mQueue.promote();
@@ -42,10 +42,15 @@ public:
             return 1;
         }
 
-        while ((actual = internalQueue->read(&event, 1 /* count */)) > 0) {
-            internalQueue->sendAck(&event, actual);
-            Return<void> ret = mCallback->onEvent(convertEvent(event));
-            (void)ret.isOk(); // ignored
+        // Hand out the events straight from the receive buffer of the queue; the wake-up events
+        // of each batch are acknowledged together once they have all been delivered.
+        while ((actual = internalQueue->borrowEvents(&events,
+                ::android::SensorEventQueue::MAX_RECEIVE_BUFFER_EVENT_COUNT)) > 0) {
+            for (ssize_t i = 0; i < actual; ++i) {
+                Return<void> ret = mCallback->onEvent(convertEvent(events[i]));
+                (void)ret.isOk(); // ignored
+            }
+            internalQueue->releaseEvents();
         }
 
         return 1; // continue to receive callbacks
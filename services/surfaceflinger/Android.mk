@@ -8,10 +8,16 @@ LOCAL_SRC_FILES := \
     Client.cpp \
     DisplayDevice.cpp \
     DispSync.cpp \
+    DumpSnapshot.cpp \
     EventControlThread.cpp \
     StartBootAnimThread.cpp \
     EventThread.cpp \
+    FrameTimelineRecorder.cpp \
+    ScreenshotBufferPool.cpp \
+    RefreshRatePolicy.cpp \
+    LayerFlatteningPolicy.cpp \
     FrameTracker.cpp \
+    QueuedBufferRing.cpp \
     GpuService.cpp \
     Layer.cpp \
     LayerDim.cpp \
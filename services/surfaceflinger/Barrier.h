@@ -53,6 +53,21 @@ public:
             cv.wait(lock);
         }
     }
+
+    // Same as wait(), but gives up after timeout. Returns true if the Barrier
+    // was opened.
+    bool waitFor(nsecs_t timeout) const {
+        Mutex::Autolock _l(lock);
+        const nsecs_t deadline = systemTime() + timeout;
+        while (state == CLOSED) {
+            const nsecs_t remaining = deadline - systemTime();
+            if (remaining <= 0) {
+                return false;
+            }
+            cv.waitRelative(lock, remaining);
+        }
+        return true;
+    }
 private:
     enum { OPENED, CLOSED };
     mutable     Mutex       lock;
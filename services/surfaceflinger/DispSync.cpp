@@ -21,6 +21,7 @@
 #define __STDC_LIMIT_MACROS
 
 #include <math.h>
+#include <stdlib.h>
 
 #include <algorithm>
 
@@ -55,6 +56,17 @@ static const bool kEnableZeroPhaseTracer = false;
 // present time and the nearest software-predicted vsync.
 static const nsecs_t kErrorThreshold = 160000000000;    // 400 usec squared
 
+// Present times further than this fraction of a period from the median
+// error are considered outliers, e.g. fences signaled late by the driver.
+static const nsecs_t kOutlierDivisor = 8;
+
+// The model is only refined from present fences if the fitted period is
+// within this fraction of the current one, larger changes need a resync.
+static const double kMaxPresentPeriodCorrection = 0.005;
+
+// Corrections smaller than this aren't worth waking DispSyncThread for.
+static const nsecs_t kMinPresentModelCorrection = 20000;    // 20 usec
+
 #undef LOG_TAG
 #define LOG_TAG "DispSyncThread"
 class DispSyncThread: public Thread {
@@ -378,7 +390,14 @@ DispSync::DispSync(const char* name) :
         mName(name),
         mRefreshSkipCount(0),
         mThread(new DispSyncThread(name)),
-        mIgnorePresentFences(!SurfaceFlinger::hasSyncFramework){
+        mIgnorePresentFences(!SurfaceFlinger::hasSyncFramework),
+        mCreationTime(systemTime(SYSTEM_TIME_MONOTONIC)),
+        mResyncStartTime(0),
+        mTotalResyncTime(0),
+        mNumResyncs(0),
+        mNumPresentModelUpdates(0),
+        mNumPresentOutliers(0),
+        mNumErrorSamples(0) {
 
     mPresentTimeOffset = SurfaceFlinger::dispSyncPresentTimeOffset;
     mThread->run("DispSync", PRIORITY_URGENT_DISPLAY + PRIORITY_MORE_FAVORABLE);
@@ -424,6 +443,7 @@ bool DispSync::addPresentFence(const sp<Fence>& fence) {
 
     mPresentFences[mPresentSampleOffset] = fence;
     mPresentTimes[mPresentSampleOffset] = 0;
+    mPresentOutliers[mPresentSampleOffset] = false;
     mPresentSampleOffset = (mPresentSampleOffset + 1) % NUM_PRESENT_SAMPLES;
     mNumResyncSamplesSincePresent = 0;
 
@@ -438,8 +458,14 @@ bool DispSync::addPresentFence(const sp<Fence>& fence) {
         }
     }
 
+    updateModelFromPresentLocked();
     updateErrorLocked();
 
+    if (mModelUpdated) {
+        mErrorSamples[mNumErrorSamples % NUM_ERROR_SAMPLES] = nsecs_t(sqrt(mError));
+        mNumErrorSamples++;
+    }
+
     return !mModelUpdated || mError > kErrorThreshold;
 }
 
@@ -448,6 +474,10 @@ void DispSync::beginResync() {
     ALOGV("[%s] beginResync", mName);
     mModelUpdated = false;
     mNumResyncSamples = 0;
+    if (mResyncStartTime == 0) {
+        mResyncStartTime = systemTime(SYSTEM_TIME_MONOTONIC);
+        mNumResyncs++;
+    }
 }
 
 bool DispSync::addResyncSample(nsecs_t timestamp) {
@@ -496,6 +526,11 @@ bool DispSync::addResyncSample(nsecs_t timestamp) {
 }
 
 void DispSync::endResync() {
+    Mutex::Autolock lock(mMutex);
+    if (mResyncStartTime != 0) {
+        mTotalResyncTime += systemTime(SYSTEM_TIME_MONOTONIC) - mResyncStartTime;
+        mResyncStartTime = 0;
+    }
 }
 
 status_t DispSync::addEventListener(const char* name, nsecs_t phase,
@@ -589,6 +624,109 @@ void DispSync::updateModelLocked() {
     }
 }
 
+void DispSync::updateModelFromPresentLocked() {
+    if (!mModelUpdated || mIgnorePresentFences) {
+        return;
+    }
+
+    // Need to compare present fences against the un-adjusted refresh period,
+    // since they might arrive between two events.
+    const nsecs_t period = mPeriod / (1 + mRefreshSkipCount);
+    const nsecs_t base = mReferenceTime + mPhase;
+
+    // Match each present time with the modeled vsync it is closest to
+    size_t indices[NUM_PRESENT_SAMPLES];
+    nsecs_t vsyncs[NUM_PRESENT_SAMPLES];
+    nsecs_t errors[NUM_PRESENT_SAMPLES];
+    size_t numSamples = 0;
+    for (size_t i = 0; i < NUM_PRESENT_SAMPLES; i++) {
+        nsecs_t sample = mPresentTimes[i] - base;
+        if (mPresentTimes[i] == 0 || sample <= 0) {
+            continue;
+        }
+        indices[numSamples] = i;
+        vsyncs[numSamples] = (sample + period / 2) / period;
+        errors[numSamples] = sample - vsyncs[numSamples] * period;
+        numSamples++;
+    }
+    if (numSamples < MIN_PRESENT_SAMPLES_FOR_UPDATE) {
+        return;
+    }
+
+    // Reject the samples that are too far from the median error. A drift
+    // moves all of them together so it doesn't move any sample away from
+    // the median.
+    nsecs_t sortedErrors[NUM_PRESENT_SAMPLES];
+    std::copy(errors, errors + numSamples, sortedErrors);
+    std::nth_element(sortedErrors, sortedErrors + numSamples / 2,
+            sortedErrors + numSamples);
+    const nsecs_t medianError = sortedErrors[numSamples / 2];
+
+    double sumX = 0;
+    double sumY = 0;
+    size_t numInliers = 0;
+    for (size_t i = 0; i < numSamples; i++) {
+        const bool outlier = llabs(errors[i] - medianError) > period / kOutlierDivisor;
+        if (outlier && !mPresentOutliers[indices[i]]) {
+            mNumPresentOutliers++;
+        }
+        mPresentOutliers[indices[i]] = outlier;
+        if (!outlier) {
+            sumX += vsyncs[i];
+            sumY += vsyncs[i] * period + errors[i];
+            numInliers++;
+        }
+    }
+    if (numInliers < MIN_PRESENT_SAMPLES_FOR_UPDATE) {
+        return;
+    }
+
+    // Least squares fit of present time = intercept + vsync * slope
+    const double avgX = sumX / numInliers;
+    const double avgY = sumY / numInliers;
+    double covariance = 0;
+    double variance = 0;
+    for (size_t i = 0; i < numSamples; i++) {
+        if (mPresentOutliers[indices[i]]) {
+            continue;
+        }
+        const double dx = vsyncs[i] - avgX;
+        covariance += dx * (vsyncs[i] * period + errors[i] - avgY);
+        variance += dx * dx;
+    }
+    if (variance == 0) {
+        return;
+    }
+    const double slope = covariance / variance;
+    const double intercept = avgY - slope * avgX;
+    if (fabs(slope - period) > period * kMaxPresentPeriodCorrection) {
+        return;
+    }
+
+    const nsecs_t newPeriod = nsecs_t(slope + 0.5);
+    const nsecs_t phaseCorrection = nsecs_t(intercept);
+    if (llabs(phaseCorrection) < kMinPresentModelCorrection &&
+            llabs(newPeriod - period) * NUM_PRESENT_SAMPLES < kMinPresentModelCorrection) {
+        return;
+    }
+
+    mPhase = (mPhase + phaseCorrection) % newPeriod;
+    if (mPhase < -(newPeriod / 2)) {
+        mPhase += newPeriod;
+    }
+    mPeriod = newPeriod * (1 + mRefreshSkipCount);
+    mNumPresentModelUpdates++;
+
+    ALOGV("[%s] Present fences moved mPeriod = %" PRId64 ", mPhase = %" PRId64,
+            mName, ns2us(mPeriod), ns2us(mPhase));
+    if (kTraceDetailedInfo) {
+        ATRACE_INT64("DispSync:Period", mPeriod);
+        ATRACE_INT64("DispSync:Phase", mPhase + mPeriod / 2);
+    }
+
+    mThread->updateModel(mPeriod, mPhase, mReferenceTime);
+}
+
 void DispSync::updateErrorLocked() {
     if (!mModelUpdated) {
         return;
@@ -602,6 +740,9 @@ void DispSync::updateErrorLocked() {
     nsecs_t sqErrSum = 0;
 
     for (size_t i = 0; i < NUM_PRESENT_SAMPLES; i++) {
+        if (mPresentOutliers[i]) {
+            continue;
+        }
         nsecs_t sample = mPresentTimes[i] - mReferenceTime;
         if (sample > mPhase) {
             nsecs_t sampleErr = (sample - mPhase) % period;
@@ -630,6 +771,7 @@ void DispSync::resetErrorLocked() {
     for (size_t i = 0; i < NUM_PRESENT_SAMPLES; i++) {
         mPresentFences[i].clear();
         mPresentTimes[i] = 0;
+        mPresentOutliers[i] = false;
     }
 }
 
@@ -693,6 +835,33 @@ void DispSync::dump(String8& result) const {
     }
 
     result.appendFormat("current monotonic time: %" PRId64 "\n", now);
+
+    nsecs_t resyncTime = mTotalResyncTime;
+    if (mResyncStartTime != 0) {
+        resyncTime += now - mResyncStartTime;
+    }
+    const nsecs_t uptime = now - mCreationTime;
+    result.appendFormat("hardware vsync on: %.3f s (%.2f%% of %.3f s), "
+            "%" PRIu64 " resyncs\n", resyncTime / 1e9,
+            uptime > 0 ? 100.0 * resyncTime / uptime : 0.0, uptime / 1e9,
+            mNumResyncs);
+    result.appendFormat("model updates from present fences: %" PRIu64
+            ", outliers rejected: %" PRIu64 "\n", mNumPresentModelUpdates,
+            mNumPresentOutliers);
+
+    const size_t numErrorSamples = min(mNumErrorSamples, size_t(NUM_ERROR_SAMPLES));
+    if (numErrorSamples > 0) {
+        nsecs_t errors[NUM_ERROR_SAMPLES];
+        std::copy(mErrorSamples, mErrorSamples + numErrorSamples, errors);
+        std::sort(errors, errors + numErrorSamples);
+        result.appendFormat("model error over the last %zu present fences: "
+                "p50=%" PRId64 " us p90=%" PRId64 " us p99=%" PRId64 " us max=%"
+                PRId64 " us\n", numErrorSamples,
+                ns2us(errors[numErrorSamples * 50 / 100]),
+                ns2us(errors[numErrorSamples * 90 / 100]),
+                ns2us(errors[numErrorSamples * 99 / 100]),
+                ns2us(errors[numErrorSamples - 1]));
+    }
 }
 
 } // namespace android
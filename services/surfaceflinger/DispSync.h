@@ -18,6 +18,7 @@
 #define ANDROID_DISPSYNC_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include <utils/Mutex.h>
 #include <utils/Timers.h>
@@ -42,6 +43,10 @@ class DispSyncThread;
 // current model accurately represents the hardware event times it will return
 // false to indicate that a resynchronization (via addResyncSample) is not
 // needed.
+//
+// Between resynchronizations the present fence timestamps are also used to
+// refine the model with a least squares fit, so that a slow drift doesn't
+// require turning the hardware vsync events back on.
 class DispSync {
 
 public:
@@ -122,13 +127,16 @@ public:
 private:
 
     void updateModelLocked();
+    void updateModelFromPresentLocked();
     void updateErrorLocked();
     void resetErrorLocked();
 
     enum { MAX_RESYNC_SAMPLES = 32 };
     enum { MIN_RESYNC_SAMPLES_FOR_UPDATE = 6 };
     enum { NUM_PRESENT_SAMPLES = 8 };
+    enum { MIN_PRESENT_SAMPLES_FOR_UPDATE = 5 };
     enum { MAX_RESYNC_SAMPLES_WITHOUT_PRESENT = 4 };
+    enum { NUM_ERROR_SAMPLES = 256 };
 
     const char* const mName;
 
@@ -164,6 +172,9 @@ private:
     // to validate the currently computed model.
     sp<Fence> mPresentFences[NUM_PRESENT_SAMPLES];
     nsecs_t mPresentTimes[NUM_PRESENT_SAMPLES];
+    // Present times too far off the others to be trusted, they are left
+    // out of the model and of mError
+    bool mPresentOutliers[NUM_PRESENT_SAMPLES];
     size_t mPresentSampleOffset;
 
     int mRefreshSkipCount;
@@ -181,6 +192,19 @@ private:
     // Ignore present (retire) fences if the device doesn't have support for the
     // sync framework
     bool mIgnorePresentFences;
+
+    // These member variables are statistics reported by dump to evaluate
+    // how long hardware vsync events stay enabled.
+    nsecs_t mCreationTime;
+    // Start of the current resynchronization, 0 if none is in progress
+    nsecs_t mResyncStartTime;
+    nsecs_t mTotalResyncTime;
+    uint64_t mNumResyncs;
+    uint64_t mNumPresentModelUpdates;
+    uint64_t mNumPresentOutliers;
+    // Ring of the square root of mError after each present fence
+    nsecs_t mErrorSamples[NUM_ERROR_SAMPLES];
+    size_t mNumErrorSamples;
 };
 
 }
@@ -23,6 +23,8 @@
 #include <string.h>
 #include <math.h>
 
+#include <vector>
+
 #include <cutils/properties.h>
 
 #include <utils/RefBase.h>
@@ -73,6 +75,23 @@ inline void eglSetSwapRectangleANDROID (EGLDisplay, EGLSurface, EGLint, EGLint,
 }
 #endif
 
+#ifdef USE_HWC2
+static bool hasEglExtension(const char* extensions, const char* name) {
+    if (extensions == nullptr) {
+        return false;
+    }
+    const size_t length = strlen(name);
+    for (const char* pos = extensions; (pos = strstr(pos, name)) != nullptr;
+            pos += length) {
+        if ((pos == extensions || pos[-1] == ' ') &&
+                (pos[length] == '\0' || pos[length] == ' ')) {
+            return true;
+        }
+    }
+    return false;
+}
+#endif
+
 /*
  * Initialize the display to the specified values.
  *
@@ -123,6 +142,8 @@ DisplayDevice::DisplayDevice(
 #ifdef USE_HWC2
     mActiveColorMode = static_cast<android_color_mode_t>(-1);
     mDisplayHasWideColor = supportWideColor;
+    mHasBufferAge = false;
+    mHasSwapBuffersWithDamage = false;
 #else
     (void) supportWideColor;
 #endif
@@ -156,6 +177,12 @@ DisplayDevice::DisplayDevice(
     mConfig = config;
     mDisplay = display;
     mSurface = eglSurface;
+#ifdef USE_HWC2
+    const char* const eglExtensions = eglQueryString(display, EGL_EXTENSIONS);
+    mHasBufferAge = hasEglExtension(eglExtensions, "EGL_EXT_buffer_age");
+    mHasSwapBuffersWithDamage = hasEglExtension(eglExtensions,
+            "EGL_KHR_swap_buffers_with_damage");
+#endif
 #ifndef USE_HWC2
     mFormat = format;
 #endif
@@ -315,6 +342,70 @@ status_t DisplayDevice::prepareFrame(const HWComposer& hwc) const {
 }
 #endif
 
+#ifdef USE_HWC2
+Region DisplayDevice::computeClientTargetDamage(const Region& newDamage,
+        bool fullRedraw) const {
+    const Region bounds(getBounds());
+
+    EGLint age = 0;
+    if (!fullRedraw && mHasBufferAge &&
+            !eglQuerySurface(mDisplay, mSurface, EGL_BUFFER_AGE_EXT, &age)) {
+        ALOGW("[%s] failed to query buffer age: %#x", mDisplayName.string(),
+                eglGetError());
+        age = 0;
+    }
+
+    Region damage(newDamage);
+    if (age <= 0 || static_cast<size_t>(age - 1) > mDamageHistory.size()) {
+        // Content of the buffer is undefined
+        damage = bounds;
+    } else {
+        // The buffer is age frames old, it lacks everything that changed in
+        // the age - 1 frames in between.
+        for (EGLint i = 0; i < age - 1; i++) {
+            damage.orSelf(mDamageHistory[i]);
+        }
+        damage.andSelf(bounds);
+    }
+
+    // When fullRedraw is set, what's in the other buffers is stale as a
+    // whole, not just where the content changed.
+    mDamageHistory.push_front(fullRedraw ? bounds : newDamage);
+    if (mDamageHistory.size() > MAX_DAMAGE_HISTORY) {
+        mDamageHistory.pop_back();
+    }
+    mClientTargetDamage = damage;
+    return damage;
+}
+
+// Returns EGL_FALSE if not supported or if nothing is known about the
+// damage, the caller then falls back to eglSwapBuffers.
+EGLBoolean DisplayDevice::swapBuffersWithDamage() const {
+    if (!mHasSwapBuffersWithDamage || mClientTargetDamage.isEmpty()) {
+        return EGL_FALSE;
+    }
+
+    // EGL wants rectangles with a bottom-left origin
+    size_t rectCount = 0;
+    const Rect* rects = mClientTargetDamage.getArray(&rectCount);
+    std::vector<EGLint> eglRects;
+    eglRects.reserve(rectCount * 4);
+    for (size_t i = 0; i < rectCount; i++) {
+        eglRects.push_back(rects[i].left);
+        eglRects.push_back(mDisplayHeight - rects[i].bottom);
+        eglRects.push_back(rects[i].getWidth());
+        eglRects.push_back(rects[i].getHeight());
+    }
+    mClientTargetDamage.clear();
+
+    EGLBoolean success = eglSwapBuffersWithDamageKHR(mDisplay, mSurface,
+            eglRects.data(), static_cast<EGLint>(rectCount));
+    ALOGW_IF(!success, "[%s] eglSwapBuffersWithDamageKHR failed with 0x%08x",
+            mDisplayName.string(), eglGetError());
+    return success;
+}
+#endif
+
 void DisplayDevice::swapBuffers(HWComposer& hwc) const {
 #ifdef USE_HWC2
     if (hwc.hasClientComposition(mHwcDisplayId)) {
@@ -329,7 +420,13 @@ void DisplayDevice::swapBuffers(HWComposer& hwc) const {
             (hwc.hasGlesComposition(mHwcDisplayId) &&
              (hwc.supportsFramebufferTarget() || mType >= DISPLAY_VIRTUAL))) {
 #endif
-        EGLBoolean success = eglSwapBuffers(mDisplay, mSurface);
+        EGLBoolean success = EGL_FALSE;
+#ifdef USE_HWC2
+        success = swapBuffersWithDamage();
+#endif
+        if (!success) {
+            success = eglSwapBuffers(mDisplay, mSurface);
+        }
         if (!success) {
             EGLint error = eglGetError();
             if (error == EGL_CONTEXT_LOST ||
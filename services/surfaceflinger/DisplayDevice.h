@@ -40,6 +40,7 @@
 #include <hardware/hwcomposer_defs.h>
 
 #ifdef USE_HWC2
+#include <deque>
 #include <memory>
 #endif
 
@@ -150,6 +151,15 @@ public:
 #ifdef USE_HWC2
     status_t prepareFrame(HWComposer& hwc);
     bool getWideColorSupport() const { return mDisplayHasWideColor; }
+
+    // Returns the region of the client target buffer about to be rendered
+    // that must be redrawn for it to be up to date, given newDamage, the
+    // region that changed since the last frame. This uses the age of the
+    // buffer and the damage of the previous frames. The whole display is
+    // returned when the age is unknown or fullRedraw is set. The result is
+    // also what swapBuffers() reports as the surface damage.
+    Region computeClientTargetDamage(const Region& newDamage,
+            bool fullRedraw) const;
 #else
     status_t prepareFrame(const HWComposer& hwc) const;
 #endif
@@ -275,6 +285,17 @@ private:
     // Initialized by SurfaceFlinger when the DisplayDevice is created.
     // Fed to RenderEngine during composition.
     bool mDisplayHasWideColor;
+
+    // Partial client composition, see computeClientTargetDamage
+    static constexpr size_t MAX_DAMAGE_HISTORY = 4;
+    bool mHasBufferAge;
+    bool mHasSwapBuffersWithDamage;
+    // damage of the previous client composited frames, most recent first
+    mutable std::deque<Region> mDamageHistory;
+    // damage of the frame being rendered, in screen space
+    mutable Region mClientTargetDamage;
+
+    EGLBoolean swapBuffersWithDamage() const;
 #endif
 };
 
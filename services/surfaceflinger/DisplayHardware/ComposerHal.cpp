@@ -583,6 +583,13 @@ Error Composer::setLayerBuffer(Display display, Layer layer,
 {
     mWriter.selectDisplay(display);
     mWriter.selectLayer(layer);
+    writeLayerBuffer(slot, buffer, acquireFence);
+    return Error::NONE;
+}
+
+void Composer::writeLayerBuffer(uint32_t slot, const sp<GraphicBuffer>& buffer,
+        int acquireFence)
+{
     if (mIsUsingVrComposer && buffer.get()) {
         IVrComposerClient::BufferMetadata metadata = {
             .width = buffer->getWidth(),
@@ -601,7 +608,6 @@ Error Composer::setLayerBuffer(Display display, Layer layer,
     }
 
     mWriter.setLayerBuffer(slot, handle, acquireFence);
-    return Error::NONE;
 }
 
 Error Composer::setLayerSurfaceDamage(Display display, Layer layer,
@@ -722,6 +728,69 @@ Error Composer::setLayerInfo(Display display, Layer layer, uint32_t type,
     return Error::NONE;
 }
 
+Error Composer::setLayerStates(Display display,
+        const std::vector<const LayerState*>& states)
+{
+    if (states.empty()) {
+        return Error::NONE;
+    }
+
+    mWriter.selectDisplay(display);
+    for (const LayerState* state : states) {
+        const uint32_t changes = state->changes;
+        if (changes == 0) {
+            continue;
+        }
+
+        mWriter.selectLayer(state->layer);
+        if (changes & LayerState::BLEND_MODE) {
+            mWriter.setLayerBlendMode(state->blendMode);
+        }
+        if (changes & LayerState::COLOR) {
+            mWriter.setLayerColor(state->color);
+        }
+        if (changes & LayerState::COMPOSITION_TYPE) {
+            mWriter.setLayerCompositionType(state->compositionType);
+        }
+        if (changes & LayerState::DATASPACE) {
+            mWriter.setLayerDataspace(state->dataspace);
+        }
+        if (changes & LayerState::DISPLAY_FRAME) {
+            mWriter.setLayerDisplayFrame(state->displayFrame);
+        }
+        if (changes & LayerState::PLANE_ALPHA) {
+            mWriter.setLayerPlaneAlpha(state->planeAlpha);
+        }
+        if (changes & LayerState::SIDEBAND_STREAM) {
+            mWriter.setLayerSidebandStream(state->sidebandStream);
+        }
+        if (changes & LayerState::SOURCE_CROP) {
+            mWriter.setLayerSourceCrop(state->sourceCrop);
+        }
+        if (changes & LayerState::TRANSFORM) {
+            mWriter.setLayerTransform(state->transform);
+        }
+        if (changes & LayerState::VISIBLE_REGION) {
+            mWriter.setLayerVisibleRegion(state->visibleRegion);
+        }
+        if (changes & LayerState::Z_ORDER) {
+            mWriter.setLayerZOrder(state->z);
+        }
+        if (changes & LayerState::SURFACE_DAMAGE) {
+            mWriter.setLayerSurfaceDamage(state->surfaceDamage);
+        }
+        if ((changes & LayerState::INFO) && mIsUsingVrComposer) {
+            mWriter.setLayerInfo(state->infoType, state->infoAppId);
+        }
+        if (changes & LayerState::BUFFER) {
+            int acquireFence = state->acquireFence != nullptr ?
+                    state->acquireFence->dup() : -1;
+            writeLayerBuffer(state->bufferSlot, state->buffer, acquireFence);
+        }
+    }
+    return Error::NONE;
+}
+
 Error Composer::execute()
 {
     // prepare input command queue
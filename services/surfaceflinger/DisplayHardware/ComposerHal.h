@@ -25,6 +25,8 @@
 
 #include <android/frameworks/vr/composer/1.0/IVrComposerClient.h>
 #include <android/hardware/graphics/composer/2.1/IComposer.h>
+#include <ui/Fence.h>
+#include <ui/GraphicBuffer.h>
 #include <utils/StrongPointer.h>
 #include <IComposerCommandBuffer.h>
 
@@ -133,6 +135,53 @@ private:
     ReturnData* mCurrentReturnData;
 };
 
+// The properties of a layer that changed since they were last sent to the
+// composer, see Composer::setLayerStates().  Only the properties flagged in
+// changes are valid.
+struct LayerState {
+    enum : uint32_t {
+        BLEND_MODE       = 1 << 0,
+        COLOR            = 1 << 1,
+        COMPOSITION_TYPE = 1 << 2,
+        DATASPACE        = 1 << 3,
+        DISPLAY_FRAME    = 1 << 4,
+        PLANE_ALPHA      = 1 << 5,
+        SIDEBAND_STREAM  = 1 << 6,
+        SOURCE_CROP      = 1 << 7,
+        TRANSFORM        = 1 << 8,
+        VISIBLE_REGION   = 1 << 9,
+        Z_ORDER          = 1 << 10,
+        SURFACE_DAMAGE   = 1 << 11,
+        INFO             = 1 << 12,
+        BUFFER           = 1 << 13,
+    };
+
+    Layer layer = 0;
+    uint32_t changes = 0;
+
+    IComposerClient::BlendMode blendMode = IComposerClient::BlendMode::INVALID;
+    IComposerClient::Color color = {0, 0, 0, 0};
+    IComposerClient::Composition compositionType =
+            IComposerClient::Composition::INVALID;
+    Dataspace dataspace = Dataspace::UNKNOWN;
+    IComposerClient::Rect displayFrame = {0, 0, 0, 0};
+    float planeAlpha = 1.0f;
+    const native_handle_t* sidebandStream = nullptr;
+    IComposerClient::FRect sourceCrop = {0.0f, 0.0f, 0.0f, 0.0f};
+    Transform transform = static_cast<Transform>(0);
+    std::vector<IComposerClient::Rect> visibleRegion;
+    uint32_t z = 0;
+    std::vector<IComposerClient::Rect> surfaceDamage;
+    uint32_t infoType = 0;
+    uint32_t infoAppId = 0;
+
+    // See Composer::setLayerBuffer() for the purpose of slot.  buffer is
+    // nullptr when it is already in the composer's cache.
+    uint32_t bufferSlot = 0;
+    sp<GraphicBuffer> buffer;
+    sp<Fence> acquireFence;
+};
+
 // Composer is a wrapper to IComposer, a proxy to server-side composer.
 class Composer {
 public:
@@ -243,6 +292,12 @@ public:
     Error setLayerZOrder(Display display, Layer layer, uint32_t z);
     Error setLayerInfo(Display display, Layer layer, uint32_t type,
                        uint32_t appId);
+
+    // Writes the changed properties of all the given layers of a display at
+    // once: the display and each layer are only selected once, instead of
+    // once per property as with the setLayer* functions above.
+    Error setLayerStates(Display display,
+            const std::vector<const LayerState*>& states);
 private:
     class CommandWriter : public CommandWriterBase {
     public:
@@ -260,6 +315,9 @@ private:
                 const IVrComposerClient::BufferMetadata& metadata);
     };
 
+    void writeLayerBuffer(uint32_t slot, const sp<GraphicBuffer>& buffer,
+            int acquireFence);
+
     // Many public functions above simply write a command into the command
     // queue to batch the calls.  validateDisplay and presentDisplay will call
     // this function to execute the command queue.
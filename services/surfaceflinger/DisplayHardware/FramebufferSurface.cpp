@@ -102,14 +102,15 @@ status_t FramebufferSurface::advanceFrame() {
     sp<GraphicBuffer> buf;
     sp<Fence> acquireFence(Fence::NO_FENCE);
     android_dataspace_t dataspace = HAL_DATASPACE_UNKNOWN;
-    status_t result = nextBuffer(slot, buf, acquireFence, dataspace);
+    Region damage(Region::INVALID_REGION);
+    status_t result = nextBuffer(slot, buf, acquireFence, dataspace, damage);
     if (result != NO_ERROR) {
         ALOGE("error latching next FramebufferSurface buffer: %s (%d)",
                 strerror(-result), result);
         return result;
     }
     result = mHwc.setClientTarget(mDisplayType, slot,
-            acquireFence, buf, dataspace);
+            acquireFence, buf, dataspace, damage);
     if (result != NO_ERROR) {
         ALOGE("error posting framebuffer: %d", result);
     }
@@ -125,7 +126,7 @@ status_t FramebufferSurface::advanceFrame() {
 #ifdef USE_HWC2
 status_t FramebufferSurface::nextBuffer(uint32_t& outSlot,
         sp<GraphicBuffer>& outBuffer, sp<Fence>& outFence,
-        android_dataspace_t& outDataspace) {
+        android_dataspace_t& outDataspace, Region& outDamage) {
 #else
 status_t FramebufferSurface::nextBuffer(sp<GraphicBuffer>& outBuffer, sp<Fence>& outFence) {
 #endif
@@ -135,8 +136,7 @@ status_t FramebufferSurface::nextBuffer(sp<GraphicBuffer>& outBuffer, sp<Fence>&
     status_t err = acquireBufferLocked(&item, 0);
     if (err == BufferQueue::NO_BUFFER_AVAILABLE) {
 #ifdef USE_HWC2
-        mHwcBufferCache.getHwcBuffer(mCurrentBufferSlot, mCurrentBuffer,
-                &outSlot, &outBuffer);
+        mHwcBufferCache.getHwcBuffer(mCurrentBuffer, &outSlot, &outBuffer);
 #else
         outBuffer = mCurrentBuffer;
 #endif
@@ -176,9 +176,9 @@ status_t FramebufferSurface::nextBuffer(sp<GraphicBuffer>& outBuffer, sp<Fence>&
 
     outFence = item.mFence;
 #ifdef USE_HWC2
-    mHwcBufferCache.getHwcBuffer(mCurrentBufferSlot, mCurrentBuffer,
-            &outSlot, &outBuffer);
+    mHwcBufferCache.getHwcBuffer(mCurrentBuffer, &outSlot, &outBuffer);
     outDataspace = item.mDataSpace;
+    outDamage = item.mSurfaceDamage;
 #else
     outBuffer = mCurrentBuffer;
 #endif
@@ -249,6 +249,10 @@ status_t FramebufferSurface::compositionComplete()
 
 void FramebufferSurface::dumpAsString(String8& result) const {
     ConsumerBase::dumpState(result);
+#ifdef USE_HWC2
+    result.append("  client target ");
+    mHwcBufferCache.dump(result);
+#endif
 }
 
 void FramebufferSurface::dumpLocked(String8& result, const char* prefix) const
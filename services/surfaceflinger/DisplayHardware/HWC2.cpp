@@ -78,6 +78,7 @@ using android::GraphicBuffer;
 using android::HdrCapabilities;
 using android::Rect;
 using android::Region;
+
 using android::sp;
 using android::hardware::Return;
 using android::hardware::Void;
@@ -86,6 +87,38 @@ namespace HWC2 {
 
 namespace Hwc2 = android::Hwc2;
 
+namespace {
+
+bool isEqual(const Hwc2::IComposerClient::Rect& lhs,
+        const Hwc2::IComposerClient::Rect& rhs)
+{
+    return lhs.left == rhs.left && lhs.top == rhs.top &&
+            lhs.right == rhs.right && lhs.bottom == rhs.bottom;
+}
+
+bool isEqual(const Hwc2::IComposerClient::FRect& lhs,
+        const Hwc2::IComposerClient::FRect& rhs)
+{
+    return lhs.left == rhs.left && lhs.top == rhs.top &&
+            lhs.right == rhs.right && lhs.bottom == rhs.bottom;
+}
+
+bool isEqual(const std::vector<Hwc2::IComposerClient::Rect>& lhs,
+        const std::vector<Hwc2::IComposerClient::Rect>& rhs)
+{
+    return std::equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(),
+            [](const auto& l, const auto& r) { return isEqual(l, r); });
+}
+
+bool isEqual(const Hwc2::IComposerClient::Color& lhs,
+        const Hwc2::IComposerClient::Color& rhs)
+{
+    return lhs.r == rhs.r && lhs.g == rhs.g && lhs.b == rhs.b &&
+            lhs.a == rhs.a;
+}
+
+} // anonymous namespace
+
 // Device methods
 
 Device::Device(bool useVrComposer)
@@ -448,6 +481,10 @@ Error Display::getChangedCompositionTypes(
     for (uint32_t element = 0; element < numElements; ++element) {
         auto layer = getLayerById(layerIds[element]);
         if (layer) {
+            // The device will switch to this type when the changes are
+            // accepted, what we sent last is stale
+            layer->mDeviceState &= ~Hwc2::LayerState::COMPOSITION_TYPE;
+
             auto type = static_cast<Composition>(types[element]);
             ALOGV("getChangedCompositionTypes: adding %" PRIu64 " %s",
                     layer->getId(), to_string(type).c_str());
@@ -606,10 +643,13 @@ Error Display::getReleaseFences(
 
 Error Display::present(sp<Fence>* outPresentFence)
 {
+    flushLayerStates();
+
     int32_t presentFenceFd = -1;
     auto intError = mDevice.mComposer->presentDisplay(mId, &presentFenceFd);
     auto error = static_cast<Error>(intError);
     if (error != Error::None) {
+        invalidateLayerStates();
         return error;
     }
 
@@ -630,13 +670,23 @@ Error Display::setActiveConfig(const std::shared_ptr<const Config>& config)
 }
 
 Error Display::setClientTarget(uint32_t slot, const sp<GraphicBuffer>& target,
-        const sp<Fence>& acquireFence, android_dataspace_t dataspace)
+        const sp<Fence>& acquireFence, android_dataspace_t dataspace,
+        const Region& damage)
 {
-    // TODO: Properly encode client target surface damage
+    // Same encoding as Layer::setSurfaceDamage, INVALID_RECT means the
+    // whole target changed
+    std::vector<Hwc2::IComposerClient::Rect> hwcRects;
+    if (!damage.isRect() || damage.getBounds() != Rect::INVALID_RECT) {
+        size_t rectCount = 0;
+        auto rectArray = damage.getArray(&rectCount);
+        for (size_t rect = 0; rect < rectCount; ++rect) {
+            hwcRects.push_back({rectArray[rect].left, rectArray[rect].top,
+                    rectArray[rect].right, rectArray[rect].bottom});
+        }
+    }
     int32_t fenceFd = acquireFence->dup();
     auto intError = mDevice.mComposer->setClientTarget(mId, slot, target,
-            fenceFd, static_cast<Hwc2::Dataspace>(dataspace),
-            std::vector<Hwc2::IComposerClient::Rect>());
+            fenceFd, static_cast<Hwc2::Dataspace>(dataspace), hwcRects);
     return static_cast<Error>(intError);
 }
 
@@ -681,12 +731,15 @@ Error Display::setVsyncEnabled(Vsync enabled)
 
 Error Display::validate(uint32_t* outNumTypes, uint32_t* outNumRequests)
 {
+    flushLayerStates();
+
     uint32_t numTypes = 0;
     uint32_t numRequests = 0;
     auto intError = mDevice.mComposer->validateDisplay(mId,
             &numTypes, &numRequests);
     auto error = static_cast<Error>(intError);
     if (error != Error::None && error != Error::HasChanges) {
+        invalidateLayerStates();
         return error;
     }
 
@@ -698,12 +751,15 @@ Error Display::validate(uint32_t* outNumTypes, uint32_t* outNumRequests)
 Error Display::presentOrValidate(uint32_t* outNumTypes, uint32_t* outNumRequests,
                                  sp<android::Fence>* outPresentFence, uint32_t* state) {
 
+    flushLayerStates();
+
     uint32_t numTypes = 0;
     uint32_t numRequests = 0;
     int32_t presentFenceFd = -1;
     auto intError = mDevice.mComposer->presentOrValidateDisplay(mId, &numTypes, &numRequests, &presentFenceFd, state);
     auto error = static_cast<Error>(intError);
     if (error != Error::None && error != Error::HasChanges) {
+        invalidateLayerStates();
         return error;
     }
 
@@ -785,6 +841,44 @@ void Display::destroyLayer(hwc2_layer_t layerId)
     mLayers.erase(layerId);
 }
 
+void Display::flushLayerStates()
+{
+    std::vector<std::shared_ptr<Layer>> layers;
+    std::vector<const Hwc2::LayerState*> states;
+    for (const auto& entry : mLayers) {
+        auto layer = entry.second.lock();
+        if (layer && layer->hasChanges()) {
+            states.push_back(&layer->getState());
+            layers.push_back(std::move(layer));
+        }
+    }
+    if (states.empty()) {
+        return;
+    }
+
+    auto intError = mDevice.mComposer->setLayerStates(mId, states);
+    auto error = static_cast<Error>(intError);
+    if (error != Error::None) {
+        ALOGE("[%" PRIu64 "] setLayerStates failed: %s (%d)", mId,
+                to_string(error).c_str(), intError);
+        return;
+    }
+
+    for (const auto& layer : layers) {
+        layer->onStateFlushed();
+    }
+}
+
+void Display::invalidateLayerStates()
+{
+    for (const auto& entry : mLayers) {
+        auto layer = entry.second.lock();
+        if (layer) {
+            layer->onStateLost();
+        }
+    }
+}
+
 // Other Display methods
 
 std::shared_ptr<Layer> Display::getLayerById(hwc2_layer_t id) const
@@ -803,8 +897,11 @@ Layer::Layer(const std::shared_ptr<Display>& display, hwc2_layer_t id)
   : mDisplay(display),
     mDisplayId(display->getId()),
     mDevice(display->getDevice()),
-    mId(id)
+    mId(id),
+    mState(std::make_unique<Hwc2::LayerState>()),
+    mDeviceState(0)
 {
+    mState->layer = id;
     ALOGV("Created layer %" PRIu64 " on display %" PRIu64, id,
             display->getId());
 }
@@ -817,6 +914,28 @@ Layer::~Layer()
     }
 }
 
+bool Layer::hasChanges() const
+{
+    return mState->changes != 0;
+}
+
+void Layer::onStateFlushed()
+{
+    mDeviceState |= mState->changes;
+    mState->changes = 0;
+
+    // A buffer is only ever sent once, don't hold on to it
+    mDeviceState &= ~Hwc2::LayerState::BUFFER;
+    mState->buffer = nullptr;
+    mState->acquireFence = nullptr;
+}
+
+void Layer::markChanged(uint32_t property)
+{
+    mState->changes |= property;
+    mDeviceState &= ~property;
+}
+
 Error Layer::setCursorPosition(int32_t x, int32_t y)
 {
     auto intError = mDevice.mComposer->setCursorPosition(mDisplayId,
@@ -827,83 +946,110 @@ Error Layer::setCursorPosition(int32_t x, int32_t y)
 Error Layer::setBuffer(uint32_t slot, const sp<GraphicBuffer>& buffer,
         const sp<Fence>& acquireFence)
 {
-    int32_t fenceFd = acquireFence->dup();
-    auto intError = mDevice.mComposer->setLayerBuffer(mDisplayId,
-            mId, slot, buffer, fenceFd);
-    return static_cast<Error>(intError);
+    // Always sent, the buffer cache already avoids sending the same handle
+    // twice
+    mState->bufferSlot = slot;
+    mState->buffer = buffer;
+    mState->acquireFence = acquireFence;
+    markChanged(Hwc2::LayerState::BUFFER);
+    return Error::None;
 }
 
 Error Layer::setSurfaceDamage(const Region& damage)
 {
     // We encode default full-screen damage as INVALID_RECT upstream, but as 0
     // rects for HWC
-    Hwc2::Error intError = Hwc2::Error::NONE;
-    if (damage.isRect() && damage.getBounds() == Rect::INVALID_RECT) {
-        intError = mDevice.mComposer->setLayerSurfaceDamage(mDisplayId,
-                mId, std::vector<Hwc2::IComposerClient::Rect>());
-    } else {
+    std::vector<Hwc2::IComposerClient::Rect> hwcRects;
+    if (!damage.isRect() || damage.getBounds() != Rect::INVALID_RECT) {
         size_t rectCount = 0;
         auto rectArray = damage.getArray(&rectCount);
 
-        std::vector<Hwc2::IComposerClient::Rect> hwcRects;
+        hwcRects.reserve(rectCount);
         for (size_t rect = 0; rect < rectCount; ++rect) {
             hwcRects.push_back({rectArray[rect].left, rectArray[rect].top,
                     rectArray[rect].right, rectArray[rect].bottom});
         }
-
-        intError = mDevice.mComposer->setLayerSurfaceDamage(mDisplayId,
-                mId, hwcRects);
     }
 
-    return static_cast<Error>(intError);
+    if (isOnDevice(Hwc2::LayerState::SURFACE_DAMAGE) &&
+            isEqual(mState->surfaceDamage, hwcRects)) {
+        return Error::None;
+    }
+    mState->surfaceDamage = std::move(hwcRects);
+    markChanged(Hwc2::LayerState::SURFACE_DAMAGE);
+    return Error::None;
 }
 
 Error Layer::setBlendMode(BlendMode mode)
 {
     auto intMode = static_cast<Hwc2::IComposerClient::BlendMode>(mode);
-    auto intError = mDevice.mComposer->setLayerBlendMode(mDisplayId,
-            mId, intMode);
-    return static_cast<Error>(intError);
+    if (isOnDevice(Hwc2::LayerState::BLEND_MODE) &&
+            mState->blendMode == intMode) {
+        return Error::None;
+    }
+    mState->blendMode = intMode;
+    markChanged(Hwc2::LayerState::BLEND_MODE);
+    return Error::None;
 }
 
 Error Layer::setColor(hwc_color_t color)
 {
     Hwc2::IComposerClient::Color hwcColor{color.r, color.g, color.b, color.a};
-    auto intError = mDevice.mComposer->setLayerColor(mDisplayId,
-            mId, hwcColor);
-    return static_cast<Error>(intError);
+    if (isOnDevice(Hwc2::LayerState::COLOR) &&
+            isEqual(mState->color, hwcColor)) {
+        return Error::None;
+    }
+    mState->color = hwcColor;
+    markChanged(Hwc2::LayerState::COLOR);
+    return Error::None;
 }
 
 Error Layer::setCompositionType(Composition type)
 {
     auto intType = static_cast<Hwc2::IComposerClient::Composition>(type);
-    auto intError = mDevice.mComposer->setLayerCompositionType(mDisplayId,
-            mId, intType);
-    return static_cast<Error>(intError);
+    if (isOnDevice(Hwc2::LayerState::COMPOSITION_TYPE) &&
+            mState->compositionType == intType) {
+        return Error::None;
+    }
+    mState->compositionType = intType;
+    markChanged(Hwc2::LayerState::COMPOSITION_TYPE);
+    return Error::None;
 }
 
 Error Layer::setDataspace(android_dataspace_t dataspace)
 {
     auto intDataspace = static_cast<Hwc2::Dataspace>(dataspace);
-    auto intError = mDevice.mComposer->setLayerDataspace(mDisplayId,
-            mId, intDataspace);
-    return static_cast<Error>(intError);
+    if (isOnDevice(Hwc2::LayerState::DATASPACE) &&
+            mState->dataspace == intDataspace) {
+        return Error::None;
+    }
+    mState->dataspace = intDataspace;
+    markChanged(Hwc2::LayerState::DATASPACE);
+    return Error::None;
 }
 
 Error Layer::setDisplayFrame(const Rect& frame)
 {
     Hwc2::IComposerClient::Rect hwcRect{frame.left, frame.top,
         frame.right, frame.bottom};
-    auto intError = mDevice.mComposer->setLayerDisplayFrame(mDisplayId,
-            mId, hwcRect);
-    return static_cast<Error>(intError);
+    if (isOnDevice(Hwc2::LayerState::DISPLAY_FRAME) &&
+            isEqual(mState->displayFrame, hwcRect)) {
+        return Error::None;
+    }
+    mState->displayFrame = hwcRect;
+    markChanged(Hwc2::LayerState::DISPLAY_FRAME);
+    return Error::None;
 }
 
 Error Layer::setPlaneAlpha(float alpha)
 {
-    auto intError = mDevice.mComposer->setLayerPlaneAlpha(mDisplayId,
-            mId, alpha);
-    return static_cast<Error>(intError);
+    if (isOnDevice(Hwc2::LayerState::PLANE_ALPHA) &&
+            mState->planeAlpha == alpha) {
+        return Error::None;
+    }
+    mState->planeAlpha = alpha;
+    markChanged(Hwc2::LayerState::PLANE_ALPHA);
+    return Error::None;
 }
 
 Error Layer::setSidebandStream(const native_handle_t* stream)
@@ -913,26 +1059,38 @@ Error Layer::setSidebandStream(const native_handle_t* stream)
                 "device supports sideband streams");
         return Error::Unsupported;
     }
-    auto intError = mDevice.mComposer->setLayerSidebandStream(mDisplayId,
-            mId, stream);
-    return static_cast<Error>(intError);
+    if (isOnDevice(Hwc2::LayerState::SIDEBAND_STREAM) &&
+            mState->sidebandStream == stream) {
+        return Error::None;
+    }
+    mState->sidebandStream = stream;
+    markChanged(Hwc2::LayerState::SIDEBAND_STREAM);
+    return Error::None;
 }
 
 Error Layer::setSourceCrop(const FloatRect& crop)
 {
     Hwc2::IComposerClient::FRect hwcRect{
         crop.left, crop.top, crop.right, crop.bottom};
-    auto intError = mDevice.mComposer->setLayerSourceCrop(mDisplayId,
-            mId, hwcRect);
-    return static_cast<Error>(intError);
+    if (isOnDevice(Hwc2::LayerState::SOURCE_CROP) &&
+            isEqual(mState->sourceCrop, hwcRect)) {
+        return Error::None;
+    }
+    mState->sourceCrop = hwcRect;
+    markChanged(Hwc2::LayerState::SOURCE_CROP);
+    return Error::None;
 }
 
 Error Layer::setTransform(Transform transform)
 {
     auto intTransform = static_cast<Hwc2::Transform>(transform);
-    auto intError = mDevice.mComposer->setLayerTransform(mDisplayId,
-            mId, intTransform);
-    return static_cast<Error>(intError);
+    if (isOnDevice(Hwc2::LayerState::TRANSFORM) &&
+            mState->transform == intTransform) {
+        return Error::None;
+    }
+    mState->transform = intTransform;
+    markChanged(Hwc2::LayerState::TRANSFORM);
+    return Error::None;
 }
 
 Error Layer::setVisibleRegion(const Region& region)
@@ -941,26 +1099,41 @@ Error Layer::setVisibleRegion(const Region& region)
     auto rectArray = region.getArray(&rectCount);
 
     std::vector<Hwc2::IComposerClient::Rect> hwcRects;
+    hwcRects.reserve(rectCount);
     for (size_t rect = 0; rect < rectCount; ++rect) {
         hwcRects.push_back({rectArray[rect].left, rectArray[rect].top,
                 rectArray[rect].right, rectArray[rect].bottom});
     }
 
-    auto intError = mDevice.mComposer->setLayerVisibleRegion(mDisplayId,
-            mId, hwcRects);
-    return static_cast<Error>(intError);
+    if (isOnDevice(Hwc2::LayerState::VISIBLE_REGION) &&
+            isEqual(mState->visibleRegion, hwcRects)) {
+        return Error::None;
+    }
+    mState->visibleRegion = std::move(hwcRects);
+    markChanged(Hwc2::LayerState::VISIBLE_REGION);
+    return Error::None;
 }
 
 Error Layer::setZOrder(uint32_t z)
 {
-    auto intError = mDevice.mComposer->setLayerZOrder(mDisplayId, mId, z);
-    return static_cast<Error>(intError);
+    if (isOnDevice(Hwc2::LayerState::Z_ORDER) && mState->z == z) {
+        return Error::None;
+    }
+    mState->z = z;
+    markChanged(Hwc2::LayerState::Z_ORDER);
+    return Error::None;
 }
 
 Error Layer::setInfo(uint32_t type, uint32_t appId)
 {
-  auto intError = mDevice.mComposer->setLayerInfo(mDisplayId, mId, type, appId);
-  return static_cast<Error>(intError);
+    if (isOnDevice(Hwc2::LayerState::INFO) && mState->infoType == type &&
+            mState->infoAppId == appId) {
+        return Error::None;
+    }
+    mState->infoType = type;
+    mState->infoAppId = appId;
+    markChanged(Hwc2::LayerState::INFO);
+    return Error::None;
 }
 
 } // namespace HWC2
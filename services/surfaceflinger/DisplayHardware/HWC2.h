@@ -31,6 +31,7 @@
 #include <utils/Timers.h>
 
 #include <functional>
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
@@ -45,6 +46,7 @@ namespace android {
     class Region;
     namespace Hwc2 {
         class Composer;
+        struct LayerState;
     }
 }
 
@@ -244,7 +246,7 @@ public:
     [[clang::warn_unused_result]] Error setClientTarget(
             uint32_t slot, const android::sp<android::GraphicBuffer>& target,
             const android::sp<android::Fence>& acquireFence,
-            android_dataspace_t dataspace);
+            android_dataspace_t dataspace, const android::Region& damage);
     [[clang::warn_unused_result]] Error setColorMode(android_color_mode_t mode);
     [[clang::warn_unused_result]] Error setColorTransform(
             const android::mat4& matrix, android_color_transform_t hint);
@@ -282,6 +284,15 @@ private:
     // For use by Layer
     void destroyLayer(hwc2_layer_t layerId);
 
+    // Writes the changes made to all the layers of this display since the
+    // last call, in one batch.  Called before the display is validated or
+    // presented.
+    void flushLayerStates();
+
+    // The commands written by flushLayerStates() were lost, every layer
+    // property has to be sent again.
+    void invalidateLayerStates();
+
     // This may fail (and return a null pointer) if no layer with this ID exists
     // on this display
     std::shared_ptr<Layer> getLayerById(hwc2_layer_t id) const;
@@ -299,8 +310,16 @@ private:
 };
 
 // Convenience C++ class to access hwc2_device_t Layer functions directly.
+//
+// Except for setCursorPosition, the properties set on a layer aren't sent to
+// the device right away. They are kept until its display is validated or
+// presented, at which point the properties of all the layers that changed
+// are sent at once. Setting a property to the value the device already has
+// is free.
 class Layer
 {
+    friend class HWC2::Display;
+
 public:
     Layer(const std::shared_ptr<Display>& display, hwc2_layer_t id);
     ~Layer();
@@ -334,10 +353,28 @@ public:
     [[clang::warn_unused_result]] Error setInfo(uint32_t type, uint32_t appId);
 
 private:
+    // For use by Display
+
+    const android::Hwc2::LayerState& getState() const { return *mState; }
+    bool hasChanges() const;
+    void onStateFlushed();
+    void onStateLost() { mDeviceState = 0; }
+
+    // Whether the device already has the value of property in mState
+    bool isOnDevice(uint32_t property) const {
+        return (mDeviceState & property) != 0;
+    }
+    void markChanged(uint32_t property);
+
     std::weak_ptr<Display> mDisplay;
     hwc2_display_t mDisplayId;
     Device& mDevice;
     hwc2_layer_t mId;
+
+    // The last value set for every property, and which ones to send
+    std::unique_ptr<android::Hwc2::LayerState> mState;
+    // The properties of mState whose value the device already has
+    uint32_t mDeviceState;
 };
 
 } // namespace HWC2
@@ -417,14 +417,15 @@ void HWComposer::setVsyncEnabled(int32_t displayId, HWC2::Vsync enabled) {
 
 status_t HWComposer::setClientTarget(int32_t displayId, uint32_t slot,
         const sp<Fence>& acquireFence, const sp<GraphicBuffer>& target,
-        android_dataspace_t dataspace) {
+        android_dataspace_t dataspace, const Region& damage) {
     if (!isValidDisplay(displayId)) {
         return BAD_INDEX;
     }
 
     ALOGV("setClientTarget for display %d", displayId);
     auto& hwcDisplay = mDisplayData[displayId].hwcDisplay;
-    auto error = hwcDisplay->setClientTarget(slot, target, acquireFence, dataspace);
+    auto error = hwcDisplay->setClientTarget(slot, target, acquireFence,
+            dataspace, damage);
     if (error != HWC2::Error::None) {
         ALOGE("Failed to set client target for display %d: %s (%d)", displayId,
                 to_string(error).c_str(), static_cast<int32_t>(error));
@@ -458,15 +459,22 @@ status_t HWComposer::prepare(DisplayDevice& displayDevice) {
 
     HWC2::Error error = HWC2::Error::None;
 
-    // First try to skip validate altogether if the HWC supports it.
+    // First try to skip validate altogether if the HWC supports it. This is
+    // only worth it when the layer stack is the same as the one the HWC
+    // validated last time, otherwise it is going to validate anyway.
+    const uint64_t compositionKey = computeCompositionKey(displayDevice);
+    const bool compositionKeyMatches = displayData.hasCompositionKey &&
+            displayData.lastCompositionKey == compositionKey;
     displayData.validateWasSkipped = false;
     if (hasCapability(HWC2::Capability::SkipValidate) &&
-            !displayData.hasClientComposition) {
+            !displayData.hasClientComposition && compositionKeyMatches) {
+        displayData.numPresentOrValidate++;
         sp<android::Fence> outPresentFence;
         uint32_t state = UINT32_MAX;
         error = hwcDisplay->presentOrValidate(&numTypes, &numRequests, &outPresentFence , &state);
         if (error != HWC2::Error::None && error != HWC2::Error::HasChanges) {
             ALOGV("skipValidate: Failed to Present or Validate");
+            displayData.hasCompositionKey = false;
             return UNKNOWN_ERROR;
         }
         if (state == 1) { //Present Succeeded.
@@ -476,13 +484,16 @@ status_t HWComposer::prepare(DisplayDevice& displayDevice) {
             displayData.lastPresentFence = outPresentFence;
             displayData.validateWasSkipped = true;
             displayData.presentError = error;
+            displayData.numValidateSkipped++;
             return NO_ERROR;
         }
         // Present failed but Validate ran.
     } else {
+        displayData.numValidate++;
         error = hwcDisplay->validate(&numTypes, &numRequests);
     }
     ALOGV("SkipValidate failed, Falling back to SLOW validate/present");
+    displayData.hasCompositionKey = false;
     if (error != HWC2::Error::None && error != HWC2::Error::HasChanges) {
         ALOGE("prepare: validate failed for display %d: %s (%d)", displayId,
                 to_string(error).c_str(), static_cast<int32_t>(error));
@@ -559,6 +570,12 @@ status_t HWComposer::prepare(DisplayDevice& displayDevice) {
         return BAD_INDEX;
     }
 
+    // The key is computed from the composition types SurfaceFlinger asked
+    // for, before the HWC changed them, since that's what the next frame is
+    // going to be compared against.
+    displayData.hasCompositionKey = true;
+    displayData.lastCompositionKey = compositionKey;
+
     return NO_ERROR;
 }
 
@@ -872,11 +889,35 @@ bool HWComposer::isUsingVrComposer() const {
     return getComposer()->isUsingVrComposer();
 }
 
+uint64_t HWComposer::computeCompositionKey(const DisplayDevice& displayDevice) {
+    const auto displayId = displayDevice.getHwcDisplayId();
+    const auto& layers = displayDevice.getVisibleLayersSortedByZ();
+    uint64_t key = layers.size();
+    for (const auto& layer : layers) {
+        const uint64_t layerKey = layer->getHwcCompositionKey(displayId);
+        key ^= layerKey + 0x9e3779b97f4a7c15ull + (key << 6) + (key >> 2);
+    }
+    return key;
+}
+
 void HWComposer::dump(String8& result) const {
     // TODO: In order to provide a dump equivalent to HWC1, we need to shadow
     // all the state going into the layers. This is probably better done in
     // Layer itself, but it's going to take a bit of work to get there.
     result.append(mHwcDevice->dump().c_str());
+
+    Mutex::Autolock _l(mDisplayLock);
+    for (size_t i = 0; i < mDisplayData.size(); i++) {
+        const auto& displayData = mDisplayData[i];
+        if (!displayData.hwcDisplay) {
+            continue;
+        }
+        result.appendFormat("Display %zu: validate=%" PRIu64
+                " presentOrValidate=%" PRIu64 " (validate skipped=%" PRIu64
+                ")\n", i, displayData.numValidate,
+                displayData.numPresentOrValidate,
+                displayData.numValidateSkipped);
+    }
 }
 
 // ---------------------------------------------------------------------------
@@ -888,7 +929,14 @@ HWComposer::DisplayData::DisplayData()
     lastPresentFence(Fence::NO_FENCE),
     outbufHandle(nullptr),
     outbufAcquireFence(Fence::NO_FENCE),
-    vsyncEnabled(HWC2::Vsync::Disable) {
+    vsyncEnabled(HWC2::Vsync::Disable),
+    validateWasSkipped(false),
+    presentError(HWC2::Error::None),
+    hasCompositionKey(false),
+    lastCompositionKey(0),
+    numPresentOrValidate(0),
+    numValidateSkipped(0),
+    numValidate(0) {
     ALOGV("Created new DisplayData");
 }
 
@@ -97,9 +97,12 @@ public:
     // Asks the HAL what it can do
     status_t prepare(DisplayDevice& displayDevice);
 
+    // damage is the part of target that changed since the previous client
+    // target, Region::INVALID_REGION if unknown
     status_t setClientTarget(int32_t displayId, uint32_t slot,
             const sp<Fence>& acquireFence,
-            const sp<GraphicBuffer>& target, android_dataspace_t dataspace);
+            const sp<GraphicBuffer>& target, android_dataspace_t dataspace,
+            const Region& damage);
 
     // Present layers to the display and read releaseFences.
     status_t presentAndGetReleaseFences(int32_t displayId);
@@ -205,8 +208,24 @@ private:
 
         bool validateWasSkipped;
         HWC2::Error presentError;
+
+        // Composition key of the last layer stack whose composition types
+        // were accepted, see computeCompositionKey
+        bool hasCompositionKey;
+        uint64_t lastCompositionKey;
+
+        // for dumpsys
+        uint64_t numPresentOrValidate;
+        uint64_t numValidateSkipped;
+        uint64_t numValidate;
     };
 
+    // Hash of the HWC state of every visible layer of the display, in Z
+    // order. When it matches the one of the last frame, the HWC is expected
+    // to pick the same composition strategy and present can be attempted
+    // without validating first.
+    static uint64_t computeCompositionKey(const DisplayDevice& displayDevice);
+
     std::unique_ptr<HWC2::Device>   mHwcDevice;
     std::vector<DisplayData>        mDisplayData;
     std::set<size_t>                mFreeDisplaySlots;
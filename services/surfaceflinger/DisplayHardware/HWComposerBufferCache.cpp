@@ -17,38 +17,91 @@
 #include "HWComposerBufferCache.h"
 
 #include <gui/BufferQueue.h>
+#include <utils/String8.h>
+
+#include <algorithm>
+#include <inttypes.h>
 
 namespace android {
 
 HWComposerBufferCache::HWComposerBufferCache()
+  : mCapacity(kInitialCapacity),
+    mUseCount(0)
 {
-    mBuffers.reserve(BufferQueue::NUM_BUFFER_SLOTS);
+    mEntries.reserve(BufferQueue::NUM_BUFFER_SLOTS);
 }
 
-void HWComposerBufferCache::getHwcBuffer(int slot,
-        const sp<GraphicBuffer>& buffer,
+void HWComposerBufferCache::getHwcBuffer(const sp<GraphicBuffer>& buffer,
         uint32_t* outSlot, sp<GraphicBuffer>* outBuffer)
 {
-    if (slot == BufferQueue::INVALID_BUFFER_SLOT || slot < 0) {
+    if (buffer == nullptr) {
         // default to slot 0
-        slot = 0;
+        *outSlot = 0;
+        *outBuffer = nullptr;
+        return;
     }
 
-    if (static_cast<size_t>(slot) >= mBuffers.size()) {
-        mBuffers.resize(slot + 1);
+    const uint64_t bufferId = buffer->getId();
+    mUseCount++;
+
+    size_t lru = 0;
+    for (size_t slot = 0; slot < mEntries.size(); slot++) {
+        if (mEntries[slot].bufferId == bufferId) {
+            // already cached in HWC, skip sending the buffer
+            mEntries[slot].lastUse = mUseCount;
+            mStats.hits++;
+            *outSlot = slot;
+            *outBuffer = nullptr;
+            return;
+        }
+        if (mEntries[slot].lastUse < mEntries[lru].lastUse) {
+            lru = slot;
+        }
     }
 
-    *outSlot = slot;
+    mStats.misses++;
+    *outBuffer = buffer;
 
-    if (mBuffers[slot] == buffer) {
-        // already cached in HWC, skip sending the buffer
-        *outBuffer = nullptr;
-    } else {
-        *outBuffer = buffer;
+    // A buffer we evicted is back, there are more buffers in flight than
+    // slots
+    auto evicted = std::find(mEvicted.begin(), mEvicted.end(), bufferId);
+    if (evicted != mEvicted.end()) {
+        mEvicted.erase(evicted);
+        if (mCapacity < static_cast<uint32_t>(BufferQueue::NUM_BUFFER_SLOTS)) {
+            mCapacity++;
+        }
+    }
+
+    if (mEntries.size() < mCapacity) {
+        *outSlot = mEntries.size();
+        mEntries.push_back({bufferId, mUseCount});
+        return;
+    }
 
-        // update cache
-        mBuffers[slot] = buffer;
+    // update cache, replacing the least recently used buffer
+    mStats.evictions++;
+    mEvicted.push_back(mEntries[lru].bufferId);
+    while (mEvicted.size() > mCapacity) {
+        mEvicted.pop_front();
     }
+    mEntries[lru] = {bufferId, mUseCount};
+    *outSlot = lru;
+}
+
+void HWComposerBufferCache::clear()
+{
+    mEntries.clear();
+    mEvicted.clear();
+}
+
+void HWComposerBufferCache::dump(String8& result) const
+{
+    const uint64_t lookups = mStats.hits + mStats.misses;
+    result.appendFormat("buffer cache: %zu/%u slots, hits=%" PRIu64
+            " misses=%" PRIu64 " evictions=%" PRIu64 " (%.1f%% hits)\n",
+            mEntries.size(), mCapacity, mStats.hits, mStats.misses,
+            mStats.evictions,
+            lookups > 0 ? 100.0 * mStats.hits / lookups : 0.0);
 }
 
 } // namespace android
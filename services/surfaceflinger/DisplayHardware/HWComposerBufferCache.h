@@ -21,12 +21,14 @@
 
 #include <utils/StrongPointer.h>
 
+#include <deque>
 #include <vector>
 
 namespace android {
 // ---------------------------------------------------------------------------
 
 class GraphicBuffer;
+class String8;
 
 // With HIDLized hwcomposer HAL, the HAL can maintain a buffer cache for each
 // HWC display and layer.  When updating a display target or a layer buffer,
@@ -37,22 +39,55 @@ class GraphicBuffer;
 //
 // To be able to find out whether a buffer is already in the HAL's cache, we
 // use HWComposerBufferCache to mirror the cache in SF.
+//
+// Buffers are identified by their GraphicBuffer id rather than by their
+// BufferQueue slot, so that a buffer moving to another slot, or a producer
+// changing its slot count, doesn't cause the handle to be sent again.  The
+// cache starts small and only grows when a buffer it evicted comes back,
+// that is when more buffers are in flight than it has slots.  Once full, the
+// least recently used buffer is evicted.
 class HWComposerBufferCache {
 public:
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+    };
+
     HWComposerBufferCache();
 
-    // Given a buffer queue slot and buffer, return the HWC cache slot and
-    // buffer to be sent to HWC.
+    // Given a buffer, return the HWC cache slot and buffer to be sent to
+    // HWC.
     //
     // outBuffer is set to buffer when buffer is not in the HWC cache;
     // otherwise, outBuffer is set to nullptr.
-    void getHwcBuffer(int slot, const sp<GraphicBuffer>& buffer,
+    void getHwcBuffer(const sp<GraphicBuffer>& buffer,
             uint32_t* outSlot, sp<GraphicBuffer>* outBuffer);
 
+    // Forgets all the buffers, for when the HWC cache is gone.  The
+    // statistics are kept.
+    void clear();
+
+    const Stats& getStats() const { return mStats; }
+    uint32_t getNumSlots() const { return mCapacity; }
+
+    void dump(String8& result) const;
+
 private:
-    // a vector as we expect "slot" to be in the range of [0, 63] (that is,
-    // less than BufferQueue::NUM_BUFFER_SLOTS).
-    std::vector<sp<GraphicBuffer>> mBuffers;
+    static constexpr uint32_t kInitialCapacity = 3;
+
+    struct Entry {
+        uint64_t bufferId;
+        uint64_t lastUse;
+    };
+
+    // Indexed by HWC slot
+    std::vector<Entry> mEntries;
+    // The ids of the buffers evicted last, oldest first, at most mCapacity
+    std::deque<uint64_t> mEvicted;
+    uint32_t mCapacity;
+    uint64_t mUseCount;
+    Stats mStats;
 };
 
 // ---------------------------------------------------------------------------
@@ -0,0 +1,102 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SF_PERDISPLAYSTORAGE_H
+#define ANDROID_SF_PERDISPLAYSTORAGE_H
+
+#include <array>
+#include <unordered_map>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace android {
+// ---------------------------------------------------------------------------
+
+// PerDisplayStorage maps an HWC display id to a T, for state kept per display
+// by every layer and looked up on every frame. HWC display ids are small and
+// dense: the built-in displays come first and virtual display ids are reused
+// once freed. Ids below N are stored inline and found by indexing; larger ids,
+// which only show up with more virtual displays than HWC normally supports,
+// fall back to a map.
+//
+// Not thread safe.
+template <typename T, size_t N = 4>
+class PerDisplayStorage {
+public:
+    static_assert(N <= 32, "the present mask has 32 bits");
+
+    // Returns nullptr if there is no T for id
+    T* find(int32_t id) {
+        if (isInline(id)) {
+            return (mPresent & bit(id)) ? &mInline[id] : nullptr;
+        }
+        auto it = mOverflow.find(id);
+        return it != mOverflow.end() ? &it->second : nullptr;
+    }
+
+    const T* find(int32_t id) const {
+        return const_cast<PerDisplayStorage*>(this)->find(id);
+    }
+
+    bool contains(int32_t id) const { return find(id) != nullptr; }
+
+    // Returns the T for id, default constructed if there wasn't one
+    T& operator[](int32_t id) {
+        if (isInline(id)) {
+            mPresent |= bit(id);
+            return mInline[id];
+        }
+        return mOverflow[id];
+    }
+
+    void erase(int32_t id) {
+        if (isInline(id)) {
+            if (mPresent & bit(id)) {
+                // Release what the T holds now, not when the slot is reused
+                mInline[id] = T();
+                mPresent &= ~bit(id);
+            }
+        } else {
+            mOverflow.erase(id);
+        }
+    }
+
+    void clear() {
+        for (size_t i = 0; i < N; i++) {
+            if (mPresent & bit(i)) {
+                mInline[i] = T();
+            }
+        }
+        mPresent = 0;
+        mOverflow.clear();
+    }
+
+    bool empty() const { return mPresent == 0 && mOverflow.empty(); }
+
+private:
+    static bool isInline(int32_t id) { return id >= 0 && static_cast<size_t>(id) < N; }
+    static uint32_t bit(size_t id) { return 1u << id; }
+
+    std::array<T, N> mInline;
+    uint32_t mPresent = 0;
+    std::unordered_map<int32_t, T> mOverflow;
+};
+
+// ---------------------------------------------------------------------------
+}; // namespace android
+
+#endif // ANDROID_SF_PERDISPLAYSTORAGE_H
@@ -19,6 +19,8 @@
 #include "HWComposer.h"
 #include "SurfaceFlinger.h"
 
+#include <inttypes.h>
+
 #include <gui/BufferItem.h>
 #include <gui/BufferQueue.h>
 #include <gui/IProducerListener.h>
@@ -70,6 +72,7 @@ VirtualDisplaySurface::VirtualDisplaySurface(HWComposer& hwc, int32_t dispId,
     mDbgState(DBG_STATE_IDLE),
     mDbgLastCompositionType(COMPOSITION_UNKNOWN),
     mMustRecompose(false),
+    mNumFrames{},
     mForceHwcCopy(SurfaceFlinger::useHwcForRgbToYuv)
 {
     mSource[SOURCE_SINK] = sink;
@@ -111,6 +114,17 @@ VirtualDisplaySurface::~VirtualDisplaySurface() {
     mSource[SOURCE_SCRATCH]->disconnect(NATIVE_WINDOW_API_EGL);
 }
 
+void VirtualDisplaySurface::setHwcOutputFormat(uint32_t format) {
+    if (mDefaultOutputFormat == format) {
+        return;
+    }
+    VDS_LOGV("setHwcOutputFormat: %#x -> %#x", mDefaultOutputFormat, format);
+    if (mOutputFormat == mDefaultOutputFormat) {
+        mOutputFormat = format;
+    }
+    mDefaultOutputFormat = format;
+}
+
 status_t VirtualDisplaySurface::beginFrame(bool mustRecompose) {
     if (mDisplayId < 0)
         return NO_ERROR;
@@ -145,6 +159,10 @@ status_t VirtualDisplaySurface::prepareFrame(CompositionType compositionType) {
         mCompositionType = COMPOSITION_MIXED;
     }
 
+    if (mCompositionType <= COMPOSITION_MIXED) {
+        mNumFrames[mCompositionType]++;
+    }
+
     if (mCompositionType != mDbgLastCompositionType) {
         VDS_LOGV("prepareFrame: composition type changed to %s",
                 dbgCompositionTypeStr(mCompositionType));
@@ -220,12 +238,11 @@ status_t VirtualDisplaySurface::advanceFrame() {
 #ifdef USE_HWC2
         uint32_t hwcSlot = 0;
         sp<GraphicBuffer> hwcBuffer;
-        mHwcBufferCache.getHwcBuffer(mFbProducerSlot, fbBuffer,
-                &hwcSlot, &hwcBuffer);
+        mHwcBufferCache.getHwcBuffer(fbBuffer, &hwcSlot, &hwcBuffer);
 
         // TODO: Correctly propagate the dataspace from GL composition
         result = mHwc.setClientTarget(mDisplayId, hwcSlot, mFbFence,
-                hwcBuffer, HAL_DATASPACE_UNKNOWN);
+                hwcBuffer, HAL_DATASPACE_UNKNOWN, Region::INVALID_REGION);
 #else
         result = mHwc.fbPost(mDisplayId, mFbFence, fbBuffer);
 #endif
@@ -301,7 +318,15 @@ void VirtualDisplaySurface::onFrameCommitted() {
     resetPerFrameState();
 }
 
-void VirtualDisplaySurface::dumpAsString(String8& /* result */) const {
+void VirtualDisplaySurface::dumpAsString(String8& result) const {
+    result.appendFormat("VDS %s: output format %#x, frames GLES=%" PRIu64
+            " HWC=%" PRIu64 " MIXED=%" PRIu64 "\n", mDisplayName.string(),
+            mDefaultOutputFormat, mNumFrames[COMPOSITION_GLES],
+            mNumFrames[COMPOSITION_HWC], mNumFrames[COMPOSITION_MIXED]);
+#ifdef USE_HWC2
+    result.append("  client target ");
+    mHwcBufferCache.dump(result);
+#endif
 }
 
 void VirtualDisplaySurface::resizeBuffers(const uint32_t w, const uint32_t h) {
@@ -79,6 +79,13 @@ public:
             const sp<IGraphicBufferConsumer>& bqConsumer,
             const String8& name);
 
+    // Requests buffers of the given format from the sink whenever h/w
+    // composer writes the output, instead of the format picked from the
+    // sink's consumer. Used with the format h/w composer chose when the
+    // virtual display was allocated, so that it can write the sink buffers
+    // directly without any conversion.
+    void setHwcOutputFormat(uint32_t format);
+
     //
     // DisplaySurface interface
     //
@@ -252,6 +259,9 @@ private:
 
     bool mMustRecompose;
 
+    // Number of frames of each CompositionType, for dumpsys
+    uint64_t mNumFrames[COMPOSITION_MIXED + 1];
+
 #ifdef USE_HWC2
     HWComposerBufferCache mHwcBufferCache;
 #endif
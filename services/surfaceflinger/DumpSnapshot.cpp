@@ -0,0 +1,64 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "DumpSnapshot.h"
+
+#include "Colorizer.h"
+
+#include <inttypes.h>
+
+namespace android {
+
+void DumpSnapshot::dump(String8& result, Colorizer& colorizer) const {
+    const nsecs_t age = systemTime() - takenAt;
+    result.appendFormat("Snapshot taken %.3f ms ago, refresh period %" PRId64 " ns\n",
+            age / 1e6, vsyncPeriod);
+
+    colorizer.bold(result);
+    result.appendFormat("Displays (%zu entries)\n", displays.size());
+    colorizer.reset(result);
+    for (const DisplayState& display : displays) {
+        result.appendFormat("+ %s type=%d, layerStack=%u, size=(%d,%d), powerMode=%d, "
+                "pageFlipCount=%u, numVisibleLayers=%zu\n",
+                display.name.string(), display.type, display.layerStack,
+                display.width, display.height, display.powerMode,
+                display.pageFlipCount, display.numVisibleLayers);
+    }
+
+    colorizer.bold(result);
+    result.appendFormat("Layers (count = %zu)\n", layers.size());
+    colorizer.reset(result);
+    for (const LayerState& layer : layers) {
+        colorizer.colorize(result, Colorizer::GREEN);
+        result.appendFormat("+ %s (%s)\n", layer.typeId, layer.name.string());
+        colorizer.reset(result);
+        result.appendFormat("      "
+                "layerStack=%4u, z=%9d, pos=(%g,%g), size=(%4u,%4u), "
+                "isOpaque=%1d, alpha=%.3f, flags=0x%08x\n",
+                layer.layerStack, layer.z, layer.x, layer.y,
+                layer.width, layer.height,
+                layer.isOpaque, layer.alpha, layer.flags);
+        result.appendFormat("      "
+                "visibleBounds=(%4d,%4d,%4d,%4d), activeBuffer=[%4ux%4u:%4u,%3X], "
+                "queued-frames=%d\n",
+                layer.visibleBounds.left, layer.visibleBounds.top,
+                layer.visibleBounds.right, layer.visibleBounds.bottom,
+                layer.bufferWidth, layer.bufferHeight, layer.bufferStride,
+                layer.bufferFormat, layer.queuedFrames);
+    }
+}
+
+}; // namespace android
@@ -0,0 +1,78 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_DUMPSNAPSHOT_H
+#define ANDROID_DUMPSNAPSHOT_H
+
+#include <ui/Rect.h>
+#include <utils/String8.h>
+#include <utils/Timers.h>
+
+#include <stdint.h>
+#include <vector>
+
+namespace android {
+
+class Colorizer;
+
+// DumpSnapshot is a copy of the state printed by
+// "dumpsys SurfaceFlinger --snapshot". The main thread fills it between two
+// frames, then the binder thread formats it without holding mStateLock, so
+// that polling it doesn't stall composition. Everything is copied by value.
+struct DumpSnapshot {
+    struct LayerState {
+        String8 name;
+        const char* typeId = "";
+        uint32_t layerStack = 0;
+        int32_t z = 0;
+        float x = 0;
+        float y = 0;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        float alpha = 0;
+        uint32_t flags = 0;
+        bool isOpaque = false;
+        Rect visibleBounds;
+        uint32_t bufferWidth = 0;
+        uint32_t bufferHeight = 0;
+        uint32_t bufferStride = 0;
+        uint32_t bufferFormat = 0;
+        int32_t queuedFrames = 0;
+    };
+
+    struct DisplayState {
+        String8 name;
+        int32_t type = 0;
+        uint32_t layerStack = 0;
+        int width = 0;
+        int height = 0;
+        int powerMode = 0;
+        uint32_t pageFlipCount = 0;
+        size_t numVisibleLayers = 0;
+    };
+
+    nsecs_t takenAt = 0;
+    nsecs_t vsyncPeriod = 0;
+    // Drawing state, in Z order
+    std::vector<LayerState> layers;
+    std::vector<DisplayState> displays;
+
+    void dump(String8& result, Colorizer& colorizer) const;
+};
+
+}; // namespace android
+
+#endif // ANDROID_DUMPSNAPSHOT_H
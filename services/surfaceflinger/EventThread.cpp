@@ -101,7 +101,15 @@ sp<EventThread::Connection> EventThread::createEventConnection() const {
 status_t EventThread::registerDisplayEventConnection(
         const sp<EventThread::Connection>& connection) {
     Mutex::Autolock _l(mLock);
+    // Dead connections are only noticed when an event is sent to them,
+    // sweep the ones that never asked for vsync here
+    for (size_t i = mDisplayEventConnections.size(); i > 0; i--) {
+        if (mDisplayEventConnections[i - 1].promote() == NULL) {
+            mDisplayEventConnections.removeAt(i - 1);
+        }
+    }
     mDisplayEventConnections.add(connection);
+    updateVsyncRequestLocked(connection);
     mCondition.broadcast();
     return NO_ERROR;
 }
@@ -110,6 +118,16 @@ void EventThread::removeDisplayEventConnection(
         const wp<EventThread::Connection>& connection) {
     Mutex::Autolock _l(mLock);
     mDisplayEventConnections.remove(connection);
+    mVsyncRequests.remove(connection);
+}
+
+void EventThread::updateVsyncRequestLocked(
+        const sp<EventThread::Connection>& connection) {
+    if (connection->count >= 0) {
+        mVsyncRequests.add(connection);
+    } else {
+        mVsyncRequests.remove(connection);
+    }
 }
 
 void EventThread::setVsyncRate(uint32_t count,
@@ -119,6 +137,7 @@ void EventThread::setVsyncRate(uint32_t count,
         const int32_t new_count = (count == 0) ? -1 : count;
         if (connection->count != new_count) {
             connection->count = new_count;
+            updateVsyncRequestLocked(connection);
             mCondition.broadcast();
         }
     }
@@ -132,6 +151,7 @@ void EventThread::requestNextVsync(
 
     if (connection->count < 0) {
         connection->count = 0;
+        updateVsyncRequestLocked(connection);
         mCondition.broadcast();
     }
 }
@@ -185,11 +205,17 @@ bool EventThread::threadLoop() {
     signalConnections = waitForEvent(&event);
 
     // dispatch events to listeners...
+    // latest-only connections also get the time of the following vsync
+    nsecs_t expectedNextVsync = -1;
+    if (event.header.type == DisplayEventReceiver::DISPLAY_EVENT_VSYNC) {
+        expectedNextVsync = event.header.timestamp + mFlinger.mPrimaryDispSync.getPeriod();
+    }
+
     const size_t count = signalConnections.size();
     for (size_t i=0 ; i<count ; i++) {
         const sp<Connection>& conn(signalConnections[i]);
         // now see if we still need to report this event
-        status_t err = conn->postEvent(event);
+        status_t err = conn->postEvent(event, expectedNextVsync);
         if (err == -EAGAIN || err == -EWOULDBLOCK) {
             // The destination doesn't accept events anymore, it's probably
             // full. For now, we just drop the events on the floor.
@@ -246,44 +272,48 @@ Vector< sp<EventThread::Connection> > EventThread::waitForEvent(
             }
         }
 
-        // find out connections waiting for events
-        size_t count = mDisplayEventConnections.size();
-        for (size_t i=0 ; i<count ; i++) {
-            sp<Connection> connection(mDisplayEventConnections[i].promote());
-            if (connection != NULL) {
-                bool added = false;
-                if (connection->count >= 0) {
-                    // we need vsync events because at least
-                    // one connection is waiting for it
-                    waitForVSync = true;
-                    if (timestamp) {
-                        // we consume the event only if it's time
-                        // (ie: we received a vsync event)
-                        if (connection->count == 0) {
-                            // fired this time around
-                            connection->count = -1;
-                            signalConnections.add(connection);
-                            added = true;
-                        } else if (connection->count == 1 ||
-                                (vsyncCount % connection->count) == 0) {
-                            // continuous event, and time to report it
-                            signalConnections.add(connection);
-                            added = true;
-                        }
-                    }
+        // we need vsync events if at least one connection is waiting
+        // for it
+        waitForVSync = !mVsyncRequests.isEmpty();
+
+        if (timestamp) {
+            // find out connections waiting for this vsync, connections
+            // that didn't ask for vsync aren't even looked at
+            size_t count = mVsyncRequests.size();
+            for (size_t i=0 ; i<count ; i++) {
+                sp<Connection> connection(mVsyncRequests[i].promote());
+                if (connection == NULL) {
+                    // the connection has died, clean-up!
+                    mDisplayEventConnections.remove(mVsyncRequests[i]);
+                    mVsyncRequests.removeAt(i);
+                    --i; --count;
+                } else if (connection->count == 0) {
+                    // one-shot event, fired this time around
+                    connection->count = -1;
+                    mVsyncRequests.removeAt(i);
+                    --i; --count;
+                    signalConnections.add(connection);
+                } else if (connection->count == 1 ||
+                        (vsyncCount % connection->count) == 0) {
+                    // continuous event, and time to report it
+                    signalConnections.add(connection);
                 }
-
-                if (eventPending && !timestamp && !added) {
-                    // we don't have a vsync event to process
-                    // (timestamp==0), but we have some pending
-                    // messages.
+            }
+        } else if (eventPending) {
+            // we don't have a vsync event to process (timestamp==0), but
+            // we have some pending messages for everybody
+            size_t count = mDisplayEventConnections.size();
+            for (size_t i=0 ; i<count ; i++) {
+                sp<Connection> connection(mDisplayEventConnections[i].promote());
+                if (connection != NULL) {
                     signalConnections.add(connection);
+                } else {
+                    // we couldn't promote this reference, the connection
+                    // has died, so clean-up!
+                    mVsyncRequests.remove(mDisplayEventConnections[i]);
+                    mDisplayEventConnections.removeAt(i);
+                    --i; --count;
                 }
-            } else {
-                // we couldn't promote this reference, the connection has
-                // died, so clean-up!
-                mDisplayEventConnections.removeAt(i);
-                --i; --count;
             }
         }
 
@@ -373,8 +403,9 @@ void EventThread::dump(String8& result) const {
             mDebugVsyncEnabled?"enabled":"disabled");
     result.appendFormat("  soft-vsync: %s\n",
             mUseSoftwareVSync?"enabled":"disabled");
-    result.appendFormat("  numListeners=%zu,\n  events-delivered: %u\n",
-            mDisplayEventConnections.size(),
+    result.appendFormat("  numListeners=%zu, vsync requests=%zu,\n"
+            "  events-delivered: %u\n",
+            mDisplayEventConnections.size(), mVsyncRequests.size(),
             mVSyncEvent[DisplayDevice::DISPLAY_PRIMARY].vsync.count);
     for (size_t i=0 ; i<mDisplayEventConnections.size() ; i++) {
         sp<Connection> connection =
@@ -416,8 +447,33 @@ void EventThread::Connection::requestNextVsync() {
     mEventThread->requestNextVsync(this);
 }
 
+status_t EventThread::Connection::enableLatestVsync(gui::LatestVsyncSlot* outSlot) {
+    Mutex::Autolock _l(mLatestVsyncLock);
+    if (mLatestVsync == nullptr) {
+        auto slot = std::make_unique<gui::LatestVsyncSlot>();
+        status_t err = slot->create();
+        if (err != NO_ERROR) {
+            return err;
+        }
+        mLatestVsync = std::move(slot);
+    }
+    return mLatestVsync->duplicate(outSlot);
+}
+
 status_t EventThread::Connection::postEvent(
-        const DisplayEventReceiver::Event& event) {
+        const DisplayEventReceiver::Event& event, nsecs_t expectedNextVsync) {
+    if (event.header.type == DisplayEventReceiver::DISPLAY_EVENT_VSYNC) {
+        Mutex::Autolock _l(mLatestVsyncLock);
+        if (mLatestVsync != nullptr) {
+            DisplayEventReceiver::LatestVsync vsync;
+            vsync.timestamp = event.header.timestamp;
+            vsync.count = event.vsync.count;
+            vsync.expectedNextTimestamp = expectedNextVsync;
+            mLatestVsync->write(vsync);
+            return NO_ERROR;
+        }
+    }
+
     ssize_t size = DisplayEventReceiver::sendEvents(&mChannel, &event, 1);
     return size < 0 ? status_t(size) : status_t(NO_ERROR);
 }
@@ -20,7 +20,10 @@
 #include <stdint.h>
 #include <sys/types.h>
 
+#include <memory>
+
 #include <private/gui/BitTube.h>
+#include <private/gui/LatestVsyncSlot.h>
 #include <gui/DisplayEventReceiver.h>
 #include <gui/IDisplayEventConnection.h>
 
@@ -59,7 +62,11 @@ class EventThread : public Thread, private VSyncSource::Callback {
     class Connection : public BnDisplayEventConnection {
     public:
         explicit Connection(const sp<EventThread>& eventThread);
-        status_t postEvent(const DisplayEventReceiver::Event& event);
+
+        // expectedNextVsync is only used by latest-only connections, for
+        // vsync events
+        status_t postEvent(const DisplayEventReceiver::Event& event,
+                nsecs_t expectedNextVsync);
 
         // count >= 1 : continuous event. count is the vsync rate
         // count == 0 : one-shot event that has not fired
@@ -72,8 +79,14 @@ class EventThread : public Thread, private VSyncSource::Callback {
         status_t stealReceiveChannel(gui::BitTube* outChannel) override;
         status_t setVsyncRate(uint32_t count) override;
         void requestNextVsync() override;    // asynchronous
+        status_t enableLatestVsync(gui::LatestVsyncSlot* outSlot) override;
         sp<EventThread> const mEventThread;
         gui::BitTube mChannel;
+
+        // set once by enableLatestVsync(), vsync events go here instead of
+        // mChannel from then on
+        Mutex mLatestVsyncLock;
+        std::unique_ptr<gui::LatestVsyncSlot> mLatestVsync;
     };
 
 public:
@@ -110,6 +123,7 @@ private:
     virtual void onVSyncEvent(nsecs_t timestamp);
 
     void removeDisplayEventConnection(const wp<Connection>& connection);
+    void updateVsyncRequestLocked(const sp<Connection>& connection);
     void enableVSyncLocked();
     void disableVSyncLocked();
     void sendVsyncHintOnLocked();
@@ -124,6 +138,9 @@ private:
 
     // protected by mLock
     SortedVector< wp<Connection> > mDisplayEventConnections;
+    // the subset of mDisplayEventConnections with count >= 0, only these
+    // are scanned on vsync
+    SortedVector< wp<Connection> > mVsyncRequests;
     Vector< DisplayEventReceiver::Event > mPendingEvents;
     DisplayEventReceiver::Event mVSyncEvent[DisplayDevice::NUM_BUILTIN_DISPLAY_TYPES];
     bool mUseSoftwareVSync;
@@ -0,0 +1,128 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define ATRACE_TAG ATRACE_TAG_GRAPHICS
+
+#include <inttypes.h>
+#include <unistd.h>
+
+#include <utils/String8.h>
+#include <utils/Trace.h>
+
+#include "FrameTimelineRecorder.h"
+
+namespace android {
+
+FrameTimelineRecorder::FrameTimelineRecorder()
+  : mWriter(),
+    mPendingFrames(),
+    mNumTimedOut(0) {
+}
+
+int FrameTimelineRecorder::dupFd() const {
+    if (mWriter.initCheck() != NO_ERROR) {
+        return -1;
+    }
+    return dup(mWriter.getFd());
+}
+
+void FrameTimelineRecorder::addFrame(int32_t layerId, uint64_t frameNumber,
+        nsecs_t queueTime, nsecs_t latchTime, nsecs_t compositionStartTime,
+        const std::shared_ptr<FenceTime>& presentFence) {
+    if (mWriter.initCheck() != NO_ERROR) {
+        return;
+    }
+
+    if (mPendingFrames.size() >= MAX_PENDING_FRAMES) {
+        publish(mPendingFrames.front());
+        mPendingFrames.pop_front();
+        mNumTimedOut++;
+    }
+
+    PendingFrame frame;
+    frame.entry.layerId = layerId;
+    frame.entry.frameNumber = frameNumber;
+    frame.entry.queueTime = queueTime;
+    frame.entry.latchTime = latchTime;
+    frame.entry.compositionStartTime = compositionStartTime;
+    frame.presentFence = presentFence;
+    mPendingFrames.push_back(std::move(frame));
+}
+
+void FrameTimelineRecorder::addRelease(int32_t layerId, uint64_t frameNumber,
+        const std::shared_ptr<FenceTime>& releaseFence) {
+    // The frame being released is almost always one of the most recent ones
+    for (auto it = mPendingFrames.rbegin(); it != mPendingFrames.rend(); ++it) {
+        if (it->entry.layerId == layerId && it->entry.frameNumber == frameNumber) {
+            it->releaseFence = releaseFence;
+            it->released = true;
+            return;
+        }
+    }
+}
+
+bool FrameTimelineRecorder::resolveFence(
+        const std::shared_ptr<FenceTime>& fence, nsecs_t* outTime) {
+    if (!fence->isValid()) {
+        *outTime = -1;
+        return true;
+    }
+    const nsecs_t signalTime = fence->getSignalTime();
+    if (signalTime == Fence::SIGNAL_TIME_PENDING) {
+        return false;
+    }
+    *outTime = signalTime == Fence::SIGNAL_TIME_INVALID ? -1 : signalTime;
+    return true;
+}
+
+void FrameTimelineRecorder::flush(nsecs_t now) {
+    ATRACE_CALL();
+    for (auto it = mPendingFrames.begin(); it != mPendingFrames.end();) {
+        nsecs_t unused;
+        const bool done = resolveFence(it->presentFence, &unused) &&
+                it->released && resolveFence(it->releaseFence, &unused);
+        if (!done && now - it->entry.latchTime < PENDING_TIMEOUT) {
+            ++it;
+            continue;
+        }
+        if (!done) {
+            mNumTimedOut++;
+        }
+        publish(*it);
+        it = mPendingFrames.erase(it);
+    }
+}
+
+void FrameTimelineRecorder::publish(PendingFrame& frame) {
+    // Whatever is still pending at this point is reported as unknown
+    if (!resolveFence(frame.presentFence, &frame.entry.presentTime)) {
+        frame.entry.presentTime = -1;
+    }
+    if (!frame.released ||
+            !resolveFence(frame.releaseFence, &frame.entry.releaseTime)) {
+        frame.entry.releaseTime = -1;
+    }
+    mWriter.write(frame.entry);
+}
+
+void FrameTimelineRecorder::dump(String8& result) const {
+    result.appendFormat("Frame timeline: %s, %zu frames pending, "
+            "%" PRIu64 " published with missing timestamps\n",
+            mWriter.initCheck() == NO_ERROR ? "enabled" : "disabled",
+            mPendingFrames.size(), mNumTimedOut);
+}
+
+}; // namespace android
@@ -0,0 +1,85 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_FRAMETIMELINERECORDER_H
+#define ANDROID_FRAMETIMELINERECORDER_H
+
+#include <gui/FrameTimeline.h>
+#include <ui/FenceTime.h>
+
+#include <utils/Timers.h>
+
+#include <deque>
+#include <memory>
+
+namespace android {
+
+class String8;
+
+// FrameTimelineRecorder collects the timestamps of every buffer latched by
+// SurfaceFlinger and publishes them to the shared memory frame timeline once
+// the present and release fences of the frame have signaled. It is *NOT*
+// thread-safe and is only used from the main thread.
+class FrameTimelineRecorder {
+public:
+    // Maximum number of frames waiting for their fences
+    enum { MAX_PENDING_FRAMES = 1024 };
+
+    // Frames whose fences haven't signaled after this long are published
+    // with the missing timestamps set to -1, e.g. the release of the last
+    // buffer of a layer only happens when the next one is latched.
+    static constexpr nsecs_t PENDING_TIMEOUT = ms2ns(1000);
+
+    FrameTimelineRecorder();
+
+    status_t initCheck() const { return mWriter.initCheck(); }
+
+    // Returns a new fd to the timeline, owned by the caller, or -1
+    int dupFd() const;
+
+    void addFrame(int32_t layerId, uint64_t frameNumber, nsecs_t queueTime,
+            nsecs_t latchTime, nsecs_t compositionStartTime,
+            const std::shared_ptr<FenceTime>& presentFence);
+    void addRelease(int32_t layerId, uint64_t frameNumber,
+            const std::shared_ptr<FenceTime>& releaseFence);
+
+    // Publishes the frames whose timestamps are all known or timed out
+    void flush(nsecs_t now);
+
+    void dump(String8& result) const;
+
+private:
+    struct PendingFrame {
+        FrameTimelineEntry entry;
+        std::shared_ptr<FenceTime> presentFence{FenceTime::NO_FENCE};
+        std::shared_ptr<FenceTime> releaseFence{FenceTime::NO_FENCE};
+        bool released{false};
+    };
+
+    // Returns true once the fence has a final value, stored in outTime
+    static bool resolveFence(const std::shared_ptr<FenceTime>& fence,
+            nsecs_t* outTime);
+
+    void publish(PendingFrame& frame);
+
+    FrameTimelineWriter mWriter;
+    std::deque<PendingFrame> mPendingFrames;
+    uint64_t mNumTimedOut;
+};
+
+}; // namespace android
+
+#endif // ANDROID_FRAMETIMELINERECORDER_H
@@ -16,64 +16,126 @@
 
 #include "GpuService.h"
 
-#include <binder/IResultReceiver.h>
-#include <binder/Parcel.h>
+#include <binder/IPCThreadState.h>
+#include <binder/PermissionCache.h>
+#include <private/android_filesystem_config.h>
+#include <ui/GraphicBufferAllocator.h>
 #include <utils/String8.h>
 #include <vkjson.h>
 
+#include <algorithm>
+
+#include <inttypes.h>
+#include <unistd.h>
+
 namespace android {
 
 // ----------------------------------------------------------------------------
 
-class BpGpuService : public BpInterface<IGpuService>
-{
-public:
-    explicit BpGpuService(const sp<IBinder>& impl) : BpInterface<IGpuService>(impl) {}
-};
+namespace {
+    status_t cmd_help(int out);
+    status_t cmd_vkjson(int out, int err);
 
-IMPLEMENT_META_INTERFACE(GpuService, "android.ui.IGpuService");
+    const String16 sDump("android.permission.DUMP");
+}
 
-status_t BnGpuService::onTransact(uint32_t code, const Parcel& data,
-        Parcel* reply, uint32_t flags)
-{
-    status_t status;
-    switch (code) {
-    case SHELL_COMMAND_TRANSACTION: {
-        int in = data.readFileDescriptor();
-        int out = data.readFileDescriptor();
-        int err = data.readFileDescriptor();
-        int argc = data.readInt32();
-        Vector<String16> args;
-        for (int i = 0; i < argc && data.dataAvail() > 0; i++) {
-           args.add(data.readString16());
-        }
-        sp<IBinder> unusedCallback;
-        sp<IResultReceiver> resultReceiver;
-        if ((status = data.readNullableStrongBinder(&unusedCallback)) != OK)
-            return status;
-        if ((status = data.readNullableStrongBinder(&resultReceiver)) != OK)
-            return status;
-        status = shellCommand(in, out, err, args);
-        if (resultReceiver != nullptr)
-            resultReceiver->send(status);
-        return OK;
+const char* const GpuService::SERVICE_NAME = "gpu";
+
+GpuService::GpuService() {}
+
+void GpuService::setGpuStats(const GraphicsEnv::GpuStats& stats) {
+    const uid_t uid = IPCThreadState::self()->getCallingUid();
+
+    Mutex::Autolock lock(mStatsLock);
+    GpuUidStats& uidStats = mStats[uid];
+    uidStats.uid = uid;
+    uidStats.processCount++;
+    if (stats.glDriverLoadTimeNs >= 0) {
+        uidStats.glDriverLoadCount++;
+        uidStats.glDriverLoadTimeTotalNs += stats.glDriverLoadTimeNs;
+        uidStats.glDriverLoadTimeMaxNs =
+                std::max(uidStats.glDriverLoadTimeMaxNs, stats.glDriverLoadTimeNs);
+    }
+    if (stats.vkDriverLoadTimeNs >= 0) {
+        uidStats.vkDriverLoadCount++;
+        uidStats.vkDriverLoadTimeTotalNs += stats.vkDriverLoadTimeNs;
+        uidStats.vkDriverLoadTimeMaxNs =
+                std::max(uidStats.vkDriverLoadTimeMaxNs, stats.vkDriverLoadTimeNs);
     }
+    uidStats.shaderCacheHits += stats.shaderCacheHits;
+    uidStats.shaderCacheMisses += stats.shaderCacheMisses;
+}
 
-    default:
-        return BBinder::onTransact(code, data, reply, flags);
+status_t GpuService::getGpuStats(std::vector<GpuUidStats>* outStats) {
+    if (!callerCanReadStats()) {
+        return PERMISSION_DENIED;
     }
+    *outStats = collectStats();
+    return NO_ERROR;
 }
 
-// ----------------------------------------------------------------------------
+std::vector<GpuUidStats> GpuService::collectStats() const {
+    std::vector<GpuUidStats> stats;
+    {
+        Mutex::Autolock lock(mStatsLock);
+        stats.reserve(mStats.size());
+        for (const auto& entry : mStats) {
+            stats.push_back(entry.second);
+        }
+    }
+    // The allocator has its own lock, don't hold ours while asking it
+    const GraphicBufferAllocator& allocator = GraphicBufferAllocator::get();
+    for (GpuUidStats& s : stats) {
+        s.gpuMemoryBytes = allocator.getUidUsage(s.uid);
+    }
+    return stats;
+}
 
-namespace {
-    status_t cmd_help(int out);
-    status_t cmd_vkjson(int out, int err);
+bool GpuService::callerCanReadStats() const {
+    IPCThreadState* ipc = IPCThreadState::self();
+    const int pid = ipc->getCallingPid();
+    const int uid = ipc->getCallingUid();
+    return uid == AID_SHELL || uid == AID_SYSTEM || uid == getuid() ||
+            PermissionCache::checkPermission(sDump, pid, uid);
 }
 
-const char* const GpuService::SERVICE_NAME = "gpu";
+status_t GpuService::dump(int fd, const Vector<String16>& /*args*/) {
+    String8 result;
+    if (!callerCanReadStats()) {
+        IPCThreadState* ipc = IPCThreadState::self();
+        result.appendFormat("Permission Denial: can't dump gpu from pid=%d, uid=%d\n",
+                ipc->getCallingPid(), ipc->getCallingUid());
+    } else {
+        dumpStats(result);
+    }
+    write(fd, result.string(), result.size());
+    return NO_ERROR;
+}
 
-GpuService::GpuService() {}
+void GpuService::dumpStats(String8& result) const {
+    std::vector<GpuUidStats> stats = collectStats();
+    std::sort(stats.begin(), stats.end(),
+            [](const GpuUidStats& a, const GpuUidStats& b) { return a.uid < b.uid; });
+
+    result.appendFormat("GPU stats of %zu uids:\n", stats.size());
+    result.append("    uid procs  GL loads avg/max (ms)  VK loads avg/max (ms)"
+            "  cache hits/misses (hit%)  buffers (KB)\n");
+    for (const GpuUidStats& s : stats) {
+        const double glAvg = s.glDriverLoadCount == 0 ? 0.0 :
+                s.glDriverLoadTimeTotalNs / 1e6 / s.glDriverLoadCount;
+        const double vkAvg = s.vkDriverLoadCount == 0 ? 0.0 :
+                s.vkDriverLoadTimeTotalNs / 1e6 / s.vkDriverLoadCount;
+        const uint64_t lookups = s.shaderCacheHits + s.shaderCacheMisses;
+        const double hitRate = lookups == 0 ? 0.0 : 100.0 * s.shaderCacheHits / lookups;
+        result.appendFormat("%7u %5u  %8u %6.2f/%7.2f  %8u %6.2f/%7.2f"
+                "  %10" PRIu64 "/%-8" PRIu64 " (%5.1f%%)  %12" PRIu64 "\n",
+                s.uid, s.processCount,
+                s.glDriverLoadCount, glAvg, s.glDriverLoadTimeMaxNs / 1e6,
+                s.vkDriverLoadCount, vkAvg, s.vkDriverLoadTimeMaxNs / 1e6,
+                s.shaderCacheHits, s.shaderCacheMisses, hitRate,
+                s.gpuMemoryBytes / 1024);
+    }
+}
 
 status_t GpuService::shellCommand(int /*in*/, int out, int err,
         Vector<String16>& args)
@@ -85,6 +147,12 @@ status_t GpuService::shellCommand(int /*in*/, int out, int err,
     if (args.size() >= 1) {
         if (args[0] == String16("vkjson"))
             return cmd_vkjson(out, err);
+        if (args[0] == String16("stats")) {
+            String8 result;
+            dumpStats(result);
+            write(out, result.string(), result.size());
+            return NO_ERROR;
+        }
         if (args[0] == String16("help"))
             return cmd_help(out);
     }
@@ -106,7 +174,9 @@ status_t cmd_help(int out) {
     }
     fprintf(outs,
         "GPU Service commands:\n"
-        "  vkjson   dump Vulkan properties as JSON\n");
+        "  vkjson   dump Vulkan properties as JSON\n"
+        "  stats    dump per-uid driver load times, shader cache hit rates\n"
+        "           and graphic buffer usage\n");
     fclose(outs);
     return NO_ERROR;
 }
@@ -17,28 +17,15 @@
 #ifndef ANDROID_GPUSERVICE_H
 #define ANDROID_GPUSERVICE_H
 
-#include <binder/IInterface.h>
 #include <cutils/compiler.h>
+#include <gui/IGpuService.h>
+#include <utils/Mutex.h>
 
-namespace android {
+#include <unordered_map>
 
-/*
- * This class defines the Binder IPC interface for GPU-related queries and
- * control.
- */
-class IGpuService : public IInterface {
-public:
-    DECLARE_META_INTERFACE(GpuService);
-};
-
-class BnGpuService: public BnInterface<IGpuService> {
-protected:
-    virtual status_t shellCommand(int in, int out, int err,
-        Vector<String16>& args) = 0;
+namespace android {
 
-    virtual status_t onTransact(uint32_t code, const Parcel& data,
-            Parcel* reply, uint32_t flags = 0) override;
-};
+class String8;
 
 class GpuService : public BnGpuService
 {
@@ -47,9 +34,23 @@ public:
 
     GpuService() ANDROID_API;
 
+    // IGpuService interface
+    virtual void setGpuStats(const GraphicsEnv::GpuStats& stats) override;
+    virtual status_t getGpuStats(std::vector<GpuUidStats>* outStats) override;
+
+    virtual status_t dump(int fd, const Vector<String16>& args) override;
+
 protected:
     virtual status_t shellCommand(int in, int out, int err,
         Vector<String16>& args) override;
+
+private:
+    bool callerCanReadStats() const;
+    std::vector<GpuUidStats> collectStats() const;
+    void dumpStats(String8& result) const;
+
+    mutable Mutex mStatsLock;
+    std::unordered_map<uid_t, GpuUidStats> mStats;
 };
 
 } // namespace android
@@ -22,7 +22,9 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <sys/types.h>
+#include <errno.h>
 #include <math.h>
+#include <unistd.h>
 
 #include <cutils/compiler.h>
 #include <cutils/native_handle.h>
@@ -53,6 +55,7 @@
 
 #include "RenderEngine/RenderEngine.h"
 
+#include <algorithm>
 #include <mutex>
 
 #define DEBUG_RESIZE    0
@@ -66,6 +69,7 @@ int32_t Layer::sSequence = 1;
 Layer::Layer(SurfaceFlinger* flinger, const sp<Client>& client,
         const String8& name, uint32_t w, uint32_t h, uint32_t flags)
     :   contentDirty(false),
+        visibleRegionDirty(true),
         sequence(uint32_t(android_atomic_inc(&sSequence))),
         mFlinger(flinger),
         mTextureName(-1U),
@@ -75,6 +79,9 @@ Layer::Layer(SurfaceFlinger* flinger, const sp<Client>& client,
         mTransactionFlags(0),
         mPendingStateMutex(),
         mPendingStates(),
+        mPublishedSequence(0),
+        mPublishedState(),
+        mTakenSequence(0),
         mQueuedFrames(0),
         mSidebandStreamChanged(false),
         mActiveBufferSlot(BufferQueue::INVALID_BUFFER_SLOT),
@@ -97,13 +104,15 @@ Layer::Layer(SurfaceFlinger* flinger, const sp<Client>& client,
         mHasSurface(false),
         mClientRef(client),
         mPotentialCursor(false),
-        mQueueItemLock(),
-        mQueueItemCondition(),
         mQueueItems(),
         mLastFrameNumberReceived(0),
+        mLastQueueTime(0),
         mUpdateTexImageFailed(false),
         mAutoRefresh(false),
         mFreezeGeometryUpdates(false)
+#ifdef USE_HWC2
+        , mRenderDurationCount(0)
+#endif
 {
 #ifdef USE_HWC2
     ALOGV("Creating Layer %s", name.string());
@@ -196,6 +205,9 @@ Layer::~Layer() {
     for (auto& point : mLocalSyncPoints) {
         point->setFrameAvailable();
     }
+    if (mPropertyBlock != nullptr) {
+        mFlinger->mNumLayerPropertyBlocks--;
+    }
     mFlinger->deleteTextureAsync(mTextureName);
     mFrameTracker.logAndResetStats(mName);
 }
@@ -222,59 +234,59 @@ void Layer::onLayerDisplayed(const sp<const DisplayDevice>& /* hw */,
 #endif
 
 void Layer::onFrameAvailable(const BufferItem& item) {
-    // Add this buffer from our internal queue tracker
-    { // Autolock scope
-        Mutex::Autolock lock(mQueueItemLock);
-        mFlinger->mInterceptor.saveBufferUpdate(this, item.mGraphicBuffer->getWidth(),
-                item.mGraphicBuffer->getHeight(), item.mFrameNumber);
-        // Reset the frame number tracker when we receive the first buffer after
-        // a frame number reset
-        if (item.mFrameNumber == 1) {
-            mLastFrameNumberReceived = 0;
-        }
+    mLastQueueTime = systemTime();
 
-        // Ensure that callbacks are handled in order
-        while (item.mFrameNumber != mLastFrameNumberReceived + 1) {
-            status_t result = mQueueItemCondition.waitRelative(mQueueItemLock,
-                    ms2ns(500));
-            if (result != NO_ERROR) {
-                ALOGE("[%s] Timed out waiting on callback", mName.string());
-            }
-        }
+    mFlinger->mInterceptor.saveBufferUpdate(this, item.mGraphicBuffer->getWidth(),
+            item.mGraphicBuffer->getHeight(), item.mFrameNumber);
+    // Reset the frame number tracker when we receive the first buffer after
+    // a frame number reset
+    if (item.mFrameNumber == 1) {
+        mLastFrameNumberReceived = 0;
+    }
 
-        mQueueItems.push_back(item);
-        android_atomic_inc(&mQueuedFrames);
+    // Add this buffer to our internal queue tracker. BufferQueueProducer
+    // delivers the callbacks one at a time and in order, so this is the only
+    // producer.
+    pushQueueItem(item, false);
+    android_atomic_inc(&mQueuedFrames);
 
-        // Wake up any pending callbacks
-        mLastFrameNumberReceived = item.mFrameNumber;
-        mQueueItemCondition.broadcast();
+    // Only now may the main thread acquire this frame
+    mLastFrameNumberReceived = item.mFrameNumber;
+
+#ifdef USE_HWC2
+    if (mFlinger->mRefreshRateSwitching) {
+        mFlinger->mRefreshRatePolicy.onFrameQueued(sequence, systemTime());
     }
+#endif
 
     mFlinger->signalLayerUpdate();
 }
 
 void Layer::onFrameReplaced(const BufferItem& item) {
-    { // Autolock scope
-        Mutex::Autolock lock(mQueueItemLock);
-
-        // Ensure that callbacks are handled in order
-        while (item.mFrameNumber != mLastFrameNumberReceived + 1) {
-            status_t result = mQueueItemCondition.waitRelative(mQueueItemLock,
-                    ms2ns(500));
-            if (result != NO_ERROR) {
-                ALOGE("[%s] Timed out waiting on callback", mName.string());
-            }
-        }
-
-        if (mQueueItems.empty()) {
-            ALOGE("Can't replace a frame on an empty queue");
-            return;
+    if (mQueueItems.empty()) {
+        ALOGE("Can't replace a frame on an empty queue");
+        return;
+    }
+    // Not a new frame for mQueuedFrames, the main thread drops the replaced
+    // item along with its replacement
+    pushQueueItem(item, true);
+    mLastFrameNumberReceived = item.mFrameNumber;
+}
+
+void Layer::pushQueueItem(const BufferItem& item, bool replacesPrevious) {
+    // The ring is only full if the main thread is falling behind by more
+    // than a BufferQueue's worth of replacements. Make the producer wait for
+    // it, the main thread must never wait for the producer.
+    nsecs_t waitStart = 0;
+    while (!mQueueItems.push(item, replacesPrevious)) {
+        const nsecs_t now = systemTime();
+        if (waitStart == 0) {
+            waitStart = now;
+        } else if (now - waitStart > ms2ns(500)) {
+            ALOGE("[%s] Timed out waiting for room in the queue", mName.string());
+            waitStart = now;
         }
-        mQueueItems.editItemAt(mQueueItems.size() - 1) = item;
-
-        // Wake up any pending callbacks
-        mLastFrameNumberReceived = item.mFrameNumber;
-        mQueueItemCondition.broadcast();
+        usleep(1000);
     }
 }
 
@@ -622,6 +634,7 @@ void Layer::setGeometry(
     ALOGE_IF(error != HWC2::Error::None, "[%s] Failed to set blend mode %s:"
              " %s (%d)", mName.string(), to_string(blendMode).c_str(),
              to_string(error).c_str(), static_cast<int32_t>(error));
+    hwcInfo.blendMode = blendMode;
 #else
     if (!isOpaque(s) || getAlpha() != 0xFF) {
         layer.setBlending(mPremultipliedAlpha ?
@@ -702,11 +715,13 @@ void Layer::setGeometry(
     ALOGE_IF(error != HWC2::Error::None, "[%s] Failed to set plane alpha %.3f: "
             "%s (%d)", mName.string(), alpha, to_string(error).c_str(),
             static_cast<int32_t>(error));
+    hwcInfo.alpha = alpha;
 
     error = hwcLayer->setZOrder(z);
     ALOGE_IF(error != HWC2::Error::None, "[%s] Failed to set Z %u: %s (%d)",
             mName.string(), z, to_string(error).c_str(),
             static_cast<int32_t>(error));
+    hwcInfo.z = z;
 
     int type = s.type;
     int appId = s.appId;
@@ -775,6 +790,7 @@ void Layer::setGeometry(
         ALOGE_IF(error != HWC2::Error::None, "[%s] Failed to set transform %s: "
                 "%s (%d)", mName.string(), to_string(transform).c_str(),
                 to_string(error).c_str(), static_cast<int32_t>(error));
+        hwcInfo.transform = transform;
     }
 #else
     if (orientation & Transform::ROT_INVALID) {
@@ -788,12 +804,13 @@ void Layer::setGeometry(
 
 #ifdef USE_HWC2
 void Layer::forceClientComposition(int32_t hwcId) {
-    if (mHwcLayers.count(hwcId) == 0) {
+    HWCInfo* hwcInfo = mHwcLayers.find(hwcId);
+    if (hwcInfo == nullptr) {
         ALOGE("forceClientComposition: no HWC layer found (%d)", hwcId);
         return;
     }
 
-    mHwcLayers[hwcId].forceClientComposition = true;
+    hwcInfo->forceClientComposition = true;
 }
 
 void Layer::setPerFrameData(const sp<const DisplayDevice>& displayDevice) {
@@ -858,6 +875,7 @@ void Layer::setPerFrameData(const sp<const DisplayDevice>& displayDevice) {
             ALOGE("[%s] Failed to clear transform: %s (%d)", mName.string(),
                     to_string(error).c_str(), static_cast<int32_t>(error));
         }
+        hwcInfo.transform = HWC2::Transform::None;
 
         return;
     }
@@ -877,12 +895,13 @@ void Layer::setPerFrameData(const sp<const DisplayDevice>& displayDevice) {
         ALOGE("[%s] Failed to set dataspace %d: %s (%d)", mName.string(),
               mCurrentState.dataSpace, to_string(error).c_str(),
               static_cast<int32_t>(error));
+    } else {
+        hwcInfo.dataspace = mCurrentState.dataSpace;
     }
 
     uint32_t hwcSlot = 0;
     sp<GraphicBuffer> hwcBuffer;
-    hwcInfo.bufferCache.getHwcBuffer(mActiveBufferSlot, mActiveBuffer,
-            &hwcSlot, &hwcBuffer);
+    hwcInfo.bufferCache.getHwcBuffer(mActiveBuffer, &hwcSlot, &hwcBuffer);
 
     auto acquireFence = mSurfaceFlingerConsumer->getCurrentFence();
     error = hwcLayer->setBuffer(hwcSlot, hwcBuffer, acquireFence);
@@ -923,8 +942,8 @@ void Layer::setPerFrameData(const sp<const DisplayDevice>& hw,
 #ifdef USE_HWC2
 void Layer::updateCursorPosition(const sp<const DisplayDevice>& displayDevice) {
     auto hwcId = displayDevice->getHwcDisplayId();
-    if (mHwcLayers.count(hwcId) == 0 ||
-            getCompositionType(hwcId) != HWC2::Composition::Cursor) {
+    HWCInfo* hwcInfo = mHwcLayers.find(hwcId);
+    if (hwcInfo == nullptr || hwcInfo->compositionType != HWC2::Composition::Cursor) {
         return;
     }
 
@@ -947,7 +966,7 @@ void Layer::updateCursorPosition(const sp<const DisplayDevice>& displayDevice) {
     auto& displayTransform(displayDevice->getTransform());
     auto position = displayTransform.transform(frame);
 
-    auto error = mHwcLayers[hwcId].layer->setCursorPosition(position.left,
+    auto error = hwcInfo->layer->setCursorPosition(position.left,
             position.top);
     ALOGE_IF(error != HWC2::Error::None, "[%s] Failed to set cursor position "
             "to (%d, %d): %s (%d)", mName.string(), position.left,
@@ -1208,11 +1227,12 @@ void Layer::drawWithOpenGL(const sp<const DisplayDevice>& hw,
 #ifdef USE_HWC2
 void Layer::setCompositionType(int32_t hwcId, HWC2::Composition type,
         bool callIntoHwc) {
-    if (mHwcLayers.count(hwcId) == 0) {
+    HWCInfo* hwcInfoPtr = mHwcLayers.find(hwcId);
+    if (hwcInfoPtr == nullptr) {
         ALOGE("setCompositionType called without a valid HWC layer");
         return;
     }
-    auto& hwcInfo = mHwcLayers[hwcId];
+    auto& hwcInfo = *hwcInfoPtr;
     auto& hwcLayer = hwcInfo.layer;
     ALOGV("setCompositionType(%" PRIx64 ", %s, %d)", hwcLayer->getId(),
             to_string(type).c_str(), static_cast<int>(callIntoHwc));
@@ -1235,27 +1255,67 @@ HWC2::Composition Layer::getCompositionType(int32_t hwcId) const {
         // have a HWC counterpart, then it will always be Client
         return HWC2::Composition::Client;
     }
-    if (mHwcLayers.count(hwcId) == 0) {
+    const HWCInfo* hwcInfo = mHwcLayers.find(hwcId);
+    if (hwcInfo == nullptr) {
         ALOGE("getCompositionType called with an invalid HWC layer");
         return HWC2::Composition::Invalid;
     }
-    return mHwcLayers.at(hwcId).compositionType;
+    return hwcInfo->compositionType;
+}
+
+static inline void hashCombine(uint64_t* hash, uint64_t value) {
+    // 64 bit variant of boost::hash_combine
+    *hash ^= value + 0x9e3779b97f4a7c15ull + (*hash << 6) + (*hash >> 2);
+}
+
+static inline uint64_t floatBits(float value) {
+    uint32_t bits = 0;
+    static_assert(sizeof(bits) == sizeof(value), "unexpected float size");
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+uint64_t Layer::getHwcCompositionKey(int32_t hwcId) const {
+    const HWCInfo* hwcInfoPtr = mHwcLayers.find(hwcId);
+    if (hwcInfoPtr == nullptr) {
+        return 0;
+    }
+    const auto& hwcInfo = *hwcInfoPtr;
+    uint64_t key = hwcInfo.layer ? hwcInfo.layer->getId() : 0;
+    hashCombine(&key, static_cast<uint64_t>(hwcInfo.compositionType));
+    hashCombine(&key, static_cast<uint64_t>(hwcInfo.forceClientComposition));
+    hashCombine(&key, static_cast<uint64_t>(hwcInfo.displayFrame.left));
+    hashCombine(&key, static_cast<uint64_t>(hwcInfo.displayFrame.top));
+    hashCombine(&key, static_cast<uint64_t>(hwcInfo.displayFrame.right));
+    hashCombine(&key, static_cast<uint64_t>(hwcInfo.displayFrame.bottom));
+    hashCombine(&key, floatBits(hwcInfo.sourceCrop.left));
+    hashCombine(&key, floatBits(hwcInfo.sourceCrop.top));
+    hashCombine(&key, floatBits(hwcInfo.sourceCrop.right));
+    hashCombine(&key, floatBits(hwcInfo.sourceCrop.bottom));
+    hashCombine(&key, static_cast<uint64_t>(hwcInfo.blendMode));
+    hashCombine(&key, static_cast<uint64_t>(hwcInfo.transform));
+    hashCombine(&key, static_cast<uint64_t>(hwcInfo.dataspace));
+    hashCombine(&key, hwcInfo.z);
+    hashCombine(&key, floatBits(hwcInfo.alpha));
+    return key;
 }
 
 void Layer::setClearClientTarget(int32_t hwcId, bool clear) {
-    if (mHwcLayers.count(hwcId) == 0) {
+    HWCInfo* hwcInfo = mHwcLayers.find(hwcId);
+    if (hwcInfo == nullptr) {
         ALOGE("setClearClientTarget called without a valid HWC layer");
         return;
     }
-    mHwcLayers[hwcId].clearClientTarget = clear;
+    hwcInfo->clearClientTarget = clear;
 }
 
 bool Layer::getClearClientTarget(int32_t hwcId) const {
-    if (mHwcLayers.count(hwcId) == 0) {
+    const HWCInfo* hwcInfo = mHwcLayers.find(hwcId);
+    if (hwcInfo == nullptr) {
         ALOGE("getClearClientTarget called without a valid HWC layer");
         return false;
     }
-    return mHwcLayers.at(hwcId).clearClientTarget;
+    return hwcInfo->clearClientTarget;
 }
 #endif
 
@@ -1285,9 +1345,8 @@ bool Layer::latchUnsignaledBuffers() {
 }
 
 uint64_t Layer::getHeadFrameNumber() const {
-    Mutex::Autolock lock(mQueueItemLock);
     if (!mQueueItems.empty()) {
-        return mQueueItems[0].mFrameNumber;
+        return mQueueItems.front().mFrameNumber;
     } else {
         return mCurrentFrameNumber;
     }
@@ -1299,23 +1358,66 @@ bool Layer::headFenceHasSignaled() const {
         return true;
     }
 
-    Mutex::Autolock lock(mQueueItemLock);
     if (mQueueItems.empty()) {
         return true;
     }
-    if (mQueueItems[0].mIsDroppable) {
+    const BufferItem& item(mQueueItems.front());
+    if (item.mIsDroppable) {
         // Even though this buffer's fence may not have signaled yet, it could
         // be replaced by another buffer before it has a chance to, which means
         // that it's possible to get into a situation where a buffer is never
         // able to be latched. To avoid this, grab this buffer anyway.
         return true;
     }
-    return mQueueItems[0].mFence->getSignalTime() != INT64_MAX;
+    return item.mFence->getSignalTime() != INT64_MAX;
 #else
     return true;
 #endif
 }
 
+#ifdef USE_HWC2
+nsecs_t Layer::getExpectedLatchTime() const {
+    if (mRenderDurationCount == 0 || latchUnsignaledBuffers()) {
+        return -1;
+    }
+
+    if (mQueueItems.empty()) {
+        return -1;
+    }
+    const BufferItem& item(mQueueItems.front());
+    // Without an auto timestamp we don't know when the buffer was queued
+    if (item.mIsDroppable || !item.mIsAutoTimestamp ||
+            item.mFence->getSignalTime() != INT64_MAX) {
+        return -1;
+    }
+
+    // Only bet on the fence making it if every recent buffer would have
+    const size_t count = std::min(mRenderDurationCount, RENDER_DURATION_HISTORY);
+    nsecs_t renderDuration = 0;
+    for (size_t i = 0; i < count; i++) {
+        renderDuration = std::max(renderDuration, mRenderDurations[i]);
+    }
+    return item.mTimestamp + renderDuration;
+}
+
+void Layer::recordRenderDuration() {
+    if (mQueueItems.empty()) {
+        return;
+    }
+    const BufferItem& item(mQueueItems.front());
+    if (!item.mIsAutoTimestamp) {
+        return;
+    }
+    // Also rejects invalid and pending fences
+    const nsecs_t signalTime = item.mFence->getSignalTime();
+    if (signalTime == INT64_MAX || signalTime < item.mTimestamp) {
+        return;
+    }
+    mRenderDurations[mRenderDurationCount++ % RENDER_DURATION_HISTORY] =
+            signalTime - item.mTimestamp;
+}
+#endif
+
 bool Layer::addSyncPoint(const std::shared_ptr<SyncPoint>& point) {
     if (point->getFrameNumber() <= mCurrentFrameNumber) {
         // Don't bother with a SyncPoint, since we've already latched the
@@ -1469,6 +1571,14 @@ void Layer::setVisibleNonTransparentRegion(const Region&
     this->visibleNonTransparentRegion = setVisibleNonTransparentRegion;
 }
 
+bool Layer::isVisibleRegionDirty() const {
+    if (visibleRegionDirty) {
+        return true;
+    }
+    const auto& p = mDrawingParent.promote();
+    return p != nullptr && p->isVisibleRegionDirty();
+}
+
 // ----------------------------------------------------------------------------
 // transaction
 // ----------------------------------------------------------------------------
@@ -1580,6 +1690,19 @@ void Layer::notifyAvailableFrames() {
     }
 }
 
+static bool relativesEqual(const SortedVector<wp<Layer>>& a,
+        const SortedVector<wp<Layer>>& b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i] != b[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
 uint32_t Layer::doTransaction(uint32_t flags) {
     ATRACE_CALL();
 
@@ -1683,6 +1806,12 @@ uint32_t Layer::doTransaction(uint32_t flags) {
         flags |= Layer::eVisibleRegion;
     }
 
+    if (c.z != s.z || c.layerStack != s.layerStack ||
+            c.zOrderRelativeOf != s.zOrderRelativeOf ||
+            !relativesEqual(c.zOrderRelatives, s.zOrderRelatives)) {
+        flags |= eLayerTreeChanged;
+    }
+
     if (c.sequence != s.sequence) {
         // invalidate and recompute the visible regions if needed
         flags |= eVisibleRegion;
@@ -1710,6 +1839,91 @@ void Layer::commitTransaction(const State& stateToCommit) {
     mDrawingState = stateToCommit;
 }
 
+uint32_t Layer::acquirePublishedState() {
+    uint32_t sequence = mPublishedSequence.load(std::memory_order_relaxed);
+    for (;;) {
+        // The owner only holds the slot for a handful of stores
+        if (!(sequence & 1) && mPublishedSequence.compare_exchange_weak(sequence,
+                sequence + 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+            return sequence + 1;
+        }
+        sequence = mPublishedSequence.load(std::memory_order_relaxed);
+    }
+}
+
+bool Layer::publishState(const layer_state_t& s) {
+    const uint32_t sequence = acquirePublishedState();
+    const bool wasEmpty = mPublishedState.what == 0;
+    if (s.what & layer_state_t::ePositionChanged) {
+        mPublishedState.x = s.x;
+        mPublishedState.y = s.y;
+    }
+    if (s.what & layer_state_t::eAlphaChanged) {
+        mPublishedState.alpha = s.alpha;
+    }
+    if (s.what & layer_state_t::eMatrixChanged) {
+        mPublishedState.matrix = s.matrix;
+    }
+    mPublishedState.what |= s.what & (layer_state_t::ePositionChanged |
+            layer_state_t::eAlphaChanged | layer_state_t::eMatrixChanged);
+    mPublishedSequence.store(sequence + 1, std::memory_order_release);
+    return wasEmpty;
+}
+
+bool Layer::takePublishedState(layer_state_t* outState) {
+    if (mPublishedSequence.load(std::memory_order_acquire) == mTakenSequence) {
+        return false;
+    }
+    const uint32_t sequence = acquirePublishedState();
+    outState->what = mPublishedState.what;
+    outState->x = mPublishedState.x;
+    outState->y = mPublishedState.y;
+    outState->alpha = mPublishedState.alpha;
+    outState->matrix = mPublishedState.matrix;
+    mPublishedState.what = 0;
+    mPublishedSequence.store(sequence + 1, std::memory_order_release);
+    mTakenSequence = sequence + 1;
+    return outState->what != 0;
+}
+
+int Layer::getPropertyBlockFd() {
+    if (mPropertyBlock == nullptr) {
+        std::unique_ptr<LayerPropertyReader> block(new LayerPropertyReader());
+        if (block->initCheck() != NO_ERROR) {
+            ALOGE("[%s] Failed to create the property block", mName.string());
+            return -1;
+        }
+        mPropertyBlock = std::move(block);
+        mFlinger->mNumLayerPropertyBlocks++;
+    }
+    return mPropertyBlock->getFd();
+}
+
+bool Layer::readPropertyBlock(layer_state_t* outState) {
+    LayerProperties properties;
+    if (mPropertyBlock == nullptr || !mPropertyBlock->read(&properties)) {
+        return false;
+    }
+    outState->what = 0;
+    if (properties.what & LayerProperties::ePositionChanged) {
+        outState->what |= layer_state_t::ePositionChanged;
+        outState->x = properties.x;
+        outState->y = properties.y;
+    }
+    if (properties.what & LayerProperties::eAlphaChanged) {
+        outState->what |= layer_state_t::eAlphaChanged;
+        outState->alpha = properties.alpha;
+    }
+    if (properties.what & LayerProperties::eMatrixChanged) {
+        outState->what |= layer_state_t::eMatrixChanged;
+        outState->matrix.dsdx = properties.dsdx;
+        outState->matrix.dtdx = properties.dtdx;
+        outState->matrix.dtdy = properties.dtdy;
+        outState->matrix.dsdy = properties.dsdy;
+    }
+    return true;
+}
+
 uint32_t Layer::getTransactionFlags(uint32_t flags) {
     return android_atomic_and(~flags, &mTransactionFlags) & flags;
 }
@@ -1976,11 +2190,10 @@ bool Layer::shouldPresentNow(const DispSync& dispSync) const {
         return true;
     }
 
-    Mutex::Autolock lock(mQueueItemLock);
     if (mQueueItems.empty()) {
         return false;
     }
-    auto timestamp = mQueueItems[0].mTimestamp;
+    auto timestamp = mQueueItems.front().mTimestamp;
     nsecs_t expectedPresent =
             mSurfaceFlingerConsumer->computeExpectedPresent(dispSync);
 
@@ -2003,11 +2216,23 @@ bool Layer::onPreComposition(nsecs_t refreshStartTime) {
     return mQueuedFrames > 0 || mSidebandStreamChanged || mAutoRefresh;
 }
 
+void Layer::addFenceTimelines(FenceTimeline::Batch* batch) {
+    batch->add(&mAcquireTimeline);
+    batch->add(&mReleaseTimeline);
+}
+
 bool Layer::onPostComposition(const std::shared_ptr<FenceTime>& glDoneFence,
         const std::shared_ptr<FenceTime>& presentFence,
         const CompositorTiming& compositorTiming) {
-    mAcquireTimeline.updateSignalTimes();
-    mReleaseTimeline.updateSignalTimes();
+    // mAcquireTimeline and mReleaseTimeline were just updated by
+    // SurfaceFlinger, see addFenceTimelines()
+
+    // Publish the fences that signaled since the last composition to the
+    // producer's frame event block, if it has one.
+    {
+        Mutex::Autolock lock(mFrameEventHistoryMutex);
+        mFrameEventHistory.updateFrameEventBlock();
+    }
 
     // mFrameLatencyNeeded is true when a new frame was latched for the
     // composition.
@@ -2015,11 +2240,22 @@ bool Layer::onPostComposition(const std::shared_ptr<FenceTime>& glDoneFence,
         return false;
 
     // Update mFrameEventHistory.
+    nsecs_t postedTime = -1;
+    nsecs_t latchTime = -1;
+    nsecs_t refreshStartTime = -1;
     {
         Mutex::Autolock lock(mFrameEventHistoryMutex);
         mFrameEventHistory.addPostComposition(mCurrentFrameNumber,
                 glDoneFence, presentFence, compositorTiming);
+        const FrameEvents* frame = mFrameEventHistory.getFrame(mCurrentFrameNumber);
+        if (frame != nullptr) {
+            postedTime = frame->postedTime;
+            latchTime = frame->latchTime;
+            refreshStartTime = frame->firstRefreshStartTime;
+        }
     }
+    mFlinger->mFrameTimeline.addFrame(sequence, mCurrentFrameNumber,
+            postedTime, latchTime, refreshStartTime, presentFence);
 
     // Update mFrameTracker.
     nsecs_t desiredPresentTime = mSurfaceFlingerConsumer->getTimestamp();
@@ -2060,6 +2296,8 @@ void Layer::releasePendingBuffer(nsecs_t dequeueReadyTime) {
     auto releaseFenceTime = std::make_shared<FenceTime>(
             mSurfaceFlingerConsumer->getPrevFinalReleaseFence());
     mReleaseTimeline.push(releaseFenceTime);
+    mFlinger->mFrameTimeline.addRelease(sequence, mPreviousFrameNumber,
+            releaseFenceTime);
 
     Mutex::Autolock lock(mFrameEventHistoryMutex);
     if (mPreviousFrameNumber != 0) {
@@ -2151,6 +2389,9 @@ Region Layer::latchBuffer(bool& recomputeVisibleRegions, nsecs_t latchTime)
         mFlinger->signalLayerUpdate();
         return outDirtyRegion;
     }
+#ifdef USE_HWC2
+    recordRenderDuration();
+#endif
 
     // Capture the old state of the layer for comparisons later
     const State& s(getDrawingState());
@@ -2182,8 +2423,7 @@ Region Layer::latchBuffer(bool& recomputeVisibleRegions, nsecs_t latchTime)
         // If the buffer has been rejected, remove it from the shadow queue
         // and return early
         if (queuedBuffer) {
-            Mutex::Autolock lock(mQueueItemLock);
-            mQueueItems.removeAt(0);
+            mQueueItems.pop();
             android_atomic_dec(&mQueuedFrames);
         }
         return outDirtyRegion;
@@ -2193,8 +2433,9 @@ Region Layer::latchBuffer(bool& recomputeVisibleRegions, nsecs_t latchTime)
         // been released, so we need to clean up the queue and bug out
         // early.
         if (queuedBuffer) {
-            Mutex::Autolock lock(mQueueItemLock);
-            mQueueItems.clear();
+            while (!mQueueItems.empty()) {
+                mQueueItems.pop();
+            }
             android_atomic_and(0, &mQueuedFrames);
         }
 
@@ -2208,19 +2449,16 @@ Region Layer::latchBuffer(bool& recomputeVisibleRegions, nsecs_t latchTime)
     }
 
     if (queuedBuffer) {
-        // Autolock scope
         auto currentFrameNumber = mSurfaceFlingerConsumer->getFrameNumber();
 
-        Mutex::Autolock lock(mQueueItemLock);
-
         // Remove any stale buffers that have been dropped during
         // updateTexImage
-        while (mQueueItems[0].mFrameNumber != currentFrameNumber) {
-            mQueueItems.removeAt(0);
+        while (mQueueItems.front().mFrameNumber != currentFrameNumber) {
+            mQueueItems.pop();
             android_atomic_dec(&mQueuedFrames);
         }
 
-        mQueueItems.removeAt(0);
+        mQueueItems.pop();
     }
 
 
@@ -2250,6 +2488,8 @@ Region Layer::latchBuffer(bool& recomputeVisibleRegions, nsecs_t latchTime)
         auto releaseFenceTime = std::make_shared<FenceTime>(
                 mSurfaceFlingerConsumer->getPrevFinalReleaseFence());
         mReleaseTimeline.push(releaseFenceTime);
+        mFlinger->mFrameTimeline.addRelease(sequence, mPreviousFrameNumber,
+                releaseFenceTime);
         if (mPreviousFrameNumber != 0) {
             mFrameEventHistory.addRelease(mPreviousFrameNumber,
                     latchTime, std::move(releaseFenceTime));
@@ -2416,6 +2656,35 @@ void Layer::dump(String8& result, Colorizer& colorizer) const
     }
 }
 
+void Layer::getDumpSnapshot(DumpSnapshot::LayerState* outState) const {
+    const Layer::State& s(getDrawingState());
+
+    outState->name = getName();
+    outState->typeId = getTypeId();
+    outState->layerStack = getLayerStack();
+    outState->z = s.z;
+    outState->x = s.active.transform.tx();
+    outState->y = s.active.transform.ty();
+    outState->width = s.active.w;
+    outState->height = s.active.h;
+#ifdef USE_HWC2
+    outState->alpha = s.alpha;
+#else
+    outState->alpha = s.alpha / 255.0f;
+#endif
+    outState->flags = s.flags;
+    outState->isOpaque = isOpaque(s);
+    outState->visibleBounds = visibleRegion.getBounds();
+
+    if (mActiveBuffer != 0) {
+        outState->bufferWidth = mActiveBuffer->getWidth();
+        outState->bufferHeight = mActiveBuffer->getHeight();
+        outState->bufferStride = mActiveBuffer->getStride();
+        outState->bufferFormat = mActiveBuffer->format;
+    }
+    outState->queuedFrames = mQueuedFrames;
+}
+
 #ifdef USE_HWC2
 void Layer::miniDumpHeader(String8& result) {
     result.append("----------------------------------------");
@@ -2430,7 +2699,8 @@ void Layer::miniDumpHeader(String8& result) {
 }
 
 void Layer::miniDump(String8& result, int32_t hwcId) const {
-    if (mHwcLayers.count(hwcId) == 0) {
+    const HWCInfo* hwcInfoPtr = mHwcLayers.find(hwcId);
+    if (hwcInfoPtr == nullptr) {
         return;
     }
 
@@ -2448,7 +2718,7 @@ void Layer::miniDump(String8& result, int32_t hwcId) const {
     result.appendFormat(" %s\n", name.string());
 
     const Layer::State& layerState(getDrawingState());
-    const HWCInfo& hwcInfo = mHwcLayers.at(hwcId);
+    const HWCInfo& hwcInfo = *hwcInfoPtr;
     result.appendFormat("  %10u | ", layerState.z);
     result.appendFormat("%10s | ",
             to_string(getCompositionType(hwcId)).c_str());
@@ -2458,6 +2728,8 @@ void Layer::miniDump(String8& result, int32_t hwcId) const {
     const FloatRect& crop = hwcInfo.sourceCrop;
     result.appendFormat("%6.1f %6.1f %6.1f %6.1f\n", crop.left, crop.top,
             crop.right, crop.bottom);
+    result.append("  ");
+    hwcInfo.bufferCache.dump(result);
 
     result.append("- - - - - - - - - - - - - - - - - - - - ");
     result.append("- - - - - - - - - - - - - - - - - - - -\n");
@@ -2506,6 +2778,16 @@ void Layer::addAndGetFrameTimestamps(const NewFrameEventsEntry* newTimestamps,
     }
 }
 
+status_t Layer::getFrameEventBlock(int* outFd) {
+    Mutex::Autolock lock(mFrameEventHistoryMutex);
+    int fd = mFrameEventHistory.getFrameEventBlockFd();
+    if (fd < 0) {
+        return NO_INIT;
+    }
+    *outFd = dup(fd);
+    return *outFd >= 0 ? NO_ERROR : -errno;
+}
+
 std::vector<OccupancyTracker::Segment> Layer::getOccupancyHistory(
         bool forceFlush) {
     std::vector<OccupancyTracker::Segment> history;
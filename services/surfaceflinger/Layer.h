@@ -33,21 +33,27 @@
 #include <ui/Region.h>
 
 #include <gui/ISurfaceComposerClient.h>
+#include <gui/LayerPropertyBlock.h>
 
 #include <private/gui/LayerState.h>
 
+#include <atomic>
 #include <list>
+#include <memory>
 
 #include "FrameTracker.h"
 #include "Client.h"
+#include "DumpSnapshot.h"
 #include "LayerVector.h"
 #include "MonitoredProducer.h"
+#include "QueuedBufferRing.h"
 #include "SurfaceFlinger.h"
 #include "SurfaceFlingerConsumer.h"
 #include "Transform.h"
 
 #include "DisplayHardware/HWComposer.h"
 #include "DisplayHardware/HWComposerBufferCache.h"
+#include "DisplayHardware/PerDisplayStorage.h"
 #include "RenderEngine/Mesh.h"
 #include "RenderEngine/Texture.h"
 
@@ -81,6 +87,24 @@ public:
     Region visibleNonTransparentRegion;
     Region surfaceDamageRegion;
 
+    // Set whenever a transaction or a latched buffer may have changed this
+    // layer's footprint, opacity or visibility. Cleared by
+    // SurfaceFlinger::rebuildLayerStacks once visible regions are recomputed.
+    bool visibleRegionDirty;
+
+    // State of the visible region accumulators of SurfaceFlinger's
+    // computeVisibleRegions right after this layer was processed. Used in
+    // incremental mode to skip layers whose inputs did not change.
+    struct VisibleRegionSnapshot {
+        bool valid = false;
+        uint32_t layerStack = 0;
+        // sequence of the layer processed right before this one, or -1
+        int32_t aboveSequence = -1;
+        Region aboveOpaqueLayers;
+        Region aboveCoveredLayers;
+    };
+    VisibleRegionSnapshot visibleRegionSnapshot;
+
     // Layer serial number.  This gives layers an explicit ordering, so we
     // have a stable sort order when their layer stack and Z-order are
     // the same.
@@ -89,6 +113,8 @@ public:
     enum { // flags for doTransaction()
         eDontUpdateGeometryState = 0x00000001,
         eVisibleRegion = 0x00000002,
+        // z-order, relatives or layer stack changed
+        eLayerTreeChanged = 0x00000004,
     };
 
     struct Geometry {
@@ -239,6 +265,26 @@ public:
     bool reparentChildren(const sp<IBinder>& layer);
     bool detachChildren();
 
+    // Publishes the position, alpha and matrix changes of s without
+    // touching mCurrentState, so may be called without mStateLock. Later
+    // changes replace earlier ones until the main thread takes them with
+    // takePublishedState(). Returns true if nothing was pending before.
+    bool publishState(const layer_state_t& s);
+    // Moves the published changes into outState (only the what, x, y,
+    // alpha and matrix fields are set). This only costs an atomic load
+    // when nothing was published since the last call. Main thread only.
+    bool takePublishedState(layer_state_t* outState);
+
+    // Returns the fd of the layer's property block, creating it on first
+    // use, or -1 on failure. The layer keeps ownership of the fd.
+    // mStateLock must be held.
+    int getPropertyBlockFd();
+    // Reads the properties the client streamed through the property block
+    // into outState, like takePublishedState(). Returns false if the block
+    // didn't change, in which case the client must signal us before writing
+    // again. mStateLock must be held.
+    bool readPropertyBlock(layer_state_t* outState);
+
     // If we have received a new buffer this frame, we will pass its surface
     // damage down to hardware composer. Otherwise, we must send a region with
     // one empty rect.
@@ -325,6 +371,11 @@ public:
     void setClearClientTarget(int32_t hwcId, bool clear);
     bool getClearClientTarget(int32_t hwcId) const;
 
+    // Hash of the state sent to the HWC by setGeometry and setPerFrameData
+    // that can affect its composition strategy. Buffer contents are not
+    // part of it.
+    uint64_t getHwcCompositionKey(int32_t hwcId) const;
+
     void updateCursorPosition(const sp<const DisplayDevice>& hw);
 #else
     void setGeometry(const sp<const DisplayDevice>& hw,
@@ -349,12 +400,26 @@ public:
 
     bool shouldPresentNow(const DispSync& dispSync) const;
 
+#ifdef USE_HWC2
+    // Returns when the acquire fence of the head buffer is expected to
+    // signal, judging by how long the last buffers took between being
+    // queued and their fence signaling. Returns -1 if there is no pending
+    // fence or nothing to base a prediction on.
+    nsecs_t getExpectedLatchTime() const;
+#endif
+
     /*
      * called before composition.
      * returns true if the layer has pending updates.
      */
     bool onPreComposition(nsecs_t refreshStartTime);
 
+    /*
+     * called after composition, before onPostComposition: adds the fence
+     * timelines of this layer to the ones SurfaceFlinger updates.
+     */
+    void addFenceTimelines(FenceTimeline::Batch* batch);
+
     /*
      * called after composition.
      * returns true if the layer latched a new buffer this frame.
@@ -402,6 +467,12 @@ public:
     void setVisibleNonTransparentRegion(const Region&
             visibleNonTransparentRegion);
 
+    /*
+     * isVisibleRegionDirty - true if this layer or any of its parents in the
+     * drawing state was flagged with visibleRegionDirty.
+     */
+    bool isVisibleRegionDirty() const;
+
     /*
      * latchBuffer - called each time the screen is redrawn and returns whether
      * the visible regions need to be recomputed (this is a fairly heavy
@@ -435,14 +506,22 @@ public:
     bool hasQueuedFrame() const { return mQueuedFrames > 0 ||
             mSidebandStreamChanged || mAutoRefresh; }
 
+    /*
+     * Returns when a buffer was last queued to this layer, 0 if never.
+     */
+    nsecs_t getLastQueueTime() const { return mLastQueueTime; }
+
+    bool hasSidebandStream() const { return mSidebandStream != nullptr; }
+
 #ifdef USE_HWC2
     // -----------------------------------------------------------------------
 
     bool hasHwcLayer(int32_t hwcId) {
-        if (mHwcLayers.count(hwcId) == 0) {
+        HWCInfo* hwcInfo = mHwcLayers.find(hwcId);
+        if (hwcInfo == nullptr) {
             return false;
         }
-        if (mHwcLayers[hwcId].layer->isAbandoned()) {
+        if (hwcInfo->layer->isAbandoned()) {
             ALOGI("Erasing abandoned layer %s on %d", mName.string(), hwcId);
             mHwcLayers.erase(hwcId);
             return false;
@@ -451,15 +530,21 @@ public:
     }
 
     std::shared_ptr<HWC2::Layer> getHwcLayer(int32_t hwcId) {
-        if (mHwcLayers.count(hwcId) == 0) {
+        HWCInfo* hwcInfo = mHwcLayers.find(hwcId);
+        if (hwcInfo == nullptr) {
             return nullptr;
         }
-        return mHwcLayers[hwcId].layer;
+        return hwcInfo->layer;
     }
 
     void setHwcLayer(int32_t hwcId, std::shared_ptr<HWC2::Layer>&& layer) {
         if (layer) {
-            mHwcLayers[hwcId].layer = layer;
+            auto& hwcInfo = mHwcLayers[hwcId];
+            if (hwcInfo.layer != layer) {
+                // The new HWC layer starts with an empty cache
+                hwcInfo.bufferCache.clear();
+            }
+            hwcInfo.layer = layer;
         } else {
             mHwcLayers.erase(hwcId);
         }
@@ -486,6 +571,8 @@ public:
 
     /* always call base class first */
     void dump(String8& result, Colorizer& colorizer) const;
+    // main thread only
+    void getDumpSnapshot(DumpSnapshot::LayerState* outState) const;
 #ifdef USE_HWC2
     static void miniDumpHeader(String8& result);
     void miniDump(String8& result, int32_t hwcId) const;
@@ -501,6 +588,7 @@ public:
     void onDisconnect();
     void addAndGetFrameTimestamps(const NewFrameEventsEntry* newEntry,
             FrameEventHistoryDelta* outDelta);
+    status_t getFrameEventBlock(int* outFd);
 
     bool getTransformToDisplayInverse() const;
 
@@ -569,6 +657,8 @@ private:
     virtual void onFrameReplaced(const BufferItem& item) override;
     virtual void onSidebandStreamChanged() override;
 
+    void pushQueueItem(const BufferItem& item, bool replacesPrevious);
+
     void commitTransaction(const State& stateToCommit);
 
     // needsLinearFiltering - true if this surface's state requires filtering
@@ -709,6 +799,26 @@ private:
     Mutex mPendingStateMutex;
     Vector<State> mPendingStates;
 
+    // Position, alpha and matrix changes published by binder threads
+    // without mStateLock, see publishState(). mPublishedSequence is odd
+    // while a thread owns mPublishedState, and is bumped by two every time
+    // the slot changes hands.
+    struct PublishedState {
+        uint32_t what;
+        float x;
+        float y;
+        float alpha;
+        layer_state_t::matrix22_t matrix;
+    };
+    uint32_t acquirePublishedState();
+    std::atomic<uint32_t> mPublishedSequence;
+    PublishedState mPublishedState;
+    // main thread only, sequence of the last takePublishedState()
+    uint32_t mTakenSequence;
+
+    // Protected by mFlinger->mStateLock, see getPropertyBlockFd()
+    std::unique_ptr<LayerPropertyReader> mPropertyBlock;
+
     // thread-safe
     volatile int32_t mQueuedFrames;
     volatile int32_t mSidebandStreamChanged; // used like an atomic boolean
@@ -754,7 +864,12 @@ private:
           : layer(),
             forceClientComposition(false),
             compositionType(HWC2::Composition::Invalid),
-            clearClientTarget(false) {}
+            clearClientTarget(false),
+            blendMode(HWC2::BlendMode::Invalid),
+            transform(HWC2::Transform::None),
+            dataspace(HAL_DATASPACE_UNKNOWN),
+            z(0),
+            alpha(1.0f) {}
 
         std::shared_ptr<HWC2::Layer> layer;
         bool forceClientComposition;
@@ -762,14 +877,20 @@ private:
         bool clearClientTarget;
         Rect displayFrame;
         FloatRect sourceCrop;
+        HWC2::BlendMode blendMode;
+        HWC2::Transform transform;
+        android_dataspace dataspace;
+        uint32_t z;
+        float alpha;
         HWComposerBufferCache bufferCache;
     };
 
     // A layer can be attached to multiple displays when operating in mirror mode
     // (a.k.a: when several displays are attached with equal layerStack). In this
     // case we need to keep track. In non-mirror mode, a layer will have only one
-    // HWCInfo. This map key is a display layerStack.
-    std::unordered_map<int32_t, HWCInfo> mHwcLayers;
+    // HWCInfo. Keyed by HWC display id, and looked up for every layer on every
+    // display on every frame, hence the inline storage.
+    PerDisplayStorage<HWCInfo> mHwcLayers;
 #else
     bool mIsGlesComposition;
 #endif
@@ -786,16 +907,25 @@ private:
     // This layer can be a cursor on some displays.
     bool mPotentialCursor;
 
-    // Local copy of the queued contents of the incoming BufferQueue
-    mutable Mutex mQueueItemLock;
-    Condition mQueueItemCondition;
-    Vector<BufferItem> mQueueItems;
+    // Local copy of the queued contents of the incoming BufferQueue, filled
+    // by the frame callbacks and drained by the main thread
+    QueuedBufferRing mQueueItems;
     std::atomic<uint64_t> mLastFrameNumberReceived;
+    std::atomic<nsecs_t> mLastQueueTime;
     bool mUpdateTexImageFailed; // This is only accessed on the main thread.
 
     bool mAutoRefresh;
     bool mFreezeGeometryUpdates;
 
+#ifdef USE_HWC2
+    // Time between queueBuffer and the acquire fence signaling for the last
+    // few latched buffers, main thread only
+    static constexpr size_t RENDER_DURATION_HISTORY = 8;
+    void recordRenderDuration();
+    nsecs_t mRenderDurations[RENDER_DURATION_HISTORY];
+    size_t mRenderDurationCount;
+#endif
+
     // Child list about to be committed/used for editing.
     LayerVector mCurrentChildren;
     // Child list used for rendering.
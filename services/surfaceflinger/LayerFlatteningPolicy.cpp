@@ -0,0 +1,78 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "LayerFlatteningPolicy"
+
+#include <inttypes.h>
+
+#include <utils/Log.h>
+#include <utils/String8.h>
+
+#include "Layer.h"
+#include "LayerFlatteningPolicy.h"
+
+namespace android {
+
+LayerFlatteningPolicy::LayerFlatteningPolicy()
+  : mNumFlattened(0),
+    mNumChanges(0) {
+}
+
+bool LayerFlatteningPolicy::isStable(const sp<Layer>& layer, nsecs_t now) {
+    // Protected and sideband content can't go through the GPU
+    if (layer->isProtected() || layer->hasSidebandStream()) {
+        return false;
+    }
+    return !layer->hasQueuedFrame() &&
+            now - layer->getLastQueueTime() >= kStableDelay;
+}
+
+bool LayerFlatteningPolicy::update(int32_t hwcId, const Vector<sp<Layer>>& layers,
+        nsecs_t now) {
+    size_t numFlattened = 0;
+    if (layers.size() >= kMinLayers) {
+        while (numFlattened < layers.size() && isStable(layers[numFlattened], now)) {
+            numFlattened++;
+        }
+        // Only worth it if it frees planes for layers that do update
+        if (numFlattened < kMinFlattenedLayers || numFlattened == layers.size()) {
+            numFlattened = 0;
+        }
+    }
+
+    if (numFlattened == mNumFlattened.valueFor(hwcId)) {
+        return false;
+    }
+    ALOGV("display %d: flattening %zu of %zu layers", hwcId, numFlattened,
+            layers.size());
+    mNumFlattened.replaceValueFor(hwcId, numFlattened);
+    mNumChanges++;
+    return true;
+}
+
+size_t LayerFlatteningPolicy::getNumFlattened(int32_t hwcId) const {
+    return mNumFlattened.valueFor(hwcId);
+}
+
+void LayerFlatteningPolicy::dump(String8& result) const {
+    result.appendFormat("  %" PRIu64 " changes\n", mNumChanges);
+    for (size_t i = 0; i < mNumFlattened.size(); i++) {
+        result.appendFormat("  display %d: %zu layers flattened\n",
+                mNumFlattened.keyAt(i), mNumFlattened.valueAt(i));
+    }
+}
+
+}; // namespace android
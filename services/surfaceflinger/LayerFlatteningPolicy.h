@@ -0,0 +1,69 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_LAYERFLATTENINGPOLICY_H
+#define ANDROID_LAYERFLATTENINGPOLICY_H
+
+#include <utils/KeyedVector.h>
+#include <utils/StrongPointer.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+
+#include <stdint.h>
+
+namespace android {
+
+class Layer;
+class String8;
+
+// LayerFlatteningPolicy picks the stable layers at the bottom of a display
+// that should be composited by the client, so that HWC has its overlay
+// planes free for the layers that update every frame. Combined with partial
+// client composition, the flattened layers are then only redrawn where they
+// are damaged and the client target effectively caches them.
+//
+// Main thread only.
+class LayerFlatteningPolicy {
+public:
+    // A layer that didn't queue a buffer for that long is stable
+    static constexpr nsecs_t kStableDelay = ms2ns(500);
+    // HWC is assumed to have a plane for each layer below that count
+    static constexpr size_t kMinLayers = 4;
+    // Flattening a single layer doesn't free any plane
+    static constexpr size_t kMinFlattenedLayers = 2;
+
+    LayerFlatteningPolicy();
+
+    // Recomputes how many of the bottom-most layers of the display should
+    // be flattened. Returns true if that changed since the last call.
+    bool update(int32_t hwcId, const Vector<sp<Layer>>& layers, nsecs_t now);
+
+    // Number of bottom-most layers of the display to flatten, as of the
+    // last update()
+    size_t getNumFlattened(int32_t hwcId) const;
+
+    void dump(String8& result) const;
+
+private:
+    static bool isStable(const sp<Layer>& layer, nsecs_t now);
+
+    DefaultKeyedVector<int32_t, size_t> mNumFlattened;
+    uint64_t mNumChanges;
+};
+
+}; // namespace android
+
+#endif // ANDROID_LAYERFLATTENINGPOLICY_H
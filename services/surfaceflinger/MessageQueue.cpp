@@ -24,6 +24,8 @@
 #include <utils/Timers.h>
 #include <utils/Log.h>
 
+#include <algorithm>
+
 #include <gui/IDisplayEventConnection.h>
 
 #include "MessageQueue.h"
@@ -70,12 +72,16 @@ void MessageQueue::Handler::handleMessage(const Message& message) {
             android_atomic_and(~eventMaskRefresh, &mEventMask);
             mQueue.mFlinger->onMessageReceived(message.what);
             break;
+        case FLUSH_DEFERRED:
+            mQueue.flushDeferredMessages();
+            break;
     }
 }
 
 // ---------------------------------------------------------------------------
 
 MessageQueue::MessageQueue()
+    : mDeferredFlushTime(0)
 {
 }
 
@@ -121,8 +127,21 @@ void MessageQueue::waitMessage() {
 }
 
 status_t MessageQueue::postMessage(
-        const sp<MessageBase>& messageHandler, nsecs_t relTime)
+        const sp<MessageBase>& messageHandler, nsecs_t relTime, uint32_t flags)
 {
+    if (flags & DEFERRABLE) {
+        const nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+        DeferredMessage deferred;
+        deferred.message = messageHandler;
+        deferred.readyTime = now + (relTime > 0 ? relTime : 0);
+        deferred.deadline = deferred.readyTime + MAX_DEFERRAL;
+
+        Mutex::Autolock _l(mDeferredLock);
+        mDeferred.push_back(deferred);
+        scheduleDeferredFlushLocked(deferred.deadline);
+        return NO_ERROR;
+    }
+
     const Message dummyMessage;
     if (relTime > 0) {
         mLooper->sendMessageDelayed(relTime, messageHandler, dummyMessage);
@@ -133,6 +152,64 @@ status_t MessageQueue::postMessage(
 }
 
 
+void MessageQueue::scheduleDeferredFlushLocked(nsecs_t deadline) {
+    if (mDeferredFlushTime != 0 && mDeferredFlushTime <= deadline) {
+        return;
+    }
+    if (mDeferredFlushTime != 0) {
+        mLooper->removeMessages(mHandler, FLUSH_DEFERRED);
+    }
+    mDeferredFlushTime = deadline;
+    mLooper->sendMessageAtTime(deadline, mHandler, Message(FLUSH_DEFERRED));
+}
+
+sp<MessageBase> MessageQueue::takeDeferredMessage(nsecs_t now, bool idle) {
+    Mutex::Autolock _l(mDeferredLock);
+    for (size_t i = 0; i < mDeferred.size(); i++) {
+        const DeferredMessage& deferred(mDeferred[i]);
+        if (deferred.deadline <= now || (idle && deferred.readyTime <= now)) {
+            sp<MessageBase> message = deferred.message;
+            mDeferred.removeAt(i);
+            return message;
+        }
+    }
+    return nullptr;
+}
+
+void MessageQueue::flushDeferredMessages() {
+    const nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    {
+        Mutex::Autolock _l(mDeferredLock);
+        mDeferredFlushTime = 0;
+    }
+
+    // Only what reached its deadline, the rest waits for idle time
+    sp<MessageBase> message;
+    while ((message = takeDeferredMessage(now, false)) != nullptr) {
+        static_cast<MessageHandler*>(message.get())->handleMessage(Message());
+    }
+
+    Mutex::Autolock _l(mDeferredLock);
+    nsecs_t nextDeadline = INT64_MAX;
+    for (const DeferredMessage& deferred : mDeferred) {
+        nextDeadline = std::min(nextDeadline, deferred.deadline);
+    }
+    if (nextDeadline != INT64_MAX) {
+        scheduleDeferredFlushLocked(nextDeadline);
+    }
+}
+
+void MessageQueue::runDeferredMessages(nsecs_t idleEnd) {
+    sp<MessageBase> message;
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    while (now < idleEnd && (message = takeDeferredMessage(now, true)) != nullptr) {
+        static_cast<MessageHandler*>(message.get())->handleMessage(Message());
+        now = systemTime(SYSTEM_TIME_MONOTONIC);
+    }
+    // Whatever is left runs after the next frame, or from the looper when
+    // its deadline expires
+}
+
 void MessageQueue::invalidate() {
     mEvents->requestNextVsync();
 }
@@ -25,6 +25,8 @@
 #include <utils/Timers.h>
 #include <utils/Looper.h>
 
+#include <utils/Vector.h>
+
 #include <private/gui/BitTube.h>
 #include <gui/DisplayEventReceiver.h>
 
@@ -49,6 +51,10 @@ public:
     // waits for the handler to be processed
     void wait() const { barrier.wait(); }
 
+    // same as wait(), but gives up after timeout. Returns true if the handler
+    // was processed
+    bool waitFor(nsecs_t timeout) const { return barrier.waitFor(timeout); }
+
 protected:
     virtual ~MessageBase();
 
@@ -78,6 +84,14 @@ class MessageQueue {
 
     friend class Handler;
 
+    struct DeferredMessage {
+        sp<MessageBase> message;
+        // not run before readyTime, and not later than deadline even if
+        // the main thread is never idle
+        nsecs_t readyTime;
+        nsecs_t deadline;
+    };
+
     sp<SurfaceFlinger> mFlinger;
     sp<Looper> mLooper;
     sp<EventThread> mEventThread;
@@ -86,22 +100,54 @@ class MessageQueue {
     sp<Handler> mHandler;
 
 
+    // protected by mDeferredLock, posted from any thread
+    Mutex mDeferredLock;
+    Vector<DeferredMessage> mDeferred;
+    // when the looper is due to run the expired deferred messages, 0 if
+    // it isn't
+    nsecs_t mDeferredFlushTime;
+
     static int cb_eventReceiver(int fd, int events, void* data);
     int eventReceiver(int fd, int events);
 
+    void scheduleDeferredFlushLocked(nsecs_t deadline);
+    void flushDeferredMessages();
+    // removes the first deferred message that must run now, i.e. is past its
+    // deadline, or is ready while the main thread is idle
+    sp<MessageBase> takeDeferredMessage(nsecs_t now, bool idle);
+
 public:
     enum {
         INVALIDATE  = 0,
         REFRESH     = 1,
+        // internal, runs the deferred messages that reached their deadline
+        FLUSH_DEFERRED = 2,
     };
 
+    // postMessage() flags
+    enum {
+        // The message is maintenance work that can wait for the main thread
+        // to be idle, it mustn't delay the next frame. It runs once a frame
+        // has been composed and there is time left before the next vsync,
+        // or MAX_DEFERRAL after it is due at the latest.
+        DEFERRABLE  = 0x1,
+    };
+
+    static constexpr nsecs_t MAX_DEFERRAL = 100000000; // 100ms
+
     MessageQueue();
     ~MessageQueue();
     void init(const sp<SurfaceFlinger>& flinger);
     void setEventThread(const sp<EventThread>& events);
 
     void waitMessage();
-    status_t postMessage(const sp<MessageBase>& message, nsecs_t reltime=0);
+    status_t postMessage(const sp<MessageBase>& message, nsecs_t reltime=0,
+            uint32_t flags=0);
+
+    // Runs the DEFERRABLE messages that are due, in the order they were
+    // posted, until idleEnd. Called by the main thread when it's done with
+    // a frame.
+    void runDeferredMessages(nsecs_t idleEnd);
 
     // sends INVALIDATE message at next VSYNC
     void invalidate();
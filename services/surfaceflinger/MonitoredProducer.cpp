@@ -94,6 +94,14 @@ status_t MonitoredProducer::queueBuffer(int slot, const QueueBufferInput& input,
     return mProducer->queueBuffer(slot, input, output);
 }
 
+status_t MonitoredProducer::queueAndDequeueBuffer(int slot,
+        const QueueBufferInput& input, QueueBufferOutput* output,
+        int* outSlot, sp<Fence>* outFence, status_t* outDequeueResult,
+        uint32_t w, uint32_t h, PixelFormat format, uint32_t usage) {
+    return mProducer->queueAndDequeueBuffer(slot, input, output, outSlot,
+            outFence, outDequeueResult, w, h, format, usage);
+}
+
 status_t MonitoredProducer::cancelBuffer(int slot, const sp<Fence>& fence) {
     return mProducer->cancelBuffer(slot, fence);
 }
@@ -154,6 +162,10 @@ void MonitoredProducer::getFrameTimestamps(FrameEventHistoryDelta* outDelta) {
     mProducer->getFrameTimestamps(outDelta);
 }
 
+status_t MonitoredProducer::getFrameEventBlock(int* outFd) {
+    return mProducer->getFrameEventBlock(outFd);
+}
+
 status_t MonitoredProducer::getUniqueId(uint64_t* outId) const {
     return mProducer->getUniqueId(outId);
 }
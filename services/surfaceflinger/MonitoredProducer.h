@@ -49,6 +49,10 @@ public:
             const sp<GraphicBuffer>& buffer);
     virtual status_t queueBuffer(int slot, const QueueBufferInput& input,
             QueueBufferOutput* output);
+    virtual status_t queueAndDequeueBuffer(int slot,
+            const QueueBufferInput& input, QueueBufferOutput* output,
+            int* outSlot, sp<Fence>* outFence, status_t* outDequeueResult,
+            uint32_t w, uint32_t h, PixelFormat format, uint32_t usage);
     virtual status_t cancelBuffer(int slot, const sp<Fence>& fence);
     virtual int query(int what, int* value);
     virtual status_t connect(const sp<IProducerListener>& token, int api,
@@ -67,6 +71,7 @@ public:
     virtual status_t setSharedBufferMode(bool sharedBufferMode) override;
     virtual status_t setAutoRefresh(bool autoRefresh) override;
     virtual void getFrameTimestamps(FrameEventHistoryDelta *outDelta) override;
+    virtual status_t getFrameEventBlock(int* outFd) override;
     virtual status_t getUniqueId(uint64_t* outId) const override;
 
     // The Layer which created this producer, and on which queued Buffer's will be displayed.
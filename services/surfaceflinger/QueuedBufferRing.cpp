@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "QueuedBufferRing.h"
+
+namespace android {
+
+QueuedBufferRing::QueuedBufferRing() : mHead(0), mTail(0) {
+}
+
+bool QueuedBufferRing::push(const BufferItem& item, bool replacesPrevious) {
+    const size_t tail = mTail.load(std::memory_order_relaxed);
+    if (tail - mHead.load(std::memory_order_acquire) == CAPACITY) {
+        return false;
+    }
+    Entry& entry = mEntries[index(tail)];
+    entry.item = item;
+    entry.replacesPrevious = replacesPrevious;
+    mTail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+bool QueuedBufferRing::empty() const {
+    return mHead.load(std::memory_order_acquire) == mTail.load(std::memory_order_acquire);
+}
+
+size_t QueuedBufferRing::frontPosition() const {
+    const size_t tail = mTail.load(std::memory_order_acquire);
+    size_t position = mHead.load(std::memory_order_relaxed);
+    while (position + 1 < tail && mEntries[index(position + 1)].replacesPrevious) {
+        position++;
+    }
+    return position;
+}
+
+const BufferItem& QueuedBufferRing::front() const {
+    return mEntries[index(frontPosition())].item;
+}
+
+void QueuedBufferRing::pop() {
+    const size_t last = frontPosition();
+    size_t position = mHead.load(std::memory_order_relaxed);
+    for (; position <= last; position++) {
+        // Don't keep the buffers and fences alive until the slot is reused
+        mEntries[index(position)].item = BufferItem();
+    }
+    mHead.store(position, std::memory_order_release);
+}
+
+}; // namespace android
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef ANDROID_QUEUEDBUFFERRING_H
+#define ANDROID_QUEUEDBUFFERRING_H
+
+#include <gui/BufferItem.h>
+#include <gui/BufferQueueDefs.h>
+
+#include <array>
+#include <atomic>
+
+#include <stddef.h>
+
+namespace android {
+
+// QueuedBufferRing is a Layer's copy of the items queued in its BufferQueue.
+// It is a bounded single-producer single-consumer ring: the frame callbacks,
+// which BufferQueueProducer already serializes, are the producer and the
+// main thread is the consumer. Neither side ever takes a lock.
+//
+// A replaced frame can't be overwritten in place, since the consumer may be
+// looking at it. The replacement is appended instead, marked as replacing the
+// item before it, and the consumer side skips the items that were replaced.
+class QueuedBufferRing {
+public:
+    // Every queued buffer holds a slot, replacements are the only source of
+    // extra items and they go away with the first pop()
+    enum { CAPACITY = BufferQueueDefs::NUM_BUFFER_SLOTS };
+
+    QueuedBufferRing();
+
+    // Producer side.
+    // Appends item, which then replaces the newest item if replacesPrevious
+    // is set. Returns false if the ring is full.
+    bool push(const BufferItem& item, bool replacesPrevious);
+
+    // Either side.
+    bool empty() const;
+
+    // Consumer side.
+    // The oldest item that wasn't replaced. The ring must not be empty.
+    const BufferItem& front() const;
+    // Removes front() and the items it replaced. The ring must not be empty.
+    void pop();
+
+private:
+    struct Entry {
+        BufferItem item;
+        bool replacesPrevious = false;
+    };
+
+    static size_t index(size_t position) { return position % CAPACITY; }
+
+    // position of the entry front() returns
+    size_t frontPosition() const;
+
+    std::array<Entry, CAPACITY> mEntries;
+    // Positions only ever grow. mHead is only written by the consumer and
+    // mTail by the producer.
+    std::atomic<size_t> mHead;
+    std::atomic<size_t> mTail;
+};
+
+}; // namespace android
+
+#endif // ANDROID_QUEUEDBUFFERRING_H
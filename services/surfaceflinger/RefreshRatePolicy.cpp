@@ -0,0 +1,113 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "RefreshRatePolicy"
+
+#include <inttypes.h>
+
+#include <utils/Log.h>
+#include <utils/String8.h>
+
+#include "RefreshRatePolicy.h"
+
+namespace android {
+
+RefreshRatePolicy::RefreshRatePolicy()
+  : mLayers(),
+    mLastQueueTime(0) {
+}
+
+void RefreshRatePolicy::onFrameQueued(int32_t layerId, nsecs_t queueTime) {
+    Mutex::Autolock lock(mMutex);
+    mLastQueueTime = queueTime;
+
+    ssize_t index = mLayers.indexOfKey(layerId);
+    if (index < 0) {
+        LayerHistory history;
+        history.lastQueueTime = queueTime;
+        history.numIntervals = 0;
+        mLayers.add(layerId, history);
+        return;
+    }
+
+    LayerHistory& history(mLayers.editValueAt(index));
+    const nsecs_t interval = queueTime - history.lastQueueTime;
+    history.lastQueueTime = queueTime;
+    if (interval <= 0) {
+        return;
+    }
+    if (interval > kMaxInterval) {
+        // The layer paused, start over
+        history.numIntervals = 0;
+        return;
+    }
+    history.intervals[history.numIntervals % NUM_INTERVALS] = interval;
+    history.numIntervals++;
+}
+
+nsecs_t RefreshRatePolicy::getIdleTime(nsecs_t now) const {
+    Mutex::Autolock lock(mMutex);
+    return now - mLastQueueTime;
+}
+
+nsecs_t RefreshRatePolicy::getContentPeriod(nsecs_t now) {
+    Mutex::Autolock lock(mMutex);
+    nsecs_t period = -1;
+    for (size_t i = mLayers.size(); i > 0; i--) {
+        const LayerHistory& history(mLayers.valueAt(i - 1));
+        const nsecs_t sinceLastQueue = now - history.lastQueueTime;
+        if (sinceLastQueue > kForgetDelay) {
+            mLayers.removeItemsAt(i - 1);
+            continue;
+        }
+        if (sinceLastQueue > kInactiveDelay) {
+            continue;
+        }
+        if (history.numIntervals < NUM_INTERVALS) {
+            // Not enough history to tell yet
+            return 0;
+        }
+        nsecs_t total = 0;
+        for (size_t j = 0; j < NUM_INTERVALS; j++) {
+            total += history.intervals[j];
+        }
+        const nsecs_t average = total / NUM_INTERVALS;
+        if (period < 0 || average < period) {
+            period = average;
+        }
+    }
+    return period;
+}
+
+void RefreshRatePolicy::dump(String8& result) const {
+    Mutex::Autolock lock(mMutex);
+    const nsecs_t now = systemTime();
+    result.appendFormat("  %zu layers tracked, last buffer queued %" PRId64
+            " ms ago\n", mLayers.size(), ns2ms(now - mLastQueueTime));
+    for (size_t i = 0; i < mLayers.size(); i++) {
+        const LayerHistory& history(mLayers.valueAt(i));
+        nsecs_t average = 0;
+        const size_t count = history.numIntervals < NUM_INTERVALS ?
+                history.numIntervals : size_t(NUM_INTERVALS);
+        for (size_t j = 0; j < count; j++) {
+            average += history.intervals[j] / static_cast<nsecs_t>(count);
+        }
+        result.appendFormat("    layer %d: %.1f fps over %zu frames\n",
+                mLayers.keyAt(i), average > 0 ? 1e9 / average : 0.0, count);
+    }
+}
+
+}; // namespace android
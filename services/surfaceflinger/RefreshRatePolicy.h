@@ -0,0 +1,75 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_REFRESHRATEPOLICY_H
+#define ANDROID_REFRESHRATEPOLICY_H
+
+#include <utils/KeyedVector.h>
+#include <utils/Mutex.h>
+#include <utils/Timers.h>
+
+#include <stdint.h>
+
+namespace android {
+
+class String8;
+
+// RefreshRatePolicy watches how often each layer queues buffers to tell
+// SurfaceFlinger which refresh period the content on screen needs, and
+// whether the screen has gone idle.
+class RefreshRatePolicy {
+public:
+    // Number of queue intervals a layer's frame rate is estimated from
+    enum { NUM_INTERVALS = 8 };
+
+    RefreshRatePolicy();
+
+    // Called whenever a layer queues a buffer, from any thread
+    void onFrameQueued(int32_t layerId, nsecs_t queueTime);
+
+    // Time since any layer last queued a buffer
+    nsecs_t getIdleTime(nsecs_t now) const;
+
+    // Returns the shortest frame interval among the layers that are
+    // currently updating, or 0 if one of them doesn't have a stable rate
+    // yet, in which case the highest refresh rate should be used. Returns
+    // -1 if no layer is updating.
+    nsecs_t getContentPeriod(nsecs_t now);
+
+    void dump(String8& result) const;
+
+private:
+    struct LayerHistory {
+        nsecs_t lastQueueTime;
+        nsecs_t intervals[NUM_INTERVALS];
+        size_t numIntervals;
+    };
+
+    // A layer that didn't queue a buffer for that long is not updating
+    static constexpr nsecs_t kInactiveDelay = ms2ns(200);
+    // Queue intervals longer than this are interruptions, not frame rate
+    static constexpr nsecs_t kMaxInterval = ms2ns(100);
+    // Layers that didn't queue a buffer for that long are forgotten
+    static constexpr nsecs_t kForgetDelay = s2ns(2);
+
+    mutable Mutex mMutex;
+    KeyedVector<int32_t, LayerHistory> mLayers;
+    nsecs_t mLastQueueTime;
+};
+
+}; // namespace android
+
+#endif // ANDROID_REFRESHRATEPOLICY_H
@@ -33,6 +33,8 @@ Description::Description() :
     mOpaque = true;
     mTextureEnabled = false;
     mColorMatrixEnabled = false;
+    mColorLut = 0;
+    mColorLutSize = 0;
 
     memset(mColor, 0, sizeof(mColor));
 }
@@ -92,5 +94,32 @@ const mat4& Description::getColorMatrix() const {
     return mColorMatrix;
 }
 
+void Description::setColorLut(GLuint lut, uint32_t size) {
+    mColorLut = lut;
+    mColorLutSize = GLfloat(size);
+}
+
+void Description::disableColorLut() {
+    mColorLut = 0;
+}
+
+bool Description::canBatchWith(const Description& other) const {
+    if (mTextureEnabled || other.mTextureEnabled) {
+        return false;
+    }
+    if (mColorMatrixEnabled != other.mColorMatrixEnabled ||
+            (mColorMatrixEnabled && mColorMatrix != other.mColorMatrix)) {
+        return false;
+    }
+    if (mColorLut != other.mColorLut) {
+        return false;
+    }
+    return mPlaneAlpha == other.mPlaneAlpha &&
+            mPremultipliedAlpha == other.mPremultipliedAlpha &&
+            mOpaque == other.mOpaque &&
+            memcmp(mColor, other.mColor, sizeof(mColor)) == 0 &&
+            mProjectionMatrix == other.mProjectionMatrix;
+}
+
 
 } /* namespace android */
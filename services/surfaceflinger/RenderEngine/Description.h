@@ -54,6 +54,11 @@ class Description {
     bool mColorMatrixEnabled;
     mat4 mColorMatrix;
 
+    // 3D color LUT applied before the color matrix, packed in a 2D texture
+    // (see setColorLut), 0 when disabled
+    GLuint mColorLut;
+    GLfloat mColorLutSize;
+
 public:
     Description();
     ~Description();
@@ -67,6 +72,16 @@ public:
     void setProjectionMatrix(const mat4& mtx);
     void setColorMatrix(const mat4& mtx);
     const mat4& getColorMatrix() const;
+    // lut is a GL_TEXTURE_2D of size x size*size texels holding size slices
+    // of a size^3 3D LUT, blue slices stacked from bottom to top
+    void setColorLut(GLuint lut, uint32_t size);
+    void disableColorLut();
+
+    bool isTextureEnabled() const { return mTextureEnabled; }
+
+    // true if both descriptions are untextured and would draw with the same
+    // program and uniforms, so their meshes can be drawn in one call
+    bool canBatchWith(const Description& other) const;
 
 private:
     bool mUniformsDirty;
@@ -30,10 +30,13 @@
 #include <utils/Trace.h>
 
 #include <cutils/compiler.h>
+#include <cutils/properties.h>
 #include <gui/ISurfaceComposer.h>
+#include <inttypes.h>
 #include <math.h>
 
 #include "GLES20RenderEngine.h"
+#include "GLExtensions.h"
 #include "Program.h"
 #include "ProgramCache.h"
 #include "Description.h"
@@ -43,6 +46,7 @@
 #include <android/hardware/configstore/1.0/ISurfaceFlingerConfigs.h>
 #include <configstore/Utils.h>
 
+#include <algorithm>
 #include <fstream>
 
 // ---------------------------------------------------------------------------
@@ -132,6 +136,18 @@ GLES20RenderEngine::GLES20RenderEngine() :
 
     //mColorBlindnessCorrection = M;
 
+    char value[PROPERTY_VALUE_MAX];
+    property_get("debug.sf.gpu_timing", value, "0");
+    if (atoi(value) &&
+            GLExtensions::getInstance().hasExtension("GL_EXT_disjoint_timer_query")) {
+        mFreeGpuTimerQueries.resize(MAX_GPU_TIMER_QUERIES);
+        glGenQueriesEXT(GLsizei(MAX_GPU_TIMER_QUERIES), mFreeGpuTimerQueries.data());
+        // reset the disjoint flag
+        GLint disjoint = 0;
+        glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+        mGpuTimingEnabled = true;
+    }
+
 #ifdef USE_HWC2
     // retrieve wide-color and hdr settings from configstore
     using namespace android::hardware::configstore;
@@ -151,6 +167,9 @@ GLES20RenderEngine::GLES20RenderEngine() :
         // not an assignment operator
         mat4 gamutTransform(transpose(srgbToP3));
         mSrgbToDisplayP3 = gamutTransform;
+
+        property_get("debug.sf.color_lut", value, "0");
+        mUseColorLut = atoi(value) != 0;
     }
 #endif
 }
@@ -205,6 +224,7 @@ void GLES20RenderEngine::setViewportAndProjection(
             break;
     }
 
+    flushBatch();
     glViewport(0, 0, vpw, vph);
     mState.setProjectionMatrix(m);
     mVpWidth = vpw;
@@ -224,17 +244,13 @@ void GLES20RenderEngine::setupLayerBlending(
 #ifdef USE_HWC2
     mState.setPlaneAlpha(alpha);
 
-    if (alpha < 1.0f || !opaque) {
+    const bool blend = alpha < 1.0f || !opaque;
 #else
     mState.setPlaneAlpha(alpha / 255.0f);
 
-    if (alpha < 0xFF || !opaque) {
+    const bool blend = alpha < 0xFF || !opaque;
 #endif
-        glEnable(GL_BLEND);
-        glBlendFunc(premultipliedAlpha ? GL_ONE : GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    } else {
-        glDisable(GL_BLEND);
-    }
+    setBlending(blend, premultipliedAlpha ? GL_ONE : GL_SRC_ALPHA);
 }
 
 #ifdef USE_HWC2
@@ -253,15 +269,10 @@ void GLES20RenderEngine::setupDimLayerBlending(int alpha) {
     mState.disableTexture();
 
 #ifdef USE_HWC2
-    if (alpha == 1.0f) {
+    setBlending(alpha != 1.0f, GL_ONE);
 #else
-    if (alpha == 0xFF) {
+    setBlending(alpha != 0xFF, GL_ONE);
 #endif
-        glDisable(GL_BLEND);
-    } else {
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
-    }
 }
 
 #ifdef USE_HWC2
@@ -298,6 +309,66 @@ void GLES20RenderEngine::setWideColor(bool hasWideColor) {
 bool GLES20RenderEngine::usesWideColor() {
     return mUseWideColor;
 }
+
+void GLES20RenderEngine::setupWideColorState(Description* state) {
+    if (mDataSpace == HAL_DATASPACE_DISPLAY_P3) {
+        return;
+    }
+    GLuint lut = getColorLut(mDataSpace);
+    if (lut != 0) {
+        state->setColorLut(lut, COLOR_LUT_SIZE);
+    } else {
+        state->setColorMatrix(state->getColorMatrix() * mSrgbToDisplayP3);
+    }
+}
+
+GLuint GLES20RenderEngine::getColorLut(android_dataspace source) {
+    if (!mUseColorLut) {
+        return 0;
+    }
+    auto it = mColorLuts.find(source);
+    if (it != mColorLuts.end()) {
+        return it->second;
+    }
+
+    ATRACE_CALL();
+    // Like the gamut matrix, treat everything that isn't Display-P3 as sRGB
+    const bool linear = source == HAL_DATASPACE_SRGB_LINEAR ||
+            source == HAL_DATASPACE_V0_SRGB_LINEAR;
+    const ColorSpace srcSpace = linear ? ColorSpace::linearSRGB() : ColorSpace::sRGB();
+    std::unique_ptr<float3> lut =
+            ColorSpace::createLUT(COLOR_LUT_SIZE, srcSpace, ColorSpace::DisplayP3());
+
+    // createLUT lays the blue slices out one after the other, which is a
+    // size x size*size 2D texture as is
+    const size_t count = COLOR_LUT_SIZE * COLOR_LUT_SIZE * COLOR_LUT_SIZE;
+    std::vector<uint8_t> texels(count * 3);
+    const float3* data = lut.get();
+    for (size_t i = 0; i < count; i++) {
+        for (size_t c = 0; c < 3; c++) {
+            const float v = std::min(std::max(data[i][c], 0.0f), 1.0f);
+            texels[i * 3 + c] = uint8_t(v * 255.0f + 0.5f);
+        }
+    }
+
+    // the layer texture is already bound to unit 0, use the LUT's unit
+    GLuint texName = 0;
+    glGenTextures(1, &texName);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, texName);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, COLOR_LUT_SIZE,
+            COLOR_LUT_SIZE * COLOR_LUT_SIZE, 0, GL_RGB, GL_UNSIGNED_BYTE, texels.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glActiveTexture(GL_TEXTURE0);
+
+    mColorLuts[source] = texName;
+    return texName;
+}
 #endif
 
 void GLES20RenderEngine::setupLayerTexturing(const Texture& texture) {
@@ -333,12 +404,30 @@ void GLES20RenderEngine::disableTexturing() {
 }
 
 void GLES20RenderEngine::disableBlending() {
-    glDisable(GL_BLEND);
+    setBlending(false, GL_ONE);
+}
+
+void GLES20RenderEngine::setBlending(bool enabled, GLenum srcFactor) {
+    if (enabled == mBlendEnabled && (!enabled || srcFactor == mBlendSrcFactor)) {
+        return;
+    }
+
+    flushBatch();
+    if (enabled) {
+        glEnable(GL_BLEND);
+        glBlendFunc(srcFactor, GL_ONE_MINUS_SRC_ALPHA);
+    } else {
+        glDisable(GL_BLEND);
+    }
+    mBlendEnabled = enabled;
+    mBlendSrcFactor = srcFactor;
 }
 
 
 void GLES20RenderEngine::bindImageAsFramebuffer(EGLImageKHR image,
         uint32_t* texName, uint32_t* fbName, uint32_t* status) {
+    flushBatch();
+
     GLuint tname, name;
     // turn our EGLImage into a texture
     glGenTextures(1, &tname);
@@ -356,6 +445,7 @@ void GLES20RenderEngine::bindImageAsFramebuffer(EGLImageKHR image,
 }
 
 void GLES20RenderEngine::unbindFramebuffer(uint32_t texName, uint32_t fbName) {
+    flushBatch();
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
     glDeleteFramebuffers(1, &fbName);
     glDeleteTextures(1, &texName);
@@ -367,10 +457,24 @@ void GLES20RenderEngine::setupFillWithColor(float r, float g, float b, float a)
     mState.setOpaque(false);
     mState.setColor(r, g, b, a);
     mState.disableTexture();
-    glDisable(GL_BLEND);
+    setBlending(false, GL_ONE);
 }
 
 void GLES20RenderEngine::drawMesh(const Mesh& mesh) {
+    if (mBatching && !mesh.getTexCoordsSize() && !mState.isTextureEnabled()) {
+#ifdef USE_HWC2
+        if (usesWideColor() && mDataSpace != HAL_DATASPACE_DISPLAY_P3) {
+            Description wideColorState = mState;
+            setupWideColorState(&wideColorState);
+            addToBatch(wideColorState, mesh);
+            return;
+        }
+#endif
+        addToBatch(mState, mesh);
+        return;
+    }
+
+    flushBatch();
 
     if (mesh.getTexCoordsSize()) {
         glEnableVertexAttribArray(Program::texCoords);
@@ -391,7 +495,7 @@ void GLES20RenderEngine::drawMesh(const Mesh& mesh) {
     if (usesWideColor()) {
         Description wideColorState = mState;
         if (mDataSpace != HAL_DATASPACE_DISPLAY_P3) {
-            wideColorState.setColorMatrix(mState.getColorMatrix() * mSrgbToDisplayP3);
+            setupWideColorState(&wideColorState);
             ALOGV("drawMesh: gamut transform applied");
         }
         ProgramCache::getInstance().useProgram(wideColorState);
@@ -419,6 +523,177 @@ void GLES20RenderEngine::drawMesh(const Mesh& mesh) {
     }
 }
 
+void GLES20RenderEngine::addToBatch(const Description& state, const Mesh& mesh) {
+    const size_t vertexSize = mesh.getVertexSize();
+    if (!mBatchPositions.empty() &&
+            (vertexSize != mBatchVertexSize || !mBatchState.canBatchWith(state))) {
+        flushBatch();
+    }
+    if (mBatchPositions.empty()) {
+        mBatchState = state;
+        mBatchVertexSize = vertexSize;
+    }
+
+    // everything is turned into a list of triangles so that meshes of any
+    // primitive can be appended to each other
+    const float* positions = mesh.getPositions();
+    const size_t stride = mesh.getStride();
+    auto append = [&](size_t index) {
+        const float* vertex = positions + index * stride;
+        mBatchPositions.insert(mBatchPositions.end(), vertex, vertex + vertexSize);
+    };
+
+    const size_t count = mesh.getVertexCount();
+    switch (mesh.getPrimitive()) {
+        case Mesh::TRIANGLES:
+            for (size_t i = 0; i + 2 < count; i += 3) {
+                append(i);
+                append(i + 1);
+                append(i + 2);
+            }
+            break;
+        case Mesh::TRIANGLE_STRIP:
+            for (size_t i = 2; i < count; i++) {
+                // every other triangle of a strip has its winding reversed
+                append(i & 1 ? i - 1 : i - 2);
+                append(i & 1 ? i - 2 : i - 1);
+                append(i);
+            }
+            break;
+        case Mesh::TRIANGLE_FAN:
+            for (size_t i = 2; i < count; i++) {
+                append(0);
+                append(i - 1);
+                append(i);
+            }
+            break;
+    }
+}
+
+void GLES20RenderEngine::flushBatch() {
+    if (mBatchPositions.empty()) {
+        return;
+    }
+
+    glVertexAttribPointer(Program::position,
+            mBatchVertexSize,
+            GL_FLOAT, GL_FALSE,
+            0,
+            mBatchPositions.data());
+
+    ProgramCache::getInstance().useProgram(mBatchState);
+
+    glDrawArrays(GL_TRIANGLES, 0, mBatchPositions.size() / mBatchVertexSize);
+
+    mBatchPositions.clear();
+}
+
+void GLES20RenderEngine::beginBatch() {
+    mBatching = true;
+}
+
+void GLES20RenderEngine::endBatch() {
+    flushBatch();
+    mBatching = false;
+}
+
+void GLES20RenderEngine::beginGpuTimer(int32_t displayId) {
+    if (!mGpuTimingEnabled || mActiveGpuTimer.query != 0) {
+        return;
+    }
+    collectGpuTimers();
+    if (mFreeGpuTimerQueries.empty()) {
+        std::lock_guard<std::mutex> lock(mGpuTimingsLock);
+        mGpuTimersSkipped++;
+        return;
+    }
+    // the draws held back so far belong to whatever came before
+    flushBatch();
+    mActiveGpuTimer.query = mFreeGpuTimerQueries.back();
+    mActiveGpuTimer.displayId = displayId;
+    mFreeGpuTimerQueries.pop_back();
+    glBeginQueryEXT(GL_TIME_ELAPSED_EXT, mActiveGpuTimer.query);
+}
+
+void GLES20RenderEngine::endGpuTimer() {
+    if (mActiveGpuTimer.query == 0) {
+        return;
+    }
+    flushBatch();
+    glEndQueryEXT(GL_TIME_ELAPSED_EXT);
+    mPendingGpuTimers.push_back(mActiveGpuTimer);
+    mActiveGpuTimer.query = 0;
+}
+
+void GLES20RenderEngine::collectGpuTimers() {
+    // a disjoint operation (e.g. a frequency change) makes every pending
+    // result meaningless
+    GLint disjoint = 0;
+    glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+
+    // queries complete in order, stop at the first one still in flight
+    while (!mPendingGpuTimers.empty()) {
+        const PendingGpuTimer timer = mPendingGpuTimers.front();
+        GLuint available = GL_FALSE;
+        glGetQueryObjectuivEXT(timer.query, GL_QUERY_RESULT_AVAILABLE_EXT, &available);
+        if (!available && !disjoint) {
+            break;
+        }
+        mPendingGpuTimers.pop_front();
+        mFreeGpuTimerQueries.push_back(timer.query);
+
+        std::lock_guard<std::mutex> lock(mGpuTimingsLock);
+        if (disjoint) {
+            mGpuTimersDisjoint++;
+            continue;
+        }
+
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64vEXT(timer.query, GL_QUERY_RESULT_EXT, &elapsed);
+        const nsecs_t duration = nsecs_t(elapsed);
+
+        GpuTimings& timings(mGpuTimings[timer.displayId]);
+        if (timings.counterName.isEmpty()) {
+            timings.counterName = String8::format("GPUComposition:%d", timer.displayId);
+            timings.recent.resize(GPU_TIMINGS_HISTORY);
+        }
+        timings.frames++;
+        timings.total += duration;
+        timings.max = std::max(timings.max, duration);
+        timings.recent[timings.next] = duration;
+        timings.next = (timings.next + 1) % GPU_TIMINGS_HISTORY;
+        ATRACE_INT64(timings.counterName.string(), duration);
+    }
+}
+
+void GLES20RenderEngine::dumpGpuTimings(String8& result) {
+    if (!mGpuTimingEnabled) {
+        result.append("GPU timing disabled (debug.sf.gpu_timing, "
+                "needs GL_EXT_disjoint_timer_query)\n");
+        return;
+    }
+    // called from a binder thread, the results are collected while composing
+    std::lock_guard<std::mutex> lock(mGpuTimingsLock);
+    result.appendFormat("GPU timing: %" PRIu64 " skipped, %" PRIu64 " disjoint\n",
+            mGpuTimersSkipped, mGpuTimersDisjoint);
+    for (const auto& entry : mGpuTimings) {
+        const GpuTimings& timings(entry.second);
+        result.appendFormat("  display %d: %" PRIu64 " frames, avg %.3f ms, max %.3f ms\n",
+                entry.first, timings.frames,
+                timings.total / 1e6 / std::max(timings.frames, uint64_t(1)),
+                timings.max / 1e6);
+        // most recent frames, oldest first
+        const size_t count = size_t(std::min(timings.frames, uint64_t(GPU_TIMINGS_HISTORY)));
+        const size_t first = (timings.next + GPU_TIMINGS_HISTORY - count) % GPU_TIMINGS_HISTORY;
+        result.append("   ");
+        for (size_t i = 0; i < count; i++) {
+            result.appendFormat(" %.3f",
+                    timings.recent[(first + i) % GPU_TIMINGS_HISTORY] / 1e6);
+        }
+        result.append("\n");
+    }
+}
+
 void GLES20RenderEngine::dump(String8& result) {
     RenderEngine::dump(result);
 #ifdef USE_HWC2
@@ -427,6 +702,8 @@ void GLES20RenderEngine::dump(String8& result) {
     } else {
         result.append("Wide-color: Off\n");
     }
+    result.appendFormat("Color LUTs: %s (%zu)\n", mUseColorLut ? "On" : "Off",
+            mColorLuts.size());
 #endif
 }
 
@@ -24,6 +24,14 @@
 #include <GLES2/gl2.h>
 #include <Transform.h>
 
+#include <deque>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include <utils/String8.h>
+#include <utils/Timers.h>
+
 #include "RenderEngine.h"
 #include "ProgramCache.h"
 #include "Description.h"
@@ -54,10 +62,59 @@ class GLES20RenderEngine : public RenderEngine {
     Description mState;
     Vector<Group> mGroupStack;
 
+    // Blending state last set on the context, only changes break a batch
+    bool mBlendEnabled = false;
+    GLenum mBlendSrcFactor = GL_ONE;
+
+    // Draws held back since beginBatch(): all with mBatchState, as a list of
+    // triangles of mBatchVertexSize dimensions
+    bool mBatching = false;
+    Description mBatchState;
+    size_t mBatchVertexSize = 0;
+    std::vector<GLfloat> mBatchPositions;
+
     virtual void bindImageAsFramebuffer(EGLImageKHR image,
             uint32_t* texName, uint32_t* fbName, uint32_t* status);
     virtual void unbindFramebuffer(uint32_t texName, uint32_t fbName);
 
+    // GPU composition time of one display
+    static constexpr size_t GPU_TIMINGS_HISTORY = 64;
+    struct GpuTimings {
+        String8 counterName;
+        uint64_t frames = 0;
+        nsecs_t total = 0;
+        nsecs_t max = 0;
+        // last GPU_TIMINGS_HISTORY frames, oldest at next when full
+        std::vector<nsecs_t> recent;
+        size_t next = 0;
+    };
+
+    // A timer query issued for a display, whose result isn't known yet
+    struct PendingGpuTimer {
+        GLuint query;
+        int32_t displayId;
+    };
+
+    // Bounds the number of frames in flight that can be timed
+    static constexpr size_t MAX_GPU_TIMER_QUERIES = 6;
+
+    bool mGpuTimingEnabled = false;
+    std::vector<GLuint> mFreeGpuTimerQueries;
+    std::deque<PendingGpuTimer> mPendingGpuTimers;
+    PendingGpuTimer mActiveGpuTimer = {0, 0};
+    // protects the statistics below, which are dumped from binder threads
+    std::mutex mGpuTimingsLock;
+    std::map<int32_t, GpuTimings> mGpuTimings;
+    // frames not timed because all queries were in flight
+    uint64_t mGpuTimersSkipped = 0;
+    // results thrown away because the GPU reported a disjoint operation
+    uint64_t mGpuTimersDisjoint = 0;
+
+    void setBlending(bool enabled, GLenum srcFactor);
+    void addToBatch(const Description& state, const Mesh& mesh);
+    // records the results of the timer queries the GPU is done with
+    void collectGpuTimers();
+
 public:
     GLES20RenderEngine();
 
@@ -93,6 +150,19 @@ protected:
 
     // Currently only supporting sRGB and DisplayP3 color spaces
     mat4 mSrgbToDisplayP3;
+
+    // Sets state up to convert mDataSpace to Display-P3
+    void setupWideColorState(Description* state);
+    // Returns the LUT converting the given dataspace to Display-P3,
+    // creating it on first use, or 0 if the LUTs are disabled
+    GLuint getColorLut(android_dataspace source);
+
+    // When set (debug.sf.color_lut), the conversion to Display-P3 is
+    // precomputed per source dataspace in a COLOR_LUT_SIZE^3 LUT, which
+    // also applies the transfer functions the gamut matrix leaves out
+    static constexpr uint32_t COLOR_LUT_SIZE = 17;
+    bool mUseColorLut = false;
+    std::map<android_dataspace, GLuint> mColorLuts;
 #else
     virtual void setupLayerBlending(bool premultipliedAlpha, bool opaque,
             int alpha);
@@ -106,6 +176,13 @@ protected:
     virtual void disableBlending();
 
     virtual void drawMesh(const Mesh& mesh);
+    virtual void beginBatch();
+    virtual void endBatch();
+    virtual void flushBatch();
+
+    virtual void beginGpuTimer(int32_t displayId);
+    virtual void endGpuTimer();
+    virtual void dumpGpuTimings(String8& result);
 
     virtual size_t getMaxTextureSize() const;
     virtual size_t getMaxViewportDims() const;
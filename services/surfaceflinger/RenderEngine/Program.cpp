@@ -19,6 +19,8 @@
 #include <log/log.h>
 #include <utils/String8.h>
 
+#include <GLES2/gl2ext.h>
+
 #include "Program.h"
 #include "ProgramCache.h"
 #include "Description.h"
@@ -53,26 +55,55 @@ Program::Program(const ProgramCache::Key& /*needs*/, const char* vertex, const c
         glDeleteShader(fragmentId);
         glDeleteProgram(programId);
     } else {
-        mProgram = programId;
         mVertexShader = vertexId;
         mFragmentShader = fragmentId;
-        mInitialized = true;
-
-        mColorMatrixLoc = glGetUniformLocation(programId, "colorMatrix");
-        mProjectionMatrixLoc = glGetUniformLocation(programId, "projection");
-        mTextureMatrixLoc = glGetUniformLocation(programId, "texture");
-        mSamplerLoc = glGetUniformLocation(programId, "sampler");
-        mColorLoc = glGetUniformLocation(programId, "color");
-        mAlphaPlaneLoc = glGetUniformLocation(programId, "alphaPlane");
-
-        // set-up the default values for our uniforms
-        glUseProgram(programId);
-        const GLfloat m[16] = {1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1 };
-        glUniformMatrix4fv(mProjectionMatrixLoc, 1, GL_FALSE, m);
-        glEnableVertexAttribArray(0);
+        initUniforms(programId);
     }
 }
 
+Program::Program(const ProgramCache::Key& /*needs*/, GLenum binaryFormat,
+        const void* binary, GLsizei length)
+        : mInitialized(false), mVertexShader(0), mFragmentShader(0) {
+    GLuint programId = glCreateProgram();
+    // the attribute bindings are part of the linked program, and therefore
+    // of its binary
+    glProgramBinaryOES(programId, binaryFormat, binary, length);
+
+    GLint status;
+    glGetProgramiv(programId, GL_LINK_STATUS, &status);
+    if (status != GL_TRUE) {
+        // this is expected when the driver changed under our feet, the
+        // caller falls back to compiling the program
+        ALOGW("Program binary rejected by the driver (format 0x%x)", binaryFormat);
+        glDeleteProgram(programId);
+        // glProgramBinaryOES reports INVALID_ENUM for unknown formats, don't
+        // let it leak into the next glGetError() check
+        while (glGetError() != GL_NO_ERROR) {}
+    } else {
+        initUniforms(programId);
+    }
+}
+
+void Program::initUniforms(GLuint programId) {
+    mProgram = programId;
+    mInitialized = true;
+
+    mColorMatrixLoc = glGetUniformLocation(programId, "colorMatrix");
+    mProjectionMatrixLoc = glGetUniformLocation(programId, "projection");
+    mTextureMatrixLoc = glGetUniformLocation(programId, "texture");
+    mSamplerLoc = glGetUniformLocation(programId, "sampler");
+    mColorLoc = glGetUniformLocation(programId, "color");
+    mAlphaPlaneLoc = glGetUniformLocation(programId, "alphaPlane");
+    mColorLutLoc = glGetUniformLocation(programId, "colorLut");
+    mColorLutSizeLoc = glGetUniformLocation(programId, "colorLutSize");
+
+    // set-up the default values for our uniforms
+    glUseProgram(programId);
+    const GLfloat m[16] = {1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1 };
+    glUniformMatrix4fv(mProjectionMatrixLoc, 1, GL_FALSE, m);
+    glEnableVertexAttribArray(0);
+}
+
 Program::~Program() {
 }
 
@@ -84,6 +115,27 @@ void Program::use() {
     glUseProgram(mProgram);
 }
 
+bool Program::getBinary(GLenum* outFormat, Vector<uint8_t>* outBinary) const {
+    if (!mInitialized) {
+        return false;
+    }
+    GLint length = 0;
+    glGetProgramiv(mProgram, GL_PROGRAM_BINARY_LENGTH_OES, &length);
+    if (length <= 0) {
+        return false;
+    }
+    outBinary->resize(size_t(length));
+    GLsizei written = 0;
+    glGetProgramBinaryOES(mProgram, length, &written, outFormat,
+            outBinary->editArray());
+    if (written <= 0) {
+        outBinary->clear();
+        return false;
+    }
+    outBinary->resize(size_t(written));
+    return true;
+}
+
 GLuint Program::getAttrib(const char* name) const {
     // TODO: maybe use a local cache
     return glGetAttribLocation(mProgram, name);
@@ -141,6 +193,14 @@ void Program::setUniforms(const Description& desc) {
     if (mColorMatrixLoc >= 0) {
         glUniformMatrix4fv(mColorMatrixLoc, 1, GL_FALSE, desc.mColorMatrix.asArray());
     }
+    if (mColorLutLoc >= 0) {
+        // the layer texture stays on unit 0
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, desc.mColorLut);
+        glActiveTexture(GL_TEXTURE0);
+        glUniform1i(mColorLutLoc, 1);
+        glUniform1f(mColorLutSizeLoc, desc.mColorLutSize);
+    }
     // these uniforms are always present
     glUniformMatrix4fv(mProjectionMatrixLoc, 1, GL_FALSE, desc.mProjectionMatrix.asArray());
 }
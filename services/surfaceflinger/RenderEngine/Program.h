@@ -21,6 +21,8 @@
 
 #include <GLES2/gl2.h>
 
+#include <utils/Vector.h>
+
 #include "Description.h"
 #include "ProgramCache.h"
 
@@ -37,11 +39,17 @@ public:
     enum { position=0, texCoords=1 };
 
     Program(const ProgramCache::Key& needs, const char* vertex, const char* fragment);
+    /* links the program from a binary obtained with getBinary() */
+    Program(const ProgramCache::Key& needs, GLenum binaryFormat,
+            const void* binary, GLsizei length);
     ~Program();
 
     /* whether this object is usable */
     bool isValid() const;
 
+    /* retrieves the linked program (GL_OES_get_program_binary) */
+    bool getBinary(GLenum* outFormat, Vector<uint8_t>* outBinary) const;
+
     /* Binds this program to the GLES context */
     void use();
 
@@ -56,6 +64,7 @@ public:
 
 
 private:
+    void initUniforms(GLuint programId);
     GLuint buildShader(const char* source, GLenum type);
     String8& dumpShader(String8& result, GLenum type);
 
@@ -84,6 +93,10 @@ private:
 
     /* location of the color uniform */
     GLint mColorLoc;
+
+    /* location of the color LUT sampler and size uniforms */
+    GLint mColorLutLoc;
+    GLint mColorLutSizeLoc;
 };
 
 
@@ -14,14 +14,23 @@
  * limitations under the License.
  */
 
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
 #include <GLES2/gl2.h>
 #include <GLES2/gl2ext.h>
 
+#include <cutils/properties.h>
+#include <log/log.h>
 #include <utils/String8.h>
 
 #include "ProgramCache.h"
 #include "Program.h"
 #include "Description.h"
+#include "GLExtensions.h"
 
 namespace android {
 // -----------------------------------------------------------------------------------------------
@@ -75,11 +84,66 @@ Formatter& dedent(Formatter& f) {
 
 // -----------------------------------------------------------------------------------------------
 
+/*
+ * Layout of the program binary cache file:
+ *   BinaryCacheHeader
+ *   driver id (header.driverIdLength bytes, not NUL terminated)
+ *   header.count times:
+ *     BinaryCacheEntry
+ *     program binary (entry.length bytes)
+ * All values are in native byte order, the file never leaves the device.
+ */
+
+static const char* const BINARY_CACHE_PATH = "/data/misc/surfaceflinger/program_binaries";
+static const char* const BINARY_CACHE_TMP_PATH = "/data/misc/surfaceflinger/program_binaries.tmp";
+static const uint32_t BINARY_CACHE_MAGIC = 0x53465042; // 'SFPB'
+static const uint32_t BINARY_CACHE_VERSION = 1;
+static const size_t MAX_BINARY_CACHE_SIZE = 8 * 1024 * 1024;
+
+struct BinaryCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t driverIdLength;
+    uint32_t count;
+};
+
+struct BinaryCacheEntry {
+    uint32_t key;
+    uint32_t format;
+    uint32_t sourceHash;
+    uint32_t length;
+};
+
+static uint32_t hashString(uint32_t hash, const String8& str) {
+    // FNV-1a
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(str.string());
+    for (size_t i = 0; i < str.size(); i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// -----------------------------------------------------------------------------------------------
+
 ANDROID_SINGLETON_STATIC_INSTANCE(ProgramCache)
 
-ProgramCache::ProgramCache() {
-    // Until surfaceflinger has a dependable blob cache on the filesystem,
-    // generate shaders on initialization so as to avoid jank.
+ProgramCache::ProgramCache()
+    : mUseBinaries(false), mBinariesDirty(false) {
+    char value[PROPERTY_VALUE_MAX];
+    property_get("debug.sf.disable_program_binaries", value, "0");
+    if (!atoi(value) &&
+            GLExtensions::getInstance().hasExtension("GL_OES_get_program_binary")) {
+        GLint formatCount = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &formatCount);
+        mUseBinaries = formatCount > 0;
+    }
+    if (mUseBinaries) {
+        loadBinaries();
+    }
+
+    // Generate shaders on initialization so as to avoid jank. Shaders
+    // for which a binary was persisted by a previous boot are only linked
+    // the first time they are used, which is cheap.
     primeCache();
 }
 
@@ -88,6 +152,7 @@ ProgramCache::~ProgramCache() {
 
 void ProgramCache::primeCache() {
     uint32_t shaderCount = 0;
+    uint32_t binaryCount = 0;
     uint32_t keyMask = Key::BLEND_MASK | Key::OPACITY_MASK |
                        Key::PLANE_ALPHA_MASK | Key::TEXTURE_MASK;
     // Prime the cache for all combinations of the above masks,
@@ -103,16 +168,173 @@ void ProgramCache::primeCache() {
             tex != Key::TEXTURE_2D) {
             continue;
         }
+        if (mBinaries.indexOfKey(shaderKey) >= 0) {
+            binaryCount++;
+            continue;
+        }
         Program* program = mCache.valueFor(shaderKey);
         if (program == NULL) {
-            program = generateProgram(shaderKey);
+            program = getProgram(shaderKey);
             mCache.add(shaderKey, program);
             shaderCount++;
         }
     }
+    saveBinaries();
     nsecs_t timeAfter = systemTime();
     float compileTimeMs = static_cast<float>(timeAfter - timeBefore) / 1.0E6;
-    ALOGD("shader cache generated - %u shaders in %f ms\n", shaderCount, compileTimeMs);
+    ALOGD("shader cache generated - %u shaders in %f ms, %u deferred to their persisted binary\n",
+            shaderCount, compileTimeMs, binaryCount);
+}
+
+Program* ProgramCache::getProgram(const Key& needs) {
+    ssize_t index = mBinaries.indexOfKey(needs);
+    if (index >= 0) {
+        const ProgramBinary& binary(mBinaries.valueAt(index));
+        if (binary.sourceHash == hashSources(needs)) {
+            Program* program = new Program(needs, binary.format,
+                    binary.data.array(), GLsizei(binary.data.size()));
+            if (program->isValid()) {
+                return program;
+            }
+            delete program;
+        }
+        // stale binary, replace it with the one we are about to compile
+        mBinaries.removeItemsAt(index);
+        mBinariesDirty = true;
+    }
+
+    Program* program = generateProgram(needs);
+    if (mUseBinaries && program->isValid()) {
+        ProgramBinary binary;
+        binary.sourceHash = hashSources(needs);
+        if (program->getBinary(&binary.format, &binary.data)) {
+            mBinaries.add(needs, binary);
+            mBinariesDirty = true;
+        }
+    }
+    return program;
+}
+
+String8 ProgramCache::getDriverId() {
+    // The GL strings don't always change with the driver build, the build
+    // fingerprint does.
+    char fingerprint[PROPERTY_VALUE_MAX];
+    property_get("ro.build.fingerprint", fingerprint, "");
+    const GLExtensions& extensions(GLExtensions::getInstance());
+    return String8::format("%s|%s|%s|%s", extensions.getVendor(),
+            extensions.getRenderer(), extensions.getVersion(), fingerprint);
+}
+
+uint32_t ProgramCache::hashSources(const Key& needs) {
+    uint32_t hash = 2166136261u;
+    hash = hashString(hash, generateVertexShader(needs));
+    hash = hashString(hash, generateFragmentShader(needs));
+    return hash;
+}
+
+void ProgramCache::loadBinaries() {
+    FILE* file = fopen(BINARY_CACHE_PATH, "rb");
+    if (file == NULL) {
+        return;
+    }
+
+    Vector<uint8_t> contents;
+    long size = -1;
+    if (fseek(file, 0, SEEK_END) == 0) {
+        size = ftell(file);
+    }
+    if (size > 0 && size_t(size) <= MAX_BINARY_CACHE_SIZE &&
+            fseek(file, 0, SEEK_SET) == 0) {
+        contents.resize(size_t(size));
+        if (fread(contents.editArray(), 1, contents.size(), file) != contents.size()) {
+            contents.clear();
+        }
+    }
+    fclose(file);
+
+    const uint8_t* data = contents.array();
+    const size_t length = contents.size();
+    size_t offset = 0;
+
+    BinaryCacheHeader header;
+    if (length < sizeof(header)) {
+        return;
+    }
+    memcpy(&header, data, sizeof(header));
+    offset += sizeof(header);
+
+    const String8 driverId(getDriverId());
+    if (header.magic != BINARY_CACHE_MAGIC ||
+            header.version != BINARY_CACHE_VERSION ||
+            header.driverIdLength != driverId.size() ||
+            length - offset < header.driverIdLength ||
+            memcmp(data + offset, driverId.string(), driverId.size()) != 0) {
+        ALOGI("program binary cache is stale, discarding it");
+        return;
+    }
+    offset += header.driverIdLength;
+
+    for (uint32_t i = 0; i < header.count; i++) {
+        BinaryCacheEntry entry;
+        if (length - offset < sizeof(entry)) {
+            break;
+        }
+        memcpy(&entry, data + offset, sizeof(entry));
+        offset += sizeof(entry);
+        if (length - offset < entry.length) {
+            break;
+        }
+        Key key;
+        key.mKey = entry.key;
+        ProgramBinary binary;
+        binary.format = entry.format;
+        binary.sourceHash = entry.sourceHash;
+        binary.data.appendArray(data + offset, entry.length);
+        mBinaries.add(key, binary);
+        offset += entry.length;
+    }
+    ALOGD("loaded %zu program binaries", mBinaries.size());
+}
+
+void ProgramCache::saveBinaries() {
+    if (!mUseBinaries || !mBinariesDirty) {
+        return;
+    }
+    // don't retry on every new program if the cache can't be written
+    mBinariesDirty = false;
+
+    FILE* file = fopen(BINARY_CACHE_TMP_PATH, "wb");
+    if (file == NULL) {
+        ALOGW("can't open %s for writing: %s", BINARY_CACHE_TMP_PATH, strerror(errno));
+        return;
+    }
+
+    const String8 driverId(getDriverId());
+    BinaryCacheHeader header;
+    header.magic = BINARY_CACHE_MAGIC;
+    header.version = BINARY_CACHE_VERSION;
+    header.driverIdLength = uint32_t(driverId.size());
+    header.count = uint32_t(mBinaries.size());
+
+    bool success = fwrite(&header, sizeof(header), 1, file) == 1 &&
+            fwrite(driverId.string(), 1, driverId.size(), file) == driverId.size();
+    for (size_t i = 0; success && i < mBinaries.size(); i++) {
+        const ProgramBinary& binary(mBinaries.valueAt(i));
+        BinaryCacheEntry entry;
+        entry.key = mBinaries.keyAt(i).mKey;
+        entry.format = binary.format;
+        entry.sourceHash = binary.sourceHash;
+        entry.length = uint32_t(binary.data.size());
+        success = fwrite(&entry, sizeof(entry), 1, file) == 1 &&
+                fwrite(binary.data.array(), 1, binary.data.size(), file) ==
+                        binary.data.size();
+    }
+    success = (fclose(file) == 0) && success;
+
+    if (!success || rename(BINARY_CACHE_TMP_PATH, BINARY_CACHE_PATH) != 0) {
+        ALOGW("can't write program binary cache: %s", strerror(errno));
+        unlink(BINARY_CACHE_TMP_PATH);
+    }
 }
 
 ProgramCache::Key ProgramCache::computeKey(const Description& description) {
@@ -129,7 +351,9 @@ ProgramCache::Key ProgramCache::computeKey(const Description& description) {
     .set(Key::OPACITY_MASK,
             description.mOpaque ? Key::OPACITY_OPAQUE : Key::OPACITY_TRANSLUCENT)
     .set(Key::COLOR_MATRIX_MASK,
-            description.mColorMatrixEnabled ? Key::COLOR_MATRIX_ON :  Key::COLOR_MATRIX_OFF);
+            description.mColorMatrixEnabled ? Key::COLOR_MATRIX_ON :  Key::COLOR_MATRIX_OFF)
+    .set(Key::COLOR_LUT_MASK,
+            description.mColorLut != 0 ? Key::COLOR_LUT_ON : Key::COLOR_LUT_OFF);
     return needs;
 }
 
@@ -175,6 +399,23 @@ String8 ProgramCache::generateFragmentShader(const Key& needs) {
     if (needs.hasColorMatrix()) {
         fs << "uniform mat4 colorMatrix;";
     }
+    if (needs.hasColorLut()) {
+        // GLES2 has no 3D textures: the slices of the LUT are stacked in a
+        // 2D texture, interpolate within the two nearest blue slices and
+        // between them
+        fs << "uniform sampler2D colorLut;"
+           << "uniform float colorLutSize;"
+           << "vec3 sampleColorLut(vec3 color) {" << indent
+           << "vec3 scaled = clamp(color, 0.0, 1.0) * (colorLutSize - 1.0);"
+           << "float slice = floor(scaled.b);"
+           << "float nextSlice = min(slice + 1.0, colorLutSize - 1.0);"
+           << "vec2 uv = vec2((scaled.r + 0.5) / colorLutSize,"
+           << "        (colorLutSize - 0.5 - scaled.g) / (colorLutSize * colorLutSize));"
+           << "vec3 lo = texture2D(colorLut, uv + vec2(0.0, slice / colorLutSize)).rgb;"
+           << "vec3 hi = texture2D(colorLut, uv + vec2(0.0, nextSlice / colorLutSize)).rgb;"
+           << "return mix(lo, hi, scaled.b - slice);"
+           << dedent << "}";
+    }
     fs << "void main(void) {" << indent;
     if (needs.isTexturing()) {
         fs << "gl_FragColor = texture2D(sampler, outTexCoords);";
@@ -194,13 +435,18 @@ String8 ProgramCache::generateFragmentShader(const Key& needs) {
         }
     }
 
-    if (needs.hasColorMatrix()) {
+    if (needs.hasColorMatrix() || needs.hasColorLut()) {
         if (!needs.isOpaque() && needs.isPremultiplied()) {
             // un-premultiply if needed before linearization
             fs << "gl_FragColor.rgb = gl_FragColor.rgb/gl_FragColor.a;";
         }
-        fs << "vec4 transformed = colorMatrix * vec4(gl_FragColor.rgb, 1);";
-        fs << "gl_FragColor.rgb = transformed.rgb/transformed.a;";
+        if (needs.hasColorLut()) {
+            fs << "gl_FragColor.rgb = sampleColorLut(gl_FragColor.rgb);";
+        }
+        if (needs.hasColorMatrix()) {
+            fs << "vec4 transformed = colorMatrix * vec4(gl_FragColor.rgb, 1);";
+            fs << "gl_FragColor.rgb = transformed.rgb/transformed.a;";
+        }
         if (!needs.isOpaque() && needs.isPremultiplied()) {
             // and re-premultiply if needed after gamma correction
             fs << "gl_FragColor.rgb = gl_FragColor.rgb*gl_FragColor.a;";
@@ -232,9 +478,12 @@ void ProgramCache::useProgram(const Description& description) {
     if (program == NULL) {
         // we didn't find our program, so generate one...
         nsecs_t time = -systemTime();
-        program = generateProgram(needs);
+        program = getProgram(needs);
         mCache.add(needs, program);
         time += systemTime();
+        // this is a key primeCache() doesn't cover, make sure the next boot
+        // doesn't have to compile it again
+        saveBinaries();
 
         //ALOGD(">>> generated new program: needs=%08X, time=%u ms (%d programs)",
         //        needs.mNeeds, uint32_t(ns2ms(time)), mCache.size());
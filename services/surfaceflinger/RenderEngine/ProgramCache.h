@@ -22,6 +22,7 @@
 #include <utils/Singleton.h>
 #include <utils/KeyedVector.h>
 #include <utils/TypeHelpers.h>
+#include <utils/Vector.h>
 
 #include "Description.h"
 
@@ -69,6 +70,10 @@ public:
             COLOR_MATRIX_OFF        =       0x00000000,
             COLOR_MATRIX_ON         =       0x00000020,
             COLOR_MATRIX_MASK       =       0x00000020,
+
+            COLOR_LUT_OFF           =       0x00000000,
+            COLOR_LUT_ON            =       0x00000040,
+            COLOR_LUT_MASK          =       0x00000040,
         };
 
         inline Key() : mKey(0) { }
@@ -97,6 +102,9 @@ public:
         inline bool hasColorMatrix() const {
             return (mKey & COLOR_MATRIX_MASK) == COLOR_MATRIX_ON;
         }
+        inline bool hasColorLut() const {
+            return (mKey & COLOR_LUT_MASK) == COLOR_LUT_ON;
+        }
 
         // this is the definition of a friend function -- not a method of class Needs
         friend inline int strictly_order_type(const Key& lhs, const Key& rhs) {
@@ -112,8 +120,29 @@ public:
     void useProgram(const Description& description);
 
 private:
+    // A linked program as returned by the driver, along with a hash of the
+    // sources it was built from so that binaries of a shader we since
+    // changed are never used.
+    struct ProgramBinary {
+        GLenum format;
+        uint32_t sourceHash;
+        Vector<uint8_t> data;
+    };
+
     // Generate shaders to populate the cache
     void primeCache();
+    // returns the program for the given Key, linking it from its persisted
+    // binary when possible and compiling it otherwise
+    Program* getProgram(const Key& needs);
+    // reads the binary cache file into mBinaries, without creating any
+    // program yet
+    void loadBinaries();
+    // writes mBinaries back to the binary cache file if it changed
+    void saveBinaries();
+    // identifies the GLES driver the binaries are valid for
+    static String8 getDriverId();
+    // hash of the shader sources generated for the given Key
+    static uint32_t hashSources(const Key& needs);
     // compute a cache Key from a Description
     static Key computeKey(const Description& description);
     // generates a program from the Key
@@ -126,6 +155,11 @@ private:
     // Key/Value map used for caching Programs. Currently the cache
     // is never shrunk.
     DefaultKeyedVector<Key, Program*> mCache;
+
+    // Program binaries persisted across boots, see loadBinaries()
+    bool mUseBinaries;
+    bool mBinariesDirty;
+    KeyedVector<Key, ProgramBinary> mBinaries;
 };
 
 
@@ -14,9 +14,12 @@
  * limitations under the License.
  */
 
+#include <inttypes.h>
+
 #include <log/log.h>
 #include <ui/Rect.h>
 #include <ui/Region.h>
+#include <utils/String8.h>
 
 #include "RenderEngine.h"
 #include "GLES20RenderEngine.h"
@@ -134,7 +137,7 @@ RenderEngine* RenderEngine::create(EGLDisplay display, int hwcFormat) {
         engine = new GLES20RenderEngine();
         break;
     }
-    engine->setEGLHandles(config, ctxt);
+    engine->setEGLHandles(display, config, ctxt);
 
     ALOGI("OpenGL ES informations:");
     ALOGI("vendor    : %s", extensions.getVendor());
@@ -150,13 +153,17 @@ RenderEngine* RenderEngine::create(EGLDisplay display, int hwcFormat) {
     return engine;
 }
 
-RenderEngine::RenderEngine() : mEGLConfig(NULL), mEGLContext(EGL_NO_CONTEXT) {
+RenderEngine::RenderEngine() : mEGLDisplay(EGL_NO_DISPLAY), mEGLConfig(NULL),
+        mEGLContext(EGL_NO_CONTEXT), mFramebufferTargetUses(0),
+        mNumFramebufferTargetsCreated(0), mNumFramebufferTargetsReused(0) {
 }
 
 RenderEngine::~RenderEngine() {
+    waitForPrimedCache();
 }
 
-void RenderEngine::setEGLHandles(EGLConfig config, EGLContext ctxt) {
+void RenderEngine::setEGLHandles(EGLDisplay display, EGLConfig config, EGLContext ctxt) {
+    mEGLDisplay = display;
     mEGLConfig = config;
     mEGLContext = ctxt;
 }
@@ -222,21 +229,25 @@ void RenderEngine::fillRegionWithColor(const Region& region, uint32_t height,
 }
 
 void RenderEngine::flush() {
+    flushBatch();
     glFlush();
 }
 
 void RenderEngine::clearWithColor(float red, float green, float blue, float alpha) {
+    flushBatch();
     glClearColor(red, green, blue, alpha);
     glClear(GL_COLOR_BUFFER_BIT);
 }
 
 void RenderEngine::setScissor(
         uint32_t left, uint32_t bottom, uint32_t right, uint32_t top) {
+    flushBatch();
     glScissor(left, bottom, right, top);
     glEnable(GL_SCISSOR_TEST);
 }
 
 void RenderEngine::disableScissor() {
+    flushBatch();
     glDisable(GL_SCISSOR_TEST);
 }
 
@@ -249,9 +260,14 @@ void RenderEngine::deleteTextures(size_t count, uint32_t const* names) {
 }
 
 void RenderEngine::readPixels(size_t l, size_t b, size_t w, size_t h, uint32_t* pixels) {
+    flushBatch();
     glReadPixels(l, b, w, h, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
 }
 
+void RenderEngine::dumpGpuTimings(String8& result) {
+    result.append("GPU timing not supported\n");
+}
+
 void RenderEngine::dump(String8& result) {
     const GLExtensions& extensions(GLExtensions::getInstance());
     result.appendFormat("GLES: %s, %s, %s\n",
@@ -259,6 +275,14 @@ void RenderEngine::dump(String8& result) {
             extensions.getRenderer(),
             extensions.getVersion());
     result.appendFormat("%s\n", extensions.getExtension());
+    result.appendFormat("Framebuffer targets: %zu kept, %" PRIu64 " created, %"
+            PRIu64 " reused\n", mFramebufferTargets.size(),
+            mNumFramebufferTargetsCreated, mNumFramebufferTargetsReused);
+    for (const auto& target : mFramebufferTargets) {
+        result.appendFormat("  %" PRIu64 ": %ux%u format %d%s\n",
+                target.buffer->getId(), target.width, target.height,
+                target.format, target.isProtected ? " protected" : "");
+    }
 }
 
 // ---------------------------------------------------------------------------
@@ -283,6 +307,108 @@ status_t RenderEngine::BindImageAsFramebuffer::getStatus() const {
 
 // ---------------------------------------------------------------------------
 
+RenderEngine::BindBufferAsFramebuffer::BindBufferAsFramebuffer(
+        RenderEngine& engine, const sp<GraphicBuffer>& buffer, bool keepTarget)
+    : mEngine(engine), mKeepTarget(keepTarget)
+{
+    mStatus = mEngine.bindBufferAsFramebuffer(buffer, mKeepTarget, &mTarget);
+}
+
+RenderEngine::BindBufferAsFramebuffer::~BindBufferAsFramebuffer() {
+    if (mStatus == NO_ERROR) {
+        mEngine.unbindBufferAsFramebuffer(mTarget, mKeepTarget);
+    }
+}
+
+bool RenderEngine::FramebufferTarget::matches(
+        const sp<GraphicBuffer>& other) const {
+    // The size, format and protected bit can't change for a given buffer id,
+    // they are checked so that a target never outlives what it was made for
+    const bool otherIsProtected =
+            (other->getUsage() & GRALLOC_USAGE_PROTECTED) != 0;
+    return buffer->getId() == other->getId() &&
+            width == other->getWidth() && height == other->getHeight() &&
+            format == other->getPixelFormat() &&
+            isProtected == otherIsProtected;
+}
+
+status_t RenderEngine::bindBufferAsFramebuffer(const sp<GraphicBuffer>& buffer,
+        bool keepTarget, FramebufferTarget* outTarget) {
+    if (keepTarget) {
+        for (auto& target : mFramebufferTargets) {
+            if (target.matches(buffer)) {
+                flushBatch();
+                glBindFramebuffer(GL_FRAMEBUFFER, target.fbName);
+                target.lastUsed = ++mFramebufferTargetUses;
+                mNumFramebufferTargetsReused++;
+                *outTarget = target;
+                return NO_ERROR;
+            }
+        }
+
+        // make room first, destroying a target unbinds the framebuffer
+        if (mFramebufferTargets.size() >= MAX_FRAMEBUFFER_TARGETS) {
+            auto victim = mFramebufferTargets.begin();
+            for (auto it = victim + 1; it != mFramebufferTargets.end(); ++it) {
+                if (it->lastUsed < victim->lastUsed) {
+                    victim = it;
+                }
+            }
+            destroyFramebufferTarget(*victim);
+            mFramebufferTargets.erase(victim);
+        }
+    }
+
+    FramebufferTarget target;
+    target.buffer = buffer;
+    target.width = buffer->getWidth();
+    target.height = buffer->getHeight();
+    target.format = buffer->getPixelFormat();
+    target.isProtected = (buffer->getUsage() & GRALLOC_USAGE_PROTECTED) != 0;
+    target.image = eglCreateImageKHR(mEGLDisplay, EGL_NO_CONTEXT,
+            EGL_NATIVE_BUFFER_ANDROID, buffer->getNativeBuffer(), NULL);
+    if (target.image == EGL_NO_IMAGE_KHR) {
+        ALOGE("bindBufferAsFramebuffer: eglCreateImageKHR failed: %#x",
+                eglGetError());
+        return BAD_VALUE;
+    }
+
+    uint32_t status = 0;
+    bindImageAsFramebuffer(target.image, &target.texName, &target.fbName,
+            &status);
+    if (status != GL_FRAMEBUFFER_COMPLETE_OES) {
+        ALOGE("glCheckFramebufferStatusOES error %d", status);
+        destroyFramebufferTarget(target);
+        return INVALID_OPERATION;
+    }
+    mNumFramebufferTargetsCreated++;
+
+    target.lastUsed = ++mFramebufferTargetUses;
+    if (keepTarget) {
+        mFramebufferTargets.push_back(target);
+    }
+    *outTarget = target;
+    return NO_ERROR;
+}
+
+void RenderEngine::unbindBufferAsFramebuffer(const FramebufferTarget& target,
+        bool keepTarget) {
+    if (keepTarget) {
+        flushBatch();
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    } else {
+        destroyFramebufferTarget(target);
+    }
+}
+
+void RenderEngine::destroyFramebufferTarget(const FramebufferTarget& target) {
+    // back to main framebuffer
+    unbindFramebuffer(target.texName, target.fbName);
+    eglDestroyImageKHR(mEGLDisplay, target.image);
+}
+
+// ---------------------------------------------------------------------------
+
 static status_t selectConfigForAttribute(EGLDisplay dpy, EGLint const* attrs,
         EGLint attribute, EGLint wanted, EGLConfig* outConfig) {
     EGLint numConfigs = -1, n = 0;
@@ -446,6 +572,57 @@ void RenderEngine::primeCache() const {
     ProgramCache::getInstance();
 }
 
+void RenderEngine::primeCacheAsync() {
+    EGLint contextClientVersion = 2;
+    eglQueryContext(mEGLDisplay, mEGLContext, EGL_CONTEXT_CLIENT_VERSION,
+            &contextClientVersion);
+    const EGLint contextAttributes[] = {
+            EGL_CONTEXT_CLIENT_VERSION, contextClientVersion, EGL_NONE };
+    EGLContext context = eglCreateContext(mEGLDisplay, mEGLConfig, mEGLContext,
+            contextAttributes);
+
+    EGLSurface pbuffer = EGL_NO_SURFACE;
+    if (context != EGL_NO_CONTEXT) {
+        EGLConfig pbufferConfig = mEGLConfig;
+        if (pbufferConfig == EGL_NO_CONFIG) {
+            pbufferConfig = chooseEglConfig(mEGLDisplay, HAL_PIXEL_FORMAT_RGBA_8888);
+        }
+        const EGLint attribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+        pbuffer = eglCreatePbufferSurface(mEGLDisplay, pbufferConfig, attribs);
+    }
+
+    if (pbuffer == EGL_NO_SURFACE) {
+        ALOGW("can't create a shared context (%#x), priming the shader cache "
+                "synchronously", eglGetError());
+        if (context != EGL_NO_CONTEXT) {
+            eglDestroyContext(mEGLDisplay, context);
+        }
+        primeCache();
+        return;
+    }
+
+    EGLDisplay display = mEGLDisplay;
+    mPrimeCacheThread = std::thread([display, context, pbuffer]() {
+        if (eglMakeCurrent(display, pbuffer, pbuffer, context)) {
+            ProgramCache::getInstance();
+            // the programs are used from the main context next
+            glFinish();
+            eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        } else {
+            // the cache is then primed by its first use
+            ALOGE("can't make the shared context current (%#x)", eglGetError());
+        }
+        eglDestroySurface(display, pbuffer);
+        eglDestroyContext(display, context);
+    });
+}
+
+void RenderEngine::waitForPrimedCache() {
+    if (mPrimeCacheThread.joinable()) {
+        mPrimeCacheThread.join();
+    }
+}
+
 // ---------------------------------------------------------------------------
 }; // namespace android
 // ---------------------------------------------------------------------------
@@ -24,8 +24,14 @@
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
 #include <math/mat4.h>
+#include <ui/GraphicBuffer.h>
+#include <utils/Errors.h>
+#include <utils/StrongPointer.h>
 #include <Transform.h>
 
+#include <thread>
+#include <vector>
+
 #define EGL_NO_CONFIG ((EGLConfig)0)
 
 // ---------------------------------------------------------------------------
@@ -47,17 +53,53 @@ class RenderEngine {
     };
     static GlesVersion parseGlesVersion(const char* str);
 
+    EGLDisplay mEGLDisplay;
     EGLConfig mEGLConfig;
     EGLContext mEGLContext;
-    void setEGLHandles(EGLConfig config, EGLContext ctxt);
+    std::thread mPrimeCacheThread;
+    void setEGLHandles(EGLDisplay display, EGLConfig config, EGLContext ctxt);
 
     virtual void bindImageAsFramebuffer(EGLImageKHR image, uint32_t* texName, uint32_t* fbName, uint32_t* status) = 0;
     virtual void unbindFramebuffer(uint32_t texName, uint32_t fbName) = 0;
 
+    // An EGLImage of a buffer, bound to a texture attached to a framebuffer
+    // object, so that the buffer can be rendered to.
+    struct FramebufferTarget {
+        sp<GraphicBuffer> buffer;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        PixelFormat format = 0;
+        bool isProtected = false;
+        EGLImageKHR image = EGL_NO_IMAGE_KHR;
+        uint32_t texName = 0;
+        uint32_t fbName = 0;
+        uint64_t lastUsed = 0;
+
+        bool matches(const sp<GraphicBuffer>& other) const;
+    };
+
+    // Targets kept across BindBufferAsFramebuffer scopes, the least recently
+    // used one is destroyed to make room for a new one.
+    enum { MAX_FRAMEBUFFER_TARGETS = 4 };
+    std::vector<FramebufferTarget> mFramebufferTargets;
+    uint64_t mFramebufferTargetUses;
+    uint64_t mNumFramebufferTargetsCreated;
+    uint64_t mNumFramebufferTargetsReused;
+
+    status_t bindBufferAsFramebuffer(const sp<GraphicBuffer>& buffer,
+            bool keepTarget, FramebufferTarget* outTarget);
+    void unbindBufferAsFramebuffer(const FramebufferTarget& target,
+            bool keepTarget);
+    void destroyFramebufferTarget(const FramebufferTarget& target);
+
 protected:
     RenderEngine();
     virtual ~RenderEngine() = 0;
 
+    // issue the draws held back since beginBatch(). must be called before
+    // touching any GL state the pending draws depend on.
+    virtual void flushBatch() { }
+
 public:
     static RenderEngine* create(EGLDisplay display, int hwcFormat);
 
@@ -65,6 +107,14 @@ public:
 
     void primeCache() const;
 
+    // Primes the program cache on a helper thread, with a context sharing
+    // objects with ours, so that compiling the shaders overlaps with the rest
+    // of the initialization. waitForPrimedCache() must be called before the
+    // first frame. Primes the cache on the calling thread if no shared
+    // context can be created.
+    void primeCacheAsync();
+    void waitForPrimedCache();
+
     // dump the extension strings. always call the base class.
     virtual void dump(String8& result);
 
@@ -91,6 +141,22 @@ public:
         int getStatus() const;
     };
 
+    // Binds buffer as the framebuffer for the duration of the scope. With
+    // keepTarget, the EGLImage and framebuffer object created for it are kept
+    // by the RenderEngine and reused the next time the same buffer is bound,
+    // which is only worth it for buffers that are recycled.
+    class BindBufferAsFramebuffer {
+        RenderEngine& mEngine;
+        const bool mKeepTarget;
+        FramebufferTarget mTarget;
+        status_t mStatus;
+    public:
+        BindBufferAsFramebuffer(RenderEngine& engine,
+                const sp<GraphicBuffer>& buffer, bool keepTarget);
+        ~BindBufferAsFramebuffer();
+        status_t getStatus() const { return mStatus; }
+    };
+
     // set-up
     virtual void checkErrors() const;
     virtual void setViewportAndProjection(size_t vpw, size_t vph,
@@ -120,6 +186,20 @@ public:
     // drawing
     virtual void drawMesh(const Mesh& mesh) = 0;
 
+    // between beginBatch() and endBatch(), consecutive untextured meshes
+    // drawn with the same state may be merged into a single draw call. GL
+    // state may only be changed through the RenderEngine in the meantime.
+    virtual void beginBatch() { }
+    virtual void endBatch() { }
+
+    // GPU timing of client composition (debug.sf.gpu_timing). The GPU time
+    // of the commands issued between beginGpuTimer() and endGpuTimer() is
+    // accounted to the given display once the GPU is done with them.
+    // Timers can't be nested.
+    virtual void beginGpuTimer(int32_t /* displayId */) { }
+    virtual void endGpuTimer() { }
+    virtual void dumpGpuTimings(String8& result);
+
     // queries
     virtual size_t getMaxTextureSize() const = 0;
     virtual size_t getMaxViewportDims() const = 0;
@@ -0,0 +1,135 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "ScreenshotBufferPool"
+#define ATRACE_TAG ATRACE_TAG_GRAPHICS
+
+#include <inttypes.h>
+
+#include <utils/Log.h>
+#include <utils/String8.h>
+#include <utils/Trace.h>
+
+#include "ScreenshotBufferPool.h"
+
+namespace android {
+
+ScreenshotBufferPool::ScreenshotBufferPool()
+  : mEntries(),
+    mNumAllocated(0),
+    mNumRecycled(0),
+    mNumEvictedInUse(0) {
+    mEntries.reserve(MAX_BUFFERS);
+}
+
+sp<GraphicBuffer> ScreenshotBufferPool::acquire(uint32_t width,
+        uint32_t height, PixelFormat format, uint32_t usage) {
+    ATRACE_CALL();
+    Mutex::Autolock lock(mMutex);
+    const nsecs_t now = systemTime();
+
+    for (auto& entry : mEntries) {
+        const sp<GraphicBuffer>& buffer(entry.buffer);
+        if (entry.inUse || buffer->getWidth() != width ||
+                buffer->getHeight() != height ||
+                buffer->getPixelFormat() != format ||
+                (buffer->getUsage() & usage) != usage) {
+            continue;
+        }
+        // The client may still be reading from it
+        if (entry.releaseFence->getSignalTime() == Fence::SIGNAL_TIME_PENDING) {
+            continue;
+        }
+        entry.inUse = true;
+        entry.releaseFence = Fence::NO_FENCE;
+        entry.lastUsed = now;
+        mNumRecycled++;
+        return buffer;
+    }
+
+    sp<GraphicBuffer> buffer = new GraphicBuffer(width, height, format, usage,
+            "ScreenshotBufferPool");
+    if (buffer->initCheck() != NO_ERROR) {
+        ALOGE("acquire: failed to allocate %ux%u buffer", width, height);
+        return nullptr;
+    }
+    mNumAllocated++;
+
+    Entry entry;
+    entry.buffer = buffer;
+    entry.releaseFence = Fence::NO_FENCE;
+    entry.inUse = true;
+    entry.lastUsed = now;
+    if (mEntries.size() < MAX_BUFFERS) {
+        mEntries.push_back(entry);
+    } else {
+        // Clients holding on to an evicted buffer keep it alive, it simply
+        // won't come back to the pool.
+        const size_t victim = pickVictimLocked();
+        if (mEntries[victim].inUse) {
+            mNumEvictedInUse++;
+        }
+        mEntries[victim] = entry;
+    }
+    return buffer;
+}
+
+size_t ScreenshotBufferPool::pickVictimLocked() const {
+    // Least recently used free buffer first, then least recently used one
+    size_t victim = 0;
+    for (size_t i = 1; i < mEntries.size(); i++) {
+        const Entry& candidate(mEntries[i]);
+        const Entry& current(mEntries[victim]);
+        if (candidate.inUse != current.inUse) {
+            if (!candidate.inUse) {
+                victim = i;
+            }
+        } else if (candidate.lastUsed < current.lastUsed) {
+            victim = i;
+        }
+    }
+    return victim;
+}
+
+void ScreenshotBufferPool::release(uint64_t bufferId,
+        const sp<Fence>& releaseFence) {
+    Mutex::Autolock lock(mMutex);
+    for (auto& entry : mEntries) {
+        if (entry.buffer->getId() == bufferId) {
+            ALOGW_IF(!entry.inUse, "release: buffer %" PRIu64 " isn't in use",
+                    bufferId);
+            entry.inUse = false;
+            entry.releaseFence = releaseFence != nullptr ?
+                    releaseFence : Fence::NO_FENCE;
+            return;
+        }
+    }
+    ALOGV("release: buffer %" PRIu64 " isn't in the pool", bufferId);
+}
+
+void ScreenshotBufferPool::dump(String8& result) const {
+    Mutex::Autolock lock(mMutex);
+    result.appendFormat("Screenshot buffer pool: %zu buffers, %" PRIu64
+            " allocated, %" PRIu64 " recycled, %" PRIu64 " evicted in use\n",
+            mEntries.size(), mNumAllocated, mNumRecycled, mNumEvictedInUse);
+    for (const auto& entry : mEntries) {
+        result.appendFormat("  %" PRIu64 ": %ux%u %s\n",
+                entry.buffer->getId(), entry.buffer->getWidth(),
+                entry.buffer->getHeight(), entry.inUse ? "in use" : "free");
+    }
+}
+
+}; // namespace android
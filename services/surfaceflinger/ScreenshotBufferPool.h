@@ -0,0 +1,74 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SCREENSHOTBUFFERPOOL_H
+#define ANDROID_SCREENSHOTBUFFERPOOL_H
+
+#include <ui/Fence.h>
+#include <ui/GraphicBuffer.h>
+#include <ui/PixelFormat.h>
+
+#include <utils/Mutex.h>
+#include <utils/StrongPointer.h>
+#include <utils/Timers.h>
+
+#include <vector>
+
+namespace android {
+
+class String8;
+
+// ScreenshotBufferPool recycles the buffers handed out by
+// SurfaceFlinger::captureScreenToBuffer. A buffer goes back to the pool when
+// its client calls ISurfaceComposer::releaseCaptureBuffer, and is only reused
+// once the release fence it came back with has signaled.
+class ScreenshotBufferPool {
+public:
+    // Maximum number of buffers kept around, in use or not
+    enum { MAX_BUFFERS = 4 };
+
+    ScreenshotBufferPool();
+
+    // Returns a buffer with the given geometry, or nullptr if the allocation
+    // failed. The buffer is marked in use until release() is called with its
+    // id.
+    sp<GraphicBuffer> acquire(uint32_t width, uint32_t height,
+            PixelFormat format, uint32_t usage);
+
+    void release(uint64_t bufferId, const sp<Fence>& releaseFence);
+
+    void dump(String8& result) const;
+
+private:
+    struct Entry {
+        sp<GraphicBuffer> buffer;
+        sp<Fence> releaseFence;
+        bool inUse;
+        nsecs_t lastUsed;
+    };
+
+    size_t pickVictimLocked() const;
+
+    mutable Mutex mMutex;
+    std::vector<Entry> mEntries;
+    uint64_t mNumAllocated;
+    uint64_t mNumRecycled;
+    uint64_t mNumEvictedInUse;
+};
+
+}; // namespace android
+
+#endif // ANDROID_SCREENSHOTBUFFERPOOL_H
@@ -20,11 +20,15 @@
 #include <stdint.h>
 #include <sys/types.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <math.h>
+#include <algorithm>
 #include <mutex>
+#include <thread>
 #include <dlfcn.h>
 #include <inttypes.h>
 #include <stdatomic.h>
+#include <unistd.h>
 
 #include <EGL/egl.h>
 
@@ -42,6 +46,7 @@
 #include <ui/DisplayStatInfo.h>
 
 #include <gui/BufferQueue.h>
+#include <gui/GraphicBufferPool.h>
 #include <gui/GuiConfig.h>
 #include <gui/IDisplayEventConnection.h>
 #include <gui/Surface.h>
@@ -126,8 +131,11 @@ SurfaceFlinger::SurfaceFlinger()
         mTransactionFlags(0),
         mTransactionPending(false),
         mAnimTransactionPending(false),
+        mHasPublishedStates(false),
+        mCoalesceTransactions(false),
         mLayersRemoved(false),
         mLayersAdded(false),
+        mLayerTreeChanged(false),
         mRepaintEverything(0),
         mHwc(nullptr),
         mRealHwc(nullptr),
@@ -136,6 +144,8 @@ SurfaceFlinger::SurfaceFlinger()
         mBootTime(systemTime()),
         mBuiltinDisplays(),
         mVisibleRegionsDirty(false),
+        mLayerVisibleRegionsDirty(false),
+        mIncrementalVisibleRegions(false),
         mGeometryInvalid(false),
         mAnimCompositionPending(false),
         mDebugRegion(0),
@@ -158,6 +168,8 @@ SurfaceFlinger::SurfaceFlinger()
         mTotalTime(0),
         mLastSwapTime(0),
         mNumLayers(0),
+        mInitStartTime(0),
+        mFirstFrameReported(false),
         mVrFlingerRequestsDisplay(false)
 {
     ALOGI("SurfaceFlinger is starting");
@@ -199,9 +211,25 @@ SurfaceFlinger::SurfaceFlinger()
     property_get("ro.bq.gpu_to_cpu_unsupported", value, "0");
     mGpuToCpuSupported = !atoi(value);
 
+    // The low latency channel defaults to SurfaceFlinger's own phase so
+    // that a frame queued right after vsync is latched the same period,
+    // the late channel to half a 60Hz period after the app phase
+    property_get("debug.sf.low_latency_vsync_offset_ns", value, "");
+    mLowLatencyVsyncPhaseOffsetNs = value[0] ? atoll(value) : sfVsyncPhaseOffsetNs;
+    property_get("debug.sf.late_vsync_offset_ns", value, "");
+    mLateVsyncPhaseOffsetNs = value[0] ? atoll(value) : vsyncPhaseOffsetNs + 8333333;
+
     property_get("debug.sf.showupdates", value, "0");
     mDebugRegion = atoi(value);
 
+    property_get("debug.sf.incremental_vis_regions", value, "0");
+    mIncrementalVisibleRegions = atoi(value);
+    ALOGI_IF(mIncrementalVisibleRegions, "Incremental visible regions enabled");
+
+    property_get("debug.sf.coalesce_transactions", value, "0");
+    mCoalesceTransactions = atoi(value);
+    ALOGI_IF(mCoalesceTransactions, "Transaction coalescing enabled");
+
     property_get("debug.sf.ddms", value, "0");
     mDebugDDMS = atoi(value);
     if (mDebugDDMS) {
@@ -217,6 +245,41 @@ SurfaceFlinger::SurfaceFlinger()
     mPropagateBackpressure = !atoi(value);
     ALOGI_IF(!mPropagateBackpressure, "Disabling backpressure propagation");
 
+    property_get("debug.sf.present_displays_early", value, "0");
+    mPresentDisplaysEarly = atoi(value);
+    ALOGI_IF(mPresentDisplaysEarly, "Presenting displays as soon as they are composed");
+
+    property_get("debug.sf.partial_client_composition", value, "0");
+    mPartialClientComposition = atoi(value);
+    ALOGI_IF(mPartialClientComposition, "Partial client composition enabled");
+
+    property_get("debug.sf.layer_flattening", value, "0");
+    mLayerFlattening = atoi(value);
+    ALOGI_IF(mLayerFlattening, "Layer flattening enabled");
+    ALOGW_IF(mLayerFlattening && !mPartialClientComposition,
+            "Layer flattening without partial client composition redraws "
+            "the flattened layers every frame");
+
+    property_get("debug.sf.predictive_latch_budget_us", value, "0");
+    mPredictiveLatchBudget = us2ns(atoi(value));
+    ALOGI_IF(mPredictiveLatchBudget > 0, "Predictive latching enabled (%d us)",
+            atoi(value));
+
+    property_get("debug.sf.refresh_rate_switching", value, "0");
+    mRefreshRateSwitching = atoi(value);
+    property_get("debug.sf.refresh_rate_idle_timer_ms", value, "300");
+    mRefreshRateIdleTimeout = ms2ns(atoi(value));
+    ALOGI_IF(mRefreshRateSwitching, "Refresh rate switching enabled (idle after %d ms)",
+            atoi(value));
+
+    property_get("debug.sf.gralloc_app_budget_kb", value, "0");
+    int appBudgetKb = atoi(value);
+    if (appBudgetKb > 0) {
+        GraphicBufferAllocator::get().setDefaultUidBudget(
+                static_cast<size_t>(appBudgetKb) * 1024);
+        ALOGI("Graphics memory capped at %d KiB per app", appBudgetKb);
+    }
+
     property_get("debug.sf.enable_hwc_vds", value, "0");
     mUseHwcVirtualDisplays = atoi(value);
     ALOGI_IF(!mUseHwcVirtualDisplays, "Enabling HWC virtual displays");
@@ -383,7 +446,8 @@ void SurfaceFlinger::deleteTextureAsync(uint32_t texture) {
             return true;
         }
     };
-    postMessageAsync(new MessageDestroyGLTexture(getRenderEngine(), texture));
+    postMessageAsync(new MessageDestroyGLTexture(getRenderEngine(), texture), 0,
+            MessageQueue::DEFERRABLE);
 }
 
 class DispSyncSource : public VSyncSource, private DispSync::Callback {
@@ -532,6 +596,22 @@ void SurfaceFlinger::init() {
 
     ALOGI("Phase offest NS: %" PRId64 "", vsyncPhaseOffsetNs);
 
+    mInitStartTime = systemTime();
+
+    // Connecting to the composer service may have to wait for it to start, do
+    // it while EGL, the EventThreads and the RenderEngine are set up. The
+    // HWComposer doesn't call back into SurfaceFlinger until it has an event
+    // handler, which is only set once the thread is joined.
+    LOG_ALWAYS_FATAL_IF(mVrFlingerRequestsDisplay,
+        "Starting with vr flinger active is not currently supported.");
+    HWComposer* hwc = nullptr;
+    nsecs_t hwcConnectionTime = 0;
+    std::thread hwcThread([&hwc, &hwcConnectionTime]() {
+        const nsecs_t start = systemTime();
+        hwc = new HWComposer(false);
+        hwcConnectionTime = systemTime() - start;
+    });
+
     { // Autolock scope
         Mutex::Autolock _l(mStateLock);
 
@@ -548,6 +628,15 @@ void SurfaceFlinger::init() {
         mSFEventThread = new EventThread(sfVsyncSrc, *this, true);
         mEventQueue.setEventThread(mSFEventThread);
 
+        // Channels without any listener leave their DispSync listener
+        // disabled and sleep, so they don't cost any wakeup
+        sp<VSyncSource> lowLatencyVsyncSrc = new DispSyncSource(&mPrimaryDispSync,
+                mLowLatencyVsyncPhaseOffsetNs, true, "app-lowlatency");
+        mLowLatencyEventThread = new EventThread(lowLatencyVsyncSrc, *this, false);
+        sp<VSyncSource> lateVsyncSrc = new DispSyncSource(&mPrimaryDispSync,
+                mLateVsyncPhaseOffsetNs, true, "app-late");
+        mLateEventThread = new EventThread(lateVsyncSrc, *this, false);
+
         // set EventThread and SFEventThread to SCHED_FIFO to minimize jitter
         struct sched_param param = {0};
         param.sched_priority = 2;
@@ -557,18 +646,26 @@ void SurfaceFlinger::init() {
         if (sched_setscheduler(mEventThread->getTid(), SCHED_FIFO, &param) != 0) {
             ALOGE("Couldn't set SCHED_FIFO for EventThread");
         }
+        if (sched_setscheduler(mLowLatencyEventThread->getTid(), SCHED_FIFO, &param) != 0) {
+            ALOGE("Couldn't set SCHED_FIFO for LowLatencyEventThread");
+        }
 
         // Get a RenderEngine for the given display / config (can't fail)
         mRenderEngine = RenderEngine::create(mEGLDisplay,
                 HAL_PIXEL_FORMAT_RGBA_8888);
+
+        // Compile the shaders while we wait for the composer
+        mRenderEngine->primeCacheAsync();
     }
 
+    const nsecs_t hwcWaitStart = systemTime();
+    hwcThread.join();
+    const nsecs_t hwcWaitTime = systemTime() - hwcWaitStart;
+
     // Drop the state lock while we initialize the hardware composer. We drop
-    // the lock because on creation, it will call back into SurfaceFlinger to
-    // initialize the primary display.
-    LOG_ALWAYS_FATAL_IF(mVrFlingerRequestsDisplay,
-        "Starting with vr flinger active is not currently supported.");
-    mRealHwc = new HWComposer(false);
+    // the lock because once it has an event handler, it will call back into
+    // SurfaceFlinger to initialize the primary display.
+    mRealHwc = hwc;
     mHwc = mRealHwc;
     mHwc->setEventHandler(static_cast<HWComposer::EventHandler*>(this));
 
@@ -614,13 +711,17 @@ void SurfaceFlinger::init() {
     // set initial conditions (e.g. unblank default device)
     initializeDisplays();
 
-    mRenderEngine->primeCache();
+    mRenderEngine->waitForPrimedCache();
 
     mStartBootAnimThread = new StartBootAnimThread();
     if (mStartBootAnimThread->Start() != NO_ERROR) {
         ALOGE("Run StartBootAnimThread failed!");
     }
 
+    ALOGI("SurfaceFlinger initialized in %.2f ms (composer connection took %.2f ms, "
+            "%.2f ms of which not overlapped with the rest of init)",
+            (systemTime() - mInitStartTime) / 1e6, hwcConnectionTime / 1e6,
+            hwcWaitTime / 1e6);
     ALOGV("Done initializing");
 }
 
@@ -834,6 +935,14 @@ void SurfaceFlinger::setActiveConfigInternal(const sp<DisplayDevice>& hw, int mo
 
     hw->setActiveConfig(mode);
     getHwComposer().setActiveConfig(type, mode);
+
+    if (type == DisplayDevice::DISPLAY_PRIMARY) {
+        // DispSync still models the old period, resync so that EventThread
+        // keeps firing at the right time
+        const nsecs_t period = getHwComposer().getActiveConfig(type)->getVsyncPeriod();
+        resyncToHardwareVsync(false);
+        mAnimFrameTracker.setDisplayRefreshPeriod(period);
+    }
 }
 
 status_t SurfaceFlinger::setActiveConfig(const sp<IBinder>& display, int mode) {
@@ -1033,14 +1142,63 @@ status_t SurfaceFlinger::injectVSync(nsecs_t when) {
     return NO_ERROR;
 }
 
+status_t SurfaceFlinger::getFrameTimeline(int* outFd) {
+    if (outFd == nullptr) {
+        return BAD_VALUE;
+    }
+    *outFd = mFrameTimeline.dupFd();
+    return *outFd >= 0 ? NO_ERROR : NO_INIT;
+}
+
+status_t SurfaceFlinger::getLayerPropertyBlock(
+        const sp<ISurfaceComposerClient>& client,
+        const sp<IBinder>& handle, int* outFd) {
+    if (outFd == nullptr) {
+        return BAD_VALUE;
+    }
+    // Same check as in setTransactionState, the layer must belong to client
+    sp<IBinder> binder = IInterface::asBinder(client);
+    if (binder == NULL || binder->queryLocalInterface(
+            ISurfaceComposerClient::descriptor) == NULL) {
+        return BAD_VALUE;
+    }
+    sp<Layer> layer(static_cast<Client*>(client.get())->getLayerUser(handle));
+    if (layer == NULL) {
+        return NAME_NOT_FOUND;
+    }
+
+    Mutex::Autolock _l(mStateLock);
+    const int fd = layer->getPropertyBlockFd();
+    if (fd < 0) {
+        return NO_INIT;
+    }
+    *outFd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (*outFd < 0) {
+        ALOGE("getLayerPropertyBlock failed to dup fd: %s", strerror(errno));
+        return -errno;
+    }
+    return NO_ERROR;
+}
+
+void SurfaceFlinger::signalLayerPropertyBlocks() {
+    if (mNumLayerPropertyBlocks > 0) {
+        signalLayerUpdate();
+    }
+}
+
 // ----------------------------------------------------------------------------
 
 sp<IDisplayEventConnection> SurfaceFlinger::createDisplayEventConnection(
         ISurfaceComposer::VsyncSource vsyncSource) {
-    if (vsyncSource == eVsyncSourceSurfaceFlinger) {
-        return mSFEventThread->createEventConnection();
-    } else {
-        return mEventThread->createEventConnection();
+    switch (vsyncSource) {
+        case eVsyncSourceSurfaceFlinger:
+            return mSFEventThread->createEventConnection();
+        case eVsyncSourceLowLatency:
+            return mLowLatencyEventThread->createEventConnection();
+        case eVsyncSourceLate:
+            return mLateEventThread->createEventConnection();
+        default:
+            return mEventThread->createEventConnection();
     }
 }
 
@@ -1063,13 +1221,13 @@ void SurfaceFlinger::signalRefresh() {
 }
 
 status_t SurfaceFlinger::postMessageAsync(const sp<MessageBase>& msg,
-        nsecs_t reltime, uint32_t /* flags */) {
-    return mEventQueue.postMessage(msg, reltime);
+        nsecs_t reltime, uint32_t flags) {
+    return mEventQueue.postMessage(msg, reltime, flags);
 }
 
 status_t SurfaceFlinger::postMessageSync(const sp<MessageBase>& msg,
-        nsecs_t reltime, uint32_t /* flags */) {
-    status_t res = mEventQueue.postMessage(msg, reltime);
+        nsecs_t reltime, uint32_t flags) {
+    status_t res = mEventQueue.postMessage(msg, reltime, flags);
     if (res == NO_ERROR) {
         msg->wait();
     }
@@ -1354,6 +1512,15 @@ void SurfaceFlinger::onMessageReceived(int32_t what) {
                 break;
             }
 
+            if (mPredictiveLatchBudget > 0 && !mInvalidateDeferred) {
+                const nsecs_t delay = computePredictiveLatchDelay();
+                if (delay > 0) {
+                    deferInvalidate(delay);
+                    break;
+                }
+            }
+            mInvalidateDeferred = false;
+
             // Now that we're going to make it to the handleMessageTransaction()
             // call below it's safe to call updateVrFlinger(), which will
             // potentially trigger a display handoff.
@@ -1378,6 +1545,21 @@ void SurfaceFlinger::onMessageReceived(int32_t what) {
 }
 
 bool SurfaceFlinger::handleMessageTransaction() {
+    if (mCoalesceTransactions) {
+        Mutex::Autolock _l(mStateLock);
+        const uint32_t queuedFlags = applyQueuedTransactionsLocked();
+        if (queuedFlags) {
+            // No need to signalTransaction(), we're handling it right now
+            android_atomic_or(queuedFlags, &mTransactionFlags);
+        }
+    }
+    if (mNumLayerPropertyBlocks > 0) {
+        Mutex::Autolock _l(mStateLock);
+        const uint32_t blockFlags = applyLayerPropertyBlocksLocked();
+        if (blockFlags) {
+            android_atomic_or(blockFlags, &mTransactionFlags);
+        }
+    }
     uint32_t transactionFlags = peekTransactionFlags();
     if (transactionFlags) {
         handleTransaction(transactionFlags);
@@ -1412,7 +1594,25 @@ void SurfaceFlinger::handleMessageRefresh() {
                 mHwc->hasClientComposition(displayDevice->getHwcDisplayId());
     }
 
+    if (mRefreshRateSwitching) {
+        updateRefreshRate();
+    }
+
     mLayersWithQueuedFrames.clear();
+
+    runDeferredMessages();
+}
+
+void SurfaceFlinger::runDeferredMessages() {
+    const nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    const nsecs_t period = mPrimaryDispSync.getPeriod();
+    nsecs_t nextWakeup = mPrimaryDispSync.computeNextRefresh(0) + sfVsyncPhaseOffsetNs;
+    while (nextWakeup <= now) {
+        nextWakeup += period;
+    }
+    // Leave some slack for the wakeup itself and for the message that
+    // might overrun
+    mEventQueue.runDeferredMessages(nextWakeup - period / 4);
 }
 
 void SurfaceFlinger::doDebugFlashRegions()
@@ -1537,6 +1737,12 @@ void SurfaceFlinger::setCompositorTimingSnapped(nsecs_t vsyncPhase,
 
 void SurfaceFlinger::postComposition(nsecs_t refreshStartTime)
 {
+    if (!mFirstFrameReported) {
+        mFirstFrameReported = true;
+        ALOGI("First frame composited %.2f ms after SurfaceFlinger init started",
+                (systemTime() - mInitStartTime) / 1e6);
+    }
+
     ATRACE_CALL();
     ALOGV("postComposition");
 
@@ -1557,12 +1763,18 @@ void SurfaceFlinger::postComposition(nsecs_t refreshStartTime)
     } else {
         glCompositionDoneFenceTime = FenceTime::NO_FENCE;
     }
-    mGlCompositionDoneTimeline.updateSignalTimes();
 
     sp<Fence> presentFence = mHwc->getPresentFence(HWC_DISPLAY_PRIMARY);
     auto presentFenceTime = std::make_shared<FenceTime>(presentFence);
     mDisplayTimeline.push(presentFenceTime);
-    mDisplayTimeline.updateSignalTimes();
+
+    // Query the fences of every timeline in one go, see FenceTimeline::Batch
+    mFenceTimelineBatch.add(&mGlCompositionDoneTimeline);
+    mFenceTimelineBatch.add(&mDisplayTimeline);
+    mDrawingState.traverseInZOrder([&](Layer* layer) {
+        layer->addFenceTimelines(&mFenceTimelineBatch);
+    });
+    mFenceTimelineBatch.updateSignalTimes();
 
     nsecs_t vsyncPhase = mPrimaryDispSync.computeNextRefresh(0);
     nsecs_t vsyncInterval = mPrimaryDispSync.getPeriod();
@@ -1586,6 +1798,7 @@ void SurfaceFlinger::postComposition(nsecs_t refreshStartTime)
                     layer->getOccupancyHistory(false));
         }
     });
+    mFrameTimeline.flush(systemTime());
 
     if (presentFence->isValid()) {
         if (mPrimaryDispSync.addPresentFence(presentFence)) {
@@ -1642,9 +1855,16 @@ void SurfaceFlinger::rebuildLayerStacks() {
     ALOGV("rebuildLayerStacks");
 
     // rebuild the visible layer list per screen
-    if (CC_UNLIKELY(mVisibleRegionsDirty)) {
+    if (CC_UNLIKELY(mVisibleRegionsDirty || mLayerVisibleRegionsDirty)) {
         ATRACE_CALL();
+        // Only the layers flagged visibleRegionDirty changed, everything else
+        // can be taken from the previous computation.
+        const bool incremental = mIncrementalVisibleRegions && !mVisibleRegionsDirty;
         mVisibleRegionsDirty = false;
+        mLayerVisibleRegionsDirty = false;
+        mVisibleRegionStats.lastComputed = 0;
+        mVisibleRegionStats.lastSkipped = 0;
+        mVisibleRegionStats.numPasses++;
         invalidateHwcGeometry();
 
         for (size_t dpy=0 ; dpy<mDisplays.size() ; dpy++) {
@@ -1657,7 +1877,7 @@ void SurfaceFlinger::rebuildLayerStacks() {
             if (displayDevice->isDisplayOn()) {
                 computeVisibleRegions(
                         displayDevice->getLayerStack(), dirtyRegion,
-                        opaqueRegion);
+                        opaqueRegion, incremental);
 
                 mDrawingState.traverseInZOrder([&](Layer* layer) {
                     if (layer->getLayerStack() == displayDevice->getLayerStack()) {
@@ -1687,6 +1907,12 @@ void SurfaceFlinger::rebuildLayerStacks() {
                     tr.transform(opaqueRegion));
             displayDevice->dirtyRegion.orSelf(dirtyRegion);
         }
+
+        // Children are traversed after their parent when their z is negative,
+        // so the flags can only be dropped once every layer stack is done.
+        mDrawingState.traverseInZOrder([](Layer* layer) {
+            layer->visibleRegionDirty = false;
+        });
     }
 }
 
@@ -1756,6 +1982,19 @@ void SurfaceFlinger::setUpHWComposer() {
         }
     }
 
+    // Decide which stable background layers go to the client target. The
+    // forced composition types are only applied with the geometry.
+    if (mLayerFlattening) {
+        const nsecs_t now = systemTime();
+        for (size_t dpy=0 ; dpy<mDisplays.size() ; dpy++) {
+            const auto hwcId = mDisplays[dpy]->getHwcDisplayId();
+            if (hwcId >= 0 && mLayerFlatteningPolicy.update(hwcId,
+                    mDisplays[dpy]->getVisibleLayersSortedByZ(), now)) {
+                mGeometryInvalid = true;
+            }
+        }
+    }
+
     // build the h/w work list
     if (CC_UNLIKELY(mGeometryInvalid)) {
         mGeometryInvalid = false;
@@ -1765,6 +2004,8 @@ void SurfaceFlinger::setUpHWComposer() {
             if (hwcId >= 0) {
                 const Vector<sp<Layer>>& currentLayers(
                         displayDevice->getVisibleLayersSortedByZ());
+                const size_t numFlattened = mLayerFlattening ?
+                        mLayerFlatteningPolicy.getNumFlattened(hwcId) : 0;
                 for (size_t i = 0; i < currentLayers.size(); i++) {
                     const auto& layer = currentLayers[i];
                     if (!layer->hasHwcLayer(hwcId)) {
@@ -1778,7 +2019,7 @@ void SurfaceFlinger::setUpHWComposer() {
                     }
 
                     layer->setGeometry(displayDevice, i);
-                    if (mDebugDisableHWC || mDebugRegion) {
+                    if (mDebugDisableHWC || mDebugRegion || i < numFlattened) {
                         layer->forceClientComposition(hwcId);
                     }
                 }
@@ -1841,58 +2082,96 @@ void SurfaceFlinger::doComposition() {
     ALOGV("doComposition");
 
     const bool repaintEverything = android_atomic_and(0, &mRepaintEverything);
+    if (CC_UNLIKELY(mPresentDisplaysEarly)) {
+        // Compose and present each display before moving on to the next one,
+        // built-in displays first, so that the GLES composition of a virtual
+        // display no longer sits on the critical path of the built-in panel.
+        const nsecs_t startTime = beginPostFramebuffer();
+        for (bool virtualDisplays : {false, true}) {
+            for (size_t dpy=0 ; dpy<mDisplays.size() ; dpy++) {
+                const sp<DisplayDevice>& hw(mDisplays[dpy]);
+                const bool isVirtual =
+                        hw->getDisplayType() >= DisplayDevice::DISPLAY_VIRTUAL;
+                if (isVirtual != virtualDisplays || !hw->isDisplayOn()) {
+                    continue;
+                }
+                composeDisplay(hw, repaintEverything);
+                postFramebufferForDisplay(hw);
+            }
+        }
+        endPostFramebuffer(startTime);
+        return;
+    }
+
     for (size_t dpy=0 ; dpy<mDisplays.size() ; dpy++) {
         const sp<DisplayDevice>& hw(mDisplays[dpy]);
         if (hw->isDisplayOn()) {
-            // transform the dirty region into this screen's coordinate space
-            const Region dirtyRegion(hw->getDirtyRegion(repaintEverything));
-
-            // repaint the framebuffer (if needed)
-            doDisplayComposition(hw, dirtyRegion);
-
-            hw->dirtyRegion.clear();
-            hw->flip(hw->swapRegion);
-            hw->swapRegion.clear();
+            composeDisplay(hw, repaintEverything);
         }
     }
     postFramebuffer();
 }
 
+void SurfaceFlinger::composeDisplay(const sp<DisplayDevice>& hw,
+        bool repaintEverything) {
+    // transform the dirty region into this screen's coordinate space
+    const Region dirtyRegion(hw->getDirtyRegion(repaintEverything));
+
+    // repaint the framebuffer (if needed)
+    doDisplayComposition(hw, dirtyRegion);
+
+    hw->dirtyRegion.clear();
+    hw->flip(hw->swapRegion);
+    hw->swapRegion.clear();
+}
+
 void SurfaceFlinger::postFramebuffer()
 {
     ATRACE_CALL();
     ALOGV("postFramebuffer");
 
-    const nsecs_t now = systemTime();
-    mDebugInSwapBuffers = now;
-
+    const nsecs_t startTime = beginPostFramebuffer();
     for (size_t displayId = 0; displayId < mDisplays.size(); ++displayId) {
         auto& displayDevice = mDisplays[displayId];
         if (!displayDevice->isDisplayOn()) {
             continue;
         }
-        const auto hwcId = displayDevice->getHwcDisplayId();
-        if (hwcId >= 0) {
-            mHwc->presentAndGetReleaseFences(hwcId);
-        }
-        displayDevice->onSwapBuffersCompleted();
-        displayDevice->makeCurrent(mEGLDisplay, mEGLContext);
-        for (auto& layer : displayDevice->getVisibleLayersSortedByZ()) {
-            sp<Fence> releaseFence = Fence::NO_FENCE;
-            if (layer->getCompositionType(hwcId) == HWC2::Composition::Client) {
-                releaseFence = displayDevice->getClientTargetAcquireFence();
-            } else {
-                auto hwcLayer = layer->getHwcLayer(hwcId);
-                releaseFence = mHwc->getLayerReleaseFence(hwcId, hwcLayer);
-            }
-            layer->onLayerDisplayed(releaseFence);
-        }
-        if (hwcId >= 0) {
-            mHwc->clearReleaseFences(hwcId);
+        postFramebufferForDisplay(displayDevice);
+    }
+    endPostFramebuffer(startTime);
+}
+
+nsecs_t SurfaceFlinger::beginPostFramebuffer() {
+    const nsecs_t now = systemTime();
+    mDebugInSwapBuffers = now;
+    return now;
+}
+
+void SurfaceFlinger::postFramebufferForDisplay(
+        const sp<DisplayDevice>& displayDevice) {
+    const auto hwcId = displayDevice->getHwcDisplayId();
+    if (hwcId >= 0) {
+        mHwc->presentAndGetReleaseFences(hwcId);
+    }
+    displayDevice->onSwapBuffersCompleted();
+    displayDevice->makeCurrent(mEGLDisplay, mEGLContext);
+    for (auto& layer : displayDevice->getVisibleLayersSortedByZ()) {
+        sp<Fence> releaseFence = Fence::NO_FENCE;
+        if (layer->getCompositionType(hwcId) == HWC2::Composition::Client) {
+            releaseFence = displayDevice->getClientTargetAcquireFence();
+        } else {
+            auto hwcLayer = layer->getHwcLayer(hwcId);
+            releaseFence = mHwc->getLayerReleaseFence(hwcId, hwcLayer);
         }
+        layer->onLayerDisplayed(releaseFence);
+    }
+    if (hwcId >= 0) {
+        mHwc->clearReleaseFences(hwcId);
     }
+}
 
-    mLastSwapBufferTime = systemTime() - now;
+void SurfaceFlinger::endPostFramebuffer(nsecs_t startTime) {
+    mLastSwapBufferTime = systemTime() - startTime;
     mDebugInSwapBuffers = 0;
 
     // |mStateLock| not needed as we are on the main thread
@@ -1943,14 +2222,27 @@ void SurfaceFlinger::handleTransactionLocked(uint32_t transactionFlags)
      * (perform the transaction for each of them if needed)
      */
 
+    if (transactionFlags & eTransactionNeeded) {
+        // The layer list itself may have changed (z-order, layer stack,
+        // reparenting...), so cached visible regions can't be trusted.
+        mVisibleRegionsDirty = true;
+        mLayerTreeChanged = true;
+    }
+
     if (transactionFlags & eTraversalNeeded) {
         mCurrentState.traverseInZOrder([&](Layer* layer) {
             uint32_t trFlags = layer->getTransactionFlags(eTransactionNeeded);
             if (!trFlags) return;
 
             const uint32_t flags = layer->doTransaction(0);
-            if (flags & Layer::eVisibleRegion)
-                mVisibleRegionsDirty = true;
+            if (flags & Layer::eVisibleRegion) {
+                layer->visibleRegionDirty = true;
+                mLayerVisibleRegionsDirty = true;
+            }
+            if (flags & Layer::eLayerTreeChanged) {
+                // e.g. a deferred z change was just applied
+                mLayerTreeChanged = true;
+            }
         });
     }
 
@@ -1986,8 +2278,11 @@ void SurfaceFlinger::handleTransactionLocked(uint32_t transactionFlags)
                         sp<DisplayDevice> hw(getDisplayDeviceLocked(draw.keyAt(i)));
                         if (hw != NULL)
                             hw->disconnect(getHwComposer());
-                        if (draw[i].type < DisplayDevice::NUM_BUILTIN_DISPLAY_TYPES)
+                        if (draw[i].type < DisplayDevice::NUM_BUILTIN_DISPLAY_TYPES) {
                             mEventThread->onHotplugReceived(draw[i].type, false);
+                            mLowLatencyEventThread->onHotplugReceived(draw[i].type, false);
+                            mLateEventThread->onHotplugReceived(draw[i].type, false);
+                        }
                         mDisplays.removeItem(draw.keyAt(i));
                     } else {
                         ALOGW("trying to remove the main display");
@@ -2045,6 +2340,7 @@ void SurfaceFlinger::handleTransactionLocked(uint32_t transactionFlags)
                     BufferQueue::createBufferQueue(&bqProducer, &bqConsumer);
 
                     int32_t hwcId = -1;
+                    int32_t hwcOutputFormat = HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED;
                     if (state.isVirtualDisplay()) {
                         // Virtual displays without a surface are dormant:
                         // they have external state (layer stack, projection,
@@ -2073,14 +2369,36 @@ void SurfaceFlinger::handleTransactionLocked(uint32_t transactionFlags)
 
                                 mHwc->allocateVirtualDisplay(width, height, &format,
                                         &hwcId);
-                            }
 
-                            // TODO: Plumb requested format back up to consumer
+                                // h/w composer may pick another format to write
+                                // the output in. That's only fine if the consumer
+                                // doesn't read the buffers with the CPU, otherwise
+                                // fall back to GLES composition.
+                                int usage = 0;
+                                state.surface->query(
+                                        NATIVE_WINDOW_CONSUMER_USAGE_BITS, &usage);
+                                if (hwcId >= 0 && format != intFormat &&
+                                        (usage & (GRALLOC_USAGE_SW_READ_MASK |
+                                                GRALLOC_USAGE_SW_WRITE_MASK))) {
+                                    ALOGW("HWC can't write format %d to virtual "
+                                            "display %s, using GLES", intFormat,
+                                            state.displayName.string());
+                                    mHwc->disconnectDisplay(hwcId);
+                                    hwcId = -1;
+                                } else if (hwcId >= 0 && format != intFormat) {
+                                    hwcOutputFormat = format;
+                                }
+                            }
 
                             sp<VirtualDisplaySurface> vds =
                                     new VirtualDisplaySurface(*mHwc,
                                             hwcId, state.surface, bqProducer,
                                             bqConsumer, state.displayName);
+                            if (hwcOutputFormat != HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED) {
+                                // Let h/w composer write straight into the sink
+                                // buffers in the format it asked for
+                                vds->setHwcOutputFormat(hwcOutputFormat);
+                            }
 
                             dispSurface = vds;
                             producer = vds;
@@ -2110,6 +2428,8 @@ void SurfaceFlinger::handleTransactionLocked(uint32_t transactionFlags)
                         mDisplays.add(display, hw);
                         if (!state.isVirtualDisplay()) {
                             mEventThread->onHotplugReceived(state.type, true);
+                            mLowLatencyEventThread->onHotplugReceived(state.type, true);
+                            mLateEventThread->onHotplugReceived(state.type, true);
                         }
                     }
                 }
@@ -2187,6 +2507,7 @@ void SurfaceFlinger::handleTransactionLocked(uint32_t transactionFlags)
         mLayersAdded = false;
         // Layers have been added.
         mVisibleRegionsDirty = true;
+        mLayerTreeChanged = true;
     }
 
     // some layers might have been removed, so
@@ -2194,6 +2515,7 @@ void SurfaceFlinger::handleTransactionLocked(uint32_t transactionFlags)
     if (mLayersRemoved) {
         mLayersRemoved = false;
         mVisibleRegionsDirty = true;
+        mLayerTreeChanged = true;
         mDrawingState.traverseInZOrder([&](Layer* layer) {
             if (mLayersPendingRemoval.indexOf(layer) >= 0) {
                 // this layer is not visible anymore
@@ -2243,16 +2565,42 @@ void SurfaceFlinger::commitTransaction()
     mAnimCompositionPending = mAnimTransactionPending;
 
     mDrawingState = mCurrentState;
-    mDrawingState.traverseInZOrder([](Layer* layer) {
+    // Not through the traversal cache: the tree changes as we walk it
+    mDrawingState.layersSortedByZ.traverseInZOrder(LayerVector::StateSet::Drawing,
+            [](Layer* layer) {
         layer->commitChildList();
     });
+    if (mLayerTreeChanged) {
+        mLayerTreeChanged = false;
+        mDrawingState.invalidateTraversalCache();
+    }
     mTransactionPending = false;
     mAnimTransactionPending = false;
     mTransactionCV.broadcast();
 }
 
+// Conservative equality: regions are only reported equal when they are
+// stored as the same list of rectangles.
+static bool regionsEqual(const Region& a, const Region& b) {
+    if (a.isTriviallyEqual(b)) {
+        return true;
+    }
+    size_t countA = 0, countB = 0;
+    const Rect* const rectsA = a.getArray(&countA);
+    const Rect* const rectsB = b.getArray(&countB);
+    if (countA != countB) {
+        return false;
+    }
+    for (size_t i = 0; i < countA; i++) {
+        if (rectsA[i] != rectsB[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
 void SurfaceFlinger::computeVisibleRegions(uint32_t layerStack,
-        Region& outDirtyRegion, Region& outOpaqueRegion)
+        Region& outDirtyRegion, Region& outOpaqueRegion, bool incremental)
 {
     ATRACE_CALL();
     ALOGV("computeVisibleRegions");
@@ -2260,6 +2608,16 @@ void SurfaceFlinger::computeVisibleRegions(uint32_t layerStack,
     Region aboveOpaqueLayers;
     Region aboveCoveredLayers;
     Region dirty;
+    Region tmp;
+    Region::Scratch& scratch(mRegionScratch);
+
+    // In incremental mode, inSync is true as long as aboveOpaqueLayers and
+    // aboveCoveredLayers are identical to what they were at the same point
+    // of the previous computation. A layer that is not dirty and sees the
+    // same accumulators as last time would produce the same regions, so we
+    // reuse them along with the accumulators it produced.
+    bool inSync = incremental;
+    int32_t aboveSequence = -1;
 
     outDirtyRegion.clear();
 
@@ -2271,6 +2629,26 @@ void SurfaceFlinger::computeVisibleRegions(uint32_t layerStack,
         if (layer->getLayerStack() != layerStack)
             return;
 
+        Layer::VisibleRegionSnapshot& snapshot(layer->visibleRegionSnapshot);
+        if (inSync && snapshot.valid && snapshot.layerStack == layerStack &&
+                snapshot.aboveSequence == aboveSequence &&
+                !layer->contentDirty && !layer->isVisibleRegionDirty()) {
+            // Nothing changed for this layer: its dirty contribution is what
+            // the exposed region computation below yields for identical
+            // inputs, i.e. the visible area that is covered by layers above.
+            tmp = layer->visibleRegion;
+            tmp.andSelf(layer->coveredRegion, scratch);
+            outDirtyRegion.orSelf(tmp, scratch);
+            aboveOpaqueLayers = snapshot.aboveOpaqueLayers;
+            aboveCoveredLayers = snapshot.aboveCoveredLayers;
+            aboveSequence = layer->sequence;
+            mVisibleRegionStats.lastSkipped++;
+            mVisibleRegionStats.totalSkipped++;
+            return;
+        }
+        mVisibleRegionStats.lastComputed++;
+        mVisibleRegionStats.totalComputed++;
+
         /*
          * opaqueRegion: area of a surface that is fully opaque.
          */
@@ -2331,20 +2709,21 @@ void SurfaceFlinger::computeVisibleRegions(uint32_t layerStack,
         }
 
         // Clip the covered region to the visible region
-        coveredRegion = aboveCoveredLayers.intersect(visibleRegion);
+        coveredRegion = aboveCoveredLayers;
+        coveredRegion.andSelf(visibleRegion, scratch);
 
         // Update aboveCoveredLayers for next (lower) layer
-        aboveCoveredLayers.orSelf(visibleRegion);
+        aboveCoveredLayers.orSelf(visibleRegion, scratch);
 
         // subtract the opaque region covered by the layers above us
-        visibleRegion.subtractSelf(aboveOpaqueLayers);
+        visibleRegion.subtractSelf(aboveOpaqueLayers, scratch);
 
         // compute this layer's dirty region
         if (layer->contentDirty) {
             // we need to invalidate the whole region
             dirty = visibleRegion;
             // as well, as the old visible region
-            dirty.orSelf(layer->visibleRegion);
+            dirty.orSelf(layer->visibleRegion, scratch);
             layer->contentDirty = false;
         } else {
             /* compute the exposed region:
@@ -2359,25 +2738,48 @@ void SurfaceFlinger::computeVisibleRegions(uint32_t layerStack,
              * (2) handles areas that were not covered by anything but got
              * exposed because of a resize.
              */
-            const Region newExposed = visibleRegion - coveredRegion;
-            const Region oldVisibleRegion = layer->visibleRegion;
-            const Region oldCoveredRegion = layer->coveredRegion;
-            const Region oldExposed = oldVisibleRegion - oldCoveredRegion;
-            dirty = (visibleRegion&oldCoveredRegion) | (newExposed-oldExposed);
+            // dirty = (visible & oldCovered) | (newExposed - oldExposed),
+            // built in place so that no temporary is needed
+            const Region& oldVisibleRegion = layer->visibleRegion;
+            const Region& oldCoveredRegion = layer->coveredRegion;
+            dirty = oldVisibleRegion;
+            dirty.subtractSelf(oldCoveredRegion, scratch);
+            tmp = visibleRegion;
+            tmp.subtractSelf(coveredRegion, scratch);
+            tmp.subtractSelf(dirty, scratch);
+            dirty = visibleRegion;
+            dirty.andSelf(oldCoveredRegion, scratch);
+            dirty.orSelf(tmp, scratch);
         }
-        dirty.subtractSelf(aboveOpaqueLayers);
+        dirty.subtractSelf(aboveOpaqueLayers, scratch);
 
         // accumulate to the screen dirty region
-        outDirtyRegion.orSelf(dirty);
+        outDirtyRegion.orSelf(dirty, scratch);
 
         // Update aboveOpaqueLayers for next (lower) layer
-        aboveOpaqueLayers.orSelf(opaqueRegion);
+        aboveOpaqueLayers.orSelf(opaqueRegion, scratch);
 
         // Store the visible region in screen space
         layer->setVisibleRegion(visibleRegion);
         layer->setCoveredRegion(coveredRegion);
-        layer->setVisibleNonTransparentRegion(
-                visibleRegion.subtract(transparentRegion));
+        tmp = visibleRegion;
+        tmp.subtractSelf(transparentRegion, scratch);
+        layer->setVisibleNonTransparentRegion(tmp);
+
+        // Layers below can only be skipped if we ended up with the same
+        // accumulators as last time.
+        inSync = incremental && snapshot.valid &&
+                snapshot.layerStack == layerStack &&
+                snapshot.aboveSequence == aboveSequence &&
+                regionsEqual(aboveOpaqueLayers, snapshot.aboveOpaqueLayers) &&
+                regionsEqual(aboveCoveredLayers, snapshot.aboveCoveredLayers);
+
+        snapshot.valid = true;
+        snapshot.layerStack = layerStack;
+        snapshot.aboveSequence = aboveSequence;
+        snapshot.aboveOpaqueLayers = aboveOpaqueLayers;
+        snapshot.aboveCoveredLayers = aboveCoveredLayers;
+        aboveSequence = layer->sequence;
     });
 
     outOpaqueRegion = aboveOpaqueLayers;
@@ -2388,7 +2790,7 @@ void SurfaceFlinger::invalidateLayerStack(uint32_t layerStack,
     for (size_t dpy=0 ; dpy<mDisplays.size() ; dpy++) {
         const sp<DisplayDevice>& hw(mDisplays[dpy]);
         if (hw->getLayerStack() == layerStack) {
-            hw->dirtyRegion.orSelf(dirty);
+            hw->dirtyRegion.orSelf(dirty, mRegionScratch);
         }
     }
 }
@@ -2426,7 +2828,12 @@ bool SurfaceFlinger::handlePageFlip()
     });
 
     for (auto& layer : mLayersWithQueuedFrames) {
-        const Region dirty(layer->latchBuffer(visibleRegions, latchTime));
+        bool layerVisibleRegions = false;
+        const Region dirty(layer->latchBuffer(layerVisibleRegions, latchTime));
+        if (layerVisibleRegions) {
+            layer->visibleRegionDirty = true;
+            visibleRegions = true;
+        }
         layer->useSurfaceDamage();
         invalidateLayerStack(layer->getLayerStack(), dirty);
         if (!dirty.isEmpty()) {
@@ -2434,7 +2841,7 @@ bool SurfaceFlinger::handlePageFlip()
         }
     }
 
-    mVisibleRegionsDirty |= visibleRegions;
+    mLayerVisibleRegionsDirty |= visibleRegions;
 
     // If we will need to wake up at some time in the future to deal with a
     // queued frame that shouldn't be displayed during this vsync period, wake
@@ -2447,12 +2854,156 @@ bool SurfaceFlinger::handlePageFlip()
     return !mLayersWithQueuedFrames.empty() && newDataLatched;
 }
 
+nsecs_t SurfaceFlinger::computePredictiveLatchDelay()
+{
+    // Each layer must be latched early enough to leave the rest of the
+    // vsync period to composition.
+    const nsecs_t now = systemTime();
+    const nsecs_t budget = std::min(mPredictiveLatchBudget,
+            mPrimaryDispSync.getPeriod() / 2);
+    const nsecs_t deadline = now + budget;
+
+    nsecs_t latchTime = now;
+    mDrawingState.traverseInZOrder([&](Layer* layer) {
+        if (!layer->hasQueuedFrame()) {
+            return;
+        }
+        const nsecs_t expected = layer->getExpectedLatchTime();
+        if (expected > latchTime && expected <= deadline) {
+            latchTime = expected;
+        }
+    });
+    return latchTime - now;
+}
+
+void SurfaceFlinger::deferInvalidate(nsecs_t delay)
+{
+    class MessageDeferredInvalidate : public MessageBase {
+        SurfaceFlinger* flinger;
+    public:
+        explicit MessageDeferredInvalidate(SurfaceFlinger* flinger)
+            : flinger(flinger) { }
+        virtual bool handler() {
+            // A regular INVALIDATE may have beaten us to it
+            if (flinger->mInvalidateDeferred) {
+                flinger->onMessageReceived(MessageQueue::INVALIDATE);
+            }
+            return true;
+        }
+    };
+
+    ATRACE_INT64("PredictiveLatchDelay", delay);
+    mInvalidateDeferred = true;
+    mPredictiveLatchStats.numDeferred++;
+    mPredictiveLatchStats.totalDelay += delay;
+    mPredictiveLatchStats.maxDelay = std::max(mPredictiveLatchStats.maxDelay, delay);
+    mEventQueue.postMessage(new MessageDeferredInvalidate(this), delay);
+}
+
+void SurfaceFlinger::updateRefreshRate()
+{
+    sp<DisplayDevice> hw(getDisplayDevice(
+            mBuiltinDisplays[DisplayDevice::DISPLAY_PRIMARY]));
+    if (hw == nullptr || !hw->isDisplayOn()) {
+        return;
+    }
+
+    const int32_t type = DisplayDevice::DISPLAY_PRIMARY;
+    const auto& configs = getHwComposer().getConfigs(type);
+    const int currentMode = hw->getActiveConfig();
+    if (configs.size() < 2 || currentMode < 0 ||
+            currentMode >= static_cast<int>(configs.size())) {
+        return;
+    }
+
+    const nsecs_t now = systemTime();
+    const nsecs_t idleTime = mRefreshRatePolicy.getIdleTime(now);
+    nsecs_t targetPeriod = 0;
+    if (idleTime >= mRefreshRateIdleTimeout) {
+        targetPeriod = INT64_MAX;
+    } else {
+        const nsecs_t contentPeriod = mRefreshRatePolicy.getContentPeriod(now);
+        if (contentPeriod > 0) {
+            // Leave some slack for the jitter of the queue times
+            targetPeriod = contentPeriod + contentPeriod / 10;
+        }
+        scheduleIdleCheck(mRefreshRateIdleTimeout - idleTime);
+    }
+
+    // Only switch between configs of the current resolution, pick the
+    // lowest refresh rate that still keeps up with the content
+    const auto& current = configs[currentMode];
+    int bestMode = -1;
+    int fastestMode = -1;
+    for (size_t i = 0; i < configs.size(); i++) {
+        const auto& config = configs[i];
+        if (config->getWidth() != current->getWidth() ||
+                config->getHeight() != current->getHeight()) {
+            continue;
+        }
+        const nsecs_t period = config->getVsyncPeriod();
+        if (fastestMode < 0 || period < configs[fastestMode]->getVsyncPeriod()) {
+            fastestMode = static_cast<int>(i);
+        }
+        if (period <= targetPeriod &&
+                (bestMode < 0 || period > configs[bestMode]->getVsyncPeriod())) {
+            bestMode = static_cast<int>(i);
+        }
+    }
+    if (bestMode < 0) {
+        bestMode = fastestMode;
+    }
+
+    if (bestMode != currentMode) {
+        ATRACE_INT("RefreshRateMode", bestMode);
+        ALOGV("Refresh rate switch %d -> %d (%" PRId64 " ns)", currentMode,
+                bestMode, configs[bestMode]->getVsyncPeriod());
+        mNumRefreshRateSwitches++;
+        setActiveConfigInternal(hw, bestMode);
+    }
+}
+
+void SurfaceFlinger::scheduleIdleCheck(nsecs_t delay)
+{
+    class MessageIdleCheck : public MessageBase {
+        SurfaceFlinger* flinger;
+    public:
+        explicit MessageIdleCheck(SurfaceFlinger* flinger)
+            : flinger(flinger) { }
+        virtual bool handler() {
+            flinger->mIdleCheckPending = false;
+            flinger->updateRefreshRate();
+            return true;
+        }
+    };
+
+    if (mIdleCheckPending) {
+        return;
+    }
+    mIdleCheckPending = true;
+    mEventQueue.postMessage(new MessageIdleCheck(this), delay);
+}
+
 void SurfaceFlinger::invalidateHwcGeometry()
 {
     mGeometryInvalid = true;
 }
 
 
+static uint64_t computeClientCompositionKey(
+        const sp<const DisplayDevice>& displayDevice) {
+    const auto hwcId = displayDevice->getHwcDisplayId();
+    const auto& layers = displayDevice->getVisibleLayersSortedByZ();
+    uint64_t key = layers.size();
+    for (const auto& layer : layers) {
+        const uint64_t layerKey = (static_cast<uint64_t>(layer->sequence) << 8) |
+                (static_cast<uint64_t>(layer->getCompositionType(hwcId)) << 1) |
+                (layer->getClearClientTarget(hwcId) ? 1 : 0);
+        key ^= layerKey + 0x9e3779b97f4a7c15ull + (key << 6) + (key >> 2);
+    }
+    return key;
+}
+
 void SurfaceFlinger::doDisplayComposition(
         const sp<const DisplayDevice>& displayDevice,
         const Region& inDirtyRegion)
@@ -2487,6 +3038,19 @@ void SurfaceFlinger::doDisplayComposition(
             // This is needed because PARTIAL_UPDATES only takes one
             // rectangle instead of a region (see DisplayDevice::flip())
             dirtyRegion.set(displayDevice->swapRegion.bounds());
+        } else if (mPartialClientComposition && isHwcDisplay &&
+                mHwc->hasClientComposition(displayDevice->getHwcDisplayId())) {
+            // we only need to redraw what changed since the client target
+            // buffer we're about to render into was last used, unless layers
+            // moved between client and device composition.
+            const int32_t hwcId = displayDevice->getHwcDisplayId();
+            const uint64_t key = computeClientCompositionKey(displayDevice);
+            const bool compositionChanged =
+                    mClientCompositionKeys.valueFor(hwcId) != key;
+            mClientCompositionKeys.replaceValueFor(hwcId, key);
+            dirtyRegion = displayDevice->computeClientTargetDamage(
+                    dirtyRegion, compositionChanged);
+            displayDevice->swapRegion = dirtyRegion;
         } else {
             // we need to redraw everything (the whole screen)
             dirtyRegion.set(displayDevice->bounds());
@@ -2538,6 +3102,20 @@ bool SurfaceFlinger::doComposeSurfaces(
             return false;
         }
 
+        mRenderEngine->beginGpuTimer(displayDevice->getDisplayType());
+
+        // With partial client composition, only the damaged part of the
+        // client target is redrawn, the rest of it is left untouched.
+        const Rect dirtyBounds(dirty.getBounds());
+        const bool partialComposition = mPartialClientComposition &&
+                dirtyBounds != displayDevice->getBounds();
+        if (partialComposition) {
+            const uint32_t height = displayDevice->getHeight();
+            mRenderEngine->setScissor(dirtyBounds.left,
+                    height - dirtyBounds.bottom, dirtyBounds.getWidth(),
+                    dirtyBounds.getHeight());
+        }
+
         // Never touch the framebuffer if we don't have any framebuffer layers
         const bool hasDeviceComposition = mHwc->hasDeviceComposition(hwcId);
         if (hasDeviceComposition) {
@@ -2581,9 +3159,13 @@ bool SurfaceFlinger::doComposeSurfaces(
                 // the GL scissor so we don't draw anything where we shouldn't
 
                 // enable scissor for this frame
+                Rect clip(scissor);
+                if (partialComposition && !scissor.intersect(dirtyBounds, &clip)) {
+                    clip.clear();
+                }
                 const uint32_t height = displayDevice->getHeight();
-                mRenderEngine->setScissor(scissor.left, height - scissor.bottom,
-                        scissor.getWidth(), scissor.getHeight());
+                mRenderEngine->setScissor(clip.left, height - clip.bottom,
+                        clip.getWidth(), clip.getHeight());
             }
         }
     }
@@ -2594,6 +3176,8 @@ bool SurfaceFlinger::doComposeSurfaces(
 
     ALOGV("Rendering client layers");
     const Transform& displayTransform = displayDevice->getTransform();
+    // clears and dim layers drawn one after the other can share a draw call
+    mRenderEngine->beginBatch();
     if (hwcId >= 0) {
         // we're using h/w composer
         bool firstLayer = true;
@@ -2641,6 +3225,8 @@ bool SurfaceFlinger::doComposeSurfaces(
             }
         }
     }
+    mRenderEngine->endBatch();
+    mRenderEngine->endGpuTimer();
 
     if (applyColorMatrix) {
         getRenderEngine().setupColorTransform(oldColorMatrix);
@@ -2751,14 +3337,132 @@ uint32_t SurfaceFlinger::setTransactionFlags(uint32_t flags) {
     return old;
 }
 
+bool SurfaceFlinger::queueTransaction(
+        const Vector<ComposerState>& state,
+        const Vector<DisplayState>& displays,
+        uint32_t flags)
+{
+    const uint32_t coalescable = layer_state_t::ePositionChanged |
+            layer_state_t::eAlphaChanged | layer_state_t::eMatrixChanged;
+
+    if (!mCoalesceTransactions || flags != 0 || !displays.isEmpty() ||
+            state.isEmpty() || mInterceptor.isEnabled()) {
+        return false;
+    }
+    for (size_t i=0 ; i<state.size() ; i++) {
+        const ComposerState& s(state[i]);
+        if ((s.state.what & ~coalescable) != 0 || s.state.surface == NULL ||
+                s.client == NULL) {
+            return false;
+        }
+        // Same check as in setTransactionState
+        sp<IBinder> binder = IInterface::asBinder(s.client);
+        if (binder == NULL || binder->queryLocalInterface(
+                ISurfaceComposerClient::descriptor) == NULL) {
+            return false;
+        }
+    }
+
+    for (size_t i=0 ; i<state.size() ; i++) {
+        const ComposerState& s(state[i]);
+        sp<Client> client(static_cast<Client *>(s.client.get()));
+        sp<Layer> layer(client->getLayerUser(s.state.surface));
+        // Same as setClientStateLocked, changes to dead layers are dropped
+        if (layer != 0 && !layer->publishState(s.state)) {
+            // Later changes replace earlier ones
+            mTransactionQueueStats.numLayerStatesMerged++;
+        }
+    }
+    mTransactionQueueStats.numQueued++;
+
+    // Only wake up the main thread for the first transaction of the batch,
+    // the others are picked up by the same handleMessageTransaction().
+    if (!mHasPublishedStates.exchange(true)) {
+        signalTransaction();
+    }
+    return true;
+}
+
+uint32_t SurfaceFlinger::applyQueuedTransactionsLocked()
+{
+    if (!mHasPublishedStates.exchange(false)) {
+        return 0;
+    }
+
+    ATRACE_CALL();
+    uint32_t transactionFlags = 0;
+    // Layers that didn't publish anything only cost an atomic load here
+    mCurrentState.traverseInZOrder([&](Layer* layer) {
+        layer_state_t s;
+        if (!layer->takePublishedState(&s)) {
+            return;
+        }
+        mTransactionQueueStats.numLayerStatesApplied++;
+        // The coalesced transaction can't have eGeometryAppliesWithResize
+        if (s.what & layer_state_t::ePositionChanged) {
+            if (layer->setPosition(s.x, s.y, true)) {
+                transactionFlags |= eTraversalNeeded;
+            }
+        }
+        if (s.what & layer_state_t::eAlphaChanged) {
+            if (layer->setAlpha(s.alpha))
+                transactionFlags |= eTraversalNeeded;
+        }
+        if (s.what & layer_state_t::eMatrixChanged) {
+            if (layer->setMatrix(s.matrix))
+                transactionFlags |= eTraversalNeeded;
+        }
+    });
+    mTransactionQueueStats.numFlushes++;
+    return transactionFlags;
+}
+
+uint32_t SurfaceFlinger::applyLayerPropertyBlocksLocked()
+{
+    ATRACE_CALL();
+    uint32_t transactionFlags = 0;
+    bool changed = false;
+    mCurrentState.traverseInZOrder([&](Layer* layer) {
+        layer_state_t s;
+        if (!layer->readPropertyBlock(&s)) {
+            return;
+        }
+        changed = true;
+        if (s.what & layer_state_t::ePositionChanged) {
+            if (layer->setPosition(s.x, s.y, true)) {
+                transactionFlags |= eTraversalNeeded;
+            }
+        }
+        if (s.what & layer_state_t::eAlphaChanged) {
+            if (layer->setAlpha(s.alpha))
+                transactionFlags |= eTraversalNeeded;
+        }
+        if (s.what & layer_state_t::eMatrixChanged) {
+            if (layer->setMatrix(s.matrix))
+                transactionFlags |= eTraversalNeeded;
+        }
+    });
+    if (changed) {
+        // Keep polling the blocks while they change, the clients only
+        // signal us once we found them idle.
+        signalLayerUpdate();
+    }
+    return transactionFlags;
+}
+
 void SurfaceFlinger::setTransactionState(
         const Vector<ComposerState>& state,
         const Vector<DisplayState>& displays,
         uint32_t flags)
 {
     ATRACE_CALL();
+    if (queueTransaction(state, displays, flags)) {
+        return;
+    }
+
     Mutex::Autolock _l(mStateLock);
-    uint32_t transactionFlags = 0;
+    // Anything queued before this transaction must be applied first.
+    uint32_t transactionFlags = applyQueuedTransactionsLocked();
 
     if (flags & eAnimation) {
         // For window updates that are part of an animation we must wait for
@@ -3223,6 +3927,8 @@ void SurfaceFlinger::setPowerModeInternal(const sp<DisplayDevice>& hw,
         if (type == DisplayDevice::DISPLAY_PRIMARY) {
             // FIXME: eventthread only knows about the main display right now
             mEventThread->onScreenAcquired();
+            mLowLatencyEventThread->onScreenAcquired();
+            mLateEventThread->onScreenAcquired();
             resyncToHardwareVsync(true);
         }
 
@@ -3247,6 +3953,8 @@ void SurfaceFlinger::setPowerModeInternal(const sp<DisplayDevice>& hw,
 
             // FIXME: eventthread only knows about the main display right now
             mEventThread->onScreenReleased();
+            mLowLatencyEventThread->onScreenReleased();
+            mLateEventThread->onScreenReleased();
         }
 
         getHwComposer().setPowerMode(type, mode);
@@ -3297,6 +4005,9 @@ status_t SurfaceFlinger::dump(int fd, const Vector<String16>& args)
             !PermissionCache::checkPermission(sDump, pid, uid)) {
         result.appendFormat("Permission Denial: "
                 "can't dump SurfaceFlinger from pid=%d, uid=%d\n", pid, uid);
+    } else if (args.size() && args[0] == String16("--snapshot")) {
+        size_t index = 1;
+        dumpSnapshot(args, index, result);
     } else {
         // Try to get the main lock, but give up after one second
         // (this would indicate SF is stuck, but we want to be able to
@@ -3360,7 +4071,20 @@ status_t SurfaceFlinger::dump(int fd, const Vector<String16>& args)
                 dumpWideColorInfo(result);
                 dumpAll = false;
             }
-        }
+
+            if ((index < numArgs) && (args[index] == String16("--gpu-timing"))) {
+                index++;
+                mRenderEngine->dumpGpuTimings(result);
+                dumpAll = false;
+            }
+
+            if ((index < numArgs) &&
+                    (args[index] == String16("--gralloc-uids"))) {
+                index++;
+                GraphicBufferAllocator::get().dumpUidUsage(result);
+                dumpAll = false;
+            }
+        }
 
         if (dumpAll) {
             dumpAllLocked(args, index, result);
@@ -3374,6 +4098,69 @@ status_t SurfaceFlinger::dump(int fd, const Vector<String16>& args)
     return NO_ERROR;
 }
 
+void SurfaceFlinger::dumpSnapshot(const Vector<String16>& args, size_t& index,
+        String8& result)
+{
+    bool colorize = false;
+    if (index < args.size()
+            && (args[index] == String16("--color"))) {
+        colorize = true;
+        index++;
+    }
+
+    class MessageTakeDumpSnapshot : public MessageBase {
+        SurfaceFlinger& mFlinger;
+    public:
+        DumpSnapshot snapshot;
+
+        explicit MessageTakeDumpSnapshot(SurfaceFlinger& flinger)
+            : mFlinger(flinger) { }
+        virtual bool handler() {
+            mFlinger.takeDumpSnapshot(&snapshot);
+            return true;
+        }
+    };
+
+    // The main thread handles the message between two frames. The message
+    // owns the snapshot, so it stays valid if we give up waiting for it.
+    sp<MessageTakeDumpSnapshot> msg = new MessageTakeDumpSnapshot(*this);
+    status_t err = mEventQueue.postMessage(msg, 0, MessageQueue::DEFERRABLE);
+    if (err != NO_ERROR || !msg->waitFor(s2ns(1))) {
+        result.appendFormat("SurfaceFlinger appears to be unresponsive, "
+                "can't take a snapshot (%d)\n", err);
+        return;
+    }
+
+    Colorizer colorizer(colorize);
+    msg->snapshot.dump(result, colorizer);
+}
+
+void SurfaceFlinger::takeDumpSnapshot(DumpSnapshot* outSnapshot)
+{
+    outSnapshot->takenAt = systemTime();
+    outSnapshot->vsyncPeriod = mPrimaryDispSync.getPeriod();
+
+    outSnapshot->layers.reserve(mDrawingState.layersSortedByZ.size());
+    mDrawingState.traverseInZOrder([&](Layer* layer) {
+        outSnapshot->layers.emplace_back();
+        layer->getDumpSnapshot(&outSnapshot->layers.back());
+    });
+
+    outSnapshot->displays.resize(mDisplays.size());
+    for (size_t dpy = 0; dpy < mDisplays.size(); dpy++) {
+        const sp<const DisplayDevice>& hw(mDisplays[dpy]);
+        DumpSnapshot::DisplayState& display(outSnapshot->displays[dpy]);
+        display.name = hw->getDisplayName();
+        display.type = hw->getDisplayType();
+        display.layerStack = hw->getLayerStack();
+        display.width = hw->getWidth();
+        display.height = hw->getHeight();
+        display.powerMode = hw->getPowerMode();
+        display.pageFlipCount = hw->getPageFlipCount();
+        display.numVisibleLayers = hw->getVisibleLayersSortedByZ().size();
+    }
+}
+
 void SurfaceFlinger::listLayersLocked(const Vector<String16>& /* args */,
         size_t& /* index */, String8& result) const
 {
@@ -3468,6 +4255,62 @@ void SurfaceFlinger::dumpStaticScreenStats(String8& result) const
             NUM_BUCKETS - 1, bucketTimeSec, percent);
 }
 
+void SurfaceFlinger::dumpVisibleRegionStats(String8& result) const
+{
+    const VisibleRegionStats& stats(mVisibleRegionStats);
+    result.appendFormat("Visible region stats (incremental mode %s):\n",
+            mIncrementalVisibleRegions ? "enabled" : "disabled");
+    result.appendFormat("  last pass: %zu layers computed, %zu skipped\n",
+            stats.lastComputed, stats.lastSkipped);
+    const uint64_t total = stats.totalComputed + stats.totalSkipped;
+    const float percent = total > 0 ?
+            100.0f * static_cast<float>(stats.totalSkipped) / total : 0.0f;
+    result.appendFormat("  %" PRIu64 " passes: %" PRIu64 " layers computed, "
+            "%" PRIu64 " skipped (%.1f%%)\n", stats.numPasses,
+            stats.totalComputed, stats.totalSkipped, percent);
+}
+
+void SurfaceFlinger::dumpTransactionQueueStats(String8& result) const
+{
+    const TransactionQueueStats& stats(mTransactionQueueStats);
+    result.appendFormat("Transaction queue (coalescing %s):\n",
+            mCoalesceTransactions ? "enabled" : "disabled");
+    result.appendFormat("  %" PRIu64 " transactions queued, %" PRIu64
+            " layer states merged, %" PRIu64 " applied in %" PRIu64
+            " flushes\n", stats.numQueued.load(), stats.numLayerStatesMerged.load(),
+            stats.numLayerStatesApplied.load(), stats.numFlushes.load());
+}
+
+void SurfaceFlinger::dumpPredictiveLatchStats(String8& result) const
+{
+    const PredictiveLatchStats& stats(mPredictiveLatchStats);
+    result.appendFormat("Predictive latching (budget %" PRId64 " us):\n",
+            ns2us(mPredictiveLatchBudget));
+    const nsecs_t averageDelay = stats.numDeferred > 0 ?
+            stats.totalDelay / static_cast<nsecs_t>(stats.numDeferred) : 0;
+    result.appendFormat("  %" PRIu64 " invalidates deferred, average %" PRId64
+            " us, max %" PRId64 " us\n", stats.numDeferred,
+            ns2us(averageDelay), ns2us(stats.maxDelay));
+}
+
+void SurfaceFlinger::dumpRefreshRateStats(String8& result) const
+{
+    result.appendFormat("Refresh rate switching: %s (idle after %" PRId64
+            " ms), %" PRIu64 " switches\n", mRefreshRateSwitching ? "on" : "off",
+            ns2ms(mRefreshRateIdleTimeout), mNumRefreshRateSwitches);
+    if (mRefreshRateSwitching) {
+        mRefreshRatePolicy.dump(result);
+    }
+}
+
+void SurfaceFlinger::dumpLayerFlatteningStats(String8& result) const
+{
+    result.appendFormat("Layer flattening: %s\n", mLayerFlattening ? "on" : "off");
+    if (mLayerFlattening) {
+        mLayerFlatteningPolicy.dump(result);
+    }
+}
+
 void SurfaceFlinger::recordBufferingStats(const char* layerName,
         std::vector<OccupancyTracker::Segment>&& history) {
     Mutex::Autolock lock(mBufferingStatsMutex);
@@ -3613,6 +4456,28 @@ void SurfaceFlinger::dumpAllLocked(const Vector<String16>& args, size_t& index,
 
     dumpBufferingStats(result);
 
+    dumpVisibleRegionStats(result);
+    result.append("\n");
+
+    dumpTransactionQueueStats(result);
+    result.append("\n");
+
+    mFrameTimeline.dump(result);
+    result.append("\n");
+
+    mScreenshotBufferPool.dump(result);
+    result.append("\n");
+
+    dumpPredictiveLatchStats(result);
+    result.append("\n");
+
+    dumpRefreshRateStats(result);
+    dumpLayerFlatteningStats(result);
+    result.append("\n");
+
+    mInterceptor.dump(result);
+    result.append("\n");
+
     /*
      * Dump the visible layer list
      */
@@ -3686,6 +4551,14 @@ void SurfaceFlinger::dumpAllLocked(const Vector<String16>& args, size_t& index,
      */
     mEventThread->dump(result);
     result.append("\n");
+    result.appendFormat("Low latency app channel (offset %" PRId64 " ns):\n",
+            mLowLatencyVsyncPhaseOffsetNs);
+    mLowLatencyEventThread->dump(result);
+    result.append("\n");
+    result.appendFormat("Late app channel (offset %" PRId64 " ns):\n",
+            mLateVsyncPhaseOffsetNs);
+    mLateEventThread->dump(result);
+    result.append("\n");
 
     /*
      * HWC layer minidump
@@ -3721,6 +4594,8 @@ void SurfaceFlinger::dumpAllLocked(const Vector<String16>& args, size_t& index,
      */
     const GraphicBufferAllocator& alloc(GraphicBufferAllocator::get());
     alloc.dump(result);
+    alloc.dumpUidUsage(result);
+    GraphicBufferPool::getInstance().dump(result);
 }
 
 const Vector< sp<Layer> >&
@@ -3768,6 +4643,7 @@ status_t SurfaceFlinger::CheckTransactCodeCredentials(uint32_t code) {
         case GET_ANIMATION_FRAME_STATS:
         case SET_POWER_MODE:
         case GET_HDR_CAPABILITIES:
+        case GET_FRAME_TIMELINE:
         {
             // codes that require permission check
             IPCThreadState* ipc = IPCThreadState::self();
@@ -3792,6 +4668,8 @@ status_t SurfaceFlinger::CheckTransactCodeCredentials(uint32_t code) {
             return OK;
         }
         case CAPTURE_SCREEN:
+        case CAPTURE_SCREEN_TO_BUFFER:
+        case RELEASE_CAPTURE_BUFFER:
         {
             // codes that require permission check
             IPCThreadState* ipc = IPCThreadState::self();
@@ -3944,11 +4822,12 @@ status_t SurfaceFlinger::onTransact(
                 mSFEventThread->setPhaseOffset(static_cast<nsecs_t>(n));
                 return NO_ERROR;
             }
-            case 1020: { // Layer updates interceptor
+            case 1020: { // Layer updates interceptor, 2 streams to disk
                 n = data.readInt32();
                 if (n) {
                     ALOGV("Interceptor enabled");
-                    mInterceptor.enable(mDrawingState.layersSortedByZ, mDrawingState.displays);
+                    mInterceptor.enable(mDrawingState.layersSortedByZ, mDrawingState.displays,
+                            n == 2);
                 }
                 else{
                     ALOGV("Interceptor disabled");
@@ -4088,6 +4967,23 @@ public:
 };
 
 
+static Transform::orientation_flags toRotationFlags(
+        ISurfaceComposer::Rotation rotation) {
+    switch (rotation) {
+        case ISurfaceComposer::eRotateNone:
+            return Transform::ROT_0;
+        case ISurfaceComposer::eRotate90:
+            return Transform::ROT_90;
+        case ISurfaceComposer::eRotate180:
+            return Transform::ROT_180;
+        case ISurfaceComposer::eRotate270:
+            return Transform::ROT_270;
+        default:
+            ALOGE("Invalid rotation passed to captureScreen(): %d\n", rotation);
+            return Transform::ROT_0;
+    }
+}
+
 status_t SurfaceFlinger::captureScreen(const sp<IBinder>& display,
         const sp<IGraphicBufferProducer>& producer,
         Rect sourceCrop, uint32_t reqWidth, uint32_t reqHeight,
@@ -4106,25 +5002,7 @@ status_t SurfaceFlinger::captureScreen(const sp<IBinder>& display,
     bool isLocalScreenshot = IInterface::asBinder(producer)->localBinder();
 
     // Convert to surfaceflinger's internal rotation type.
-    Transform::orientation_flags rotationFlags;
-    switch (rotation) {
-        case ISurfaceComposer::eRotateNone:
-            rotationFlags = Transform::ROT_0;
-            break;
-        case ISurfaceComposer::eRotate90:
-            rotationFlags = Transform::ROT_90;
-            break;
-        case ISurfaceComposer::eRotate180:
-            rotationFlags = Transform::ROT_180;
-            break;
-        case ISurfaceComposer::eRotate270:
-            rotationFlags = Transform::ROT_270;
-            break;
-        default:
-            rotationFlags = Transform::ROT_0;
-            ALOGE("Invalid rotation passed to captureScreen(): %d\n", rotation);
-            break;
-    }
+    Transform::orientation_flags rotationFlags = toRotationFlags(rotation);
 
     class MessageCaptureScreen : public MessageBase {
         SurfaceFlinger* flinger;
@@ -4187,6 +5065,92 @@ status_t SurfaceFlinger::captureScreen(const sp<IBinder>& display,
     return res;
 }
 
+status_t SurfaceFlinger::captureScreenToBuffer(const sp<IBinder>& display,
+        Rect sourceCrop, uint32_t reqWidth, uint32_t reqHeight,
+        int32_t minLayerZ, int32_t maxLayerZ,
+        bool useIdentityTransform, ISurfaceComposer::Rotation rotation,
+        sp<GraphicBuffer>* outBuffer, sp<Fence>* outFence) {
+
+    if (CC_UNLIKELY(display == 0))
+        return BAD_VALUE;
+
+    if (CC_UNLIKELY(outBuffer == nullptr || outFence == nullptr))
+        return BAD_VALUE;
+
+    // Same as captureScreen, secure windows can only be captured by
+    // SurfaceFlinger itself.
+    bool isLocalScreenshot = IPCThreadState::self()->getCallingPid() == getpid();
+
+    class MessageCaptureScreenToBuffer : public MessageBase {
+        SurfaceFlinger* flinger;
+        sp<IBinder> display;
+        Rect sourceCrop;
+        uint32_t reqWidth, reqHeight;
+        int32_t minLayerZ,maxLayerZ;
+        bool useIdentityTransform;
+        Transform::orientation_flags rotation;
+        bool isLocalScreenshot;
+        status_t result;
+        sp<GraphicBuffer> buffer;
+        sp<Fence> fence;
+    public:
+        MessageCaptureScreenToBuffer(SurfaceFlinger* flinger,
+                const sp<IBinder>& display,
+                Rect sourceCrop, uint32_t reqWidth, uint32_t reqHeight,
+                int32_t minLayerZ, int32_t maxLayerZ,
+                bool useIdentityTransform,
+                Transform::orientation_flags rotation,
+                bool isLocalScreenshot)
+            : flinger(flinger), display(display),
+              sourceCrop(sourceCrop), reqWidth(reqWidth), reqHeight(reqHeight),
+              minLayerZ(minLayerZ), maxLayerZ(maxLayerZ),
+              useIdentityTransform(useIdentityTransform),
+              rotation(rotation), isLocalScreenshot(isLocalScreenshot),
+              result(PERMISSION_DENIED)
+        {
+        }
+        status_t getResult() const {
+            return result;
+        }
+        const sp<GraphicBuffer>& getBuffer() const {
+            return buffer;
+        }
+        const sp<Fence>& getFence() const {
+            return fence;
+        }
+        virtual bool handler() {
+            Mutex::Autolock _l(flinger->mStateLock);
+            sp<const DisplayDevice> hw(flinger->getDisplayDeviceLocked(display));
+            result = flinger->captureScreenToBufferImplLocked(hw,
+                    sourceCrop, reqWidth, reqHeight, minLayerZ, maxLayerZ,
+                    useIdentityTransform, rotation, isLocalScreenshot,
+                    &buffer, &fence);
+            return true;
+        }
+    };
+
+    // Only the GL commands are issued on the main thread, the caller waits
+    // on the returned fence for the GPU to be done.
+    sp<MessageCaptureScreenToBuffer> msg = new MessageCaptureScreenToBuffer(
+            this, display, sourceCrop, reqWidth, reqHeight, minLayerZ,
+            maxLayerZ, useIdentityTransform, toRotationFlags(rotation),
+            isLocalScreenshot);
+    status_t res = postMessageSync(msg);
+    if (res == NO_ERROR) {
+        res = msg->getResult();
+    }
+    if (res == NO_ERROR) {
+        *outBuffer = msg->getBuffer();
+        *outFence = msg->getFence();
+    }
+    return res;
+}
+
+void SurfaceFlinger::releaseCaptureBuffer(uint64_t bufferId,
+        const sp<Fence>& releaseFence) {
+    mScreenshotBufferPool.release(bufferId, releaseFence);
+}
+
 
 void SurfaceFlinger::renderScreenImplLocked(
         const sp<const DisplayDevice>& hw,
@@ -4269,39 +5233,10 @@ status_t SurfaceFlinger::captureScreenImplLocked(
 {
     ATRACE_CALL();
 
-    // get screen geometry
-    uint32_t hw_w = hw->getWidth();
-    uint32_t hw_h = hw->getHeight();
-
-    if (rotation & Transform::ROT_90) {
-        std::swap(hw_w, hw_h);
-    }
-
-    if ((reqWidth > hw_w) || (reqHeight > hw_h)) {
-        ALOGE("size mismatch (%d, %d) > (%d, %d)",
-                reqWidth, reqHeight, hw_w, hw_h);
-        return BAD_VALUE;
-    }
-
-    reqWidth  = (!reqWidth)  ? hw_w : reqWidth;
-    reqHeight = (!reqHeight) ? hw_h : reqHeight;
-
-    bool secureLayerIsVisible = false;
-    for (const auto& layer : mDrawingState.layersSortedByZ) {
-        const Layer::State& state(layer->getDrawingState());
-        if ((layer->getLayerStack() != hw->getLayerStack()) ||
-                (state.z < minLayerZ || state.z > maxLayerZ)) {
-            continue;
-        }
-        layer->traverseInZOrder(LayerVector::StateSet::Drawing, [&](Layer *layer) {
-            secureLayerIsVisible = secureLayerIsVisible || (layer->isVisible() &&
-                    layer->isSecure());
-        });
-    }
-
-    if (!isLocalScreenshot && secureLayerIsVisible) {
-        ALOGW("FB is protected: PERMISSION_DENIED");
-        return PERMISSION_DENIED;
+    status_t result = checkScreenCaptureLocked(hw, &reqWidth, &reqHeight,
+            minLayerZ, maxLayerZ, rotation, isLocalScreenshot);
+    if (result != NO_ERROR) {
+        return result;
     }
 
     // create a surface (because we're a producer, and we need to
@@ -4317,7 +5252,7 @@ status_t SurfaceFlinger::captureScreenImplLocked(
 
     ANativeWindow* window = sur.get();
 
-    status_t result = native_window_api_connect(window, NATIVE_WINDOW_API_EGL);
+    result = native_window_api_connect(window, NATIVE_WINDOW_API_EGL);
     if (result == NO_ERROR) {
         uint32_t usage = GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_SW_WRITE_OFTEN |
                         GRALLOC_USAGE_HW_RENDER | GRALLOC_USAGE_HW_TEXTURE;
@@ -4336,78 +5271,13 @@ status_t SurfaceFlinger::captureScreenImplLocked(
             result = native_window_dequeue_buffer_and_wait(window,  &buffer);
             if (result == NO_ERROR) {
                 int syncFd = -1;
-                // create an EGLImage from the buffer so we can later
-                // turn it into a texture
-                EGLImageKHR image = eglCreateImageKHR(mEGLDisplay, EGL_NO_CONTEXT,
-                        EGL_NATIVE_BUFFER_ANDROID, buffer, NULL);
-                if (image != EGL_NO_IMAGE_KHR) {
-                    // this binds the given EGLImage as a framebuffer for the
-                    // duration of this scope.
-                    RenderEngine::BindImageAsFramebuffer imageBond(getRenderEngine(), image);
-                    if (imageBond.getStatus() == NO_ERROR) {
-                        // this will in fact render into our dequeued buffer
-                        // via an FBO, which means we didn't have to create
-                        // an EGLSurface and therefore we're not
-                        // dependent on the context's EGLConfig.
-                        renderScreenImplLocked(
-                            hw, sourceCrop, reqWidth, reqHeight, minLayerZ, maxLayerZ, true,
-                            useIdentityTransform, rotation);
-
-                        // Attempt to create a sync khr object that can produce a sync point. If that
-                        // isn't available, create a non-dupable sync object in the fallback path and
-                        // wait on it directly.
-                        EGLSyncKHR sync;
-                        if (!DEBUG_SCREENSHOTS) {
-                           sync = eglCreateSyncKHR(mEGLDisplay, EGL_SYNC_NATIVE_FENCE_ANDROID, NULL);
-                           // native fence fd will not be populated until flush() is done.
-                           getRenderEngine().flush();
-                        } else {
-                            sync = EGL_NO_SYNC_KHR;
-                        }
-                        if (sync != EGL_NO_SYNC_KHR) {
-                            // get the sync fd
-                            syncFd = eglDupNativeFenceFDANDROID(mEGLDisplay, sync);
-                            if (syncFd == EGL_NO_NATIVE_FENCE_FD_ANDROID) {
-                                ALOGW("captureScreen: failed to dup sync khr object");
-                                syncFd = -1;
-                            }
-                            eglDestroySyncKHR(mEGLDisplay, sync);
-                        } else {
-                            // fallback path
-                            sync = eglCreateSyncKHR(mEGLDisplay, EGL_SYNC_FENCE_KHR, NULL);
-                            if (sync != EGL_NO_SYNC_KHR) {
-                                EGLint result = eglClientWaitSyncKHR(mEGLDisplay, sync,
-                                    EGL_SYNC_FLUSH_COMMANDS_BIT_KHR, 2000000000 /*2 sec*/);
-                                EGLint eglErr = eglGetError();
-                                if (result == EGL_TIMEOUT_EXPIRED_KHR) {
-                                    ALOGW("captureScreen: fence wait timed out");
-                                } else {
-                                    ALOGW_IF(eglErr != EGL_SUCCESS,
-                                            "captureScreen: error waiting on EGL fence: %#x", eglErr);
-                                }
-                                eglDestroySyncKHR(mEGLDisplay, sync);
-                            } else {
-                                ALOGW("captureScreen: error creating EGL fence: %#x", eglGetError());
-                            }
-                        }
-                        if (DEBUG_SCREENSHOTS) {
-                            uint32_t* pixels = new uint32_t[reqWidth*reqHeight];
-                            getRenderEngine().readPixels(0, 0, reqWidth, reqHeight, pixels);
-                            checkScreenshot(reqWidth, reqHeight, reqWidth, pixels,
-                                    hw, minLayerZ, maxLayerZ);
-                            delete [] pixels;
-                        }
-
-                    } else {
-                        ALOGE("got GL_FRAMEBUFFER_COMPLETE_OES error while taking screenshot");
-                        result = INVALID_OPERATION;
-                        window->cancelBuffer(window, buffer, syncFd);
-                        buffer = NULL;
-                    }
-                    // destroy our image
-                    eglDestroyImageKHR(mEGLDisplay, image);
-                } else {
-                    result = BAD_VALUE;
+                result = renderScreenToBufferLocked(hw,
+                        GraphicBuffer::from(buffer), false, sourceCrop,
+                        reqWidth, reqHeight, minLayerZ, maxLayerZ,
+                        useIdentityTransform, rotation, &syncFd);
+                if (result == INVALID_OPERATION) {
+                    window->cancelBuffer(window, buffer, syncFd);
+                    buffer = NULL;
                 }
                 if (buffer) {
                     // queueBuffer takes ownership of syncFd
@@ -4423,6 +5293,175 @@ status_t SurfaceFlinger::captureScreenImplLocked(
     return result;
 }
 
+status_t SurfaceFlinger::checkScreenCaptureLocked(
+        const sp<const DisplayDevice>& hw,
+        uint32_t* inOutReqWidth, uint32_t* inOutReqHeight,
+        int32_t minLayerZ, int32_t maxLayerZ,
+        Transform::orientation_flags rotation, bool isLocalScreenshot)
+{
+    if (hw == nullptr) {
+        ALOGE("screen capture: invalid display");
+        return BAD_VALUE;
+    }
+
+    // get screen geometry
+    uint32_t hw_w = hw->getWidth();
+    uint32_t hw_h = hw->getHeight();
+
+    if (rotation & Transform::ROT_90) {
+        std::swap(hw_w, hw_h);
+    }
+
+    if ((*inOutReqWidth > hw_w) || (*inOutReqHeight > hw_h)) {
+        ALOGE("size mismatch (%d, %d) > (%d, %d)",
+                *inOutReqWidth, *inOutReqHeight, hw_w, hw_h);
+        return BAD_VALUE;
+    }
+
+    *inOutReqWidth  = (!*inOutReqWidth)  ? hw_w : *inOutReqWidth;
+    *inOutReqHeight = (!*inOutReqHeight) ? hw_h : *inOutReqHeight;
+
+    bool secureLayerIsVisible = false;
+    for (const auto& layer : mDrawingState.layersSortedByZ) {
+        const Layer::State& state(layer->getDrawingState());
+        if ((layer->getLayerStack() != hw->getLayerStack()) ||
+                (state.z < minLayerZ || state.z > maxLayerZ)) {
+            continue;
+        }
+        layer->traverseInZOrder(LayerVector::StateSet::Drawing, [&](Layer *layer) {
+            secureLayerIsVisible = secureLayerIsVisible || (layer->isVisible() &&
+                    layer->isSecure());
+        });
+    }
+
+    if (!isLocalScreenshot && secureLayerIsVisible) {
+        ALOGW("FB is protected: PERMISSION_DENIED");
+        return PERMISSION_DENIED;
+    }
+    return NO_ERROR;
+}
+
+status_t SurfaceFlinger::renderScreenToBufferLocked(
+        const sp<const DisplayDevice>& hw, const sp<GraphicBuffer>& buffer,
+        bool keepTarget,
+        Rect sourceCrop, uint32_t reqWidth, uint32_t reqHeight,
+        int32_t minLayerZ, int32_t maxLayerZ,
+        bool useIdentityTransform, Transform::orientation_flags rotation,
+        int* outSyncFd)
+{
+    ATRACE_CALL();
+    status_t result = NO_ERROR;
+    int syncFd = -1;
+    {
+        // this binds the given buffer as a framebuffer for the
+        // duration of this scope.
+        RenderEngine::BindBufferAsFramebuffer bufferBond(getRenderEngine(),
+                buffer, keepTarget);
+        result = bufferBond.getStatus();
+        if (result == NO_ERROR) {
+            // this will in fact render into our dequeued buffer
+            // via an FBO, which means we didn't have to create
+            // an EGLSurface and therefore we're not
+            // dependent on the context's EGLConfig.
+            renderScreenImplLocked(
+                hw, sourceCrop, reqWidth, reqHeight, minLayerZ, maxLayerZ, true,
+                useIdentityTransform, rotation);
+
+            // Attempt to create a sync khr object that can produce a sync point. If that
+            // isn't available, create a non-dupable sync object in the fallback path and
+            // wait on it directly.
+            EGLSyncKHR sync;
+            if (!DEBUG_SCREENSHOTS) {
+               sync = eglCreateSyncKHR(mEGLDisplay, EGL_SYNC_NATIVE_FENCE_ANDROID, NULL);
+               // native fence fd will not be populated until flush() is done.
+               getRenderEngine().flush();
+            } else {
+                sync = EGL_NO_SYNC_KHR;
+            }
+            if (sync != EGL_NO_SYNC_KHR) {
+                // get the sync fd
+                syncFd = eglDupNativeFenceFDANDROID(mEGLDisplay, sync);
+                if (syncFd == EGL_NO_NATIVE_FENCE_FD_ANDROID) {
+                    ALOGW("captureScreen: failed to dup sync khr object");
+                    syncFd = -1;
+                }
+                eglDestroySyncKHR(mEGLDisplay, sync);
+            } else {
+                // fallback path
+                sync = eglCreateSyncKHR(mEGLDisplay, EGL_SYNC_FENCE_KHR, NULL);
+                if (sync != EGL_NO_SYNC_KHR) {
+                    EGLint result = eglClientWaitSyncKHR(mEGLDisplay, sync,
+                        EGL_SYNC_FLUSH_COMMANDS_BIT_KHR, 2000000000 /*2 sec*/);
+                    EGLint eglErr = eglGetError();
+                    if (result == EGL_TIMEOUT_EXPIRED_KHR) {
+                        ALOGW("captureScreen: fence wait timed out");
+                    } else {
+                        ALOGW_IF(eglErr != EGL_SUCCESS,
+                                "captureScreen: error waiting on EGL fence: %#x", eglErr);
+                    }
+                    eglDestroySyncKHR(mEGLDisplay, sync);
+                } else {
+                    ALOGW("captureScreen: error creating EGL fence: %#x", eglGetError());
+                }
+            }
+            if (DEBUG_SCREENSHOTS) {
+                uint32_t* pixels = new uint32_t[reqWidth*reqHeight];
+                getRenderEngine().readPixels(0, 0, reqWidth, reqHeight, pixels);
+                checkScreenshot(reqWidth, reqHeight, reqWidth, pixels,
+                        hw, minLayerZ, maxLayerZ);
+                delete [] pixels;
+            }
+
+        } else {
+            ALOGE("failed to bind buffer as framebuffer while taking screenshot");
+        }
+    }
+    *outSyncFd = syncFd;
+    return result;
+}
+
+status_t SurfaceFlinger::captureScreenToBufferImplLocked(
+        const sp<const DisplayDevice>& hw,
+        Rect sourceCrop, uint32_t reqWidth, uint32_t reqHeight,
+        int32_t minLayerZ, int32_t maxLayerZ,
+        bool useIdentityTransform, Transform::orientation_flags rotation,
+        bool isLocalScreenshot,
+        sp<GraphicBuffer>* outBuffer, sp<Fence>* outFence)
+{
+    ATRACE_CALL();
+
+    status_t result = checkScreenCaptureLocked(hw, &reqWidth, &reqHeight,
+            minLayerZ, maxLayerZ, rotation, isLocalScreenshot);
+    if (result != NO_ERROR) {
+        return result;
+    }
+
+    uint32_t usage = GRALLOC_USAGE_SW_READ_OFTEN |
+            GRALLOC_USAGE_HW_RENDER | GRALLOC_USAGE_HW_TEXTURE;
+    sp<GraphicBuffer> buffer = mScreenshotBufferPool.acquire(reqWidth,
+            reqHeight, HAL_PIXEL_FORMAT_RGBA_8888, usage);
+    if (buffer == nullptr) {
+        return NO_MEMORY;
+    }
+
+    int syncFd = -1;
+    result = renderScreenToBufferLocked(hw, buffer, true, sourceCrop,
+            reqWidth, reqHeight, minLayerZ, maxLayerZ,
+            useIdentityTransform, rotation, &syncFd);
+    if (result != NO_ERROR) {
+        if (syncFd >= 0) {
+            close(syncFd);
+        }
+        mScreenshotBufferPool.release(buffer->getId(), Fence::NO_FENCE);
+        return result;
+    }
+
+    *outBuffer = buffer;
+    // An invalid fence means the buffer is ready already
+    *outFence = new Fence(syncFd);
+    return NO_ERROR;
+}
+
 void SurfaceFlinger::checkScreenshot(size_t w, size_t s, size_t h, void const* vaddr,
         const sp<const DisplayDevice>& hw, int32_t minLayerZ, int32_t maxLayerZ) {
     if (DEBUG_SCREENSHOTS) {
@@ -4455,12 +5494,38 @@ void SurfaceFlinger::checkScreenshot(size_t w, size_t s, size_t h, void const* v
 
 // ---------------------------------------------------------------------------
 
+void SurfaceFlinger::State::updateTraversalCache() const {
+    if (traversalCacheValid) {
+        return;
+    }
+    traversalCache.clear();
+    layersSortedByZ.traverseInZOrder(stateSet, [&](Layer* layer) {
+        traversalCache.push_back(layer);
+    });
+    traversalCacheValid = true;
+}
+
 void SurfaceFlinger::State::traverseInZOrder(const LayerVector::Visitor& visitor) const {
-    layersSortedByZ.traverseInZOrder(stateSet, visitor);
+    if (stateSet != LayerVector::StateSet::Drawing) {
+        layersSortedByZ.traverseInZOrder(stateSet, visitor);
+        return;
+    }
+    updateTraversalCache();
+    for (size_t i = 0; i < traversalCache.size(); i++) {
+        visitor(traversalCache[i]);
+    }
 }
 
 void SurfaceFlinger::State::traverseInReverseZOrder(const LayerVector::Visitor& visitor) const {
-    layersSortedByZ.traverseInReverseZOrder(stateSet, visitor);
+    if (stateSet != LayerVector::StateSet::Drawing) {
+        layersSortedByZ.traverseInReverseZOrder(stateSet, visitor);
+        return;
+    }
+    // The reverse traversal visits layers in exactly the opposite order
+    updateTraversalCache();
+    for (size_t i = traversalCache.size(); i > 0; i--) {
+        visitor(traversalCache[i - 1]);
+    }
 }
 
 }; // namespace android
@@ -38,6 +38,7 @@
 
 #include <ui/FenceTime.h>
 #include <ui/PixelFormat.h>
+#include <ui/Region.h>
 #include <math/mat4.h>
 
 #include <gui/FrameTimestamps.h>
@@ -54,9 +55,14 @@
 #include "Barrier.h"
 #include "DisplayDevice.h"
 #include "DispSync.h"
+#include "DumpSnapshot.h"
+#include "FrameTimelineRecorder.h"
 #include "FrameTracker.h"
 #include "LayerVector.h"
 #include "MessageQueue.h"
+#include "ScreenshotBufferPool.h"
+#include "RefreshRatePolicy.h"
+#include "LayerFlatteningPolicy.h"
 #include "SurfaceInterceptor.h"
 #include "StartBootAnimThread.h"
 
@@ -253,6 +259,18 @@ private:
 
         void traverseInZOrder(const LayerVector::Visitor& visitor) const;
         void traverseInReverseZOrder(const LayerVector::Visitor& visitor) const;
+
+        // The drawing state only changes in commitTransaction(), so its
+        // traversals walk a flattened copy of the layer tree instead of
+        // sorting children and resolving relatives every time. The copy is
+        // rebuilt on the first traversal after this is called.
+        void invalidateTraversalCache() { traversalCacheValid = false; }
+
+    private:
+        void updateTraversalCache() const;
+        // Not copied by operator=, see invalidateTraversalCache()
+        mutable std::vector<Layer*> traversalCache;
+        mutable bool traversalCacheValid = false;
     };
 
     /* ------------------------------------------------------------------------
@@ -284,6 +302,13 @@ private:
             Rect sourceCrop, uint32_t reqWidth, uint32_t reqHeight,
             int32_t minLayerZ, int32_t maxLayerZ,
             bool useIdentityTransform, ISurfaceComposer::Rotation rotation);
+    virtual status_t captureScreenToBuffer(const sp<IBinder>& display,
+            Rect sourceCrop, uint32_t reqWidth, uint32_t reqHeight,
+            int32_t minLayerZ, int32_t maxLayerZ,
+            bool useIdentityTransform, ISurfaceComposer::Rotation rotation,
+            sp<GraphicBuffer>* outBuffer, sp<Fence>* outFence);
+    virtual void releaseCaptureBuffer(uint64_t bufferId,
+            const sp<Fence>& releaseFence);
     virtual status_t getDisplayStats(const sp<IBinder>& display,
             DisplayStatInfo* stats);
     virtual status_t getDisplayConfigs(const sp<IBinder>& display,
@@ -301,6 +326,11 @@ private:
             HdrCapabilities* outCapabilities) const;
     virtual status_t enableVSyncInjections(bool enable);
     virtual status_t injectVSync(nsecs_t when);
+    virtual status_t getFrameTimeline(int* outFd);
+    virtual status_t getLayerPropertyBlock(
+            const sp<ISurfaceComposerClient>& client,
+            const sp<IBinder>& handle, int* outFd);
+    virtual void signalLayerPropertyBlocks();
 
 
     /* ------------------------------------------------------------------------
@@ -366,6 +396,17 @@ private:
     void commitTransaction();
     uint32_t setClientStateLocked(const sp<Client>& client, const layer_state_t& s);
     uint32_t setDisplayStateLocked(const DisplayState& s);
+    // Queues a transaction that only changes the position, alpha or matrix
+    // of layers, merging it with the changes already queued for the same
+    // layers. Returns false if the transaction must be applied right away.
+    bool queueTransaction(const Vector<ComposerState>& state,
+            const Vector<DisplayState>& displays, uint32_t flags);
+    // Applies the queued transactions, returns the resulting transaction
+    // flags without setting them.
+    uint32_t applyQueuedTransactionsLocked();
+    // Applies what clients streamed through layer property blocks, returns
+    // the resulting transaction flags without setting them.
+    uint32_t applyLayerPropertyBlocksLocked();
 
     /* ------------------------------------------------------------------------
      * Layer management
@@ -425,6 +466,34 @@ private:
             bool useIdentityTransform, Transform::orientation_flags rotation,
             bool isLocalScreenshot);
 
+    status_t captureScreenToBufferImplLocked(
+            const sp<const DisplayDevice>& hw,
+            Rect sourceCrop, uint32_t reqWidth, uint32_t reqHeight,
+            int32_t minLayerZ, int32_t maxLayerZ,
+            bool useIdentityTransform, Transform::orientation_flags rotation,
+            bool isLocalScreenshot,
+            sp<GraphicBuffer>* outBuffer, sp<Fence>* outFence);
+
+    // Validates the requested size, defaulting it to the display size, and
+    // checks for secure layers.
+    status_t checkScreenCaptureLocked(
+            const sp<const DisplayDevice>& hw,
+            uint32_t* inOutReqWidth, uint32_t* inOutReqHeight,
+            int32_t minLayerZ, int32_t maxLayerZ,
+            Transform::orientation_flags rotation, bool isLocalScreenshot);
+
+    // Renders the screen into buffer. outSyncFd is set to a fence signaling
+    // when rendering is done, or -1 if rendering already completed.
+    // keepTarget keeps the framebuffer object made for buffer in the
+    // RenderEngine, for buffers coming back to us
+    status_t renderScreenToBufferLocked(
+            const sp<const DisplayDevice>& hw, const sp<GraphicBuffer>& buffer,
+            bool keepTarget,
+            Rect sourceCrop, uint32_t reqWidth, uint32_t reqHeight,
+            int32_t minLayerZ, int32_t maxLayerZ,
+            bool useIdentityTransform, Transform::orientation_flags rotation,
+            int* outSyncFd);
+
     sp<StartBootAnimThread> mStartBootAnimThread = nullptr;
 
     /* ------------------------------------------------------------------------
@@ -497,11 +566,17 @@ private:
      * Compositing
      */
     void invalidateHwcGeometry();
+    // When incremental is true, layers whose inputs are unchanged since the
+    // last computation reuse their cached regions (see
+    // Layer::VisibleRegionSnapshot) instead of being recomputed.
     void computeVisibleRegions(uint32_t layerStack,
-            Region& dirtyRegion, Region& opaqueRegion);
+            Region& dirtyRegion, Region& opaqueRegion, bool incremental = false);
 
     void preComposition(nsecs_t refreshStartTime);
     void postComposition(nsecs_t refreshStartTime);
+    // runs the deferrable messages until shortly before the next
+    // INVALIDATE is due
+    void runDeferredMessages();
     void updateCompositorTiming(
             nsecs_t vsyncPhase, nsecs_t vsyncInterval, nsecs_t compositeTime,
             std::shared_ptr<FenceTime>& presentFenceTime);
@@ -525,6 +600,12 @@ private:
     bool doComposeSurfaces(const sp<const DisplayDevice>& displayDevice, const Region& dirty);
 
     void postFramebuffer();
+#ifdef USE_HWC2
+    void composeDisplay(const sp<DisplayDevice>& hw, bool repaintEverything);
+    nsecs_t beginPostFramebuffer();
+    void postFramebufferForDisplay(const sp<DisplayDevice>& displayDevice);
+    void endPostFramebuffer(nsecs_t startTime);
+#endif
     void drawWormhole(const sp<const DisplayDevice>& displayDevice, const Region& region) const;
 
     /* ------------------------------------------------------------------------
@@ -550,6 +631,9 @@ private:
     void dumpStatsLocked(const Vector<String16>& args, size_t& index, String8& result) const;
     void clearStatsLocked(const Vector<String16>& args, size_t& index, String8& result);
     void dumpAllLocked(const Vector<String16>& args, size_t& index, String8& result) const;
+    // Doesn't need mStateLock, asks the main thread for a DumpSnapshot
+    void dumpSnapshot(const Vector<String16>& args, size_t& index, String8& result);
+    void takeDumpSnapshot(DumpSnapshot* outSnapshot);
     bool startDdmConnection();
     void appendSfConfigString(String8& result) const;
     void checkScreenshot(size_t w, size_t s, size_t h, void const* vaddr,
@@ -559,6 +643,8 @@ private:
     void logFrameStats();
 
     void dumpStaticScreenStats(String8& result) const;
+    void dumpVisibleRegionStats(String8& result) const;
+    void dumpTransactionQueueStats(String8& result) const;
     // Not const because each Layer needs to query Fences and cache timestamps.
     void dumpFrameEventsLocked(String8& result);
 
@@ -580,6 +666,30 @@ private:
 
     // Check to see if we should handoff to vr flinger.
     void updateVrFlinger();
+
+    /* ------------------------------------------------------------------------
+     * Predictive latching
+     */
+    // How long to push INVALIDATE back so that the layers whose acquire
+    // fence is expected to signal shortly are latched this vsync, 0 to
+    // latch right away.
+    nsecs_t computePredictiveLatchDelay();
+    void deferInvalidate(nsecs_t delay);
+    void dumpPredictiveLatchStats(String8& result) const;
+
+    /* ------------------------------------------------------------------------
+     * Refresh rate switching
+     */
+    // Switches the primary display to the config whose refresh rate best
+    // matches the content, or to the lowest refresh rate once idle
+    void updateRefreshRate();
+    void scheduleIdleCheck(nsecs_t delay);
+    void dumpRefreshRateStats(String8& result) const;
+
+    /* ------------------------------------------------------------------------
+     * Layer flattening
+     */
+    void dumpLayerFlatteningStats(String8& result) const;
 #endif
 
     // Panel hardware rotation
@@ -597,11 +707,31 @@ private:
     bool mTransactionPending;
     bool mAnimTransactionPending;
     SortedVector< sp<Layer> > mLayersPendingRemoval;
+
+    // Coalesced layer states waiting for the next vsync live in each
+    // layer (see Layer::publishState), binder threads queue them without
+    // taking any lock. mHasPublishedStates is set when a layer may have
+    // published changes since the last applyQueuedTransactionsLocked().
+    struct TransactionQueueStats {
+        std::atomic<uint64_t> numQueued{0};
+        std::atomic<uint64_t> numLayerStatesMerged{0};
+        std::atomic<uint64_t> numLayerStatesApplied{0};
+        std::atomic<uint64_t> numFlushes{0};
+    };
+    std::atomic<bool> mHasPublishedStates;
+    TransactionQueueStats mTransactionQueueStats;
+    bool mCoalesceTransactions;
+    // Number of layers that have a property block, see
+    // Layer::getPropertyBlockFd()
+    std::atomic<uint32_t> mNumLayerPropertyBlocks{0};
     SortedVector< wp<IBinder> > mGraphicBufferProducerList;
 
     // protected by mStateLock (but we could use another lock)
     bool mLayersRemoved;
     bool mLayersAdded;
+    // Whether the next commitTransaction() changes the shape of the layer
+    // tree (z-order, relatives, layer stacks, parents)
+    bool mLayerTreeChanged;
 
     // access must be protected by mInvalidateLock
     volatile int32_t mRepaintEverything;
@@ -618,6 +748,9 @@ private:
     bool mGpuToCpuSupported;
     sp<EventThread> mEventThread;
     sp<EventThread> mSFEventThread;
+    // additional app vsync channels, see ISurfaceComposer::VsyncSource
+    sp<EventThread> mLowLatencyEventThread;
+    sp<EventThread> mLateEventThread;
     sp<EventThread> mInjectorEventThread;
     sp<InjectVSyncSource> mVSyncInjector;
     sp<EventControlThread> mEventControlThread;
@@ -633,6 +766,10 @@ private:
     // don't need synchronization
     State mDrawingState{LayerVector::StateSet::Drawing};
     bool mVisibleRegionsDirty;
+    // Set instead of mVisibleRegionsDirty when only individual layers (flagged
+    // with Layer::visibleRegionDirty) need their visible regions recomputed.
+    bool mLayerVisibleRegionsDirty;
+    bool mIncrementalVisibleRegions;
 #ifndef USE_HWC2
     bool mHwWorkListDirty;
 #else
@@ -646,6 +783,8 @@ private:
 #endif
     FenceTimeline mGlCompositionDoneTimeline;
     FenceTimeline mDisplayTimeline;
+    // main thread only
+    FenceTimeline::Batch mFenceTimelineBatch;
 
     // this may only be written from the main thread with mStateLock held
     // it may be read from other threads with mStateLock held
@@ -664,9 +803,46 @@ private:
     bool mForceFullDamage;
 #ifdef USE_HWC2
     bool mPropagateBackpressure = true;
+    // Present each display right after composing it instead of composing
+    // all displays first, see doComposition()
+    bool mPresentDisplaysEarly = false;
+    // Only redraw the damaged part of the client target, see
+    // doDisplayComposition()
+    bool mPartialClientComposition = false;
+    // Hash of the composition types of the layers of each HWC display at
+    // the last client composition, main thread only
+    DefaultKeyedVector<int32_t, uint64_t> mClientCompositionKeys;
+    // How long INVALIDATE may be pushed back waiting for acquire fences
+    // that are about to signal, 0 disables predictive latching
+    nsecs_t mPredictiveLatchBudget = 0;
+    // Set while an INVALIDATE pushed back by deferInvalidate() is pending
+    bool mInvalidateDeferred = false;
+    struct PredictiveLatchStats {
+        uint64_t numDeferred = 0;
+        nsecs_t totalDelay = 0;
+        nsecs_t maxDelay = 0;
+    };
+    PredictiveLatchStats mPredictiveLatchStats;
+    // Let updateRefreshRate() pick the primary display config
+    bool mRefreshRateSwitching = false;
+    // How long without any buffer queued before dropping to the lowest
+    // refresh rate
+    nsecs_t mRefreshRateIdleTimeout = 0;
+    // Set while the idle check posted by scheduleIdleCheck() is pending
+    bool mIdleCheckPending = false;
+    uint64_t mNumRefreshRateSwitches = 0;
+    // Fed from Layer::onFrameAvailable(), thread safe
+    RefreshRatePolicy mRefreshRatePolicy;
+    // Let mLayerFlatteningPolicy force the stable bottom layers to client
+    // composition, see setUpHWComposer()
+    bool mLayerFlattening = false;
+    LayerFlatteningPolicy mLayerFlatteningPolicy;
 #endif
     SurfaceInterceptor mInterceptor;
     bool mUseHwcVirtualDisplays = false;
+    // phase offsets of the additional app vsync channels
+    int64_t mLowLatencyVsyncPhaseOffsetNs = 0;
+    int64_t mLateVsyncPhaseOffsetNs = 0;
 
     // Restrict layers to use two buffers in their bufferqueues.
     bool mLayerTripleBufferingDisabled = false;
@@ -674,6 +850,9 @@ private:
     // these are thread safe
     mutable MessageQueue mEventQueue;
     FrameTracker mAnimFrameTracker;
+    // Only written from the main thread, the exported fd is thread safe
+    FrameTimelineRecorder mFrameTimeline;
+    ScreenshotBufferPool mScreenshotBufferPool;
     DispSync mPrimaryDispSync;
 
     // protected by mDestroyedLayerLock;
@@ -720,6 +899,25 @@ private:
 
     size_t mNumLayers;
 
+    // Boot time reporting: when init() started and whether the first frame
+    // was logged yet. Main thread only.
+    nsecs_t mInitStartTime;
+    bool mFirstFrameReported;
+
+    // Incremental visible region stats, main thread only
+    struct VisibleRegionStats {
+        size_t lastComputed = 0;
+        size_t lastSkipped = 0;
+        uint64_t totalComputed = 0;
+        uint64_t totalSkipped = 0;
+        uint64_t numPasses = 0;
+    };
+    VisibleRegionStats mVisibleRegionStats;
+
+    // Working memory of the in-place Region operations done by the
+    // visibility pass and invalidateLayerStack, main thread only
+    Region::Scratch mRegionScratch;
+
     // Double- vs. triple-buffering stats
     struct BufferingStats {
         BufferingStats()
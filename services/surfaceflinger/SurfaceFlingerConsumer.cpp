@@ -239,6 +239,11 @@ void SurfaceFlingerConsumer::setContentsChangedListener(
     mContentsChangedListener = listener;
 }
 
+void SurfaceFlingerConsumer::onFrameAvailable(const BufferItem& item) {
+    prepareEglImage(item);
+    GLConsumer::onFrameAvailable(item);
+}
+
 void SurfaceFlingerConsumer::onSidebandStreamChanged() {
     FrameAvailableListener* unsafeFrameAvailableListener = nullptr;
     {
@@ -273,6 +278,14 @@ void SurfaceFlingerConsumer::addAndGetFrameTimestamps(
     }
 }
 
+status_t SurfaceFlingerConsumer::getFrameEventBlock(int* outFd) {
+    sp<Layer> l = mLayer.promote();
+    if (l.get()) {
+        return l->getFrameEventBlock(outFd);
+    }
+    return NO_INIT;
+}
+
 // ---------------------------------------------------------------------------
 }; // namespace android
 
@@ -42,7 +42,9 @@ public:
             uint32_t tex, Layer* layer)
         : GLConsumer(consumer, tex, GLConsumer::TEXTURE_EXTERNAL, false, false),
           mTransformToDisplayInverse(false), mSurfaceDamage(), mLayer(layer)
-    {}
+    {
+        setEglImageCacheSize(EGL_IMAGE_CACHE_SIZE);
+    }
 
     class BufferRejecter {
         friend class SurfaceFlingerConsumer;
@@ -90,8 +92,17 @@ public:
     void addAndGetFrameTimestamps(
             const NewFrameEventsEntry* newTimestamps,
             FrameEventHistoryDelta* outDelta) override;
+    status_t getFrameEventBlock(int* outFd) override;
+
+protected:
+    // Creates the EGLImage of the queued buffer on the producer's binder
+    // thread, so that latching it on the main thread doesn't have to.
+    virtual void onFrameAvailable(const BufferItem& item) override;
 
 private:
+    // Enough for a triple buffered producer to reattach its buffers
+    static constexpr size_t EGL_IMAGE_CACHE_SIZE = 3;
+
     virtual void onSidebandStreamChanged();
 
     wp<ContentsChangedListener> mContentsChangedListener;
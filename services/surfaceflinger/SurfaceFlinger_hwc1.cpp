@@ -18,11 +18,13 @@
 
 #include <dlfcn.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <math.h>
 #include <stdatomic.h>
 #include <stdint.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 #include <mutex>
 
@@ -39,6 +41,7 @@
 #include <ui/DisplayStatInfo.h>
 
 #include <gui/BufferQueue.h>
+#include <gui/GraphicBufferPool.h>
 #include <gui/GuiConfig.h>
 #include <gui/IDisplayEventConnection.h>
 #include <gui/Surface.h>
@@ -122,12 +125,17 @@ SurfaceFlinger::SurfaceFlinger()
         mTransactionFlags(0),
         mTransactionPending(false),
         mAnimTransactionPending(false),
+        mHasPublishedStates(false),
+        mCoalesceTransactions(false),
         mLayersRemoved(false),
         mLayersAdded(false),
+        mLayerTreeChanged(false),
         mRepaintEverything(0),
         mRenderEngine(NULL),
         mBootTime(systemTime()),
         mVisibleRegionsDirty(false),
+        mLayerVisibleRegionsDirty(false),
+        mIncrementalVisibleRegions(false),
         mHwWorkListDirty(false),
         mAnimCompositionPending(false),
         mDebugRegion(0),
@@ -150,7 +158,9 @@ SurfaceFlinger::SurfaceFlinger()
         mFrameBuckets(),
         mTotalTime(0),
         mLastSwapTime(0),
-        mNumLayers(0)
+        mNumLayers(0),
+        mInitStartTime(0),
+        mFirstFrameReported(false)
 {
     ALOGI("SurfaceFlinger is starting");
 
@@ -183,9 +193,25 @@ SurfaceFlinger::SurfaceFlinger()
     property_get("ro.bq.gpu_to_cpu_unsupported", value, "0");
     mGpuToCpuSupported = !atoi(value);
 
+    // The low latency channel defaults to SurfaceFlinger's own phase so
+    // that a frame queued right after vsync is latched the same period,
+    // the late channel to half a 60Hz period after the app phase
+    property_get("debug.sf.low_latency_vsync_offset_ns", value, "");
+    mLowLatencyVsyncPhaseOffsetNs = value[0] ? atoll(value) : sfVsyncPhaseOffsetNs;
+    property_get("debug.sf.late_vsync_offset_ns", value, "");
+    mLateVsyncPhaseOffsetNs = value[0] ? atoll(value) : vsyncPhaseOffsetNs + 8333333;
+
     property_get("debug.sf.showupdates", value, "0");
     mDebugRegion = atoi(value);
 
+    property_get("debug.sf.incremental_vis_regions", value, "0");
+    mIncrementalVisibleRegions = atoi(value);
+    ALOGI_IF(mIncrementalVisibleRegions, "Incremental visible regions enabled");
+
+    property_get("debug.sf.coalesce_transactions", value, "0");
+    mCoalesceTransactions = atoi(value);
+    ALOGI_IF(mCoalesceTransactions, "Transaction coalescing enabled");
+
     property_get("debug.sf.ddms", value, "0");
     mDebugDDMS = atoi(value);
     if (mDebugDDMS) {
@@ -197,6 +223,14 @@ SurfaceFlinger::SurfaceFlinger()
     ALOGI_IF(mDebugRegion, "showupdates enabled");
     ALOGI_IF(mDebugDDMS, "DDMS debugging enabled");
 
+    property_get("debug.sf.gralloc_app_budget_kb", value, "0");
+    int appBudgetKb = atoi(value);
+    if (appBudgetKb > 0) {
+        GraphicBufferAllocator::get().setDefaultUidBudget(
+                static_cast<size_t>(appBudgetKb) * 1024);
+        ALOGI("Graphics memory capped at %d KiB per app", appBudgetKb);
+    }
+
     property_get("debug.sf.enable_hwc_vds", value, "0");
     mUseHwcVirtualDisplays = atoi(value);
     ALOGI_IF(!mUseHwcVirtualDisplays, "Enabling HWC virtual displays");
@@ -362,7 +396,8 @@ void SurfaceFlinger::deleteTextureAsync(uint32_t texture) {
             return true;
         }
     };
-    postMessageAsync(new MessageDestroyGLTexture(getRenderEngine(), texture));
+    postMessageAsync(new MessageDestroyGLTexture(getRenderEngine(), texture), 0,
+            MessageQueue::DEFERRABLE);
 }
 
 class DispSyncSource : public VSyncSource, private DispSync::Callback {
@@ -509,6 +544,8 @@ void SurfaceFlinger::init() {
     ALOGI(  "SurfaceFlinger's main thread ready to run. "
             "Initializing graphics H/W...");
 
+    mInitStartTime = systemTime();
+
     Mutex::Autolock _l(mStateLock);
 
     // initialize EGL for the default display
@@ -524,6 +561,15 @@ void SurfaceFlinger::init() {
     mSFEventThread = new EventThread(sfVsyncSrc, *this, true);
     mEventQueue.setEventThread(mSFEventThread);
 
+    // Channels without any listener leave their DispSync listener
+    // disabled and sleep, so they don't cost any wakeup
+    sp<VSyncSource> lowLatencyVsyncSrc = new DispSyncSource(&mPrimaryDispSync,
+            mLowLatencyVsyncPhaseOffsetNs, true, "app-lowlatency");
+    mLowLatencyEventThread = new EventThread(lowLatencyVsyncSrc, *this, false);
+    sp<VSyncSource> lateVsyncSrc = new DispSyncSource(&mPrimaryDispSync,
+            mLateVsyncPhaseOffsetNs, true, "app-late");
+    mLateEventThread = new EventThread(lateVsyncSrc, *this, false);
+
     // set EventThread and SFEventThread to SCHED_FIFO to minimize jitter
     struct sched_param param = {0};
     param.sched_priority = 2;
@@ -533,6 +579,9 @@ void SurfaceFlinger::init() {
     if (sched_setscheduler(mEventThread->getTid(), SCHED_FIFO, &param) != 0) {
         ALOGE("Couldn't set SCHED_FIFO for EventThread");
     }
+    if (sched_setscheduler(mLowLatencyEventThread->getTid(), SCHED_FIFO, &param) != 0) {
+        ALOGE("Couldn't set SCHED_FIFO for LowLatencyEventThread");
+    }
 
     // Initialize the H/W composer object.  There may or may not be an
     // actual hardware composer underneath.
@@ -542,6 +591,9 @@ void SurfaceFlinger::init() {
     // get a RenderEngine for the given display / config (can't fail)
     mRenderEngine = RenderEngine::create(mEGLDisplay, mHwc->getVisualID());
 
+    // Compile the shaders while the displays are set up
+    mRenderEngine->primeCacheAsync();
+
     // retrieve the EGL context that was selected/created
     mEGLContext = mRenderEngine->getEGLContext();
 
@@ -601,13 +653,14 @@ void SurfaceFlinger::init() {
     // set initial conditions (e.g. unblank default device)
     initializeDisplays();
 
-    mRenderEngine->primeCache();
+    mRenderEngine->waitForPrimedCache();
 
     mStartBootAnimThread = new StartBootAnimThread();
     if (mStartBootAnimThread->Start() != NO_ERROR) {
         ALOGE("Run StartBootAnimThread failed!");
     }
 
+    ALOGI("SurfaceFlinger initialized in %.2f ms", (systemTime() - mInitStartTime) / 1e6);
     ALOGV("Done initializing");
 }
 
@@ -942,14 +995,63 @@ status_t SurfaceFlinger::injectVSync(nsecs_t when) {
     return NO_ERROR;
 }
 
+status_t SurfaceFlinger::getFrameTimeline(int* outFd) {
+    if (outFd == nullptr) {
+        return BAD_VALUE;
+    }
+    *outFd = mFrameTimeline.dupFd();
+    return *outFd >= 0 ? NO_ERROR : NO_INIT;
+}
+
+status_t SurfaceFlinger::getLayerPropertyBlock(
+        const sp<ISurfaceComposerClient>& client,
+        const sp<IBinder>& handle, int* outFd) {
+    if (outFd == nullptr) {
+        return BAD_VALUE;
+    }
+    // Same check as in setTransactionState, the layer must belong to client
+    sp<IBinder> binder = IInterface::asBinder(client);
+    if (binder == NULL || binder->queryLocalInterface(
+            ISurfaceComposerClient::descriptor) == NULL) {
+        return BAD_VALUE;
+    }
+    sp<Layer> layer(static_cast<Client*>(client.get())->getLayerUser(handle));
+    if (layer == NULL) {
+        return NAME_NOT_FOUND;
+    }
+
+    Mutex::Autolock _l(mStateLock);
+    const int fd = layer->getPropertyBlockFd();
+    if (fd < 0) {
+        return NO_INIT;
+    }
+    *outFd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (*outFd < 0) {
+        ALOGE("getLayerPropertyBlock failed to dup fd: %s", strerror(errno));
+        return -errno;
+    }
+    return NO_ERROR;
+}
+
+void SurfaceFlinger::signalLayerPropertyBlocks() {
+    if (mNumLayerPropertyBlocks > 0) {
+        signalLayerUpdate();
+    }
+}
+
 // ----------------------------------------------------------------------------
 
 sp<IDisplayEventConnection> SurfaceFlinger::createDisplayEventConnection(
         ISurfaceComposer::VsyncSource vsyncSource) {
-    if (vsyncSource == eVsyncSourceSurfaceFlinger) {
-        return mSFEventThread->createEventConnection();
-    } else {
-        return mEventThread->createEventConnection();
+    switch (vsyncSource) {
+        case eVsyncSourceSurfaceFlinger:
+            return mSFEventThread->createEventConnection();
+        case eVsyncSourceLowLatency:
+            return mLowLatencyEventThread->createEventConnection();
+        case eVsyncSourceLate:
+            return mLateEventThread->createEventConnection();
+        default:
+            return mEventThread->createEventConnection();
     }
 }
 
@@ -972,13 +1074,13 @@ void SurfaceFlinger::signalRefresh() {
 }
 
 status_t SurfaceFlinger::postMessageAsync(const sp<MessageBase>& msg,
-        nsecs_t reltime, uint32_t /* flags */) {
-    return mEventQueue.postMessage(msg, reltime);
+        nsecs_t reltime, uint32_t flags) {
+    return mEventQueue.postMessage(msg, reltime, flags);
 }
 
 status_t SurfaceFlinger::postMessageSync(const sp<MessageBase>& msg,
-        nsecs_t reltime, uint32_t /* flags */) {
-    status_t res = mEventQueue.postMessage(msg, reltime);
+        nsecs_t reltime, uint32_t flags) {
+    status_t res = mEventQueue.postMessage(msg, reltime, flags);
     if (res == NO_ERROR) {
         msg->wait();
     }
@@ -1124,6 +1226,21 @@ void SurfaceFlinger::onMessageReceived(int32_t what) {
 }
 
 bool SurfaceFlinger::handleMessageTransaction() {
+    if (mCoalesceTransactions) {
+        Mutex::Autolock _l(mStateLock);
+        const uint32_t queuedFlags = applyQueuedTransactionsLocked();
+        if (queuedFlags) {
+            // No need to signalTransaction(), we're handling it right now
+            android_atomic_or(queuedFlags, &mTransactionFlags);
+        }
+    }
+    if (mNumLayerPropertyBlocks > 0) {
+        Mutex::Autolock _l(mStateLock);
+        const uint32_t blockFlags = applyLayerPropertyBlocksLocked();
+        if (blockFlags) {
+            android_atomic_or(blockFlags, &mTransactionFlags);
+        }
+    }
     uint32_t transactionFlags = peekTransactionFlags();
     if (transactionFlags) {
         handleTransaction(transactionFlags);
@@ -1148,6 +1265,20 @@ void SurfaceFlinger::handleMessageRefresh() {
     doDebugFlashRegions();
     doComposition();
     postComposition(refreshStartTime);
+
+    runDeferredMessages();
+}
+
+void SurfaceFlinger::runDeferredMessages() {
+    const nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    const nsecs_t period = mPrimaryDispSync.getPeriod();
+    nsecs_t nextWakeup = mPrimaryDispSync.computeNextRefresh(0) + sfVsyncPhaseOffsetNs;
+    while (nextWakeup <= now) {
+        nextWakeup += period;
+    }
+    // Leave some slack for the wakeup itself and for the message that
+    // might overrun
+    mEventQueue.runDeferredMessages(nextWakeup - period / 4);
 }
 
 void SurfaceFlinger::doDebugFlashRegions()
@@ -1265,6 +1396,12 @@ void SurfaceFlinger::setCompositorTimingSnapped(nsecs_t vsyncPhase,
 
 void SurfaceFlinger::postComposition(nsecs_t refreshStartTime)
 {
+    if (!mFirstFrameReported) {
+        mFirstFrameReported = true;
+        ALOGI("First frame composited %.2f ms after SurfaceFlinger init started",
+                (systemTime() - mInitStartTime) / 1e6);
+    }
+
     const HWComposer& hwc = getHwComposer();
     const sp<const DisplayDevice> hw(getDefaultDisplayDevice());
 
@@ -1276,12 +1413,18 @@ void SurfaceFlinger::postComposition(nsecs_t refreshStartTime)
     } else {
         glCompositionDoneFenceTime = FenceTime::NO_FENCE;
     }
-    mGlCompositionDoneTimeline.updateSignalTimes();
 
     sp<Fence> retireFence = mHwc->getDisplayFence(HWC_DISPLAY_PRIMARY);
     auto retireFenceTime = std::make_shared<FenceTime>(retireFence);
     mDisplayTimeline.push(retireFenceTime);
-    mDisplayTimeline.updateSignalTimes();
+
+    // Query the fences of every timeline in one go, see FenceTimeline::Batch
+    mFenceTimelineBatch.add(&mGlCompositionDoneTimeline);
+    mFenceTimelineBatch.add(&mDisplayTimeline);
+    mDrawingState.traverseInZOrder([&](Layer* layer) {
+        layer->addFenceTimelines(&mFenceTimelineBatch);
+    });
+    mFenceTimelineBatch.updateSignalTimes();
 
     nsecs_t vsyncPhase = mPrimaryDispSync.computeNextRefresh(0);
     nsecs_t vsyncInterval = mPrimaryDispSync.getPeriod();
@@ -1307,6 +1450,7 @@ void SurfaceFlinger::postComposition(nsecs_t refreshStartTime)
                     layer->getOccupancyHistory(false));
         }
     });
+    mFrameTimeline.flush(systemTime());
 
     if (retireFence->isValid()) {
         if (mPrimaryDispSync.addPresentFence(retireFence)) {
@@ -1359,9 +1503,16 @@ void SurfaceFlinger::postComposition(nsecs_t refreshStartTime)
 
 void SurfaceFlinger::rebuildLayerStacks() {
     // rebuild the visible layer list per screen
-    if (CC_UNLIKELY(mVisibleRegionsDirty)) {
+    if (CC_UNLIKELY(mVisibleRegionsDirty || mLayerVisibleRegionsDirty)) {
         ATRACE_CALL();
+        // Only the layers flagged visibleRegionDirty changed, everything else
+        // can be taken from the previous computation.
+        const bool incremental = mIncrementalVisibleRegions && !mVisibleRegionsDirty;
         mVisibleRegionsDirty = false;
+        mLayerVisibleRegionsDirty = false;
+        mVisibleRegionStats.lastComputed = 0;
+        mVisibleRegionStats.lastSkipped = 0;
+        mVisibleRegionStats.numPasses++;
         invalidateHwcGeometry();
 
         for (size_t dpy=0 ; dpy<mDisplays.size() ; dpy++) {
@@ -1373,7 +1524,7 @@ void SurfaceFlinger::rebuildLayerStacks() {
             const Rect bounds(hw->getBounds());
             if (hw->isDisplayOn()) {
                 computeVisibleRegions(hw->getLayerStack(), dirtyRegion,
-                        opaqueRegion);
+                        opaqueRegion, incremental);
 
                 mDrawingState.traverseInZOrder([&](Layer* layer) {
                     if (layer->getLayerStack() == hw->getLayerStack()) {
@@ -1391,6 +1542,12 @@ void SurfaceFlinger::rebuildLayerStacks() {
             hw->undefinedRegion.subtractSelf(tr.transform(opaqueRegion));
             hw->dirtyRegion.orSelf(dirtyRegion);
         }
+
+        // Children are traversed after their parent when their z is negative,
+        // so the flags can only be dropped once every layer stack is done.
+        mDrawingState.traverseInZOrder([](Layer* layer) {
+            layer->visibleRegionDirty = false;
+        });
     }
 }
 
@@ -1617,14 +1774,27 @@ void SurfaceFlinger::handleTransactionLocked(uint32_t transactionFlags)
      * (perform the transaction for each of them if needed)
      */
 
+    if (transactionFlags & eTransactionNeeded) {
+        // The layer list itself may have changed (z-order, layer stack,
+        // reparenting...), so cached visible regions can't be trusted.
+        mVisibleRegionsDirty = true;
+        mLayerTreeChanged = true;
+    }
+
     if (transactionFlags & eTraversalNeeded) {
         mCurrentState.traverseInZOrder([&](Layer* layer) {
             uint32_t trFlags = layer->getTransactionFlags(eTransactionNeeded);
             if (!trFlags) return;
 
             const uint32_t flags = layer->doTransaction(0);
-            if (flags & Layer::eVisibleRegion)
-                mVisibleRegionsDirty = true;
+            if (flags & Layer::eVisibleRegion) {
+                layer->visibleRegionDirty = true;
+                mLayerVisibleRegionsDirty = true;
+            }
+            if (flags & Layer::eLayerTreeChanged) {
+                // e.g. a deferred z change was just applied
+                mLayerTreeChanged = true;
+            }
         });
     }
 
@@ -1660,8 +1830,11 @@ void SurfaceFlinger::handleTransactionLocked(uint32_t transactionFlags)
                         sp<DisplayDevice> hw(getDisplayDeviceLocked(draw.keyAt(i)));
                         if (hw != NULL)
                             hw->disconnect(getHwComposer());
-                        if (draw[i].type < DisplayDevice::NUM_BUILTIN_DISPLAY_TYPES)
+                        if (draw[i].type < DisplayDevice::NUM_BUILTIN_DISPLAY_TYPES) {
                             mEventThread->onHotplugReceived(draw[i].type, false);
+                            mLowLatencyEventThread->onHotplugReceived(draw[i].type, false);
+                            mLateEventThread->onHotplugReceived(draw[i].type, false);
+                        }
                         mDisplays.removeItem(draw.keyAt(i));
                     } else {
                         ALOGW("trying to remove the main display");
@@ -1782,6 +1955,8 @@ void SurfaceFlinger::handleTransactionLocked(uint32_t transactionFlags)
                             }
                         } else {
                             mEventThread->onHotplugReceived(state.type, true);
+                            mLowLatencyEventThread->onHotplugReceived(state.type, true);
+                            mLateEventThread->onHotplugReceived(state.type, true);
                         }
                     }
                 }
@@ -1859,6 +2034,7 @@ void SurfaceFlinger::handleTransactionLocked(uint32_t transactionFlags)
         mLayersAdded = false;
         // Layers have been added.
         mVisibleRegionsDirty = true;
+        mLayerTreeChanged = true;
     }
 
     // some layers might have been removed, so
@@ -1866,6 +2042,7 @@ void SurfaceFlinger::handleTransactionLocked(uint32_t transactionFlags)
     if (mLayersRemoved) {
         mLayersRemoved = false;
         mVisibleRegionsDirty = true;
+        mLayerTreeChanged = true;
         mDrawingState.traverseInZOrder([&](Layer* layer) {
             if (mLayersPendingRemoval.indexOf(layer) >= 0) {
                 // this layer is not visible anymore
@@ -1927,22 +2104,58 @@ void SurfaceFlinger::commitTransaction()
     mAnimCompositionPending = mAnimTransactionPending;
 
     mDrawingState = mCurrentState;
-    mDrawingState.traverseInZOrder([](Layer* layer) {
+    // Not through the traversal cache: the tree changes as we walk it
+    mDrawingState.layersSortedByZ.traverseInZOrder(LayerVector::StateSet::Drawing,
+            [](Layer* layer) {
         layer->commitChildList();
     });
+    if (mLayerTreeChanged) {
+        mLayerTreeChanged = false;
+        mDrawingState.invalidateTraversalCache();
+    }
     mTransactionPending = false;
     mAnimTransactionPending = false;
     mTransactionCV.broadcast();
 }
 
+// Conservative equality: regions are only reported equal when they are
+// stored as the same list of rectangles.
+static bool regionsEqual(const Region& a, const Region& b) {
+    if (a.isTriviallyEqual(b)) {
+        return true;
+    }
+    size_t countA = 0, countB = 0;
+    const Rect* const rectsA = a.getArray(&countA);
+    const Rect* const rectsB = b.getArray(&countB);
+    if (countA != countB) {
+        return false;
+    }
+    for (size_t i = 0; i < countA; i++) {
+        if (rectsA[i] != rectsB[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
 void SurfaceFlinger::computeVisibleRegions(uint32_t layerStack,
-        Region& outDirtyRegion, Region& outOpaqueRegion)
+        Region& outDirtyRegion, Region& outOpaqueRegion, bool incremental)
 {
     ATRACE_CALL();
 
     Region aboveOpaqueLayers;
     Region aboveCoveredLayers;
     Region dirty;
+    Region tmp;
+    Region::Scratch& scratch(mRegionScratch);
+
+    // In incremental mode, inSync is true as long as aboveOpaqueLayers and
+    // aboveCoveredLayers are identical to what they were at the same point
+    // of the previous computation. A layer that is not dirty and sees the
+    // same accumulators as last time would produce the same regions, so we
+    // reuse them along with the accumulators it produced.
+    bool inSync = incremental;
+    int32_t aboveSequence = -1;
 
     outDirtyRegion.clear();
 
@@ -1954,6 +2167,26 @@ void SurfaceFlinger::computeVisibleRegions(uint32_t layerStack,
         if (layer->getLayerStack() != layerStack)
             return;
 
+        Layer::VisibleRegionSnapshot& snapshot(layer->visibleRegionSnapshot);
+        if (inSync && snapshot.valid && snapshot.layerStack == layerStack &&
+                snapshot.aboveSequence == aboveSequence &&
+                !layer->contentDirty && !layer->isVisibleRegionDirty()) {
+            // Nothing changed for this layer: its dirty contribution is what
+            // the exposed region computation below yields for identical
+            // inputs, i.e. the visible area that is covered by layers above.
+            tmp = layer->visibleRegion;
+            tmp.andSelf(layer->coveredRegion, scratch);
+            outDirtyRegion.orSelf(tmp, scratch);
+            aboveOpaqueLayers = snapshot.aboveOpaqueLayers;
+            aboveCoveredLayers = snapshot.aboveCoveredLayers;
+            aboveSequence = layer->sequence;
+            mVisibleRegionStats.lastSkipped++;
+            mVisibleRegionStats.totalSkipped++;
+            return;
+        }
+        mVisibleRegionStats.lastComputed++;
+        mVisibleRegionStats.totalComputed++;
+
         /*
          * opaqueRegion: area of a surface that is fully opaque.
          */
@@ -2014,20 +2247,21 @@ void SurfaceFlinger::computeVisibleRegions(uint32_t layerStack,
         }
 
         // Clip the covered region to the visible region
-        coveredRegion = aboveCoveredLayers.intersect(visibleRegion);
+        coveredRegion = aboveCoveredLayers;
+        coveredRegion.andSelf(visibleRegion, scratch);
 
         // Update aboveCoveredLayers for next (lower) layer
-        aboveCoveredLayers.orSelf(visibleRegion);
+        aboveCoveredLayers.orSelf(visibleRegion, scratch);
 
         // subtract the opaque region covered by the layers above us
-        visibleRegion.subtractSelf(aboveOpaqueLayers);
+        visibleRegion.subtractSelf(aboveOpaqueLayers, scratch);
 
         // compute this layer's dirty region
         if (layer->contentDirty) {
             // we need to invalidate the whole region
             dirty = visibleRegion;
             // as well, as the old visible region
-            dirty.orSelf(layer->visibleRegion);
+            dirty.orSelf(layer->visibleRegion, scratch);
             layer->contentDirty = false;
         } else {
             /* compute the exposed region:
@@ -2042,25 +2276,48 @@ void SurfaceFlinger::computeVisibleRegions(uint32_t layerStack,
              * (2) handles areas that were not covered by anything but got
              * exposed because of a resize.
              */
-            const Region newExposed = visibleRegion - coveredRegion;
-            const Region oldVisibleRegion = layer->visibleRegion;
-            const Region oldCoveredRegion = layer->coveredRegion;
-            const Region oldExposed = oldVisibleRegion - oldCoveredRegion;
-            dirty = (visibleRegion&oldCoveredRegion) | (newExposed-oldExposed);
+            // dirty = (visible & oldCovered) | (newExposed - oldExposed),
+            // built in place so that no temporary is needed
+            const Region& oldVisibleRegion = layer->visibleRegion;
+            const Region& oldCoveredRegion = layer->coveredRegion;
+            dirty = oldVisibleRegion;
+            dirty.subtractSelf(oldCoveredRegion, scratch);
+            tmp = visibleRegion;
+            tmp.subtractSelf(coveredRegion, scratch);
+            tmp.subtractSelf(dirty, scratch);
+            dirty = visibleRegion;
+            dirty.andSelf(oldCoveredRegion, scratch);
+            dirty.orSelf(tmp, scratch);
         }
-        dirty.subtractSelf(aboveOpaqueLayers);
+        dirty.subtractSelf(aboveOpaqueLayers, scratch);
 
         // accumulate to the screen dirty region
-        outDirtyRegion.orSelf(dirty);
+        outDirtyRegion.orSelf(dirty, scratch);
 
         // Update aboveOpaqueLayers for next (lower) layer
-        aboveOpaqueLayers.orSelf(opaqueRegion);
+        aboveOpaqueLayers.orSelf(opaqueRegion, scratch);
 
         // Store the visible region in screen space
         layer->setVisibleRegion(visibleRegion);
         layer->setCoveredRegion(coveredRegion);
-        layer->setVisibleNonTransparentRegion(
-                visibleRegion.subtract(transparentRegion));
+        tmp = visibleRegion;
+        tmp.subtractSelf(transparentRegion, scratch);
+        layer->setVisibleNonTransparentRegion(tmp);
+
+        // Layers below can only be skipped if we ended up with the same
+        // accumulators as last time.
+        inSync = incremental && snapshot.valid &&
+                snapshot.layerStack == layerStack &&
+                snapshot.aboveSequence == aboveSequence &&
+                regionsEqual(aboveOpaqueLayers, snapshot.aboveOpaqueLayers) &&
+                regionsEqual(aboveCoveredLayers, snapshot.aboveCoveredLayers);
+
+        snapshot.valid = true;
+        snapshot.layerStack = layerStack;
+        snapshot.aboveSequence = aboveSequence;
+        snapshot.aboveOpaqueLayers = aboveOpaqueLayers;
+        snapshot.aboveCoveredLayers = aboveCoveredLayers;
+        aboveSequence = layer->sequence;
     });
 
     outOpaqueRegion = aboveOpaqueLayers;
@@ -2071,7 +2328,7 @@ void SurfaceFlinger::invalidateLayerStack(uint32_t layerStack,
     for (size_t dpy=0 ; dpy<mDisplays.size() ; dpy++) {
         const sp<DisplayDevice>& hw(mDisplays[dpy]);
         if (hw->getLayerStack() == layerStack) {
-            hw->dirtyRegion.orSelf(dirty);
+            hw->dirtyRegion.orSelf(dirty, mRegionScratch);
         }
     }
 }
@@ -2108,12 +2365,17 @@ bool SurfaceFlinger::handlePageFlip()
     });
     for (size_t i = 0, count = layersWithQueuedFrames.size() ; i<count ; i++) {
         Layer* layer = layersWithQueuedFrames[i];
-        const Region dirty(layer->latchBuffer(visibleRegions, latchTime));
+        bool layerVisibleRegions = false;
+        const Region dirty(layer->latchBuffer(layerVisibleRegions, latchTime));
+        if (layerVisibleRegions) {
+            layer->visibleRegionDirty = true;
+            visibleRegions = true;
+        }
         layer->useSurfaceDamage();
         invalidateLayerStack(layer->getLayerStack(), dirty);
     }
 
-    mVisibleRegionsDirty |= visibleRegions;
+    mLayerVisibleRegionsDirty |= visibleRegions;
 
     // If we will need to wake up at some time in the future to deal with a
     // queued frame that shouldn't be displayed during this vsync period, wake
@@ -2209,6 +2471,8 @@ bool SurfaceFlinger::doComposeSurfaces(const sp<const DisplayDevice>& hw, const
             return false;
         }
 
+        engine.beginGpuTimer(hw->getDisplayType());
+
         // Never touch the framebuffer if we don't have any framebuffer layers
         const bool hasHwcComposition = hwc.hasHwcComposition(id);
         if (hasHwcComposition) {
@@ -2266,6 +2530,8 @@ bool SurfaceFlinger::doComposeSurfaces(const sp<const DisplayDevice>& hw, const
     const Vector< sp<Layer> >& layers(hw->getVisibleLayersSortedByZ());
     const size_t count = layers.size();
     const Transform& tr = hw->getTransform();
+    // clears and dim layers drawn one after the other can share a draw call
+    engine.beginBatch();
     if (cur != end) {
         // we're using h/w composer
         for (size_t i=0 ; i<count && cur!=end ; ++i, ++cur) {
@@ -2311,6 +2577,8 @@ bool SurfaceFlinger::doComposeSurfaces(const sp<const DisplayDevice>& hw, const
             }
         }
     }
+    engine.endBatch();
+    engine.endGpuTimer();
 
     // disable scissor at the end of the frame
     engine.disableScissor();
@@ -2417,14 +2685,132 @@ uint32_t SurfaceFlinger::setTransactionFlags(uint32_t flags) {
     return old;
 }
 
+bool SurfaceFlinger::queueTransaction(
+        const Vector<ComposerState>& state,
+        const Vector<DisplayState>& displays,
+        uint32_t flags)
+{
+    const uint32_t coalescable = layer_state_t::ePositionChanged |
+            layer_state_t::eAlphaChanged | layer_state_t::eMatrixChanged;
+
+    if (!mCoalesceTransactions || flags != 0 || !displays.isEmpty() ||
+            state.isEmpty() || mInterceptor.isEnabled()) {
+        return false;
+    }
+    for (size_t i=0 ; i<state.size() ; i++) {
+        const ComposerState& s(state[i]);
+        if ((s.state.what & ~coalescable) != 0 || s.state.surface == NULL ||
+                s.client == NULL) {
+            return false;
+        }
+        // Same check as in setTransactionState
+        sp<IBinder> binder = IInterface::asBinder(s.client);
+        if (binder == NULL || binder->queryLocalInterface(
+                ISurfaceComposerClient::descriptor) == NULL) {
+            return false;
+        }
+    }
+
+    for (size_t i=0 ; i<state.size() ; i++) {
+        const ComposerState& s(state[i]);
+        sp<Client> client(static_cast<Client *>(s.client.get()));
+        sp<Layer> layer(client->getLayerUser(s.state.surface));
+        // Same as setClientStateLocked, changes to dead layers are dropped
+        if (layer != 0 && !layer->publishState(s.state)) {
+            // Later changes replace earlier ones
+            mTransactionQueueStats.numLayerStatesMerged++;
+        }
+    }
+    mTransactionQueueStats.numQueued++;
+
+    // Only wake up the main thread for the first transaction of the batch,
+    // the others are picked up by the same handleMessageTransaction().
+    if (!mHasPublishedStates.exchange(true)) {
+        signalTransaction();
+    }
+    return true;
+}
+
+uint32_t SurfaceFlinger::applyQueuedTransactionsLocked()
+{
+    if (!mHasPublishedStates.exchange(false)) {
+        return 0;
+    }
+
+    ATRACE_CALL();
+    uint32_t transactionFlags = 0;
+    // Layers that didn't publish anything only cost an atomic load here
+    mCurrentState.traverseInZOrder([&](Layer* layer) {
+        layer_state_t s;
+        if (!layer->takePublishedState(&s)) {
+            return;
+        }
+        mTransactionQueueStats.numLayerStatesApplied++;
+        // The coalesced transaction can't have eGeometryAppliesWithResize
+        if (s.what & layer_state_t::ePositionChanged) {
+            if (layer->setPosition(s.x, s.y, true)) {
+                transactionFlags |= eTraversalNeeded;
+            }
+        }
+        if (s.what & layer_state_t::eAlphaChanged) {
+            if (layer->setAlpha(uint8_t(255.0f*s.alpha+0.5f)))
+                transactionFlags |= eTraversalNeeded;
+        }
+        if (s.what & layer_state_t::eMatrixChanged) {
+            if (layer->setMatrix(s.matrix))
+                transactionFlags |= eTraversalNeeded;
+        }
+    });
+    mTransactionQueueStats.numFlushes++;
+    return transactionFlags;
+}
+
+uint32_t SurfaceFlinger::applyLayerPropertyBlocksLocked()
+{
+    ATRACE_CALL();
+    uint32_t transactionFlags = 0;
+    bool changed = false;
+    mCurrentState.traverseInZOrder([&](Layer* layer) {
+        layer_state_t s;
+        if (!layer->readPropertyBlock(&s)) {
+            return;
+        }
+        changed = true;
+        if (s.what & layer_state_t::ePositionChanged) {
+            if (layer->setPosition(s.x, s.y, true)) {
+                transactionFlags |= eTraversalNeeded;
+            }
+        }
+        if (s.what & layer_state_t::eAlphaChanged) {
+            if (layer->setAlpha(uint8_t(255.0f*s.alpha+0.5f)))
+                transactionFlags |= eTraversalNeeded;
+        }
+        if (s.what & layer_state_t::eMatrixChanged) {
+            if (layer->setMatrix(s.matrix))
+                transactionFlags |= eTraversalNeeded;
+        }
+    });
+    if (changed) {
+        // Keep polling the blocks while they change, the clients only
+        // signal us once we found them idle.
+        signalLayerUpdate();
+    }
+    return transactionFlags;
+}
+
 void SurfaceFlinger::setTransactionState(
         const Vector<ComposerState>& state,
         const Vector<DisplayState>& displays,
         uint32_t flags)
 {
     ATRACE_CALL();
+    if (queueTransaction(state, displays, flags)) {
+        return;
+    }
+
     Mutex::Autolock _l(mStateLock);
-    uint32_t transactionFlags = 0;
+    // Anything queued before this transaction must be applied first.
+    uint32_t transactionFlags = applyQueuedTransactionsLocked();
 
     if (flags & eAnimation) {
         // For window updates that are part of an animation we must wait for
@@ -2885,6 +3271,8 @@ void SurfaceFlinger::setPowerModeInternal(const sp<DisplayDevice>& hw,
         if (type == DisplayDevice::DISPLAY_PRIMARY) {
             // FIXME: eventthread only knows about the main display right now
             mEventThread->onScreenAcquired();
+            mLowLatencyEventThread->onScreenAcquired();
+            mLateEventThread->onScreenAcquired();
             resyncToHardwareVsync(true);
         }
 
@@ -2909,6 +3297,8 @@ void SurfaceFlinger::setPowerModeInternal(const sp<DisplayDevice>& hw,
 
             // FIXME: eventthread only knows about the main display right now
             mEventThread->onScreenReleased();
+            mLowLatencyEventThread->onScreenReleased();
+            mLateEventThread->onScreenReleased();
         }
 
         getHwComposer().setPowerMode(type, mode);
@@ -2959,6 +3349,9 @@ status_t SurfaceFlinger::dump(int fd, const Vector<String16>& args)
             !PermissionCache::checkPermission(sDump, pid, uid)) {
         result.appendFormat("Permission Denial: "
                 "can't dump SurfaceFlinger from pid=%d, uid=%d\n", pid, uid);
+    } else if (args.size() && args[0] == String16("--snapshot")) {
+        size_t index = 1;
+        dumpSnapshot(args, index, result);
     } else {
         // Try to get the main lock, but give up after one second
         // (this would indicate SF is stuck, but we want to be able to
@@ -3016,6 +3409,20 @@ status_t SurfaceFlinger::dump(int fd, const Vector<String16>& args)
                 dumpFrameEventsLocked(result);
                 dumpAll = false;
             }
+
+            if ((index < numArgs) &&
+                    (args[index] == String16("--gpu-timing"))) {
+                index++;
+                mRenderEngine->dumpGpuTimings(result);
+                dumpAll = false;
+            }
+
+            if ((index < numArgs) &&
+                    (args[index] == String16("--gralloc-uids"))) {
+                index++;
+                GraphicBufferAllocator::get().dumpUidUsage(result);
+                dumpAll = false;
+            }
         }
 
         if (dumpAll) {
@@ -3030,6 +3437,69 @@ status_t SurfaceFlinger::dump(int fd, const Vector<String16>& args)
     return NO_ERROR;
 }
 
+void SurfaceFlinger::dumpSnapshot(const Vector<String16>& args, size_t& index,
+        String8& result)
+{
+    bool colorize = false;
+    if (index < args.size()
+            && (args[index] == String16("--color"))) {
+        colorize = true;
+        index++;
+    }
+
+    class MessageTakeDumpSnapshot : public MessageBase {
+        SurfaceFlinger& mFlinger;
+    public:
+        DumpSnapshot snapshot;
+
+        explicit MessageTakeDumpSnapshot(SurfaceFlinger& flinger)
+            : mFlinger(flinger) { }
+        virtual bool handler() {
+            mFlinger.takeDumpSnapshot(&snapshot);
+            return true;
+        }
+    };
+
+    // The main thread handles the message between two frames. The message
+    // owns the snapshot, so it stays valid if we give up waiting for it.
+    sp<MessageTakeDumpSnapshot> msg = new MessageTakeDumpSnapshot(*this);
+    status_t err = mEventQueue.postMessage(msg);
+    if (err != NO_ERROR || !msg->waitFor(s2ns(1))) {
+        result.appendFormat("SurfaceFlinger appears to be unresponsive, "
+                "can't take a snapshot (%d)\n", err);
+        return;
+    }
+
+    Colorizer colorizer(colorize);
+    msg->snapshot.dump(result, colorizer);
+}
+
+void SurfaceFlinger::takeDumpSnapshot(DumpSnapshot* outSnapshot)
+{
+    outSnapshot->takenAt = systemTime();
+    outSnapshot->vsyncPeriod = mPrimaryDispSync.getPeriod();
+
+    outSnapshot->layers.reserve(mDrawingState.layersSortedByZ.size());
+    mDrawingState.traverseInZOrder([&](Layer* layer) {
+        outSnapshot->layers.emplace_back();
+        layer->getDumpSnapshot(&outSnapshot->layers.back());
+    });
+
+    outSnapshot->displays.resize(mDisplays.size());
+    for (size_t dpy = 0; dpy < mDisplays.size(); dpy++) {
+        const sp<const DisplayDevice>& hw(mDisplays[dpy]);
+        DumpSnapshot::DisplayState& display(outSnapshot->displays[dpy]);
+        display.name = hw->getDisplayName();
+        display.type = hw->getDisplayType();
+        display.layerStack = hw->getLayerStack();
+        display.width = hw->getWidth();
+        display.height = hw->getHeight();
+        display.powerMode = hw->getPowerMode();
+        display.pageFlipCount = hw->getPageFlipCount();
+        display.numVisibleLayers = hw->getVisibleLayersSortedByZ().size();
+    }
+}
+
 void SurfaceFlinger::listLayersLocked(const Vector<String16>& /* args */,
         size_t& /* index */, String8& result) const
 {
@@ -3134,6 +3604,32 @@ void SurfaceFlinger::dumpFrameEventsLocked(String8& result) {
     }
 }
 
+void SurfaceFlinger::dumpVisibleRegionStats(String8& result) const
+{
+    const VisibleRegionStats& stats(mVisibleRegionStats);
+    result.appendFormat("Visible region stats (incremental mode %s):\n",
+            mIncrementalVisibleRegions ? "enabled" : "disabled");
+    result.appendFormat("  last pass: %zu layers computed, %zu skipped\n",
+            stats.lastComputed, stats.lastSkipped);
+    const uint64_t total = stats.totalComputed + stats.totalSkipped;
+    const float percent = total > 0 ?
+            100.0f * static_cast<float>(stats.totalSkipped) / total : 0.0f;
+    result.appendFormat("  %" PRIu64 " passes: %" PRIu64 " layers computed, "
+            "%" PRIu64 " skipped (%.1f%%)\n", stats.numPasses,
+            stats.totalComputed, stats.totalSkipped, percent);
+}
+
+void SurfaceFlinger::dumpTransactionQueueStats(String8& result) const
+{
+    const TransactionQueueStats& stats(mTransactionQueueStats);
+    result.appendFormat("Transaction queue (coalescing %s):\n",
+            mCoalesceTransactions ? "enabled" : "disabled");
+    result.appendFormat("  %" PRIu64 " transactions queued, %" PRIu64
+            " layer states merged, %" PRIu64 " applied in %" PRIu64
+            " flushes\n", stats.numQueued.load(), stats.numLayerStatesMerged.load(),
+            stats.numLayerStatesApplied.load(), stats.numFlushes.load());
+}
+
 void SurfaceFlinger::recordBufferingStats(const char* layerName,
         std::vector<OccupancyTracker::Segment>&& history) {
     Mutex::Autolock lock(mBufferingStatsMutex);
@@ -3239,6 +3735,21 @@ void SurfaceFlinger::dumpAllLocked(const Vector<String16>& args, size_t& index,
 
     dumpBufferingStats(result);
 
+    dumpVisibleRegionStats(result);
+    result.append("\n");
+
+    dumpTransactionQueueStats(result);
+    result.append("\n");
+
+    mFrameTimeline.dump(result);
+    result.append("\n");
+
+    mScreenshotBufferPool.dump(result);
+    result.append("\n");
+
+    mInterceptor.dump(result);
+    result.append("\n");
+
     /*
      * Dump the visible layer list
      */
@@ -3311,6 +3822,12 @@ void SurfaceFlinger::dumpAllLocked(const Vector<String16>& args, size_t& index,
      * VSYNC state
      */
     mEventThread->dump(result);
+    result.appendFormat("Low latency app channel (offset %" PRId64 " ns):\n",
+            mLowLatencyVsyncPhaseOffsetNs);
+    mLowLatencyEventThread->dump(result);
+    result.appendFormat("Late app channel (offset %" PRId64 " ns):\n",
+            mLateVsyncPhaseOffsetNs);
+    mLateEventThread->dump(result);
 
     /*
      * Dump HWComposer state
@@ -3329,6 +3846,8 @@ void SurfaceFlinger::dumpAllLocked(const Vector<String16>& args, size_t& index,
      */
     const GraphicBufferAllocator& alloc(GraphicBufferAllocator::get());
     alloc.dump(result);
+    alloc.dumpUidUsage(result);
+    GraphicBufferPool::getInstance().dump(result);
 }
 
 const Vector< sp<Layer> >&
@@ -3378,6 +3897,7 @@ status_t SurfaceFlinger::onTransact(
         case GET_ANIMATION_FRAME_STATS:
         case SET_POWER_MODE:
         case GET_HDR_CAPABILITIES:
+        case GET_FRAME_TIMELINE:
         {
             // codes that require permission check
             IPCThreadState* ipc = IPCThreadState::self();
@@ -3403,6 +3923,8 @@ status_t SurfaceFlinger::onTransact(
             break;
         }
         case CAPTURE_SCREEN:
+        case CAPTURE_SCREEN_TO_BUFFER:
+        case RELEASE_CAPTURE_BUFFER:
         {
             // codes that require permission check
             IPCThreadState* ipc = IPCThreadState::self();
@@ -3546,11 +4068,12 @@ status_t SurfaceFlinger::onTransact(
                 mSFEventThread->setPhaseOffset(static_cast<nsecs_t>(n));
                 return NO_ERROR;
             }
-            case 1020: { // Layer updates interceptor
+            case 1020: { // Layer updates interceptor, 2 streams to disk
                 n = data.readInt32();
                 if (n) {
                     ALOGV("Interceptor enabled");
-                    mInterceptor.enable(mDrawingState.layersSortedByZ, mDrawingState.displays);
+                    mInterceptor.enable(mDrawingState.layersSortedByZ, mDrawingState.displays,
+                            n == 2);
                 }
                 else{
                     ALOGV("Interceptor disabled");
@@ -3690,6 +4213,23 @@ public:
 };
 
 
+static Transform::orientation_flags toRotationFlags(
+        ISurfaceComposer::Rotation rotation) {
+    switch (rotation) {
+        case ISurfaceComposer::eRotateNone:
+            return Transform::ROT_0;
+        case ISurfaceComposer::eRotate90:
+            return Transform::ROT_90;
+        case ISurfaceComposer::eRotate180:
+            return Transform::ROT_180;
+        case ISurfaceComposer::eRotate270:
+            return Transform::ROT_270;
+        default:
+            ALOGE("Invalid rotation passed to captureScreen(): %d\n", rotation);
+            return Transform::ROT_0;
+    }
+}
+
 status_t SurfaceFlinger::captureScreen(const sp<IBinder>& display,
         const sp<IGraphicBufferProducer>& producer,
         Rect sourceCrop, uint32_t reqWidth, uint32_t reqHeight,
@@ -3708,25 +4248,7 @@ status_t SurfaceFlinger::captureScreen(const sp<IBinder>& display,
     bool isLocalScreenshot = IInterface::asBinder(producer)->localBinder();
 
     // Convert to surfaceflinger's internal rotation type.
-    Transform::orientation_flags rotationFlags;
-    switch (rotation) {
-        case ISurfaceComposer::eRotateNone:
-            rotationFlags = Transform::ROT_0;
-            break;
-        case ISurfaceComposer::eRotate90:
-            rotationFlags = Transform::ROT_90;
-            break;
-        case ISurfaceComposer::eRotate180:
-            rotationFlags = Transform::ROT_180;
-            break;
-        case ISurfaceComposer::eRotate270:
-            rotationFlags = Transform::ROT_270;
-            break;
-        default:
-            rotationFlags = Transform::ROT_0;
-            ALOGE("Invalid rotation passed to captureScreen(): %d\n", rotation);
-            break;
-    }
+    Transform::orientation_flags rotationFlags = toRotationFlags(rotation);
 
     class MessageCaptureScreen : public MessageBase {
         SurfaceFlinger* flinger;
@@ -3789,6 +4311,92 @@ status_t SurfaceFlinger::captureScreen(const sp<IBinder>& display,
     return res;
 }
 
+status_t SurfaceFlinger::captureScreenToBuffer(const sp<IBinder>& display,
+        Rect sourceCrop, uint32_t reqWidth, uint32_t reqHeight,
+        int32_t minLayerZ, int32_t maxLayerZ,
+        bool useIdentityTransform, ISurfaceComposer::Rotation rotation,
+        sp<GraphicBuffer>* outBuffer, sp<Fence>* outFence) {
+
+    if (CC_UNLIKELY(display == 0))
+        return BAD_VALUE;
+
+    if (CC_UNLIKELY(outBuffer == nullptr || outFence == nullptr))
+        return BAD_VALUE;
+
+    // Same as captureScreen, secure windows can only be captured by
+    // SurfaceFlinger itself.
+    bool isLocalScreenshot = IPCThreadState::self()->getCallingPid() == getpid();
+
+    class MessageCaptureScreenToBuffer : public MessageBase {
+        SurfaceFlinger* flinger;
+        sp<IBinder> display;
+        Rect sourceCrop;
+        uint32_t reqWidth, reqHeight;
+        int32_t minLayerZ,maxLayerZ;
+        bool useIdentityTransform;
+        Transform::orientation_flags rotation;
+        bool isLocalScreenshot;
+        status_t result;
+        sp<GraphicBuffer> buffer;
+        sp<Fence> fence;
+    public:
+        MessageCaptureScreenToBuffer(SurfaceFlinger* flinger,
+                const sp<IBinder>& display,
+                Rect sourceCrop, uint32_t reqWidth, uint32_t reqHeight,
+                int32_t minLayerZ, int32_t maxLayerZ,
+                bool useIdentityTransform,
+                Transform::orientation_flags rotation,
+                bool isLocalScreenshot)
+            : flinger(flinger), display(display),
+              sourceCrop(sourceCrop), reqWidth(reqWidth), reqHeight(reqHeight),
+              minLayerZ(minLayerZ), maxLayerZ(maxLayerZ),
+              useIdentityTransform(useIdentityTransform),
+              rotation(rotation), isLocalScreenshot(isLocalScreenshot),
+              result(PERMISSION_DENIED)
+        {
+        }
+        status_t getResult() const {
+            return result;
+        }
+        const sp<GraphicBuffer>& getBuffer() const {
+            return buffer;
+        }
+        const sp<Fence>& getFence() const {
+            return fence;
+        }
+        virtual bool handler() {
+            Mutex::Autolock _l(flinger->mStateLock);
+            sp<const DisplayDevice> hw(flinger->getDisplayDeviceLocked(display));
+            result = flinger->captureScreenToBufferImplLocked(hw,
+                    sourceCrop, reqWidth, reqHeight, minLayerZ, maxLayerZ,
+                    useIdentityTransform, rotation, isLocalScreenshot,
+                    &buffer, &fence);
+            return true;
+        }
+    };
+
+    // Only the GL commands are issued on the main thread, the caller waits
+    // on the returned fence for the GPU to be done.
+    sp<MessageCaptureScreenToBuffer> msg = new MessageCaptureScreenToBuffer(
+            this, display, sourceCrop, reqWidth, reqHeight, minLayerZ,
+            maxLayerZ, useIdentityTransform, toRotationFlags(rotation),
+            isLocalScreenshot);
+    status_t res = postMessageSync(msg);
+    if (res == NO_ERROR) {
+        res = msg->getResult();
+    }
+    if (res == NO_ERROR) {
+        *outBuffer = msg->getBuffer();
+        *outFence = msg->getFence();
+    }
+    return res;
+}
+
+void SurfaceFlinger::releaseCaptureBuffer(uint64_t bufferId,
+        const sp<Fence>& releaseFence) {
+    mScreenshotBufferPool.release(bufferId, releaseFence);
+}
+
 
 void SurfaceFlinger::renderScreenImplLocked(
         const sp<const DisplayDevice>& hw,
@@ -3873,6 +4481,69 @@ status_t SurfaceFlinger::captureScreenImplLocked(
 {
     ATRACE_CALL();
 
+    status_t result = checkScreenCaptureLocked(hw, &reqWidth, &reqHeight,
+            minLayerZ, maxLayerZ, rotation, isLocalScreenshot);
+    if (result != NO_ERROR) {
+        return result;
+    }
+
+    // create a surface (because we're a producer, and we need to
+    // dequeue/queue a buffer)
+    sp<Surface> sur = new Surface(producer, false);
+    ANativeWindow* window = sur.get();
+
+    result = native_window_api_connect(window, NATIVE_WINDOW_API_EGL);
+    if (result == NO_ERROR) {
+        uint32_t usage = GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_SW_WRITE_OFTEN |
+                        GRALLOC_USAGE_HW_RENDER | GRALLOC_USAGE_HW_TEXTURE;
+
+        int err = 0;
+        err = native_window_set_buffers_dimensions(window, reqWidth, reqHeight);
+        err |= native_window_set_scaling_mode(window, NATIVE_WINDOW_SCALING_MODE_SCALE_TO_WINDOW);
+        err |= native_window_set_buffers_format(window, HAL_PIXEL_FORMAT_RGBA_8888);
+        err |= native_window_set_usage(window, usage);
+
+        if (err == NO_ERROR) {
+            ANativeWindowBuffer* buffer;
+            /* TODO: Once we have the sync framework everywhere this can use
+             * server-side waits on the fence that dequeueBuffer returns.
+             */
+            result = native_window_dequeue_buffer_and_wait(window,  &buffer);
+            if (result == NO_ERROR) {
+                int syncFd = -1;
+                result = renderScreenToBufferLocked(hw,
+                        GraphicBuffer::from(buffer), false, sourceCrop,
+                        reqWidth, reqHeight, minLayerZ, maxLayerZ,
+                        useIdentityTransform, rotation, &syncFd);
+                if (result == INVALID_OPERATION) {
+                    window->cancelBuffer(window, buffer, syncFd);
+                    buffer = NULL;
+                }
+                if (buffer) {
+                    // queueBuffer takes ownership of syncFd
+                    result = window->queueBuffer(window, buffer, syncFd);
+                }
+            }
+        } else {
+            result = BAD_VALUE;
+        }
+        native_window_api_disconnect(window, NATIVE_WINDOW_API_EGL);
+    }
+
+    return result;
+}
+
+status_t SurfaceFlinger::checkScreenCaptureLocked(
+        const sp<const DisplayDevice>& hw,
+        uint32_t* inOutReqWidth, uint32_t* inOutReqHeight,
+        int32_t minLayerZ, int32_t maxLayerZ,
+        Transform::orientation_flags rotation, bool isLocalScreenshot)
+{
+    if (hw == nullptr) {
+        ALOGE("screen capture: invalid display");
+        return BAD_VALUE;
+    }
+
     // get screen geometry
     uint32_t hw_w = hw->getWidth();
     uint32_t hw_h = hw->getHeight();
@@ -3881,14 +4552,14 @@ status_t SurfaceFlinger::captureScreenImplLocked(
         std::swap(hw_w, hw_h);
     }
 
-    if ((reqWidth > hw_w) || (reqHeight > hw_h)) {
+    if ((*inOutReqWidth > hw_w) || (*inOutReqHeight > hw_h)) {
         ALOGE("size mismatch (%d, %d) > (%d, %d)",
-                reqWidth, reqHeight, hw_w, hw_h);
+                *inOutReqWidth, *inOutReqHeight, hw_w, hw_h);
         return BAD_VALUE;
     }
 
-    reqWidth  = (!reqWidth)  ? hw_w : reqWidth;
-    reqHeight = (!reqHeight) ? hw_h : reqHeight;
+    *inOutReqWidth  = (!*inOutReqWidth)  ? hw_w : *inOutReqWidth;
+    *inOutReqHeight = (!*inOutReqHeight) ? hw_h : *inOutReqHeight;
 
     bool secureLayerIsVisible = false;
     for (const auto& layer : mDrawingState.layersSortedByZ) {
@@ -3907,118 +4578,130 @@ status_t SurfaceFlinger::captureScreenImplLocked(
         ALOGW("FB is protected: PERMISSION_DENIED");
         return PERMISSION_DENIED;
     }
+    return NO_ERROR;
+}
 
-    // create a surface (because we're a producer, and we need to
-    // dequeue/queue a buffer)
-    sp<Surface> sur = new Surface(producer, false);
-    ANativeWindow* window = sur.get();
-
-    status_t result = native_window_api_connect(window, NATIVE_WINDOW_API_EGL);
-    if (result == NO_ERROR) {
-        uint32_t usage = GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_SW_WRITE_OFTEN |
-                        GRALLOC_USAGE_HW_RENDER | GRALLOC_USAGE_HW_TEXTURE;
-
-        int err = 0;
-        err = native_window_set_buffers_dimensions(window, reqWidth, reqHeight);
-        err |= native_window_set_scaling_mode(window, NATIVE_WINDOW_SCALING_MODE_SCALE_TO_WINDOW);
-        err |= native_window_set_buffers_format(window, HAL_PIXEL_FORMAT_RGBA_8888);
-        err |= native_window_set_usage(window, usage);
-
-        if (err == NO_ERROR) {
-            ANativeWindowBuffer* buffer;
-            /* TODO: Once we have the sync framework everywhere this can use
-             * server-side waits on the fence that dequeueBuffer returns.
-             */
-            result = native_window_dequeue_buffer_and_wait(window,  &buffer);
-            if (result == NO_ERROR) {
-                int syncFd = -1;
-                // create an EGLImage from the buffer so we can later
-                // turn it into a texture
-                EGLImageKHR image = eglCreateImageKHR(mEGLDisplay, EGL_NO_CONTEXT,
-                        EGL_NATIVE_BUFFER_ANDROID, buffer, NULL);
-                if (image != EGL_NO_IMAGE_KHR) {
-                    // this binds the given EGLImage as a framebuffer for the
-                    // duration of this scope.
-                    RenderEngine::BindImageAsFramebuffer imageBond(getRenderEngine(), image);
-                    if (imageBond.getStatus() == NO_ERROR) {
-                        // this will in fact render into our dequeued buffer
-                        // via an FBO, which means we didn't have to create
-                        // an EGLSurface and therefore we're not
-                        // dependent on the context's EGLConfig.
-                        renderScreenImplLocked(
-                            hw, sourceCrop, reqWidth, reqHeight, minLayerZ, maxLayerZ, true,
-                            useIdentityTransform, rotation);
-
-                        // Attempt to create a sync khr object that can produce a sync point. If that
-                        // isn't available, create a non-dupable sync object in the fallback path and
-                        // wait on it directly.
-                        EGLSyncKHR sync;
-                        if (!DEBUG_SCREENSHOTS) {
-                           sync = eglCreateSyncKHR(mEGLDisplay, EGL_SYNC_NATIVE_FENCE_ANDROID, NULL);
-                           // native fence fd will not be populated until flush() is done.
-                           getRenderEngine().flush();
-                        } else {
-                            sync = EGL_NO_SYNC_KHR;
-                        }
-                        if (sync != EGL_NO_SYNC_KHR) {
-                            // get the sync fd
-                            syncFd = eglDupNativeFenceFDANDROID(mEGLDisplay, sync);
-                            if (syncFd == EGL_NO_NATIVE_FENCE_FD_ANDROID) {
-                                ALOGW("captureScreen: failed to dup sync khr object");
-                                syncFd = -1;
-                            }
-                            eglDestroySyncKHR(mEGLDisplay, sync);
-                        } else {
-                            // fallback path
-                            sync = eglCreateSyncKHR(mEGLDisplay, EGL_SYNC_FENCE_KHR, NULL);
-                            if (sync != EGL_NO_SYNC_KHR) {
-                                EGLint result = eglClientWaitSyncKHR(mEGLDisplay, sync,
-                                    EGL_SYNC_FLUSH_COMMANDS_BIT_KHR, 2000000000 /*2 sec*/);
-                                EGLint eglErr = eglGetError();
-                                if (result == EGL_TIMEOUT_EXPIRED_KHR) {
-                                    ALOGW("captureScreen: fence wait timed out");
-                                } else {
-                                    ALOGW_IF(eglErr != EGL_SUCCESS,
-                                            "captureScreen: error waiting on EGL fence: %#x", eglErr);
-                                }
-                                eglDestroySyncKHR(mEGLDisplay, sync);
-                            } else {
-                                ALOGW("captureScreen: error creating EGL fence: %#x", eglGetError());
-                            }
-                        }
-                        if (DEBUG_SCREENSHOTS) {
-                            uint32_t* pixels = new uint32_t[reqWidth*reqHeight];
-                            getRenderEngine().readPixels(0, 0, reqWidth, reqHeight, pixels);
-                            checkScreenshot(reqWidth, reqHeight, reqWidth, pixels,
-                                    hw, minLayerZ, maxLayerZ);
-                            delete [] pixels;
-                        }
-
+status_t SurfaceFlinger::renderScreenToBufferLocked(
+        const sp<const DisplayDevice>& hw, const sp<GraphicBuffer>& buffer,
+        bool keepTarget,
+        Rect sourceCrop, uint32_t reqWidth, uint32_t reqHeight,
+        int32_t minLayerZ, int32_t maxLayerZ,
+        bool useIdentityTransform, Transform::orientation_flags rotation,
+        int* outSyncFd)
+{
+    ATRACE_CALL();
+    status_t result = NO_ERROR;
+    int syncFd = -1;
+    {
+        // this binds the given buffer as a framebuffer for the
+        // duration of this scope.
+        RenderEngine::BindBufferAsFramebuffer bufferBond(getRenderEngine(),
+                buffer, keepTarget);
+        result = bufferBond.getStatus();
+        if (result == NO_ERROR) {
+            // this will in fact render into our dequeued buffer
+            // via an FBO, which means we didn't have to create
+            // an EGLSurface and therefore we're not
+            // dependent on the context's EGLConfig.
+            renderScreenImplLocked(
+                hw, sourceCrop, reqWidth, reqHeight, minLayerZ, maxLayerZ, true,
+                useIdentityTransform, rotation);
+
+            // Attempt to create a sync khr object that can produce a sync point. If that
+            // isn't available, create a non-dupable sync object in the fallback path and
+            // wait on it directly.
+            EGLSyncKHR sync;
+            if (!DEBUG_SCREENSHOTS) {
+               sync = eglCreateSyncKHR(mEGLDisplay, EGL_SYNC_NATIVE_FENCE_ANDROID, NULL);
+               // native fence fd will not be populated until flush() is done.
+               getRenderEngine().flush();
+            } else {
+                sync = EGL_NO_SYNC_KHR;
+            }
+            if (sync != EGL_NO_SYNC_KHR) {
+                // get the sync fd
+                syncFd = eglDupNativeFenceFDANDROID(mEGLDisplay, sync);
+                if (syncFd == EGL_NO_NATIVE_FENCE_FD_ANDROID) {
+                    ALOGW("captureScreen: failed to dup sync khr object");
+                    syncFd = -1;
+                }
+                eglDestroySyncKHR(mEGLDisplay, sync);
+            } else {
+                // fallback path
+                sync = eglCreateSyncKHR(mEGLDisplay, EGL_SYNC_FENCE_KHR, NULL);
+                if (sync != EGL_NO_SYNC_KHR) {
+                    EGLint result = eglClientWaitSyncKHR(mEGLDisplay, sync,
+                        EGL_SYNC_FLUSH_COMMANDS_BIT_KHR, 2000000000 /*2 sec*/);
+                    EGLint eglErr = eglGetError();
+                    if (result == EGL_TIMEOUT_EXPIRED_KHR) {
+                        ALOGW("captureScreen: fence wait timed out");
                     } else {
-                        ALOGE("got GL_FRAMEBUFFER_COMPLETE_OES error while taking screenshot");
-                        result = INVALID_OPERATION;
-                        window->cancelBuffer(window, buffer, syncFd);
-                        buffer = NULL;
+                        ALOGW_IF(eglErr != EGL_SUCCESS,
+                                "captureScreen: error waiting on EGL fence: %#x", eglErr);
                     }
-                    // destroy our image
-                    eglDestroyImageKHR(mEGLDisplay, image);
+                    eglDestroySyncKHR(mEGLDisplay, sync);
                 } else {
-                    result = BAD_VALUE;
-                }
-                if (buffer) {
-                    // queueBuffer takes ownership of syncFd
-                    result = window->queueBuffer(window, buffer, syncFd);
+                    ALOGW("captureScreen: error creating EGL fence: %#x", eglGetError());
                 }
             }
+            if (DEBUG_SCREENSHOTS) {
+                uint32_t* pixels = new uint32_t[reqWidth*reqHeight];
+                getRenderEngine().readPixels(0, 0, reqWidth, reqHeight, pixels);
+                checkScreenshot(reqWidth, reqHeight, reqWidth, pixels,
+                        hw, minLayerZ, maxLayerZ);
+                delete [] pixels;
+            }
+
         } else {
-            result = BAD_VALUE;
+            ALOGE("failed to bind buffer as framebuffer while taking screenshot");
         }
-        native_window_api_disconnect(window, NATIVE_WINDOW_API_EGL);
     }
-
+    *outSyncFd = syncFd;
     return result;
 }
 
+status_t SurfaceFlinger::captureScreenToBufferImplLocked(
+        const sp<const DisplayDevice>& hw,
+        Rect sourceCrop, uint32_t reqWidth, uint32_t reqHeight,
+        int32_t minLayerZ, int32_t maxLayerZ,
+        bool useIdentityTransform, Transform::orientation_flags rotation,
+        bool isLocalScreenshot,
+        sp<GraphicBuffer>* outBuffer, sp<Fence>* outFence)
+{
+    ATRACE_CALL();
+
+    status_t result = checkScreenCaptureLocked(hw, &reqWidth, &reqHeight,
+            minLayerZ, maxLayerZ, rotation, isLocalScreenshot);
+    if (result != NO_ERROR) {
+        return result;
+    }
+
+    uint32_t usage = GRALLOC_USAGE_SW_READ_OFTEN |
+            GRALLOC_USAGE_HW_RENDER | GRALLOC_USAGE_HW_TEXTURE;
+    sp<GraphicBuffer> buffer = mScreenshotBufferPool.acquire(reqWidth,
+            reqHeight, HAL_PIXEL_FORMAT_RGBA_8888, usage);
+    if (buffer == nullptr) {
+        return NO_MEMORY;
+    }
+
+    int syncFd = -1;
+    result = renderScreenToBufferLocked(hw, buffer, true, sourceCrop,
+            reqWidth, reqHeight, minLayerZ, maxLayerZ,
+            useIdentityTransform, rotation, &syncFd);
+    if (result != NO_ERROR) {
+        if (syncFd >= 0) {
+            close(syncFd);
+        }
+        mScreenshotBufferPool.release(buffer->getId(), Fence::NO_FENCE);
+        return result;
+    }
+
+    *outBuffer = buffer;
+    // An invalid fence means the buffer is ready already
+    *outFence = new Fence(syncFd);
+    return NO_ERROR;
+}
+
 void SurfaceFlinger::checkScreenshot(size_t w, size_t s, size_t h, void const* vaddr,
         const sp<const DisplayDevice>& hw, int32_t minLayerZ, int32_t maxLayerZ) {
     if (DEBUG_SCREENSHOTS) {
@@ -4050,12 +4733,38 @@ void SurfaceFlinger::checkScreenshot(size_t w, size_t s, size_t h, void const* v
 
 // ---------------------------------------------------------------------------
 
+void SurfaceFlinger::State::updateTraversalCache() const {
+    if (traversalCacheValid) {
+        return;
+    }
+    traversalCache.clear();
+    layersSortedByZ.traverseInZOrder(stateSet, [&](Layer* layer) {
+        traversalCache.push_back(layer);
+    });
+    traversalCacheValid = true;
+}
+
 void SurfaceFlinger::State::traverseInZOrder(const LayerVector::Visitor& visitor) const {
-    layersSortedByZ.traverseInZOrder(stateSet, visitor);
+    if (stateSet != LayerVector::StateSet::Drawing) {
+        layersSortedByZ.traverseInZOrder(stateSet, visitor);
+        return;
+    }
+    updateTraversalCache();
+    for (size_t i = 0; i < traversalCache.size(); i++) {
+        visitor(traversalCache[i]);
+    }
 }
 
 void SurfaceFlinger::State::traverseInReverseZOrder(const LayerVector::Visitor& visitor) const {
-    layersSortedByZ.traverseInReverseZOrder(stateSet, visitor);
+    if (stateSet != LayerVector::StateSet::Drawing) {
+        layersSortedByZ.traverseInReverseZOrder(stateSet, visitor);
+        return;
+    }
+    // The reverse traversal visits layers in exactly the opposite order
+    updateTraversalCache();
+    for (size_t i = traversalCache.size(); i > 0; i--) {
+        visitor(traversalCache[i - 1]);
+    }
 }
 
 }; // namespace android
@@ -23,8 +23,17 @@
 
 #include <fstream>
 
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+
 #include <android-base/file.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
 #include <log/log.h>
+#include <utils/String8.h>
 #include <utils/Trace.h>
 
 namespace android {
@@ -37,14 +46,18 @@ SurfaceInterceptor::SurfaceInterceptor(SurfaceFlinger* flinger)
 }
 
 void SurfaceInterceptor::enable(const SortedVector<sp<Layer>>& layers,
-        const DefaultKeyedVector< wp<IBinder>, DisplayDeviceState>& displays)
+        const DefaultKeyedVector< wp<IBinder>, DisplayDeviceState>& displays,
+        bool streaming)
 {
     if (mEnabled) {
         return;
     }
     ATRACE_CALL();
-    mEnabled = true;
     std::lock_guard<std::mutex> protoGuard(mTraceMutex);
+    if (streaming && startStreamingLocked() != NO_ERROR) {
+        return;
+    }
+    mEnabled = true;
     saveExistingDisplaysLocked(displays);
     saveExistingSurfacesLocked(layers);
 }
@@ -56,6 +69,10 @@ void SurfaceInterceptor::disable() {
     ATRACE_CALL();
     std::lock_guard<std::mutex> protoGuard(mTraceMutex);
     mEnabled = false;
+    if (mStreaming) {
+        stopStreamingLocked();
+        return;
+    }
     status_t err(writeProtoFileLocked());
     ALOGE_IF(err == PERMISSION_DENIED, "Could not save the proto file! Permission denied");
     ALOGE_IF(err == NOT_ENOUGH_DATA, "Could not save the proto file! There are missing fields");
@@ -66,6 +83,187 @@ bool SurfaceInterceptor::isEnabled() {
     return mEnabled;
 }
 
+void SurfaceInterceptor::dump(String8& result) const {
+    std::lock_guard<std::mutex> protoGuard(mTraceMutex);
+    result.appendFormat("SurfaceInterceptor: %s\n",
+            !mEnabled ? "disabled" : mStreaming ? "streaming" : "buffering");
+    if (!mStreaming) {
+        return;
+    }
+    const StreamStats& stats(mStreamStats);
+    const nsecs_t averageOverhead = stats.numIncrements > 0 ?
+            stats.totalOverhead / static_cast<nsecs_t>(stats.numIncrements) : 0;
+    result.appendFormat("  %" PRIu64 " increments (%" PRIu64 " bytes), %" PRIu64
+            " dropped, overhead average %" PRId64 " us, max %" PRId64 " us\n",
+            stats.numIncrements, stats.numBytes, stats.numDropped,
+            ns2us(averageOverhead), ns2us(stats.maxOverhead));
+    std::lock_guard<std::mutex> streamGuard(mStreamMutex);
+    result.appendFormat("  %zu/%zu chunks pending, %" PRIu64 " written, %" PRIu64
+            " write errors\n", mFullChunks.size(), mStreamChunks.size(),
+            mNumChunksWritten, mNumWriteErrors);
+}
+
+status_t SurfaceInterceptor::startStreamingLocked() {
+    ATRACE_CALL();
+    mStreamFd = open(mOutputFileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (mStreamFd < 0) {
+        ALOGE("Could not open %s for streaming: %s", mOutputFileName.c_str(), strerror(errno));
+        return PERMISSION_DENIED;
+    }
+
+    // Everything the main thread needs is allocated up front
+    mStreamChunks.resize(NUM_STREAM_CHUNKS);
+    {
+        std::lock_guard<std::mutex> streamGuard(mStreamMutex);
+        for (auto& chunk : mStreamChunks) {
+            chunk.data.reset(new uint8_t[STREAM_CHUNK_SIZE]);
+            chunk.size = 0;
+            mFreeChunks.push_back(&chunk);
+        }
+        mFullChunks.clear();
+        mStreamWriterExit = false;
+        mNumChunksWritten = 0;
+        mNumWriteErrors = 0;
+    }
+    mCurrentChunk = nullptr;
+    mLastChunkSubmitTime = systemTime();
+    mStreamStats = {};
+    mStreamIncrement.Clear();
+    mStreaming = true;
+    mStreamWriter = std::thread(&SurfaceInterceptor::streamWriterMain, this);
+    return NO_ERROR;
+}
+
+void SurfaceInterceptor::stopStreamingLocked() {
+    ATRACE_CALL();
+    submitStreamChunkLocked(systemTime());
+    {
+        std::lock_guard<std::mutex> streamGuard(mStreamMutex);
+        mStreamWriterExit = true;
+    }
+    mStreamCondition.notify_one();
+    mStreamWriter.join();
+
+    close(mStreamFd);
+    mStreamFd = -1;
+    mStreaming = false;
+    ALOGI("Streamed %" PRIu64 " increments (%" PRIu64 " bytes), %" PRIu64 " dropped",
+            mStreamStats.numIncrements, mStreamStats.numBytes, mStreamStats.numDropped);
+
+    mCurrentChunk = nullptr;
+    {
+        std::lock_guard<std::mutex> streamGuard(mStreamMutex);
+        mFreeChunks.clear();
+        mFullChunks.clear();
+    }
+    mStreamChunks.clear();
+}
+
+void SurfaceInterceptor::submitStreamChunkLocked(nsecs_t now) {
+    mLastChunkSubmitTime = now;
+    if (mCurrentChunk == nullptr || mCurrentChunk->size == 0) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> streamGuard(mStreamMutex);
+        mFullChunks.push_back(mCurrentChunk);
+    }
+    mCurrentChunk = nullptr;
+    mStreamCondition.notify_one();
+}
+
+void SurfaceInterceptor::streamWriterMain() {
+    std::unique_lock<std::mutex> lock(mStreamMutex);
+    while (true) {
+        mStreamCondition.wait(lock, [this] {
+            return mStreamWriterExit || !mFullChunks.empty();
+        });
+        if (mFullChunks.empty()) {
+            // Only exit once everything submitted is on disk
+            break;
+        }
+        StreamChunk* chunk = mFullChunks.front();
+        mFullChunks.pop_front();
+        lock.unlock();
+
+        ATRACE_NAME("SurfaceInterceptor::writeChunk");
+        bool failed = false;
+        size_t written = 0;
+        while (written < chunk->size) {
+            ssize_t n = write(mStreamFd, chunk->data.get() + written, chunk->size - written);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                ALOGE("Could not write the trace: %s", strerror(errno));
+                failed = true;
+                break;
+            }
+            written += static_cast<size_t>(n);
+        }
+
+        lock.lock();
+        chunk->size = 0;
+        mFreeChunks.push_back(chunk);
+        if (failed) {
+            mNumWriteErrors++;
+        } else {
+            mNumChunksWritten++;
+        }
+    }
+}
+
+void SurfaceInterceptor::commitTraceIncrementLocked() {
+    if (!mStreaming) {
+        return;
+    }
+    using google::protobuf::io::CodedOutputStream;
+    using google::protobuf::internal::WireFormatLite;
+
+    const uint32_t incrementSize = static_cast<uint32_t>(mStreamIncrement.ByteSize());
+    const uint32_t tag = WireFormatLite::MakeTag(Trace::kIncrementFieldNumber,
+            WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+    const size_t recordSize = CodedOutputStream::VarintSize32(tag) +
+            CodedOutputStream::VarintSize32(incrementSize) + incrementSize;
+
+    const nsecs_t startTime = mStreamIncrement.time_stamp();
+    if (mCurrentChunk != nullptr && STREAM_CHUNK_SIZE - mCurrentChunk->size < recordSize) {
+        submitStreamChunkLocked(startTime);
+    }
+    if (mCurrentChunk == nullptr) {
+        std::lock_guard<std::mutex> streamGuard(mStreamMutex);
+        if (!mFreeChunks.empty()) {
+            mCurrentChunk = mFreeChunks.back();
+            mFreeChunks.pop_back();
+        }
+    }
+
+    if (mCurrentChunk == nullptr || recordSize > STREAM_CHUNK_SIZE) {
+        // The writer can't keep up, don't block the caller
+        mStreamStats.numDropped++;
+    } else {
+        uint8_t* const start = mCurrentChunk->data.get() + mCurrentChunk->size;
+        uint8_t* out = CodedOutputStream::WriteVarint32ToArray(tag, start);
+        out = CodedOutputStream::WriteVarint32ToArray(incrementSize, out);
+        out = mStreamIncrement.SerializeWithCachedSizesToArray(out);
+        mCurrentChunk->size += static_cast<size_t>(out - start);
+        mStreamStats.numIncrements++;
+        mStreamStats.numBytes += recordSize;
+    }
+    // Clear() keeps the allocated sub-messages around for the next increment
+    mStreamIncrement.Clear();
+
+    const nsecs_t now = systemTime();
+    const nsecs_t overhead = now - startTime;
+    mStreamStats.totalOverhead += overhead;
+    if (overhead > mStreamStats.maxOverhead) {
+        mStreamStats.maxOverhead = overhead;
+    }
+    if (now - mLastChunkSubmitTime > STREAM_FLUSH_INTERVAL) {
+        submitStreamChunkLocked(now);
+    }
+}
+
 void SurfaceInterceptor::saveExistingDisplaysLocked(
         const DefaultKeyedVector< wp<IBinder>, DisplayDeviceState>& displays)
 {
@@ -73,7 +271,9 @@ void SurfaceInterceptor::saveExistingDisplaysLocked(
     ATRACE_CALL();
     for (size_t i = 0 ; i < displays.size() ; i++) {
         addDisplayCreationLocked(createTraceIncrementLocked(), displays[i]);
+        commitTraceIncrementLocked();
         addInitialDisplayStateLocked(createTraceIncrementLocked(), displays[i]);
+        commitTraceIncrementLocked();
     }
 }
 
@@ -82,7 +282,9 @@ void SurfaceInterceptor::saveExistingSurfacesLocked(const SortedVector<sp<Layer>
     for (const auto& l : layers) {
         l->traverseInZOrder(LayerVector::StateSet::Drawing, [this](Layer* layer) {
             addSurfaceCreationLocked(createTraceIncrementLocked(), layer);
+            commitTraceIncrementLocked();
             addInitialSurfaceStateLocked(createTraceIncrementLocked(), layer);
+            commitTraceIncrementLocked();
         });
     }
 }
@@ -159,7 +361,7 @@ int32_t SurfaceInterceptor::getLayerId(const sp<const Layer>& layer) {
 }
 
 Increment* SurfaceInterceptor::createTraceIncrementLocked() {
-    Increment* increment(mTrace.add_increment());
+    Increment* increment(mStreaming ? &mStreamIncrement : mTrace.add_increment());
     increment->set_time_stamp(systemTime());
     return increment;
 }
@@ -527,6 +729,7 @@ void SurfaceInterceptor::saveTransaction(const Vector<ComposerState>& stateUpdat
     std::lock_guard<std::mutex> protoGuard(mTraceMutex);
     addTransactionLocked(createTraceIncrementLocked(), stateUpdates, displays, changedDisplays,
             flags);
+    commitTraceIncrementLocked();
 }
 
 void SurfaceInterceptor::saveSurfaceCreation(const sp<const Layer>& layer) {
@@ -536,6 +739,7 @@ void SurfaceInterceptor::saveSurfaceCreation(const sp<const Layer>& layer) {
     ATRACE_CALL();
     std::lock_guard<std::mutex> protoGuard(mTraceMutex);
     addSurfaceCreationLocked(createTraceIncrementLocked(), layer);
+    commitTraceIncrementLocked();
 }
 
 void SurfaceInterceptor::saveSurfaceDeletion(const sp<const Layer>& layer) {
@@ -545,6 +749,7 @@ void SurfaceInterceptor::saveSurfaceDeletion(const sp<const Layer>& layer) {
     ATRACE_CALL();
     std::lock_guard<std::mutex> protoGuard(mTraceMutex);
     addSurfaceDeletionLocked(createTraceIncrementLocked(), layer);
+    commitTraceIncrementLocked();
 }
 
 void SurfaceInterceptor::saveBufferUpdate(const sp<const Layer>& layer, uint32_t width,
@@ -556,6 +761,7 @@ void SurfaceInterceptor::saveBufferUpdate(const sp<const Layer>& layer, uint32_t
     ATRACE_CALL();
     std::lock_guard<std::mutex> protoGuard(mTraceMutex);
     addBufferUpdateLocked(createTraceIncrementLocked(), layer, width, height, frameNumber);
+    commitTraceIncrementLocked();
 }
 
 void SurfaceInterceptor::saveVSyncEvent(nsecs_t timestamp) {
@@ -564,6 +770,7 @@ void SurfaceInterceptor::saveVSyncEvent(nsecs_t timestamp) {
     }
     std::lock_guard<std::mutex> protoGuard(mTraceMutex);
     addVSyncUpdateLocked(createTraceIncrementLocked(), timestamp);
+    commitTraceIncrementLocked();
 }
 
 void SurfaceInterceptor::saveDisplayCreation(const DisplayDeviceState& info) {
@@ -573,6 +780,7 @@ void SurfaceInterceptor::saveDisplayCreation(const DisplayDeviceState& info) {
     ATRACE_CALL();
     std::lock_guard<std::mutex> protoGuard(mTraceMutex);
     addDisplayCreationLocked(createTraceIncrementLocked(), info);
+    commitTraceIncrementLocked();
 }
 
 void SurfaceInterceptor::saveDisplayDeletion(int32_t displayId) {
@@ -582,6 +790,7 @@ void SurfaceInterceptor::saveDisplayDeletion(int32_t displayId) {
     ATRACE_CALL();
     std::lock_guard<std::mutex> protoGuard(mTraceMutex);
     addDisplayDeletionLocked(createTraceIncrementLocked(), displayId);
+    commitTraceIncrementLocked();
 }
 
 void SurfaceInterceptor::savePowerModeUpdate(int32_t displayId, int32_t mode) {
@@ -591,6 +800,7 @@ void SurfaceInterceptor::savePowerModeUpdate(int32_t displayId, int32_t mode) {
     ATRACE_CALL();
     std::lock_guard<std::mutex> protoGuard(mTraceMutex);
     addPowerModeUpdateLocked(createTraceIncrementLocked(), displayId, mode);
+    commitTraceIncrementLocked();
 }
 
 
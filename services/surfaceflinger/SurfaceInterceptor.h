@@ -19,15 +19,22 @@
 
 #include <frameworks/native/cmds/surfacereplayer/proto/src/trace.pb.h>
 
+#include <condition_variable>
+#include <deque>
+#include <memory>
 #include <mutex>
+#include <thread>
+#include <vector>
 
 #include <utils/SortedVector.h>
+#include <utils/Timers.h>
 #include <utils/Vector.h>
 
 namespace android {
 
 class BufferItem;
 class Layer;
+class String8;
 class SurfaceFlinger;
 struct DisplayState;
 struct layer_state_t;
@@ -37,16 +44,26 @@ constexpr auto DEFAULT_FILENAME = "/data/SurfaceTrace.dat";
 /*
  * SurfaceInterceptor intercepts and stores incoming streams of window
  * properties on SurfaceFlinger.
+ *
+ * By default the whole trace is kept in memory and written out by disable().
+ * In streaming mode each increment is serialized as soon as it is complete
+ * into one of a fixed set of preallocated chunks, and a background thread
+ * appends the full chunks to the output file. Each increment is written as
+ * a length-delimited Trace.increment field, so the file still parses as a
+ * Trace. Increments are dropped, and counted, when the writer falls behind.
  */
 class SurfaceInterceptor {
 public:
     SurfaceInterceptor(SurfaceFlinger* const flinger);
     // Both vectors are used to capture the current state of SF as the initial snapshot in the trace
     void enable(const SortedVector<sp<Layer>>& layers,
-            const DefaultKeyedVector< wp<IBinder>, DisplayDeviceState>& displays);
+            const DefaultKeyedVector< wp<IBinder>, DisplayDeviceState>& displays,
+            bool streaming = false);
     void disable();
     bool isEnabled();
 
+    void dump(String8& result) const;
+
     // Intercept display and surface transactions
     void saveTransaction(const Vector<ComposerState>& stateUpdates,
             const DefaultKeyedVector< wp<IBinder>, DisplayDeviceState>& displays,
@@ -80,6 +97,14 @@ private:
     int32_t getLayerId(const sp<const Layer>& layer);
 
     Increment* createTraceIncrementLocked();
+    // Must follow each increment once it is complete
+    void commitTraceIncrementLocked();
+
+    // Streaming mode
+    status_t startStreamingLocked();
+    void stopStreamingLocked();
+    void submitStreamChunkLocked(nsecs_t now);
+    void streamWriterMain();
     void addSurfaceCreationLocked(Increment* increment, const sp<const Layer>& layer);
     void addSurfaceDeletionLocked(Increment* increment, const sp<const Layer>& layer);
     void addBufferUpdateLocked(Increment* increment, const sp<const Layer>& layer, uint32_t width,
@@ -129,9 +154,47 @@ private:
 
     bool mEnabled {false};
     std::string mOutputFileName {DEFAULT_FILENAME};
-    std::mutex mTraceMutex {};
+    mutable std::mutex mTraceMutex {};
     Trace mTrace {};
     SurfaceFlinger* const mFlinger;
+
+    static constexpr size_t STREAM_CHUNK_SIZE = 256 * 1024;
+    static constexpr size_t NUM_STREAM_CHUNKS = 16;
+    // Partially filled chunks are handed to the writer after that long
+    static constexpr nsecs_t STREAM_FLUSH_INTERVAL = s2ns(1);
+
+    struct StreamChunk {
+        std::unique_ptr<uint8_t[]> data;
+        size_t size;
+    };
+
+    // Main-thread side of the streaming mode, protected by mTraceMutex.
+    // The overhead is the time from createTraceIncrementLocked() to the
+    // end of commitTraceIncrementLocked().
+    struct StreamStats {
+        uint64_t numIncrements;
+        uint64_t numDropped;
+        uint64_t numBytes;
+        nsecs_t totalOverhead;
+        nsecs_t maxOverhead;
+    };
+    bool mStreaming {false};
+    Increment mStreamIncrement {};
+    std::vector<StreamChunk> mStreamChunks {};
+    StreamChunk* mCurrentChunk {nullptr};
+    nsecs_t mLastChunkSubmitTime {0};
+    StreamStats mStreamStats {};
+
+    // Hand-off to the writer thread. mStreamMutex nests inside mTraceMutex.
+    mutable std::mutex mStreamMutex {};
+    std::condition_variable mStreamCondition {};
+    std::vector<StreamChunk*> mFreeChunks {};
+    std::deque<StreamChunk*> mFullChunks {};
+    bool mStreamWriterExit {false};
+    uint64_t mNumChunksWritten {0};
+    uint64_t mNumWriteErrors {0};
+    int mStreamFd {-1};
+    std::thread mStreamWriter {};
 };
 
 }
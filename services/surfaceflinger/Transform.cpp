@@ -34,7 +34,8 @@ Transform::Transform() {
 }
 
 Transform::Transform(const Transform&  other)
-    : mMatrix(other.mMatrix), mType(other.mType) {
+    : mMatrix(other.mMatrix), mType(other.mType),
+      mFastPath(other.mFastPath), mOrtho(other.mOrtho) {
 }
 
 Transform::Transform(uint32_t orientation) {
@@ -80,6 +81,7 @@ Transform Transform::operator * (const Transform& rhs) const
     // TODO: we could recompute this value from r and rhs
     r.mType &= 0xFF;
     r.mType |= UNKNOWN_TYPE;
+    r.mFastPath = FAST_PATH_UNKNOWN;
     return r;
 }
 
@@ -97,6 +99,8 @@ float Transform::ty() const {
 
 void Transform::reset() {
     mType = IDENTITY;
+    mFastPath = FAST_PATH_UNKNOWN;
+    mOrtho = ortho();
     for(int i=0 ; i<3 ; i++) {
         vec3& v(mMatrix[i]);
         for (int j=0 ; j<3 ; j++)
@@ -109,6 +113,7 @@ void Transform::set(float tx, float ty)
     mMatrix[2][0] = tx;
     mMatrix[2][1] = ty;
     mMatrix[2][2] = 1.0f;
+    mFastPath = FAST_PATH_UNKNOWN;
 
     if (isZero(tx) && isZero(ty)) {
         mType &= ~TRANSLATE;
@@ -124,6 +129,7 @@ void Transform::set(float a, float b, float c, float d)
     M[0][1] = c;    M[1][1] = d;
     M[0][2] = 0;    M[1][2] = 0;
     mType = UNKNOWN_TYPE;
+    mFastPath = FAST_PATH_UNKNOWN;
 }
 
 status_t Transform::set(uint32_t flags, float w, float h)
@@ -196,9 +202,71 @@ Rect Transform::makeBounds(int w, int h) const
     return transform( Rect(w, h) );
 }
 
+uint32_t Transform::fastPath() const
+{
+    if (mFastPath == FAST_PATH_UNKNOWN) {
+        const mat33& M(mMatrix);
+        const float a = M[0][0];
+        const float b = M[1][0];
+        const float c = M[0][1];
+        const float d = M[1][1];
+        const float x = M[2][0];
+        const float y = M[2][1];
+
+        // see transformOrtho() for the range of the translation
+        const bool ortho =
+                ((b == 0 && c == 0 && fabsf(a) == 1 && fabsf(d) == 1) ||
+                 (a == 0 && d == 0 && fabsf(b) == 1 && fabsf(c) == 1)) &&
+                x == floorf(x) && y == floorf(y) &&
+                fabsf(x) < (1 << 22) && fabsf(y) < (1 << 22);
+        if (ortho) {
+            mOrtho.a = static_cast<int32_t>(a);
+            mOrtho.b = static_cast<int32_t>(b);
+            mOrtho.c = static_cast<int32_t>(c);
+            mOrtho.d = static_cast<int32_t>(d);
+            mOrtho.x = static_cast<int32_t>(x);
+            mOrtho.y = static_cast<int32_t>(y);
+            mFastPath = FAST_PATH_ORTHO;
+        } else {
+            mFastPath = FAST_PATH_NONE;
+        }
+    }
+    return mFastPath;
+}
+
+bool Transform::transformOrtho(const Rect& bounds, Rect* out) const
+{
+    // Below 2^22 the float mapping is exact, including the +0.5 rounding,
+    // so both give the same result whether rounding outwards or not.
+    static const int32_t LIMIT = 1 << 22;
+    if (bounds.left <= -LIMIT || bounds.left >= LIMIT ||
+            bounds.top <= -LIMIT || bounds.top >= LIMIT ||
+            bounds.right <= -LIMIT || bounds.right >= LIMIT ||
+            bounds.bottom <= -LIMIT || bounds.bottom >= LIMIT) {
+        return false;
+    }
+
+    // Each output coordinate only depends on one input coordinate, so
+    // mapping two opposite corners is enough.
+    const ortho& o(mOrtho);
+    const int32_t x0 = o.a * bounds.left  + o.b * bounds.top    + o.x;
+    const int32_t y0 = o.c * bounds.left  + o.d * bounds.top    + o.y;
+    const int32_t x1 = o.a * bounds.right + o.b * bounds.bottom + o.x;
+    const int32_t y1 = o.c * bounds.right + o.d * bounds.bottom + o.y;
+    out->left   = min(x0, x1);
+    out->top    = min(y0, y1);
+    out->right  = max(x0, x1);
+    out->bottom = max(y0, y1);
+    return true;
+}
+
 Rect Transform::transform(const Rect& bounds, bool roundOutwards) const
 {
     Rect r;
+    if (fastPath() == FAST_PATH_ORTHO && transformOrtho(bounds, &r)) {
+        return r;
+    }
+
     vec2 lt( bounds.left,  bounds.top    );
     vec2 rt( bounds.right, bounds.top    );
     vec2 lb( bounds.left,  bounds.bottom );
@@ -228,7 +296,9 @@ Region Transform::transform(const Region& reg) const
 {
     Region out;
     if (CC_UNLIKELY(type() > TRANSLATE)) {
-        if (CC_LIKELY(preserveRects())) {
+        if (reg.isRect() && !reg.isEmpty()) {
+            out.set(transform(reg.bounds()));
+        } else if (CC_LIKELY(preserveRects())) {
             Region::const_iterator it = reg.begin();
             Region::const_iterator const end = reg.end();
             while (it != end) {
@@ -310,6 +380,7 @@ Transform Transform::inverse() const {
         result = *this;
         result.mMatrix[2][0] = -result.mMatrix[2][0];
         result.mMatrix[2][1] = -result.mMatrix[2][1];
+        result.mFastPath = FAST_PATH_UNKNOWN;
     } else {
         // a c 0
         // b d 0
@@ -323,6 +394,7 @@ Transform Transform::inverse() const {
         const float y = M[2][1];
 
         const float idet = 1.0 / (a*d - b*c);
+        result.mFastPath = FAST_PATH_UNKNOWN;
         result.mMatrix[0][0] =  d*idet;
         result.mMatrix[0][1] = -c*idet;
         result.mMatrix[1][0] = -b*idet;
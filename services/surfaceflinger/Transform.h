@@ -99,12 +99,30 @@ private:
 
     enum { UNKNOWN_TYPE = 0x80000000 };
 
+    // How transform(const Rect&) maps integer coordinates, classified the
+    // first time it is needed after the matrix changed
+    enum fast_path {
+        FAST_PATH_UNKNOWN = 0,  // not classified yet
+        FAST_PATH_ORTHO,        // flips and 90 degrees rotations without
+                                // scaling, integral translation
+        FAST_PATH_NONE          // float mapping
+    };
+
+    // a, b, c, d, x and y of the matrix, in integers, for FAST_PATH_ORTHO
+    struct ortho {
+        int32_t a, b, c, d, x, y;
+    };
+
     uint32_t type() const;
+    uint32_t fastPath() const;
+    bool transformOrtho(const Rect& bounds, Rect* out) const;
     static bool absIsOne(float f);
     static bool isZero(float f);
 
     mat33               mMatrix;
     mutable uint32_t    mType;
+    mutable uint32_t    mFastPath;
+    mutable ortho       mOrtho;
 };
 
 // ---------------------------------------------------------------------------
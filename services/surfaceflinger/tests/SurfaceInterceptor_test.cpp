@@ -87,6 +87,10 @@ static void enableInterceptor() {
     system("service call SurfaceFlinger 1020 i32 1 > /dev/null");
 }
 
+static void enableStreamingInterceptor() {
+    system("service call SurfaceFlinger 1020 i32 2 > /dev/null");
+}
+
 static void disableInterceptor() {
     system("service call SurfaceFlinger 1020 i32 0 > /dev/null");
 }
@@ -796,6 +800,17 @@ TEST_F(SurfaceInterceptorTest, InterceptAllUpdatesWorks) {
     assertAllUpdatesFound(&capturedTrace);
 }
 
+TEST_F(SurfaceInterceptorTest, InterceptStreamingWorks) {
+    enableStreamingInterceptor();
+    runAllUpdates();
+    disableInterceptor();
+
+    // The streamed records must parse as a regular trace
+    Trace capturedTrace;
+    ASSERT_EQ(NO_ERROR, readProtoFile(&capturedTrace));
+    assertAllUpdatesFound(&capturedTrace);
+}
+
 TEST_F(SurfaceInterceptorTest, InterceptSurfaceCreationWorks) {
     captureTest(&SurfaceInterceptorTest::surfaceCreation,
             Increment::IncrementCase::kSurfaceCreation);
@@ -0,0 +1,23 @@
+LOCAL_PATH:= $(call my-dir)
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := surfaceflinger_benchmark
+
+LOCAL_MODULE_TAGS := tests
+
+LOCAL_SRC_FILES := \
+    MainLoop_benchmark.cpp \
+    ../../Transform.cpp
+
+LOCAL_C_INCLUDES := \
+    $(LOCAL_PATH)/../..
+
+LOCAL_SHARED_LIBRARIES := \
+    libcutils \
+    liblog \
+    libui \
+    libutils
+
+LOCAL_CFLAGS += -Wall -Werror -Wunused -Wunreachable-code
+
+include $(BUILD_NATIVE_BENCHMARK)
@@ -0,0 +1,517 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Microbenchmarks for the region and geometry work SurfaceFlinger does on
+ * its main thread for every frame that changes the layer stack.
+ *
+ * The phases below follow SurfaceFlinger::computeVisibleRegions,
+ * SurfaceFlinger::rebuildLayerStacks and the geometry part of
+ * SurfaceFlinger::setUpHWComposer / Layer::setGeometry, applied to synthetic
+ * layer stacks. Those functions need a running SurfaceFlinger with real
+ * displays, so the layers here only carry the state the phases read; keep
+ * them in sync when changing the originals.
+ *
+ * Every benchmark takes {number of layers, overlap in percent, features},
+ * see the Feature enum. For machine-readable results, run with
+ *   surfaceflinger_benchmark --benchmark_format=json
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <ui/Rect.h>
+#include <ui/Region.h>
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "DisplayHardware/PerDisplayStorage.h"
+#include "Transform.h"
+
+namespace android {
+
+static constexpr int32_t kDisplayWidth = 1080;
+static constexpr int32_t kDisplayHeight = 1920;
+
+enum Feature {
+    // layers have a crop smaller than their buffer
+    kCrop = 0x1,
+    // every other layer is scaled, every fourth one is rotated by 90 degrees
+    kTransform = 0x2,
+    // translucent layers with a transparent region hint
+    kTranslucent = 0x4,
+    kAllFeatures = kCrop | kTransform | kTranslucent,
+};
+
+struct SyntheticLayer {
+    uint32_t w = 0;
+    uint32_t h = 0;
+    Transform transform;
+    Rect crop = Rect::EMPTY_RECT;
+    Rect finalCrop = Rect::EMPTY_RECT;
+    Region activeTransparentRegion;
+    bool opaque = true;
+    float alpha = 1.0f;
+    bool contentDirty = true;
+
+    Region visibleRegion;
+    Region coveredRegion;
+    Region visibleNonTransparentRegion;
+
+    // Layer::computeBounds
+    Rect computeBounds(const Region& transparentRegion) const {
+        Rect bounds(w, h);
+        if (!crop.isEmpty()) {
+            bounds.intersect(crop, &bounds);
+        }
+        return reduce(bounds, transparentRegion);
+    }
+
+    // Layer::computeScreenBounds
+    Rect computeScreenBounds() const {
+        Rect bounds(w, h);
+        if (!crop.isEmpty()) {
+            bounds.intersect(crop, &bounds);
+        }
+        return transform.transform(bounds);
+    }
+
+private:
+    static Rect reduce(const Rect& win, const Region& exclude) {
+        if (exclude.isEmpty()) {
+            return win;
+        }
+        if (exclude.isRect()) {
+            return win.reduce(exclude.getBounds());
+        }
+        return Region(win).subtract(exclude).getBounds();
+    }
+};
+
+// Stands in for HWC2::Layer, it only keeps what it is given.
+struct FakeHwcLayer {
+    Rect displayFrame;
+    std::vector<Rect> visibleRegion;
+    bool blending = false;
+
+    void setDisplayFrame(const Rect& frame) {
+        displayFrame = frame;
+    }
+    void setVisibleRegion(const Region& region) {
+        // Same conversion as HWC2::Layer::setVisibleRegion
+        size_t rectCount = 0;
+        const Rect* rects = region.getArray(&rectCount);
+        visibleRegion.assign(rects, rects + rectCount);
+    }
+};
+
+static std::vector<SyntheticLayer> createLayers(const benchmark::State& state) {
+    const int numLayers = state.range(0);
+    const int overlap = state.range(1);
+    const int features = state.range(2);
+
+    // Each layer is shifted from the previous one so that it overlaps it by
+    // the requested amount, wrapping around the display.
+    const uint32_t w = kDisplayWidth / 2;
+    const uint32_t h = kDisplayHeight / 4;
+    const int32_t stepX = int32_t(w * (100 - overlap) / 100);
+    const int32_t stepY = int32_t(h * (100 - overlap) / 100);
+
+    std::vector<SyntheticLayer> layers(static_cast<size_t>(numLayers));
+    for (size_t i = 0; i < layers.size(); i++) {
+        SyntheticLayer& layer(layers[i]);
+        layer.w = w;
+        layer.h = h;
+
+        if ((features & kTransform) && (i % 4) == 3) {
+            layer.transform.set(Transform::ROT_90, w, h);
+        } else if ((features & kTransform) && (i % 2) == 1) {
+            layer.transform.set(1.5f, 0.0f, 0.0f, 1.5f);
+        }
+        const int32_t x = stepX * int32_t(i) % (kDisplayWidth - int32_t(w) + 1);
+        const int32_t y = stepY * int32_t(i) % (kDisplayHeight - int32_t(h) + 1);
+        Transform translation;
+        translation.set(float(x), float(y));
+        layer.transform = translation * layer.transform;
+
+        if (features & kCrop) {
+            layer.crop = Rect(w / 8, h / 8, w - w / 8, h - h / 8);
+            if ((i % 3) == 0) {
+                layer.finalCrop = Rect(0, 0, kDisplayWidth, kDisplayHeight / 2);
+            }
+        }
+        if ((features & kTranslucent) && (i % 2) == 0) {
+            layer.opaque = false;
+            layer.alpha = 0.5f;
+            layer.activeTransparentRegion.set(Rect(0, 0, w, h / 4));
+            layer.activeTransparentRegion.orSelf(Rect(0, h - h / 4, w, h));
+        }
+    }
+    return layers;
+}
+
+// Marks a quarter of the layers as having new content, rotating between
+// iterations, so both the dirty and the exposed region paths are taken.
+static void invalidateSomeLayers(std::vector<SyntheticLayer>& layers, size_t iteration) {
+    for (size_t i = 0; i < layers.size(); i++) {
+        layers[i].contentDirty = ((i + iteration) % 4) == 0;
+    }
+}
+
+// SurfaceFlinger::computeVisibleRegions, non incremental
+static void computeVisibleRegions(std::vector<SyntheticLayer>& layers,
+        Region& outDirtyRegion, Region& outOpaqueRegion) {
+    Region aboveOpaqueLayers;
+    Region aboveCoveredLayers;
+    Region dirty;
+
+    outDirtyRegion.clear();
+
+    for (auto it = layers.rbegin(); it != layers.rend(); ++it) {
+        SyntheticLayer& layer(*it);
+
+        Region opaqueRegion;
+        Region visibleRegion;
+        Region coveredRegion;
+        Region transparentRegion;
+
+        const bool translucent = !layer.opaque;
+        Rect bounds(layer.computeScreenBounds());
+        visibleRegion.set(bounds);
+        const Transform& tr(layer.transform);
+        if (!visibleRegion.isEmpty()) {
+            if (translucent) {
+                if (tr.preserveRects()) {
+                    transparentRegion = tr.transform(layer.activeTransparentRegion);
+                } else {
+                    transparentRegion.clear();
+                }
+            }
+            const int32_t layerOrientation = tr.getOrientation();
+            if (layer.alpha == 1.0f && !translucent &&
+                    ((layerOrientation & Transform::ROT_INVALID) == false)) {
+                opaqueRegion = visibleRegion;
+            }
+        }
+
+        coveredRegion = aboveCoveredLayers.intersect(visibleRegion);
+        aboveCoveredLayers.orSelf(visibleRegion);
+        visibleRegion.subtractSelf(aboveOpaqueLayers);
+
+        if (layer.contentDirty) {
+            dirty = visibleRegion;
+            dirty.orSelf(layer.visibleRegion);
+            layer.contentDirty = false;
+        } else {
+            const Region newExposed = visibleRegion - coveredRegion;
+            const Region oldVisibleRegion = layer.visibleRegion;
+            const Region oldCoveredRegion = layer.coveredRegion;
+            const Region oldExposed = oldVisibleRegion - oldCoveredRegion;
+            dirty = (visibleRegion&oldCoveredRegion) | (newExposed-oldExposed);
+        }
+        dirty.subtractSelf(aboveOpaqueLayers);
+        outDirtyRegion.orSelf(dirty);
+        aboveOpaqueLayers.orSelf(opaqueRegion);
+
+        layer.visibleRegion = visibleRegion;
+        layer.coveredRegion = coveredRegion;
+        layer.visibleNonTransparentRegion = visibleRegion.subtract(transparentRegion);
+    }
+
+    outOpaqueRegion = aboveOpaqueLayers;
+}
+
+// The per-display part of SurfaceFlinger::rebuildLayerStacks
+static size_t rebuildLayerStack(std::vector<SyntheticLayer>& layers,
+        const Transform& displayTransform, const Rect& displayBounds,
+        std::vector<SyntheticLayer*>& outVisibleLayers, Region& outUndefinedRegion) {
+    Region opaqueRegion;
+    Region dirtyRegion;
+    computeVisibleRegions(layers, dirtyRegion, opaqueRegion);
+
+    outVisibleLayers.clear();
+    for (auto& layer : layers) {
+        Region drawRegion(displayTransform.transform(layer.visibleNonTransparentRegion));
+        drawRegion.andSelf(displayBounds);
+        if (!drawRegion.isEmpty()) {
+            outVisibleLayers.push_back(&layer);
+        }
+    }
+    outUndefinedRegion.set(displayBounds);
+    outUndefinedRegion.subtractSelf(displayTransform.transform(opaqueRegion));
+    return outVisibleLayers.size();
+}
+
+// The geometry part of Layer::setGeometry and Layer::setPerFrameData
+static void setGeometry(const SyntheticLayer& layer, const Transform& displayTransform,
+        const Rect& viewport, FakeHwcLayer& hwcLayer) {
+    hwcLayer.blending = !layer.opaque || layer.alpha != 1.0f;
+
+    Region activeTransparentRegion(layer.activeTransparentRegion);
+    const Transform& t(layer.transform);
+    if (!layer.crop.isEmpty()) {
+        Rect activeCrop(layer.crop);
+        activeCrop = t.transform(activeCrop);
+        if (!activeCrop.intersect(viewport, &activeCrop)) {
+            activeCrop.clear();
+        }
+        activeCrop = t.inverse().transform(activeCrop, true);
+        if (!activeCrop.intersect(Rect(layer.w, layer.h), &activeCrop)) {
+            activeCrop.clear();
+        }
+        activeTransparentRegion.orSelf(Rect(0, 0, layer.w, activeCrop.top));
+        activeTransparentRegion.orSelf(Rect(0, activeCrop.bottom, layer.w, layer.h));
+        activeTransparentRegion.orSelf(Rect(0, activeCrop.top,
+                activeCrop.left, activeCrop.bottom));
+        activeTransparentRegion.orSelf(Rect(activeCrop.right, activeCrop.top,
+                layer.w, activeCrop.bottom));
+    }
+
+    Rect frame(t.transform(layer.computeBounds(activeTransparentRegion)));
+    if (!layer.finalCrop.isEmpty()) {
+        if (!frame.intersect(layer.finalCrop, &frame)) {
+            frame.clear();
+        }
+    }
+    if (!frame.intersect(viewport, &frame)) {
+        frame.clear();
+    }
+    hwcLayer.setDisplayFrame(displayTransform.transform(frame));
+
+    // setPerFrameData
+    Region visible = displayTransform.transform(layer.visibleRegion.intersect(viewport));
+    hwcLayer.setVisibleRegion(visible);
+}
+
+static void setLayersProcessed(benchmark::State& state) {
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// ---------------------------------------------------------------------------
+
+static void BM_ComputeVisibleRegions(benchmark::State& state) {
+    std::vector<SyntheticLayer> layers(createLayers(state));
+    Region dirtyRegion;
+    Region opaqueRegion;
+    size_t iteration = 0;
+    while (state.KeepRunning()) {
+        invalidateSomeLayers(layers, iteration++);
+        computeVisibleRegions(layers, dirtyRegion, opaqueRegion);
+        benchmark::DoNotOptimize(dirtyRegion.getBounds());
+    }
+    setLayersProcessed(state);
+}
+
+static void BM_RebuildLayerStacks(benchmark::State& state) {
+    std::vector<SyntheticLayer> layers(createLayers(state));
+    const Rect bounds(kDisplayWidth, kDisplayHeight);
+    // A primary display, plus an external display mirroring it rotated
+    Transform primary;
+    Transform external;
+    external.set(Transform::ROT_90, kDisplayWidth, kDisplayHeight);
+
+    std::vector<SyntheticLayer*> visibleLayers;
+    Region undefinedRegion;
+    size_t iteration = 0;
+    while (state.KeepRunning()) {
+        invalidateSomeLayers(layers, iteration++);
+        benchmark::DoNotOptimize(rebuildLayerStack(layers, primary, bounds,
+                visibleLayers, undefinedRegion));
+        benchmark::DoNotOptimize(rebuildLayerStack(layers, external, bounds,
+                visibleLayers, undefinedRegion));
+    }
+    setLayersProcessed(state);
+}
+
+static void BM_SetUpHWComposer(benchmark::State& state) {
+    std::vector<SyntheticLayer> layers(createLayers(state));
+    const Rect viewport(kDisplayWidth, kDisplayHeight);
+    const Transform displayTransform;
+
+    // setUpHWComposer runs after rebuildLayerStacks, which is not timed here
+    std::vector<SyntheticLayer*> visibleLayers;
+    Region undefinedRegion;
+    rebuildLayerStack(layers, displayTransform, viewport, visibleLayers, undefinedRegion);
+
+    std::vector<FakeHwcLayer> hwcLayers(visibleLayers.size());
+    while (state.KeepRunning()) {
+        for (size_t i = 0; i < visibleLayers.size(); i++) {
+            setGeometry(*visibleLayers[i], displayTransform, viewport, hwcLayers[i]);
+        }
+        benchmark::DoNotOptimize(hwcLayers.data());
+    }
+    setLayersProcessed(state);
+}
+
+// ---------------------------------------------------------------------------
+
+// A region made of count rects, staggered so that they can't be merged
+static Region createStaggeredRegion(int32_t count, int32_t offset) {
+    Region region;
+    for (int32_t i = 0; i < count; i++) {
+        const int32_t x = (i * 37 + offset) % (kDisplayWidth - 64);
+        const int32_t y = (i * 53 + offset) % (kDisplayHeight - 64);
+        region.orSelf(Rect(x, y, x + 64, y + 64));
+    }
+    return region;
+}
+
+static void BM_RegionOr(benchmark::State& state) {
+    const Region a(createStaggeredRegion(int32_t(state.range(0)), 0));
+    const Region b(createStaggeredRegion(int32_t(state.range(0)), 17));
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(a.merge(b).getBounds());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+static void BM_RegionSubtract(benchmark::State& state) {
+    const Region a(createStaggeredRegion(int32_t(state.range(0)), 0));
+    const Region b(createStaggeredRegion(int32_t(state.range(0)), 17));
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(a.subtract(b).getBounds());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+static void BM_RegionIntersect(benchmark::State& state) {
+    const Region a(createStaggeredRegion(int32_t(state.range(0)), 0));
+    const Region b(createStaggeredRegion(int32_t(state.range(0)), 17));
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(a.intersect(b).getBounds());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+static void BM_RegionTransform(benchmark::State& state) {
+    const Region a(createStaggeredRegion(int32_t(state.range(0)), 0));
+    Transform tr;
+    tr.set(Transform::ROT_90, kDisplayWidth, kDisplayHeight);
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(tr.transform(a).getBounds());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// The per-display part of Layer::HWCInfo that setUpHWComposer reads and writes
+struct FakeHwcInfo {
+    std::shared_ptr<int> layer;
+    bool forceClientComposition = false;
+    int32_t compositionType = 0;
+    bool clearClientTarget = false;
+    Rect displayFrame;
+    uint32_t z = 0;
+};
+
+// How Layer used to store its HWCInfo
+struct HwcInfoMap {
+    std::unordered_map<int32_t, FakeHwcInfo> map;
+
+    void add(int32_t hwcId) { map[hwcId].layer = std::make_shared<int>(hwcId); }
+    bool has(int32_t hwcId) { return map.count(hwcId) != 0; }
+    FakeHwcInfo& get(int32_t hwcId) { return map[hwcId]; }
+    FakeHwcInfo* find(int32_t hwcId) {
+        return map.count(hwcId) != 0 ? &map.at(hwcId) : nullptr;
+    }
+};
+
+struct HwcInfoStorage {
+    PerDisplayStorage<FakeHwcInfo> storage;
+
+    void add(int32_t hwcId) { storage[hwcId].layer = std::make_shared<int>(hwcId); }
+    bool has(int32_t hwcId) { return storage.contains(hwcId); }
+    FakeHwcInfo& get(int32_t hwcId) { return storage[hwcId]; }
+    FakeHwcInfo* find(int32_t hwcId) { return storage.find(hwcId); }
+};
+
+// The HWCInfo lookups SurfaceFlinger::setUpHWComposer does for every layer
+// on every display: hasHwcLayer, forceClientComposition or setGeometry,
+// setPerFrameData, setClearClientTarget then getCompositionType and
+// getClearClientTarget after validation. Takes {layers, displays}.
+template <typename Storage>
+static void BM_HwcInfoLookup(benchmark::State& state) {
+    const int32_t numLayers = int32_t(state.range(0));
+    const int32_t numDisplays = int32_t(state.range(1));
+    std::vector<Storage> layers(numLayers);
+    for (auto& layer : layers) {
+        for (int32_t hwcId = 0; hwcId < numDisplays; hwcId++) {
+            layer.add(hwcId);
+        }
+    }
+
+    while (state.KeepRunning()) {
+        for (int32_t hwcId = 0; hwcId < numDisplays; hwcId++) {
+            uint32_t z = 0;
+            for (auto& layer : layers) {
+                if (!layer.has(hwcId)) {
+                    continue;
+                }
+                FakeHwcInfo& geometry = layer.get(hwcId);
+                geometry.z = z++;
+                geometry.displayFrame = Rect(kDisplayWidth, kDisplayHeight);
+                FakeHwcInfo& perFrame = layer.get(hwcId);
+                perFrame.compositionType = 2;
+                FakeHwcInfo* clearTarget = layer.find(hwcId);
+                if (clearTarget) {
+                    clearTarget->clearClientTarget = false;
+                }
+            }
+            for (auto& layer : layers) {
+                FakeHwcInfo* info = layer.find(hwcId);
+                benchmark::DoNotOptimize(info ? info->compositionType : 0);
+                info = layer.find(hwcId);
+                benchmark::DoNotOptimize(info ? info->clearClientTarget : false);
+            }
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0) * state.range(1));
+}
+
+// {layers, overlap, features}
+static void LayerStackArgs(benchmark::internal::Benchmark* b) {
+    for (int layers : {4, 16, 64}) {
+        for (int overlap : {0, 50, 90}) {
+            b->Args({layers, overlap, 0});
+            b->Args({layers, overlap, kAllFeatures});
+        }
+    }
+}
+
+// {layers, displays}
+static void HwcInfoArgs(benchmark::internal::Benchmark* b) {
+    for (int layers : {4, 16, 64}) {
+        for (int displays : {1, 2, 3}) {
+            b->Args({layers, displays});
+        }
+    }
+}
+
+BENCHMARK(BM_ComputeVisibleRegions)->Apply(LayerStackArgs);
+BENCHMARK(BM_RebuildLayerStacks)->Apply(LayerStackArgs);
+BENCHMARK(BM_SetUpHWComposer)->Apply(LayerStackArgs);
+
+BENCHMARK_TEMPLATE(BM_HwcInfoLookup, HwcInfoMap)->Apply(HwcInfoArgs);
+BENCHMARK_TEMPLATE(BM_HwcInfoLookup, HwcInfoStorage)->Apply(HwcInfoArgs);
+
+BENCHMARK(BM_RegionOr)->Range(1, 256);
+BENCHMARK(BM_RegionSubtract)->Range(1, 256);
+BENCHMARK(BM_RegionIntersect)->Range(1, 256);
+BENCHMARK(BM_RegionTransform)->Range(1, 256);
+
+} // namespace android
+
+BENCHMARK_MAIN();
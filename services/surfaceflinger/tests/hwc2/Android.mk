@@ -49,6 +49,7 @@ LOCAL_SRC_FILES := \
     Hwc2TestLayers.cpp \
     Hwc2TestBuffer.cpp \
     Hwc2TestClientTarget.cpp \
+    Hwc2TestLatency.cpp \
     Hwc2TestVirtualDisplay.cpp
 
 include $(BUILD_NATIVE_TEST)
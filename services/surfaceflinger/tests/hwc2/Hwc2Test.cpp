@@ -15,6 +15,7 @@
  */
 
 #include <array>
+#include <cmath>
 #include <unordered_set>
 #include <unordered_map>
 #include <gtest/gtest.h>
@@ -33,6 +34,7 @@
 #include "Hwc2TestLayers.h"
 #include "Hwc2TestClientTarget.h"
 #include "Hwc2TestVirtualDisplay.h"
+#include "Hwc2TestLatency.h"
 
 void hwc2TestHotplugCallback(hwc2_callback_data_t callbackData,
         hwc2_display_t display, int32_t connected);
@@ -411,8 +413,12 @@ public:
                 getFunction(HWC2_FUNCTION_SET_LAYER_BUFFER));
         ASSERT_TRUE(pfn) << "failed to get function";
 
-        auto err = static_cast<hwc2_error_t>(pfn(mHwc2Device, display, layer,
-                buffer, acquireFence));
+        hwc2_error_t err;
+        {
+            Hwc2TestLatencyScope scope(mSetLayerBufferLatency);
+            err = static_cast<hwc2_error_t>(pfn(mHwc2Device, display, layer,
+                    buffer, acquireFence));
+        }
         if (outErr) {
             *outErr = err;
         } else {
@@ -577,6 +583,7 @@ public:
                 getFunction(HWC2_FUNCTION_VALIDATE_DISPLAY));
         ASSERT_TRUE(pfn) << "failed to get function";
 
+        Hwc2TestLatencyScope scope(mValidateDisplayLatency);
         *outErr = static_cast<hwc2_error_t>(pfn(mHwc2Device, display,
                 outNumTypes, outNumRequests));
     }
@@ -825,8 +832,12 @@ public:
                 getFunction(HWC2_FUNCTION_PRESENT_DISPLAY));
         ASSERT_TRUE(pfn) << "failed to get function";
 
-        auto err = static_cast<hwc2_error_t>(pfn(mHwc2Device, display,
-                outPresentFence));
+        hwc2_error_t err;
+        {
+            Hwc2TestLatencyScope scope(mPresentDisplayLatency);
+            err = static_cast<hwc2_error_t>(pfn(mHwc2Device, display,
+                    outPresentFence));
+        }
         if (outErr) {
             *outErr = err;
         } else {
@@ -1696,9 +1707,12 @@ protected:
                 dataspace, damage));
     }
 
+    /* For each active display and for each config, it presents every layer
+     * combination frameCnt times. The layer properties are set again before
+     * every frame, so each frame sets a new buffer and acquire fence */
     void presentDisplays(size_t layerCnt, Hwc2TestCoverage coverage,
             const std::unordered_map<Hwc2TestPropertyName, Hwc2TestCoverage>&
-            coverageExceptions, bool optimize)
+            coverageExceptions, bool optimize, size_t frameCnt = 1)
     {
         for (auto display : mDisplays) {
             std::vector<hwc2_config_t> configs;
@@ -1728,51 +1742,123 @@ protected:
                 Hwc2TestClientTarget testClientTarget;
 
                 do {
-                    uint32_t numTypes, numRequests;
-                    bool hasChanges, skip;
-                    bool flipClientTarget;
-                    int32_t presentFence;
+                    for (size_t frame = 0; frame < frameCnt; frame++) {
+                        uint32_t numTypes, numRequests;
+                        bool hasChanges, skip;
+                        bool flipClientTarget;
+                        int32_t presentFence;
+
+                        ASSERT_NO_FATAL_FAILURE(setLayerProperties(display,
+                                layers, &testLayers, &skip));
+                        if (skip)
+                            break;
+
+                        ASSERT_NO_FATAL_FAILURE(validateDisplay(display,
+                                &numTypes, &numRequests, &hasChanges));
+                        if (hasChanges)
+                            EXPECT_LE(numTypes,
+                                    static_cast<uint32_t>(layers.size()))
+                                    << "wrong number of requests";
+
+                        ASSERT_NO_FATAL_FAILURE(handleCompositionChanges(
+                                display, testLayers, layers, numTypes,
+                                &clientLayers));
+                        ASSERT_NO_FATAL_FAILURE(handleRequests(display, layers,
+                                numRequests, &clearLayers, &flipClientTarget));
+                        ASSERT_NO_FATAL_FAILURE(setClientTarget(display,
+                                &testClientTarget, testLayers, clientLayers,
+                                clearLayers, flipClientTarget, displayArea));
+                        ASSERT_NO_FATAL_FAILURE(acceptDisplayChanges(display));
+
+                        ASSERT_NO_FATAL_FAILURE(waitForVsync());
+
+                        EXPECT_NO_FATAL_FAILURE(presentDisplay(display,
+                                &presentFence));
+
+                        ASSERT_NO_FATAL_FAILURE(closeFences(display,
+                                presentFence));
+                    }
 
-                    ASSERT_NO_FATAL_FAILURE(setLayerProperties(display, layers,
-                            &testLayers, &skip));
-                    if (skip)
-                        continue;
+                } while (testLayers.advance());
 
-                    ASSERT_NO_FATAL_FAILURE(validateDisplay(display, &numTypes,
-                            &numRequests, &hasChanges));
-                    if (hasChanges)
-                        EXPECT_LE(numTypes, static_cast<uint32_t>(layers.size()))
-                                << "wrong number of requests";
+                ASSERT_NO_FATAL_FAILURE(destroyLayers(display,
+                        std::move(layers)));
+            }
 
-                    ASSERT_NO_FATAL_FAILURE(handleCompositionChanges(display,
-                            testLayers, layers, numTypes, &clientLayers));
-                    ASSERT_NO_FATAL_FAILURE(handleRequests(display, layers,
-                            numRequests, &clearLayers, &flipClientTarget));
-                    ASSERT_NO_FATAL_FAILURE(setClientTarget(display,
-                            &testClientTarget, testLayers, clientLayers,
-                            clearLayers, flipClientTarget, displayArea));
-                    ASSERT_NO_FATAL_FAILURE(acceptDisplayChanges(display));
+            ASSERT_NO_FATAL_FAILURE(disableVsync(display));
+            ASSERT_NO_FATAL_FAILURE(setPowerMode(display, HWC2_POWER_MODE_OFF));
+        }
+    }
 
-                    ASSERT_NO_FATAL_FAILURE(waitForVsync());
+    /* Runs presentDisplays for each layer count from 1 to maxLayerCnt and
+     * reports the latency of every validateDisplay, presentDisplay and
+     * setLayerBuffer call made by the HWC2 while doing so. The percentiles are
+     * printed and added to the test properties, so they end up in the gtest
+     * xml output where they can be compared against a budget */
+    void presentDisplaysPerformance(size_t maxLayerCnt,
+            Hwc2TestCoverage coverage,
+            const std::unordered_map<Hwc2TestPropertyName, Hwc2TestCoverage>&
+            coverageExceptions, bool optimize, size_t frameCnt)
+    {
+        Hwc2TestLatency validateDisplayLatency("validateDisplay");
+        Hwc2TestLatency presentDisplayLatency("presentDisplay");
+        Hwc2TestLatency setLayerBufferLatency("setLayerBuffer");
 
-                    EXPECT_NO_FATAL_FAILURE(presentDisplay(display,
-                            &presentFence));
+        for (size_t layerCnt = 1; layerCnt <= maxLayerCnt; layerCnt++) {
+            validateDisplayLatency.reset();
+            presentDisplayLatency.reset();
+            setLayerBufferLatency.reset();
 
-                    ASSERT_NO_FATAL_FAILURE(closeFences(display, presentFence));
+            mValidateDisplayLatency = &validateDisplayLatency;
+            mPresentDisplayLatency = &presentDisplayLatency;
+            mSetLayerBufferLatency = &setLayerBufferLatency;
 
-                } while (testLayers.advance());
+            EXPECT_NO_FATAL_FAILURE(presentDisplays(layerCnt, coverage,
+                    coverageExceptions, optimize, frameCnt));
 
-                ASSERT_NO_FATAL_FAILURE(destroyLayers(display,
-                        std::move(layers)));
+            mValidateDisplayLatency = nullptr;
+            mPresentDisplayLatency = nullptr;
+            mSetLayerBufferLatency = nullptr;
+
+            if (HasFatalFailure())
+                return;
+
+            for (auto latency : {&validateDisplayLatency,
+                    &presentDisplayLatency, &setLayerBufferLatency}) {
+                printf("layers %zu: %s\n", layerCnt, latency->dump().c_str());
             }
 
-            ASSERT_NO_FATAL_FAILURE(disableVsync(display));
-            ASSERT_NO_FATAL_FAILURE(setPowerMode(display, HWC2_POWER_MODE_OFF));
+            recordLatencyProperties(layerCnt, "validateDisplay",
+                    validateDisplayLatency);
+            recordLatencyProperties(layerCnt, "presentDisplay",
+                    presentDisplayLatency);
+            recordLatencyProperties(layerCnt, "setLayerBuffer",
+                    setLayerBufferLatency);
+        }
+    }
+
+    void recordLatencyProperties(size_t layerCnt, const std::string& function,
+            const Hwc2TestLatency& latency)
+    {
+        const std::string prefix = function + "_" + std::to_string(layerCnt)
+                + "_layers_";
+
+        for (auto percentile : {50, 90, 99, 100}) {
+            RecordProperty(prefix + (percentile == 100 ? "max"
+                    : "p" + std::to_string(percentile)) + "_us",
+                    static_cast<int>(std::ceil(
+                    latency.getPercentile(percentile))));
         }
     }
 
     hwc2_device_t* mHwc2Device = nullptr;
 
+    /* Set while a performance test case runs. Each wrapped HWC2 call records
+     * its duration in the matching latency */
+    Hwc2TestLatency* mValidateDisplayLatency = nullptr;
+    Hwc2TestLatency* mPresentDisplayLatency = nullptr;
+    Hwc2TestLatency* mSetLayerBufferLatency = nullptr;
+
     enum class Hwc2TestHotplugStatus {
         Init = 1,
         Receiving,
@@ -4096,6 +4182,57 @@ TEST_F(Hwc2Test, PRESENT_DISPLAY_not_validated)
     ));
 }
 
+/* TESTCASE: Reports the latency of validateDisplay, presentDisplay and
+ * setLayerBuffer while presenting 1 to 8 default layers. */
+TEST_F(Hwc2Test, PERFORMANCE_default)
+{
+    const size_t maxLayerCnt = 8;
+    const size_t frameCnt = 60;
+    Hwc2TestCoverage coverage = Hwc2TestCoverage::Default;
+    std::unordered_map<Hwc2TestPropertyName, Hwc2TestCoverage> exceptions;
+    bool optimize = false;
+
+    ASSERT_NO_FATAL_FAILURE(presentDisplaysPerformance(maxLayerCnt, coverage,
+            exceptions, optimize, frameCnt));
+}
+
+/* TESTCASE: Reports the latency of validateDisplay, presentDisplay and
+ * setLayerBuffer while presenting 1 to 3 layers whose buffers are reallocated
+ * with a new size every few frames. */
+TEST_F(Hwc2Test, PERFORMANCE_buffer)
+{
+    const size_t maxLayerCnt = 3;
+    const size_t frameCnt = 10;
+    Hwc2TestCoverage coverage = Hwc2TestCoverage::Default;
+    std::unordered_map<Hwc2TestPropertyName, Hwc2TestCoverage> exceptions =
+            {{Hwc2TestPropertyName::BufferArea, Hwc2TestCoverage::Complete}};
+    bool optimize = false;
+
+    ASSERT_NO_FATAL_FAILURE(presentDisplaysPerformance(maxLayerCnt, coverage,
+            exceptions, optimize, frameCnt));
+}
+
+/* TESTCASE: Reports the latency of validateDisplay, presentDisplay and
+ * setLayerBuffer while presenting 1 to 2 layers whose properties change every
+ * frame. */
+TEST_F(Hwc2Test, PERFORMANCE_property_churn)
+{
+    const size_t maxLayerCnt = 2;
+    const size_t frameCnt = 1;
+    Hwc2TestCoverage coverage = Hwc2TestCoverage::Default;
+    std::unordered_map<Hwc2TestPropertyName, Hwc2TestCoverage> exceptions =
+            {{Hwc2TestPropertyName::BlendMode, Hwc2TestCoverage::Basic},
+            {Hwc2TestPropertyName::Composition, Hwc2TestCoverage::Basic},
+            {Hwc2TestPropertyName::DisplayFrame, Hwc2TestCoverage::Basic},
+            {Hwc2TestPropertyName::PlaneAlpha, Hwc2TestCoverage::Basic},
+            {Hwc2TestPropertyName::SourceCrop, Hwc2TestCoverage::Basic},
+            {Hwc2TestPropertyName::Transform, Hwc2TestCoverage::Basic}};
+    bool optimize = true;
+
+    ASSERT_NO_FATAL_FAILURE(presentDisplaysPerformance(maxLayerCnt, coverage,
+            exceptions, optimize, frameCnt));
+}
+
 /* TESTCASE: Tests that the HWC2 cannot get release fences from a bad display. */
 TEST_F(Hwc2Test, GET_RELEASE_FENCES_bad_display)
 {
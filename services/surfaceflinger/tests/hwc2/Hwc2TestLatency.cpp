@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+
+#include "Hwc2TestLatency.h"
+
+Hwc2TestLatency::Hwc2TestLatency(const std::string& name)
+    : mName(name) { }
+
+void Hwc2TestLatency::record(Clock::duration latency)
+{
+    if (!mLatencies.empty() && latency < mLatencies.back())
+        mSorted = false;
+    mLatencies.push_back(latency);
+}
+
+void Hwc2TestLatency::reset()
+{
+    mLatencies.clear();
+    mSorted = true;
+}
+
+size_t Hwc2TestLatency::getCount() const
+{
+    return mLatencies.size();
+}
+
+/* Uses the nearest rank method, so the returned value is always a latency
+ * that was actually measured */
+double Hwc2TestLatency::getPercentile(double percentile) const
+{
+    if (mLatencies.empty())
+        return 0.0;
+
+    sort();
+
+    size_t rank = static_cast<size_t>(std::ceil(percentile / 100.0
+            * mLatencies.size()));
+    rank = std::min(std::max(rank, static_cast<size_t>(1)), mLatencies.size());
+
+    return std::chrono::duration<double, std::micro>(
+            mLatencies[rank - 1]).count();
+}
+
+std::string Hwc2TestLatency::dump() const
+{
+    std::stringstream dmp;
+
+    dmp << std::fixed << std::setprecision(1) << mName << ": calls "
+            << getCount() << ", p50 " << getPercentile(50.0) << "us, p90 "
+            << getPercentile(90.0) << "us, p99 " << getPercentile(99.0)
+            << "us, max " << getPercentile(100.0) << "us";
+
+    return dmp.str();
+}
+
+void Hwc2TestLatency::sort() const
+{
+    if (mSorted)
+        return;
+
+    std::sort(mLatencies.begin(), mLatencies.end());
+    mSorted = true;
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HWC2_TEST_LATENCY_H
+#define _HWC2_TEST_LATENCY_H
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+/* Collects the duration of every call to one HWC2 function so that the
+ * performance test cases can report latency percentiles for it */
+class Hwc2TestLatency {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    Hwc2TestLatency(const std::string& name);
+
+    void record(Clock::duration latency);
+    void reset();
+
+    size_t getCount() const;
+
+    /* Returns the latency that percentile percent of the calls did not
+     * exceed, in microseconds. Returns 0 if no call was recorded */
+    double getPercentile(double percentile) const;
+
+    std::string dump() const;
+
+private:
+    void sort() const;
+
+    std::string mName;
+
+    /* Sorted lazily, when a percentile is requested */
+    mutable std::vector<Clock::duration> mLatencies;
+    mutable bool mSorted = true;
+};
+
+/* Records the time spent in its scope into latency, if latency is set */
+class Hwc2TestLatencyScope {
+public:
+    Hwc2TestLatencyScope(Hwc2TestLatency* latency)
+        : mLatency(latency),
+          mStart(latency ? Hwc2TestLatency::Clock::now()
+                : Hwc2TestLatency::Clock::time_point()) { }
+
+    ~Hwc2TestLatencyScope()
+    {
+        if (mLatency)
+            mLatency->record(Hwc2TestLatency::Clock::now() - mStart);
+    }
+
+private:
+    Hwc2TestLatency* mLatency;
+    Hwc2TestLatency::Clock::time_point mStart;
+};
+
+#endif /* ifndef _HWC2_TEST_LATENCY_H */
@@ -21,6 +21,7 @@ sourceFiles := \
     producer_channel.cpp \
     consumer_queue_channel.cpp \
     producer_queue_channel.cpp \
+    queue_ready_set.cpp \
 
 staticLibraries := \
 	libperformance \
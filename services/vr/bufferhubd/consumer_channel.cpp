@@ -19,10 +19,10 @@ namespace android {
 namespace dvr {
 
 ConsumerChannel::ConsumerChannel(BufferHubService* service, int buffer_id,
-                                 int channel_id,
+                                 int channel_id, uint64_t consumer_state_bit,
                                  const std::shared_ptr<Channel> producer)
     : BufferHubChannel(service, buffer_id, channel_id, kConsumerType),
-      handled_(true),
+      consumer_state_bit_(consumer_state_bit),
       ignored_(false),
       producer_(producer) {
   GetProducer()->AddConsumer(this);
@@ -33,11 +33,9 @@ ConsumerChannel::~ConsumerChannel() {
            "ConsumerChannel::~ConsumerChannel: channel_id=%d buffer_id=%d",
            channel_id(), buffer_id());
 
-  if (auto producer = GetProducer()) {
-    if (!handled_)  // Producer is waiting for our Release.
-      producer->OnConsumerIgnored();
+  // The producer releases the buffer for us if it is waiting for our Release.
+  if (auto producer = GetProducer())
     producer->RemoveConsumer(this);
-  }
 }
 
 BufferHubChannel::BufferInfo ConsumerChannel::GetBufferInfo() const {
@@ -60,6 +58,11 @@ void ConsumerChannel::HandleImpulse(Message& message) {
     case BufferHubRPC::ConsumerRelease::Opcode:
       OnConsumerRelease(message, {});
       break;
+
+    case BufferHubRPC::BufferStateChanged::Opcode:
+      if (auto producer = GetProducer())
+        producer->OnBufferStateChanged();
+      break;
   }
 }
 
@@ -72,7 +75,7 @@ bool ConsumerChannel::HandleMessage(Message& message) {
   switch (message.GetOp()) {
     case BufferHubRPC::GetBuffer::Opcode:
       DispatchRemoteMethod<BufferHubRPC::GetBuffer>(
-          *producer, &ProducerChannel::OnGetBuffer, message);
+          *this, &ConsumerChannel::OnGetBuffer, message);
       return true;
 
     case BufferHubRPC::NewConsumer::Opcode:
@@ -100,23 +103,30 @@ bool ConsumerChannel::HandleMessage(Message& message) {
   }
 }
 
-Status<std::pair<BorrowedFence, ConsumerChannel::MetaData>>
-ConsumerChannel::OnConsumerAcquire(Message& message,
-                                   std::size_t metadata_size) {
+Status<BufferDescription<BorrowedHandle>> ConsumerChannel::OnGetBuffer(
+    Message& /*message*/) {
+  ATRACE_NAME("ConsumerChannel::OnGetBuffer");
+  ALOGD_IF(TRACE, "ConsumerChannel::OnGetBuffer: buffer=%d", buffer_id());
+  if (auto producer = GetProducer())
+    return producer->GetBuffer(consumer_state_bit_);
+  else
+    return ErrorStatus(EPIPE);
+}
+
+Status<BorrowedFence> ConsumerChannel::OnConsumerAcquire(Message& message) {
   ATRACE_NAME("ConsumerChannel::OnConsumerAcquire");
   auto producer = GetProducer();
   if (!producer)
     return ErrorStatus(EPIPE);
 
-  if (ignored_ || handled_) {
+  if (ignored_) {
     ALOGE(
-        "ConsumerChannel::OnConsumerAcquire: Acquire when not posted: "
-        "ignored=%d handled=%d channel_id=%d buffer_id=%d",
-        ignored_, handled_, message.GetChannelId(), producer->buffer_id());
+        "ConsumerChannel::OnConsumerAcquire: Acquire when ignored: "
+        "channel_id=%d buffer_id=%d",
+        message.GetChannelId(), producer->buffer_id());
     return ErrorStatus(EBUSY);
   } else {
-    ClearAvailable();
-    return producer->OnConsumerAcquire(message, metadata_size);
+    return producer->OnConsumerAcquire(message, consumer_state_bit_);
   }
 }
 
@@ -127,18 +137,15 @@ Status<void> ConsumerChannel::OnConsumerRelease(Message& message,
   if (!producer)
     return ErrorStatus(EPIPE);
 
-  if (ignored_ || handled_) {
+  if (ignored_) {
     ALOGE(
-        "ConsumerChannel::OnConsumerRelease: Release when not acquired: "
-        "ignored=%d handled=%d channel_id=%d buffer_id=%d",
-        ignored_, handled_, message.GetChannelId(), producer->buffer_id());
+        "ConsumerChannel::OnConsumerRelease: Release when ignored: "
+        "channel_id=%d buffer_id=%d",
+        message.GetChannelId(), producer->buffer_id());
     return ErrorStatus(EBUSY);
   } else {
-    ClearAvailable();
-    auto status =
-        producer->OnConsumerRelease(message, std::move(release_fence));
-    handled_ = !!status;
-    return status;
+    return producer->OnConsumerRelease(message, consumer_state_bit_,
+                                       std::move(release_fence));
   }
 }
 
@@ -149,28 +156,30 @@ Status<void> ConsumerChannel::OnConsumerSetIgnore(Message&, bool ignored) {
     return ErrorStatus(EPIPE);
 
   ignored_ = ignored;
-  if (ignored_ && !handled_) {
-    // Update the producer if ignore is set after the consumer acquires the
-    // buffer.
-    ClearAvailable();
-    producer->OnConsumerIgnored();
-    handled_ = false;
-  }
-
+  producer->OnConsumerIgnored(consumer_state_bit_, ignored);
   return {};
 }
 
-bool ConsumerChannel::OnProducerPosted() {
-  if (ignored_) {
-    handled_ = true;
-    return false;
-  } else {
-    handled_ = false;
+void ConsumerChannel::OnBufferStateChanged(uint64_t buffer_state,
+                                           uint64_t acquired_state,
+                                           uint32_t post_count) {
+  if (!BufferHubDefs::IsBufferPosted(buffer_state, acquired_state,
+                                     consumer_state_bit_)) {
+    ClearAvailable();
+  } else if (post_count != signaled_post_count_) {
+    signaled_post_count_ = post_count;
     SignalAvailable();
-    return true;
+    if (auto ready_set = queue_ready_set_.lock())
+      ready_set->SignalReady(queue_slot_);
   }
 }
 
+void ConsumerChannel::SetQueueSlot(
+    const std::shared_ptr<QueueReadySet>& ready_set, size_t slot) {
+  queue_ready_set_ = ready_set;
+  queue_slot_ = slot;
+}
+
 void ConsumerChannel::OnProducerClosed() {
   producer_.reset();
   Hangup();
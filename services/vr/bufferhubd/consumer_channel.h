@@ -3,19 +3,22 @@
 
 #include "buffer_hub.h"
 
-#include <pdx/rpc/buffer_wrapper.h>
 #include <private/dvr/bufferhub_rpc.h>
 
+#include "queue_ready_set.h"
+
 namespace android {
 namespace dvr {
 
 // Consumer channels are attached to a Producer channel
 class ConsumerChannel : public BufferHubChannel {
  public:
+  using BorrowedHandle = pdx::BorrowedHandle;
   using Channel = pdx::Channel;
   using Message = pdx::Message;
 
   ConsumerChannel(BufferHubService* service, int buffer_id, int channel_id,
+                  uint64_t consumer_state_bit,
                   const std::shared_ptr<Channel> producer);
   ~ConsumerChannel() override;
 
@@ -24,24 +27,38 @@ class ConsumerChannel : public BufferHubChannel {
 
   BufferInfo GetBufferInfo() const override;
 
-  bool OnProducerPosted();
+  // Updates the event fd of the consumer to match the shared buffer state.
+  void OnBufferStateChanged(uint64_t buffer_state, uint64_t acquired_state,
+                            uint32_t post_count);
   void OnProducerClosed();
 
- private:
-  using MetaData = pdx::rpc::BufferWrapper<std::uint8_t*>;
+  uint64_t consumer_state_bit() const { return consumer_state_bit_; }
+
+  // Makes the buffer report to |ready_set| as |slot| of a consumer queue when
+  // it is posted.
+  void SetQueueSlot(const std::shared_ptr<QueueReadySet>& ready_set,
+                    size_t slot);
 
+ private:
   std::shared_ptr<ProducerChannel> GetProducer() const;
 
-  pdx::Status<std::pair<BorrowedFence, MetaData>> OnConsumerAcquire(
-      Message& message, std::size_t metadata_size);
+  pdx::Status<BufferDescription<BorrowedHandle>> OnGetBuffer(Message& message);
+  pdx::Status<BorrowedFence> OnConsumerAcquire(Message& message);
   pdx::Status<void> OnConsumerRelease(Message& message,
                                       LocalFence release_fence);
   pdx::Status<void> OnConsumerSetIgnore(Message& message, bool ignore);
 
-  bool handled_;  // True if we have processed RELEASE.
+  // Identifies this consumer in the shared buffer state.
+  uint64_t consumer_state_bit_;
   bool ignored_;  // True if we are ignoring events.
+  // Post count of the last time this consumer was signaled.
+  uint32_t signaled_post_count_{0};
   std::weak_ptr<Channel> producer_;
 
+  // Consumer queue the buffer belongs to, if any.
+  std::weak_ptr<QueueReadySet> queue_ready_set_;
+  size_t queue_slot_{0};
+
   ConsumerChannel(const ConsumerChannel&) = delete;
   void operator=(const ConsumerChannel&) = delete;
 };
@@ -15,10 +15,12 @@ namespace dvr {
 
 ConsumerQueueChannel::ConsumerQueueChannel(
     BufferHubService* service, int buffer_id, int channel_id,
-    const std::shared_ptr<Channel>& producer)
+    const std::shared_ptr<Channel>& producer,
+    std::shared_ptr<QueueReadySet> ready_set)
     : BufferHubChannel(service, buffer_id, channel_id, kConsumerQueueType),
       producer_(producer),
-      capacity_(0) {
+      capacity_(0),
+      ready_set_(std::move(ready_set)) {
   GetProducer()->AddConsumer(this);
 }
 
@@ -50,6 +52,11 @@ bool ConsumerQueueChannel::HandleMessage(Message& message) {
           *producer, &ProducerQueueChannel::OnGetQueueInfo, message);
       return true;
 
+    case BufferHubRPC::GetQueueState::Opcode:
+      DispatchRemoteMethod<BufferHubRPC::GetQueueState>(
+          *this, &ConsumerQueueChannel::OnGetQueueState, message);
+      return true;
+
     case BufferHubRPC::ConsumerQueueImportBuffers::Opcode:
       DispatchRemoteMethod<BufferHubRPC::ConsumerQueueImportBuffers>(
           *this, &ConsumerQueueChannel::OnConsumerQueueImportBuffers, message);
@@ -91,9 +98,9 @@ void ConsumerQueueChannel::RegisterNewBuffer(
   SignalAvailable();
 }
 
-Status<std::vector<std::pair<RemoteChannelHandle, size_t>>>
+Status<std::vector<RemoteQueueBufferSlot>>
 ConsumerQueueChannel::OnConsumerQueueImportBuffers(Message& message) {
-  std::vector<std::pair<RemoteChannelHandle, size_t>> buffer_handles;
+  std::vector<RemoteQueueBufferSlot> buffer_handles;
   ATRACE_NAME("ConsumerQueueChannel::OnConsumerQueueImportBuffers");
   ALOGD_IF(
       TRACE,
@@ -115,7 +122,8 @@ ConsumerQueueChannel::OnConsumerQueueImportBuffers(Message& message) {
       continue;
     }
 
-    auto status = producer_channel->CreateConsumer(message);
+    std::shared_ptr<ConsumerChannel> consumer_channel;
+    auto status = producer_channel->CreateConsumer(message, &consumer_channel);
 
     // If no buffers are imported successfully, clear available and return an
     // error. Otherwise, return all consumer handles already imported
@@ -134,13 +142,31 @@ ConsumerQueueChannel::OnConsumerQueueImportBuffers(Message& message) {
       }
     }
 
-    buffer_handles.emplace_back(status.take(), producer_slot);
+    // A buffer that is already posted is picked up by the client when it
+    // imports the buffer; later posts are reported through the ready set.
+    consumer_channel->SetQueueSlot(ready_set_, producer_slot);
+    buffer_handles.push_back(
+        {status.take(), producer_slot,
+         producer_channel->GetBuffer(consumer_channel->consumer_state_bit())
+             .take()});
   }
 
   ClearAvailable();
   return {std::move(buffer_handles)};
 }
 
+Status<QueueStateDescription<pdx::BorrowedHandle>>
+ConsumerQueueChannel::OnGetQueueState(Message&) {
+  return ready_set_->GetDescription(buffer_id());
+}
+
+void ConsumerQueueChannel::OnBufferDetached(size_t slot) {
+  ALOGD_IF(TRACE,
+           "ConsumerQueueChannel::OnBufferDetached: queue_id=%d slot=%zu",
+           buffer_id(), slot);
+  ready_set_->SignalHangup(slot);
+}
+
 void ConsumerQueueChannel::OnProducerClosed() {
   ALOGD_IF(TRACE, "ConsumerQueueChannel::OnProducerClosed: queue_id=%d",
            buffer_id());
@@ -19,7 +19,8 @@ class ConsumerQueueChannel : public BufferHubChannel {
   using RemoteChannelHandle = pdx::RemoteChannelHandle;
 
   ConsumerQueueChannel(BufferHubService* service, int buffer_id, int channel_id,
-                       const std::shared_ptr<Channel>& producer);
+                       const std::shared_ptr<Channel>& producer,
+                       std::shared_ptr<QueueReadySet> ready_set);
   ~ConsumerQueueChannel() override;
 
   bool HandleMessage(Message& message) override;
@@ -34,11 +35,18 @@ class ConsumerQueueChannel : public BufferHubChannel {
 
   // Called after clients been signaled by service that new buffer has been
   // allocated. Clients uses kOpConsumerQueueImportBuffers to import new
-  // consumer buffers and this handler returns a vector of fd representing
-  // BufferConsumers that clients can import.
-  pdx::Status<std::vector<std::pair<RemoteChannelHandle, size_t>>>
+  // consumer buffers and this handler returns the channels and buffer
+  // descriptions of all pending BufferConsumers in one reply.
+  pdx::Status<std::vector<RemoteQueueBufferSlot>>
   OnConsumerQueueImportBuffers(Message& message);
 
+  // Returns the state through which the client learns about posted buffers.
+  pdx::Status<QueueStateDescription<pdx::BorrowedHandle>> OnGetQueueState(
+      Message& message);
+
+  // Called by ProducerQueueChannel when the buffer in |slot| is detached.
+  void OnBufferDetached(size_t slot);
+
   void OnProducerClosed();
 
  private:
@@ -54,6 +62,9 @@ class ConsumerQueueChannel : public BufferHubChannel {
   // Tracks how many buffers have this queue imported.
   size_t capacity_;
 
+  // Signals the client when buffers in the queue are posted or detached.
+  std::shared_ptr<QueueReadySet> ready_set_;
+
   ConsumerQueueChannel(const ConsumerQueueChannel&) = delete;
   void operator=(const ConsumerQueueChannel&) = delete;
 };
@@ -1,5 +1,7 @@
 #include "producer_channel.h"
 
+#include <hardware/gralloc.h>
+#include <inttypes.h>
 #include <log/log.h>
 #include <sync/sync.h>
 #include <sys/poll.h>
@@ -7,6 +9,7 @@
 
 #include <algorithm>
 #include <atomic>
+#include <new>
 #include <thread>
 
 #include <private/dvr/bufferhub_rpc.h>
@@ -17,24 +20,26 @@ using android::pdx::ErrorStatus;
 using android::pdx::Message;
 using android::pdx::RemoteChannelHandle;
 using android::pdx::Status;
-using android::pdx::rpc::BufferWrapper;
 using android::pdx::rpc::DispatchRemoteMethod;
-using android::pdx::rpc::WrapBuffer;
 
 namespace android {
 namespace dvr {
 
+namespace {
+
+constexpr uint32_t kMetadataUsage =
+    GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_SW_WRITE_OFTEN;
+
+}  // anonymous namespace
+
 ProducerChannel::ProducerChannel(BufferHubService* service, int channel_id,
                                  uint32_t width, uint32_t height,
                                  uint32_t layer_count, uint32_t format,
                                  uint64_t usage, size_t meta_size_bytes,
                                  int* error)
     : BufferHubChannel(service, channel_id, channel_id, kProducerType),
-      pending_consumers_(0),
-      producer_owns_(true),
-      meta_size_bytes_(meta_size_bytes),
-      meta_(meta_size_bytes ? new uint8_t[meta_size_bytes] : nullptr) {
-  const int ret = buffer_.Alloc(width, height, layer_count, format, usage);
+      meta_size_bytes_(meta_size_bytes) {
+  int ret = buffer_.Alloc(width, height, layer_count, format, usage);
   if (ret < 0) {
     ALOGE("ProducerChannel::ProducerChannel: Failed to allocate buffer: %s",
           strerror(-ret));
@@ -42,6 +47,33 @@ ProducerChannel::ProducerChannel(BufferHubService* service, int channel_id,
     return;
   }
 
+  const size_t metadata_size =
+      BufferHubDefs::kMetadataHeaderSize + meta_size_bytes;
+  ret = metadata_buffer_.Alloc(metadata_size, 1, 1, HAL_PIXEL_FORMAT_BLOB,
+                               kMetadataUsage);
+  if (ret < 0) {
+    ALOGE(
+        "ProducerChannel::ProducerChannel: Failed to allocate metadata "
+        "buffer: %s",
+        strerror(-ret));
+    *error = ret;
+    return;
+  }
+
+  void* metadata_ptr = nullptr;
+  ret = metadata_buffer_.Lock(kMetadataUsage, 0, 0, metadata_size, 1,
+                              &metadata_ptr);
+  if (ret < 0) {
+    ALOGE("ProducerChannel::ProducerChannel: Failed to map metadata: %s",
+          strerror(-ret));
+    *error = ret;
+    return;
+  }
+
+  // The buffer starts out gained by the producer.
+  metadata_header_ = new (metadata_ptr) BufferHubDefs::MetadataHeader();
+  metadata_header_->buffer_state.store(BufferHubDefs::kProducerStateBit);
+
   // Success.
   *error = 0;
 }
@@ -66,6 +98,8 @@ ProducerChannel::~ProducerChannel() {
            channel_id(), buffer_id());
   for (auto consumer : consumer_channels_)
     consumer->OnProducerClosed();
+  if (metadata_header_)
+    metadata_buffer_.Unlock();
 }
 
 BufferHubChannel::BufferInfo ProducerChannel::GetBufferInfo() const {
@@ -80,6 +114,15 @@ void ProducerChannel::HandleImpulse(Message& message) {
     case BufferHubRPC::ProducerGain::Opcode:
       OnProducerGain(message);
       break;
+
+    case BufferHubRPC::BufferStateChanged::Opcode:
+      // A post without a fence makes the previous post fence stale.
+      if (!(metadata_header_->fence_state.load(std::memory_order_acquire) &
+            BufferHubDefs::kPostFenceBit)) {
+        post_fence_.close();
+      }
+      OnBufferStateChanged();
+      break;
   }
 }
 
@@ -121,28 +164,57 @@ bool ProducerChannel::HandleMessage(Message& message) {
   }
 }
 
-Status<NativeBufferHandle<BorrowedHandle>> ProducerChannel::OnGetBuffer(
-    Message& message) {
+Status<BufferDescription<BorrowedHandle>> ProducerChannel::GetBuffer(
+    uint64_t buffer_state_bit) {
+  return {BufferDescription<BorrowedHandle>(buffer_, metadata_buffer_,
+                                            buffer_id(), buffer_state_bit)};
+}
+
+Status<BufferDescription<BorrowedHandle>> ProducerChannel::OnGetBuffer(
+    Message& /*message*/) {
   ATRACE_NAME("ProducerChannel::OnGetBuffer");
   ALOGD_IF(TRACE, "ProducerChannel::OnGetBuffer: buffer=%d", buffer_id());
-  return {NativeBufferHandle<BorrowedHandle>(buffer_, buffer_id())};
+  return GetBuffer(BufferHubDefs::kProducerStateBit);
 }
 
-Status<RemoteChannelHandle> ProducerChannel::CreateConsumer(Message& message) {
+uint64_t ProducerChannel::AllocateConsumerStateBit() {
+  const uint64_t free_mask =
+      ~consumer_state_mask_ & BufferHubDefs::kConsumerStateMask;
+  // Isolate the lowest free bit.
+  const uint64_t bit = free_mask & -free_mask;
+  consumer_state_mask_ |= bit;
+  return bit;
+}
+
+Status<RemoteChannelHandle> ProducerChannel::CreateConsumer(
+    Message& message, std::shared_ptr<ConsumerChannel>* out_consumer) {
   ATRACE_NAME("ProducerChannel::CreateConsumer");
   ALOGD_IF(TRACE, "ProducerChannel::CreateConsumer: buffer_id=%d", buffer_id());
 
+  const uint64_t consumer_state_bit = AllocateConsumerStateBit();
+  if (!consumer_state_bit) {
+    ALOGE(
+        "ProducerChannel::CreateConsumer: Buffer already has the maximum of "
+        "%zu consumers: buffer_id=%d",
+        BufferHubDefs::kMaxConsumerCount, buffer_id());
+    return ErrorStatus(E2BIG);
+  }
+
   int channel_id;
   auto status = message.PushChannel(0, nullptr, &channel_id);
   if (!status) {
     ALOGE(
         "ProducerChannel::CreateConsumer: Failed to push consumer channel: %s",
         status.GetErrorMessage().c_str());
+    consumer_state_mask_ &= ~consumer_state_bit;
     return ErrorStatus(ENOMEM);
   }
 
+  // From here on the consumer channel owns the state bit and returns it when
+  // it is destroyed.
   auto consumer = std::make_shared<ConsumerChannel>(
-      service(), buffer_id(), channel_id, shared_from_this());
+      service(), buffer_id(), channel_id, consumer_state_bit,
+      shared_from_this());
   const auto channel_status = service()->SetChannel(channel_id, consumer);
   if (!channel_status) {
     ALOGE(
@@ -152,12 +224,14 @@ Status<RemoteChannelHandle> ProducerChannel::CreateConsumer(Message& message) {
     return ErrorStatus(ENOMEM);
   }
 
-  if (!producer_owns_) {
-    // Signal the new consumer when adding it to a posted producer.
-    if (consumer->OnProducerPosted())
-      pending_consumers_++;
-  }
+  // Signal the new consumer when adding it to a posted producer.
+  metadata_header_->active_consumers.fetch_or(consumer_state_bit,
+                                              std::memory_order_release);
+  if (BufferHubDefs::PostToConsumer(metadata_header_, consumer_state_bit))
+    OnBufferStateChanged();
 
+  if (out_consumer)
+    *out_consumer = std::move(consumer);
   return {status.take()};
 }
 
@@ -167,89 +241,89 @@ Status<RemoteChannelHandle> ProducerChannel::OnNewConsumer(Message& message) {
   return CreateConsumer(message);
 }
 
-Status<void> ProducerChannel::OnProducerPost(
-    Message&, LocalFence acquire_fence,
-    BufferWrapper<std::vector<std::uint8_t>> metadata) {
+Status<void> ProducerChannel::OnProducerPost(Message&,
+                                             LocalFence acquire_fence) {
   ATRACE_NAME("ProducerChannel::OnProducerPost");
   ALOGD_IF(TRACE, "ProducerChannel::OnProducerPost: buffer_id=%d", buffer_id());
-  if (!producer_owns_) {
+  const uint64_t state =
+      metadata_header_->buffer_state.load(std::memory_order_acquire);
+  if (!BufferHubDefs::IsBufferGained(state)) {
     ALOGE("ProducerChannel::OnProducerPost: Not in gained state!");
     return ErrorStatus(EBUSY);
   }
 
-  if (meta_size_bytes_ != metadata.size()) {
-    ALOGD_IF(TRACE,
-             "ProducerChannel::OnProducerPost: Expected meta_size_bytes=%zu "
-             "got size=%zu",
-             meta_size_bytes_, metadata.size());
-    return ErrorStatus(EINVAL);
-  }
-
-  std::copy(metadata.begin(), metadata.end(), meta_.get());
+  // The producer wrote the metadata into the metadata buffer before sending the
+  // fence; the consumers pick the fence up from us.
   post_fence_ = std::move(acquire_fence);
-  producer_owns_ = false;
-
-  // Signal any interested consumers. If there are none, automatically release
-  // the buffer.
-  pending_consumers_ = 0;
-  for (auto consumer : consumer_channels_) {
-    if (consumer->OnProducerPosted())
-      pending_consumers_++;
+  if (post_fence_) {
+    metadata_header_->fence_state.fetch_or(BufferHubDefs::kPostFenceBit,
+                                           std::memory_order_release);
+  } else {
+    metadata_header_->fence_state.fetch_and(~BufferHubDefs::kPostFenceBit,
+                                            std::memory_order_release);
   }
-  if (pending_consumers_ == 0)
-    SignalAvailable();
-  ALOGD_IF(TRACE, "ProducerChannel::OnProducerPost: %d pending consumers",
-           pending_consumers_);
 
+  const int ret = BufferHubDefs::ProducerPost(metadata_header_);
+  if (ret < 0)
+    return ErrorStatus(-ret);
+
+  // Signal any interested consumers. If there are none the buffer is released
+  // right away and the producer is signaled instead.
+  OnBufferStateChanged();
   return {};
 }
 
 Status<LocalFence> ProducerChannel::OnProducerGain(Message& message) {
   ATRACE_NAME("ProducerChannel::OnGain");
   ALOGD_IF(TRACE, "ProducerChannel::OnGain: buffer_id=%d", buffer_id());
-  if (producer_owns_) {
+  const int ret = BufferHubDefs::ProducerGain(metadata_header_);
+  if (ret == -EALREADY) {
     ALOGE("ProducerChanneL::OnGain: Already in gained state: channel=%d",
           channel_id());
     return ErrorStatus(EALREADY);
+  } else if (ret < 0) {
+    // There are still pending consumers, return busy.
+    return ErrorStatus(-ret);
   }
 
-  // There are still pending consumers, return busy.
-  if (pending_consumers_ > 0)
-    return ErrorStatus(EBUSY);
-
-  ClearAvailable();
-  producer_owns_ = true;
+  metadata_header_->fence_state.store(0, std::memory_order_release);
   post_fence_.close();
+  OnBufferStateChanged();
   return {std::move(returned_fence_)};
 }
 
-Status<std::pair<BorrowedFence, BufferWrapper<std::uint8_t*>>>
-ProducerChannel::OnConsumerAcquire(Message& message,
-                                   std::size_t metadata_size) {
+Status<BorrowedFence> ProducerChannel::OnConsumerAcquire(
+    Message& /*message*/, uint64_t consumer_state_bit) {
   ATRACE_NAME("ProducerChannel::OnConsumerAcquire");
   ALOGD_IF(TRACE, "ProducerChannel::OnConsumerAcquire: buffer_id=%d",
            buffer_id());
-  if (producer_owns_) {
+  const int ret =
+      BufferHubDefs::ConsumerAcquire(metadata_header_, consumer_state_bit);
+  if (ret < 0) {
     ALOGE("ProducerChannel::OnConsumerAcquire: Not in posted state!");
-    return ErrorStatus(EBUSY);
+    return ErrorStatus(-ret);
   }
+  OnBufferStateChanged();
 
   // Return a borrowed fd to avoid unnecessary duplication of the underlying fd.
   // Serialization just needs to read the handle.
-  if (metadata_size == 0)
-    return {std::make_pair(post_fence_.borrow(),
-                           WrapBuffer<std::uint8_t>(nullptr, 0))};
-  else
-    return {std::make_pair(post_fence_.borrow(),
-                           WrapBuffer(meta_.get(), meta_size_bytes_))};
+  if (metadata_header_->fence_state.load(std::memory_order_acquire) &
+      BufferHubDefs::kPostFenceBit) {
+    return {post_fence_.borrow()};
+  } else {
+    return {BorrowedFence()};
+  }
 }
 
 Status<void> ProducerChannel::OnConsumerRelease(Message&,
+                                                uint64_t consumer_state_bit,
                                                 LocalFence release_fence) {
   ATRACE_NAME("ProducerChannel::OnConsumerRelease");
   ALOGD_IF(TRACE, "ProducerChannel::OnConsumerRelease: buffer_id=%d",
            buffer_id());
-  if (producer_owns_) {
+  const uint64_t state =
+      metadata_header_->buffer_state.load(std::memory_order_acquire);
+  if (!(state & consumer_state_bit)) {
     ALOGE("ProducerChannel::OnConsumerRelease: Not in acquired state!");
     return ErrorStatus(EBUSY);
   }
@@ -270,18 +344,76 @@ Status<void> ProducerChannel::OnConsumerRelease(Message&,
     } else {
       returned_fence_ = std::move(release_fence);
     }
+
+    // The producer has to come to us for the fence before it may gain.
+    metadata_header_->fence_state.fetch_or(BufferHubDefs::kReleaseFenceBit,
+                                           std::memory_order_release);
   }
 
-  OnConsumerIgnored();
+  bool released;
+  const int ret = BufferHubDefs::ConsumerRelease(
+      metadata_header_, consumer_state_bit, &released);
+  if (ret < 0)
+    return ErrorStatus(-ret);
+
+  OnBufferStateChanged();
   return {};
 }
 
-void ProducerChannel::OnConsumerIgnored() {
-  if (!--pending_consumers_)
-    SignalAvailable();
+void ProducerChannel::OnConsumerIgnored(uint64_t consumer_state_bit,
+                                        bool ignored) {
+  if (ignored) {
+    metadata_header_->active_consumers.fetch_and(~consumer_state_bit,
+                                                 std::memory_order_release);
+    // Give up the buffer if ignore is set after it was posted to the consumer.
+    bool released;
+    BufferHubDefs::ConsumerRelease(metadata_header_, consumer_state_bit,
+                                   &released);
+    OnBufferStateChanged();
+  } else {
+    metadata_header_->active_consumers.fetch_or(consumer_state_bit,
+                                                std::memory_order_release);
+  }
   ALOGD_IF(TRACE,
-           "ProducerChannel::OnConsumerIgnored: buffer_id=%d %d consumers left",
-           buffer_id(), pending_consumers_);
+           "ProducerChannel::OnConsumerIgnored: buffer_id=%d ignored=%d "
+           "buffer_state=%" PRIx64,
+           buffer_id(), ignored, metadata_header_->buffer_state.load());
+}
+
+void ProducerChannel::OnBufferStateChanged() {
+  ATRACE_NAME("ProducerChannel::OnBufferStateChanged");
+  // Read the counts after the state; they are bumped after the state changes,
+  // so they are at least as recent as the state. If the transition that made a
+  // channel available is newer than its count, the impulse that follows that
+  // transition gets the channel signaled.
+  const uint64_t state =
+      metadata_header_->buffer_state.load(std::memory_order_acquire);
+  const uint64_t acquired =
+      metadata_header_->acquired_state.load(std::memory_order_acquire);
+  const uint32_t post_count =
+      metadata_header_->post_count.load(std::memory_order_acquire);
+  const uint32_t release_count =
+      metadata_header_->release_count.load(std::memory_order_acquire);
+
+  // Clients wait for these events with edge triggered epoll, so each channel
+  // is signaled once per transition rather than every time it is reconciled.
+  if (!BufferHubDefs::IsBufferReleased(state)) {
+    ClearAvailable();
+  } else if (release_count != signaled_release_count_) {
+    signaled_release_count_ = release_count;
+    SignalAvailable();
+    if (auto ready_set = queue_ready_set_.lock())
+      ready_set->SignalReady(queue_slot_);
+  }
+
+  for (auto consumer : consumer_channels_)
+    consumer->OnBufferStateChanged(state, acquired, post_count);
+}
+
+void ProducerChannel::SetQueueSlot(
+    const std::shared_ptr<QueueReadySet>& ready_set, size_t slot) {
+  queue_ready_set_ = ready_set;
+  queue_slot_ = slot;
 }
 
 Status<void> ProducerChannel::OnProducerMakePersistent(Message& message,
@@ -335,6 +467,18 @@ void ProducerChannel::AddConsumer(ConsumerChannel* channel) {
 void ProducerChannel::RemoveConsumer(ConsumerChannel* channel) {
   consumer_channels_.erase(
       std::find(consumer_channels_.begin(), consumer_channels_.end(), channel));
+
+  // If the producer is waiting for this consumer, release the buffer on its
+  // behalf before handing the state bit back.
+  const uint64_t consumer_state_bit = channel->consumer_state_bit();
+  metadata_header_->active_consumers.fetch_and(~consumer_state_bit,
+                                               std::memory_order_release);
+  bool released;
+  if (BufferHubDefs::ConsumerRelease(metadata_header_, consumer_state_bit,
+                                     &released) == 0) {
+    OnBufferStateChanged();
+  }
+  consumer_state_mask_ &= ~consumer_state_bit;
 }
 
 // Returns true if either the user or group ids match the owning ids or both
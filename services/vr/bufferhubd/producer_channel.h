@@ -9,10 +9,12 @@
 
 #include <pdx/channel_handle.h>
 #include <pdx/file_handle.h>
-#include <pdx/rpc/buffer_wrapper.h>
+#include <private/dvr/buffer_hub_defs.h>
 #include <private/dvr/bufferhub_rpc.h>
 #include <private/dvr/ion_buffer.h>
 
+#include "queue_ready_set.h"
+
 namespace android {
 namespace dvr {
 
@@ -22,13 +24,16 @@ namespace dvr {
 // The producer channel is owned by a single app that writes into buffers and
 // calls POST when drawing is complete. This channel has a set of consumer
 // channels associated with it that are waiting for notifications.
+//
+// The ownership of the buffer is tracked in a metadata buffer shared with the
+// clients, which perform the transitions that don't involve fences themselves
+// and then send a BufferStateChanged impulse. The channel keeps the event fds
+// of the producer and consumers in line with the shared state.
 class ProducerChannel : public BufferHubChannel {
  public:
   using Message = pdx::Message;
   using BorrowedHandle = pdx::BorrowedHandle;
   using RemoteChannelHandle = pdx::RemoteChannelHandle;
-  template <typename T>
-  using BufferWrapper = pdx::rpc::BufferWrapper<T>;
 
   static pdx::Status<std::shared_ptr<ProducerChannel>> Create(
       BufferHubService* service, int channel_id, uint32_t width,
@@ -42,21 +47,35 @@ class ProducerChannel : public BufferHubChannel {
 
   BufferInfo GetBufferInfo() const override;
 
-  pdx::Status<NativeBufferHandle<BorrowedHandle>> OnGetBuffer(Message& message);
+  pdx::Status<BufferDescription<BorrowedHandle>> GetBuffer(
+      uint64_t buffer_state_bit);
+  pdx::Status<BufferDescription<BorrowedHandle>> OnGetBuffer(Message& message);
 
-  pdx::Status<RemoteChannelHandle> CreateConsumer(Message& message);
+  // Creates a new consumer channel. When |consumer| is not null it is set to
+  // the new channel.
+  pdx::Status<RemoteChannelHandle> CreateConsumer(
+      Message& message, std::shared_ptr<ConsumerChannel>* consumer = nullptr);
   pdx::Status<RemoteChannelHandle> OnNewConsumer(Message& message);
 
-  pdx::Status<std::pair<BorrowedFence, BufferWrapper<std::uint8_t*>>>
-  OnConsumerAcquire(Message& message, std::size_t metadata_size);
+  pdx::Status<BorrowedFence> OnConsumerAcquire(Message& message,
+                                               uint64_t consumer_state_bit);
   pdx::Status<void> OnConsumerRelease(Message& message,
+                                      uint64_t consumer_state_bit,
                                       LocalFence release_fence);
+  void OnConsumerIgnored(uint64_t consumer_state_bit, bool ignored);
 
-  void OnConsumerIgnored();
+  // Updates the event fds of the producer and consumers to match the shared
+  // buffer state.
+  void OnBufferStateChanged();
 
   void AddConsumer(ConsumerChannel* channel);
   void RemoveConsumer(ConsumerChannel* channel);
 
+  // Makes the buffer report to |ready_set| as |slot| of a producer queue when it
+  // becomes released. Passing a null |ready_set| detaches it from the queue.
+  void SetQueueSlot(const std::shared_ptr<QueueReadySet>& ready_set,
+                    size_t slot);
+
   bool CheckAccess(int euid, int egid);
   bool CheckParameters(uint32_t width, uint32_t height, uint32_t layer_count,
                        uint32_t format, uint64_t usage, size_t meta_size_bytes);
@@ -68,17 +87,26 @@ class ProducerChannel : public BufferHubChannel {
 
  private:
   std::vector<ConsumerChannel*> consumer_channels_;
-  // This counts the number of consumers left to process this buffer. If this is
-  // zero then the producer can re-acquire ownership.
-  int pending_consumers_;
+  // Buffer state bits handed out to the consumers in |consumer_channels_|.
+  uint64_t consumer_state_mask_{0};
 
   IonBuffer buffer_;
 
-  bool producer_owns_;
+  // Holds the shared buffer state followed by |meta_size_bytes_| of user
+  // metadata. Mapped for the lifetime of the channel.
+  IonBuffer metadata_buffer_;
+  BufferHubDefs::MetadataHeader* metadata_header_{nullptr};
+
+  // Release count of the last time the producer was signaled.
+  uint32_t signaled_release_count_{0};
+
+  // Producer queue the buffer belongs to, if any.
+  std::weak_ptr<QueueReadySet> queue_ready_set_;
+  size_t queue_slot_{0};
+
   LocalFence post_fence_;
   LocalFence returned_fence_;
   size_t meta_size_bytes_;
-  std::unique_ptr<uint8_t[]> meta_;
 
   static constexpr int kNoCheckId = -1;
   static constexpr int kUseCallerId = 0;
@@ -94,11 +122,12 @@ class ProducerChannel : public BufferHubChannel {
                   uint32_t height, uint32_t layer_count, uint32_t format,
                   uint64_t usage, size_t meta_size_bytes, int* error);
 
-  pdx::Status<void> OnProducerPost(
-      Message& message, LocalFence acquire_fence,
-      BufferWrapper<std::vector<std::uint8_t>> metadata);
+  pdx::Status<void> OnProducerPost(Message& message, LocalFence acquire_fence);
   pdx::Status<LocalFence> OnProducerGain(Message& message);
 
+  // Returns an unused consumer state bit or zero if there are none left.
+  uint64_t AllocateConsumerStateBit();
+
   ProducerChannel(const ProducerChannel&) = delete;
   void operator=(const ProducerChannel&) = delete;
 };
@@ -2,9 +2,14 @@
 
 #include <inttypes.h>
 
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
 #include "consumer_queue_channel.h"
 #include "producer_channel.h"
 
+using android::pdx::BorrowedHandle;
 using android::pdx::ErrorStatus;
 using android::pdx::Message;
 using android::pdx::Status;
@@ -14,6 +19,8 @@ using android::pdx::rpc::DispatchRemoteMethod;
 namespace android {
 namespace dvr {
 
+constexpr size_t ProducerQueueChannel::kMaxAllocationThreads;
+
 ProducerQueueChannel::ProducerQueueChannel(BufferHubService* service,
                                            int channel_id,
                                            size_t meta_size_bytes,
@@ -23,6 +30,16 @@ ProducerQueueChannel::ProducerQueueChannel(BufferHubService* service,
       meta_size_bytes_(meta_size_bytes),
       usage_policy_(usage_policy),
       capacity_(0) {
+  auto ready_set_status = QueueReadySet::Create();
+  if (!ready_set_status) {
+    ALOGE(
+        "ProducerQueueChannel::ProducerQueueChannel: Failed to create ready "
+        "set: %s",
+        ready_set_status.GetErrorMessage().c_str());
+    *error = -ready_set_status.error();
+    return;
+  }
+  ready_set_ = ready_set_status.take();
   *error = 0;
 }
 
@@ -70,6 +87,11 @@ bool ProducerQueueChannel::HandleMessage(Message& message) {
           *this, &ProducerQueueChannel::OnGetQueueInfo, message);
       return true;
 
+    case BufferHubRPC::GetQueueState::Opcode:
+      DispatchRemoteMethod<BufferHubRPC::GetQueueState>(
+          *this, &ProducerQueueChannel::OnGetQueueState, message);
+      return true;
+
     case BufferHubRPC::ProducerQueueAllocateBuffers::Opcode:
       DispatchRemoteMethod<BufferHubRPC::ProducerQueueAllocateBuffers>(
           *this, &ProducerQueueChannel::OnProducerQueueAllocateBuffers,
@@ -111,8 +133,18 @@ Status<RemoteChannelHandle> ProducerQueueChannel::OnCreateConsumerQueue(
     return ErrorStatus(ENOMEM);
   }
 
+  auto ready_set_status = QueueReadySet::Create();
+  if (!ready_set_status) {
+    ALOGE(
+        "ProducerQueueChannel::OnCreateConsumerQueue: Failed to create ready "
+        "set: %s",
+        ready_set_status.GetErrorMessage().c_str());
+    return ErrorStatus(ready_set_status.error());
+  }
+
   auto consumer_queue_channel = std::make_shared<ConsumerQueueChannel>(
-      service(), buffer_id(), channel_id, shared_from_this());
+      service(), buffer_id(), channel_id, shared_from_this(),
+      ready_set_status.take());
 
   // Register the existing buffers with the new consumer queue.
   for (size_t slot = 0; slot < BufferHubRPC::kMaxQueueCapacity; slot++) {
@@ -137,7 +169,12 @@ Status<QueueInfo> ProducerQueueChannel::OnGetQueueInfo(Message&) {
   return {{meta_size_bytes_, buffer_id()}};
 }
 
-Status<std::vector<std::pair<RemoteChannelHandle, size_t>>>
+Status<QueueStateDescription<BorrowedHandle>>
+ProducerQueueChannel::OnGetQueueState(Message&) {
+  return ready_set_->GetDescription(buffer_id());
+}
+
+Status<std::vector<RemoteQueueBufferSlot>>
 ProducerQueueChannel::OnProducerQueueAllocateBuffers(
     Message& message, uint32_t width, uint32_t height, uint32_t layer_count,
     uint32_t format, uint64_t usage, size_t buffer_count) {
@@ -147,8 +184,6 @@ ProducerQueueChannel::OnProducerQueueAllocateBuffers(
            "producer_channel_id=%d",
            channel_id());
 
-  std::vector<std::pair<RemoteChannelHandle, size_t>> buffer_handles;
-
   // Deny buffer allocation violating preset rules.
   if (usage & usage_policy_.usage_deny_set_mask) {
     ALOGE(
@@ -168,112 +203,138 @@ ProducerQueueChannel::OnProducerQueueAllocateBuffers(
     return ErrorStatus(EINVAL);
   }
 
+  if (buffer_count > BufferHubRPC::kMaxQueueCapacity - capacity_) {
+    ALOGE(
+        "ProducerQueueChannel::OnProducerQueueAllocateBuffers: allocating %zu "
+        "buffers would exceed kMaxQueueCapacity, capacity=%zu.",
+        buffer_count, capacity_);
+    return ErrorStatus(E2BIG);
+  }
+
   // Force set mask and clear mask. Note that |usage_policy_.usage_set_mask_|
   // takes precedence and will overwrite |usage_policy_.usage_clear_mask|.
   uint64_t effective_usage =
       (usage & ~usage_policy_.usage_clear_mask) | usage_policy_.usage_set_mask;
 
+  return AllocateBuffers(message, width, height, layer_count, format,
+                         effective_usage, buffer_count);
+}
+
+Status<std::vector<RemoteQueueBufferSlot>>
+ProducerQueueChannel::AllocateBuffers(Message& message, uint32_t width,
+                                      uint32_t height, uint32_t layer_count,
+                                      uint32_t format, uint64_t usage,
+                                      size_t buffer_count) {
+  ATRACE_NAME("ProducerQueueChannel::AllocateBuffers");
+  ALOGD_IF(TRACE,
+           "ProducerQueueChannel::AllocateBuffers: producer_channel_id=%d "
+           "buffer_count=%zu width=%u height=%u layer_count=%u format=%u "
+           "usage=%" PRIx64,
+           channel_id(), buffer_count, width, height, layer_count, format,
+           usage);
+
+  // Here we are creating new BufferHubBuffers, initialize their producer
+  // channels, and returning their file handles back to the client.
+  // buffer_id is the id of the producer channel of BufferHubBuffer.
+  std::vector<RemoteChannelHandle> buffer_handles;
+  std::vector<int> buffer_ids(buffer_count);
   for (size_t i = 0; i < buffer_count; i++) {
-    auto status = AllocateBuffer(message, width, height, layer_count, format,
-                                 effective_usage);
+    auto status = message.PushChannel(0, nullptr, &buffer_ids[i]);
     if (!status) {
-      ALOGE(
-          "ProducerQueueChannel::OnProducerQueueAllocateBuffers: Failed to "
-          "allocate new buffer.");
+      ALOGE("ProducerQueueChannel::AllocateBuffers: failed to push channel: %s",
+            status.GetErrorMessage().c_str());
       return ErrorStatus(status.error());
     }
     buffer_handles.push_back(status.take());
   }
 
-  return {std::move(buffer_handles)};
-}
-
-Status<std::pair<RemoteChannelHandle, size_t>>
-ProducerQueueChannel::AllocateBuffer(Message& message, uint32_t width,
-                                     uint32_t height, uint32_t layer_count,
-                                     uint32_t format, uint64_t usage) {
-  ATRACE_NAME("ProducerQueueChannel::AllocateBuffer");
-  ALOGD_IF(TRACE,
-           "ProducerQueueChannel::AllocateBuffer: producer_channel_id=%d",
-           channel_id());
-
-  if (capacity_ >= BufferHubRPC::kMaxQueueCapacity) {
-    ALOGE("ProducerQueueChannel::AllocateBuffer: reaches kMaxQueueCapacity.");
-    return ErrorStatus(E2BIG);
-  }
-
-  // Here we are creating a new BufferHubBuffer, initialize the producer
-  // channel, and returning its file handle back to the client.
-  // buffer_id is the id of the producer channel of BufferHubBuffer.
-  int buffer_id;
-  auto status = message.PushChannel(0, nullptr, &buffer_id);
-
-  if (!status) {
-    ALOGE("ProducerQueueChannel::AllocateBuffer: failed to push channel: %s",
-          status.GetErrorMessage().c_str());
-    return ErrorStatus(status.error());
+  // Pushing channels is cheap, allocating gralloc buffers is not. Spread the
+  // allocations over a few threads, the calling thread being one of them, and
+  // only touch the queue state once they are all done.
+  std::vector<Status<std::shared_ptr<ProducerChannel>>> producer_channels(
+      buffer_count);
+  std::atomic<size_t> next_index{0};
+  auto allocate = [&] {
+    size_t i;
+    while ((i = next_index.fetch_add(1, std::memory_order_relaxed)) <
+           buffer_count) {
+      producer_channels[i] =
+          ProducerChannel::Create(service(), buffer_ids[i], width, height,
+                                  layer_count, format, usage, meta_size_bytes_);
+    }
+  };
+
+  std::vector<std::thread> allocation_threads;
+  const size_t thread_count = std::min(buffer_count, kMaxAllocationThreads);
+  for (size_t i = 1; i < thread_count; i++)
+    allocation_threads.emplace_back(allocate);
+  allocate();
+  for (auto& thread : allocation_threads)
+    thread.join();
+
+  for (auto& producer_channel_status : producer_channels) {
+    if (!producer_channel_status) {
+      ALOGE(
+          "ProducerQueueChannel::AllocateBuffers: Failed to create producer "
+          "buffer: %s",
+          producer_channel_status.GetErrorMessage().c_str());
+      return ErrorStatus(ENOMEM);
+    }
   }
 
-  ALOGD_IF(TRACE,
-           "ProducerQueueChannel::AllocateBuffer: buffer_id=%d width=%u "
-           "height=%u layer_count=%u format=%u usage=%" PRIx64,
-           buffer_id, width, height, layer_count, format, usage);
-  auto buffer_handle = status.take();
-
-  auto producer_channel_status =
-      ProducerChannel::Create(service(), buffer_id, width, height, layer_count,
-                              format, usage, meta_size_bytes_);
-  if (!producer_channel_status) {
-    ALOGE(
-        "ProducerQueueChannel::AllocateBuffer: Failed to create producer "
-        "buffer: %s",
-        producer_channel_status.GetErrorMessage().c_str());
-    return ErrorStatus(ENOMEM);
-  }
-  auto producer_channel = producer_channel_status.take();
+  std::vector<RemoteQueueBufferSlot> buffer_slots;
+  for (size_t i = 0; i < buffer_count; i++) {
+    auto producer_channel = producer_channels[i].take();
+    const int buffer_id = buffer_ids[i];
 
-  ALOGD_IF(
-      TRACE,
-      "ProducerQueueChannel::AllocateBuffer: buffer_id=%d, buffer_handle=%d",
-      buffer_id, buffer_handle.value());
+    ALOGD_IF(TRACE,
+             "ProducerQueueChannel::AllocateBuffers: buffer_id=%d, "
+             "buffer_handle=%d",
+             buffer_id, buffer_handles[i].value());
 
-  const auto channel_status =
-      service()->SetChannel(buffer_id, producer_channel);
-  if (!channel_status) {
-    ALOGE(
-        "ProducerQueueChannel::AllocateBuffer: failed to set producer channel "
-        "for new BufferHubBuffer: %s",
-        channel_status.GetErrorMessage().c_str());
-    return ErrorStatus(ENOMEM);
-  }
+    const auto channel_status =
+        service()->SetChannel(buffer_id, producer_channel);
+    if (!channel_status) {
+      ALOGE(
+          "ProducerQueueChannel::AllocateBuffers: failed to set producer "
+          "channel for new BufferHubBuffer: %s",
+          channel_status.GetErrorMessage().c_str());
+      return ErrorStatus(ENOMEM);
+    }
 
-  // Register the newly allocated buffer's channel_id into the first empty
-  // buffer slot.
-  size_t slot = 0;
-  for (; slot < BufferHubRPC::kMaxQueueCapacity; slot++) {
-    if (buffers_[slot].expired())
-      break;
-  }
-  if (slot == BufferHubRPC::kMaxQueueCapacity) {
-    ALOGE(
-        "ProducerQueueChannel::AllocateBuffer: Cannot find empty slot for new "
-        "buffer allocation.");
-    return ErrorStatus(E2BIG);
-  }
+    // Register the newly allocated buffer's channel_id into the first empty
+    // buffer slot.
+    size_t slot = 0;
+    for (; slot < BufferHubRPC::kMaxQueueCapacity; slot++) {
+      if (buffers_[slot].expired())
+        break;
+    }
+    if (slot == BufferHubRPC::kMaxQueueCapacity) {
+      ALOGE(
+          "ProducerQueueChannel::AllocateBuffers: Cannot find empty slot for "
+          "new buffer allocation.");
+      return ErrorStatus(E2BIG);
+    }
 
-  buffers_[slot] = producer_channel;
-  capacity_++;
+    buffers_[slot] = producer_channel;
+    producer_channel->SetQueueSlot(ready_set_, slot);
+    capacity_++;
+
+    // Notify each consumer channel about the new buffer.
+    for (auto* consumer_channel : consumer_channels_) {
+      ALOGD(
+          "ProducerQueueChannel::AllocateBuffers: Notified consumer with new "
+          "buffer, buffer_id=%d",
+          buffer_id);
+      consumer_channel->RegisterNewBuffer(producer_channel, slot);
+    }
 
-  // Notify each consumer channel about the new buffer.
-  for (auto* consumer_channel : consumer_channels_) {
-    ALOGD(
-        "ProducerQueueChannel::AllocateBuffer: Notified consumer with new "
-        "buffer, buffer_id=%d",
-        buffer_id);
-    consumer_channel->RegisterNewBuffer(producer_channel, slot);
+    buffer_slots.push_back(
+        {std::move(buffer_handles[i]), slot,
+         producer_channel->GetBuffer(BufferHubDefs::kProducerStateBit).take()});
   }
 
-  return {{std::move(buffer_handle), slot}};
+  return {std::move(buffer_slots)};
 }
 
 Status<void> ProducerQueueChannel::OnProducerQueueDetachBuffer(
@@ -293,8 +354,14 @@ Status<void> ProducerQueueChannel::OnProducerQueueDetachBuffer(
     return ErrorStatus(EINVAL);
   }
 
+  if (auto buffer = buffers_[slot].lock())
+    buffer->SetQueueSlot(nullptr, slot);
   buffers_[slot].reset();
   capacity_--;
+
+  // Consumer queues drop their buffer of the slot as well.
+  for (auto* consumer_channel : consumer_channels_)
+    consumer_channel->OnBufferDetached(slot);
   return {};
 }
 
@@ -6,6 +6,8 @@
 #include <pdx/status.h>
 #include <private/dvr/bufferhub_rpc.h>
 
+#include "queue_ready_set.h"
+
 namespace android {
 namespace dvr {
 
@@ -30,9 +32,14 @@ class ProducerQueueChannel : public BufferHubChannel {
 
   pdx::Status<QueueInfo> OnGetQueueInfo(pdx::Message& message);
 
-  // Allocate a new BufferHubProducer according to the input spec. Client may
-  // handle this as if a new producer is created through kOpCreateBuffer.
-  pdx::Status<std::vector<std::pair<pdx::RemoteChannelHandle, size_t>>>
+  // Returns the state through which the client learns about released buffers.
+  pdx::Status<QueueStateDescription<pdx::BorrowedHandle>> OnGetQueueState(
+      pdx::Message& message);
+
+  // Allocate |buffer_count| new BufferHubProducers according to the input spec.
+  // Client may handle these as if new producers are created through
+  // kOpCreateBuffer. The reply carries everything needed to import the buffers.
+  pdx::Status<std::vector<RemoteQueueBufferSlot>>
   OnProducerQueueAllocateBuffers(pdx::Message& message, uint32_t width,
                                  uint32_t height, uint32_t layer_count,
                                  uint32_t format, uint64_t usage,
@@ -51,14 +58,20 @@ class ProducerQueueChannel : public BufferHubChannel {
                        size_t meta_size_bytes, const UsagePolicy& usage_policy,
                        int* error);
 
-  // Allocate one single producer buffer by |OnProducerQueueAllocateBuffers|.
-  // Note that the newly created buffer's file handle will be pushed to client
-  // and our return type is a RemoteChannelHandle.
-  // Returns the remote channel handle and the slot number for the newly
-  // allocated buffer.
-  pdx::Status<std::pair<pdx::RemoteChannelHandle, size_t>> AllocateBuffer(
+  // Maximum number of threads allocating gralloc buffers for a single
+  // |OnProducerQueueAllocateBuffers| request.
+  static constexpr size_t kMaxAllocationThreads = 4;
+
+  // Allocate the producer buffers for |OnProducerQueueAllocateBuffers|. The
+  // gralloc allocations run in parallel; the buffers are only added to the
+  // queue once all of them succeeded. Note that the newly created buffers'
+  // file handles will be pushed to client.
+  // Returns the remote channel handle, the slot number and the buffer
+  // description of each newly allocated buffer.
+  pdx::Status<std::vector<RemoteQueueBufferSlot>> AllocateBuffers(
       pdx::Message& message, uint32_t width, uint32_t height,
-      uint32_t layer_count, uint32_t format, uint64_t usage);
+      uint32_t layer_count, uint32_t format, uint64_t usage,
+      size_t buffer_count);
 
   // Size of the meta data associated with all the buffers allocated from the
   // queue. Now we assume the metadata size is immutable once the queue is
@@ -76,6 +89,9 @@ class ProducerQueueChannel : public BufferHubChannel {
   // Tracks how many buffers have this queue allocated.
   size_t capacity_;
 
+  // Signals the client when buffers in the queue are released.
+  std::shared_ptr<QueueReadySet> ready_set_;
+
   // Tracks of all buffer producer allocated through this buffer queue. Once
   // a buffer get allocated, it will take a logical slot in the |buffers_| array
   // and the slot number will stay unchanged during the entire life cycle of the
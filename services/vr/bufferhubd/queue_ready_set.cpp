@@ -0,0 +1,93 @@
+#include "queue_ready_set.h"
+
+#include <hardware/gralloc.h>
+#include <log/log.h>
+#include <sys/eventfd.h>
+
+#include <new>
+
+using android::pdx::BorrowedHandle;
+using android::pdx::ErrorStatus;
+using android::pdx::LocalHandle;
+using android::pdx::Status;
+
+namespace android {
+namespace dvr {
+
+namespace {
+
+constexpr uint32_t kStateUsage =
+    GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_SW_WRITE_OFTEN;
+
+}  // anonymous namespace
+
+/* static */
+Status<std::shared_ptr<QueueReadySet>> QueueReadySet::Create() {
+  std::shared_ptr<QueueReadySet> ready_set(new QueueReadySet());
+  const int ret = ready_set->Init();
+  if (ret < 0)
+    return ErrorStatus(-ret);
+  else
+    return {std::move(ready_set)};
+}
+
+QueueReadySet::~QueueReadySet() {
+  if (state_)
+    state_buffer_.Unlock();
+}
+
+int QueueReadySet::Init() {
+  doorbell_.Reset(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+  if (!doorbell_) {
+    const int error = errno;
+    ALOGE("QueueReadySet::Init: Failed to create doorbell: %s",
+          strerror(error));
+    return -error;
+  }
+
+  const size_t state_size = sizeof(BufferHubDefs::QueueState);
+  int ret = state_buffer_.Alloc(state_size, 1, 1, HAL_PIXEL_FORMAT_BLOB,
+                                kStateUsage);
+  if (ret < 0) {
+    ALOGE("QueueReadySet::Init: Failed to allocate queue state: %s",
+          strerror(-ret));
+    return ret;
+  }
+
+  void* state_ptr = nullptr;
+  ret = state_buffer_.Lock(kStateUsage, 0, 0, state_size, 1, &state_ptr);
+  if (ret < 0) {
+    ALOGE("QueueReadySet::Init: Failed to map queue state: %s",
+          strerror(-ret));
+    return ret;
+  }
+
+  state_ = new (state_ptr) BufferHubDefs::QueueState();
+  return 0;
+}
+
+void QueueReadySet::SignalReady(size_t slot) {
+  if (BufferHubDefs::MarkQueueSlots(&state_->ready_slots, 1ULL << slot))
+    RingDoorbell();
+}
+
+void QueueReadySet::SignalHangup(size_t slot) {
+  if (BufferHubDefs::MarkQueueSlots(&state_->hangup_slots, 1ULL << slot))
+    RingDoorbell();
+}
+
+void QueueReadySet::RingDoorbell() {
+  if (eventfd_write(doorbell_.Get(), 1) < 0) {
+    ALOGE("QueueReadySet::RingDoorbell: Failed to ring doorbell: %s",
+          strerror(errno));
+  }
+}
+
+Status<QueueStateDescription<BorrowedHandle>> QueueReadySet::GetDescription(
+    int queue_id) const {
+  return {QueueStateDescription<BorrowedHandle>(state_buffer_, queue_id,
+                                                doorbell_.Borrow())};
+}
+
+}  // namespace dvr
+}  // namespace android
@@ -0,0 +1,49 @@
+#ifndef ANDROID_DVR_BUFFERHUBD_QUEUE_READY_SET_H_
+#define ANDROID_DVR_BUFFERHUBD_QUEUE_READY_SET_H_
+
+#include <pdx/file_handle.h>
+#include <pdx/status.h>
+#include <private/dvr/buffer_hub_defs.h>
+#include <private/dvr/bufferhub_rpc.h>
+#include <private/dvr/ion_buffer.h>
+
+namespace android {
+namespace dvr {
+
+// Tells a queue client which of its buffers are ready through the QueueState
+// shared with it, ringing the doorbell eventfd of the queue when the client
+// has to wake up. Producer and consumer queue channels own one each; buffer
+// channels that are part of a queue keep a weak reference to it along with
+// their slot.
+class QueueReadySet {
+ public:
+  static pdx::Status<std::shared_ptr<QueueReadySet>> Create();
+  ~QueueReadySet();
+
+  // Marks the buffer in |slot| as ready for the client.
+  void SignalReady(size_t slot);
+
+  // Marks the buffer in |slot| as detached from the queue.
+  void SignalHangup(size_t slot);
+
+  pdx::Status<QueueStateDescription<pdx::BorrowedHandle>> GetDescription(
+      int queue_id) const;
+
+ private:
+  QueueReadySet() = default;
+
+  int Init();
+  void RingDoorbell();
+
+  IonBuffer state_buffer_;
+  BufferHubDefs::QueueState* state_{nullptr};
+  pdx::LocalHandle doorbell_;
+
+  QueueReadySet(const QueueReadySet&) = delete;
+  void operator=(const QueueReadySet&) = delete;
+};
+
+}  // namespace dvr
+}  // namespace android
+
+#endif  // ANDROID_DVR_BUFFERHUBD_QUEUE_READY_SET_H_
@@ -16,6 +16,7 @@ LOCAL_PATH := $(call my-dir)
 
 sourceFiles := \
 	cpu_set.cpp \
+	frame_boost_policy.cpp \
 	main.cpp \
 	performance_service.cpp \
 	task.cpp
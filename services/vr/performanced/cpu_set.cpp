@@ -234,13 +234,17 @@ UniqueFile CpuSet::OpenFilePointer(const std::string& name, int flags) const {
 }
 
 int CpuSet::AttachTask(pid_t task_id) const {
-  auto file = OpenFile("tasks", O_RDWR);
-  if (file.get() >= 0) {
+  if (tasks_fd_.get() < 0)
+    tasks_fd_ = OpenFile("tasks", O_RDWR);
+
+  if (tasks_fd_.get() >= 0) {
     std::ostringstream stream;
     stream << task_id;
     std::string value = stream.str();
 
-    const bool ret = base::WriteStringToFd(value, file.get());
+    // Each write to the tasks file moves one task, independent of the file
+    // offset, so the same descriptor can be reused for every call.
+    const bool ret = base::WriteStringToFd(value, tasks_fd_.get());
     return !ret ? -errno : 0;
   } else {
     ALOGE("CpuSet::AttachTask: Failed to open %s/tasks: %s", path_.c_str(),
@@ -28,6 +28,8 @@ class CpuSet {
 
   std::string GetCpuList() const;
 
+  // Moves |task_id| into this cpuset. The tasks file is kept open after the
+  // first call so that later calls only need a single write.
   int AttachTask(pid_t task_id) const;
   std::vector<pid_t> GetTasks() const;
 
@@ -49,6 +51,7 @@ class CpuSet {
   std::string name_;
   std::string path_;
   base::unique_fd cpuset_fd_;
+  mutable base::unique_fd tasks_fd_;
   std::vector<std::unique_ptr<CpuSet>> children_;
 
   static void SetPrefixEnabled(bool enabled) { prefix_enabled_ = enabled; }
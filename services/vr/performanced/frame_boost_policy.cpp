@@ -0,0 +1,78 @@
+#include "frame_boost_policy.h"
+
+#include <bitset>
+
+namespace android {
+namespace dvr {
+
+static_assert(FrameBoostPolicy::kWindowFrames <= 32,
+              "The frame window must fit the tight frame bit mask.");
+
+constexpr int64_t FrameBoostPolicy::kTightPercent;
+constexpr size_t FrameBoostPolicy::kTightFrameCount;
+constexpr size_t FrameBoostPolicy::kWindowFrames;
+constexpr int64_t FrameBoostPolicy::kRelaxPercent;
+constexpr size_t FrameBoostPolicy::kRelaxFrames;
+
+FrameBoostPolicy::Level FrameBoostPolicy::AddFrame(uint32_t vsync_count,
+                                                   int64_t work_ns,
+                                                   int64_t budget_ns) {
+  if (budget_ns <= 0)
+    return level_;
+
+  // Unsigned arithmetic keeps this correct across vsync count wraparound. A
+  // frame that arrives more than one vsync after the previous one means the
+  // thread could not keep up; frames for an old vsync are ignored.
+  const int32_t vsync_delta =
+      has_vsync_ ? static_cast<int32_t>(vsync_count - last_vsync_count_) : 1;
+  if (vsync_delta <= 0)
+    return level_;
+  has_vsync_ = true;
+  last_vsync_count_ = vsync_count;
+
+  if (vsync_delta > 1 || work_ns > budget_ns) {
+    Raise();
+    return level_;
+  }
+
+  const uint32_t window_mask = (1U << kWindowFrames) - 1;
+  const bool tight = work_ns * 100 > budget_ns * kTightPercent;
+  tight_frames_ = ((tight_frames_ << 1) | (tight ? 1 : 0)) & window_mask;
+  if (std::bitset<32>(tight_frames_).count() >= kTightFrameCount) {
+    Raise();
+    return level_;
+  }
+
+  if (work_ns * 100 < budget_ns * kRelaxPercent) {
+    if (++relaxed_frame_count_ >= kRelaxFrames)
+      Lower();
+  } else {
+    relaxed_frame_count_ = 0;
+  }
+  return level_;
+}
+
+void FrameBoostPolicy::Reset() {
+  level_ = kLevelNone;
+  has_vsync_ = false;
+  tight_frames_ = 0;
+  relaxed_frame_count_ = 0;
+}
+
+void FrameBoostPolicy::Raise() {
+  if (level_ + 1 < kLevelCount)
+    level_ = static_cast<Level>(level_ + 1);
+
+  // Give the new level a full window to take effect before judging it.
+  tight_frames_ = 0;
+  relaxed_frame_count_ = 0;
+}
+
+void FrameBoostPolicy::Lower() {
+  if (level_ > kLevelNone)
+    level_ = static_cast<Level>(level_ - 1);
+  relaxed_frame_count_ = 0;
+}
+
+}  // namespace dvr
+}  // namespace android
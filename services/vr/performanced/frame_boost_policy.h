@@ -0,0 +1,78 @@
+#ifndef ANDROID_DVR_PERFORMANCED_FRAME_BOOST_POLICY_H_
+#define ANDROID_DVR_PERFORMANCED_FRAME_BOOST_POLICY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace android {
+namespace dvr {
+
+// FrameBoostPolicy decides how much a thread that renders frames against the
+// display deadline should be boosted, based on how much of the time available
+// to recent frames the thread used. Frames that come close to their budget, or
+// vsyncs that passed without a frame, raise the boost one level at a time.
+// Once the thread has had plenty of headroom for a while the boost is lowered
+// again, to give the power back.
+//
+// The policy only tracks state; PerformanceService applies the levels.
+class FrameBoostPolicy {
+ public:
+  enum Level {
+    // No boost, the thread runs with its regular scheduling.
+    kLevelNone = 0,
+    // The utilization clamp of the thread is raised, which puts a floor under
+    // the frequency of the cpu it runs on.
+    kLevelUtilFloor,
+    // The utilization clamp is maxed out and the thread is moved to the
+    // performance cores.
+    kLevelBigCores,
+
+    kLevelCount,
+  };
+
+  // A frame that uses more than this percentage of its budget is late enough
+  // to be a risk.
+  static constexpr int64_t kTightPercent = 80;
+
+  // Number of risky frames within the last kWindowFrames frames that raise the
+  // boost. A frame that missed its vsync raises the boost right away.
+  static constexpr size_t kTightFrameCount = 2;
+  static constexpr size_t kWindowFrames = 8;
+
+  // The boost is lowered one level after this many consecutive frames that
+  // used less than kRelaxPercent of their budget.
+  static constexpr int64_t kRelaxPercent = 50;
+  static constexpr size_t kRelaxFrames = 60;
+
+  FrameBoostPolicy() = default;
+
+  // Accounts for a frame that took |work_ns| out of |budget_ns| to complete.
+  // |vsync_count| is the vsync the frame was shown at; a gap to the vsync of the
+  // previous frame means the vsyncs in between were missed. Returns the boost
+  // level to apply after this frame.
+  Level AddFrame(uint32_t vsync_count, int64_t work_ns, int64_t budget_ns);
+
+  Level level() const { return level_; }
+
+  // Returns to kLevelNone and forgets the recent frames.
+  void Reset();
+
+ private:
+  void Raise();
+  void Lower();
+
+  Level level_ = kLevelNone;
+
+  bool has_vsync_ = false;
+  uint32_t last_vsync_count_ = 0;
+
+  // One bit per frame of the window, set for risky frames. The newest frame is
+  // the lowest bit.
+  uint32_t tight_frames_ = 0;
+  size_t relaxed_frame_count_ = 0;
+};
+
+}  // namespace dvr
+}  // namespace android
+
+#endif  // ANDROID_DVR_PERFORMANCED_FRAME_BOOST_POLICY_H_
@@ -1,9 +1,16 @@
 #include "performance_service.h"
 
+#include <errno.h>
 #include <sched.h>
+#include <stdint.h>
+#include <string.h>
 #include <sys/prctl.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <sstream>
+
 #include <pdx/default_transport/service_endpoint.h>
 #include <pdx/rpc/argument_encoder.h>
 #include <pdx/rpc/message_buffer.h>
@@ -26,6 +33,90 @@ const char kCpuSetBasePath[] = "/dev/cpuset";
 constexpr unsigned long kTimerSlackForegroundNs = 50000;
 constexpr unsigned long kTimerSlackBackgroundNs = 40000000;
 
+// Utilization clamps of the scheduler classes, out of 1024.
+constexpr uint32_t kUtilClampNone = 0;
+constexpr uint32_t kUtilClampMedium = 512;
+constexpr uint32_t kUtilClampMax = 1024;
+
+// Upper bound of the number of tasks with frame boost state, after which the
+// state of tasks that exited is dropped.
+constexpr size_t kMaxFrameBoostTasks = 32;
+
+// Name of the child partition with the performance cores; tasks at the top
+// frame boost level are moved from their partition into this child of it.
+const char kPerformancePartition[] = "performance";
+
+// Minimum utilization clamp for each frame boost level, out of 1024. The
+// schedutil governor does not pick a frequency below the clamped utilization
+// of the runnable tasks, so this acts as a per-task frequency floor.
+constexpr uint32_t kFrameBoostUtilClampMin[] = {kUtilClampNone, kUtilClampMedium,
+                                                kUtilClampMax};
+static_assert(sizeof(kFrameBoostUtilClampMin) /
+                      sizeof(kFrameBoostUtilClampMin[0]) ==
+                  android::dvr::FrameBoostPolicy::kLevelCount,
+              "Every frame boost level needs a utilization clamp.");
+
+// Argument of the sched_setattr syscall, which has no libc wrapper, including
+// the utilization clamp fields.
+struct SchedAttr {
+  uint32_t size;
+  uint32_t sched_policy;
+  uint64_t sched_flags;
+  int32_t sched_nice;
+  uint32_t sched_priority;
+  uint64_t sched_runtime;
+  uint64_t sched_deadline;
+  uint64_t sched_period;
+  uint32_t sched_util_min;
+  uint32_t sched_util_max;
+};
+
+constexpr uint64_t kSchedFlagKeepPolicy = 0x08;
+constexpr uint64_t kSchedFlagKeepParams = 0x10;
+constexpr uint64_t kSchedFlagUtilClampMin = 0x20;
+
+// Sets the minimum utilization clamp of |task_id|, leaving its scheduling
+// policy and parameters alone. Returns 0 or a negative errno code.
+int SetUtilClampMin(pid_t task_id, uint32_t util_min) {
+#ifdef __NR_sched_setattr
+  SchedAttr attr = {};
+  attr.size = sizeof(attr);
+  attr.sched_flags =
+      kSchedFlagKeepPolicy | kSchedFlagKeepParams | kSchedFlagUtilClampMin;
+  attr.sched_util_min = util_min;
+  if (syscall(__NR_sched_setattr, task_id, &attr, 0) < 0)
+    return -errno;
+  return 0;
+#else
+  (void)task_id;
+  (void)util_min;
+  return -ENOSYS;
+#endif
+}
+
+// Returns the minimum utilization clamp of |task_id|, or 0 if it cannot be
+// read.
+uint32_t GetUtilClampMin(pid_t task_id) {
+#ifdef __NR_sched_getattr
+  SchedAttr attr = {};
+  if (syscall(__NR_sched_getattr, task_id, &attr, sizeof(attr), 0) < 0 ||
+      attr.size < sizeof(attr)) {
+    return 0;
+  }
+  return attr.sched_util_min;
+#else
+  (void)task_id;
+  return 0;
+#endif
+}
+
+// Returns the path of the performance partition under |partition|.
+std::string GetPerformancePartition(const std::string& partition) {
+  if (partition == "/")
+    return partition + kPerformancePartition;
+  return partition + "/" + kPerformancePartition;
+}
+
 }  // anonymous namespace
 
 namespace android {
@@ -56,51 +147,81 @@ PerformanceService::PerformanceService()
       {"audio:low",
        {.timer_slack = kTimerSlackForegroundNs,
         .scheduler_policy = SCHED_FIFO | SCHED_RESET_ON_FORK,
-        .priority = fifo_medium}},
+        .priority = fifo_medium,
+        .util_clamp_min = kUtilClampNone}},
       {"audio:high",
        {.timer_slack = kTimerSlackForegroundNs,
         .scheduler_policy = SCHED_FIFO | SCHED_RESET_ON_FORK,
-        .priority = fifo_medium + 3}},
+        .priority = fifo_medium + 3,
+        .util_clamp_min = kUtilClampNone}},
       {"graphics",
        {.timer_slack = kTimerSlackForegroundNs,
         .scheduler_policy = SCHED_FIFO | SCHED_RESET_ON_FORK,
-        .priority = fifo_medium}},
+        .priority = fifo_medium,
+        .util_clamp_min = kUtilClampNone}},
       {"graphics:low",
        {.timer_slack = kTimerSlackForegroundNs,
         .scheduler_policy = SCHED_FIFO | SCHED_RESET_ON_FORK,
-        .priority = fifo_medium}},
+        .priority = fifo_medium,
+        .util_clamp_min = kUtilClampNone}},
       {"graphics:high",
        {.timer_slack = kTimerSlackForegroundNs,
         .scheduler_policy = SCHED_FIFO | SCHED_RESET_ON_FORK,
-        .priority = fifo_medium + 2}},
+        .priority = fifo_medium + 2,
+        .util_clamp_min = kUtilClampNone}},
       {"sensors",
        {.timer_slack = kTimerSlackForegroundNs,
         .scheduler_policy = SCHED_FIFO | SCHED_RESET_ON_FORK,
-        .priority = fifo_low}},
+        .priority = fifo_low,
+        .util_clamp_min = kUtilClampNone}},
       {"sensors:low",
        {.timer_slack = kTimerSlackForegroundNs,
         .scheduler_policy = SCHED_FIFO | SCHED_RESET_ON_FORK,
-        .priority = fifo_low}},
+        .priority = fifo_low,
+        .util_clamp_min = kUtilClampNone}},
       {"sensors:high",
        {.timer_slack = kTimerSlackForegroundNs,
         .scheduler_policy = SCHED_FIFO | SCHED_RESET_ON_FORK,
-        .priority = fifo_low + 1}},
+        .priority = fifo_low + 1,
+        .util_clamp_min = kUtilClampNone}},
       {"normal",
        {.timer_slack = kTimerSlackForegroundNs,
         .scheduler_policy = SCHED_NORMAL,
-        .priority = 0}},
+        .priority = 0,
+        .util_clamp_min = kUtilClampNone}},
       {"foreground",
        {.timer_slack = kTimerSlackForegroundNs,
         .scheduler_policy = SCHED_NORMAL,
-        .priority = 0}},
+        .priority = 0,
+        .util_clamp_min = kUtilClampNone}},
       {"background",
        {.timer_slack = kTimerSlackBackgroundNs,
         .scheduler_policy = SCHED_BATCH,
-        .priority = 0}},
+        .priority = 0,
+        .util_clamp_min = kUtilClampNone}},
       {"batch",
        {.timer_slack = kTimerSlackBackgroundNs,
         .scheduler_policy = SCHED_BATCH,
-        .priority = 0}},
+        .priority = 0,
+        .util_clamp_min = kUtilClampNone}},
+      // Latency critical threads that render against a deadline but do not
+      // need real-time priority, such as UI render threads and game threads.
+      {"render",
+       {.timer_slack = kTimerSlackForegroundNs,
+        .scheduler_policy = SCHED_NORMAL,
+        .priority = 0,
+        .util_clamp_min = kUtilClampMedium}},
+      {"render:high",
+       {.timer_slack = kTimerSlackForegroundNs,
+        .scheduler_policy = SCHED_FIFO | SCHED_RESET_ON_FORK,
+        .priority = fifo_medium + 1,
+        .util_clamp_min = kUtilClampMax}},
+      // Stages of a camera pipeline that process every frame.
+      {"camera",
+       {.timer_slack = kTimerSlackForegroundNs,
+        .scheduler_policy = SCHED_FIFO | SCHED_RESET_ON_FORK,
+        .priority = fifo_medium,
+        .util_clamp_min = kUtilClampMedium}},
   };
 }
 
@@ -110,13 +231,34 @@ bool PerformanceService::IsInitialized() const {
 }
 
 std::string PerformanceService::DumpState(size_t /*max_length*/) {
-  return cpuset_.DumpState();
+  std::ostringstream stream;
+  stream << cpuset_.DumpState();
+
+  if (!frame_boosts_.empty()) {
+    stream << std::endl << "Frame boost:" << std::endl;
+    for (const auto& pair : frame_boosts_) {
+      stream << "  task=" << pair.first
+             << " level=" << pair.second.applied_level;
+      if (!pair.second.base_partition.empty())
+        stream << " moved_from=" << pair.second.base_partition;
+      stream << std::endl;
+    }
+  }
+
+  return stream.str();
 }
 
-int PerformanceService::OnSetCpuPartition(Message& message, pid_t task_id,
-                                          const std::string& partition) {
-  Task task(task_id);
-  if (!task || task.thread_group_id() != message.GetProcessId())
+const Task* PerformanceService::GetProcessTask(pid_t process_id,
+                                               pid_t task_id) {
+  const Task* task = tasks_.Get(task_id);
+  if (!task || task->thread_group_id() != process_id)
+    return nullptr;
+  return task;
+}
+
+int PerformanceService::SetCpuPartition(pid_t process_id, pid_t task_id,
+                                        const std::string& partition) {
+  if (!GetProcessTask(process_id, task_id))
     return -EINVAL;
 
   auto target_set = cpuset_.Lookup(partition);
@@ -127,14 +269,18 @@ int PerformanceService::OnSetCpuPartition(Message& message, pid_t task_id,
   if (attach_error)
     return attach_error;
 
+  // An explicit partition replaces the one a frame boost moved the task out of.
+  auto search = frame_boosts_.find(task_id);
+  if (search != frame_boosts_.end())
+    search->second.base_partition.clear();
+
   return 0;
 }
 
-int PerformanceService::OnSetSchedulerClass(
-    Message& message, pid_t task_id, const std::string& scheduler_class) {
+int PerformanceService::SetSchedulerClass(pid_t process_id, pid_t task_id,
+                                          const std::string& scheduler_class) {
   // Make sure the task id is valid and belongs to the sending process.
-  Task task(task_id);
-  if (!task || task.thread_group_id() != message.GetProcessId())
+  if (!GetProcessTask(process_id, task_id))
     return -EINVAL;
 
   struct sched_param param;
@@ -148,26 +294,184 @@ int PerformanceService::OnSetSchedulerClass(
     param.sched_priority = config.priority;
     sched_setscheduler(task_id, config.scheduler_policy, &param);
     prctl(PR_SET_TIMERSLACK_PID, config.timer_slack, task_id);
-    ALOGI("PerformanceService::OnSetSchedulerClass: Set task=%d to class=%s.",
+
+    // A frame boost of the task only ever raises the clamp of its class.
+    uint32_t util_clamp_min = config.util_clamp_min;
+    auto boost = frame_boosts_.find(task_id);
+    if (boost != frame_boosts_.end()) {
+      boost->second.class_util_clamp_min = config.util_clamp_min;
+      util_clamp_min =
+          std::max(util_clamp_min,
+                   kFrameBoostUtilClampMin[boost->second.applied_level]);
+    }
+    ApplyUtilClampMin(task_id, util_clamp_min);
+    ALOGI("PerformanceService::SetSchedulerClass: Set task=%d to class=%s.",
           task_id, scheduler_class.c_str());
     return 0;
   } else {
     ALOGE(
-        "PerformanceService::OnSetSchedulerClass: Invalid class=%s requested "
+        "PerformanceService::SetSchedulerClass: Invalid class=%s requested "
         "by task=%d.",
         scheduler_class.c_str(), task_id);
     return -EINVAL;
   }
 }
 
+int PerformanceService::OnSetCpuPartition(Message& message, pid_t task_id,
+                                          const std::string& partition) {
+  return SetCpuPartition(message.GetProcessId(), task_id, partition);
+}
+
+int PerformanceService::OnSetSchedulerClass(
+    Message& message, pid_t task_id, const std::string& scheduler_class) {
+  return SetSchedulerClass(message.GetProcessId(), task_id, scheduler_class);
+}
+
 std::string PerformanceService::OnGetCpuPartition(Message& message,
                                                   pid_t task_id) {
   // Make sure the task id is valid and belongs to the sending process.
-  Task task(task_id);
-  if (!task || task.thread_group_id() != message.GetProcessId())
+  const Task* task = GetProcessTask(message.GetProcessId(), task_id);
+  if (!task)
     REPLY_ERROR_RETURN(message, EINVAL, "");
 
-  return task.GetCpuSetPath();
+  return task->GetCpuSetPath();
+}
+
+std::vector<int> PerformanceService::OnSetCpuPartitions(
+    Message& message,
+    const std::vector<std::pair<pid_t, std::string>>& requests) {
+  std::vector<int> results;
+  results.reserve(requests.size());
+  for (const auto& request : requests) {
+    results.push_back(
+        SetCpuPartition(message.GetProcessId(), request.first, request.second));
+  }
+  return results;
+}
+
+std::vector<int> PerformanceService::OnSetSchedulerClasses(
+    Message& message,
+    const std::vector<std::pair<pid_t, std::string>>& requests) {
+  std::vector<int> results;
+  results.reserve(requests.size());
+  for (const auto& request : requests) {
+    results.push_back(SetSchedulerClass(message.GetProcessId(), request.first,
+                                        request.second));
+  }
+  return results;
+}
+
+void PerformanceService::OnReportFrameTiming(Message& message) {
+  PerformanceRPC::FrameTiming timing;
+  if (message.GetSendLength() < sizeof(timing)) {
+    ALOGE(
+        "PerformanceService::OnReportFrameTiming: Short payload from pid=%d: "
+        "%zu bytes.",
+        message.GetProcessId(), message.GetSendLength());
+    return;
+  }
+  memcpy(&timing, message.ImpulseBegin(), sizeof(timing));
+
+  const pid_t task_id = timing.task_id;
+  if (!GetProcessTask(message.GetProcessId(), task_id))
+    return;
+
+  auto search = frame_boosts_.find(task_id);
+  if (search == frame_boosts_.end()) {
+    if (frame_boosts_.size() >= kMaxFrameBoostTasks)
+      PruneFrameBoosts();
+    search = frame_boosts_.emplace(task_id, FrameBoost{}).first;
+    search->second.class_util_clamp_min = GetUtilClampMin(task_id);
+  }
+
+  FrameBoost& boost = search->second;
+  const auto level = boost.policy.AddFrame(timing.vsync_count, timing.work_ns,
+                                           timing.budget_ns);
+  if (level != boost.applied_level)
+    ApplyFrameBoost(task_id, &boost, level);
+}
+
+void PerformanceService::ApplyFrameBoost(pid_t task_id, FrameBoost* boost,
+                                         FrameBoostPolicy::Level level) {
+  ALOGD_IF(TRACE,
+           "PerformanceService::ApplyFrameBoost: task=%d level=%d -> %d",
+           task_id, boost->applied_level, level);
+  boost->applied_level = level;
+
+  ApplyUtilClampMin(task_id, std::max(kFrameBoostUtilClampMin[level],
+                                      boost->class_util_clamp_min));
+
+  const bool big_cores = level >= FrameBoostPolicy::kLevelBigCores;
+  if (big_cores && boost->base_partition.empty()) {
+    const Task* task = tasks_.Get(task_id);
+    if (!task)
+      return;
+
+    const std::string partition = task->GetCpuSetPath();
+    CpuSet* target_set = cpuset_.Lookup(GetPerformancePartition(partition));
+    if (!target_set)
+      return;
+
+    const int error = target_set->AttachTask(task_id);
+    if (error < 0) {
+      ALOGE(
+          "PerformanceService::ApplyFrameBoost: Failed to move task=%d to "
+          "partition=%s: %s",
+          task_id, target_set->path().c_str(), strerror(-error));
+      return;
+    }
+    boost->base_partition = partition;
+  } else if (!big_cores && !boost->base_partition.empty()) {
+    if (CpuSet* base_set = cpuset_.Lookup(boost->base_partition)) {
+      const int error = base_set->AttachTask(task_id);
+      ALOGE_IF(error < 0,
+               "PerformanceService::ApplyFrameBoost: Failed to return task=%d "
+               "to partition=%s: %s",
+               task_id, boost->base_partition.c_str(), strerror(-error));
+    }
+    boost->base_partition.clear();
+  }
+}
+
+void PerformanceService::PruneFrameBoosts() {
+  for (auto it = frame_boosts_.begin(); it != frame_boosts_.end();) {
+    if (tasks_.Get(it->first))
+      ++it;
+    else
+      it = frame_boosts_.erase(it);
+  }
+}
+
+int PerformanceService::ApplyUtilClampMin(pid_t task_id, uint32_t util_min) {
+  if (!util_clamp_supported_)
+    return -EOPNOTSUPP;
+
+  const int error = SetUtilClampMin(task_id, util_min);
+  if (error == -EINVAL || error == -E2BIG || error == -ENOSYS ||
+      error == -EOPNOTSUPP) {
+    ALOGI(
+        "PerformanceService::ApplyUtilClampMin: Utilization clamping is not "
+        "supported: %s",
+        strerror(-error));
+    util_clamp_supported_ = false;
+  } else {
+    ALOGE_IF(error < 0,
+             "PerformanceService::ApplyUtilClampMin: Failed to set utilization "
+             "clamp of task=%d: %s",
+             task_id, strerror(-error));
+  }
+  return error;
+}
+
+void PerformanceService::HandleImpulse(Message& message) {
+  switch (message.GetOp()) {
+    case PerformanceRPC::ReportFrameTiming::Opcode:
+      OnReportFrameTiming(message);
+      break;
+
+    default:
+      break;
+  }
 }
 
 pdx::Status<void> PerformanceService::HandleMessage(Message& message) {
@@ -187,6 +491,16 @@ pdx::Status<void> PerformanceService::HandleMessage(Message& message) {
           *this, &PerformanceService::OnGetCpuPartition, message);
       return {};
 
+    case PerformanceRPC::SetCpuPartitions::Opcode:
+      DispatchRemoteMethod<PerformanceRPC::SetCpuPartitions>(
+          *this, &PerformanceService::OnSetCpuPartitions, message);
+      return {};
+
+    case PerformanceRPC::SetSchedulerClasses::Opcode:
+      DispatchRemoteMethod<PerformanceRPC::SetSchedulerClasses>(
+          *this, &PerformanceService::OnSetSchedulerClasses, message);
+      return {};
+
     default:
       return Service::HandleMessage(message);
   }
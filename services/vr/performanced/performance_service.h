@@ -3,10 +3,14 @@
 
 #include <string>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <pdx/service.h>
 
 #include "cpu_set.h"
+#include "frame_boost_policy.h"
+#include "task.h"
 
 namespace android {
 namespace dvr {
@@ -21,6 +25,7 @@ class PerformanceService : public pdx::ServiceBase<PerformanceService> {
   bool IsInitialized() const override;
 
   std::string DumpState(size_t max_length) override;
+  void HandleImpulse(pdx::Message& message) override;
 
  private:
   friend BASE;
@@ -32,9 +37,56 @@ class PerformanceService : public pdx::ServiceBase<PerformanceService> {
   int OnSetSchedulerClass(pdx::Message& message, pid_t task_id,
                           const std::string& scheduler_class);
   std::string OnGetCpuPartition(pdx::Message& message, pid_t task_id);
+  std::vector<int> OnSetCpuPartitions(
+      pdx::Message& message,
+      const std::vector<std::pair<pid_t, std::string>>& requests);
+  std::vector<int> OnSetSchedulerClasses(
+      pdx::Message& message,
+      const std::vector<std::pair<pid_t, std::string>>& requests);
+
+  // Returns the task for |task_id| if it belongs to |process_id|, otherwise
+  // nullptr.
+  const Task* GetProcessTask(pid_t process_id, pid_t task_id);
+
+  int SetCpuPartition(pid_t process_id, pid_t task_id,
+                      const std::string& partition);
+  int SetSchedulerClass(pid_t process_id, pid_t task_id,
+                        const std::string& scheduler_class);
+
+  void OnReportFrameTiming(pdx::Message& message);
+
+  // Frame boost state of a task that reports its frame timing.
+  struct FrameBoost {
+    FrameBoostPolicy policy;
+    FrameBoostPolicy::Level applied_level = FrameBoostPolicy::kLevelNone;
+
+    // The partition the task was moved out of when it was moved to the
+    // performance cores, empty while it was not moved.
+    std::string base_partition;
+
+    // Utilization clamp of the scheduler class of the task, which the boost
+    // never goes below.
+    uint32_t class_util_clamp_min = 0;
+  };
+
+  // Applies |level| to |task_id|, moving it between its base partition and the
+  // performance partition as needed.
+  void ApplyFrameBoost(pid_t task_id, FrameBoost* boost,
+                       FrameBoostPolicy::Level level);
+
+  // Drops the frame boost state of tasks that exited.
+  void PruneFrameBoosts();
+
+  // Sets the minimum utilization clamp of |task_id| if the kernel supports
+  // utilization clamping. Returns 0 or a negative errno code.
+  int ApplyUtilClampMin(pid_t task_id, uint32_t util_min);
 
   CpuSetManager cpuset_;
 
+  // Clients usually make requests for the same few threads, so their procfs
+  // information is cached between requests.
+  TaskCache tasks_;
+
   int sched_fifo_min_priority_;
   int sched_fifo_max_priority_;
 
@@ -43,10 +95,21 @@ class PerformanceService : public pdx::ServiceBase<PerformanceService> {
     unsigned long timer_slack;
     int scheduler_policy;
     int priority;
+
+    // Minimum utilization clamp, out of 1024. Classes for latency critical
+    // threads raise it so that the cpu frequency does not lag behind bursts of
+    // work; all other classes reset it.
+    uint32_t util_clamp_min;
   };
 
   std::unordered_map<std::string, SchedulerClassConfig> scheduler_classes_;
 
+  std::unordered_map<pid_t, FrameBoost> frame_boosts_;
+
+  // Cleared when the kernel turns out not to support utilization clamping, in
+  // which case only the partition part of the frame boost is used.
+  bool util_clamp_supported_ = true;
+
   PerformanceService(const PerformanceService&) = delete;
   void operator=(const PerformanceService&) = delete;
 };
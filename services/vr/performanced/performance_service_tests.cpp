@@ -78,6 +78,14 @@ TEST(PerformanceTest, SetSchedulerClass) {
   EXPECT_EQ(0, error);
   EXPECT_EQ(SCHED_FIFO | SCHED_RESET_ON_FORK, sched_getscheduler(0));
 
+  error = dvrSetSchedulerClass(0, "render");
+  EXPECT_EQ(0, error);
+  EXPECT_EQ(SCHED_NORMAL, sched_getscheduler(0));
+
+  error = dvrSetSchedulerClass(0, "camera");
+  EXPECT_EQ(0, error);
+  EXPECT_EQ(SCHED_FIFO | SCHED_RESET_ON_FORK, sched_getscheduler(0));
+
   error = dvrSetSchedulerClass(0, "normal");
   EXPECT_EQ(0, error);
   EXPECT_EQ(SCHED_NORMAL, sched_getscheduler(0));
@@ -86,6 +94,80 @@ TEST(PerformanceTest, SetSchedulerClass) {
   EXPECT_EQ(-EINVAL, error);
 }
 
+TEST(PerformanceTest, SetSchedulerClasses) {
+  int error;
+  int results[3];
+
+  // Set a thread other than the calling one along with the calling thread.
+  std::mutex mutex;
+  std::condition_variable condition;
+  bool done = false;
+  pid_t other_task_id = -1;
+  int other_scheduler = -1;
+  std::thread thread([&]() {
+    std::unique_lock<std::mutex> lock(mutex);
+    other_task_id = gettid();
+    condition.notify_one();
+    condition.wait(lock, [&done]() { return done; });
+    other_scheduler = sched_getscheduler(0);
+  });
+
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    condition.wait(lock, [&other_task_id]() { return other_task_id != -1; });
+  }
+
+  const pid_t task_ids[] = {0, other_task_id, 1};
+  const char* const classes[] = {"background", "background", "normal"};
+  error = dvrSetSchedulerClasses(3, task_ids, classes, results);
+  EXPECT_EQ(-EINVAL, error);
+  EXPECT_EQ(0, results[0]);
+  EXPECT_EQ(0, results[1]);
+  EXPECT_EQ(-EINVAL, results[2]);
+  EXPECT_EQ(SCHED_BATCH, sched_getscheduler(0));
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    done = true;
+    condition.notify_one();
+  }
+  thread.join();
+  EXPECT_EQ(SCHED_BATCH, other_scheduler);
+
+  // The other thread exited, so requests for it fail now.
+  const char* const normal_classes[] = {"normal", "normal"};
+  error = dvrSetSchedulerClasses(2, task_ids, normal_classes, results);
+  EXPECT_EQ(-EINVAL, error);
+  EXPECT_EQ(0, results[0]);
+  EXPECT_EQ(-EINVAL, results[1]);
+  EXPECT_EQ(SCHED_NORMAL, sched_getscheduler(0));
+
+  // An invalid class only fails its own request.
+  const pid_t self_task_ids[] = {0, 0};
+  const char* const invalid_classes[] = {"foobar", "normal"};
+  error = dvrSetSchedulerClasses(2, self_task_ids, invalid_classes, nullptr);
+  EXPECT_EQ(-EINVAL, error);
+  EXPECT_EQ(SCHED_NORMAL, sched_getscheduler(0));
+
+  // An empty batch is valid.
+  error = dvrSetSchedulerClasses(0, nullptr, nullptr, nullptr);
+  EXPECT_EQ(0, error);
+}
+
+TEST(PerformanceTest, ReportFrameTiming) {
+  int error;
+
+  // Reports are asynchronous, so only sending them can fail.
+  for (uint32_t vsync_count = 1; vsync_count <= 10; vsync_count++) {
+    error = dvrReportFrameTiming(0, vsync_count, 1000000, 8000000);
+    EXPECT_EQ(0, error);
+  }
+
+  // Reports for tasks of other processes are dropped by the service.
+  error = dvrReportFrameTiming(1, 1, 1000000, 8000000);
+  EXPECT_EQ(0, error);
+}
+
 TEST(PerformanceTest, SchedulerClassResetOnFork) {
   int error;
 
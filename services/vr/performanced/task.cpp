@@ -4,6 +4,7 @@
 #include <fcntl.h>
 #include <log/log.h>
 #include <stdio.h>
+#include <unistd.h>
 
 #include <cctype>
 #include <cstdlib>
@@ -159,5 +160,47 @@ std::string Task::GetCpuSetPath() const {
   }
 }
 
+bool Task::IsAlive() const {
+  // Lookups in the directory of a task that exited fail, even when the task id
+  // was reused by a new task.
+  return IsValid() && faccessat(task_fd_.get(), "status", F_OK, 0) == 0;
+}
+
+constexpr size_t TaskCache::kMaxTaskCount;
+
+const Task* TaskCache::Get(pid_t task_id) {
+  auto search = tasks_.find(task_id);
+  if (search != tasks_.end()) {
+    if (search->second->IsAlive())
+      return search->second.get();
+    tasks_.erase(search);
+  }
+
+  auto task = std::make_unique<Task>(task_id);
+  if (!*task)
+    return nullptr;
+
+  if (tasks_.size() >= kMaxTaskCount)
+    Evict();
+
+  auto result = tasks_.emplace(task_id, std::move(task));
+  return result.first->second.get();
+}
+
+void TaskCache::Evict() {
+  for (auto it = tasks_.begin(); it != tasks_.end();) {
+    if (it->second->IsAlive())
+      ++it;
+    else
+      it = tasks_.erase(it);
+  }
+
+  if (tasks_.size() >= kMaxTaskCount) {
+    ALOGD_IF(TRACE, "TaskCache::Evict: Dropping all %zu cached tasks.",
+             tasks_.size());
+    tasks_.clear();
+  }
+}
+
 }  // namespace dvr
 }  // namespace android
@@ -46,6 +46,11 @@ class Task {
 
   std::string GetCpuSetPath() const;
 
+  // Returns true while the task has not exited. The open /proc directory keeps
+  // referring to the original task, so this is still correct after the task id
+  // is reused.
+  bool IsAlive() const;
+
  private:
   pid_t task_id_;
   base::unique_fd task_fd_;
@@ -77,6 +82,38 @@ class Task {
   void operator=(const Task&) = delete;
 };
 
+// TaskCache keeps the Task instances of recently seen task ids so that
+// repeated requests for the same tasks don't need to open and parse procfs each
+// time. Cached tasks are rechecked with Task::IsAlive() on each lookup and read
+// again once they exit. Fields that may change during the lifetime of a task,
+// like the thread count or allowed cpus, can be stale; callers that need them
+// should construct a Task instead.
+class TaskCache {
+ public:
+  TaskCache() = default;
+
+  // Returns the task for |task_id|, or nullptr if no such task exists. The
+  // pointer is owned by the cache and is valid until the next call to Get() or
+  // Clear().
+  const Task* Get(pid_t task_id);
+
+  void Clear() { tasks_.clear(); }
+  size_t size() const { return tasks_.size(); }
+
+ private:
+  // Bounds the number of open /proc directories held by the cache.
+  static constexpr size_t kMaxTaskCount = 256;
+
+  // Makes room for a new task by dropping the tasks that exited, or every task
+  // if none did.
+  void Evict();
+
+  std::unordered_map<pid_t, std::unique_ptr<Task>> tasks_;
+
+  TaskCache(const TaskCache&) = delete;
+  void operator=(const TaskCache&) = delete;
+};
+
 }  // namespace dvr
 }  // namespace android
 
@@ -57,6 +57,7 @@ int EvdevInjector::UInput::IoctlVoid(int request) {
 }
 
 void EvdevInjector::Close() {
+  pending_events_.clear();
   uinput_->Close();
   state_ = State::CLOSED;
 }
@@ -218,9 +219,20 @@ int EvdevInjector::Send(uint16_t type, uint16_t code, int32_t value) {
   event.type = type;
   event.code = code;
   event.value = value;
-  if (const int status = uinput_->Write(&event, sizeof(event))) {
-    ALOGE("failed to write event 0x%" PRIX16 ", 0x%" PRIX16 ", 0x%" PRIX32,
-          type, code, value);
+  pending_events_.push_back(event);
+  if (type != EV_SYN || code != SYN_REPORT) {
+    return 0;
+  }
+
+  // Write the complete frame with a single system call.
+  const size_t count = pending_events_.size();
+  const int status = uinput_->Write(pending_events_.data(),
+                                    count * sizeof(pending_events_[0]));
+  pending_events_.clear();
+  if (status) {
+    ALOGE("failed to write %zu events ending with 0x%" PRIX16 ", 0x%" PRIX16
+          ", 0x%" PRIX32,
+          count, type, code, value);
     return Error(status);
   }
   return 0;
@@ -8,6 +8,7 @@
 #include <cstdint>
 #include <memory>
 #include <unordered_set>
+#include <vector>
 
 namespace android {
 namespace dvr {
@@ -57,7 +58,12 @@ class EvdevInjector {
   void Close();
 
   int GetError() const { return error_; }
-  void ResetError() { error_ = 0; }
+
+  // Clears the error state, along with any events of an incomplete frame.
+  void ResetError() {
+    error_ = 0;
+    pending_events_.clear();
+  }
 
   // Configuration must be performed before sending any events.
   // |ConfigureBegin()| must be called first, and |ConfigureEnd()| last,
@@ -92,6 +98,8 @@ class EvdevInjector {
 
   // Send various events.
   //
+  // Events are queued until the |SYN_REPORT| that ends their frame, and the
+  // whole frame is then written to uinput at once.
   int Send(uint16_t type, uint16_t code, int32_t value);
   int SendSynReport();
   int SendKey(uint16_t code, int32_t value);
@@ -131,6 +139,7 @@ class EvdevInjector {
   uinput_user_dev uidev_;
   std::unordered_set<uint16_t> enabled_event_types_;
   int32_t latest_slot_ = -1;
+  std::vector<input_event> pending_events_;
 
   EvdevInjector(const EvdevInjector&) = delete;
   void operator=(const EvdevInjector&) = delete;
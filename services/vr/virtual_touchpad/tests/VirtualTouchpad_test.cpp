@@ -4,6 +4,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <vector>
 
 #include "EvdevInjector.h"
 #include "VirtualTouchpadEvdev.h"
@@ -16,14 +17,23 @@ namespace {
 class UInputForTesting : public EvdevInjector::UInput {
  public:
   ~UInputForTesting() override {}
+
+  // Events are written in frames, each ending with a SYN_REPORT.
   void WriteInputEvent(uint16_t type, uint16_t code, int32_t value) {
     struct input_event event;
     memset(&event, 0, sizeof(event));
     event.type = type;
     event.code = code;
     event.value = value;
-    Write(&event, sizeof(event));
+    frame_.push_back(event);
+    if (type == EV_SYN && code == SYN_REPORT) {
+      Write(frame_.data(), frame_.size() * sizeof(frame_[0]));
+      frame_.clear();
+    }
   }
+
+ private:
+  std::vector<input_event> frame_;
 };
 
 // Recording test implementation of UInput.
@@ -323,5 +333,40 @@ TEST_F(VirtualTouchpadTest, Badness) {
   EXPECT_NE(0, touch_status);
 }
 
+TEST_F(VirtualTouchpadTest, Frames) {
+  EvdevInjectorForTesting injector;
+  UInputRecorder expect;
+
+  injector.ConfigureBegin("vr-virtual-touchpad-test", BUS_VIRTUAL, 0, 0, 1);
+  injector.ConfigureMultiTouchXY(0, 0, 99, 99);
+  injector.ConfigureEnd();
+  EXPECT_EQ(0, injector.GetError());
+
+  // Events are not written before the end of their frame.
+  injector.record.Reset();
+  EXPECT_EQ(0, injector.SendMultiTouchXY(0, 0, 10, 20));
+  EXPECT_EQ(expect.GetString(), injector.record.GetString());
+
+  // The whole frame is written at once.
+  expect.WriteInputEvent(EV_ABS, ABS_MT_SLOT, 0);
+  expect.WriteInputEvent(EV_ABS, ABS_MT_TRACKING_ID, 0);
+  expect.WriteInputEvent(EV_ABS, ABS_MT_POSITION_X, 10);
+  expect.WriteInputEvent(EV_ABS, ABS_MT_POSITION_Y, 20);
+  expect.WriteInputEvent(EV_SYN, SYN_REPORT, 0);
+  EXPECT_EQ(0, injector.SendSynReport());
+  EXPECT_EQ(expect.GetString(), injector.record.GetString());
+
+  // Resetting the error state drops an incomplete frame.
+  expect.Reset();
+  injector.record.Reset();
+  EXPECT_EQ(0, injector.SendAbs(ABS_MT_POSITION_X, 30));
+  injector.ResetError();
+  expect.WriteInputEvent(EV_ABS, ABS_MT_POSITION_Y, 40);
+  expect.WriteInputEvent(EV_SYN, SYN_REPORT, 0);
+  EXPECT_EQ(0, injector.SendAbs(ABS_MT_POSITION_Y, 40));
+  EXPECT_EQ(0, injector.SendSynReport());
+  EXPECT_EQ(expect.GetString(), injector.record.GetString());
+}
+
 }  // namespace dvr
 }  // namespace android
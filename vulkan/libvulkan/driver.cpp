@@ -29,6 +29,7 @@
 #include <android/dlext.h>
 #include <cutils/properties.h>
 #include <ui/GraphicsEnv.h>
+#include <utils/Timers.h>
 #include <utils/Vector.h>
 
 #include "driver.h"
@@ -207,6 +208,7 @@ bool Hal::Open() {
     // Use a stub device unless we successfully open a real HAL device.
     hal_.dev_ = &stubhal::kDevice;
 
+    const nsecs_t openTime = systemTime();
     int result;
     const hwvulkan_module_t* module = nullptr;
 
@@ -246,6 +248,9 @@ bool Hal::Open() {
 
     hal_.InitDebugReportIndex();
 
+    android::GraphicsEnv::getInstance().setDriverLoadTime(
+        android::GraphicsEnv::Api::Vulkan, systemTime() - openTime);
+
     return true;
 }
 
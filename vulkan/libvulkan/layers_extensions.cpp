@@ -24,6 +24,7 @@
 
 #include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <android/dlext.h>
@@ -70,12 +71,14 @@ const char kSystemLayerLibraryDir[] = "/data/local/debug/vulkan";
 class LayerLibrary {
    public:
     explicit LayerLibrary(const std::string& path)
-        : path_(path), dlhandle_(nullptr), refcount_(0) {}
+        : path_(path), dlhandle_(nullptr), refcount_(0), keep_loaded_(false) {}
 
     LayerLibrary(LayerLibrary&& other)
         : path_(std::move(other.path_)),
           dlhandle_(other.dlhandle_),
-          refcount_(other.refcount_) {
+          refcount_(other.refcount_),
+          keep_loaded_(other.keep_loaded_),
+          gpa_cache_(std::move(other.gpa_cache_)) {
         other.dlhandle_ = nullptr;
         other.refcount_ = 0;
     }
@@ -87,6 +90,11 @@ class LayerLibrary {
     bool Open();
     void Close();
 
+    // Keeps the library loaded after the last Close(), so that apps creating
+    // and destroying instances over and over don't pay for dlopen and the
+    // layer's own initialization every time.
+    void KeepLoaded();
+
     bool EnumerateLayers(size_t library_idx,
                          std::vector<Layer>& instance_layers) const;
 
@@ -97,14 +105,19 @@ class LayerLibrary {
    private:
     const std::string path_;
 
-    std::mutex mutex_;
+    mutable std::mutex mutex_;
     void* dlhandle_;
     size_t refcount_;
+    bool keep_loaded_;
+
+    // GetGPA results, by layer and function name; only filled in once the
+    // library is kept loaded, as dlclose would invalidate them.
+    mutable std::unordered_map<std::string, void*> gpa_cache_;
 };
 
 bool LayerLibrary::Open() {
     std::lock_guard<std::mutex> lock(mutex_);
-    if (refcount_++ == 0) {
+    if (refcount_++ == 0 && !dlhandle_) {
         ALOGV("opening layer library '%s'", path_.c_str());
         // Libraries in the system layer library dir can't be loaded into
         // the application namespace. That causes compatibility problems, since
@@ -134,13 +147,18 @@ bool LayerLibrary::Open() {
 
 void LayerLibrary::Close() {
     std::lock_guard<std::mutex> lock(mutex_);
-    if (--refcount_ == 0) {
+    if (--refcount_ == 0 && !keep_loaded_) {
         ALOGV("closing layer library '%s'", path_.c_str());
         dlclose(dlhandle_);
         dlhandle_ = nullptr;
     }
 }
 
+void LayerLibrary::KeepLoaded() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    keep_loaded_ = true;
+}
+
 bool LayerLibrary::EnumerateLayers(size_t library_idx,
                                    std::vector<Layer>& instance_layers) const {
     PFN_vkEnumerateInstanceLayerProperties enumerate_instance_layers =
@@ -286,6 +304,15 @@ bool LayerLibrary::EnumerateLayers(size_t library_idx,
 void* LayerLibrary::GetGPA(const Layer& layer,
                            const char* gpa_name,
                            size_t gpa_name_len) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string key;
+    if (keep_loaded_) {
+        key.append(layer.properties.layerName).append(1, '\0').append(gpa_name);
+        auto it = gpa_cache_.find(key);
+        if (it != gpa_cache_.end())
+            return it->second;
+    }
+
     void* gpa;
     size_t layer_name_len =
         std::max(size_t{2}, strlen(layer.properties.layerName));
@@ -297,6 +324,8 @@ void* LayerLibrary::GetGPA(const Layer& layer,
         strcpy(name + 2, gpa_name);
         gpa = dlsym(dlhandle_, name);
     }
+    if (keep_loaded_)
+        gpa_cache_.emplace(std::move(key), gpa);
     return gpa;
 }
 
@@ -481,7 +510,10 @@ const VkExtensionProperties* FindLayerDeviceExtension(const Layer& layer,
 
 LayerRef GetLayerRef(const Layer& layer) {
     LayerLibrary& library = g_layer_libraries[layer.library_idx];
-    return LayerRef((library.Open()) ? &layer : nullptr);
+    if (!library.Open())
+        return LayerRef(nullptr);
+    library.KeepLoaded();
+    return LayerRef(&layer);
 }
 
 LayerRef::LayerRef(const Layer* layer) : layer_(layer) {}
@@ -14,8 +14,17 @@
  * limitations under the License.
  */
 
-#include <algorithm>
+#include <time.h>
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <cutils/properties.h>
 #include <grallocusage/GrallocUsageConversion.h>
 #include <log/log.h>
 #include <ui/BufferQueueDefs.h>
@@ -206,7 +215,11 @@ struct Swapchain {
           mailbox_mode(present_mode == VK_PRESENT_MODE_MAILBOX_KHR),
           frame_timestamps_enabled(false),
           shared(present_mode == VK_PRESENT_MODE_SHARED_DEMAND_REFRESH_KHR ||
-                 present_mode == VK_PRESENT_MODE_SHARED_CONTINUOUS_REFRESH_KHR) {
+                 present_mode == VK_PRESENT_MODE_SHARED_CONTINUOUS_REFRESH_KHR),
+          present_pacing(false),
+          dequeue_ahead_depth(0),
+          dequeue_result(VK_SUCCESS),
+          stop_dequeue(false) {
         ANativeWindow* window = surface.window.get();
         native_window_get_refresh_cycle_duration(
             window,
@@ -233,6 +246,29 @@ struct Swapchain {
     } images[android::BufferQueueDefs::NUM_BUFFER_SLOTS];
 
     android::Vector<TimingInfo> timing;
+    // Pick a desiredPresentTime for presents that don't have one
+    // (debug.vulkan.present_pacing). See ScheduleNextPresent.
+    bool present_pacing;
+
+    // Dequeue-ahead mode (debug.vulkan.dequeue_ahead): a helper thread keeps
+    // up to dequeue_ahead_depth buffers dequeued, so AcquireNextImageKHR only
+    // waits for one to be ready, and can honor its timeout. Buffers sitting in
+    // ready_buffers aren't marked dequeued in images[] until they're acquired.
+    struct ReadyBuffer {
+        uint32_t idx;
+        int fence;
+    };
+    uint32_t dequeue_ahead_depth;
+    std::thread dequeue_thread;
+    std::mutex dequeue_mutex;
+    // Signalled when there's room in ready_buffers, or the thread must stop.
+    std::condition_variable dequeue_cond;
+    // Signalled when a buffer is ready, or dequeue_result is set.
+    std::condition_variable ready_cond;
+    // Guarded by dequeue_mutex.
+    std::deque<ReadyBuffer> ready_buffers;
+    VkResult dequeue_result;
+    bool stop_dequeue;
 };
 
 VkSwapchainKHR HandleFromSwapchain(Swapchain* swapchain) {
@@ -292,9 +328,97 @@ void ReleaseSwapchainImage(VkDevice device,
     image.buffer.clear();
 }
 
+void DequeueAheadThread(Swapchain* swapchain,
+                        std::vector<ANativeWindowBuffer*> buffers) {
+    ANativeWindow* window = swapchain->surface.window.get();
+    std::unique_lock<std::mutex> lock(swapchain->dequeue_mutex);
+    while (true) {
+        swapchain->dequeue_cond.wait(lock, [swapchain] {
+            return swapchain->stop_dequeue ||
+                   (swapchain->dequeue_result == VK_SUCCESS &&
+                    swapchain->ready_buffers.size() <
+                        swapchain->dequeue_ahead_depth);
+        });
+        if (swapchain->stop_dequeue)
+            return;
+        lock.unlock();
+
+        // This is where BufferQueue back-pressure blocks, instead of in
+        // vkAcquireNextImageKHR.
+        ANativeWindowBuffer* buffer;
+        int fence_fd;
+        VkResult result = VK_SUCCESS;
+        uint32_t idx = 0;
+        int err = window->dequeueBuffer(window, &buffer, &fence_fd);
+        if (err != 0) {
+            ALOGE("dequeueBuffer failed: %s (%d)", strerror(-err), err);
+            result = VK_ERROR_SURFACE_LOST_KHR;
+        } else {
+            auto it = std::find(buffers.begin(), buffers.end(), buffer);
+            if (it == buffers.end()) {
+                ALOGE("dequeueBuffer returned unrecognized buffer");
+                window->cancelBuffer(window, buffer, fence_fd);
+                result = VK_ERROR_OUT_OF_DATE_KHR;
+            } else {
+                idx = static_cast<uint32_t>(it - buffers.begin());
+            }
+        }
+
+        lock.lock();
+        if (result == VK_SUCCESS)
+            swapchain->ready_buffers.push_back({idx, fence_fd});
+        else
+            swapchain->dequeue_result = result;
+        swapchain->ready_cond.notify_all();
+    }
+}
+
+void StartDequeueAhead(Swapchain& swapchain, uint32_t depth) {
+    std::vector<ANativeWindowBuffer*> buffers;
+    for (uint32_t i = 0; i < swapchain.num_images; i++)
+        buffers.push_back(swapchain.images[i].buffer.get());
+    swapchain.dequeue_ahead_depth = depth;
+    swapchain.dequeue_thread =
+        std::thread(DequeueAheadThread, &swapchain, std::move(buffers));
+}
+
+// Stops the dequeue-ahead thread, and gives the buffers it dequeued back to
+// the window. With release_acquired, the buffers the application acquired
+// are given back first, since the thread may be blocked in dequeueBuffer
+// waiting for one of them.
+void StopDequeueAhead(Swapchain& swapchain,
+                      ANativeWindow* window,
+                      bool release_acquired) {
+    if (!swapchain.dequeue_thread.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(swapchain.dequeue_mutex);
+        swapchain.stop_dequeue = true;
+    }
+    swapchain.dequeue_cond.notify_all();
+    if (release_acquired) {
+        for (uint32_t i = 0; i < swapchain.num_images; i++) {
+            Swapchain::Image& img = swapchain.images[i];
+            if (img.dequeued) {
+                window->cancelBuffer(window, img.buffer.get(),
+                                     img.dequeue_fence);
+                img.dequeue_fence = -1;
+                img.dequeued = false;
+            }
+        }
+    }
+    swapchain.dequeue_thread.join();
+    for (const auto& ready : swapchain.ready_buffers) {
+        window->cancelBuffer(window, swapchain.images[ready.idx].buffer.get(),
+                             ready.fence);
+    }
+    swapchain.ready_buffers.clear();
+}
+
 void OrphanSwapchain(VkDevice device, Swapchain* swapchain) {
     if (swapchain->surface.swapchain_handle != HandleFromSwapchain(swapchain))
         return;
+    StopDequeueAhead(*swapchain, swapchain->surface.window.get(), false);
     for (uint32_t i = 0; i < swapchain->num_images; i++) {
         if (!swapchain->images[i].dequeued)
             ReleaseSwapchainImage(device, nullptr, -1, swapchain->images[i]);
@@ -398,6 +522,37 @@ void copy_ready_timings(Swapchain& swapchain,
     *count = num_copied;
 }
 
+// Picks a desiredPresentTime for a frame the application didn't schedule
+// itself, from the newest past frame whose actual present time is known:
+// later frames are spaced one refresh cycle apart, each due half a cycle
+// before the vsync it's meant for, so the compositor releases them evenly
+// instead of in bursts. Returns 0 ("as soon as possible") if there's no
+// usable history yet, or if the frame's slot has already gone by.
+int64_t ScheduleNextPresent(Swapchain& swapchain, uint64_t native_frame_id) {
+    const int64_t rdur = swapchain.refresh_duration;
+    if (rdur <= 0 || native_frame_id == 0)
+        return 0;
+    get_num_ready_timings(swapchain);
+    for (size_t i = swapchain.timing.size(); i-- > 0;) {
+        const TimingInfo& ti = swapchain.timing[i];
+        if (!ti.ready() || ti.vals_.actualPresentTime == 0)
+            continue;
+        if (native_frame_id <= ti.native_frame_id_)
+            return 0;
+        int64_t frames = static_cast<int64_t>(native_frame_id -
+                                              ti.native_frame_id_);
+        int64_t target =
+            static_cast<int64_t>(ti.vals_.actualPresentTime) +
+            frames * rdur - rdur / 2;
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int64_t now_ns = static_cast<int64_t>(now.tv_sec) * 1000000000 +
+                         now.tv_nsec;
+        return target > now_ns ? target : 0;
+    }
+    return 0;
+}
+
 android_pixel_format GetNativePixelFormat(VkFormat format) {
     android_pixel_format native_format = HAL_PIXEL_FORMAT_RGBA_8888;
     switch (format) {
@@ -861,8 +1016,8 @@ VkResult CreateSwapchainKHR(VkDevice device,
     if (err != 0) {
         // TODO(jessehall): Improve error reporting. Can we enumerate possible
         // errors and translate them to valid Vulkan result codes?
-        ALOGE("native_window->setSwapInterval(1) failed: %s (%d)",
-              strerror(-err), err);
+        ALOGE("native_window->setSwapInterval(%d) failed: %s (%d)",
+              swap_interval, strerror(-err), err);
         return VK_ERROR_SURFACE_LOST_KHR;
     }
 
@@ -979,6 +1134,15 @@ VkResult CreateSwapchainKHR(VkDevice device,
     uint32_t num_images =
         (create_info->minImageCount - 1) + min_undequeued_buffers;
 
+    // A shared presentable image swapchain has exactly one image: it stays
+    // dequeued for the swapchain's lifetime, and AcquireNextImageKHR and
+    // QueuePresentKHR only ever hand image 0 back and forth. Creating more
+    // would leave VkImages the app can never acquire holding extra buffers.
+    if (create_info->presentMode == VK_PRESENT_MODE_SHARED_DEMAND_REFRESH_KHR ||
+        create_info->presentMode == VK_PRESENT_MODE_SHARED_CONTINUOUS_REFRESH_KHR) {
+        num_images = 1;
+    }
+
     // Lower layer insists that we have at least two buffers. This is wasteful
     // and we'd like to relax it in the shared case, but not all the pieces are
     // in place for that to work yet. Note we only lie to the lower layer-- we
@@ -1132,6 +1296,22 @@ VkResult CreateSwapchainKHR(VkDevice device,
         return result;
     }
 
+    // Mailbox swapchains already show the newest frame at every vsync, and a
+    // shared image is never queued in the first place.
+    swapchain->present_pacing =
+        !swapchain->shared && !swapchain->mailbox_mode &&
+        property_get_bool("debug.vulkan.present_pacing", false);
+
+    if (!swapchain->shared) {
+        // Leave the application at least one image it can acquire itself.
+        int32_t depth = property_get_int32("debug.vulkan.dequeue_ahead", 0);
+        uint32_t max_depth = num_images - 1;
+        if (depth > 0 && max_depth > 0) {
+            StartDequeueAhead(*swapchain, std::min(static_cast<uint32_t>(depth),
+                                                   max_depth));
+        }
+    }
+
     surface.swapchain_handle = HandleFromSwapchain(swapchain);
     *swapchain_handle = surface.swapchain_handle;
     return VK_SUCCESS;
@@ -1151,6 +1331,9 @@ void DestroySwapchainKHR(VkDevice device,
     if (swapchain->frame_timestamps_enabled) {
         native_window_enable_frame_timestamps(window, false);
     }
+    // An inactive swapchain's thread was stopped when it was orphaned.
+    if (window)
+        StopDequeueAhead(*swapchain, window, true);
     for (uint32_t i = 0; i < swapchain->num_images; i++)
         ReleaseSwapchainImage(device, window, -1, swapchain->images[i]);
     if (active)
@@ -1202,10 +1385,6 @@ VkResult AcquireNextImageKHR(VkDevice device,
     if (swapchain.surface.swapchain_handle != swapchain_handle)
         return VK_ERROR_OUT_OF_DATE_KHR;
 
-    ALOGW_IF(
-        timeout != UINT64_MAX,
-        "vkAcquireNextImageKHR: non-infinite timeouts not yet implemented");
-
     if (swapchain.shared) {
         // In shared mode, we keep the buffer dequeued all the time, so we don't
         // want to dequeue a buffer here. Instead, just ask the driver to ensure
@@ -1218,26 +1397,59 @@ VkResult AcquireNextImageKHR(VkDevice device,
 
     ANativeWindowBuffer* buffer;
     int fence_fd;
-    err = window->dequeueBuffer(window, &buffer, &fence_fd);
-    if (err != 0) {
-        // TODO(jessehall): Improve error reporting. Can we enumerate possible
-        // errors and translate them to valid Vulkan result codes?
-        ALOGE("dequeueBuffer failed: %s (%d)", strerror(-err), err);
-        return VK_ERROR_SURFACE_LOST_KHR;
-    }
-
     uint32_t idx;
-    for (idx = 0; idx < swapchain.num_images; idx++) {
-        if (swapchain.images[idx].buffer.get() == buffer) {
-            swapchain.images[idx].dequeued = true;
-            swapchain.images[idx].dequeue_fence = fence_fd;
-            break;
+    if (swapchain.dequeue_thread.joinable()) {
+        // The helper thread has done the dequeueing; we only wait for it to
+        // have a buffer ready, which timeout can actually bound.
+        std::unique_lock<std::mutex> lock(swapchain.dequeue_mutex);
+        auto ready = [&swapchain] {
+            return !swapchain.ready_buffers.empty() ||
+                   swapchain.dequeue_result != VK_SUCCESS;
+        };
+        if (timeout == UINT64_MAX) {
+            swapchain.ready_cond.wait(lock, ready);
+        } else if (!swapchain.ready_cond.wait_for(
+                       lock,
+                       std::chrono::nanoseconds(std::min<uint64_t>(
+                           timeout, INT64_MAX / 2)),
+                       ready)) {
+            return timeout == 0 ? VK_NOT_READY : VK_TIMEOUT;
+        }
+        if (swapchain.ready_buffers.empty())
+            return swapchain.dequeue_result;
+        idx = swapchain.ready_buffers.front().idx;
+        fence_fd = swapchain.ready_buffers.front().fence;
+        swapchain.ready_buffers.pop_front();
+        swapchain.images[idx].dequeued = true;
+        swapchain.images[idx].dequeue_fence = fence_fd;
+        buffer = swapchain.images[idx].buffer.get();
+        lock.unlock();
+        swapchain.dequeue_cond.notify_one();
+    } else {
+        ALOGW_IF(timeout != UINT64_MAX,
+                 "vkAcquireNextImageKHR: non-infinite timeouts not yet "
+                 "implemented");
+
+        err = window->dequeueBuffer(window, &buffer, &fence_fd);
+        if (err != 0) {
+            // TODO(jessehall): Improve error reporting. Can we enumerate
+            // possible errors and translate them to valid Vulkan result codes?
+            ALOGE("dequeueBuffer failed: %s (%d)", strerror(-err), err);
+            return VK_ERROR_SURFACE_LOST_KHR;
+        }
+
+        for (idx = 0; idx < swapchain.num_images; idx++) {
+            if (swapchain.images[idx].buffer.get() == buffer) {
+                swapchain.images[idx].dequeued = true;
+                swapchain.images[idx].dequeue_fence = fence_fd;
+                break;
+            }
+        }
+        if (idx == swapchain.num_images) {
+            ALOGE("dequeueBuffer returned unrecognized buffer");
+            window->cancelBuffer(window, buffer, fence_fd);
+            return VK_ERROR_OUT_OF_DATE_KHR;
         }
-    }
-    if (idx == swapchain.num_images) {
-        ALOGE("dequeueBuffer returned unrecognized buffer");
-        window->cancelBuffer(window, buffer, fence_fd);
-        return VK_ERROR_OUT_OF_DATE_KHR;
     }
 
     int fence_clone = -1;
@@ -1401,6 +1613,9 @@ VkResult QueuePresentKHR(VkQueue queue, const VkPresentInfoKHR* present_info) {
                     }
                     native_window_set_surface_damage(window, rects, rcount);
                 }
+                VkPresentTimeGOOGLE paced_time = {0, 0};
+                if (!time && swapchain.present_pacing)
+                    time = &paced_time;
                 if (time) {
                     if (!swapchain.frame_timestamps_enabled) {
                         ALOGV(
@@ -1425,15 +1640,20 @@ VkResult QueuePresentKHR(VkQueue queue, const VkPresentInfoKHR* present_info) {
                     while (swapchain.timing.size() > MAX_TIMING_INFOS) {
                         swapchain.timing.removeAt(0);
                     }
-                    if (time->desiredPresentTime) {
+                    int64_t desired_present_time =
+                        static_cast<int64_t>(time->desiredPresentTime);
+                    if (!desired_present_time && swapchain.present_pacing) {
+                        desired_present_time =
+                            ScheduleNextPresent(swapchain, nativeFrameId);
+                    }
+                    if (desired_present_time) {
                         // Set the desiredPresentTime:
                         ALOGV(
                             "Calling "
                             "native_window_set_buffers_timestamp(%" PRId64 ")",
-                            time->desiredPresentTime);
+                            desired_present_time);
                         native_window_set_buffers_timestamp(
-                            window,
-                            static_cast<int64_t>(time->desiredPresentTime));
+                            window, desired_present_time);
                     }
                 }
 
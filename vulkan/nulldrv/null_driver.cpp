@@ -16,13 +16,17 @@
 
 #include <hardware/hwvulkan.h>
 
+#include <errno.h>
 #include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 
+#include <cutils/properties.h>
 #include <log/log.h>
 #include <utils/Errors.h>
 
@@ -92,6 +96,46 @@ enum Enum {
 
 const VkDeviceSize kMaxDeviceMemory = 0x10000000;  // 256 MiB, arbitrary
 
+// Knobs for using the null driver to measure the CPU cost of the loader and
+// layers above it, with driver time taken out of the picture or stood in for.
+// Read once, from:
+//   debug.vulkan.null.submit_us   microseconds each vkQueueSubmit takes
+//   debug.vulkan.null.present_us  microseconds each present takes
+//   debug.vulkan.null.heap_mb     size of the memory heap; allocations that
+//                                 don't fit in what's left of it fail
+struct Config {
+    uint32_t submit_latency_us;
+    uint32_t present_latency_us;
+    VkDeviceSize heap_size;
+};
+
+uint32_t GetLatencyProperty(const char* name) {
+    return static_cast<uint32_t>(std::max(0, property_get_int32(name, 0)));
+}
+
+const Config& GetConfig() {
+    static const Config config = [] {
+        int32_t heap_mb = property_get_int32("debug.vulkan.null.heap_mb", 0);
+        return Config{
+            GetLatencyProperty("debug.vulkan.null.submit_us"),
+            GetLatencyProperty("debug.vulkan.null.present_us"),
+            heap_mb > 0 ? static_cast<VkDeviceSize>(heap_mb) << 20
+                        : kMaxDeviceMemory,
+        };
+    }();
+    return config;
+}
+
+// Stands in for the time a real driver would spend, without using the CPU.
+void FakeLatency(uint32_t us) {
+    if (us == 0)
+        return;
+    timespec ts = {static_cast<time_t>(us / 1000000),
+                   static_cast<long>(us % 1000000) * 1000};
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+}
+
 }  // anonymous namespace
 
 struct VkDevice_T {
@@ -100,6 +144,8 @@ struct VkDevice_T {
     VkInstance_T* instance;
     VkQueue_T queue;
     std::array<uint64_t, HandleType::kNumTypes> next_handle;
+    // Bytes of device memory allocated, against Config::heap_size.
+    std::atomic<VkDeviceSize> allocated_memory;
 };
 
 // -----------------------------------------------------------------------------
@@ -569,7 +615,7 @@ void GetPhysicalDeviceMemoryProperties(
         VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
     properties->memoryTypes[0].heapIndex = 0;
     properties->memoryHeapCount = 1;
-    properties->memoryHeaps[0].size = kMaxDeviceMemory;
+    properties->memoryHeaps[0].size = GetConfig().heap_size;
     properties->memoryHeaps[0].flags = VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
 }
 
@@ -664,6 +710,7 @@ VkResult CreateDevice(VkPhysicalDevice physical_device,
     device->queue.dispatch.magic = HWVULKAN_DISPATCH_MAGIC;
     std::fill(device->next_handle.begin(), device->next_handle.end(),
               UINT64_C(0));
+    std::atomic_init(&device->allocated_memory, VkDeviceSize(0));
 
     for (uint32_t i = 0; i < create_info->enabledExtensionCount; i++) {
         if (strcmp(create_info->ppEnabledExtensionNames[i],
@@ -777,12 +824,24 @@ VkResult AllocateMemory(VkDevice device,
     if (!allocator)
         allocator = &device->allocator;
 
+    const VkDeviceSize heap_size = GetConfig().heap_size;
+    if (alloc_info->allocationSize > heap_size)
+        return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+    VkDeviceSize allocated =
+        device->allocated_memory.fetch_add(alloc_info->allocationSize);
+    if (allocated > heap_size - alloc_info->allocationSize) {
+        device->allocated_memory.fetch_sub(alloc_info->allocationSize);
+        return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+    }
+
     size_t size = sizeof(DeviceMemory) + size_t(alloc_info->allocationSize);
     DeviceMemory* mem = static_cast<DeviceMemory*>(allocator->pfnAllocation(
         allocator->pUserData, size, alignof(DeviceMemory),
         VK_SYSTEM_ALLOCATION_SCOPE_OBJECT));
-    if (!mem)
+    if (!mem) {
+        device->allocated_memory.fetch_sub(alloc_info->allocationSize);
         return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
     mem->size = size;
     *mem_handle = GetHandleToDeviceMemory(mem);
     return VK_SUCCESS;
@@ -794,6 +853,9 @@ void FreeMemory(VkDevice device,
     if (!allocator)
         allocator = &device->allocator;
     DeviceMemory* mem = GetDeviceMemoryFromHandle(mem_handle);
+    if (!mem)
+        return;
+    device->allocated_memory.fetch_sub(mem->size - sizeof(DeviceMemory));
     allocator->pfnFree(allocator->pUserData, mem);
 }
 
@@ -950,6 +1012,7 @@ VkResult QueueSignalReleaseImageANDROID(VkQueue,
                                         const VkSemaphore*,
                                         VkImage,
                                         int* fence) {
+    FakeLatency(GetConfig().present_latency_us);
     *fence = -1;
     return VK_SUCCESS;
 }
@@ -1144,6 +1207,7 @@ VkResult EnumerateInstanceLayerProperties(uint32_t* pCount, VkLayerProperties* p
 }
 
 VkResult QueueSubmit(VkQueue queue, uint32_t submitCount, const VkSubmitInfo* pSubmitInfo, VkFence fence) {
+    FakeLatency(GetConfig().submit_latency_us);
     return VK_SUCCESS;
 }
 
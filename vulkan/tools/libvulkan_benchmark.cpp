@@ -0,0 +1,309 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Microbenchmarks of the CPU time libvulkan adds on top of the driver: the
+ * trampolines (api_gen.cpp), the driver hooks (driver.cpp) and the WSI
+ * implementation (swapchain.cpp). The swapchain presents to an in-process
+ * BufferQueue whose consumer hands every buffer straight back, so neither
+ * SurfaceFlinger nor a display is involved.
+ *
+ * To keep the GPU out of the numbers, run these against the null driver
+ * (vulkan.default). Its debug.vulkan.null.* properties stand in for the time
+ * a real driver would spend in vkQueueSubmit and in presenting.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <gui/BufferItem.h>
+#include <gui/BufferItemConsumer.h>
+#include <gui/BufferQueue.h>
+#include <gui/Surface.h>
+#include <ui/GraphicBuffer.h>
+#include <utils/StrongPointer.h>
+
+#include <vulkan/vulkan.h>
+
+namespace android {
+namespace {
+
+const uint32_t kWidth = 1920;
+const uint32_t kHeight = 1080;
+
+// Gives every queued buffer back right away, like a consumer that never
+// falls behind.
+struct ReleasingListener : public BufferItemConsumer::FrameAvailableListener {
+    explicit ReleasingListener(const sp<BufferItemConsumer>& consumer)
+        : mConsumer(consumer) {}
+    void onFrameAvailable(const BufferItem& /*item*/) override {
+        BufferItem item;
+        if (mConsumer->acquireBuffer(&item, 0, false) == NO_ERROR) {
+            mConsumer->releaseBuffer(item);
+        }
+    }
+    wp<BufferItemConsumer> mConsumer;
+};
+
+class Context {
+  public:
+    Context() = default;
+    ~Context() {
+        if (mDevice) {
+            vkDeviceWaitIdle(mDevice);
+            if (mSwapchain) vkDestroySwapchainKHR(mDevice, mSwapchain, nullptr);
+            if (mPool) vkDestroyCommandPool(mDevice, mPool, nullptr);
+            vkDestroyDevice(mDevice, nullptr);
+        }
+        if (mInstance) {
+            if (mSurface) vkDestroySurfaceKHR(mInstance, mSurface, nullptr);
+            vkDestroyInstance(mInstance, nullptr);
+        }
+    }
+
+    // Creates an instance, a device with one queue and a primary command
+    // buffer, and with |swapchain|, a FIFO swapchain of |images| images.
+    bool init(benchmark::State& state, bool swapchain, uint32_t images = 3) {
+        const char* instanceExtensions[] = {
+            VK_KHR_SURFACE_EXTENSION_NAME,
+            VK_KHR_ANDROID_SURFACE_EXTENSION_NAME,
+        };
+        VkInstanceCreateInfo instanceInfo = {};
+        instanceInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+        instanceInfo.enabledExtensionCount = swapchain ? 2 : 0;
+        instanceInfo.ppEnabledExtensionNames = instanceExtensions;
+        if (vkCreateInstance(&instanceInfo, nullptr, &mInstance) != VK_SUCCESS) {
+            state.SkipWithError("vkCreateInstance failed");
+            return false;
+        }
+
+        uint32_t count = 1;
+        VkPhysicalDevice gpu;
+        VkResult result = vkEnumeratePhysicalDevices(mInstance, &count, &gpu);
+        if ((result != VK_SUCCESS && result != VK_INCOMPLETE) || count == 0) {
+            state.SkipWithError("no physical device");
+            return false;
+        }
+
+        const float priority = 1.0f;
+        VkDeviceQueueCreateInfo queueInfo = {};
+        queueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+        queueInfo.queueFamilyIndex = 0;
+        queueInfo.queueCount = 1;
+        queueInfo.pQueuePriorities = &priority;
+        const char* deviceExtensions[] = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
+        VkDeviceCreateInfo deviceInfo = {};
+        deviceInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+        deviceInfo.queueCreateInfoCount = 1;
+        deviceInfo.pQueueCreateInfos = &queueInfo;
+        deviceInfo.enabledExtensionCount = swapchain ? 1 : 0;
+        deviceInfo.ppEnabledExtensionNames = deviceExtensions;
+        if (vkCreateDevice(gpu, &deviceInfo, nullptr, &mDevice) != VK_SUCCESS) {
+            state.SkipWithError("vkCreateDevice failed");
+            return false;
+        }
+        vkGetDeviceQueue(mDevice, 0, 0, &mQueue);
+
+        VkCommandPoolCreateInfo poolInfo = {};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        if (vkCreateCommandPool(mDevice, &poolInfo, nullptr, &mPool) != VK_SUCCESS) {
+            state.SkipWithError("vkCreateCommandPool failed");
+            return false;
+        }
+        VkCommandBufferAllocateInfo cmdInfo = {};
+        cmdInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        cmdInfo.commandPool = mPool;
+        cmdInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        cmdInfo.commandBufferCount = 1;
+        if (vkAllocateCommandBuffers(mDevice, &cmdInfo, &mCmd) != VK_SUCCESS) {
+            state.SkipWithError("vkAllocateCommandBuffers failed");
+            return false;
+        }
+
+        return !swapchain || initSwapchain(state, images);
+    }
+
+    VkDevice device() const { return mDevice; }
+    VkQueue queue() const { return mQueue; }
+    VkCommandBuffer cmd() const { return mCmd; }
+    VkSwapchainKHR swapchain() const { return mSwapchain; }
+
+    // Replaces the swapchain with a new one, as on a resize or rotation.
+    bool recreateSwapchain() {
+        VkSwapchainKHR old = mSwapchain;
+        mSwapchainInfo.oldSwapchain = old;
+        VkResult result = vkCreateSwapchainKHR(mDevice, &mSwapchainInfo, nullptr, &mSwapchain);
+        if (old) vkDestroySwapchainKHR(mDevice, old, nullptr);
+        if (result != VK_SUCCESS) {
+            mSwapchain = VK_NULL_HANDLE;
+            return false;
+        }
+        return true;
+    }
+
+  private:
+    bool initSwapchain(benchmark::State& state, uint32_t images) {
+        sp<IGraphicBufferProducer> producer;
+        sp<IGraphicBufferConsumer> consumer;
+        BufferQueue::createBufferQueue(&producer, &consumer);
+        consumer->setDefaultBufferSize(kWidth, kHeight);
+        mConsumer = new BufferItemConsumer(consumer, GraphicBuffer::USAGE_HW_COMPOSER);
+        mListener = new ReleasingListener(mConsumer);
+        mConsumer->setFrameAvailableListener(mListener);
+        mWindow = new Surface(producer);
+
+        VkAndroidSurfaceCreateInfoKHR surfaceInfo = {};
+        surfaceInfo.sType = VK_STRUCTURE_TYPE_ANDROID_SURFACE_CREATE_INFO_KHR;
+        surfaceInfo.window = mWindow.get();
+        if (vkCreateAndroidSurfaceKHR(mInstance, &surfaceInfo, nullptr, &mSurface) !=
+            VK_SUCCESS) {
+            state.SkipWithError("vkCreateAndroidSurfaceKHR failed");
+            return false;
+        }
+
+        mSwapchainInfo = {};
+        mSwapchainInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+        mSwapchainInfo.surface = mSurface;
+        mSwapchainInfo.minImageCount = images;
+        mSwapchainInfo.imageFormat = VK_FORMAT_R8G8B8A8_UNORM;
+        mSwapchainInfo.imageColorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
+        mSwapchainInfo.imageExtent = {kWidth, kHeight};
+        mSwapchainInfo.imageArrayLayers = 1;
+        mSwapchainInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+        mSwapchainInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        mSwapchainInfo.preTransform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
+        mSwapchainInfo.compositeAlpha = VK_COMPOSITE_ALPHA_INHERIT_BIT_KHR;
+        mSwapchainInfo.presentMode = VK_PRESENT_MODE_FIFO_KHR;
+        mSwapchainInfo.clipped = VK_TRUE;
+        if (!recreateSwapchain()) {
+            state.SkipWithError("vkCreateSwapchainKHR failed");
+            return false;
+        }
+        return true;
+    }
+
+
+    VkInstance mInstance = VK_NULL_HANDLE;
+    VkDevice mDevice = VK_NULL_HANDLE;
+    VkQueue mQueue = VK_NULL_HANDLE;
+    VkCommandPool mPool = VK_NULL_HANDLE;
+    VkCommandBuffer mCmd = VK_NULL_HANDLE;
+    VkSurfaceKHR mSurface = VK_NULL_HANDLE;
+    VkSwapchainKHR mSwapchain = VK_NULL_HANDLE;
+    VkSwapchainCreateInfoKHR mSwapchainInfo;
+    sp<BufferItemConsumer> mConsumer;
+    sp<ReleasingListener> mListener;
+    sp<Surface> mWindow;
+};
+
+// Loader work per instance: driver and layer discovery, dispatch tables.
+void BM_CreateDestroyInstance(benchmark::State& state) {
+    VkInstanceCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+    while (state.KeepRunning()) {
+        VkInstance instance;
+        if (vkCreateInstance(&info, nullptr, &instance) != VK_SUCCESS) {
+            state.SkipWithError("vkCreateInstance failed");
+            break;
+        }
+        vkDestroyInstance(instance, nullptr);
+    }
+}
+BENCHMARK(BM_CreateDestroyInstance);
+
+// The device-level name lookup that engines do at startup.
+void BM_GetDeviceProcAddr(benchmark::State& state) {
+    Context ctx;
+    if (!ctx.init(state, false)) return;
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(vkGetDeviceProcAddr(ctx.device(), "vkCmdDraw"));
+    }
+}
+BENCHMARK(BM_GetDeviceProcAddr);
+
+// One trampoline per call, into a command the null driver ignores: this is
+// the per-command overhead of going through libvulkan.
+void BM_CommandTrampoline(benchmark::State& state) {
+    Context ctx;
+    if (!ctx.init(state, false)) return;
+    const VkCommandBuffer cmd = ctx.cmd();
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    vkBeginCommandBuffer(cmd, &beginInfo);
+    while (state.KeepRunning()) {
+        vkCmdSetLineWidth(cmd, 1.0f);
+    }
+    vkEndCommandBuffer(cmd);
+}
+BENCHMARK(BM_CommandTrampoline);
+
+void BM_QueueSubmit(benchmark::State& state) {
+    Context ctx;
+    if (!ctx.init(state, false)) return;
+    const VkCommandBuffer cmd = ctx.cmd();
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &cmd;
+    while (state.KeepRunning()) {
+        vkQueueSubmit(ctx.queue(), 1, &submitInfo, VK_NULL_HANDLE);
+    }
+}
+BENCHMARK(BM_QueueSubmit);
+
+// A full frame of WSI work: acquire, then present, through swapchain.cpp and
+// the BufferQueue. The argument is the number of swapchain images.
+void BM_AcquirePresent(benchmark::State& state) {
+    Context ctx;
+    if (!ctx.init(state, true, static_cast<uint32_t>(state.range(0)))) return;
+    const VkSwapchainKHR swapchain = ctx.swapchain();
+    VkPresentInfoKHR presentInfo = {};
+    presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+    presentInfo.swapchainCount = 1;
+    presentInfo.pSwapchains = &swapchain;
+    while (state.KeepRunning()) {
+        uint32_t index;
+        if (vkAcquireNextImageKHR(ctx.device(), swapchain, UINT64_MAX, VK_NULL_HANDLE,
+                                  VK_NULL_HANDLE, &index) != VK_SUCCESS) {
+            state.SkipWithError("vkAcquireNextImageKHR failed");
+            break;
+        }
+        presentInfo.pImageIndices = &index;
+        if (vkQueuePresentKHR(ctx.queue(), &presentInfo) != VK_SUCCESS) {
+            state.SkipWithError("vkQueuePresentKHR failed");
+            break;
+        }
+    }
+}
+BENCHMARK(BM_AcquirePresent)->Arg(2)->Arg(3);
+
+// Swapchain (re)creation, as on every rotation or resize.
+void BM_RecreateSwapchain(benchmark::State& state) {
+    Context ctx;
+    if (!ctx.init(state, true)) return;
+    while (state.KeepRunning()) {
+        if (!ctx.recreateSwapchain()) {
+            state.SkipWithError("vkCreateSwapchainKHR failed");
+            break;
+        }
+    }
+}
+BENCHMARK(BM_RecreateSwapchain);
+
+}  // namespace
+}  // namespace android
+
+BENCHMARK_MAIN();